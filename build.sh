@@ -34,6 +34,7 @@ do
         "debug"          ) debug=1;;
         "dev"            ) dev=1;;
         "test"           ) test=1;;
+        "bench"          ) bench=1;;
         "clean-logs"     ) clean_logs=1;;
         "clang"          ) clang=1;;
         "ci"             ) builddir="cmake_ci/";;
@@ -65,6 +66,7 @@ Special CI options:
   ci                 Use the CI build directory (cmake_ci/).
   clang              Use clang as the compiler.
   test               Run tests after building.
+  bench              Build and run the micro-benchmarks (JSON output).
 
 If no options are provided, the script will build the sources.
 If the -d option is provided, the script will build, install, restart,
@@ -178,6 +180,17 @@ else
     cp pihole-FTL ../
 fi
 
+# If we are asked to run the micro-benchmarks, we do this here
+if [[ -n "${bench}" ]]; then
+    cmake --build . --target pihole-FTL-bench -- ${MAKEFLAGS}
+    ./pihole-FTL-bench
+fi
+
+# The performance stage of the tests runs the micro-benchmarks, too
+if [[ -n "${test}" && -z "${bench}" ]]; then
+    cmake --build . --target pihole-FTL-bench -- ${MAKEFLAGS}
+fi
+
 # If we are asked to run tests, we do this here
 if [[ -n "${test}" ]]; then
     cd ..
@@ -26,4 +26,19 @@ patch -p1 < patch/civetweb/0001-Expose-bound-to-addresses-from-CivetWeb-to-the-f
 echo "Applying patch 0001-Increase-niceness-of-all-civetweb-threads-as-DNS-ope.patch"
 patch -p1 < patch/civetweb/0001-Increase-niceness-of-all-civetweb-threads-as-DNS-ope.patch
 
+echo "Applying patch 0001-Expose-number-of-bytes-sent-on-a-connection.patch"
+patch -p1 < patch/civetweb/0001-Expose-number-of-bytes-sent-on-a-connection.patch
+
+echo "Applying patch 0001-Send-immutable-cache-header-for-versioned-static-files.patch"
+patch -p1 < patch/civetweb/0001-Send-immutable-cache-header-for-versioned-static-files.patch
+
+echo "Applying patch 0001-Cache-compiled-Lua-server-pages.patch"
+patch -p1 < patch/civetweb/0001-Cache-compiled-Lua-server-pages.patch
+
+echo "Applying patch 0001-Retire-idle-worker-threads.patch"
+patch -p1 < patch/civetweb/0001-Retire-idle-worker-threads.patch
+
+echo "Applying patch 0001-Enable-TLS-session-resumption.patch"
+patch -p1 < patch/civetweb/0001-Enable-TLS-session-resumption.patch
+
 echo "ALL PATCHES APPLIED OKAY"
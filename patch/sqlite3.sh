@@ -3,5 +3,6 @@ set -e
 
 patch -p1 < patch/sqlite3/0001-print-FTL-version-in-interactive-shell.patch
 patch -p1 < patch/sqlite3/0002-make-sqlite3ErrName-public.patch
+patch -p1 < patch/sqlite3/0003-add-bwlimit-option-to-sqlite3_rsync.patch
 
 echo "ALL PATCHES APPLIED OKAY"
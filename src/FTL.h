@@ -55,9 +55,6 @@
 // How many client connection do we accept at once?
 #define MAXCONNS 255
 
-// Over how many queries do we iterate at most when trying to find a match?
-#define MAXITER 1000
-
 // How many hours do we want to store in FTL's memory? [hours]
 #define MAXLOGAGE 24u
 
@@ -75,6 +72,13 @@
 // would incorrectly be located at Mon 08:15:00
 #define OVERTIME_SLOTS ((MAXLOGAGE*3600)/OVERTIME_INTERVAL + 1)
 
+// Finer overTime tiers kept in addition to the OVERTIME_INTERVAL slots above
+// Default: 10 seconds for the last hour and one minute for the last six hours
+#define OVERTIME_FINE_INTERVAL 10u
+#define OVERTIME_FINE_SLOTS (3600u/OVERTIME_FINE_INTERVAL)
+#define OVERTIME_MINUTE_INTERVAL 60u
+#define OVERTIME_MINUTE_SLOTS (6u*3600u/OVERTIME_MINUTE_INTERVAL)
+
 // Interval for re-resolving ALL known host names [seconds]
 // Default: 3600 (once every hour)
 #define RERESOLVE_INTERVAL 3600
@@ -168,7 +172,9 @@
 #define recv(sockfd, buf, len, flags) FTLrecv(sockfd, buf, len, flags, true, __FILE__,  __FUNCTION__,  __LINE__)
 #define recv_nowarn(sockfd, buf, len, flags) FTLrecv(sockfd, buf, len, flags,false,  __FILE__,  __FUNCTION__,  __LINE__)
 #define recvfrom(sockfd, buf, len, flags, src_addr, addrlen) FTLrecvfrom(sockfd, buf, len, flags, src_addr, addrlen, __FILE__,  __FUNCTION__,  __LINE__)
+#define recvmmsg(sockfd, msgvec, vlen, flags) FTLrecvmmsg(sockfd, msgvec, vlen, flags, __FILE__,  __FUNCTION__,  __LINE__)
 #define sendto(sockfd, buf, len, flags, dest_addr, addrlen) FTLsendto(sockfd, buf, len, flags, dest_addr, addrlen, __FILE__,  __FUNCTION__,  __LINE__)
+#define sendmmsg(sockfd, msgvec, vlen, flags) FTLsendmmsg(sockfd, msgvec, vlen, flags, __FILE__,  __FUNCTION__,  __LINE__)
 #define select(nfds, readfds, writefds, exceptfds, timeout) FTLselect(nfds, readfds, writefds, exceptfds, timeout, __FILE__,  __FUNCTION__,  __LINE__)
 #define pthread_mutex_lock(mutex) FTLpthread_mutex_lock(mutex, __FILE__,  __FUNCTION__,  __LINE__)
 #define fopen(pathname, mode) FTLfopen(pathname, mode, __FILE__,  __FUNCTION__,  __LINE__)
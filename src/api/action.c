@@ -22,6 +22,8 @@
 // flush_network_table()
 #include "database/network-table.h"
 #include "config/config.h"
+// run_profile()
+#include "profiler.h"
 
 static int run_and_stream_command(struct ftl_conn *api, const char *path, const char *const args[])
 {
@@ -172,3 +174,56 @@ int api_action_flush_arp(struct ftl_conn *api)
 		                       "Cannot flush the ARP tables",
 		                       NULL);
 }
+
+int api_action_profile(struct ftl_conn *api)
+{
+	unsigned int seconds = PROFILE_SECONDS, hz = PROFILE_HZ;
+	const char *qs = api->request->query_string;
+	if(qs != NULL)
+	{
+		const char *msg = NULL;
+		if((!get_uint_var_msg(qs, "seconds", &seconds, &msg) && msg != NULL) ||
+		   (!get_uint_var_msg(qs, "hz", &hz, &msg) && msg != NULL))
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Invalid request: Invalid profiling parameter",
+			                       msg);
+	}
+	if(seconds < 1 || seconds > PROFILE_MAX_SECONDS || hz < 1 || hz > PROFILE_MAX_HZ)
+	{
+		char hint[96];
+		snprintf(hint, sizeof(hint), "seconds has to be in [1, %u] and hz in [1, %u]",
+		         PROFILE_MAX_SECONDS, PROFILE_MAX_HZ);
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "Invalid request: Profiling parameter out of range",
+		                       hint);
+	}
+
+	struct profile_result result = { 0 };
+	switch(run_profile(seconds, hz, &result))
+	{
+		case PROFILE_OK:
+			break;
+		case PROFILE_BUSY:
+			return send_json_error(api, 429,
+			                       "busy",
+			                       "Another profile is already running",
+			                       NULL);
+		case PROFILE_UNSUPPORTED:
+			return send_json_error(api, 501,
+			                       "not_implemented",
+			                       "Profiling is not supported",
+			                       "pihole-FTL has not been compiled with glibc/backtrace support");
+		case PROFILE_FAILED:
+		default:
+			return send_json_error(api, 500,
+			                       "server_error",
+			                       "Profiling failed",
+			                       NULL);
+	}
+
+	send_http(api, "text/plain; charset=utf-8", result.folded);
+	free(result.folded);
+	return 200;
+}
@@ -14,13 +14,50 @@
 #include "webserver/http-common.h"
 #include "webserver/json_macros.h"
 #include "api.h"
+// api_stats_record()
+#include "api/endpoint_stats.h"
 #include "shmem.h"
 // exit_code
 #include "signals.h"
 // struct config
 #include "config/config.h"
+// get_webserver_threads()
+#include "webserver/webserver.h"
+// json_arena_begin()
+#include "webserver/json-arena.h"
+// ceil()
+#include <math.h>
+// FTL_PROBE()
+#include "probes.h"
 
 static int api_endpoints(struct ftl_conn *api);
+static int api_batch(struct ftl_conn *api);
+
+// Maximum number of requests which can be combined using /api/batch
+#define API_BATCH_MAX 32
+
+// Cost classes of API endpoints. Cheap requests are always answered right
+// away, expensive ones (API_HEAVY and API_BULK) are processed up to a limit per
+// class at the same time and wait for a free slot otherwise
+enum api_cost {
+	API_COST_CHEAP,
+	API_COST_HEAVY,
+	API_COST_BULK,
+	API_COSTS
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t slot[API_COSTS];
+	unsigned int running[API_COSTS];
+	unsigned int waiting[API_COSTS];
+	// Moving average of the processing time in seconds, used to tell
+	// rejected clients when to try again
+	double duration[API_COSTS];
+} admission = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.slot = { PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER }
+};
 
 static struct {
 	const char *uri;
@@ -30,89 +67,193 @@ static struct {
 	bool require_auth;
 	enum http_method methods;
 } api_request[] = {
-	// URI                                      ARGUMENTS                     FUNCTION                               OPTIONS                                        AUTH   ALLOWED METHODS
+	// URI                                      ARGUMENTS                     FUNCTION                               OPTIONS                                          AUTH   ALLOWED METHODS
 	//                                                                                                               flags             fifo ID
 	// Note: The order of appearance matters here, more specific URIs have to
 	// appear *before* less specific URIs: 1. "/a/b/c", 2. "/a/b", 3. "/a"
-	{ "/api/auth/sessions",                     "",                           api_auth_sessions,                     { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/auth/session",                      "/{id}",                      api_auth_session_delete,               { API_PARSE_JSON, 0                         }, true,  HTTP_DELETE },
-	{ "/api/auth/app",                          "",                           generateAppPw,                         { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/auth/totp",                         "",                           generateTOTP,                          { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/auth",                              "",                           api_auth,                              { API_PARSE_JSON, 0                         }, false, HTTP_GET | HTTP_POST | HTTP_DELETE },
-	{ "/api/dns/blocking",                      "",                           api_dns_blocking,                      { API_PARSE_JSON, 0                         }, true,  HTTP_GET | HTTP_POST },
-	{ "/api/clients/_suggestions",              "",                           api_client_suggestions,                { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/clients",                           "/{client}",                  api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
-	{ "/api/clients",                           "",                           api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/clients:batchDelete",               "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0       }, true,  HTTP_POST },
-	{ "/api/domains",                           "/{type}/{kind}/{domain}",    api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
-	{ "/api/domains",                           "/{type}/{kind}",             api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/domains:batchDelete",               "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0       }, true,  HTTP_POST },
-	{ "/api/search",                            "/{domain}",                  api_search,                            { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/groups",                            "/{name}",                    api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
-	{ "/api/groups",                            "",                           api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/groups:batchDelete",                "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0       }, true,  HTTP_POST },
-	{ "/api/lists",                             "/{list}",                    api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
-	{ "/api/lists",                             "",                           api_list,                              { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/lists:batchDelete",                 "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0       }, true,  HTTP_POST },
-	{ "/api/info/client",                       "",                           api_info_client,                       { API_PARSE_JSON, 0                         }, false, HTTP_GET },
-	{ "/api/info/login",                        "",                           api_info_login,                        { API_PARSE_JSON, 0                         }, false, HTTP_GET },
-	{ "/api/info/system",                       "",                           api_info_system,                       { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/database",                     "",                           api_info_database,                     { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/sensors",                      "",                           api_info_sensors,                      { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/host",                         "",                           api_info_host,                         { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/ftl",                          "",                           api_info_ftl,                          { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/version",                      "",                           api_info_version,                      { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/messages/count",               "",                           api_info_messages_count,               { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/messages",                     "/{message_id}",              api_info_messages,                     { API_PARSE_JSON, 0                         }, true,  HTTP_DELETE },
-	{ "/api/info/messages",                     "",                           api_info_messages,                     { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/info/metrics",                      "",                           api_info_metrics,                      { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/logs/dnsmasq",                      "",                           api_logs,                              { API_PARSE_JSON, FIFO_DNSMASQ              }, true,  HTTP_GET },
-	{ "/api/logs/ftl",                          "",                           api_logs,                              { API_PARSE_JSON, FIFO_FTL                  }, true,  HTTP_GET },
-	{ "/api/logs/webserver",                    "",                           api_logs,                              { API_PARSE_JSON, FIFO_WEBSERVER            }, true,  HTTP_GET },
-	{ "/api/history/clients",                   "",                           api_history_clients,                   { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/history/database/clients",          "",                           api_history_database_clients,          { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/history/database",                  "",                           api_history_database,                  { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/history",                           "",                           api_history,                           { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/queries/suggestions",               "",                           api_queries_suggestions,               { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/queries",                           "",                           api_queries,                           { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/summary",                     "",                           api_stats_summary,                     { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/query_types",                 "",                           api_stats_query_types,                 { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/upstreams",                   "",                           api_stats_upstreams,                   { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/top_domains",                 "",                           api_stats_top_domains,                 { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/top_clients",                 "",                           api_stats_top_clients,                 { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/recent_blocked",              "",                           api_stats_recentblocked,               { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/database/top_domains",        "",                           api_stats_database_top_items,          { API_DOMAINS | API_PARSE_JSON, 0           }, true,  HTTP_GET },
-	{ "/api/stats/database/top_clients",        "",                           api_stats_database_top_items,          { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/database/summary",            "",                           api_stats_database_summary,            { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/database/query_types",        "",                           api_stats_database_query_types,        { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/stats/database/upstreams",          "",                           api_stats_database_upstreams,          { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/config",                            "",                           api_config,                            { API_PARSE_JSON, 0                         }, true,  HTTP_GET | HTTP_PATCH },
-	{ "/api/config",                            "/{element}",                 api_config,                            { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/config",                            "/{element}/{value}",         api_config,                            { API_PARSE_JSON, 0                         }, true,  HTTP_DELETE | HTTP_PUT },
-	{ "/api/network/gateway",                   "",                           api_network_gateway,                   { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/network/routes",                    "",                           api_network_routes,                    { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/network/interfaces",                "",                           api_network_interfaces,                { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/network/devices",                   "",                           api_network_devices,                   { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/network/devices",                   "/{device_id}",               api_network_devices,                   { API_PARSE_JSON, 0                         }, true,  HTTP_DELETE },
-	{ "/api/endpoints",                         "",                           api_endpoints,                         { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/teleporter",                        "",                           api_teleporter,                        { API_FLAG_NONE, 0                          }, true,  HTTP_GET | HTTP_POST },
-	{ "/api/dhcp/leases",                       "",                           api_dhcp_leases_GET,                   { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/dhcp/leases",                       "/{ip}",                      api_dhcp_leases_DELETE,                { API_PARSE_JSON, 0                         }, true,  HTTP_DELETE },
-	{ "/api/action/gravity",                    "",                           api_action_gravity,                    { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/action/restartdns",                 "",                           api_action_restartDNS,                 { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/action/flush/logs",                 "",                           api_action_flush_logs,                 { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/action/flush/arp",                  "",                           api_action_flush_arp,                  { API_PARSE_JSON, 0                         }, true,  HTTP_POST },
-	{ "/api/padd",                              "",                           api_padd,                              { API_PARSE_JSON, 0                         }, true,  HTTP_GET },
-	{ "/api/docs",                              "",                           api_docs,                              { API_PARSE_JSON, 0                         }, false, HTTP_GET },
+	{ "/api/auth/sessions",                     "",                           api_auth_sessions,                     { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/auth/session",                      "/{id}",                      api_auth_session_delete,               { API_PARSE_JSON, 0                           }, true,  HTTP_DELETE },
+	{ "/api/auth/app",                          "",                           generateAppPw,                         { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/auth/totp",                         "",                           generateTOTP,                          { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/auth",                              "",                           api_auth,                              { API_PARSE_JSON, 0                           }, false, HTTP_GET | HTTP_POST | HTTP_DELETE },
+	{ "/api/dns/blocking",                      "",                           api_dns_blocking,                      { API_PARSE_JSON, 0                           }, true,  HTTP_GET | HTTP_POST },
+	{ "/api/clients/_suggestions",              "",                           api_client_suggestions,                { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/clients",                           "/{client}",                  api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
+	{ "/api/clients",                           "",                           api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/clients:batchDelete",               "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0         }, true,  HTTP_POST },
+	{ "/api/domains",                           "/{type}/{kind}/{domain}",    api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
+	{ "/api/domains",                           "/{type}/{kind}",             api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/domains:batchDelete",               "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0         }, true,  HTTP_POST },
+	{ "/api/domains:import",                    "",                           api_list_import,                       { API_BULK, 0                                 }, true,  HTTP_POST },
+	{ "/api/search",                            "/{domain}",                  api_search,                            { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/groups",                            "/{name}",                    api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
+	{ "/api/groups",                            "",                           api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/groups:batchDelete",                "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0         }, true,  HTTP_POST },
+	{ "/api/lists",                             "/{list}",                    api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_GET | HTTP_PUT | HTTP_DELETE },
+	{ "/api/lists",                             "",                           api_list,                              { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/lists:batchDelete",                 "",                           api_list,                              { API_PARSE_JSON | API_BATCHDELETE, 0         }, true,  HTTP_POST },
+	{ "/api/lists:import",                      "",                           api_list_import,                       { API_BULK, 0                                 }, true,  HTTP_POST },
+	{ "/api/info/client",                       "",                           api_info_client,                       { API_PARSE_JSON, 0                           }, false, HTTP_GET },
+	{ "/api/info/login",                        "",                           api_info_login,                        { API_PARSE_JSON, 0                           }, false, HTTP_GET },
+	{ "/api/info/system",                       "",                           api_info_system,                       { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/database",                     "",                           api_info_database,                     { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/sensors",                      "",                           api_info_sensors,                      { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/host",                         "",                           api_info_host,                         { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/ftl",                          "",                           api_info_ftl,                          { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/version",                      "",                           api_info_version,                      { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/messages/count",               "",                           api_info_messages_count,               { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/messages",                     "/{message_id}",              api_info_messages,                     { API_PARSE_JSON, 0                           }, true,  HTTP_DELETE },
+	{ "/api/info/messages",                     "",                           api_info_messages,                     { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/api_stats",                    "",                           api_info_api_stats,                    { API_FLAG_NONE, 0                            }, true,  HTTP_GET },
+	{ "/api/info/latency",                      "",                           api_info_latency,                      { API_FLAG_NONE, 0                            }, true,  HTTP_GET },
+	{ "/api/info/memory",                       "",                           api_info_memory,                       { API_FLAG_NONE, 0                            }, true,  HTTP_GET },
+	{ "/api/info/locks",                        "",                           api_info_locks,                        { API_FLAG_NONE, 0                            }, true,  HTTP_GET | HTTP_DELETE },
+	{ "/api/info/metrics",                      "",                           api_info_metrics,                      { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/info/cache",                        "",                           api_info_cache,                        { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/logs/dnsmasq",                      "",                           api_logs,                              { API_PARSE_JSON, FIFO_DNSMASQ                }, true,  HTTP_GET },
+	{ "/api/logs/ftl",                          "",                           api_logs,                              { API_PARSE_JSON, FIFO_FTL                    }, true,  HTTP_GET },
+	{ "/api/logs/webserver",                    "",                           api_logs,                              { API_PARSE_JSON, FIFO_WEBSERVER              }, true,  HTTP_GET },
+	{ "/api/history/clients",                   "",                           api_history_clients,                   { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/history/database/clients",          "",                           api_history_database_clients,          { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/history/database",                  "",                           api_history_database,                  { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/history",                           "",                           api_history,                           { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/queries/suggestions",               "",                           api_queries_suggestions,               { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/queries/stream",                    "",                           api_queries_stream,                    { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/queries/export",                    "",                           api_queries_export,                    { API_PARSE_JSON | API_BULK, 0                }, true,  HTTP_GET },
+	{ "/api/queries",                           "",                           api_queries,                           { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/stats/summary",                     "",                           api_stats_summary,                     { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/stats/query_types",                 "",                           api_stats_query_types,                 { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/stats/upstreams",                   "",                           api_stats_upstreams,                   { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/stats/top_domains",                 "",                           api_stats_top_domains,                 { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/stats/top_clients",                 "",                           api_stats_top_clients,                 { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/stats/recent_blocked",              "",                           api_stats_recentblocked,               { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/stats/database/top_domains",        "",                           api_stats_database_top_items,          { API_DOMAINS | API_PARSE_JSON | API_HEAVY, 0 }, true,  HTTP_GET },
+	{ "/api/stats/database/top_clients",        "",                           api_stats_database_top_items,          { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/stats/database/summary",            "",                           api_stats_database_summary,            { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/stats/database/query_types",        "",                           api_stats_database_query_types,        { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/stats/database/upstreams",          "",                           api_stats_database_upstreams,          { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/config",                            "",                           api_config,                            { API_PARSE_JSON, 0                           }, true,  HTTP_GET | HTTP_PATCH },
+	{ "/api/config",                            "/{element}",                 api_config,                            { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/config",                            "/{element}/{value}",         api_config,                            { API_PARSE_JSON, 0                           }, true,  HTTP_DELETE | HTTP_PUT },
+	{ "/api/network/gateway",                   "",                           api_network_gateway,                   { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/network/routes",                    "",                           api_network_routes,                    { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/network/interfaces",                "",                           api_network_interfaces,                { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/network/devices",                   "",                           api_network_devices,                   { API_PARSE_JSON | API_HEAVY, 0               }, true,  HTTP_GET },
+	{ "/api/network/devices",                   "/{device_id}",               api_network_devices,                   { API_PARSE_JSON, 0                           }, true,  HTTP_DELETE },
+	{ "/api/endpoints",                         "",                           api_endpoints,                         { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/batch",                             "",                           api_batch,                             { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/teleporter",                        "",                           api_teleporter,                        { API_BULK, 0                                 }, true,  HTTP_GET | HTTP_POST },
+	{ "/api/dhcp/leases",                       "",                           api_dhcp_leases_GET,                   { API_PARSE_JSON, 0                           }, true,  HTTP_GET },
+	{ "/api/dhcp/leases",                       "/{ip}",                      api_dhcp_leases_DELETE,                { API_PARSE_JSON, 0                           }, true,  HTTP_DELETE },
+	{ "/api/action/gravity",                    "",                           api_action_gravity,                    { API_PARSE_JSON | API_BULK, 0                }, true,  HTTP_POST },
+	{ "/api/action/restartdns",                 "",                           api_action_restartDNS,                 { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/action/flush/logs",                 "",                           api_action_flush_logs,                 { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/action/flush/arp",                  "",                           api_action_flush_arp,                  { API_PARSE_JSON, 0                           }, true,  HTTP_POST },
+	{ "/api/action/profile",                    "",                           api_action_profile,                    { API_BULK, 0                                 }, true,  HTTP_POST },
+	{ "/api/metrics",                           "",                           api_metrics,                           { API_FLAG_NONE, 0                            }, true,  HTTP_GET },
+	{ "/api/padd",                              "",                           api_padd,                              { API_PARSE_JSON | API_CACHE, 0               }, true,  HTTP_GET },
+	{ "/api/federation/summary",                "",                           api_federation_summary,                { API_FLAG_NONE, 0                            }, false, HTTP_GET },
+	{ "/api/federation/peers",                  "",                           api_federation_peers,                  { API_FLAG_NONE, 0                            }, true,  HTTP_GET },
+	{ "/api/federation/gravity/block",          "",                           api_federation_gravity_block,          { API_FLAG_NONE, 0                            }, false, HTTP_GET },
+	{ "/api/federation/gravity",                "",                           api_federation_gravity,                { API_FLAG_NONE, 0                            }, false, HTTP_GET },
+	{ "/api/docs",                              "",                           api_docs,                              { API_PARSE_JSON, 0                           }, false, HTTP_GET },
 };
 
-int api_handler(struct mg_connection *conn, void *ignored)
+// Every endpoint needs a slot for its request statistics
+_Static_assert(ArraySize(api_request) <= API_STATS_ENDPOINTS, "Too many API endpoints for the request statistics");
+
+static enum api_cost __attribute__((const)) get_api_cost(const enum api_flags flags)
 {
-	// Unused, but required by CivetWeb
-	// This is a no-op but suppresses the warning "unused parameter
-	// 'ignored'" on modern compilers
-	(void)ignored;
+	if(flags & API_BULK)
+		return API_COST_BULK;
+	if(flags & API_HEAVY)
+		return API_COST_HEAVY;
+	return API_COST_CHEAP;
+}
+
+/**
+ * Admit an expensive request. Requests which cannot be processed right away
+ * wait up to webserver.pool.wait milliseconds for a free slot of their class.
+ * Waiting requests occupy a worker thread, too, so the total number of
+ * expensive requests never leaves fewer than webserver.pool.reserved threads
+ * for all other requests.
+ *
+ * @param cost The cost class of the request
+ * @return 0 if the request has been admitted, otherwise the number of seconds
+ *         after which the client should try again
+ */
+static unsigned int admission_begin(const enum api_cost cost)
+{
+	const unsigned int threads = get_webserver_threads();
+	const unsigned int expensive = threads - min(config.webserver.pool.reserved.v.ui, threads - 1);
+	const unsigned int limit = max(cost == API_COST_BULK ? config.webserver.pool.bulk.v.ui :
+	                                                       config.webserver.pool.heavy.v.ui, 1u);
+
+	pthread_mutex_lock(&admission.lock);
+	unsigned int occupied = 0;
+	for(enum api_cost c = API_COST_HEAVY; c < API_COSTS; c++)
+		occupied += admission.running[c] + admission.waiting[c];
+
+	if(occupied < expensive)
+	{
+		// Arriving requests queue up behind those already waiting
+		if(admission.waiting[cost] == 0 && admission.running[cost] < limit)
+		{
+			admission.running[cost]++;
+			pthread_mutex_unlock(&admission.lock);
+			return 0;
+		}
+
+		if(config.webserver.pool.wait.v.ui > 0)
+		{
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			const unsigned int wait = config.webserver.pool.wait.v.ui;
+			deadline.tv_sec += wait / 1000u;
+			deadline.tv_nsec += (wait % 1000u) * 1000000L;
+			if(deadline.tv_nsec >= 1000000000L)
+			{
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+
+			admission.waiting[cost]++;
+			int rc = 0;
+			while(admission.running[cost] >= limit && rc != ETIMEDOUT)
+				rc = pthread_cond_timedwait(&admission.slot[cost], &admission.lock, &deadline);
+			admission.waiting[cost]--;
 
+			if(admission.running[cost] < limit)
+			{
+				admission.running[cost]++;
+				pthread_mutex_unlock(&admission.lock);
+				return 0;
+			}
+		}
+	}
+
+	// Suggest trying again once the requests ahead are likely done
+	const double retry = ceil(admission.duration[cost] * (admission.running[cost] + admission.waiting[cost]) / limit);
+	pthread_mutex_unlock(&admission.lock);
+
+	return retry < 1.0 ? 1u : retry > 60.0 ? 60u : (unsigned int)retry;
+}
+
+// Release the slot of an expensive request and hand it to the next waiting
+// request of the same class (if any)
+static void admission_end(const enum api_cost cost, const uint64_t nsec)
+{
+	pthread_mutex_lock(&admission.lock);
+	admission.running[cost]--;
+	const double duration = 1e-9*nsec;
+	admission.duration[cost] = admission.duration[cost] > 0.0 ?
+	                           0.8*admission.duration[cost] + 0.2*duration : duration;
+	pthread_cond_signal(&admission.slot[cost]);
+	pthread_mutex_unlock(&admission.lock);
+}
+
+static int handle_api_request(struct mg_connection *conn)
+{
 	// Prepare API info struct
 	struct ftl_conn api = {
 		conn,
@@ -126,7 +267,9 @@ int api_handler(struct mg_connection *conn, void *ignored)
 		{ false, NULL, NULL, NULL, 0u },
 		{ false },
 		NULL,
-		{ API_FLAG_NONE, 0 }
+		{ API_FLAG_NONE, 0 },
+		{ NULL, 0u },
+		NULL
 	};
 
 	log_debug(DEBUG_API, "Requested API URI: %s -> %s %s ? %s (Content-Type %s)",
@@ -140,6 +283,7 @@ int api_handler(struct mg_connection *conn, void *ignored)
 
 	// Loop over all API endpoints and check if the requested URI matches
 	bool unauthorized = false;
+	unsigned int retry_after = 0;
 	enum http_method allowed_methods = 0;
 	for(unsigned int i = 0; i < ArraySize(api_request); i++)
 	{
@@ -185,17 +329,47 @@ int api_handler(struct mg_connection *conn, void *ignored)
 				break;
 			}
 
-			// Call the API function and get the return code
-			log_debug(DEBUG_API, "Processing %s %s in %s",
-			          api.request->request_method,
-			          api.request->local_uri_raw,
-			          api_request[i].uri);
-			ret = api_request[i].func(&api);
-			log_debug(DEBUG_API, "Done");
+			// Expensive requests must not occupy the threads
+			// reserved for cheap ones
+			const enum api_cost cost = get_api_cost(api_request[i].opts.flags);
+			if(cost != API_COST_CHEAP && (retry_after = admission_begin(cost)) > 0)
+				break;
+
+			// Measure how long answering the request takes, how
+			// much of this is spent on SHM locks and how large
+			// the response is
+			const uint64_t start = api_stats_clock();
+			const uint64_t lock_start = get_thread_lock_time();
+			const long long bytes_start = my_get_bytes_sent(conn);
+
+			// Answer from the response cache if the data has not
+			// changed since the last identical request
+			if(!(api_request[i].opts.flags & API_CACHE) ||
+			   (ret = api_cache_lookup(&api, api_request[i].uri)) == 0)
+			{
+				// Call the API function and get the return code
+				log_debug(DEBUG_API, "Processing %s %s in %s",
+				          api.request->request_method,
+				          api.request->local_uri_raw,
+				          api_request[i].uri);
+				ret = api_request[i].func(&api);
+				log_debug(DEBUG_API, "Done");
+			}
+
+			const uint64_t elapsed = api_stats_clock() - start;
+			api_stats_record(i, api_request[i].uri, elapsed,
+			                 get_thread_lock_time() - lock_start,
+			                 my_get_bytes_sent(conn) - bytes_start);
+			if(cost != API_COST_CHEAP)
+				admission_end(cost, elapsed);
+			FTL_PROBE(api_request, api_request[i].uri, api.method, ret, elapsed);
 			break;
 		}
 	}
 
+	// Free cache key of responses which have not been sent
+	api_cache_release(&api);
+
 	// Free memory allocated for action path (if allocated)
 	if(api.action_path != NULL)
 	{
@@ -225,6 +399,19 @@ int api_handler(struct mg_connection *conn, void *ignored)
 		return send_json_unauthorized(&api);
 	}
 
+	if(retry_after > 0)
+	{
+		log_debug(DEBUG_API, "Rejecting %s %s, too many expensive requests in progress (retry after %us)",
+		          api.request->request_method, api.request->local_uri_raw, retry_after);
+		const size_t len = strlen(pi_hole_extra_headers);
+		snprintf(pi_hole_extra_headers + len, sizeof(pi_hole_extra_headers) - len,
+		         "Retry-After: %u\r\n", retry_after);
+		return send_json_error(&api, 429,
+		                       "busy",
+		                       "Too many expensive requests in progress, try again later",
+		                       api.request->local_uri_raw);
+	}
+
 	// The HTTP OPTIONS method requests permitted communication options for
 	// a given URL or server. We no not implement the wildcard OPTIONS method
 	// but instead return the allowed methods for the requested endpoint
@@ -262,9 +449,31 @@ int api_handler(struct mg_connection *conn, void *ignored)
 		                      api.request->local_uri_raw);
 	}
 
-	// Restart FTL if requested
+	// Restart FTL if requested once further changes (if any) settled
 	if(api.ftl.restart)
-		restart_ftl(api.ftl.restart_reason);
+		schedule_restart_ftl(api.ftl.restart_reason);
+
+	return ret;
+}
+
+int api_handler(struct mg_connection *conn, void *ignored)
+{
+	// Unused, but required by CivetWeb
+	// This is a no-op but suppresses the warning "unused parameter
+	// 'ignored'" on modern compilers
+	(void)ignored;
+
+	// The cJSON objects built while reading are freed once the response
+	// has been sent, allocate them from the arena. Other requests may
+	// store parts of their payload (e.g. in the config)
+	const bool arena = http_method(conn) == HTTP_GET;
+	if(arena)
+		json_arena_begin();
+
+	const int ret = handle_api_request(conn);
+
+	if(arena)
+		json_arena_end();
 
 	return ret;
 }
@@ -329,3 +538,132 @@ static int api_endpoints(struct ftl_conn *api)
 	// Send response
 	JSON_SEND_OBJECT(json);
 }
+
+// Answer a single request of a batch. The response is stored in the given
+// object. The caller holds the shared SHM lock
+static void batch_request(struct ftl_conn *api, const char *uri, cJSON *result)
+{
+	struct batch_response response = { 500, NULL };
+
+	// Split request into path and query string
+	char path[128];
+	const char *query = strchr(uri, '?');
+	const size_t len = query != NULL ? (size_t)(query - uri) : strlen(uri);
+	if(len >= sizeof(path))
+	{
+		cJSON_AddNumberToObject(result, "status", 404);
+		return;
+	}
+	memcpy(path, uri, len);
+	path[len] = '\0';
+
+	struct mg_request_info request = *api->request;
+	request.request_method = "GET";
+	request.local_uri = path;
+	request.local_uri_raw = path;
+	request.query_string = query != NULL ? query + 1 : NULL;
+
+	struct ftl_conn sub = {
+		.conn = api->conn,
+		.request = &request,
+		.method = HTTP_GET,
+		.user_id = api->user_id,
+		.now = api->now,
+		.session = api->session,
+		.batch = &response
+	};
+
+	response.code = 404;
+	for(unsigned int i = 0; i < ArraySize(api_request); i++)
+	{
+		if(!(api_request[i].methods & HTTP_GET) ||
+		   (sub.item = startsWith(api_request[i].uri, &sub)) == NULL)
+			continue;
+
+		// Only read-only statistics are answered, anything else may
+		// need the exclusive SHM lock or have side effects
+		if(!(api_request[i].opts.flags & API_CACHE))
+		{
+			response.code = 400;
+			break;
+		}
+
+		memcpy(&sub.opts, &api_request[i].opts, sizeof(sub.opts));
+		log_debug(DEBUG_API, "Processing batched GET %s in %s",
+		          uri, api_request[i].uri);
+		api_request[i].func(&sub);
+		break;
+	}
+
+	if(sub.action_path != NULL)
+		free(sub.action_path);
+
+	cJSON_AddNumberToObject(result, "status", response.code);
+	if(response.body != NULL)
+	{
+		cJSON *body = cJSON_Parse(response.body);
+		if(body != NULL)
+			cJSON_AddItemToObject(result, "response", body);
+		free(response.body);
+	}
+}
+
+/**
+ * Answer several read-only statistics requests at once. The client is
+ * authenticated only once and all responses are built from the same state of
+ * the shared memory, i.e., no queries can be added in between.
+ *
+ * @param api The API connection
+ * @return HTTP status code
+ */
+static int api_batch(struct ftl_conn *api)
+{
+	const int ret = check_json_payload(api);
+	if(ret != 0)
+		return ret;
+
+	const cJSON *requests = cJSON_GetObjectItemCaseSensitive(api->payload.json, "requests");
+	if(!cJSON_IsArray(requests))
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "No \"requests\" array in request body",
+		                       NULL);
+
+	if(cJSON_GetArraySize(requests) > API_BATCH_MAX)
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "Too many requests in batch",
+		                       NULL);
+
+	// Check all requests before processing any of them
+	const cJSON *request = NULL;
+	cJSON_ArrayForEach(request, requests)
+	{
+		if(!cJSON_IsString(request) || request->valuestring[0] != '/')
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Requests have to be paths starting with \"/api/\"",
+			                       cJSON_IsString(request) ? request->valuestring : NULL);
+	}
+
+	cJSON *responses = JSON_NEW_ARRAY();
+
+	// Keep the shared lock during all requests so the responses are
+	// consistent with each other. The requests take the shared lock
+	// themselves, this nests
+	lock_shm_read();
+	cJSON_ArrayForEach(request, requests)
+	{
+		cJSON *result = cJSON_CreateObject();
+		if(result == NULL)
+			continue;
+		cJSON_AddStringToObject(result, "uri", request->valuestring);
+		batch_request(api, request->valuestring, result);
+		cJSON_AddItemToArray(responses, result);
+	}
+	unlock_shm_read();
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(json, "responses", responses);
+	JSON_SEND_OBJECT(json);
+}
@@ -25,9 +25,13 @@
 // API router
 int api_handler(struct mg_connection *conn, void *ignored);
 
+// Response cache methods
+int api_cache_lookup(struct ftl_conn *api, const char *endpoint);
+void api_cache_store(struct ftl_conn *api, const char *mime_type, const char *msg);
+void api_cache_release(struct ftl_conn *api);
+
 // Statistic methods
 int __attribute__((pure)) cmpdesc(const void *a, const void *b);
-unsigned int get_active_clients(void);
 int api_stats_summary(struct ftl_conn *api);
 int api_stats_query_types(struct ftl_conn *api);
 int api_stats_upstreams(struct ftl_conn *api);
@@ -52,6 +56,8 @@ int api_history_database_clients(struct ftl_conn *api);
 // Query methods
 int api_queries(struct ftl_conn *api);
 int api_queries_suggestions(struct ftl_conn *api);
+int api_queries_stream(struct ftl_conn *api);
+int api_queries_export(struct ftl_conn *api);
 bool compile_filter_regex(struct ftl_conn *api, const char *path, cJSON *json, regex_t **regex, unsigned int *N_regex);
 
 // Statistics methods (database)
@@ -71,6 +77,11 @@ int api_info_version(struct ftl_conn *api);
 int api_info_messages_count(struct ftl_conn *api);
 int api_info_messages(struct ftl_conn *api);
 int api_info_metrics(struct ftl_conn *api);
+int api_info_cache(struct ftl_conn *api);
+int api_info_api_stats(struct ftl_conn *api);
+int api_info_latency(struct ftl_conn *api);
+int api_info_locks(struct ftl_conn *api);
+int api_info_memory(struct ftl_conn *api);
 int api_info_login(struct ftl_conn *api);
 cJSON *read_sys_property(const char *path);
 int get_system_obj(struct ftl_conn *api, cJSON *system);
@@ -98,6 +109,7 @@ int api_dns_blocking(struct ftl_conn *api);
 
 // List methods
 int api_list(struct ftl_conn *api);
+int api_list_import(struct ftl_conn *api);
 int api_group(struct ftl_conn *api);
 
 // Auth method
@@ -106,6 +118,7 @@ void free_api(void);
 int check_client_auth(struct ftl_conn *api, const bool is_api);
 int api_auth(struct ftl_conn *api);
 void delete_all_sessions(void);
+void expire_sessions(const time_t now);
 int api_auth_sessions(struct ftl_conn *api);
 int api_auth_session_delete(struct ftl_conn *api);
 
@@ -131,6 +144,7 @@ int api_action_gravity(struct ftl_conn *api);
 int api_action_restartDNS(struct ftl_conn *api);
 int api_action_flush_logs(struct ftl_conn *api);
 int api_action_flush_arp(struct ftl_conn *api);
+int api_action_profile(struct ftl_conn *api);
 
 // Search methods
 int api_search(struct ftl_conn *api);
@@ -141,5 +155,19 @@ int api_dhcp_leases_DELETE(struct ftl_conn *api);
 
 // PADD methods
 int api_padd(struct ftl_conn *api);
+void update_padd_snapshot(void);
+
+// Prometheus metrics
+int api_metrics(struct ftl_conn *api);
+
+// Federation methods and cluster views
+bool api_cluster_view(const struct ftl_conn *api);
+int api_federation_summary(struct ftl_conn *api);
+int api_federation_peers(struct ftl_conn *api);
+int api_federation_gravity(struct ftl_conn *api);
+int api_federation_gravity_block(struct ftl_conn *api);
+int api_stats_summary_cluster(struct ftl_conn *api);
+int api_stats_top_cluster(struct ftl_conn *api, const bool clients);
+int api_history_cluster(struct ftl_conn *api);
 
 #endif // ROUTES_H
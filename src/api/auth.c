@@ -27,10 +27,92 @@
 #include "database/session-table.h"
 // FTLDBerror()
 #include "database/common.h"
+// hashStr()
+#include "datastructure.h"
+
+// How often expired sessions are freed (seconds)
+#define SESSION_SWEEP_INTERVAL 60
 
 static uint16_t max_sessions = 0;
 static struct session *auth_data = NULL;
 
+// Open-addressing hash index of the sessions by their SID. Each slot holds
+// the position of a session in auth_data or one of the markers below. The
+// index is protected by sid_lock
+#define SID_INDEX_EMPTY -1
+#define SID_INDEX_DELETED -2
+static int32_t *sid_index = NULL;
+static uint32_t sid_index_mask = 0;
+static uint32_t sid_index_deleted = 0;
+static pthread_mutex_t sid_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t next_session_sweep = 0;
+
+// Compare two SIDs (or CSRF tokens) in constant time so the time needed to
+// reject a token does not reveal how much of it was correct
+static bool __attribute__((pure)) sid_equal(const char *a, const char *b)
+{
+	unsigned char diff = 0;
+	for(unsigned int i = 0; i < SID_SIZE; i++)
+		diff |= (unsigned char)(a[i] ^ b[i]);
+	return diff == 0;
+}
+
+// Find the session with this SID, returns -1 if there is none
+static int __attribute__((pure)) sid_index_find(const char *sid)
+{
+	uint32_t pos = hashStr(sid) & sid_index_mask;
+	for(uint32_t n = 0; n <= sid_index_mask; n++, pos = (pos + 1) & sid_index_mask)
+	{
+		const int32_t id = sid_index[pos];
+		if(id == SID_INDEX_EMPTY)
+			break;
+		if(id != SID_INDEX_DELETED && auth_data[id].used && sid_equal(auth_data[id].sid, sid))
+			return id;
+	}
+	return -1;
+}
+
+static void sid_index_add(const int id)
+{
+	uint32_t pos = hashStr(auth_data[id].sid) & sid_index_mask;
+	while(sid_index[pos] >= 0)
+		pos = (pos + 1) & sid_index_mask;
+	if(sid_index[pos] == SID_INDEX_DELETED)
+		sid_index_deleted--;
+	sid_index[pos] = id;
+}
+
+static void sid_index_rebuild(void)
+{
+	for(uint32_t pos = 0; pos <= sid_index_mask; pos++)
+		sid_index[pos] = SID_INDEX_EMPTY;
+	sid_index_deleted = 0;
+
+	for(unsigned int i = 0; i < max_sessions; i++)
+		if(auth_data[i].used)
+			sid_index_add(i);
+}
+
+static void sid_index_remove(const int id)
+{
+	uint32_t pos = hashStr(auth_data[id].sid) & sid_index_mask;
+	for(uint32_t n = 0; n <= sid_index_mask; n++, pos = (pos + 1) & sid_index_mask)
+	{
+		if(sid_index[pos] == SID_INDEX_EMPTY)
+			return;
+		if(sid_index[pos] == id)
+		{
+			sid_index[pos] = SID_INDEX_DELETED;
+			sid_index_deleted++;
+			break;
+		}
+	}
+
+	// Too many deleted slots make lookups of unknown SIDs slow
+	if(sid_index_deleted > (sid_index_mask + 1) / 4)
+		sid_index_rebuild();
+}
+
 static void add_request_info(struct ftl_conn *api, const char *csrf)
 {
 	// Copy CSRF token into request
@@ -56,6 +138,19 @@ void init_api(void)
 
 	if(!FTLDBerror())
 		restore_db_sessions(auth_data, max_sessions);
+
+	// The index has at least twice as many slots as there are sessions
+	uint32_t size = 16;
+	while(size < 2u*max_sessions)
+		size <<= 1;
+	sid_index = calloc(size, sizeof(*sid_index));
+	if(sid_index == NULL)
+	{
+		log_crit("Could not allocate memory for API session index, check config value of webserver.api.max_sessions");
+		exit(EXIT_FAILURE);
+	}
+	sid_index_mask = size - 1;
+	sid_index_rebuild();
 }
 
 void free_api(void)
@@ -65,9 +160,14 @@ void free_api(void)
 
 	// Store sessions in database
 	backup_db_sessions(auth_data, max_sessions);
+	pthread_mutex_lock(&sid_lock);
 	max_sessions = 0;
 	free(auth_data);
 	auth_data = NULL;
+	free(sid_index);
+	sid_index = NULL;
+	sid_index_mask = 0;
+	pthread_mutex_unlock(&sid_lock);
 }
 
 // Can we validate this client?
@@ -83,8 +183,9 @@ int check_client_auth(struct ftl_conn *api, const bool is_api)
 		return API_AUTH_EMPTYPASS;
 	}
 
-	// Does the client provide a session ID?
-	char sid[SID_SIZE];
+	// Does the client provide a session ID? (zero-initialized as SIDs are
+	// compared in full length)
+	char sid[SID_SIZE] = { 0 };
 	const char *sid_source = "-";
 	// Try to extract SID from cookie
 	bool sid_avail = false;
@@ -188,7 +289,7 @@ int check_client_auth(struct ftl_conn *api, const bool is_api)
 
 	// If the SID has been sent through a cookie, we require a CSRF token in
 	// the header to be sent along with the request for any API requests
-	char csrf[SID_SIZE];
+	char csrf[SID_SIZE] = { 0 };
 	const bool need_csrf = cookie_auth && is_api;
 	if(need_csrf)
 	{
@@ -210,28 +311,26 @@ int check_client_auth(struct ftl_conn *api, const bool is_api)
 	}
 
 	bool expired = false;
-	for(unsigned int i = 0; i < max_sessions; i++)
+	pthread_mutex_lock(&sid_lock);
+	const int i = sid_index != NULL ? sid_index_find(sid) : -1;
+	pthread_mutex_unlock(&sid_lock);
+	if(i >= 0)
 	{
-		if(auth_data[i].used &&
-		   strcmp(auth_data[i].sid, sid) == 0)
-		{
-			// Check if session is known but expired
-			if(auth_data[i].valid_until < now)
-				expired = true;
+		// Check if session is known but expired
+		if(auth_data[i].valid_until < now)
+			expired = true;
 
-			// Check CSRF if authentiating via cookie
-			if(need_csrf && strcmp(auth_data[i].csrf, csrf) != 0)
-			{
-				api->message = "CSRF token mismatch";
-				log_debug(DEBUG_API, "API Authentication: FAIL (%s, received \"%s\", expected \"%s\")",
-				          api->message, csrf, auth_data[i].csrf);
-				return API_AUTH_UNAUTHORIZED;
-			}
-			user_id = i;
-			break;
+		// Check CSRF if authentiating via cookie
+		if(need_csrf && !sid_equal(auth_data[i].csrf, csrf))
+		{
+			api->message = "CSRF token mismatch";
+			log_debug(DEBUG_API, "API Authentication: FAIL (%s, received \"%s\", expected \"%s\")",
+			          api->message, csrf, auth_data[i].csrf);
+			return API_AUTH_UNAUTHORIZED;
 		}
+		user_id = i;
 	}
-	if(user_id > API_AUTH_UNAUTHORIZED)
+	if(user_id > API_AUTH_UNAUTHORIZED && !expired)
 	{
 		// Authentication successful: valid session
 
@@ -351,13 +450,16 @@ static int get_session_object(struct ftl_conn *api, cJSON *json, const int user_
 	return 0;
 }
 
-static bool delete_session(const int user_id)
+// Caller has to hold sid_lock
+static bool delete_session_locked(const int user_id)
 {
 	// Skip if nothing to be done here
 	if(user_id < 0 || user_id >= max_sessions)
 		return false;
 
 	const bool was_valid = auth_data[user_id].used;
+	if(was_valid)
+		sid_index_remove(user_id);
 
 	// Zero out this session (also sets valid to false == 0)
 	memset(&auth_data[user_id], 0, sizeof(auth_data[user_id]));
@@ -365,10 +467,44 @@ static bool delete_session(const int user_id)
 	return was_valid;
 }
 
+static bool delete_session(const int user_id)
+{
+	pthread_mutex_lock(&sid_lock);
+	const bool was_valid = delete_session_locked(user_id);
+	pthread_mutex_unlock(&sid_lock);
+
+	return was_valid;
+}
+
 void delete_all_sessions(void)
 {
 	// Zero out all sessions without looping
+	pthread_mutex_lock(&sid_lock);
 	memset(auth_data, 0, max_sessions*sizeof(*auth_data));
+	if(sid_index != NULL)
+		sid_index_rebuild();
+	pthread_mutex_unlock(&sid_lock);
+}
+
+// Free expired sessions, called by the GC thread. Sessions are looked up
+// through the index so this is the only place where all of them are scanned
+void expire_sessions(const time_t now)
+{
+	if(auth_data == NULL || now < next_session_sweep)
+		return;
+	next_session_sweep = now + SESSION_SWEEP_INTERVAL;
+
+	pthread_mutex_lock(&sid_lock);
+	for(unsigned int i = 0; i < max_sessions; i++)
+	{
+		if(auth_data[i].used && auth_data[i].valid_until < now)
+		{
+			log_debug(DEBUG_API, "API: Session of client %u (%s) expired, freeing...",
+			          i, auth_data[i].remote_addr);
+			delete_session_locked(i);
+		}
+	}
+	pthread_mutex_unlock(&sid_lock);
 }
 
 static int send_api_auth_status(struct ftl_conn *api, const int user_id, const time_t now)
@@ -570,6 +706,7 @@ int api_auth(struct ftl_conn *api)
 		}
 
 		// Find unused authentication slot
+		pthread_mutex_lock(&sid_lock);
 		for(unsigned int i = 0; i < max_sessions; i++)
 		{
 			// Expired slow, mark as unused
@@ -578,7 +715,7 @@ int api_auth(struct ftl_conn *api)
 			{
 				log_debug(DEBUG_API, "API: Session of client %u (%s) expired, freeing...",
 				          i, auth_data[i].remote_addr);
-				delete_session(i);
+				delete_session_locked(i);
 			}
 
 			// Found unused authentication slot (might have been freed before)
@@ -624,10 +761,14 @@ int api_auth(struct ftl_conn *api)
 				generateSID(auth_data[i].sid);
 				generateSID(auth_data[i].csrf);
 
+				// Make the session known to check_client_auth()
+				sid_index_add(i);
+
 				user_id = i;
 				break;
 			}
 		}
+		pthread_mutex_unlock(&sid_lock);
 
 		// Debug logging
 		if(config.debug.api.v.b && user_id > API_AUTH_UNAUTHORIZED)
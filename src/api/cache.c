@@ -0,0 +1,287 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API response cache
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file cache.c
+* @brief Reuses the responses of read-only statistics endpoints.
+*
+* Dashboards and PADD instances poll the same endpoints every few seconds,
+* often from many screens at once. Responses of endpoints flagged with
+* API_CACHE are kept together with the SHM data generation they were built
+* from. As long as no exclusive SHM lock has been released since, the data
+* cannot have changed and the stored response is sent again. The age of reused
+* responses is additionally limited by webserver.api.responseCache as some
+* endpoints contain data not kept in shared memory (e.g. system load in
+* /api/padd).
+*
+* Each response carries an ETag so clients sending If-None-Match get a bodyless
+* 304 reply while the cached response is still valid.
+*/
+
+#include "FTL.h"
+#include "webserver/http-common.h"
+#include "api/api.h"
+// get_data_generation()
+#include "shmem.h"
+// log_debug()
+#include "log.h"
+// pi_hole_extra_headers
+#include "webserver/civetweb/civetweb.h"
+
+// Number of distinct responses (endpoint + query string) kept at a time
+#define API_CACHE_SLOTS 32u
+
+struct api_cache_entry {
+	char *key;
+	uint32_t hash;
+	unsigned int generation;
+	double created;
+	double last_used;
+	char mime_type[48];
+	char *body;
+	size_t len;
+	char etag[24];
+};
+
+static struct api_cache_entry cache[API_CACHE_SLOTS] = {{ 0 }};
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a hash
+static uint32_t __attribute__((pure)) hash_str(const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct api_cache_entry *find_entry(const char *key, const uint32_t hash)
+{
+	for(unsigned int i = 0; i < API_CACHE_SLOTS; i++)
+		if(cache[i].key != NULL && cache[i].hash == hash && strcmp(cache[i].key, key) == 0)
+			return &cache[i];
+	return NULL;
+}
+
+// Add the ETag header to the response, the extra headers may already contain
+// a session cookie
+static void add_etag_header(const char *etag)
+{
+	const size_t len = strlen(pi_hole_extra_headers);
+	snprintf(pi_hole_extra_headers + len, sizeof(pi_hole_extra_headers) - len,
+	         "ETag: %s\r\n", etag);
+}
+
+static const char * __attribute__((pure)) skip_ows(const char *s)
+{
+	while(*s == ' ' || *s == '\t')
+		s++;
+	return s;
+}
+
+// Check if an If-None-Match field value matches our entity tag. The value is
+// either "*" or a comma-separated list of (possibly weak) entity tags compared
+// using the weak comparison of RFC 9110, Section 8.8.3.2: the opaque tags have
+// to be identical, the W/ prefix is ignored. "*" matches any current
+// representation, i.e., every cached response
+static bool __attribute__((pure)) inm_matches(const char *inm, const char *etag)
+{
+	inm = skip_ows(inm);
+	if(*inm == '*')
+		return *skip_ows(inm + 1) == '\0';
+
+	// Our tags are always strong
+	const size_t etag_len = strlen(etag);
+	while(*inm != '\0')
+	{
+		inm = skip_ows(inm);
+		if(strncmp(inm, "W/", 2) == 0)
+			inm += 2;
+
+		// Opaque tags are quoted and may contain commas
+		const char *end = NULL;
+		if(*inm == '"' && (end = strchr(inm + 1, '"')) != NULL)
+		{
+			const size_t len = end - inm + 1;
+			if(len == etag_len && strncmp(inm, etag, len) == 0)
+				return true;
+			inm = end + 1;
+		}
+
+		// Continue with the next list element, skipping invalid ones
+		if((inm = strchr(inm, ',')) == NULL)
+			break;
+		inm++;
+	}
+
+	return false;
+}
+
+// Check if any of the If-None-Match headers of the request matches our entity
+// tag. Clients may split the list over multiple header fields
+static bool etag_matches(struct ftl_conn *api, const char *etag)
+{
+	for(int i = 0; i < api->request->num_headers; i++)
+		if(strcasecmp(api->request->http_headers[i].name, "If-None-Match") == 0 &&
+		   inm_matches(api->request->http_headers[i].value, etag))
+			return true;
+
+	return false;
+}
+
+/**
+ * Answer the request from the cache if possible. Otherwise, the cache key is
+ * stored in the connection so the response can be stored once it is sent.
+ *
+ * @param api The API connection
+ * @param endpoint The matched endpoint
+ * @return The HTTP status code sent or 0 if the request has not been answered
+ */
+int api_cache_lookup(struct ftl_conn *api, const char *endpoint)
+{
+	const unsigned int ttl = config.webserver.api.responseCache.v.ui;
+	// Only JSON responses are cached
+	// Cluster views contain data of other nodes not covered by the data
+	// generation
+	if(ttl == 0 || api->method != HTTP_GET || api_wants_cbor(api) || api_cluster_view(api))
+		return 0;
+
+	// Get the generation *before* building the response. Anything changing
+	// in the meantime makes the response outdated right away
+	const unsigned int generation = get_data_generation();
+	const char *query = api->request->query_string;
+	char *key = NULL;
+	if(asprintf(&key, "%s?%s", endpoint, query != NULL ? query : "") < 0)
+		return 0;
+	const uint32_t hash = hash_str(key, strlen(key));
+
+	pthread_mutex_lock(&cache_lock);
+	struct api_cache_entry *entry = find_entry(key, hash);
+	if(entry == NULL || entry->generation != generation ||
+	   api->now - entry->created >= ttl)
+	{
+		pthread_mutex_unlock(&cache_lock);
+
+		log_debug(DEBUG_API, "Response cache miss for %s", key);
+		api->cache.key = key;
+		api->cache.generation = generation;
+		return 0;
+	}
+
+	// Copy the response so it can be sent without holding the lock
+	entry->last_used = api->now;
+	char etag[sizeof(entry->etag)];
+	strcpy(etag, entry->etag);
+	char mime_type[sizeof(entry->mime_type)];
+	strcpy(mime_type, entry->mime_type);
+	const size_t len = entry->len;
+	char *body = NULL;
+	const bool not_modified = etag_matches(api, etag);
+	if(!not_modified && (body = malloc(len)) != NULL)
+		memcpy(body, entry->body, len);
+	pthread_mutex_unlock(&cache_lock);
+
+	if(!not_modified && body == NULL)
+	{
+		// Build the response from scratch when out of memory
+		free(key);
+		return 0;
+	}
+
+	log_debug(DEBUG_API, "Response cache hit for %s (%s)", key,
+	          not_modified ? "not modified" : "resent");
+	free(key);
+
+	add_etag_header(etag);
+	if(not_modified)
+	{
+		send_http_code(api, mime_type, 304, "");
+		return 304;
+	}
+
+	mg_send_http_ok(api->conn, mime_type, len);
+	mg_write(api->conn, body, len);
+	free(body);
+
+	return 200;
+}
+
+/**
+ * Store a response about to be sent in the cache. This is called by send_http()
+ * for requests which missed the cache in api_cache_lookup().
+ *
+ * @param api The API connection
+ * @param mime_type MIME type of the response
+ * @param msg The response body
+ */
+void api_cache_store(struct ftl_conn *api, const char *mime_type, const char *msg)
+{
+	char *key = api->cache.key;
+	api->cache.key = NULL;
+
+	const size_t len = strlen(msg);
+	char *body = malloc(len);
+	if(body == NULL)
+	{
+		free(key);
+		return;
+	}
+	memcpy(body, msg, len);
+
+	char etag[sizeof(cache[0].etag)];
+	snprintf(etag, sizeof(etag), "\"%08x-%08x\"", api->cache.generation, hash_str(msg, len));
+	add_etag_header(etag);
+
+	const uint32_t hash = hash_str(key, strlen(key));
+	pthread_mutex_lock(&cache_lock);
+
+	// Replace a previous response for the same request or, if there is
+	// none, the least recently used one
+	struct api_cache_entry *entry = find_entry(key, hash);
+	if(entry == NULL)
+	{
+		entry = &cache[0];
+		for(unsigned int i = 1; i < API_CACHE_SLOTS && entry->key != NULL; i++)
+			if(cache[i].key == NULL || cache[i].last_used < entry->last_used)
+				entry = &cache[i];
+	}
+	// Slots which have never been used are empty
+	if(entry->key != NULL)
+		free(entry->key);
+	if(entry->body != NULL)
+		free(entry->body);
+
+	entry->key = key;
+	entry->hash = hash;
+	entry->generation = api->cache.generation;
+	entry->created = api->now;
+	entry->last_used = api->now;
+	strncpy(entry->mime_type, mime_type, sizeof(entry->mime_type) - 1);
+	entry->mime_type[sizeof(entry->mime_type) - 1] = '\0';
+	entry->body = body;
+	entry->len = len;
+	strcpy(entry->etag, etag);
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+// Free the cache key of a request whose response has not been stored (e.g.
+// because an error has been sent instead)
+void api_cache_release(struct ftl_conn *api)
+{
+	if(api->cache.key == NULL)
+		return;
+
+	free(api->cache.key);
+	api->cache.key = NULL;
+}
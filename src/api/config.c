@@ -18,7 +18,7 @@
 #include "datastructure.h"
 // INT_MIN, INT_MAX, ...
 #include <limits.h>
-// writeFTLtoml()
+// schedule_config_write()
 #include "config/toml_writer.h"
 // write_dnsmasq_config()
 #include "config/dnsmasq_config.h"
@@ -584,6 +584,7 @@ int get_json_config(struct ftl_conn *api, cJSON *json, const bool detailed)
 			// Add config item flags
 			cJSON *flags = JSON_NEW_OBJECT();
 			JSON_ADD_BOOL_TO_OBJECT(flags, "restart_dnsmasq", conf_item->f & FLAG_RESTART_FTL);
+			JSON_ADD_BOOL_TO_OBJECT(flags, "reload_servers", conf_item->f & FLAG_RELOAD_SERVERS);
 			JSON_ADD_BOOL_TO_OBJECT(flags, "session_reset", conf_item->f & FLAG_INVALIDATE_SESSIONS);
 			JSON_ADD_BOOL_TO_OBJECT(flags, "env_var", conf_item->f & FLAG_ENV_VAR);
 			JSON_ADD_ITEM_TO_OBJECT(leaf, "flags", flags);
@@ -659,7 +660,8 @@ int get_json_config(struct ftl_conn *api, cJSON *json, const bool detailed)
 	return 0;
 }
 
-static int api_config_get(struct ftl_conn *api)
+// Send the full config, optionally with a summary of how changes were applied
+static int send_config(struct ftl_conn *api, cJSON *applied)
 {
 	// Parse query string parameters
 	bool detailed = false;
@@ -671,11 +673,18 @@ static int api_config_get(struct ftl_conn *api)
 
 	cJSON *json = JSON_NEW_OBJECT();
 	get_json_config(api, json, detailed);
+	if(applied != NULL)
+		JSON_ADD_ITEM_TO_OBJECT(json, "applied", applied);
 
 	// Build and return JSON response
 	JSON_SEND_OBJECT(json);
 }
 
+static int api_config_get(struct ftl_conn *api)
+{
+	return send_config(api, NULL);
+}
+
 static int api_config_patch(struct ftl_conn *api)
 {
 	// Is there a payload with valid JSON data?
@@ -706,7 +715,9 @@ static int api_config_patch(struct ftl_conn *api)
 	// Read all known config items
 	bool config_changed = false;
 	bool dnsmasq_changed = false;
+	bool servers_changed = false;
 	bool rewrite_hosts = false;
+	cJSON *changed = JSON_NEW_ARRAY();
 	struct config newconf;
 	duplicate_config(&newconf, &config);
 	for(unsigned int i = 0; i < CONFIG_ELEMENTS; i++)
@@ -733,6 +744,7 @@ static int api_config_patch(struct ftl_conn *api)
 		{
 			char *key = strdup(new_item->k);
 			free_config(&newconf);
+			cJSON_Delete(changed);
 			return send_json_error_free(api, 400,
 			                            "bad_request",
 			                            "This config option can only be set in pihole.toml, not via the API",
@@ -755,6 +767,7 @@ static int api_config_patch(struct ftl_conn *api)
 			if(hint == NULL)
 			{
 				free_config(&newconf);
+				cJSON_Delete(changed);
 				return send_json_error(api, 500,
 				                       "internal_error",
 				                       "Failed to allocate memory for hint",
@@ -764,6 +777,7 @@ static int api_config_patch(struct ftl_conn *api)
 			strcat(hint, ": ");
 			strcat(hint, response);
 			free_config(&newconf);
+			cJSON_Delete(changed);
 			return send_json_error_free(api, 400,
 			                            "bad_request",
 			                            "Config item is invalid",
@@ -779,6 +793,7 @@ static int api_config_patch(struct ftl_conn *api)
 		{
 			char *key = strdup(new_item->k);
 			free_config(&newconf);
+			cJSON_Delete(changed);
 			return send_json_error_free(api, 400,
 			                            "bad_request",
 			                            "Config items set via environment variables cannot be changed via the API",
@@ -796,6 +811,7 @@ static int api_config_patch(struct ftl_conn *api)
 
 		// Memorize that at least one config item actually changed
 		config_changed = true;
+		JSON_REF_STR_IN_ARRAY(changed, conf_item->k);
 
 		// If we reach this point, a valid setting was found and changed
 
@@ -804,6 +820,7 @@ static int api_config_patch(struct ftl_conn *api)
 		if(!conf_item->c(&new_item->v, new_item->k, errbuf))
 		{
 			free_config(&newconf);
+			cJSON_Delete(changed);
 			return send_json_error(api, 400,
 			                       "bad_request",
 			                       "Config item validation failed",
@@ -814,6 +831,11 @@ static int api_config_patch(struct ftl_conn *api)
 		if(conf_item->f & FLAG_RESTART_FTL)
 			dnsmasq_changed = true;
 
+		// Check if this item can be applied by re-reading the upstream
+		// servers instead
+		if(conf_item->f & FLAG_RELOAD_SERVERS)
+			servers_changed = true;
+
 		// Check if this item requires rewriting the HOSTS file
 		if(conf_item == &config.dns.hosts)
 			rewrite_hosts = true;
@@ -847,6 +869,21 @@ static int api_config_patch(struct ftl_conn *api)
 			else
 			{
 				free_config(&newconf);
+				cJSON_Delete(changed);
+				return send_json_error(api, 400,
+				                       "bad_request",
+				                       "Invalid configuration",
+				                       errbuf);
+			}
+		}
+		// Otherwise, apply changed upstream servers without restarting
+		else if(servers_changed)
+		{
+			char errbuf[ERRBUF_SIZE] = { 0 };
+			if(!write_dnsmasq_servers(&newconf, errbuf))
+			{
+				free_config(&newconf);
+				cJSON_Delete(changed);
 				return send_json_error(api, 400,
 				                       "bad_request",
 				                       "Invalid configuration",
@@ -860,12 +897,16 @@ static int api_config_patch(struct ftl_conn *api)
 		// Reload debug levels
 		set_debug_flags(&config);
 
-		// Store changed configuration to disk
-		writeFTLtoml(true);
+		// Store changed configuration to disk once the changes settled
+		schedule_config_write();
 
 		// Rewrite HOSTS file if required
 		if(rewrite_hosts)
 			write_custom_list();
+
+		// Let the resolver re-read the upstream servers
+		if(servers_changed && !api->ftl.restart)
+			FTL_reload_servers();
 	}
 	else
 	{
@@ -874,8 +915,14 @@ static int api_config_patch(struct ftl_conn *api)
 		log_info("No config changes detected");
 	}
 
+	// Report how the changes were applied
+	cJSON *applied = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(applied, "changed", changed);
+	JSON_ADD_BOOL_TO_OBJECT(applied, "restart", api->ftl.restart);
+	JSON_ADD_BOOL_TO_OBJECT(applied, "reload_servers", servers_changed && !api->ftl.restart);
+
 	// Return full config after possible changes above
-	return api_config_get(api);
+	return send_config(api, applied);
 }
 
 // Inspired by https://stackoverflow.com/a/32496721
@@ -913,6 +960,7 @@ static int api_config_put_delete(struct ftl_conn *api)
 
 	// Read all known config items
 	bool dnsmasq_changed = false;
+	bool servers_changed = false;
 	bool rewrite_hosts = false;
 	bool found = false;
 	struct config newconf;
@@ -1019,6 +1067,11 @@ static int api_config_put_delete(struct ftl_conn *api)
 		if(new_item->f & FLAG_RESTART_FTL)
 			dnsmasq_changed = true;
 
+		// Check if this item can be applied by re-reading the upstream
+		// servers instead
+		if(new_item->f & FLAG_RELOAD_SERVERS)
+			servers_changed = true;
+
 		// Check if this item requires rewriting the HOSTS file
 		if(new_item == &newconf.dns.hosts)
 			rewrite_hosts = true;
@@ -1067,6 +1120,19 @@ static int api_config_put_delete(struct ftl_conn *api)
 			                       errbuf);
 		}
 	}
+	// Otherwise, apply changed upstream servers without restarting
+	else if(servers_changed)
+	{
+		char errbuf[ERRBUF_SIZE] = { 0 };
+		if(!write_dnsmasq_servers(&newconf, errbuf))
+		{
+			free_config(&newconf);
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Invalid configuration",
+			                       errbuf);
+		}
+	}
 
 	// Install new configuration
 	replace_config(&newconf);
@@ -1074,13 +1140,17 @@ static int api_config_put_delete(struct ftl_conn *api)
 	// Reload debug levels
 	set_debug_flags(&config);
 
-	// Store changed configuration to disk
-	writeFTLtoml(true);
+	// Store changed configuration to disk once the changes settled
+	schedule_config_write();
 
 	// Rewrite HOSTS file if required
 	if(rewrite_hosts)
 		write_custom_list();
 
+	// Let the resolver re-read the upstream servers
+	if(servers_changed && !api->ftl.restart)
+		FTL_reload_servers();
+
 	// Send empty reply with matching HTTP status code
 	// 201 - Created or 204 - No content
 	if(api->method == HTTP_PUT)
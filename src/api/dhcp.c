@@ -16,6 +16,23 @@
 // rotate_files()
 #include "files.h"
 
+// Lease read from the lease file
+struct lease_line {
+	cJSON *lease;
+	const char *ip;
+	unsigned int pos;
+	bool skip;
+};
+
+static int cmp_lease_line(const void *a, const void *b)
+{
+	const struct lease_line *la = a, *lb = b;
+	const int c = strcmp(la->ip, lb->ip);
+	if(c != 0)
+		return c;
+	return (la->pos > lb->pos) - (la->pos < lb->pos);
+}
+
 int api_dhcp_leases_GET(struct ftl_conn *api)
 {
 	// Get DHCP leases
@@ -30,6 +47,12 @@ int api_dhcp_leases_GET(struct ftl_conn *api)
 		JSON_SEND_OBJECT(json);
 	}
 
+	// Changed leases are appended to the lease file, a later line for an
+	// address replaces the earlier ones. Removed leases are appended with
+	// an expiry time of 1 (see lease_update_file() in dnsmasq's lease.c)
+	struct lease_line *lines = NULL;
+	unsigned int num_lines = 0, cap = 0;
+
 	char *line = NULL;
 	size_t len = 0;
 	ssize_t read;
@@ -63,12 +86,53 @@ int api_dhcp_leases_GET(struct ftl_conn *api)
 		JSON_COPY_STR_TO_OBJECT(lease, "name", name);
 		JSON_COPY_STR_TO_OBJECT(lease, "clientid", clientid);
 
-		// Add lease to array
-		JSON_ADD_ITEM_TO_ARRAY(leases, lease);
+		// Memorize lease
+		if(num_lines >= cap)
+		{
+			cap = cap > 0 ? 2*cap : 256;
+			struct lease_line *new_lines = realloc(lines, cap * sizeof(*new_lines));
+			if(new_lines == NULL)
+			{
+				cJSON_Delete(lease);
+				break;
+			}
+			lines = new_lines;
+		}
+		lines[num_lines].lease = lease;
+		lines[num_lines].ip = cJSON_GetStringValue(cJSON_GetObjectItem(lease, "ip"));
+		lines[num_lines].pos = num_lines;
+		lines[num_lines].skip = expires == 1;
+		num_lines++;
 	}
 	free(line);
 	fclose(fp);
 
+	if(num_lines > 0)
+	{
+		// Skip all but the last line of every address
+		qsort(lines, num_lines, sizeof(*lines), cmp_lease_line);
+		for(unsigned int i = 0; i + 1 < num_lines; i++)
+			if(strcmp(lines[i].ip, lines[i + 1].ip) == 0)
+				lines[i].skip = true;
+
+		// Add leases to array in the order of the file
+		cJSON **ordered = calloc(num_lines, sizeof(*ordered));
+		for(unsigned int i = 0; i < num_lines; i++)
+		{
+			if(lines[i].skip || ordered == NULL)
+				cJSON_Delete(lines[i].lease);
+			else
+				ordered[lines[i].pos] = lines[i].lease;
+		}
+		for(unsigned int i = 0; ordered != NULL && i < num_lines; i++)
+			if(ordered[i] != NULL)
+				JSON_ADD_ITEM_TO_ARRAY(leases, ordered[i]);
+		if(ordered != NULL)
+			free(ordered);
+	}
+	if(lines != NULL)
+		free(lines);
+
 	JSON_SEND_OBJECT(json);
 }
 
@@ -47,6 +47,7 @@
 #include "hex/specs/search_yaml.h"
 #include "hex/specs/action_yaml.h"
 #include "hex/specs/padd_yaml.h"
+#include "hex/specs/federation_yaml.h"
 struct {
     const char *path;
     const char *mime_type;
@@ -85,6 +86,7 @@ struct {
     {"specs/teleporter.yaml", "text/plain", (const char*)specs_teleporter_yaml, specs_teleporter_yaml_len},
     {"specs/action.yaml", "text/plain", (const char*)specs_action_yaml, specs_action_yaml_len},
     {"specs/padd.yaml", "text/plain", (const char*)specs_padd_yaml, specs_padd_yaml_len},
+    {"specs/federation.yaml", "text/plain", (const char*)specs_federation_yaml, specs_federation_yaml_len},
 };
 
 #endif // API_DOCS_H
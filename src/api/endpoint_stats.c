@@ -0,0 +1,325 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API Implementation /api/info/api_stats, /api/info/latency and /api/info/locks
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file endpoint_stats.c
+* @brief Per-endpoint request statistics of the API.
+*
+* api_handler() reports every request it dispatched to an endpoint together
+* with the time it took, the time the handling thread spent waiting for and
+* holding SHM locks, and the number of bytes sent. Besides the totals, each
+* value is sorted into a log-linear histogram which has a relative error of at
+* most 25% over its whole range while needing less than a hundred buckets.
+*/
+
+#include "FTL.h"
+#include "webserver/http-common.h"
+#include "webserver/json_macros.h"
+#include "api/api.h"
+#include "api/endpoint_stats.h"
+// get_latency_stats()
+#include "latency.h"
+// getDomain(), getClient(), getstr(), get_shm_lock_sites()
+#include "shmem.h"
+// short_path()
+#include "log.h"
+
+static struct api_endpoint_stats endpoint_stats[API_STATS_ENDPOINTS] = {{ 0 }};
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Monotonic clock used for timing requests [nanoseconds]
+uint64_t api_stats_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Get the histogram bucket a value is counted in
+ *
+ * @param value The value to be counted
+ * @return The bucket index
+ */
+unsigned int api_histogram_bucket(const uint64_t value)
+{
+	if(value < 4)
+		return value;
+
+	// Power of two and the two bits following the most significant one
+	const unsigned int exp = 63 - __builtin_clzll(value);
+	const unsigned int bucket = 4*(exp - 1) + ((value >> (exp - 2)) & 3u);
+
+	return bucket < API_HISTOGRAM_BUCKETS ? bucket : API_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * Get the (exclusive) upper bound of a histogram bucket
+ *
+ * @param bucket The bucket index
+ * @return The smallest value not counted in this bucket, UINT64_MAX for the
+ * last bucket
+ */
+uint64_t api_histogram_upper(const unsigned int bucket)
+{
+	if(bucket >= API_HISTOGRAM_BUCKETS - 1)
+		return UINT64_MAX;
+	if(bucket < 4)
+		return bucket + 1;
+
+	const unsigned int exp = bucket/4 + 1;
+	return (uint64_t)(5 + bucket%4) << (exp - 2);
+}
+
+/**
+ * Account one request answered by an endpoint
+ *
+ * @param endpoint Index of the endpoint in the API table
+ * @param uri The endpoint's URI, this has to be a static string
+ * @param time Time needed to answer the request [nanoseconds]
+ * @param lock Time spent waiting for and holding SHM locks [nanoseconds]
+ * @param bytes Number of bytes sent, including the headers
+ */
+void api_stats_record(const unsigned int endpoint, const char *uri, const uint64_t time,
+                      const uint64_t lock, const uint64_t bytes)
+{
+	if(endpoint >= API_STATS_ENDPOINTS)
+		return;
+
+	pthread_mutex_lock(&stats_lock);
+	struct api_endpoint_stats *stats = &endpoint_stats[endpoint];
+	stats->uri = uri;
+	stats->count++;
+	stats->time += time;
+	stats->lock += lock;
+	stats->bytes += bytes;
+	stats->time_hist.buckets[api_histogram_bucket(time / 1000u)]++;
+	stats->lock_hist.buckets[api_histogram_bucket(lock / 1000u)]++;
+	stats->bytes_hist.buckets[api_histogram_bucket(bytes)]++;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Get a copy of the statistics of all endpoints which have been used so far
+ *
+ * @param num Set to the number of returned endpoints
+ * @return Array of endpoint statistics (to be freed by the caller) or NULL
+ * if no endpoint has been used yet or on error
+ */
+struct api_endpoint_stats *get_api_endpoint_stats(unsigned int *num)
+{
+	*num = 0;
+	struct api_endpoint_stats *stats = calloc(API_STATS_ENDPOINTS, sizeof(*stats));
+	if(stats == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&stats_lock);
+	for(unsigned int i = 0; i < API_STATS_ENDPOINTS; i++)
+		if(endpoint_stats[i].count > 0)
+			stats[(*num)++] = endpoint_stats[i];
+	pthread_mutex_unlock(&stats_lock);
+
+	if(*num == 0)
+	{
+		free(stats);
+		return NULL;
+	}
+
+	return stats;
+}
+
+// Add the total and the non-empty buckets of a histogram, the bounds are
+// multiplied by scale
+static int add_histogram(struct ftl_conn *api, cJSON *object, const char *key, const double total,
+                         const struct api_histogram *hist, const double scale)
+{
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(json, "total", total);
+	cJSON *histogram = JSON_NEW_ARRAY();
+	for(unsigned int i = 0; i < API_HISTOGRAM_BUCKETS; i++)
+	{
+		if(hist->buckets[i] == 0)
+			continue;
+
+		cJSON *bucket = JSON_NEW_OBJECT();
+		if(i < API_HISTOGRAM_BUCKETS - 1)
+			JSON_ADD_NUMBER_TO_OBJECT(bucket, "upper", scale * api_histogram_upper(i));
+		else
+			JSON_ADD_NULL_TO_OBJECT(bucket, "upper");
+		JSON_ADD_NUMBER_TO_OBJECT(bucket, "count", hist->buckets[i]);
+		JSON_ADD_ITEM_TO_ARRAY(histogram, bucket);
+	}
+	JSON_ADD_ITEM_TO_OBJECT(json, "histogram", histogram);
+	JSON_ADD_ITEM_TO_OBJECT(object, key, json);
+
+	return 0;
+}
+
+int api_info_api_stats(struct ftl_conn *api)
+{
+	unsigned int num = 0;
+	struct api_endpoint_stats *stats = get_api_endpoint_stats(&num);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	cJSON *endpoints = JSON_NEW_ARRAY();
+	for(unsigned int i = 0; i < num; i++)
+	{
+		cJSON *endpoint = JSON_NEW_OBJECT();
+		JSON_REF_STR_IN_OBJECT(endpoint, "uri", stats[i].uri);
+		JSON_ADD_NUMBER_TO_OBJECT(endpoint, "count", stats[i].count);
+
+		int ret;
+		if((ret = add_histogram(api, endpoint, "time", 1e-9 * stats[i].time, &stats[i].time_hist, 1e-6)) != 0 ||
+		   (ret = add_histogram(api, endpoint, "lock", 1e-9 * stats[i].lock, &stats[i].lock_hist, 1e-6)) != 0 ||
+		   (ret = add_histogram(api, endpoint, "bytes", stats[i].bytes, &stats[i].bytes_hist, 1.0)) != 0)
+		{
+			free(stats);
+			return ret;
+		}
+
+		JSON_ADD_ITEM_TO_ARRAY(endpoints, endpoint);
+	}
+	free(stats);
+
+	JSON_ADD_ITEM_TO_OBJECT(json, "endpoints", endpoints);
+	JSON_SEND_OBJECT(json);
+}
+
+static const char *check_names[] = {
+	"cache", "allow_exact", "allow_regex", "special", "deny_exact",
+	"antigravity", "gravity", "deny_regex"
+};
+
+int api_info_latency(struct ftl_conn *api)
+{
+	struct latency_stage_stats stats[LATENCY_STAGES];
+	get_latency_stats(stats);
+
+	// Resolve domains and clients of the example queries while holding the
+	// lock, they are added to the JSON object below
+	cJSON *domains[LATENCY_STAGES][LATENCY_EXEMPLARS] = {{ NULL }};
+	cJSON *clients[LATENCY_STAGES][LATENCY_EXEMPLARS] = {{ NULL }};
+	lock_shm_read();
+	for(unsigned int s = 0; s < LATENCY_STAGES; s++)
+	{
+		for(unsigned int i = 0; i < stats[s].exemplars; i++)
+		{
+			const domainsData *domain = getDomain(stats[s].exemplar[i].domainID, true);
+			const clientsData *client = getClient(stats[s].exemplar[i].clientID, true);
+			domains[s][i] = domain != NULL ? cJSON_CreateString(getDomainName(domain)) : cJSON_CreateNull();
+			clients[s][i] = client != NULL ? cJSON_CreateString(getstr(client->ippos)) : cJSON_CreateNull();
+		}
+	}
+	unlock_shm_read();
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_BOOL_TO_OBJECT(json, "enabled", config.misc.traceLatency.v.b);
+	cJSON *stages = JSON_NEW_ARRAY();
+	for(unsigned int s = 0; s < LATENCY_STAGES; s++)
+	{
+		cJSON *stage = JSON_NEW_OBJECT();
+		JSON_REF_STR_IN_OBJECT(stage, "stage", latency_stage_name(s));
+		JSON_ADD_NUMBER_TO_OBJECT(stage, "count", stats[s].count);
+
+		int ret;
+		if((ret = add_histogram(api, stage, "time", 1e-6 * stats[s].sum, &stats[s].hist, 1e-6)) != 0)
+			return ret;
+
+		cJSON *exemplars = JSON_NEW_ARRAY();
+		for(unsigned int i = 0; i < stats[s].exemplars; i++)
+		{
+			const struct latency_exemplar *exemplar = &stats[s].exemplar[i];
+			cJSON *item = JSON_NEW_OBJECT();
+			JSON_ADD_NUMBER_TO_OBJECT(item, "id", exemplar->id);
+			JSON_ADD_NUMBER_TO_OBJECT(item, "time", 1e-6 * exemplar->usec);
+			JSON_ADD_NUMBER_TO_OBJECT(item, "timestamp", exemplar->timestamp);
+			JSON_ADD_ITEM_TO_OBJECT(item, "domain", domains[s][i]);
+			JSON_ADD_ITEM_TO_OBJECT(item, "client", clients[s][i]);
+			cJSON *checks = JSON_NEW_ARRAY();
+			for(unsigned int c = 0; c < ArraySize(check_names); c++)
+				if(exemplar->checks & (1u << c))
+					JSON_REF_STR_IN_ARRAY(checks, check_names[c]);
+			JSON_ADD_ITEM_TO_OBJECT(item, "checks", checks);
+			JSON_ADD_ITEM_TO_ARRAY(exemplars, item);
+		}
+		JSON_ADD_ITEM_TO_OBJECT(stage, "exemplars", exemplars);
+		JSON_ADD_ITEM_TO_ARRAY(stages, stage);
+	}
+
+	JSON_ADD_ITEM_TO_OBJECT(json, "stages", stages);
+	JSON_SEND_OBJECT(json);
+}
+
+// Sort call sites by the total time they held the lock (longest first)
+static int cmp_lock_hold(const void *a, const void *b)
+{
+	const struct shm_lock_site *site_a = a, *site_b = b;
+	if(site_a->hold < site_b->hold)
+		return 1;
+	if(site_a->hold > site_b->hold)
+		return -1;
+	return 0;
+}
+
+static int api_info_locks_GET(struct ftl_conn *api)
+{
+	struct shm_lock_site *sites = calloc(SHM_LOCK_SITES, sizeof(*sites));
+	if(sites == NULL)
+		return send_json_error(api, 500, "internal_error", "Failed to allocate memory", NULL);
+
+	uint64_t dropped = 0;
+	const unsigned int num = get_shm_lock_sites(sites, &dropped);
+	qsort(sites, num, sizeof(*sites), cmp_lock_hold);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	cJSON *jsites = JSON_NEW_ARRAY();
+	for(unsigned int i = 0; i < num; i++)
+	{
+		cJSON *site = JSON_NEW_OBJECT();
+		JSON_REF_STR_IN_OBJECT(site, "function", sites[i].func);
+		JSON_REF_STR_IN_OBJECT(site, "file", short_path(sites[i].file));
+		JSON_ADD_NUMBER_TO_OBJECT(site, "line", sites[i].line);
+		JSON_ADD_BOOL_TO_OBJECT(site, "shared", sites[i].shared);
+		JSON_ADD_NUMBER_TO_OBJECT(site, "count", sites[i].count);
+
+		int ret;
+		if((ret = add_histogram(api, site, "wait", 1e-9 * sites[i].wait, &sites[i].wait_hist, 1e-6)) != 0 ||
+		   (ret = add_histogram(api, site, "hold", 1e-9 * sites[i].hold, &sites[i].hold_hist, 1e-6)) != 0)
+		{
+			free(sites);
+			return ret;
+		}
+		cJSON *wait = cJSON_GetObjectItemCaseSensitive(site, "wait");
+		JSON_ADD_NUMBER_TO_OBJECT(wait, "max", 1e-9 * sites[i].max_wait);
+		cJSON *hold = cJSON_GetObjectItemCaseSensitive(site, "hold");
+		JSON_ADD_NUMBER_TO_OBJECT(hold, "max", 1e-9 * sites[i].max_hold);
+
+		JSON_ADD_ITEM_TO_ARRAY(jsites, site);
+	}
+	free(sites);
+
+	JSON_ADD_ITEM_TO_OBJECT(json, "sites", jsites);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "dropped", dropped);
+	JSON_SEND_OBJECT(json);
+}
+
+int api_info_locks(struct ftl_conn *api)
+{
+	if(api->method == HTTP_GET)
+		return api_info_locks_GET(api);
+	else if(api->method == HTTP_DELETE)
+	{
+		reset_shm_lock_sites();
+		cJSON *json = JSON_NEW_OBJECT();
+		JSON_SEND_OBJECT_CODE(json, 204);
+	}
+	else
+		return send_json_error(api, 405, "method_not_allowed", "Method not allowed", NULL);
+}
@@ -0,0 +1,48 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API endpoint statistics prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef API_ENDPOINT_STATS_H
+#define API_ENDPOINT_STATS_H
+
+#include <stdint.h>
+
+// Number of endpoints statistics can be kept for, this has to be at least the
+// number of entries in the API table
+#define API_STATS_ENDPOINTS 96u
+
+// Log-linear histogram: values below 4 get a bucket of their own, every larger
+// power of two is split into four equally wide buckets. The last bucket
+// collects everything beyond (about 29 seconds or 28 MiB)
+#define API_HISTOGRAM_BUCKETS 96u
+
+struct api_histogram {
+	uint32_t buckets[API_HISTOGRAM_BUCKETS];
+};
+
+// Statistics of one endpoint (times in nanoseconds, histograms of times in
+// microseconds)
+struct api_endpoint_stats {
+	const char *uri;
+	uint64_t count;
+	uint64_t time;
+	uint64_t lock;
+	uint64_t bytes;
+	struct api_histogram time_hist;
+	struct api_histogram lock_hist;
+	struct api_histogram bytes_hist;
+};
+
+uint64_t api_stats_clock(void);
+void api_stats_record(const unsigned int endpoint, const char *uri, const uint64_t time,
+                      const uint64_t lock, const uint64_t bytes);
+struct api_endpoint_stats *get_api_endpoint_stats(unsigned int *num);
+unsigned int api_histogram_bucket(const uint64_t value) __attribute__((const));
+uint64_t api_histogram_upper(const unsigned int bucket) __attribute__((const));
+
+#endif // API_ENDPOINT_STATS_H
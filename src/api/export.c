@@ -0,0 +1,884 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API Implementation /api/queries/export
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file export.c
+ * @brief Bulk export of the long-term query history as Apache Arrow stream
+ *
+ * All queries of a time range are read sequentially from the long-term
+ * database (including archived queries) and sent as Arrow IPC stream, i.e. a
+ * schema message followed by dictionary and record batches. Domains, clients,
+ * upstreams and all enumerations are dictionary-encoded, dictionaries grow by
+ * delta batches whenever a record batch introduces new strings. The result can
+ * be read directly by pyarrow, pandas, polars, DuckDB, ...
+ *
+ * The flatbuffer metadata is built by hand (back to front, as the flatbuffers
+ * library does it) so we do not need any additional dependency for the few
+ * message types we send.
+ */
+
+#include "FTL.h"
+#include "webserver/http-common.h"
+#include "webserver/json_macros.h"
+#include "api/api.h"
+// get_query_*_str()
+#include "datastructure.h"
+// dbopen(), dbclose()
+#include "database/common.h"
+// killed
+#include "signals.h"
+// htole32()
+#include <endian.h>
+
+// Number of rows per record batch
+#define EXPORT_BATCH_ROWS 65536u
+#define EXPORT_BATCH_ROWS_MAX 1048576u
+
+// Arrow metadata constants (see Schema.fbs and Message.fbs)
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_DICTIONARY 2
+#define ARROW_HEADER_RECORDBATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOAT 3
+#define ARROW_TYPE_UTF8 5
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+
+// Largest number of fields of the tables we build
+#define FB_MAX_FIELDS 6u
+
+// Flatbuffer builder, data grows downwards from the end of buf
+struct fb {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	bool failed;
+	// Fields of the table currently being built (position, 0 = absent)
+	size_t fields[FB_MAX_FIELDS];
+	unsigned int nfields;
+	size_t table_start;
+};
+
+static bool fb_grow(struct fb *b, const size_t need)
+{
+	if(b->failed)
+		return false;
+	if(b->len + need <= b->size)
+		return true;
+
+	size_t size = b->size > 0 ? b->size : 1024;
+	while(size < b->len + need)
+		size *= 2;
+
+	uint8_t *buf = malloc(size);
+	if(buf == NULL)
+	{
+		b->failed = true;
+		return false;
+	}
+	if(b->len > 0)
+		memcpy(buf + size - b->len, b->buf + b->size - b->len, b->len);
+	if(b->buf != NULL)
+		free(b->buf);
+	b->buf = buf;
+	b->size = size;
+	return true;
+}
+
+static void fb_push(struct fb *b, const void *data, const size_t n)
+{
+	if(!fb_grow(b, n))
+		return;
+	b->len += n;
+	memcpy(b->buf + b->size - b->len, data, n);
+}
+
+static void fb_zero(struct fb *b, const size_t n)
+{
+	if(!fb_grow(b, n))
+		return;
+	b->len += n;
+	memset(b->buf + b->size - b->len, 0, n);
+}
+
+// Pad such that an object of size additional pushed next ends up aligned
+static void fb_prep(struct fb *b, const size_t align, const size_t additional)
+{
+	fb_zero(b, (align - ((b->len + additional) % align)) % align);
+}
+
+static void fb_u8(struct fb *b, const uint8_t v)
+{
+	fb_push(b, &v, sizeof(v));
+}
+
+static void fb_u16(struct fb *b, const uint16_t v)
+{
+	const uint16_t le = htole16(v);
+	fb_prep(b, sizeof(le), 0);
+	fb_push(b, &le, sizeof(le));
+}
+
+static void fb_u32(struct fb *b, const uint32_t v)
+{
+	const uint32_t le = htole32(v);
+	fb_prep(b, sizeof(le), 0);
+	fb_push(b, &le, sizeof(le));
+}
+
+static void fb_u64(struct fb *b, const uint64_t v)
+{
+	const uint64_t le = htole64(v);
+	fb_prep(b, sizeof(le), 0);
+	fb_push(b, &le, sizeof(le));
+}
+
+// Offsets are relative to the position they are stored at
+static void fb_offset(struct fb *b, const size_t target)
+{
+	fb_prep(b, sizeof(uint32_t), 0);
+	fb_u32(b, (uint32_t)(b->len + sizeof(uint32_t) - target));
+}
+
+static size_t fb_string(struct fb *b, const char *s)
+{
+	const size_t n = strlen(s);
+	fb_prep(b, sizeof(uint32_t), n + 1);
+	fb_zero(b, 1);
+	fb_push(b, s, n);
+	fb_u32(b, n);
+	return b->len;
+}
+
+static size_t fb_offsets(struct fb *b, const size_t *items, const unsigned int n)
+{
+	fb_prep(b, sizeof(uint32_t), n * sizeof(uint32_t));
+	for(unsigned int i = n; i-- > 0;)
+		fb_offset(b, items[i]);
+	fb_u32(b, n);
+	return b->len;
+}
+
+// Vector of structs consisting of two longs (FieldNode and Buffer)
+static size_t fb_pairs(struct fb *b, const int64_t (*items)[2], const unsigned int n)
+{
+	fb_prep(b, sizeof(uint32_t), n * 2 * sizeof(int64_t));
+	fb_prep(b, sizeof(int64_t), n * 2 * sizeof(int64_t));
+	for(unsigned int i = n; i-- > 0;)
+	{
+		fb_u64(b, items[i][1]);
+		fb_u64(b, items[i][0]);
+	}
+	fb_u32(b, n);
+	return b->len;
+}
+
+static void fb_start(struct fb *b)
+{
+	memset(b->fields, 0, sizeof(b->fields));
+	b->nfields = 0;
+	b->table_start = b->len;
+}
+
+static void fb_slot(struct fb *b, const unsigned int idx)
+{
+	b->fields[idx] = b->len;
+	if(idx + 1 > b->nfields)
+		b->nfields = idx + 1;
+}
+
+static void fb_add_u8(struct fb *b, const unsigned int idx, const uint8_t v)
+{
+	fb_u8(b, v);
+	fb_slot(b, idx);
+}
+
+static void fb_add_u16(struct fb *b, const unsigned int idx, const uint16_t v)
+{
+	fb_u16(b, v);
+	fb_slot(b, idx);
+}
+
+static void fb_add_u32(struct fb *b, const unsigned int idx, const uint32_t v)
+{
+	fb_u32(b, v);
+	fb_slot(b, idx);
+}
+
+static void fb_add_u64(struct fb *b, const unsigned int idx, const uint64_t v)
+{
+	fb_u64(b, v);
+	fb_slot(b, idx);
+}
+
+static void fb_add_offset(struct fb *b, const unsigned int idx, const size_t target)
+{
+	fb_offset(b, target);
+	fb_slot(b, idx);
+}
+
+// Finish the current table by writing its vtable right in front of it
+static size_t fb_end(struct fb *b)
+{
+	fb_u32(b, 0);
+	const size_t table = b->len;
+	for(unsigned int i = b->nfields; i-- > 0;)
+		fb_u16(b, b->fields[i] > 0 ? (uint16_t)(table - b->fields[i]) : 0);
+	fb_u16(b, (uint16_t)(table - b->table_start));
+	fb_u16(b, (uint16_t)(4 + 2 * b->nfields));
+
+	// Point the table to its vtable
+	if(!b->failed)
+	{
+		const uint32_t soffset = htole32((uint32_t)(b->len - table));
+		memcpy(b->buf + b->size - table, &soffset, sizeof(soffset));
+	}
+	return table;
+}
+
+static void fb_finish(struct fb *b, const size_t root)
+{
+	fb_prep(b, sizeof(int64_t), sizeof(uint32_t));
+	fb_offset(b, root);
+}
+
+// Growing byte buffer used for the message bodies
+struct body {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+	bool failed;
+	// Buffer descriptors (offset, length) and field nodes (length, nulls)
+	int64_t buffers[32][2];
+	unsigned int nbuffers;
+	int64_t nodes[16][2];
+	unsigned int nnodes;
+};
+
+static void *body_alloc(struct body *body, const size_t n)
+{
+	// Every buffer starts at an 8-byte boundary
+	const size_t padded = (n + 7u) & ~(size_t)7u;
+	if(body->failed || body->nbuffers >= ArraySize(body->buffers))
+	{
+		body->failed = true;
+		return NULL;
+	}
+	if(body->len + padded > body->size)
+	{
+		size_t size = body->size > 0 ? body->size : 65536;
+		while(size < body->len + padded)
+			size *= 2;
+		uint8_t *data = realloc(body->data, size);
+		if(data == NULL)
+		{
+			body->failed = true;
+			return NULL;
+		}
+		body->data = data;
+		body->size = size;
+	}
+
+	uint8_t *ptr = body->data + body->len;
+	if(padded > n)
+		memset(ptr + n, 0, padded - n);
+	body->buffers[body->nbuffers][0] = body->len;
+	body->buffers[body->nbuffers][1] = n;
+	body->nbuffers++;
+	body->len += padded;
+	return ptr;
+}
+
+static void body_buffer(struct body *body, const void *data, const size_t n)
+{
+	void *ptr = body_alloc(body, n);
+	if(ptr != NULL && n > 0)
+		memcpy(ptr, data, n);
+}
+
+static void body_node(struct body *body, const int64_t length, const int64_t nulls)
+{
+	if(body->nnodes >= ArraySize(body->nodes))
+	{
+		body->failed = true;
+		return;
+	}
+	body->nodes[body->nnodes][0] = length;
+	body->nodes[body->nnodes][1] = nulls;
+	body->nnodes++;
+}
+
+static void body_reset(struct body *body)
+{
+	body->len = 0;
+	body->nbuffers = 0;
+	body->nnodes = 0;
+}
+
+// String dictionary with hash index
+struct dict {
+	int32_t *offsets;
+	char *data;
+	uint32_t *slots; // index + 1, 0 = empty
+	unsigned int count;
+	unsigned int sent;
+	unsigned int capacity;
+	unsigned int nslots;
+	size_t len;
+	size_t size;
+};
+
+static uint32_t __attribute__((pure)) dict_hash(const char *s, const size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)s[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool dict_rehash(struct dict *d, const unsigned int nslots)
+{
+	uint32_t *slots = calloc(nslots, sizeof(*slots));
+	if(slots == NULL)
+		return false;
+	for(unsigned int i = 0; i < d->count; i++)
+	{
+		const char *s = d->data + d->offsets[i];
+		const size_t len = d->offsets[i + 1] - d->offsets[i];
+		uint32_t slot = dict_hash(s, len) & (nslots - 1);
+		while(slots[slot] != 0)
+			slot = (slot + 1) & (nslots - 1);
+		slots[slot] = i + 1;
+	}
+	if(d->slots != NULL)
+		free(d->slots);
+	d->slots = slots;
+	d->nslots = nslots;
+	return true;
+}
+
+// Get the index of a string, adding it to the dictionary if necessary
+static int32_t dict_index(struct dict *d, const char *s)
+{
+	// Keep the load factor below 50%
+	if(2 * (d->count + 1) > d->nslots && !dict_rehash(d, d->nslots > 0 ? 2 * d->nslots : 256))
+		return -1;
+
+	const size_t len = strlen(s);
+	uint32_t slot = dict_hash(s, len) & (d->nslots - 1);
+	while(d->slots[slot] != 0)
+	{
+		const unsigned int i = d->slots[slot] - 1;
+		if((size_t)(d->offsets[i + 1] - d->offsets[i]) == len &&
+		   memcmp(d->data + d->offsets[i], s, len) == 0)
+			return i;
+		slot = (slot + 1) & (d->nslots - 1);
+	}
+
+	// Add new string
+	if(d->count + 2 > d->capacity)
+	{
+		const unsigned int capacity = d->capacity > 0 ? 2 * d->capacity : 256;
+		int32_t *offsets = realloc(d->offsets, capacity * sizeof(*offsets));
+		if(offsets == NULL)
+			return -1;
+		if(d->capacity == 0)
+			offsets[0] = 0;
+		d->offsets = offsets;
+		d->capacity = capacity;
+	}
+	if(d->len + len > d->size)
+	{
+		size_t size = d->size > 0 ? d->size : 4096;
+		while(size < d->len + len)
+			size *= 2;
+		// Arrow uses 32 bit offsets for Utf8 arrays
+		if(size > INT32_MAX)
+			return -1;
+		char *data = realloc(d->data, size);
+		if(data == NULL)
+			return -1;
+		d->data = data;
+		d->size = size;
+	}
+	memcpy(d->data + d->len, s, len);
+	d->len += len;
+	d->offsets[d->count + 1] = d->len;
+	d->slots[slot] = ++d->count;
+	return d->count - 1;
+}
+
+static void dict_free(struct dict *d)
+{
+	if(d->offsets != NULL)
+		free(d->offsets);
+	if(d->data != NULL)
+		free(d->data);
+	if(d->slots != NULL)
+		free(d->slots);
+	memset(d, 0, sizeof(*d));
+}
+
+enum export_column {
+	COL_ID,
+	COL_TIME,
+	COL_TYPE,
+	COL_STATUS,
+	COL_DOMAIN,
+	COL_CLIENT,
+	COL_UPSTREAM,
+	COL_REPLY,
+	COL_REPLY_TIME,
+	COL_DNSSEC,
+	COL_COUNT
+} __attribute__ ((packed));
+
+enum export_kind {
+	KIND_INT64,
+	KIND_DOUBLE,
+	KIND_DICT
+} __attribute__ ((packed));
+
+static const struct {
+	const char *name;
+	enum export_kind kind;
+	bool nullable;
+} columns[COL_COUNT] = {
+	[COL_ID] = { "id", KIND_INT64, false },
+	[COL_TIME] = { "time", KIND_DOUBLE, false },
+	[COL_TYPE] = { "type", KIND_DICT, true },
+	[COL_STATUS] = { "status", KIND_DICT, true },
+	[COL_DOMAIN] = { "domain", KIND_DICT, true },
+	[COL_CLIENT] = { "client", KIND_DICT, true },
+	[COL_UPSTREAM] = { "upstream", KIND_DICT, true },
+	[COL_REPLY] = { "reply", KIND_DICT, true },
+	[COL_REPLY_TIME] = { "reply_time", KIND_DOUBLE, true },
+	[COL_DNSSEC] = { "dnssec", KIND_DICT, true },
+};
+
+// Column data of one record batch. Dictionary columns store their indices in
+// the lower 32 bits of values
+struct export_state {
+	struct ftl_conn *api;
+	struct fb fb;
+	struct body body;
+	struct dict dicts[COL_COUNT];
+	union {
+		int64_t i;
+		double d;
+		int32_t idx;
+	} *values[COL_COUNT];
+	uint8_t *validity[COL_COUNT];
+	unsigned int nulls[COL_COUNT];
+	unsigned int rows;
+	unsigned int batch;
+	bool failed;
+};
+
+static bool send_data(struct export_state *state, const void *data, const size_t len)
+{
+	if(state->failed || len == 0)
+		return !state->failed;
+	if(mg_send_chunk(state->api->conn, data, len) < 0)
+		state->failed = true;
+	return !state->failed;
+}
+
+// Send the flatbuffer metadata and the body as one encapsulated message
+static bool send_message(struct export_state *state, const bool with_body)
+{
+	struct fb *b = &state->fb;
+	if(b->failed || (with_body && state->body.failed))
+		return false;
+
+	// Metadata is padded to 8 bytes including the continuation marker and
+	// the length prefix
+	const size_t padding = (8 - ((b->len + 8) % 8)) % 8;
+	const uint32_t prefix[2] = { htole32(ARROW_CONTINUATION), htole32((uint32_t)(b->len + padding)) };
+	static const uint8_t zeros[8] = { 0 };
+
+	const bool okay = send_data(state, prefix, sizeof(prefix)) &&
+	                  send_data(state, b->buf + b->size - b->len, b->len) &&
+	                  send_data(state, zeros, padding) &&
+	                  (!with_body || send_data(state, state->body.data, state->body.len));
+
+	b->len = 0;
+	return okay;
+}
+
+static size_t build_int_type(struct fb *b, const uint32_t bits)
+{
+	fb_start(b);
+	fb_add_u32(b, 0, bits);
+	fb_add_u8(b, 1, 1);
+	return fb_end(b);
+}
+
+static size_t build_message(struct fb *b, const uint8_t type, const size_t header, const int64_t body_len)
+{
+	fb_start(b);
+	fb_add_u64(b, 3, body_len);
+	fb_add_offset(b, 2, header);
+	fb_add_u16(b, 0, ARROW_METADATA_V5);
+	fb_add_u8(b, 1, type);
+	return fb_end(b);
+}
+
+static bool send_schema(struct export_state *state)
+{
+	struct fb *b = &state->fb;
+	size_t fields[COL_COUNT] = { 0 };
+	int64_t dict_id = 0;
+	for(unsigned int c = 0; c < COL_COUNT; c++)
+	{
+		const size_t name = fb_string(b, columns[c].name);
+		const size_t children = fb_offsets(b, NULL, 0);
+
+		size_t type = 0, encoding = 0;
+		uint8_t type_type = ARROW_TYPE_UTF8;
+		switch(columns[c].kind)
+		{
+			case KIND_INT64:
+				type = build_int_type(b, 64);
+				type_type = ARROW_TYPE_INT;
+				break;
+			case KIND_DOUBLE:
+				fb_start(b);
+				fb_add_u16(b, 0, ARROW_PRECISION_DOUBLE);
+				type = fb_end(b);
+				type_type = ARROW_TYPE_FLOAT;
+				break;
+			case KIND_DICT:
+			{
+				fb_start(b);
+				type = fb_end(b);
+				const size_t index_type = build_int_type(b, 32);
+				fb_start(b);
+				fb_add_u64(b, 0, dict_id++);
+				fb_add_offset(b, 1, index_type);
+				encoding = fb_end(b);
+				break;
+			}
+		}
+
+		fb_start(b);
+		fb_add_offset(b, 0, name);
+		fb_add_offset(b, 3, type);
+		if(encoding > 0)
+			fb_add_offset(b, 4, encoding);
+		fb_add_offset(b, 5, children);
+		fb_add_u8(b, 1, columns[c].nullable);
+		fb_add_u8(b, 2, type_type);
+		fields[c] = fb_end(b);
+	}
+
+	const size_t vec = fb_offsets(b, fields, COL_COUNT);
+	fb_start(b);
+	fb_add_offset(b, 1, vec);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	fb_add_u16(b, 0, 1);
+#endif
+	const size_t schema = fb_end(b);
+	fb_finish(b, build_message(b, ARROW_HEADER_SCHEMA, schema, 0));
+
+	return send_message(state, false);
+}
+
+// RecordBatch table describing the buffers collected in the body
+static size_t build_record_batch(struct fb *b, const struct body *body, const int64_t length)
+{
+	const size_t buffers = fb_pairs(b, body->buffers, body->nbuffers);
+	const size_t nodes = fb_pairs(b, body->nodes, body->nnodes);
+	fb_start(b);
+	fb_add_u64(b, 0, length);
+	fb_add_offset(b, 1, nodes);
+	fb_add_offset(b, 2, buffers);
+	return fb_end(b);
+}
+
+// Send all strings added to a dictionary since it was last sent. The first
+// batch of every dictionary is sent even when it is empty as readers expect
+// all dictionaries to be known before the first record batch
+static bool send_dictionary(struct export_state *state, const int64_t id, struct dict *d, const bool first)
+{
+	if(!first && d->count == d->sent)
+		return true;
+
+	struct body *body = &state->body;
+	body_reset(body);
+
+	const unsigned int count = d->count - d->sent;
+	const int32_t start = d->count > 0 ? d->offsets[d->sent] : 0;
+	body_node(body, count, 0);
+	body_alloc(body, 0);
+	int32_t *offsets = body_alloc(body, (count + 1) * sizeof(*offsets));
+	if(offsets != NULL)
+	{
+		offsets[0] = 0;
+		for(unsigned int i = 1; i <= count; i++)
+			offsets[i] = d->offsets[d->sent + i] - start;
+	}
+	body_buffer(body, d->data + start, count > 0 ? (size_t)(d->offsets[d->count] - start) : 0);
+
+	struct fb *b = &state->fb;
+	const size_t data = build_record_batch(b, body, count);
+	fb_start(b);
+	fb_add_u64(b, 0, id);
+	fb_add_offset(b, 1, data);
+	fb_add_u8(b, 2, !first);
+	const size_t batch = fb_end(b);
+	fb_finish(b, build_message(b, ARROW_HEADER_DICTIONARY, batch, body->len));
+
+	d->sent = d->count;
+	return send_message(state, true);
+}
+
+static bool send_batch(struct export_state *state)
+{
+	if(state->rows == 0)
+		return true;
+
+	// New dictionary entries have to be known before the batch using them
+	int64_t dict_id = 0;
+	for(unsigned int c = 0; c < COL_COUNT; c++)
+		if(columns[c].kind == KIND_DICT &&
+		   !send_dictionary(state, dict_id++, &state->dicts[c], false))
+			return false;
+
+	struct body *body = &state->body;
+	body_reset(body);
+	for(unsigned int c = 0; c < COL_COUNT; c++)
+	{
+		body_node(body, state->rows, state->nulls[c]);
+		body_buffer(body, state->validity[c], state->nulls[c] > 0 ? (state->rows + 7) / 8 : 0);
+		if(columns[c].kind == KIND_DICT)
+		{
+			int32_t *indices = body_alloc(body, state->rows * sizeof(*indices));
+			if(indices != NULL)
+				for(unsigned int i = 0; i < state->rows; i++)
+					indices[i] = state->values[c][i].idx;
+		}
+		else
+			body_buffer(body, state->values[c], state->rows * sizeof(*state->values[c]));
+	}
+
+	struct fb *b = &state->fb;
+	const size_t batch = build_record_batch(b, body, state->rows);
+	fb_finish(b, build_message(b, ARROW_HEADER_RECORDBATCH, batch, body->len));
+
+	state->rows = 0;
+	memset(state->nulls, 0, sizeof(state->nulls));
+	for(unsigned int c = 0; c < COL_COUNT; c++)
+		memset(state->validity[c], 0xFF, (state->batch + 7) / 8);
+
+	return send_message(state, true);
+}
+
+static void set_null(struct export_state *state, const enum export_column c)
+{
+	state->validity[c][state->rows / 8] &= (uint8_t)~(1u << (state->rows % 8));
+	state->nulls[c]++;
+	state->values[c][state->rows].i = 0;
+}
+
+static bool set_string(struct export_state *state, const enum export_column c, const char *s)
+{
+	if(s == NULL)
+	{
+		set_null(state, c);
+		return true;
+	}
+	const int32_t idx = dict_index(&state->dicts[c], s);
+	state->values[c][state->rows].i = 0;
+	state->values[c][state->rows].idx = idx;
+	return idx >= 0;
+}
+
+static bool add_row(struct export_state *state, sqlite3_stmt *stmt)
+{
+	char buffer[32] = { 0 };
+	const unsigned int row = state->rows;
+	state->values[COL_ID][row].i = sqlite3_column_int64(stmt, 0);
+	state->values[COL_TIME][row].d = sqlite3_column_double(stmt, 1);
+
+	// Type (other types are stored with an offset of 100)
+	const char *type = NULL;
+	if(sqlite3_column_type(stmt, 2) != SQLITE_NULL)
+	{
+		const int qtype = sqlite3_column_int(stmt, 2);
+		queriesData query = { .qtype = qtype >= 100 ? qtype - 100 : 0 };
+		type = get_query_type_str(qtype >= 100 ? TYPE_OTHER : (enum query_type)qtype, &query, buffer);
+	}
+
+	const char *status = sqlite3_column_type(stmt, 3) == SQLITE_NULL ? NULL :
+	                     get_query_status_str(sqlite3_column_int(stmt, 3));
+	const char *reply = sqlite3_column_type(stmt, 7) == SQLITE_NULL ? NULL :
+	                    get_query_reply_str(sqlite3_column_int(stmt, 7));
+	const char *dnssec = sqlite3_column_type(stmt, 9) == SQLITE_NULL ? NULL :
+	                     get_query_dnssec_str(sqlite3_column_int(stmt, 9));
+
+	if(sqlite3_column_type(stmt, 8) == SQLITE_NULL)
+		set_null(state, COL_REPLY_TIME);
+	else
+		state->values[COL_REPLY_TIME][row].d = sqlite3_column_double(stmt, 8);
+
+	const bool okay =
+		set_string(state, COL_TYPE, type) &&
+		set_string(state, COL_STATUS, status) &&
+		set_string(state, COL_DOMAIN, (const char*)sqlite3_column_text(stmt, 4)) &&
+		set_string(state, COL_CLIENT, (const char*)sqlite3_column_text(stmt, 5)) &&
+		set_string(state, COL_UPSTREAM, (const char*)sqlite3_column_text(stmt, 6)) &&
+		set_string(state, COL_REPLY, reply) &&
+		set_string(state, COL_DNSSEC, dnssec);
+
+	state->rows++;
+	return okay;
+}
+
+static void free_export_state(struct export_state *state)
+{
+	if(state->fb.buf != NULL)
+		free(state->fb.buf);
+	if(state->body.data != NULL)
+		free(state->body.data);
+	for(unsigned int c = 0; c < COL_COUNT; c++)
+	{
+		dict_free(&state->dicts[c]);
+		if(state->values[c] != NULL)
+			free(state->values[c]);
+		if(state->validity[c] != NULL)
+			free(state->validity[c]);
+	}
+}
+
+int api_queries_export(struct ftl_conn *api)
+{
+	double from = 0, until = 0;
+	int batch = EXPORT_BATCH_ROWS;
+	if(api->request->query_string != NULL)
+	{
+		get_double_var(api->request->query_string, "from", &from);
+		get_double_var(api->request->query_string, "until", &until);
+		get_int_var(api->request->query_string, "batch", &batch);
+	}
+
+	// Check if we received the required information
+	if(from < 1.0 || until < 1.0)
+	{
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "You need to specify both \"from\" and \"until\" in the request.",
+		                       NULL);
+	}
+	if(batch < 1 || (unsigned int)batch > EXPORT_BATCH_ROWS_MAX)
+	{
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "Invalid batch size",
+		                       NULL);
+	}
+
+	struct export_state state = { .api = api, .batch = batch };
+	for(unsigned int c = 0; c < COL_COUNT; c++)
+	{
+		state.values[c] = calloc(state.batch, sizeof(*state.values[c]));
+		state.validity[c] = malloc((state.batch + 7) / 8);
+		if(state.values[c] == NULL || state.validity[c] == NULL)
+		{
+			free_export_state(&state);
+			return send_json_error(api, 500,
+			                       "internal_error",
+			                       "Failed to allocate memory for the export",
+			                       NULL);
+		}
+		memset(state.validity[c], 0xFF, (state.batch + 7) / 8);
+	}
+
+	// Open the database
+	sqlite3 *db = dbopen(false, false);
+	if(db == NULL)
+	{
+		free_export_state(&state);
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to open long-term database",
+		                       NULL);
+	}
+
+	// Queries are read in storage order, there is no point in letting
+	// SQLite sort potentially millions of rows the client can sort itself
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT id, timestamp, type, status, domain, client, forward, "
+	                                "reply_type, reply_time, dnssec FROM queries "
+	                                "WHERE timestamp >= ?1 AND timestamp < ?2", -1, &stmt, NULL);
+	if(rc != SQLITE_OK ||
+	   (rc = sqlite3_bind_double(stmt, 1, from)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_double(stmt, 2, until)) != SQLITE_OK)
+	{
+		log_err("api_queries_export(): Failed to prepare query (error %d) - %s",
+		        rc, sqlite3_errstr(rc));
+		sqlite3_finalize(stmt);
+		dbclose(&db);
+		free_export_state(&state);
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to prepare query",
+		                       NULL);
+	}
+
+	mg_send_http_ok(api->conn, "application/vnd.apache.arrow.stream", -1);
+
+	// Schema and initial (empty) dictionaries
+	bool okay = send_schema(&state);
+	int64_t dict_id = 0;
+	for(unsigned int c = 0; okay && c < COL_COUNT; c++)
+		if(columns[c].kind == KIND_DICT)
+			okay = send_dictionary(&state, dict_id++, &state.dicts[c], true);
+
+	unsigned long total = 0;
+	while(okay && !killed && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		okay = add_row(&state, stmt);
+		total++;
+		if(okay && state.rows >= state.batch)
+			okay = send_batch(&state);
+	}
+	if(okay && rc != SQLITE_ROW && rc != SQLITE_DONE)
+	{
+		log_err("api_queries_export(): Failed to read queries (error %d) - %s",
+		        rc, sqlite3_errstr(rc));
+		okay = false;
+	}
+	if(okay)
+		okay = send_batch(&state);
+
+	sqlite3_finalize(stmt);
+	dbclose(&db);
+
+	// End-of-stream marker. On errors, we omit it so the client notices
+	// the export is incomplete
+	if(okay && !killed)
+	{
+		const uint32_t eos[2] = { htole32(ARROW_CONTINUATION), 0 };
+		send_data(&state, eos, sizeof(eos));
+	}
+	log_debug(DEBUG_API, "Exported %lu queries (%s)", total, okay ? "complete" : "incomplete");
+
+	// Terminate the chunked response (if the client is still there)
+	if(!state.failed)
+		mg_send_chunk(api->conn, "", 0);
+
+	free_export_state(&state);
+	return 200;
+}
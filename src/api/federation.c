@@ -0,0 +1,350 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API Implementation /api/federation and cluster views
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "webserver/http-common.h"
+#include "webserver/json_macros.h"
+#include "api/api.h"
+// config struct
+#include "config/config.h"
+// federation_*()
+#include "federation.h"
+// gravity_last_updated()
+#include "database/gravity-db.h"
+// gravity_image_*()
+#include "database/gravity-image.h"
+
+/**
+ * Check if a cluster view (combined statistics of this instance and all
+ * webserver.api.federation.peers) is requested
+ *
+ * @param api The API connection
+ * @return Whether cluster=true is part of the query string
+ */
+bool api_cluster_view(const struct ftl_conn *api)
+{
+	bool cluster = false;
+	if(api->request->query_string != NULL)
+		get_bool_var(api->request->query_string, "cluster", &cluster);
+	return cluster;
+}
+
+// Peers authenticate their requests using the shared token (see
+// federation_verify_request()), anyone else needs a valid session
+static bool federation_auth(struct ftl_conn *api)
+{
+	const char *auth = mg_get_header(api->conn, FEDERATION_AUTH_HEADER);
+	const char *secret = config.webserver.api.federation.token.v.s;
+	if(auth != NULL && secret[0] != '\0')
+	{
+		// The HMAC covers the URI as sent by the peer
+		const struct mg_request_info *ri = api->request;
+		const char *path = ri->local_uri_raw != NULL ? ri->local_uri_raw : ri->local_uri;
+		char *uri = NULL;
+		if(asprintf(&uri, "%s%s%s", path, ri->query_string != NULL ? "?" : "",
+		            ri->query_string != NULL ? ri->query_string : "") < 0)
+			return false;
+		const bool peer = federation_verify_request(ri->request_method, uri, auth, secret);
+		free(uri);
+		if(peer)
+			return true;
+	}
+	return check_client_auth(api, true) != API_AUTH_UNAUTHORIZED;
+}
+
+int api_federation_summary(struct ftl_conn *api)
+{
+	if(!federation_auth(api))
+		return send_json_unauthorized(api);
+
+	unsigned int since = 0;
+	if(api->request->query_string != NULL)
+		get_uint_var(api->request->query_string, "since", &since);
+
+	cJSON *json = federation_summary_json(since);
+	if(json == NULL)
+	{
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to allocate memory for the summary",
+		                       NULL);
+	}
+
+	JSON_SEND_OBJECT(json);
+}
+
+int api_federation_gravity(struct ftl_conn *api)
+{
+	if(!federation_auth(api))
+		return send_json_unauthorized(api);
+
+	char version[GRAVITY_IMAGE_VERSION_SIZE] = "";
+	cJSON *json = gravity_image_manifest(version);
+	if(json == NULL)
+	{
+		return send_json_error(api, 404,
+		                       "not_found",
+		                       "No gravity image has been published",
+		                       "see webserver.api.federation.gravity.publish");
+	}
+
+	// Followers send the version they already have
+	char known[GRAVITY_IMAGE_VERSION_SIZE] = "";
+	if(api->request->query_string != NULL &&
+	   GET_VAR("version", known, api->request->query_string) > 0 &&
+	   strcmp(known, version) == 0)
+	{
+		cJSON_Delete(json);
+		send_http_code(api, "application/json; charset=utf-8", 304, "");
+		return 304;
+	}
+
+	JSON_SEND_OBJECT(json);
+}
+
+int api_federation_gravity_block(struct ftl_conn *api)
+{
+	if(!federation_auth(api))
+		return send_json_unauthorized(api);
+
+	char file[16] = "", version[GRAVITY_IMAGE_VERSION_SIZE] = "";
+	unsigned int block = 0;
+	enum gravity_image_file f = GRAVITY_IMAGE_FILES;
+	if(api->request->query_string != NULL &&
+	   GET_VAR("file", file, api->request->query_string) > 0 &&
+	   GET_VAR("version", version, api->request->query_string) > 0 &&
+	   get_uint_var(api->request->query_string, "block", &block))
+	{
+		for(f = 0; f < GRAVITY_IMAGE_FILES; f++)
+			if(strcmp(file, gravity_image_file_name(f)) == 0)
+				break;
+	}
+	if(f == GRAVITY_IMAGE_FILES)
+	{
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "Missing or invalid parameters",
+		                       "file, block and version are required");
+	}
+
+	void *buf = malloc(GRAVITY_IMAGE_BLOCK_SIZE);
+	if(buf == NULL)
+	{
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to allocate memory for the block",
+		                       NULL);
+	}
+
+	// The image may have been replaced since the follower fetched the
+	// manifest
+	const ssize_t len = gravity_image_read_block(f, block, version, buf);
+	if(len < 0)
+	{
+		free(buf);
+		return send_json_error(api, 404,
+		                       "not_found",
+		                       "No such block",
+		                       "the gravity image may have been replaced in the meantime");
+	}
+
+	mg_send_http_ok(api->conn, "application/octet-stream", len);
+	mg_write(api->conn, buf, len);
+	free(buf);
+
+	return 200;
+}
+
+int api_federation_peers(struct ftl_conn *api)
+{
+	cJSON *peers = federation_peers_json();
+	if(peers == NULL)
+	{
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to allocate memory for the peers",
+		                       NULL);
+	}
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(json, "peers", peers);
+	JSON_SEND_OBJECT(json);
+}
+
+// /api/stats/summary?cluster=true
+int api_stats_summary_cluster(struct ftl_conn *api)
+{
+	struct fed_node *sum = calloc(1, sizeof(*sum));
+	unsigned int nodes = 0;
+	if(sum == NULL || !federation_cluster_counters(sum, &nodes))
+	{
+		free(sum);
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to collect cluster statistics",
+		                       NULL);
+	}
+
+	// Calculate percentage of blocked queries
+	float percent_blocked = 0.0f;
+	// Avoid 1/0 condition
+	if(sum->total > 0)
+		percent_blocked = 1e2f*sum->blocked/sum->total;
+
+	cJSON *queries = cJSON_CreateObject();
+	cJSON_AddNumberToObject(queries, "total", sum->total);
+	cJSON_AddNumberToObject(queries, "blocked", sum->blocked);
+	cJSON_AddNumberToObject(queries, "percent_blocked", percent_blocked);
+	cJSON_AddNumberToObject(queries, "unique_domains", sum->domains);
+	cJSON_AddNumberToObject(queries, "forwarded", sum->forwarded);
+	cJSON_AddNumberToObject(queries, "cached", sum->cached);
+	cJSON_AddNumberToObject(queries, "frequency", sum->frequency);
+
+	cJSON *types = cJSON_CreateObject();
+	for(enum query_type type = TYPE_A; type < TYPE_MAX; type++)
+	{
+		// We add the collective OTHER type at the end
+		if(type == TYPE_OTHER)
+			continue;
+		cJSON_AddNumberToObject(types, get_query_type_str(type, NULL, NULL), sum->types[type]);
+	}
+	cJSON_AddNumberToObject(types, "OTHER", sum->types[TYPE_OTHER]);
+	cJSON_AddItemToObject(queries, "types", types);
+
+	cJSON *statuses = cJSON_CreateObject();
+	for(enum query_status status = 0; status < QUERY_STATUS_MAX; status++)
+		cJSON_AddNumberToObject(statuses, get_query_status_str(status), sum->status[status]);
+	cJSON_AddItemToObject(queries, "status", statuses);
+
+	cJSON *replies = cJSON_CreateObject();
+	for(enum reply_type reply = 0; reply < QUERY_REPLY_MAX; reply++)
+		cJSON_AddNumberToObject(replies, get_query_reply_str(reply), sum->reply[reply]);
+	cJSON_AddItemToObject(queries, "replies", replies);
+
+	cJSON *clients = cJSON_CreateObject();
+	cJSON_AddNumberToObject(clients, "active", sum->clients_active);
+	cJSON_AddNumberToObject(clients, "total", sum->clients_total);
+
+	// All nodes are expected to use the same lists, the numbers of this
+	// node are shown
+	cJSON *gravity = cJSON_CreateObject();
+	cJSON_AddNumberToObject(gravity, "domains_being_blocked", sum->gravity);
+	cJSON_AddNumberToObject(gravity, "last_update", gravity_last_updated());
+
+	cJSON *cluster = cJSON_CreateObject();
+	cJSON_AddNumberToObject(cluster, "nodes", nodes);
+
+	free(sum);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(json, "queries", queries);
+	JSON_ADD_ITEM_TO_OBJECT(json, "clients", clients);
+	JSON_ADD_ITEM_TO_OBJECT(json, "gravity", gravity);
+	JSON_ADD_ITEM_TO_OBJECT(json, "cluster", cluster);
+	JSON_SEND_OBJECT(json);
+}
+
+// /api/history?cluster=true
+int api_history_cluster(struct ftl_conn *api)
+{
+	unsigned int interval = 0;
+	if(api->request->query_string != NULL)
+		get_uint_var(api->request->query_string, "interval", &interval);
+	if(interval > 0 && interval < OVERTIME_INTERVAL)
+	{
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "Cluster views only support the default interval",
+		                       NULL);
+	}
+
+	struct fed_slot *slots = calloc(OVERTIME_SLOTS, sizeof(*slots));
+	if(slots == NULL)
+	{
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to allocate memory for overTime data",
+		                       NULL);
+	}
+
+	const unsigned int num_slots = federation_cluster_history(slots);
+	cJSON *history = cJSON_CreateArray();
+	for(unsigned int slot = 0; slot < num_slots; slot++)
+	{
+		cJSON *item = cJSON_CreateObject();
+		cJSON_AddNumberToObject(item, "timestamp", slots[slot].timestamp);
+		cJSON_AddNumberToObject(item, "total", slots[slot].total);
+		cJSON_AddNumberToObject(item, "cached", slots[slot].cached);
+		cJSON_AddNumberToObject(item, "blocked", slots[slot].blocked);
+		cJSON_AddNumberToObject(item, "forwarded", slots[slot].forwarded);
+		cJSON_AddItemToArray(history, item);
+	}
+	free(slots);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(json, "history", history);
+	JSON_SEND_OBJECT(json);
+}
+
+// /api/stats/top_domains?cluster=true and /api/stats/top_clients?cluster=true
+int api_stats_top_cluster(struct ftl_conn *api, const bool clients)
+{
+	bool blocked = false;
+	int count = 10;
+	if(api->request->query_string != NULL)
+	{
+		get_bool_var(api->request->query_string, "blocked", &blocked);
+		get_int_var(api->request->query_string, "count", &count);
+	}
+	// Only the heads of the top lists are exchanged between nodes
+	if(count < 1 || count > (int)FEDERATION_TOP_SIZE)
+		count = FEDERATION_TOP_SIZE;
+
+	const enum top_list_type type = clients ?
+		(blocked ? TOP_CLIENTS_BLOCKED : TOP_CLIENTS_TOTAL) :
+		(blocked ? TOP_DOMAINS_BLOCKED : TOP_DOMAINS_PERMITTED);
+	struct fed_top *top = calloc(count, sizeof(*top));
+	struct fed_node *sum = calloc(1, sizeof(*sum));
+	unsigned int nodes = 0;
+	const int num = top != NULL ? federation_cluster_top(type, top, count) : -1;
+	if(num < 0 || sum == NULL || !federation_cluster_counters(sum, &nodes))
+	{
+		free(top);
+		free(sum);
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to collect cluster statistics",
+		                       NULL);
+	}
+
+	cJSON *list = cJSON_CreateArray();
+	for(int i = 0; i < num; i++)
+	{
+		cJSON *item = cJSON_CreateObject();
+		if(clients)
+		{
+			cJSON_AddStringToObject(item, "name", top[i].name);
+			cJSON_AddStringToObject(item, "ip", top[i].ip);
+		}
+		else
+			cJSON_AddStringToObject(item, "domain", top[i].name);
+		cJSON_AddNumberToObject(item, "count", top[i].count);
+		cJSON_AddItemToArray(list, item);
+	}
+	const int total = sum->total, blocked_count = sum->blocked;
+	free(top);
+	free(sum);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(json, clients ? "clients" : "domains", list);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "total_queries", total);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "blocked_queries", blocked_count);
+	JSON_SEND_OBJECT(json);
+}
@@ -21,28 +21,107 @@
 // get_max_overtime_slot()
 #include "gc.h"
 
+// Number of clients ranked per overTime slot, requests for more clients rank
+// all clients of each slot again
+#define RANKED_CLIENTS 100u
+
+/**
+ * struct slot_ranking - Clients with the most queries in one overTime slot
+ * @timestamp: Timestamp of the ranked slot (0 if unused)
+ * @total: Total number of queries in this slot when it was ranked
+ * @client_generation: Client generation when the slot was ranked
+ * @k: Number of clients which have been asked for
+ * @num: Number of ranked clients, only clients with queries are ranked so the
+ *       ranking is complete if num < k
+ * @sum: Queries of all clients not managed by alias-clients in this slot
+ * @ranked: IDs and counts of the ranked clients in descending order
+ *
+ * Client counts of a slot only change together with its total. Once a slot
+ * has been closed, its ranking can hence be used until the slot leaves the
+ * overTime window or clients joined or left alias-clients. Only the current
+ * slot is ranked again when it received further queries.
+ */
+struct slot_ranking {
+	time_t timestamp;
+	int total;
+	unsigned int client_generation;
+	unsigned int k;
+	unsigned int num;
+	int sum;
+	int ranked[RANKED_CLIENTS][2];
+};
+
+static struct slot_ranking rankings[OVERTIME_SLOTS] = {{ 0 }};
+static pthread_mutex_t rankings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Get the overTime tier matching the interval requested by the user (if any)
+// and allocate a buffer for a copy of its slots if this is one of the finer
+// tiers. Returns false if the buffer could not be allocated
+static bool get_requested_tier(struct ftl_conn *api, enum overtime_tier *tier, overTimeData **tierdata)
+{
+	unsigned int interval = 0;
+	if(api->request->query_string != NULL)
+	{
+		// Does the user request a finer resolution?
+		get_uint_var(api->request->query_string, "interval", &interval);
+	}
+
+	*tier = get_overTime_tier(interval);
+	*tierdata = NULL;
+	if(*tier == OVERTIME_TIER_DEFAULT)
+		return true;
+
+	*tierdata = calloc(get_overTime_tier_slots(*tier), sizeof(overTimeData));
+	return *tierdata != NULL;
+}
+
 int api_history(struct ftl_conn *api)
 {
-	lock_shm();
+	if(api_cluster_view(api))
+		return api_history_cluster(api);
+
+	enum overtime_tier tier;
+	overTimeData *tierdata = NULL;
+	if(!get_requested_tier(api, &tier, &tierdata))
+	{
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to allocate memory for overTime data",
+		                       NULL);
+	}
+
+	lock_shm_read();
+
+	// Finer tiers are copied in chronological order, the regular overTime
+	// slots are already stored in this order
+	const overTimeData *data = overTime;
+	unsigned int num_slots = get_max_overtime_slot() + 1;
+	if(tierdata != NULL)
+	{
+		num_slots = copy_overTime_tier(tier, time(NULL), tierdata);
+		data = tierdata;
+	}
 
 	cJSON *history = JSON_NEW_ARRAY();
-	const unsigned int max_slot = get_max_overtime_slot();
 	// Loop over all overTime slots and add them to the array
-	for(unsigned int slot = 0; slot <= max_slot; slot++)
+	for(unsigned int slot = 0; slot < num_slots; slot++)
 	{
 		cJSON *item = JSON_NEW_OBJECT();
-		JSON_ADD_NUMBER_TO_OBJECT(item, "timestamp", overTime[slot].timestamp);
-		JSON_ADD_NUMBER_TO_OBJECT(item, "total", overTime[slot].total);
-		JSON_ADD_NUMBER_TO_OBJECT(item, "cached", overTime[slot].cached);
-		JSON_ADD_NUMBER_TO_OBJECT(item, "blocked", overTime[slot].blocked);
-		JSON_ADD_NUMBER_TO_OBJECT(item, "forwarded", overTime[slot].forwarded);
+		JSON_ADD_NUMBER_TO_OBJECT(item, "timestamp", data[slot].timestamp);
+		JSON_ADD_NUMBER_TO_OBJECT(item, "total", data[slot].total);
+		JSON_ADD_NUMBER_TO_OBJECT(item, "cached", data[slot].cached);
+		JSON_ADD_NUMBER_TO_OBJECT(item, "blocked", data[slot].blocked);
+		JSON_ADD_NUMBER_TO_OBJECT(item, "forwarded", data[slot].forwarded);
 		JSON_ADD_ITEM_TO_ARRAY(history, item);
 	}
 
 	// Unlock already here to avoid keeping the lock during JSON generation
 	// This is safe because we don't access any shared memory after this
 	// point. All numbers in the JSON are copied
-	unlock_shm();
+	unlock_shm_read();
+
+	if(tierdata != NULL)
+		free(tierdata);
 
 	// Minimum structure is
 	// {"history":[]}
@@ -51,7 +130,171 @@ int api_history(struct ftl_conn *api)
 	JSON_SEND_OBJECT(json);
 }
 
-static unsigned int build_client_temparray(int *temparray, const int slot)
+// Get the number of queries of a client in the given slot. If slotcounts is
+// not NULL, the counts of a finer tier have been collected into it
+static inline int client_slot_count(const clientsData *client, const unsigned int clientID,
+                                    const int slot, const int *slotcounts)
+{
+	if(slot < 0)
+		return client->count;
+	if(slotcounts != NULL)
+		return slotcounts[clientID];
+	return client->overTime[slot];
+}
+
+/**
+ * Count the queries of each client in one slot of a finer tier. Clients do not
+ * carry per-client data for the finer tiers, the counts are collected from the
+ * queries in memory instead. As queries are stored in chronological order, all
+ * slots of one request can be collected in one pass over the queries of this
+ * period.
+ *
+ * @param slotcounts Array of counters->clients elements, overwritten
+ * @param queryID ID of the first query not yet collected, this is advanced to
+ * the first query after this slot
+ * @param recordID ID of the first record of the cold tier not yet collected,
+ * this is advanced like queryID
+ * @param start Start of the slot
+ * @param end End of the slot
+ */
+static void collect_client_slot(int *slotcounts, unsigned int *queryID, unsigned int *recordID,
+                                const double start, const double end)
+{
+	memset(slotcounts, 0, counters->clients * sizeof(int));
+
+	// Older queries may have been moved into the cold tier which counts
+	// them per minute
+	for(; *recordID < counters->cold_records; (*recordID)++)
+	{
+		const struct cold_query *cold = get_cold_record(*recordID);
+		if(cold->timestamp >= end)
+			break;
+		if(cold->timestamp < start)
+			continue;
+
+		slotcounts[cold->clientID] += cold->count;
+		const clientsData *client = getClient(cold->clientID, true);
+		if(client != NULL && client->aliasclient_id > -1)
+			slotcounts[client->aliasclient_id] += cold->count;
+	}
+
+	for(; *queryID < (unsigned int)counters->queries; (*queryID)++)
+	{
+		const queriesData *query = getQuery(*queryID, true);
+		if(query == NULL)
+			continue;
+
+		const double timestamp = get_query_timestamp(query);
+		if(timestamp >= end)
+			break;
+		if(timestamp < start)
+			continue;
+
+		// Count the query for its client and the alias-client the client
+		// belongs to (if any)
+		slotcounts[query->clientID]++;
+		const clientsData *client = getClient(query->clientID, true);
+		if(client != NULL && client->aliasclient_id > -1)
+			slotcounts[client->aliasclient_id]++;
+	}
+}
+
+// Find the oldest query at or after the given timestamp
+static unsigned int find_first_query(const double start)
+{
+	unsigned int queryID = counters->queries;
+	while(queryID > 0)
+	{
+		const queriesData *query = getQuery(queryID - 1, true);
+		if(query != NULL && get_query_timestamp(query) < start)
+			break;
+		queryID--;
+	}
+	return queryID;
+}
+
+// Find the oldest record of the cold tier at or after the given timestamp
+static unsigned int __attribute__((pure)) find_first_cold_record(const double start)
+{
+	unsigned int lo = 0, hi = counters->cold_records;
+	while(lo < hi)
+	{
+		const unsigned int mid = lo + (hi - lo) / 2;
+		if(get_cold_record(mid)->timestamp < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// Clients managed by an alias-client are counted by their alias-client
+static inline bool managed_by_aliasclient(const clientsData *client)
+{
+	return !client->flags.aliasclient && client->aliasclient_id > -1;
+}
+
+/**
+ * Get the k clients with the most queries in a slot of the regular overTime
+ * data. The caller has to hold the SHM lock and rankings_lock.
+ *
+ * @param slot Index of the slot
+ * @param k Number of clients to rank, at most RANKED_CLIENTS
+ * @return The ranking of this slot
+ */
+static const struct slot_ranking *rank_slot(const unsigned int slot, const unsigned int k)
+{
+	// Slots move through the overTime array, their rankings are stored by
+	// timestamp instead
+	const time_t timestamp = overTime[slot].timestamp;
+	struct slot_ranking *r = &rankings[(timestamp / OVERTIME_INTERVAL) % OVERTIME_SLOTS];
+	const unsigned int client_generation = get_client_generation();
+	if(r->timestamp == timestamp && r->total == overTime[slot].total &&
+	   r->client_generation == client_generation && (r->k >= k || r->num < r->k))
+		return r;
+
+	r->num = 0;
+	r->sum = 0;
+	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		const clientsData *client = getClient(clientID, true);
+		if(client == NULL || managed_by_aliasclient(client))
+			continue;
+
+		const int count = client->overTime[slot];
+		r->sum += count;
+		if(count < 1 || k == 0 || (r->num == k && count <= r->ranked[k - 1][1]))
+			continue;
+
+		// Insert into the ranking, the client with the fewest queries
+		// drops out if the ranking is already full
+		unsigned int i = r->num < k ? r->num++ : k - 1;
+		for(; i > 0 && r->ranked[i - 1][1] < count; i--)
+		{
+			r->ranked[i][0] = r->ranked[i - 1][0];
+			r->ranked[i][1] = r->ranked[i - 1][1];
+		}
+		r->ranked[i][0] = clientID;
+		r->ranked[i][1] = count;
+	}
+
+	r->timestamp = timestamp;
+	r->total = overTime[slot].total;
+	r->client_generation = client_generation;
+	r->k = k;
+
+	return r;
+}
+
+static bool __attribute__((pure)) is_ranked(const struct slot_ranking *r, const int clientID)
+{
+	for(unsigned int i = 0; i < r->num; i++)
+		if(r->ranked[i][0] == clientID)
+			return true;
+	return false;
+}
+
+static unsigned int build_client_temparray(int *temparray, const int slot, const int *slotcounts)
 {
 	// Clear temporary array
 	memset(temparray, 0, 2 * counters->clients * sizeof(int));
@@ -68,7 +311,7 @@ static unsigned int build_client_temparray(int *temparray, const int slot)
 
 		// If this client is managed by an alias-client, we substitute
 		// -1 for the total count
-		if(!client->flags.aliasclient && client->aliasclient_id > -1)
+		if(managed_by_aliasclient(client))
 		{
 			log_debug(DEBUG_API, "Skipping client (ID %u) contained in alias-client with ID %d",
 			          clientID, client->aliasclient_id);
@@ -81,7 +324,7 @@ static unsigned int build_client_temparray(int *temparray, const int slot)
 		// Otherwise, we return the number of queries in the given time
 		// slot
 		temparray[2*num_clients + 0] = clientID;
-		temparray[2*num_clients + 1] = slot < 0 ? client->count : client->overTime[slot];
+		temparray[2*num_clients + 1] = client_slot_count(client, clientID, slot, slotcounts);
 
 		// Increase number of clients by one
 		num_clients++;
@@ -120,23 +363,56 @@ int api_history_clients(struct ftl_conn *api)
 		Nc = counters->clients;
 	}
 
+	enum overtime_tier tier;
+	overTimeData *tierdata = NULL;
+	if(!get_requested_tier(api, &tier, &tierdata))
+	{
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to allocate memory for overTime data",
+		                       NULL);
+	}
+
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
-	// Allocate memory for the temporary buffer for ranking our clients
+	// Allocate memory for the temporary buffer for ranking our clients and,
+	// for the finer tiers, for collecting the per-client counts of one slot
 	int *temparray = calloc(counters->clients, 2 * sizeof(int));
-	if(temparray == NULL)
+	int *slotcounts = tierdata != NULL ? calloc(counters->clients, sizeof(int)) : NULL;
+	if(temparray == NULL || (tierdata != NULL && slotcounts == NULL))
 	{
-		unlock_shm();
+		unlock_shm_read();
+		if(temparray != NULL)
+			free(temparray);
+		if(slotcounts != NULL)
+			free(slotcounts);
+		if(tierdata != NULL)
+			free(tierdata);
 		return send_json_error(api, 500,
 		                       "internal_error",
 		                       "Failed to allocate memory for temporary array",
 		                       NULL);
 	}
 
+	// Finer tiers are copied in chronological order, the regular overTime
+	// slots are already stored in this order
+	const overTimeData *data = overTime;
+	unsigned int num_slots = get_max_overtime_slot() + 1;
+	unsigned int interval = OVERTIME_INTERVAL;
+	unsigned int queryID = 0, recordID = 0;
+	if(tierdata != NULL)
+	{
+		num_slots = copy_overTime_tier(tier, time(NULL), tierdata);
+		data = tierdata;
+		interval = get_overTime_tier_interval(tier);
+		queryID = find_first_query(data[0].timestamp - interval / 2);
+		recordID = find_first_cold_record(data[0].timestamp - interval / 2);
+	}
+
 	// Get MAX_CLIENTS clients with the highest number of queries
 	// Skip clients included in others (in alias-clients)
-	unsigned int num_clients = build_client_temparray(temparray, -1);
+	unsigned int num_clients = build_client_temparray(temparray, -1, NULL);
 
 	if(config.webserver.api.client_history_global_max.v.b)
 	{
@@ -147,22 +423,78 @@ int api_history_clients(struct ftl_conn *api)
 		qsort(temparray, num_clients, sizeof(int[2]), cmpdesc);
 	}
 
+	// The regular overTime slots use the rankings kept across requests
+	// -1 because of the special "other" client
+	const unsigned int k = Nc > 0 ? Nc - 1 : 0;
+	const bool use_rankings = tierdata == NULL && k <= RANKED_CLIENTS;
+	if(use_rankings)
+		pthread_mutex_lock(&rankings_lock);
+
 	// Main return loop
 	int others_total = 0;
 
 	cJSON *history = JSON_NEW_ARRAY();
-	const unsigned int max_slot = get_max_overtime_slot();
-	for(unsigned int slot = 0; slot <= max_slot; slot++)
+	for(unsigned int slot = 0; slot < num_slots; slot++)
 	{
 		cJSON *item = JSON_NEW_OBJECT();
-		JSON_ADD_NUMBER_TO_OBJECT(item, "timestamp", overTime[slot].timestamp);
+		if(use_rankings)
+		{
+			// The JSON macros cannot be used while holding
+			// rankings_lock as they return on errors
+			cJSON_AddNumberToObject(item, "timestamp", data[slot].timestamp);
+			const struct slot_ranking *r = rank_slot(slot, k);
+			int named = 0;
+			unsigned int num_named = 0;
+			cJSON *clientdata = JSON_NEW_OBJECT();
+			if(!config.webserver.api.client_history_global_max.v.b)
+			{
+				// Clients with the most queries in this slot
+				for(; num_named < r->num && num_named < k; num_named++)
+				{
+					const clientsData *client = getClient(r->ranked[num_named][0], true);
+					cJSON_AddNumberToObject(clientdata, getstr(client->ippos), r->ranked[num_named][1]);
+					named += r->ranked[num_named][1];
+				}
+			}
+
+			// In global-max mode, the same clients are returned for
+			// all slots. Otherwise, fill up with clients without
+			// queries in this slot (temparray holds all clients)
+			for(unsigned int arrayID = 0; num_named < k && arrayID < num_clients; arrayID++)
+			{
+				const int clientID = temparray[2*arrayID + 0];
+				if(!config.webserver.api.client_history_global_max.v.b && is_ranked(r, clientID))
+					continue;
+
+				const clientsData *client = getClient(clientID, true);
+				cJSON_AddNumberToObject(clientdata, getstr(client->ippos), client->overTime[slot]);
+				named += client->overTime[slot];
+				num_named++;
+			}
+
+			// All other clients are summed up as "others"
+			others_total += r->sum - named;
+			cJSON_AddNumberToObject(clientdata, "others", r->sum - named);
+
+			JSON_ADD_ITEM_TO_OBJECT(item, "data", clientdata);
+			JSON_ADD_ITEM_TO_ARRAY(history, item);
+			continue;
+		}
+
+		JSON_ADD_NUMBER_TO_OBJECT(item, "timestamp", data[slot].timestamp);
+
+		// Collect per-client data of this slot for the finer tiers
+		if(slotcounts != NULL)
+			collect_client_slot(slotcounts, &queryID, &recordID,
+			                    data[slot].timestamp - interval / 2,
+			                    data[slot].timestamp + (interval + 1) / 2);
 
 		// If we are not in global-max mode, we need to build the temporary
 		// client array for each slot individually
 		if(!config.webserver.api.client_history_global_max.v.b)
 		{
 			// Collect global client data
-			num_clients = build_client_temparray(temparray, slot);
+			num_clients = build_client_temparray(temparray, slot, slotcounts);
 
 			// Sort temporary array. Even when the array itself has <counters.clients>
 			// elements, we only sort the first <clients> elements to avoid sorting
@@ -173,7 +505,7 @@ int api_history_clients(struct ftl_conn *api)
 
 		// Loop over clients to generate output to be sent to the client
 		int others = 0;
-		cJSON *data = JSON_NEW_OBJECT();
+		cJSON *clientdata = JSON_NEW_OBJECT();
 		for(unsigned int arrayID = 0; arrayID < num_clients; arrayID++)
 		{
 
@@ -192,21 +524,25 @@ int api_history_clients(struct ftl_conn *api)
 			// all clients
 			if(arrayID >= Nc - 1)
 			{
-				others += client->overTime[slot];
+				others += client_slot_count(client, clientID, slot, slotcounts);
 				continue;
 			}
 
 			// Add client to the array
-			cJSON_AddNumberToObject(data, getstr(client->ippos), client->overTime[slot]);
+			cJSON_AddNumberToObject(clientdata, getstr(client->ippos),
+			                        client_slot_count(client, clientID, slot, slotcounts));
 		}
 		// Add others as last element in the array
 		others_total += others;
-		JSON_ADD_NUMBER_TO_OBJECT(data, "others", others);
+		JSON_ADD_NUMBER_TO_OBJECT(clientdata, "others", others);
 
-		JSON_ADD_ITEM_TO_OBJECT(item, "data", data);
+		JSON_ADD_ITEM_TO_OBJECT(item, "data", clientdata);
 		JSON_ADD_ITEM_TO_ARRAY(history, item);
 	}
 
+	if(use_rankings)
+		pthread_mutex_unlock(&rankings_lock);
+
 	// Loop over clients to generate output to be sent to the client
 	cJSON *clients = JSON_NEW_OBJECT();
 	for(unsigned int arrayID = 0; arrayID < num_clients; arrayID++)
@@ -233,16 +569,16 @@ int api_history_clients(struct ftl_conn *api)
 
 		// Create JSON object for this client
 		cJSON *item = JSON_NEW_OBJECT();
-		JSON_REF_STR_IN_OBJECT(item, "name", client_name);
+		JSON_COPY_STR_TO_OBJECT(item, "name", client_name);
 		JSON_ADD_NUMBER_TO_OBJECT(item, "total", client->count);
 		JSON_ADD_ITEM_TO_OBJECT(clients, client_ip, item);
 	}
 
 	// Unlock already here to avoid keeping the lock during JSON generation
 	// This is safe because we don't access any shared memory after this
-	// point and all strings in the JSON are references to idempotent shared
-	// memory and can, thus, be accessed at any time without locking
-	unlock_shm();
+	// point. All strings in the JSON are copied as the garbage collection
+	// may compact the shared strings once we released the lock
+	unlock_shm_read();
 
 	// Add "others" client only if there are more clients than we return
 	// and if we are not returning all clients
@@ -256,6 +592,10 @@ int api_history_clients(struct ftl_conn *api)
 
 	// Free memory
 	free(temparray);
+	if(slotcounts != NULL)
+		free(slotcounts);
+	if(tierdata != NULL)
+		free(tierdata);
 
 	cJSON *json = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(json, "history", history);
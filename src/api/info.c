@@ -22,8 +22,9 @@
 #include "files.h"
 // get_sqlite3_version()
 #include "database/common.h"
-// get_number_of_queries_in_DB()
+// db_counts()
 #include "database/query-table.h"
+#include "database/database-thread.h"
 // getgrgid()
 #include <grp.h>
 // config struct
@@ -32,7 +33,7 @@
 #include "datastructure.h"
 // uname()
 #include <sys/utsname.h>
-// get_ftl_cpu_percentage()
+// get_ftl_cpu_percentage(), get_thread_usage()
 #include "daemon.h"
 // getProcessMemory()
 #include "procps.h"
@@ -57,6 +58,14 @@
 
 // timer_elapsed_msec()
 #include "timers.h"
+// gravity_filter_stats()
+#include "database/gravity-filter.h"
+// get_gc_pause_stats()
+#include "gc.h"
+// get_alloc_sites()
+#include "syscalls/alloc-stats.h"
+// get_ntp_server_stats()
+#include "ntp/ntp.h"
 
 #define VERSIONS_FILE "/etc/pihole/versions"
 
@@ -146,9 +155,33 @@ int api_info_database(struct ftl_conn *api)
 	JSON_ADD_ITEM_TO_OBJECT(owner, "group", group);
 	JSON_ADD_ITEM_TO_OBJECT(json, "owner", owner);
 
-	// Add number of queries in on-disk database
-	const int queries_in_database = get_number_of_queries_in_DB(NULL, "query_storage");
-	JSON_ADD_NUMBER_TO_OBJECT(json, "queries", queries_in_database);
+	// Add number of queries in the database
+	unsigned long last_idx = 0, mem_num = 0, disk_num = 0;
+	db_counts(&last_idx, &mem_num, &disk_num);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "queries", mem_num);
+
+	// Add queries waiting to be stored in the in-memory database
+	double export_age = 0.0;
+	cJSON *export = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(export, "pending", get_export_queue(&export_age));
+	JSON_ADD_NUMBER_TO_OBJECT(export, "age", export_age);
+	JSON_ADD_ITEM_TO_OBJECT(json, "export", export);
+
+	// Add timings of the disk jobs of the database thread
+	struct db_job_stats stats[DB_JOBS];
+	get_db_job_stats(stats);
+	cJSON *jobs = JSON_NEW_OBJECT();
+	for(unsigned int i = 0; i < DB_JOBS; i++)
+	{
+		cJSON *job = JSON_NEW_OBJECT();
+		JSON_ADD_NUMBER_TO_OBJECT(job, "runs", stats[i].runs);
+		JSON_ADD_NUMBER_TO_OBJECT(job, "deferred", stats[i].deferred);
+		JSON_ADD_NUMBER_TO_OBJECT(job, "last", stats[i].last);
+		JSON_ADD_NUMBER_TO_OBJECT(job, "max", stats[i].max);
+		JSON_ADD_NUMBER_TO_OBJECT(job, "total", stats[i].total);
+		JSON_ADD_ITEM_TO_OBJECT(jobs, get_db_job_name(i), job);
+	}
+	JSON_ADD_ITEM_TO_OBJECT(json, "jobs", jobs);
 
 	// Add SQLite library version
 	JSON_REF_STR_IN_OBJECT(json, "sqlite_version", get_sqlite3_version());
@@ -541,7 +574,7 @@ static int get_ftl_obj(struct ftl_conn *api, cJSON *ftl)
 	cJSON *database = JSON_NEW_OBJECT();
 
 	// Source from shared objects within lock
-	lock_shm();
+	lock_shm_read();
 	const int db_gravity = counters->database.gravity;
 	const int db_groups = counters->database.groups;
 	const int db_lists = counters->database.lists;
@@ -551,22 +584,22 @@ static int get_ftl_obj(struct ftl_conn *api, cJSON *ftl)
 	const int db_allowed_regex = counters->database.domains.allowed.regex;
 	const int db_denied_regex = counters->database.domains.denied.regex;
 	const int clients_total = counters->clients;
+	const unsigned int queries_total = counters->queries;
+	const unsigned int queries_capacity = counters->queries_MAX;
+	const unsigned int queries_oldest = counters->queries_oldest;
 	const int privacylevel = config.misc.privacylevel.v.privacy_level;
 	const double qps = get_qps();
+	struct gravity_filter_stats filter = { 0 };
+	gravity_filter_stats(&filter);
+	struct shm_lock_stats lock_stats[SHM_LOCK_PATHS] = { 0 };
+	get_shm_lock_stats(lock_stats);
+	struct gc_pause_stats gc_stats = { 0 };
+	unsigned int gc_bounds[GC_PAUSE_BUCKETS - 1] = { 0 };
+	get_gc_pause_stats(&gc_stats, gc_bounds);
 
 	// unique_clients: count only clients that have been active within the most recent 24 hours
-	int activeclients = 0;
-	for(unsigned int clientID=0; clientID < counters->clients; clientID++)
-	{
-		// Get client pointer
-		const clientsData *client = getClient(clientID, true);
-		if(client == NULL)
-			continue;
-
-		if(client->count > 0)
-			activeclients++;
-	}
-	unlock_shm();
+	const unsigned int activeclients = get_active_clients();
+	unlock_shm_read();
 
 	JSON_ADD_NUMBER_TO_OBJECT(database, "gravity", db_gravity);
 	JSON_ADD_NUMBER_TO_OBJECT(database, "groups", db_groups);
@@ -582,6 +615,13 @@ static int get_ftl_obj(struct ftl_conn *api, cJSON *ftl)
 	JSON_ADD_NUMBER_TO_OBJECT(regex, "allowed", db_allowed_regex);
 	JSON_ADD_NUMBER_TO_OBJECT(regex, "denied", db_denied_regex);
 	JSON_ADD_ITEM_TO_OBJECT(database, "regex", regex);
+
+	cJSON *jfilter = JSON_NEW_OBJECT();
+	JSON_ADD_BOOL_TO_OBJECT(jfilter, "ready", filter.ready);
+	JSON_ADD_NUMBER_TO_OBJECT(jfilter, "entries", filter.entries);
+	JSON_ADD_NUMBER_TO_OBJECT(jfilter, "memory", filter.memory);
+	JSON_ADD_NUMBER_TO_OBJECT(jfilter, "fpr", filter.fpr);
+	JSON_ADD_ITEM_TO_OBJECT(database, "filter", jfilter);
 	JSON_ADD_ITEM_TO_OBJECT(ftl, "database", database);
 
 	JSON_ADD_NUMBER_TO_OBJECT(ftl, "privacy_level", privacylevel);
@@ -592,6 +632,47 @@ static int get_ftl_obj(struct ftl_conn *api, cJSON *ftl)
 	JSON_ADD_NUMBER_TO_OBJECT(clients, "active", activeclients);
 	JSON_ADD_ITEM_TO_OBJECT(ftl, "clients", clients);
 
+	// Ring buffer of the queries in memory
+	cJSON *queries = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(queries, "total", queries_total);
+	JSON_ADD_NUMBER_TO_OBJECT(queries, "capacity", queries_capacity);
+	JSON_ADD_NUMBER_TO_OBJECT(queries, "oldest", queries_oldest);
+	JSON_ADD_ITEM_TO_OBJECT(ftl, "queries", queries);
+
+	// Shared memory lock wait times per access path (seconds)
+	cJSON *lock = JSON_NEW_OBJECT();
+	const char *lock_paths[SHM_LOCK_PATHS] = { "dns", "api", "other" };
+	for(unsigned int i = 0; i < SHM_LOCK_PATHS; i++)
+	{
+		cJSON *path = JSON_NEW_OBJECT();
+		JSON_ADD_NUMBER_TO_OBJECT(path, "count", lock_stats[i].count);
+		JSON_ADD_NUMBER_TO_OBJECT(path, "wait", 1e-9 * lock_stats[i].wait);
+		JSON_ADD_NUMBER_TO_OBJECT(path, "max", 1e-9 * lock_stats[i].max);
+		JSON_ADD_NUMBER_TO_OBJECT(path, "readers", 1e-9 * lock_stats[i].readers);
+		JSON_ADD_ITEM_TO_OBJECT(lock, lock_paths[i], path);
+	}
+	JSON_ADD_ITEM_TO_OBJECT(ftl, "lock", lock);
+
+	// Time the garbage collection was holding the lock (seconds)
+	cJSON *gc = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(gc, "runs", gc_stats.runs);
+	JSON_ADD_NUMBER_TO_OBJECT(gc, "count", gc_stats.count);
+	JSON_ADD_NUMBER_TO_OBJECT(gc, "total", 1e-9 * gc_stats.total);
+	JSON_ADD_NUMBER_TO_OBJECT(gc, "max", 1e-9 * gc_stats.max);
+	cJSON *histogram = JSON_NEW_ARRAY();
+	for(unsigned int i = 0; i < GC_PAUSE_BUCKETS; i++)
+	{
+		cJSON *bucket = JSON_NEW_OBJECT();
+		if(i < GC_PAUSE_BUCKETS - 1)
+			JSON_ADD_NUMBER_TO_OBJECT(bucket, "upper", 1e-6 * gc_bounds[i]);
+		else
+			JSON_ADD_NULL_TO_OBJECT(bucket, "upper");
+		JSON_ADD_NUMBER_TO_OBJECT(bucket, "count", gc_stats.buckets[i]);
+		JSON_ADD_ITEM_TO_ARRAY(histogram, bucket);
+	}
+	JSON_ADD_ITEM_TO_OBJECT(gc, "histogram", histogram);
+	JSON_ADD_ITEM_TO_OBJECT(ftl, "gc", gc);
+
 	JSON_ADD_NUMBER_TO_OBJECT(ftl, "pid", getpid());
 
 	JSON_ADD_NUMBER_TO_OBJECT(ftl, "uptime", timer_elapsed_msec(EXIT_TIMER));
@@ -603,6 +684,35 @@ static int get_ftl_obj(struct ftl_conn *api, cJSON *ftl)
 	JSON_ADD_NUMBER_TO_OBJECT(ftl, "%mem", pmem.VmRSS_percent);
 	JSON_ADD_NUMBER_TO_OBJECT(ftl, "%cpu", get_ftl_cpu_percentage());
 
+	// CPU and scheduling statistics of the individual threads
+	struct thread_usage usage[THREAD_USAGE_MAX];
+	const unsigned int nthreads = get_thread_usage(usage);
+	cJSON *threads_arr = JSON_NEW_ARRAY();
+	for(unsigned int i = 0; i < nthreads; i++)
+	{
+		cJSON *thread = JSON_NEW_OBJECT();
+		JSON_ADD_NUMBER_TO_OBJECT(thread, "tid", usage[i].proc.tid);
+		JSON_COPY_STR_TO_OBJECT(thread, "name", usage[i].proc.name);
+		JSON_ADD_NUMBER_TO_OBJECT(thread, "%cpu", usage[i].cpu);
+		JSON_ADD_NUMBER_TO_OBJECT(thread, "%wait", usage[i].wait);
+		JSON_ADD_NUMBER_TO_OBJECT(thread, "wakeups", usage[i].wakeups);
+		JSON_ADD_NUMBER_TO_OBJECT(thread, "user", usage[i].proc.user);
+		JSON_ADD_NUMBER_TO_OBJECT(thread, "system", usage[i].proc.system);
+		cJSON *switches = JSON_NEW_OBJECT();
+		JSON_ADD_NUMBER_TO_OBJECT(switches, "voluntary", usage[i].proc.voluntary);
+		JSON_ADD_NUMBER_TO_OBJECT(switches, "involuntary", usage[i].proc.involuntary);
+		JSON_ADD_ITEM_TO_OBJECT(thread, "context_switches", switches);
+		char cpus[256];
+		const char *policy = NULL;
+		int priority = 0;
+		get_thread_placement(usage[i].proc.tid, cpus, sizeof(cpus), &policy, &priority);
+		JSON_COPY_STR_TO_OBJECT(thread, "cpus", cpus);
+		JSON_REF_STR_IN_OBJECT(thread, "policy", policy);
+		JSON_ADD_NUMBER_TO_OBJECT(thread, "priority", priority);
+		JSON_ADD_ITEM_TO_ARRAY(threads_arr, thread);
+	}
+	JSON_ADD_ITEM_TO_OBJECT(ftl, "threads", threads_arr);
+
 	JSON_ADD_BOOL_TO_OBJECT(ftl, "allow_destructive", config.webserver.api.allow_destructive.v.b);
 
 	// dnsmasq struct
@@ -1017,7 +1127,10 @@ int api_info_messages(struct ftl_conn *api)
 int api_info_metrics(struct ftl_conn *api)
 {
 	struct metrics metrics = { 0 };
+	// The cache may be resized concurrently (dns.cache.autosize)
+	lock_shm_read();
 	get_dnsmasq_metrics(&metrics);
+	unlock_shm_read();
 	cJSON *cache = JSON_NEW_OBJECT();
 	JSON_ADD_NUMBER_TO_OBJECT(cache, "size", metrics.dns.cache.size);
 	JSON_ADD_NUMBER_TO_OBJECT(cache, "inserted", metrics.dns.cache.inserted);
@@ -1025,6 +1138,17 @@ int api_info_metrics(struct ftl_conn *api)
 	JSON_ADD_NUMBER_TO_OBJECT(cache, "expired", metrics.dns.cache.expired);
 	JSON_ADD_NUMBER_TO_OBJECT(cache, "immortal", metrics.dns.cache.immortal);
 
+	cJSON *prefetch = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(prefetch, "issued", __atomic_load_n(&counters->prefetch.issued, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(prefetch, "hits", __atomic_load_n(&counters->prefetch.hits, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(prefetch, "misses", __atomic_load_n(&counters->prefetch.misses, __ATOMIC_RELAXED));
+	JSON_ADD_ITEM_TO_OBJECT(cache, "prefetch", prefetch);
+
+	cJSON *cname = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(cname, "hits", __atomic_load_n(&counters->cname_verdicts.hits, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(cname, "misses", __atomic_load_n(&counters->cname_verdicts.misses, __ATOMIC_RELAXED));
+	JSON_ADD_ITEM_TO_OBJECT(cache, "cname", cname);
+
 	cJSON *content = JSON_NEW_ARRAY();
 	for(unsigned int i = 0; i < RRTYPES; i++)
 	{
@@ -1045,6 +1169,21 @@ int api_info_metrics(struct ftl_conn *api)
 	}
 	JSON_ADD_ITEM_TO_OBJECT(cache, "content", content);
 
+	cJSON *pools = JSON_NEW_OBJECT();
+	const struct { const char *name; const struct pool *pool; } pool_list[] = {
+		{ "blockdata", &metrics.dns.blockdata },
+		{ "bignames", &metrics.dns.bignames },
+		{ "frecs", &metrics.dns.frecs },
+	};
+	for(unsigned int i = 0; i < ArraySize(pool_list); i++)
+	{
+		cJSON *pool = JSON_NEW_OBJECT();
+		JSON_ADD_NUMBER_TO_OBJECT(pool, "used", pool_list[i].pool->used);
+		JSON_ADD_NUMBER_TO_OBJECT(pool, "hwm", pool_list[i].pool->hwm);
+		JSON_ADD_NUMBER_TO_OBJECT(pool, "allocated", pool_list[i].pool->allocated);
+		JSON_ADD_ITEM_TO_OBJECT(pools, pool_list[i].name, pool);
+	}
+
 	cJSON *replies = JSON_NEW_OBJECT();
 	JSON_ADD_NUMBER_TO_OBJECT(replies, "local", metrics.dns.local_answered);
 	JSON_ADD_NUMBER_TO_OBJECT(replies, "forwarded", metrics.dns.forwarded_queries);
@@ -1058,6 +1197,10 @@ int api_info_metrics(struct ftl_conn *api)
 	              + metrics.dns.auth_answered;
 	JSON_ADD_NUMBER_TO_OBJECT(replies, "sum", sum);
 
+	cJSON *coalesced = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(coalesced, "saved", __atomic_load_n(&counters->coalesced.saved, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(coalesced, "answered", __atomic_load_n(&counters->coalesced.answered, __ATOMIC_RELAXED));
+
 	cJSON *dhcp = JSON_NEW_OBJECT();
 	JSON_ADD_NUMBER_TO_OBJECT(dhcp, "ack", metrics.dhcp.ack);
 	JSON_ADD_NUMBER_TO_OBJECT(dhcp, "decline", metrics.dhcp.decline);
@@ -1078,19 +1221,171 @@ int api_info_metrics(struct ftl_conn *api)
 	JSON_ADD_NUMBER_TO_OBJECT(leases, "pruned_6", metrics.dhcp.leases.pruned_6);
 	JSON_ADD_ITEM_TO_OBJECT(dhcp, "leases", leases);
 
+	cJSON *udp = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(udp, "received", __atomic_load_n(&counters->udp.received, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(udp, "receive_calls", __atomic_load_n(&counters->udp.recv_calls, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(udp, "sent", __atomic_load_n(&counters->udp.sent, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(udp, "send_calls", __atomic_load_n(&counters->udp.send_calls, __ATOMIC_RELAXED));
+
+	cJSON *dnssec = JSON_NEW_OBJECT();
+	const uint64_t validations = __atomic_load_n(&counters->dnssec.validations, __ATOMIC_RELAXED);
+	const uint64_t usec = __atomic_load_n(&counters->dnssec.usec, __ATOMIC_RELAXED);
+	JSON_ADD_NUMBER_TO_OBJECT(dnssec, "validations", validations);
+	JSON_ADD_NUMBER_TO_OBJECT(dnssec, "time", 1e-6*usec);
+	JSON_ADD_NUMBER_TO_OBJECT(dnssec, "queued", get_dnssec_queued());
+	JSON_ADD_NUMBER_TO_OBJECT(dnssec, "verified", __atomic_load_n(&counters->dnssec.verified, __ATOMIC_RELAXED));
+	JSON_ADD_NUMBER_TO_OBJECT(dnssec, "memoized", __atomic_load_n(&counters->dnssec.memo_hits, __ATOMIC_RELAXED));
+
 	cJSON *dns = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(dns, "cache", cache);
+	JSON_ADD_ITEM_TO_OBJECT(dns, "pools", pools);
 	JSON_ADD_ITEM_TO_OBJECT(dns, "replies", replies);
+	JSON_ADD_ITEM_TO_OBJECT(dns, "coalesced", coalesced);
+	JSON_ADD_ITEM_TO_OBJECT(dns, "udp", udp);
+	JSON_ADD_ITEM_TO_OBJECT(dns, "dnssec", dnssec);
+
+	struct ntp_server_stats ntp_stats[2];
+	get_ntp_server_stats(ntp_stats);
+	cJSON *ntp = JSON_NEW_OBJECT();
+	for(unsigned int i = 0; i < ArraySize(ntp_stats); i++)
+	{
+		cJSON *server = JSON_NEW_OBJECT();
+		JSON_ADD_BOOL_TO_OBJECT(server, "active", ntp_stats[i].active);
+		JSON_ADD_NUMBER_TO_OBJECT(server, "requests", ntp_stats[i].requests);
+		JSON_ADD_NUMBER_TO_OBJECT(server, "replies", ntp_stats[i].replies);
+		JSON_ADD_NUMBER_TO_OBJECT(server, "invalid", ntp_stats[i].invalid);
+		JSON_ADD_NUMBER_TO_OBJECT(server, "errors", ntp_stats[i].errors);
+		JSON_ADD_NUMBER_TO_OBJECT(server, "receive_calls", ntp_stats[i].recv_calls);
+		JSON_ADD_NUMBER_TO_OBJECT(server, "send_calls", ntp_stats[i].send_calls);
+		cJSON *latency = JSON_NEW_OBJECT();
+		JSON_ADD_NUMBER_TO_OBJECT(latency, "avg", ntp_stats[i].replies > 0 ? 1e-6*ntp_stats[i].latency_sum/ntp_stats[i].replies : 0.0);
+		JSON_ADD_NUMBER_TO_OBJECT(latency, "max", 1e-6*ntp_stats[i].latency_max);
+		JSON_ADD_ITEM_TO_OBJECT(server, "latency", latency);
+		JSON_ADD_ITEM_TO_OBJECT(ntp, i == 0 ? "ipv4" : "ipv6", server);
+	}
 
 	cJSON *json = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(json, "dns", dns);
 	JSON_ADD_ITEM_TO_OBJECT(json, "dhcp", dhcp);
+	JSON_ADD_ITEM_TO_OBJECT(json, "ntp", ntp);
 
 	cJSON *json2 = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(json2, "metrics", json);
 	JSON_SEND_OBJECT(json2);
 }
 
+// Upper limit for the number of domains returned by /api/info/cache
+#define CACHE_DOMAINS_MAX 100
+
+struct cache_domain {
+	unsigned int id;
+	int hits;
+	int misses;
+};
+
+// Insert a domain into the list of the domains with the most cache misses (or
+// hits), the list is sorted by decreasing count and holds at most max entries
+static void add_cache_domain(struct cache_domain *list, unsigned int *num, const unsigned int max,
+                             const struct cache_domain *entry, const bool by_hits)
+{
+	const int count = by_hits ? entry->hits : entry->misses;
+	unsigned int pos = *num;
+	while(pos > 0 && (by_hits ? list[pos - 1].hits : list[pos - 1].misses) < count)
+		pos--;
+	if(pos >= max)
+		return;
+
+	const unsigned int last = *num < max ? *num : max - 1;
+	memmove(&list[pos + 1], &list[pos], (last - pos) * sizeof(*list));
+	list[pos] = *entry;
+	if(*num < max)
+		(*num)++;
+}
+
+int api_info_cache(struct ftl_conn *api)
+{
+	bool by_hits = false;
+	int count = 10;
+	if(api->request->query_string != NULL)
+	{
+		// Domains with the most hits instead of the most misses?
+		get_bool_var(api->request->query_string, "hits", &by_hits);
+
+		// Does the user request a non-default number of domains?
+		get_int_var(api->request->query_string, "count", &count);
+	}
+	if(count < 0)
+		count = 0;
+	else if(count > CACHE_DOMAINS_MAX)
+		count = CACHE_DOMAINS_MAX;
+
+	struct metrics metrics = { 0 };
+	// The cache may be resized concurrently (dns.cache.autosize)
+	lock_shm_read();
+	get_dnsmasq_metrics(&metrics);
+	unlock_shm_read();
+
+	cJSON *cache = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(cache, "size", metrics.dns.cache.size);
+	JSON_ADD_NUMBER_TO_OBJECT(cache, "inserted", metrics.dns.cache.inserted);
+
+	cJSON *evictions = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(evictions, "live", metrics.dns.cache.live_freed);
+	JSON_ADD_NUMBER_TO_OBJECT(evictions, "expired", metrics.dns.cache.expired_freed);
+	JSON_ADD_NUMBER_TO_OBJECT(evictions, "flushed", metrics.dns.cache.flushed);
+	JSON_ADD_ITEM_TO_OBJECT(cache, "evictions", evictions);
+
+	const char *ttl_names[CACHE_HIT_TTL_MAX] = { "stale", "below_10", "below_25", "below_50", "above_50" };
+	cJSON *hit_ttl = JSON_NEW_OBJECT();
+	for(unsigned int i = 0; i < CACHE_HIT_TTL_MAX; i++)
+		JSON_ADD_NUMBER_TO_OBJECT(hit_ttl, ttl_names[i], __atomic_load_n(&counters->cache_hit_ttl[i], __ATOMIC_RELAXED));
+	JSON_ADD_ITEM_TO_OBJECT(cache, "hit_ttl", hit_ttl);
+
+	// Domains with the most cache misses (or hits). The JSON macros cannot
+	// be used while holding the lock as they return on errors
+	cJSON *domains = JSON_NEW_ARRAY();
+	struct cache_domain list[CACHE_DOMAINS_MAX];
+	unsigned int num = 0;
+	if(count > 0 && config.misc.privacylevel.v.privacy_level < PRIVACY_HIDE_DOMAINS)
+	{
+		lock_shm_read();
+		for(unsigned int domainID = 0; domainID < counters->domains; domainID++)
+		{
+			// Skip e.g. recycled domains and those excluded from the
+			// statistics (webserver.api.excludeDomains)
+			const domainsData *domain = getDomain(domainID, true);
+			if(domain == NULL || domain->flags.excluded ||
+			   (by_hits ? domain->cachehits : domain->cachemisses) < 1)
+				continue;
+
+			const struct cache_domain entry = { domainID, domain->cachehits, domain->cachemisses };
+			add_cache_domain(list, &num, count, &entry, by_hits);
+		}
+
+		for(unsigned int i = 0; i < num; i++)
+		{
+			const domainsData *domain = getDomain(list[i].id, true);
+			const char *name = domain != NULL ? getDomainName(domain) : "";
+			if(name[0] == '\0' || strcmp(name, HIDDEN_DOMAIN) == 0)
+				continue;
+
+			const int total = list[i].hits + list[i].misses;
+			cJSON *item = cJSON_CreateObject();
+			cJSON_AddStringToObject(item, "domain", name);
+			cJSON_AddNumberToObject(item, "hits", list[i].hits);
+			cJSON_AddNumberToObject(item, "misses", list[i].misses);
+			cJSON_AddNumberToObject(item, "hit_rate", total > 0 ? (double)list[i].hits / total : 0.0);
+			cJSON_AddItemToArray(domains, item);
+		}
+		unlock_shm_read();
+	}
+	JSON_ADD_ITEM_TO_OBJECT(cache, "domains", domains);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(json, "cache", cache);
+	JSON_SEND_OBJECT(json);
+}
+
 int api_info_login(struct ftl_conn *api)
 {
 	cJSON *json = JSON_NEW_OBJECT();
@@ -1102,3 +1397,141 @@ int api_info_login(struct ftl_conn *api)
 
 	JSON_SEND_OBJECT(json);
 }
+
+// Sort allocation call sites (or modules) by their live bytes, largest first
+static int cmp_alloc_live(const void *a, const void *b)
+{
+	const struct alloc_site *site_a = a, *site_b = b;
+	if(site_a->live < site_b->live)
+		return 1;
+	if(site_a->live > site_b->live)
+		return -1;
+	return 0;
+}
+
+// Sort allocation call sites by their file
+static int cmp_alloc_file(const void *a, const void *b)
+{
+	const struct alloc_site *site_a = a, *site_b = b;
+	return strcmp(site_a->file, site_b->file);
+}
+
+// Add live and total allocations of a call site or module
+static int add_alloc_site(struct ftl_conn *api, cJSON *array, const struct alloc_site *site, const double elapsed)
+{
+	cJSON *item = JSON_NEW_OBJECT();
+	if(site->func != NULL)
+		JSON_REF_STR_IN_OBJECT(item, "function", site->func);
+	JSON_REF_STR_IN_OBJECT(item, "file", site->file);
+	if(site->func != NULL)
+		JSON_ADD_NUMBER_TO_OBJECT(item, "line", site->line);
+	JSON_ADD_NUMBER_TO_OBJECT(item, "live", site->live);
+	JSON_ADD_NUMBER_TO_OBJECT(item, "blocks", site->blocks);
+	JSON_ADD_NUMBER_TO_OBJECT(item, "allocs", site->allocs);
+	JSON_ADD_NUMBER_TO_OBJECT(item, "bytes", site->bytes);
+	JSON_ADD_NUMBER_TO_OBJECT(item, "rate", site->allocs / elapsed);
+	JSON_ADD_ITEM_TO_ARRAY(array, item);
+
+	return 0;
+}
+
+int api_info_memory(struct ftl_conn *api)
+{
+	cJSON *json = JSON_NEW_OBJECT();
+
+	// Shared memory objects (the same details log_shmem_details() logs).
+	// The JSON macros cannot be used while holding the lock as they return
+	// on errors
+	cJSON *shm = JSON_NEW_OBJECT();
+	cJSON *objects = JSON_NEW_ARRAY();
+	unsigned int num = 0, remaps = 0;
+	size_t used = 0;
+	lock_shm_read();
+	SharedMemory *const *shm_objects = get_shmem_details(&num, &remaps, &used);
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const SharedMemory *sharedMemory = shm_objects[i];
+		if(sharedMemory->name == NULL)
+			continue;
+
+		cJSON *object = cJSON_CreateObject();
+		cJSON_AddStringToObject(object, "name", sharedMemory->name);
+		cJSON_AddNumberToObject(object, "size", sharedMemory->size);
+		cJSON_AddNumberToObject(object, "mapped", sharedMemory->mapped);
+		cJSON_AddNumberToObject(object, "resizes", sharedMemory->resizes);
+		cJSON_AddNumberToObject(object, "remaps", sharedMemory->remaps);
+		cJSON_AddItemToArray(objects, object);
+	}
+	unlock_shm_read();
+	JSON_ADD_NUMBER_TO_OBJECT(shm, "used", used);
+	JSON_ADD_NUMBER_TO_OBJECT(shm, "remaps", remaps);
+	JSON_ADD_ITEM_TO_OBJECT(shm, "objects", objects);
+	JSON_ADD_ITEM_TO_OBJECT(json, "shm", shm);
+
+	// Heap memory of this process attributed to the code allocating it
+	struct alloc_site *sites = calloc(2*ALLOC_SITES, sizeof(*sites));
+	if(sites == NULL)
+	{
+		cJSON_Delete(json);
+		return send_json_error(api, 500, "internal_error", "Failed to allocate memory", NULL);
+	}
+	struct alloc_site *modules = sites + ALLOC_SITES;
+	struct alloc_stats stats = { 0 };
+	num = get_alloc_sites(sites, &stats);
+	const time_t now = time(NULL);
+	const double elapsed = now > stats.since ? (double)(now - stats.since) : 1.0;
+
+	// Sum up the call sites of each source file
+	unsigned int num_modules = 0;
+	uint64_t live = 0, blocks = 0;
+	qsort(sites, num, sizeof(*sites), cmp_alloc_file);
+	for(unsigned int i = 0; i < num; i++)
+	{
+		sites[i].file = short_path(sites[i].file);
+		if(num_modules == 0 || strcmp(modules[num_modules - 1].file, sites[i].file) != 0)
+			modules[num_modules++].file = sites[i].file;
+
+		struct alloc_site *module = &modules[num_modules - 1];
+		module->live += sites[i].live;
+		module->blocks += sites[i].blocks;
+		module->allocs += sites[i].allocs;
+		module->bytes += sites[i].bytes;
+		live += sites[i].live;
+		blocks += sites[i].blocks;
+	}
+	qsort(sites, num, sizeof(*sites), cmp_alloc_live);
+	qsort(modules, num_modules, sizeof(*modules), cmp_alloc_live);
+
+	cJSON *heap = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(heap, "since", stats.since);
+	JSON_ADD_NUMBER_TO_OBJECT(heap, "live", live);
+	JSON_ADD_NUMBER_TO_OBJECT(heap, "blocks", blocks);
+	JSON_ADD_NUMBER_TO_OBJECT(heap, "untracked", stats.untracked);
+	JSON_ADD_NUMBER_TO_OBJECT(heap, "overhead", stats.table);
+	cJSON *jmodules = JSON_NEW_ARRAY();
+	for(unsigned int i = 0; i < num_modules; i++)
+	{
+		const int ret = add_alloc_site(api, jmodules, &modules[i], elapsed);
+		if(ret != 0)
+		{
+			free(sites);
+			return ret;
+		}
+	}
+	JSON_ADD_ITEM_TO_OBJECT(heap, "modules", jmodules);
+	cJSON *jsites = JSON_NEW_ARRAY();
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const int ret = add_alloc_site(api, jsites, &sites[i], elapsed);
+		if(ret != 0)
+		{
+			free(sites);
+			return ret;
+		}
+	}
+	free(sites);
+	JSON_ADD_ITEM_TO_OBJECT(heap, "sites", jsites);
+	JSON_ADD_ITEM_TO_OBJECT(json, "heap", heap);
+
+	JSON_SEND_OBJECT(json);
+}
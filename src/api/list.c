@@ -19,10 +19,131 @@
 #include "database/network-table.h"
 // valid_domain()
 #include "tools/gravity-parseList.h"
-// parse_groupIDs()
+// parse_groupIDs(), json_stream_*()
 #include "webserver/http-common.h"
+// domainlist_changed()
+#include "datastructure.h"
 #include <idn2.h>
+// INT_MAX
+#include <limits.h>
+// get_list_hits()
+#include "database/list-hits.h"
+
+// Add the properties of a list item to the given object
+static int add_list_row(struct ftl_conn *api, const enum gravity_list_type listtype,
+                        tablerow *table, cJSON *row)
+{
+	// Special fields
+	if(listtype == GRAVITY_GROUPS)
+	{
+		JSON_COPY_STR_TO_OBJECT(row, "name", table->name);
+		JSON_COPY_STR_TO_OBJECT(row, "comment", table->comment);
+	}
+	else if(listtype == GRAVITY_ADLISTS ||
+	        listtype == GRAVITY_ADLISTS_BLOCK ||
+	        listtype == GRAVITY_ADLISTS_ALLOW)
+	{
+		JSON_COPY_STR_TO_OBJECT(row, "address", table->address);
+		JSON_COPY_STR_TO_OBJECT(row, "comment", table->comment);
+	}
+	else if(listtype == GRAVITY_CLIENTS)
+	{
+		char *name = NULL;
+		if(table->client != NULL)
+		{
+			// Try to obtain hostname
+			if(isValidIPv4(table->client) || isValidIPv6(table->client))
+				name = getNameFromIP(NULL, table->client);
+			else if(isMAC(table->client))
+				name = getNameFromMAC(table->client);
+		}
+
+		JSON_COPY_STR_TO_OBJECT(row, "client", table->client);
+		JSON_COPY_STR_TO_OBJECT(row, "name", name);
+		JSON_COPY_STR_TO_OBJECT(row, "comment", table->comment);
+
+		// Free allocated memory (if applicable)
+		if(name != NULL)
+			free(name);
+	}
+	else // domainlists
+	{
+		char *unicode = NULL;
+		const int rc = idn2_to_unicode_lzlz(table->domain, &unicode, IDN2_NONTRANSITIONAL);
+		JSON_COPY_STR_TO_OBJECT(row, "domain", table->domain);
+		if(rc == IDN2_OK)
+			JSON_COPY_STR_TO_OBJECT(row, "unicode", unicode);
+		else
+			JSON_COPY_STR_TO_OBJECT(row, "unicode", table->domain);
+		JSON_REF_STR_IN_OBJECT(row, "type", table->type);
+		JSON_REF_STR_IN_OBJECT(row, "kind", table->kind);
+		JSON_COPY_STR_TO_OBJECT(row, "comment", table->comment);
+		if(unicode != NULL)
+			free(unicode);
+	}
+
+	// Groups don't have the groups property
+	if(listtype != GRAVITY_GROUPS)
+	{
+		const int ret = parse_groupIDs(api, table, row);
+		if(ret != 0)
+			return ret;
+	}
+
+	// Clients don't have the enabled property
+	if(listtype != GRAVITY_CLIENTS)
+		JSON_ADD_BOOL_TO_OBJECT(row, "enabled", table->enabled);
+
+	// Add read-only database parameters
+	JSON_ADD_NUMBER_TO_OBJECT(row, "id", table->id);
+	JSON_ADD_NUMBER_TO_OBJECT(row, "date_added", table->date_added);
+	JSON_ADD_NUMBER_TO_OBJECT(row, "date_modified", table->date_modified);
 
+	// Properties added in https://github.com/pi-hole/pi-hole/pull/3951
+	if(listtype == GRAVITY_ADLISTS ||
+	   listtype == GRAVITY_ADLISTS_BLOCK ||
+	   listtype == GRAVITY_ADLISTS_ALLOW)
+	{
+		JSON_REF_STR_IN_OBJECT(row, "type", table->type);
+		JSON_ADD_NUMBER_TO_OBJECT(row, "date_updated", table->date_updated);
+		JSON_ADD_NUMBER_TO_OBJECT(row, "number", table->number);
+		JSON_ADD_NUMBER_TO_OBJECT(row, "invalid_domains", table->invalid_domains);
+		JSON_ADD_NUMBER_TO_OBJECT(row, "abp_entries", table->abp_entries);
+		JSON_ADD_NUMBER_TO_OBJECT(row, "status", table->status);
+	}
+
+	// Number of queries allowed or blocked by this list (the caller holds
+	// the SHM lock)
+	if(listtype != GRAVITY_GROUPS && listtype != GRAVITY_CLIENTS)
+	{
+		const bool adlist = listtype == GRAVITY_ADLISTS ||
+		                    listtype == GRAVITY_ADLISTS_BLOCK ||
+		                    listtype == GRAVITY_ADLISTS_ALLOW;
+		uint64_t hits = 0;
+		double last_hit = 0.0;
+		get_list_hits(adlist ? ADLIST_HITS_ID(table->id) : (int)table->id, &hits, &last_hit);
+		JSON_ADD_NUMBER_TO_OBJECT(row, "hits", hits);
+		JSON_ADD_NUMBER_TO_OBJECT(row, "last_hit", (long)last_hit);
+	}
+
+	return 0;
+}
+
+static const char * __attribute__((const)) list_objname(const enum gravity_list_type listtype)
+{
+	if(listtype == GRAVITY_GROUPS)
+		return "groups";
+	else if(listtype == GRAVITY_ADLISTS ||
+	        listtype == GRAVITY_ADLISTS_BLOCK ||
+	        listtype == GRAVITY_ADLISTS_ALLOW)
+		return "lists";
+	else if(listtype == GRAVITY_CLIENTS)
+		return "clients";
+	else // domainlists
+		return "domains";
+}
+
+// Send the item(s) after they have been modified, the caller holds the SHM lock
 static int api_list_read(struct ftl_conn *api,
                          const int code,
                          const enum gravity_list_type listtype,
@@ -30,7 +151,7 @@ static int api_list_read(struct ftl_conn *api,
                          cJSON *processed)
 {
 	const char *sql_msg = NULL;
-	if(!gravityDB_readTable(listtype, item, &sql_msg, true, NULL))
+	if(!gravityDB_readTable(listtype, item, &sql_msg, true, NULL, NULL))
 	{
 		return send_json_error(api, 400, // 400 Bad Request
 		                       "database_error",
@@ -43,99 +164,13 @@ static int api_list_read(struct ftl_conn *api,
 	while(gravityDB_readTableGetRow(listtype, &table, &sql_msg))
 	{
 		cJSON *row = JSON_NEW_OBJECT();
-
-		// Special fields
-		if(listtype == GRAVITY_GROUPS)
+		const int ret = add_list_row(api, listtype, &table, row);
+		if(ret != 0)
 		{
-			JSON_COPY_STR_TO_OBJECT(row, "name", table.name);
-			JSON_COPY_STR_TO_OBJECT(row, "comment", table.comment);
-		}
-		else if(listtype == GRAVITY_ADLISTS ||
-		        listtype == GRAVITY_ADLISTS_BLOCK ||
-		        listtype == GRAVITY_ADLISTS_ALLOW)
-		{
-			JSON_COPY_STR_TO_OBJECT(row, "address", table.address);
-			JSON_COPY_STR_TO_OBJECT(row, "comment", table.comment);
-		}
-		else if(listtype == GRAVITY_CLIENTS)
-		{
-			char *name = NULL;
-			if(table.client != NULL)
-			{
-				// Try to obtain hostname
-				if(isValidIPv4(table.client) || isValidIPv6(table.client))
-					name = getNameFromIP(NULL, table.client);
-				else if(isMAC(table.client))
-					name = getNameFromMAC(table.client);
-			}
-
-			JSON_COPY_STR_TO_OBJECT(row, "client", table.client);
-			JSON_COPY_STR_TO_OBJECT(row, "name", name);
-			JSON_COPY_STR_TO_OBJECT(row, "comment", table.comment);
-
-			// Free allocated memory (if applicable)
-			if(name != NULL)
-				free(name);
-		}
-		else // domainlists
-		{
-			char *unicode = NULL;
-			const int rc = idn2_to_unicode_lzlz(table.domain, &unicode, IDN2_NONTRANSITIONAL);
-			JSON_COPY_STR_TO_OBJECT(row, "domain", table.domain);
-			if(rc == IDN2_OK)
-				JSON_COPY_STR_TO_OBJECT(row, "unicode", unicode);
-			else
-				JSON_COPY_STR_TO_OBJECT(row, "unicode", table.domain);
-			JSON_REF_STR_IN_OBJECT(row, "type", table.type);
-			JSON_REF_STR_IN_OBJECT(row, "kind", table.kind);
-			JSON_COPY_STR_TO_OBJECT(row, "comment", table.comment);
-			if(unicode != NULL)
-				free(unicode);
-		}
-
-		// Groups don't have the groups property
-		if(listtype != GRAVITY_GROUPS)
-		{
-			if(table.group_ids != NULL)
-			{
-				const int ret = parse_groupIDs(api, &table, row);
-				if(ret != 0)
-				{
-					JSON_DELETE(rows);
-					return ret;
-				}
-
-			}
-			else
-			{
-				// Empty group set
-				cJSON *group_ids = JSON_NEW_ARRAY();
-				JSON_ADD_ITEM_TO_OBJECT(row, "groups", group_ids);
-			}
-		}
-
-		// Clients don't have the enabled property
-		if(listtype != GRAVITY_CLIENTS)
-			JSON_ADD_BOOL_TO_OBJECT(row, "enabled", table.enabled);
-
-		// Add read-only database parameters
-		JSON_ADD_NUMBER_TO_OBJECT(row, "id", table.id);
-		JSON_ADD_NUMBER_TO_OBJECT(row, "date_added", table.date_added);
-		JSON_ADD_NUMBER_TO_OBJECT(row, "date_modified", table.date_modified);
-
-		// Properties added in https://github.com/pi-hole/pi-hole/pull/3951
-		if(listtype == GRAVITY_ADLISTS ||
-		   listtype == GRAVITY_ADLISTS_BLOCK ||
-		   listtype == GRAVITY_ADLISTS_ALLOW)
-		{
-			JSON_REF_STR_IN_OBJECT(row, "type", table.type);
-			JSON_ADD_NUMBER_TO_OBJECT(row, "date_updated", table.date_updated);
-			JSON_ADD_NUMBER_TO_OBJECT(row, "number", table.number);
-			JSON_ADD_NUMBER_TO_OBJECT(row, "invalid_domains", table.invalid_domains);
-			JSON_ADD_NUMBER_TO_OBJECT(row, "abp_entries", table.abp_entries);
-			JSON_ADD_NUMBER_TO_OBJECT(row, "status", table.status);
+			gravityDB_readTableFinalize();
+			JSON_DELETE(rows);
+			return ret;
 		}
-
 		JSON_ADD_ITEM_TO_ARRAY(rows, row);
 	}
 	gravityDB_readTableFinalize();
@@ -143,19 +178,8 @@ static int api_list_read(struct ftl_conn *api,
 	if(sql_msg == NULL)
 	{
 		// No error, send domains array
-		const char *objname;
 		cJSON *json = JSON_NEW_OBJECT();
-		if(listtype == GRAVITY_GROUPS)
-			objname = "groups";
-		else if(listtype == GRAVITY_ADLISTS ||
-		        listtype == GRAVITY_ADLISTS_BLOCK ||
-		        listtype == GRAVITY_ADLISTS_ALLOW)
-			objname = "lists";
-		else if(listtype == GRAVITY_CLIENTS)
-			objname = "clients";
-		else // domainlists
-			objname = "domains";
-		JSON_ADD_ITEM_TO_OBJECT(json, objname, rows);
+		JSON_ADD_ITEM_TO_OBJECT(json, list_objname(listtype), rows);
 
 		// Add processed count (if applicable)
 		if(processed != NULL)
@@ -173,6 +197,120 @@ static int api_list_read(struct ftl_conn *api,
 	}
 }
 
+/**
+ * @brief Send (a page of) a list. Rows are sorted by their ID. With limit set,
+ * the response contains the ID to pass as "after" to get the next page (or
+ * null on the last page). The rows are streamed, only the current row is kept
+ * as JSON object
+ */
+static int api_list_get(struct ftl_conn *api,
+                        const enum gravity_list_type listtype)
+{
+	struct table_page page = { .enabled = -1, .group = -1 };
+	char search[256] = { 0 };
+	const char *qs = api->request->query_string;
+	if(qs != NULL)
+	{
+		const char *msg = NULL;
+		uint64_t after = 0;
+		unsigned int group = 0;
+		bool enabled = false;
+		char order[8] = { 0 };
+		if((!get_uint_var_msg(qs, "limit", &page.limit, &msg) && msg != NULL) ||
+		   (!get_uint64_var_msg(qs, "after", &after, &msg) && msg != NULL) ||
+		   (!get_uint_var_msg(qs, "group", &group, &msg) && msg != NULL))
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Invalid request: Invalid pagination parameter",
+			                       msg);
+		if(after > LONG_MAX || group > INT_MAX)
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Invalid request: Invalid pagination parameter",
+			                       "Specified integer too large");
+		page.after = (long)after;
+		if(get_uint_var(qs, "group", &group))
+			page.group = (int)group;
+		if(get_bool_var(qs, "enabled", &enabled))
+			page.enabled = enabled ? 1 : 0;
+		if(GET_STR("search", search, qs) > 0)
+			page.search = search;
+		if(GET_STR("order", order, qs) > 0)
+		{
+			if(strcasecmp(order, "desc") == 0)
+				page.descending = true;
+			else if(strcasecmp(order, "asc") != 0)
+				return send_json_error(api, 400,
+				                       "bad_request",
+				                       "Invalid request: Invalid order (should be either \"asc\" or \"desc\")",
+				                       order);
+		}
+	}
+
+	// We would not actually need the SHM lock here, however, we do this for
+	// simplicity to ensure nobody else is editing the lists while we're
+	// doing this here
+	lock_shm();
+	const char *sql_msg = NULL;
+	if(!gravityDB_readTable(listtype, api->item, &sql_msg, true, NULL, &page))
+	{
+		unlock_shm();
+		return send_json_error(api, 400, // 400 Bad Request
+		                       "database_error",
+		                       "Could not read domains from database table",
+		                       sql_msg);
+	}
+
+	// Nothing but the header may be sent while holding the lock as a slow
+	// client would otherwise block DNS resolution
+	struct json_stream stream;
+	if(!json_stream_start(&stream, api, list_objname(listtype)))
+	{
+		gravityDB_readTableFinalize();
+		unlock_shm();
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Internal server error, failed to allocate stream buffer",
+		                       NULL);
+	}
+	json_stream_hold(&stream, true);
+
+	unsigned int num = 0;
+	long last = 0;
+	tablerow table = { 0 };
+	while(gravityDB_readTableGetRow(listtype, &table, &sql_msg))
+	{
+		cJSON *row = cJSON_CreateObject();
+		const int ret = row != NULL ? add_list_row(api, listtype, &table, row) : 500;
+		if(ret != 0)
+		{
+			gravityDB_readTableFinalize();
+			unlock_shm();
+			json_stream_hold(&stream, false);
+			return ret;
+		}
+		json_stream_add_item(&stream, row);
+		last = table.id;
+		num++;
+	}
+	gravityDB_readTableFinalize();
+	unlock_shm();
+	json_stream_hold(&stream, false);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	if(page.limit > 0 && num == page.limit)
+		JSON_ADD_NUMBER_TO_OBJECT(json, "next", last);
+	else
+		JSON_ADD_NULL_TO_OBJECT(json, "next");
+
+	// The response has already been started, errors while reading can only
+	// be reported as part of it
+	if(sql_msg != NULL)
+		JSON_COPY_STR_TO_OBJECT(json, "error", sql_msg);
+
+	return json_stream_end(&stream, json);
+}
+
 static int api_list_write(struct ftl_conn *api,
                           const enum gravity_list_type listtype,
                           const char *item)
@@ -464,6 +602,12 @@ static int api_list_write(struct ftl_conn *api,
 		                            regex_msg, true, true);
 	}
 
+	// Changes of exact domains (which are not turned into regular expressions)
+	// only require re-validating these domains instead of reloading all lists
+	const bool exact = (listtype == GRAVITY_DOMAINLIST_ALLOW_EXACT ||
+	                    listtype == GRAVITY_DOMAINLIST_DENY_EXACT) &&
+	                   (row.kind == NULL || strcasecmp(row.kind, "exact") == 0);
+
 	// Try to add item(s) to table
 	const char *sql_msg = NULL;
 	cJSON *elem = NULL;
@@ -477,6 +621,8 @@ static int api_list_write(struct ftl_conn *api,
 		row.item = elem->valuestring;
 		if((okay = gravityDB_addToTable(listtype, &row, &sql_msg, api->method)))
 		{
+			if(exact)
+				domainlist_changed(row.item);
 			if(listtype != GRAVITY_GROUPS)
 			{
 				cJSON *groups = cJSON_GetObjectItemCaseSensitive(api->payload.json, "groups");
@@ -501,8 +647,9 @@ static int api_list_write(struct ftl_conn *api,
 		cJSON_AddItemToArray(okay ? success : errors, details);
 	}
 
-	// Inform the resolver that it needs to reload gravity
-	set_event(RELOAD_GRAVITY);
+	// Inform the resolver that it needs to reload gravity (or only the
+	// changed domains)
+	set_event(exact ? RELOAD_DOMAINLIST : RELOAD_GRAVITY);
 
 	int response_code = 201; // 201 - Created
 	if(api->method == HTTP_PUT)
@@ -532,6 +679,34 @@ static int api_list_write(struct ftl_conn *api,
 	return ret;
 }
 
+// Check if only exact domains have been removed and remember them, they do not
+// require reloading all lists
+static bool exact_domains_removed(const enum gravity_list_type listtype, const cJSON *array)
+{
+	if(listtype != GRAVITY_DOMAINLIST_ALLOW_EXACT &&
+	   listtype != GRAVITY_DOMAINLIST_DENY_EXACT &&
+	   listtype != GRAVITY_DOMAINLIST_ALL_ALL)
+		return false;
+
+	// Types 0 and 1 are exact allow and deny domains, respectively
+	const cJSON *it = NULL;
+	cJSON_ArrayForEach(it, array)
+	{
+		const cJSON *type = cJSON_GetObjectItemCaseSensitive(it, "type");
+		if(!cJSON_IsNumber(type) || (type->valueint != 0 && type->valueint != 1))
+			return false;
+	}
+
+	cJSON_ArrayForEach(it, array)
+	{
+		const cJSON *item = cJSON_GetObjectItemCaseSensitive(it, "item");
+		if(cJSON_IsString(item))
+			domainlist_changed(item->valuestring);
+	}
+
+	return true;
+}
+
 static int api_list_remove(struct ftl_conn *api,
                            const enum gravity_list_type listtype,
                            const char *item)
@@ -713,8 +888,9 @@ static int api_list_remove(struct ftl_conn *api,
 	unsigned int deleted = 0u;
 	if(gravityDB_delFromTable(listtype, array, &deleted, &sql_msg))
 	{
-		// Inform the resolver that it needs to reload gravity
-		set_event(RELOAD_GRAVITY);
+		// Inform the resolver that it needs to reload gravity (or only
+		// the changed domains)
+		set_event(exact_domains_removed(listtype, array) ? RELOAD_DOMAINLIST : RELOAD_GRAVITY);
 
 		// Free memory allocated above
 		if(allocated_json)
@@ -740,6 +916,482 @@ static int api_list_remove(struct ftl_conn *api,
 	}
 }
 
+// Maximum length of a single import line
+#define IMPORT_LINE_MAX (MAX_PAYLOAD_BYTES - 1)
+// Maximum number of rows accepted by a single import
+#define IMPORT_MAX_ROWS 1000000u
+// Maximum number of rows with errors reported individually
+#define IMPORT_MAX_ERRORS 1000u
+// Maximum number of columns of CSV imports and groups per row
+#define IMPORT_MAX_COLUMNS 16u
+#define IMPORT_MAX_GROUPS 256u
+
+enum import_column {
+	IMPORT_ITEM,
+	IMPORT_TYPE,
+	IMPORT_KIND,
+	IMPORT_COMMENT,
+	IMPORT_ENABLED,
+	IMPORT_GROUPS,
+	IMPORT_COLUMNS
+} __attribute__ ((packed));
+
+static const char *import_columns[IMPORT_COLUMNS] = {
+	[IMPORT_ITEM] = NULL, // "domain" or "address"
+	[IMPORT_TYPE] = "type",
+	[IMPORT_KIND] = "kind",
+	[IMPORT_COMMENT] = "comment",
+	[IMPORT_ENABLED] = "enabled",
+	[IMPORT_GROUPS] = "groups",
+};
+
+// Line-wise reader of the request body which is not limited to
+// MAX_PAYLOAD_BYTES as a whole
+struct import_reader {
+	struct mg_connection *conn;
+	char *buf;
+	size_t len;
+	size_t pos;
+	bool eof;
+	bool skip;
+};
+
+// Get the next line of the request body, lines exceeding IMPORT_LINE_MAX are
+// returned truncated with too_long set
+static char *import_next_line(struct import_reader *r, bool *too_long)
+{
+	while(true)
+	{
+		char *start = r->buf + r->pos;
+		char *end = memchr(start, '\n', r->len - r->pos);
+		if(end == NULL && r->eof)
+		{
+			if(r->pos >= r->len)
+				return NULL;
+			end = r->buf + r->len;
+		}
+
+		if(end != NULL)
+		{
+			*end = '\0';
+			if(end > start && end[-1] == '\r')
+				end[-1] = '\0';
+			r->pos = end - r->buf + (end < r->buf + r->len ? 1 : 0);
+			*too_long = r->skip;
+			r->skip = false;
+			return start;
+		}
+
+		// Move the incomplete line to the front and read more data. If the
+		// buffer is full, we discard the line up to its end
+		memmove(r->buf, start, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+		if(r->len >= IMPORT_LINE_MAX)
+		{
+			r->skip = true;
+			r->len = 0;
+		}
+		const int n = mg_read(r->conn, r->buf + r->len, IMPORT_LINE_MAX - r->len);
+		if(n > 0)
+			r->len += n;
+		else
+			r->eof = true;
+	}
+}
+
+// Split a CSV line in place, fields may be enclosed in double quotes (with ""
+// as escaped quote). Returns the number of fields
+static unsigned int import_split_csv(char *line, char **fields, const unsigned int max)
+{
+	unsigned int num = 0;
+	char *in = line;
+	while(num < max)
+	{
+		char *out = in;
+		fields[num++] = out;
+		bool quoted = false;
+		if(*in == '"')
+		{
+			quoted = true;
+			in++;
+		}
+		while(*in != '\0')
+		{
+			if(quoted && *in == '"')
+			{
+				if(in[1] != '"')
+				{
+					quoted = false;
+					in++;
+					continue;
+				}
+				in++;
+			}
+			else if(!quoted && *in == ',')
+				break;
+			*out++ = *in++;
+		}
+		const bool more = *in == ',';
+		*out = '\0';
+		if(!more)
+			break;
+		in++;
+	}
+	return num;
+}
+
+static void import_set_error(struct import_row *row, const char *error)
+{
+	if(row->error == NULL)
+		row->error = strdup(error);
+}
+
+// Validate and normalize the item of a row, exact domains are converted to
+// lowercase punycode
+static void import_check_item(const bool lists, struct import_row *row)
+{
+	if(strlen(row->item) == 0)
+	{
+		import_set_error(row, lists ? "Missing address" : "Missing domain");
+		return;
+	}
+	if(strpbrk(row->item, " \t") != NULL)
+	{
+		import_set_error(row, "Spaces, newlines and tabs are not allowed in domains and URLs");
+		return;
+	}
+	if(lists)
+		return;
+
+	if(row->type == 2 || row->type == 3)
+	{
+		// Test validity of this regex
+		regexData regex = { 0 };
+		char *regex_msg = NULL;
+		const bool okay = compile_regex(row->item, &regex, &regex_msg);
+		if(regex.available)
+		{
+			regfree(&regex.regex);
+			free(regex.string);
+		}
+		if(!okay)
+			import_set_error(row, regex_msg != NULL ? regex_msg : "Invalid regex");
+		if(regex_msg != NULL)
+			free(regex_msg);
+		return;
+	}
+
+	char *punycode = NULL;
+	const int rc = idn2_to_ascii_lz(row->item, &punycode, IDN2_NFC_INPUT | IDN2_NONTRANSITIONAL);
+	if(rc != IDN2_OK)
+	{
+		import_set_error(row, idn2_strerror(rc));
+		return;
+	}
+	for(char *p = punycode; *p != '\0'; p++)
+		*p = tolower(*p);
+	if(!valid_domain(punycode, strlen(punycode), false))
+	{
+		free(punycode);
+		import_set_error(row, "Invalid domain");
+		return;
+	}
+
+	free(row->item);
+	row->item = punycode;
+}
+
+// Fill a row from the (string) values of its columns. Missing columns are
+// NULL, groups are separated by semicolons or spaces. Group assignments are
+// only replaced if at least one group is given
+static void import_fill_row(const bool lists, struct import_row *row, const char *values[IMPORT_COLUMNS])
+{
+	row->item = strdup(values[IMPORT_ITEM] != NULL ? values[IMPORT_ITEM] : "");
+	if(values[IMPORT_COMMENT] != NULL && strlen(values[IMPORT_COMMENT]) > 0)
+		row->comment = strdup(values[IMPORT_COMMENT]);
+
+	const char *enabled = values[IMPORT_ENABLED];
+	row->enabled = enabled == NULL || strlen(enabled) == 0 ||
+	               strcasecmp(enabled, "true") == 0 || strcmp(enabled, "1") == 0;
+	if(!row->enabled && strcasecmp(enabled, "false") != 0 && strcmp(enabled, "0") != 0)
+		import_set_error(row, "Invalid value of \"enabled\"");
+
+	const char *type = values[IMPORT_TYPE];
+	const char *kind = values[IMPORT_KIND];
+	if(lists)
+	{
+		// Lists are blocklists unless specified otherwise
+		if(type == NULL || strlen(type) == 0 || strcasecmp(type, "block") == 0)
+			row->type = ADLIST_BLOCK;
+		else if(strcasecmp(type, "allow") == 0)
+			row->type = ADLIST_ALLOW;
+		else
+			import_set_error(row, "Invalid type (must be \"allow\" or \"block\")");
+	}
+	else
+	{
+		// Domains are exact domains unless specified otherwise
+		const bool regex = kind != NULL && strcasecmp(kind, "regex") == 0;
+		if(kind != NULL && strlen(kind) > 0 && !regex && strcasecmp(kind, "exact") != 0)
+			import_set_error(row, "Invalid kind (must be \"exact\" or \"regex\")");
+		if(type != NULL && strcasecmp(type, "allow") == 0)
+			row->type = regex ? 2 : 0;
+		else if(type != NULL && strcasecmp(type, "deny") == 0)
+			row->type = regex ? 3 : 1;
+		else
+			import_set_error(row, "Invalid type (must be \"allow\" or \"deny\")");
+	}
+
+	const char *groups = values[IMPORT_GROUPS];
+	if(groups != NULL && strlen(groups) > 0)
+	{
+		row->has_groups = true;
+		const char *p = groups;
+		while(*p != '\0' && row->error == NULL)
+		{
+			char *end = NULL;
+			const long id = strtol(p, &end, 10);
+			if(end == p || id < 0 || id > INT_MAX || row->ngroups >= IMPORT_MAX_GROUPS)
+			{
+				import_set_error(row, "Invalid group ID");
+				break;
+			}
+			if(row->groups == NULL)
+				row->groups = calloc(IMPORT_MAX_GROUPS, sizeof(*row->groups));
+			if(row->groups == NULL)
+			{
+				import_set_error(row, "Out of memory");
+				break;
+			}
+			row->groups[row->ngroups++] = id;
+			p = end;
+			while(*p == ';' || *p == ' ')
+				p++;
+		}
+	}
+
+	if(row->error == NULL)
+		import_check_item(lists, row);
+}
+
+// Fill a row from a JSON object, groups are an array of group IDs
+static void import_json_row(const bool lists, struct import_row *row, const char *line)
+{
+	cJSON *json = cJSON_Parse(line);
+	if(!cJSON_IsObject(json))
+	{
+		row->item = strdup("");
+		import_set_error(row, "Invalid JSON object");
+		cJSON_Delete(json);
+		return;
+	}
+
+	const char *values[IMPORT_COLUMNS] = { NULL };
+	char enabled[6] = { 0 };
+	char groups[IMPORT_MAX_GROUPS * 12] = { 0 };
+	bool invalid = false;
+	for(unsigned int i = 0; i < IMPORT_COLUMNS; i++)
+	{
+		const char *key = i == IMPORT_ITEM ? (lists ? "address" : "domain") : import_columns[i];
+		const cJSON *value = cJSON_GetObjectItemCaseSensitive(json, key);
+		if(value == NULL || cJSON_IsNull(value))
+			continue;
+		if(i == IMPORT_ENABLED && cJSON_IsBool(value))
+		{
+			strcpy(enabled, cJSON_IsTrue(value) ? "true" : "false");
+			values[i] = enabled;
+		}
+		else if(i == IMPORT_GROUPS && cJSON_IsArray(value))
+		{
+			size_t len = 0;
+			const cJSON *group = NULL;
+			cJSON_ArrayForEach(group, value)
+			{
+				if(!cJSON_IsNumber(group) || len + 12 > sizeof(groups))
+				{
+					invalid = true;
+					break;
+				}
+				len += snprintf(groups + len, sizeof(groups) - len, "%s%d", len > 0 ? ";" : "", group->valueint);
+			}
+			values[i] = groups;
+		}
+		else if(cJSON_IsString(value) && i != IMPORT_ENABLED && i != IMPORT_GROUPS)
+			values[i] = value->valuestring;
+		else
+			invalid = true;
+	}
+
+	import_fill_row(lists, row, values);
+	if(invalid)
+		import_set_error(row, "Invalid value type in JSON object");
+	cJSON_Delete(json);
+}
+
+static void import_free_rows(struct import_row *rows, const unsigned int num)
+{
+	for(unsigned int i = 0; i < num; i++)
+	{
+		if(rows[i].item != NULL)
+			free(rows[i].item);
+		if(rows[i].comment != NULL)
+			free(rows[i].comment);
+		if(rows[i].groups != NULL)
+			free(rows[i].groups);
+		if(rows[i].error != NULL)
+			free(rows[i].error);
+	}
+	if(rows != NULL)
+		free(rows);
+}
+
+int api_list_import(struct ftl_conn *api)
+{
+	const bool lists = startsWith("/api/lists:import", api) != NULL;
+	const char *content_type = mg_get_header(api->conn, "Content-Type");
+	const bool csv = content_type != NULL && strncasecmp(content_type, "text/csv", 8) == 0;
+
+	struct import_reader reader = { .conn = api->conn };
+	reader.buf = calloc(IMPORT_LINE_MAX + 1, sizeof(char));
+	if(reader.buf == NULL)
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to allocate memory for the import",
+		                       NULL);
+
+	// Read and validate all rows before touching the database so the lists
+	// are not locked while the client is uploading
+	struct import_row *rows = NULL;
+	unsigned int num = 0, capacity = 0, line = 0;
+	int columns[IMPORT_COLUMNS];
+	bool header = csv, too_long = false;
+	const char *error = NULL;
+	char *text = NULL;
+	while((text = import_next_line(&reader, &too_long)) != NULL)
+	{
+		line++;
+		if(strlen(text) == 0 && !too_long)
+			continue;
+
+		// The first line of a CSV import names the columns
+		if(header)
+		{
+			char *fields[IMPORT_MAX_COLUMNS] = { NULL };
+			const unsigned int nfields = import_split_csv(text, fields, IMPORT_MAX_COLUMNS);
+			for(unsigned int i = 0; i < IMPORT_COLUMNS; i++)
+			{
+				const char *name = i == IMPORT_ITEM ? (lists ? "address" : "domain") : import_columns[i];
+				columns[i] = -1;
+				for(unsigned int j = 0; j < nfields; j++)
+					if(strcasecmp(fields[j], name) == 0)
+						columns[i] = j;
+			}
+			header = false;
+			if(columns[IMPORT_ITEM] < 0)
+			{
+				error = lists ? "CSV header lacks the \"address\" column" :
+				                "CSV header lacks the \"domain\" column";
+				break;
+			}
+			continue;
+		}
+
+		if(num >= IMPORT_MAX_ROWS)
+		{
+			error = "Too many rows";
+			break;
+		}
+		if(num >= capacity)
+		{
+			capacity = capacity > 0 ? 2 * capacity : 1024;
+			struct import_row *new_rows = realloc(rows, capacity * sizeof(*rows));
+			if(new_rows == NULL)
+			{
+				error = "Out of memory";
+				break;
+			}
+			rows = new_rows;
+		}
+		struct import_row *row = &rows[num++];
+		memset(row, 0, sizeof(*row));
+		row->line = line;
+
+		if(too_long)
+		{
+			row->item = strdup("");
+			import_set_error(row, "Line too long");
+		}
+		else if(csv)
+		{
+			char *fields[IMPORT_MAX_COLUMNS] = { NULL };
+			const unsigned int nfields = import_split_csv(text, fields, IMPORT_MAX_COLUMNS);
+			const char *values[IMPORT_COLUMNS] = { NULL };
+			for(unsigned int i = 0; i < IMPORT_COLUMNS; i++)
+				if(columns[i] >= 0 && (unsigned int)columns[i] < nfields)
+					values[i] = fields[columns[i]];
+			import_fill_row(lists, row, values);
+		}
+		else
+			import_json_row(lists, row, text);
+	}
+	free(reader.buf);
+
+	if(error == NULL && num == 0)
+		error = "No rows to import";
+	if(error != NULL)
+	{
+		import_free_rows(rows, num);
+		return send_json_error(api, 400,
+		                       "bad_request",
+		                       "Invalid import",
+		                       error);
+	}
+
+	// Import all valid rows within a single transaction
+	unsigned int imported = 0;
+	const char *sql_msg = NULL;
+	lock_shm();
+	const bool okay = gravityDB_import(lists ? GRAVITY_ADLISTS : GRAVITY_DOMAINLIST_ALL_ALL,
+	                                   rows, num, &imported, &sql_msg);
+	unlock_shm();
+
+	if(!okay)
+	{
+		import_free_rows(rows, num);
+		return send_json_error(api, 500,
+		                       "database_error",
+		                       "Could not import into gravity database",
+		                       sql_msg);
+	}
+
+	// Reload lists once after all rows have been imported
+	if(imported > 0)
+		set_event(RELOAD_GRAVITY);
+
+	cJSON *errors = JSON_NEW_ARRAY();
+	unsigned int failed = 0;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		if(rows[i].error == NULL || failed++ >= IMPORT_MAX_ERRORS)
+			continue;
+		cJSON *details = JSON_NEW_OBJECT();
+		JSON_ADD_NUMBER_TO_OBJECT(details, "line", rows[i].line);
+		JSON_COPY_STR_TO_OBJECT(details, "item", rows[i].item);
+		JSON_COPY_STR_TO_OBJECT(details, "error", rows[i].error);
+		JSON_ADD_ITEM_TO_ARRAY(errors, details);
+	}
+	import_free_rows(rows, num);
+
+	cJSON *processed = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(processed, "success", imported);
+	JSON_ADD_NUMBER_TO_OBJECT(processed, "failed", failed);
+	JSON_ADD_ITEM_TO_OBJECT(processed, "errors", errors);
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_ITEM_TO_OBJECT(json, "processed", processed);
+	JSON_SEND_OBJECT_CODE(json, imported > 0 ? 201 : 400);
+}
+
 int api_list(struct ftl_conn *api)
 {
 	enum gravity_list_type listtype;
@@ -859,13 +1511,7 @@ int api_list(struct ftl_conn *api)
 	if(api->method == HTTP_GET)
 	{
 		// Read list item identified by URI (or read them all)
-		// We would not actually need the SHM lock here, however, we do
-		// this for simplicity to ensure nobody else is editing the
-		// lists while we're doing this here
-		lock_shm();
-		const int ret = api_list_read(api, 200, listtype, api->item, NULL);
-		unlock_shm();
-		return ret;
+		return api_list_get(api, listtype);
 	}
 	else if(can_modify && api->method == HTTP_PUT)
 	{
@@ -21,44 +21,27 @@
 // fifologData is allocated in shared memory for cross-fork compatibility
 int api_logs(struct ftl_conn *api)
 {
-	unsigned int start = 0u;
+	// Messages are read by their ID, see add_to_fifo_buffer(). The oldest
+	// message we still have is LOG_SIZE messages behind the next one
+	const unsigned int next_id = fifo_log->logs[api->opts.which].next_id;
+	const unsigned int oldest = next_id > LOG_SIZE ? next_id - LOG_SIZE : 0u;
+	unsigned int start = oldest;
 	if(api->request->query_string != NULL)
 	{
-		// Does the user request an ID to sent from?
+		// Does the user request an ID to sent from? We return the
+		// entire buffer if the requested ID is older than the oldest
+		// one we have and no data if it is not yet known
 		unsigned int nextID;
 		if(get_uint_var(api->request->query_string, "nextID", &nextID))
-		{
-			if(nextID >= fifo_log->logs[api->opts.which].next_id)
-			{
-				// Do not return any data
-				start = LOG_SIZE;
-			}
-			else if((fifo_log->logs[api->opts.which].next_id > LOG_SIZE) && nextID < (fifo_log->logs[api->opts.which].next_id) - LOG_SIZE)
-			{
-				// Requested an ID smaller than the lowest one we have
-				// We return the entire buffer
-				start = 0u;
-			}
-			else if(fifo_log->logs[api->opts.which].next_id >= LOG_SIZE)
-			{
-				// Reply with partial buffer, measure from the end
-				// (the log is full)
-				start = LOG_SIZE - (fifo_log->logs[api->opts.which].next_id - nextID);
-			}
-			else
-			{
-				// Reply with partial buffer, measure from the start
-				// (the log is not yet full)
-				start = nextID;
-			}
-		}
+			start = nextID > next_id ? next_id : nextID < oldest ? oldest : nextID;
 	}
 
 	// Process data
 	cJSON *json = JSON_NEW_OBJECT();
 	cJSON *log = JSON_NEW_ARRAY();
-	for(unsigned int i = start; i < LOG_SIZE; i++)
+	for(unsigned int id = start; id != next_id; id++)
 	{
+		const unsigned int i = id % LOG_SIZE;
 		if(fifo_log->logs[api->opts.which].timestamp[i] < 1.0)
 		{
 			// Uninitialized buffer entry
@@ -72,7 +55,7 @@ int api_logs(struct ftl_conn *api)
 		JSON_ADD_ITEM_TO_ARRAY(log, entry);
 	}
 	JSON_ADD_ITEM_TO_OBJECT(json, "log", log);
-	JSON_ADD_NUMBER_TO_OBJECT(json, "nextID", fifo_log->logs[api->opts.which].next_id);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "nextID", next_id);
 	JSON_ADD_NUMBER_TO_OBJECT(json, "pid", main_pid());
 
 	// Add file name
@@ -0,0 +1,722 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API Implementation /api/metrics
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file metrics.c
+* @brief Prometheus text exposition of FTL's statistics.
+*
+* The response is written straight into a text buffer, no cJSON tree is built.
+* Global counters are single machine words which are read without taking the
+* SHM lock. Only the upstream section needs the shared lock as upstream names
+* live in the string pool which may be compacted concurrently.
+*/
+
+#include "FTL.h"
+#include "webserver/http-common.h"
+#include "webserver/json_macros.h"
+#include "api/api.h"
+// counters, getUpstream(), getstr(), lock_shm_read()
+#include "shmem.h"
+// get_query_status_str(), get_query_type_str(), get_query_reply_str()
+#include "datastructure.h"
+// get_dnsmasq_metrics(), rrtype_name()
+#include "metrics.h"
+// get_api_endpoint_stats()
+#include "api/endpoint_stats.h"
+// get_export_queue()
+#include "database/query-table.h"
+// get_db_job_stats()
+#include "database/database-thread.h"
+// get_stmt_cache_stats()
+#include "database/common.h"
+// get_message_queue_stats()
+#include "database/message-table.h"
+// get_replication_stats()
+#include "database/replication.h"
+// get_query_sink_stats()
+#include "database/query-sink.h"
+// get_latency_stats()
+#include "latency.h"
+// get_ptr_cache_stats(), get_name_source_stats()
+#include "resolve.h"
+// get_log_writer_stats()
+#include "log-writer.h"
+// get_lsp_cache_stats()
+#include "webserver/lua_web.h"
+// get_tls_stats()
+#include "webserver/webserver.h"
+// get_thread_usage()
+#include "daemon.h"
+// get_ntp_server_stats()
+#include "ntp/ntp.h"
+// va_list
+#include <stdarg.h>
+
+#define METRICS_MIME_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+struct metrics_buffer {
+	char *buf;
+	size_t len;
+	size_t size;
+	bool failed;
+};
+
+static void __attribute__((format(printf, 2, 3))) metrics_printf(struct metrics_buffer *out, const char *format, ...)
+{
+	while(!out->failed)
+	{
+		va_list args;
+		va_start(args, format);
+		const int len = vsnprintf(out->buf + out->len, out->size - out->len, format, args);
+		va_end(args);
+
+		if(len < 0)
+		{
+			out->failed = true;
+			return;
+		}
+
+		if(out->len + (size_t)len < out->size)
+		{
+			out->len += len;
+			return;
+		}
+
+		// Grow buffer and try again
+		char *buf = realloc(out->buf, 2*out->size + len);
+		if(buf == NULL)
+		{
+			out->failed = true;
+			return;
+		}
+		out->buf = buf;
+		out->size = 2*out->size + len;
+	}
+}
+
+// Print the HELP and TYPE lines introducing a metric
+static void metrics_header(struct metrics_buffer *out, const char *name,
+                           const char *type, const char *help)
+{
+	metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Label values must have backslashes, double quotes and newlines escaped
+static void metrics_label(struct metrics_buffer *out, const char *value)
+{
+	char escaped[256];
+	size_t j = 0;
+	for(const char *c = value; *c != '\0' && j < sizeof(escaped) - 2; c++)
+	{
+		if(*c == '\\' || *c == '"')
+			escaped[j++] = '\\';
+		else if(*c == '\n')
+		{
+			escaped[j++] = '\\';
+			escaped[j++] = 'n';
+			continue;
+		}
+		escaped[j++] = *c;
+	}
+	escaped[j] = '\0';
+
+	metrics_printf(out, "\"%s\"", escaped);
+}
+
+static unsigned int __attribute__((pure)) load_counter(const unsigned int *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void add_query_metrics(struct metrics_buffer *out)
+{
+	metrics_header(out, "pihole_queries", "gauge",
+	               "Number of queries within the last 24 hours by status");
+	for(enum query_status s = QUERY_UNKNOWN; s < QUERY_STATUS_MAX; s++)
+		metrics_printf(out, "pihole_queries{status=\"%s\"} %u\n",
+		               get_query_status_str(s), get_status_count(s));
+
+	metrics_header(out, "pihole_queries_by_type", "gauge",
+	               "Number of queries within the last 24 hours by query type");
+	queriesData query = { 0 };
+	for(enum query_type t = TYPE_A; t < TYPE_MAX; t++)
+	{
+		query.type = t;
+		metrics_printf(out, "pihole_queries_by_type{type=\"%s\"} %u\n",
+		               get_query_type_str(t, &query, NULL), get_querytype_count(t));
+	}
+
+	metrics_header(out, "pihole_replies", "gauge",
+	               "Number of replies within the last 24 hours by reply type");
+	for(enum reply_type r = REPLY_UNKNOWN; r < QUERY_REPLY_MAX; r++)
+		metrics_printf(out, "pihole_replies{reply=\"%s\"} %u\n",
+		               get_query_reply_str(r), get_reply_count(r));
+
+	metrics_header(out, "pihole_clients", "gauge", "Number of known clients");
+	metrics_printf(out, "pihole_clients %u\n", load_counter(&counters->clients));
+	metrics_header(out, "pihole_domains", "gauge", "Number of known domains");
+	metrics_printf(out, "pihole_domains %u\n", load_counter(&counters->domains));
+	metrics_header(out, "pihole_gravity_domains", "gauge", "Number of domains on the blocklists");
+	metrics_printf(out, "pihole_gravity_domains %d\n",
+	               __atomic_load_n(&counters->database.gravity, __ATOMIC_RELAXED));
+}
+
+enum upstream_metric {
+	UPSTREAM_QUERIES,
+	UPSTREAM_FAILED,
+	UPSTREAM_RESPONSE_TIME,
+	UPSTREAM_SMOOTHED_RESPONSE_TIME,
+	UPSTREAM_SMOOTHED_FAILURE_RATE,
+	UPSTREAM_METRICS
+};
+
+static void add_upstream_metrics(struct metrics_buffer *out)
+{
+	static const char *names[UPSTREAM_METRICS] = {
+		"pihole_upstream_queries",
+		"pihole_upstream_failed",
+		"pihole_upstream_response_seconds",
+		"pihole_upstream_smoothed_response_seconds",
+		"pihole_upstream_smoothed_failure_ratio"
+	};
+	static const char *help[UPSTREAM_METRICS] = {
+		"Number of queries forwarded to this upstream within the last 24 hours",
+		"Number of queries this upstream did not answer within the last 24 hours",
+		"Average response time of this upstream",
+		"Exponentially weighted moving average of the response time of this upstream",
+		"Exponentially weighted moving average of the fraction of queries this upstream did not answer"
+	};
+
+	// All samples of a metric have to be grouped together
+	lock_shm_read();
+	const int upstreams = counters->upstreams;
+	for(enum upstream_metric m = UPSTREAM_QUERIES; m < UPSTREAM_METRICS; m++)
+	{
+		metrics_header(out, names[m], "gauge", help[m]);
+		for(int upstreamID = 0; upstreamID < upstreams; upstreamID++)
+		{
+			const upstreamsData *upstream = getUpstream(upstreamID, true);
+			if(upstream == NULL)
+				continue;
+
+			metrics_printf(out, "%s{upstream=", names[m]);
+			metrics_label(out, getstr(upstream->ippos));
+			metrics_printf(out, ",name=");
+			metrics_label(out, getstr(upstream->namepos));
+			metrics_printf(out, ",port=\"%u\"} ", (unsigned int)upstream->port);
+
+			if(m == UPSTREAM_QUERIES)
+				metrics_printf(out, "%d\n", upstream->count);
+			else if(m == UPSTREAM_FAILED)
+				metrics_printf(out, "%d\n", upstream->failed);
+			else if(m == UPSTREAM_RESPONSE_TIME)
+				metrics_printf(out, "%g\n", upstream->responses > 0 ?
+				               upstream->rtime / upstream->responses : 0.0);
+			else if(m == UPSTREAM_SMOOTHED_RESPONSE_TIME)
+				metrics_printf(out, "%g\n", upstream->ewma_rtime);
+			else
+				metrics_printf(out, "%g\n", upstream->ewma_failed);
+		}
+	}
+	unlock_shm_read();
+}
+
+static void add_dnsmasq_metrics(struct metrics_buffer *out)
+{
+	struct metrics metrics = { 0 };
+	// The cache may be resized concurrently (dns.cache.autosize)
+	lock_shm_read();
+	get_dnsmasq_metrics(&metrics);
+	unlock_shm_read();
+
+	metrics_header(out, "pihole_dns_cache_size", "gauge", "Size of the DNS cache");
+	metrics_printf(out, "pihole_dns_cache_size %d\n", metrics.dns.cache.size);
+	metrics_header(out, "pihole_dns_cache_inserted_total", "counter",
+	               "Number of records inserted into the DNS cache");
+	metrics_printf(out, "pihole_dns_cache_inserted_total %d\n", metrics.dns.cache.inserted);
+	metrics_header(out, "pihole_dns_cache_evicted_total", "counter",
+	               "Number of records evicted from the DNS cache before they expired");
+	metrics_printf(out, "pihole_dns_cache_evicted_total %d\n", metrics.dns.cache.live_freed);
+	metrics_header(out, "pihole_dns_cache_prefetch_total", "counter",
+	               "Number of cache refreshes issued by prefetching and queries for popular domains answered from cache (hit) or forwarded (miss)");
+	metrics_printf(out, "pihole_dns_cache_prefetch_total{result=\"issued\"} %u\n",
+	               load_counter(&counters->prefetch.issued));
+	metrics_printf(out, "pihole_dns_cache_prefetch_total{result=\"hit\"} %u\n",
+	               load_counter(&counters->prefetch.hits));
+	metrics_printf(out, "pihole_dns_cache_prefetch_total{result=\"miss\"} %u\n",
+	               load_counter(&counters->prefetch.misses));
+	metrics_header(out, "pihole_dns_cname_verdicts_total", "counter",
+	               "Number of CNAME targets whose blocking verdict was reused (hit) or had to be determined (miss) during deep CNAME inspection");
+	metrics_printf(out, "pihole_dns_cname_verdicts_total{result=\"hit\"} %u\n",
+	               load_counter(&counters->cname_verdicts.hits));
+	metrics_printf(out, "pihole_dns_cname_verdicts_total{result=\"miss\"} %u\n",
+	               load_counter(&counters->cname_verdicts.misses));
+	metrics_header(out, "pihole_dns_coalesced_queries_total", "counter",
+	               "Number of queries which waited for an identical query already sent upstream (saved) and which were answered with its reply (answered)");
+	metrics_printf(out, "pihole_dns_coalesced_queries_total{result=\"saved\"} %u\n",
+	               load_counter(&counters->coalesced.saved));
+	metrics_printf(out, "pihole_dns_coalesced_queries_total{result=\"answered\"} %u\n",
+	               load_counter(&counters->coalesced.answered));
+
+	metrics_header(out, "pihole_dns_cache_records", "gauge", "Number of records in the DNS cache");
+	for(unsigned int i = 0; i < RRTYPES; i++)
+	{
+		if(metrics.dns.cache.content[i].count[CACHE_VALID] == 0 &&
+		   metrics.dns.cache.content[i].count[CACHE_STALE] == 0)
+			continue;
+
+		const char *name = rrtype_name(metrics.dns.cache.content[i].type);
+		metrics_printf(out, "pihole_dns_cache_records{type=\"%s\",state=\"valid\"} %d\n",
+		               name, metrics.dns.cache.content[i].count[CACHE_VALID]);
+		metrics_printf(out, "pihole_dns_cache_records{type=\"%s\",state=\"stale\"} %d\n",
+		               name, metrics.dns.cache.content[i].count[CACHE_STALE]);
+	}
+
+	metrics_header(out, "pihole_dns_pool_records", "gauge",
+	               "Number of records in use and allocated in the pools backing the DNS cache and the forwarding table");
+	const struct { const char *name; const struct pool *pool; } pools[] = {
+		{ "blockdata", &metrics.dns.blockdata },
+		{ "bignames", &metrics.dns.bignames },
+		{ "frecs", &metrics.dns.frecs },
+	};
+	for(unsigned int i = 0; i < ArraySize(pools); i++)
+	{
+		metrics_printf(out, "pihole_dns_pool_records{pool=\"%s\",state=\"used\"} %u\n",
+		               pools[i].name, pools[i].pool->used);
+		metrics_printf(out, "pihole_dns_pool_records{pool=\"%s\",state=\"allocated\"} %u\n",
+		               pools[i].name, pools[i].pool->allocated);
+	}
+
+	metrics_header(out, "pihole_dns_udp_syscalls_total", "counter",
+	               "Number of system calls receiving queries and sending replies over UDP");
+	metrics_printf(out, "pihole_dns_udp_syscalls_total{direction=\"receive\"} %llu\n",
+	               (unsigned long long)__atomic_load_n(&counters->udp.recv_calls, __ATOMIC_RELAXED));
+	metrics_printf(out, "pihole_dns_udp_syscalls_total{direction=\"send\"} %llu\n",
+	               (unsigned long long)__atomic_load_n(&counters->udp.send_calls, __ATOMIC_RELAXED));
+	metrics_header(out, "pihole_dns_udp_datagrams_total", "counter",
+	               "Number of queries received and replies sent over UDP");
+	metrics_printf(out, "pihole_dns_udp_datagrams_total{direction=\"receive\"} %llu\n",
+	               (unsigned long long)__atomic_load_n(&counters->udp.received, __ATOMIC_RELAXED));
+	metrics_printf(out, "pihole_dns_udp_datagrams_total{direction=\"send\"} %llu\n",
+	               (unsigned long long)__atomic_load_n(&counters->udp.sent, __ATOMIC_RELAXED));
+
+	metrics_header(out, "pihole_dnssec_validations_total", "counter",
+	               "Number of replies validated (including replies to DNSKEY and DS queries)");
+	metrics_printf(out, "pihole_dnssec_validations_total %llu\n",
+	               (unsigned long long)__atomic_load_n(&counters->dnssec.validations, __ATOMIC_RELAXED));
+	metrics_header(out, "pihole_dnssec_validation_seconds_total", "counter",
+	               "Time spent validating replies");
+	metrics_printf(out, "pihole_dnssec_validation_seconds_total %.6f\n",
+	               1e-6*__atomic_load_n(&counters->dnssec.usec, __ATOMIC_RELAXED));
+	metrics_header(out, "pihole_dnssec_queued", "gauge",
+	               "Number of replies waiting for DNSKEY or DS records needed for their validation");
+	metrics_printf(out, "pihole_dnssec_queued %d\n", get_dnssec_queued());
+	metrics_header(out, "pihole_dnssec_signatures_total", "counter",
+	               "Number of signatures verified (verified) or found to have been verified before (memoized)");
+	metrics_printf(out, "pihole_dnssec_signatures_total{result=\"verified\"} %u\n",
+	               load_counter(&counters->dnssec.verified));
+	metrics_printf(out, "pihole_dnssec_signatures_total{result=\"memoized\"} %u\n",
+	               load_counter(&counters->dnssec.memo_hits));
+
+	metrics_header(out, "pihole_dns_replies_total", "counter", "Number of replies sent by the DNS server");
+	metrics_printf(out, "pihole_dns_replies_total{source=\"local\"} %d\n", metrics.dns.local_answered);
+	metrics_printf(out, "pihole_dns_replies_total{source=\"forwarded\"} %d\n", metrics.dns.forwarded_queries);
+	metrics_printf(out, "pihole_dns_replies_total{source=\"optimized\"} %d\n", metrics.dns.stale_answered);
+	metrics_printf(out, "pihole_dns_replies_total{source=\"unanswered\"} %d\n", metrics.dns.unanswered_queries);
+	metrics_printf(out, "pihole_dns_replies_total{source=\"auth\"} %d\n", metrics.dns.auth_answered);
+
+	metrics_header(out, "pihole_dhcp_messages_total", "counter", "Number of DHCP messages by type");
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"ack\"} %d\n", metrics.dhcp.ack);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"decline\"} %d\n", metrics.dhcp.decline);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"discover\"} %d\n", metrics.dhcp.discover);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"inform\"} %d\n", metrics.dhcp.inform);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"nak\"} %d\n", metrics.dhcp.nak);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"offer\"} %d\n", metrics.dhcp.offer);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"release\"} %d\n", metrics.dhcp.release);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"request\"} %d\n", metrics.dhcp.request);
+	metrics_printf(out, "pihole_dhcp_messages_total{type=\"noanswer\"} %d\n", metrics.dhcp.noanswer);
+}
+
+static void add_resolver_metrics(struct metrics_buffer *out)
+{
+	struct ptr_cache_stats ptr;
+	get_ptr_cache_stats(&ptr);
+
+	metrics_header(out, "pihole_resolver_ptr_cache_entries", "gauge",
+	               "Number of cached PTR lookups of client and upstream host names (all) and of those without a host name (negative)");
+	metrics_printf(out, "pihole_resolver_ptr_cache_entries{type=\"all\"} %u\n", ptr.entries);
+	metrics_printf(out, "pihole_resolver_ptr_cache_entries{type=\"negative\"} %u\n", ptr.negative);
+	metrics_header(out, "pihole_resolver_ptr_cache_lookups_total", "counter",
+	               "Number of host name lookups answered from the PTR cache (hit) or sent as PTR queries (miss)");
+	metrics_printf(out, "pihole_resolver_ptr_cache_lookups_total{result=\"hit\"} %lu\n", ptr.hits);
+	metrics_printf(out, "pihole_resolver_ptr_cache_lookups_total{result=\"miss\"} %lu\n", ptr.misses);
+
+	unsigned long answered[NAME_SOURCES];
+	get_name_source_stats(answered);
+	metrics_header(out, "pihole_resolver_names_total", "counter",
+	               "Number of client and upstream host names obtained by source");
+	for(unsigned int i = 0; i < NAME_SOURCES; i++)
+		metrics_printf(out, "pihole_resolver_names_total{source=\"%s\"} %lu\n",
+		               name_source_str(i), answered[i]);
+}
+
+static void add_ntp_metrics(struct metrics_buffer *out)
+{
+	struct ntp_server_stats stats[2];
+	get_ntp_server_stats(stats);
+	const char *servers[] = { "ipv4", "ipv6" };
+
+	metrics_header(out, "pihole_ntp_requests_total", "counter",
+	               "Number of requests received by the NTP server (all) and of those which were not valid NTP client requests (invalid)");
+	for(unsigned int i = 0; i < ArraySize(servers); i++)
+	{
+		if(!stats[i].active)
+			continue;
+		metrics_printf(out, "pihole_ntp_requests_total{server=\"%s\",type=\"all\"} %llu\n",
+		               servers[i], (unsigned long long)stats[i].requests);
+		metrics_printf(out, "pihole_ntp_requests_total{server=\"%s\",type=\"invalid\"} %llu\n",
+		               servers[i], (unsigned long long)stats[i].invalid);
+	}
+	metrics_header(out, "pihole_ntp_replies_total", "counter",
+	               "Number of replies sent by the NTP server");
+	for(unsigned int i = 0; i < ArraySize(servers); i++)
+		if(stats[i].active)
+			metrics_printf(out, "pihole_ntp_replies_total{server=\"%s\"} %llu\n",
+			               servers[i], (unsigned long long)stats[i].replies);
+	metrics_header(out, "pihole_ntp_errors_total", "counter",
+	               "Number of failed system calls receiving requests or sending replies");
+	for(unsigned int i = 0; i < ArraySize(servers); i++)
+		if(stats[i].active)
+			metrics_printf(out, "pihole_ntp_errors_total{server=\"%s\"} %llu\n",
+			               servers[i], (unsigned long long)stats[i].errors);
+	metrics_header(out, "pihole_ntp_syscalls_total", "counter",
+	               "Number of system calls receiving requests and sending replies");
+	for(unsigned int i = 0; i < ArraySize(servers); i++)
+	{
+		if(!stats[i].active)
+			continue;
+		metrics_printf(out, "pihole_ntp_syscalls_total{server=\"%s\",direction=\"receive\"} %llu\n",
+		               servers[i], (unsigned long long)stats[i].recv_calls);
+		metrics_printf(out, "pihole_ntp_syscalls_total{server=\"%s\",direction=\"send\"} %llu\n",
+		               servers[i], (unsigned long long)stats[i].send_calls);
+	}
+	metrics_header(out, "pihole_ntp_reply_latency_seconds", "summary",
+	               "Time between the kernel receiving a request and the reply being sent");
+	for(unsigned int i = 0; i < ArraySize(servers); i++)
+	{
+		if(!stats[i].active)
+			continue;
+		metrics_printf(out, "pihole_ntp_reply_latency_seconds_sum{server=\"%s\"} %g\n",
+		               servers[i], 1e-6*stats[i].latency_sum);
+		metrics_printf(out, "pihole_ntp_reply_latency_seconds_count{server=\"%s\"} %llu\n",
+		               servers[i], (unsigned long long)stats[i].replies);
+	}
+	metrics_header(out, "pihole_ntp_reply_latency_max_seconds", "gauge",
+	               "Longest time between the kernel receiving a request and the reply being sent");
+	for(unsigned int i = 0; i < ArraySize(servers); i++)
+		if(stats[i].active)
+			metrics_printf(out, "pihole_ntp_reply_latency_max_seconds{server=\"%s\"} %g\n",
+			               servers[i], 1e-6*stats[i].latency_max);
+}
+
+static void add_log_metrics(struct metrics_buffer *out)
+{
+	struct log_writer_stats stats;
+	get_log_writer_stats(&stats);
+
+	metrics_header(out, "pihole_log_lines_total", "counter",
+	               "Number of lines (batches of records for the binary query log) written to the log files (written) and dropped as the log queue was full (dropped)");
+	metrics_printf(out, "pihole_log_lines_total{result=\"written\"} %lu\n", stats.written);
+	metrics_printf(out, "pihole_log_lines_total{result=\"dropped\"} %lu\n", stats.dropped);
+	metrics_header(out, "pihole_log_batches_total", "counter",
+	               "Number of batches of log lines written by the log writer thread");
+	metrics_printf(out, "pihole_log_batches_total %lu\n", stats.batches);
+	metrics_header(out, "pihole_log_syncs_total", "counter",
+	               "Number of times log files have been synced to disk");
+	metrics_printf(out, "pihole_log_syncs_total %lu\n", stats.syncs);
+}
+
+static void add_webserver_metrics(struct metrics_buffer *out)
+{
+	struct lsp_cache_stats stats;
+	get_lsp_cache_stats(&stats);
+
+	metrics_header(out, "pihole_webserver_lsp_cache_requests_total", "counter",
+	               "Number of Lua server pages (including pages included by others) served from compiled bytecode (hit) or compiled from source (miss)");
+	metrics_printf(out, "pihole_webserver_lsp_cache_requests_total{result=\"hit\"} %lu\n", stats.hits);
+	metrics_printf(out, "pihole_webserver_lsp_cache_requests_total{result=\"miss\"} %lu\n", stats.misses);
+	metrics_header(out, "pihole_webserver_lsp_cache_evictions_total", "counter",
+	               "Number of compiled Lua server pages evicted from the cache as it was full");
+	metrics_printf(out, "pihole_webserver_lsp_cache_evictions_total %lu\n", stats.evictions);
+	metrics_header(out, "pihole_webserver_lsp_cache_bytes", "gauge",
+	               "Size of the bytecode of the cached Lua server pages");
+	metrics_printf(out, "pihole_webserver_lsp_cache_bytes %zu\n", stats.bytes);
+
+	// A resumed session may still fail to complete the handshake so
+	// resumptions are counted separately from the handshakes' results
+	struct tls_stats tls;
+	get_tls_stats(&tls);
+	metrics_header(out, "pihole_webserver_tls_handshakes_total", "counter",
+	               "Number of TLS handshakes on HTTPS ports by result");
+	metrics_printf(out, "pihole_webserver_tls_handshakes_total{result=\"success\"} %lu\n", tls.handshakes);
+	metrics_printf(out, "pihole_webserver_tls_handshakes_total{result=\"failed\"} %lu\n", tls.failed);
+	metrics_header(out, "pihole_webserver_tls_resumptions_total", "counter",
+	               "Number of TLS sessions resumed from the session cache or a session ticket instead of performing a full handshake");
+	metrics_printf(out, "pihole_webserver_tls_resumptions_total %lu\n", tls.resumed);
+}
+
+static void add_database_metrics(struct metrics_buffer *out)
+{
+	double age = 0.0;
+	const unsigned int pending = get_export_queue(&age);
+
+	metrics_header(out, "pihole_database_export_pending", "gauge",
+	               "Number of changed queries waiting to be stored in the database");
+	metrics_printf(out, "pihole_database_export_pending %u\n", pending);
+	metrics_header(out, "pihole_database_export_age_seconds", "gauge",
+	               "Seconds the oldest pending query has been waiting");
+	metrics_printf(out, "pihole_database_export_age_seconds %.3f\n", age);
+
+	struct db_job_stats stats[DB_JOBS];
+	get_db_job_stats(stats);
+	metrics_header(out, "pihole_database_job_runs_total", "counter",
+	               "Number of runs of the disk jobs of the database thread");
+	for(unsigned int i = 0; i < DB_JOBS; i++)
+		metrics_printf(out, "pihole_database_job_runs_total{job=\"%s\"} %u\n",
+		               get_db_job_name(i), stats[i].runs);
+	metrics_header(out, "pihole_database_job_deferred_total", "counter",
+	               "Number of times a disk job has been postponed as the disk was busy");
+	for(unsigned int i = 0; i < DB_JOBS; i++)
+		metrics_printf(out, "pihole_database_job_deferred_total{job=\"%s\"} %u\n",
+		               get_db_job_name(i), stats[i].deferred);
+	metrics_header(out, "pihole_database_job_seconds_total", "counter",
+	               "Time spent on the disk jobs of the database thread");
+	for(unsigned int i = 0; i < DB_JOBS; i++)
+		metrics_printf(out, "pihole_database_job_seconds_total{job=\"%s\"} %.3f\n",
+		               get_db_job_name(i), stats[i].total);
+	metrics_header(out, "pihole_database_job_last_seconds", "gauge",
+	               "Duration of the last run of the disk jobs of the database thread");
+	for(unsigned int i = 0; i < DB_JOBS; i++)
+		metrics_printf(out, "pihole_database_job_last_seconds{job=\"%s\"} %.3f\n",
+		               get_db_job_name(i), stats[i].last);
+
+	struct stmt_cache_stats cache;
+	get_stmt_cache_stats(&cache);
+	metrics_header(out, "pihole_database_statement_cache_hits_total", "counter",
+	               "Number of database queries reusing a cached prepared statement");
+	metrics_printf(out, "pihole_database_statement_cache_hits_total %lu\n", cache.hits);
+	metrics_header(out, "pihole_database_statement_cache_misses_total", "counter",
+	               "Number of database queries which had to prepare a new statement");
+	metrics_printf(out, "pihole_database_statement_cache_misses_total %lu\n", cache.misses);
+	metrics_header(out, "pihole_database_statement_cache_evictions_total", "counter",
+	               "Number of cached prepared statements replaced by newer ones");
+	metrics_printf(out, "pihole_database_statement_cache_evictions_total %lu\n", cache.evictions);
+
+	struct message_queue_stats messages;
+	get_message_queue_stats(&messages);
+	metrics_header(out, "pihole_database_messages_queued_total", "counter",
+	               "Number of messages queued for the message table");
+	metrics_printf(out, "pihole_database_messages_queued_total %lu\n", messages.queued);
+	metrics_header(out, "pihole_database_messages_coalesced_total", "counter",
+	               "Number of messages merged with an identical queued or recently written message");
+	metrics_printf(out, "pihole_database_messages_coalesced_total %lu\n", messages.coalesced);
+	metrics_header(out, "pihole_database_messages_dropped_total", "counter",
+	               "Number of messages dropped because the message queue was full");
+	metrics_printf(out, "pihole_database_messages_dropped_total %lu\n", messages.dropped);
+
+	struct replication_stats repl;
+	get_replication_stats(&repl);
+	metrics_header(out, "pihole_database_replication_running", "gauge",
+	               "Whether the database is currently being replicated to the standby node");
+	metrics_printf(out, "pihole_database_replication_running %d\n", repl.running ? 1 : 0);
+	metrics_header(out, "pihole_database_replication_runs_total", "counter",
+	               "Number of finished database replications");
+	metrics_printf(out, "pihole_database_replication_runs_total %lu\n", repl.runs);
+	metrics_header(out, "pihole_database_replication_failures_total", "counter",
+	               "Number of failed database replications");
+	metrics_printf(out, "pihole_database_replication_failures_total %lu\n", repl.failures);
+	metrics_header(out, "pihole_database_replication_last_success_timestamp_seconds", "gauge",
+	               "Time of the last successful database replication");
+	metrics_printf(out, "pihole_database_replication_last_success_timestamp_seconds %.3f\n", repl.last_success);
+	metrics_header(out, "pihole_database_replication_last_duration_seconds", "gauge",
+	               "Duration of the last database replication");
+	metrics_printf(out, "pihole_database_replication_last_duration_seconds %.3f\n", repl.last_duration);
+	metrics_header(out, "pihole_database_replication_last_sent_bytes", "gauge",
+	               "Bytes sent to the standby node during the last database replication");
+	metrics_printf(out, "pihole_database_replication_last_sent_bytes %llu\n", repl.last_sent);
+	metrics_header(out, "pihole_database_replication_sent_bytes_total", "counter",
+	               "Bytes sent to the standby node for database replication");
+	metrics_printf(out, "pihole_database_replication_sent_bytes_total %llu\n", repl.total_sent);
+	metrics_header(out, "pihole_database_replication_received_bytes_total", "counter",
+	               "Bytes received from the standby node for database replication");
+	metrics_printf(out, "pihole_database_replication_received_bytes_total %llu\n", repl.total_received);
+
+	struct query_sink_stats sink;
+	get_query_sink_stats(&sink);
+	metrics_header(out, "pihole_database_sink_connected", "gauge",
+	               "Whether the target of the query sink is connected");
+	metrics_printf(out, "pihole_database_sink_connected %d\n", sink.connected ? 1 : 0);
+	metrics_header(out, "pihole_database_sink_connects_total", "counter",
+	               "Number of connections established to the target of the query sink");
+	metrics_printf(out, "pihole_database_sink_connects_total %lu\n", sink.connects);
+	metrics_header(out, "pihole_database_sink_records_total", "counter",
+	               "Number of queries queued for the query sink");
+	metrics_printf(out, "pihole_database_sink_records_total %lu\n", sink.records);
+	metrics_header(out, "pihole_database_sink_dropped_total", "counter",
+	               "Number of queries dropped because the queue of the query sink was full or the connection was lost");
+	metrics_printf(out, "pihole_database_sink_dropped_total %lu\n", sink.dropped);
+	metrics_header(out, "pihole_database_sink_queued_bytes", "gauge",
+	               "Bytes waiting to be written to the query sink");
+	metrics_printf(out, "pihole_database_sink_queued_bytes %zu\n", sink.queued);
+	metrics_header(out, "pihole_database_sink_sent_bytes_total", "counter",
+	               "Bytes written to the query sink");
+	metrics_printf(out, "pihole_database_sink_sent_bytes_total %llu\n", sink.sent);
+}
+
+// Print a histogram as cumulative buckets. Only bounds of non-empty buckets
+// are printed, bounds are multiplied by scale
+static void add_histogram(struct metrics_buffer *out, const char *name, const char *label,
+                          const char *value, const struct api_histogram *hist, const double sum,
+                          const uint64_t count, const double scale)
+{
+	uint64_t cumulative = 0;
+	for(unsigned int i = 0; i < API_HISTOGRAM_BUCKETS - 1; i++)
+	{
+		if(hist->buckets[i] == 0)
+			continue;
+
+		cumulative += hist->buckets[i];
+		metrics_printf(out, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n", name, label, value,
+		               scale * api_histogram_upper(i), (unsigned long long)cumulative);
+	}
+	metrics_printf(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n", name, label, value, (unsigned long long)count);
+	metrics_printf(out, "%s_sum{%s=\"%s\"} %g\n", name, label, value, sum);
+	metrics_printf(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long)count);
+}
+
+static void add_api_metrics(struct metrics_buffer *out)
+{
+	unsigned int num = 0;
+	struct api_endpoint_stats *stats = get_api_endpoint_stats(&num);
+	if(stats == NULL)
+		return;
+
+	metrics_header(out, "pihole_api_request_duration_seconds", "histogram",
+	               "Time needed to answer API requests");
+	for(unsigned int i = 0; i < num; i++)
+		add_histogram(out, "pihole_api_request_duration_seconds", "endpoint", stats[i].uri,
+		              &stats[i].time_hist, 1e-9 * stats[i].time, stats[i].count, 1e-6);
+
+	metrics_header(out, "pihole_api_lock_duration_seconds", "histogram",
+	               "Time API requests spent waiting for and holding the SHM lock");
+	for(unsigned int i = 0; i < num; i++)
+		add_histogram(out, "pihole_api_lock_duration_seconds", "endpoint", stats[i].uri,
+		              &stats[i].lock_hist, 1e-9 * stats[i].lock, stats[i].count, 1e-6);
+
+	metrics_header(out, "pihole_api_response_bytes", "histogram",
+	               "Size of API responses including headers");
+	for(unsigned int i = 0; i < num; i++)
+		add_histogram(out, "pihole_api_response_bytes", "endpoint", stats[i].uri,
+		              &stats[i].bytes_hist, stats[i].bytes, stats[i].count, 1.0);
+
+	free(stats);
+}
+
+static void add_thread_metrics(struct metrics_buffer *out)
+{
+	struct thread_usage usage[THREAD_USAGE_MAX];
+	const unsigned int num = get_thread_usage(usage);
+
+	// Several threads may share a name (e.g., the webserver workers)
+	metrics_header(out, "pihole_thread_cpu_seconds_total", "counter",
+	               "CPU time spent by the threads of FTL");
+	for(unsigned int i = 0; i < num; i++)
+	{
+		metrics_printf(out, "pihole_thread_cpu_seconds_total{thread=");
+		metrics_label(out, usage[i].proc.name);
+		metrics_printf(out, ",tid=\"%d\",mode=\"user\"} %.2f\n", (int)usage[i].proc.tid, usage[i].proc.user);
+		metrics_printf(out, "pihole_thread_cpu_seconds_total{thread=");
+		metrics_label(out, usage[i].proc.name);
+		metrics_printf(out, ",tid=\"%d\",mode=\"system\"} %.2f\n", (int)usage[i].proc.tid, usage[i].proc.system);
+	}
+	metrics_header(out, "pihole_thread_context_switches_total", "counter",
+	               "Context switches of the threads of FTL because they waited for something (voluntary) or have been preempted (involuntary)");
+	for(unsigned int i = 0; i < num; i++)
+	{
+		metrics_printf(out, "pihole_thread_context_switches_total{thread=");
+		metrics_label(out, usage[i].proc.name);
+		metrics_printf(out, ",tid=\"%d\",type=\"voluntary\"} %lu\n", (int)usage[i].proc.tid, usage[i].proc.voluntary);
+		metrics_printf(out, "pihole_thread_context_switches_total{thread=");
+		metrics_label(out, usage[i].proc.name);
+		metrics_printf(out, ",tid=\"%d\",type=\"involuntary\"} %lu\n", (int)usage[i].proc.tid, usage[i].proc.involuntary);
+	}
+	metrics_header(out, "pihole_thread_wakeups_total", "counter",
+	               "Number of times the threads of FTL have been put on a CPU");
+	for(unsigned int i = 0; i < num; i++)
+	{
+		metrics_printf(out, "pihole_thread_wakeups_total{thread=");
+		metrics_label(out, usage[i].proc.name);
+		metrics_printf(out, ",tid=\"%d\"} %llu\n", (int)usage[i].proc.tid, usage[i].proc.wakeups);
+	}
+	metrics_header(out, "pihole_thread_runqueue_seconds_total", "counter",
+	               "Time the threads of FTL spent waiting for a CPU");
+	for(unsigned int i = 0; i < num; i++)
+	{
+		metrics_printf(out, "pihole_thread_runqueue_seconds_total{thread=");
+		metrics_label(out, usage[i].proc.name);
+		metrics_printf(out, ",tid=\"%d\"} %.6f\n", (int)usage[i].proc.tid, usage[i].proc.runqueue);
+	}
+}
+
+static void add_latency_metrics(struct metrics_buffer *out)
+{
+	if(!config.misc.traceLatency.v.b)
+		return;
+
+	struct latency_stage_stats stats[LATENCY_STAGES];
+	get_latency_stats(stats);
+
+	metrics_header(out, "pihole_dns_stage_duration_seconds", "histogram",
+	               "Time DNS queries spent in the stages of their processing");
+	for(unsigned int i = 0; i < LATENCY_STAGES; i++)
+		add_histogram(out, "pihole_dns_stage_duration_seconds", "stage", latency_stage_name(i),
+		              &stats[i].hist, 1e-6 * stats[i].sum, stats[i].count, 1e-6);
+}
+
+int api_metrics(struct ftl_conn *api)
+{
+	struct metrics_buffer out = { NULL, 0, 4096, false };
+	out.buf = malloc(out.size);
+	if(out.buf == NULL)
+		return send_http_internal_error(api);
+
+	add_query_metrics(&out);
+	add_upstream_metrics(&out);
+	add_dnsmasq_metrics(&out);
+	add_resolver_metrics(&out);
+	add_ntp_metrics(&out);
+	add_log_metrics(&out);
+	add_webserver_metrics(&out);
+	add_database_metrics(&out);
+	add_api_metrics(&out);
+	add_latency_metrics(&out);
+	add_thread_metrics(&out);
+
+	if(out.failed)
+	{
+		free(out.buf);
+		return send_http_internal_error(api);
+	}
+
+	send_http(api, METRICS_MIME_TYPE, out.buf);
+	free(out.buf);
+
+	return 200;
+}
@@ -40,9 +40,9 @@ int get_gateway(struct ftl_conn *api, cJSON * json, const bool detailed)
 
 	// Get interface information ...
 	cJSON *interfaces = JSON_NEW_ARRAY();
-	nllinks(interfaces, detailed);
+	nllinks(interfaces, NULL, detailed);
 	// ... and enrich them with addresses
-	nladdrs(interfaces, detailed);
+	nladdrs(interfaces, NULL, detailed);
 
 	cJSON *gateway = JSON_NEW_ARRAY();
 	// Search through routes for the default gateway
@@ -131,18 +131,71 @@ int api_network_gateway(struct ftl_conn *api)
 	JSON_SEND_OBJECT(json);
 }
 
+// Get the ?family, ?table, ?interface, ?start and ?length parameters. Returns
+// 0 on success, otherwise the error has been sent already
+static int get_nl_filter(struct ftl_conn *api, struct nl_filter *filter)
+{
+	memset(filter, 0, sizeof(*filter));
+	filter->family = AF_UNSPEC;
+	filter->length = -1;
+
+	char family[8] = { 0 };
+	if(GET_STR("family", family, api->request->query_string) > 0)
+	{
+		if(strcmp(family, "inet") == 0)
+			filter->family = AF_INET;
+		else if(strcmp(family, "inet6") == 0)
+			filter->family = AF_INET6;
+		else
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Invalid family, expected \"inet\" or \"inet6\"",
+			                       family);
+	}
+
+	char ifname[IF_NAMESIZE] = { 0 };
+	if(GET_STR("interface", ifname, api->request->query_string) > 0 &&
+	   (filter->ifindex = if_nametoindex(ifname)) == 0)
+		return send_json_error(api, 404,
+		                       "not_found",
+		                       "Interface not found",
+		                       ifname);
+
+	get_uint_var(api->request->query_string, "table", &filter->table);
+	get_uint_var(api->request->query_string, "start", &filter->start);
+	get_int_var(api->request->query_string, "length", &filter->length);
+
+	return 0;
+}
+
+static void stream_route(cJSON *route, void *data)
+{
+	json_stream_add_item(data, route);
+}
+
 int api_network_routes(struct ftl_conn *api)
 {
 	// Get ?detailed parameter
 	bool detailed = false;
 	get_bool_var(api->request->query_string, "detailed", &detailed);
 
-	// Add routing information
-	cJSON *routes = JSON_NEW_ARRAY();
-	nlroutes(routes, detailed);
+	struct nl_filter filter;
+	const int ret = get_nl_filter(api, &filter);
+	if(ret != 0)
+		return ret;
+
+	// Stream the routes as they are read from the kernel, full routing
+	// tables do not need to fit into memory
+	struct json_stream stream;
+	if(!json_stream_start(&stream, api, "routes"))
+		return send_json_error(api, 500, "internal_error",
+		                       "Internal server error, failed to allocate stream buffer",
+		                       NULL);
+	nlroutes_stream(&filter, detailed, stream_route, &stream);
+
 	cJSON *json = JSON_NEW_OBJECT();
-	JSON_ADD_ITEM_TO_OBJECT(json, "routes", routes);
-	JSON_SEND_OBJECT(json);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "recordsFiltered", filter.matched);
+	return json_stream_end(&stream, json);
 }
 
 int api_network_interfaces(struct ftl_conn *api)
@@ -151,29 +204,49 @@ int api_network_interfaces(struct ftl_conn *api)
 	bool detailed = false;
 	get_bool_var(api->request->query_string, "detailed", &detailed);
 
+	struct nl_filter filter;
+	const int ret = get_nl_filter(api, &filter);
+	if(ret != 0)
+		return ret;
+
 	cJSON *interfaces = JSON_NEW_ARRAY();
 	// Get links ...
-	nllinks(interfaces, detailed);
-	// ... and enrich them with addresses
-	nladdrs(interfaces, detailed);
+	nllinks(interfaces, &filter, detailed);
+	// ... and enrich them with addresses (only those of the links on this
+	// page are added)
+	nladdrs(interfaces, &filter, detailed);
 
 	cJSON *json = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(json, "interfaces", interfaces);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "recordsFiltered", filter.matched);
 	JSON_SEND_OBJECT(json);
 }
 
 static int api_network_devices_GET(struct ftl_conn *api)
 {
 	// Does the user request a custom number of devices to be included?
-	unsigned int device_count = 10;
-	get_uint_var(api->request->query_string, "max_devices", &device_count);
+	network_page page = { .lastQuery = -1, .devices = 10, .addresses = 3 };
+	get_uint_var(api->request->query_string, "max_devices", &page.devices);
 
 	// Does the user request a custom number of addresses per device to be included?
-	unsigned int address_count = 3;
-	get_uint_var(api->request->query_string, "max_addresses", &address_count);
+	get_uint_var(api->request->query_string, "max_addresses", &page.addresses);
+
+	// Does the user request the page after a given device? The cursor is
+	// the "next" value of the previous page
+	char after[32] = { 0 };
+	if(GET_STR("after", after, api->request->query_string) > 0)
+	{
+		long long lastQuery = 0;
+		if(sscanf(after, "%lld:%i", &lastQuery, &page.id) != 2 || lastQuery < 0)
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Invalid cursor, expected \"<lastQuery>:<id>\"",
+			                       after);
+		page.lastQuery = (time_t)lastQuery;
+	}
 
 	// Open pihole-FTL.db database file
-	sqlite3_stmt *device_stmt = NULL, *ip_stmt = NULL;
+	sqlite3_stmt *device_stmt = NULL;
 	sqlite3 *db = dbopen(true, false);
 	if(db == NULL)
 	{
@@ -181,12 +254,13 @@ static int api_network_devices_GET(struct ftl_conn *api)
 		return false;
 	}
 
+	// Devices and their addresses are read using a single query
 	const char *sql_msg = NULL;
-	if(!networkTable_readDevices(db, &device_stmt, &sql_msg))
+	if(!networkTable_readDevices(db, &device_stmt, &page, &sql_msg))
 	{
 		networkTable_readDevicesFinalize(device_stmt);
 		dbclose(&db);
-	
+
 		// Add SQL message (may be NULL = not available)
 		return send_json_error(api, 500,
 		                       "database_error",
@@ -194,87 +268,84 @@ static int api_network_devices_GET(struct ftl_conn *api)
 		                       sql_msg);
 	}
 
-	// Read record for a single device
-	cJSON *devices = JSON_NEW_ARRAY();
+	struct json_stream stream;
+	if(!json_stream_start(&stream, api, "devices"))
+	{
+		networkTable_readDevicesFinalize(device_stmt);
+		dbclose(&db);
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Internal server error, failed to allocate stream buffer",
+		                       NULL);
+	}
+
+	// The rows of a device are consecutive, each device is sent as soon as
+	// the first row of the next one has been read
+	cJSON *item = NULL, *ips = NULL;
 	network_record network;
+	network_addresses_record network_address;
 	unsigned int device_counter = 0;
-	while(networkTable_readDevicesGetRecord(device_stmt, &network, &sql_msg) &&
-	      device_counter++ < device_count)
+	time_t lastQuery = 0;
+	int lastID = 0;
+	while(networkTable_readDevicesGetRecord(device_stmt, &network, &network_address, &sql_msg))
 	{
-		cJSON *item = JSON_NEW_OBJECT();
-		JSON_ADD_NUMBER_TO_OBJECT(item, "id", network.id);
-		JSON_COPY_STR_TO_OBJECT(item, "hwaddr", network.hwaddr);
-		JSON_COPY_STR_TO_OBJECT(item, "interface", network.iface);
-		JSON_ADD_NUMBER_TO_OBJECT(item, "firstSeen", network.firstSeen);
-		JSON_ADD_NUMBER_TO_OBJECT(item, "lastQuery", network.lastQuery);
-		JSON_ADD_NUMBER_TO_OBJECT(item, "numQueries", network.numQueries);
-		JSON_COPY_STR_TO_OBJECT(item, "macVendor", network.macVendor);
-
-		// Build array of all IP addresses known associated to this client
-		cJSON *ips = JSON_NEW_ARRAY();
-		if(networkTable_readIPs(db, &ip_stmt, network.id, &sql_msg))
+		if(item == NULL || (int)network.id != lastID)
 		{
-			// Walk known IP addresses + names
-			network_addresses_record network_address;
-			unsigned int address_counter = 0;
-			while(networkTable_readIPsGetRecord(ip_stmt, &network_address, &sql_msg) &&
-			      address_counter++ < address_count)
-			{
-				cJSON *ip = JSON_NEW_OBJECT();
-				JSON_COPY_STR_TO_OBJECT(ip, "ip", network_address.ip);
-				JSON_COPY_STR_TO_OBJECT(ip, "name", network_address.name);
-				JSON_ADD_NUMBER_TO_OBJECT(ip, "lastSeen", network_address.lastSeen);
-				JSON_ADD_NUMBER_TO_OBJECT(ip, "nameUpdated", network_address.nameUpdated);
-				JSON_ADD_ITEM_TO_ARRAY(ips, ip);
-			}
-
-			// Possible error handling
-			if(sql_msg != NULL)
-			{
-				cJSON_Delete(ips);
-				cJSON_Delete(devices);
-
-				networkTable_readIPsFinalize(ip_stmt);
-				networkTable_readDevicesFinalize(device_stmt);
-				dbclose(&db);
-
-				return send_json_error(api, 500,
-				                       "database_error",
-				                       "Could not read network details from database table (getting IP records)",
-				                       sql_msg);
-			}
-
-			// Finalize sub-query
-			networkTable_readIPsFinalize(ip_stmt);
+			if(item != NULL)
+				json_stream_add_item(&stream, item);
+
+			item = JSON_NEW_OBJECT();
+			JSON_ADD_NUMBER_TO_OBJECT(item, "id", network.id);
+			JSON_COPY_STR_TO_OBJECT(item, "hwaddr", network.hwaddr);
+			JSON_COPY_STR_TO_OBJECT(item, "interface", network.iface);
+			JSON_ADD_NUMBER_TO_OBJECT(item, "firstSeen", network.firstSeen);
+			JSON_ADD_NUMBER_TO_OBJECT(item, "lastQuery", network.lastQuery);
+			JSON_ADD_NUMBER_TO_OBJECT(item, "numQueries", network.numQueries);
+			JSON_COPY_STR_TO_OBJECT(item, "macVendor", network.macVendor);
+
+			// Array of the IP addresses associated to this device
+			ips = JSON_NEW_ARRAY();
+			JSON_ADD_ITEM_TO_OBJECT(item, "ips", ips);
+
+			lastID = network.id;
+			lastQuery = network.lastQuery;
+			device_counter++;
 		}
 
-		// Add array of IP addresses to device
-		JSON_ADD_ITEM_TO_OBJECT(item, "ips", ips);
-
-		// Add device to array of all devices
-		JSON_ADD_ITEM_TO_ARRAY(devices, item);
-	}
-
-	if(sql_msg != NULL)
-	{
-		networkTable_readDevicesFinalize(device_stmt);
-		dbclose(&db);
+		// Devices without any address have a single row without one
+		if(network_address.ip == NULL)
+			continue;
 
-		cJSON_Delete(devices);
-		return send_json_error(api, 500,
-		                       "database_error",
-		                       "Could not read network details from database table (step)",
-		                       sql_msg);
+		cJSON *ip = JSON_NEW_OBJECT();
+		JSON_COPY_STR_TO_OBJECT(ip, "ip", network_address.ip);
+		JSON_COPY_STR_TO_OBJECT(ip, "name", network_address.name);
+		JSON_ADD_NUMBER_TO_OBJECT(ip, "lastSeen", network_address.lastSeen);
+		JSON_ADD_NUMBER_TO_OBJECT(ip, "nameUpdated", network_address.nameUpdated);
+		JSON_ADD_ITEM_TO_ARRAY(ips, ip);
 	}
+	if(item != NULL)
+		json_stream_add_item(&stream, item);
 
 	// Finalize query
 	networkTable_readDevicesFinalize(device_stmt);
 	dbclose(&db);
 
-	// Return data to user
 	cJSON *json = JSON_NEW_OBJECT();
-	JSON_ADD_ITEM_TO_OBJECT(json, "devices", devices);
-	JSON_SEND_OBJECT(json);
+	if(page.devices > 0 && device_counter == page.devices)
+	{
+		char next[32];
+		snprintf(next, sizeof(next), "%lld:%d", (long long)lastQuery, lastID);
+		JSON_COPY_STR_TO_OBJECT(json, "next", next);
+	}
+	else
+		JSON_ADD_NULL_TO_OBJECT(json, "next");
+
+	// The response has already been started, errors while reading can only
+	// be reported as part of it
+	if(sql_msg != NULL)
+		JSON_COPY_STR_TO_OBJECT(json, "error", sql_msg);
+
+	return json_stream_end(&stream, json);
 }
 
 static int api_network_devices_DELETE(struct ftl_conn *api)
@@ -3,7 +3,7 @@
 *  Network-wide ad blocking via your own hardware.
 *
 *  FTL Engine
-*  API Implementation /api/dns
+*  API Implementation /api/padd
 *
 *  This file is copyright under the latest version of the EUPL.
 *  Please see LICENSE file for your rights under this license. */
@@ -12,7 +12,7 @@
 #include "webserver/http-common.h"
 #include "webserver/json_macros.h"
 #include "api.h"
-// lock_shm() and unlock_shm()
+// lock_shm_read() and unlock_shm_read()
 #include "shmem.h"
 // counters
 #include "datastructure.h"
@@ -28,19 +28,33 @@
 #include "procps.h"
 // getcpu_percentage()
 #include "daemon.h"
-
-int api_padd(struct ftl_conn *api)
+// struct mg_request_info
+#include "webserver/civetweb/civetweb.h"
+
+// Snapshots older than this are not sent but the response is built from
+// scratch [seconds]
+#define PADD_SNAPSHOT_MAX_AGE 2.0
+// Snapshots are only refreshed while PADD has been requested within this
+// time [seconds]
+#define PADD_SNAPSHOT_IDLE 30.0
+
+// Pre-built responses (without and with full=true), refreshed once per second
+// by the timer thread. A new snapshot is built before it replaces the current
+// one so requests never wait for it being built
+static struct {
+	char *body[2];
+	double built[2];
+	double requested[2];
+} padd_snapshot = { { NULL, NULL }, { 0.0, 0.0 }, { 0.0, 0.0 } };
+static pthread_mutex_t padd_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int build_padd(struct ftl_conn *api, const bool full)
 {
-	// Parse parameters
-	bool full = true;
-	if(api->request->query_string != NULL)
-		get_bool_var(api->request->query_string, "full", &full);
-
 	cJSON *json = JSON_NEW_OBJECT();
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
-	const int total = counters->queries;
+	const int total = get_total_queries();
 	const int blocked = get_blocked_count();
 	const unsigned int active_clients = get_active_clients();
 	const int num_gravity = counters->database.gravity;
@@ -50,8 +64,14 @@ int api_padd(struct ftl_conn *api)
 	if(config.misc.privacylevel.v.privacy_level < PRIVACY_HIDE_DOMAINS)
 	{
 		// Find most recently blocked query
+		const struct query_columns *columns = get_query_columns();
 		for(int queryID = counters->queries - 1; queryID > 0 ; queryID--)
 		{
+			// Skip non-blocked queries without touching the query
+			// records if the columnar mirror is available
+			if(columns != NULL && !is_blocked(columns->status[query_slot(queryID)]))
+				continue;
+
 			const queriesData *query = getQuery(queryID, true);
 			if(query == NULL)
 				continue;
@@ -71,7 +91,7 @@ int api_padd(struct ftl_conn *api)
 	}
 
 	// Unlock shared memory
-	unlock_shm();
+	unlock_shm_read();
 
 	// Add the number of active clients, the size of the gravity list
 	JSON_ADD_NUMBER_TO_OBJECT(json, "active_clients", active_clients);
@@ -136,7 +156,10 @@ int api_padd(struct ftl_conn *api)
 	// Add cache statistics
 	cJSON *cache = JSON_NEW_OBJECT();
 	struct metrics metrics = { 0 };
+	// The cache may be resized concurrently (dns.cache.autosize)
+	lock_shm_read();
 	get_dnsmasq_metrics(&metrics);
+	unlock_shm_read();
 	JSON_ADD_NUMBER_TO_OBJECT(cache, "size", metrics.dns.cache.size);
 	JSON_ADD_NUMBER_TO_OBJECT(cache, "inserted", metrics.dns.cache.inserted);
 	JSON_ADD_NUMBER_TO_OBJECT(cache, "evicted", metrics.dns.cache.live_freed);
@@ -307,3 +330,72 @@ int api_padd(struct ftl_conn *api)
 
 	JSON_SEND_OBJECT(json);
 }
+
+/**
+ * Refresh the PADD snapshots which have been requested recently. This is
+ * called once per second by the timer thread.
+ */
+void update_padd_snapshot(void)
+{
+	for(unsigned int full = 0; full < 2; full++)
+	{
+		const double now = double_time();
+		pthread_mutex_lock(&padd_snapshot_lock);
+		const bool wanted = now - padd_snapshot.requested[full] < PADD_SNAPSHOT_IDLE;
+		pthread_mutex_unlock(&padd_snapshot_lock);
+		if(!wanted)
+			continue;
+
+		// Build the response the same way as for a request of
+		// /api/batch, it is stored instead of being sent
+		struct batch_response response = { 500, NULL };
+		struct mg_request_info request = { 0 };
+		struct ftl_conn api = {
+			.request = &request,
+			.method = HTTP_GET,
+			.now = now,
+			.batch = &response
+		};
+		build_padd(&api, full);
+		if(response.code != 200 || response.body == NULL)
+		{
+			free(response.body);
+			continue;
+		}
+
+		pthread_mutex_lock(&padd_snapshot_lock);
+		char *old = padd_snapshot.body[full];
+		padd_snapshot.body[full] = response.body;
+		padd_snapshot.built[full] = now;
+		pthread_mutex_unlock(&padd_snapshot_lock);
+		free(old);
+	}
+}
+
+int api_padd(struct ftl_conn *api)
+{
+	// Parse parameters
+	bool full = true;
+	if(api->request->query_string != NULL)
+		get_bool_var(api->request->query_string, "full", &full);
+
+	// Copy the latest snapshot if it is recent enough
+	char *body = NULL;
+	pthread_mutex_lock(&padd_snapshot_lock);
+	padd_snapshot.requested[full] = api->now;
+	if(padd_snapshot.body[full] != NULL &&
+	   api->now - padd_snapshot.built[full] < PADD_SNAPSHOT_MAX_AGE)
+		body = strdup(padd_snapshot.body[full]);
+	pthread_mutex_unlock(&padd_snapshot_lock);
+
+	// Snapshots are JSON-encoded, other encodings are built on demand
+	if(body == NULL || api_wants_cbor(api))
+	{
+		free(body);
+		return build_padd(api, full);
+	}
+
+	send_http(api, "application/json; charset=utf-8", body);
+	free(body);
+	return 200;
+}
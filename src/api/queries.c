@@ -15,77 +15,32 @@
 #include "datastructure.h"
 // config struct
 #include "config/config.h"
-// get_memdb()
+// get_webserver_threads()
+#include "webserver/webserver.h"
+// get_memdb_reader(), get_memdb_query_source()
 #include "database/query-table.h"
 // dbopen(false, ), dbclose()
 #include "database/common.h"
-
-#if 0
-static int add_strings_to_array(struct ftl_conn *api, cJSON *array1, cJSON *array2, const char *querystr, const int max_count)
-{
-
-	sqlite3 *memdb = get_memdb();
-	if(memdb == NULL)
-	{
-		return send_json_error(api, 500, // 500 Internal error
-		                       "database_error",
-		                       "Could not read from in-memory database",
-		                       NULL);
-	}
-
-	sqlite3_stmt *stmt = NULL;
-	int rc = sqlite3_prepare_v2(memdb, querystr, -1, &stmt, NULL);
-	if( rc != SQLITE_OK )
-	{
-		return send_json_error(api, 500, // 500 Internal error
-		                       "database_error",
-		                       "Could not prepare in-memory database",
-		                       sqlite3_errstr(rc));
-	}
-
-	// Loop through returned rows and add them to the array
-	int counter = 0;
-	while((rc = sqlite3_step(stmt)) == SQLITE_ROW &&
-	      (max_count < 0 || ++counter <= max_count))
-	{
-		const char *array1_str = (const char*)sqlite3_column_text(stmt, 0);
-		if(array1_str != NULL && array1_str[0] != '\0')
-			// Only add non-empty strings
-			JSON_COPY_STR_TO_ARRAY(array1, array1_str);
-		if(array2 != NULL)
-		{
-			// We have a second array to fill (second column in the query)
-			const char *array2_str = (const char*)sqlite3_column_text(stmt, 1);
-			if(array2_str != NULL && array2_str[0] != '\0')
-				// Only add non-empty strings
-				JSON_COPY_STR_TO_ARRAY(array2, array2_str);
-		}
-	}
-
-	// Acceptable return codes are either
-	// - SQLITE_DONE: We read all lines, or
-	// - SQLITE_ROW: We ended reading early because of set limit
-	if( rc != SQLITE_DONE && rc != SQLITE_ROW )
-	{
-		sqlite3_finalize(stmt);
-		return send_json_error(api, 500, // 500 Internal error
-		                       "database_error",
-		                       "Could not step in-memory database",
-		                       sqlite3_errstr(rc));
-	}
-
-	// Finalize SQLite3 statement
-	sqlite3_finalize(stmt);
-
-	return 0;
-}
-#endif
+// counters, getstr(), lock_shm_read()
+#include "shmem.h"
+// killed
+#include "signals.h"
+// ULONG_MAX
+#include <limits.h>
+// TOP_LIST_SIZE
+#include "top-lists.h"
+// find_domain_suffix()
+#include "domain-suffixes.h"
 
 int api_queries_suggestions(struct ftl_conn *api)
 {
 	// Does the user request a custom number of records to be included?
+	// Suggestions are limited to the size of the top lists so they are
+	// always served from them instead of scanning all domains and clients
 	int count = 30;
 	get_int_var(api->request->query_string, "count", &count);
+	if(count < 1 || count > (int)TOP_LIST_SIZE)
+		count = TOP_LIST_SIZE;
 
 	// Get domains
 	cJSON *domain = get_top_domains(api, count, false, true);
@@ -261,6 +216,467 @@ static bool is_wildcard(char *string)
 	return wildcard;
 }
 
+// Filters of the shared memory path of /api/queries. Strings are NULL if the
+// filter has not been requested, wildcards have already been converted to SQL
+// syntax by is_wildcard()
+struct query_filter {
+	bool from_set, until_set, cursor_set;
+	bool domain_like, upstream_like, client_ip_like, client_name_like;
+	enum { UPSTREAM_ANY, UPSTREAM_BLOCKLIST, UPSTREAM_CACHE, UPSTREAM_PERMITTED } upstream_status;
+	double from, until;
+	unsigned long cursor;
+	unsigned long last_id;
+	const char *domain, *upstream, *client_ip, *client_name;
+	const char *domain_search, *client_search;
+	const char *type, *status, *reply, *dnssec;
+};
+
+// Check if any filter reducing the number of results has been requested
+static bool __attribute__((pure)) query_filter_active(const struct query_filter *filter)
+{
+	return filter->from_set || filter->until_set ||
+	       filter->upstream_status != UPSTREAM_ANY || filter->upstream != NULL ||
+	       filter->domain != NULL || filter->domain_search != NULL ||
+	       filter->client_ip != NULL || filter->client_name != NULL || filter->client_search != NULL ||
+	       filter->type != NULL || filter->status != NULL || filter->reply != NULL || filter->dnssec != NULL;
+}
+
+// Match a string against a pattern using the rules of SQL's LIKE operator: %
+// matches any sequence of characters, _ any single character and the
+// comparison is case-insensitive (for ASCII characters)
+static bool __attribute__((pure)) like_match(const char *pattern, const char *string)
+{
+	const char *p_star = NULL, *s_star = NULL;
+	while(*string != '\0')
+	{
+		if(*pattern == '%')
+		{
+			// Remember position for backtracking
+			p_star = ++pattern;
+			s_star = string;
+		}
+		else if(*pattern == '_' || (*pattern != '\0' && tolower((unsigned char)*pattern) == tolower((unsigned char)*string)))
+		{
+			pattern++;
+			string++;
+		}
+		else if(p_star != NULL)
+		{
+			// Let the last % consume one more character
+			pattern = p_star;
+			string = ++s_star;
+		}
+		else
+			return false;
+	}
+
+	// Trailing % match the empty string
+	while(*pattern == '%')
+		pattern++;
+
+	return *pattern == '\0';
+}
+
+// Apply a filter as either LIKE or exact (case-sensitive) comparison
+static inline bool str_filter(const char *filter, const bool like, const char *string)
+{
+	return filter == NULL || (like ? like_match(filter, string) : strcmp(filter, string) == 0);
+}
+
+static bool domain_matches(const struct query_filter *filter, const char *domain)
+{
+	return str_filter(filter->domain, filter->domain_like, domain) &&
+	       str_filter(filter->domain_search, true, domain);
+}
+
+static bool client_matches(const struct query_filter *filter, const char *ip, const char *name)
+{
+	// The name is NULL in the database if it is empty
+	const bool has_name = name[0] != '\0';
+	return str_filter(filter->client_ip, filter->client_ip_like, ip) &&
+	       (filter->client_name == NULL || (has_name && str_filter(filter->client_name, filter->client_name_like, name))) &&
+	       (filter->client_search == NULL || like_match(filter->client_search, ip) ||
+	        (has_name && like_match(filter->client_search, name)));
+}
+
+// Format an upstream destination the same way it is stored in the database
+static void get_upstream_string(const upstreamsData *upstream, char *buffer, const size_t len)
+{
+	snprintf(buffer, len, "%s#%u", getstr(upstream->ippos), upstream->port);
+}
+
+// Get the suffix of a LIKE pattern selecting all subdomains of a domain, i.e.,
+// of the form %.example.com, NULL for all other patterns
+static const char * __attribute__((pure)) subdomain_pattern(const char *pattern)
+{
+	if(strncmp(pattern, "%.", 2) != 0 || pattern[2] == '\0' || strpbrk(pattern + 2, "%_") != NULL)
+		return NULL;
+
+	return pattern + 2;
+}
+
+/**
+ * Evaluate the string filters once per domain, client and upstream instead of
+ * once per query. The resulting arrays are indexed by the object IDs and tell
+ * if queries referencing the object pass the filters. The caller must hold the
+ * SHM lock and free the arrays.
+ */
+static bool compute_id_sets(const struct query_filter *filter, bool **domain_ok,
+                            bool **client_ok, bool **upstream_ok)
+{
+	*domain_ok = *client_ok = *upstream_ok = NULL;
+	if(filter->domain != NULL || filter->domain_search != NULL)
+	{
+		if((*domain_ok = calloc(counters->domains + 1, sizeof(bool))) == NULL)
+			return false;
+
+		// Subdomain filters (*.example.com) are matched against domains
+		// stored as label suffixes by following their chain of suffixes
+		// instead of comparing strings
+		const char *suffix = filter->domain != NULL && filter->domain_like && filter->domain_search == NULL ?
+		                     subdomain_pattern(filter->domain) : NULL;
+		int suffixID = -1;
+		if(suffix != NULL && strlen(suffix) < DOMAIN_NAME_MAX)
+		{
+			char lower[DOMAIN_NAME_MAX];
+			strcpy(lower, suffix);
+			strtolower(lower);
+			suffixID = find_domain_suffix(lower);
+		}
+
+		for(unsigned int domainID = 0; domainID < (unsigned int)counters->domains; domainID++)
+		{
+			const domainsData *domain = getDomain(domainID, true);
+			if(domain == NULL)
+				continue;
+			if(suffix != NULL && domain->suffix != SUFFIX_ROOT)
+				(*domain_ok)[domainID] = suffixID > -1 && domain_has_suffix(domain->suffix, suffixID);
+			else
+				(*domain_ok)[domainID] = domain_matches(filter, getDomainName(domain));
+		}
+	}
+
+	if(filter->client_ip != NULL || filter->client_name != NULL || filter->client_search != NULL)
+	{
+		if((*client_ok = calloc(counters->clients + 1, sizeof(bool))) == NULL)
+			return false;
+		for(unsigned int clientID = 0; clientID < (unsigned int)counters->clients; clientID++)
+		{
+			const clientsData *client = getClient(clientID, true);
+			if(client != NULL)
+				(*client_ok)[clientID] = client_matches(filter, getstr(client->ippos), getstr(client->namepos));
+		}
+	}
+
+	if(filter->upstream != NULL)
+	{
+		if((*upstream_ok = calloc(counters->upstreams + 1, sizeof(bool))) == NULL)
+			return false;
+		for(unsigned int upstreamID = 0; upstreamID < (unsigned int)counters->upstreams; upstreamID++)
+		{
+			const upstreamsData *upstream = getUpstream(upstreamID, true);
+			if(upstream == NULL)
+				continue;
+
+			char buffer[INET6_ADDRSTRLEN + 8];
+			get_upstream_string(upstream, buffer, sizeof(buffer));
+			(*upstream_ok)[upstreamID] = str_filter(filter->upstream, filter->upstream_like, buffer);
+		}
+	}
+
+	return true;
+}
+
+static bool query_matches(const struct query_filter *filter, const queriesData *query,
+                          const bool *domain_ok, const bool *client_ok, const bool *upstream_ok,
+                          const int type, const int status, const int reply, const int dnssec)
+{
+	// Only queries which have already been stored in the database have an
+	// ID which can be used as cursor
+	const int64_t dbid = get_query_dbid(query);
+	if(dbid < 1 || (unsigned long)dbid > filter->cursor)
+		return false;
+
+	const double timestamp = get_query_timestamp(query);
+	if((filter->from_set && timestamp < filter->from) ||
+	   (filter->until_set && timestamp >= filter->until))
+		return false;
+
+	// Queries of type OTHER are stored with their numeric type
+	if((type > -1 && (query->type != type || query->type == TYPE_OTHER)) ||
+	   (status > -1 && query->status != status) ||
+	   (reply > -1 && query->reply != reply) ||
+	   (dnssec > -1 && query->dnssec != dnssec))
+		return false;
+
+	switch(filter->upstream_status)
+	{
+		case UPSTREAM_BLOCKLIST:
+			if(!is_blocked(query->status))
+				return false;
+			break;
+		case UPSTREAM_CACHE:
+			if(!is_cached(query->status))
+				return false;
+			break;
+		case UPSTREAM_PERMITTED:
+			if(is_blocked(query->status))
+				return false;
+			break;
+		case UPSTREAM_ANY:
+			break;
+	}
+	if(upstream_ok != NULL && (query->upstreamID < 0 || !upstream_ok[query->upstreamID]))
+		return false;
+
+	// Hidden domains and clients are matched against the placeholder
+	if(domain_ok != NULL &&
+	   !(query->privacylevel < PRIVACY_HIDE_DOMAINS ? domain_ok[query->domainID] :
+	     domain_matches(filter, HIDDEN_DOMAIN)))
+		return false;
+	if(client_ok != NULL &&
+	   !(query->privacylevel < PRIVACY_HIDE_DOMAINS_CLIENTS ? client_ok[query->clientID] :
+	     client_matches(filter, HIDDEN_CLIENT, HIDDEN_CLIENT)))
+		return false;
+
+	// Skip queries excluded by webserver.api.excludeDomains and
+	// webserver.api.excludeClients
+	const domainsData *domain = getDomain(query->domainID, true);
+	const clientsData *client = getClient(query->clientID, true);
+	if(domain == NULL || domain->flags.excluded ||
+	   client == NULL || client->flags.excluded)
+		return false;
+
+	return true;
+}
+
+// Build the JSON object of a query in the same format as the database path
+static int build_shm_query(struct ftl_conn *api, const queriesData *query, cJSON **result)
+{
+	cJSON *item = JSON_NEW_OBJECT();
+	char buffer[INET6_ADDRSTRLEN + 8] = { 0 };
+	JSON_ADD_NUMBER_TO_OBJECT(item, "id", get_query_dbid(query));
+	JSON_ADD_NUMBER_TO_OBJECT(item, "time", get_query_timestamp(query));
+	// We have to copy the string as TYPExxx string won't be static
+	JSON_COPY_STR_TO_OBJECT(item, "type", get_query_type_str(query->type, query, buffer));
+	JSON_REF_STR_IN_OBJECT(item, "status", get_query_status_str(query->status));
+	JSON_REF_STR_IN_OBJECT(item, "dnssec", get_query_dnssec_str(query->dnssec));
+	JSON_COPY_STR_TO_OBJECT(item, "domain", getDomainString(query));
+
+	const upstreamsData *upstream = query->upstreamID > -1 ? getUpstream(query->upstreamID, true) : NULL;
+	if(upstream != NULL)
+	{
+		get_upstream_string(upstream, buffer, sizeof(buffer));
+		JSON_COPY_STR_TO_OBJECT(item, "upstream", buffer);
+	}
+	else
+		JSON_ADD_NULL_TO_OBJECT(item, "upstream");
+
+	cJSON *reply = JSON_NEW_OBJECT();
+	JSON_REF_STR_IN_OBJECT(reply, "type", get_query_reply_str(query->reply));
+	JSON_ADD_NUMBER_TO_OBJECT(reply, "time", query->flags.response_calculated ? get_query_response(query) : 0.0);
+	JSON_ADD_ITEM_TO_OBJECT(item, "reply", reply);
+
+	cJSON *client = JSON_NEW_OBJECT();
+	const char *client_name = getClientNameString(query);
+	JSON_COPY_STR_TO_OBJECT(client, "ip", getClientIPString(query));
+	if(client_name[0] != '\0')
+		JSON_COPY_STR_TO_OBJECT(client, "name", client_name);
+	else
+		JSON_ADD_NULL_TO_OBJECT(client, "name");
+	JSON_ADD_ITEM_TO_OBJECT(item, "client", client);
+
+	// Add list_id if it exists
+	const int cacheID = query->cacheID > -1 ? query->cacheID : findCacheID(query->domainID, query->clientID, query->type, false);
+	const DNSCacheData *cache = cacheID > -1 ? getDNSCache(cacheID, true) : NULL;
+	if(cache != NULL && cache->list_id != -1)
+		JSON_ADD_NUMBER_TO_OBJECT(item, "list_id", cache->list_id);
+	else
+		JSON_ADD_NULL_TO_OBJECT(item, "list_id");
+
+	// Add EDE code and text (if applicable)
+	cJSON *ede = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(ede, "code", query->ede);
+	if(query->ede > 0)
+		JSON_REF_STR_IN_OBJECT(ede, "text", edestr(query->ede));
+	else
+		JSON_ADD_NULL_TO_OBJECT(ede, "text");
+	JSON_ADD_ITEM_TO_OBJECT(item, "ede", ede);
+
+	// Add CNAME information if it exists
+	if(query->status == QUERY_GRAVITY_CNAME ||
+	   query->status == QUERY_REGEX_CNAME ||
+	   query->status == QUERY_DENYLIST_CNAME)
+		JSON_COPY_STR_TO_OBJECT(item, "cname", getCNAMEDomainString(query));
+	else
+		JSON_ADD_NULL_TO_OBJECT(item, "cname");
+
+	*result = item;
+	return 0;
+}
+
+static int add_shm_query(struct ftl_conn *api, struct json_stream *stream, const queriesData *query)
+{
+	cJSON *item = NULL;
+	const int ret = build_shm_query(api, query, &item);
+	if(ret == 0)
+		json_stream_add_item(stream, item);
+	return ret;
+}
+
+// Translate the name of an enum value into its value, returns -1 if no filter
+// is requested and -2 if the name is invalid
+#define PARSE_ENUM_FILTER(name, first, max, str_func)({ \
+	int value = -1; \
+	if((name) != NULL) \
+	{ \
+		for(value = (first); value < (max); value++) \
+			if(strcasecmp(name, str_func) == 0) \
+				break; \
+		if(value >= (max)) \
+			value = -2; \
+	} \
+	value; \
+})
+
+// Translate the enum filters into their values, returns 0 on success or the
+// HTTP status code of the error sent
+static int parse_enum_filters(struct ftl_conn *api, const struct query_filter *filter,
+                              int *type, int *status, int *reply, int *dnssec)
+{
+	char buffer[20] = { 0 };
+	*type = PARSE_ENUM_FILTER(filter->type, TYPE_A, TYPE_MAX, get_query_type_str(value, NULL, buffer));
+	if(*type == -2)
+		return send_json_error(api, 400, "bad_request", "Requested type is invalid", filter->type);
+	*status = PARSE_ENUM_FILTER(filter->status, QUERY_UNKNOWN, QUERY_STATUS_MAX, get_query_status_str(value));
+	if(*status == -2)
+		return send_json_error(api, 400, "bad_request", "Requested status is invalid", filter->status);
+	*reply = PARSE_ENUM_FILTER(filter->reply, REPLY_UNKNOWN, QUERY_REPLY_MAX, get_query_reply_str(value));
+	if(*reply == -2)
+		return send_json_error(api, 400, "bad_request", "Requested reply is invalid", filter->reply);
+	*dnssec = PARSE_ENUM_FILTER(filter->dnssec, DNSSEC_UNKNOWN, DNSSEC_MAX, get_query_dnssec_str(value));
+	if(*dnssec == -2)
+		return send_json_error(api, 400, "bad_request", "Requested dnssec is invalid", filter->dnssec);
+
+	return 0;
+}
+
+// Whether the queries in shared memory cover everything since the given
+// timestamp. Older queries may have been moved into the cold tier (see
+// misc.hotQueries), they can only be listed from the database
+static bool shm_covers(const double from)
+{
+	lock_shm_read();
+	bool covers = counters->cold_records == 0;
+	if(!covers && counters->queries > 0)
+	{
+		const queriesData *query = getQuery(0, true);
+		covers = query != NULL && from >= get_query_timestamp(query);
+	}
+	unlock_shm_read();
+
+	return covers;
+}
+
+/**
+ * Alternative execution path of /api/queries filtering directly over the
+ * queries in shared memory instead of querying the in-memory database. This
+ * avoids the JOINs and LIKE scans in SQL as the string filters are evaluated
+ * only once per domain, client and upstream. The result is the same as the
+ * default (newest first) sorting of the database path and queries become
+ * visible once they have got a database ID (the cursor is a database ID).
+ */
+static int api_queries_shm(struct ftl_conn *api, const struct query_filter *filter,
+                           const int length, const unsigned int start, const int draw,
+                           const unsigned long mem_dbnum)
+{
+	int type = -1, status = -1, reply = -1, dnssec = -1;
+	const int ret = parse_enum_filters(api, filter, &type, &status, &reply, &dnssec);
+	if(ret != 0)
+		return ret;
+
+	// We only need to count all matching queries when filtering, otherwise
+	// the number of queries in the database is used
+	const bool filtering = query_filter_active(filter) ||
+	                       cJSON_GetArraySize(config.webserver.api.excludeDomains.v.json) > 0 ||
+	                       cJSON_GetArraySize(config.webserver.api.excludeClients.v.json) > 0;
+
+	struct json_stream stream;
+	if(!json_stream_start(&stream, api, "queries"))
+		return send_json_error(api, 500, "internal_error",
+		                       "Internal server error, failed to allocate stream buffer",
+		                       NULL);
+
+	// Nothing may be sent while holding the lock as a slow client would
+	// otherwise block DNS resolution
+	json_stream_hold(&stream, true);
+	lock_shm_read();
+
+	bool *domain_ok = NULL, *client_ok = NULL, *upstream_ok = NULL;
+	unsigned int added = 0, recordsCounted = 0;
+	// With keyset pagination, queries are only added after the last query
+	// of the previous page has been passed
+	bool passed_last = filter->last_id == 0;
+	if(compute_id_sets(filter, &domain_ok, &client_ok, &upstream_ok))
+	{
+		// Walk from the most recent query backwards
+		for(unsigned int queryID = counters->queries; queryID-- > 0;)
+		{
+			const queriesData *query = getQuery(queryID, true);
+			if(query == NULL ||
+			   !query_matches(filter, query, domain_ok, client_ok, upstream_ok,
+			                  type, status, reply, dnssec))
+				continue;
+
+			recordsCounted++;
+
+			// Skip all results BEFORE start (server-side pagination)
+			if(recordsCounted <= start)
+				continue;
+
+			// Skip all results up to the last query of the previous page
+			if(!passed_last)
+			{
+				passed_last = (unsigned long)get_query_dbid(query) == filter->last_id;
+				continue;
+			}
+
+			// Length may be set to -1 to indicate we want everything
+			if(length < 0 || added < (unsigned int)length)
+			{
+				if(add_shm_query(api, &stream, query) != 0)
+					break;
+				added++;
+			}
+			else if(!filtering)
+				break;
+		}
+	}
+	else
+		log_err("Cannot filter queries: %s", strerror(ENOMEM));
+
+	unlock_shm_read();
+	json_stream_hold(&stream, false);
+
+	if(domain_ok != NULL)
+		free(domain_ok);
+	if(client_ok != NULL)
+		free(client_ok);
+	if(upstream_ok != NULL)
+		free(upstream_ok);
+
+	log_debug(DEBUG_API, "Sending %u of %lu in memory queries from shared memory (counted %u)",
+	          added, mem_dbnum, recordsCounted);
+
+	cJSON *json = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(json, "cursor", filter->cursor);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "recordsTotal", mem_dbnum);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "recordsFiltered", filtering ? recordsCounted : mem_dbnum);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "draw", draw);
+
+	return json_stream_end(&stream, json);
+}
+
 int api_queries(struct ftl_conn *api)
 {
 	// Exit before processing any data if requested via config setting
@@ -281,9 +697,12 @@ int api_queries(struct ftl_conn *api)
 	if(api->request->query_string != NULL)
 		get_bool_var(api->request->query_string, "disk", &disk);
 
-	// Start building database query string
+	// Start building database query string. Queries evicted from the
+	// in-memory database are read from disk transparently
 	char querystr[QUERYSTRBUFFERLEN] = { 0 };
-	snprintf(querystr, QUERYSTRBUFFERLEN, "%s FROM %s q %s", QUERYSTR, disk ? "disk.query_storage" : "query_storage", JOINSTR);
+	char source[256];
+	snprintf(querystr, QUERYSTRBUFFERLEN, "%s FROM %s q %s", QUERYSTR,
+	         disk ? "disk.query_storage" : get_memdb_query_source(source, sizeof(source)), JOINSTR);
 	int draw = 0;
 
 	char domainname[512] = { 0 };
@@ -316,21 +735,25 @@ int api_queries(struct ftl_conn *api)
 	// performance reasons.
 	bool filtering = false;
 
+	// Filters as applied by the shared memory path
+	struct query_filter filter = { 0 };
+
 	// Filter-/sorting based on GET parameters?
 	if(api->request->query_string != NULL)
 	{
 		// Time filtering FROM (inclusive)
-		if(get_double_var(api->request->query_string, "from", &timestamp_from))
+		if((filter.from_set = get_double_var(api->request->query_string, "from", &timestamp_from)))
 			add_querystr_string(api, querystr, "timestamp>=", ":tsfrom", &where);
 
 		// Time filtering UNTIL (exclusive)
-		if(get_double_var(api->request->query_string, "until", &timestamp_until))
+		if((filter.until_set = get_double_var(api->request->query_string, "until", &timestamp_until)))
 			add_querystr_string(api, querystr, "timestamp<", ":tsuntil", &where);
 
 		// Domain filtering?
 		if(GET_STR("domain", domainname, api->request->query_string) > 0)
 		{
-			if(is_wildcard(domainname))
+			filter.domain = domainname;
+			if((filter.domain_like = is_wildcard(domainname)))
 				add_querystr_string(api, querystr, "d.domain LIKE", ":domain", &where);
 			else
 				add_querystr_string(api, querystr, "d.domain=", ":domain", &where);
@@ -343,23 +766,27 @@ int api_queries(struct ftl_conn *api)
 			{
 				// Pseudo-upstream for blocked queries
 				add_querystr_string(api, querystr, "q.status IN ", get_blocked_statuslist(), &where);
+				filter.upstream_status = UPSTREAM_BLOCKLIST;
 				filtering = true;
 			}
 			else if(strcmp(upstreamname, "cache") == 0)
 			{
 				// Pseudo-upstream for cached queries
 				add_querystr_string(api, querystr, "q.status IN ", get_cached_statuslist(), &where);
+				filter.upstream_status = UPSTREAM_CACHE;
 				filtering = true;
 			}
 			else if(strcmp(upstreamname, "permitted") == 0)
 			{
 				// Pseudo-upstream for permitted queries
 				add_querystr_string(api, querystr, "q.status IN ", get_permitted_statuslist(), &where);
+				filter.upstream_status = UPSTREAM_PERMITTED;
 				filtering = true;
 			}
 			else
 			{
-				if(is_wildcard(upstreamname))
+				filter.upstream = upstreamname;
+				if((filter.upstream_like = is_wildcard(upstreamname)))
 					add_querystr_string(api, querystr, "f.forward LIKE", ":upstream", &where);
 				else
 					add_querystr_string(api, querystr, "f.forward=", ":upstream", &where);
@@ -369,7 +796,8 @@ int api_queries(struct ftl_conn *api)
 		// Client IP filtering?
 		if(GET_STR("client_ip", clientip, api->request->query_string) > 0)
 		{
-			if(is_wildcard(clientip))
+			filter.client_ip = clientip;
+			if((filter.client_ip_like = is_wildcard(clientip)))
 				add_querystr_string(api, querystr, "c.ip LIKE", ":cip", &where);
 			else
 				add_querystr_string(api, querystr, "c.ip=", ":cip", &where);
@@ -378,7 +806,8 @@ int api_queries(struct ftl_conn *api)
 		// Client filtering?
 		if(GET_STR("client_name", clientname, api->request->query_string) > 0)
 		{
-			if(is_wildcard(clientname))
+			filter.client_name = clientname;
+			if((filter.client_name_like = is_wildcard(clientname)))
 				add_querystr_string(api, querystr, "c.name LIKE", ":cname", &where);
 			else
 				add_querystr_string(api, querystr, "c.name=", ":cname", &where);
@@ -411,6 +840,7 @@ int api_queries(struct ftl_conn *api)
 			{
 				cursor = unum;
 				cursor_set = true;
+				filter.cursor_set = true;
 				add_querystr_string(api, querystr, "q.id<=", ":cursor", &where);
 			}
 			else
@@ -426,21 +856,51 @@ int api_queries(struct ftl_conn *api)
 			}
 		}
 
+		// Keyset pagination: Continue after the last query of the
+		// previous page instead of skipping start queries
+		unum = 0u;
+		msg = NULL;
+		if(get_uint64_var_msg(api->request->query_string, "last_id", &unum, &msg) && unum > 0)
+		{
+			filter.last_id = unum;
+			start = 0;
+			add_querystr_string(api, querystr, "q.id<", ":last_id", &where);
+		}
+		else if(msg != NULL)
+		{
+			return send_json_error(api, 400,
+			                       "bad_request",
+			                       "Requested last_id is invalid",
+			                       msg);
+		}
+
 		// Query type filtering?
 		if(GET_STR("type", typename, api->request->query_string) > 0)
+		{
+			filter.type = typename;
 			add_querystr_string(api, querystr, "q.type=", ":type", &where);
+		}
 
 		// Query status filtering?
 		if(GET_STR("status", statusname, api->request->query_string) > 0)
+		{
+			filter.status = statusname;
 			add_querystr_string(api, querystr, "q.status=", ":status", &where);
+		}
 
 		// Reply type filtering?
 		if(GET_STR("reply", replyname, api->request->query_string) > 0)
+		{
+			filter.reply = replyname;
 			add_querystr_string(api, querystr, "q.reply_type=", ":reply_type", &where);
+		}
 
 		// DNSSEC status filtering?
 		if(GET_STR("dnssec", dnssecname, api->request->query_string) > 0)
+		{
+			filter.dnssec = dnssecname;
 			add_querystr_string(api, querystr, "q.dnssec=", ":dnssec", &where);
+		}
 
 		// Sorting?
 		int sort_column = -1;
@@ -513,11 +973,13 @@ int api_queries(struct ftl_conn *api)
 					if(j == 0 && strcasecmp(search_col_id_str, "domain") == 0)
 					{
 						log_debug(DEBUG_API, "Searching column domain: \"%s\"", search[j]);
+						filter.domain_search = search[j];
 						add_querystr_string(api, querystr, "d.domain LIKE", ":domain_search", &where);
 					}
 					else if(j == 1 && (strcasecmp(search_col_id_str, "client.ip") == 0 || strcasecmp(search_col_id_str, "client") == 0))
 					{
 						log_debug(DEBUG_API, "Searching column client: \"%s\"", search[j]);
+						filter.client_search = search[j];
 						// We search both client IP and name
 						add_querystr_string(api, querystr, "c.ip LIKE :client_search OR c.name LIKE", ":client_search", &where);
 					}
@@ -531,6 +993,19 @@ int api_queries(struct ftl_conn *api)
 		}
 	}
 
+	// Filter directly over the queries in shared memory unless the on-disk
+	// database, a sort order other than the default one, or queries no
+	// longer kept in shared memory have been requested
+	if(!disk && (sort_col[0] == '\0' ||
+	             (strcasecmp(sort_col, "time") == 0 && strncasecmp(sort_dir, "desc", 4) == 0)) &&
+	   shm_covers(timestamp_from))
+	{
+		filter.from = timestamp_from;
+		filter.until = timestamp_until;
+		filter.cursor = cursor;
+		return api_queries_shm(api, &filter, length, start, draw, mem_dbnum);
+	}
+
 	// Regex filtering?
 	regex_t *regex_domains = NULL;
 	unsigned int N_regex_domains = 0;
@@ -549,8 +1024,18 @@ int api_queries(struct ftl_conn *api)
 	// Finish preparing query string
 	querystr_finish(querystr, sort_col, sort_dir);
 
-	// Get connection to in-memory database
-	sqlite3 *memdb = get_memdb();
+	// Without filters, the matching rows need not be counted and SQLite can
+	// stop after the requested page. Together with last_id, deep pages cost
+	// the same as the first one
+	if(!filtering && !query_filter_active(&filter) && length > 0)
+	{
+		const size_t strpos = strlen(querystr);
+		snprintf(querystr + strpos, QUERYSTRBUFFERLEN - strpos, " LIMIT %d OFFSET %u", length, start);
+		start = 0;
+	}
+
+	// Get this thread's connection to the in-memory database
+	sqlite3 *memdb = get_memdb_reader();
 	if(memdb == NULL)
 	{
 		return send_json_error(api, 500, // 500 Internal error
@@ -792,6 +1277,22 @@ int api_queries(struct ftl_conn *api)
 				                       dnssecname);
 			}
 		}
+		idx = sqlite3_bind_parameter_index(read_stmt, ":last_id");
+		if(idx > 0)
+		{
+			log_debug(DEBUG_API, "adding :last_id = %lu to query", filter.last_id);
+			// Do not set filtering as the last ID is not a filter
+			rc = sqlite3_bind_int64(read_stmt, idx, filter.last_id);
+			if(rc != SQLITE_OK)
+			{
+				sqlite3_reset(read_stmt);
+				sqlite3_finalize(read_stmt);
+				return send_json_error(api, 500,
+				                       "internal_error",
+				                       "Internal server error, failed to bind last_id to SQL query",
+				                       sqlite3_errstr(rc));
+			}
+		}
 		idx = sqlite3_bind_parameter_index(read_stmt, ":cursor");
 		if(idx > 0)
 		{
@@ -844,7 +1345,19 @@ int api_queries(struct ftl_conn *api)
 	log_debug(DEBUG_API, "SQL: %s", querystr);
 	log_debug(DEBUG_API, "  with cursor: %lu, start: %u, length: %d", cursor, start, length);
 
-	cJSON *queries = JSON_NEW_ARRAY();
+	// Stream the queries to the client while iterating over the rows, this
+	// keeps memory usage constant even for very large exports
+	struct json_stream stream;
+	if(!json_stream_start(&stream, api, "queries"))
+	{
+		sqlite3_reset(read_stmt);
+		sqlite3_finalize(read_stmt);
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Internal server error, failed to allocate stream buffer",
+		                       NULL);
+	}
+
 	unsigned int added = 0, recordsCounted = 0, regex_skipped = 0;
 	bool skipTheRest = false;
 	while((rc = sqlite3_step(read_stmt)) == SQLITE_ROW)
@@ -1057,14 +1570,13 @@ int api_queries(struct ftl_conn *api)
 		else
 			JSON_ADD_NULL_TO_OBJECT(item, "cname");
 
-		JSON_ADD_ITEM_TO_ARRAY(queries, item);
+		json_stream_add_item(&stream, item);
 
 		added++;
 	}
 	log_debug(DEBUG_API, "Sending %u of %lu in memory and %lu on disk queries (counted %u, skipped %u)",
 	          added, mem_dbnum, disk_dbnum, recordsCounted, regex_skipped);
 	cJSON *json = JSON_NEW_OBJECT();
-	JSON_ADD_ITEM_TO_OBJECT(json, "queries", queries);
 
 	if(cursor_set)
 	{
@@ -1111,7 +1623,226 @@ int api_queries(struct ftl_conn *api)
 		free(regex_clients);
 	}
 
-	JSON_SEND_OBJECT(json);
+	return json_stream_end(&stream, json);
+}
+
+// Evaluate the string filters for a single query. This is used where only a
+// few queries are checked so computing the results for all domains, clients
+// and upstreams up front (see compute_id_sets()) does not pay off
+static bool query_strings_match(const struct query_filter *filter, const queriesData *query)
+{
+	if(!domain_matches(filter, getDomainString(query)) ||
+	   !client_matches(filter, getClientIPString(query), getClientNameString(query)))
+		return false;
+
+	if(filter->upstream == NULL)
+		return true;
+
+	const upstreamsData *upstream = query->upstreamID > -1 ? getUpstream(query->upstreamID, true) : NULL;
+	if(upstream == NULL)
+		return false;
+
+	char buffer[INET6_ADDRSTRLEN + 8];
+	get_upstream_string(upstream, buffer, sizeof(buffer));
+	return str_filter(filter->upstream, filter->upstream_like, buffer);
+}
+
+// Maximum number of queries sent at once, older queries of larger bursts are
+// skipped
+#define QUERY_STREAM_MAX_BATCH 1000u
+// Send a comment line after this many seconds without new queries so proxies
+// keep the connection open and disconnected clients are detected
+#define QUERY_STREAM_KEEPALIVE 15u
+
+static unsigned int active_streams = 0;
+
+/**
+ * Live query log: Send newly stored queries as Server-Sent Events. The stream
+ * waits for queries_to_database() to store new queries, so open streams cost
+ * nothing while there is no traffic. Each event carries a query in the same
+ * format as /api/queries, filters are applied on the server. The database ID
+ * of the last event of every batch is sent as event ID so reconnecting
+ * clients (Last-Event-ID header) continue where they left off.
+ */
+int api_queries_stream(struct ftl_conn *api)
+{
+	// Exit before processing any data if requested via config setting
+	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_MAXIMUM)
+		return send_json_error(api, 403,
+		                       "forbidden",
+		                       "Queries are not recorded at the current privacy level",
+		                       NULL);
+
+	char domainname[512] = { 0 };
+	char clientip[512] = { 0 };
+	char clientname[512] = { 0 };
+	char upstreamname[256] = { 0 };
+	char typename[32] = { 0 };
+	char statusname[32] = { 0 };
+	char replyname[32] = { 0 };
+	char dnssecname[32] = { 0 };
+
+	// Every query stored from now on passes the cursor check in
+	// query_matches()
+	struct query_filter filter = { 0 };
+	filter.cursor = ULONG_MAX;
+
+	if(api->request->query_string != NULL)
+	{
+		if(GET_STR("domain", domainname, api->request->query_string) > 0)
+		{
+			filter.domain = domainname;
+			filter.domain_like = is_wildcard(domainname);
+		}
+
+		if(GET_STR("upstream", upstreamname, api->request->query_string) > 0)
+		{
+			if(strcmp(upstreamname, "blocklist") == 0)
+				filter.upstream_status = UPSTREAM_BLOCKLIST;
+			else if(strcmp(upstreamname, "cache") == 0)
+				filter.upstream_status = UPSTREAM_CACHE;
+			else if(strcmp(upstreamname, "permitted") == 0)
+				filter.upstream_status = UPSTREAM_PERMITTED;
+			else
+			{
+				filter.upstream = upstreamname;
+				filter.upstream_like = is_wildcard(upstreamname);
+			}
+		}
+
+		if(GET_STR("client_ip", clientip, api->request->query_string) > 0)
+		{
+			filter.client_ip = clientip;
+			filter.client_ip_like = is_wildcard(clientip);
+		}
+
+		if(GET_STR("client_name", clientname, api->request->query_string) > 0)
+		{
+			filter.client_name = clientname;
+			filter.client_name_like = is_wildcard(clientname);
+		}
+
+		if(GET_STR("type", typename, api->request->query_string) > 0)
+			filter.type = typename;
+		if(GET_STR("status", statusname, api->request->query_string) > 0)
+			filter.status = statusname;
+		if(GET_STR("reply", replyname, api->request->query_string) > 0)
+			filter.reply = replyname;
+		if(GET_STR("dnssec", dnssecname, api->request->query_string) > 0)
+			filter.dnssec = dnssecname;
+	}
+
+	int type = -1, status = -1, reply = -1, dnssec = -1;
+	const int ret = parse_enum_filters(api, &filter, &type, &status, &reply, &dnssec);
+	if(ret != 0)
+		return ret;
+
+	// Start with the queries stored from now on unless the client resumes
+	// a previous stream
+	unsigned long cursor = 0, mem_dbnum = 0, disk_dbnum = 0;
+	db_counts(&cursor, &mem_dbnum, &disk_dbnum);
+	const char *last_event_id = mg_get_header(api->conn, "Last-Event-ID");
+	unsigned long resume = 0;
+	if(last_event_id != NULL && sscanf(last_event_id, "%lu", &resume) == 1 && resume < cursor)
+		cursor = resume;
+
+	// Each stream occupies a webserver thread for its whole lifetime, make
+	// sure most of them remain available for other requests
+	if(__atomic_add_fetch(&active_streams, 1, __ATOMIC_SEQ_CST) > max(1u, get_webserver_threads() / 4))
+	{
+		__atomic_sub_fetch(&active_streams, 1, __ATOMIC_SEQ_CST);
+		return send_json_error(api, 503,
+		                       "too_many_streams",
+		                       "Too many open query streams",
+		                       NULL);
+	}
+
+	log_debug(DEBUG_API, "Opened query stream after database ID %lu", cursor);
+	mg_send_http_ok(api->conn, "text/event-stream", -1);
+
+	// Let browsers reconnect quickly when the connection is lost
+	bool failed = mg_send_chunk(api->conn, "retry: 2000\n\n", 13) < 0;
+	unsigned int idle = 0;
+	cJSON *items[QUERY_STREAM_MAX_BATCH];
+	while(!failed && !killed)
+	{
+		// Wake up once per second to notice when FTL is shutting down
+		if(!wait_for_stored_queries(cursor, 1000))
+		{
+			if(++idle >= QUERY_STREAM_KEEPALIVE)
+			{
+				idle = 0;
+				failed = mg_send_chunk(api->conn, ":\n\n", 3) < 0;
+			}
+			continue;
+		}
+		idle = 0;
+
+		// Collect the new queries. They are stored in batches from the
+		// newest to the oldest query, so all queries older than the
+		// first one known to the client are known as well
+		unsigned int num = 0;
+		unsigned long newest = cursor;
+		lock_shm_read();
+		for(unsigned int queryID = counters->queries; queryID-- > 0;)
+		{
+			const queriesData *query = getQuery(queryID, true);
+			if(query == NULL)
+				continue;
+
+			const int64_t dbid = get_query_dbid(query);
+			if(dbid < 1)
+				continue;
+			if((unsigned long)dbid <= cursor)
+				break;
+			if((unsigned long)dbid > newest)
+				newest = dbid;
+
+			if(num >= QUERY_STREAM_MAX_BATCH ||
+			   !query_matches(&filter, query, NULL, NULL, NULL, type, status, reply, dnssec) ||
+			   !query_strings_match(&filter, query))
+				continue;
+
+			if(build_shm_query(api, query, &items[num]) != 0)
+			{
+				failed = true;
+				break;
+			}
+			num++;
+		}
+		unlock_shm_read();
+		cursor = newest;
+
+		// Send events in chronological order, the last one carries the
+		// cursor as event ID
+		for(unsigned int i = num; i-- > 0;)
+		{
+			char *json = failed ? NULL : cJSON_PrintUnformatted(items[i]);
+			cJSON_Delete(items[i]);
+			if(json == NULL)
+				continue;
+
+			char *event = NULL;
+			const int len = i == 0 ?
+			                asprintf(&event, "id: %lu\ndata: %s\n\n", cursor, json) :
+			                asprintf(&event, "data: %s\n\n", json);
+			free(json);
+			if(len < 0)
+				continue;
+
+			failed = mg_send_chunk(api->conn, event, len) < 0;
+			free(event);
+		}
+	}
+
+	__atomic_sub_fetch(&active_streams, 1, __ATOMIC_SEQ_CST);
+	log_debug(DEBUG_API, "Closed query stream at database ID %lu", cursor);
+
+	// Terminate the chunked response (if the client is still there)
+	if(!failed)
+		mg_send_chunk(api->conn, "", 0);
+
+	return 200;
 }
 
 bool compile_filter_regex(struct ftl_conn *api, const char *path, cJSON *json, regex_t **regex, unsigned int *N_regex)
@@ -37,7 +37,7 @@ static int search_table(struct ftl_conn *api, const char *item,
 
 	// Check domain against lists table
 	const char *sql_msg = NULL;
-	if(!gravityDB_readTable(listtype, item, &sql_msg, !partial, ids))
+	if(!gravityDB_readTable(listtype, item, &sql_msg, !partial, ids, NULL))
 	{
 		return send_json_error(api, 400, // 400 Bad Request
 		                       "database_error",
@@ -24,13 +24,16 @@
 #include "regex_r.h"
 // sqrt()
 #include <math.h>
+// get_top_list()
+#include "top-lists.h"
+// client_sketch_top()
+#include "client-sketch.h"
 
 struct top_entries {
 	int count;
 	unsigned int responses;
 	in_port_t port;
-	size_t namepos;
-	size_t ippos;
+	unsigned int id;
 	double rtime;
 	double rtuncertainty;
 
@@ -85,49 +88,32 @@ static int get_query_types_obj(struct ftl_conn *api, cJSON *types)
 		// We add the collective OTHER type at the end
 		if(i == TYPE_OTHER)
 			continue;
-		JSON_ADD_NUMBER_TO_OBJECT(types, get_query_type_str(i, NULL, NULL), counters->querytype[i]);
+		JSON_ADD_NUMBER_TO_OBJECT(types, get_query_type_str(i, NULL, NULL), get_querytype_count(i));
 	}
-	JSON_ADD_NUMBER_TO_OBJECT(types, "OTHER", counters->querytype[TYPE_OTHER]);
+	JSON_ADD_NUMBER_TO_OBJECT(types, "OTHER", get_querytype_count(TYPE_OTHER));
 
 	return 0;
 }
 
-// shmem needs to be locked while calling this function
-unsigned int get_active_clients(void)
-{
-	unsigned int activeclients = 0;
-	for(unsigned int clientID=0; clientID < counters->clients; clientID++)
-	{
-		// Get client pointer
-		const clientsData *client = getClient(clientID, true);
-		if(client == NULL)
-			continue;
-
-		if(client->count > 0)
-			activeclients++;
-	}
-
-	return activeclients;
-}
-
 int api_stats_summary(struct ftl_conn *api)
 {
-	// Lock shared memory
-	lock_shm();
+	if(api_cluster_view(api))
+		return api_stats_summary_cluster(api);
 
+	// All values below are plain counters maintained incrementally by the
+	// writers, so there is no need to lock the shared memory here. The
+	// values may be from slightly different points in time but each of
+	// them is consistent on its own
 	const int blocked = get_blocked_count();
 	const int forwarded = get_forwarded_count();
 	const int cached = get_cached_count();
-	const int total = counters->queries;
-	const int num_gravity = counters->database.gravity;
-	const int num_clients = counters->clients;
-	const int num_domains = counters->domains;
+	const int total = get_total_queries();
+	const int num_gravity = __atomic_load_n(&counters->database.gravity, __ATOMIC_RELAXED);
+	const int num_clients = __atomic_load_n(&counters->clients, __ATOMIC_RELAXED);
+	const int num_domains = __atomic_load_n(&counters->domains, __ATOMIC_RELAXED);
 
 	// Count clients that have been active within the most recent 24 hours
-	unsigned int activeclients = get_active_clients();
-
-	// Unlock shared memory
-	unlock_shm();
+	const unsigned int activeclients = get_active_clients();
 
 	// Calculate percentage of blocked queries
 	float percent_blocked = 0.0f;
@@ -153,12 +139,12 @@ int api_stats_summary(struct ftl_conn *api)
 
 	cJSON *statuses = JSON_NEW_OBJECT();
 	for(enum query_status status = 0; status < QUERY_STATUS_MAX; status++)
-		JSON_ADD_NUMBER_TO_OBJECT(statuses, get_query_status_str(status), counters->status[status]);
+		JSON_ADD_NUMBER_TO_OBJECT(statuses, get_query_status_str(status), get_status_count(status));
 	JSON_ADD_ITEM_TO_OBJECT(queries, "status", statuses);
 
 	cJSON *replies = JSON_NEW_OBJECT();
 	for(enum reply_type reply = 0; reply <QUERY_REPLY_MAX; reply++)
-		JSON_ADD_NUMBER_TO_OBJECT(replies, get_query_reply_str(reply), counters->reply[reply]);
+		JSON_ADD_NUMBER_TO_OBJECT(replies, get_query_reply_str(reply), get_reply_count(reply));
 	JSON_ADD_ITEM_TO_OBJECT(queries, "replies", replies);
 
 	cJSON *clients = JSON_NEW_OBJECT();
@@ -176,44 +162,59 @@ int api_stats_summary(struct ftl_conn *api)
 	JSON_SEND_OBJECT(json);
 }
 
-cJSON *get_top_domains(struct ftl_conn *api, const int count,
-                       const bool blocked, const bool domains_only)
+// Where the candidates of a top list are taken from. Requests are answered
+// from the incrementally maintained top lists (see top-lists.c) whenever they
+// contain enough exact entries. Otherwise, the list is rebuilt and, as a last
+// resort, all domains or clients are scanned
+enum top_source {
+	TOP_FROM_LIST,
+	TOP_FROM_REBUILT_LIST,
+	TOP_FROM_SCAN
+};
+
+// Get the candidates of a top list, sorted by decreasing count. Returns NULL
+// if memory allocation failed
+static struct top_entries *get_top_list_candidates(const enum top_list_type type, const enum top_source source,
+                                                   unsigned int *num, bool *complete)
 {
-	// Exit before processing any data if requested via config setting
-	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_HIDE_DOMAINS)
+	if(source == TOP_FROM_REBUILT_LIST)
 	{
-		log_debug(DEBUG_API, "Not returning top domains: Privacy level is set to %i",
-		          config.misc.privacylevel.v.privacy_level);
+		// Rebuilding modifies the list, this needs the exclusive lock
+		lock_shm();
+		rebuild_top_list(type);
+		unlock_shm();
+	}
 
-		// Minimum structure is
-		// {"top_domains":[]}
-		if(domains_only)
-			return cJSON_CreateArray();
+	struct top_list_entry list[TOP_LIST_SIZE];
+	lock_shm_read();
+	*num = get_top_list(type, list, complete);
+	unlock_shm_read();
 
-		cJSON *json = cJSON_CreateObject();
-		cJSON_AddItemToObject(json, "domains", cJSON_CreateArray());
-		cJSON_AddNumberToObject(json, "total_queries", -1);
-		cJSON_AddNumberToObject(json, "blocked_queries", -1);
-		return json;
+	struct top_entries *entries = calloc(*num > 0 ? *num : 1, sizeof(struct top_entries));
+	if(entries == NULL)
+		return NULL;
+
+	for(unsigned int i = 0; i < *num; i++)
+	{
+		entries[i].id = list[i].id;
+		entries[i].count = list[i].count;
 	}
 
-	// Get domains which the user doesn't want to see
-	regex_t *regex_domains = NULL;
-	unsigned int N_regex_domains = 0;
-	compile_filter_regex(api, "webserver.api.excludeDomains",
-	                     config.webserver.api.excludeDomains.v.json,
-	                     &regex_domains, &N_regex_domains);
+	return entries;
+}
 
+// Get all domains sorted by decreasing count. Returns NULL if memory
+// allocation failed
+static struct top_entries *scan_top_domains(const bool blocked, unsigned int *num)
+{
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
 	const unsigned int domains = counters->domains;
-	const unsigned int total_queries = counters->queries;
-	const unsigned int blocked_count = get_blocked_count();
-	struct top_entries *top_domains = calloc(domains, sizeof(struct top_entries));
+	struct top_entries *top_domains = calloc(domains > 0 ? domains : 1, sizeof(struct top_entries));
 	if(top_domains == NULL)
 	{
-		log_err("Memory allocation failed in %s()", __FUNCTION__);
+		unlock_shm_read();
 		return NULL;
 	}
 
@@ -225,96 +226,140 @@ cJSON *get_top_domains(struct ftl_conn *api, const int count,
 		if(domain == NULL)
 			continue;
 
-		const char *domain_name = getstr(domain->domainpos);
-
-		// Hidden domain, probably due to privacy level. Skip this in the top lists
-		if(strcmp(domain_name, HIDDEN_DOMAIN) == 0)
-			continue;
-
 		// Use either blocked or total count based on request string
 		top_domains[added_domains].count = blocked ? domain->blockedcount : domain->count - domain->blockedcount;
 
-		// Get domain name
-		top_domains[added_domains].namepos = domain->domainpos;
+		// Remember the domain, its name is looked up again below as
+		// strings may move while we do not hold the lock
+		top_domains[added_domains].id = domainID;
 
 		// Increment counter
 		added_domains++;
 	}
 
 	// Unlock shared memory
-	unlock_shm();
+	unlock_shm_read();
 
 	// Sort temporary array
 	qsort(top_domains, added_domains, sizeof(*top_domains), cmpdesc_te);
 
-	int n = 0;
-	cJSON *jtop_domains = cJSON_CreateArray();
+	*num = added_domains;
+	return top_domains;
+}
+
+cJSON *get_top_domains(struct ftl_conn *api, const int count,
+                       const bool blocked, const bool domains_only)
+{
+	// Exit before processing any data if requested via config setting
+	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_HIDE_DOMAINS)
+	{
+		log_debug(DEBUG_API, "Not returning top domains: Privacy level is set to %i",
+		          config.misc.privacylevel.v.privacy_level);
+
+		// Minimum structure is
+		// {"top_domains":[]}
+		if(domains_only)
+			return cJSON_CreateArray();
+
+		cJSON *json = cJSON_CreateObject();
+		cJSON_AddItemToObject(json, "domains", cJSON_CreateArray());
+		cJSON_AddNumberToObject(json, "total_queries", -1);
+		cJSON_AddNumberToObject(json, "blocked_queries", -1);
+		return json;
+	}
 
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
+	const unsigned int total_queries = get_total_queries();
+	const unsigned int blocked_count = get_blocked_count();
+	unlock_shm_read();
 
-	for(unsigned int i = 0; i < added_domains; i++)
+	const enum top_list_type type = blocked ? TOP_DOMAINS_BLOCKED : TOP_DOMAINS_PERMITTED;
+	cJSON *jtop_domains = NULL;
+	for(enum top_source source = count <= (int)TOP_LIST_SIZE ? TOP_FROM_LIST : TOP_FROM_SCAN;
+	    source <= TOP_FROM_SCAN; source++)
 	{
-		// Skip e.g. recycled domains
-		if(top_domains[i].namepos == 0)
+		// Rebuilding needs the exclusive lock which cannot be
+		// obtained while the caller holds the shared one (e.g.
+		// within /api/batch)
+		if(source == TOP_FROM_REBUILT_LIST && holds_shm_read_lock())
 			continue;
 
-		const char *domain = getstr(top_domains[i].namepos);
-
-		// Skip this client if there is a filter on it
-		bool skip_domain = false;
-		if(N_regex_domains > 0)
+		unsigned int added_domains = 0u;
+		bool complete = true;
+		struct top_entries *top_domains = source == TOP_FROM_SCAN ?
+			scan_top_domains(blocked, &added_domains) :
+			get_top_list_candidates(type, source, &added_domains, &complete);
+		if(top_domains == NULL)
 		{
-			// Iterate over all regex filters
-			for(unsigned int j = 0; j < N_regex_domains; j++)
-			{
-				// Check if the domain matches the regex
-				if(regexec(&regex_domains[j], domain, 0, NULL, 0) == 0)
-				{
-					// Domain matches
-					skip_domain = true;
-					break;
-				}
-			}
+			log_err("Memory allocation failed in %s()", __FUNCTION__);
+			cJSON_Delete(jtop_domains);
+			jtop_domains = NULL;
+			break;
 		}
 
-		if(skip_domain || top_domains[i].count < 1)
-			continue;
+		int n = 0;
+		cJSON_Delete(jtop_domains);
+		jtop_domains = cJSON_CreateArray();
 
-		if(domains_only)
-		{
-			cJSON_AddStringToArray(jtop_domains, domain);
-		}
-		else
+		// Lock shared memory
+		lock_shm_read();
+
+		for(unsigned int i = 0; i < added_domains; i++)
 		{
-			cJSON *domain_item = cJSON_CreateObject();
-			cJSON_AddStringToObject(domain_item, "domain", domain);
-			cJSON_AddNumberToObject(domain_item, "count", top_domains[i].count);
-			cJSON_AddItemToArray(jtop_domains, domain_item);
-		}
+			// Skip e.g. recycled domains
+			const domainsData *top_domain = getDomain(top_domains[i].id, true);
+			if(top_domain == NULL)
+				continue;
 
-		// Only count entries that are actually sent and return when we have send enough data
-		if(++n >= count)
-			break;
-	}
+			const char *domain = getDomainName(top_domain);
+			if(domain[0] == '\0')
+				continue;
 
-	// Unlock shared memory
-	unlock_shm();
+			// Hidden domain, probably due to privacy level. Skip this in the top lists
+			if(strcmp(domain, HIDDEN_DOMAIN) == 0)
+				continue;
 
-	// Free temporary array
-	free(top_domains);
+			// Skip this domain if there is a filter on it
+			// (webserver.api.excludeDomains)
+			if(top_domain->flags.excluded || top_domains[i].count < 1)
+				continue;
 
-	// Free regexes
-	if(N_regex_domains > 0)
-	{
-		// Free individual regexes
-		for(unsigned int i = 0; i < N_regex_domains; i++)
-			regfree(&regex_domains[i]);
+			if(domains_only)
+			{
+				cJSON_AddStringToArray(jtop_domains, domain);
+			}
+			else
+			{
+				cJSON *domain_item = cJSON_CreateObject();
+				cJSON_AddStringToObject(domain_item, "domain", domain);
+				cJSON_AddNumberToObject(domain_item, "count", top_domains[i].count);
+				cJSON_AddItemToArray(jtop_domains, domain_item);
+			}
+
+			// Only count entries that are actually sent and return when we have send enough data
+			if(++n >= count)
+				break;
+		}
+
+		// Unlock shared memory
+		unlock_shm_read();
+
+		// Free temporary array
+		free(top_domains);
+
+		// Done if we found enough domains or if there are no further
+		// domains beyond the candidates
+		if(n >= count || complete)
+			break;
 
-		// Free array of regex pointers
-		free(regex_domains);
+		log_debug(DEBUG_API, "Top list %d has too few exact entries (found %d of %d)",
+		          type, n, count);
 	}
 
+	if(jtop_domains == NULL)
+		return NULL;
+
 	if(domains_only)
 	{
 		// Return the array of domains only
@@ -329,10 +374,100 @@ cJSON *get_top_domains(struct ftl_conn *api, const int count,
 	return json;
 }
 
+// Top domains of a single client estimated from its sketches (see
+// client-sketch.c)
+static int get_client_top_domains(struct ftl_conn *api, const char *clientip,
+                                  const int count, const bool blocked)
+{
+	cJSON *json = cJSON_CreateObject();
+	cJSON *jtop_domains = JSON_NEW_ARRAY();
+	JSON_ADD_ITEM_TO_OBJECT(json, "domains", jtop_domains);
+
+	// Exit before processing any data if requested via config setting
+	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_HIDE_DOMAINS)
+	{
+		log_debug(DEBUG_API, "Not returning top domains: Privacy level is set to %i",
+		          config.misc.privacylevel.v.privacy_level);
+
+		JSON_ADD_NUMBER_TO_OBJECT(json, "total_queries", -1);
+		JSON_ADD_NUMBER_TO_OBJECT(json, "blocked_queries", -1);
+		JSON_ADD_NULL_TO_OBJECT(json, "error");
+		JSON_SEND_OBJECT(json);
+	}
+
+	// Lock shared memory
+	lock_shm_read();
+
+	const int clientID = findClientID(clientip, false, false, 0.0);
+	const clientsData *client = clientID < 0 ? NULL : getClient(clientID, true);
+	if(client == NULL)
+	{
+		unlock_shm_read();
+		cJSON_Delete(json);
+		return send_json_error(api, 404,
+		                       "not_found",
+		                       "Client not found",
+		                       clientip);
+	}
+
+	struct client_sketch_entry *entries = NULL;
+	uint32_t total = 0;
+	const unsigned int num = client_sketch_top(clientID, blocked ? CLIENT_SKETCH_BLOCKED : CLIENT_SKETCH_PERMITTED,
+	                                           &entries, &total);
+
+	int n = 0;
+	for(unsigned int i = 0; i < num && n < count; i++)
+	{
+		// Skip e.g. recycled domains
+		const domainsData *top_domain = getDomain(entries[i].domainID, true);
+		if(top_domain == NULL)
+			continue;
+
+		const char *domain = getDomainName(top_domain);
+		if(domain[0] == '\0')
+			continue;
+
+		// Skip hidden domains and domains with a filter on them
+		// (webserver.api.excludeDomains)
+		if(strcmp(domain, HIDDEN_DOMAIN) == 0 || top_domain->flags.excluded)
+			continue;
+
+		cJSON *domain_item = cJSON_CreateObject();
+		cJSON_AddStringToObject(domain_item, "domain", domain);
+		cJSON_AddNumberToObject(domain_item, "count", entries[i].count);
+		cJSON_AddItemToArray(jtop_domains, domain_item);
+		n++;
+	}
+
+	const int total_queries = client->count;
+	const int blocked_queries = client->blockedcount;
+
+	// Unlock shared memory
+	unlock_shm_read();
+
+	if(entries != NULL)
+		free(entries);
+
+	JSON_ADD_NUMBER_TO_OBJECT(json, "total_queries", total_queries);
+	JSON_ADD_NUMBER_TO_OBJECT(json, "blocked_queries", blocked_queries);
+
+	// Counts are estimates which may exceed the true count by up to
+	// max_overcount with probability of at least 1 - delta
+	const double epsilon = client_sketch_epsilon();
+	cJSON *error = JSON_NEW_OBJECT();
+	JSON_ADD_NUMBER_TO_OBJECT(error, "epsilon", epsilon);
+	JSON_ADD_NUMBER_TO_OBJECT(error, "delta", client_sketch_delta());
+	JSON_ADD_NUMBER_TO_OBJECT(error, "max_overcount", floor(epsilon * total));
+	JSON_ADD_ITEM_TO_OBJECT(json, "error", error);
+
+	JSON_SEND_OBJECT(json);
+}
+
 int api_stats_top_domains(struct ftl_conn *api)
 {
 	bool blocked = false; // Can be overwritten by query string
 	int count = 10;
+	char clientip[INET6_ADDRSTRLEN + 16] = { 0 };
 	// /api/stats/top_domains?blocked=true
 	if(api->request->query_string != NULL)
 	{
@@ -342,45 +477,35 @@ int api_stats_top_domains(struct ftl_conn *api)
 		// Does the user request a non-default number of replies?
 		// Note: We do not accept zero query requests here
 		get_int_var(api->request->query_string, "count", &count);
+
+		// Top domains of a single client?
+		GET_STR("client", clientip, api->request->query_string);
 	}
 
+	// Clients are only known to this node
+	if(clientip[0] != '\0')
+		return get_client_top_domains(api, clientip, count, blocked);
+
+	if(api_cluster_view(api))
+		return api_stats_top_cluster(api, false);
+
 	cJSON *json = get_top_domains(api, count, blocked, false);
 	JSON_SEND_OBJECT(json);
 }
 
-cJSON *get_top_clients(struct ftl_conn *api, const int count,
-                       const bool blocked, const bool clients_only,
-                       const bool names_only, const bool ip_if_no_name)
+// Get all clients sorted by decreasing count. Returns NULL if memory
+// allocation failed
+static struct top_entries *scan_top_clients(const bool blocked, unsigned int *num)
 {
-	// Exit before processing any data if requested via config setting
-	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_HIDE_DOMAINS_CLIENTS)
-	{
-		log_debug(DEBUG_API, "Not returning top clients: Privacy level is set to %i",
-		          config.misc.privacylevel.v.privacy_level);
-
-		// Minimum structure is
-		// {"top_clients":[]}
-		if(clients_only)
-			return cJSON_CreateArray();
-
-		cJSON *json = cJSON_CreateObject();
-		cJSON_AddItemToObject(json, "clients", cJSON_CreateArray());
-		cJSON_AddNumberToObject(json, "total_queries", -1);
-		cJSON_AddNumberToObject(json, "blocked_queries", -1);
-		return json;
-	}
-
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
 	const unsigned int clients = counters->clients;
-	const int total_queries = counters->queries;
-	const int blocked_count = get_blocked_count();
-	struct top_entries *top_clients = calloc(clients, sizeof(struct top_entries));
+	struct top_entries *top_clients = calloc(clients > 0 ? clients : 1, sizeof(struct top_entries));
 	if(top_clients == NULL)
 	{
-		log_err("Memory allocation failed in %s()", __FUNCTION__);
-		return 0;
+		unlock_shm_read();
+		return NULL;
 	}
 
 	unsigned int added_clients = 0;
@@ -397,27 +522,11 @@ cJSON *get_top_clients(struct ftl_conn *api, const int count,
 			continue;
 		}
 
-		// Skip recycled clients
-		if(client->ippos == 0)
-		{
-			log_debug(DEBUG_API, "Skipping client %u because it is recycled", clientID);
-			continue;
-		}
-
-		const char *client_ip = getstr(client->ippos);
-		// Hidden client, probably due to privacy level. Skip this in the top lists
-		if(strcmp(client_ip, HIDDEN_CLIENT) == 0)
-		{
-			log_debug(DEBUG_API, "Skipping client %u because it is hidden", clientID);
-			continue;
-		}
-
 		// Use either blocked or total count based on request string
 		top_clients[added_clients].count = blocked ? client->blockedcount : client->count;
 
-		// Get client name and IP
-		top_clients[added_clients].ippos = client->ippos;
-		top_clients[added_clients].namepos = client->namepos;
+		// Remember the client, see scan_top_domains()
+		top_clients[added_clients].id = clientID;
 
 		added_clients++;
 	}
@@ -425,106 +534,152 @@ cJSON *get_top_clients(struct ftl_conn *api, const int count,
 	log_debug(DEBUG_API, "Found %u clients", added_clients);
 
 	// Unlock shared memory
-	unlock_shm();
+	unlock_shm_read();
 
 	// Sort temporary array
 	qsort(top_clients, added_clients, sizeof(*top_clients), cmpdesc_te);
 
-	// Get clients which the user doesn't want to see
-	regex_t *regex_clients = NULL;
-	unsigned int N_regex_clients = 0;
-	compile_filter_regex(api, "webserver.api.excludeClients",
-	                     config.webserver.api.excludeClients.v.json,
-	                     &regex_clients, &N_regex_clients);
+	*num = added_clients;
+	return top_clients;
+}
 
-	int n = 0;
-	cJSON *jtop_clients = JSON_NEW_ARRAY();
+cJSON *get_top_clients(struct ftl_conn *api, const int count,
+                       const bool blocked, const bool clients_only,
+                       const bool names_only, const bool ip_if_no_name)
+{
+	// Exit before processing any data if requested via config setting
+	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_HIDE_DOMAINS_CLIENTS)
+	{
+		log_debug(DEBUG_API, "Not returning top clients: Privacy level is set to %i",
+		          config.misc.privacylevel.v.privacy_level);
+
+		// Minimum structure is
+		// {"top_clients":[]}
+		if(clients_only)
+			return cJSON_CreateArray();
+
+		cJSON *json = cJSON_CreateObject();
+		cJSON_AddItemToObject(json, "clients", cJSON_CreateArray());
+		cJSON_AddNumberToObject(json, "total_queries", -1);
+		cJSON_AddNumberToObject(json, "blocked_queries", -1);
+		return json;
+	}
 
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
+	const int total_queries = get_total_queries();
+	const int blocked_count = get_blocked_count();
+	unlock_shm_read();
 
-	for(unsigned int i = 0; i < added_clients; i++)
+	const enum top_list_type type = blocked ? TOP_CLIENTS_BLOCKED : TOP_CLIENTS_TOTAL;
+	cJSON *jtop_clients = NULL;
+	for(enum top_source source = count <= (int)TOP_LIST_SIZE ? TOP_FROM_LIST : TOP_FROM_SCAN;
+	    source <= TOP_FROM_SCAN; source++)
 	{
-		const char *client_ip = getstr(top_clients[i].ippos);
-		const char *client_name = getstr(top_clients[i].namepos);
+		// Rebuilding needs the exclusive lock which cannot be
+		// obtained while the caller holds the shared one (e.g.
+		// within /api/batch)
+		if(source == TOP_FROM_REBUILT_LIST && holds_shm_read_lock())
+			continue;
 
-		// Skip this client if there is a filter on it
-		bool skip_client = false;
-		if(N_regex_clients > 0)
+		unsigned int added_clients = 0u;
+		bool complete = true;
+		struct top_entries *top_clients = source == TOP_FROM_SCAN ?
+			scan_top_clients(blocked, &added_clients) :
+			get_top_list_candidates(type, source, &added_clients, &complete);
+		if(top_clients == NULL)
 		{
-			// Iterate over all regex filters
-			for(unsigned int j = 0; j < N_regex_clients; j++)
-			{
-				// Check if the domain matches the regex
-				if(regexec(&regex_clients[j], client_ip, 0, NULL, 0) == 0)
-				{
-					// Client IP matches
-					skip_client = true;
-					break;
-				}
-				else if(client_name != NULL && regexec(&regex_clients[j], client_name, 0, NULL, 0) == 0)
-				{
-					// Client name matches
-					skip_client = true;
-					break;
-				}
-			}
+			log_err("Memory allocation failed in %s()", __FUNCTION__);
+			cJSON_Delete(jtop_clients);
+			jtop_clients = NULL;
+			break;
 		}
 
-		if(skip_client || top_clients[i].count < 1)
-		{
-			log_debug(DEBUG_API, "Skipping client %s because it %s", client_ip,
-			          skip_client ? "matches a filter" : "has no queries");
-			continue;
-		}
+		int n = 0;
+		cJSON_Delete(jtop_clients);
+		jtop_clients = cJSON_CreateArray();
 
-		if(clients_only)
+		// Lock shared memory
+		lock_shm_read();
+
+		for(unsigned int i = 0; i < added_clients; i++)
 		{
-			if(ip_if_no_name)
+			// Skip e.g. recycled clients
+			const clientsData *client = getClient(top_clients[i].id, true);
+			if(client == NULL || client->ippos == 0)
+			{
+				log_debug(DEBUG_API, "Skipping client %u because it is recycled", top_clients[i].id);
+				continue;
+			}
+
+			const char *client_ip = getstr(client->ippos);
+			const char *client_name = getstr(client->namepos);
+
+			// Hidden client, probably due to privacy level. Skip this in the top lists
+			if(strcmp(client_ip, HIDDEN_CLIENT) == 0)
+			{
+				log_debug(DEBUG_API, "Skipping client %u because it is hidden", top_clients[i].id);
+				continue;
+			}
+
+			// Skip this client if there is a filter on it
+			// (webserver.api.excludeClients)
+			const bool skip_client = client->flags.excluded;
+			if(skip_client || top_clients[i].count < 1)
+			{
+				log_debug(DEBUG_API, "Skipping client %s because it %s", client_ip,
+				          skip_client ? "matches a filter" : "has no queries");
+				continue;
+			}
+
+			if(clients_only)
 			{
-				if(strlen(client_name) > 0)
-					cJSON_AddStringToArray(jtop_clients, client_name);
+				if(ip_if_no_name)
+				{
+					if(strlen(client_name) > 0)
+						cJSON_AddStringToArray(jtop_clients, client_name);
+					else
+						cJSON_AddStringToArray(jtop_clients, client_ip);
+				}
+				else if(names_only)
+				{
+					if(strlen(client_name) > 0)
+						cJSON_AddStringToArray(jtop_clients, client_name);
+				}
 				else
 					cJSON_AddStringToArray(jtop_clients, client_ip);
 			}
-			else if(names_only)
+			else
 			{
-				if(strlen(client_name) > 0)
-					cJSON_AddStringToArray(jtop_clients, client_name);
+				cJSON *client_item = cJSON_CreateObject();
+				cJSON_AddStringToObject(client_item, "name", client_name);
+				cJSON_AddStringToObject(client_item, "ip", client_ip);
+				cJSON_AddNumberToObject(client_item, "count", top_clients[i].count);
+				cJSON_AddItemToArray(jtop_clients, client_item);
 			}
-			else
-				cJSON_AddStringToArray(jtop_clients, client_ip);
-		}
-		else
-		{
-			cJSON *client_item = cJSON_CreateObject();
-			cJSON_AddStringToObject(client_item, "name", client_name);
-			cJSON_AddStringToObject(client_item, "ip", client_ip);
-			cJSON_AddNumberToObject(client_item, "count", top_clients[i].count);
-			cJSON_AddItemToArray(jtop_clients, client_item);
-		}
 
-		if(++n == count)
-			break;
-	}
+			if(++n == count)
+				break;
+		}
 
-	// Unlock shared memory
-	unlock_shm();
+		// Unlock shared memory
+		unlock_shm_read();
 
-	// Free temporary array
-	free(top_clients);
+		// Free temporary array
+		free(top_clients);
 
-	// Free regexes
-	if(N_regex_clients > 0)
-	{
-		// Free individual regexes
-		for(unsigned int i = 0; i < N_regex_clients; i++)
-			regfree(&regex_clients[i]);
+		// Done if we found enough clients or if there are no further
+		// clients beyond the candidates
+		if(n >= count || complete)
+			break;
 
-		// Free array of regex pointers
-		free(regex_clients);
+		log_debug(DEBUG_API, "Top list %d has too few exact entries (found %d of %d)",
+		          type, n, count);
 	}
 
+	if(jtop_clients == NULL)
+		return NULL;
+
 	if(clients_only)
 	{
 		// Return the array of clients only
@@ -541,6 +696,9 @@ cJSON *get_top_clients(struct ftl_conn *api, const int count,
 
 int api_stats_top_clients(struct ftl_conn *api)
 {
+	if(api_cluster_view(api))
+		return api_stats_top_cluster(api, true);
+
 	bool blocked = false; // Can be overwritten by query string
 	int count = 10;
 	// /api/stats/top_clients?blocked=true
@@ -562,7 +720,7 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 {
 	const int upstreams = counters->upstreams;
 	const int forwarded_count = get_forwarded_count();
-	const int total_queries = counters->queries;
+	const int total_queries = get_total_queries();
 	struct top_entries *top_upstreams = calloc(upstreams, sizeof(struct top_entries));
 	if(top_upstreams == NULL)
 	{
@@ -571,7 +729,7 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 	}
 
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
 	unsigned int added_upstreams = 0;
 	for(int upstreamID = 0; upstreamID < upstreams; upstreamID++)
@@ -582,8 +740,7 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 			continue;
 
 		top_upstreams[added_upstreams].count = upstream->count;
-		top_upstreams[added_upstreams].ippos = upstream->ippos;
-		top_upstreams[added_upstreams].namepos = upstream->namepos;
+		top_upstreams[added_upstreams].id = upstreamID;
 		top_upstreams[added_upstreams].port = upstream->port;
 		top_upstreams[added_upstreams].responses = upstream->responses;
 		top_upstreams[added_upstreams].rtime = upstream->rtime;
@@ -593,7 +750,7 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 	}
 
 	// Unlock shared memory
-	unlock_shm();
+	unlock_shm_read();
 
 	// Sort temporary array in descending order
 	qsort(top_upstreams, added_upstreams, sizeof(*top_upstreams), cmpdesc);
@@ -602,7 +759,7 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 	cJSON *jtop_upstreams = JSON_NEW_ARRAY();
 
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
 	for(int i = -2; i < (int)added_upstreams; i++)
 	{
@@ -610,6 +767,7 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 		const char* ip, *name;
 		int port = -1; // Need signed data type here as -1 means: no port applicable
 		double responsetime = 0.0, uncertainty = 0.0;
+		const char *health = NULL;
 
 		if(i == -2)
 		{
@@ -628,10 +786,15 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 		else
 		{
 			// Regular upstream destination
-			ip = getstr(top_upstreams[i].ippos);
-			name = getstr(top_upstreams[i].namepos);
+			const upstreamsData *upstream = getUpstream(top_upstreams[i].id, true);
+			if(upstream == NULL)
+				continue;
+
+			ip = getstr(upstream->ippos);
+			name = getstr(upstream->namepos);
 			port = top_upstreams[i].port;
 			count = top_upstreams[i].count;
+			health = upstream_circuit_name(upstream->circuit.state);
 
 			// Compute average response time and uncertainty (unit: seconds)
 			if(top_upstreams[i].responses > 0)
@@ -668,12 +831,16 @@ cJSON *get_top_upstreams(struct ftl_conn *api, const bool upstreams_only)
 			cJSON_AddNumberToObject(statistics, "response", responsetime);
 			cJSON_AddNumberToObject(statistics, "variance", uncertainty);
 			cJSON_AddItemToObject(upstream, "statistics", statistics);
+			if(health != NULL)
+				cJSON_AddStringToObject(upstream, "health", health);
+			else
+				cJSON_AddNullToObject(upstream, "health");
 			cJSON_AddItemToArray(jtop_upstreams, upstream);
 		}
 	}
 
 	// Unlock shared memory
-	unlock_shm();
+	unlock_shm_read();
 
 	// Free temporary array
 	free(top_upstreams);
@@ -702,18 +869,18 @@ int api_stats_upstreams(struct ftl_conn *api)
 int api_stats_query_types(struct ftl_conn *api)
 {
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
 	cJSON *types = JSON_NEW_OBJECT();
 	int ret = get_query_types_obj(api, types);
 	if(ret != 0)
 	{
-		unlock_shm();
+		unlock_shm_read();
 		return ret;
 	}
 
 	// Unlock shared memory
-	unlock_shm();
+	unlock_shm_read();
 
 	cJSON *json = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(json, "types", types);
@@ -744,13 +911,19 @@ int api_stats_recentblocked(struct ftl_conn *api)
 	}
 
 	// Lock shared memory
-	lock_shm();
+	lock_shm_read();
 
 	// Find most recently blocked query
 	unsigned int found = 0;
 	cJSON *blocked = JSON_NEW_ARRAY();
+	const struct query_columns *columns = get_query_columns();
 	for(int queryID = counters->queries - 1; queryID > 0 ; queryID--)
 	{
+		// Skip non-blocked queries without touching the query records
+		// if the columnar mirror is available
+		if(columns != NULL && !is_blocked(columns->status[query_slot(queryID)]))
+			continue;
+
 		const queriesData *query = getQuery(queryID, true);
 		if(query == NULL)
 			continue;
@@ -763,7 +936,7 @@ int api_stats_recentblocked(struct ftl_conn *api)
 			if(domain == NULL)
 				continue;
 
-			JSON_REF_STR_IN_ARRAY(blocked, domain);
+			JSON_COPY_STR_TO_ARRAY(blocked, domain);
 
 			// Only count when added successfully
 			found++;
@@ -774,7 +947,7 @@ int api_stats_recentblocked(struct ftl_conn *api)
 	}
 
 	// Unlock shared memory
-	unlock_shm();
+	unlock_shm_read();
 
 	cJSON *json = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(json, "blocked", blocked);
@@ -18,11 +18,72 @@
 #include "log.h"
 // db
 #include "database/common.h"
+// get_rollup_period()
+#include "database/rollup-table.h"
 
 // SQL Query type filters for the database
 #define FILTER_STATUS_NOT_BLOCKED "status IN (0,2,3,12,13,14,17)"
 #define FILTER_STATUS_BLOCKED "status NOT IN (0,2,3,12,13,14,17)"
 
+// Ranges covering whole periods are answered from the pre-aggregated counts in
+// the query_rollup table instead of the raw queries
+#define FILTER_ROLLUP "timestamp >= :from AND timestamp < :until AND period = :period"
+
+// Bind the rollup period if the statement uses the query_rollup table
+static int bind_period(sqlite3_stmt *stmt, const unsigned int period)
+{
+	const int idx = sqlite3_bind_parameter_index(stmt, ":period");
+	if(idx == 0)
+		return SQLITE_OK;
+
+	return sqlite3_bind_int(stmt, idx, period);
+}
+
+// Run a query returning a single integer on either the raw or the
+// pre-aggregated queries. This is the same as db_query_int_from_until_type()
+// but additionally binds the rollup period
+static int db_query_int_range(sqlite3 *db, const char* querystr, const double from,
+                              const double until, const unsigned int period, const int type)
+{
+	if(period == 0)
+		return type < 0 ? db_query_int_from_until(db, querystr, from, until) :
+		                  db_query_int_from_until_type(db, querystr, from, until, type);
+
+	sqlite3_stmt* stmt;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	if( rc != SQLITE_OK ){
+		log_err("db_query_int_range(%s) - SQL error prepare (%i): %s",
+		        querystr, rc, sqlite3_errstr(rc));
+		return DB_FAILED;
+	}
+
+	// Bind from, until, period and (if used) type to prepared statement
+	if((rc = sqlite3_bind_double(stmt, 1, from))  != SQLITE_OK ||
+	   (rc = sqlite3_bind_double(stmt, 2, until)) != SQLITE_OK ||
+	   (rc = bind_period(stmt, period)) != SQLITE_OK ||
+	   (type >= 0 && (rc = sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":type"), type)) != SQLITE_OK))
+	{
+		log_err("db_query_int_range(%s) - SQL error bind (%i): %s",
+		        querystr, rc, sqlite3_errstr(rc));
+		sqlite3_finalize(stmt);
+		return DB_FAILED;
+	}
+
+	int result = DB_NODATA;
+	if((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		result = sqlite3_column_int(stmt, 0);
+	else if(rc != SQLITE_DONE)
+	{
+		log_err("db_query_int_range(%s) - SQL error step (%i): %s",
+		        querystr, rc, sqlite3_errstr(rc));
+		result = DB_FAILED;
+	}
+
+	sqlite3_finalize(stmt);
+
+	return result;
+}
+
 int api_history_database(struct ftl_conn *api)
 {
 	double from = 0, until = 0;
@@ -50,12 +111,18 @@ int api_history_database(struct ftl_conn *api)
 		                       "Failed to open long-term database",
 		                       NULL);
 
+	// Use pre-aggregated counts if the requested range covers whole periods
+	const unsigned int period = get_rollup_period(from, &until, interval);
+
 	// Build SQL string
-	const char *querystr = "SELECT (timestamp/:interval)*:interval interval,status,COUNT(*) FROM query_storage "
+	const char *querystr = period > 0 ?
+	                       "SELECT (timestamp/:interval)*:interval interval,status,SUM(count) FROM query_rollup "
+	                       "WHERE (status != 0) AND " FILTER_ROLLUP " "
+	                       "GROUP by interval,status ORDER by interval" :
+	                       "SELECT (timestamp/:interval)*:interval interval,status,COUNT(*) FROM query_storage "
 	                       "WHERE (status != 0) AND timestamp >= :from AND timestamp <= :until "
 	                       "GROUP by interval,status ORDER by interval";
 
-
 	// Prepare SQLite statement
 	sqlite3_stmt *stmt = NULL;
 	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
@@ -110,6 +177,21 @@ int api_history_database(struct ftl_conn *api)
 		                       NULL);
 	}
 
+	// Bind rollup period to prepared statement
+	if((rc = bind_period(stmt, period)) != SQLITE_OK)
+	{
+		log_err("api_stats_database_history(): Failed to bind period (error %d) - %s",
+		        rc, sqlite3_errstr(rc));
+		sqlite3_reset(stmt);
+		sqlite3_finalize(stmt);
+		dbclose(&db);
+
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to bind period",
+		                       NULL);
+	}
+
 	// Loop over returned data and accumulate results
 	cJSON *history = JSON_NEW_ARRAY();
 	cJSON *item = NULL;
@@ -217,9 +299,60 @@ int api_stats_database_top_items(struct ftl_conn *api)
 		                       "Failed to open long-term database",
 		                       NULL);
 
+	// Use pre-aggregated counts if the requested range covers whole periods
+	const unsigned int period = get_rollup_period(from, &until, 0);
+
 	// Build SQL string
 	const char *querystr, *count_total_str, *count_blocked_str;
-	if(domains)
+	if(domains && period > 0)
+	{
+		// Get domains and count of queries (blocked or not blocked)
+		querystr = blocked ?
+		           "SELECT SUM(count),d.domain AS cnt FROM query_rollup q "
+		           "JOIN domain_by_id d ON d.id = q.domain "
+		           "WHERE " FILTER_ROLLUP " "
+		           "AND " FILTER_STATUS_BLOCKED " "
+		           "GROUP by q.domain" :
+		           "SELECT SUM(count),d.domain AS cnt FROM query_rollup q "
+		           "JOIN domain_by_id d ON d.id = q.domain "
+		           "WHERE " FILTER_ROLLUP " "
+		           "AND " FILTER_STATUS_NOT_BLOCKED " "
+		           "GROUP by q.domain";
+
+		// Count total number of queries for domains
+		count_total_str = "SELECT COUNT(DISTINCT domain) FROM query_rollup "
+		                  "WHERE " FILTER_ROLLUP;
+
+		// Count total number of blocked queries for domains
+		count_blocked_str = "SELECT COUNT(DISTINCT domain) FROM query_rollup "
+		                    "WHERE " FILTER_ROLLUP " "
+		                    "AND " FILTER_STATUS_BLOCKED;
+	}
+	else if(period > 0)
+	{
+		// Get clients and count of queries (blocked or not blocked)
+		querystr = blocked ?
+		           "SELECT SUM(count),c.ip,c.name AS cnt FROM query_rollup q "
+		           "JOIN client_by_id c ON c.id = q.client "
+		           "WHERE " FILTER_ROLLUP " "
+		           "AND " FILTER_STATUS_BLOCKED " "
+		           "GROUP by q.client" :
+		           "SELECT SUM(count),c.ip,c.name AS cnt FROM query_rollup q "
+		           "JOIN client_by_id c ON c.id = q.client "
+		           "WHERE " FILTER_ROLLUP " "
+		           "AND " FILTER_STATUS_NOT_BLOCKED " "
+		           "GROUP by q.client";
+
+		// Count total number of queries for clients
+		count_total_str = "SELECT COUNT(DISTINCT client) FROM query_rollup "
+		                  "WHERE " FILTER_ROLLUP;
+
+		// Count number of blocked queries for clients
+		count_blocked_str = "SELECT COUNT(DISTINCT client) FROM query_rollup "
+		                    "WHERE " FILTER_ROLLUP " "
+		                    "AND " FILTER_STATUS_BLOCKED;
+	}
+	else if(domains)
 	{
 		if(blocked)
 		{
@@ -255,7 +388,7 @@ int api_stats_database_top_items(struct ftl_conn *api)
 		{
 			// Get clients and count of queries (blocked)
 			querystr = "SELECT COUNT(*),c.ip,c.name AS cnt FROM query_storage q "
-			           "JOIN client_by_id c ON c.id = q.client"
+			           "JOIN client_by_id c ON c.id = q.client "
 			           "WHERE timestamp >= :from AND timestamp <= :until "
 			           "AND " FILTER_STATUS_BLOCKED " "
 			           "GROUP by q.client";
@@ -326,6 +459,21 @@ int api_stats_database_top_items(struct ftl_conn *api)
 		                       NULL);
 	}
 
+	// Bind rollup period to prepared statement
+	if((rc = bind_period(stmt, period)) != SQLITE_OK)
+	{
+		log_err("api_stats_database_top_items(): Failed to bind period (error %d) - %s",
+		        rc, sqlite3_errstr(rc));
+		sqlite3_reset(stmt);
+		sqlite3_finalize(stmt);
+		dbclose(&db);
+
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to bind period",
+		                       NULL);
+	}
+
 	// Loop over and accumulate results
 	cJSON *top_items = JSON_NEW_ARRAY();
 	unsigned int total = 0;
@@ -355,8 +503,8 @@ int api_stats_database_top_items(struct ftl_conn *api)
 
 	cJSON *json = JSON_NEW_OBJECT();
 	JSON_ADD_ITEM_TO_OBJECT(json, (domains ? "domains" : "clients"), top_items);
-	const int total_num = db_query_int_from_until(db, count_total_str, from, until);
-	const int blocked_num = db_query_int_from_until(db, count_blocked_str, from, until);
+	const int total_num = db_query_int_range(db, count_total_str, from, until, period, -1);
+	const int blocked_num = db_query_int_range(db, count_blocked_str, from, until, period, -1);
 	JSON_ADD_NUMBER_TO_OBJECT(json, "total_queries", total_num);
 	JSON_ADD_NUMBER_TO_OBJECT(json, "blocked_queries", blocked_num);
 
@@ -390,20 +538,33 @@ int api_stats_database_summary(struct ftl_conn *api)
 		                       "Failed to open long-term database",
 		                       NULL);
 
+	// Use pre-aggregated counts if the requested range covers whole periods
+	const unsigned int period = get_rollup_period(from, &until, 0);
+
 	// Perform SQL queries
 	const char *querystr;
-	querystr = "SELECT COUNT(*) FROM query_storage "
+	querystr = period > 0 ?
+	           "SELECT IFNULL(SUM(count),0) FROM query_rollup "
+	           "WHERE " FILTER_ROLLUP :
+	           "SELECT COUNT(*) FROM query_storage "
 	           "WHERE timestamp >= :from AND timestamp <= :until";
-	const int sum_queries = db_query_int_from_until(db, querystr, from, until);
+	const int sum_queries = db_query_int_range(db, querystr, from, until, period, -1);
 
-	querystr = "SELECT COUNT(*) FROM query_storage "
+	querystr = period > 0 ?
+	           "SELECT IFNULL(SUM(count),0) FROM query_rollup "
+	           "WHERE " FILTER_ROLLUP " "
+	           "AND " FILTER_STATUS_BLOCKED :
+	           "SELECT COUNT(*) FROM query_storage "
 	           "WHERE timestamp >= :from AND timestamp <= :until "
 	           "AND " FILTER_STATUS_BLOCKED;
-	const int sum_blocked = db_query_int_from_until(db, querystr, from, until);
+	const int sum_blocked = db_query_int_range(db, querystr, from, until, period, -1);
 
-	querystr = "SELECT COUNT(DISTINCT client) FROM query_storage "
+	querystr = period > 0 ?
+	           "SELECT COUNT(DISTINCT client) FROM query_rollup "
+	           "WHERE " FILTER_ROLLUP :
+	           "SELECT COUNT(DISTINCT client) FROM query_storage "
 	           "WHERE timestamp >= :from AND timestamp <= :until";
-	const int total_clients = db_query_int_from_until(db, querystr, from, until);
+	const int total_clients = db_query_int_range(db, querystr, from, until, period, -1);
 
 	// Calculate percentage of blocked queries, substituting 0.0 if there
 	// are no blocked queries
@@ -464,7 +625,15 @@ int api_history_database_clients(struct ftl_conn *api)
 		                       "Failed to open long-term database",
 		                       NULL);
 
-	const char *querystr = "SELECT DISTINCT(client),ip,name FROM query_storage "
+	// Use pre-aggregated counts if the requested range covers whole periods
+	const unsigned int period = get_rollup_period(from, &until, interval);
+
+	const char *querystr = period > 0 ?
+	                       "SELECT DISTINCT(client),ip,name FROM query_rollup "
+	                       "JOIN client_by_id ON client_by_id.id = client "
+	                       "WHERE " FILTER_ROLLUP " "
+	                       "ORDER BY client DESC" :
+	                       "SELECT DISTINCT(client),ip,name FROM query_storage "
 	                       "JOIN client_by_id ON client_by_id.id = client "
 	                       "WHERE timestamp >= :from AND timestamp <= :until "
 	                       "ORDER BY client DESC";
@@ -512,6 +681,21 @@ int api_history_database_clients(struct ftl_conn *api)
 		                       NULL);
 	}
 
+	// Bind rollup period to prepared statement
+	if((rc = bind_period(stmt, period)) != SQLITE_OK)
+	{
+		log_err("api_stats_database_clients(): Failed to bind period (error %d) - %s",
+		        rc, sqlite3_errstr(rc));
+		sqlite3_reset(stmt);
+		sqlite3_finalize(stmt);
+		dbclose(&db);
+
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to bind period",
+		                       NULL);
+	}
+
 	// Loop over clients and accumulate results
 	cJSON *clients = JSON_NEW_OBJECT();
 	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
@@ -523,7 +707,11 @@ int api_history_database_clients(struct ftl_conn *api)
 	sqlite3_finalize(stmt);
 
 	// Build SQL string
-	querystr = "SELECT (timestamp/:interval)*:interval interval,client,COUNT(*) FROM query_storage "
+	querystr = period > 0 ?
+	           "SELECT (timestamp/:interval)*:interval interval,client,SUM(count) FROM query_rollup "
+	           "WHERE " FILTER_ROLLUP " "
+	           "GROUP BY interval,client ORDER BY interval DESC, client DESC" :
+	           "SELECT (timestamp/:interval)*:interval interval,client,COUNT(*) FROM query_storage "
 	           "WHERE timestamp >= :from AND timestamp <= :until "
 	           "GROUP BY interval,client ORDER BY interval DESC, client DESC";
 
@@ -584,6 +772,21 @@ int api_history_database_clients(struct ftl_conn *api)
 		                       NULL);
 	}
 
+	// Bind rollup period to prepared statement
+	if((rc = bind_period(stmt, period)) != SQLITE_OK)
+	{
+		log_err("api_stats_database_clients(): Failed to bind period (error %d) - %s",
+		        rc, sqlite3_errstr(rc));
+		sqlite3_reset(stmt);
+		sqlite3_finalize(stmt);
+		dbclose(&db);
+
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to bind period",
+		                       NULL);
+	}
+
 	cJSON *item = NULL;
 	cJSON *data = NULL;
 	unsigned int previous_timeslot = 0u;
@@ -658,15 +861,22 @@ int api_stats_database_query_types(struct ftl_conn *api)
 		                       "Failed to open long-term database",
 		                       NULL);
 
+	// Use pre-aggregated counts if the requested range covers whole periods
+	const unsigned int period = get_rollup_period(from, &until, 0);
+
 	// Perform SQL queries
 	cJSON *types = JSON_NEW_OBJECT();
 	for(int i = TYPE_A; i < TYPE_MAX; i++)
 	{
-		const char *querystr = "SELECT COUNT(*) FROM query_storage "
+		const char *querystr = period > 0 ?
+		                       "SELECT IFNULL(SUM(count),0) FROM query_rollup "
+		                       "WHERE " FILTER_ROLLUP " "
+		                       "AND type = :type" :
+		                       "SELECT COUNT(*) FROM query_storage "
 		                       "WHERE timestamp >= :from AND timestamp <= :until "
 		                       "AND type = :type";
 		// Add 1 as type is stored one-based in the database for historical reasons
-		int count = db_query_int_from_until_type(db, querystr, from, until, i+1);
+		int count = db_query_int_range(db, querystr, from, until, period, i+1);
 		JSON_ADD_NUMBER_TO_OBJECT(types, get_query_type_str(i, NULL, NULL), count);
 	}
 
@@ -706,22 +916,39 @@ int api_stats_database_upstreams(struct ftl_conn *api)
 		                       "Failed to open long-term database",
 		                       NULL);
 
+	// Use pre-aggregated counts if the requested range covers whole periods
+	const unsigned int period = get_rollup_period(from, &until, 0);
+
 	// Perform simple SQL queries
 	unsigned int sum_queries = 0;
 	const char *querystr;
-	querystr = "SELECT COUNT(*) FROM query_storage "
+	querystr = period > 0 ?
+	           "SELECT IFNULL(SUM(count),0) FROM query_rollup "
+	           "WHERE " FILTER_ROLLUP " "
+	           "AND status = 3" :
+	           "SELECT COUNT(*) FROM query_storage "
 	           "WHERE timestamp >= :from AND timestamp <= :until "
 	           "AND status = 3";
-	int cached_queries = db_query_int_from_until(db, querystr, from, until);
+	int cached_queries = db_query_int_range(db, querystr, from, until, period, -1);
 	sum_queries += cached_queries;
 
-	querystr = "SELECT COUNT(*) FROM query_storage "
+	querystr = period > 0 ?
+	           "SELECT IFNULL(SUM(count),0) FROM query_rollup "
+	           "WHERE " FILTER_ROLLUP " "
+		   "AND status != 0 AND status != 2 AND status != 3" :
+	           "SELECT COUNT(*) FROM query_storage "
 	           "WHERE timestamp >= :from AND timestamp <= :until "
 		   "AND status != 0 AND status != 2 AND status != 3";
-	int blocked_queries = db_query_int_from_until(db, querystr, from, until);
+	int blocked_queries = db_query_int_range(db, querystr, from, until, period, -1);
 	sum_queries += blocked_queries;
 
-	querystr = "SELECT forward,COUNT(*) FROM query_storage "
+	// Queries without upstream are stored with forward = 0 in the rollup
+	querystr = period > 0 ?
+	           "SELECT forward,SUM(count) FROM query_rollup "
+	           "WHERE " FILTER_ROLLUP " "
+		   "AND forward != 0 "
+	           "GROUP BY forward ORDER BY forward" :
+	           "SELECT forward,COUNT(*) FROM query_storage "
 	           "WHERE timestamp >= :from AND timestamp <= :until "
 		   "AND forward IS NOT NULL "
 	           "GROUP BY forward ORDER BY forward";
@@ -769,6 +996,21 @@ int api_stats_database_upstreams(struct ftl_conn *api)
 		                       NULL);
 	}
 
+	// Bind rollup period to prepared statement
+	if((rc = bind_period(stmt, period)) != SQLITE_OK)
+	{
+		log_err("api_stats_database_upstreams(): Failed to bind period (error %d) - %s",
+		        rc, sqlite3_errstr(rc));
+		sqlite3_reset(stmt);
+		sqlite3_finalize(stmt);
+		dbclose(&db);
+
+		return send_json_error(api, 500,
+		                       "internal_error",
+		                       "Failed to bind period",
+		                       NULL);
+	}
+
 	// Loop over clients and accumulate results
 	cJSON *upstreams = JSON_NEW_ARRAY();
 	int forwarded_queries = 0;
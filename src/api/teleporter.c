@@ -34,38 +34,109 @@
 
 #define MAXFILESIZE (50u*1024*1024)
 
-static int api_teleporter_GET(struct ftl_conn *api)
+// Teleporter archive streamed to the client
+struct zip_response {
+	struct ftl_conn *api;
+	const char *filename;
+	bool started;
+};
+
+static bool send_zip_chunk(void *opaque, const void *buf, const size_t len)
 {
-	mz_zip_archive zip = { 0 };
-	void *ptr = NULL;
-	size_t size = 0u;
-	char filename[128] = "";
-	const char *error = generate_teleporter_zip(&zip, filename, &ptr, &size);
-	if(error != NULL)
+	struct zip_response *response = opaque;
+
+	// Send the headers when the first chunk arrives, errors before this
+	// point can still be reported as JSON error
+	if(!response->started)
+	{
+		// Add header indicating that this is a file to be downloaded and
+		// stored as teleporter.zip (rather than showing the binary data
+		// in the browser window). This client is free to ignore and do
+		// whatever it wants with this data stream.
+		snprintf(pi_hole_extra_headers, sizeof(pi_hole_extra_headers),
+		         "Content-Disposition: attachment; filename=\"%s\"",
+		         response->filename);
+
+		// Send 200 OK with appropriate headers. The size of the archive
+		// is not known in advance so it is sent using chunked transfer
+		// encoding
+		mg_send_http_ok(response->api->conn, "application/zip", -1);
+
+		// Clear extra headers
+		pi_hole_extra_headers[0] = '\0';
+		response->started = true;
+	}
+
+	// An empty chunk would terminate the response
+	if(len == 0)
+		return true;
+
+	// Send raw (binary) ZIP content
+	return mg_send_chunk(response->api->conn, buf, len) >= 0;
+}
+
+static bool write_zip_tmpfile(void *opaque, const void *buf, const size_t len)
+{
+	return fwrite(buf, 1, len, opaque) == len;
+}
+
+// Generate the archive into a temporary file which is then sent as a whole.
+// Unlike the streamed archive, the response has a known length and can be
+// requested in ranges so interrupted downloads can be resumed
+static int api_teleporter_GET_file(struct ftl_conn *api)
+{
+	char filename[128] = "", path[PATH_MAX] = "";
+	if(!create_teleporter_tmpfile(TELEPORTER_DOWNLOAD, path))
 		return send_json_error(api, 500,
+		                       "compression_error",
+		                       "Failed to create temporary file",
+		                       NULL);
+
+	FILE *fp = fopen(path, "w");
+	const char *error = fp == NULL ? strerror(errno) :
+	                    generate_teleporter_zip(filename, write_zip_tmpfile, fp);
+	if(fp != NULL && fclose(fp) != 0 && error == NULL)
+		error = strerror(errno);
+
+	int code;
+	if(error != NULL)
+		code = send_json_error(api, 500,
 		                       "compression_error",
 		                       error,
 		                       NULL);
+	else
+		code = send_http_file(api, path, "application/zip", filename);
 
-	// Add header indicating that this is a file to be downloaded and stored as
-	// teleporter.zip (rather than showing the binary data in the browser
-	// window). This client is free to ignore and do whatever it wants with this
-	// data stream.
-	snprintf(pi_hole_extra_headers, sizeof(pi_hole_extra_headers),
-	         "Content-Disposition: attachment; filename=\"%s\"",
-	         filename);
+	// The file has been sent completely when send_http_file() returns
+	unlink(path);
+	return code;
+}
 
-	// Send 200 OK with appropriate headers
-	mg_send_http_ok(api->conn, "application/zip", size);
+static int api_teleporter_GET(struct ftl_conn *api)
+{
+	// Check if the archive should be sent as file rather than streamed
+	bool file = false;
+	if(api->request->query_string != NULL)
+		get_bool_var(api->request->query_string, "file", &file);
+	if(file)
+		return api_teleporter_GET_file(api);
 
-	// Clear extra headers
-	pi_hole_extra_headers[0] = '\0';
+	char filename[128] = "";
+	struct zip_response response = { api, filename, false };
+	const char *error = generate_teleporter_zip(filename, send_zip_chunk, &response);
+	if(error != NULL && !response.started)
+		return send_json_error(api, 500,
+		                       "compression_error",
+		                       error,
+		                       NULL);
 
-	// Send raw (binary) ZIP content
-	mg_write(api->conn, ptr, size);
+	// Do not terminate the chunked response if the archive is incomplete so
+	// the client notices the truncated download
+	if(error != NULL)
+		return 500;
 
-	// Free allocated ZIP memory
-	free_teleporter_zip(&zip);
+	// Terminate chunked response
+	mg_send_chunk(api->conn, "", 0);
 
 	return 200;
 }
@@ -74,10 +145,13 @@ static int api_teleporter_GET(struct ftl_conn *api)
 struct upload_data {
 	bool too_large;
 	char *sid;
+	bool write_error;
 	cJSON *import;
-	uint8_t *data;
+	FILE *fp;
 	char *filename;
 	size_t filesize;
+	uint8_t magic[4];
+	char path[PATH_MAX];
 	struct {
 		bool file;
 		bool sid;
@@ -97,8 +171,17 @@ static int field_found(const char *key,
 
 	// Set all fields to false
 	memset(&data->field, false, sizeof(data->field));
-	if(strcasecmp(key, "file") == 0 && filename && *filename)
+	if(strcasecmp(key, "file") == 0 && filename && *filename && data->fp == NULL)
 	{
+		// The archive is stored in a temporary file while it is
+		// received rather than in memory
+		if(!create_teleporter_tmpfile(TELEPORTER_UPLOAD, data->path) ||
+		   (data->fp = fopen(data->path, "wb")) == NULL)
+		{
+			log_warn("Unable to store uploaded Teleporter file: %s", strerror(errno));
+			data->write_error = true;
+			return MG_FORM_FIELD_STORAGE_ABORT;
+		}
 		data->filename = strdup(filename);
 		data->field.file = true;
 		return MG_FORM_FIELD_STORAGE_GET;
@@ -135,13 +218,20 @@ static int field_get(const char *key, const char *value, size_t valuelen, void *
 			data->too_large = true;
 			return MG_FORM_FIELD_HANDLE_ABORT;
 		}
-		// Allocate memory for the raw file data
-		data->data = realloc(data->data, data->filesize + valuelen);
-		// Copy the raw file data
-		memcpy(data->data + data->filesize, value, valuelen);
+		// Remember the first bytes to identify the type of archive
+		if(data->filesize < sizeof(data->magic))
+			memcpy(data->magic + data->filesize, value,
+			       min(valuelen, sizeof(data->magic) - data->filesize));
+		// Append the raw file data to the temporary file
+		if(fwrite(value, 1, valuelen, data->fp) != valuelen)
+		{
+			log_warn("Unable to store uploaded Teleporter file: %s", strerror(errno));
+			data->write_error = true;
+			return MG_FORM_FIELD_HANDLE_ABORT;
+		}
 		// Store the size of the file raw data
 		data->filesize += valuelen;
-		log_debug(DEBUG_API, "Received file (%zu bytes, buffer is now %zu bytes)",
+		log_debug(DEBUG_API, "Received file (%zu bytes, file is now %zu bytes)",
 		          valuelen, data->filesize);
 	}
 	else if(data->field.sid)
@@ -200,10 +290,15 @@ static int free_upload_data(struct upload_data *data)
 		free(data->sid);
 		data->sid = NULL;
 	}
-	if(data->data)
+	if(data->fp)
 	{
-		free(data->data);
-		data->data = NULL;
+		fclose(data->fp);
+		data->fp = NULL;
+	}
+	if(data->path[0] != '\0')
+	{
+		unlink(data->path);
+		data->path[0] = '\0';
 	}
 	if(data->import)
 	{
@@ -256,8 +351,18 @@ static int api_teleporter_POST(struct ftl_conn *api)
 		                       NULL);
 	}
 
+	// Check if we could store the file we received
+	if(data.write_error)
+	{
+		free_upload_data(&data);
+		return send_json_error(api, 500,
+		                       "storage_error",
+		                       "Unable to store uploaded file",
+		                       NULL);
+	}
+
 	// Check if we received something we consider being a file
-	if(data.data == NULL || data.filesize == 0)
+	if(data.fp == NULL || data.filesize == 0)
 	{
 		free_upload_data(&data);
 		return send_json_error(api, 400,
@@ -276,6 +381,18 @@ static int api_teleporter_POST(struct ftl_conn *api)
 		                       NULL);
 	}
 
+	// Complete the temporary file
+	const bool closed = fclose(data.fp) == 0;
+	data.fp = NULL;
+	if(!closed)
+	{
+		free_upload_data(&data);
+		return send_json_error(api, 500,
+		                       "storage_error",
+		                       "Unable to store uploaded file",
+		                       strerror(errno));
+	}
+
 	// Ensure v6 migration directory exists
 	create_migration_target_v6();
 
@@ -287,7 +404,7 @@ static int api_teleporter_POST(struct ftl_conn *api)
 	if(strlen(data.filename) > 4 &&
 	   strcmp(data.filename + strlen(data.filename) - 4, ".zip") == 0 &&
 	   data.filesize >= 40 &&
-	   memcmp(data.data, "\x50\x4b\x03\x04", 4) == 0)
+	   memcmp(data.magic, "\x50\x4b\x03\x04", 4) == 0)
 	{
 		return process_received_zip(api, &data);
 	}
@@ -299,7 +416,7 @@ static int api_teleporter_POST(struct ftl_conn *api)
 	else if(strlen(data.filename) > 7 &&
 	        strcmp(data.filename + strlen(data.filename) - 7, ".tar.gz") == 0 &&
 	        data.filesize >= 40 &&
-	        memcmp(data.data, "\x1f\x8b", 2) == 0)
+	        memcmp(data.magic, "\x1f\x8b", 2) == 0)
 	{
 		return process_received_tar_gz(api, &data);
 	}
@@ -317,7 +434,7 @@ static int process_received_zip(struct ftl_conn *api, struct upload_data *data)
 	char hint[ERRBUF_SIZE];
 	memset(hint, 0, sizeof(hint));
 	cJSON *json_files = JSON_NEW_ARRAY();
-	const char *error = read_teleporter_zip(data->data, data->filesize, hint, data->import, json_files);
+	const char *error = read_teleporter_zip(data->path, hint, data->import, json_files);
 	if(error != NULL)
 	{
 		const size_t msglen = strlen(error) + strlen(hint) + 4;
@@ -664,10 +781,29 @@ static bool import_json_table(cJSON *json, struct teleporter_files *file)
 
 static int process_received_tar_gz(struct ftl_conn *api, struct upload_data *data)
 {
+	// Legacy archives only contain a few small files, read them into memory
+	uint8_t *buffer = calloc(data->filesize, sizeof(uint8_t));
+	FILE *upload = fopen(data->path, "rb");
+	const bool loaded = buffer != NULL && upload != NULL &&
+	                  fread(buffer, 1, data->filesize, upload) == data->filesize;
+	if(upload != NULL)
+		fclose(upload);
+	if(!loaded)
+	{
+		free(buffer);
+		free_upload_data(data);
+		return send_json_error(api, 500,
+		                       "storage_error",
+		                       "Unable to read uploaded file",
+		                       NULL);
+	}
+
 	// Try to decompress the received data
 	uint8_t *archive = NULL;
 	mz_ulong archive_size = 0u;
-	if(!inflate_buffer(data->data, data->filesize, &archive, &archive_size))
+	const bool inflated = inflate_buffer(buffer, data->filesize, &archive, &archive_size);
+	free(buffer);
+	if(!inflated)
 	{
 		free_upload_data(data);
 		return send_json_error(api, 400,
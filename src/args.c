@@ -38,6 +38,8 @@
 #include "lua/ftl_lua.h"
 // gravity_parseList()
 #include "tools/gravity-parseList.h"
+// gravity_index_write()
+#include "database/gravity-index.h"
 // run_dhcp_discover()
 #include "tools/dhcp-discover.h"
 // mg_version()
@@ -58,6 +60,10 @@
 #include "tools/dhcp-discover.h"
 // run_arp_scan()
 #include "tools/arp-scan.h"
+// run_dns_bench()
+#include "tools/dns-bench.h"
+// run_simulation()
+#include "tools/simulate.h"
 // run_performance_test()
 #include "config/password.h"
 // idn2_to_ascii_lz()
@@ -70,6 +76,10 @@
 #include "ntp/ntp.h"
 // check_capability()
 #include "capabilities.h"
+// edns0_bench()
+#include "edns0.h"
+// decode_querylog()
+#include "querylog.h"
 
 // defined in dnsmasq.c
 extern void print_dnsmasq_version(const char *yellow, const char *green, const char *bold, const char *normal);
@@ -237,6 +247,9 @@ void parse_args(int argc, char *argv[])
 	{
 		// Enable stdout printing
 		cli_mode = true;
+		log_ctrl(false, false);
+		// Read config for misc.compressThreads
+		readFTLconf(&config, false);
 		log_ctrl(false, true);
 
 		// Get input and output file names
@@ -449,15 +462,42 @@ void parse_args(int argc, char *argv[])
 		// pihole-FTL gravity parseList <infile> <outfile> <adlistID>
 		if(argc == 6 && strcasecmp(argv[2], "parseList") == 0)
 		{
+			// Need to know if the search index is to be built
+			log_ctrl(false, false);
+			readFTLconf(&config, false);
+
 			// Parse the given list and write the result to the given file
-			exit(gravity_parseList(argv[3], argv[4], argv[5], false, antigravity));
+			exit(gravity_parseList(argv[3], argv[4], argv[5], false, antigravity, false));
+		}
+
+		// pihole-FTL gravity updateList <infile> <database> <adlistID>
+		if(argc == 6 && strcasecmp(argv[2], "updateList") == 0)
+		{
+			// Need to know if the search index is to be updated
+			log_ctrl(false, false);
+			readFTLconf(&config, false);
+
+			// Replace the domains of the given list in the given
+			// database by the ones of the file (if it changed)
+			exit(gravity_parseList(argv[3], argv[4], argv[5], false, antigravity, true));
 		}
 
 		// pihole-FTL gravity checkList <infile>
 		if(argc == 4 && strcasecmp(argv[2], "checkList") == 0)
 		{
 			// Parse the given list and write the result to the given file
-			exit(gravity_parseList(argv[3], "", "-1", true, antigravity));
+			exit(gravity_parseList(argv[3], "", "-1", true, antigravity, false));
+		}
+
+		// pihole-FTL gravity compileIndex <database> [<outfile>]
+		if((argc == 4 || argc == 5) && strcasecmp(argv[2], "compileIndex") == 0)
+		{
+			// Print progress and errors on the terminal
+			log_ctrl(false, true);
+
+			// Write the compiled index of the given database to a
+			// file which FTL maps instead of compiling it itself
+			exit(gravity_index_write(argv[3], argc == 5 ? argv[4] : NULL) ? EXIT_SUCCESS : EXIT_FAILURE);
 		}
 
 		printf("Incorrect usage of pihole-FTL gravity subcommand\n");
@@ -485,9 +525,166 @@ void parse_args(int argc, char *argv[])
 	{
 		// Enable stdout printing
 		cli_mode = true;
-		const bool scan_all = argc > 2 && strcmp(argv[2], "-a") == 0;
-		const bool extreme_mode = argc > 2 && strcmp(argv[2], "-x") == 0;
-		exit(run_arp_scan(scan_all, extreme_mode));
+		bool scan_all = false, extreme_mode = false, update_neigh = false;
+		unsigned int rate = 0;
+		for(int i = 2; i < argc; i++)
+		{
+			if(strcmp(argv[i], "-a") == 0)
+				scan_all = true;
+			else if(strcmp(argv[i], "-x") == 0)
+				extreme_mode = true;
+			else if(strcmp(argv[i], "-n") == 0)
+				update_neigh = true;
+			else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%u", &rate) == 1 && rate > 0)
+				i++;
+			else
+			{
+				printf("pihole-FTL: invalid option -- '%s'\nTry '%s --help' for more information\n", argv[i], argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		exit(run_arp_scan(scan_all, extreme_mode, rate, update_neigh));
+	}
+
+	// DNS load generator
+	if(argc > 2 && strcmp(argv[1], "bench") == 0 && strcmp(argv[2], "dns") == 0)
+	{
+		// Enable stdout printing
+		cli_mode = true;
+		struct dns_bench_opts opts = {
+			.samples = DNS_BENCH_SAMPLES,
+			.rate = DNS_BENCH_RATE,
+			.duration = DNS_BENCH_DURATION
+		};
+		for(int i = 3; i < argc; i++)
+		{
+			if(strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+				opts.corpus = argv[++i];
+			else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+				opts.server = argv[++i];
+			else if(strcmp(argv[i], "-m") == 0)
+				opts.mac = true;
+			else if(strcmp(argv[i], "--tcp") == 0)
+				opts.tcp = true;
+			else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%u", &opts.samples) == 1 && opts.samples > 0)
+				i++;
+			else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%u", &opts.rate) == 1 && opts.rate > 0)
+				i++;
+			else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%u", &opts.duration) == 1 && opts.duration > 0)
+				i++;
+			else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%u", &opts.clients) == 1 && opts.clients < (1u << 24))
+				i++;
+			else
+			{
+				printf("pihole-FTL: invalid option -- '%s'\nTry '%s --help' for more information\n", argv[i], argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		// Need to get dns.port and the long-term database
+		readFTLconf(&config, false);
+		exit(run_dns_bench(&opts));
+	}
+
+	// Simulate candidate block lists against the long-term database
+	if(argc > 1 && strcmp(argv[1], "simulate") == 0)
+	{
+		// Enable stdout printing
+		cli_mode = true;
+		struct simulate_opts opts = {
+			.days = SIMULATE_DAYS,
+			.top = SIMULATE_TOP
+		};
+		char **candidates = calloc(argc, sizeof(char*));
+		if(candidates == NULL)
+			exit(EXIT_FAILURE);
+		opts.candidates = candidates;
+		for(int i = 2; i < argc; i++)
+		{
+			if(strcmp(argv[i], "-d") == 0 && i + 1 < argc &&
+			   sscanf(argv[i + 1], "%u", &opts.days) == 1 && opts.days > 0)
+				i++;
+			else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%u", &opts.threads) == 1 && opts.threads > 0)
+				i++;
+			else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%u", &opts.top) == 1)
+				i++;
+			else if(argv[i][0] != '-')
+				candidates[opts.num_candidates++] = argv[i];
+			else
+			{
+				printf("pihole-FTL: invalid option -- '%s'\nTry '%s --help' for more information\n", argv[i], argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(opts.num_candidates == 0)
+		{
+			printf("pihole-FTL: need at least one candidate list\nTry '%s --help' for more information\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+
+		// Need to get the paths of the databases
+		log_ctrl(false, false);
+		readFTLconf(&config, false);
+		log_ctrl(false, true);
+		exit(run_simulation(&opts));
+	}
+
+	// Replay queries from the long-term database
+	if(argc > 1 && strcmp(argv[1], "replay") == 0)
+	{
+		// Enable stdout printing
+		cli_mode = true;
+		struct dns_bench_opts opts = {
+			.replay = true,
+			.from = -1.0,
+			.until = -1.0,
+			.speed = DNS_REPLAY_SPEED
+		};
+		for(int i = 2; i < argc; i++)
+		{
+			if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+				opts.server = argv[++i];
+			else if(strcmp(argv[i], "-c") == 0)
+				opts.ecs = true;
+			else if(strcmp(argv[i], "--tcp") == 0)
+				opts.tcp = true;
+			else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%lf", &opts.from) == 1 && opts.from >= 0.0)
+				i++;
+			else if(strcmp(argv[i], "-u") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%lf", &opts.until) == 1 && opts.until >= 0.0)
+				i++;
+			else if(strcmp(argv[i], "-x") == 0 && i + 1 < argc &&
+			        sscanf(argv[i + 1], "%lf", &opts.speed) == 1 && opts.speed > 0.0)
+				i++;
+			else
+			{
+				printf("pihole-FTL: invalid option -- '%s'\nTry '%s --help' for more information\n", argv[i], argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		// The window ends now and lasts one hour unless given otherwise
+		if(opts.until < 0.0)
+			opts.until = opts.from < 0.0 ? double_time() : opts.from + DNS_REPLAY_WINDOW;
+		if(opts.from < 0.0)
+			opts.from = opts.until - DNS_REPLAY_WINDOW;
+		if(opts.from >= opts.until)
+		{
+			printf("pihole-FTL: the replay window must not be empty\n");
+			exit(EXIT_FAILURE);
+		}
+
+		// Need to get dns.port and the long-term database
+		readFTLconf(&config, false);
+		exit(run_dns_bench(&opts));
 	}
 
 	// IDN2 conversion mode
@@ -537,6 +734,14 @@ void parse_args(int argc, char *argv[])
 		}
 	}
 
+	// Binary query log decoder
+	if(argc == 3 && strcmp(argv[1], "querylog") == 0)
+	{
+		// Enable stdout printing
+		cli_mode = true;
+		exit(decode_querylog(argv[2]));
+	}
+
 	// sha256sum mode
 	if(argc == 3 && strcmp(argv[1], "sha256sum") == 0)
 	{
@@ -968,6 +1173,60 @@ void parse_args(int argc, char *argv[])
 			}
 		}
 
+		// Regex benchmark mode
+		if(strcmp(argv[i], "regex-bench") == 0)
+		{
+			// Enable stdout printing
+			cli_mode = true;
+			unsigned int threads = 0;
+			if(argc == i + 3 && (sscanf(argv[i + 2], "%u", &threads) != 1 || threads == 0))
+			{
+				printf("pihole-FTL: invalid number of threads '%s'\n", argv[i + 2]);
+				exit(EXIT_FAILURE);
+			}
+			if(argc == i + 2 || argc == i + 3)
+				exit(regex_bench(debug_mode, quiet, argv[i + 1], threads));
+			else
+			{
+				printf("pihole-FTL: invalid option -- '%s' need either one or two parameters\nTry '%s --help' for more information\n", argv[i], argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		// EDNS(0) parser benchmark and fuzzing mode
+		if(strcmp(argv[i], "edns0-bench") == 0)
+		{
+			// Enable stdout printing
+			cli_mode = true;
+			unsigned int rounds = 0;
+			if(argc == i + 3 && (sscanf(argv[i + 2], "%u", &rounds) != 1 || rounds == 0))
+			{
+				printf("pihole-FTL: invalid number of rounds '%s'\n", argv[i + 2]);
+				exit(EXIT_FAILURE);
+			}
+			if(argc == i + 2 || argc == i + 3)
+				exit(edns0_bench(debug_mode, quiet, argv[i + 1], rounds));
+			else
+			{
+				printf("pihole-FTL: invalid option -- '%s' need either one or two parameters\nTry '%s --help' for more information\n", argv[i], argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		// Domain validation benchmark mode
+		if(strcmp(argv[i], "domain-bench") == 0)
+		{
+			// Enable stdout printing
+			cli_mode = true;
+			if(argc == i + 2)
+				exit(domain_bench(argv[i + 1]));
+			else
+			{
+				printf("pihole-FTL: invalid option -- '%s' needs exactly one parameter\nTry '%s --help' for more information\n", argv[i], argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+
 		// List of implemented arguments
 		if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "help") == 0 || strcmp(argv[i], "--help") == 0)
 		{
@@ -1004,6 +1263,24 @@ void parse_args(int argc, char *argv[])
 			printf("    to test %ssomebad.domain%s against %sbad%s\n\n", blue, normal, cyan, normal);
 			printf("    An optional %s-q%s prevents any output (exit code testing):\n", purple, normal);
 			printf("    %s%s %s-q%s regex-test %ssomebad.domain %sbad%s\n\n", green, argv[0], purple, green, blue, cyan, normal);
+			printf("\t%sregex-bench %sfile%s    Match all domains in %sfile%s (one per\n", green, blue, normal, blue, normal);
+			printf("\t                    line) against all regular expressions\n");
+			printf("\t                    in the database and report the slowest\n");
+			printf("\t                    expressions\n");
+			printf("\t%sregex-bench %sfile %sn%s  Same using %sn%s threads (default: one\n", green, blue, cyan, normal, cyan, normal);
+			printf("\t                    per CPU)\n\n");
+
+			printf("%sEDNS(0) parser benchmark:%s\n", yellow, normal);
+			printf("\t%sedns0-bench %sfile%s    Parse all OPT records in %sfile%s (hex,\n", green, blue, normal, blue, normal);
+			printf("\t                    one per line) repeatedly and then\n");
+			printf("\t                    randomly mutated copies of them\n");
+			printf("\t%sedns0-bench %sfile %sn%s  Same with %sn%s rounds per record\n", green, blue, cyan, normal, cyan, normal);
+			printf("\t                    (default: 100000)\n\n");
+
+			printf("%sDomain validation benchmark:%s\n", yellow, normal);
+			printf("\t%sdomain-bench %sfile%s   Validate all domains in %sfile%s (one\n", green, blue, normal, blue, normal);
+			printf("\t                    per line) byte by byte and vectorized\n");
+			printf("\t                    and compare the results\n\n");
 
 			printf("%sEmbedded Lua engine:%s\n", yellow, normal);
 			printf("\t%s--lua%s, %slua%s          FTL's lua interpreter\n", green, normal, green, normal);
@@ -1073,7 +1350,7 @@ void parse_args(int argc, char *argv[])
 			printf("\t%s--config %skey %svalue%s  Set new %svalue%s of config item %skey%s\n\n", green, blue, cyan, normal, cyan, normal, blue, normal);
 
 			printf("%sEmbedded GZIP un-/compressor:%s\n", yellow, normal);
-			printf("    A simple but fast in-memory gzip compressor\n\n");
+			printf("    A simple but fast multi-threaded gzip compressor\n\n");
 			printf("    Usage: %s%s --gzip %sinfile %s[outfile]%s\n\n", green, argv[0], cyan, purple, normal);
 			printf("    - %sinfile%s is the file to be processed. If the filename ends\n", cyan, normal);
 			printf("      in %s.gz%s, FTL will uncompress, otherwise it will compress\n\n", yellow, normal);
@@ -1117,6 +1394,16 @@ void parse_args(int argc, char *argv[])
 			printf("    gravity filters. The expected input format is one domain\n");
 			printf("    per line (no HOSTS lists, etc.)\n\n");
 			printf("    Usage: %s%s gravity checkList %sinfile%s\n\n", green, argv[0], cyan, normal);
+			printf("    Update the domains of an adlist in an existing gravity\n");
+			printf("    database. Nothing is done if the list did not change since\n");
+			printf("    it has been parsed last, otherwise only the domains added\n");
+			printf("    to or removed from the list are written.\n\n");
+			printf("    Usage: %s%s gravity updateList %sinfile database adlistID%s\n\n", green, argv[0], cyan, normal);
+			printf("    Compile the blocking index of a gravity database and write\n");
+			printf("    it to a file (default: database.idx). FTL loads this file\n");
+			printf("    instead of compiling the index as long as the database is\n");
+			printf("    not modified afterwards.\n\n");
+			printf("    Usage: %s%s gravity compileIndex %sdatabase %s[outfile]%s\n\n", green, argv[0], cyan, purple, normal);
 
 			printf("%sIDN2 conversion:%s\n", yellow, normal);
 			printf("    Convert a given internationalized domain name (IDN) to\n");
@@ -1143,14 +1430,59 @@ void parse_args(int argc, char *argv[])
 			printf("\t%sverify%s              Verify the integrity of the FTL binary\n", green, normal);
 			printf("\t%sptr %sIP%s %s[tcp]%s        Resolve IP address to hostname\n", green, cyan, normal, purple, normal);
 			printf("\t                    Append %stcp%s to use TCP instead of UDP\n", purple, normal);
+			printf("\t%squerylog %sfile%s       Decode a binary query log into JSON\n", green, cyan, normal);
+			printf("\t                    lines\n");
 			printf("\t%sdhcp-discover%s       Discover DHCP servers in the local\n", green, normal);
 			printf("\t                    network\n");
+			printf("\t%sbench dns%s           Send DNS queries at a fixed rate and\n", green, normal);
+			printf("\t                    report the latency by query status\n");
+			printf("\t                    Append %s-f file%s to replay the domains\n", cyan, normal);
+			printf("\t                    in %sfile%s (optionally followed by the\n", cyan, normal);
+			printf("\t                    query type), otherwise %s-d n%s queries\n", cyan, normal);
+			printf("\t                    are sampled from the long-term\n");
+			printf("\t                    database (default: 10000)\n");
+			printf("\t                    Append %s-r n%s to send n queries per\n", cyan, normal);
+			printf("\t                    second (default: 1000) for %s-t n%s\n", cyan, normal);
+			printf("\t                    seconds (default: 10)\n");
+			printf("\t                    Append %s-c n%s to spread the queries\n", cyan, normal);
+			printf("\t                    over n clients using ECS (or MAC\n");
+			printf("\t                    addresses with %s-m%s)\n", cyan, normal);
+			printf("\t                    Append %s-s ip[#port]%s to query another\n", cyan, normal);
+			printf("\t                    server and %s--tcp%s to use TCP\n", cyan, normal);
+			printf("\t%sreplay%s              Replay queries from the long-term\n", green, normal);
+			printf("\t                    database with their original timing\n");
+			printf("\t                    and report the latency by query status\n");
+			printf("\t                    Append %s-f time%s and/or %s-u time%s to\n", cyan, normal, cyan, normal);
+			printf("\t                    replay the queries from/until the\n");
+			printf("\t                    given Unix times (default: the last\n");
+			printf("\t                    hour)\n");
+			printf("\t                    Append %s-x n%s to replay n times faster\n", cyan, normal);
+			printf("\t                    Append %s-c%s to send the queries from\n", cyan, normal);
+			printf("\t                    their original clients using ECS\n");
+			printf("\t                    Append %s-s ip[#port]%s to query another\n", cyan, normal);
+			printf("\t                    server and %s--tcp%s to use TCP\n", cyan, normal);
+			printf("\t%ssimulate %slist ...%s   Report which queries of the last days\n", green, cyan, normal);
+			printf("\t                    would have been blocked by the given\n");
+			printf("\t                    candidate lists without changing the\n");
+			printf("\t                    live configuration. Lists are given\n");
+			printf("\t                    as %sadlist:id%s, %sdomain:domain%s,\n", cyan, normal, cyan, normal);
+			printf("\t                    %sfile:path%s (domains, HOSTS or ABP\n", cyan, normal);
+			printf("\t                    format), or %sregex:regex%s\n", cyan, normal);
+			printf("\t                    Append %s-d n%s to evaluate the last n\n", cyan, normal);
+			printf("\t                    days (default: 7), %s-t n%s to use n\n", cyan, normal);
+			printf("\t                    threads (default: one per CPU), and\n");
+			printf("\t                    %s-n n%s to list the top n domains and\n", cyan, normal);
+			printf("\t                    clients (default: 10)\n");
 			printf("\t%sarp-scan %s[-a/-x]%s    Use ARP to scan local network for\n", green, cyan, normal);
 			printf("\t                    possible IP conflicts\n");
 			printf("\t                    Append %s-a%s to force scan on all\n", cyan, normal);
 			printf("\t                    interfaces\n");
 			printf("\t                    Append %s-x%s to force scan on all\n", cyan, normal);
 			printf("\t                    interfaces and scan 10x more often\n");
+			printf("\t                    Append %s-r n%s to send n requests per\n", cyan, normal);
+			printf("\t                    second and interface (default: 5000)\n");
+			printf("\t                    Append %s-n%s to add found devices to\n", cyan, normal);
+			printf("\t                    the neighbor cache (network table)\n");
 			printf("\t%s--totp%s              Generate valid TOTP token for 2FA\n", green, normal);
 			printf("\t                    authentication (if enabled)\n");
 			printf("\t%s--perf%s              Run performance-tests based on the\n", green, normal);
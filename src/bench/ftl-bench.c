@@ -0,0 +1,1171 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Micro-benchmarks of core data structures and hot functions
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#define FTLDNS
+#include "dnsmasq/dnsmasq.h"
+#undef __USE_XOPEN
+#include "FTL.h"
+#include "main.h"
+#include "log.h"
+// getUserName(), init_locale()
+#include "daemon.h"
+// struct config, readFTLconf()
+#include "config/config.h"
+// init_shmem(), shm_ensure_size()
+#include "shmem.h"
+// hashStr(), findDomainID(), findClientID(), findClientIDaddr()
+#include "datastructure.h"
+// lookup_insert(), lookup_find_id()
+#include "lookup-table.h"
+// in_gravity(), gen_abp_patterns()
+#include "database/gravity-db.h"
+// in_regex(), read_regex_from_database()
+#include "regex_r.h"
+// _FTL_make_answer()
+#include "dnsmasq_interface.h"
+// json_formatter()
+#include "webserver/http-common.h"
+// cbor_add_item()
+#include "webserver/cbor.h"
+// pihole_sqlite3_initalize()
+#include "database/sqlite3-ext.h"
+// git_version()
+#include "version.h"
+
+// Globals otherwise defined in main.c
+char *username;
+bool startup = true;
+bool forked = false;
+jmp_buf exit_jmp;
+
+// Defaults of the command line options
+#define BENCH_DOMAINS 65536u
+#define BENCH_RUNS 5u
+
+// Clients the domains are spread over
+#define BENCH_CLIENTS 256u
+
+// Distinct DNS queries and log lines prepared for _FTL_make_answer() and
+// add_to_fifo_buffer()
+#define BENCH_PACKETS 256u
+
+// Queries contained in the serialized API responses
+#define BENCH_API_QUERIES 100u
+
+// Elements of the lookup table check (IDs are indices into a pool of this
+// size), the number of distinct hashes shared by half of them, and the number
+// of operations between two simulated garbage collection runs
+#define CHECK_LOOKUP_IDS 8192u
+#define CHECK_LOOKUP_HASHES 64u
+#define CHECK_LOOKUP_GC 2048u
+
+struct ftl_bench {
+	const char *name;
+	// Operations per run are the number of domains divided by this
+	unsigned int div;
+	// Returns NULL when ready or why the benchmark cannot be run
+	const char *(*setup)(void);
+	// Runs n operations. The returned value depends on all results so the
+	// compiler cannot optimize the calls away
+	uint64_t (*run)(const size_t n);
+};
+
+static size_t num_domains = BENCH_DOMAINS;
+static char **domains = NULL;
+static uint32_t *hashes = NULL;
+static unsigned int *domainIDs = NULL;
+static char *clientIPs[BENCH_CLIENTS] = { NULL };
+static struct client_addr clientAddrs[BENCH_CLIENTS] = { 0 };
+static clientsData *client = NULL;
+
+// Domains checked against gravity, every other one is taken from gravity
+static char **gravity_domains = NULL;
+
+union packet {
+	struct dns_header header;
+	unsigned char buf[PACKETSZ];
+};
+
+static struct {
+	union packet pkt;
+	size_t len;
+} packets[BENCH_PACKETS];
+
+static struct {
+	char line[MAX_MSG_FIFO];
+	size_t len;
+} loglines[BENCH_PACKETS];
+
+static cJSON *api_response = NULL;
+
+static inline uint64_t bench_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift32, the benchmark data has to be the same on every run
+static uint32_t bench_random(void)
+{
+	static uint32_t state = 0x9E3779B9u;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// Generate distinct domains with a realistic mix of label lengths
+static bool gen_domains(void)
+{
+	static const char *const prefix[] = { "www", "cdn", "api", "static", "img", "ads", "tracker",
+	                                      "mail", "s3", "edge", "telemetry", "clients4" };
+	static const char *const sld[] = { "example", "doubleclick", "googleapis", "akamaiedge",
+	                                   "cloudfront", "facebook", "pi-hole", "github", "ytimg",
+	                                   "amazonaws", "adservice", "microsoft" };
+	static const char *const tld[] = { "com", "net", "org", "io", "de", "co.uk" };
+
+	domains = calloc(num_domains, sizeof(*domains));
+	hashes = calloc(num_domains, sizeof(*hashes));
+	domainIDs = calloc(num_domains, sizeof(*domainIDs));
+	if(domains == NULL || hashes == NULL || domainIDs == NULL)
+		return false;
+
+	for(size_t i = 0; i < num_domains; i++)
+	{
+		const uint32_t r = bench_random();
+		if(asprintf(&domains[i], "%s%zx.%s.%s", prefix[r % ArraySize(prefix)], i,
+		            sld[(r >> 8) % ArraySize(sld)], tld[(r >> 16) % ArraySize(tld)]) < 0)
+			return false;
+		hashes[i] = hashStr(domains[i]);
+	}
+
+	return true;
+}
+
+// Encode a query for <name> IN A
+static size_t put_query(union packet *pkt, const char *name, const uint16_t id)
+{
+	struct dns_header *header = &pkt->header;
+	memset(header, 0, sizeof(*header));
+	header->id = htons(id);
+	header->hb3 = HB3_RD;
+	header->qdcount = htons(1);
+
+	unsigned char *p = (unsigned char *)(header + 1);
+	for(const char *label = name; *label != '\0';)
+	{
+		const char *dot = strchr(label, '.');
+		const size_t len = dot != NULL ? (size_t)(dot - label) : strlen(label);
+		*p++ = (unsigned char)len;
+		memcpy(p, label, len);
+		p += len;
+		label += dot != NULL ? len + 1 : len;
+	}
+	*p++ = 0;
+	PUTSHORT(T_A, p);
+	PUTSHORT(C_IN, p);
+
+	return p - pkt->buf;
+}
+
+/********************************** hashStr() *********************************/
+static uint64_t run_hashStr(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+		sum += hashStr(domains[i % num_domains]);
+	return sum;
+}
+
+/************************ lookup_insert(), lookup_find_id() *******************/
+// Compare IDs only so the table itself is measured, not the string comparison
+static bool cmp_id(const struct lookup_table *entry, const struct lookup_data *lookup_data)
+{
+	return entry->id == lookup_data->domainID;
+}
+
+static uint64_t run_lookup_find_id(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		const size_t j = i % num_domains;
+		const struct lookup_data lookup_data = { .domainID = domainIDs[j] };
+		unsigned int id = 0;
+		if(lookup_find_id(DOMAINS_LOOKUP, hashes[j], &lookup_data, &id, cmp_id))
+			sum += id;
+	}
+	return sum;
+}
+
+// The element is removed first so the table keeps its size, the operation
+// measured is one removal and one insertion
+static uint64_t run_lookup_insert(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		const size_t j = i % num_domains;
+		lookup_remove(DOMAINS_LOOKUP, domainIDs[j], hashes[j]);
+		sum += lookup_insert(DOMAINS_LOOKUP, domainIDs[j], hashes[j]);
+	}
+	return sum;
+}
+
+/************ _findDomainID(), _findClientID(), _findClientIDaddr() ***********/
+static uint64_t run_findDomainID(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		const size_t j = i % num_domains;
+		sum += findHashedDomainID(domains[j], hashes[j], false);
+	}
+	return sum;
+}
+
+static uint64_t run_findClientID(const size_t n)
+{
+	uint64_t sum = 0;
+	const double now = double_time();
+	for(size_t i = 0; i < n; i++)
+		sum += findClientID(clientIPs[i % BENCH_CLIENTS], false, false, now);
+	return sum;
+}
+
+static uint64_t run_findClientIDaddr(const size_t n)
+{
+	uint64_t sum = 0;
+	const double now = double_time();
+	for(size_t i = 0; i < n; i++)
+		sum += findClientIDaddr(&clientAddrs[i % BENCH_CLIENTS], false, now);
+	return sum;
+}
+
+/*************************** in_gravity(), in_regex() *************************/
+static const char *setup_gravity(void)
+{
+	if(!gravityDB_prepare_client_statements(client))
+		return "gravity database not available";
+
+	gravity_domains = calloc(num_domains, sizeof(*gravity_domains));
+	if(gravity_domains == NULL)
+		return "out of memory";
+
+	// Take every other domain from gravity so we see both hits and misses
+	size_t i = 0;
+	if(gravityDB_getTable(GRAVITY_TABLE))
+	{
+		const char *domain = NULL;
+		for(i = 0; 2*i + 1 < num_domains && (domain = gravityDB_getDomain(NULL)) != NULL; i++)
+			gravity_domains[2*i] = strdup(domain);
+		gravityDB_finalizeTable();
+	}
+	for(size_t j = 0; j < num_domains; j++)
+		if(gravity_domains[j] == NULL)
+			gravity_domains[j] = strdup(domains[j]);
+
+	return NULL;
+}
+
+// domain_in_list() is not called directly but as it is during the blocking
+// decision: after the prefilter and without the compiled index
+static uint64_t run_in_gravity(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		int domain_id = -1;
+		sum += in_gravity(gravity_domains[i % num_domains], client, false, &domain_id) == FOUND;
+	}
+	return sum;
+}
+
+static const char *setup_regex(void)
+{
+	if(gravity_domains == NULL)
+		return "gravity database not available";
+
+	read_regex_from_database();
+	if(get_num_regex(REGEX_DENY) + get_num_regex(REGEX_ALLOW) == 0)
+		return "no regex filters";
+
+	return NULL;
+}
+
+// With the default number of domains, they outnumber the memo by far so
+// nearly all evaluations end up in match_regex()
+static uint64_t run_in_regex(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		DNSCacheData dns_cache = { .query_type = TYPE_A, .list_id = -1 };
+		sum += in_regex(gravity_domains[i % num_domains], &dns_cache, client->id, REGEX_DENY);
+	}
+	return sum;
+}
+
+/****************************** gen_abp_patterns() ****************************/
+static uint64_t run_gen_abp_patterns(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		cJSON *patterns = gen_abp_patterns(domains[i % num_domains], false);
+		sum += cJSON_GetArraySize(patterns);
+		cJSON_Delete(patterns);
+	}
+	return sum;
+}
+
+/****************************** _FTL_make_answer() ****************************/
+static const char *setup_make_answer(void)
+{
+	// dnsmasq is not running, its settings are all zero
+	if(daemon == NULL && (daemon = calloc(1, sizeof(*daemon))) == NULL)
+		return "out of memory";
+
+	for(unsigned int i = 0; i < BENCH_PACKETS; i++)
+		packets[i].len = put_query(&packets[i].pkt, domains[i % num_domains], i);
+
+	return NULL;
+}
+
+// The query is copied first as the answer is written into the same buffer
+static uint64_t run_make_answer(const size_t n)
+{
+	uint64_t sum = 0;
+	union packet answer;
+	for(size_t i = 0; i < n; i++)
+	{
+		const unsigned int j = i % BENCH_PACKETS;
+		memcpy(answer.buf, packets[j].pkt.buf, packets[j].len);
+		unsigned char ede_data[MAX_EDE_DATA];
+		size_t ede_len = 0;
+		sum += FTL_make_answer(&answer.header, (char *)answer.buf + sizeof(answer.buf),
+		                       packets[j].len, ede_data, &ede_len);
+	}
+	return sum;
+}
+
+/***************************** add_to_fifo_buffer() ***************************/
+static const char *setup_fifo(void)
+{
+	for(unsigned int i = 0; i < BENCH_PACKETS; i++)
+	{
+		const int len = snprintf(loglines[i].line, sizeof(loglines[i].line),
+		                         "query[A] %s from %s\n", domains[i % num_domains],
+		                         clientIPs[i % BENCH_CLIENTS]);
+		loglines[i].len = len > 0 ? (size_t)len : 0u;
+	}
+
+	return NULL;
+}
+
+static uint64_t run_add_to_fifo_buffer(const size_t n)
+{
+	for(size_t i = 0; i < n; i++)
+	{
+		const unsigned int j = i % BENCH_PACKETS;
+		add_to_fifo_buffer(FIFO_DNSMASQ, loglines[j].line, NULL, loglines[j].len);
+	}
+	return fifo_log->logs[FIFO_DNSMASQ].next_id;
+}
+
+/******************************** extract_name() ******************************/
+// DNS messages the names are extracted from, either taken from a capture or
+// generated
+static struct dns_message {
+	unsigned char *buf;
+	size_t len;
+} *messages = NULL;
+static size_t num_messages = 0;
+
+// Messages taken from a capture at most
+#define BENCH_MAX_MESSAGES 65536u
+
+static bool add_message(const unsigned char *buf, const size_t len)
+{
+	if(len < sizeof(struct dns_header) || num_messages >= BENCH_MAX_MESSAGES)
+		return false;
+
+	struct dns_message *msgs = realloc(messages, (num_messages + 1) * sizeof(*messages));
+	if(msgs == NULL)
+		return false;
+	messages = msgs;
+
+	if((messages[num_messages].buf = malloc(len)) == NULL)
+		return false;
+	memcpy(messages[num_messages].buf, buf, len);
+	messages[num_messages].len = len;
+	num_messages++;
+
+	return true;
+}
+
+static uint32_t pcap_u32(const unsigned char *p, const bool swapped)
+{
+	const uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+	return swapped ? __builtin_bswap32(v) : v;
+}
+
+// Add the payload of a captured frame if it is a UDP datagram from or to
+// port 53. Frames of other protocols, IP fragments and IPv6 extension headers
+// are skipped
+static void add_frame(const unsigned char *frame, size_t len, const uint32_t linktype)
+{
+	unsigned int ethertype = 0;
+	switch(linktype)
+	{
+		case 1: // Ethernet
+			if(len < 14)
+				return;
+			ethertype = frame[12] << 8 | frame[13];
+			frame += 14, len -= 14;
+			while((ethertype == 0x8100 || ethertype == 0x88a8) && len >= 4)
+			{
+				ethertype = frame[2] << 8 | frame[3];
+				frame += 4, len -= 4;
+			}
+			break;
+		case 113: // Linux cooked capture
+			if(len < 16)
+				return;
+			ethertype = frame[14] << 8 | frame[15];
+			frame += 16, len -= 16;
+			break;
+		case 276: // Linux cooked capture v2
+			if(len < 20)
+				return;
+			ethertype = frame[0] << 8 | frame[1];
+			frame += 20, len -= 20;
+			break;
+		case 12: case 101: case 228: case 229: // Raw IP
+			if(len < 1)
+				return;
+			ethertype = (frame[0] >> 4) == 6 ? 0x86dd : 0x0800;
+			break;
+		default:
+			return;
+	}
+
+	if(ethertype == 0x0800 && len >= 20 && (frame[0] >> 4) == 4)
+	{
+		const size_t ihl = (frame[0] & 0x0f) * 4u;
+		// UDP, not fragmented
+		if(frame[9] != 17 || (frame[6] & 0x3f) != 0 || frame[7] != 0 || ihl < 20 || len < ihl)
+			return;
+		frame += ihl, len -= ihl;
+	}
+	else if(ethertype == 0x86dd && len >= 40 && (frame[0] >> 4) == 6)
+	{
+		if(frame[6] != 17)
+			return;
+		frame += 40, len -= 40;
+	}
+	else
+		return;
+
+	if(len < 8)
+		return;
+	const unsigned int sport = frame[0] << 8 | frame[1], dport = frame[2] << 8 | frame[3];
+	const size_t udplen = frame[4] << 8 | frame[5];
+	if((sport != NAMESERVER_PORT && dport != NAMESERVER_PORT) || udplen < 8 || udplen > len)
+		return;
+
+	add_message(frame + 8, udplen - 8);
+}
+
+// Load the DNS messages of a capture in pcap format (as written by tcpdump)
+static const char *load_capture(const char *file)
+{
+	FILE *fp = fopen(file, "rb");
+	if(fp == NULL)
+		return strerror(errno);
+
+	const char *err = NULL;
+	unsigned char hdr[24];
+	unsigned char *frame = malloc(UINT16_MAX + 1);
+	if(frame == NULL)
+		err = "out of memory";
+	else if(fread(hdr, sizeof(hdr), 1, fp) != 1)
+		err = "not a pcap file";
+	else
+	{
+		// Microsecond or nanosecond timestamps, either byte order
+		const uint32_t magic = pcap_u32(hdr, false);
+		const bool swapped = magic == 0xd4c3b2a1u || magic == 0x4d3cb2a1u;
+		if(!swapped && magic != 0xa1b2c3d4u && magic != 0xa1b23c4du)
+			err = "not a pcap file (pcapng is not supported)";
+		const uint32_t linktype = pcap_u32(hdr + 20, swapped) & 0xffff;
+
+		unsigned char rec[16];
+		while(err == NULL && fread(rec, sizeof(rec), 1, fp) == 1)
+		{
+			const uint32_t caplen = pcap_u32(rec + 8, swapped);
+			if(caplen > UINT16_MAX + 1)
+				err = "frame too large";
+			else if(fread(frame, 1, caplen, fp) != caplen)
+				break;
+			else
+				add_frame(frame, caplen, linktype);
+		}
+	}
+
+	fclose(fp);
+	free(frame);
+
+	if(err == NULL && num_messages == 0)
+		err = "no DNS messages found";
+	return err;
+}
+
+// Replies to the generated queries following a CNAME to a long hostname on a
+// CDN as it is typical for tracking and ad domains
+static bool gen_messages(void)
+{
+	for(unsigned int i = 0; i < BENCH_PACKETS; i++)
+	{
+		union packet pkt;
+		size_t len = put_query(&pkt, domains[i % num_domains], i);
+		struct dns_header *header = &pkt.header;
+		header->hb3 |= HB3_QR;
+		header->ancount = htons(2);
+
+		// <owner> CNAME <target>, the owner points to the question
+		unsigned char *p = pkt.buf + len;
+		PUTSHORT(0xc000 | sizeof(struct dns_header), p);
+		PUTSHORT(T_CNAME, p);
+		PUTSHORT(C_IN, p);
+		PUTLONG(300, p);
+		unsigned char *rdlen = p;
+		p += 2;
+		const size_t target = p - pkt.buf;
+		// Hashed labels of 20 to 40 characters
+		const unsigned int labellen = 20u + bench_random() % 21u;
+		*p++ = labellen;
+		for(unsigned int j = 0; j < labellen; j++)
+			*p++ = "0123456789abcdef"[bench_random() % 16u];
+		static const char cdn[] = "\x04""edge\x0a""cloudfront\x03""net";
+		memcpy(p, cdn, sizeof(cdn));
+		p += sizeof(cdn);
+		PUTSHORT(p - rdlen - 2, rdlen);
+
+		// <target> A 192.0.2.x
+		PUTSHORT(0xc000 | target, p);
+		PUTSHORT(T_A, p);
+		PUTSHORT(C_IN, p);
+		PUTLONG(60, p);
+		PUTSHORT(INADDRSZ, p);
+		*p++ = 192, *p++ = 0, *p++ = 2, *p++ = i & 0xff;
+
+		len = p - pkt.buf;
+		if(!add_message(pkt.buf, len))
+			return false;
+	}
+
+	return true;
+}
+
+static const char *setup_extract_name(void)
+{
+	if(num_messages == 0 && !gen_messages())
+		return "out of memory";
+	return NULL;
+}
+
+// Process the names of a DNS message the way replies are processed: each
+// record is compared to the name the CNAMEs followed so far lead to, CNAME
+// targets are extracted. Returns a value depending on all results
+static uint64_t walk_names(struct dns_message *msg, const bool compare)
+{
+	// malloc()ed, hence aligned
+	struct dns_header *header = (struct dns_header *)(void *)msg->buf;
+	char name[MAXDNAME*2], target[MAXDNAME*2];
+	unsigned char *p = (unsigned char *)(header + 1);
+	uint64_t sum = 0;
+
+	if(ntohs(header->qdcount) != 1 ||
+	   !extract_name(header, msg->len, &p, target, EXTR_NAME_EXTRACT, 4))
+		return 0;
+	p += 4;
+
+	const unsigned int rrs = ntohs(header->ancount) + ntohs(header->nscount) + ntohs(header->arcount);
+	for(unsigned int i = 0; i < rrs; i++)
+	{
+		const int rc = compare ?
+			extract_name(header, msg->len, &p, target, EXTR_NAME_COMPARE, 10) :
+			extract_name(header, msg->len, &p, name, EXTR_NAME_EXTRACT, 10);
+		if(rc == 0)
+			break;
+		sum += rc;
+
+		unsigned short type, rdlen;
+		GETSHORT(type, p);
+		p += 6;
+		GETSHORT(rdlen, p);
+		if(!CHECK_LEN(header, p, msg->len, rdlen))
+			break;
+
+		unsigned char *rdata = p;
+		if((type == T_CNAME || type == T_NS || type == T_PTR) &&
+		   extract_name(header, msg->len, &rdata, compare ? target : name, EXTR_NAME_EXTRACT, 0))
+			sum += strlen(compare ? target : name);
+		p += rdlen;
+	}
+
+	return sum;
+}
+
+static uint64_t run_names(const size_t n, const bool compare, const int vector)
+{
+	uint64_t sum = 0;
+	extract_name_vector = vector;
+	for(size_t i = 0; i < n; i++)
+		sum += walk_names(&messages[i % num_messages], compare);
+	extract_name_vector = 1;
+	return sum;
+}
+
+static uint64_t run_extract_name(const size_t n)
+{
+	return run_names(n, false, 1);
+}
+
+static uint64_t run_extract_name_scalar(const size_t n)
+{
+	return run_names(n, false, 0);
+}
+
+static uint64_t run_compare_name(const size_t n)
+{
+	return run_names(n, true, 1);
+}
+
+static uint64_t run_compare_name_scalar(const size_t n)
+{
+	return run_names(n, true, 0);
+}
+
+// Messages of any size received over UDP
+union fuzz_packet {
+	struct dns_header header;
+	unsigned char buf[UINT16_MAX];
+};
+
+// Call extract_name() with and without the vector code on the same input,
+// returns false if anything differs
+static bool same_extract_name(const union fuzz_packet *pkt, union fuzz_packet *buf, const size_t len,
+                              const size_t offset, char *name, const int func, const unsigned int parm)
+{
+	char out[2][MAXDNAME*2];
+	unsigned char *pos[2];
+	int rc[2];
+	for(int vector = 0; vector < 2; vector++)
+	{
+		memcpy(buf->buf, pkt->buf, len);
+		if(func == EXTR_NAME_EXTRACT)
+			memset(out[vector], 0xaa, sizeof(out[vector]));
+		else
+			strcpy(out[vector], name);
+		pos[vector] = buf->buf + offset;
+		extract_name_vector = vector;
+		rc[vector] = extract_name(&buf->header, len, &pos[vector], out[vector], func, parm);
+	}
+	extract_name_vector = 1;
+
+	return rc[0] == rc[1] && pos[0] == pos[1] && memcmp(out[0], out[1], sizeof(out[0])) == 0;
+}
+
+// Mutate the messages and compare the results of extract_name() with and
+// without the vector code at random positions. Returns the number of inputs
+// for which they differ
+static unsigned long fuzz_extract_name(const unsigned long iterations, unsigned long *checks)
+{
+	static union fuzz_packet pkt, buf;
+	unsigned long mismatches = 0;
+	for(unsigned long i = 0; i < iterations; i++)
+	{
+		const struct dns_message *msg = &messages[bench_random() % num_messages];
+		size_t len = min(msg->len, sizeof(pkt.buf));
+		memcpy(pkt.buf, msg->buf, len);
+
+		// Flip the case of letters, change random bytes (also to the
+		// characters needing escapes) and cut the message short
+		const unsigned int mutations = bench_random() % 8u;
+		for(unsigned int m = 0; m < mutations && len > sizeof(struct dns_header); m++)
+		{
+			const size_t at = sizeof(struct dns_header) + bench_random() % (len - sizeof(struct dns_header));
+			static const unsigned char special[] = { 0, '.', NAME_ESCAPE, 0xc0, 63, 'A', 'z' };
+			const uint32_t r = bench_random();
+			if(r % 4u == 0)
+				pkt.buf[at] = special[(r >> 8) % sizeof(special)];
+			else if(r % 4u == 1)
+				pkt.buf[at] = r >> 8;
+			else if(isalpha(pkt.buf[at]))
+				pkt.buf[at] ^= 0x20;
+		}
+		if(bench_random() % 8u == 0)
+			len -= bench_random() % (len - sizeof(struct dns_header) + 1);
+
+		// The question and a random position
+		for(unsigned int k = 0; k < 2 && len > sizeof(struct dns_header); k++)
+		{
+			const size_t offset = k == 0 ? sizeof(struct dns_header) :
+				sizeof(struct dns_header) + bench_random() % (len - sizeof(struct dns_header));
+			char name[MAXDNAME*2] = "";
+			memcpy(buf.buf, pkt.buf, len);
+			unsigned char *p = buf.buf + offset;
+			extract_name_vector = 0;
+			const bool valid = extract_name(&buf.header, len, &p, name, EXTR_NAME_EXTRACT, 0) != 0;
+			extract_name_vector = 1;
+
+			mismatches += !same_extract_name(&pkt, &buf, len, offset, NULL, EXTR_NAME_EXTRACT, 4);
+			(*checks)++;
+			if(!valid)
+				continue;
+
+			// Compare against the name itself, a name differing in case
+			// or in one character and a prefix of it
+			const size_t namelen = strlen(name);
+			const uint32_t r = bench_random();
+			if(namelen > 0 && r % 4u == 1)
+				name[(r >> 8) % namelen] ^= 0x20;
+			else if(namelen > 0 && r % 4u == 2)
+				name[(r >> 8) % namelen] = 'a' + (r >> 16) % 26u;
+			else if(namelen > 0 && r % 4u == 3)
+				name[(r >> 8) % namelen] = '\0';
+			mismatches += !same_extract_name(&pkt, &buf, len, offset, name, EXTR_NAME_COMPARE, 0);
+			mismatches += !same_extract_name(&pkt, &buf, len, offset, name, EXTR_NAME_NOCASE, 0);
+			*checks += 2;
+		}
+	}
+
+	return mismatches;
+}
+
+/****************************** lookup table check ****************************/
+struct check_element {
+	uint32_t hash;
+	bool present;
+	unsigned long inserted;
+};
+
+// Look up one element, it has to be found if and only if it is in the table
+static bool check_element(const struct check_element *elements, const unsigned int id)
+{
+	const struct lookup_data lookup_data = { .domainID = id };
+	unsigned int found = LOOKUP_EMPTY;
+	const bool hit = lookup_find_id(UPSTREAMS_LOOKUP, elements[id].hash, &lookup_data, &found, cmp_id);
+	return hit == elements[id].present && (!hit || found == id);
+}
+
+// Look up all elements and compare the size of the table
+static unsigned long check_all_elements(const struct check_element *elements, unsigned long *checks)
+{
+	unsigned long mismatches = 0;
+	unsigned int present = 0;
+	for(unsigned int id = 0; id < CHECK_LOOKUP_IDS; id++)
+	{
+		mismatches += !check_element(elements, id);
+		present += elements[id].present;
+	}
+	*checks += CHECK_LOOKUP_IDS + 1;
+
+	return mismatches + (present != counters->upstreams_lookup_size);
+}
+
+// Insert, remove and find elements of the upstreams lookup table (unused by the
+// benchmarks) in random order and compare the results with those expected. Half
+// of the elements share a few hashes, so there are long runs of colliding
+// elements backward-shift deletion has to move. The table grows from its
+// initial size while it is filled. Like the garbage collection, all elements
+// inserted more than CHECK_LOOKUP_GC operations ago are removed at once every
+// CHECK_LOOKUP_GC operations, then all elements are looked up. Returns the
+// number of differences
+static unsigned long check_lookup(const unsigned long operations, unsigned long *checks,
+                                  unsigned int capacity[2])
+{
+	struct check_element *elements = calloc(CHECK_LOOKUP_IDS, sizeof(*elements));
+	if(elements == NULL)
+		return 1;
+
+	unsigned long mismatches = 0;
+	capacity[0] = counters->upstreams_lookup_MAX;
+	for(unsigned long i = 1; i <= operations; i++)
+	{
+		const uint32_t r = bench_random();
+		const unsigned int id = (r >> 8) % CHECK_LOOKUP_IDS;
+		struct check_element *element = &elements[id];
+		if(!element->present && r % 4u != 0)
+		{
+			shm_ensure_size();
+			element->hash = bench_random() % 2u ? bench_random() % CHECK_LOOKUP_HASHES : bench_random();
+			element->present = lookup_insert(UPSTREAMS_LOOKUP, id, element->hash);
+			element->inserted = i;
+			mismatches += !element->present;
+		}
+		else if(element->present && r % 4u == 0)
+		{
+			mismatches += !lookup_remove(UPSTREAMS_LOOKUP, id, element->hash);
+			element->present = false;
+		}
+		else
+		{
+			mismatches += !check_element(elements, id);
+			(*checks)++;
+		}
+
+		if(i % CHECK_LOOKUP_GC != 0)
+			continue;
+
+		for(unsigned int j = 0; j < CHECK_LOOKUP_IDS; j++)
+		{
+			if(!elements[j].present || elements[j].inserted + CHECK_LOOKUP_GC >= i)
+				continue;
+			mismatches += !lookup_remove(UPSTREAMS_LOOKUP, j, elements[j].hash);
+			elements[j].present = false;
+		}
+		mismatches += check_all_elements(elements, checks);
+	}
+	mismatches += check_all_elements(elements, checks);
+	capacity[1] = counters->upstreams_lookup_MAX;
+	free(elements);
+
+	return mismatches;
+}
+
+/******************************** API serializers *****************************/
+// Build a response shaped like the one of /api/queries
+static const char *setup_api(void)
+{
+	if(api_response != NULL)
+		return NULL;
+
+	cJSON *queries = cJSON_CreateArray();
+	for(unsigned int i = 0; i < BENCH_API_QUERIES; i++)
+	{
+		cJSON *item = cJSON_CreateObject();
+		cJSON_AddNumberToObject(item, "id", 1234567 + i);
+		cJSON_AddNumberToObject(item, "time", 1760000000.123456 + i);
+		cJSON_AddStringToObject(item, "type", i % 3 ? "A" : "AAAA");
+		cJSON_AddStringToObject(item, "status", i % 4 ? "FORWARDED" : "GRAVITY");
+		cJSON_AddStringToObject(item, "dnssec", "UNKNOWN");
+		cJSON_AddStringToObject(item, "domain", domains[i % num_domains]);
+		if(i % 4)
+			cJSON_AddStringToObject(item, "upstream", "1.1.1.1#53");
+		else
+			cJSON_AddNullToObject(item, "upstream");
+		cJSON *reply = cJSON_CreateObject();
+		cJSON_AddStringToObject(reply, "type", i % 4 ? "IP" : "BLOB");
+		cJSON_AddNumberToObject(reply, "time", 0.0123 * (i % 17));
+		cJSON_AddItemToObject(item, "reply", reply);
+		cJSON_AddNumberToObject(item, "list_id", i % 4 ? -1 : 42);
+		cJSON *client_item = cJSON_CreateObject();
+		cJSON_AddStringToObject(client_item, "ip", clientIPs[i % BENCH_CLIENTS]);
+		cJSON_AddStringToObject(client_item, "name", "laptop.lan");
+		cJSON_AddItemToObject(item, "client", client_item);
+		cJSON *ede = cJSON_CreateObject();
+		cJSON_AddNumberToObject(ede, "code", -1);
+		cJSON_AddNullToObject(ede, "text");
+		cJSON_AddItemToObject(item, "ede", ede);
+		cJSON_AddNullToObject(item, "cname");
+		cJSON_AddItemToArray(queries, item);
+	}
+
+	api_response = cJSON_CreateObject();
+	cJSON_AddItemToObject(api_response, "queries", queries);
+	cJSON_AddNumberToObject(api_response, "cursor", 1234567);
+	cJSON_AddNumberToObject(api_response, "recordsTotal", 98765);
+	cJSON_AddNumberToObject(api_response, "recordsFiltered", 98765);
+	cJSON_AddNumberToObject(api_response, "draw", 1);
+	cJSON_AddNumberToObject(api_response, "took", 0.003);
+
+	return NULL;
+}
+
+static uint64_t run_json_formatter(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		char *json = json_formatter(api_response);
+		sum += json != NULL ? strlen(json) : 0u;
+		free(json);
+	}
+	return sum;
+}
+
+static uint64_t run_cbor_add_item(const size_t n)
+{
+	uint64_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		struct cbor_buffer cbor;
+		if(!cbor_init(&cbor))
+			continue;
+		cbor_add_item(&cbor, api_response);
+		sum += cbor.len;
+		cbor_free(&cbor);
+	}
+	return sum;
+}
+
+static const struct ftl_bench benchmarks[] = {
+	{ "hashStr", 1, NULL, run_hashStr },
+	{ "lookup_find_id", 1, NULL, run_lookup_find_id },
+	{ "lookup_insert", 1, NULL, run_lookup_insert },
+	{ "_findDomainID", 1, NULL, run_findDomainID },
+	{ "_findClientID", 1, NULL, run_findClientID },
+	{ "_findClientIDaddr", 1, NULL, run_findClientIDaddr },
+	{ "in_gravity", 4, setup_gravity, run_in_gravity },
+	{ "in_regex", 4, setup_regex, run_in_regex },
+	{ "gen_abp_patterns", 1, NULL, run_gen_abp_patterns },
+	{ "_FTL_make_answer", 1, setup_make_answer, run_make_answer },
+	{ "add_to_fifo_buffer", 1, setup_fifo, run_add_to_fifo_buffer },
+	{ "extract_name", 1, setup_extract_name, run_extract_name },
+	{ "extract_name_scalar", 1, setup_extract_name, run_extract_name_scalar },
+	{ "compare_name", 1, setup_extract_name, run_compare_name },
+	{ "compare_name_scalar", 1, setup_extract_name, run_compare_name_scalar },
+	{ "json_formatter", 256, setup_api, run_json_formatter },
+	{ "cbor_add_item", 256, setup_api, run_cbor_add_item },
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Populate the shared memory objects the way queries would
+static bool populate_shmem(void)
+{
+	for(size_t i = 0; i < num_domains; i++)
+	{
+		shm_ensure_size();
+		const int domainID = findHashedDomainID(domains[i], hashes[i], true);
+		if(domainID < 0)
+			return false;
+		domainIDs[i] = domainID;
+	}
+
+	const double now = double_time();
+	for(unsigned int i = 0; i < BENCH_CLIENTS; i++)
+	{
+		shm_ensure_size();
+		if(asprintf(&clientIPs[i], "10.%u.%u.%u", i / 64u, (i * 37u) % 256u, 1u + i % 254u) < 0 ||
+		   findClientID(clientIPs[i], true, false, now) < 0 ||
+		   !parse_client_addr(clientIPs[i], &clientAddrs[i]))
+			return false;
+	}
+
+	client = getClient(0, true);
+	return client != NULL;
+}
+
+// Run all (matching) benchmarks, each of them <runs> times
+static cJSON *run_benchmarks(const unsigned int runs, const char *filter, uint64_t *sink)
+{
+	cJSON *results = cJSON_CreateArray();
+	double *ns = calloc(runs, sizeof(*ns));
+	for(unsigned int b = 0; b < ArraySize(benchmarks) && ns != NULL; b++)
+	{
+		const struct ftl_bench *bench = &benchmarks[b];
+		if(filter != NULL && strstr(bench->name, filter) == NULL)
+			continue;
+
+		cJSON *result = cJSON_CreateObject();
+		cJSON_AddStringToObject(result, "name", bench->name);
+		cJSON_AddItemToArray(results, result);
+
+		const char *skipped = bench->setup != NULL ? bench->setup() : NULL;
+		if(skipped != NULL)
+		{
+			cJSON_AddStringToObject(result, "skipped", skipped);
+			continue;
+		}
+
+		// Warm up caches and lazily allocated memory before measuring
+		const size_t ops = num_domains / bench->div;
+		*sink += bench->run(ops);
+		for(unsigned int r = 0; r < runs; r++)
+		{
+			const uint64_t start = bench_nsec();
+			*sink += bench->run(ops);
+			ns[r] = (double)(bench_nsec() - start) / ops;
+		}
+		qsort(ns, runs, sizeof(*ns), cmp_double);
+
+		cJSON_AddNumberToObject(result, "ops", ops);
+		cJSON_AddNumberToObject(result, "min_ns", ns[0]);
+		cJSON_AddNumberToObject(result, "median_ns", ns[runs / 2]);
+		cJSON_AddNumberToObject(result, "max_ns", ns[runs - 1]);
+	}
+	free(ns);
+
+	return results;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n <domains>] [-r <runs>] [-b <benchmark>] [-g <gravity.db>]\n", name);
+	printf("       [-p <capture.pcap>] [-z <iterations>] [-l <operations>]\n\n");
+	printf("Runs micro-benchmarks of FTL's core data structures and hot functions\n");
+	printf("and prints the results as JSON object to stdout.\n\n");
+	printf("  -n <domains>     Number of distinct domains (default %u)\n", BENCH_DOMAINS);
+	printf("  -r <runs>        Repetitions of each benchmark (default %u)\n", BENCH_RUNS);
+	printf("  -b <benchmark>   Run only benchmarks whose name contains this string\n");
+	printf("  -g <gravity.db>  Gravity database to use instead of the configured one\n");
+	printf("  -p <capture>     Extract the names of the DNS messages in this pcap file\n");
+	printf("                   instead of generated replies\n");
+	printf("  -z <iterations>  Check extract_name() with and without vector code on\n");
+	printf("                   this many mutated messages, fails on any difference\n");
+	printf("  -l <operations>  Check the lookup tables with this many random insertions,\n");
+	printf("                   removals and lookups, fails on any difference\n\n");
+	printf("Benchmarks:");
+	for(unsigned int i = 0; i < ArraySize(benchmarks); i++)
+		printf(" %s", benchmarks[i].name);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int runs = BENCH_RUNS;
+	unsigned long fuzz = 0, lookup = 0;
+	const char *filter = NULL, *gravity = NULL, *capture = NULL;
+	for(int i = 1; i < argc; i++)
+	{
+		const bool has_arg = i + 1 < argc;
+		if(strcmp(argv[i], "-n") == 0 && has_arg)
+			num_domains = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "-r") == 0 && has_arg)
+			runs = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "-b") == 0 && has_arg)
+			filter = argv[++i];
+		else if(strcmp(argv[i], "-g") == 0 && has_arg)
+			gravity = argv[++i];
+		else if(strcmp(argv[i], "-p") == 0 && has_arg)
+			capture = argv[++i];
+		else if(strcmp(argv[i], "-z") == 0 && has_arg)
+			fuzz = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "-l") == 0 && has_arg)
+			lookup = strtoul(argv[++i], NULL, 10);
+		else
+		{
+			usage(argv[0]);
+			return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ?
+			       EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if(num_domains < BENCH_PACKETS || runs == 0)
+	{
+		fprintf(stderr, "Need at least %u domains and one run\n", BENCH_PACKETS);
+		return EXIT_FAILURE;
+	}
+
+	// stdout is reserved for the results
+	log_ctrl(false, false);
+	init_locale();
+	username = getUserName();
+	getLogFilePath();
+	readFTLconf(&config, false);
+	clear_debug_flags();
+	pihole_sqlite3_initalize();
+
+	if(gravity != NULL)
+	{
+		if(config.files.gravity.t == CONF_STRING_ALLOCATED)
+			free(config.files.gravity.v.s);
+		config.files.gravity.v.s = strdup(gravity);
+		config.files.gravity.t = CONF_STRING_ALLOCATED;
+	}
+
+	// Never touch the long-term database, new clients look up their
+	// alias-clients in it
+	if(config.files.database.t == CONF_STRING_ALLOCATED)
+		free(config.files.database.v.s);
+	config.files.database.v.s = strdup(":memory:");
+	config.files.database.t = CONF_STRING_ALLOCATED;
+
+	if(!init_shmem())
+	{
+		fprintf(stderr, "Initialization of shared memory failed\n");
+		return EXIT_FAILURE;
+	}
+
+	int ret = EXIT_FAILURE;
+	if(!gen_domains() || !populate_shmem())
+	{
+		fprintf(stderr, "Cannot prepare benchmark data\n");
+		goto end_of_main;
+	}
+
+	const char *err = capture != NULL ? load_capture(capture) : NULL;
+	if(err != NULL)
+	{
+		fprintf(stderr, "Cannot load %s: %s\n", capture, err);
+		goto end_of_main;
+	}
+
+	uint64_t sink = 0;
+	cJSON *json = cJSON_CreateObject();
+	cJSON_AddStringToObject(json, "version", git_version());
+	cJSON_AddStringToObject(json, "hash", git_hash());
+	cJSON_AddStringToObject(json, "arch", ftl_arch());
+	cJSON_AddStringToObject(json, "cc", ftl_cc());
+	cJSON_AddNumberToObject(json, "domains", num_domains);
+	cJSON_AddNumberToObject(json, "runs", runs);
+	cJSON_AddItemToObject(json, "benchmarks", run_benchmarks(runs, filter, &sink));
+	if(capture != NULL)
+		cJSON_AddNumberToObject(json, "messages", num_messages);
+
+	unsigned long mismatches = 0;
+	if(fuzz > 0 && setup_extract_name() == NULL)
+	{
+		unsigned long checks = 0;
+		mismatches = fuzz_extract_name(fuzz, &checks);
+		cJSON *fuzzed = cJSON_CreateObject();
+		cJSON_AddNumberToObject(fuzzed, "iterations", fuzz);
+		cJSON_AddNumberToObject(fuzzed, "checks", checks);
+		cJSON_AddNumberToObject(fuzzed, "mismatches", mismatches);
+		cJSON_AddItemToObject(json, "fuzz", fuzzed);
+	}
+	if(lookup > 0)
+	{
+		unsigned long checks = 0;
+		unsigned int capacity[2] = { 0 };
+		const unsigned long lookup_mismatches = check_lookup(lookup, &checks, capacity);
+		cJSON *checked = cJSON_CreateObject();
+		cJSON_AddNumberToObject(checked, "operations", lookup);
+		cJSON_AddNumberToObject(checked, "checks", checks);
+		cJSON_AddNumberToObject(checked, "mismatches", lookup_mismatches);
+		cJSON_AddNumberToObject(checked, "capacity_start", capacity[0]);
+		cJSON_AddNumberToObject(checked, "capacity_end", capacity[1]);
+		cJSON_AddItemToObject(json, "lookup", checked);
+		mismatches += lookup_mismatches;
+	}
+	// Printing the checksum keeps the compiler from discarding any result
+	cJSON_AddNumberToObject(json, "checksum", sink % 1000000007u);
+
+	char *out = cJSON_Print(json);
+	if(out != NULL)
+	{
+		puts(out);
+		ret = mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	free(out);
+	cJSON_Delete(json);
+
+end_of_main:
+	destroy_shmem();
+	return ret;
+}
@@ -0,0 +1,290 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-client heavy-hitter sketches
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file client-sketch.c
+* @brief Approximate per-client top domains in bounded memory.
+*
+* Every client owns a count-min sketch for its permitted and one for its
+* blocked queries. Each query increments one counter per row, the count of a
+* domain is estimated as the smallest of its counters. Estimates never
+* underestimate the true count and overestimate it by at most e/WIDTH times the
+* number of queries in the sketch with probability 1 - exp(-DEPTH).
+*
+* Next to the counters, each sketch keeps the IDs of up to TOPK domains with the
+* highest estimates. A domain which is not a candidate replaces the one with the
+* smallest estimate once its own estimate exceeds it, in the same way as the
+* global top lists in top-lists.c are maintained.
+*
+* Expiring queries are subtracted again, the sketches of alias-clients are the
+* sum of the sketches of their members and are computed on request.
+*/
+
+#include "FTL.h"
+#include "client-sketch.h"
+// counters, getClient()
+#include "shmem.h"
+// log_err()
+#include "log.h"
+// exp(), M_E
+#include <math.h>
+
+// Odd multipliers of the row hashes
+static const uint64_t row_seeds[CLIENT_SKETCH_DEPTH] = {
+	0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full,
+	0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull
+};
+
+static inline unsigned int __attribute__((const)) cell_index(const unsigned int row, const unsigned int domainID)
+{
+	// Multiplicative hashing, the most significant bits are the best mixed
+	return (unsigned int)(((domainID + 1ull) * row_seeds[row]) >> (64u - CLIENT_SKETCH_WIDTH_BITS));
+}
+
+static struct count_min *get_sketch(const unsigned int clientID, const enum client_sketch_type type)
+{
+	if(client_sketches == NULL || clientID >= counters->clients_MAX)
+		return NULL;
+
+	return &client_sketches[clientID].sketch[type];
+}
+
+static uint32_t __attribute__((pure)) estimate(const struct count_min *cm, const unsigned int domainID)
+{
+	uint32_t est = UINT32_MAX;
+	for(unsigned int row = 0; row < CLIENT_SKETCH_DEPTH; row++)
+	{
+		const uint32_t c = cm->cell[row][cell_index(row, domainID)];
+		if(c < est)
+			est = c;
+	}
+
+	return est;
+}
+
+static void update_candidates(struct count_min *cm, const unsigned int domainID, const uint32_t est)
+{
+	for(unsigned int i = 0; i < cm->num; i++)
+		if(cm->candidate[i] == domainID)
+			return;
+
+	// Add new candidate if there is still space left
+	if(cm->num < CLIENT_SKETCH_TOPK)
+	{
+		cm->candidate[cm->num++] = domainID;
+		return;
+	}
+
+	if(est <= cm->min)
+		return;
+
+	// The lower bound may be outdated as candidates grow without updating
+	// it, find the actual smallest candidate
+	unsigned int min_idx = 0;
+	uint32_t min = UINT32_MAX;
+	for(unsigned int i = 0; i < cm->num; i++)
+	{
+		const uint32_t e = estimate(cm, cm->candidate[i]);
+		if(e < min)
+		{
+			min = e;
+			min_idx = i;
+		}
+	}
+	cm->min = min;
+
+	// Replace the smallest candidate
+	if(est > min)
+		cm->candidate[min_idx] = domainID;
+}
+
+void client_sketch_reset(const unsigned int clientID)
+{
+	if(client_sketches == NULL || clientID >= counters->clients_MAX)
+		return;
+
+	memset(&client_sketches[clientID], 0, sizeof(clientSketchData));
+}
+
+void client_sketch_add(const unsigned int clientID, const unsigned int domainID,
+                       const enum client_sketch_type type)
+{
+	struct count_min *cm = get_sketch(clientID, type);
+	if(cm == NULL)
+		return;
+
+	uint32_t est = UINT32_MAX;
+	for(unsigned int row = 0; row < CLIENT_SKETCH_DEPTH; row++)
+	{
+		const uint32_t c = ++cm->cell[row][cell_index(row, domainID)];
+		if(c < est)
+			est = c;
+	}
+	cm->total++;
+
+	update_candidates(cm, domainID, est);
+}
+
+void client_sketch_remove(const unsigned int clientID, const unsigned int domainID,
+                          const enum client_sketch_type type)
+{
+	struct count_min *cm = get_sketch(clientID, type);
+	if(cm == NULL)
+		return;
+
+	uint32_t est = UINT32_MAX;
+	for(unsigned int row = 0; row < CLIENT_SKETCH_DEPTH; row++)
+	{
+		uint32_t *c = &cm->cell[row][cell_index(row, domainID)];
+		if(*c > 0)
+			(*c)--;
+		if(*c < est)
+			est = *c;
+	}
+	if(cm->total > 0)
+		cm->total--;
+
+	// Candidates stay, only keep the lower bound of the smallest
+	// candidate up to date
+	if(est < cm->min)
+		cm->min = est;
+}
+
+// A query of this client has been blocked after it was counted as permitted
+void client_sketch_blocked(const unsigned int clientID, const unsigned int domainID)
+{
+	client_sketch_remove(clientID, domainID, CLIENT_SKETCH_PERMITTED);
+	client_sketch_add(clientID, domainID, CLIENT_SKETCH_BLOCKED);
+}
+
+// qsort subroutine, sort DESC
+static int __attribute__((pure)) cmpdesc_sketch(const void *a, const void *b)
+{
+	const struct client_sketch_entry *elem1 = (const struct client_sketch_entry*)a;
+	const struct client_sketch_entry *elem2 = (const struct client_sketch_entry*)b;
+
+	if (elem1->count > elem2->count)
+		return -1;
+	else if (elem1->count < elem2->count)
+		return 1;
+	else
+		return 0;
+}
+
+/**
+ * Get the estimated top domains of a client sorted by decreasing count. For
+ * alias-clients, the sketches of all members are summed up. The caller must
+ * hold (at least) the shared SHM lock and free the returned entries.
+ *
+ * @param clientID The client
+ * @param type Which queries to consider
+ * @param entries Set to an allocated array of the candidates, NULL if there
+ * are none
+ * @param total Set to the number of queries in the (summed) sketch, the
+ * overestimation of each count is bounded relative to this number
+ * @return The number of entries returned
+ */
+unsigned int client_sketch_top(const unsigned int clientID, const enum client_sketch_type type,
+                               struct client_sketch_entry **entries, uint32_t *total)
+{
+	*entries = NULL;
+	*total = 0;
+
+	const clientsData *client = getClient(clientID, true);
+	if(client == NULL)
+		return 0;
+
+	struct count_min *sum = calloc(1, sizeof(*sum));
+	if(sum == NULL)
+		return 0;
+
+	unsigned int num = 0, size = 0;
+	const unsigned int first = client->flags.aliasclient ? 0 : clientID;
+	const unsigned int last = client->flags.aliasclient ? counters->clients : clientID + 1;
+	for(unsigned int id = first; id < last; id++)
+	{
+		if(client->flags.aliasclient)
+		{
+			const clientsData *member = getClient(id, true);
+			if(member == NULL || member->flags.aliasclient || member->aliasclient_id != (int)clientID)
+				continue;
+		}
+
+		const struct count_min *cm = get_sketch(id, type);
+		if(cm == NULL)
+			continue;
+
+		sum->total += cm->total;
+		for(unsigned int row = 0; row < CLIENT_SKETCH_DEPTH; row++)
+			for(unsigned int col = 0; col < CLIENT_SKETCH_WIDTH; col++)
+				sum->cell[row][col] += cm->cell[row][col];
+
+		// Collect the union of all candidates
+		for(unsigned int i = 0; i < cm->num; i++)
+		{
+			bool known = false;
+			for(unsigned int j = 0; j < num && !known; j++)
+				known = (*entries)[j].domainID == cm->candidate[i];
+			if(known)
+				continue;
+
+			if(num == size)
+			{
+				size += CLIENT_SKETCH_TOPK;
+				struct client_sketch_entry *tmp = realloc(*entries, size*sizeof(**entries));
+				if(tmp == NULL)
+				{
+					log_err("Memory allocation failed in %s()", __FUNCTION__);
+					free(sum);
+					if(*entries != NULL)
+						free(*entries);
+					*entries = NULL;
+					return 0;
+				}
+				*entries = tmp;
+			}
+			(*entries)[num++].domainID = cm->candidate[i];
+		}
+	}
+
+	// Estimate the candidates using the summed sketch, domains whose queries
+	// all expired are dropped
+	unsigned int valid = 0;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const uint32_t count = estimate(sum, (*entries)[i].domainID);
+		if(count < 1)
+			continue;
+
+		(*entries)[valid].domainID = (*entries)[i].domainID;
+		(*entries)[valid].count = count;
+		valid++;
+	}
+
+	if(valid > 0)
+		qsort(*entries, valid, sizeof(**entries), cmpdesc_sketch);
+
+	*total = sum->total;
+	free(sum);
+
+	return valid;
+}
+
+// Relative error bound of the estimates
+double client_sketch_epsilon(void)
+{
+	return M_E / CLIENT_SKETCH_WIDTH;
+}
+
+// Probability of an estimate exceeding the error bound
+double client_sketch_delta(void)
+{
+	return exp(-(double)CLIENT_SKETCH_DEPTH);
+}
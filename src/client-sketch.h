@@ -0,0 +1,78 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-client heavy-hitter sketches header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef CLIENT_SKETCH_H
+#define CLIENT_SKETCH_H
+
+#include <stdbool.h>
+// uint32_t
+#include <stdint.h>
+
+// Dimensions of the count-min sketches. With probability of at least
+// 1 - exp(-DEPTH), no estimate exceeds the true count by more than
+// e/WIDTH times the number of queries counted in the sketch
+#define CLIENT_SKETCH_DEPTH 4u
+#define CLIENT_SKETCH_WIDTH_BITS 7u
+#define CLIENT_SKETCH_WIDTH (1u << CLIENT_SKETCH_WIDTH_BITS)
+// How many candidates for the top domains are kept per sketch
+#define CLIENT_SKETCH_TOPK 32u
+
+enum client_sketch_type {
+	CLIENT_SKETCH_PERMITTED,
+	CLIENT_SKETCH_BLOCKED,
+	CLIENT_SKETCH_TYPES
+} __attribute__ ((packed));
+
+/**
+ * struct count_min - Count-min sketch of the domains queried by a client
+ * @total: Number of queries counted in the sketch
+ * @num: Number of candidates
+ * @min: Lower bound of the smallest estimate of all candidates
+ * @cell: The counters, each query is counted once in every row
+ * @candidate: IDs of the domains with (presumably) the highest counts
+ *
+ * Queries are removed from the sketch again when they expire so the counters
+ * always reflect the queries in memory.
+ */
+struct count_min {
+	uint32_t total;
+	uint32_t num;
+	uint32_t min;
+	uint32_t cell[CLIENT_SKETCH_DEPTH][CLIENT_SKETCH_WIDTH];
+	unsigned int candidate[CLIENT_SKETCH_TOPK];
+};
+
+// Sketches of one client, stored at the index of the client's ID
+typedef struct {
+	struct count_min sketch[CLIENT_SKETCH_TYPES];
+} clientSketchData;
+
+extern clientSketchData *client_sketches;
+
+struct client_sketch_entry {
+	unsigned int domainID;
+	uint32_t count;
+};
+
+// Called with the exclusive SHM lock held
+void client_sketch_reset(const unsigned int clientID);
+void client_sketch_add(const unsigned int clientID, const unsigned int domainID,
+                       const enum client_sketch_type type);
+void client_sketch_remove(const unsigned int clientID, const unsigned int domainID,
+                          const enum client_sketch_type type);
+void client_sketch_blocked(const unsigned int clientID, const unsigned int domainID);
+
+// Called with (at least) the shared SHM lock held
+unsigned int client_sketch_top(const unsigned int clientID, const enum client_sketch_type type,
+                               struct client_sketch_entry **entries, uint32_t *total);
+double client_sketch_epsilon(void) __attribute__((const));
+double client_sketch_delta(void) __attribute__((const));
+
+#endif //CLIENT_SKETCH_H
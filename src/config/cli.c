@@ -501,7 +501,7 @@ int set_config_from_CLI(const char *key, const char *value)
 		}
 
 		// Is this a dnsmasq option we need to check?
-		if(conf_item->f & FLAG_RESTART_FTL)
+		if(conf_item->f & (FLAG_RESTART_FTL | FLAG_RELOAD_SERVERS))
 		{
 			char errbuf[ERRBUF_SIZE] = { 0 };
 			if(!write_dnsmasq_config(&newconf, true, errbuf))
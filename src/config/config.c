@@ -37,6 +37,10 @@
 #include "files.h"
 // restart_ftl()
 #include "signals.h"
+// update_exclude_filters()
+#include "exclude-filter.h"
+// special_domains_invalidate()
+#include "special-domains.h"
 
 // Global variables
 struct config config = { 0 };
@@ -402,7 +406,7 @@ static void initConfig(struct config *conf)
 	conf->dns.upstreams.a = cJSON_CreateStringReference("array of IP addresses and/or hostnames, optionally with a port (#...)");
 	conf->dns.upstreams.t = CONF_JSON_STRING_ARRAY;
 	conf->dns.upstreams.d.json = cJSON_CreateArray();
-	conf->dns.upstreams.f = FLAG_RESTART_FTL;
+	conf->dns.upstreams.f = FLAG_RELOAD_SERVERS;
 	conf->dns.upstreams.c = validate_stub; // Type-based checking + dnsmasq syntax checking
 
 	conf->dns.CNAMEdeepInspect.k = "dns.CNAMEdeepInspect";
@@ -579,6 +583,13 @@ static void initConfig(struct config *conf)
 	conf->dns.port.d.u16 = 53u;
 	conf->dns.port.c = validate_stub; // Only type-based checking
 
+	conf->dns.dotPort.k = "dns.dotPort";
+	conf->dns.dotPort.h = "Port of the DNS-over-TLS (DoT) server, usually 853. It uses the certificate of the web server (webserver.tls.cert) and its session resumption settings (webserver.tls.cache, webserver.tls.tickets and webserver.tls.lifetime). Connections are handled by FTL itself and stay open for further queries. Setting this to 0 disables the DoT server.";
+	conf->dns.dotPort.t = CONF_UINT16;
+	conf->dns.dotPort.f = FLAG_RESTART_FTL;
+	conf->dns.dotPort.d.u16 = 0u;
+	conf->dns.dotPort.c = validate_stub; // Only type-based checking
+
 	// sub-struct dns.cache
 	conf->dns.cache.size.k = "dns.cache.size";
 	conf->dns.cache.size.h = "Cache size of the DNS server. Note that expiring cache entries naturally make room for new insertions over time. Setting this number too high will have an adverse effect as not only more space is needed, but also lookup speed gets degraded in the 10,000+ range. dnsmasq may issue a warning when you go beyond 10,000+ cache entries.";
@@ -600,6 +611,42 @@ static void initConfig(struct config *conf)
 	conf->dns.cache.upstreamBlockedTTL.d.ui = 86400;
 	conf->dns.cache.upstreamBlockedTTL.c = validate_stub; // Only type-based checking
 
+	conf->dns.cache.prefetch.k = "dns.cache.prefetch";
+	conf->dns.cache.prefetch.h = "Cache prefetching: If a record of a popular domain is served from the cache within the last given percentage of its TTL, FTL answers the query from the cache and additionally asks the upstream server for fresh data in the background. Popular domains thereby stay in the cache instead of expiring and having to be resolved while the client is waiting. Values above 100 are treated as 100. Setting this value to zero disables prefetching.";
+	conf->dns.cache.prefetch.t = CONF_UINT;
+	conf->dns.cache.prefetch.d.ui = 0;
+	conf->dns.cache.prefetch.c = validate_stub; // Only type-based checking
+
+	conf->dns.cache.prefetchHits.k = "dns.cache.prefetchHits";
+	conf->dns.cache.prefetchHits.h = "Minimum number of queries for a domain within the history kept in memory for the domain to be considered popular for cache prefetching (see dns.cache.prefetch).";
+	conf->dns.cache.prefetchHits.t = CONF_UINT;
+	conf->dns.cache.prefetchHits.d.ui = 10;
+	conf->dns.cache.prefetchHits.c = validate_stub; // Only type-based checking
+
+	conf->dns.cache.aggressiveNSEC.k = "dns.cache.aggressiveNSEC";
+	conf->dns.cache.aggressiveNSEC.h = "Aggressive use of the DNSSEC-validated cache (RFC 8198): Queries for names (or types) which validated NSEC records of the same zone prove not to exist are answered with NXDOMAIN (or NODATA) without asking the upstream server. This reduces the load caused by queries for random subdomains. Only effective when dns.dnssec is enabled, queries requesting DNSSEC records are always forwarded.";
+	conf->dns.cache.aggressiveNSEC.t = CONF_BOOL;
+	conf->dns.cache.aggressiveNSEC.d.b = true;
+	conf->dns.cache.aggressiveNSEC.c = validate_stub; // Only type-based checking
+
+	conf->dns.cache.autosize.k = "dns.cache.autosize";
+	conf->dns.cache.autosize.h = "Adaptive cache sizing: When enabled, FTL checks the DNS cache once a minute. If records were evicted from the cache before their TTL expired, the cache is grown (doubled, but never beyond dns.cache.maxSize and only if enough memory is available). If the cache stays mostly unused for a while, the most recent growth step is reverted. dns.cache.size is used as initial and minimum size of the cache. Each resize decision is logged.";
+	conf->dns.cache.autosize.t = CONF_BOOL;
+	conf->dns.cache.autosize.d.b = false;
+	conf->dns.cache.autosize.c = validate_stub; // Only type-based checking
+
+	conf->dns.cache.maxSize.k = "dns.cache.maxSize";
+	conf->dns.cache.maxSize.h = "Upper limit for the number of DNS cache entries when adaptive cache sizing is enabled (see dns.cache.autosize).";
+	conf->dns.cache.maxSize.t = CONF_UINT;
+	conf->dns.cache.maxSize.d.ui = 100000u;
+	conf->dns.cache.maxSize.c = validate_stub; // Only type-based checking
+
+	conf->dns.cache.persist.k = "dns.cache.persist";
+	conf->dns.cache.persist.h = "Keep the DNS cache across restarts: When enabled, FTL saves the records in its DNS cache when it is stopped (and additionally once an hour) and restores them on the next start. Records whose TTL expired in the meantime are discarded unless they may still be served stale (see dns.cache.optimizer). Clients hence do not have to wait for all domains to be resolved again after a restart. Flushing the cache (e.g., pihole reloaddns) is not affected. When running additional UDP worker processes (dns.udpWorkers), only the cache of the main process is saved, the restored records are available to all processes.";
+	conf->dns.cache.persist.t = CONF_BOOL;
+	conf->dns.cache.persist.d.b = true;
+	conf->dns.cache.persist.c = validate_stub; // Only type-based checking
+
 	// sub-struct dns.blocking
 	conf->dns.blocking.active.k = "dns.blocking.active";
 	conf->dns.blocking.active.h = "Should FTL block queries?";
@@ -639,6 +686,18 @@ static void initConfig(struct config *conf)
 	conf->dns.blocking.edns.d.edns_mode = EDNS_MODE_TEXT;
 	conf->dns.blocking.edns.c = validate_stub; // Only type-based checking
 
+	conf->dns.blocking.compiledIndex.k = "dns.blocking.compiledIndex";
+	conf->dns.blocking.compiledIndex.h = "Should FTL compile the exact domains on your lists (gravity, antigravity, and exact allow/deny domains) into a read-only in-memory index? When enabled, blocking decisions for exact and ABP-style domains are answered from this index instead of querying the gravity database for every new domain. The database remains the only source of truth, the index is rebuilt whenever the lists are reloaded (changing this setting takes effect on the next reload, e.g., after running \"pihole reloadlists\"). This speeds up the processing of queries not already known to FTL significantly, especially for large blocking lists, at the expense of about 24 bytes of additional memory per list entry plus the length of its domain.";
+	conf->dns.blocking.compiledIndex.t = CONF_BOOL;
+	conf->dns.blocking.compiledIndex.d.b = false;
+	conf->dns.blocking.compiledIndex.c = validate_stub; // Only type-based checking
+
+	conf->dns.blocking.combinedRegex.k = "dns.blocking.combinedRegex";
+	conf->dns.blocking.combinedRegex.h = "Should FTL compile all regex filters of the same kind (deny or allow) into a single combined automaton? When enabled, a domain not already known to FTL is matched against all regex filters in one pass instead of testing one regex after another, the per-client enabled state is applied afterwards. Filters the combined automaton cannot represent (e.g., back-references, word boundaries, approximate matching, or inverted filters) are still tested individually. Changing this setting takes effect on the next reload of the lists, e.g., after running \"pihole reloadlists\". This speeds up the processing of new domains significantly for large numbers of regex filters at the expense of some additional memory (at most a few megabytes).";
+	conf->dns.blocking.combinedRegex.t = CONF_BOOL;
+	conf->dns.blocking.combinedRegex.d.b = false;
+	conf->dns.blocking.combinedRegex.c = validate_stub; // Only type-based checking
+
 	conf->dns.revServers.k = "dns.revServers";
 	conf->dns.revServers.h = "Reverse server (former also called \"conditional forwarding\") feature\n Array of reverse servers each one in one of the following forms: \"<enabled>,<ip-address>[/<prefix-len>],<server>[#<port>][,<domain>]\"\n\n Individual components:\n\n <enabled>: either \"true\" or \"false\"\n\n <ip-address>[/<prefix-len>]: Address range for the reverse server feature in CIDR notation. If the prefix length is omitted, either 32 (IPv4) or 128 (IPv6) are substituted (exact address match). This is almost certainly not what you want here.\n Example: \"192.168.0.0/24\" for the range 192.168.0.1 - 192.168.0.255\n\n <server>[#<port>]: Target server to be used for the reverse server feature\n Example: \"192.168.0.1#53\"\n\n <domain>: Domain used for the reverse server feature (e.g., \"fritz.box\")\n Example: \"fritz.box\"";
 	conf->dns.revServers.a = cJSON_CreateStringReference("array of reverse servers each one in one of the following forms: \"<enabled>,<ip-address>[/<prefix-len>],<server>[#<port>][,<domain>]\", e.g., \"true,192.168.0.0/24,192.168.0.1,fritz.box\"");
@@ -647,9 +706,35 @@ static void initConfig(struct config *conf)
 	conf->dns.revServers.c = validate_dns_revServers;
 	conf->dns.revServers.f = FLAG_RESTART_FTL;
 
+	conf->dns.fastestUpstream.k = "dns.fastestUpstream";
+	conf->dns.fastestUpstream.h = "Should FTL prefer the fastest healthy upstream server? Upstreams are then ranked by their smoothed response time and the rate of queries they did not answer, every 32nd query is sent to another upstream to keep its statistics current. When disabled, dnsmasq's own selection is used which sends queries to all servers from time to time and then sticks to the first one answering. This setting has no effect when strict-order is set using misc.dnsmasq_lines. Queries are still sent to all servers when all-servers is set.";
+	conf->dns.fastestUpstream.t = CONF_BOOL;
+	conf->dns.fastestUpstream.d.b = false;
+	conf->dns.fastestUpstream.c = validate_stub; // Only type-based checking
+
+	conf->dns.circuitBreaker.k = "dns.circuitBreaker";
+	conf->dns.circuitBreaker.h = "Should FTL stop sending queries to upstream servers which do not answer them? An upstream is considered down after five consecutive queries had to be retried or could not be sent to it. Queries are then sent to the other upstreams only while the upstream is probed in the background with increasing intervals (from five seconds up to five minutes) until it answers again. Queries are still sent to upstreams considered down when all upstreams are.";
+	conf->dns.circuitBreaker.t = CONF_BOOL;
+	conf->dns.circuitBreaker.d.b = false;
+	conf->dns.circuitBreaker.c = validate_stub; // Only type-based checking
+
+	conf->dns.udpWorkers.k = "dns.udpWorkers";
+	conf->dns.udpWorkers.h = "Number of additional processes receiving DNS queries over UDP. All processes bind the same port (using SO_REUSEPORT) and the kernel distributes incoming queries among them, so query processing is no longer limited to a single CPU core. Each process has its own DNS cache and forwards its queries on its own, statistics and the blocking lists are shared. The processes are restarted whenever the configuration or the upstream servers change. Workers are not started when upstream servers use fixed source addresses or ports. At most 64 workers are started, a reasonable value is the number of CPU cores minus one. Setting this value to zero processes all queries in a single process.";
+	conf->dns.udpWorkers.t = CONF_UINT;
+	conf->dns.udpWorkers.f = FLAG_RESTART_FTL;
+	conf->dns.udpWorkers.d.ui = 0;
+	conf->dns.udpWorkers.c = validate_stub; // Only type-based checking
+
+	conf->dns.tcpWorkers.k = "dns.tcpWorkers";
+	conf->dns.tcpWorkers.h = "Number of processes accepting DNS connections over TCP in advance. By default, a new process is started for every TCP connection and terminated afterwards. The processes of the pool instead handle one connection after another and keep their database connections, DNS cache and connections to the upstream servers open. Each process handles one connection at a time, further connections wait until a process becomes available. The processes are restarted whenever the configuration or the upstream servers change. At most 64 processes are started. Setting this value to zero starts a new process for every connection.";
+	conf->dns.tcpWorkers.t = CONF_UINT;
+	conf->dns.tcpWorkers.f = FLAG_RESTART_FTL;
+	conf->dns.tcpWorkers.d.ui = 0;
+	conf->dns.tcpWorkers.c = validate_stub; // Only type-based checking
+
 	// sub-struct dns.rate_limit
 	conf->dns.rateLimit.count.k = "dns.rateLimit.count";
-	conf->dns.rateLimit.count.h = "Rate-limited queries are answered with a REFUSED reply and not further processed by FTL.\n The default settings for FTL's rate-limiting are to permit no more than 1000 queries in 60 seconds. Both numbers can be customized independently. It is important to note that rate-limiting is happening on a per-client basis. Other clients can continue to use FTL while rate-limited clients are short-circuited at the same time.\n For this setting, both numbers, the maximum number of queries within a given time, and the length of the time interval (seconds) have to be specified. For instance, if you want to set a rate limit of 1 query per hour, the option should look like dns.rateLimit.count=1 and dns.rateLimit.interval=3600. The time interval is relative to when FTL has finished starting (start of the daemon + possible delay by DELAY_STARTUP) then it will advance in steps of the rate-limiting interval. If a client reaches the maximum number of queries it will be blocked until the end of the current interval. This will be logged to /var/log/pihole/FTL.log, e.g. Rate-limiting 10.0.1.39 for at least 44 seconds. If the client continues to send queries while being blocked already and this number of queries during the blocking exceeds the limit the client will continue to be blocked until the end of the next interval (FTL.log will contain lines like Still rate-limiting 10.0.1.39 as it made additional 5007 queries). As soon as the client requests less than the set limit, it will be unblocked (Ending rate-limitation of 10.0.1.39).\n Rate-limiting may be disabled altogether by setting both values to zero (this results in the same behavior as before FTL v5.7).\n How many queries are permitted...";
+	conf->dns.rateLimit.count.h = "Rate-limited queries are answered with a REFUSED reply and not further processed by FTL.\n The default settings for FTL's rate-limiting are to permit no more than 1000 queries in 60 seconds. Both numbers can be customized independently. It is important to note that rate-limiting is happening on a per-client basis. Other clients can continue to use FTL while rate-limited clients are short-circuited at the same time.\n For this setting, both numbers, the maximum number of queries within a given time, and the length of the time interval (seconds) have to be specified. For instance, if you want to set a rate limit of 1 query per hour, the option should look like dns.rateLimit.count=1 and dns.rateLimit.interval=3600. A client may send up to count queries at once, its allowance is replenished continuously at a rate of count queries per interval. If a client has used up its allowance, it will be blocked until the allowance suffices for another query. This will be logged to /var/log/pihole/FTL.log, e.g. Rate-limiting 10.0.1.39 for at least 4 seconds. Refused queries do not count against the allowance. The first query permitted again ends the blocking (Ending rate-limitation of 10.0.1.39 after refusing 5007 queries).\n Rate-limiting may be disabled altogether by setting both values to zero (this results in the same behavior as before FTL v5.7).\n How many queries are permitted...";
 	conf->dns.rateLimit.count.t = CONF_UINT;
 	conf->dns.rateLimit.count.d.ui = 1000;
 	conf->dns.rateLimit.count.c = validate_stub; // Only type-based checking
@@ -660,6 +745,18 @@ static void initConfig(struct config *conf)
 	conf->dns.rateLimit.interval.d.ui = 60;
 	conf->dns.rateLimit.interval.c = validate_stub; // Only type-based checking
 
+	conf->dns.rateLimit.prefixV4.k = "dns.rateLimit.prefixV4";
+	conf->dns.rateLimit.prefixV4.h = "Rate-limit all clients of an IPv4 network together instead of each client on its own. Clients whose addresses share this many leading bits (e.g., 24 for a /24 network) share a single allowance, a flood of queries from many addresses of the same network is then refused as a whole. The value 32 rate-limits every IPv4 client on its own.";
+	conf->dns.rateLimit.prefixV4.t = CONF_UINT;
+	conf->dns.rateLimit.prefixV4.d.ui = 32;
+	conf->dns.rateLimit.prefixV4.c = validate_stub; // Only type-based checking
+
+	conf->dns.rateLimit.prefixV6.k = "dns.rateLimit.prefixV6";
+	conf->dns.rateLimit.prefixV6.h = "Rate-limit all clients of an IPv6 network together instead of each client on its own. Clients whose addresses share this many leading bits (e.g., 56 or 64) share a single allowance. The value 128 rate-limits every IPv6 client on its own.";
+	conf->dns.rateLimit.prefixV6.t = CONF_UINT;
+	conf->dns.rateLimit.prefixV6.d.ui = 128;
+	conf->dns.rateLimit.prefixV6.c = validate_stub; // Only type-based checking
+
 	// sub-struct dns.special_domains
 	conf->dns.specialDomains.mozillaCanary.k = "dns.specialDomains.mozillaCanary";
 	conf->dns.specialDomains.mozillaCanary.h = "Should Pi-hole always reply with NXDOMAIN to A and AAAA queries of use-application-dns.net to disable Firefox automatic DNS-over-HTTP? This is following the recommendation on https://support.mozilla.org/en-US/kb/configuring-networks-disable-dns-over-https";
@@ -825,6 +922,12 @@ static void initConfig(struct config *conf)
 
 
 	// struct ntp
+	conf->ntp.rateLimit.k = "ntp.rateLimit";
+	conf->ntp.rateLimit.h = "Maximum number of NTP requests answered per second by each of the IPv4 and IPv6 NTP servers. Requests exceeding this rate are queued and dropped once the queue is full. Set to 0 to disable rate limiting";
+	conf->ntp.rateLimit.t = CONF_UINT;
+	conf->ntp.rateLimit.d.ui = 100;
+	conf->ntp.rateLimit.c = validate_stub; // Only type-based checking
+
 	conf->ntp.ipv4.active.k = "ntp.ipv4.active";
 	conf->ntp.ipv4.active.h = "Should FTL act as network time protocol (NTP) server (IPv4)?";
 	conf->ntp.ipv4.active.t = CONF_BOOL;
@@ -863,7 +966,7 @@ static void initConfig(struct config *conf)
 	conf->ntp.sync.active.c = validate_stub; // Only type-based checking
 
 	conf->ntp.sync.server.k = "ntp.sync.server";
-	conf->ntp.sync.server.h = "NTP upstream server to sync with, e.g., \"pool.ntp.org\". Note that the NTP server should be located as close as possible to you in order to minimize the time offset possibly introduced by different routing paths.";
+	conf->ntp.sync.server.h = "NTP upstream server to sync with, e.g., \"pool.ntp.org\". Multiple servers can be given separated by spaces, all their addresses are queried concurrently and only servers agreeing on the time are used. Note that the NTP server should be located as close as possible to you in order to minimize the time offset possibly introduced by different routing paths.";
 	conf->ntp.sync.server.a = cJSON_CreateStringReference("valid NTP upstream server");
 	conf->ntp.sync.server.t = CONF_STRING;
 	conf->ntp.sync.server.d.s = (char*)"pool.ntp.org";
@@ -936,6 +1039,17 @@ static void initConfig(struct config *conf)
 	conf->resolver.refreshNames.d.refresh_hostnames = REFRESH_IPV4_ONLY;
 	conf->resolver.refreshNames.c = validate_stub; // Only type-based checking
 
+	conf->resolver.nameSources.k = "resolver.nameSources";
+	conf->resolver.nameSources.h = "Sources of client and upstream host names in the order they are tried. \"hosts\" are /etc/hosts and the custom DNS records (dns.hosts), \"leases\" are the active DHCP leases, \"dns\" are PTR queries to Pi-hole itself and \"network\" is the network table (only used when resolver.networkNames is enabled). Sources which are not listed are not used. Names from local sources avoid PTR queries, the local sources are read once per run.";
+	conf->resolver.nameSources.a = cJSON_CreateStringReference("array of sources: \"hosts\", \"leases\", \"dns\" and \"network\"");
+	conf->resolver.nameSources.t = CONF_JSON_STRING_ARRAY;
+	conf->resolver.nameSources.d.json = cJSON_CreateArray();
+	cJSON_AddItemReferenceToArray(conf->resolver.nameSources.d.json, cJSON_CreateStringReference("hosts"));
+	cJSON_AddItemReferenceToArray(conf->resolver.nameSources.d.json, cJSON_CreateStringReference("leases"));
+	cJSON_AddItemReferenceToArray(conf->resolver.nameSources.d.json, cJSON_CreateStringReference("dns"));
+	cJSON_AddItemReferenceToArray(conf->resolver.nameSources.d.json, cJSON_CreateStringReference("network"));
+	conf->resolver.nameSources.c = validate_resolver_nameSources;
+
 
 	// struct database
 	conf->database.DBimport.k = "database.DBimport";
@@ -950,6 +1064,37 @@ static void initConfig(struct config *conf)
 	conf->database.maxDBdays.d.i = (365/4);
 	conf->database.maxDBdays.c = validate_stub; // Only type-based checking
 
+	conf->database.partitionDays.k = "database.partitionDays";
+	conf->database.partitionDays.h = "Should the long-term query storage be split into partitions covering this many days each (e.g., 7 for one partition per week)?\n Expired queries are then removed by dropping entire partitions instead of deleting them one by one which avoids long write transactions and large WAL files on big databases. Queries are kept until their whole partition has expired, i.e., up to this many days longer than configured by database.maxDBdays. Setting this value to 0 disables partitioning, existing partitions are merged back into a single table (this may take a while).";
+	conf->database.partitionDays.t = CONF_UINT;
+	conf->database.partitionDays.d.ui = 0;
+	conf->database.partitionDays.c = validate_stub; // Only type-based checking
+
+	conf->database.archiveDays.k = "database.archiveDays";
+	conf->database.archiveDays.h = "Should partitions of the long-term query storage be converted into a compressed columnar archive once all of their queries are older than this many days?\n Archived queries need a fraction of the disk space and remain available for the long-term statistics and the query log. Only the columns needed for statistics are kept: additional info, reply time, DNSSEC status, list ID and EDE of archived queries are lost. This needs partitioning to be enabled (database.partitionDays). Setting this value to 0 disables archiving.";
+	conf->database.archiveDays.t = CONF_UINT;
+	conf->database.archiveDays.d.ui = 0;
+	conf->database.archiveDays.c = validate_stub; // Only type-based checking
+
+	conf->database.ioBudget.k = "database.ioBudget";
+	conf->database.ioBudget.h = "How many MB per second may FTL write to the long-term database while deleting expired queries and returning free space to the file system?\n Expired queries are deleted in small transactions, FTL waits between them to stay within this budget. Storing new queries is never throttled. Setting this value to 0 disables the limit.";
+	conf->database.ioBudget.t = CONF_UINT;
+	conf->database.ioBudget.d.ui = 0;
+	conf->database.ioBudget.c = validate_stub; // Only type-based checking
+
+	conf->database.memoryLimit.k = "database.memoryLimit";
+	conf->database.memoryLimit.h = "How much memory may the in-memory query database use [MB]? When this limit is reached, queries are stored in the long-term database early and the oldest of them are removed from memory. The query log reads them from the long-term database transparently. Setting this value to 0 disables the limit.";
+	conf->database.memoryLimit.t = CONF_UINT;
+	conf->database.memoryLimit.d.ui = 0;
+	conf->database.memoryLimit.c = validate_stub; // Only type-based checking
+
+	conf->database.inMemory.k = "database.inMemory";
+	conf->database.inMemory.h = "Should FTL keep a copy of the recent queries in an in-memory database?\n When disabled, the query log is served directly from the queries FTL keeps in shared memory and queries are written straight into the long-term database at the configured interval. This saves the memory of the second copy. Sorting the query log by anything but time then reads the queries stored in the long-term database, so the most recent queries appear there only after they have been stored. Disabling this needs the long-term database (database.maxDBdays > 0), database.memoryLimit has no effect then.";
+	conf->database.inMemory.t = CONF_BOOL;
+	conf->database.inMemory.f = FLAG_RESTART_FTL;
+	conf->database.inMemory.d.b = true;
+	conf->database.inMemory.c = validate_stub; // Only type-based checking
+
 	conf->database.DBinterval.k = "database.DBinterval";
 	conf->database.DBinterval.h = "How often do we store queries in FTL's database [seconds]?";
 	conf->database.DBinterval.t = CONF_UINT;
@@ -974,6 +1119,12 @@ static void initConfig(struct config *conf)
 	conf->database.useWAL.d.b = true;
 	conf->database.useWAL.c = validate_stub; // Only type-based checking
 
+	conf->database.gravitySearchIndex.k = "database.gravitySearchIndex";
+	conf->database.gravitySearchIndex.h = "Should pihole -g build a trigram index of all gravity domains? Partial matches in the search (e.g., on the \"Search Lists\" page) become index lookups instead of scanning the entire gravity table which can take several seconds on large lists. The index roughly triples the size of the gravity database. Searching falls back to scanning the table when the index is missing. Changes take effect with the next gravity update.";
+	conf->database.gravitySearchIndex.t = CONF_BOOL;
+	conf->database.gravitySearchIndex.d.b = false;
+	conf->database.gravitySearchIndex.c = validate_stub; // Only type-based checking
+
 	// sub-struct database.network
 	conf->database.network.parseARPcache.k = "database.network.parseARPcache";
 	conf->database.network.parseARPcache.h = "Should FTL analyze the local ARP cache? When disabled, client identification and the network table will stop working reliably.";
@@ -987,6 +1138,40 @@ static void initConfig(struct config *conf)
 	conf->database.network.expire.d.ui = conf->database.maxDBdays.d.ui;
 	conf->database.network.expire.c = validate_stub; // Only type-based checking
 
+	// sub-struct database.replication
+	conf->database.replication.replica.k = "database.replication.replica";
+	conf->database.replication.replica.h = "Where should FTL replicate the long-term database to? When set, FTL periodically pushes the database to a standby node using the sqlite3_rsync protocol over SSH. Only pages which changed since the last run are transferred. The standby node needs pihole-FTL installed with a symlink named sqlite3_rsync in the PATH of the remote user and the user running FTL needs key-based SSH access to it. Replication requires database.useWAL. Leave empty to disable replication.";
+	conf->database.replication.replica.a = cJSON_CreateStringReference("<user>@<host>:<path>, e.g., \"pihole@standby:/etc/pihole/pihole-FTL.db\"");
+	conf->database.replication.replica.t = CONF_STRING;
+	conf->database.replication.replica.d.s = (char*)"";
+	conf->database.replication.replica.c = validate_stub; // Only type-based checking
+
+	conf->database.replication.interval.k = "database.replication.interval";
+	conf->database.replication.interval.h = "How often should the database be replicated [seconds]?";
+	conf->database.replication.interval.t = CONF_UINT;
+	conf->database.replication.interval.d.ui = 3600;
+	conf->database.replication.interval.c = validate_stub; // Only type-based checking
+
+	conf->database.replication.bwlimit.k = "database.replication.bwlimit";
+	conf->database.replication.bwlimit.h = "How many kilobytes per second may be sent to the standby node while replicating? Setting this value to 0 disables the limit.";
+	conf->database.replication.bwlimit.t = CONF_UINT;
+	conf->database.replication.bwlimit.d.ui = 0;
+	conf->database.replication.bwlimit.c = validate_stub; // Only type-based checking
+
+	// sub-struct database.sink
+	conf->database.sink.target.k = "database.sink.target";
+	conf->database.sink.target.h = "Where should FTL stream completed queries to? When set, every query is sent as one line of JSON (NDJSON) once its first reply is known. Queries are written once per second without ever blocking FTL, see database.sink.buffer for what happens when the receiver is too slow. Named pipes are created if they do not exist yet. The long-term database can be disabled (database.maxDBdays = 0) on nodes which only forward their queries this way. Leave empty to disable streaming.";
+	conf->database.sink.target.a = cJSON_CreateStringReference("unix:<path>, tcp:<IP>:<port> (IPv6 addresses in brackets), or fifo:<path>, e.g., \"unix:/run/pihole/queries.sock\"");
+	conf->database.sink.target.t = CONF_STRING;
+	conf->database.sink.target.d.s = (char*)"";
+	conf->database.sink.target.c = validate_sink_target;
+
+	conf->database.sink.buffer.k = "database.sink.buffer";
+	conf->database.sink.buffer.h = "How many kilobytes of queries may be queued while the target of database.sink.target is not reachable or not reading fast enough? Further queries are dropped and counted (see the pihole_database_sink_dropped_total metric) until the queue has been written. The minimum is 64 kilobytes.";
+	conf->database.sink.buffer.t = CONF_UINT;
+	conf->database.sink.buffer.d.ui = 1024;
+	conf->database.sink.buffer.c = validate_stub; // Only type-based checking
+
 
 	// struct http
 	conf->webserver.domain.k = "webserver.domain";
@@ -1040,6 +1225,51 @@ static void initConfig(struct config *conf)
 	conf->webserver.serve_all.d.b = false;
 	conf->webserver.serve_all.c = validate_stub;
 
+	conf->webserver.precompress.k = "webserver.precompress";
+	conf->webserver.precompress.h = "Should the web server serve precompressed copies of the static files of the web interface? If enabled, FTL creates gzip-compressed copies (<file>.gz) of compressible static files in webserver.paths.webhome (or the entire webserver.paths.webroot if webserver.serve_all is enabled) when starting and serves them to clients accepting gzip-compressed content. Copies are only recreated when the original file changed. Directories not writable by the user running FTL are skipped.";
+	conf->webserver.precompress.t = CONF_BOOL;
+	conf->webserver.precompress.f = FLAG_RESTART_FTL;
+	conf->webserver.precompress.d.b = true;
+	conf->webserver.precompress.c = validate_stub;
+
+	conf->webserver.pool.min.k = "webserver.pool.min";
+	conf->webserver.pool.min.h = "Minimum number of worker threads of the web server. These threads are created when the web server starts and are kept even when idle. Additional threads (up to webserver.threads) are created whenever all existing threads are busy.";
+	conf->webserver.pool.min.t = CONF_UINT;
+	conf->webserver.pool.min.f = FLAG_RESTART_FTL;
+	conf->webserver.pool.min.d.ui = 2;
+	conf->webserver.pool.min.c = validate_stub; // Only type-based checking
+
+	conf->webserver.pool.idle.k = "webserver.pool.idle";
+	conf->webserver.pool.idle.h = "Number of seconds after which idle worker threads exceeding webserver.pool.min are retired to free their resources. The value 0 keeps all threads once they have been created.";
+	conf->webserver.pool.idle.t = CONF_UINT;
+	conf->webserver.pool.idle.f = FLAG_RESTART_FTL;
+	conf->webserver.pool.idle.d.ui = 60;
+	conf->webserver.pool.idle.c = validate_stub; // Only type-based checking
+
+	conf->webserver.pool.reserved.k = "webserver.pool.reserved";
+	conf->webserver.pool.reserved.h = "Number of worker threads kept available for cheap requests (authentication, summary statistics, web interface pages, ...). Expensive API requests (database history and statistics, the query log, Teleporter, ...) are rejected with HTTP status 429 when they would leave fewer threads than this available for other requests.";
+	conf->webserver.pool.reserved.t = CONF_UINT;
+	conf->webserver.pool.reserved.d.ui = 4;
+	conf->webserver.pool.reserved.c = validate_stub; // Only type-based checking
+
+	conf->webserver.pool.heavy.k = "webserver.pool.heavy";
+	conf->webserver.pool.heavy.h = "Maximum number of expensive API requests (database history and statistics, the query log, search, network table, ...) processed at the same time. Further requests wait for one of them to finish (see webserver.pool.wait).";
+	conf->webserver.pool.heavy.t = CONF_UINT;
+	conf->webserver.pool.heavy.d.ui = 4;
+	conf->webserver.pool.heavy.c = validate_stub; // Only type-based checking
+
+	conf->webserver.pool.bulk.k = "webserver.pool.bulk";
+	conf->webserver.pool.bulk.h = "Maximum number of bulk API requests (Teleporter, list imports, query log exports, gravity updates) processed at the same time. Further requests wait for one of them to finish (see webserver.pool.wait).";
+	conf->webserver.pool.bulk.t = CONF_UINT;
+	conf->webserver.pool.bulk.d.ui = 1;
+	conf->webserver.pool.bulk.c = validate_stub; // Only type-based checking
+
+	conf->webserver.pool.wait.k = "webserver.pool.wait";
+	conf->webserver.pool.wait.h = "Number of milliseconds expensive and bulk API requests wait for a free slot before they are rejected with HTTP status 429. The Retry-After header of the response tells clients when to try again. The value 0 rejects such requests immediately.";
+	conf->webserver.pool.wait.t = CONF_UINT;
+	conf->webserver.pool.wait.d.ui = 2000;
+	conf->webserver.pool.wait.c = validate_stub; // Only type-based checking
+
 	conf->webserver.tls.cert.k = "webserver.tls.cert";
 	conf->webserver.tls.cert.h = "Path to the TLS (SSL) certificate file. All directories along the path must be readable and accessible by the user running FTL (typically 'pihole'). This option is only required when at least one of webserver.port is TLS. The file must be in PEM format, and it must have both, private key and certificate (the *.pem file created must contain a 'CERTIFICATE' section as well as a 'RSA PRIVATE KEY' section).\n The *.pem file can be created using\n     cp server.crt server.pem\n     cat server.key >> server.pem\n if you have these files instead";
 	conf->webserver.tls.cert.a = cJSON_CreateStringReference("<valid TLS certificate file (*.pem)>");
@@ -1048,6 +1278,27 @@ static void initConfig(struct config *conf)
 	conf->webserver.tls.cert.d.s = (char*)"/etc/pihole/tls.pem";
 	conf->webserver.tls.cert.c = validate_filepath;
 
+	conf->webserver.tls.cache.k = "webserver.tls.cache";
+	conf->webserver.tls.cache.h = "Number of TLS sessions kept in the server-side session cache. Clients reconnecting within webserver.tls.lifetime can resume their session instead of performing a full (expensive) handshake. The value 0 disables the session cache.";
+	conf->webserver.tls.cache.t = CONF_UINT;
+	conf->webserver.tls.cache.f = FLAG_RESTART_FTL;
+	conf->webserver.tls.cache.d.ui = 64;
+	conf->webserver.tls.cache.c = validate_stub; // Only type-based checking
+
+	conf->webserver.tls.tickets.k = "webserver.tls.tickets";
+	conf->webserver.tls.tickets.h = "Should session tickets be issued to clients? Session tickets allow clients to resume their TLS session without the server keeping state. They are encrypted with keys which are regenerated every webserver.tls.lifetime seconds.";
+	conf->webserver.tls.tickets.t = CONF_BOOL;
+	conf->webserver.tls.tickets.f = FLAG_RESTART_FTL;
+	conf->webserver.tls.tickets.d.b = true;
+	conf->webserver.tls.tickets.c = validate_stub; // Only type-based checking
+
+	conf->webserver.tls.lifetime.k = "webserver.tls.lifetime";
+	conf->webserver.tls.lifetime.h = "Lifetime of cached TLS sessions and session tickets (in seconds)";
+	conf->webserver.tls.lifetime.t = CONF_UINT;
+	conf->webserver.tls.lifetime.f = FLAG_RESTART_FTL;
+	conf->webserver.tls.lifetime.d.ui = 86400;
+	conf->webserver.tls.lifetime.c = validate_stub; // Only type-based checking
+
 	conf->webserver.session.timeout.k = "webserver.session.timeout";
 	conf->webserver.session.timeout.h = "Session timeout in seconds. If a session is inactive for more than this time, it will be terminated. Sessions are continuously refreshed by the web interface, preventing sessions from timing out while the web interface is open.\n This option may also be used to make logins persistent for long times, e.g. 86400 seconds (24 hours), 604800 seconds (7 days) or 2592000 seconds (30 days). Note that the total number of concurrent sessions is limited so setting this value too high may result in users being rejected and unable to log in if there are already too many sessions active.";
 	conf->webserver.session.timeout.t = CONF_UINT;
@@ -1199,6 +1450,18 @@ static void initConfig(struct config *conf)
 	conf->webserver.api.client_history_global_max.d.b = true;
 	conf->webserver.api.client_history_global_max.c = validate_stub; // Only type-based checking
 
+	conf->webserver.api.fineHistory.k = "webserver.api.fineHistory";
+	conf->webserver.api.fineHistory.h = "Should FTL keep additional activity graph data with a resolution of 10 seconds for the last hour and of one minute for the last six hours? The finer data is returned by the endpoints /api/history and /api/history/clients when a shorter interval is requested using the parameter interval.";
+	conf->webserver.api.fineHistory.t = CONF_BOOL;
+	conf->webserver.api.fineHistory.d.b = true;
+	conf->webserver.api.fineHistory.c = validate_stub; // Only type-based checking
+
+	conf->webserver.api.responseCache.k = "webserver.api.responseCache";
+	conf->webserver.api.responseCache.h = "For how long may responses of the statistics endpoints (/api/stats/*, /api/history and /api/padd) be reused [seconds]? Responses are only reused as long as no new data has been processed in the meantime. Clients sending If-None-Match receive a 304 Not Modified reply instead. Set this to 0 to disable the response cache.";
+	conf->webserver.api.responseCache.t = CONF_UINT;
+	conf->webserver.api.responseCache.d.ui = 5;
+	conf->webserver.api.responseCache.c = validate_stub; // Only type-based checking
+
 	conf->webserver.api.allow_destructive.k = "webserver.api.allow_destructive";
 	conf->webserver.api.allow_destructive.h = "Allow destructive API calls (e.g. restart DNS server, flush logs, ...)";
 	conf->webserver.api.allow_destructive.t = CONF_BOOL;
@@ -1227,6 +1490,49 @@ static void initConfig(struct config *conf)
 	conf->webserver.api.temp.unit.d.temp_unit = TEMP_UNIT_C;
 	conf->webserver.api.temp.unit.c = validate_stub; // Only type-based checking
 
+	// sub-struct webserver.api.federation
+	conf->webserver.api.federation.peers.k = "webserver.api.federation.peers";
+	conf->webserver.api.federation.peers.h = "Array of other Pi-hole instances whose statistics should be combined with the statistics of this one. FTL periodically fetches a compact summary (counters, activity graph and top lists) from each peer. Cluster-wide statistics are returned by /api/stats/summary, /api/stats/top_domains, /api/stats/top_clients and /api/history when requested with cluster=true. The peers need the same webserver.api.federation.token as this instance. Only plain HTTP is supported, peers should be reachable over a trusted network.\n Example: [ \"http://192.168.2.10\", \"http://pihole2.lan:8080\" ]";
+	conf->webserver.api.federation.peers.a = cJSON_CreateStringReference("array of peers given as [http://]<host>[:<port>]");
+	conf->webserver.api.federation.peers.t = CONF_JSON_STRING_ARRAY;
+	conf->webserver.api.federation.peers.d.json = cJSON_CreateArray();
+	conf->webserver.api.federation.peers.c = validate_stub; // Only type-based checking
+
+	conf->webserver.api.federation.token.k = "webserver.api.federation.token";
+	conf->webserver.api.federation.token.h = "Shared secret of the Pi-hole instances combining their statistics. Peers knowing this token may fetch the statistics summary and the gravity image of this instance without logging in. Peers authenticate each request with it, the token itself is never sent. Their clocks have to be synchronized, requests more than 30 seconds old are rejected. When empty, the summary is only available to authenticated clients and no gravity image is published. This setting is write-only, you can not read the token back.";
+	conf->webserver.api.federation.token.a = cJSON_CreateStringReference("<any string>");
+	conf->webserver.api.federation.token.t = CONF_STRING;
+	conf->webserver.api.federation.token.f = FLAG_WRITE_ONLY;
+	conf->webserver.api.federation.token.d.s = (char*)"";
+	conf->webserver.api.federation.token.c = validate_stub; // Only type-based checking
+
+	conf->webserver.api.federation.interval.k = "webserver.api.federation.interval";
+	conf->webserver.api.federation.interval.h = "How often should the statistics of the peers be fetched [seconds]?";
+	conf->webserver.api.federation.interval.t = CONF_UINT;
+	conf->webserver.api.federation.interval.d.ui = 10;
+	conf->webserver.api.federation.interval.c = validate_stub; // Only type-based checking
+
+	// sub-struct webserver.api.federation.gravity
+	conf->webserver.api.federation.gravity.publish.k = "webserver.api.federation.gravity.publish";
+	conf->webserver.api.federation.gravity.publish.h = "Should this instance publish its gravity database for other Pi-hole instances? When enabled, a signed image consisting of a copy of the gravity database and its compiled index is built whenever the database changes (e.g., after pihole -g). Instances following this one (see webserver.api.federation.gravity.source) then only need to download the parts of the image which changed instead of running pihole -g themselves. Images are signed with a private key created when the first image is published, it is stored next to the image and never leaves this instance. Its public key is logged and has to be set as webserver.api.federation.gravity.key on the instances following this one. Publishing requires webserver.api.federation.token.";
+	conf->webserver.api.federation.gravity.publish.t = CONF_BOOL;
+	conf->webserver.api.federation.gravity.publish.d.b = false;
+	conf->webserver.api.federation.gravity.publish.c = validate_stub; // Only type-based checking
+
+	conf->webserver.api.federation.gravity.source.k = "webserver.api.federation.gravity.source";
+	conf->webserver.api.federation.gravity.source.h = "Pi-hole instance publishing the gravity database this instance should use. FTL checks for a new image every webserver.api.federation.interval seconds, transfers the changed parts of it and verifies them using webserver.api.federation.gravity.key. The local gravity database is then replaced and reloaded, local changes to it are lost. pihole -g should not be run on instances following another one. Only plain HTTP is supported. Leave empty to disable.";
+	conf->webserver.api.federation.gravity.source.a = cJSON_CreateStringReference("[http://]<host>[:<port>], e.g., \"http://192.168.2.10\"");
+	conf->webserver.api.federation.gravity.source.t = CONF_STRING;
+	conf->webserver.api.federation.gravity.source.d.s = (char*)"";
+	conf->webserver.api.federation.gravity.source.c = validate_stub; // Only type-based checking
+
+	conf->webserver.api.federation.gravity.key.k = "webserver.api.federation.gravity.key";
+	conf->webserver.api.federation.gravity.key.h = "Public key of the instance given in webserver.api.federation.gravity.source. Gravity images are only accepted if they are signed with the matching private key. The publisher logs its public key when publishing the first image, it is also part of the manifest at /api/federation/gravity.";
+	conf->webserver.api.federation.gravity.key.a = cJSON_CreateStringReference("<64 hex digits>");
+	conf->webserver.api.federation.gravity.key.t = CONF_STRING;
+	conf->webserver.api.federation.gravity.key.d.s = (char*)"";
+	conf->webserver.api.federation.gravity.key.c = validate_gravity_image_key;
+
 	// struct files
 	conf->files.pid.k = "files.pid";
 	conf->files.pid.h = "The file which contains the PID of FTL's main process.";
@@ -1274,6 +1580,13 @@ static void initConfig(struct config *conf)
 	conf->files.pcap.d.s = (char*)"";
 	conf->files.pcap.c = validate_filepath_empty;
 
+	conf->files.snapshot.k = "files.snapshot";
+	conf->files.snapshot.h = "The location of the snapshot of FTL's in-memory query data saved on clean shutdown. On the next start, queries, clients, domains, and statistics are restored from this file instead of being replayed from the long-term database which can take minutes on busy networks. The snapshot is only used if it has been saved by the same version of FTL and the long-term database has not been changed since, it is removed after startup.\n Setting this to an empty string disables the snapshot. The file must be writable by the user running FTL (typically pihole).";
+	conf->files.snapshot.a = cJSON_CreateStringReference("<any writable file>");
+	conf->files.snapshot.t = CONF_STRING;
+	conf->files.snapshot.d.s = (char*)"/etc/pihole/pihole-FTL.snapshot";
+	conf->files.snapshot.c = validate_filepath_empty;
+
 	// sub-struct files.log
 	// conf->files.log.ftl is set in a separate function
 
@@ -1293,6 +1606,14 @@ static void initConfig(struct config *conf)
 	conf->files.log.dnsmasq.d.s = (char*)"/var/log/pihole/pihole.log";
 	conf->files.log.dnsmasq.c = validate_filepath_dash;
 
+	conf->files.log.queries.k = "files.log.queries";
+	conf->files.log.queries.h = "The binary query log. When set, a compact fixed-size record with time, client, query type, status, reply, upstream and response time is written for every query. This is an alternative to the text query log of dns.queryLogging for processing queries with other tools, use \"pihole-FTL querylog <file>\" to decode it.\n Setting this to an empty string disables the binary query log.";
+	conf->files.log.queries.a = cJSON_CreateStringReference("<any writable file>");
+	conf->files.log.queries.t = CONF_STRING;
+	conf->files.log.queries.f = FLAG_RESTART_FTL;
+	conf->files.log.queries.d.s = (char*)"";
+	conf->files.log.queries.c = validate_filepath_empty;
+
 
 	// struct misc
 	conf->misc.privacylevel.k = "misc.privacylevel";
@@ -1359,6 +1680,94 @@ static void initConfig(struct config *conf)
 	conf->misc.readOnly.d.b = false;
 	conf->misc.readOnly.c = validate_stub; // Only type-based checking
 
+	conf->misc.queryColumns.k = "misc.queryColumns";
+	conf->misc.queryColumns.h = "Should FTL keep a columnar copy of the most frequently scanned fields of the queries in memory (timestamp, status, client, domain, and DNS ID)? Scans over all queries, e.g., when looking for the most recently blocked domain, then read small contiguous arrays instead of the complete query records. This costs 17 additional bytes of memory per query.";
+	conf->misc.queryColumns.t = CONF_BOOL;
+	conf->misc.queryColumns.f = FLAG_RESTART_FTL;
+	conf->misc.queryColumns.d.b = false;
+	conf->misc.queryColumns.c = validate_stub; // Only type-based checking
+
+	conf->misc.domainSuffixes.k = "misc.domainSuffixes";
+	conf->misc.domainSuffixes.h = "Should FTL store new domains as chains of their labels with common suffixes (e.g., cdn.example.com) shared between all domains ending in them? This saves memory when many subdomains of the same domains are queried and lets subdomain filters like *.example.com of /api/queries follow the suffixes instead of comparing strings. Names have to be reconstructed whenever they are needed, which costs some CPU time. Changing this setting only affects domains seen afterwards.";
+	conf->misc.domainSuffixes.t = CONF_BOOL;
+	conf->misc.domainSuffixes.d.b = false;
+	conf->misc.domainSuffixes.c = validate_stub; // Only type-based checking
+
+	conf->misc.shmReserve.k = "misc.shmReserve";
+	conf->misc.shmReserve.h = "Address space (in MiB) FTL should reserve up front for each of its growing shared memory objects (queries, domains, clients, strings, DNS cache, and their lookup tables). Objects then grow in place until they exceed the reservation and other processes accessing them (e.g., TCP workers) do not have to remap them. Only address space is reserved, memory is used as the objects grow. Setting this to 0 disables the reservation. Large values should be avoided on 32-bit systems as their address space is limited.";
+	conf->misc.shmReserve.t = CONF_UINT;
+	conf->misc.shmReserve.f = FLAG_RESTART_FTL;
+	conf->misc.shmReserve.d.ui = 0u;
+	conf->misc.shmReserve.c = validate_stub; // Only type-based checking
+
+	conf->misc.gcPause.k = "misc.gcPause";
+	conf->misc.gcPause.h = "Maximum time (in microseconds) the garbage collection may block DNS resolution and the API while removing old queries from memory. Queries are then removed in slices and other processes and threads can obtain the lock between them. Setting this to 0 removes all old queries in one go. The achieved pauses are reported by the API endpoint /api/info/ftl.";
+	conf->misc.gcPause.t = CONF_UINT;
+	conf->misc.gcPause.d.ui = 0u;
+	conf->misc.gcPause.c = validate_stub; // Only type-based checking
+
+	conf->misc.hotQueries.k = "misc.hotQueries";
+	conf->misc.hotQueries.h = "Number of seconds queries are kept in memory with all their details. Older queries are moved into a compact cold tier holding only what is needed for the statistics, queries of the same minute with the same domain, client, upstream, status, type, and reply are counted only once. Statistics, graphs, and top lists still cover the full history. Queries of the cold tier are listed by /api/queries from the in-memory database. Values below 3600 are treated as 3600, setting this to 0 keeps the full history in memory.";
+	conf->misc.hotQueries.t = CONF_UINT;
+	conf->misc.hotQueries.d.ui = 0u;
+	conf->misc.hotQueries.c = validate_stub; // Only type-based checking
+
+	conf->misc.traceLatency.k = "misc.traceLatency";
+	conf->misc.traceLatency.h = "Should FTL measure how long DNS queries spend in the individual stages of their processing (analysis of client and domain, blocking checks, forwarding, waiting for the upstream reply, and sending the answer)? The durations are collected in per-stage histograms together with a few sampled example queries and are reported by the API endpoint /api/info/latency and the Prometheus metrics. This costs one clock reading per stage and query.";
+	conf->misc.traceLatency.t = CONF_BOOL;
+	conf->misc.traceLatency.d.b = false;
+	conf->misc.traceLatency.c = validate_stub; // Only type-based checking
+
+	conf->misc.compressThreads.k = "misc.compressThreads";
+	conf->misc.compressThreads.h = "Number of threads used for gzip compression (e.g., by pihole-FTL --gzip or when precompressing the static files of the web interface). Files are split into blocks of 1 MiB which are compressed in parallel. The result is an ordinary gzip file. The value 0 uses one thread per CPU core.";
+	conf->misc.compressThreads.t = CONF_UINT;
+	conf->misc.compressThreads.d.ui = 0u;
+	conf->misc.compressThreads.c = validate_stub; // Only type-based checking
+
+	// sub-struct misc.pcap
+	conf->misc.pcap.buffer.k = "misc.pcap.buffer";
+	conf->misc.pcap.buffer.h = "Size of the buffer for the packet capture (files.pcap) in KiB. Packets are collected in the buffer and written together which keeps the capture usable on busy resolvers. Setting this to 0 writes every packet right away.";
+	conf->misc.pcap.buffer.t = CONF_UINT;
+	conf->misc.pcap.buffer.f = FLAG_RESTART_FTL;
+	conf->misc.pcap.buffer.d.ui = 256u;
+	conf->misc.pcap.buffer.c = validate_stub; // Only type-based checking
+
+	conf->misc.pcap.flushInterval.k = "misc.pcap.flushInterval";
+	conf->misc.pcap.flushInterval.h = "Buffered packets are written to the packet capture at least this often [seconds].";
+	conf->misc.pcap.flushInterval.t = CONF_UINT;
+	conf->misc.pcap.flushInterval.d.ui = 1u;
+	conf->misc.pcap.flushInterval.c = validate_stub; // Only type-based checking
+
+	conf->misc.pcap.maxSize.k = "misc.pcap.maxSize";
+	conf->misc.pcap.maxSize.h = "Maximum size of the packet capture in MiB. Larger captures are renamed to <file>.1 (replacing an older one) and a new capture is started. Setting this to 0 disables rotation. Named pipes are never rotated.";
+	conf->misc.pcap.maxSize.t = CONF_UINT;
+	conf->misc.pcap.maxSize.d.ui = 0u;
+	conf->misc.pcap.maxSize.c = validate_stub; // Only type-based checking
+
+	conf->misc.pcap.clients.k = "misc.pcap.clients";
+	conf->misc.pcap.clients.h = "Only record queries of and replies to these clients in the packet capture. Other packets, including those exchanged with upstream servers, are not recorded when this list is not empty.";
+	conf->misc.pcap.clients.a = cJSON_CreateStringReference("array of IP addresses");
+	conf->misc.pcap.clients.t = CONF_JSON_STRING_ARRAY;
+	conf->misc.pcap.clients.f = FLAG_RESTART_FTL;
+	conf->misc.pcap.clients.d.json = cJSON_CreateArray();
+	conf->misc.pcap.clients.c = validate_pcap_clients;
+
+	conf->misc.pcap.types.k = "misc.pcap.types";
+	conf->misc.pcap.types.h = "Only record DNS packets for these query types (e.g. \"A\", \"AAAA\", \"HTTPS\" or a number) in the packet capture.";
+	conf->misc.pcap.types.a = cJSON_CreateStringReference("array of query types");
+	conf->misc.pcap.types.t = CONF_JSON_STRING_ARRAY;
+	conf->misc.pcap.types.f = FLAG_RESTART_FTL;
+	conf->misc.pcap.types.d.json = cJSON_CreateArray();
+	conf->misc.pcap.types.c = validate_pcap_types;
+
+	conf->misc.pcap.rcodes.k = "misc.pcap.rcodes";
+	conf->misc.pcap.rcodes.h = "Only record DNS replies with one of these RCODEs (\"NOERROR\", \"FORMERR\", \"SERVFAIL\", \"NXDOMAIN\", \"NOTIMP\" or \"REFUSED\") in the packet capture. Queries are not recorded when this list is not empty.";
+	conf->misc.pcap.rcodes.a = cJSON_CreateStringReference("array of RCODEs");
+	conf->misc.pcap.rcodes.t = CONF_JSON_STRING_ARRAY;
+	conf->misc.pcap.rcodes.f = FLAG_RESTART_FTL;
+	conf->misc.pcap.rcodes.d.json = cJSON_CreateArray();
+	conf->misc.pcap.rcodes.c = validate_pcap_rcodes;
+
 	// sub-struct misc.check
 	conf->misc.check.load.k = "misc.check.load";
 	conf->misc.check.load.h = "Pi-hole is very lightweight on resources. Nevertheless, this does not mean that you should run Pi-hole on a server that is otherwise extremely busy as queuing on the system can lead to unnecessary delays in DNS operation as the system becomes less and less usable as the system load increases because all resources are permanently in use. To account for this, FTL regularly checks the system load. To bring this to your attention, FTL warns about excessive load when the 15 minute system load average exceeds the number of cores.\n This check can be disabled with this setting.";
@@ -1378,6 +1787,52 @@ static void initConfig(struct config *conf)
 	conf->misc.check.shmem.d.ui = 90;
 	conf->misc.check.shmem.c = validate_stub; // Only type-based checking
 
+	// sub-struct misc.threads
+	conf->misc.threads.dns.cpus.k = "misc.threads.dns.cpus";
+	conf->misc.threads.dns.cpus.h = "CPUs the DNS resolver may run on, given as a comma separated list of CPU numbers and ranges. This is the main thread of FTL receiving queries and sending replies, forked TCP workers inherit this setting. Dedicating CPUs to the resolver on multi-core systems keeps it from being delayed by the database, the web server and other processes. Leave empty to allow all CPUs";
+	conf->misc.threads.dns.cpus.a = cJSON_CreateStringReference("comma separated list of CPU numbers and ranges, e.g., \"2-3\" or \"0,2\", or empty string (\"\") for all CPUs");
+	conf->misc.threads.dns.cpus.t = CONF_STRING;
+	conf->misc.threads.dns.cpus.f = FLAG_RESTART_FTL;
+	conf->misc.threads.dns.cpus.d.s = (char*)"";
+	conf->misc.threads.dns.cpus.c = validate_cpu_list;
+
+	conf->misc.threads.dns.priority.k = "misc.threads.dns.priority";
+	conf->misc.threads.dns.priority.h = "Real-time priority of the DNS resolver between 1 (lowest) and 99 (highest). Real-time threads are run before all other threads on their CPUs as soon as they have work to do (SCHED_FIFO). Note that a busy real-time thread can starve all other threads sharing its CPUs. Set to 0 to use the default scheduling policy";
+	conf->misc.threads.dns.priority.t = CONF_UINT;
+	conf->misc.threads.dns.priority.f = FLAG_RESTART_FTL;
+	conf->misc.threads.dns.priority.d.ui = 0;
+	conf->misc.threads.dns.priority.c = validate_rt_priority;
+
+	conf->misc.threads.background.cpus.k = "misc.threads.background.cpus";
+	conf->misc.threads.background.cpus.h = "CPUs the background threads of FTL (database, garbage collection, host name resolution, timers, NTP, federation and log writer) may run on, in the same format as misc.threads.dns.cpus. Leave empty to allow all CPUs";
+	conf->misc.threads.background.cpus.a = cJSON_CreateStringReference("comma separated list of CPU numbers and ranges, e.g., \"2-3\" or \"0,2\", or empty string (\"\") for all CPUs");
+	conf->misc.threads.background.cpus.t = CONF_STRING;
+	conf->misc.threads.background.cpus.f = FLAG_RESTART_FTL;
+	conf->misc.threads.background.cpus.d.s = (char*)"";
+	conf->misc.threads.background.cpus.c = validate_cpu_list;
+
+	conf->misc.threads.background.priority.k = "misc.threads.background.priority";
+	conf->misc.threads.background.priority.h = "Real-time priority of the background threads of FTL, see misc.threads.dns.priority. Set to 0 to use the default scheduling policy";
+	conf->misc.threads.background.priority.t = CONF_UINT;
+	conf->misc.threads.background.priority.f = FLAG_RESTART_FTL;
+	conf->misc.threads.background.priority.d.ui = 0;
+	conf->misc.threads.background.priority.c = validate_rt_priority;
+
+	conf->misc.threads.webserver.cpus.k = "misc.threads.webserver.cpus";
+	conf->misc.threads.webserver.cpus.h = "CPUs the threads of the web server and API may run on, in the same format as misc.threads.dns.cpus. Leave empty to allow all CPUs";
+	conf->misc.threads.webserver.cpus.a = cJSON_CreateStringReference("comma separated list of CPU numbers and ranges, e.g., \"2-3\" or \"0,2\", or empty string (\"\") for all CPUs");
+	conf->misc.threads.webserver.cpus.t = CONF_STRING;
+	conf->misc.threads.webserver.cpus.f = FLAG_RESTART_FTL;
+	conf->misc.threads.webserver.cpus.d.s = (char*)"";
+	conf->misc.threads.webserver.cpus.c = validate_cpu_list;
+
+	conf->misc.threads.webserver.priority.k = "misc.threads.webserver.priority";
+	conf->misc.threads.webserver.priority.h = "Real-time priority of the threads of the web server and API, see misc.threads.dns.priority. Set to 0 to use the default scheduling policy";
+	conf->misc.threads.webserver.priority.t = CONF_UINT;
+	conf->misc.threads.webserver.priority.f = FLAG_RESTART_FTL;
+	conf->misc.threads.webserver.priority.d.ui = 0;
+	conf->misc.threads.webserver.priority.c = validate_rt_priority;
+
 
 	// struct debug
 	conf->debug.database.k = "debug.database";
@@ -1910,23 +2365,88 @@ const char * __attribute__ ((const)) get_conf_type_str(const enum conf_type type
 	}
 }
 
+// Configurations replaced by replace_config(). Threads reading the config
+// without holding the SHM lock (API, web server, ...) may still use strings
+// and arrays of the previous configuration for a short while, so its values
+// are only freed after CONFIG_GRACE_PERIOD seconds
+struct retired_config {
+	struct config conf;
+	time_t retired;
+	struct retired_config *next;
+};
+static struct retired_config *retired_configs = NULL;
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void replace_config(struct config *newconf)
 {
+	// Allocate the backup before locking to keep the critical section short
+	struct retired_config *old = calloc(1, sizeof(*old));
+
 	// Lock shared memory
 	lock_shm();
 
-	// Backup old config struct (so we can free it)
+	// Backup old config struct (so we can free it later)
 	struct config old_conf;
 	memcpy(&old_conf, &config, sizeof(struct config));
 
 	// Replace old config struct by changed one atomically
 	memcpy(&config, newconf, sizeof(struct config));
 
-	// Free old backup struct
-	free_config(&old_conf);
+	// Update cached exclusion verdicts of domains and clients
+	update_exclude_filters(&old_conf);
+
+	// Rebuild the special domain table on the next query
+	special_domains_invalidate();
+
+	// Free old backup struct right away if we cannot defer it
+	if(old == NULL)
+		free_config(&old_conf);
 
 	// Unlock shared memory
 	unlock_shm();
+
+	if(old == NULL)
+		return;
+
+	// Queue old values for reclamation after the grace period
+	memcpy(&old->conf, &old_conf, sizeof(struct config));
+	old->retired = time(NULL);
+	pthread_mutex_lock(&retired_lock);
+	old->next = retired_configs;
+	retired_configs = old;
+	pthread_mutex_unlock(&retired_lock);
+}
+
+/**
+ * Free configurations which have been replaced at least CONFIG_GRACE_PERIOD
+ * seconds ago. Called periodically by the GC thread. The memory is released
+ * without holding the SHM lock so it does not delay query processing.
+ */
+void reclaim_configs(const time_t now)
+{
+	struct retired_config *expired = NULL;
+
+	// Unlink expired entries. New entries are added at the head, so all
+	// entries after the first expired one have expired as well
+	pthread_mutex_lock(&retired_lock);
+	for(struct retired_config **prev = &retired_configs; *prev != NULL; prev = &(*prev)->next)
+	{
+		if(now - (*prev)->retired >= CONFIG_GRACE_PERIOD)
+		{
+			expired = *prev;
+			*prev = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&retired_lock);
+
+	while(expired != NULL)
+	{
+		struct retired_config *next = expired->next;
+		free_config(&expired->conf);
+		free(expired);
+		expired = next;
+	}
 }
 
 void reread_config(void)
@@ -1952,7 +2472,7 @@ void reread_config(void)
 	duplicate_config(&conf_copy, &config);
 
 	// Read TOML config file
-	bool restart = false;
+	bool restart = false, reload_servers = false;
 	if(readFTLtoml(&config, &conf_copy, NULL, true, &restart, 0))
 	{
 		// Install new configuration
@@ -1973,6 +2493,12 @@ void reread_config(void)
 			restart = true;
 		}
 
+		// Changed upstream servers are applied without a restart
+		char errbuf[ERRBUF_SIZE] = { 0 };
+		reload_servers = !restart &&
+		                 !compare_config_item(config.dns.upstreams.t, &config.dns.upstreams.v, &conf_copy.dns.upstreams.v) &&
+		                 write_dnsmasq_servers(&conf_copy, errbuf);
+
 		// Replace config struct used by FTL by newly loaded
 		// configuration. This swaps the pointers and frees
 		// the old config structure altogether
@@ -1999,6 +2525,8 @@ void reread_config(void)
 	// If we need to restart FTL, we do so now
 	if(restart)
 		restart_ftl("pihole.toml change");
+	else if(reload_servers)
+		FTL_reload_servers();
 }
 
 // Very simple test of a port's availability by trying to bind a TCP socket to
@@ -104,6 +104,7 @@ enum conf_type {
 #define FLAG_ENV_VAR               (1 << 4)
 #define FLAG_CONF_IMPORTED         (1 << 5)
 #define FLAG_READ_ONLY             (1 << 6)
+#define FLAG_RELOAD_SERVERS        (1 << 7)
 
 struct conf_item {
 	const char *k;        // item Key
@@ -151,16 +152,29 @@ struct config {
 		struct conf_item queryLogging;
 		struct conf_item cnameRecords;
 		struct conf_item port;
+		struct conf_item dotPort;
 		struct conf_item revServers;
+		struct conf_item fastestUpstream;
+		struct conf_item circuitBreaker;
+		struct conf_item udpWorkers;
+		struct conf_item tcpWorkers;
 		struct {
 			struct conf_item size;
 			struct conf_item optimizer;
 			struct conf_item upstreamBlockedTTL;
+			struct conf_item prefetch;
+			struct conf_item prefetchHits;
+			struct conf_item aggressiveNSEC;
+			struct conf_item autosize;
+			struct conf_item maxSize;
+			struct conf_item persist;
 		} cache;
 		struct {
 			struct conf_item active;
 			struct conf_item mode;
 			struct conf_item edns;
+			struct conf_item compiledIndex;
+			struct conf_item combinedRegex;
 		} blocking;
 		struct {
 			struct conf_item mozillaCanary;
@@ -184,6 +198,8 @@ struct config {
 		struct {
 			struct conf_item count;
 			struct conf_item interval;
+			struct conf_item prefixV4;
+			struct conf_item prefixV6;
 		} rateLimit;
 	} dns;
 
@@ -203,6 +219,7 @@ struct config {
 	} dhcp;
 
 	struct {
+		struct conf_item rateLimit;
 		struct {
 			struct conf_item active;
 			struct conf_item address;
@@ -229,17 +246,33 @@ struct config {
 		struct conf_item resolveIPv6;
 		struct conf_item networkNames;
 		struct conf_item refreshNames;
+		struct conf_item nameSources;
 	} resolver;
 
 	struct {
 		struct conf_item DBimport;
 		struct conf_item maxDBdays;
+		struct conf_item partitionDays;
+		struct conf_item archiveDays;
+		struct conf_item ioBudget;
+		struct conf_item memoryLimit;
+		struct conf_item inMemory;
 		struct conf_item DBinterval;
 		struct conf_item useWAL;
+		struct conf_item gravitySearchIndex;
 		struct {
 			struct conf_item parseARPcache;
 			struct conf_item expire;
 		} network;
+		struct {
+			struct conf_item replica;
+			struct conf_item interval;
+			struct conf_item bwlimit;
+		} replication;
+		struct {
+			struct conf_item target;
+			struct conf_item buffer;
+		} sink;
 	} database;
 
 	struct {
@@ -249,12 +282,24 @@ struct config {
 		struct conf_item threads;
 		struct conf_item headers;
 		struct conf_item serve_all;
+		struct conf_item precompress;
+		struct {
+			struct conf_item min;
+			struct conf_item idle;
+			struct conf_item reserved;
+			struct conf_item heavy;
+			struct conf_item bulk;
+			struct conf_item wait;
+		} pool;
 		struct {
 			struct conf_item timeout;
 			struct conf_item restore;
 		} session;
 		struct {
 			struct conf_item cert;
+			struct conf_item cache;
+			struct conf_item tickets;
+			struct conf_item lifetime;
 		} tls;
 		struct {
 			struct conf_item webroot;
@@ -279,11 +324,23 @@ struct config {
 			struct conf_item maxHistory;
 			struct conf_item maxClients;
 			struct conf_item client_history_global_max;
+			struct conf_item fineHistory;
+			struct conf_item responseCache;
 			struct conf_item allow_destructive;
 			struct {
 				struct conf_item limit;
 				struct conf_item unit;
 			} temp;
+			struct {
+				struct conf_item peers;
+				struct conf_item token;
+				struct conf_item interval;
+				struct {
+					struct conf_item publish;
+					struct conf_item source;
+					struct conf_item key;
+				} gravity;
+			} federation;
 		} api;
 	} webserver;
 
@@ -294,10 +351,12 @@ struct config {
 		struct conf_item gravity_tmp;
 		struct conf_item macvendor;
 		struct conf_item pcap;
+		struct conf_item snapshot;
 		struct {
 			struct conf_item ftl;
 			struct conf_item dnsmasq;
 			struct conf_item webserver;
+			struct conf_item queries;
 		} log;
 	} files;
 
@@ -310,11 +369,40 @@ struct config {
 		struct conf_item dnsmasq_lines;
 		struct conf_item extraLogging;
 		struct conf_item readOnly;
+		struct conf_item queryColumns;
+		struct conf_item domainSuffixes;
+		struct conf_item shmReserve;
+		struct conf_item gcPause;
+		struct conf_item hotQueries;
+		struct conf_item traceLatency;
+		struct conf_item compressThreads;
+		struct {
+			struct conf_item buffer;
+			struct conf_item flushInterval;
+			struct conf_item maxSize;
+			struct conf_item clients;
+			struct conf_item types;
+			struct conf_item rcodes;
+		} pcap;
 		struct {
 			struct conf_item load;
 			struct conf_item shmem;
 			struct conf_item disk;
 		} check;
+		struct {
+			struct {
+				struct conf_item cpus;
+				struct conf_item priority;
+			} dns;
+			struct {
+				struct conf_item cpus;
+				struct conf_item priority;
+			} background;
+			struct {
+				struct conf_item cpus;
+				struct conf_item priority;
+			} webserver;
+		} threads;
 	} misc;
 
 	struct {
@@ -358,6 +446,13 @@ struct config {
 extern struct config config;
 
 #define CONFIG_ELEMENTS (sizeof(config)/sizeof(struct conf_item))
+// Seconds after which the values of a replaced configuration are freed
+#define CONFIG_GRACE_PERIOD 30
+// Changes of the configuration made through the API are written to disk (and
+// restarts are performed) once no further change arrived for this many
+// seconds, but at most CHANGE_MAX_DELAY seconds after the first change
+#define CHANGE_QUIET_PERIOD 1.0
+#define CHANGE_MAX_DELAY 5.0
 #define DEBUG_ELEMENTS (sizeof(config.debug)/sizeof(struct conf_item))
 
 // Defined in config.c
@@ -377,6 +472,7 @@ void free_config_path(char **paths);
 bool check_paths_equal(char **paths1, char **paths2, unsigned int max_level) __attribute__ ((pure));
 const char *get_conf_type_str(const enum conf_type type) __attribute__ ((const));
 void replace_config(struct config *newconf);
+void reclaim_configs(const time_t now);
 void reread_config(void);
 bool create_migration_target_v6(void);
 
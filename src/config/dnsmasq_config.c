@@ -28,10 +28,12 @@
 #include <unistd.h>
 // wait
 #include <sys/wait.h>
+// PATH_MAX
+#include <limits.h>
 
 #define HEADER_WIDTH 80
 
-static bool test_dnsmasq_config(char errbuf[ERRBUF_SIZE])
+static bool test_dnsmasq_config(const char *path, char errbuf[ERRBUF_SIZE])
 {
 	// Create a pipe for communication with our child
 	int pipefd[2];
@@ -51,9 +53,12 @@ static bool test_dnsmasq_config(char errbuf[ERRBUF_SIZE])
 		// Close the reading end of the pipe
 		close(pipefd[0]);
 
+		char conf_file[PATH_MAX + 16];
+		snprintf(conf_file, sizeof(conf_file), "--conf-file=%s", path);
+
 		const char *argv[3];
 		argv[0] = "X";
-		argv[1] = "--conf-file="DNSMASQ_TEMP_CONF;
+		argv[1] = conf_file;
 		argv[2] = "--test";
 
 		// Disable logging
@@ -153,7 +158,7 @@ check_return:
 			if(lineno > 0)
 			{
 				const size_t errbuf_size = strlen(errbuf);
-				char *line = get_dnsmasq_line(lineno);
+				char *line = get_dnsmasq_line(path, lineno);
 				// Append line to error message
 				snprintf(errbuf+errbuf_size, ERRBUF_SIZE-errbuf_size, ": \"%s\"", line);
 				free(line);
@@ -181,13 +186,13 @@ int get_lineno_from_string(const char *string)
 		return -1;
 }
 
-char *get_dnsmasq_line(const unsigned int lineno)
+char *get_dnsmasq_line(const char *path, const unsigned int lineno)
 {
 	// Open temporary file
-	FILE *fp = fopen(DNSMASQ_TEMP_CONF, "r");
+	FILE *fp = fopen(path, "r");
 	if (fp == NULL)
 	{
-		log_warn("Cannot read "DNSMASQ_TEMP_CONF);
+		log_warn("Cannot read %s", path);
 		return NULL;
 	}
 
@@ -244,6 +249,98 @@ static void write_config_header(FILE *fp, const char *description)
 	CONFIG_CENTER(fp, HEADER_WIDTH, "%s", "################################################################################");
 }
 
+// Write the upstream servers into a temporary file. They are kept out of
+// the main config file so dnsmasq can re-read them without a restart
+static bool write_servers_file(const struct config *conf)
+{
+	log_debug(DEBUG_CONFIG, "Opening "DNSMASQ_SERVERS_TEMP" for writing");
+	FILE *fp = fopen(DNSMASQ_SERVERS_TEMP, "w");
+	if(!fp)
+	{
+		log_err("Cannot open "DNSMASQ_SERVERS_TEMP" for writing, unable to update upstream servers: %s", strerror(errno));
+		return false;
+	}
+
+	// Lock file, may block if the file is currently opened
+	const bool locked = lock_file(fp, DNSMASQ_SERVERS_TEMP);
+
+	write_config_header(fp, "Upstream DNS servers");
+	fputc('\n', fp);
+
+	const int n = cJSON_GetArraySize(conf->dns.upstreams.v.json);
+	for(int i = 0; i < n; i++)
+	{
+		cJSON *server = cJSON_GetArrayItem(conf->dns.upstreams.v.json, i);
+		if(server != NULL && cJSON_IsString(server))
+			fprintf(fp, "server=%s\n", server->valuestring);
+	}
+
+	// Unlock file
+	if(locked)
+		unlock_file(fp, DNSMASQ_SERVERS_TEMP);
+
+	if(fclose(fp) != 0)
+	{
+		log_err("Cannot close "DNSMASQ_SERVERS_TEMP": %s", strerror(errno));
+		return false;
+	}
+
+	// Chown file if we are root
+	if(geteuid() == 0)
+		chown_pihole(DNSMASQ_SERVERS_TEMP, NULL);
+
+	return true;
+}
+
+// Replace the servers file by the temporary file written before if they differ
+static bool install_servers_file(void)
+{
+	// Skip the header when comparing
+	if(files_different(DNSMASQ_SERVERS_TEMP, DNSMASQ_SERVERS, 24))
+	{
+		if(rename(DNSMASQ_SERVERS_TEMP, DNSMASQ_SERVERS) != 0)
+		{
+			log_err("Cannot install "DNSMASQ_SERVERS": %s", strerror(errno));
+			remove(DNSMASQ_SERVERS_TEMP);
+			return false;
+		}
+		log_debug(DEBUG_CONFIG, "Upstream servers written to "DNSMASQ_SERVERS);
+		return true;
+	}
+
+	log_debug(DEBUG_CONFIG, DNSMASQ_SERVERS" unchanged");
+	if(remove(DNSMASQ_SERVERS_TEMP) != 0)
+	{
+		log_err("Cannot remove "DNSMASQ_SERVERS_TEMP": %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Write and test the upstream servers file without touching the remaining
+ * dnsmasq configuration. The running resolver picks up the new servers on
+ * FTL_reload_servers() without restarting or flushing its cache.
+ */
+bool __attribute__((nonnull(1,2))) write_dnsmasq_servers(const struct config *conf, char errbuf[ERRBUF_SIZE])
+{
+	if(!write_servers_file(conf))
+	{
+		strncpy(errbuf, "Cannot write upstream servers file", ERRBUF_SIZE);
+		return false;
+	}
+
+	if(!test_dnsmasq_config(DNSMASQ_SERVERS_TEMP, errbuf))
+	{
+		log_warn("New upstream servers are not valid (%s), config remains unchanged", errbuf);
+		remove(DNSMASQ_SERVERS_TEMP);
+		return false;
+	}
+
+	return install_servers_file();
+}
+
 bool __attribute__((nonnull(1,3))) write_dnsmasq_config(struct config *conf, bool test_config, char errbuf[ERRBUF_SIZE])
 {
 	// Early config checks
@@ -334,18 +431,9 @@ bool __attribute__((nonnull(1,3))) write_dnsmasq_config(struct config *conf, boo
 	fputs("# DNS port to be used\n", pihole_conf);
 	fprintf(pihole_conf, "port=%u\n", conf->dns.port.v.u16);
 	fputs("\n", pihole_conf);
-	if(cJSON_GetArraySize(conf->dns.upstreams.v.json) > 0)
-	{
-		fputs("# List of upstream DNS server\n", pihole_conf);
-		const int n = cJSON_GetArraySize(conf->dns.upstreams.v.json);
-		for(int i = 0; i < n; i++)
-		{
-			cJSON *server = cJSON_GetArrayItem(conf->dns.upstreams.v.json, i);
-			if(server != NULL && cJSON_IsString(server))
-				fprintf(pihole_conf, "server=%s\n", server->valuestring);
-		}
-		fputs("\n", pihole_conf);
-	}
+	fputs("# List of upstream DNS servers (re-read without restarting on changes)\n", pihole_conf);
+	fputs("servers-file="DNSMASQ_SERVERS"\n", pihole_conf);
+	fputs("\n", pihole_conf);
 	fputs("# Set the size of dnsmasq's cache. The default is 150 names. Setting the cache\n", pihole_conf);
 	fputs("# size to zero disables caching. Note: huge cache size impacts performance\n", pihole_conf);
 	fprintf(pihole_conf, "cache-size=%u\n", conf->dns.cache.size.v.ui);
@@ -798,9 +886,26 @@ bool __attribute__((nonnull(1,3))) write_dnsmasq_config(struct config *conf, boo
 	if(geteuid() == 0)
 		chown_pihole(DNSMASQ_TEMP_CONF, NULL);
 
+	// The servers file is only read when dnsmasq starts so it has to be
+	// tested on its own
+	if(!write_servers_file(conf))
+	{
+		strncpy(errbuf, "Cannot write upstream servers file", ERRBUF_SIZE);
+		remove(DNSMASQ_TEMP_CONF);
+		return false;
+	}
+	if(test_config && !test_dnsmasq_config(DNSMASQ_SERVERS_TEMP, errbuf))
+	{
+		log_warn("New upstream servers are not valid (%s), config remains unchanged", errbuf);
+		remove(DNSMASQ_SERVERS_TEMP);
+		remove(DNSMASQ_TEMP_CONF);
+		return false;
+	}
+
 	log_debug(DEBUG_CONFIG, "Testing "DNSMASQ_TEMP_CONF);
-	if(test_config && !test_dnsmasq_config(errbuf))
+	if(test_config && !test_dnsmasq_config(DNSMASQ_TEMP_CONF, errbuf))
 	{
+		remove(DNSMASQ_SERVERS_TEMP);
 		log_warn("New dnsmasq configuration is not valid (%s), config remains unchanged", errbuf);
 
 		if(debug_flags[DEBUG_ANY])
@@ -827,9 +932,10 @@ bool __attribute__((nonnull(1,3))) write_dnsmasq_config(struct config *conf, boo
 		{
 			log_err("Cannot install dnsmasq config file: %s", strerror(errno));
 
-			// Remove temporary config file
+			// Remove temporary config files
 			if(remove(DNSMASQ_TEMP_CONF) != 0)
 				log_err("Cannot remove temporary dnsmasq config file: %s", strerror(errno));
+			remove(DNSMASQ_SERVERS_TEMP);
 
 			return false;
 		}
@@ -846,7 +952,8 @@ bool __attribute__((nonnull(1,3))) write_dnsmasq_config(struct config *conf, boo
 			return false;
 		}
 	}
-	return true;
+
+	return install_servers_file();
 }
 
 bool read_legacy_dhcp_static_config(void)
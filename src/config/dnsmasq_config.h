@@ -15,8 +15,11 @@
 #define ERRBUF_SIZE 1024
 
 bool write_dnsmasq_config(struct config *conf, bool test_config, char errbuf[ERRBUF_SIZE]) __attribute__((nonnull(1,3)));
+bool write_dnsmasq_servers(const struct config *conf, char errbuf[ERRBUF_SIZE]) __attribute__((nonnull(1,2)));
+// defined in src/dnsmasq_interface.c
+void FTL_reload_servers(void);
 int get_lineno_from_string(const char *string);
-char *get_dnsmasq_line(const unsigned int lineno);
+char *get_dnsmasq_line(const char *path, const unsigned int lineno);
 bool read_legacy_dhcp_static_config(void);
 bool read_legacy_cnames_config(void);
 bool read_legacy_custom_hosts_config(void);
@@ -24,6 +27,8 @@ bool write_custom_list(void);
 
 #define DNSMASQ_PH_CONFIG "/etc/pihole/dnsmasq.conf"
 #define DNSMASQ_TEMP_CONF "/etc/pihole/dnsmasq.conf.temp"
+#define DNSMASQ_SERVERS "/etc/pihole/dnsmasq.servers"
+#define DNSMASQ_SERVERS_TEMP "/etc/pihole/dnsmasq.servers.temp"
 #define DNSMASQ_STATIC_LEASES MIGRATION_TARGET_V6"/04-pihole-static-dhcp.conf"
 #define DNSMASQ_CNAMES MIGRATION_TARGET_V6"/05-pihole-custom-cname.conf"
 #define DNSMASQ_HOSTSDIR "/etc/pihole/hosts"
@@ -28,6 +28,7 @@
 #include <nettle/base64.h>
 #include <nettle/version.h>
 #include <nettle/balloon.h>
+#include <nettle/hmac.h>
 
 // Salt length for balloon hashing
 // The purpose of including salts is to modify the function used to hash each
@@ -53,6 +54,23 @@
 #define CLI_PW_FILE "/etc/pihole/cli_pw"
 static char *cli_password = NULL;
 
+// Cache of recently verified passwords
+// Scripts authenticating every request with the app password would otherwise
+// run the (deliberately expensive) balloon hash each time. Only an HMAC of
+// password hash and password under a random per-process key is kept, never
+// the password itself. Entries expire after a short time and all of them are
+// dropped (and the key is replaced) when a password is changed. As the
+// password hash is part of the HMAC, entries of replaced hashes never match.
+// Incorrect passwords are not cached, they always take the full cost.
+struct verified_password {
+	uint8_t mac[SHA256_DIGEST_SIZE];
+	time_t expires;
+};
+static struct verified_password verified[PASSWORD_CACHE_SIZE] = {{ { 0 }, 0 }};
+static uint8_t verified_key[SHA256_DIGEST_SIZE] = { 0 };
+static bool verified_key_set = false;
+static pthread_mutex_t verified_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Convert RAW data into hex representation
 // Two hexadecimal digits are generated for each input byte.
 void sha256_raw_to_hex(uint8_t *data, char *buffer)
@@ -383,6 +401,78 @@ static bool parse_PHC_string(const char *phc, size_t *s_cost, size_t *t_cost, ui
 	return true;
 }
 
+// Compute the cache key of a password verified against a password hash.
+// Caller has to hold verified_lock
+static bool verified_mac(const char *password, const char *pwhash, uint8_t mac[SHA256_DIGEST_SIZE])
+{
+	if(!verified_key_set)
+	{
+		if(!get_secure_randomness(verified_key, sizeof(verified_key)))
+			return false;
+		verified_key_set = true;
+	}
+
+	struct hmac_sha256_ctx ctx;
+	hmac_sha256_set_key(&ctx, sizeof(verified_key), verified_key);
+	// Include the terminating NUL of the hash to separate it from the password
+	hmac_sha256_update(&ctx, strlen(pwhash) + 1, (const uint8_t*)pwhash);
+	hmac_sha256_update(&ctx, strlen(password), (const uint8_t*)password);
+	hmac_sha256_digest(&ctx, SHA256_DIGEST_SIZE, mac);
+	explicit_bzero(&ctx, sizeof(ctx));
+
+	return true;
+}
+
+// Check if this password has recently been verified against this hash
+static bool is_verified_password(const char *password, const char *pwhash)
+{
+	uint8_t mac[SHA256_DIGEST_SIZE];
+	const time_t now = time(NULL);
+	bool found = false;
+
+	pthread_mutex_lock(&verified_lock);
+	if(verified_mac(password, pwhash, mac))
+	{
+		// Compare against all entries in constant time
+		for(unsigned int i = 0; i < PASSWORD_CACHE_SIZE; i++)
+		{
+			uint8_t diff = 0;
+			for(unsigned int j = 0; j < SHA256_DIGEST_SIZE; j++)
+				diff |= verified[i].mac[j] ^ mac[j];
+			found |= diff == 0 && verified[i].expires >= now;
+		}
+	}
+	pthread_mutex_unlock(&verified_lock);
+	explicit_bzero(mac, sizeof(mac));
+
+	return found;
+}
+
+// Remember a successfully verified password, replacing the entry which
+// expires first
+static void add_verified_password(const char *password, const char *pwhash)
+{
+	pthread_mutex_lock(&verified_lock);
+	unsigned int slot = 0;
+	for(unsigned int i = 1; i < PASSWORD_CACHE_SIZE; i++)
+		if(verified[i].expires < verified[slot].expires)
+			slot = i;
+
+	if(verified_mac(password, pwhash, verified[slot].mac))
+		verified[slot].expires = time(NULL) + PASSWORD_CACHE_TTL;
+	pthread_mutex_unlock(&verified_lock);
+}
+
+// Forget all verified passwords, called when a password changes
+void flush_verified_passwords(void)
+{
+	pthread_mutex_lock(&verified_lock);
+	explicit_bzero(verified, sizeof(verified));
+	explicit_bzero(verified_key, sizeof(verified_key));
+	verified_key_set = false;
+	pthread_mutex_unlock(&verified_lock);
+}
+
 char * __attribute__((malloc)) create_password(const char *password)
 {
 	// Generate a 128 bit random salt
@@ -455,6 +545,14 @@ enum password_result verify_password(const char *password, const char *pwhash, c
 	// Check password hash format
 	if(pwhash[0] == '$')
 	{
+		// Recently verified passwords skip the balloon hash
+		if(is_verified_password(password, pwhash))
+		{
+			// Successful logins do not count against rate-limiting
+			num_password_attempts--;
+			return PASSWORD_CORRECT;
+		}
+
 		// Parse PHC string
 		size_t s_cost = 0;
 		size_t t_cost = 0;
@@ -474,7 +572,10 @@ enum password_result verify_password(const char *password, const char *pwhash, c
 
 		// Successful logins do not count against rate-limiting
 		if(result)
+		{
 			num_password_attempts--;
+			add_verified_password(password, pwhash);
+		}
 
 		return result ? PASSWORD_CORRECT : PASSWORD_INCORRECT;
 	}
@@ -697,6 +798,9 @@ bool set_and_check_password(struct conf_item *conf_item, const char *password)
 		return true;
 	}
 
+	// Passwords verified against the old hash must not be accepted anymore
+	flush_verified_passwords();
+
 	// Get password hash as allocated string (an empty string is hashed to an empty string)
 	char *pwhash = strlen(password) > 0 ? create_password(password) : strdup("");
 
@@ -24,6 +24,7 @@ bool set_and_check_password(struct conf_item *conf_item, const char *password);
 bool generate_password(char **password, char **pwhash);
 bool create_cli_password(void);
 bool remove_cli_password(void);
+void flush_verified_passwords(void);
 
 enum password_result {
 	PASSWORD_INCORRECT = 0,
@@ -37,4 +38,8 @@ enum password_result {
 // The maximum number of password attempts per second
 #define MAX_PASSWORD_ATTEMPTS_PER_SECOND 3
 
+// Number of recently verified passwords remembered and for how long (seconds)
+#define PASSWORD_CACHE_SIZE 8
+#define PASSWORD_CACHE_TTL 60
+
 #endif //PASSWORD_H
@@ -212,3 +212,49 @@ bool writeFTLtoml(const bool verbose)
 
 	return true;
 }
+
+// Pending write of pihole.toml requested by schedule_config_write()
+static struct {
+	bool pending;
+	double first;
+	double last;
+} deferred_write = { false, 0.0, 0.0 };
+static pthread_mutex_t deferred_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Request writing pihole.toml. Scripts changing many settings in a row (one
+ * API request each) would otherwise rewrite the entire file for every single
+ * change. The file is written by flush_config_write() once the changes have
+ * settled.
+ */
+void schedule_config_write(void)
+{
+	const double now = double_time();
+	pthread_mutex_lock(&deferred_write_lock);
+	if(!deferred_write.pending)
+		deferred_write.first = now;
+	deferred_write.pending = true;
+	deferred_write.last = now;
+	pthread_mutex_unlock(&deferred_write_lock);
+}
+
+/**
+ * Write pihole.toml if a write has been scheduled and no further change arrived
+ * for CHANGE_QUIET_PERIOD seconds (or the first change is CHANGE_MAX_DELAY
+ * seconds old). Called periodically by the GC thread and with force = true
+ * before FTL terminates.
+ */
+void flush_config_write(const bool force)
+{
+	const double now = double_time();
+	pthread_mutex_lock(&deferred_write_lock);
+	const bool due = deferred_write.pending &&
+	                 (force || now - deferred_write.last >= CHANGE_QUIET_PERIOD ||
+	                  now - deferred_write.first >= CHANGE_MAX_DELAY);
+	if(due)
+		deferred_write.pending = false;
+	pthread_mutex_unlock(&deferred_write_lock);
+
+	if(due)
+		writeFTLtoml(true);
+}
@@ -11,5 +11,7 @@
 #define TOML_WRITER_H
 
 bool writeFTLtoml(const bool verbose);
+void schedule_config_write(void);
+void flush_config_write(const bool force);
 
 #endif //TOML_WRITER_H
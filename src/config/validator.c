@@ -14,6 +14,16 @@
 #include "tools/gravity-parseList.h"
 // regex
 #include "regex_r.h"
+// name_source_str()
+#include "resolve.h"
+// pcap_qtype(), pcap_rcode()
+#include "pcap-writer.h"
+// parse_sink_target()
+#include "database/query-sink.h"
+// parse_cpu_list()
+#include "daemon.h"
+// gravity_image_parse_key()
+#include "database/gravity-image.h"
 
 // Stub validator for config types that need to dedicated validation as they can
 // be tested by their type only (e.g., integers, strings, booleans, enums, etc.)
@@ -535,3 +545,176 @@ bool validate_dns_revServers(union conf_value *val, const char *key, char err[VA
 	// Return success
 	return true;
 }
+
+// Validate resolver.nameSources array
+// Each entry has to be one of the known sources, none may be given twice
+bool validate_resolver_nameSources(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	// Check if it's an array
+	if(!cJSON_IsArray(val->json))
+	{
+		snprintf(err, VALIDATOR_ERRBUF_LEN, "%s: not an array", key);
+		return false;
+	}
+
+	bool seen[NAME_SOURCES] = { false };
+	for(int i = 0; i < cJSON_GetArraySize(val->json); i++)
+	{
+		// Get array item
+		cJSON *item = cJSON_GetArrayItem(val->json, i);
+
+		// Check if it's a string
+		if(!cJSON_IsString(item))
+		{
+			snprintf(err, VALIDATOR_ERRBUF_LEN, "%s[%d]: not a string", key, i);
+			return false;
+		}
+
+		// Check if it's a known source
+		unsigned int source = 0;
+		while(source < NAME_SOURCES && strcmp(item->valuestring, name_source_str(source)) != 0)
+			source++;
+		if(source == NAME_SOURCES)
+		{
+			snprintf(err, VALIDATOR_ERRBUF_LEN, "%s[%d]: unknown source \"%s\"",
+			         key, i, item->valuestring);
+			return false;
+		}
+
+		// Check if it's a duplicate
+		if(seen[source])
+		{
+			snprintf(err, VALIDATOR_ERRBUF_LEN, "%s[%d]: source \"%s\" is given more than once",
+			         key, i, item->valuestring);
+			return false;
+		}
+		seen[source] = true;
+	}
+
+	// Return success
+	return true;
+}
+
+// Check that val is an array of strings which are accepted by valid()
+static bool validate_string_array(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN],
+                                  bool (*valid)(const char *), const char *what)
+{
+	// Check if it's an array
+	if(!cJSON_IsArray(val->json))
+	{
+		snprintf(err, VALIDATOR_ERRBUF_LEN, "%s: not an array", key);
+		return false;
+	}
+
+	for(int i = 0; i < cJSON_GetArraySize(val->json); i++)
+	{
+		// Get array item
+		cJSON *item = cJSON_GetArrayItem(val->json, i);
+
+		// Check if it's a string
+		if(!cJSON_IsString(item))
+		{
+			snprintf(err, VALIDATOR_ERRBUF_LEN, "%s[%d]: not a string", key, i);
+			return false;
+		}
+
+		if(!valid(item->valuestring))
+		{
+			snprintf(err, VALIDATOR_ERRBUF_LEN, "%s[%d]: not a valid %s (\"%s\")",
+			         key, i, what, item->valuestring);
+			return false;
+		}
+	}
+
+	// Return success
+	return true;
+}
+
+static bool valid_ip(const char *ip)
+{
+	struct in6_addr addr;
+	return inet_pton(AF_INET, ip, &addr) == 1 || inet_pton(AF_INET6, ip, &addr) == 1;
+}
+
+static bool valid_qtype(const char *name)
+{
+	return pcap_qtype(name) > 0;
+}
+
+static bool valid_rcode(const char *name)
+{
+	return pcap_rcode(name) >= 0;
+}
+
+bool validate_pcap_clients(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	return validate_string_array(val, key, err, valid_ip, "IP address");
+}
+
+bool validate_pcap_types(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	return validate_string_array(val, key, err, valid_qtype, "query type");
+}
+
+bool validate_pcap_rcodes(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	return validate_string_array(val, key, err, valid_rcode, "RCODE");
+}
+
+// Validate the target of the query sink (empty allowed)
+bool validate_sink_target(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	if(strlen(val->s) == 0)
+		return true;
+
+	struct sink_target target;
+	if(!parse_sink_target(val->s, &target))
+	{
+		snprintf(err, VALIDATOR_ERRBUF_LEN, "%s: not a valid sink target (\"%s\")", key, val->s);
+		return false;
+	}
+
+	return true;
+}
+
+// Validate the public key of a gravity image publisher (empty allowed)
+bool validate_gravity_image_key(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	if(strlen(val->s) == 0)
+		return true;
+
+	uint8_t public_key[GRAVITY_IMAGE_KEY_SIZE];
+	if(!gravity_image_parse_key(val->s, public_key))
+	{
+		snprintf(err, VALIDATOR_ERRBUF_LEN, "%s: not a valid public key (expected %u hex digits)", key, 2*GRAVITY_IMAGE_KEY_SIZE);
+		return false;
+	}
+
+	return true;
+}
+
+bool validate_cpu_list(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	if(strlen(val->s) == 0)
+		return true;
+
+	cpu_set_t set;
+	if(!parse_cpu_list(val->s, &set))
+	{
+		snprintf(err, VALIDATOR_ERRBUF_LEN, "%s: not a valid list of CPUs (\"%s\")", key, val->s);
+		return false;
+	}
+
+	return true;
+}
+
+bool validate_rt_priority(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN])
+{
+	if(val->ui > 99)
+	{
+		snprintf(err, VALIDATOR_ERRBUF_LEN, "%s: real-time priority must be between 1 and 99 or 0 to disable (%u)", key, val->ui);
+		return false;
+	}
+
+	return true;
+}
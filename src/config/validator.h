@@ -26,5 +26,13 @@ bool validate_filepath_empty(union conf_value *val, const char *key, char err[VA
 bool validate_filepath_dash(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
 bool validate_regex_array(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
 bool validate_dns_revServers(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_resolver_nameSources(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_pcap_clients(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_pcap_types(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_pcap_rcodes(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_cpu_list(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_rt_priority(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_sink_target(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
+bool validate_gravity_image_key(union conf_value *val, const char *key, char err[VALIDATOR_ERRBUF_LEN]);
 
 #endif // CONFIG_VALIDATOR_H
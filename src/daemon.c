@@ -16,6 +16,10 @@
 #include "timers.h"
 // gravityDB_close()
 #include "database/gravity-db.h"
+// gravity_index_free()
+#include "database/gravity-index.h"
+// gravity_filter_free()
+#include "database/gravity-filter.h"
 // destroy_shmem()
 #include "shmem.h"
 // uname()
@@ -29,7 +33,7 @@
 #include <sys/resource.h>
 // free_regex()
 #include "regex_r.h"
-// close_memory_database()
+// close_memory_database(), save_query_snapshot()
 #include "database/query-table.h"
 // http_terminate()
 #include "webserver/webserver.h"
@@ -43,6 +47,16 @@
 #include "procps.h"
 // destroy_entropy()
 #include "webserver/x509.h"
+// stop_log_writer()
+#include "log-writer.h"
+// flush_querylog()
+#include "querylog.h"
+// pcap_flush()
+#include "pcap-writer.h"
+// flush_config_write()
+#include "config/toml_writer.h"
+// pthread_setaffinity_np(), pthread_setschedparam()
+#include <pthread.h>
 
 pthread_t threads[THREADS_MAX] = { 0 };
 bool resolver_ready = false;
@@ -300,6 +314,7 @@ static void terminate_threads(void)
 {
 	// Terminate threads before closing database connections and finishing shared memory
 	killed = true;
+	wake_all_threads();
 	// Try to join threads to ensure cancellation has succeeded
 	log_info("Waiting for threads to join");
 	for(int i = 0; i < THREADS_MAX; i++)
@@ -393,6 +408,155 @@ void set_nice(void)
 	}
 }
 
+// Parse a list of CPUs such as "0-2,4", returns false if the list is malformed
+// or refers to CPUs beyond CPU_SETSIZE
+bool parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	const char *p = list;
+	while(*p != '\0')
+	{
+		char *end = NULL;
+		const unsigned long first = strtoul(p, &end, 10);
+		if(end == p || first >= CPU_SETSIZE)
+			return false;
+		unsigned long last = first;
+		p = end;
+
+		// Range of CPUs
+		if(*p == '-')
+		{
+			p++;
+			last = strtoul(p, &end, 10);
+			if(end == p || last >= CPU_SETSIZE || last < first)
+				return false;
+			p = end;
+		}
+
+		for(unsigned long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, set);
+
+		if(*p == ',' && *(p + 1) != '\0')
+			p++;
+		else if(*p != '\0')
+			return false;
+	}
+
+	return CPU_COUNT(set) > 0;
+}
+
+// Format set as a list of CPUs such as "0-2,4"
+static void format_cpu_list(const cpu_set_t *set, char *buf, const size_t len)
+{
+	size_t pos = 0;
+	buf[0] = '\0';
+	for(int cpu = 0; cpu < CPU_SETSIZE && pos < len; cpu++)
+	{
+		if(!CPU_ISSET(cpu, set))
+			continue;
+
+		// Find the end of this range of CPUs
+		int last = cpu;
+		while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+			last++;
+
+		const int ret = last > cpu ?
+			snprintf(buf + pos, len - pos, "%s%d-%d", pos > 0 ? "," : "", cpu, last) :
+			snprintf(buf + pos, len - pos, "%s%d", pos > 0 ? "," : "", cpu);
+		if(ret < 0)
+			break;
+		pos += ret;
+		cpu = last;
+	}
+}
+
+static const char * const thread_role_names[ROLE_MAX] = { "DNS", "background", "webserver" };
+
+// Apply the CPU affinity and real-time priority configured for role to the
+// calling thread. Threads and processes created afterwards by this thread
+// inherit both
+void set_thread_placement(const enum thread_role role)
+{
+	const struct conf_item *cpus = NULL, *priority = NULL;
+	switch(role)
+	{
+		case ROLE_DNS:
+			cpus = &config.misc.threads.dns.cpus;
+			priority = &config.misc.threads.dns.priority;
+			break;
+		case ROLE_BACKGROUND:
+			cpus = &config.misc.threads.background.cpus;
+			priority = &config.misc.threads.background.priority;
+			break;
+		case ROLE_WEBSERVER:
+			cpus = &config.misc.threads.webserver.cpus;
+			priority = &config.misc.threads.webserver.priority;
+			break;
+		case ROLE_MAX:
+		default:
+			return;
+	}
+
+	if(strlen(cpus->v.s) > 0)
+	{
+		cpu_set_t set;
+		int ret = EINVAL;
+		if(!parse_cpu_list(cpus->v.s, &set) ||
+		   (ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+			log_warn("Cannot restrict %s threads to CPUs %s: %s",
+			         thread_role_names[role], cpus->v.s, strerror(ret));
+	}
+
+	if(priority->v.ui > 0)
+	{
+		// SCHED_FIFO threads run until they block or yield to a thread
+		// of higher priority
+		struct sched_param param = { .sched_priority = priority->v.ui };
+		const int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(ret == EPERM)
+			log_warn("Insufficient permissions to set real-time priority %u of %s threads (CAP_SYS_NICE required)",
+			         priority->v.ui, thread_role_names[role]);
+		else if(ret != 0)
+			log_warn("Cannot set real-time priority %u of %s threads: %s",
+			         priority->v.ui, thread_role_names[role], strerror(ret));
+	}
+}
+
+// Get the CPUs a thread of this process may run on, its scheduling policy and
+// its (real-time) priority
+void get_thread_placement(const pid_t tid, char *cpus, const size_t len, const char **policy, int *priority)
+{
+	cpu_set_t set;
+	if(sched_getaffinity(tid, sizeof(set), &set) == 0)
+		format_cpu_list(&set, cpus, len);
+	else
+		cpus[0] = '\0';
+
+	struct sched_param param = { 0 };
+	*priority = sched_getparam(tid, &param) == 0 ? param.sched_priority : 0;
+	switch(sched_getscheduler(tid) & ~SCHED_RESET_ON_FORK)
+	{
+		case SCHED_OTHER:
+			*policy = "other";
+			break;
+		case SCHED_FIFO:
+			*policy = "fifo";
+			break;
+		case SCHED_RR:
+			*policy = "rr";
+			break;
+		case SCHED_BATCH:
+			*policy = "batch";
+			break;
+		case SCHED_IDLE:
+			*policy = "idle";
+			break;
+		default:
+			*policy = "unknown";
+			break;
+	}
+}
+
 // Clean up on exit
 void cleanup(const int ret)
 {
@@ -402,9 +566,18 @@ void cleanup(const int ret)
 		// Terminate threads
 		terminate_threads();
 
+		// Write the rest of the binary query log and the packet capture
+		flush_querylog();
+		pcap_flush(true);
+
+		// Save the shared memory objects for a quick restart
+		save_query_snapshot();
+
 		// Close database connection
 		lock_shm();
 		gravityDB_close();
+		gravity_index_free();
+		gravity_filter_free();
 		unlock_shm();
 	}
 
@@ -420,9 +593,15 @@ void cleanup(const int ret)
 	// Terminate HTTP server (if running)
 	http_terminate();
 
+	// Write configuration changes which have not been written so far
+	flush_config_write(true);
+
 	// Close memory database
 	close_memory_database();
 
+	// Log how often the shared memory objects had to grow
+	log_shmem_details();
+
 	// Remove shared memory objects
 	// Important: This invalidated all objects such as
 	//            counters-> ... etc.
@@ -441,10 +620,71 @@ void cleanup(const int ret)
 		log_info("########## FTL terminated after%s (internal restart)! ##########", buffer);
 	else
 		log_info("########## FTL terminated after%s (code %i)! ##########", buffer, ret);
+
+	// Write remaining log lines, the lines above are the last ones
+	stop_log_writer();
 }
 
 static float ftl_cpu_usage = 0.0f;
 static float total_cpu_usage = 0.0f;
+
+// Per-thread statistics, written by the GC thread and read by the API
+static pthread_mutex_t thread_usage_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_usage thread_usage[THREAD_USAGE_MAX];
+static unsigned int thread_usage_num = 0;
+
+// Sample the CPU and scheduling statistics of all threads and derive their
+// rates from the previous sample. Threads started in the meantime are
+// accounted with everything they used so far
+static void calc_thread_usage(const unsigned int interval)
+{
+	struct proc_thread procs[THREAD_USAGE_MAX];
+	const unsigned int num = parse_proc_threads(procs, THREAD_USAGE_MAX);
+
+	pthread_mutex_lock(&thread_usage_lock);
+	struct thread_usage usage[THREAD_USAGE_MAX];
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const struct proc_thread *last = NULL;
+		for(unsigned int j = 0; j < thread_usage_num; j++)
+			if(thread_usage[j].proc.tid == procs[i].tid)
+			{
+				last = &thread_usage[j].proc;
+				break;
+			}
+
+		const struct proc_thread *proc = &procs[i];
+		const double cpu = proc->user + proc->system - (last ? last->user + last->system : 0.0);
+		const double wait = proc->runqueue - (last ? last->runqueue : 0.0);
+		const unsigned long long wakeups = proc->wakeups - (last ? last->wakeups : 0u);
+
+		usage[i].proc = *proc;
+		usage[i].cpu = 100.0 * cpu / interval;
+		usage[i].wait = 100.0 * wait / interval;
+		usage[i].wakeups = (double)wakeups / interval;
+	}
+	memcpy(thread_usage, usage, num * sizeof(*usage));
+	thread_usage_num = num;
+	pthread_mutex_unlock(&thread_usage_lock);
+}
+
+/**
+ * @brief Get the CPU and scheduling statistics of all threads of FTL as of
+ * the last call of calc_cpu_usage()
+ *
+ * @param usage Array receiving the statistics
+ * @return Number of threads
+ */
+unsigned int get_thread_usage(struct thread_usage usage[THREAD_USAGE_MAX])
+{
+	pthread_mutex_lock(&thread_usage_lock);
+	const unsigned int num = thread_usage_num;
+	memcpy(usage, thread_usage, num * sizeof(*usage));
+	pthread_mutex_unlock(&thread_usage_lock);
+
+	return num;
+}
+
 void calc_cpu_usage(const unsigned int interval)
 {
 	// Get the current resource usage
@@ -470,6 +710,9 @@ void calc_cpu_usage(const unsigned int interval)
 	// Store the current time for the next call to this function
 	last_ftl_cpu_time = ftl_cpu_time;
 
+	// Break the usage down by thread
+	calc_thread_usage(interval);
+
 	// The number of clock ticks per second
 	static long user_hz = 0;
 	if(user_hz == 0)
@@ -11,8 +11,23 @@
 #define DAEMON_H
 
 #include "enums.h"
+// cpu_set_t
+#include <sched.h>
+// struct proc_thread
+#include "procps.h"
 extern pthread_t threads[THREADS_MAX];
 
+// Number of threads CPU and scheduling statistics are kept for
+#define THREAD_USAGE_MAX 64u
+
+// Statistics of a thread, rates are averages over the last CPU_AVERAGE_INTERVAL
+struct thread_usage {
+	struct proc_thread proc;
+	float cpu; // Percent of one core
+	float wait; // Percent of time spent waiting for a CPU
+	float wakeups; // Per second
+};
+
 void go_daemon(void);
 void savePID(void);
 char *getUserName(void);
@@ -22,9 +37,13 @@ void delay_startup(void);
 bool is_fork(const pid_t mpid, const pid_t pid) __attribute__ ((const));
 void cleanup(const int ret);
 void set_nice(void);
+void set_thread_placement(const enum thread_role role);
+void get_thread_placement(const pid_t tid, char *cpus, const size_t len, const char **policy, int *priority);
+bool parse_cpu_list(const char *list, cpu_set_t *set);
 void calc_cpu_usage(const unsigned int interval);
 float get_ftl_cpu_percentage(void) __attribute__((pure));
 float get_total_cpu_percentage(void) __attribute__((pure));
+unsigned int get_thread_usage(struct thread_usage usage[THREAD_USAGE_MAX]);
 bool ipv6_enabled(void);
 void init_locale(void);
 
@@ -19,6 +19,10 @@
 #include "log.h"
 // getAliasclientIDfromIP()
 #include "network-table.h"
+// invalidate_top_client_lists()
+#include "top-lists.h"
+// set_client_excluded()
+#include "exclude-filter.h"
 
 bool create_aliasclients_table(sqlite3 *db)
 {
@@ -46,46 +50,65 @@ bool create_aliasclients_table(sqlite3 *db)
 	return true;
 }
 
-// Recompute the alias-client's values
-// We shouldn't do this too often as it iterates over all existing clients
-static void recompute_aliasclient(const int aliasclientID)
+// Add (sign = 1) or remove (sign = -1) the counts of a client to/from the
+// alias-client it is managed by. The counts of alias-clients are kept current
+// by change_clientcount() and the overTime routines afterwards, so this is only
+// needed when a client joins or leaves an alias-client
+static void move_aliasclient_counts(const clientsData *client, const int aliasclientID, const int sign)
 {
 	clientsData *aliasclient = getClient(aliasclientID, true);
+	if(aliasclient == NULL)
+		return;
 
-	log_debug(DEBUG_ALIASCLIENTS, "Recomputing alias-client \"%s\" (%s)...",
+	log_debug(DEBUG_ALIASCLIENTS, "Client \"%s\" (%s) %s alias-client \"%s\" (%s)",
+	          getstr(client->namepos), getstr(client->ippos), sign > 0 ? "joins" : "leaves",
 	          getstr(aliasclient->namepos), getstr(aliasclient->ippos));
 
-	// Reset this alias-client
-	aliasclient->count = 0;
-	aliasclient->blockedcount = 0;
-	memset(aliasclient->overTime, 0, sizeof(aliasclient->overTime));
+	set_clientcount(aliasclient, aliasclient->count + sign * client->count);
+	aliasclient->blockedcount += sign * client->blockedcount;
+	for(unsigned int idx = 0; idx < OVERTIME_SLOTS; idx++)
+		aliasclient->overTime[idx] += sign * client->overTime[idx];
+	top_lists_client_changed(aliasclient);
+}
 
-	// Loop over all existing clients to find which clients are associated to this one
-	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
+// Compare the incrementally maintained counts of all alias-clients with their
+// full recomputation and correct them if needed. This iterates over all clients
+// once per alias-client and is hence only done with debug.aliasclients enabled
+static void verify_aliasclients(void)
+{
+	for(unsigned int aliasclientID = 0; aliasclientID < counters->clients; aliasclientID++)
 	{
-		// Get pointer to client candidate
-		const clientsData *client = getClient(clientID, true);
-		// Skip invalid clients and alias-clients
-		if(client == NULL || client->flags.aliasclient)
+		clientsData *aliasclient = getClient(aliasclientID, true);
+		if(aliasclient == NULL || !aliasclient->flags.aliasclient)
 			continue;
 
-		// Skip clients that are not managed by this aliasclient
-		if(client->aliasclient_id != aliasclientID)
+		int count = 0, blockedcount = 0;
+		int overTime[OVERTIME_SLOTS] = { 0 };
+		for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
 		{
-			log_debug(DEBUG_ALIASCLIENTS, "Client \"%s\" (%s) NOT managed by this alias-client, skipping",
-			          getstr(client->namepos), getstr(client->ippos));
-			continue;
+			const clientsData *client = getClient(clientID, true);
+			if(client == NULL || client->flags.aliasclient ||
+			   client->aliasclient_id != (int)aliasclientID)
+				continue;
+
+			count += client->count;
+			blockedcount += client->blockedcount;
+			for(unsigned int idx = 0; idx < OVERTIME_SLOTS; idx++)
+				overTime[idx] += client->overTime[idx];
 		}
 
-		// Debug logging
-		log_debug(DEBUG_ALIASCLIENTS, "Client \"%s\" (%s) IS  managed by this alias-client, adding counts",
-		          getstr(client->namepos), getstr(client->ippos));
-
-		// Add counts of this client to the alias-client
-		aliasclient->count += client->count;
-		aliasclient->blockedcount += client->blockedcount;
-		for(unsigned int idx = 0; idx < OVERTIME_SLOTS; idx++)
-			aliasclient->overTime[idx] += client->overTime[idx];
+		if(count == aliasclient->count && blockedcount == aliasclient->blockedcount &&
+		   memcmp(overTime, aliasclient->overTime, sizeof(overTime)) == 0)
+			continue;
+
+		log_warn("Counts of alias-client \"%s\" (%s) are inconsistent (%d/%d instead of %d/%d), correcting",
+		         getstr(aliasclient->namepos), getstr(aliasclient->ippos),
+		         aliasclient->count, aliasclient->blockedcount, count, blockedcount);
+		set_clientcount(aliasclient, count);
+		aliasclient->blockedcount = blockedcount;
+		memcpy(aliasclient->overTime, overTime, sizeof(overTime));
+		top_lists_client_changed(aliasclient);
+		bump_client_generation();
 	}
 }
 
@@ -146,11 +169,12 @@ bool import_aliasclients(sqlite3 *db)
 		client->flags.new = false;
 
 		// Reset counter
-		client->count = 0;
+		set_clientcount(client, 0);
 
 		// Store intended name
 		const char *name = (char*)sqlite3_column_text(stmt, 1);
 		client->namepos = addstr(name);
+		set_client_excluded(client);
 
 		// This is a aliasclient
 		client->flags.aliasclient = true;
@@ -188,36 +212,31 @@ static int get_aliasclient_ID(sqlite3 *db, const clientsData *client)
 	// Get aliasclient ID from database (DB index)
 	const int aliasclient_DBid = getAliasclientIDfromIP(db, clientIP);
 
-	// Compare DB index for all alias-clients stored in FTL
-	unsigned int aliasclientID = 0;
-	for(; aliasclientID < counters->clients; aliasclientID++)
+	if(aliasclient_DBid < 0)
 	{
-		// Get pointer to alias client candidate
-		const clientsData *alias_client = getClient(aliasclientID, true);
-
-		// Skip clients that are not alias-clients
-		if(alias_client == NULL || !alias_client->flags.aliasclient)
-			continue;
-
-		// Compare MAC address of the current client to the
-		// alias client candidate's MAC address
-		if(alias_client->aliasclient_id == aliasclient_DBid)
-		{
-			log_debug(DEBUG_ALIASCLIENTS, "   -> \"%s\" (%s)",
-			          getstr(alias_client->namepos),
-			          getstr(alias_client->ippos));
-
-			return aliasclientID;
-		}
+		log_debug(DEBUG_ALIASCLIENTS, "   -> not found");
+		return -1;
 	}
 
-	if(aliasclientID == counters->clients)
+	// Alias-clients are stored as clients with the pseudo-address
+	// "aliasclient-<DB index>" (see import_aliasclients()), use the client
+	// lookup table instead of iterating over all clients
+	char aliasclient_str[32];
+	snprintf(aliasclient_str, sizeof(aliasclient_str), "aliasclient-%i", aliasclient_DBid);
+	const int aliasclientID = findClientID(aliasclient_str, false, false, 0.0);
+	const clientsData *alias_client = aliasclientID > -1 ? getClient(aliasclientID, true) : NULL;
+	if(alias_client == NULL || !alias_client->flags.aliasclient ||
+	   alias_client->aliasclient_id != aliasclient_DBid)
 	{
 		log_debug(DEBUG_ALIASCLIENTS, "   -> not found");
+		return -1;
 	}
 
-	// Not found
-	return -1;
+	log_debug(DEBUG_ALIASCLIENTS, "   -> \"%s\" (%s)",
+	          getstr(alias_client->namepos),
+	          getstr(alias_client->ippos));
+
+	return aliasclientID;
 }
 
 void reset_aliasclient(sqlite3 *db, clientsData *client)
@@ -242,20 +261,33 @@ void reset_aliasclient(sqlite3 *db, clientsData *client)
 
 	// Skip alias-clients themselves
 	if(client->flags.aliasclient)
+	{
+		if(db_opened) dbclose(&db);
 		return;
+	}
 
 	// Find corresponding alias-client (if any)
-	client->aliasclient_id = get_aliasclient_ID(db, client);
+	const int old_id = client->aliasclient_id;
+	const int new_id = get_aliasclient_ID(db, client);
 
 	// Close the database if we opened it here
 	if(db_opened) dbclose(&db);
 
-	// Skip if there is no responsible alias-client
-	if(client->aliasclient_id == -1)
+	// Nothing to do if the client stays with its alias-client
+	if(new_id == old_id)
 		return;
 
-	// Recompute all values for this alias-client
-	recompute_aliasclient(client->aliasclient_id);
+	// Move the counts of this client to the new alias-client
+	if(old_id > -1)
+		move_aliasclient_counts(client, old_id, -1);
+	client->aliasclient_id = new_id;
+	if(new_id > -1)
+		move_aliasclient_counts(client, new_id, 1);
+
+	// The client top lists are rebuilt on the next request as the
+	// alias-client replaces the counts of its clients
+	invalidate_top_client_lists();
+	bump_client_generation();
 }
 
 // Reimport alias-clients from database
@@ -281,21 +313,31 @@ void reimport_aliasclients(sqlite3 *db)
 		db_opened = true;
 	}
 
-	// Loop over all existing alias-clients and set their counters to zero
+	// Loop over all existing alias-clients and set their counters to zero.
+	// All other clients leave their alias-clients and join them again below
 	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
 	{
 		// Get pointer to client candidate
 		clientsData *client = getClient(clientID, true);
-		// Skip invalid and non-alias-clients
-		if(client == NULL || !client->flags.aliasclient)
+		// Skip invalid clients
+		if(client == NULL)
 			continue;
 
+		if(!client->flags.aliasclient)
+		{
+			client->aliasclient_id = -1;
+			continue;
+		}
+
 		// Reset this alias-client
-		client->count = 0;
+		set_clientcount(client, 0);
 		client->blockedcount = 0;
 		memset(client->overTime, 0, sizeof(client->overTime));
 	}
 
+	// Forget cached aliasclient IDs, they may have been changed
+	network_cache_flush();
+
 	// Import aliasclients from database table
 	import_aliasclients(db);
 
@@ -311,6 +353,13 @@ void reimport_aliasclients(sqlite3 *db)
 		reset_aliasclient(db, client);
 	}
 
+	// Clients may have left alias-clients
+	invalidate_top_client_lists();
+	bump_client_generation();
+
+	if(config.debug.aliasclients.v.b)
+		verify_aliasclients();
+
 	// Close the database if we opened it here
 	if(db_opened) dbclose(&db);
 }
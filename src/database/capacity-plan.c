@@ -0,0 +1,178 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Shared memory capacity plan
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file capacity-plan.c
+* @brief Preallocation of the shared memory for the usage of the last day.
+*
+* The shared memory objects start small and grow while they are filled. Every
+* growth step is a resize which all other processes have to follow with a
+* remap. The DB thread records the peak numbers of queries, domains, clients,
+* DNS cache entries and bytes of strings of the current and the previous day
+* in the ftl table. When FTL starts, the objects are grown to the larger of
+* both peaks (plus some headroom) at once so neither the history import nor
+* the ramp-up afterwards has to resize them again.
+*/
+
+#include "FTL.h"
+#include "database/capacity-plan.h"
+#include "database/common.h"
+// lock_shm(), preallocate_shmem()
+#include "shmem.h"
+#include "log.h"
+// UINT_MAX
+#include <limits.h>
+
+_Static_assert(PLAN_ITEMS <= DB_PLAN_PREVIOUS_PEAK - DB_PLAN_PEAK, "Too many capacity plan items for the ftl table");
+
+// The peaks are only accessed by the main thread during startup and by the
+// DB thread afterwards
+static bool loaded = false;
+static time_t day_start = 0;
+static unsigned int peak[PLAN_ITEMS] = { 0 };
+static unsigned int previous_peak[PLAN_ITEMS] = { 0 };
+
+// Read the peaks recorded so far from the ftl table
+static void load_peaks(void)
+{
+	loaded = true;
+	if(FTLDBerror())
+		return;
+
+	sqlite3 *db = dbopen(true, false);
+	if(db == NULL)
+		return;
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT id, value FROM ftl WHERE id >= ?1 AND id < ?2;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("load_peaks(): SQL error prepare: %s", sqlite3_errstr(rc));
+		dbclose(&db);
+		return;
+	}
+
+	sqlite3_bind_int(stmt, 1, DB_PLAN_DAY);
+	sqlite3_bind_int(stmt, 2, DB_PLAN_PREVIOUS_PEAK + PLAN_ITEMS);
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		const sqlite3_int64 value = sqlite3_column_int64(stmt, 1);
+		if(value < 0)
+			continue;
+
+		if(id == DB_PLAN_DAY)
+			day_start = (time_t)value;
+		else if(id >= DB_PLAN_PEAK && id < DB_PLAN_PEAK + PLAN_ITEMS)
+			peak[id - DB_PLAN_PEAK] = (unsigned int)value;
+		else if(id >= DB_PLAN_PREVIOUS_PEAK)
+			previous_peak[id - DB_PLAN_PREVIOUS_PEAK] = (unsigned int)value;
+	}
+
+	if(rc != SQLITE_DONE)
+		log_err("load_peaks(): SQL error step: %s", sqlite3_errstr(rc));
+
+	sqlite3_finalize(stmt);
+	dbclose(&db);
+}
+
+/**
+ * Grow the shared memory objects to the peak usage of the current and the
+ * previous day. Called during startup before the history is imported (and
+ * again afterwards as a restored snapshot replaces the objects)
+ */
+void apply_capacity_plan(void)
+{
+	if(!loaded)
+		load_peaks();
+
+	unsigned int plan[PLAN_ITEMS];
+	bool planned = false;
+	for(unsigned int i = 0; i < PLAN_ITEMS; i++)
+	{
+		const uint64_t num = (uint64_t)max(peak[i], previous_peak[i]) * (100u + PLAN_HEADROOM) / 100u;
+		plan[i] = num < UINT_MAX ? (unsigned int)num : UINT_MAX;
+		planned |= plan[i] > 0;
+	}
+
+	// Nothing has been recorded so far
+	if(!planned)
+		return;
+
+	lock_shm();
+	preallocate_shmem(plan);
+	unlock_shm();
+
+	log_debug(DEBUG_SHMEM, "Preallocated shared memory for %u queries, %u domains, %u clients, "
+	          "%u DNS cache entries and %u bytes of strings", plan[PLAN_QUERIES],
+	          plan[PLAN_DOMAINS], plan[PLAN_CLIENTS], plan[PLAN_DNS_CACHE], plan[PLAN_STRINGS]);
+}
+
+/**
+ * Record the current usage of the shared memory objects if it exceeds the
+ * peaks of the current day. Called by the DB thread every
+ * database.DBinterval seconds
+ *
+ * @param db The on-disk database
+ * @return true on success (or if there was nothing to store)
+ */
+bool store_capacity_plan(sqlite3 *db)
+{
+	if(!loaded)
+		load_peaks();
+
+	unsigned int usage[PLAN_ITEMS];
+	lock_shm_read();
+	get_shmem_usage(usage);
+	unlock_shm_read();
+
+	bool changed = false;
+	const time_t now = time(NULL);
+	if(now - day_start >= PLAN_DAY_SECONDS)
+	{
+		// A new day begins, the peaks of the day before are kept for
+		// another day
+		memcpy(previous_peak, peak, sizeof(peak));
+		memset(peak, 0, sizeof(peak));
+		day_start = now;
+		changed = true;
+	}
+
+	for(unsigned int i = 0; i < PLAN_ITEMS; i++)
+	{
+		if(usage[i] > peak[i])
+		{
+			peak[i] = usage[i];
+			changed = true;
+		}
+	}
+
+	if(!changed)
+		return true;
+
+	if(dbquery(db, "BEGIN TRANSACTION;") != SQLITE_OK)
+		return false;
+
+	bool okay = db_set_FTL_property(db, DB_PLAN_DAY, (int)day_start);
+	for(unsigned int i = 0; i < PLAN_ITEMS && okay; i++)
+	{
+		okay = db_set_FTL_property(db, (enum ftl_table_props)(DB_PLAN_PEAK + i), (int)min(peak[i], (unsigned int)INT_MAX)) &&
+		       db_set_FTL_property(db, (enum ftl_table_props)(DB_PLAN_PREVIOUS_PEAK + i), (int)min(previous_peak[i], (unsigned int)INT_MAX));
+	}
+
+	if(!okay || dbquery(db, "COMMIT;") != SQLITE_OK)
+	{
+		log_err("store_capacity_plan(): Failed to store peak usage");
+		dbquery(db, "ROLLBACK;");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,25 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Shared memory capacity plan prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef CAPACITY_PLAN_H
+#define CAPACITY_PLAN_H
+
+#include <stdbool.h>
+#include "sqlite3.h"
+
+// Peaks are recorded per day, the plan uses the current and the previous one
+#define PLAN_DAY_SECONDS 86400
+
+// Headroom added to the observed peaks (percent)
+#define PLAN_HEADROOM 10u
+
+void apply_capacity_plan(void);
+bool store_capacity_plan(sqlite3 *db);
+
+#endif // CAPACITY_PLAN_H
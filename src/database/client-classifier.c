@@ -0,0 +1,660 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Compiled client classifier routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file client-classifier.c
+ * @brief Read-only in-memory copy of the client table used to assign groups
+ *
+ * The classifier is compiled from the client and client_by_group tables of
+ * gravity.db whenever the lists are reloaded and replaces the SQL statements
+ * get_client_groupids() would otherwise run for every new client:
+ *
+ * - Address and subnet entries are stored as networks (masked address and
+ *   prefix length) in a hash table. A longest-prefix match probes it once per
+ *   prefix length in use, starting with the longest one. Entries describing
+ *   the same network are merged so the ambiguity warning of the database
+ *   lookup can be reproduced without further work.
+ * - All entries (including MAC addresses, host names and ":interface"
+ *   entries) are stored in a second hash table keyed by their lowercase
+ *   string, this is what COLLATE NOCASE compares.
+ * - The group IDs of every client are concatenated into one string in
+ *   advance.
+ *
+ * gravity.db remains the only source of truth. Forks created before the lists
+ * have been reloaded detect this through the gravity generation and fall back
+ * to the database.
+ */
+
+#include "FTL.h"
+#include "database/client-classifier.h"
+// logging routines
+#include "log.h"
+// get_gravity_generation()
+#include "shmem.h"
+// gravity_hash_finalize(), FNV64_*
+#include "database/gravity-index.h"
+// isMAC()
+#include "database/network-table.h"
+// inet_pton()
+#include <arpa/inet.h>
+
+// Network of one or more address/subnet entries of the client table
+struct subnet_key {
+	uint8_t addr[16];
+	uint8_t bits;
+	uint8_t ipv6;
+};
+
+struct cc_network {
+	struct subnet_key key;
+	unsigned int count;
+	int id;
+	size_t text;
+	size_t ids;
+};
+
+// Entry of the client table, the string is stored in lowercase
+struct cc_name {
+	uint64_t hash;
+	int id;
+	size_t name;
+};
+
+// Comma-separated groups of a client
+struct cc_groups {
+	int id;
+	size_t groups;
+};
+
+struct client_classifier {
+	// All strings, referenced by their offset
+	char *pool;
+	size_t pool_len;
+	size_t pool_cap;
+	struct cc_network *networks;
+	size_t num_networks;
+	// Slots hold the index of an entry + 1, zero marks unused slots
+	uint32_t *network_slots;
+	size_t network_mask;
+	// Prefix lengths in use per address family, longest first
+	uint8_t lengths[2][129];
+	unsigned int num_lengths[2];
+	struct cc_name *names;
+	size_t num_names;
+	uint32_t *name_slots;
+	size_t name_mask;
+	// Sorted by client ID
+	struct cc_groups *groups;
+	size_t num_groups;
+};
+
+// Address or subnet entry read from the database
+struct cc_rule {
+	struct subnet_key key;
+	int id;
+	size_t text;
+};
+
+static struct client_classifier *active = NULL;
+static unsigned int generation = 0u;
+
+static void free_classifier(struct client_classifier *cc)
+{
+	if(cc == NULL)
+		return;
+
+	if(cc->pool != NULL)
+		free(cc->pool);
+	if(cc->networks != NULL)
+		free(cc->networks);
+	if(cc->network_slots != NULL)
+		free(cc->network_slots);
+	if(cc->names != NULL)
+		free(cc->names);
+	if(cc->name_slots != NULL)
+		free(cc->name_slots);
+	if(cc->groups != NULL)
+		free(cc->groups);
+	free(cc);
+}
+
+// Number of hash table slots for n entries (at most half of them are used)
+static size_t __attribute__((const)) table_size(const size_t n)
+{
+	size_t size = 16u;
+	while(size < 2*n)
+		size *= 2;
+	return size;
+}
+
+// Append a string (without NUL) to the string pool
+static bool pool_append(struct client_classifier *cc, const char *s, const size_t len)
+{
+	if(cc->pool_len + len + 1 > cc->pool_cap)
+	{
+		size_t cap = MAX(2*cc->pool_cap, 1024u);
+		while(cap < cc->pool_len + len + 1)
+			cap *= 2;
+		char *new_pool = realloc(cc->pool, cap);
+		if(new_pool == NULL)
+			return false;
+		cc->pool = new_pool;
+		cc->pool_cap = cap;
+	}
+
+	memcpy(cc->pool + cc->pool_len, s, len);
+	cc->pool_len += len;
+	return true;
+}
+
+// Terminate the string appended last
+static bool pool_finish(struct client_classifier *cc)
+{
+	if(!pool_append(cc, "", 0))
+		return false;
+	cc->pool[cc->pool_len++] = '\0';
+	return true;
+}
+
+static bool pool_add(struct client_classifier *cc, const char *s, size_t *offset)
+{
+	*offset = cc->pool_len;
+	return pool_append(cc, s, strlen(s)) && pool_finish(cc);
+}
+
+static inline uint64_t __attribute__((const)) name_step(const uint64_t h, const char c)
+{
+	return (h ^ (unsigned char)tolower((unsigned char)c)) * FNV64_PRIME;
+}
+
+// Case-insensitive hash of prefix + name
+static uint64_t __attribute__((pure)) name_hash(const char *prefix, const char *name)
+{
+	uint64_t h = FNV64_OFFSET;
+	for(; *prefix; prefix++)
+		h = name_step(h, *prefix);
+	for(; *name; name++)
+		h = name_step(h, *name);
+	return gravity_hash_finalize(h);
+}
+
+static uint64_t __attribute__((pure)) subnet_hash(const struct subnet_key *key)
+{
+	return gravity_hash_len((const char*)key, sizeof(*key));
+}
+
+// Clear all bits of an address beyond the prefix length
+static void mask_addr(uint8_t addr[16], const unsigned int bits)
+{
+	for(unsigned int i = 0; i < 16u; i++)
+	{
+		if(8*i >= bits)
+			addr[i] = 0;
+		else if(8*(i + 1) > bits)
+			addr[i] &= (uint8_t)(0xFF << (8*(i + 1) - bits));
+	}
+}
+
+// Parse an entry of the client table the way subnet_match() does. Returns
+// false for everything that can never match an address
+static bool parse_subnet(const char *entry, struct subnet_key *key)
+{
+	if(isMAC(entry))
+		return false;
+
+	const bool ipv6 = strchr(entry, ':') != NULL;
+	int cidr = ipv6 ? 128 : 32;
+	char *addr = NULL;
+	const int rt = sscanf(entry, "%m[^/]/%i", &addr, &cidr);
+	if(rt < 1 || addr == NULL)
+		return false;
+
+	memset(key, 0, sizeof(*key));
+	const bool okay = inet_pton(ipv6 ? AF_INET6 : AF_INET, addr, key->addr) == 1;
+	free(addr);
+	if(!okay)
+		return false;
+
+	if(cidr < 0 || cidr > (ipv6 ? 128 : 32))
+	{
+		log_warn("Invalid CIDR value %d in client table entry: %s", cidr, entry);
+		return false;
+	}
+
+	// A prefix length of zero is never considered a match
+	if(cidr == 0)
+		return false;
+
+	key->bits = (uint8_t)cidr;
+	key->ipv6 = ipv6;
+	mask_addr(key->addr, key->bits);
+
+	return true;
+}
+
+static int cmp_rule(const void *a, const void *b)
+{
+	const struct cc_rule *ra = a, *rb = b;
+	const int c = memcmp(&ra->key, &rb->key, sizeof(ra->key));
+	if(c != 0)
+		return c;
+	return (ra->id > rb->id) - (ra->id < rb->id);
+}
+
+// Read all entries of the client table
+static bool read_clients(sqlite3 *db, struct client_classifier *cc, struct cc_rule **rules, size_t *num_rules)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT id, ip FROM client ORDER BY id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("client_classifier_compile(client) - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	bool okay = true;
+	size_t names_cap = 0u, rules_cap = 0u;
+	while(okay && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		const char *ip = (const char*)sqlite3_column_text(stmt, 1);
+		if(ip == NULL)
+			continue;
+
+		if(cc->num_names >= names_cap)
+		{
+			names_cap = MAX(2*names_cap, 64u);
+			struct cc_name *new_names = realloc(cc->names, names_cap * sizeof(*new_names));
+			if(new_names == NULL)
+			{
+				okay = false;
+				break;
+			}
+			cc->names = new_names;
+		}
+
+		struct cc_name *name = &cc->names[cc->num_names++];
+		name->id = id;
+		name->hash = name_hash("", ip);
+		if(!pool_add(cc, ip, &name->name))
+		{
+			okay = false;
+			break;
+		}
+		for(char *p = cc->pool + name->name; *p; p++)
+			*p = (char)tolower((unsigned char)*p);
+
+		struct subnet_key key;
+		if(!parse_subnet(ip, &key))
+			continue;
+
+		if(*num_rules >= rules_cap)
+		{
+			rules_cap = MAX(2*rules_cap, 64u);
+			struct cc_rule *new_rules = realloc(*rules, rules_cap * sizeof(*new_rules));
+			if(new_rules == NULL)
+			{
+				okay = false;
+				break;
+			}
+			*rules = new_rules;
+		}
+
+		struct cc_rule *rule = &(*rules)[(*num_rules)++];
+		rule->key = key;
+		rule->id = id;
+		if(!pool_add(cc, ip, &rule->text))
+			okay = false;
+	}
+
+	sqlite3_finalize(stmt);
+
+	if(okay && rc != SQLITE_DONE)
+	{
+		log_err("client_classifier_compile(client) - SQL error step: %s", sqlite3_errstr(rc));
+		okay = false;
+	}
+
+	return okay;
+}
+
+// Hash the entries of the client table. Entries only differing in case are
+// found by the lowest ID just like the first row of the database lookup
+static bool build_names(struct client_classifier *cc)
+{
+	const size_t size = table_size(cc->num_names);
+	cc->name_slots = calloc(size, sizeof(*cc->name_slots));
+	if(cc->name_slots == NULL)
+		return false;
+	cc->name_mask = size - 1;
+
+	for(size_t i = 0; i < cc->num_names; i++)
+	{
+		const struct cc_name *name = &cc->names[i];
+		size_t pos = name->hash & cc->name_mask;
+		bool duplicate = false;
+		while(cc->name_slots[pos] != 0)
+		{
+			const struct cc_name *other = &cc->names[cc->name_slots[pos] - 1];
+			if(other->hash == name->hash &&
+			   strcmp(cc->pool + other->name, cc->pool + name->name) == 0)
+			{
+				duplicate = true;
+				break;
+			}
+			pos = (pos + 1) & cc->name_mask;
+		}
+		if(!duplicate)
+			cc->name_slots[pos] = (uint32_t)(i + 1);
+	}
+
+	return true;
+}
+
+// Merge the address and subnet entries into networks and hash them
+static bool build_networks(struct client_classifier *cc, struct cc_rule *rules, const size_t num_rules)
+{
+	if(num_rules > 0)
+	{
+		qsort(rules, num_rules, sizeof(*rules), cmp_rule);
+		cc->networks = calloc(num_rules, sizeof(*cc->networks));
+		if(cc->networks == NULL)
+			return false;
+	}
+
+	bool seen[2][129] = {{ false }};
+	for(size_t i = 0; i < num_rules; )
+	{
+		// Entries describing the same network are adjacent, the last one
+		// has the highest ID
+		size_t j = i + 1;
+		while(j < num_rules && memcmp(&rules[i].key, &rules[j].key, sizeof(rules[i].key)) == 0)
+			j++;
+
+		struct cc_network *net = &cc->networks[cc->num_networks++];
+		net->key = rules[i].key;
+		net->count = (unsigned int)(j - i);
+		net->id = rules[j - 1].id;
+		net->text = rules[j - 1].text;
+		net->ids = cc->pool_len;
+		for(size_t k = i; k < j; k++)
+		{
+			char buffer[16];
+			const int len = snprintf(buffer, sizeof(buffer), k > i ? ",%d" : "%d", rules[k].id);
+			if(!pool_append(cc, buffer, (size_t)len))
+				return false;
+		}
+		if(!pool_finish(cc))
+			return false;
+
+		seen[net->key.ipv6][net->key.bits] = true;
+		i = j;
+	}
+
+	for(unsigned int family = 0; family < 2u; family++)
+		for(int bits = 128; bits > 0; bits--)
+			if(seen[family][bits])
+				cc->lengths[family][cc->num_lengths[family]++] = (uint8_t)bits;
+
+	const size_t size = table_size(cc->num_networks);
+	cc->network_slots = calloc(size, sizeof(*cc->network_slots));
+	if(cc->network_slots == NULL)
+		return false;
+	cc->network_mask = size - 1;
+
+	for(size_t i = 0; i < cc->num_networks; i++)
+	{
+		size_t pos = subnet_hash(&cc->networks[i].key) & cc->network_mask;
+		while(cc->network_slots[pos] != 0)
+			pos = (pos + 1) & cc->network_mask;
+		cc->network_slots[pos] = (uint32_t)(i + 1);
+	}
+
+	return true;
+}
+
+// Concatenate the groups of all clients
+static bool read_groups(sqlite3 *db, struct client_classifier *cc)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT client_id, group_id FROM client_by_group "
+	                                "ORDER BY client_id, group_id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("client_classifier_compile(client_by_group) - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	bool okay = true;
+	size_t cap = 0u;
+	struct cc_groups *current = NULL;
+	while(okay && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		const bool first = current == NULL || current->id != id;
+		if(first)
+		{
+			// Finish previous client
+			if(current != NULL && !pool_finish(cc))
+			{
+				okay = false;
+				break;
+			}
+
+			if(cc->num_groups >= cap)
+			{
+				cap = MAX(2*cap, 64u);
+				struct cc_groups *new_groups = realloc(cc->groups, cap * sizeof(*new_groups));
+				if(new_groups == NULL)
+				{
+					okay = false;
+					break;
+				}
+				cc->groups = new_groups;
+			}
+			current = &cc->groups[cc->num_groups++];
+			current->id = id;
+			current->groups = cc->pool_len;
+		}
+
+		char buffer[16];
+		const int len = snprintf(buffer, sizeof(buffer), first ? "%d" : ",%d", sqlite3_column_int(stmt, 1));
+		okay = pool_append(cc, buffer, (size_t)len);
+	}
+	if(okay && current != NULL)
+		okay = pool_finish(cc);
+
+	sqlite3_finalize(stmt);
+
+	if(okay && rc != SQLITE_DONE)
+	{
+		log_err("client_classifier_compile(client_by_group) - SQL error step: %s", sqlite3_errstr(rc));
+		okay = false;
+	}
+
+	return okay;
+}
+
+/**
+ * @brief Compile a classifier from the client table of a gravity database
+ *
+ * @param db Open gravity database connection
+ * @return The classifier, NULL on errors
+ */
+struct client_classifier *client_classifier_compile(sqlite3 *db)
+{
+	const double t0 = double_time();
+
+	struct client_classifier *cc = calloc(1, sizeof(*cc));
+	if(cc == NULL)
+		return NULL;
+
+	struct cc_rule *rules = NULL;
+	size_t num_rules = 0u;
+	const bool okay = read_clients(db, cc, &rules, &num_rules) &&
+	                  build_names(cc) &&
+	                  build_networks(cc, rules, num_rules) &&
+	                  read_groups(db, cc);
+	if(rules != NULL)
+		free(rules);
+
+	if(!okay)
+	{
+		log_err("Failed to compile client classifier, falling back to database lookups");
+		free_classifier(cc);
+		return NULL;
+	}
+
+	log_debug(DEBUG_DATABASE, "Compiled client classifier with %zu entries (%zu networks) in %.1f msec",
+	          cc->num_names, cc->num_networks, 1e3*(double_time() - t0));
+
+	return cc;
+}
+
+/**
+ * @brief Activate a compiled classifier, the previous one is freed
+ *
+ * This has to be called while holding the shared memory lock.
+ *
+ * @param cc Classifier, NULL to disable the classifier
+ */
+void client_classifier_publish(struct client_classifier *cc)
+{
+	struct client_classifier *old = active;
+	active = cc;
+	generation = get_gravity_generation();
+	free_classifier(old);
+}
+
+void client_classifier_discard(struct client_classifier *cc)
+{
+	free_classifier(cc);
+}
+
+bool client_classifier_build(sqlite3 *db)
+{
+	client_classifier_publish(client_classifier_compile(db));
+	return active != NULL;
+}
+
+void client_classifier_free(void)
+{
+	client_classifier_publish(NULL);
+}
+
+/**
+ * @brief Check if the classifier can be used
+ *
+ * The classifier is not used in forks created before the lists have been
+ * reloaded by the main process, they fall back to the database instead.
+ */
+bool __attribute__((pure)) client_classifier_ready(void)
+{
+	return active != NULL && generation == get_gravity_generation();
+}
+
+/**
+ * @brief Find the longest subnet entry of the client table matching an address
+ *
+ * @param ip Client address
+ * @param match Receives the details of the match
+ * @return true if an entry matches, false otherwise
+ */
+bool client_classifier_subnet(const char *ip, struct client_subnet_match *match)
+{
+	const struct client_classifier *cc = active;
+	if(cc == NULL)
+		return false;
+
+	struct subnet_key key = { 0 };
+	key.ipv6 = strchr(ip, ':') != NULL;
+	uint8_t addr[16] = { 0 };
+	if(inet_pton(key.ipv6 ? AF_INET6 : AF_INET, ip, addr) != 1)
+		return false;
+
+	for(unsigned int i = 0; i < cc->num_lengths[key.ipv6]; i++)
+	{
+		key.bits = cc->lengths[key.ipv6][i];
+		memcpy(key.addr, addr, sizeof(key.addr));
+		mask_addr(key.addr, key.bits);
+
+		for(size_t pos = subnet_hash(&key) & cc->network_mask;
+		    cc->network_slots[pos] != 0;
+		    pos = (pos + 1) & cc->network_mask)
+		{
+			const struct cc_network *net = &cc->networks[cc->network_slots[pos] - 1];
+			if(memcmp(&net->key, &key, sizeof(key)) != 0)
+				continue;
+
+			match->count = net->count;
+			match->id = net->id;
+			match->text = cc->pool + net->text;
+			match->ids = cc->pool + net->ids;
+			match->bits = key.bits;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Find an entry of the client table (case-insensitive)
+ *
+ * @param prefix Prefix of the entry (e.g., ":" for interfaces)
+ * @param name MAC address, host name or interface
+ * @return ID of the entry, -1 if there is none
+ */
+int __attribute__((pure)) client_classifier_id(const char *prefix, const char *name)
+{
+	const struct client_classifier *cc = active;
+	if(cc == NULL)
+		return -1;
+
+	const uint64_t hash = name_hash(prefix, name);
+	const size_t prefix_len = strlen(prefix);
+	for(size_t pos = hash & cc->name_mask;
+	    cc->name_slots[pos] != 0;
+	    pos = (pos + 1) & cc->name_mask)
+	{
+		const struct cc_name *entry = &cc->names[cc->name_slots[pos] - 1];
+		const char *str = cc->pool + entry->name;
+		if(entry->hash == hash &&
+		   strncasecmp(str, prefix, prefix_len) == 0 &&
+		   strcasecmp(str + prefix_len, name) == 0)
+			return entry->id;
+	}
+
+	return -1;
+}
+
+static int cmp_groups(const void *a, const void *b)
+{
+	const int id = *(const int*)a;
+	const struct cc_groups *groups = b;
+	return (id > groups->id) - (id < groups->id);
+}
+
+/**
+ * @brief Get the comma-separated groups of a client
+ *
+ * @param id ID of the entry in the client table
+ * @return The groups, NULL if the client is not assigned to any group
+ */
+const char * __attribute__((pure)) client_classifier_groups(const int id)
+{
+	const struct client_classifier *cc = active;
+	if(cc == NULL || cc->num_groups == 0)
+		return NULL;
+
+	const struct cc_groups *groups = bsearch(&id, cc->groups, cc->num_groups,
+	                                         sizeof(*cc->groups), cmp_groups);
+	return groups != NULL ? cc->pool + groups->groups : NULL;
+}
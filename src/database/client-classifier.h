@@ -0,0 +1,42 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Compiled client classifier prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef CLIENT_CLASSIFIER_H
+#define CLIENT_CLASSIFIER_H
+
+#include <stdbool.h>
+// sqlite3
+#include "database/sqlite3.h"
+
+// Best subnet match of a client address, equivalent to the result of the
+// subnet_match() query of get_client_groupids()
+struct client_subnet_match {
+	// Number of entries matching with the same (longest) prefix
+	unsigned int count;
+	// Highest ID among them and its entry in the client table
+	int id;
+	const char *text;
+	// Comma-separated IDs of all matching entries
+	const char *ids;
+	unsigned int bits;
+};
+
+struct client_classifier;
+
+struct client_classifier *client_classifier_compile(sqlite3 *db) __attribute__((malloc));
+void client_classifier_publish(struct client_classifier *cc);
+void client_classifier_discard(struct client_classifier *cc);
+bool client_classifier_build(sqlite3 *db);
+void client_classifier_free(void);
+bool client_classifier_ready(void) __attribute__((pure));
+bool client_classifier_subnet(const char *ip, struct client_subnet_match *match);
+int client_classifier_id(const char *prefix, const char *name) __attribute__((pure));
+const char *client_classifier_groups(const int id) __attribute__((pure));
+
+#endif //CLIENT_CLASSIFIER_H
@@ -30,6 +30,12 @@
 #include "signals.h"
 // create_session_table()
 #include "database/session-table.h"
+// create_query_rollup_table()
+#include "database/rollup-table.h"
+// create_list_hits_table(), load_list_hits()
+#include "database/list-hits.h"
+// hashStr()
+#include "datastructure.h"
 
 bool DBdeleteoldqueries = false;
 static bool DBerror = false;
@@ -57,6 +63,192 @@ bool checkFTLDBrc(const int rc)
 	return DBerror;
 }
 
+// Prepared statements of the db_query_*() helpers are cached per connection
+// opened through dbopen() and reused until the connection is closed. They are
+// looked up by their SQL text, the least recently used statement is finalized
+// when all slots are taken. SQLite re-prepares cached statements itself after
+// schema changes, a statement failing with SQLITE_SCHEMA nonetheless is
+// dropped from the cache
+#define STMT_CACHE_SLOTS 16u
+#define STMT_CACHE_KEY "FTL statement cache"
+
+struct stmt_cache_entry {
+	sqlite3_stmt *stmt;
+	uint32_t hash;
+	unsigned long last_used;
+	bool in_use;
+};
+
+struct stmt_cache {
+	pthread_mutex_t lock;
+	unsigned long uses;
+	struct stmt_cache_entry entry[STMT_CACHE_SLOTS];
+};
+
+static struct stmt_cache_stats stmt_stats = { 0 };
+static pthread_mutex_t stmt_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void stmt_cache_count(unsigned long *counter)
+{
+	pthread_mutex_lock(&stmt_stats_lock);
+	(*counter)++;
+	pthread_mutex_unlock(&stmt_stats_lock);
+}
+
+void get_stmt_cache_stats(struct stmt_cache_stats *stats)
+{
+	pthread_mutex_lock(&stmt_stats_lock);
+	*stats = stmt_stats;
+	pthread_mutex_unlock(&stmt_stats_lock);
+}
+
+// Destructor called by SQLite when the connection is closed
+static void stmt_cache_free(void *ptr)
+{
+	struct stmt_cache *cache = ptr;
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+// Enable the statement cache for this connection
+static void stmt_cache_attach(sqlite3 *db)
+{
+	struct stmt_cache *cache = calloc(1, sizeof(struct stmt_cache));
+	if(cache == NULL)
+		return;
+
+	pthread_mutex_init(&cache->lock, NULL);
+	if(sqlite3_set_clientdata(db, STMT_CACHE_KEY, cache, stmt_cache_free) != SQLITE_OK)
+		stmt_cache_free(cache);
+}
+
+// Finalize all cached statements, they would prevent closing the connection
+static void stmt_cache_finalize(sqlite3 *db)
+{
+	struct stmt_cache *cache = sqlite3_get_clientdata(db, STMT_CACHE_KEY);
+	if(cache == NULL)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	for(unsigned int i = 0; i < STMT_CACHE_SLOTS; i++)
+	{
+		sqlite3_finalize(cache->entry[i].stmt);
+		memset(&cache->entry[i], 0, sizeof(cache->entry[i]));
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Get a prepared statement for the given SQL, either from the statement
+ * cache of this connection or by preparing a new one.
+ *
+ * The statement has to be returned using stmt_cache_release().
+ *
+ * @param db The database connection.
+ * @param querystr The SQL statement.
+ * @param stmt Pointer to store the prepared statement.
+ * @return SQLite return code of preparing the statement.
+ */
+static int stmt_cache_prepare(sqlite3 *db, const char *querystr, sqlite3_stmt **stmt)
+{
+	struct stmt_cache *cache = db != NULL ? sqlite3_get_clientdata(db, STMT_CACHE_KEY) : NULL;
+	if(cache == NULL)
+		return sqlite3_prepare_v2(db, querystr, -1, stmt, NULL);
+
+	// Try to reuse a cached statement not currently in use by another
+	// thread sharing this connection
+	const uint32_t hash = hashStr(querystr);
+	pthread_mutex_lock(&cache->lock);
+	for(unsigned int i = 0; i < STMT_CACHE_SLOTS; i++)
+	{
+		struct stmt_cache_entry *entry = &cache->entry[i];
+		if(entry->stmt != NULL && !entry->in_use && entry->hash == hash &&
+		   strcmp(sqlite3_sql(entry->stmt), querystr) == 0)
+		{
+			entry->in_use = true;
+			entry->last_used = ++cache->uses;
+			*stmt = entry->stmt;
+			pthread_mutex_unlock(&cache->lock);
+			stmt_cache_count(&stmt_stats.hits);
+			return SQLITE_OK;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	stmt_cache_count(&stmt_stats.misses);
+
+	const int rc = sqlite3_prepare_v3(db, querystr, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+	if(rc != SQLITE_OK)
+		return rc;
+
+	// Store the new statement in a free slot or replace the least recently
+	// used statement. If all statements are in use, the new one is not cached
+	// and will be finalized after use
+	pthread_mutex_lock(&cache->lock);
+	struct stmt_cache_entry *slot = NULL;
+	for(unsigned int i = 0; i < STMT_CACHE_SLOTS; i++)
+	{
+		struct stmt_cache_entry *entry = &cache->entry[i];
+		if(entry->in_use)
+			continue;
+		if(slot == NULL || entry->stmt == NULL || entry->last_used < slot->last_used)
+			slot = entry;
+		if(entry->stmt == NULL)
+			break;
+	}
+	if(slot != NULL)
+	{
+		if(slot->stmt != NULL)
+		{
+			sqlite3_finalize(slot->stmt);
+			stmt_cache_count(&stmt_stats.evictions);
+		}
+		slot->stmt = *stmt;
+		slot->hash = hash;
+		slot->in_use = true;
+		slot->last_used = ++cache->uses;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return SQLITE_OK;
+}
+
+// Return a statement obtained from stmt_cache_prepare(). Statements which are
+// not cached or failed due to a schema change are finalized
+static void stmt_cache_release(sqlite3 *db, sqlite3_stmt *stmt, const int rc)
+{
+	if(stmt == NULL)
+		return;
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	struct stmt_cache *cache = db != NULL ? sqlite3_get_clientdata(db, STMT_CACHE_KEY) : NULL;
+	if(cache != NULL)
+	{
+		pthread_mutex_lock(&cache->lock);
+		for(unsigned int i = 0; i < STMT_CACHE_SLOTS; i++)
+		{
+			struct stmt_cache_entry *entry = &cache->entry[i];
+			if(entry->stmt != stmt)
+				continue;
+
+			if(rc == SQLITE_SCHEMA)
+				memset(entry, 0, sizeof(*entry));
+			else
+				entry->in_use = false;
+
+			pthread_mutex_unlock(&cache->lock);
+
+			if(rc == SQLITE_SCHEMA)
+				sqlite3_finalize(stmt);
+			return;
+		}
+		pthread_mutex_unlock(&cache->lock);
+	}
+
+	sqlite3_finalize(stmt);
+}
+
 void _dbclose(sqlite3 **db, const char *func, const int line, const char *file)
 {
 	// Silently return if the database is known to be broken. It may not be
@@ -67,6 +259,10 @@ void _dbclose(sqlite3 **db, const char *func, const int line, const char *file)
 	if(config.debug.database.v.b)
 		log_debug(DEBUG_DATABASE, "Closing FTL database in %s() (%s:%i)", func, file, line);
 
+	// Cached statements have to be finalized before closing the connection
+	if(db != NULL && *db != NULL)
+		stmt_cache_finalize(*db);
+
 	// Only try to close an existing database connection
 	int rc = SQLITE_OK;
 	if(db != NULL && *db != NULL && (rc = sqlite3_close(*db)) != SQLITE_OK)
@@ -122,6 +318,9 @@ sqlite3* _dbopen(const bool readonly, const bool create, const char *func, const
 		return NULL;
 	}
 
+	// Reuse prepared statements of the db_query_*() helpers
+	stmt_cache_attach(db);
+
 	return db;
 }
 
@@ -215,6 +414,10 @@ static bool db_create(void)
 	if(db == NULL)
 		return false;
 
+	// Allow returning free pages to the file system after deleting old
+	// queries, this has to be set before the first table is created
+	SQL_bool(db, "PRAGMA auto_vacuum = INCREMENTAL;");
+
 	// Create Queries table in the database
 	SQL_bool(db, CREATE_QUERIES_TABLE_V1);
 
@@ -648,6 +851,57 @@ void db_init(void)
 		dbversion = db_get_int(db, DB_VERSION);
 	}
 
+	// Update to version 22 if lower
+	if(dbversion < 22)
+	{
+		// Update to version 22: Add (client, timestamp) and (domain,
+		// timestamp) indices to the query_storage table
+		log_info("Updating long-term database to version 22");
+		if(!create_query_storage_timestamp_indices(db))
+		{
+			log_info("Indices on the query_storage table cannot be added, database not available");
+			dbclose(&db);
+			DBerror = true;
+			return;
+		}
+		// Get updated version
+		dbversion = db_get_int(db, DB_VERSION);
+	}
+
+	// Update to version 23 if lower
+	if(dbversion < 23)
+	{
+		// Update to version 23: Add table with pre-aggregated query
+		// counts for long-term statistics
+		log_info("Updating long-term database to version 23");
+		if(!create_query_rollup_table(db))
+		{
+			log_info("Query rollup table cannot be created, database not available");
+			dbclose(&db);
+			DBerror = true;
+			return;
+		}
+		// Get updated version
+		dbversion = db_get_int(db, DB_VERSION);
+	}
+
+	// Update to version 24 if lower
+	if(dbversion < 24)
+	{
+		// Update to version 24: Add table with the number of queries
+		// allowed or blocked by each list
+		log_info("Updating long-term database to version 24");
+		if(!create_list_hits_table(db))
+		{
+			log_info("List hits table cannot be created, database not available");
+			dbclose(&db);
+			DBerror = true;
+			return;
+		}
+		// Get updated version
+		dbversion = db_get_int(db, DB_VERSION);
+	}
+
 	/* * * * * * * * * * * * * IMPORTANT * * * * * * * * * * * * *
 	 * If you add a new database version, check if the in-memory
 	 * schema needs to be update as well (always recreated from
@@ -668,6 +922,7 @@ void db_init(void)
 
 	lock_shm();
 	import_aliasclients(db);
+	load_list_hits(db);
 	unlock_shm();
 
 	// Close database to prevent having it opened all time
@@ -726,8 +981,8 @@ int db_query_int(sqlite3 *db, const char* querystr)
 {
 	log_debug(DEBUG_DATABASE, "dbquery: \"%s\"", querystr);
 
-	sqlite3_stmt* stmt;
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	sqlite3_stmt* stmt = NULL;
+	int rc = stmt_cache_prepare(db, querystr, &stmt);
 	if( rc != SQLITE_OK )
 	{
 		if( rc != SQLITE_BUSY )
@@ -754,10 +1009,11 @@ int db_query_int(sqlite3 *db, const char* querystr)
 	{
 		log_err("Encountered step error in db_query_int(\"%s\"): %s",
 		        querystr, sqlite3_errstr(rc));
+		stmt_cache_release(db, stmt, rc);
 		return DB_FAILED;
 	}
 
-	sqlite3_finalize(stmt);
+	stmt_cache_release(db, stmt, rc);
 	return result;
 }
 
@@ -765,8 +1021,8 @@ int db_query_int_int(sqlite3 *db, const char* querystr, const int arg)
 {
 	log_debug(DEBUG_DATABASE, "db_query_int_arg: \"%s\"", querystr);
 
-	sqlite3_stmt* stmt;
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	sqlite3_stmt* stmt = NULL;
+	int rc = stmt_cache_prepare(db, querystr, &stmt);
 	if( rc != SQLITE_OK )
 	{
 		if( rc != SQLITE_BUSY )
@@ -800,10 +1056,11 @@ int db_query_int_int(sqlite3 *db, const char* querystr, const int arg)
 	{
 		log_err("Encountered step error in db_query_int(\"%s\"): %s",
 		        querystr, sqlite3_errstr(rc));
+		stmt_cache_release(db, stmt, rc);
 		return DB_FAILED;
 	}
 
-	sqlite3_finalize(stmt);
+	stmt_cache_release(db, stmt, rc);
 	return result;
 }
 
@@ -811,8 +1068,8 @@ int db_query_int_str(sqlite3 *db, const char* querystr, const char *arg)
 {
 	log_debug(DEBUG_DATABASE, "db_query_int_str: \"%s\"", querystr);
 
-	sqlite3_stmt* stmt;
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	sqlite3_stmt* stmt = NULL;
+	int rc = stmt_cache_prepare(db, querystr, &stmt);
 	if( rc != SQLITE_OK )
 	{
 		if( rc != SQLITE_BUSY )
@@ -846,10 +1103,11 @@ int db_query_int_str(sqlite3 *db, const char* querystr, const char *arg)
 	{
 		log_err("Encountered step error in db_query_int(\"%s\"): %s",
 		        querystr, sqlite3_errstr(rc));
+		stmt_cache_release(db, stmt, rc);
 		return DB_FAILED;
 	}
 
-	sqlite3_finalize(stmt);
+	stmt_cache_release(db, stmt, rc);
 	return result;
 }
 
@@ -858,7 +1116,7 @@ double db_query_double(sqlite3 *db, const char* querystr)
 	log_debug(DEBUG_DATABASE, "dbquery: \"%s\"", querystr);
 
 	sqlite3_stmt* stmt = NULL;
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	int rc = stmt_cache_prepare(db, querystr, &stmt);
 	if( rc != SQLITE_OK )
 	{
 		if( rc != SQLITE_BUSY )
@@ -889,17 +1147,18 @@ double db_query_double(sqlite3 *db, const char* querystr)
 		log_err("Encountered step error in db_query_double(\"%s\"): %s",
 		        querystr, sqlite3_errstr(rc));
 		checkFTLDBrc(rc);
+		stmt_cache_release(db, stmt, rc);
 		return DB_FAILED;
 	}
 
-	sqlite3_finalize(stmt);
+	stmt_cache_release(db, stmt, rc);
 	return result;
 }
 
 int db_query_int_from_until(sqlite3 *db, const char* querystr, const double from, const double until)
 {
-	sqlite3_stmt* stmt;
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	sqlite3_stmt* stmt = NULL;
+	int rc = stmt_cache_prepare(db, querystr, &stmt);
 	if( rc != SQLITE_OK ){
 		log_err("db_query_int_from_until(%s) - SQL error prepare (%i): %s",
 		        querystr, rc, sqlite3_errstr(rc));
@@ -930,18 +1189,19 @@ int db_query_int_from_until(sqlite3 *db, const char* querystr, const double from
 	{
 		log_err("db_query_int_from_until(%s) - SQL error step (%i): %s",
 		        querystr, rc, sqlite3_errstr(rc));
+		stmt_cache_release(db, stmt, rc);
 		return DB_FAILED;
 	}
 
-	sqlite3_finalize(stmt);
+	stmt_cache_release(db, stmt, rc);
 
 	return result;
 }
 
 int db_query_int_from_until_type(sqlite3 *db, const char* querystr, const double from, const double until, const int type)
 {
-	sqlite3_stmt* stmt;
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	sqlite3_stmt* stmt = NULL;
+	int rc = stmt_cache_prepare(db, querystr, &stmt);
 	if( rc != SQLITE_OK ){
 		log_err("db_query_int_from_until(%s) - SQL error prepare (%i): %s",
 		        querystr, rc, sqlite3_errstr(rc));
@@ -973,10 +1233,11 @@ int db_query_int_from_until_type(sqlite3 *db, const char* querystr, const double
 	{
 		log_err("db_query_int_from_until(%s) - SQL error step (%i): %s",
 		        querystr, rc, sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		stmt_cache_release(db, stmt, rc);
 		return DB_FAILED;
 	}
-	rc = sqlite3_finalize(stmt);
-	checkFTLDBrc(rc);
+	stmt_cache_release(db, stmt, rc);
 	return result;
 }
 
@@ -19,7 +19,13 @@
 enum ftl_table_props {
 	DB_VERSION,
 	DB_LASTTIMESTAMP,
-	DB_FIRSTCOUNTERTIMESTAMP
+	DB_FIRSTCOUNTERTIMESTAMP,
+	// Capacity plan (see capacity-plan.c): start of the current day and the
+	// peak usage of the current and the previous day (one entry per
+	// enum shm_plan_item each)
+	DB_PLAN_DAY,
+	DB_PLAN_PEAK,
+	DB_PLAN_PREVIOUS_PEAK = DB_PLAN_PEAK + 8
 } __attribute__ ((packed));
 
 // Database table "counters"
@@ -49,6 +55,14 @@ double db_query_double(sqlite3 *db, const char *querystr);
 int db_query_int_from_until(sqlite3 *db, const char* querystr, const double from, const double until);
 int db_query_int_from_until_type(sqlite3 *db, const char* querystr, const double from, const double until, const int type);
 
+// Usage of the statement cache of the db_query_*() helpers
+struct stmt_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+};
+void get_stmt_cache_stats(struct stmt_cache_stats *stats);
+
 void SQLite3LogCallback(void *pArg, int iErrCode, const char *zMsg);
 bool db_set_counter(sqlite3 *db, const enum counters_table_props ID, const int value);
 const char *get_sqlite3_version(void);
@@ -8,6 +8,9 @@
 *  This file is copyright under the latest version of the EUPL.
 *  Please see LICENSE file for your rights under this license. */
 
+#define FTLDNS
+#include "dnsmasq/dnsmasq.h"
+#undef __USE_XOPEN
 #include "FTL.h"
 #include "database/database-thread.h"
 #include "database/common.h"
@@ -15,7 +18,7 @@
 #include "shmem.h"
 // parse_neighbor_cache()
 #include "database/network-table.h"
-// export_queries_to_disk()
+// export_queries_to_disk(), disk_queries_deleted()
 #include "database/query-table.h"
 #include "config/config.h"
 #include "log.h"
@@ -30,29 +33,227 @@
 #include "files.h"
 // gravity_updated()
 #include "database/gravity-db.h"
+// delete_query_rollup()
+#include "database/rollup-table.h"
+// update_query_partitions()
+#include "database/query-partitions.h"
+// flush_message_queue()
+#include "database/message-table.h"
+// replicate_database()
+#include "database/replication.h"
+// flush_query_sink()
+#include "database/query-sink.h"
+// store_list_hits()
+#include "database/list-hits.h"
+// store_capacity_plan()
+#include "database/capacity-plan.h"
+// FTL_refresh_dns_cache()
+#include "dnsmasq_interface.h"
+// PATH_MAX
+#include <limits.h>
+// set_thread_placement()
+#include "daemon.h"
+
+// Checkpoint the WAL once it is larger than this after storing queries, do a
+// RESTART checkpoint once it is larger than the second limit so the next
+// writer starts at the beginning of the file again
+#define WAL_CHECKPOINT_BYTES (4u*1024u*1024u)
+#define WAL_RESTART_BYTES (64u*1024u*1024u)
+// Storing queries is considered slow if it took this much longer than usual,
+// retention and ANALYZE are postponed then (but not more often than this)
+#define SLOW_EXPORT_FACTOR 3.0
+#define JOB_DEFER_MAX 10u
+// Domainlists are reloaded once no further change arrived for this many
+// seconds, but at most LIST_RELOAD_MAX_DELAY seconds after the first change
+#define LIST_RELOAD_QUIET 0.25
+#define LIST_RELOAD_MAX_DELAY 2.0
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct db_job_stats job_stats[DB_JOBS] = {{ 0 }};
+
+const char *get_db_job_name(const enum db_job job)
+{
+	switch(job)
+	{
+		case DB_JOB_EXPORT:
+			return "export";
+		case DB_JOB_CHECKPOINT:
+			return "checkpoint";
+		case DB_JOB_RETENTION:
+			return "retention";
+		case DB_JOB_ANALYZE:
+			return "analyze";
+		case DB_JOBS:
+		default:
+			return "unknown";
+	}
+}
+
+void get_db_job_stats(struct db_job_stats stats[DB_JOBS])
+{
+	pthread_mutex_lock(&job_lock);
+	memcpy(stats, job_stats, sizeof(job_stats));
+	pthread_mutex_unlock(&job_lock);
+}
+
+static void job_done(const enum db_job job, const double start)
+{
+	const double duration = double_time() - start;
+	pthread_mutex_lock(&job_lock);
+	job_stats[job].runs++;
+	job_stats[job].last = duration;
+	job_stats[job].total += duration;
+	if(duration > job_stats[job].max)
+		job_stats[job].max = duration;
+	pthread_mutex_unlock(&job_lock);
+}
+
+static void job_deferred(const enum db_job job)
+{
+	pthread_mutex_lock(&job_lock);
+	job_stats[job].deferred++;
+	pthread_mutex_unlock(&job_lock);
+}
+
+static off_t get_wal_size(void)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s-wal", config.files.database.v.s);
+
+	struct stat st;
+	if(stat(path, &st) != 0)
+		return 0;
+
+	return st.st_size;
+}
+
+static bool checkpoint_wal(sqlite3 *db, const off_t wal_size)
+{
+	const int mode = wal_size >= WAL_RESTART_BYTES ? SQLITE_CHECKPOINT_RESTART : SQLITE_CHECKPOINT_PASSIVE;
+	int frames = 0, checkpointed = 0;
+	const int rc = sqlite3_wal_checkpoint_v2(db, NULL, mode, &frames, &checkpointed);
+	if(rc != SQLITE_OK && rc != SQLITE_BUSY)
+	{
+		log_err("checkpoint_wal(): %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	log_debug(DEBUG_DATABASE, "%s WAL checkpoint: %d of %d frames checkpointed%s",
+	          mode == SQLITE_CHECKPOINT_RESTART ? "RESTART" : "PASSIVE",
+	          checkpointed, frames, rc == SQLITE_BUSY ? " (busy)" : "");
+
+	return true;
+}
 
+// Number of queries deleted per transaction
+#define DELETE_CHUNK_ROWS 5000
+// Number of free pages returned to the file system per step
+#define VACUUM_CHUNK_PAGES 1024
+// Maximum time spent on housekeeping per run [s] so storing new queries is
+// not held up for long
+#define HOUSEKEEPING_TIME_LIMIT 2.0
+
+// Sleep long enough for the pages written since the last call to stay within
+// the configured I/O budget (database.ioBudget)
+static void io_budget_wait(sqlite3 *db, const int page_size, const double since)
+{
+	int pages = 0, highwater = 0;
+	sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &pages, &highwater, true);
+	if(config.database.ioBudget.v.ui == 0 || page_size <= 0)
+		return;
+
+	const double needed = (double)pages * page_size / (1e6 * config.database.ioBudget.v.ui);
+	const double elapsed = double_time() - since;
+	if(needed > elapsed)
+		thread_sleepms(DB, (int)(1e3*(needed - elapsed)));
+}
+
+// Return free pages to the file system in small steps. This only works for
+// databases created with auto_vacuum = INCREMENTAL
+static bool incremental_vacuum(sqlite3 *db, const int page_size, const double start)
+{
+	if(db_query_int(db, "PRAGMA auto_vacuum;") != 2)
+		return true;
+
+	int freelist = db_query_int(db, "PRAGMA freelist_count;");
+	while(freelist > 0 && !killed && double_time() - start < HOUSEKEEPING_TIME_LIMIT)
+	{
+		const double since = double_time();
+		SQL_bool(db, "PRAGMA incremental_vacuum(%d);", VACUUM_CHUNK_PAGES);
+		freelist -= VACUUM_CHUNK_PAGES;
+		io_budget_wait(db, page_size, since);
+	}
+
+	log_debug(DEBUG_DATABASE, "Incremental vacuum: %d free pages left", MAX(freelist, 0));
+	return true;
+}
+
+// Delete expired queries from the database. Returns true when all expired
+// queries have been deleted, false if there are more to be deleted during the
+// next run
 static bool delete_old_queries_in_DB(sqlite3 *db)
 {
-	// Delete old queries from the database but never more than 1% of the
-	// database at once to avoid long blocking times. Check out
+	// Delete old queries in small transactions and never spend more than a
+	// few seconds at once to avoid long blocking times. Check out
 	// https://github.com/pi-hole/FTL/issues/1372 for details.
-	// As deleting database entries happens typically once per minute,
-	// this method could still delete 1440% of the database per day.
-	// Even when the database storing interval is set to 1 hour, this
-	// method would still delete 24% of the database per day so maxDBdays > 4
-	// does still work.
+	// Whatever is left over is deleted during the next run
+	const double start = double_time();
 	const time_t timestamp = time(NULL) - config.database.maxDBdays.v.ui * 86400;
-	SQL_bool(db, "DELETE FROM query_storage WHERE id IN (SELECT id FROM query_storage WHERE timestamp <= %lu LIMIT (SELECT COUNT(*)/100 FROM query_storage));",
-	         (unsigned long)timestamp);
+	const bool partitioned = query_storage_partitioned(db);
+	const int page_size = db_query_int(db, "PRAGMA page_size;");
+	int affected = 0;
+	bool done = true;
+
+	// Reset the number of pages written so far
+	io_budget_wait(db, 0, start);
+
+	if(partitioned)
+	{
+		// Partitioned storage: Drop partitions which are entirely expired
+		// instead of deleting individual queries
+		if((affected = drop_query_partitions(db, timestamp)) < 0)
+			return false;
+		if(affected > 0)
+			disk_queries_deleted(-1);
+	}
+	else
+	{
+		while(true)
+		{
+			const double since = double_time();
+			SQL_bool(db, "DELETE FROM query_storage WHERE id IN (SELECT id FROM query_storage WHERE timestamp <= %lu LIMIT %d);",
+			         (unsigned long)timestamp, DELETE_CHUNK_ROWS);
+
+			// Get how many rows have been affected (deleted)
+			const int deleted = sqlite3_changes(db);
+			affected += deleted;
+			disk_queries_deleted(deleted);
+			if(deleted < DELETE_CHUNK_ROWS)
+				break;
+
+			// Yield between chunks
+			io_budget_wait(db, page_size, since);
+			if(killed || double_time() - start >= HOUSEKEEPING_TIME_LIMIT)
+			{
+				done = false;
+				break;
+			}
+		}
+	}
+
+	// Delete pre-aggregated counts of periods which are entirely expired
+	delete_query_rollup(db, timestamp, false);
 
-	// Get how many rows have been affected (deleted)
-	const int affected = sqlite3_changes(db);
+	// Shrink the database file if possible
+	if(done && !incremental_vacuum(db, page_size, start))
+		return false;
 
 	// Print debug message
-	log_debug(DEBUG_DATABASE, "Size of %s is %.2f MB, deleted %i rows",
-	          config.files.database.v.s, 1e-6*get_FTL_db_filesize(), affected);
+	log_debug(DEBUG_DATABASE, "Size of %s is %.2f MB, deleted %i %s%s",
+	          config.files.database.v.s, 1e-6*get_FTL_db_filesize(), affected,
+	          partitioned ? "partitions" : "rows", done ? "" : " (more to be deleted)");
 
-	return true;
+	return done;
 }
 
 static bool analyze_database(sqlite3 *db)
@@ -66,7 +267,17 @@ static bool analyze_database(sqlite3 *db)
 	// Measure time
 	struct timespec start, end;
 	clock_gettime(CLOCK_MONOTONIC, &start);
-	SQL_bool(db, "ANALYZE;");
+	if(query_storage_partitioned(db))
+	{
+		// Partitions no longer receiving queries do not need to be
+		// analyzed again
+		if(!analyze_query_partitions(db))
+			return false;
+	}
+	else
+	{
+		SQL_bool(db, "ANALYZE;");
+	}
 	clock_gettime(CLOCK_MONOTONIC, &end);
 
 	// Print final message
@@ -76,13 +287,51 @@ static bool analyze_database(sqlite3 *db)
 	return true;
 }
 
-#define DBOPEN_OR_AGAIN() { if(!db) db = dbopen(false, false); if(!db) { thread_sleepms(DB, 5000); continue; } }
+// Reload the domainlists after changes (e.g., through the API) have settled.
+// Adding many domains one by one results in a single reload instead of one
+// reload per domain
+static void process_list_reloads(void)
+{
+	static bool reload_all = false, reload_changed = false;
+	static double first = 0.0, last = 0.0;
+	const double now = double_time();
+
+	const bool all = get_and_clear_event(RELOAD_GRAVITY);
+	const bool changed = get_and_clear_event(RELOAD_DOMAINLIST);
+	if(all || changed)
+	{
+		if(!reload_all && !reload_changed)
+			first = now;
+		last = now;
+		reload_all |= all;
+		reload_changed |= changed;
+	}
+
+	if(!reload_all && !reload_changed)
+		return;
+	if(now - last < LIST_RELOAD_QUIET && now - first < LIST_RELOAD_MAX_DELAY)
+		return;
+
+	// A full reload covers changed domains, too
+	if(reload_all)
+		FTL_reload_all_domainlists();
+	else
+		FTL_reload_changed_domains();
+	reload_all = reload_changed = false;
+
+	// Re-validate the hottest DNS cache records right away so their next
+	// query does not have to evaluate the lists again
+	FTL_refresh_dns_cache();
+}
+
+#define DBOPEN_OR_AGAIN() { if(!db) db = dbopen(false, false); if(!db) { thread_sleepms(DB, 5000); continue; } sqlite3_wal_autocheckpoint(db, 0); }
 #define DBCLOSE_OR_BREAK() { dbclose(&db); BREAK_IF_KILLED(); }
 
 void *DB_thread(void *val)
 {
 	// Set thread name
 	prctl(PR_SET_NAME, thread_names[DB], 0, 0, 0);
+	set_thread_placement(ROLE_BACKGROUND);
 
 	// Save timestamp as we do not want to store immediately
 	// to the database
@@ -100,6 +349,16 @@ void *DB_thread(void *val)
 	lastAnalyze += rand() % 3600;
 	lastMACVendor += rand() % 3600;
 
+	// Disk jobs are run one after another, at most one per second, so their
+	// I/O does not pile up. Storing queries always comes first
+	time_t lastDiskJob = before;
+	time_t lastMessages = before;
+	time_t lastNeighbors = before;
+	bool checkpoint_due = false;
+	double export_avg = 0.0;
+	unsigned int slow_exports = 0;
+	bool deferred[DB_JOBS] = { false };
+
 	// This thread runs until shutdown of the process. We keep this thread
 	// running when pihole-FTL.db is corrupted because reloading of privacy
 	// level, and the gravity database (initially and after gravity)
@@ -113,9 +372,8 @@ void *DB_thread(void *val)
 		// Do this once per second
 		if(now > before)
 		{
-			lock_shm();
+			// Takes the SHM lock only while copying changed queries
 			queries_to_database();
-			unlock_shm();
 			before = now;
 
 			// Check if we need to reload gravity
@@ -138,21 +396,34 @@ void *DB_thread(void *val)
 
 			// Save data to database
 			DBOPEN_OR_AGAIN();
-			lock_shm();
+
+			// Start a new partition when the current period is over
+			update_query_partitions(db);
+
+			// Works on the in-memory database only, no SHM lock needed
+			const double start = double_time();
 			export_queries_to_disk(false);
-			unlock_shm();
+			const double duration = double_time() - start;
+			job_done(DB_JOB_EXPORT, start);
 
-			// Intermediate cancellation-point
-			if(killed)
-				break;
+			// Store list hits counted since the last time
+			store_list_hits(db);
 
-			// Check if GC should be done on the database
-			if(DBdeleteoldqueries)
-			{
-				// No thread locks needed
-				delete_old_queries_in_DB(db);
-				DBdeleteoldqueries = false;
-			}
+			// Record the peak usage of the shared memory
+			store_capacity_plan(db);
+
+			// Postpone retention and ANALYZE while storing queries is
+			// slower than usual, the disk is busy with something else
+			if(export_avg > 0.0 && duration > SLOW_EXPORT_FACTOR*export_avg &&
+			   slow_exports < JOB_DEFER_MAX)
+				slow_exports++;
+			else
+				slow_exports = 0;
+			export_avg = export_avg > 0.0 ? 0.8*export_avg + 0.2*duration : duration;
+			memset(deferred, 0, sizeof(deferred));
+
+			checkpoint_due = config.database.useWAL.v.b;
+			lastDiskJob = now;
 
 			DBCLOSE_OR_BREAK();
 
@@ -164,13 +435,62 @@ void *DB_thread(void *val)
 		if(killed)
 			break;
 
-		// Optimize database once per week
-		if(now - lastAnalyze >= DATABASE_ANALYZE_INTERVAL)
+		// Run the next pending disk job
+		if(now > lastDiskJob)
 		{
-			DBOPEN_OR_AGAIN();
-			analyze_database(db);
-			lastAnalyze = now;
-			DBCLOSE_OR_BREAK();
+			enum db_job job = DB_JOBS;
+			off_t wal_size = 0;
+			if(checkpoint_due && (wal_size = get_wal_size()) >= WAL_CHECKPOINT_BYTES)
+				job = DB_JOB_CHECKPOINT;
+			else if(DBdeleteoldqueries)
+				job = DB_JOB_RETENTION;
+			else if(now - lastAnalyze >= DATABASE_ANALYZE_INTERVAL)
+				job = DB_JOB_ANALYZE;
+			checkpoint_due = false;
+
+			if((job == DB_JOB_RETENTION || job == DB_JOB_ANALYZE) && slow_exports > 0)
+			{
+				if(!deferred[job])
+					job_deferred(job);
+				deferred[job] = true;
+				job = DB_JOBS;
+			}
+
+			if(job != DB_JOBS)
+			{
+				DBOPEN_OR_AGAIN();
+				const double start = double_time();
+				switch(job)
+				{
+					case DB_JOB_CHECKPOINT:
+						checkpoint_wal(db, wal_size);
+						break;
+
+					case DB_JOB_RETENTION:
+						// No thread locks needed. Continue during the
+						// next run if not all expired queries could be
+						// deleted
+						DBdeleteoldqueries = !delete_old_queries_in_DB(db);
+
+						// Move old partitions into the archive
+						archive_query_partitions(db);
+						break;
+
+					case DB_JOB_ANALYZE:
+						// Optimize database once per week
+						analyze_database(db);
+						lastAnalyze = now;
+						break;
+
+					case DB_JOB_EXPORT:
+					case DB_JOBS:
+					default:
+						break;
+				}
+				job_done(job, start);
+				lastDiskJob = now;
+				DBCLOSE_OR_BREAK();
+			}
 		}
 
 		// Intermediate cancellation-point
@@ -191,6 +511,33 @@ void *DB_thread(void *val)
 		if(killed)
 			break;
 
+		// Write queued messages in one transaction, at most once per
+		// second
+		if(now > lastMessages && messages_pending(false))
+		{
+			lastMessages = now;
+			DBOPEN_OR_AGAIN();
+			flush_message_queue(db, false);
+			DBCLOSE_OR_BREAK();
+		}
+
+		// Intermediate cancellation-point
+		BREAK_IF_KILLED();
+
+		// Push the database to the standby node when due, the
+		// replication itself runs in a child process
+		replicate_database(now);
+
+		// Store neighbors which appeared or changed as reported by the
+		// kernel, at most once per second
+		if(read_neighbor_events() && now > lastNeighbors)
+		{
+			lastNeighbors = now;
+			DBOPEN_OR_AGAIN();
+			update_neighbors(db);
+			DBCLOSE_OR_BREAK();
+		}
+
 		// Parse ARP cache if requested
 		if(get_and_clear_event(PARSE_NEIGHBOR_CACHE))
 		{
@@ -213,20 +560,38 @@ void *DB_thread(void *val)
 		}
 
 		// Process database related event queue elements
-		if(get_and_clear_event(RELOAD_GRAVITY))
-			FTL_reload_all_domainlists();
+		process_list_reloads();
 
 		// Intermediate cancellation-point
 		BREAK_IF_KILLED();
 
-		// Sleep 0.1 sec
-		thread_sleepms(DB, 100);
+		// Everything above is due at most once per second, sleep until
+		// the next second starts unless woken up by an event
+		const double wakeup = double_time();
+		thread_sleepms(DB, (int)(1e3*(1.0 - (wakeup - (time_t)wakeup))) + 1);
+	}
+
+	// Write all messages still queued, messages logged from now on are
+	// written right away
+	if(messages_pending(true))
+	{
+		if(!db)
+			db = dbopen(false, false);
+		if(db)
+			flush_message_queue(db, true);
 	}
 
 	// Close database handle if still open
 	if(db)
 		dbclose(&db);
 
+	// Do not leave a replication running after we terminated
+	stop_database_replication();
+
+	// Write what the query sink accepts without blocking, the rest is lost
+	flush_query_sink();
+	close_query_sink();
+
 	log_info("Terminating database thread");
 	return NULL;
 }
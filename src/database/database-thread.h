@@ -10,6 +10,24 @@
 #ifndef DATABASE_THREAD_H
 #define DATABASE_THREAD_H
 
+enum db_job {
+	DB_JOB_EXPORT,
+	DB_JOB_CHECKPOINT,
+	DB_JOB_RETENTION,
+	DB_JOB_ANALYZE,
+	DB_JOBS
+} __attribute__ ((packed));
+
+struct db_job_stats {
+	unsigned int runs;
+	unsigned int deferred;
+	double last;
+	double max;
+	double total;
+};
+
 void *DB_thread(void *val);
+void get_db_job_stats(struct db_job_stats stats[DB_JOBS]);
+const char *get_db_job_name(const enum db_job job) __attribute__ ((const));
 
 #endif //DATABASE_THREAD_H
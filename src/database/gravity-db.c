@@ -32,6 +32,39 @@
 #include "regex_r.h"
 // file_readable()
 #include "files.h"
+// gravity_index_lookup()
+#include "database/gravity-index.h"
+// gravity_filter_maybe()
+#include "database/gravity-filter.h"
+// client_classifier_subnet()
+#include "database/client-classifier.h"
+
+// Longest ABP pattern we construct: "@@||" + domain (at most 253 characters in
+// presentation format) + "^" + NUL
+#define ABP_MAX_PATTERN_LEN 260
+
+// Generation of lookup structures compiled by gravityDB_compile_next() but
+// not yet published by gravityDB_reopen()
+static struct {
+	bool ready;
+	bool keep_filter;
+	struct gravity_filter *filter;
+	struct gravity_index *index;
+	struct client_classifier *clients;
+} next_gen = { false, false, NULL, NULL, NULL };
+
+// Result of the last combined probe of the compiled index, see domain_in_index()
+static struct {
+	bool valid;
+	unsigned int generation;
+	unsigned int clientID;
+	size_t groupspos;
+	unsigned int string_generation;
+	enum db_result result;
+	unsigned int found;
+	int ids[GRAVITY_INDEX_LISTS];
+	char domain[ABP_MAX_PATTERN_LEN];
+} last_probe = { 0 };
 
 // Prefix of interface names in the client table
 #define INTERFACE_SEP ":"
@@ -49,6 +82,8 @@ static sqlite3 *gravity_db = NULL;
 static sqlite3_stmt* table_stmt = NULL;
 bool gravityDB_opened = false;
 static bool gravity_abp_format = false;
+// Whether gravity and antigravity have a trigram search index
+static bool gravity_search_index[2] = { false, false };
 
 // Variables memorizing the parent gravity database connection and prepared
 // statements to avoid valgrind warnings about memory leaks
@@ -110,8 +145,11 @@ void gravityDB_forked(void)
 	parent_antigravity_stmt = antigravity_stmt;
 	antigravity_stmt = NULL;
 
-	// Open the database
-	gravityDB_open();
+	// Forks inherit the compiled index and the prefilter as read-only
+	// shared mappings and need the database only as a fallback. In this
+	// case, it is opened lazily on first use
+	if(!gravity_index_ready())
+		gravityDB_open();
 }
 
 static void gravity_check_ABP_format(void)
@@ -148,6 +186,40 @@ static void gravity_check_ABP_format(void)
 	sqlite3_finalize(stmt);
 }
 
+// Check which of the optional search indices have been built by pihole -g
+static void gravity_check_search_index(void)
+{
+	gravity_search_index[0] = false;
+	gravity_search_index[1] = false;
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(gravity_db,
+	                            "SELECT name FROM sqlite_master WHERE type = 'table' AND name IN ('gravity_search','antigravity_search');",
+	                            -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_warn("gravity_check_search_index() - SQL error prepare: %s", sqlite3_errstr(rc));
+		return;
+	}
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *name = (const char*)sqlite3_column_text(stmt, 0);
+		if(name == NULL)
+			continue;
+		if(strcmp(name, "gravity_search") == 0)
+			gravity_search_index[0] = true;
+		else
+			gravity_search_index[1] = true;
+	}
+
+	sqlite3_finalize(stmt);
+
+	log_debug(DEBUG_DATABASE, "Search index: gravity %s, antigravity %s",
+	          gravity_search_index[0] ? "available" : "missing",
+	          gravity_search_index[1] ? "available" : "missing");
+}
+
 // Open gravity database
 static bool gravityDB_open(void)
 {
@@ -216,18 +288,117 @@ static bool gravityDB_open(void)
 	// entries in the database
 	gravity_check_ABP_format();
 
+	// Check if partial matches can be looked up in the search index
+	gravity_check_search_index();
+
 	log_debug(DEBUG_DATABASE, "gravityDB_open(): Successfully opened gravity.db");
 
 	return true;
 }
 
+// Discard a compiled but not yet published generation (if any)
+static void gravityDB_discard_next(void)
+{
+	gravity_filter_discard(next_gen.filter);
+	gravity_index_discard(next_gen.index);
+	client_classifier_discard(next_gen.clients);
+	next_gen.filter = NULL;
+	next_gen.index = NULL;
+	next_gen.clients = NULL;
+	next_gen.ready = false;
+	next_gen.keep_filter = false;
+}
+
+// Compile the next generation of the in-memory lookup structures (prefilter,
+// compiled index and client classifier). This is called WITHOUT holding the shared memory lock
+// so DNS queries keep being answered by the current generation in the
+// meantime. A private read-only connection is used, the connection and the
+// prepared statements of the current generation remain untouched. The new
+// generation is published by the next call of gravityDB_reopen(). When only
+// the domainlists changed (gravity == false), the current prefilter is kept
+void gravityDB_compile_next(const bool gravity)
+{
+	gravityDB_discard_next();
+
+	sqlite3 *db = NULL;
+	int rc = sqlite3_open_v2(config.files.gravity.v.s, &db, SQLITE_OPEN_READONLY, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("gravityDB_compile_next() - SQL error: %s", sqlite3_errstr(rc));
+		sqlite3_close(db);
+		return;
+	}
+
+	// Wait for a possibly ongoing write to the database to finish
+	sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT);
+
+	if(gravity)
+		next_gen.filter = gravity_filter_compile(db);
+	next_gen.keep_filter = !gravity;
+	if(config.dns.blocking.compiledIndex.v.b)
+		next_gen.index = gravity_index_compile(db);
+	next_gen.clients = client_classifier_compile(db);
+	next_gen.ready = true;
+
+	sqlite3_close(db);
+}
+
 bool gravityDB_reopen(void)
 {
 	// We call this routine when reloading the cache.
 	gravityDB_close();
 
+	// Let TCP workers forked before this point know that their inherited
+	// lookup structures are outdated. This also invalidates all records in
+	// FTL's internal DNS cache
+	bump_gravity_generation();
+
 	// Re-open gravity database
-	return gravityDB_open();
+	if(!gravityDB_open())
+	{
+		// The index and the prefilter may be outdated, we cannot use
+		// them any longer
+		gravity_index_free();
+		gravity_filter_free();
+		client_classifier_free();
+		gravityDB_discard_next();
+		return false;
+	}
+
+	if(next_gen.ready)
+	{
+		// Publish the generation compiled by gravityDB_compile_next().
+		// As lookups only happen while holding the shared memory lock
+		// (which we hold here, too), the previous generation is not
+		// in use by anyone and can be freed right away
+		if(next_gen.keep_filter)
+			gravity_filter_renew();
+		else
+			gravity_filter_publish(next_gen.filter);
+		gravity_index_publish(next_gen.index);
+		client_classifier_publish(next_gen.clients);
+		next_gen.filter = NULL;
+		next_gen.index = NULL;
+		next_gen.clients = NULL;
+		next_gen.ready = false;
+		next_gen.keep_filter = false;
+
+		return true;
+	}
+
+	// (Re-)build the negative prefilter for the gravity lookups
+	gravity_filter_build(gravity_db);
+
+	// (Re-)compile the in-memory index of the exact lists if enabled
+	if(config.dns.blocking.compiledIndex.v.b)
+		gravity_index_build(gravity_db);
+	else
+		gravity_index_free();
+
+	// (Re-)compile the client classifier used for group assignment
+	client_classifier_build(gravity_db);
+
+	return true;
 }
 
 static char* get_client_querystr(const char *table, const char *column, const char *groups)
@@ -280,70 +451,95 @@ static bool get_client_groupids(clientsData *client)
 
 	log_debug(DEBUG_DATABASE, "Querying gravity database for client with IP %s...", ip);
 
-	// Check if client is configured through the client table
-	// This will return nothing if the client is unknown/unconfigured
-	const char *querystr = "SELECT count(id) matching_count, "
-	                       "max(id) chosen_match_id, "
-	                       "ip chosen_match_text, "
-	                       "group_concat(id) matching_ids, "
-	                       "subnet_match(ip,?) matching_bits FROM client "
-	                       "WHERE matching_bits > 0 "
-	                       "GROUP BY matching_bits "
-	                       "ORDER BY matching_bits DESC LIMIT 1;";
-
-	// Prepare query
-	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
-	if(rc != SQLITE_OK)
-	{
-		log_err("get_client_groupids(\"%s\") - SQL error prepare: %s",
-		        ip, sqlite3_errstr(rc));
-		return false;
-	}
-
-	// Bind ipaddr to prepared statement
-	if((rc = sqlite3_bind_text(table_stmt, 1, ip, -1, SQLITE_STATIC)) != SQLITE_OK)
-	{
-		log_err("get_client_groupids(\"%s\"): Failed to bind ip: %s",
-		        ip, sqlite3_errstr(rc));
-		sqlite3_reset(table_stmt);
-		sqlite3_finalize(table_stmt);
-		return false;
-	}
-
-	// Perform query
-	rc = sqlite3_step(table_stmt);
+	// Use the compiled client classifier unless it is not available (e.g., in
+	// forks created before the lists have been reloaded)
+	const bool compiled = client_classifier_ready();
+	const char *querystr = NULL;
+	int rc = SQLITE_OK;
 	int matching_count = 0, chosen_match_id = -1, matching_bits = 0;
 	char *matching_ids = NULL, *chosen_match_text = NULL;
-	if(rc == SQLITE_ROW)
+	struct client_subnet_match match = { 0 };
+	if(compiled && client_classifier_subnet(ip, &match))
 	{
-		// There is a record for this client in the database,
-		// extract the result (there can be at most one line)
-		matching_count = sqlite3_column_int(table_stmt, 0);
-		chosen_match_id = sqlite3_column_int(table_stmt, 1);
-		chosen_match_text = strdup((const char*)sqlite3_column_text(table_stmt, 2));
-		matching_ids = strdup((const char*)sqlite3_column_text(table_stmt, 3));
-		matching_bits = sqlite3_column_int(table_stmt, 4);
+		matching_count = (int)match.count;
+		chosen_match_id = match.id;
+		chosen_match_text = strdup(match.text);
+		matching_ids = strdup(match.ids);
+		matching_bits = (int)match.bits;
 
 		if(matching_count == 1)
 			// Case matching_count > 1 handled below using logg_subnet_warning()
 			log_debug(DEBUG_CLIENTS, "--> Found record for %s in the client table (group ID %d)", ip, chosen_match_id);
 	}
-	else if(rc == SQLITE_DONE)
+	else if(compiled)
 	{
 		log_debug(DEBUG_CLIENTS, "--> No record for %s in the client table", ip);
 	}
 	else
 	{
-		// Error
-		log_err("get_client_groupids(\"%s\") - SQL error step: %s",
-		        ip, sqlite3_errstr(rc));
+		// Check if client is configured through the client table
+		// This will return nothing if the client is unknown/unconfigured
+		querystr = "SELECT count(id) matching_count, "
+		           "max(id) chosen_match_id, "
+		           "ip chosen_match_text, "
+		           "group_concat(id) matching_ids, "
+		           "subnet_match(ip,?) matching_bits FROM client "
+		           "WHERE matching_bits > 0 "
+		           "GROUP BY matching_bits "
+		           "ORDER BY matching_bits DESC LIMIT 1;";
+
+		// Prepare query
+		rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
+		if(rc != SQLITE_OK)
+		{
+			log_err("get_client_groupids(\"%s\") - SQL error prepare: %s",
+			        ip, sqlite3_errstr(rc));
+			return false;
+		}
+
+		// Bind ipaddr to prepared statement
+		if((rc = sqlite3_bind_text(table_stmt, 1, ip, -1, SQLITE_STATIC)) != SQLITE_OK)
+		{
+			log_err("get_client_groupids(\"%s\"): Failed to bind ip: %s",
+			        ip, sqlite3_errstr(rc));
+			sqlite3_reset(table_stmt);
+			sqlite3_finalize(table_stmt);
+			return false;
+		}
+
+		// Perform query
+		rc = sqlite3_step(table_stmt);
+		if(rc == SQLITE_ROW)
+		{
+			// There is a record for this client in the database,
+			// extract the result (there can be at most one line)
+			matching_count = sqlite3_column_int(table_stmt, 0);
+			chosen_match_id = sqlite3_column_int(table_stmt, 1);
+			chosen_match_text = strdup((const char*)sqlite3_column_text(table_stmt, 2));
+			matching_ids = strdup((const char*)sqlite3_column_text(table_stmt, 3));
+			matching_bits = sqlite3_column_int(table_stmt, 4);
+
+			if(matching_count == 1)
+				// Case matching_count > 1 handled below using logg_subnet_warning()
+				log_debug(DEBUG_CLIENTS, "--> Found record for %s in the client table (group ID %d)", ip, chosen_match_id);
+		}
+		else if(rc == SQLITE_DONE)
+		{
+			log_debug(DEBUG_CLIENTS, "--> No record for %s in the client table", ip);
+		}
+		else
+		{
+			// Error
+			log_err("get_client_groupids(\"%s\") - SQL error step: %s",
+			        ip, sqlite3_errstr(rc));
+			gravityDB_finalizeTable();
+			return false;
+		}
+
+		// Finalize statement
 		gravityDB_finalizeTable();
-		return false;
 	}
 
-	// Finalize statement
-	gravityDB_finalizeTable();
-
 	if(matching_count > 1)
 	{
 		// There is more than one configured subnet that matches to current device
@@ -423,7 +619,19 @@ static bool get_client_groupids(clientsData *client)
 
 	// Check if we received a valid MAC address
 	// This ensures we skip mock hardware addresses such as "ip-127.0.0.1"
-	if(hwaddr != NULL)
+	if(hwaddr != NULL && compiled)
+	{
+		chosen_match_id = client_classifier_id("", hwaddr);
+		if(chosen_match_id > -1)
+		{
+			log_debug(DEBUG_CLIENTS, "--> Found record for %s in the client table (group ID %d)", hwaddr, chosen_match_id);
+		}
+		else
+		{
+			log_debug(DEBUG_CLIENTS, "--> There is no record for %s in the client table", hwaddr);
+		}
+	}
+	else if(hwaddr != NULL)
 	{
 		log_debug(DEBUG_CLIENTS, "--> Querying client table for %s", hwaddr);
 
@@ -506,7 +714,19 @@ static bool get_client_groupids(clientsData *client)
 
 	// Check if we received a valid MAC address
 	// This ensures we skip mock hardware addresses such as "ip-127.0.0.1"
-	if(hostname != NULL)
+	if(hostname != NULL && compiled)
+	{
+		chosen_match_id = client_classifier_id("", hostname);
+		if(chosen_match_id > -1)
+		{
+			log_debug(DEBUG_CLIENTS, "--> Found record for %s in the client table (group ID %d)", hostname, chosen_match_id);
+		}
+		else
+		{
+			log_debug(DEBUG_CLIENTS, "--> There is no record for %s in the client table", hostname);
+		}
+	}
+	else if(hostname != NULL)
 	{
 		log_debug(DEBUG_CLIENTS, "--> Querying client table for %s", hostname);
 
@@ -592,7 +812,19 @@ static bool get_client_groupids(clientsData *client)
 	}
 
 	// Check if we received a valid interface
-	if(interface != NULL)
+	if(interface != NULL && compiled)
+	{
+		chosen_match_id = client_classifier_id(INTERFACE_SEP, interface);
+		if(chosen_match_id > -1)
+		{
+			log_debug(DEBUG_CLIENTS, "--> Found record for interface "INTERFACE_SEP"%s in the client table (group ID %d)", interface, chosen_match_id);
+		}
+		else
+		{
+			log_debug(DEBUG_CLIENTS, "--> There is no record for interface "INTERFACE_SEP"%s in the client table", interface);
+		}
+	}
+	else if(interface != NULL)
 	{
 		log_debug(DEBUG_CLIENTS, "Querying client table for interface "INTERFACE_SEP"%s", interface);
 
@@ -689,64 +921,76 @@ static bool get_client_groupids(clientsData *client)
 		return true;
 	}
 
-	// Build query string to get possible group associations for this particular client
-	// The SQL GROUP_CONCAT() function returns a string which is the concatenation of all
-	// non-NULL values of group_id separated by ','. The order of the concatenated elements
-	// is arbitrary, however, is of no relevance for your use case.
-	// We check using a possibly defined subnet and use the first result
-	querystr = "SELECT GROUP_CONCAT(group_id) FROM client_by_group "
-	           "WHERE client_id = ?;";
-
 	log_debug(DEBUG_CLIENTS, "Querying gravity database for client %s (getting groups)", ip);
 
-	// Prepare query
-	rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
-	if(rc != SQLITE_OK)
+	if(compiled)
 	{
-		log_err("get_client_groupids(\"%s\", \"%s\", %d) - SQL error prepare: %s",
-		        ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
-		sqlite3_finalize(table_stmt);
-		return false;
+		// A client without any groups is not assigned to any group.
+		// Unlike the NULL returned by GROUP_CONCAT() in this case, this
+		// is remembered so the client is not looked up again and again
+		const char *groups = client_classifier_groups(chosen_match_id);
+		client->groupspos = addstr(groups != NULL ? groups : "");
+		client->flags.found_group = true;
 	}
-
-	// Bind hwaddr to prepared statement
-	if((rc = sqlite3_bind_int(table_stmt, 1, chosen_match_id)) != SQLITE_OK)
+	else
 	{
-		log_err("get_client_groupids(\"%s\", \"%s\", %d): Failed to bind chosen_match_id: %s",
-		        ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
-		sqlite3_reset(table_stmt);
-		sqlite3_finalize(table_stmt);
-		return false;
-	}
+		// Build query string to get possible group associations for this particular client
+		// The SQL GROUP_CONCAT() function returns a string which is the concatenation of all
+		// non-NULL values of group_id separated by ','. The order of the concatenated elements
+		// is arbitrary, however, is of no relevance for your use case.
+		// We check using a possibly defined subnet and use the first result
+		querystr = "SELECT GROUP_CONCAT(group_id) FROM client_by_group "
+		           "WHERE client_id = ?;";
 
-	// Perform query
-	rc = sqlite3_step(table_stmt);
-	if(rc == SQLITE_ROW)
-	{
-		// There is a record for this client in the database
-		const char* result = (const char*)sqlite3_column_text(table_stmt, 0);
-		if(result != NULL)
+		// Prepare query
+		rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
+		if(rc != SQLITE_OK)
+		{
+			log_err("get_client_groupids(\"%s\", \"%s\", %d) - SQL error prepare: %s",
+			        ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
+			sqlite3_finalize(table_stmt);
+			return false;
+		}
+
+		// Bind hwaddr to prepared statement
+		if((rc = sqlite3_bind_int(table_stmt, 1, chosen_match_id)) != SQLITE_OK)
 		{
-			client->groupspos = addstr(result);
+			log_err("get_client_groupids(\"%s\", \"%s\", %d): Failed to bind chosen_match_id: %s",
+			        ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
+			sqlite3_reset(table_stmt);
+			sqlite3_finalize(table_stmt);
+			return false;
+		}
+
+		// Perform query
+		rc = sqlite3_step(table_stmt);
+		if(rc == SQLITE_ROW)
+		{
+			// There is a record for this client in the database
+			const char* result = (const char*)sqlite3_column_text(table_stmt, 0);
+			if(result != NULL)
+			{
+				client->groupspos = addstr(result);
+				client->flags.found_group = true;
+			}
+		}
+		else if(rc == SQLITE_DONE)
+		{
+			// Found no record for this client in the database
+			// -> No associated groups
+			client->groupspos = addstr("");
 			client->flags.found_group = true;
 		}
-	}
-	else if(rc == SQLITE_DONE)
-	{
-		// Found no record for this client in the database
-		// -> No associated groups
-		client->groupspos = addstr("");
-		client->flags.found_group = true;
-	}
-	else
-	{
-		log_err("get_client_groupids(\"%s\", \"%s\", %d) - SQL error step: %s",
-		        ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
+		else
+		{
+			log_err("get_client_groupids(\"%s\", \"%s\", %d) - SQL error step: %s",
+			        ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
+			gravityDB_finalizeTable();
+			return false;
+		}
+		// Finalize statement
 		gravityDB_finalizeTable();
-		return false;
 	}
-	// Finalize statement
-	gravityDB_finalizeTable();
 
 	// Debug logging
 	if(config.debug.clients.v.b)
@@ -1220,11 +1464,94 @@ static enum db_result domain_in_list(const char *domain, sqlite3_stmt *stmt, con
 	return (rc == SQLITE_ROW) ? FOUND : NOT_FOUND;
 }
 
+// Check if the compiled index can be used. TCP workers forked before the
+// lists have been reloaded cannot use their inherited index any longer and
+// fall back to the database which they may not have opened so far
+static bool use_gravity_index(void)
+{
+	if(gravity_index_ready())
+		return true;
+
+	if(!gravityDB_opened)
+		gravityDB_open();
+
+	return false;
+}
+
+// Check if a domain is on one of the lists using the compiled index
+static enum db_result domain_in_index(const char *domain, clientsData *client,
+                                      const enum gravity_index_list list, int *domain_id)
+{
+	// Get associated groups for this client (if not already known)
+	if(!client->flags.found_group && !get_client_groupids(client))
+		return LIST_NOT_AVAILABLE;
+
+	// in_allowlist(), in_denylist() and in_gravity() are called one after
+	// another for the same domain and client. The first of them probes the
+	// index for all lists at once, the others reuse the result
+	if(!last_probe.valid ||
+	   last_probe.generation != gravity_index_generation() ||
+	   last_probe.clientID != client->id ||
+	   last_probe.groupspos != client->groupspos ||
+	   last_probe.string_generation != get_string_generation() ||
+	   strcmp(last_probe.domain, domain) != 0)
+	{
+		const uint64_t *groups = gravity_index_client_groups(client->id, client->groupspos, getstr(client->groupspos));
+		last_probe.result = gravity_index_lookup_all(gravity_hash(domain), domain, groups, last_probe.ids, &last_probe.found);
+
+		// Remember the result only if the domain fits into the buffer
+		const size_t len = strlen(domain);
+		last_probe.valid = len < sizeof(last_probe.domain);
+		if(last_probe.valid)
+		{
+			memcpy(last_probe.domain, domain, len + 1);
+			last_probe.generation = gravity_index_generation();
+			last_probe.clientID = client->id;
+			last_probe.groupspos = client->groupspos;
+			last_probe.string_generation = get_string_generation();
+		}
+	}
+
+	enum db_result result = NOT_FOUND;
+	if(last_probe.result == LIST_NOT_AVAILABLE)
+		result = LIST_NOT_AVAILABLE;
+	else if(last_probe.found & (1u << list))
+		result = FOUND;
+
+	if(domain_id != NULL)
+		*domain_id = last_probe.ids[list];
+
+	log_debug(DEBUG_DATABASE, "domain_in_index(\"%s\", %u): %d", domain, list,
+	          domain_id != NULL ? *domain_id : result);
+
+	return result;
+}
+
+// Check if a domain (or ABP pattern) is on one of the (anti)gravity lists
+static enum db_result gravity_lookup(const char *domain, clientsData *client, const bool use_index,
+                                     const enum gravity_index_list list, sqlite3_stmt *stmt,
+                                     const char *listname, int *domain_id)
+{
+	// The prefilter rules out most domains without touching the database.
+	// It is not needed for the index as its result has typically already
+	// been obtained during the allowlist check
+	if(!use_index && !gravity_filter_maybe(domain))
+		return NOT_FOUND;
+
+	return use_index ?
+		domain_in_index(domain, client, list, domain_id) :
+		domain_in_list(domain, stmt, listname, domain_id);
+}
+
 void gravityDB_reload_groups(clientsData *client)
 {
 	// Rebuild client table statements (possibly from a different group set)
 	gravityDB_finalize_client_statements(client);
-	gravityDB_prepare_client_statements(client);
+
+	// The compiled index does not need per-client statements, the groups
+	// of the client are re-read on its next query
+	if(!gravity_index_ready())
+		gravityDB_prepare_client_statements(client);
 
 	// Reload regex for this client (possibly from a different group set)
 	reload_per_client_regex(client);
@@ -1248,6 +1575,13 @@ static void gravityDB_client_check_again(clientsData *client)
 
 enum db_result in_allowlist(const char *domain, DNSCacheData *dns_cache, clientsData *client)
 {
+	// Use the compiled index if available
+	if(use_gravity_index())
+	{
+		gravityDB_client_check_again(client);
+		return domain_in_index(domain, client, GRAVITY_INDEX_ALLOW, &dns_cache->list_id);
+	}
+
 	// If list statement is not ready and cannot be initialized (e.g. no
 	// access to the database), we return false to prevent an FTL crash
 	if(whitelist_stmt == NULL)
@@ -1384,45 +1718,137 @@ cJSON *gen_abp_patterns(const char *domain, const bool antigravity)
 	return patterns;
 }
 
-enum db_result in_gravity(const char *domain, clientsData *client, const bool antigravity, int *domain_id)
+// Check a single ABP suffix candidate, the suffix hash has already been computed
+static enum db_result abp_probe(const char *domain, const size_t len, const size_t start,
+                                const uint64_t h, const bool antigravity, const bool use_index,
+                                const uint64_t *groups, sqlite3_stmt *stmt, const char *listname,
+                                int *domain_id)
 {
-	// If list statement is not ready and cannot be initialized (e.g. no
-	// access to the database), we return false to prevent an FTL crash
-	if(gravity_stmt == NULL || antigravity_stmt == NULL)
-		return LIST_NOT_AVAILABLE;
+	const char *intro = antigravity ? "@@||" : "||";
+
+	// The prefilter rules out most suffixes without touching the database
+	const uint64_t hash = gravity_abp_finalize(h, antigravity);
+	enum db_result result = NOT_FOUND;
+	if(!gravity_filter_maybe_hash(hash))
+		result = NOT_FOUND;
+	else if(use_index)
+		result = gravity_index_lookup_hash(hash, domain + start, len - start,
+		                                   antigravity ? GRAVITY_INDEX_ANTIGRAVITY : GRAVITY_INDEX_GRAVITY,
+		                                   groups, domain_id);
+	else
+	{
+		// Construct the pattern on the stack and verify it against the
+		// database taking the client's groups into account
+		char pattern[ABP_MAX_PATTERN_LEN];
+		const int n = snprintf(pattern, sizeof(pattern), "%s%.*s^", intro, (int)(len - start), domain + start);
+		if(n < 0 || (size_t)n >= sizeof(pattern))
+			return NOT_FOUND;
+		result = domain_in_list(pattern, stmt, listname, domain_id);
+	}
 
-	// Check if this client needs a rechecking of group membership
-	gravityDB_client_check_again(client);
+	log_debug(DEBUG_QUERIES, "Checking if \"%s%.*s^\" is in %s (ABP): %s",
+	          intro, (int)(len - start), domain + start, listname, result == FOUND ? "yes" : "no");
 
-	// Check again as the client may have been reloaded if this is a TCP
-	// worker
-	if(gravity_stmt == NULL || antigravity_stmt == NULL)
-		return LIST_NOT_AVAILABLE;
+	return result;
+}
 
-	// Get whitelist statement from vector of prepared statements
-	sqlite3_stmt *stmt = antigravity ?
-		antigravity_stmt->get(antigravity_stmt, client->id) :
-		gravity_stmt->get(gravity_stmt, client->id);
+// Check if any ABP-style "||domain^" (or "@@||domain^" for antigravity) pattern
+// matches the domain. Instead of generating all patterns, the domain is walked
+// once from right to left. The suffix hash is extended character by character
+// and probed whenever a label boundary is reached. Like gen_abp_patterns(), the
+// TLD is checked first and the full domain last, but no memory is allocated
+static enum db_result in_gravity_abp(const char *domain, clientsData *client, const bool antigravity,
+                                     const bool use_index, sqlite3_stmt *stmt, const char *listname,
+                                     int *domain_id)
+{
+	// Get associated groups for this client (if not already known)
+	const uint64_t *groups = NULL;
+	if(use_index)
+	{
+		if(!client->flags.found_group && !get_client_groupids(client))
+			return FOUND;
+		groups = gravity_index_client_groups(client->id, client->groupspos, getstr(client->groupspos));
+	}
+
+	const size_t len = strlen(domain);
+	uint64_t h = FNV64_OFFSET;
+	for(size_t i = len; i-- > 0;)
+	{
+		if(domain[i] == '.' && i + 1 < len)
+		{
+			// The suffix to the right of this dot is complete
+			const enum db_result result = abp_probe(domain, len, i + 1, h, antigravity, use_index,
+			                                        groups, stmt, listname, domain_id);
+			// Return for anything else than "not found" (e.g.
+			// "found" or "list not available")
+			if(result != NOT_FOUND)
+				return FOUND;
+		}
+		h = gravity_abp_step(h, domain[i]);
+	}
+
+	// Finally, check the full domain
+	if(len > 0 && abp_probe(domain, len, 0, h, antigravity, use_index,
+	                        groups, stmt, listname, domain_id) != NOT_FOUND)
+		return FOUND;
+
+	// Domain not found in gravity list
+	return NOT_FOUND;
+}
 
+enum db_result in_gravity(const char *domain, clientsData *client, const bool antigravity, int *domain_id)
+{
 	// Get string for debug logging
 	const char *listname = antigravity ? "antigravity" : "gravity";
 
-	// If client statement is not ready and cannot be initialized (e.g. no access to
-	// the database), we return false (not in gravity list) to prevent an FTL crash
-	if(stmt == NULL && !gravityDB_prepare_client_statements(client))
+	// Use the compiled index if available
+	const bool use_index = use_gravity_index();
+	const enum gravity_index_list list = antigravity ? GRAVITY_INDEX_ANTIGRAVITY : GRAVITY_INDEX_GRAVITY;
+
+	sqlite3_stmt *stmt = NULL;
+	if(use_index)
 	{
-		log_err("Gravity database not available (%s)", listname);
-		return LIST_NOT_AVAILABLE;
+		// Check if this client needs a rechecking of group membership
+		gravityDB_client_check_again(client);
 	}
+	else
+	{
+		// If list statement is not ready and cannot be initialized (e.g. no
+		// access to the database), we return false to prevent an FTL crash
+		if(gravity_stmt == NULL || antigravity_stmt == NULL)
+			return LIST_NOT_AVAILABLE;
 
-	// Update statement if has just been initialized
-	if(stmt == NULL)
-		antigravity ?
+		// Check if this client needs a rechecking of group membership
+		gravityDB_client_check_again(client);
+
+		// Check again as the client may have been reloaded if this is a TCP
+		// worker
+		if(gravity_stmt == NULL || antigravity_stmt == NULL)
+			return LIST_NOT_AVAILABLE;
+
+		// Get whitelist statement from vector of prepared statements
+		stmt = antigravity ?
 			antigravity_stmt->get(antigravity_stmt, client->id) :
 			gravity_stmt->get(gravity_stmt, client->id);
 
+		// If client statement is not ready and cannot be initialized (e.g. no access to
+		// the database), we return false (not in gravity list) to prevent an FTL crash
+		if(stmt == NULL && !gravityDB_prepare_client_statements(client))
+		{
+			log_err("Gravity database not available (%s)", listname);
+			return LIST_NOT_AVAILABLE;
+		}
+
+		// Update statement if has just been initialized
+		if(stmt == NULL)
+			stmt = antigravity ?
+				antigravity_stmt->get(antigravity_stmt, client->id) :
+				gravity_stmt->get(gravity_stmt, client->id);
+	}
+
 	// Check if domain is exactly in gravity list
-	const enum db_result exact_match = domain_in_list(domain, stmt, listname, domain_id);
+	const enum db_result exact_match =
+		gravity_lookup(domain, client, use_index, list, stmt, listname, domain_id);
 	log_debug(DEBUG_QUERIES, "Checking if \"%s\" is in %s (exact): %s",
 	          domain, listname, exact_match == FOUND ? "yes" : "no");
 	// Return for anything else than "not found" (e.g. "found" or "list not available")
@@ -1435,36 +1861,19 @@ enum db_result in_gravity(const char *domain, clientsData *client, const bool an
 	if(!gravity_abp_format)
 		return NOT_FOUND;
 
-	// Generate ABP patterns for domain
-	cJSON *abp_patterns = gen_abp_patterns(domain, antigravity);
-	if(abp_patterns == NULL)
-	{
-		log_err("Failed to generate ABP patterns for domain \"%s\"", domain);
-		return LIST_NOT_AVAILABLE;
-	}
-
-	// Check if any of the ABP patterns is in the (anti)gravity list
-	cJSON * abp_pattern = NULL;
-	cJSON_ArrayForEach(abp_pattern, abp_patterns)
-	{
-		const char *pattern = cJSON_GetStringValue(abp_pattern);
-		log_debug(DEBUG_QUERIES, "Checking if \"%s\" is in %s (ABP): %s",
-		          pattern, listname, exact_match == FOUND ? "yes" : "no");
-		const enum db_result abp_match = domain_in_list(pattern, stmt, listname, domain_id);
-		if(abp_match == FOUND || abp_match == LIST_NOT_AVAILABLE)
-		{
-			cJSON_Delete(abp_patterns);
-			return FOUND;
-		}
-	}
-
-	// Domain not found in gravity list
-	cJSON_Delete(abp_patterns);
-	return NOT_FOUND;
+	// Walk the labels of the domain looking for ABP-style patterns
+	return in_gravity_abp(domain, client, antigravity, use_index, stmt, listname, domain_id);
 }
 
 enum db_result in_denylist(const char *domain, DNSCacheData *dns_cache, clientsData *client)
 {
+	// Use the compiled index if available
+	if(use_gravity_index())
+	{
+		gravityDB_client_check_again(client);
+		return domain_in_index(domain, client, GRAVITY_INDEX_DENY, &dns_cache->list_id);
+	}
+
 	// If list statement is not ready and cannot be initialized (e.g. no
 	// access to the database), we return false to prevent an FTL crash
 	if(blacklist_stmt == NULL)
@@ -2091,9 +2500,51 @@ bool gravityDB_delFromTable(const enum gravity_list_type listtype, const cJSON*
 }
 
 static sqlite3_stmt* read_stmt = NULL;
+// Append filters, ordering and limit of a page to a list query
+static void append_page(char *querystr, const size_t buflen, const enum gravity_list_type listtype,
+                        const struct table_page *page)
+{
+	const char *column = "domain", *by_group = "SELECT domainlist_id FROM domainlist_by_group WHERE group_id = :group";
+	bool has_enabled = true;
+	if(listtype == GRAVITY_GROUPS)
+	{
+		column = "name";
+		by_group = NULL;
+	}
+	else if(listtype == GRAVITY_ADLISTS ||
+	        listtype == GRAVITY_ADLISTS_BLOCK ||
+	        listtype == GRAVITY_ADLISTS_ALLOW)
+	{
+		column = "address";
+		by_group = "SELECT adlist_id FROM adlist_by_group WHERE group_id = :group";
+	}
+	else if(listtype == GRAVITY_CLIENTS)
+	{
+		column = "ip";
+		by_group = "SELECT client_id FROM client_by_group WHERE group_id = :group";
+		has_enabled = false;
+	}
+
+	// Rows are always sorted by their ID (the rowid) so the next page can
+	// continue where the previous one ended without any OFFSET
+	size_t len = strlen(querystr);
+	if(page->after > 0)
+		len += snprintf(querystr + len, buflen - len, " AND id %s :after", page->descending ? "<" : ">");
+	if(page->enabled > -1 && has_enabled)
+		len += snprintf(querystr + len, buflen - len, " AND enabled = :enabled");
+	if(page->group > -1 && by_group != NULL)
+		len += snprintf(querystr + len, buflen - len, " AND id IN (%s)", by_group);
+	if(page->search != NULL)
+		len += snprintf(querystr + len, buflen - len, " AND %s LIKE :search", column);
+	len += snprintf(querystr + len, buflen - len, " ORDER BY id %s", page->descending ? "DESC" : "ASC");
+	if(page->limit > 0)
+		snprintf(querystr + len, buflen - len, " LIMIT :limit");
+}
+
 bool gravityDB_readTable(const enum gravity_list_type listtype,
                          const char *item, const char **message,
-                         const bool exact, const char *ids)
+                         const bool exact, const char *ids,
+                         const struct table_page *page)
 {
 	if(gravity_db == NULL)
 	{
@@ -2146,7 +2597,7 @@ bool gravityDB_readTable(const enum gravity_list_type listtype,
 	}
 
 	// Build query statement
-	const size_t buflen = 512u + (ids != NULL ? strlen(ids) : 0u);
+	const size_t buflen = 1024u + (ids != NULL ? strlen(ids) : 0u);
 	char *querystr = calloc(buflen, sizeof(char));
 	char *like_name = (char*)item;
 	if(!exact && item != NULL && item[0] != '\0')
@@ -2167,11 +2618,11 @@ bool gravityDB_readTable(const enum gravity_list_type listtype,
 		if(item != NULL && item[0] != '\0')
 		{
 			if(exact)
-				filter = " WHERE name = :item";
+				filter = " AND name = :item";
 			else
-				filter = " WHERE name LIKE :item";
+				filter = " AND name LIKE :item";
 		}
-		snprintf(querystr, buflen, "SELECT id,name,enabled,date_added,date_modified,description AS comment FROM \"group\"%s;", filter);
+		snprintf(querystr, buflen, "SELECT id,name,enabled,date_added,date_modified,description AS comment FROM \"group\" WHERE TRUE%s", filter);
 	}
 	else if(listtype == GRAVITY_ADLISTS ||
 	        listtype == GRAVITY_ADLISTS_BLOCK ||
@@ -2195,31 +2646,41 @@ bool gravityDB_readTable(const enum gravity_list_type listtype,
 		snprintf(querystr, buflen, "SELECT id,type,address,enabled,date_added,date_modified,comment,"
 		                                     "(SELECT GROUP_CONCAT(group_id) FROM adlist_by_group g WHERE g.adlist_id = a.id) AS group_ids,"
 		                                     "date_updated,number,invalid_domains,status,abp_entries "
-		                                     "FROM adlist a WHERE %s%s;", filter, filter2);
+		                                     "FROM adlist a WHERE %s%s", filter, filter2);
 	}
 	else if(listtype == GRAVITY_CLIENTS)
 	{
 		if(item != NULL && item[0] != '\0')
 		{
 			if(exact)
-				filter = " WHERE ip = :item";
+				filter = " AND ip = :item";
 			else
-				filter = " WHERE ip LIKE :item";
+				filter = " AND ip LIKE :item";
 		}
 		snprintf(querystr, buflen, "SELECT id,ip AS client,date_added,date_modified,comment,"
 		                                     "(SELECT GROUP_CONCAT(group_id) FROM client_by_group g WHERE g.client_id = c.id) AS group_ids "
-		                                     "FROM client c%s;", filter);
+		                                     "FROM client c WHERE TRUE%s", filter);
 	}
 	else if(listtype == GRAVITY_GRAVITY || listtype == GRAVITY_ANTIGRAVITY)
 	{
+		const char *table = listtype == GRAVITY_GRAVITY ? "gravity" : "antigravity";
 		if(item != NULL && item[0] != '\0')
 		{
 			if(exact)
 				filter = " WHERE g.domain = :item";
+			else if(gravity_search_index[listtype == GRAVITY_GRAVITY ? 0 : 1] &&
+			        strlen(item) >= GRAVITY_SEARCH_MIN_LEN && strpbrk(item, "%_\"") == NULL)
+			{
+				// Look up candidates in the trigram index instead
+				// of scanning the entire table. LIKE remains to
+				// filter false positives of the index
+				filter = listtype == GRAVITY_GRAVITY ?
+					" WHERE g.rowid IN (SELECT rowid FROM gravity_search WHERE gravity_search MATCH :match) AND g.domain LIKE :item" :
+					" WHERE g.rowid IN (SELECT rowid FROM antigravity_search WHERE antigravity_search MATCH :match) AND g.domain LIKE :item";
+			}
 			else
 				filter = " WHERE g.domain LIKE :item";
 		}
-		const char *table = listtype == GRAVITY_GRAVITY ? "gravity" : "antigravity";
 		snprintf(querystr, buflen, "SELECT domain,a.id,a.address,a.enabled,a.date_added,a.date_modified,a.comment,a.date_updated,a.number,a.invalid_domains,a.status,a.abp_entries,a.type,"
 		                                     "(SELECT GROUP_CONCAT(group_id) FROM adlist_by_group ag WHERE ag.adlist_id = g.adlist_id) AS group_ids "
 		                                     "FROM %s g JOIN adlist a ON a.id = g.adlist_id %s;", table, filter);
@@ -2245,6 +2706,10 @@ bool gravityDB_readTable(const enum gravity_list_type listtype,
 			snprintf(querystr+strlen(querystr), buflen-strlen(querystr), " AND id IN (%s)", ids);
 	}
 
+	// Keyset pagination and filters are not available for gravity
+	if(page != NULL && listtype != GRAVITY_GRAVITY && listtype != GRAVITY_ANTIGRAVITY)
+		append_page(querystr, buflen, listtype, page);
+
 	// Prepare SQLite statement
 	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &read_stmt, NULL);
 	if( rc != SQLITE_OK ){
@@ -2272,6 +2737,23 @@ bool gravityDB_readTable(const enum gravity_list_type listtype,
 		return false;
 	}
 
+	// Bind search index phrase to prepared statement (if requested). The
+	// item is quoted so it is matched as a whole, it cannot contain quotes
+	// itself when the index is used
+	idx = sqlite3_bind_parameter_index(read_stmt, ":match");
+	if(idx > 0 && (rc = sqlite3_bind_text(read_stmt, idx, sqlite3_mprintf("\"%s\"", item), -1, sqlite3_free)) != SQLITE_OK)
+	{
+		*message = sqlite3_errmsg(gravity_db);
+		log_err("gravityDB_readTable(%d => (%s), %s): Failed to bind match (error %d) - %s",
+		        listtype, type, like_name, rc, *message);
+		sqlite3_reset(read_stmt);
+		sqlite3_finalize(read_stmt);
+		if(!exact)
+			free(like_name);
+		free(querystr);
+		return false;
+	}
+
 	// Bind ids to prepared statement (if requested)
 	idx = sqlite3_bind_parameter_index(read_stmt, ":ids");
 	if(idx > 0 && (rc = sqlite3_bind_text(read_stmt, idx, ids, -1, SQLITE_STATIC)) != SQLITE_OK)
@@ -2287,6 +2769,30 @@ bool gravityDB_readTable(const enum gravity_list_type listtype,
 		return false;
 	}
 
+	// Bind pagination and filters to prepared statement (if requested)
+	if(page != NULL &&
+	   (((idx = sqlite3_bind_parameter_index(read_stmt, ":after")) > 0 &&
+	     (rc = sqlite3_bind_int64(read_stmt, idx, page->after)) != SQLITE_OK) ||
+	    ((idx = sqlite3_bind_parameter_index(read_stmt, ":enabled")) > 0 &&
+	     (rc = sqlite3_bind_int(read_stmt, idx, page->enabled)) != SQLITE_OK) ||
+	    ((idx = sqlite3_bind_parameter_index(read_stmt, ":group")) > 0 &&
+	     (rc = sqlite3_bind_int(read_stmt, idx, page->group)) != SQLITE_OK) ||
+	    ((idx = sqlite3_bind_parameter_index(read_stmt, ":search")) > 0 &&
+	     (rc = sqlite3_bind_text(read_stmt, idx, sqlite3_mprintf("%%%s%%", page->search), -1, sqlite3_free)) != SQLITE_OK) ||
+	    ((idx = sqlite3_bind_parameter_index(read_stmt, ":limit")) > 0 &&
+	     (rc = sqlite3_bind_int64(read_stmt, idx, page->limit)) != SQLITE_OK)))
+	{
+		*message = sqlite3_errmsg(gravity_db);
+		log_err("gravityDB_readTable(%d => (%s), %s): Failed to bind page (error %d) - %s",
+		        listtype, type, like_name, rc, *message);
+		sqlite3_reset(read_stmt);
+		sqlite3_finalize(read_stmt);
+		if(!exact)
+			free(like_name);
+		free(querystr);
+		return false;
+	}
+
 	// Debug output
 	if(config.debug.api.v.b)
 	{
@@ -2681,6 +3187,138 @@ bool gravityDB_edit_groups(const enum gravity_list_type listtype, cJSON *groups,
 	return okay;
 }
 
+// Apply a single import row within its own savepoint so a failing row (e.g.
+// because it references a non-existing group) leaves no trace. Returns an
+// allocated error message or NULL on success
+static char *import_row(sqlite3_stmt **stmt, const struct import_row *row)
+{
+	if(sqlite3_exec(gravity_db, "SAVEPOINT import_row;", NULL, NULL, NULL) != SQLITE_OK)
+		return strdup(sqlite3_errmsg(gravity_db));
+
+	// Insert or update the item and get its ID
+	sqlite3_int64 id = -1;
+	if(sqlite3_bind_text(stmt[0], 1, row->item, -1, SQLITE_STATIC) == SQLITE_OK &&
+	   sqlite3_bind_int(stmt[0], 2, row->type) == SQLITE_OK &&
+	   sqlite3_bind_int(stmt[0], 3, row->enabled ? 1 : 0) == SQLITE_OK &&
+	   sqlite3_bind_text(stmt[0], 4, row->comment, -1, SQLITE_STATIC) == SQLITE_OK &&
+	   sqlite3_step(stmt[0]) == SQLITE_ROW)
+		id = sqlite3_column_int64(stmt[0], 0);
+	sqlite3_reset(stmt[0]);
+	bool okay = id > -1;
+
+	// Replace group assignments (if specified)
+	if(okay && row->has_groups)
+	{
+		okay = sqlite3_bind_int64(stmt[1], 1, id) == SQLITE_OK &&
+		       sqlite3_step(stmt[1]) == SQLITE_DONE;
+		sqlite3_reset(stmt[1]);
+
+		for(unsigned int i = 0; okay && i < row->ngroups; i++)
+		{
+			okay = sqlite3_bind_int64(stmt[2], 1, id) == SQLITE_OK &&
+			       sqlite3_bind_int(stmt[2], 2, row->groups[i]) == SQLITE_OK &&
+			       sqlite3_step(stmt[2]) == SQLITE_DONE;
+			sqlite3_reset(stmt[2]);
+		}
+	}
+
+	// The error message has to be copied before rolling back overwrites it
+	char *error = okay ? NULL : strdup(sqlite3_errmsg(gravity_db));
+	if(!okay)
+		sqlite3_exec(gravity_db, "ROLLBACK TO import_row;", NULL, NULL, NULL);
+	sqlite3_exec(gravity_db, "RELEASE import_row;", NULL, NULL, NULL);
+
+	return error;
+}
+
+/**
+ * @brief Insert or update many domains (GRAVITY_DOMAINLIST_ALL_ALL) or lists
+ * (GRAVITY_ADLISTS) within a single transaction. Existing items get their
+ * enabled state and comment updated, group assignments are replaced if the row
+ * specifies groups. Rows which already carry an error are skipped, rows which
+ * cannot be imported get their error set
+ *
+ * @param listtype GRAVITY_DOMAINLIST_ALL_ALL or GRAVITY_ADLISTS
+ * @param rows Rows to import
+ * @param num Number of rows
+ * @param imported Number of successfully imported rows
+ * @param message Error message if the transaction as a whole failed
+ * @return true on success, false if nothing has been imported
+ */
+bool gravityDB_import(const enum gravity_list_type listtype, struct import_row *rows,
+                      const unsigned int num, unsigned int *imported, const char **message)
+{
+	*imported = 0;
+	if(gravity_db == NULL)
+	{
+		*message = "Database not available";
+		return false;
+	}
+
+	const bool lists = listtype == GRAVITY_ADLISTS;
+	const char *querystr[3] = {
+		lists ? "INSERT INTO adlist (address,type,enabled,comment) VALUES (?1,?2,?3,?4) "
+		        "ON CONFLICT(address,type) DO UPDATE SET enabled = ?3, comment = ?4 RETURNING id;" :
+		        "INSERT INTO domainlist (domain,type,enabled,comment) VALUES (?1,?2,?3,?4) "
+		        "ON CONFLICT(domain,type) DO UPDATE SET enabled = ?3, comment = ?4 RETURNING id;",
+		lists ? "DELETE FROM adlist_by_group WHERE adlist_id = ?1;" :
+		        "DELETE FROM domainlist_by_group WHERE domainlist_id = ?1;",
+		lists ? "INSERT INTO adlist_by_group (adlist_id,group_id) VALUES (?1,?2);" :
+		        "INSERT INTO domainlist_by_group (domainlist_id,group_id) VALUES (?1,?2);"
+	};
+
+	int rc = sqlite3_exec(gravity_db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+	if(rc != SQLITE_OK)
+	{
+		*message = sqlite3_errmsg(gravity_db);
+		log_err("gravityDB_import(%d): SQL error exec(\"BEGIN TRANSACTION\"): %s",
+		        listtype, *message);
+		return false;
+	}
+
+	sqlite3_stmt *stmt[3] = { NULL, NULL, NULL };
+	for(unsigned int i = 0; i < ArraySize(stmt); i++)
+	{
+		if((rc = sqlite3_prepare_v2(gravity_db, querystr[i], -1, &stmt[i], NULL)) != SQLITE_OK)
+		{
+			*message = sqlite3_errmsg(gravity_db);
+			log_err("gravityDB_import(%d) - SQL error prepare(\"%s\"): %s",
+			        listtype, querystr[i], *message);
+			goto rollback;
+		}
+	}
+
+	for(unsigned int i = 0; i < num; i++)
+	{
+		if(rows[i].error != NULL)
+			continue;
+		if((rows[i].error = import_row(stmt, &rows[i])) == NULL)
+			(*imported)++;
+	}
+
+	for(unsigned int i = 0; i < ArraySize(stmt); i++)
+		sqlite3_finalize(stmt[i]);
+
+	if((rc = sqlite3_exec(gravity_db, "COMMIT TRANSACTION;", NULL, NULL, NULL)) != SQLITE_OK)
+	{
+		*message = sqlite3_errmsg(gravity_db);
+		log_err("gravityDB_import(%d): SQL error exec(\"COMMIT TRANSACTION\"): %s",
+		        listtype, *message);
+		*imported = 0;
+		sqlite3_exec(gravity_db, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+		return false;
+	}
+
+	log_debug(DEBUG_API, "Imported %u of %u rows", *imported, num);
+	return true;
+
+rollback:
+	for(unsigned int i = 0; i < ArraySize(stmt); i++)
+		sqlite3_finalize(stmt[i]);
+	sqlite3_exec(gravity_db, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+	return false;
+}
+
 void check_inaccessible_adlists(void)
 {
 	// Check if any adlist was inaccessible in the last gravity run
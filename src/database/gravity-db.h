@@ -15,6 +15,18 @@
 // Definition of struct regexData
 #include "regex_r.h"
 
+// Trigram index for partial matches in /api/search. Both tables are external
+// content tables, i.e., they only hold the index and refer to the domains in
+// (anti)gravity by rowid
+#define GRAVITY_SEARCH_MIN_LEN 3u
+#define CREATE_GRAVITY_SEARCH_TABLE(table) "CREATE VIRTUAL TABLE IF NOT EXISTS " table "_search USING fts5(domain, content='" table "', content_rowid='rowid', tokenize='trigram');"
+
+// Property of the info table storing the SHA-256 checksum of the list the
+// domains of an adlist have been parsed from, followed by the adlist ID. It is
+// written in the same transaction as the domains so the checksum identifies
+// them, too
+#define ADLIST_CHECKSUM_PROPERTY "adlist_checksum_"
+
 // Table row record, not all fields are used by all tables
 typedef struct {
 	bool enabled;
@@ -39,6 +51,32 @@ typedef struct {
 	time_t date_updated;
 } tablerow;
 
+// Keyset pagination and filters of list reads. Filters not applicable to a
+// table (e.g. groups of groups) are ignored
+struct table_page {
+	long after; // only rows after this ID (0 = from the start)
+	unsigned int limit; // 0 = no limit
+	int enabled; // -1 = any
+	int group; // -1 = any
+	bool descending;
+	const char *search; // substring of the item, NULL = any
+};
+
+// Row of a bulk import. The type is the domainlist type (0-3) or the adlist
+// type, error is allocated and set when the row could not be imported
+struct import_row {
+	char *item;
+	char *comment;
+	int *groups;
+	char *error;
+	unsigned int ngroups;
+	unsigned int line;
+	int type;
+	bool enabled;
+	bool has_groups;
+};
+
+void gravityDB_compile_next(const bool gravity);
 bool gravityDB_reopen(void);
 void gravityDB_forked(void);
 void gravityDB_reload_groups(clientsData *client);
@@ -62,7 +100,8 @@ bool gravityDB_get_regex_client_groups(clientsData *client, const unsigned int n
                                        const unsigned char type, const char* table);
 
 bool gravityDB_readTable(const enum gravity_list_type listtype, const char *filter,
-                         const char **message, const bool exact, const char *ids);
+                         const char **message, const bool exact, const char *ids,
+                         const struct table_page *page);
 bool gravityDB_readTableGetRow(const enum gravity_list_type listtype, tablerow *row, const char **message);
 void gravityDB_readTableFinalize(void);
 bool gravityDB_addToTable(const enum gravity_list_type listtype, tablerow *row,
@@ -70,6 +109,8 @@ bool gravityDB_addToTable(const enum gravity_list_type listtype, tablerow *row,
 bool gravityDB_delFromTable(const enum gravity_list_type listtype, const cJSON* array, unsigned int *deleted, const char **message);
 bool gravityDB_edit_groups(const enum gravity_list_type listtype, cJSON *groups,
                            const tablerow *row, const char **message);
+bool gravityDB_import(const enum gravity_list_type listtype, struct import_row *rows,
+                      const unsigned int num, unsigned int *imported, const char **message);
 
 time_t gravity_last_updated(void) __attribute__((pure));
 
@@ -0,0 +1,333 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Gravity prefilter routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file gravity-filter.c
+ * @brief Probabilistic "definitely not on gravity" prefilter
+ *
+ * The vast majority of queried domains are not on any gravity or antigravity
+ * list. Even worse, with ABP-style matching enabled, every query is expanded
+ * into several patterns, each of them requiring a database lookup. This module
+ * implements a split block Bloom filter covering every string found in the
+ * gravity and antigravity tables. Each domain maps onto exactly one 256-bit
+ * block (a single cache line) in which it sets one bit in each of the eight
+ * 32-bit words. A negative answer is hence available after touching a single
+ * cache line and is always correct, a positive answer is verified by the
+ * regular lookup.
+ *
+ * The filter does not know about groups or enabled states, it is a superset of
+ * the domains that may effectively be blocked for any client.
+ *
+ * Like the compiled index, the filter lives in a read-only shared anonymous
+ * mapping that is inherited by forked TCP workers.
+ */
+
+#include "FTL.h"
+#include "database/gravity-filter.h"
+// gravity_hash()
+#include "database/gravity-index.h"
+// logging routines
+#include "log.h"
+// get_gravity_generation()
+#include "shmem.h"
+// mmap()
+#include <sys/mman.h>
+// pow()
+#include <math.h>
+
+// Number of filter bits reserved per domain. Twelve bits result in a
+// false-positive rate of about 0.5%
+#define FILTER_BITS_PER_ENTRY 12u
+
+// A block consists of eight 32-bit words (256 bits = 32 bytes)
+#define FILTER_WORDS 8u
+
+struct filter_block {
+	uint32_t word[FILTER_WORDS];
+} __attribute__((aligned(32)));
+
+struct gravity_filter {
+	struct filter_block *blocks;
+	uint32_t num_blocks;
+	size_t num_entries;
+	double fpr;
+};
+
+// The currently active filter (NULL if not available)
+static struct gravity_filter *gfilter = NULL;
+
+// Shared memory generation the active filter has been published in
+static unsigned int generation = 0u;
+
+// Odd salts used to derive the eight bit positions within a block
+static const uint32_t salt[FILTER_WORDS] = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+static inline struct filter_block * __attribute__((pure)) get_block(const struct gravity_filter *filter, const uint64_t hash)
+{
+	// Map the upper 32 bits onto [0, num_blocks) without a division
+	return &filter->blocks[((hash >> 32) * filter->num_blocks) >> 32];
+}
+
+static inline uint32_t __attribute__((const)) get_bit(const uint32_t key, const unsigned int i)
+{
+	return 1u << ((key * salt[i]) >> 27);
+}
+
+static void free_filter(struct gravity_filter *filter)
+{
+	if(filter == NULL)
+		return;
+
+	if(filter->blocks != NULL)
+		munmap(filter->blocks, filter->num_blocks * sizeof(struct filter_block));
+	free(filter);
+}
+
+static bool count_entries(sqlite3 *db, size_t *count)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT (SELECT COUNT(*) FROM gravity) + (SELECT COUNT(*) FROM antigravity);", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("gravity_filter_build() - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	rc = sqlite3_step(stmt);
+	if(rc != SQLITE_ROW)
+	{
+		log_err("gravity_filter_build() - SQL error step: %s", sqlite3_errstr(rc));
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	const sqlite3_int64 num = sqlite3_column_int64(stmt, 0);
+	*count = num > 0 ? (size_t)num : 0u;
+	sqlite3_finalize(stmt);
+
+	return true;
+}
+
+static bool fill_filter(sqlite3 *db, struct gravity_filter *filter)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT domain FROM gravity UNION ALL SELECT domain FROM antigravity;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("gravity_filter_build() - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		if(domain == NULL)
+			continue;
+
+		const uint64_t hash = gravity_entry_hash(domain);
+		struct filter_block *block = get_block(filter, hash);
+		for(unsigned int i = 0; i < FILTER_WORDS; i++)
+			block->word[i] |= get_bit((uint32_t)hash, i);
+		filter->num_entries++;
+	}
+
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		log_err("gravity_filter_build() - SQL error step: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Estimate the false-positive rate from the fill level of the filter
+ *
+ * A lookup is a false positive if all eight probed bits are set by chance.
+ * Each of them lies in a different word so their probabilities are
+ * (approximately) independent.
+ */
+static double __attribute__((pure)) estimate_fpr(const struct gravity_filter *filter)
+{
+	size_t set_bits = 0u;
+	for(uint32_t b = 0; b < filter->num_blocks; b++)
+		for(unsigned int i = 0; i < FILTER_WORDS; i++)
+			set_bits += __builtin_popcount(filter->blocks[b].word[i]);
+
+	const double fill = (double)set_bits / (32.0 * FILTER_WORDS * filter->num_blocks);
+	return pow(fill, FILTER_WORDS);
+}
+
+/**
+ * @brief Build a new prefilter from the gravity and antigravity tables
+ *
+ * This does not touch the currently active filter and may hence run without
+ * holding the shared memory lock. Use gravity_filter_publish() to activate
+ * the result.
+ *
+ * @param db Open connection to the gravity database (may be private to the
+ * caller)
+ * @return New filter or NULL on error
+ */
+struct gravity_filter *gravity_filter_compile(sqlite3 *db)
+{
+	const double t0 = double_time();
+
+	size_t count = 0u;
+	if(!count_entries(db, &count))
+		return NULL;
+
+	// Size the filter for the expected number of domains. We allocate at
+	// least one block so lookups need not care about empty filters
+	const size_t num_blocks = (count * FILTER_BITS_PER_ENTRY + 32u * FILTER_WORDS - 1u) / (32u * FILTER_WORDS);
+	if(num_blocks > UINT32_MAX)
+	{
+		log_err("Gravity prefilter: Too many domains (%zu)", count);
+		return NULL;
+	}
+
+	struct gravity_filter *filter = calloc(1, sizeof(*filter));
+	if(filter == NULL)
+		return NULL;
+
+	filter->num_blocks = num_blocks > 0u ? (uint32_t)num_blocks : 1u;
+	// Anonymous mappings are zero-initialized and page-aligned
+	const size_t size = filter->num_blocks * sizeof(struct filter_block);
+	void *blocks = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(blocks == MAP_FAILED)
+	{
+		log_err("Gravity prefilter: Failed to map %zu bytes: %s", size, strerror(errno));
+		free_filter(filter);
+		return NULL;
+	}
+	filter->blocks = blocks;
+
+	if(!fill_filter(db, filter))
+	{
+		log_err("Failed to build gravity prefilter, falling back to database lookups");
+		free_filter(filter);
+		return NULL;
+	}
+
+	// The filter is never modified again
+	if(mprotect(blocks, size, PROT_READ) != 0)
+		log_warn("Gravity prefilter: Failed to make filter read-only: %s", strerror(errno));
+
+	filter->fpr = estimate_fpr(filter);
+
+	char prefix[2] = { 0 };
+	double formatted = 0.0;
+	format_memory_size(prefix, filter->num_blocks * sizeof(struct filter_block), &formatted);
+	log_info("Built gravity prefilter with %zu entries (%.1f %sB, %.3f%% false-positive rate) in %.1f msec",
+	         filter->num_entries, formatted, prefix, 100.0*filter->fpr, 1e3*(double_time() - t0));
+
+	return filter;
+}
+
+/**
+ * @brief Replace the active filter by a new one (which may be NULL)
+ *
+ * The caller must hold the shared memory lock, the previous filter is freed
+ * immediately.
+ */
+void gravity_filter_publish(struct gravity_filter *filter)
+{
+	struct gravity_filter *old = gfilter;
+	gfilter = filter;
+	generation = get_gravity_generation();
+	free_filter(old);
+}
+
+void gravity_filter_discard(struct gravity_filter *filter)
+{
+	free_filter(filter);
+}
+
+/**
+ * @brief Keep the active filter for a new gravity generation
+ *
+ * Used when only the domainlists changed, the filter covers gravity and
+ * antigravity only. The caller must hold the shared memory lock.
+ */
+void gravity_filter_renew(void)
+{
+	generation = get_gravity_generation();
+}
+
+/**
+ * @brief Build the prefilter and activate it
+ *
+ * @param db Open connection to the gravity database
+ * @return true if the filter is available afterwards
+ */
+bool gravity_filter_build(sqlite3 *db)
+{
+	// Replace the old filter in any case, it may be outdated
+	gravity_filter_publish(NULL);
+	gravity_filter_publish(gravity_filter_compile(db));
+
+	return gfilter != NULL;
+}
+
+void gravity_filter_free(void)
+{
+	gravity_filter_publish(NULL);
+}
+
+/**
+ * @brief Check if a domain may be on any gravity or antigravity list
+ *
+ * @param domain Domain (or ABP pattern) to check
+ * @return false if the domain is definitely not on any of the lists, true if
+ * it may be (or if the filter is unavailable)
+ */
+bool gravity_filter_maybe(const char *domain)
+{
+	return gravity_filter_maybe_hash(gravity_hash(domain));
+}
+
+/**
+ * @brief Check if a precomputed hash (see gravity_entry_hash()) may be on any
+ * gravity or antigravity list
+ */
+bool gravity_filter_maybe_hash(const uint64_t hash)
+{
+	// Forks created before the lists have been reloaded cannot rule out
+	// anything as their filter may be missing new domains
+	if(gfilter == NULL || generation != get_gravity_generation())
+		return true;
+
+	const struct filter_block *block = get_block(gfilter, hash);
+	for(unsigned int i = 0; i < FILTER_WORDS; i++)
+	{
+		const uint32_t bit = get_bit((uint32_t)hash, i);
+		if((block->word[i] & bit) != bit)
+			return false;
+	}
+
+	return true;
+}
+
+void gravity_filter_stats(struct gravity_filter_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if(gfilter == NULL)
+		return;
+
+	stats->ready = true;
+	stats->entries = gfilter->num_entries;
+	stats->memory = sizeof(*gfilter) + gfilter->num_blocks * sizeof(struct filter_block);
+	stats->fpr = gfilter->fpr;
+}
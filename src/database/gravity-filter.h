@@ -0,0 +1,38 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Gravity prefilter prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef GRAVITY_FILTER_H
+#define GRAVITY_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+// sqlite3
+#include "database/sqlite3.h"
+
+struct gravity_filter_stats {
+	bool ready;
+	size_t entries;
+	size_t memory;
+	double fpr;
+};
+
+struct gravity_filter;
+
+struct gravity_filter *gravity_filter_compile(sqlite3 *db) __attribute__((malloc));
+void gravity_filter_publish(struct gravity_filter *filter);
+void gravity_filter_discard(struct gravity_filter *filter);
+void gravity_filter_renew(void);
+bool gravity_filter_build(sqlite3 *db);
+void gravity_filter_free(void);
+bool gravity_filter_maybe(const char *domain) __attribute__((pure));
+bool gravity_filter_maybe_hash(const uint64_t hash) __attribute__((pure));
+void gravity_filter_stats(struct gravity_filter_stats *stats);
+
+#endif //GRAVITY_FILTER_H
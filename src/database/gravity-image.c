@@ -0,0 +1,884 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Gravity image distribution
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file gravity-image.c
+* @brief Builds gravity once and distributes it to a fleet of nodes.
+*
+* A node with webserver.api.federation.gravity.publish enabled takes a
+* consistent snapshot of its gravity database whenever it changes and compiles
+* the gravity index for it (see gravity_index_write()). Database and index make
+* up the published image, they are kept next to the gravity database. The image
+* is described by a manifest listing the SHA-256 of every block of both files.
+* The manifest is signed using Ed25519. The private key is created by the
+* publisher when it first publishes an image and is kept next to the image, it
+* never leaves the publisher. Its public key is logged and part of the
+* manifest.
+*
+* Nodes following the publisher (webserver.api.federation.gravity.source)
+* fetch the manifest in the federation thread, verify its signature using the
+* configured public key (webserver.api.federation.gravity.key) and
+* assemble both files in staging files next to their gravity database. Blocks
+* matching the same block of the local files are copied locally, only changed
+* blocks are transferred. Every block is checked against the signed manifest.
+* Index and database are then renamed into place and the lists are reloaded
+* the same way as after pihole -g. The index matches the received database
+* exactly, so the follower maps it instead of compiling the index itself.
+*/
+
+#include "FTL.h"
+#include "database/gravity-image.h"
+// config
+#include "config/config.h"
+// log_*()
+#include "log.h"
+// gravity_index_write(), GRAVITY_INDEX_SUFFIX
+#include "database/gravity-index.h"
+// sqlite3_backup_*()
+#include "database/sqlite3.h"
+// federation_http_get(), FEDERATION_MAX_SUMMARY
+#include "federation.h"
+// set_event()
+#include "events.h"
+// killed
+#include "signals.h"
+// sha256_raw_to_hex(), get_secure_randomness()
+#include "config/password.h"
+// struct sha256_ctx
+#include <nettle/sha2.h>
+// ed25519_sha512_*()
+#include <nettle/eddsa.h>
+// open()
+#include <fcntl.h>
+
+// Image files are built next to the published ones and renamed afterwards,
+// followers receive them into staging files next to their gravity database
+#define BUILD_SUFFIX ".tmp"
+#define STAGING_SUFFIX ".image.new"
+// Suffix of the private key of the publisher, kept next to the image
+#define KEY_SUFFIX ".key"
+
+// Limits of the block size accepted from a publisher
+#define MIN_BLOCK_SIZE (4u*1024u)
+#define MAX_BLOCK_SIZE (4u*1024u*1024u)
+
+struct image_file {
+	uint64_t size;
+	unsigned int num_blocks;
+	uint8_t (*hashes)[SHA256_DIGEST_SIZE];
+};
+
+struct image {
+	char version[GRAVITY_IMAGE_VERSION_SIZE];
+	uint8_t signature[ED25519_SIGNATURE_SIZE];
+	time_t created;
+	unsigned int block_size;
+	struct image_file files[GRAVITY_IMAGE_FILES];
+};
+
+// Keys of the files in the manifest and in block requests
+static const char * const file_names[GRAVITY_IMAGE_FILES] = {
+	"database",
+	"index"
+};
+
+// Image published by this node. It is only replaced by the federation thread,
+// the lock protects it and the image files against concurrent reads of the
+// API threads
+static pthread_mutex_t image_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct image published = { 0 };
+// State of the gravity database the published image has been built from (or
+// failed to be built from, it is retried once the database changes)
+static struct stat published_from = { 0 };
+// Key pair signing the published images, it is loaded (or created) when the
+// first image is published
+static uint8_t private_key[ED25519_KEY_SIZE] = { 0 };
+static uint8_t public_key[ED25519_KEY_SIZE] = { 0 };
+static bool have_key = false;
+
+// Version of the image last received from the publisher and why the last
+// attempt to receive an image failed (empty if it did not)
+static char followed[GRAVITY_IMAGE_VERSION_SIZE] = "";
+static char follow_error[128] = "";
+
+const char * __attribute__((const)) gravity_image_file_name(const enum gravity_image_file file)
+{
+	return file < GRAVITY_IMAGE_FILES ? file_names[file] : NULL;
+}
+
+// Size of a block, only the last block of a file may be shorter
+static inline size_t block_len(const struct image_file *file, const unsigned int block_size,
+                               const unsigned int block)
+{
+	const uint64_t offset = (uint64_t)block * block_size;
+	return file->size - offset < block_size ? file->size - offset : block_size;
+}
+
+static void free_image(struct image *img)
+{
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		if(img->files[f].hashes != NULL)
+			free(img->files[f].hashes);
+	}
+	memset(img, 0, sizeof(*img));
+}
+
+// Path of a file of the image belonging to a gravity database
+static char *image_path(const char *dbfile, const char *suffix, const enum gravity_image_file file)
+{
+	char *path = NULL;
+	if(asprintf(&path, "%s%s%s", dbfile, suffix,
+	            file == GRAVITY_IMAGE_INDEX ? GRAVITY_INDEX_SUFFIX : "") < 0)
+		return NULL;
+	return path;
+}
+
+/**
+ * Compute the digest of an image which is signed and the version derived from
+ * it. Both cover the block size as well as the size and the block hashes of all
+ * files.
+ *
+ * @param img The image
+ * @param version Receives the version of the image
+ * @param digest Receives the digest
+ */
+static void digest_image(const struct image *img, char version[GRAVITY_IMAGE_VERSION_SIZE],
+                         uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	struct sha256_ctx sha;
+	sha256_init(&sha);
+
+	char head[64];
+	int len = snprintf(head, sizeof(head), "FTLGIMG1 %u", img->block_size);
+	sha256_update(&sha, len, (const uint8_t*)head);
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		const struct image_file *file = &img->files[f];
+		len = snprintf(head, sizeof(head), " %s %llu ", file_names[f], (unsigned long long)file->size);
+		sha256_update(&sha, len, (const uint8_t*)head);
+		sha256_update(&sha, file->num_blocks * SHA256_DIGEST_SIZE, (const uint8_t*)file->hashes);
+	}
+
+	char hex[2*SHA256_DIGEST_SIZE + 1];
+	sha256_digest(&sha, SHA256_DIGEST_SIZE, digest);
+	sha256_raw_to_hex(digest, hex);
+	memcpy(version, hex, GRAVITY_IMAGE_VERSION_SIZE - 1);
+	version[GRAVITY_IMAGE_VERSION_SIZE - 1] = '\0';
+}
+
+static void hex_encode(const uint8_t *data, const size_t len, char *hex)
+{
+	for(size_t i = 0; i < len; i++)
+		sprintf(hex + 2*i, "%02x", data[i]);
+	hex[2*len] = '\0';
+}
+
+// Create a new private key. It is written to a temporary file first so an
+// interrupted attempt does not leave a truncated key behind
+static bool create_key(const char *path)
+{
+	char *tmp = NULL;
+	if(asprintf(&tmp, "%s%s", path, BUILD_SUFFIX) < 0)
+		return false;
+
+	bool okay = false;
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if(fd < 0)
+		log_err("Cannot create gravity image key %s: %s", tmp, strerror(errno));
+	else if(!get_secure_randomness(private_key, sizeof(private_key)))
+		log_err("Cannot create gravity image key %s: no randomness available", tmp);
+	else if(write(fd, private_key, sizeof(private_key)) != (ssize_t)sizeof(private_key) ||
+	        fsync(fd) != 0 || rename(tmp, path) != 0)
+		log_err("Cannot write gravity image key %s: %s", path, strerror(errno));
+	else
+		okay = true;
+
+	if(fd >= 0)
+		close(fd);
+	if(!okay)
+		unlink(tmp);
+	free(tmp);
+
+	return okay;
+}
+
+// Load the key pair signing the published images, a new one is created if
+// there is none yet
+static bool load_key(const char *dbfile)
+{
+	char *path = NULL;
+	if(asprintf(&path, "%s%s%s", dbfile, GRAVITY_IMAGE_SUFFIX, KEY_SUFFIX) < 0)
+		return false;
+
+	bool okay = false;
+	const int fd = open(path, O_RDONLY);
+	if(fd >= 0)
+	{
+		errno = 0;
+		okay = read(fd, private_key, sizeof(private_key)) == (ssize_t)sizeof(private_key);
+		if(!okay)
+			log_err("Cannot read gravity image key %s: %s", path,
+			        errno != 0 ? strerror(errno) : "file is too short");
+		close(fd);
+	}
+	else if(errno == ENOENT)
+		okay = create_key(path);
+	else
+		log_err("Cannot open gravity image key %s: %s", path, strerror(errno));
+
+	if(okay)
+	{
+		char hex[2*ED25519_KEY_SIZE + 1];
+		ed25519_sha512_public_key(public_key, private_key);
+		hex_encode(public_key, sizeof(public_key), hex);
+		log_info("Gravity images are signed with public key %s", hex);
+	}
+	else
+		memset(private_key, 0, sizeof(private_key));
+	free(path);
+
+	have_key = okay;
+	return okay;
+}
+
+// Get the SHA-256 of every block of a file
+static bool hash_file(const char *path, struct image_file *out, const unsigned int block_size)
+{
+	const int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		log_err("Cannot open %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	bool okay = false;
+	uint8_t *buf = NULL;
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+		goto end_of_hash_file;
+
+	out->size = st.st_size;
+	out->num_blocks = (out->size + block_size - 1) / block_size;
+	if(out->num_blocks > 0 &&
+	   (out->hashes = calloc(out->num_blocks, sizeof(*out->hashes))) == NULL)
+		goto end_of_hash_file;
+	if((buf = malloc(block_size)) == NULL)
+		goto end_of_hash_file;
+
+	for(unsigned int i = 0; i < out->num_blocks; i++)
+	{
+		const off_t offset = (off_t)i * block_size;
+		const size_t len = block_len(out, block_size, i);
+		if(pread(fd, buf, len, offset) != (ssize_t)len)
+		{
+			log_err("Cannot read %s: %s", path, strerror(errno));
+			goto end_of_hash_file;
+		}
+
+		struct sha256_ctx ctx;
+		sha256_init(&ctx);
+		sha256_update(&ctx, len, buf);
+		sha256_digest(&ctx, SHA256_DIGEST_SIZE, out->hashes[i]);
+	}
+	okay = true;
+
+end_of_hash_file:
+	if(buf != NULL)
+		free(buf);
+	close(fd);
+
+	return okay;
+}
+
+// Take a consistent copy of the gravity database using the online backup API.
+// It copies the database page by page, so unchanged parts of the lists mostly
+// end up in unchanged blocks of the image
+static bool snapshot_database(const char *dbfile, const char *target)
+{
+	sqlite3 *src = NULL, *dst = NULL;
+	bool okay = false;
+
+	unlink(target);
+	if(sqlite3_open_v2(dbfile, &src, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		log_err("Cannot open gravity database %s: %s", dbfile, sqlite3_errmsg(src));
+		goto end_of_snapshot;
+	}
+	if(sqlite3_open_v2(target, &dst, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK)
+	{
+		log_err("Cannot create gravity image %s: %s", target, sqlite3_errmsg(dst));
+		goto end_of_snapshot;
+	}
+
+	sqlite3_backup *backup = sqlite3_backup_init(dst, "main", src, "main");
+	if(backup == NULL)
+	{
+		log_err("Cannot copy gravity database %s: %s", dbfile, sqlite3_errmsg(dst));
+		goto end_of_snapshot;
+	}
+	const int rc = sqlite3_backup_step(backup, -1);
+	sqlite3_backup_finish(backup);
+	if(rc != SQLITE_DONE)
+	{
+		log_err("Cannot copy gravity database %s: %s", dbfile, sqlite3_errstr(rc));
+		goto end_of_snapshot;
+	}
+	okay = true;
+
+end_of_snapshot:
+	sqlite3_close(src);
+	sqlite3_close(dst);
+
+	return okay;
+}
+
+// Build a new image if the gravity database changed since the last one
+static void publish_image(void)
+{
+	const char *dbfile = config.files.gravity.v.s;
+	struct stat st;
+	if(stat(dbfile, &st) != 0)
+		return;
+
+	// Nothing to do if the database did not change since the last attempt
+	if(st.st_ino == published_from.st_ino && st.st_size == published_from.st_size &&
+	   st.st_mtim.tv_sec == published_from.st_mtim.tv_sec &&
+	   st.st_mtim.tv_nsec == published_from.st_mtim.tv_nsec)
+		return;
+	published_from = st;
+	if(!have_key && !load_key(dbfile))
+		return;
+
+	const double t0 = double_time();
+	struct image img = { 0 };
+	img.block_size = GRAVITY_IMAGE_BLOCK_SIZE;
+	img.created = time(NULL);
+
+	char *paths[GRAVITY_IMAGE_FILES] = { NULL }, *build[GRAVITY_IMAGE_FILES] = { NULL };
+	bool okay = false;
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		if((paths[f] = image_path(dbfile, GRAVITY_IMAGE_SUFFIX, f)) == NULL ||
+		   (build[f] = image_path(dbfile, GRAVITY_IMAGE_SUFFIX BUILD_SUFFIX, f)) == NULL)
+			goto end_of_publish;
+	}
+
+	// gravity_index_write() puts the index next to the copied database
+	if(!snapshot_database(dbfile, build[GRAVITY_IMAGE_DATABASE]) ||
+	   !gravity_index_write(build[GRAVITY_IMAGE_DATABASE], NULL))
+		goto end_of_publish;
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+		if(!hash_file(build[f], &img.files[f], img.block_size))
+			goto end_of_publish;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	digest_image(&img, img.version, digest);
+	ed25519_sha512_sign(public_key, private_key, sizeof(digest), digest, img.signature);
+
+	// Replace the published image while no block can be read from it
+	pthread_mutex_lock(&image_lock);
+	okay = rename(build[GRAVITY_IMAGE_INDEX], paths[GRAVITY_IMAGE_INDEX]) == 0 &&
+	       rename(build[GRAVITY_IMAGE_DATABASE], paths[GRAVITY_IMAGE_DATABASE]) == 0;
+	if(okay)
+	{
+		struct image old = published;
+		published = img;
+		img = old;
+	}
+	else
+	{
+		log_err("Cannot publish gravity image %s: %s", paths[GRAVITY_IMAGE_DATABASE], strerror(errno));
+		// Do not serve blocks of a partially replaced image
+		free_image(&published);
+	}
+	pthread_mutex_unlock(&image_lock);
+
+	if(okay)
+	{
+		char prefix[2] = { 0 };
+		double formatted = 0.0;
+		format_memory_size(prefix, published.files[GRAVITY_IMAGE_DATABASE].size +
+		                   published.files[GRAVITY_IMAGE_INDEX].size, &formatted);
+		log_info("Published gravity image %s (%.1f %sB) in %.1f s",
+		         published.version, formatted, prefix, double_time() - t0);
+	}
+
+end_of_publish:
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		if(!okay && build[f] != NULL)
+			unlink(build[f]);
+		if(paths[f] != NULL)
+			free(paths[f]);
+		if(build[f] != NULL)
+			free(build[f]);
+	}
+	free_image(&img);
+}
+
+/**
+ * Get the manifest of the published image
+ *
+ * @param version Receives the version of the image
+ * @return The manifest or NULL if no image has been published
+ */
+cJSON *gravity_image_manifest(char version[GRAVITY_IMAGE_VERSION_SIZE])
+{
+	pthread_mutex_lock(&image_lock);
+	if(published.version[0] == '\0')
+	{
+		pthread_mutex_unlock(&image_lock);
+		return NULL;
+	}
+
+	char hex[2*ED25519_SIGNATURE_SIZE + 1];
+	strcpy(version, published.version);
+
+	cJSON *json = cJSON_CreateObject();
+	cJSON_AddStringToObject(json, "version", version);
+	cJSON_AddNumberToObject(json, "created", published.created);
+	cJSON_AddNumberToObject(json, "block_size", published.block_size);
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		cJSON *file = cJSON_AddObjectToObject(json, file_names[f]);
+		cJSON_AddNumberToObject(file, "size", published.files[f].size);
+		cJSON *blocks = cJSON_AddArrayToObject(file, "blocks");
+		for(unsigned int i = 0; i < published.files[f].num_blocks; i++)
+		{
+			sha256_raw_to_hex(published.files[f].hashes[i], hex);
+			cJSON_AddItemToArray(blocks, cJSON_CreateString(hex));
+		}
+	}
+	hex_encode(published.signature, sizeof(published.signature), hex);
+	cJSON_AddStringToObject(json, "signature", hex);
+	// Only for setting up followers, they never trust the key sent along
+	// with the manifest
+	hex_encode(public_key, sizeof(public_key), hex);
+	cJSON_AddStringToObject(json, "key", hex);
+	pthread_mutex_unlock(&image_lock);
+
+	return json;
+}
+
+/**
+ * Read a block of the published image
+ *
+ * @param file The file of the image
+ * @param block Index of the block
+ * @param version The version of the image the block belongs to
+ * @param buf Buffer of GRAVITY_IMAGE_BLOCK_SIZE bytes
+ * @return Size of the block or -1 if there is no such block (anymore)
+ */
+ssize_t gravity_image_read_block(const enum gravity_image_file file, const unsigned int block,
+                                 const char *version, void *buf)
+{
+	char *path = image_path(config.files.gravity.v.s, GRAVITY_IMAGE_SUFFIX, file);
+	if(path == NULL)
+		return -1;
+
+	ssize_t len = -1;
+	pthread_mutex_lock(&image_lock);
+	if(file < GRAVITY_IMAGE_FILES && published.version[0] != '\0' &&
+	   strcmp(published.version, version) == 0 && block < published.files[file].num_blocks)
+	{
+		const off_t offset = (off_t)block * published.block_size;
+		const size_t size = block_len(&published.files[file], published.block_size, block);
+		const int fd = open(path, O_RDONLY);
+		if(fd < 0 || (len = pread(fd, buf, size, offset)) != (ssize_t)size)
+		{
+			log_err("Cannot read gravity image %s: %s", path, strerror(errno));
+			len = -1;
+		}
+		if(fd >= 0)
+			close(fd);
+	}
+	pthread_mutex_unlock(&image_lock);
+	free(path);
+
+	return len;
+}
+
+static bool hex_decode(const char *hex, uint8_t *out, const size_t len)
+{
+	if(hex == NULL || strlen(hex) != 2*len)
+		return false;
+	for(size_t i = 0; i < len; i++)
+	{
+		unsigned int byte = 0;
+		if(!isxdigit(hex[2*i]) || !isxdigit(hex[2*i + 1]) ||
+		   sscanf(hex + 2*i, "%2x", &byte) != 1)
+			return false;
+		out[i] = byte;
+	}
+	return true;
+}
+
+/**
+ * Parse a public key given in hex representation
+ *
+ * @param hex The key
+ * @param key Receives the key
+ * @return Whether the key is valid
+ */
+bool gravity_image_parse_key(const char *hex, uint8_t key[GRAVITY_IMAGE_KEY_SIZE])
+{
+	return hex_decode(hex, key, GRAVITY_IMAGE_KEY_SIZE);
+}
+
+/**
+ * Parse and verify the manifest of an image received from the publisher
+ *
+ * @param json The manifest
+ * @param key The public key of the publisher
+ * @param img Receives the image
+ * @return NULL on success, an error message otherwise
+ */
+static const char *parse_manifest(const cJSON *json, const uint8_t key[GRAVITY_IMAGE_KEY_SIZE],
+                                  struct image *img)
+{
+	const char *version = cJSON_GetStringValue(cJSON_GetObjectItem(json, "version"));
+	const cJSON *block_size = cJSON_GetObjectItem(json, "block_size");
+	uint8_t signature[ED25519_SIGNATURE_SIZE];
+	if(version == NULL || strlen(version) != GRAVITY_IMAGE_VERSION_SIZE - 1 ||
+	   !cJSON_IsNumber(block_size) || block_size->valuedouble < MIN_BLOCK_SIZE ||
+	   block_size->valuedouble > MAX_BLOCK_SIZE ||
+	   !hex_decode(cJSON_GetStringValue(cJSON_GetObjectItem(json, "signature")), signature, sizeof(signature)))
+		return "Invalid manifest";
+	img->block_size = block_size->valuedouble;
+
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		const cJSON *file = cJSON_GetObjectItem(json, file_names[f]);
+		const cJSON *size = cJSON_GetObjectItem(file, "size");
+		const cJSON *blocks = cJSON_GetObjectItem(file, "blocks");
+		if(!cJSON_IsNumber(size) || size->valuedouble < 0 || size->valuedouble > (double)INT64_MAX ||
+		   !cJSON_IsArray(blocks))
+			return "Invalid manifest";
+
+		struct image_file *out = &img->files[f];
+		out->size = size->valuedouble;
+		out->num_blocks = cJSON_GetArraySize(blocks);
+		if(out->num_blocks != (out->size + img->block_size - 1) / img->block_size)
+			return "Invalid manifest";
+		if(out->num_blocks > 0 &&
+		   (out->hashes = calloc(out->num_blocks, sizeof(*out->hashes))) == NULL)
+			return "Out of memory";
+
+		unsigned int i = 0;
+		const cJSON *hash = NULL;
+		cJSON_ArrayForEach(hash, blocks)
+			if(!hex_decode(cJSON_GetStringValue(hash), out->hashes[i++], SHA256_DIGEST_SIZE))
+				return "Invalid manifest";
+	}
+
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	digest_image(img, img->version, digest);
+	if(strcmp(img->version, version) != 0 ||
+	   !ed25519_sha512_verify(key, sizeof(digest), digest, signature))
+		return "Invalid signature";
+
+	return NULL;
+}
+
+/**
+ * Assemble a file of a received image in a staging file
+ *
+ * @param source The publisher
+ * @param token The shared secret authenticating the requests
+ * @param img The image
+ * @param f The file of the image
+ * @param local The local file used as base of the delta transfer
+ * @param staging The staging file
+ * @param identical Receives whether the local file already matches the image
+ * @param fetched Receives the number of bytes transferred
+ * @param error Buffer receiving an error message
+ * @param error_len Size of the error buffer
+ * @return Whether the file could be assembled
+ */
+static bool assemble_file(const char *source, const char *token, const struct image *img,
+                          const enum gravity_image_file f, const char *local, const char *staging,
+                          bool *identical, uint64_t *fetched, char *error, const size_t error_len)
+{
+	const struct image_file *file = &img->files[f];
+	const int base = open(local, O_RDONLY);
+	struct stat st;
+	*identical = base >= 0 && fstat(base, &st) == 0 && (uint64_t)st.st_size == file->size;
+
+	bool okay = false;
+	uint8_t *buf = NULL;
+	const int fd = open(staging, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		snprintf(error, error_len, "Cannot create %s: %s", staging, strerror(errno));
+		goto end_of_assemble;
+	}
+	if((buf = malloc(img->block_size)) == NULL)
+	{
+		snprintf(error, error_len, "Out of memory");
+		goto end_of_assemble;
+	}
+
+	for(unsigned int i = 0; i < file->num_blocks && !killed; i++)
+	{
+		const off_t offset = (off_t)i * img->block_size;
+		const size_t len = block_len(file, img->block_size, i);
+		uint8_t hash[SHA256_DIGEST_SIZE];
+		struct sha256_ctx ctx;
+
+		// Reuse the block of the local file if it did not change
+		if(base >= 0 && pread(base, buf, len, offset) == (ssize_t)len)
+		{
+			sha256_init(&ctx);
+			sha256_update(&ctx, len, buf);
+			sha256_digest(&ctx, sizeof(hash), hash);
+			if(memcmp(hash, file->hashes[i], sizeof(hash)) == 0)
+				goto write_block;
+		}
+		*identical = false;
+
+		char uri[128], *body = NULL;
+		size_t body_len = 0u;
+		snprintf(uri, sizeof(uri), "/api/federation/gravity/block?file=%s&block=%u&version=%s",
+		         file_names[f], i, img->version);
+		const int status = federation_http_get(source, uri, token, img->block_size,
+		                                       &body, &body_len, error, error_len);
+		if(status != 200)
+		{
+			// The image may have been replaced in the meantime, the new one
+			// is fetched next time
+			if(status > 0)
+				snprintf(error, error_len, "HTTP status %d for block %u of the %s", status, i, file_names[f]);
+			goto end_of_assemble;
+		}
+		if(body_len == len)
+		{
+			memcpy(buf, body, len);
+			sha256_init(&ctx);
+			sha256_update(&ctx, len, buf);
+			sha256_digest(&ctx, sizeof(hash), hash);
+		}
+		free(body);
+		if(body_len != len || memcmp(hash, file->hashes[i], sizeof(hash)) != 0)
+		{
+			snprintf(error, error_len, "Block %u of the %s does not match the manifest", i, file_names[f]);
+			goto end_of_assemble;
+		}
+		*fetched += len;
+
+write_block:
+		if(pwrite(fd, buf, len, offset) != (ssize_t)len)
+		{
+			snprintf(error, error_len, "Cannot write %s: %s", staging, strerror(errno));
+			goto end_of_assemble;
+		}
+	}
+
+	if(killed)
+		snprintf(error, error_len, "Interrupted");
+	else if(fsync(fd) != 0)
+		snprintf(error, error_len, "Cannot write %s: %s", staging, strerror(errno));
+	else
+		okay = true;
+
+end_of_assemble:
+	if(buf != NULL)
+		free(buf);
+	if(fd >= 0)
+		close(fd);
+	if(base >= 0)
+		close(base);
+
+	return okay;
+}
+
+// Receive the image of the publisher if it changed since the last time
+static void follow_image(const char *source, const char *token, const char *key_hex)
+{
+	const char *dbfile = config.files.gravity.v.s;
+	char error[sizeof(follow_error)] = { 0 };
+	struct image img = { 0 };
+	cJSON *json = NULL;
+	char *body = NULL;
+	char *local[GRAVITY_IMAGE_FILES] = { NULL }, *staging[GRAVITY_IMAGE_FILES] = { NULL };
+
+	uint8_t key[GRAVITY_IMAGE_KEY_SIZE];
+	if(token[0] == '\0')
+	{
+		snprintf(error, sizeof(error), "webserver.api.federation.token is not set");
+		goto end_of_follow;
+	}
+	if(key_hex[0] == '\0')
+	{
+		snprintf(error, sizeof(error), "webserver.api.federation.gravity.key is not set");
+		goto end_of_follow;
+	}
+	if(!gravity_image_parse_key(key_hex, key))
+	{
+		snprintf(error, sizeof(error), "webserver.api.federation.gravity.key is invalid");
+		goto end_of_follow;
+	}
+
+	char uri[128];
+	size_t len = 0u;
+	snprintf(uri, sizeof(uri), "/api/federation/gravity?version=%s", followed);
+	const int status = federation_http_get(source, uri, token, FEDERATION_MAX_SUMMARY,
+	                                       &body, &len, error, sizeof(error));
+	// The image did not change
+	if(status == 304)
+		goto end_of_follow;
+	if(status != 200)
+	{
+		if(status > 0)
+			snprintf(error, sizeof(error), "HTTP status %d", status);
+		goto end_of_follow;
+	}
+
+	const char *msg = NULL;
+	if((json = cJSON_Parse(body)) == NULL)
+		msg = "Invalid JSON";
+	else
+		msg = parse_manifest(json, key, &img);
+	if(msg != NULL)
+	{
+		snprintf(error, sizeof(error), "%s", msg);
+		goto end_of_follow;
+	}
+	if(strcmp(img.version, followed) == 0)
+		goto end_of_follow;
+
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		if((local[f] = image_path(dbfile, "", f)) == NULL ||
+		   (staging[f] = image_path(dbfile, STAGING_SUFFIX, f)) == NULL)
+		{
+			snprintf(error, sizeof(error), "Out of memory");
+			goto end_of_follow;
+		}
+	}
+
+	const double t0 = double_time();
+	uint64_t fetched = 0u;
+	bool identical[GRAVITY_IMAGE_FILES] = { false };
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+		if(!assemble_file(source, token, &img, f, local[f], staging[f],
+		                  &identical[f], &fetched, error, sizeof(error)))
+			goto end_of_follow;
+
+	// Move the index first, it is ignored until the matching database is in
+	// place, too
+	for(int f = GRAVITY_IMAGE_FILES - 1; f >= 0; f--)
+	{
+		if(identical[f])
+			unlink(staging[f]);
+		else if(rename(staging[f], local[f]) != 0)
+		{
+			snprintf(error, sizeof(error), "Cannot replace %s: %s", local[f], strerror(errno));
+			goto end_of_follow;
+		}
+	}
+
+	if(!identical[GRAVITY_IMAGE_DATABASE] || !identical[GRAVITY_IMAGE_INDEX])
+	{
+		set_event(RELOAD_GRAVITY);
+
+		char prefix[2] = { 0 }, total_prefix[2] = { 0 };
+		double formatted = 0.0, total_formatted = 0.0;
+		format_memory_size(prefix, fetched, &formatted);
+		format_memory_size(total_prefix, img.files[GRAVITY_IMAGE_DATABASE].size +
+		                   img.files[GRAVITY_IMAGE_INDEX].size, &total_formatted);
+		log_info("Received gravity image %s from %s (%.1f %sB of %.1f %sB transferred) in %.1f s",
+		         img.version, source, formatted, prefix, total_formatted, total_prefix,
+		         double_time() - t0);
+	}
+	else
+	{
+		log_debug(DEBUG_DATABASE, "Gravity database already matches image %s", img.version);
+	}
+	strcpy(followed, img.version);
+
+end_of_follow:
+	for(unsigned int f = 0; f < GRAVITY_IMAGE_FILES; f++)
+	{
+		if(staging[f] != NULL)
+		{
+			if(error[0] != '\0')
+				unlink(staging[f]);
+			free(staging[f]);
+		}
+		if(local[f] != NULL)
+			free(local[f]);
+	}
+	if(body != NULL)
+		free(body);
+	cJSON_Delete(json);
+	free_image(&img);
+
+	// Only log changes of the state
+	if(error[0] != '\0' && follow_error[0] == '\0')
+		log_warn("Cannot receive gravity image from %s: %s", source, error);
+	else if(error[0] == '\0' && follow_error[0] != '\0')
+		log_info("Receiving gravity images from %s again", source);
+	strcpy(follow_error, error);
+}
+
+/**
+ * Publish a new image and receive the image of the publisher as configured.
+ * This is called periodically by the federation thread.
+ */
+void gravity_image_update(void)
+{
+	// Copy the configuration as it may be replaced at any time
+	const bool publish = config.webserver.api.federation.gravity.publish.v.b;
+	char *token = strdup(config.webserver.api.federation.token.v.s);
+	char *source = strdup(config.webserver.api.federation.gravity.source.v.s);
+	char *key = strdup(config.webserver.api.federation.gravity.key.v.s);
+	if(token == NULL || source == NULL || key == NULL)
+		goto end_of_update;
+
+	static bool warned = false;
+	if(publish && token[0] == '\0')
+	{
+		if(!warned)
+			log_warn("Not publishing a gravity image as webserver.api.federation.token is not set");
+		warned = true;
+	}
+	else if(publish)
+	{
+		publish_image();
+		warned = false;
+	}
+	else if(published_from.st_ino != 0)
+	{
+		// Stop publishing
+		gravity_image_free();
+	}
+
+	if(source[0] != '\0' && !killed)
+		follow_image(source, token, key);
+
+end_of_update:
+	if(token != NULL)
+		free(token);
+	if(source != NULL)
+		free(source);
+	if(key != NULL)
+		free(key);
+}
+
+void gravity_image_free(void)
+{
+	pthread_mutex_lock(&image_lock);
+	free_image(&published);
+	memset(&published_from, 0, sizeof(published_from));
+	memset(private_key, 0, sizeof(private_key));
+	memset(public_key, 0, sizeof(public_key));
+	have_key = false;
+	pthread_mutex_unlock(&image_lock);
+}
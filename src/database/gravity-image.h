@@ -0,0 +1,48 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Gravity image distribution prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef GRAVITY_IMAGE_H
+#define GRAVITY_IMAGE_H
+
+#include <stdbool.h>
+// uint8_t
+#include <stdint.h>
+// ssize_t
+#include <sys/types.h>
+// cJSON
+#include "webserver/cJSON/cJSON.h"
+
+// Unit of the delta transfer. Followers only fetch blocks whose SHA-256
+// differs from the same block of their local copy
+#define GRAVITY_IMAGE_BLOCK_SIZE (256u*1024u)
+// Suffix of the image published next to the gravity database
+#define GRAVITY_IMAGE_SUFFIX ".image"
+// Images are identified by the first 16 bytes of the SHA-256 of their manifest
+// in hex representation
+#define GRAVITY_IMAGE_VERSION_SIZE (2*16 + 1)
+// Images are signed using Ed25519, followers verify them using the public key
+// of the publisher (webserver.api.federation.gravity.key)
+#define GRAVITY_IMAGE_KEY_SIZE 32u
+
+// Files making up an image, the order is part of the signed manifest
+enum gravity_image_file {
+	GRAVITY_IMAGE_DATABASE,
+	GRAVITY_IMAGE_INDEX,
+	GRAVITY_IMAGE_FILES
+} __attribute__ ((packed));
+
+void gravity_image_update(void);
+void gravity_image_free(void);
+cJSON *gravity_image_manifest(char version[GRAVITY_IMAGE_VERSION_SIZE]);
+ssize_t gravity_image_read_block(const enum gravity_image_file file, const unsigned int block,
+                                 const char *version, void *buf);
+const char *gravity_image_file_name(const enum gravity_image_file file) __attribute__((const));
+bool gravity_image_parse_key(const char *hex, uint8_t key[GRAVITY_IMAGE_KEY_SIZE]);
+
+#endif //GRAVITY_IMAGE_H
@@ -0,0 +1,1507 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Compiled gravity index routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file gravity-index.c
+ * @brief Read-only in-memory index of the exact domain lists in gravity.db
+ *
+ * The index is compiled from gravity.db (which remains the only source of
+ * truth) whenever the lists are reloaded. It contains one entry per (domain,
+ * list) pair of the gravity, antigravity and the exact allow/deny domainlists.
+ * Entries are stored as a sorted array of 64-bit domain hashes together with
+ * a directory of bucket offsets indexed by the most significant bits of the
+ * hash. A lookup hence costs one hash computation and a short linear scan of
+ * (typically) one or two entries sharing a cache line. The hash is not keyed,
+ * so colliding domains can be crafted on purpose. Every entry hence references
+ * its domain (the domain part of ABP-style patterns) in a string table and a
+ * hash match is only reported once the strings have been compared.
+ *
+ * Once compiled, all arrays are moved into one read-only shared anonymous
+ * mapping. TCP workers forked by dnsmasq inherit it without any setup or
+ * copy-on-write overhead. A generation counter in shared memory allows forks
+ * to detect that the lists have been reloaded since they were created.
+ *
+ * Every enabled group is assigned one bit. Group memberships are interned
+ * into a small table of distinct group bitmaps, each entry references one of
+ * them. The groups of a client are translated into the same bit layout once
+ * and cached so a lookup for any client is a single probe followed by a
+ * bitwise AND. No per-client SQL statements are needed.
+ *
+ * The index remembers the checksum of the list every adlist has been parsed
+ * from (see ADLIST_CHECKSUM_PROPERTY). When it is recompiled, the entries of
+ * adlists whose checksum did not change are taken over from the active index
+ * instead of being read from the database again. Only the domains of changed
+ * adlists and the domainlist are read and merged into them.
+ *
+ * pihole -g can write the compiled index to a file (see gravity_index_write())
+ * which is mapped by FTL instead of compiling the index as long as the
+ * database has not been changed since.
+ */
+
+#include "FTL.h"
+#include "database/gravity-index.h"
+// logging routines
+#include "log.h"
+// struct config
+#include "config/config.h"
+// get_gravity_generation()
+#include "shmem.h"
+// ADLIST_CHECKSUM_PROPERTY
+#include "database/gravity-db.h"
+// mmap()
+#include <sys/mman.h>
+// open()
+#include <fcntl.h>
+
+// Bounds for the number of bits used for the bucket directory
+#define MIN_BUCKET_BITS 4u
+#define MAX_BUCKET_BITS 26u
+
+// Largest group set index that can be stored in an entry
+#define MAX_GROUPSETS ((1u << 24) - 1u)
+
+struct gravity_index_entry {
+	uint64_t hash;
+	int32_t id;
+	uint32_t set : 24;
+	uint32_t list : 8;
+	// Offset of the domain in the string table
+	uint32_t name;
+};
+
+// Cached group bitmap of a client
+struct client_groups {
+	size_t groupspos;
+	unsigned int string_generation;
+	bool valid;
+};
+
+// Owner (adlist) of gravity entries
+struct index_owner {
+	int id;
+	int type;
+	uint32_t set;
+	// Hash of the checksum of the list the domains have been parsed from
+	uint64_t checksum;
+	bool has_checksum;
+	// Entries are taken over from the previous index
+	bool reused;
+};
+
+struct gravity_index {
+	struct gravity_index_entry *entries;
+	size_t num_entries;
+	size_t cap_entries;
+	uint32_t *buckets;
+	unsigned int bucket_bits;
+	int *groups;
+	size_t num_groups;
+	unsigned int words;
+	uint64_t *sets;
+	size_t num_sets;
+	size_t cap_sets;
+	char *strings;
+	size_t strings_size;
+	size_t cap_strings;
+	void *map;
+	size_t map_size;
+	struct client_groups *clients;
+	uint64_t *client_bits;
+	size_t num_clients;
+	struct index_owner *owners;
+	size_t num_owners;
+	double build_time;
+};
+
+// The currently active index (NULL if not available)
+static struct gravity_index *gindex = NULL;
+
+// Shared memory generation the active index has been published in
+static unsigned int generation = 0u;
+
+/**
+ * @brief Check if a list entry is an ABP-style "||domain^" or "@@||domain^"
+ * pattern and locate the domain within it
+ *
+ * @param pattern List entry to check
+ * @param start Set to the first character of the domain
+ * @param len Set to the length of the domain
+ * @param antigravity Set to true for "@@||" (exception) patterns
+ * @return true if this is an ABP-style pattern
+ */
+bool gravity_abp_unwrap(const char *pattern, const char **start, size_t *len, bool *antigravity)
+{
+	*antigravity = pattern[0] == '@' && pattern[1] == '@';
+	const char *p = *antigravity ? pattern + 2 : pattern;
+	if(p[0] != '|' || p[1] != '|')
+		return false;
+
+	p += 2;
+	const size_t plen = strlen(p);
+	if(plen < 2 || p[plen - 1] != '^')
+		return false;
+
+	*start = p;
+	*len = plen - 1;
+	return true;
+}
+
+/**
+ * @brief Hash a list entry as it is stored in the index and the prefilter
+ *
+ * Exact domains use gravity_hash(), ABP-style patterns are hashed from right
+ * to left so they can be matched by walking the labels of a queried domain
+ * starting at the TLD (see gravity_abp_step())
+ */
+uint64_t gravity_entry_hash(const char *entry)
+{
+	const char *start = NULL;
+	size_t len = 0u;
+	bool antigravity = false;
+	if(!gravity_abp_unwrap(entry, &start, &len, &antigravity))
+		return gravity_hash(entry);
+
+	uint64_t h = FNV64_OFFSET;
+	while(len-- > 0)
+		h = gravity_abp_step(h, start[len]);
+
+	return gravity_abp_finalize(h, antigravity);
+}
+
+static void free_index(struct gravity_index *idx)
+{
+	if(idx == NULL)
+		return;
+
+	if(idx->map != NULL)
+		munmap(idx->map, idx->map_size);
+	else
+	{
+		free(idx->entries);
+		free(idx->buckets);
+		free(idx->groups);
+		free(idx->sets);
+		if(idx->strings != NULL)
+			free(idx->strings);
+	}
+	// Client group bitmaps are only allocated once a client has been
+	// looked up
+	if(idx->clients != NULL)
+		free(idx->clients);
+	if(idx->client_bits != NULL)
+		free(idx->client_bits);
+	if(idx->owners != NULL)
+		free(idx->owners);
+	free(idx);
+}
+
+static size_t __attribute__((pure)) index_memsize(const struct gravity_index *idx)
+{
+	if(idx == NULL)
+		return 0u;
+
+	if(idx->map != NULL)
+		return sizeof(*idx) + idx->map_size +
+		       idx->num_owners * sizeof(*idx->owners) +
+		       idx->num_clients * (sizeof(*idx->clients) + idx->words * sizeof(*idx->client_bits));
+
+	return sizeof(*idx) +
+	       idx->cap_entries * sizeof(*idx->entries) +
+	       ((1u << idx->bucket_bits) + 1u) * sizeof(*idx->buckets) +
+	       idx->num_groups * sizeof(*idx->groups) +
+	       idx->cap_sets * idx->words * sizeof(*idx->sets) +
+	       idx->cap_strings;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+	const int ia = *(const int*)a, ib = *(const int*)b;
+	return (ia > ib) - (ia < ib);
+}
+
+static int cmp_owner(const void *a, const void *b)
+{
+	const int ia = ((const struct index_owner*)a)->id;
+	const int ib = ((const struct index_owner*)b)->id;
+	return (ia > ib) - (ia < ib);
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct gravity_index_entry *ea = a, *eb = b;
+	if(ea->hash != eb->hash)
+		return ea->hash < eb->hash ? -1 : 1;
+	if(ea->list != eb->list)
+		return ea->list < eb->list ? -1 : 1;
+	return (ea->id > eb->id) - (ea->id < eb->id);
+}
+
+/**
+ * @brief Store a group bitmap in the index, reusing an identical bitmap if
+ * one has already been stored before.
+ *
+ * @param idx Index to work on
+ * @param bits Group bitmap (idx->words words)
+ * @param set Pointer to store the index of the group set into
+ * @return true on success, false on memory errors
+ */
+static bool intern_groupset(struct gravity_index *idx, const uint64_t *bits, uint32_t *set)
+{
+	const size_t size = idx->words * sizeof(*bits);
+
+	// Check if we already know this set
+	for(uint32_t i = 0; i < idx->num_sets; i++)
+	{
+		if(memcmp(&idx->sets[i * idx->words], bits, size) == 0)
+		{
+			*set = i;
+			return true;
+		}
+	}
+
+	if(idx->num_sets >= MAX_GROUPSETS)
+	{
+		log_err("gravity_index_build(): Too many distinct group sets");
+		return false;
+	}
+
+	// Store new set
+	if(idx->num_sets >= idx->cap_sets)
+	{
+		const size_t newcap = MAX(2*idx->cap_sets, 16u);
+		uint64_t *new_sets = realloc(idx->sets, newcap * size);
+		if(new_sets == NULL)
+			return false;
+		idx->sets = new_sets;
+		idx->cap_sets = newcap;
+	}
+	memcpy(&idx->sets[idx->num_sets * idx->words], bits, size);
+
+	*set = idx->num_sets++;
+	return true;
+}
+
+// Append a domain to the string table of the index
+static bool add_string(struct gravity_index *idx, const char *domain, const size_t len, uint32_t *name)
+{
+	if(idx->strings_size + len + 1u > UINT32_MAX)
+	{
+		log_err("gravity_index_build(): Too many domains");
+		return false;
+	}
+
+	if(idx->strings_size + len + 1u > idx->cap_strings)
+	{
+		const size_t newcap = MAX(2*idx->cap_strings, MAX(idx->strings_size + len + 1u, 65536u));
+		char *new_strings = realloc(idx->strings, newcap);
+		if(new_strings == NULL)
+			return false;
+		idx->strings = new_strings;
+		idx->cap_strings = newcap;
+	}
+
+	memcpy(idx->strings + idx->strings_size, domain, len);
+	idx->strings[idx->strings_size + len] = '\0';
+	*name = idx->strings_size;
+	idx->strings_size += len + 1u;
+
+	return true;
+}
+
+static bool add_entry(struct gravity_index *idx, const char *domain, const int id,
+                      const enum gravity_index_list list, const uint32_t set)
+{
+	if(idx->num_entries >= UINT32_MAX)
+	{
+		log_err("gravity_index_build(): Too many entries");
+		return false;
+	}
+
+	if(idx->num_entries >= idx->cap_entries)
+	{
+		const size_t newcap = MAX(2*idx->cap_entries, 1024u);
+		struct gravity_index_entry *new_entries = realloc(idx->entries, newcap * sizeof(*new_entries));
+		if(new_entries == NULL)
+			return false;
+		idx->entries = new_entries;
+		idx->cap_entries = newcap;
+	}
+
+	// ABP-style patterns are compared by their domain part
+	const char *start = domain;
+	size_t len = 0u;
+	bool antigravity = false;
+	if(!gravity_abp_unwrap(domain, &start, &len, &antigravity))
+		len = strlen(domain);
+
+	struct gravity_index_entry *entry = &idx->entries[idx->num_entries];
+	if(!add_string(idx, start, len, &entry->name))
+		return false;
+	entry->hash = gravity_entry_hash(domain);
+	entry->id = id;
+	entry->set = set;
+	entry->list = list;
+	idx->num_entries++;
+
+	return true;
+}
+
+// Set the bit of the group in column col in the group bitmap bits. NULL values
+// (objects without any group) and disabled groups are skipped
+static void collect_group(sqlite3_stmt *stmt, const int col, const struct gravity_index *idx, uint64_t *bits)
+{
+	if(sqlite3_column_type(stmt, col) == SQLITE_NULL)
+		return;
+
+	const int group_id = sqlite3_column_int(stmt, col);
+	const int *pos = bsearch(&group_id, idx->groups, idx->num_groups, sizeof(*idx->groups), cmp_int);
+	if(pos == NULL)
+		return;
+
+	const size_t bit = pos - idx->groups;
+	bits[bit / 64u] |= 1ull << (bit % 64u);
+}
+
+// Read the IDs of all enabled groups in ascending order. The position of a group
+// in idx->groups is its bit in the group bitmaps, collect_group() finds it
+// using a binary search
+static bool read_enabled_groups(sqlite3 *db, struct gravity_index *idx)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT id FROM \"group\" WHERE enabled = 1 ORDER BY id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("gravity_index_build(groups) - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	size_t cap = 0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		if(idx->num_groups >= cap)
+		{
+			cap = MAX(2*cap, 16u);
+			int *new_groups = realloc(idx->groups, cap * sizeof(*new_groups));
+			if(new_groups == NULL)
+			{
+				sqlite3_finalize(stmt);
+				return false;
+			}
+			idx->groups = new_groups;
+		}
+		idx->groups[idx->num_groups++] = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		log_err("gravity_index_build(groups) - SQL error step: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	// Number of 64-bit words needed for one group bitmap
+	idx->words = MAX(1u, (idx->num_groups + 63u) / 64u);
+
+	return true;
+}
+
+// Read all enabled adlists together with their group sets and the checksums
+// of the lists they have been parsed from
+static bool read_adlists(sqlite3 *db, struct gravity_index *idx)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT adlist.id, adlist.type, adlist_by_group.group_id, info.value "
+	                                "FROM adlist LEFT JOIN adlist_by_group ON adlist_by_group.adlist_id = adlist.id "
+	                                "LEFT JOIN info ON info.property = '" ADLIST_CHECKSUM_PROPERTY "' || adlist.id "
+	                                "WHERE adlist.enabled = 1 ORDER BY adlist.id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("gravity_index_build(adlists) - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	uint64_t *bits = calloc(idx->words, sizeof(*bits));
+	bool okay = bits != NULL;
+	size_t cap = 0;
+	struct index_owner *current = NULL;
+	while(okay && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		if(current == NULL || current->id != id)
+		{
+			// Finish previous adlist
+			if(current != NULL)
+				okay = intern_groupset(idx, bits, &current->set);
+			memset(bits, 0, idx->words * sizeof(*bits));
+
+			if(idx->num_owners >= cap)
+			{
+				cap = MAX(2*cap, 16u);
+				struct index_owner *new_owners = realloc(idx->owners, cap * sizeof(*new_owners));
+				if(new_owners == NULL)
+				{
+					okay = false;
+					break;
+				}
+				idx->owners = new_owners;
+			}
+			current = &idx->owners[idx->num_owners++];
+			current->id = id;
+			current->type = sqlite3_column_int(stmt, 1);
+			current->set = 0;
+			const char *checksum = (const char*)sqlite3_column_text(stmt, 3);
+			current->has_checksum = checksum != NULL;
+			current->checksum = checksum != NULL ? gravity_hash(checksum) : 0u;
+			current->reused = false;
+		}
+
+		if(okay)
+			collect_group(stmt, 2, idx, bits);
+	}
+	if(okay && current != NULL)
+		okay = intern_groupset(idx, bits, &current->set);
+
+	sqlite3_finalize(stmt);
+	free(bits);
+
+	if(okay && rc != SQLITE_DONE)
+	{
+		log_err("gravity_index_build(adlists) - SQL error step: %s", sqlite3_errstr(rc));
+		okay = false;
+	}
+
+	return okay;
+}
+
+// Read all enabled exact allow and deny domains
+static bool read_domainlist(sqlite3 *db, struct gravity_index *idx)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT domainlist.id, domainlist.type, domainlist.domain, domainlist_by_group.group_id "
+	                                "FROM domainlist LEFT JOIN domainlist_by_group ON domainlist_by_group.domainlist_id = domainlist.id "
+	                                "WHERE domainlist.enabled = 1 AND domainlist.type IN (0,1) ORDER BY domainlist.id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("gravity_index_build(domainlist) - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	uint64_t *bits = calloc(idx->words, sizeof(*bits));
+	bool okay = bits != NULL;
+	int current_id = -1;
+	enum gravity_index_list current_list = GRAVITY_INDEX_ALLOW;
+	char *current_domain = NULL;
+	while(okay && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		if(current_domain == NULL || current_id != id)
+		{
+			// Finish previous domain
+			if(current_domain != NULL)
+			{
+				uint32_t set = 0;
+				okay = intern_groupset(idx, bits, &set) &&
+				       add_entry(idx, current_domain, current_id, current_list, set);
+				free(current_domain);
+			}
+			memset(bits, 0, idx->words * sizeof(*bits));
+
+			const char *domain = (const char*)sqlite3_column_text(stmt, 2);
+			current_domain = strdup(domain != NULL ? domain : "");
+			current_id = id;
+			current_list = sqlite3_column_int(stmt, 1) == 0 ? GRAVITY_INDEX_ALLOW : GRAVITY_INDEX_DENY;
+			if(current_domain == NULL)
+			{
+				okay = false;
+				break;
+			}
+		}
+
+		if(okay)
+			collect_group(stmt, 3, idx, bits);
+	}
+	if(okay && current_domain != NULL)
+	{
+		uint32_t set = 0;
+		okay = intern_groupset(idx, bits, &set) &&
+		       add_entry(idx, current_domain, current_id, current_list, set);
+	}
+
+	sqlite3_finalize(stmt);
+	free(current_domain);
+	free(bits);
+
+	if(okay && rc != SQLITE_DONE)
+	{
+		log_err("gravity_index_build(domainlist) - SQL error step: %s", sqlite3_errstr(rc));
+		okay = false;
+	}
+
+	return okay;
+}
+
+// Read the domains of the gravity or antigravity table. Only the domains of
+// adlists whose entries are not taken over from the previous index are read
+static bool read_gravity(sqlite3 *db, struct gravity_index *idx, const bool antigravity)
+{
+	// Adlist type 0 is for blocking, type 1 for allowing (antigravity)
+	const int type = antigravity ? 1 : 0;
+	const enum gravity_index_list list = antigravity ? GRAVITY_INDEX_ANTIGRAVITY : GRAVITY_INDEX_GRAVITY;
+	const char *table = antigravity ? "antigravity" : "gravity";
+
+	size_t reused = 0u, changed = 0u;
+	for(size_t i = 0; i < idx->num_owners; i++)
+		if(idx->owners[i].type == type)
+		{
+			if(idx->owners[i].reused)
+				reused++;
+			else
+				changed++;
+		}
+
+	// Nothing to read if all adlists are reused
+	if(changed == 0u && reused > 0u)
+		return true;
+
+	// Read only the domains of the changed adlists if there are any to be
+	// reused, the full table otherwise
+	const size_t size = 64u + changed * 12u;
+	char *querystr = calloc(size, sizeof(char));
+	if(querystr == NULL)
+		return false;
+	size_t len = snprintf(querystr, size, "SELECT domain, adlist_id FROM %s", table);
+	if(reused > 0u)
+	{
+		len += snprintf(querystr + len, size - len, " WHERE adlist_id IN (");
+		for(size_t i = 0, n = 0; i < idx->num_owners && len < size; i++)
+			if(idx->owners[i].type == type && !idx->owners[i].reused)
+				len += snprintf(querystr + len, size - len, "%s%d", n++ > 0 ? "," : "", idx->owners[i].id);
+		if(len < size)
+			len += snprintf(querystr + len, size - len, ")");
+	}
+	if(len < size)
+		len += snprintf(querystr + len, size - len, ";");
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = len < size ? sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL) : SQLITE_TOOBIG;
+	free(querystr);
+	if(rc != SQLITE_OK)
+	{
+		log_err("gravity_index_build(%s) - SQL error prepare: %s", table, sqlite3_errstr(rc));
+		return false;
+	}
+
+	bool okay = true;
+	const struct index_owner *owner = NULL;
+	while(okay && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int adlist_id = sqlite3_column_int(stmt, 1);
+
+		// Domains are typically grouped by adlist so we can often
+		// skip the search
+		if(owner == NULL || owner->id != adlist_id)
+		{
+			const struct index_owner key = { .id = adlist_id };
+			owner = bsearch(&key, idx->owners, idx->num_owners, sizeof(*idx->owners), cmp_owner);
+		}
+
+		// Skip domains of disabled adlists or adlists of the other type
+		if(owner == NULL || owner->type != type || owner->reused)
+			continue;
+
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		if(domain == NULL)
+			continue;
+
+		okay = add_entry(idx, domain, adlist_id, list, owner->set);
+	}
+
+	sqlite3_finalize(stmt);
+
+	if(okay && rc != SQLITE_DONE)
+	{
+		log_err("gravity_index_build(%s) - SQL error step: %s", table, sqlite3_errstr(rc));
+		okay = false;
+	}
+
+	return okay;
+}
+
+// Mark the adlists whose lists did not change since the previous index has
+// been compiled, their entries are taken over instead of being read again.
+// Adlists without a known checksum are always read
+static size_t reuse_adlists(struct gravity_index *idx, const struct gravity_index *prev)
+{
+	if(prev == NULL)
+		return 0u;
+
+	size_t reused = 0u;
+	for(size_t i = 0; i < idx->num_owners; i++)
+	{
+		struct index_owner *owner = &idx->owners[i];
+		const struct index_owner *old = bsearch(owner, prev->owners, prev->num_owners, sizeof(*prev->owners), cmp_owner);
+		owner->reused = owner->has_checksum && old != NULL && old->has_checksum &&
+		                old->checksum == owner->checksum && old->type == owner->type;
+		if(owner->reused)
+			reused++;
+	}
+
+	return reused;
+}
+
+// Sort the entries read from the database and merge the entries of reused
+// adlists from the previous index into them. Both are sorted so this is a
+// single pass from the back of the (enlarged) array. Reused entries get the
+// group set of their adlist in the new index
+static bool sort_entries(struct gravity_index *idx, const struct gravity_index *prev, size_t *reused)
+{
+	qsort(idx->entries, idx->num_entries, sizeof(*idx->entries), cmp_entry);
+
+	*reused = 0u;
+	if(prev == NULL)
+		return true;
+
+	// Collect the entries to take over
+	struct gravity_index_entry *kept = NULL;
+	size_t num_kept = 0u, cap_kept = 0u;
+	const struct index_owner *owner = NULL;
+	for(size_t i = 0; i < prev->num_entries; i++)
+	{
+		const struct gravity_index_entry *entry = &prev->entries[i];
+		if(entry->list != GRAVITY_INDEX_GRAVITY && entry->list != GRAVITY_INDEX_ANTIGRAVITY)
+			continue;
+
+		if(owner == NULL || owner->id != entry->id)
+		{
+			const struct index_owner key = { .id = entry->id };
+			owner = bsearch(&key, idx->owners, idx->num_owners, sizeof(*idx->owners), cmp_owner);
+		}
+		if(owner == NULL || !owner->reused)
+			continue;
+
+		if(num_kept >= cap_kept)
+		{
+			const size_t newcap = MAX(2*cap_kept, 1024u);
+			struct gravity_index_entry *new_kept = realloc(kept, newcap * sizeof(*new_kept));
+			if(new_kept == NULL)
+			{
+				free(kept);
+				return false;
+			}
+			kept = new_kept;
+			cap_kept = newcap;
+		}
+		kept[num_kept] = *entry;
+		kept[num_kept].set = owner->set;
+		const char *name = prev->strings + entry->name;
+		if(!add_string(idx, name, strlen(name), &kept[num_kept].name))
+		{
+			free(kept);
+			return false;
+		}
+		num_kept++;
+	}
+
+	if(num_kept == 0u)
+	{
+		free(kept);
+		return true;
+	}
+
+	const size_t total = idx->num_entries + num_kept;
+	if(total > UINT32_MAX)
+	{
+		log_err("gravity_index_build(): Too many entries");
+		free(kept);
+		return false;
+	}
+	if(total > idx->cap_entries)
+	{
+		struct gravity_index_entry *new_entries = realloc(idx->entries, total * sizeof(*new_entries));
+		if(new_entries == NULL)
+		{
+			free(kept);
+			return false;
+		}
+		idx->entries = new_entries;
+		idx->cap_entries = total;
+	}
+
+	size_t i = idx->num_entries, j = num_kept, k = total;
+	while(j > 0)
+	{
+		if(i > 0 && cmp_entry(&idx->entries[i - 1], &kept[j - 1]) > 0)
+			idx->entries[--k] = idx->entries[--i];
+		else
+			idx->entries[--k] = kept[--j];
+	}
+	idx->num_entries = total;
+	*reused = num_kept;
+
+	free(kept);
+	return true;
+}
+
+// Build the bucket directory of the sorted entries
+static bool finalize_index(struct gravity_index *idx)
+{
+	// Use about one bucket per entry
+	unsigned int bits = MIN_BUCKET_BITS;
+	while(bits < MAX_BUCKET_BITS && (1ull << bits) < idx->num_entries)
+		bits++;
+	idx->bucket_bits = bits;
+
+	const size_t num_buckets = 1u << bits;
+	idx->buckets = calloc(num_buckets + 1u, sizeof(*idx->buckets));
+	if(idx->buckets == NULL)
+		return false;
+
+	// Store the offset of the first entry of every bucket
+	size_t i = 0;
+	for(size_t b = 0; b < num_buckets; b++)
+	{
+		idx->buckets[b] = i;
+		while(i < idx->num_entries && (idx->entries[i].hash >> (64u - bits)) == b)
+			i++;
+	}
+	idx->buckets[num_buckets] = idx->num_entries;
+
+	return true;
+}
+
+// Round up to a multiple of 64 bytes (one cache line)
+#define ALIGN64(x) (((x) + 63u) & ~(size_t)63u)
+
+// Offsets of the arrays of a sealed index relative to its first entry
+struct index_layout {
+	size_t buckets;
+	size_t sets;
+	size_t groups;
+	size_t strings;
+	size_t size;
+};
+
+static void get_layout(const size_t num_entries, const unsigned int bucket_bits, const size_t num_sets,
+                       const size_t words, const size_t num_groups, const size_t strings_size,
+                       struct index_layout *layout)
+{
+	layout->buckets = ALIGN64(num_entries * sizeof(struct gravity_index_entry));
+	layout->sets = layout->buckets + ALIGN64(((1u << bucket_bits) + 1u) * sizeof(uint32_t));
+	layout->groups = layout->sets + ALIGN64(num_sets * words * sizeof(uint64_t));
+	layout->strings = layout->groups + ALIGN64(num_groups * sizeof(int));
+	layout->size = layout->strings + ALIGN64(strings_size);
+}
+
+/**
+ * @brief Move all arrays of a finalized index into a single read-only shared
+ * anonymous mapping
+ *
+ * The mapping is inherited by forked TCP workers. As it is never written to
+ * again, no pages are ever copied. The heap arrays are freed on success.
+ */
+static bool seal_index(struct gravity_index *idx)
+{
+	struct index_layout layout;
+	get_layout(idx->num_entries, idx->bucket_bits, idx->num_sets, idx->words, idx->num_groups,
+	           idx->strings_size, &layout);
+	const size_t map_size = MAX(layout.size, 64u);
+
+	char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+	{
+		log_err("gravity_index_build(): Failed to map %zu bytes: %s", map_size, strerror(errno));
+		return false;
+	}
+
+	struct gravity_index_entry *entries = (void*)map;
+	uint32_t *buckets = (void*)(map + layout.buckets);
+	uint64_t *sets = (void*)(map + layout.sets);
+	int *groups = (void*)(map + layout.groups);
+	char *strings = map + layout.strings;
+
+	if(idx->num_entries > 0)
+		memcpy(entries, idx->entries, idx->num_entries * sizeof(*entries));
+	memcpy(buckets, idx->buckets, ((1u << idx->bucket_bits) + 1u) * sizeof(*buckets));
+	if(idx->num_sets > 0)
+		memcpy(sets, idx->sets, idx->num_sets * idx->words * sizeof(*sets));
+	if(idx->num_groups > 0)
+		memcpy(groups, idx->groups, idx->num_groups * sizeof(*groups));
+	if(idx->strings_size > 0)
+		memcpy(strings, idx->strings, idx->strings_size);
+
+	if(mprotect(map, map_size, PROT_READ) != 0)
+		log_warn("gravity_index_build(): Failed to make index read-only: %s", strerror(errno));
+
+	free(idx->entries);
+	free(idx->buckets);
+	free(idx->sets);
+	free(idx->groups);
+	if(idx->strings != NULL)
+		free(idx->strings);
+	idx->entries = entries;
+	idx->buckets = buckets;
+	idx->sets = sets;
+	idx->groups = groups;
+	idx->strings = strings;
+	idx->cap_entries = idx->num_entries;
+	idx->cap_sets = idx->num_sets;
+	idx->cap_strings = idx->strings_size;
+	idx->map = map;
+	idx->map_size = map_size;
+
+	return true;
+}
+
+// Compile an in-memory index from the gravity database
+static struct gravity_index *compile_index(sqlite3 *db)
+{
+	const double t0 = double_time();
+
+	struct gravity_index *idx = calloc(1, sizeof(*idx));
+	if(idx == NULL)
+		return NULL;
+
+	// The active index is only replaced by the database thread which is
+	// also the one compiling the next index, so it can safely be read here
+	const struct gravity_index *prev = gindex;
+	size_t reused_lists = 0u, reused_entries = 0u;
+
+	bool okay = read_enabled_groups(db, idx) &&
+	            read_adlists(db, idx);
+	if(okay)
+	{
+		qsort(idx->owners, idx->num_owners, sizeof(*idx->owners), cmp_owner);
+		reused_lists = reuse_adlists(idx, prev);
+		okay = read_domainlist(db, idx) &&
+		       read_gravity(db, idx, true) &&
+		       read_gravity(db, idx, false) &&
+		       sort_entries(idx, reused_lists > 0u ? prev : NULL, &reused_entries) &&
+		       finalize_index(idx) &&
+		       seal_index(idx);
+	}
+
+	if(!okay)
+	{
+		log_err("Failed to compile gravity index, falling back to database lookups");
+		free_index(idx);
+		return NULL;
+	}
+
+	idx->build_time = 1e3*(double_time() - t0);
+
+	char prefix[2] = { 0 };
+	double formatted = 0.0;
+	format_memory_size(prefix, index_memsize(idx), &formatted);
+	if(reused_lists > 0u)
+		log_info("Compiled gravity index with %zu entries (%.1f %sB) in %.1f msec, reused %zu entries of %zu unchanged adlist%s",
+		         idx->num_entries, formatted, prefix, idx->build_time, reused_entries,
+		         reused_lists, reused_lists == 1 ? "" : "s");
+	else
+		log_info("Compiled gravity index with %zu entries (%.1f %sB) in %.1f msec",
+		         idx->num_entries, formatted, prefix, idx->build_time);
+
+	return idx;
+}
+
+// Checksum of the sections of an index file. They are aligned to and sized in
+// multiples of 64 bytes
+static uint64_t __attribute__((pure)) file_checksum(const void *data, const size_t size)
+{
+	const uint64_t *words = data;
+	uint64_t h = FNV64_OFFSET;
+	for(size_t i = 0; i < size / sizeof(*words); i++)
+		h = (h ^ words[i]) * FNV64_PRIME;
+
+	return gravity_hash_finalize(h);
+}
+
+// Get the state of a gravity database. The file change counter and the page
+// count in its header are updated by every write transaction (the database
+// is not used in WAL mode)
+static bool get_db_stamp(const char *dbfile, uint8_t db_header[8], uint64_t *db_size)
+{
+	const int fd = open(dbfile, O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	uint8_t header[32];
+	struct stat st;
+	const bool okay = fstat(fd, &st) == 0 &&
+	                  pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+	                  memcmp(header, "SQLite format 3", 16) == 0;
+	close(fd);
+	if(!okay)
+		return false;
+
+	memcpy(db_header, header + 24, 8);
+	*db_size = st.st_size;
+
+	return true;
+}
+
+// Map the index file written by pihole -g if it matches the current state of
+// the gravity database. Returns NULL if there is none or it cannot be used
+static struct gravity_index *load_index_file(const char *dbfile)
+{
+	const double t0 = double_time();
+
+	char *path = NULL;
+	if(asprintf(&path, "%s" GRAVITY_INDEX_SUFFIX, dbfile) < 0)
+		return NULL;
+
+	// No index file has been written for this database
+	const int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		log_debug(DEBUG_DATABASE, "No gravity index file %s: %s", path, strerror(errno));
+		free(path);
+		return NULL;
+	}
+
+	struct gravity_index *idx = NULL;
+	const char *reason = NULL;
+	const size_t header_size = ALIGN64(sizeof(struct gravity_index_header));
+	char *map = MAP_FAILED;
+	size_t size = 0u;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < header_size)
+		reason = "file too small";
+	else
+	{
+		size = st.st_size;
+		map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if(map == MAP_FAILED)
+			reason = strerror(errno);
+	}
+	close(fd);
+	if(reason != NULL)
+		goto end_of_load_index_file;
+
+	const struct gravity_index_header *header = (const void*)map;
+	uint8_t db_header[8] = { 0 };
+	uint64_t db_size = 0u;
+	struct index_layout layout = { 0 };
+	if(memcmp(header->magic, GRAVITY_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+	   header->version != GRAVITY_INDEX_VERSION ||
+	   header->entry_size != sizeof(struct gravity_index_entry) ||
+	   header->owner_size != sizeof(struct index_owner))
+		reason = "incompatible format";
+	else if(!get_db_stamp(dbfile, db_header, &db_size) ||
+	        memcmp(db_header, header->db_header, sizeof(db_header)) != 0 ||
+	        db_size != header->db_size)
+		reason = "database has been changed since";
+	else if(header->file_size != size ||
+	        header->bucket_bits < MIN_BUCKET_BITS || header->bucket_bits > MAX_BUCKET_BITS ||
+	        header->num_entries > UINT32_MAX || header->num_sets > MAX_GROUPSETS ||
+	        header->num_groups > size / sizeof(int) || header->num_owners > size / sizeof(struct index_owner) ||
+	        header->words != MAX(1u, (header->num_groups + 63u) / 64u) ||
+	        header->num_sets > size / sizeof(uint64_t) / header->words ||
+	        header->strings_size > size || header->strings_size > UINT32_MAX)
+		reason = "invalid header";
+	else
+	{
+		get_layout(header->num_entries, header->bucket_bits, header->num_sets,
+		           header->words, header->num_groups, header->strings_size, &layout);
+		if(header_size + layout.size + ALIGN64(header->num_owners * sizeof(struct index_owner)) != size)
+			reason = "invalid size";
+		else if(file_checksum(map + header_size, size - header_size) != header->checksum)
+			reason = "checksum mismatch";
+		// Domains are compared as strings, the last of them has to be
+		// terminated within the string table
+		else if(header->strings_size > 0u && map[header_size + layout.strings + header->strings_size - 1u] != '\0')
+			reason = "invalid string table";
+	}
+	if(reason != NULL)
+		goto end_of_load_index_file;
+
+	idx = calloc(1, sizeof(*idx));
+	if(idx == NULL)
+	{
+		reason = "out of memory";
+		goto end_of_load_index_file;
+	}
+	idx->entries = (void*)(map + header_size);
+	idx->num_entries = idx->cap_entries = header->num_entries;
+	idx->buckets = (void*)(map + header_size + layout.buckets);
+	idx->bucket_bits = header->bucket_bits;
+	idx->sets = (void*)(map + header_size + layout.sets);
+	idx->num_sets = idx->cap_sets = header->num_sets;
+	idx->words = header->words;
+	idx->groups = (void*)(map + header_size + layout.groups);
+	idx->num_groups = header->num_groups;
+	idx->strings = map + header_size + layout.strings;
+	idx->strings_size = idx->cap_strings = header->strings_size;
+
+	// The adlists are needed when the index is recompiled, they are the
+	// only part kept on the heap
+	if(header->num_owners > 0u)
+	{
+		idx->owners = calloc(header->num_owners, sizeof(*idx->owners));
+		if(idx->owners == NULL)
+		{
+			reason = "out of memory";
+			goto end_of_load_index_file;
+		}
+		memcpy(idx->owners, map + header_size + layout.size, header->num_owners * sizeof(*idx->owners));
+		idx->num_owners = header->num_owners;
+	}
+
+	if(idx->buckets[1u << idx->bucket_bits] != idx->num_entries)
+	{
+		reason = "invalid bucket directory";
+		goto end_of_load_index_file;
+	}
+
+	idx->map = map;
+	idx->map_size = size;
+	idx->build_time = 1e3*(double_time() - t0);
+
+	char prefix[2] = { 0 };
+	double formatted = 0.0;
+	format_memory_size(prefix, index_memsize(idx), &formatted);
+	log_info("Loaded gravity index with %zu entries (%.1f %sB) from %s in %.1f msec",
+	         idx->num_entries, formatted, prefix, path, idx->build_time);
+
+end_of_load_index_file:
+	if(reason != NULL)
+	{
+		log_info("Not using gravity index file %s: %s", path, reason);
+		if(idx != NULL)
+		{
+			// The arrays are part of the mapping unmapped below
+			idx->map = NULL;
+			idx->entries = NULL;
+			idx->buckets = NULL;
+			idx->sets = NULL;
+			idx->groups = NULL;
+			idx->strings = NULL;
+			free_index(idx);
+		}
+		if(map != MAP_FAILED)
+			munmap(map, size);
+	}
+	free(path);
+
+	return idx;
+}
+
+/**
+ * @brief Get an in-memory index of the gravity database
+ *
+ * The index file written by pihole -g is used if it matches the database,
+ * otherwise the index is compiled. This does not touch the currently active
+ * index and may hence run without holding the shared memory lock while the
+ * active index keeps serving lookups. Use gravity_index_publish() to activate
+ * the result.
+ *
+ * @param db Open gravity database connection (may be private to the caller)
+ * @return New index or NULL on error
+ */
+struct gravity_index *gravity_index_compile(sqlite3 *db)
+{
+	const char *dbfile = sqlite3_db_filename(db, "main");
+	if(dbfile != NULL && dbfile[0] != '\0')
+	{
+		struct gravity_index *idx = load_index_file(dbfile);
+		if(idx != NULL)
+			return idx;
+	}
+
+	return compile_index(db);
+}
+
+/**
+ * @brief Compile the index of a gravity database and write it to a file
+ *
+ * This is used at the end of pihole -g, FTL then maps the file instead of
+ * compiling the index itself as long as the database is not changed (see
+ * load_index_file()). The index is written to a temporary file first which is
+ * renamed afterwards so FTL never sees an incomplete file.
+ *
+ * @param dbfile Gravity database
+ * @param outfile Index file, NULL for the default next to the database
+ * @return true on success, false otherwise
+ */
+bool gravity_index_write(const char *dbfile, const char *outfile)
+{
+	struct gravity_index_header header = { 0 };
+	if(!get_db_stamp(dbfile, header.db_header, &header.db_size))
+	{
+		log_err("Unable to read gravity database %s", dbfile);
+		return false;
+	}
+
+	sqlite3 *db = NULL;
+	struct gravity_index *idx = NULL;
+	char *path = NULL, *tmp = NULL;
+	char *map = MAP_FAILED;
+	size_t size = 0u;
+	int fd = -1;
+	bool okay = false;
+
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		log_err("Unable to open gravity database %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_gravity_index_write;
+	}
+	idx = compile_index(db);
+	if(idx == NULL)
+		goto end_of_gravity_index_write;
+
+	// Refuse to write an index which may not match the database
+	uint8_t db_header[8] = { 0 };
+	uint64_t db_size = 0u;
+	if(!get_db_stamp(dbfile, db_header, &db_size) ||
+	   memcmp(db_header, header.db_header, sizeof(db_header)) != 0 ||
+	   db_size != header.db_size)
+	{
+		log_err("Gravity database %s has been changed while compiling its index", dbfile);
+		goto end_of_gravity_index_write;
+	}
+
+	if((outfile != NULL ? asprintf(&path, "%s", outfile) : asprintf(&path, "%s" GRAVITY_INDEX_SUFFIX, dbfile)) < 0 ||
+	   asprintf(&tmp, "%s.tmp", path) < 0)
+		goto end_of_gravity_index_write;
+
+	struct index_layout layout;
+	get_layout(idx->num_entries, idx->bucket_bits, idx->num_sets, idx->words, idx->num_groups,
+	           idx->strings_size, &layout);
+	const size_t header_size = ALIGN64(sizeof(header));
+	size = header_size + layout.size + ALIGN64(idx->num_owners * sizeof(*idx->owners));
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, size) != 0 ||
+	   (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		log_err("Unable to create gravity index file %s: %s", tmp, strerror(errno));
+		goto end_of_gravity_index_write;
+	}
+
+	// The sealed index is stored in exactly this layout
+	memcpy(map + header_size, idx->map, layout.size);
+	if(idx->num_owners > 0u)
+		memcpy(map + header_size + layout.size, idx->owners, idx->num_owners * sizeof(*idx->owners));
+
+	memcpy(header.magic, GRAVITY_INDEX_MAGIC, sizeof(header.magic));
+	header.version = GRAVITY_INDEX_VERSION;
+	header.entry_size = sizeof(struct gravity_index_entry);
+	header.owner_size = sizeof(struct index_owner);
+	header.bucket_bits = idx->bucket_bits;
+	header.file_size = size;
+	header.num_entries = idx->num_entries;
+	header.num_sets = idx->num_sets;
+	header.num_groups = idx->num_groups;
+	header.num_owners = idx->num_owners;
+	header.words = idx->words;
+	header.strings_size = idx->strings_size;
+	header.checksum = file_checksum(map + header_size, size - header_size);
+	memcpy(map, &header, sizeof(header));
+
+	if(msync(map, size, MS_SYNC) != 0 || fsync(fd) != 0 || rename(tmp, path) != 0)
+	{
+		log_err("Unable to write gravity index file %s: %s", path, strerror(errno));
+		goto end_of_gravity_index_write;
+	}
+
+	char prefix[2] = { 0 };
+	double formatted = 0.0;
+	format_memory_size(prefix, size, &formatted);
+	log_info("Wrote gravity index with %zu entries (%.1f %sB) to %s",
+	         idx->num_entries, formatted, prefix, path);
+	okay = true;
+
+end_of_gravity_index_write:
+	if(map != MAP_FAILED)
+		munmap(map, size);
+	if(fd >= 0)
+		close(fd);
+	if(!okay && tmp != NULL)
+		unlink(tmp);
+	free(path);
+	free(tmp);
+	free_index(idx);
+	sqlite3_close(db);
+
+	return okay;
+}
+
+/**
+ * @brief Replace the active index by a new one (which may be NULL)
+ *
+ * Lookups are only performed while holding the shared memory lock, so the
+ * caller must hold it, too. The previous index can then not be in use by
+ * anyone in this process and is unmapped immediately. Forks that still use it
+ * keep their own reference to the mapping. The caller is expected to
+ * increment the shared generation counter (see bump_gravity_generation())
+ * before publishing.
+ */
+void gravity_index_publish(struct gravity_index *idx)
+{
+	struct gravity_index *old = gindex;
+	gindex = idx;
+	generation = get_gravity_generation();
+	free_index(old);
+}
+
+/**
+ * @brief Get the generation of the active index
+ *
+ * The returned number changes whenever a new index is published and can be
+ * used to invalidate results derived from an older index.
+ */
+unsigned int __attribute__((pure)) gravity_index_generation(void)
+{
+	return generation;
+}
+
+/**
+ * @brief Compile a new index and activate it
+ *
+ * On failure, the previous index (if any) is freed as it may not be trusted
+ * any longer.
+ *
+ * @param db Open gravity database connection
+ * @return true on success, false otherwise
+ */
+bool gravity_index_build(sqlite3 *db)
+{
+	// Free the old index before compiling the new one to limit the peak
+	// memory usage
+	gravity_index_publish(NULL);
+	gravity_index_publish(gravity_index_compile(db));
+
+	return gindex != NULL;
+}
+
+void gravity_index_free(void)
+{
+	gravity_index_publish(NULL);
+}
+
+void gravity_index_discard(struct gravity_index *idx)
+{
+	free_index(idx);
+}
+
+/**
+ * @brief Check if the compiled index can be used
+ *
+ * The index is not used in forks created before the lists have been reloaded
+ * by the main process, they fall back to the database instead.
+ */
+bool __attribute__((pure)) gravity_index_ready(void)
+{
+	return gindex != NULL && generation == get_gravity_generation();
+}
+
+/**
+ * @brief Get the group bitmap of a client
+ *
+ * The comma-separated list of group IDs is translated into the bit layout of
+ * the current index once and cached until either the groups of the client
+ * change or the index is rebuilt.
+ *
+ * @param clientID ID of the client
+ * @param groupspos String position of the client's comma-separated group IDs
+ * @param groups The client's comma-separated group IDs
+ * @return Group bitmap, NULL if the index is not available or on memory errors
+ */
+const uint64_t *gravity_index_client_groups(const unsigned int clientID, const size_t groupspos, const char *groups)
+{
+	struct gravity_index *idx = gindex;
+	if(idx == NULL)
+		return NULL;
+
+	// Grow cache if needed
+	if(clientID >= idx->num_clients)
+	{
+		const size_t newnum = MAX(2*idx->num_clients, MAX(clientID + 1u, 64u));
+		struct client_groups *new_clients = realloc(idx->clients, newnum * sizeof(*new_clients));
+		if(new_clients == NULL)
+			return NULL;
+		idx->clients = new_clients;
+		uint64_t *new_bits = realloc(idx->client_bits, newnum * idx->words * sizeof(*new_bits));
+		if(new_bits == NULL)
+			return NULL;
+		idx->client_bits = new_bits;
+		memset(&idx->clients[idx->num_clients], 0, (newnum - idx->num_clients) * sizeof(*new_clients));
+		idx->num_clients = newnum;
+	}
+
+	struct client_groups *cg = &idx->clients[clientID];
+	uint64_t *bits = &idx->client_bits[clientID * idx->words];
+	// String positions are only meaningful within one string generation
+	const unsigned int string_generation = get_string_generation();
+	if(cg->valid && cg->groupspos == groupspos && cg->string_generation == string_generation)
+		return bits;
+
+	// Parse comma-separated group IDs
+	memset(bits, 0, idx->words * sizeof(*bits));
+	const char *p = groups;
+	while(*p != '\0')
+	{
+		int group_id = 0;
+		bool valid = false;
+		for(; *p >= '0' && *p <= '9'; p++)
+		{
+			group_id = 10*group_id + (*p - '0');
+			valid = true;
+		}
+
+		const int *pos = valid ? bsearch(&group_id, idx->groups, idx->num_groups, sizeof(*idx->groups), cmp_int) : NULL;
+		if(pos != NULL)
+		{
+			const size_t bit = pos - idx->groups;
+			bits[bit / 64u] |= 1ull << (bit % 64u);
+		}
+
+		// Skip separator(s)
+		while(*p != '\0' && (*p < '0' || *p > '9'))
+			p++;
+	}
+
+	cg->groupspos = groupspos;
+	cg->string_generation = string_generation;
+	cg->valid = true;
+
+	return bits;
+}
+
+// Check if the group bitmaps of an entry and a client intersect
+static bool __attribute__((pure)) groupset_matches(const struct gravity_index *idx, const uint32_t set, const uint64_t *groups)
+{
+	const uint64_t *bits = &idx->sets[set * idx->words];
+	for(unsigned int i = 0; i < idx->words; i++)
+		if(bits[i] & groups[i])
+			return true;
+
+	return false;
+}
+
+// Check if the domain of an entry is the one looked up. The hash alone is not
+// trusted as colliding domains can be crafted
+static bool __attribute__((pure)) name_matches(const struct gravity_index *idx, const struct gravity_index_entry *entry,
+                                               const char *name, const size_t len)
+{
+	if(entry->name >= idx->strings_size || idx->strings_size - entry->name <= len)
+		return false;
+
+	const char *s = idx->strings + entry->name;
+	return memcmp(s, name, len) == 0 && s[len] == '\0';
+}
+
+/**
+ * @brief Look up a domain in the compiled index
+ *
+ * @param domain Domain to look for (exact match)
+ * @param list List to search in
+ * @param groups Comma-separated list of the client's group IDs
+ * @param id Pointer to store the ID of the matching list into (may be NULL),
+ *           this is -1 if the domain was not found
+ * @return FOUND, NOT_FOUND, or LIST_NOT_AVAILABLE if there is no index
+ */
+enum db_result gravity_index_lookup(const char *domain, const enum gravity_index_list list,
+                                    const uint64_t *groups, int *id)
+{
+	return gravity_index_lookup_hash(gravity_hash(domain), domain, strlen(domain), list, groups, id);
+}
+
+/**
+ * @brief Look up a precomputed hash (see gravity_entry_hash()) in the index
+ *
+ * @param hash Hash of the domain
+ * @param name Domain the hash has been computed for (the domain part of
+ * ABP-style patterns), it does not need to be terminated after len characters
+ * @param len Length of the domain
+ */
+enum db_result gravity_index_lookup_hash(const uint64_t hash, const char *name, const size_t len,
+                                         const enum gravity_index_list list,
+                                         const uint64_t *groups, int *id)
+{
+	if(id != NULL)
+		*id = -1;
+
+	const struct gravity_index *idx = gindex;
+	if(idx == NULL || groups == NULL)
+		return LIST_NOT_AVAILABLE;
+
+	const uint64_t bucket = hash >> (64u - idx->bucket_bits);
+	for(uint32_t i = idx->buckets[bucket]; i < idx->buckets[bucket + 1]; i++)
+	{
+		const struct gravity_index_entry *entry = &idx->entries[i];
+
+		// Entries are sorted by hash, then by list
+		if(entry->hash < hash || (entry->hash == hash && entry->list < list))
+			continue;
+		if(entry->hash > hash || entry->list > list)
+			break;
+
+		if(!groupset_matches(idx, entry->set, groups) ||
+		   !name_matches(idx, entry, name, len))
+			continue;
+
+		if(id != NULL)
+			*id = entry->id;
+
+		return FOUND;
+	}
+
+	return NOT_FOUND;
+}
+
+/**
+ * @brief Look up a precomputed hash on all lists at once
+ *
+ * All entries of one hash are stored next to each other (sorted by list, then
+ * by ID) so a single probe answers for every list.
+ *
+ * @param hash Hash of the domain (see gravity_entry_hash())
+ * @param domain Domain the hash has been computed for
+ * @param groups Group bitmap of the client
+ * @param ids Array receiving the ID of the first matching entry of every
+ * list (-1 if there is none)
+ * @param found Set to a bitmask of the lists with matches (1 << list)
+ * @return FOUND if any list matched, NOT_FOUND or LIST_NOT_AVAILABLE otherwise
+ */
+enum db_result gravity_index_lookup_all(const uint64_t hash, const char *domain, const uint64_t *groups,
+                                        int ids[GRAVITY_INDEX_LISTS], unsigned int *found)
+{
+	*found = 0u;
+	for(unsigned int i = 0; i < GRAVITY_INDEX_LISTS; i++)
+		ids[i] = -1;
+
+	const struct gravity_index *idx = gindex;
+	if(idx == NULL || groups == NULL)
+		return LIST_NOT_AVAILABLE;
+
+	const size_t len = strlen(domain);
+	const uint64_t bucket = hash >> (64u - idx->bucket_bits);
+	for(uint32_t i = idx->buckets[bucket]; i < idx->buckets[bucket + 1]; i++)
+	{
+		const struct gravity_index_entry *entry = &idx->entries[i];
+
+		// Entries are sorted by hash
+		if(entry->hash < hash)
+			continue;
+		if(entry->hash > hash)
+			break;
+
+		// Only the first match of each list is of interest
+		const unsigned int bit = 1u << entry->list;
+		if((*found & bit) || !groupset_matches(idx, entry->set, groups) ||
+		   !name_matches(idx, entry, domain, len))
+			continue;
+
+		*found |= bit;
+		ids[entry->list] = entry->id;
+	}
+
+	return *found != 0u ? FOUND : NOT_FOUND;
+}
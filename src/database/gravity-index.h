@@ -0,0 +1,155 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Compiled gravity index prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef GRAVITY_INDEX_H
+#define GRAVITY_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+// uint64_t
+#include <stdint.h>
+// enum db_result
+#include "enums.h"
+// sqlite3
+#include "database/sqlite3.h"
+
+// Lists covered by the compiled gravity index. The order is used to sort
+// entries with identical hashes and must not be changed without care
+enum gravity_index_list {
+	GRAVITY_INDEX_ALLOW,
+	GRAVITY_INDEX_DENY,
+	GRAVITY_INDEX_ANTIGRAVITY,
+	GRAVITY_INDEX_GRAVITY,
+	GRAVITY_INDEX_LISTS
+} __attribute__ ((packed));
+
+// FNV-1a 64 bit parameters
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+/**
+ * @brief Mix the bits of a 64-bit hash (splitmix64 finalizer)
+ *
+ * FNV-1a alone does not distribute short inputs well across the most
+ * significant bits which are used to address buckets.
+ */
+static inline uint64_t __attribute__((const)) gravity_hash_finalize(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+/**
+ * @brief Hash a domain (or ABP pattern) the way the gravity index and the
+ * gravity prefilter expect it
+ */
+static inline uint64_t __attribute__((pure)) gravity_hash(const char *s)
+{
+	uint64_t h = FNV64_OFFSET;
+	for(; *s; s++)
+	{
+		h ^= (unsigned char)*s;
+		h *= FNV64_PRIME;
+	}
+	return gravity_hash_finalize(h);
+}
+
+/**
+ * @brief Same as gravity_hash() for strings which are not NUL-terminated
+ */
+static inline uint64_t __attribute__((pure)) gravity_hash_len(const char *s, size_t len)
+{
+	uint64_t h = FNV64_OFFSET;
+	for(; len > 0; s++, len--)
+	{
+		h ^= (unsigned char)*s;
+		h *= FNV64_PRIME;
+	}
+	return gravity_hash_finalize(h);
+}
+
+// Tags used to separate the hashes of ABP-style "||domain^" and
+// "@@||domain^" patterns from the hashes of exact domains
+#define ABP_HASH_TAG_GRAVITY 0x7c7c5eULL
+#define ABP_HASH_TAG_ANTIGRAVITY 0x40407c7c5eULL
+
+/**
+ * @brief Feed one more character into an ABP suffix hash
+ *
+ * ABP patterns are hashed from right to left (starting at the TLD) so that
+ * the hashes of all suffixes of a domain can be obtained in a single pass.
+ */
+static inline uint64_t __attribute__((const)) gravity_abp_step(const uint64_t h, const char c)
+{
+	return (h ^ (unsigned char)c) * FNV64_PRIME;
+}
+
+static inline uint64_t __attribute__((const)) gravity_abp_finalize(const uint64_t h, const bool antigravity)
+{
+	return gravity_hash_finalize(h ^ (antigravity ? ABP_HASH_TAG_ANTIGRAVITY : ABP_HASH_TAG_GRAVITY));
+}
+
+// File of a compiled index written by "pihole-FTL gravity compileIndex" at the
+// end of pihole -g. FTL maps it instead of compiling the index itself if it
+// matches the state of the gravity database. The header is followed by the
+// arrays of the index the way they are used in memory, each of them aligned
+// to 64 bytes
+#define GRAVITY_INDEX_MAGIC "FTLGIDX"
+#define GRAVITY_INDEX_VERSION 2u
+#define GRAVITY_INDEX_SUFFIX ".idx"
+
+struct gravity_index_header {
+	char magic[8];
+	uint32_t version;
+	// Sizes of the stored structures, they depend on the architecture
+	uint32_t entry_size;
+	uint32_t owner_size;
+	uint32_t bucket_bits;
+	uint64_t file_size;
+	// File change counter and page count of the gravity database (bytes
+	// 24-31 of its header) as well as its size at the time of compilation
+	uint8_t db_header[8];
+	uint64_t db_size;
+	uint64_t num_entries;
+	uint64_t num_sets;
+	uint64_t num_groups;
+	uint64_t num_owners;
+	uint64_t words;
+	uint64_t strings_size;
+	// Checksum of everything following the header
+	uint64_t checksum;
+};
+
+bool gravity_abp_unwrap(const char *pattern, const char **start, size_t *len, bool *antigravity);
+uint64_t gravity_entry_hash(const char *entry) __attribute__((pure));
+
+struct gravity_index;
+
+struct gravity_index *gravity_index_compile(sqlite3 *db) __attribute__((malloc));
+void gravity_index_publish(struct gravity_index *idx);
+void gravity_index_discard(struct gravity_index *idx);
+bool gravity_index_build(sqlite3 *db);
+bool gravity_index_write(const char *dbfile, const char *outfile);
+void gravity_index_free(void);
+bool gravity_index_ready(void) __attribute__((pure));
+const uint64_t *gravity_index_client_groups(const unsigned int clientID, const size_t groupspos, const char *groups);
+enum db_result gravity_index_lookup(const char *domain, const enum gravity_index_list list,
+                                    const uint64_t *groups, int *id);
+enum db_result gravity_index_lookup_hash(const uint64_t hash, const char *name, const size_t len,
+                                         const enum gravity_index_list list,
+                                         const uint64_t *groups, int *id);
+enum db_result gravity_index_lookup_all(const uint64_t hash, const char *domain, const uint64_t *groups,
+                                        int ids[GRAVITY_INDEX_LISTS], unsigned int *found);
+unsigned int gravity_index_generation(void) __attribute__((pure));
+
+#endif //GRAVITY_INDEX_H
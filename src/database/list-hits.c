@@ -0,0 +1,293 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-list hit counters
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file list-hits.c
+* @brief Number of queries decided by each adlist and domainlist entry.
+*
+* Queries are counted in shared memory for the list which allowed or blocked
+* them (the list_id also stored with the query). The DB thread adds the new
+* hits to the list_hits table of the on-disk database every
+* database.DBinterval seconds and they are loaded back into shared memory when
+* FTL starts. Lists which never blocked anything can hence be found without
+* scanning the stored queries.
+*/
+
+#include "FTL.h"
+#include "database/list-hits.h"
+#include "database/common.h"
+// lock_shm()
+#include "shmem.h"
+#include "log.h"
+
+// Add hits to the ones already stored
+#define LIST_HITS_UPSERT "INSERT INTO list_hits (list_id, hits, last_hit) VALUES (?1, ?2, ?3) " \
+                         "ON CONFLICT (list_id) DO UPDATE SET hits = hits + excluded.hits, " \
+                                                             "last_hit = MAX(last_hit, excluded.last_hit);"
+
+listHitsData *list_hits = NULL;
+
+// Serializes storing by the DB thread and the final update on shutdown
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Hits taken from the shared memory to be stored
+struct list_hits_store {
+	unsigned int slot;
+	int list_id;
+	uint64_t pending;
+	double last_hit;
+};
+
+/**
+ * Find the slot of a list. The caller has to hold the SHM lock.
+ *
+ * @param list_id ID of the list
+ * @param add Use a free slot if the list has none so far
+ * @return The slot or NULL if the list has none (and none is free)
+ */
+static struct list_hits_slot *find_slot(const int list_id, const bool add)
+{
+	if(list_hits == NULL)
+		return NULL;
+
+	const unsigned int start = ((uint32_t)list_id * 2654435761u) % LIST_HITS_SLOTS;
+	for(unsigned int i = 0; i < LIST_HITS_PROBES; i++)
+	{
+		struct list_hits_slot *slot = &list_hits->slot[(start + i) % LIST_HITS_SLOTS];
+		if(slot->used && slot->list_id == list_id)
+			return slot;
+		if(!slot->used)
+		{
+			// Slots are never freed, the list cannot be found further on
+			if(!add)
+				return NULL;
+			slot->used = true;
+			slot->list_id = list_id;
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Count a query allowed or blocked by the given list. The caller has to hold
+ * the SHM lock.
+ *
+ * @param list_id ID of the list, see ADLIST_HITS_ID()
+ * @param now Timestamp of the query
+ */
+void count_list_hit(const int list_id, const double now)
+{
+	struct list_hits_slot *slot = find_slot(list_id, true);
+	if(slot == NULL)
+	{
+		if(list_hits != NULL)
+			list_hits->dropped++;
+		return;
+	}
+
+	slot->hits++;
+	slot->pending++;
+	if(now > slot->last_hit)
+		slot->last_hit = now;
+}
+
+/**
+ * Get the number of queries decided by the given list. The caller has to hold
+ * the SHM lock.
+ *
+ * @param list_id ID of the list, see ADLIST_HITS_ID()
+ * @param hits Number of queries (0 if the list has never been hit)
+ * @param last_hit Timestamp of the most recent of these queries (0 if none)
+ * @return true if the list has been hit
+ */
+bool get_list_hits(const int list_id, uint64_t *hits, double *last_hit)
+{
+	const struct list_hits_slot *slot = find_slot(list_id, false);
+	*hits = slot != NULL ? slot->hits : 0;
+	*last_hit = slot != NULL ? slot->last_hit : 0.0;
+	return slot != NULL;
+}
+
+bool create_list_hits_table(sqlite3 *db)
+{
+	// Start transaction of database update
+	SQL_bool(db, "BEGIN TRANSACTION;");
+
+	// Create list hits table
+	SQL_bool(db, CREATE_LIST_HITS_TABLE);
+
+	// Start with the queries already in the database
+	SQL_bool(db, "INSERT INTO list_hits (list_id, hits, last_hit) "
+	             "SELECT list_id, COUNT(*), CAST(MAX(timestamp) AS INTEGER) FROM query_storage "
+	             "WHERE list_id IS NOT NULL AND list_id != -1 GROUP BY list_id;");
+
+	// Update database version to 24
+	if(!db_set_FTL_property(db, DB_VERSION, 24))
+	{
+		log_err("create_list_hits_table(): Failed to update database version!");
+		return false;
+	}
+
+	// Finish transaction
+	SQL_bool(db, "COMMIT");
+
+	return true;
+}
+
+/**
+ * Load the stored hits into shared memory. The caller has to hold the SHM
+ * lock.
+ *
+ * @param db The on-disk database
+ */
+void load_list_hits(sqlite3 *db)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT list_id, hits, last_hit FROM list_hits;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("load_list_hits(): SQL error prepare: %s", sqlite3_errstr(rc));
+		return;
+	}
+
+	unsigned int loaded = 0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		struct list_hits_slot *slot = find_slot(sqlite3_column_int(stmt, 0), true);
+		if(slot == NULL)
+			continue;
+
+		// Hits counted before the database was available are kept
+		slot->hits += sqlite3_column_int64(stmt, 1);
+		const double last_hit = sqlite3_column_double(stmt, 2);
+		if(last_hit > slot->last_hit)
+			slot->last_hit = last_hit;
+		loaded++;
+	}
+
+	if(rc != SQLITE_DONE)
+		log_err("load_list_hits(): SQL error step: %s", sqlite3_errstr(rc));
+
+	sqlite3_finalize(stmt);
+	log_debug(DEBUG_DATABASE, "Loaded hits of %u lists", loaded);
+}
+
+/**
+ * Add the hits counted since the last time to the list_hits table
+ *
+ * @param db The on-disk database
+ * @return true on success (or if there was nothing to store)
+ */
+bool store_list_hits(sqlite3 *db)
+{
+	if(list_hits == NULL)
+		return true;
+
+	pthread_mutex_lock(&store_lock);
+
+	// Take the pending hits while holding the lock, the database is written
+	// without it
+	struct list_hits_store *store = NULL;
+	sqlite3_stmt *stmt = NULL;
+	unsigned int num = 0, dropped = 0;
+	lock_shm();
+	for(unsigned int i = 0; i < LIST_HITS_SLOTS; i++)
+		if(list_hits->slot[i].used && list_hits->slot[i].pending > 0)
+			num++;
+	if(num > 0 && (store = calloc(num, sizeof(*store))) != NULL)
+	{
+		num = 0;
+		for(unsigned int i = 0; i < LIST_HITS_SLOTS; i++)
+		{
+			const struct list_hits_slot *slot = &list_hits->slot[i];
+			if(!slot->used || slot->pending == 0)
+				continue;
+			store[num].slot = i;
+			store[num].list_id = slot->list_id;
+			store[num].pending = slot->pending;
+			store[num].last_hit = slot->last_hit;
+			num++;
+		}
+	}
+	dropped = list_hits->dropped;
+	unlock_shm();
+
+	bool okay = num == 0;
+	if(num > 0 && store == NULL)
+		log_err("store_list_hits(): Failed to allocate memory");
+	if(store == NULL)
+		goto end;
+
+	int rc = SQLITE_OK;
+	if(dbquery(db, "BEGIN TRANSACTION;") != SQLITE_OK)
+		goto end;
+
+	if((rc = sqlite3_prepare_v2(db, LIST_HITS_UPSERT, -1, &stmt, NULL)) != SQLITE_OK)
+	{
+		log_err("store_list_hits(): SQL error prepare: %s", sqlite3_errstr(rc));
+		dbquery(db, "ROLLBACK;");
+		goto end;
+	}
+
+	for(unsigned int i = 0; i < num; i++)
+	{
+		if((rc = sqlite3_bind_int(stmt, 1, store[i].list_id)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_int64(stmt, 2, store[i].pending)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_int64(stmt, 3, (sqlite3_int64)store[i].last_hit)) != SQLITE_OK ||
+		   (rc = sqlite3_step(stmt)) != SQLITE_DONE)
+		{
+			log_err("store_list_hits(): Failed to store hits of list %d: %s",
+			        store[i].list_id, sqlite3_errstr(rc));
+			dbquery(db, "ROLLBACK;");
+			goto end;
+		}
+		sqlite3_reset(stmt);
+	}
+
+	if(dbquery(db, "COMMIT;") != SQLITE_OK)
+	{
+		dbquery(db, "ROLLBACK;");
+		goto end;
+	}
+
+	// Hits counted in the meantime remain pending
+	lock_shm();
+	for(unsigned int i = 0; i < num; i++)
+		list_hits->slot[store[i].slot].pending -= store[i].pending;
+	unlock_shm();
+
+	log_debug(DEBUG_DATABASE, "Stored hits of %u lists (%u hits not counted)", num, dropped);
+	okay = true;
+
+end:
+	if(stmt != NULL)
+		sqlite3_finalize(stmt);
+	if(store != NULL)
+		free(store);
+	pthread_mutex_unlock(&store_lock);
+	return okay;
+}
+
+// Store the hits counted since the DB thread stored them the last time, this
+// is called on shutdown
+void store_final_list_hits(void)
+{
+	if(FTLDBerror())
+		return;
+
+	sqlite3 *db = dbopen(false, false);
+	if(db == NULL)
+		return;
+
+	store_list_hits(db);
+	dbclose(&db);
+}
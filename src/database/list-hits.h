@@ -0,0 +1,55 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-list hit counters prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef LIST_HITS_H
+#define LIST_HITS_H
+
+#include <stdbool.h>
+// uint64_t
+#include <stdint.h>
+#include "sqlite3.h"
+
+// Lists which can be counted, further lists are not counted. A list is
+// assigned the first free one of LIST_HITS_PROBES consecutive slots
+#define LIST_HITS_SLOTS 8192u
+#define LIST_HITS_PROBES 64u
+
+// Lists are identified the same way as by the list_id column of the queries:
+// IDs of domainlist entries (exact domains and regex) are used as they are,
+// gravity list n is stored as -(n + 2)
+#define ADLIST_HITS_ID(id) (-1 * ((int)(id) + 2))
+
+#define CREATE_LIST_HITS_TABLE "CREATE TABLE list_hits ( list_id INTEGER PRIMARY KEY, " \
+                                                        "hits INTEGER NOT NULL, " \
+                                                        "last_hit INTEGER NOT NULL );"
+
+// Hits are pending until they have been added to the list_hits table
+struct list_hits_slot {
+	int list_id;
+	bool used;
+	uint64_t hits;
+	uint64_t pending;
+	double last_hit;
+};
+
+typedef struct {
+	struct list_hits_slot slot[LIST_HITS_SLOTS];
+	unsigned int dropped; // hits of lists for which no slot was free
+} listHitsData;
+
+extern listHitsData *list_hits;
+
+void count_list_hit(const int list_id, const double now);
+bool get_list_hits(const int list_id, uint64_t *hits, double *last_hit);
+bool create_list_hits_table(sqlite3 *db);
+void load_list_hits(sqlite3 *db);
+bool store_list_hits(sqlite3 *db);
+void store_final_list_hits(void);
+
+#endif // LIST_HITS_H
@@ -19,12 +19,10 @@
 #include "args.h"
 // cleanup()
 #include "daemon.h"
-// main_pid()
+// main_pid(), killed
 #include "signals.h"
 // struct config
 #include "config/config.h"
-// get_rate_limit_turnaround()
-#include "gc.h"
 // get_filesystem_details()
 #include "files.h"
 // get_memdb()
@@ -33,6 +31,8 @@
 #include "webserver/http-common.h"
 // GIT_HASH, FTL_ARCH
 #include "version.h"
+// counters
+#include "shmem.h"
 
 // Number of arguments in a variadic macro
 // Credit: https://stackoverflow.com/a/35693080/2087442
@@ -300,6 +300,366 @@ bool create_message_table(sqlite3 *db)
 	return true;
 }
 
+// Messages are not written to the database right away but queued in memory and
+// written by the database thread in one transaction per second. Identical
+// messages (same type and message text) are coalesced: Repetitions while a
+// message is still queued only update its arguments, repetitions within
+// MESSAGE_COALESCE_WINDOW seconds after it has been written are written again
+// once this window has passed
+#define MESSAGE_QUEUE_SIZE 64u
+#define MESSAGE_COALESCE_WINDOW 60.0
+#define MESSAGE_MAX_ARGS 5u
+
+union message_arg {
+	int i;
+	double d;
+	char *s;
+};
+
+struct queued_message {
+	enum message_type type;
+	bool used;
+	bool pending;
+	unsigned int count;
+	unsigned int nargs;
+	time_t timestamp;
+	// Time the message may be written (pending) or has been written
+	double due;
+	double written;
+	char *message;
+	union message_arg args[MESSAGE_MAX_ARGS];
+};
+
+static struct queued_message message_queue[MESSAGE_QUEUE_SIZE];
+static struct message_queue_stats message_stats = { 0 };
+static pthread_mutex_t message_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void get_message_queue_stats(struct message_queue_stats *stats)
+{
+	pthread_mutex_lock(&message_queue_lock);
+	*stats = message_stats;
+	pthread_mutex_unlock(&message_queue_lock);
+}
+
+static void free_message_args(const enum message_type type, union message_arg *args, const unsigned int nargs)
+{
+	for(unsigned int j = 0; j < nargs; j++)
+	{
+		if(message_blob_types[type][j] != SQLITE_TEXT || args[j].s == NULL)
+			continue;
+		free(args[j].s);
+		args[j].s = NULL;
+	}
+}
+
+static void clear_queued_message(struct queued_message *msg)
+{
+	free_message_args(msg->type, msg->args, msg->nargs);
+	if(msg->message != NULL)
+		free(msg->message);
+	memset(msg, 0, sizeof(*msg));
+}
+
+// Deep copy of a queued message so it can be written without holding the lock
+static bool copy_queued_message(struct queued_message *dst, const struct queued_message *src)
+{
+	*dst = *src;
+	if((dst->message = strdup(src->message)) == NULL)
+		return false;
+
+	for(unsigned int j = 0; j < src->nargs; j++)
+	{
+		if(message_blob_types[src->type][j] != SQLITE_TEXT || src->args[j].s == NULL)
+			continue;
+		if((dst->args[j].s = strdup(src->args[j].s)) == NULL)
+		{
+			// Do not free the strings we did not copy
+			dst->nargs = j;
+			clear_queued_message(dst);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Adjust the number of messages in the table after a successful write. Messages
+// written before the shared memory exists are removed by the flush on startup
+static void change_message_counts(const int total, const int dnsmasq_warn)
+{
+	if(counters == NULL)
+		return;
+
+	__atomic_add_fetch(&counters->messages.total, total, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&counters->messages.dnsmasq_warn, dnsmasq_warn, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Write messages to the message table in a single transaction. Older
+ * messages of the same type and message text are replaced.
+ *
+ * @param db The database connection.
+ * @param msgs The messages to be written.
+ * @param n The number of messages.
+ * @return true if all messages were written, false otherwise.
+ */
+static bool write_messages(sqlite3 *db, const struct queued_message *msgs, const unsigned int n)
+{
+	sqlite3_stmt *del = NULL, *ins = NULL;
+	bool okay = false;
+	int rc, total = 0, dnsmasq_warn = 0;
+
+	if(n == 0)
+		return true;
+
+	// dbquery() logs the reason for a failure
+	if((rc = dbquery(db, "BEGIN TRANSACTION")) != SQLITE_OK)
+		return false;
+
+	// Ensure there are no duplicates when adding messages
+	rc = sqlite3_prepare_v2(db, "DELETE FROM message WHERE type = ?1 AND message = ?2;", -1, &del, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("write_messages() - SQL error prepare DELETE: %s", sqlite3_errstr(rc));
+		goto end_of_write_messages;
+	}
+
+	rc = sqlite3_prepare_v2(db, "INSERT INTO message (timestamp,type,message,blob1,blob2,blob3,blob4,blob5) "
+	                            "VALUES (?1,?2,?3,?4,?5,?6,?7,?8);", -1, &ins, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("write_messages() - SQL error prepare INSERT: %s", sqlite3_errstr(rc));
+		goto end_of_write_messages;
+	}
+
+	for(unsigned int i = 0; i < n; i++)
+	{
+		const struct queued_message *msg = &msgs[i];
+		const char *type = get_message_type_str(msg->type);
+
+		if((rc = sqlite3_bind_text(del, 1, type, -1, SQLITE_STATIC)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_text(del, 2, msg->message, -1, SQLITE_STATIC)) != SQLITE_OK ||
+		   (rc = sqlite3_step(del)) != SQLITE_DONE)
+		{
+			log_err("write_messages(type=%s, message=%s) - SQL error DELETE: %s",
+			        type, msg->message, sqlite3_errstr(rc));
+			goto end_of_write_messages;
+		}
+		// Replacing a message does not change the number of messages
+		const int added = 1 - sqlite3_changes(db);
+		total += added;
+		if(msg->type == DNSMASQ_WARN_MESSAGE)
+			dnsmasq_warn += added;
+		sqlite3_reset(del);
+		sqlite3_clear_bindings(del);
+
+		if((rc = sqlite3_bind_int64(ins, 1, msg->timestamp)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_text(ins, 2, type, -1, SQLITE_STATIC)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_text(ins, 3, msg->message, -1, SQLITE_STATIC)) != SQLITE_OK)
+		{
+			log_err("write_messages(type=%s, message=%s) - Failed to bind: %s",
+			        type, msg->message, sqlite3_errstr(rc));
+			goto end_of_write_messages;
+		}
+
+		for(unsigned int j = 0; j < msg->nargs; j++)
+		{
+			const unsigned char datatype = message_blob_types[msg->type][j];
+			switch(datatype)
+			{
+				case SQLITE_INTEGER:
+					rc = sqlite3_bind_int(ins, 4 + j, msg->args[j].i);
+					break;
+
+				case SQLITE_FLOAT:
+					rc = sqlite3_bind_double(ins, 4 + j, msg->args[j].d);
+					break;
+
+				case SQLITE_TEXT:
+					rc = sqlite3_bind_text(ins, 4 + j, msg->args[j].s, -1, SQLITE_STATIC);
+					break;
+
+				case SQLITE_NULL: /* Fall through */
+				default:
+					rc = sqlite3_bind_null(ins, 4 + j);
+					break;
+			}
+
+			if(rc != SQLITE_OK)
+			{
+				log_err("write_messages(type=%s, message=%s) - Failed to bind argument %u (type %u): %s",
+				        type, msg->message, 4 + j, datatype, sqlite3_errstr(rc));
+				goto end_of_write_messages;
+			}
+		}
+
+		if((rc = sqlite3_step(ins)) != SQLITE_DONE)
+		{
+			log_err("Encountered error while trying to store message in long-term database: %s", sqlite3_errstr(rc));
+			goto end_of_write_messages;
+		}
+		sqlite3_reset(ins);
+		sqlite3_clear_bindings(ins);
+	}
+
+	okay = true;
+
+end_of_write_messages:
+	sqlite3_finalize(del);
+	sqlite3_finalize(ins);
+
+	if(okay)
+		okay = (rc = dbquery(db, "END TRANSACTION")) == SQLITE_OK;
+	else
+		dbquery(db, "ROLLBACK TRANSACTION");
+
+	if(okay)
+		change_message_counts(total, dnsmasq_warn);
+	else
+		checkFTLDBrc(rc);
+
+	return okay;
+}
+
+// Add a message to the queue, the queue takes ownership of its memory
+static void queue_message(struct queued_message *msg)
+{
+	pthread_mutex_lock(&message_queue_lock);
+
+	// Coalesce with a queued or recently written identical message, the
+	// most recent arguments win
+	for(unsigned int i = 0; i < MESSAGE_QUEUE_SIZE; i++)
+	{
+		struct queued_message *queued = &message_queue[i];
+		if(!queued->used || queued->type != msg->type || strcmp(queued->message, msg->message) != 0)
+			continue;
+
+		free_message_args(queued->type, queued->args, queued->nargs);
+		memcpy(queued->args, msg->args, sizeof(queued->args));
+		queued->nargs = msg->nargs;
+		queued->timestamp = msg->timestamp;
+		queued->count++;
+		if(!queued->pending)
+		{
+			queued->pending = true;
+			queued->due = queued->written + MESSAGE_COALESCE_WINDOW;
+		}
+		message_stats.coalesced++;
+		pthread_mutex_unlock(&message_queue_lock);
+
+		free(msg->message);
+		return;
+	}
+
+	// Use a free slot or replace the message written longest ago. Pending
+	// messages are never replaced
+	struct queued_message *slot = NULL;
+	for(unsigned int i = 0; i < MESSAGE_QUEUE_SIZE; i++)
+	{
+		struct queued_message *queued = &message_queue[i];
+		if(!queued->used)
+		{
+			slot = queued;
+			break;
+		}
+		if(!queued->pending && (slot == NULL || queued->written < slot->written))
+			slot = queued;
+	}
+
+	if(slot == NULL)
+	{
+		message_stats.dropped++;
+		pthread_mutex_unlock(&message_queue_lock);
+		log_debug(DEBUG_DATABASE, "Message queue full, dropping message (type=%s, message=%s)",
+		          get_message_type_str(msg->type), msg->message);
+		clear_queued_message(msg);
+		return;
+	}
+
+	clear_queued_message(slot);
+	*slot = *msg;
+	slot->used = true;
+	slot->pending = true;
+	slot->due = 0.0;
+	message_stats.queued++;
+	pthread_mutex_unlock(&message_queue_lock);
+}
+
+// Check if there are queued messages to be written. If all is false, messages
+// deferred by the coalescing window are only considered once it has passed
+bool messages_pending(const bool all)
+{
+	const double now = double_time();
+	bool pending = false;
+
+	pthread_mutex_lock(&message_queue_lock);
+	for(unsigned int i = 0; i < MESSAGE_QUEUE_SIZE && !pending; i++)
+		pending = message_queue[i].pending && (all || message_queue[i].due <= now);
+	pthread_mutex_unlock(&message_queue_lock);
+
+	return pending;
+}
+
+/**
+ * @brief Write all due queued messages to the database in one transaction.
+ * Messages written longer than the coalescing window ago are forgotten.
+ *
+ * @param db The database connection.
+ * @param all Also write messages deferred by the coalescing window.
+ */
+void flush_message_queue(sqlite3 *db, const bool all)
+{
+	struct queued_message batch[MESSAGE_QUEUE_SIZE];
+	unsigned int n = 0;
+	const double now = double_time();
+
+	pthread_mutex_lock(&message_queue_lock);
+	for(unsigned int i = 0; i < MESSAGE_QUEUE_SIZE; i++)
+	{
+		struct queued_message *msg = &message_queue[i];
+		if(!msg->used)
+			continue;
+
+		if(msg->pending && (all || msg->due <= now))
+		{
+			// Keep the message queued if it cannot be copied
+			if(!copy_queued_message(&batch[n], msg))
+				continue;
+
+			msg->pending = false;
+			msg->written = now;
+			n++;
+		}
+		else if(!msg->pending && now - msg->written > MESSAGE_COALESCE_WINDOW)
+			clear_queued_message(msg);
+	}
+	pthread_mutex_unlock(&message_queue_lock);
+
+	if(n > 0)
+	{
+		if(!write_messages(db, batch, n))
+			log_err("Failed to write %u queued message%s", n, n == 1 ? "" : "s");
+		else
+			log_debug(DEBUG_DATABASE, "Wrote %u queued message%s", n, n == 1 ? "" : "s");
+	}
+
+	for(unsigned int i = 0; i < n; i++)
+		clear_queued_message(&batch[i]);
+}
+
+// Forget about written messages so identical messages are written again right
+// away after they have been deleted from the database
+static void forget_written_messages(void)
+{
+	pthread_mutex_lock(&message_queue_lock);
+	for(unsigned int i = 0; i < MESSAGE_QUEUE_SIZE; i++)
+	{
+		if(message_queue[i].used && !message_queue[i].pending)
+			clear_queued_message(&message_queue[i]);
+	}
+	pthread_mutex_unlock(&message_queue_lock);
+}
+
 // Flush message table
 bool flush_message_table(void)
 {
@@ -307,6 +667,9 @@ bool flush_message_table(void)
 
 	// Flush message table
 	SQL_bool(memdb, "DELETE FROM disk.message;");
+	__atomic_store_n(&counters->messages.total, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&counters->messages.dnsmasq_warn, 0, __ATOMIC_RELAXED);
+	forget_written_messages();
 
 	return true;
 }
@@ -316,6 +679,7 @@ static int _add_message(const enum message_type type,
 #define add_message(type, message, ...) _add_message(type, message, PP_NARG(__VA_ARGS__), __VA_ARGS__)
 #define add_message_no_args(type, message) _add_message(type, message, 0)
 
+// Returns 0 if the message has been queued or written, -1 on error
 static int _add_message(const enum message_type type,
                         const char *message, const size_t count,...)
 {
@@ -323,7 +687,6 @@ static int _add_message(const enum message_type type,
 	if(cli_mode)
 		return -1;
 
-	int rowid = -1;
 	// Return early if database is known to be broken
 	if(FTLDBerror())
 		return -1;
@@ -338,10 +701,10 @@ static int _add_message(const enum message_type type,
 
 	// Check if number of arguments is valid
 	// Total number of arguments
-	if(count > 5)
+	if(count > MESSAGE_MAX_ARGS)
 	{
-		log_err("add_message(type=%u, message=%s) - Too many arguments (%zu), expected at most 5",
-		        type, message, count);
+		log_err("add_message(type=%u, message=%s) - Too many arguments (%zu), expected at most %u",
+		        type, message, count, MESSAGE_MAX_ARGS);
 		return -1;
 	}
 	// No arguments check
@@ -359,148 +722,68 @@ static int _add_message(const enum message_type type,
 		return -1;
 	}
 
-	sqlite3 *db;
-	// Open database connection
-	if((db = dbopen(false, false)) == NULL)
-		// Reason for failure is logged in dbopen()
+	struct queued_message msg = { 0 };
+	msg.type = type;
+	msg.count = 1;
+	msg.timestamp = time(NULL);
+	if((msg.message = strdup(message)) == NULL)
 		return -1;
 
-	// Ensure there are no duplicates when adding messages
-	sqlite3_stmt* stmt = NULL;
-	const char *querystr = "DELETE FROM message WHERE type = ?1 AND message = ?2";
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
-	if( rc != SQLITE_OK ){
-		log_err("add_message(type=%u, message=%s) - SQL error prepare DELETE: %s",
-		        type, message, sqlite3_errstr(rc));
-		goto end_of_add_message;
-	}
-
-	// Bind type to prepared statement
-	if((rc = sqlite3_bind_text(stmt, 1, get_message_type_str(type), -1, SQLITE_STATIC)) != SQLITE_OK)
-	{
-		log_err("add_message(type=%u, message=%s) - Failed to bind type DELETE: %s",
-			type, message, sqlite3_errstr(rc));
-		sqlite3_reset(stmt);
-		sqlite3_finalize(stmt);
-		goto end_of_add_message;
-	}
-
-	// Bind message to prepared statement
-	if((rc = sqlite3_bind_text(stmt, 2, message, -1, SQLITE_STATIC)) != SQLITE_OK)
-	{
-		log_err("add_message(type=%u, message=%s) - Failed to bind message DELETE: %s",
-			type, message, sqlite3_errstr(rc));
-		sqlite3_reset(stmt);
-		sqlite3_finalize(stmt);
-		goto end_of_add_message;
-	}
-
-	// Execute and finalize
-	if((rc = sqlite3_step(stmt)) != SQLITE_OK && rc != SQLITE_DONE)
-	{
-		log_err("add_message(type=%u, message=%s) - SQL error step DELETE: %s",
-			type, message, sqlite3_errstr(rc));
-		goto end_of_add_message;
-	}
-	sqlite3_clear_bindings(stmt);
-	sqlite3_reset(stmt);
-	sqlite3_finalize(stmt);
-	stmt = NULL;
-
-	// Prepare SQLite statement
-	querystr = "INSERT INTO message (timestamp,type,message,blob1,blob2,blob3,blob4,blob5) "
-	           "VALUES ((cast(strftime('%s', 'now') as int)),?,?,?,?,?,?,?);";
-	rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
-	if( rc != SQLITE_OK )
-	{
-		log_err("add_message(type=%u, message=%s) - SQL error prepare: %s",
-		        type, message, sqlite3_errstr(rc));
-		goto end_of_add_message;
-	}
-
-	// Bind type to prepared statement
-	if((rc = sqlite3_bind_text(stmt, 1, get_message_type_str(type), -1, SQLITE_STATIC)) != SQLITE_OK)
-	{
-		log_err("add_message(type=%u, message=%s) - Failed to bind type: %s",
-		        type, message, sqlite3_errstr(rc));
-		sqlite3_reset(stmt);
-		sqlite3_finalize(stmt);
-		goto end_of_add_message;
-	}
-
-	// Bind message to prepared statement
-	if((rc = sqlite3_bind_text(stmt, 2, message, -1, SQLITE_STATIC)) != SQLITE_OK)
-	{
-		log_err("add_message(type=%u, message=%s) - Failed to bind message: %s",
-		        type, message, sqlite3_errstr(rc));
-		sqlite3_reset(stmt);
-		sqlite3_finalize(stmt);
-		goto end_of_add_message;
-	}
-
+	// Copy the arguments, strings may be gone by the time the message is
+	// written
 	va_list ap;
 	va_start(ap, count);
-	for (size_t j = 0; j < count; j++)
+	for(size_t j = 0; j < count; j++)
 	{
-		const unsigned char datatype = message_blob_types[type][j];
-		switch (datatype)
+		switch(message_blob_types[type][j])
 		{
 			case SQLITE_INTEGER:
-				rc = sqlite3_bind_int(stmt, 3 + j, va_arg(ap, int));
+				msg.args[j].i = va_arg(ap, int);
 				break;
 
 			case SQLITE_FLOAT:
-				rc = sqlite3_bind_double(stmt, 3 + j, va_arg(ap, double));
+				msg.args[j].d = va_arg(ap, double);
 				break;
 
 			case SQLITE_TEXT:
-				rc = sqlite3_bind_text(stmt, 3 + j, va_arg(ap, char*), -1, SQLITE_STATIC);
+			{
+				const char *arg = va_arg(ap, char*);
+				msg.args[j].s = arg != NULL ? strdup(arg) : NULL;
 				break;
+			}
 
 			case SQLITE_NULL: /* Fall through */
 			default:
 				log_warn("add_message(type=%s, message=%s) - Excess property, binding NULL",
 				         get_message_type_str(type), message);
-				rc = sqlite3_bind_null(stmt, 3 + j);
 				break;
 		}
-
-		// Bind message to prepared statement
-		if(rc != SQLITE_OK)
-		{
-			log_err("add_message(type=%u, message=%s) - Failed to bind argument %zu (type %u): %s",
-			        type, message, 3 + j, datatype, sqlite3_errstr(rc));
-			sqlite3_reset(stmt);
-			sqlite3_finalize(stmt);
-			checkFTLDBrc(rc);
-			va_end(ap);
-			goto end_of_add_message;
-		}
+		msg.nargs = j + 1;
 	}
 	va_end(ap);
 
-	// Step and check if successful
-	rc = sqlite3_step(stmt);
-
-	if(rc != SQLITE_DONE)
+	// Forked TCP workers cannot hand messages over to the database thread
+	// of the main process. Messages logged during shutdown and critical
+	// dnsmasq configuration errors (FTL may be about to terminate) are
+	// written right away as well
+	if(getpid() != main_pid() || killed || type == DNSMASQ_CONFIG_MESSAGE)
 	{
-		log_err("Encountered error while trying to store message in long-term database: %s", sqlite3_errstr(rc));
-		checkFTLDBrc(rc);
-		goto end_of_add_message;
+		int rc = -1;
+		sqlite3 *db;
+		// Reason for failure is logged in dbopen()
+		if((db = dbopen(false, false)) != NULL)
+		{
+			if(write_messages(db, &msg, 1))
+				rc = 0;
+			dbclose(&db);
+		}
+		clear_queued_message(&msg);
+		return rc;
 	}
 
-	// Final database handling
-	sqlite3_clear_bindings(stmt);
-	sqlite3_reset(stmt);
-	sqlite3_finalize(stmt);
+	queue_message(&msg);
 
-	// Get row ID of the newly added message
-	rowid = sqlite3_last_insert_rowid(db);
-
-end_of_add_message: // Close database connection
-	dbclose(&db);
-
-	return rowid;
+	return 0;
 }
 
 bool delete_message(cJSON *ids, int *deleted)
@@ -518,7 +801,7 @@ bool delete_message(cJSON *ids, int *deleted)
 	}
 
 	sqlite3_stmt *res = NULL;
-	if(sqlite3_prepare_v2(db, "DELETE FROM message WHERE id = ?;", -1, &res, 0) != SQLITE_OK)
+	if(sqlite3_prepare_v2(db, "DELETE FROM message WHERE id = ? RETURNING type;", -1, &res, 0) != SQLITE_OK)
 	{
 		log_err("SQL error (%i): %s", sqlite3_errcode(db), sqlite3_errmsg(db));
 		return false;
@@ -532,15 +815,26 @@ bool delete_message(cJSON *ids, int *deleted)
 		const int idval = cJSON_GetNumberValue(id);
 		sqlite3_bind_int(res, 1, idval);
 
-		// Execute and finalize
-		if(sqlite3_step(res) != SQLITE_DONE)
+		// Execute and finalize, the type of the deleted message (if
+		// any) is returned
+		int rc;
+		int dnsmasq_warn = 0;
+		while((rc = sqlite3_step(res)) == SQLITE_ROW)
+		{
+			const char *type = (const char*)sqlite3_column_text(res, 0);
+			if(type != NULL && strcmp(type, get_message_type_str(DNSMASQ_WARN_MESSAGE)) == 0)
+				dnsmasq_warn++;
+		}
+		if(rc != SQLITE_DONE)
 		{
 			log_err("SQL error (%i): %s", sqlite3_errcode(db), sqlite3_errmsg(db));
 			return false;
 		}
 
 		// Add to deleted count
-		*deleted += sqlite3_changes(db);
+		const int changes = sqlite3_changes(db);
+		*deleted += changes;
+		change_message_counts(-changes, -dnsmasq_warn);
 
 		sqlite3_reset(res);
 		sqlite3_clear_bindings(res);
@@ -550,6 +844,9 @@ bool delete_message(cJSON *ids, int *deleted)
 	// Close database connection
 	dbclose(&db);
 
+	// Deleted messages are written again when they occur the next time
+	forget_written_messages();
+
 	return true;
 }
 
@@ -1018,47 +1315,18 @@ static void format_gravity_restored_message(char *plain, const int sizeof_plain,
 	}
 }
 
+// The message table is flushed on startup and all writes to it are accounted
+// for in the shared counters, so there is no need to query the database here
 int count_messages(const bool filter_dnsmasq_warnings)
 {
-	int count = 0;
-
 	if(FTLDBerror())
-		return count;
+		return 0;
 
-	sqlite3 *db;
-	// Open database connection
-	if((db = dbopen(false, false)) == NULL)
-	{
-		log_err("count_messages() - Failed to open DB");
-		return count;
-	}
+	int count = __atomic_load_n(&counters->messages.total, __ATOMIC_RELAXED);
+	if(filter_dnsmasq_warnings)
+		count -= __atomic_load_n(&counters->messages.dnsmasq_warn, __ATOMIC_RELAXED);
 
-	// Get message
-	sqlite3_stmt* stmt = NULL;
-	const char *querystr = filter_dnsmasq_warnings ?  "SELECT COUNT(*) FROM message WHERE type != 'DNSMASQ_WARN'" : "SELECT COUNT(*) FROM message";
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
-	if( rc != SQLITE_OK ){
-		log_err("count_messages() - SQL error prepare SELECT: %s",
-		        sqlite3_errstr(rc));
-		goto end_of_count_messages;
-	}
-
-	// Execute and finalize
-	rc = sqlite3_step(stmt);
-	if( rc != SQLITE_ROW ){
-		log_err("count_messages() - SQL error step SELECT: %s",
-		        sqlite3_errstr(rc));
-		goto end_of_count_messages;
-	}
-
-	// Get count
-	count = sqlite3_column_int(stmt, 0);
-
-end_of_count_messages: // Close database connection
-	sqlite3_finalize(stmt);
-	dbclose(&db);
-
-	return count;
+	return count > 0 ? count : 0;
 }
 
 bool format_messages(cJSON *array)
@@ -1426,10 +1694,8 @@ void logg_fatal_dnsmasq_message(const char *message)
 
 }
 
-void logg_rate_limit_message(const char *clientIP, const unsigned int rate_limit_count)
+void logg_rate_limit_message(const char *clientIP, const int turnaround)
 {
-	const int turnaround = get_rate_limit_turnaround(rate_limit_count);
-
 	// Create message
 	char buf[2048];
 	format_rate_limit_message(buf, sizeof(buf), NULL, 0, clientIP, config.dns.rateLimit.count.v.ui, config.dns.rateLimit.interval.v.ui, turnaround);
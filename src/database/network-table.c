@@ -23,6 +23,12 @@
 #include "resolve.h"
 // killed
 #include "signals.h"
+// nlneigh_subscribe()
+#include "tools/netlink.h"
+// set_event()
+#include "events.h"
+// poll()
+#include <poll.h>
 
 static char *getMACVendor(const char *hwaddr) __attribute__ ((malloc));
 enum arp_status { CLIENT_NOT_HANDLED, CLIENT_ARP_COMPLETE, CLIENT_ARP_INCOMPLETE } __attribute__ ((packed));
@@ -221,306 +227,814 @@ bool create_network_addresses_network_id_index(sqlite3 *db)
 	return true;
 }
 
-// Try to find device by recent usage of this IP address
-static int find_device_by_recent_ip(sqlite3 *db, const char *ipaddr)
+// Bounded cache of the network table lookups by IP address. Client discovery
+// and get_client_groupids() would otherwise open the database and run one
+// statement per lookup. Negative results are cached as well so new clients do
+// not trigger a database query for every lookup. Entries are invalidated by
+// parse_neighbor_cache() when the underlying rows change and expire after
+// NETWORK_CACHE_TTL seconds to catch changes made by anyone else
+#define NETWORK_CACHE_SLOTS 256u
+#define NETWORK_CACHE_TTL 300.0
+
+enum network_cache_field {
+	NETWORK_CACHE_MAC,
+	NETWORK_CACHE_NAME,
+	NETWORK_CACHE_IFACE,
+	NETWORK_CACHE_ALIAS,
+	NETWORK_CACHE_FIELDS
+} __attribute__ ((packed));
+
+struct network_cache_entry {
+	char ip[INET6_ADDRSTRLEN];
+	uint32_t hash;
+	double last_used;
+	// Time a field was stored, zero if not cached
+	double stored[NETWORK_CACHE_FIELDS];
+	char *str[NETWORK_CACHE_FIELDS];
+	int aliasclient_id;
+};
+
+static struct network_cache_entry network_cache[NETWORK_CACHE_SLOTS];
+static pthread_mutex_t network_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void network_cache_clear(struct network_cache_entry *entry)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
-		return -1;
+	for(unsigned int i = 0; i < NETWORK_CACHE_FIELDS; i++)
+		if(entry->str[i] != NULL)
+			free(entry->str[i]);
+	memset(entry, 0, sizeof(*entry));
+}
 
-	const char *querystr = "SELECT network_id FROM network_addresses "
-	                       "WHERE ip = ?1 AND "
-	                       "lastSeen > (cast(strftime('%%s', 'now') as int)-86400) "
-	                       "ORDER BY lastSeen DESC LIMIT 1;";
+static struct network_cache_entry *network_cache_find(const char *ipaddr, const uint32_t hash)
+{
+	for(unsigned int i = 0; i < NETWORK_CACHE_SLOTS; i++)
+		if(network_cache[i].ip[0] != '\0' && network_cache[i].hash == hash &&
+		   strcmp(network_cache[i].ip, ipaddr) == 0)
+			return &network_cache[i];
+	return NULL;
+}
 
-	// Perform SQL query
-	int network_id = db_query_int_str(db, querystr, ipaddr);
+/**
+ * @brief Looks up a cached network table result for an IP address.
+ *
+ * @param ipaddr The IP address to look up.
+ * @param field The lookup the result belongs to.
+ * @param str Pointer to store a copy of a cached string (may be NULL when the
+ * lookup had no result), the caller needs to free it.
+ * @param num Pointer to store a cached aliasclient ID.
+ * @return true if a valid result was cached, false otherwise.
+ */
+static bool network_cache_get(const char *ipaddr, const enum network_cache_field field, char **str, int *num)
+{
+	const uint32_t hash = hashStr(ipaddr);
+	const double now = double_time();
+	bool found = false;
 
-	if(network_id == DB_FAILED)
+	pthread_mutex_lock(&network_cache_lock);
+	struct network_cache_entry *entry = network_cache_find(ipaddr, hash);
+	if(entry != NULL && entry->stored[field] > 0.0 && now - entry->stored[field] < NETWORK_CACHE_TTL)
 	{
-		// SQLite error
-		return -1;
+		entry->last_used = now;
+		if(str != NULL)
+			*str = entry->str[field] != NULL ? strdup(entry->str[field]) : NULL;
+		if(num != NULL)
+			*num = entry->aliasclient_id;
+		found = true;
+	}
+	pthread_mutex_unlock(&network_cache_lock);
+
+	return found;
+}
+
+// Store the result of a network table lookup, the least recently used entry is
+// replaced if the cache is full
+static void network_cache_put(const char *ipaddr, const enum network_cache_field field, const char *str, const int num)
+{
+	// Do not cache anything that cannot be a valid IP address
+	if(strlen(ipaddr) >= INET6_ADDRSTRLEN)
+		return;
+
+	const uint32_t hash = hashStr(ipaddr);
+	const double now = double_time();
+
+	pthread_mutex_lock(&network_cache_lock);
+	struct network_cache_entry *entry = network_cache_find(ipaddr, hash);
+	if(entry == NULL)
+	{
+		// Take the least recently used slot (unused slots have never
+		// been used)
+		entry = &network_cache[0];
+		for(unsigned int i = 1; i < NETWORK_CACHE_SLOTS; i++)
+			if(network_cache[i].last_used < entry->last_used)
+				entry = &network_cache[i];
+
+		network_cache_clear(entry);
+		strcpy(entry->ip, ipaddr);
+		entry->hash = hash;
+	}
+
+	if(entry->str[field] != NULL)
+		free(entry->str[field]);
+	entry->str[field] = str != NULL ? strdup(str) : NULL;
+	if(field == NETWORK_CACHE_ALIAS)
+		entry->aliasclient_id = num;
+	entry->stored[field] = now;
+	entry->last_used = now;
+	pthread_mutex_unlock(&network_cache_lock);
+}
+
+// Forget everything cached about an IP address
+static void network_cache_invalidate(const char *ipaddr)
+{
+	const uint32_t hash = hashStr(ipaddr);
+
+	pthread_mutex_lock(&network_cache_lock);
+	struct network_cache_entry *entry = network_cache_find(ipaddr, hash);
+	if(entry != NULL)
+		network_cache_clear(entry);
+	pthread_mutex_unlock(&network_cache_lock);
+}
+
+// Forget everything cached, used after changes affecting many devices
+void network_cache_flush(void)
+{
+	pthread_mutex_lock(&network_cache_lock);
+	for(unsigned int i = 0; i < NETWORK_CACHE_SLOTS; i++)
+		network_cache_clear(&network_cache[i]);
+	pthread_mutex_unlock(&network_cache_lock);
+}
+
+// In-memory mirror of the network and network_addresses tables. It is loaded
+// once at the beginning of parse_neighbor_cache() so looking up devices does
+// not need one SQL query per client. Changes to existing rows are collected in
+// memory and only the changed rows are written back at the end of the run.
+// Adding and un-mocking devices is rare and, hence, done immediately
+struct netmap_device {
+	int id;
+	int next;
+	uint32_t hash;
+	bool dirty;
+	// Set when a change affects the results of the lookups by IP
+	bool changed;
+	char *hwaddr;
+	char *iface;
+	time_t firstSeen;
+	time_t lastQuery;
+	unsigned int numQueries;
+};
+
+struct netmap_address {
+	int network_id;
+	int device;
+	int next;
+	uint32_t hash;
+	bool dirty;
+	bool changed;
+	char *ip;
+	char *name;
+	time_t lastSeen;
+	time_t nameUpdated;
+};
+
+struct netmap {
+	struct netmap_device *devices;
+	struct netmap_address *addresses;
+	unsigned int num_devices;
+	unsigned int num_addresses;
+	unsigned int size_devices;
+	unsigned int size_addresses;
+	// Both hash tables use the same number of buckets (always a power of two)
+	unsigned int buckets;
+	int *device_buckets;
+	int *address_buckets;
+};
+
+// Hardware addresses are compared case-insensitively (COLLATE NOCASE)
+static uint32_t hwaddr_hash(const char *hwaddr)
+{
+	char buffer[128];
+	strncpy(buffer, hwaddr, sizeof(buffer)-1);
+	buffer[sizeof(buffer)-1] = '\0';
+	return strtolower_hash(buffer);
+}
+
+/**
+ * @brief Rebuilds both hash tables of the network mirror with a new number of
+ * buckets.
+ *
+ * @param map Pointer to the network mirror.
+ * @param buckets The new number of buckets, must be a power of two.
+ * @return true on success, false if memory allocation failed.
+ */
+static bool netmap_rehash(struct netmap *map, const unsigned int buckets)
+{
+	int *device_buckets = malloc(buckets * sizeof(int));
+	int *address_buckets = malloc(buckets * sizeof(int));
+	if(device_buckets == NULL || address_buckets == NULL)
+	{
+		log_err("Network table: Failed to allocate memory for %u hash buckets", buckets);
+		free(device_buckets);
+		free(address_buckets);
+		return false;
 	}
-	else if(network_id == DB_NODATA)
+
+	for(unsigned int i = 0; i < buckets; i++)
 	{
-		// No result found
+		device_buckets[i] = -1;
+		address_buckets[i] = -1;
+	}
+
+	for(unsigned int i = 0; i < map->num_devices; i++)
+	{
+		const unsigned int bucket = map->devices[i].hash & (buckets - 1);
+		map->devices[i].next = device_buckets[bucket];
+		device_buckets[bucket] = i;
+	}
+
+	for(unsigned int i = 0; i < map->num_addresses; i++)
+	{
+		const unsigned int bucket = map->addresses[i].hash & (buckets - 1);
+		map->addresses[i].next = address_buckets[bucket];
+		address_buckets[bucket] = i;
+	}
+
+	if(map->device_buckets != NULL)
+		free(map->device_buckets);
+	if(map->address_buckets != NULL)
+		free(map->address_buckets);
+	map->device_buckets = device_buckets;
+	map->address_buckets = address_buckets;
+	map->buckets = buckets;
+
+	return true;
+}
+
+// Add a device to the network mirror, returns the index of the new device or
+// -1 if memory allocation failed
+static int netmap_new_device(struct netmap *map, const int id, const char *hwaddr, const char *iface,
+                             const time_t firstSeen, const time_t lastQuery, const unsigned int numQueries)
+{
+	if(map->num_devices >= map->size_devices)
+	{
+		const unsigned int size = map->size_devices > 0 ? 2*map->size_devices : 64;
+		struct netmap_device *devices = realloc(map->devices, size*sizeof(*devices));
+		if(devices == NULL)
+		{
+			log_err("Network table: Failed to allocate memory for %u devices", size);
+			return -1;
+		}
+		map->devices = devices;
+		map->size_devices = size;
+	}
+
+	struct netmap_device *device = &map->devices[map->num_devices];
+	device->id = id;
+	device->hwaddr = strdup(hwaddr);
+	device->iface = strdup(iface != NULL ? iface : "");
+	if(device->hwaddr == NULL || device->iface == NULL)
+	{
+		log_err("Network table: Failed to allocate memory for device %s", hwaddr);
+		free(device->hwaddr);
+		free(device->iface);
 		return -1;
 	}
+	device->hash = hwaddr_hash(hwaddr);
+	device->firstSeen = firstSeen;
+	device->lastQuery = lastQuery;
+	device->numQueries = numQueries;
+	device->dirty = false;
+	device->changed = false;
 
-	log_debug(DEBUG_ARP, "APR: Identified device %s using most recently used IP address", ipaddr);
+	const int idx = map->num_devices++;
+	if(map->num_devices > map->buckets)
+		return netmap_rehash(map, 2*map->buckets) ? idx : -1;
 
-	// Found network_id
-	return network_id;
+	const unsigned int bucket = device->hash & (map->buckets - 1);
+	device->next = map->device_buckets[bucket];
+	map->device_buckets[bucket] = idx;
+
+	return idx;
 }
 
-// Try to find device by mock hardware address (generated from IP address)
-static int find_device_by_mock_hwaddr(sqlite3 *db, const char *ipaddr)
+// Add an address to the network mirror, returns the index of the new address
+// or -1 if memory allocation failed
+static int netmap_new_address(struct netmap *map, const int network_id, const int device, const char *ip,
+                              const time_t lastSeen, const char *name, const time_t nameUpdated)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
-		return DB_FAILED;
+	if(map->num_addresses >= map->size_addresses)
+	{
+		const unsigned int size = map->size_addresses > 0 ? 2*map->size_addresses : 64;
+		struct netmap_address *addresses = realloc(map->addresses, size*sizeof(*addresses));
+		if(addresses == NULL)
+		{
+			log_err("Network table: Failed to allocate memory for %u addresses", size);
+			return -1;
+		}
+		map->addresses = addresses;
+		map->size_addresses = size;
+	}
 
-	const char *querystr = "SELECT id FROM network WHERE hwaddr = concat('ip-',?1)";
+	struct netmap_address *address = &map->addresses[map->num_addresses];
+	address->network_id = network_id;
+	address->device = device;
+	address->ip = strdup(ip);
+	address->name = name != NULL ? strdup(name) : NULL;
+	if(address->ip == NULL)
+	{
+		log_err("Network table: Failed to allocate memory for address %s", ip);
+		free(address->name);
+		return -1;
+	}
+	address->hash = hashStr(ip);
+	address->lastSeen = lastSeen;
+	address->nameUpdated = nameUpdated;
+	address->dirty = false;
+	address->changed = false;
 
-	// Perform SQL query
-	return db_query_int_str(db, querystr, ipaddr);
+	const int idx = map->num_addresses++;
+	if(map->num_addresses > map->buckets)
+		return netmap_rehash(map, 2*map->buckets) ? idx : -1;
+
+	const unsigned int bucket = address->hash & (map->buckets - 1);
+	address->next = map->address_buckets[bucket];
+	map->address_buckets[bucket] = idx;
+
+	return idx;
 }
 
-// Try to find device by hardware address
-static int find_device_by_hwaddr(sqlite3 *db, const char hwaddr[])
+// Find a device by its hardware address, returns -1 if not found
+static int netmap_find_device(const struct netmap *map, const char *hwaddr)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
-		return DB_FAILED;
+	const uint32_t hash = hwaddr_hash(hwaddr);
+	for(int i = map->device_buckets[hash & (map->buckets - 1)]; i > -1; i = map->devices[i].next)
+		if(map->devices[i].hash == hash && strcasecmp(map->devices[i].hwaddr, hwaddr) == 0)
+			return i;
 
-	const char *querystr = "SELECT id FROM network WHERE hwaddr = ?1 COLLATE NOCASE;";
+	return -1;
+}
 
-	// Perform SQL query
-	return db_query_int_str(db, querystr, hwaddr);
+// Find an address by its IP, returns -1 if not found
+static int netmap_find_address(const struct netmap *map, const char *ip)
+{
+	const uint32_t hash = hashStr(ip);
+	for(int i = map->address_buckets[hash & (map->buckets - 1)]; i > -1; i = map->addresses[i].next)
+		if(map->addresses[i].hash == hash && strcmp(map->addresses[i].ip, ip) == 0)
+			return i;
+
+	return -1;
 }
 
-// Try to find device by RECENT mock hardware address (generated from IP address)
-static int find_recent_device_by_mock_hwaddr(sqlite3 *db, const char *ipaddr)
+// Change the hardware address of a device and move it to the matching bucket
+static void netmap_rename_device(struct netmap *map, const int idx, const char *hwaddr)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
-		return DB_FAILED;
+	struct netmap_device *device = &map->devices[idx];
+	char *copy = strdup(hwaddr);
+	if(copy == NULL)
+		return;
 
-	const char *querystr = "SELECT id FROM network WHERE "
-	                       "hwaddr = concat('ip-',?1) AND "
-	                       "firstSeen > (cast(strftime('%%s', 'now') as int)-3600)";
+	// Unlink device from its current bucket
+	int *link = &map->device_buckets[device->hash & (map->buckets - 1)];
+	while(*link > -1 && *link != idx)
+		link = &map->devices[*link].next;
+	if(*link == idx)
+		*link = device->next;
+
+	free(device->hwaddr);
+	device->hwaddr = copy;
+	device->changed = true;
+	device->hash = hwaddr_hash(hwaddr);
+
+	// Link device into its new bucket
+	const unsigned int bucket = device->hash & (map->buckets - 1);
+	device->next = map->device_buckets[bucket];
+	map->device_buckets[bucket] = idx;
+}
 
-	// Perform SQL query
-	return db_query_int_str(db, querystr, ipaddr);
+// Find the index of a device by its database ID. This uses binary search and
+// is only valid while loading as devices are read ordered by their ID
+static int __attribute__ ((pure)) netmap_device_by_id(const struct netmap *map, const int id)
+{
+	int lo = 0, hi = (int)map->num_devices - 1;
+	while(lo <= hi)
+	{
+		const int mid = lo + (hi - lo) / 2;
+		if(map->devices[mid].id == id)
+			return mid;
+		else if(map->devices[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return -1;
+}
+
+static void netmap_free(struct netmap *map)
+{
+	// Names, interfaces and buckets are not always set
+	for(unsigned int i = 0; i < map->num_devices; i++)
+	{
+		if(map->devices[i].hwaddr != NULL)
+			free(map->devices[i].hwaddr);
+		if(map->devices[i].iface != NULL)
+			free(map->devices[i].iface);
+	}
+	for(unsigned int i = 0; i < map->num_addresses; i++)
+	{
+		if(map->addresses[i].ip != NULL)
+			free(map->addresses[i].ip);
+		if(map->addresses[i].name != NULL)
+			free(map->addresses[i].name);
+	}
+	void *ptrs[] = { map->devices, map->addresses,
+	                 map->device_buckets, map->address_buckets };
+	for(unsigned int i = 0; i < ArraySize(ptrs); i++)
+		if(ptrs[i] != NULL)
+			free(ptrs[i]);
+	memset(map, 0, sizeof(*map));
 }
 
 /**
- * @brief Updates the name associated with a given IP address in the network database.
+ * @brief Loads the network and network_addresses tables into memory.
  *
- * @param db A pointer to the SQLite database connection.
- * @param ip The IP address whose associated name is to be updated.
- * @param name The new name to associate with the given IP address.
- * @return true if the operation was successful, false otherwise.
+ * @param db Pointer to the SQLite database connection.
+ * @param map Pointer to the network mirror to be filled.
+ * @return true on success, false otherwise.
  */
-static bool update_netDB_name(sqlite3 *db, const char *ip, const char *name)
+static bool netmap_load(sqlite3 *db, struct netmap *map)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
+	memset(map, 0, sizeof(*map));
+	if(!netmap_rehash(map, 64))
 		return false;
 
-	// Skip if hostname is NULL or an empty string (= no result)
-	if(name == NULL || strlen(name) < 1)
-		return true;
-
 	bool success = false;
-	sqlite3_stmt *query_stmt = NULL;
-	const char querystr[] = "UPDATE network_addresses SET name = ?1, "
-	                               "nameUpdated = (cast(strftime('%s', 'now') as int)) "
-	                               "WHERE ip = ?2";
-
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
+	sqlite3_stmt *stmt = NULL;
+	const char devices_querystr[] = "SELECT id,hwaddr,interface,firstSeen,lastQuery,numQueries FROM network ORDER BY id;";
+	int rc = sqlite3_prepare_v2(db, devices_querystr, -1, &stmt, NULL);
 	if(rc != SQLITE_OK)
 	{
-		log_err("update_netDB_name(%s, \"%s\") - SQL error prepare (%i): %s",
-		        ip, name, rc, sqlite3_errstr(rc));
-		goto update_netDB_name_end;
+		log_err("netmap_load() - SQL error prepare (%i): %s", rc, sqlite3_errstr(rc));
+		goto netmap_load_end;
 	}
 
-	log_debug(DEBUG_DATABASE, "dbquery: \"%s\" with arguments 1 = \"%s\" and 2 = \"%s\"",
-	          querystr, name, ip);
-
-
-	// Bind name to prepared statement (1st argument)
-	// We can do this as name has dynamic scope that exceeds that of the binding.
-	if((rc = sqlite3_bind_text(query_stmt, 1, name, -1, SQLITE_STATIC)) != SQLITE_OK)
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
 	{
-		log_err("update_netDB_name(%s, \"%s\"): Failed to bind ip (error %d): %s",
-		        ip, name, rc, sqlite3_errstr(rc));
-		goto update_netDB_name_end;
+		const char *hwaddr = (const char*)sqlite3_column_text(stmt, 1);
+		if(netmap_new_device(map, sqlite3_column_int(stmt, 0), hwaddr != NULL ? hwaddr : "",
+		                     (const char*)sqlite3_column_text(stmt, 2),
+		                     sqlite3_column_int64(stmt, 3), sqlite3_column_int64(stmt, 4),
+		                     sqlite3_column_int(stmt, 5)) < 0)
+			goto netmap_load_end;
 	}
-	// Bind ip (unique key) to prepared statement (2nd argument)
-	// We can do this as name has dynamic scope that exceeds that of the binding.
-	if((rc = sqlite3_bind_text(query_stmt, 2, ip, -1, SQLITE_STATIC)) != SQLITE_OK)
+	if(rc != SQLITE_DONE)
 	{
-		log_err("update_netDB_name(%s, \"%s\"): Failed to bind name (error %d): %s",
-		        ip, name, rc, sqlite3_errstr(rc));
-		goto update_netDB_name_end;
+		log_err("netmap_load() - SQL error step (%i): %s", rc, sqlite3_errstr(rc));
+		goto netmap_load_end;
 	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
 
-	// Perform step
-	if ((rc = sqlite3_step(query_stmt)) != SQLITE_DONE)
+	const char addresses_querystr[] = "SELECT network_id,ip,lastSeen,name,nameUpdated FROM network_addresses;";
+	rc = sqlite3_prepare_v2(db, addresses_querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("netmap_load() - SQL error prepare (%i): %s", rc, sqlite3_errstr(rc));
+		goto netmap_load_end;
+	}
+
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *ip = (const char*)sqlite3_column_text(stmt, 1);
+		if(ip == NULL)
+			continue;
+
+		// Addresses of devices which do not exist (anymore) are kept
+		// but are never returned by device lookups
+		const int network_id = sqlite3_column_int(stmt, 0);
+		if(netmap_new_address(map, network_id, netmap_device_by_id(map, network_id), ip,
+		                      sqlite3_column_int64(stmt, 2), (const char*)sqlite3_column_text(stmt, 3),
+		                      sqlite3_column_int64(stmt, 4)) < 0)
+			goto netmap_load_end;
+	}
+	if(rc != SQLITE_DONE)
 	{
-		log_err("update_netDB_name(%s, \"%s\"): Failed to step (error %d): %s",
-		        ip, name, rc, sqlite3_errstr(rc));
-		goto update_netDB_name_end;
+		log_err("netmap_load() - SQL error step (%i): %s", rc, sqlite3_errstr(rc));
+		goto netmap_load_end;
 	}
 
 	success = true;
 
-update_netDB_name_end:
+netmap_load_end:
 	if(!success)
 		checkFTLDBrc(rc);
 
 	// Finalize statement
-	sqlite3_reset(query_stmt);
-	sqlite3_finalize(query_stmt);
+	sqlite3_finalize(stmt);
+
+	log_debug(DEBUG_ARP, "Network table: Loaded %u devices and %u addresses into memory",
+	          map->num_devices, map->num_addresses);
 
 	return success;
 }
 
 /**
- * @brief Updates the last query time for a specific network in the database.
+ * @brief Writes all changed devices and addresses back to the database.
  *
- * This function updates the `lastQuery` field for a network identified by `network_id`
- * in the database. It ensures that the `lastQuery` field is set to the maximum of its
- * current value and the provided `lastQuery` value.
+ * Both statements are prepared only once and reused for all changed rows.
+ * This is expected to run inside the transaction opened by
+ * parse_neighbor_cache().
  *
  * @param db Pointer to the SQLite database connection.
- * @param network_id The ID of the network to update.
- * @param lastQuery The new last query time to set.
- * @return true if the operation was successful, false otherwise.
+ * @param map Pointer to the network mirror.
+ * @return true on success, false otherwise.
  */
-static bool update_netDB_lastQuery(sqlite3 *db, const int network_id, const time_t lastQuery)
+static bool netmap_flush(sqlite3 *db, struct netmap *map)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
 		return false;
 
-	// Check for invalid network ID
-	if(network_id < 0)
-		return false;
+	bool success = false;
+	unsigned int devices = 0, addresses = 0;
+	sqlite3_stmt *device_stmt = NULL, *address_stmt = NULL;
+	const char device_querystr[] = "UPDATE network SET interface = ?1, lastQuery = ?2, numQueries = ?3 WHERE id = ?4;";
+	const char address_querystr[] = "INSERT OR REPLACE INTO network_addresses "
+	                                "(network_id,ip,lastSeen,name,nameUpdated) VALUES (?1,?2,?3,?4,?5);";
 
-	// Return early if there is nothing to update
-	if(lastQuery < 1)
-		return true;
+	int rc = sqlite3_prepare_v2(db, device_querystr, -1, &device_stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("netmap_flush() - SQL error prepare (%i): %s", rc, sqlite3_errstr(rc));
+		goto netmap_flush_end;
+	}
+	rc = sqlite3_prepare_v2(db, address_querystr, -1, &address_stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("netmap_flush() - SQL error prepare (%i): %s", rc, sqlite3_errstr(rc));
+		goto netmap_flush_end;
+	}
 
-	const int ret = dbquery(db, "UPDATE network "\
-	                            "SET lastQuery = MAX(lastQuery, %lu) "\
-	                            "WHERE id = %i;",
-	                            (unsigned long)lastQuery, network_id);
+	for(unsigned int i = 0; i < map->num_devices; i++)
+	{
+		struct netmap_device *device = &map->devices[i];
+		if(!device->dirty)
+			continue;
+
+		if((rc = sqlite3_bind_text(device_stmt, 1, device->iface, -1, SQLITE_STATIC)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_int64(device_stmt, 2, device->lastQuery)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_int(device_stmt, 3, device->numQueries)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_int(device_stmt, 4, device->id)) != SQLITE_OK)
+		{
+			log_err("netmap_flush(): Failed to bind device %i (error %d): %s",
+			        device->id, rc, sqlite3_errstr(rc));
+			goto netmap_flush_end;
+		}
+
+		if((rc = sqlite3_step(device_stmt)) != SQLITE_DONE)
+		{
+			log_err("netmap_flush(): Failed to update device %i (error %d): %s",
+			        device->id, rc, sqlite3_errstr(rc));
+			goto netmap_flush_end;
+		}
+		sqlite3_reset(device_stmt);
+
+		device->dirty = false;
+		devices++;
+	}
+
+	for(unsigned int i = 0; i < map->num_addresses; i++)
+	{
+		struct netmap_address *address = &map->addresses[i];
+		if(!address->dirty)
+			continue;
 
-	return ret == SQLITE_OK;
+		// The name may be NULL, the nameUpdated timestamp is NULL when unset
+		if((rc = sqlite3_bind_int(address_stmt, 1, address->network_id)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_text(address_stmt, 2, address->ip, -1, SQLITE_STATIC)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_int64(address_stmt, 3, address->lastSeen)) != SQLITE_OK ||
+		   (rc = sqlite3_bind_text(address_stmt, 4, address->name, -1, SQLITE_STATIC)) != SQLITE_OK ||
+		   (rc = address->nameUpdated > 0 ?
+		         sqlite3_bind_int64(address_stmt, 5, address->nameUpdated) :
+		         sqlite3_bind_null(address_stmt, 5)) != SQLITE_OK)
+		{
+			log_err("netmap_flush(): Failed to bind address %s (error %d): %s",
+			        address->ip, rc, sqlite3_errstr(rc));
+			goto netmap_flush_end;
+		}
+
+		if((rc = sqlite3_step(address_stmt)) != SQLITE_DONE)
+		{
+			log_err("netmap_flush(): Failed to store address %s (error %d): %s",
+			        address->ip, rc, sqlite3_errstr(rc));
+			goto netmap_flush_end;
+		}
+		sqlite3_reset(address_stmt);
+
+		address->dirty = false;
+		addresses++;
+	}
+
+	success = true;
+
+netmap_flush_end:
+	if(!success)
+		checkFTLDBrc(rc);
+
+	// Finalize statements
+	sqlite3_finalize(device_stmt);
+	sqlite3_finalize(address_stmt);
+
+	log_debug(DEBUG_ARP, "Network table: Stored %u changed devices and %u changed addresses",
+	          devices, addresses);
+
+	return success;
+}
+
+// Invalidate the cached lookups of all addresses affected by changes of this
+// run. This has to be called after the changes have been committed
+static void netmap_invalidate_cache(const struct netmap *map)
+{
+	unsigned int invalidated = 0;
+	for(unsigned int i = 0; i < map->num_addresses; i++)
+	{
+		const struct netmap_address *address = &map->addresses[i];
+		if(address->changed || (address->device > -1 && map->devices[address->device].changed))
+		{
+			network_cache_invalidate(address->ip);
+			invalidated++;
+		}
+	}
+
+	log_debug(DEBUG_ARP, "Network table: Invalidated cached lookups of %u addresses", invalidated);
+}
+
+// Try to find device by recent usage of this IP address
+static int find_device_by_recent_ip(const struct netmap *map, const char *ipaddr, const time_t now)
+{
+	const int addrID = netmap_find_address(map, ipaddr);
+	if(addrID < 0 || map->addresses[addrID].device < 0 ||
+	   map->addresses[addrID].lastSeen <= now - 86400)
+	{
+		// No result found
+		return -1;
+	}
+
+	log_debug(DEBUG_ARP, "APR: Identified device %s using most recently used IP address", ipaddr);
+
+	// Found device
+	return map->addresses[addrID].device;
+}
+
+// Try to find device by mock hardware address (generated from IP address)
+static int find_device_by_mock_hwaddr(const struct netmap *map, const char *ipaddr)
+{
+	char hwaddr[128];
+	snprintf(hwaddr, sizeof(hwaddr), "ip-%s", ipaddr);
+	return netmap_find_device(map, hwaddr);
+}
+
+// Try to find device by RECENT mock hardware address (generated from IP address)
+static int find_recent_device_by_mock_hwaddr(const struct netmap *map, const char *ipaddr, const time_t now)
+{
+	const int devID = find_device_by_mock_hwaddr(map, ipaddr);
+	if(devID < 0 || map->devices[devID].firstSeen <= now - 3600)
+		return -1;
+
+	return devID;
 }
 
 /**
- * @brief Updates the number of queries for a specific network entry in the database.
+ * @brief Updates the name associated with a given IP address in the network mirror.
  *
- * @param db Pointer to the SQLite database connection.
- * @param dbID The ID of the network entry to update.
- * @param numQueries The number of queries to add to the current count.
- * @return true if the operation was successful, false otherwise.
+ * Nothing is done if the IP address is not known (yet).
+ *
+ * @param map Pointer to the network mirror.
+ * @param ip The IP address whose associated name is to be updated.
+ * @param name The new name to associate with the given IP address.
+ * @param now The current timestamp.
  */
-static bool update_netDB_numQueries(sqlite3 *db, const int dbID, const int numQueries)
+static void update_netDB_name(struct netmap *map, const char *ip, const char *name, const time_t now)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
-		return false;
+	// Skip if hostname is NULL or an empty string (= no result)
+	if(name == NULL || strlen(name) < 1)
+		return;
 
-	// Return early if there is nothing to update
-	if(numQueries < 1)
-		return true;
+	const int addrID = netmap_find_address(map, ip);
+	if(addrID < 0)
+		return;
 
-	const int ret = dbquery(db, "UPDATE network "
-	                            "SET numQueries = numQueries + %i "
-	                            "WHERE id = %i;",
-	                            numQueries, dbID);
+	struct netmap_address *address = &map->addresses[addrID];
+	if(address->name == NULL || strcmp(address->name, name) != 0)
+	{
+		free(address->name);
+		address->name = strdup(name);
 
-	return ret == SQLITE_OK;
+		// Other addresses of the same device may fall back to this name
+		address->changed = true;
+		if(address->device > -1)
+			map->devices[address->device].changed = true;
+	}
+	address->nameUpdated = now;
+	address->dirty = true;
 }
 
 /**
- * @brief Adds or updates a network address in the database.
+ * @brief Updates the last query time for a device in the network mirror.
  *
- * @param db Pointer to the SQLite database connection.
- * @param network_id The ID of the network to which the IP address belongs.
- * @param ip The IP address to be added or updated in the database.
- * @return true if the operation was successful or if there was nothing to be done, false otherwise.
+ * The `lastQuery` field is set to the maximum of its current value and the
+ * provided `lastQuery` value.
+ *
+ * @param map Pointer to the network mirror.
+ * @param devID The index of the device to update.
+ * @param lastQuery The new last query time to set.
  */
-static bool add_netDB_network_address(sqlite3 *db, const int network_id, const char *ip)
+static void update_netDB_lastQuery(struct netmap *map, const int devID, const time_t lastQuery)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
-		return false;
+	// Check for invalid device
+	if(devID < 0)
+		return;
+
+	struct netmap_device *device = &map->devices[devID];
+	if(lastQuery > device->lastQuery)
+	{
+		device->lastQuery = lastQuery;
+		device->dirty = true;
+	}
+}
+
+/**
+ * @brief Adds to the number of queries of a device in the network mirror.
+ *
+ * @param map Pointer to the network mirror.
+ * @param devID The index of the device to update.
+ * @param numQueries The number of queries to add to the current count.
+ */
+static void update_netDB_numQueries(struct netmap *map, const int devID, const unsigned int numQueries)
+{
+	// Return early if there is nothing to update
+	if(devID < 0 || numQueries < 1)
+		return;
 
-	// Check for invalid network ID
-	if(network_id < 0)
+	map->devices[devID].numQueries += numQueries;
+	map->devices[devID].dirty = true;
+}
+
+/**
+ * @brief Adds or updates a network address in the network mirror.
+ *
+ * @param map Pointer to the network mirror.
+ * @param devID The index of the device to which the IP address belongs.
+ * @param ip The IP address to be added or updated.
+ * @param now The current timestamp.
+ * @return true if the operation was successful or if there was nothing to be done, false otherwise.
+ */
+static bool add_netDB_network_address(struct netmap *map, const int devID, const char *ip, const time_t now)
+{
+	// Check for invalid device
+	if(devID < 0)
 		return false;
 
 	// Return early if there is nothing to be done in here
 	if(ip == NULL || strlen(ip) == 0)
 		return true;
 
-	bool success = false;
-	sqlite3_stmt *query_stmt = NULL;
-	const char querystr[] = "INSERT OR REPLACE INTO network_addresses "
-	                        "(network_id,ip,lastSeen,name,nameUpdated) VALUES "
-	                        "(?1,?2,(cast(strftime('%s', 'now') as int)),"
-	                        "(SELECT name FROM network_addresses "
-	                                "WHERE ip = ?2),"
-	                        "(SELECT nameUpdated FROM network_addresses "
-	                                "WHERE ip = ?2));";
-
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
-	if(rc != SQLITE_OK)
-	{
-		log_err("add_netDB_network_address(%i, \"%s\") - SQL error prepare (%i): %s",
-		        network_id, ip, rc, sqlite3_errstr(rc));
-		goto add_netDB_network_address_end;
-	}
-
-	log_debug(DEBUG_DATABASE, "dbquery: \"%s\" with arguments ?1 = %i and ?2 = \"%s\"",
-		     querystr, network_id, ip);
-
-	// Bind network_id to prepared statement (1st argument)
-	if((rc = sqlite3_bind_int(query_stmt, 1, network_id)) != SQLITE_OK)
-	{
-		log_err("add_netDB_network_address(%i, \"%s\"): Failed to bind network_id (error %d): %s",
-		        network_id, ip, rc, sqlite3_errstr(rc));
-		goto add_netDB_network_address_end;
-	}
-	// Bind ip to prepared statement (2nd argument)
-	if((rc = sqlite3_bind_text(query_stmt, 2, ip, -1, SQLITE_STATIC)) != SQLITE_OK)
-	{
-		log_err("add_netDB_network_address(%i, \"%s\"): Failed to bind name (error %d): %s",
-		        network_id, ip, rc, sqlite3_errstr(rc));
-		goto add_netDB_network_address_end;
-	}
+	int addrID = netmap_find_address(map, ip);
+	if(addrID < 0 && (addrID = netmap_new_address(map, 0, -1, ip, now, NULL, 0)) < 0)
+		return false;
 
-	// Perform step
-	if ((rc = sqlite3_step(query_stmt)) != SQLITE_DONE)
+	struct netmap_address *address = &map->addresses[addrID];
+	if(address->device != devID || address->network_id != map->devices[devID].id)
 	{
-		log_err("add_netDB_network_address(%i, \"%s\"): Failed to step (error %d): %s",
-		        network_id, ip, rc, sqlite3_errstr(rc));
-		goto add_netDB_network_address_end;
+		// The address is new or moved to another device
+		if(address->device > -1)
+			map->devices[address->device].changed = true;
+		map->devices[devID].changed = true;
+		address->changed = true;
 	}
+	address->network_id = map->devices[devID].id;
+	address->device = devID;
+	address->lastSeen = now;
+	address->dirty = true;
 
-	success = true;
-
-add_netDB_network_address_end:
-	if(!success)
-		checkFTLDBrc(rc);
-
-	// Finalize statement
-	sqlite3_reset(query_stmt);
-	sqlite3_finalize(query_stmt);
-
-	return success;
+	return true;
 }
 
 /**
- * @brief Inserts a network device record into the database.
+ * @brief Inserts a network device record into the database and the network mirror.
  *
  * @param db Pointer to the SQLite database connection.
+ * @param map Pointer to the network mirror.
  * @param hwaddr Hardware address (MAC address) of the network device.
  * @param firstSeen Timestamp of when the device was first seen.
  * @param lastQuery Timestamp of the last query made to the device.
  * @param numQueriesARP Number of ARP queries made to the device.
  * @param macVendor Vendor of the MAC address.
- * @param new_id Pointer to store the new ID of the inserted device.
+ * @param devID Pointer to store the index of the new device in the network mirror.
  * @return true if the insertion was successful, false otherwise.
  */
-static bool insert_netDB_device(sqlite3 *db, const char *hwaddr, const time_t firstSeen, const time_t lastQuery,
-                               const unsigned int numQueriesARP, const char *macVendor, int *new_id)
+static bool insert_netDB_device(sqlite3 *db, struct netmap *map, const char *hwaddr, const time_t firstSeen,
+                                const time_t lastQuery, const unsigned int numQueriesARP, const char *macVendor,
+                                int *devID)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
@@ -591,10 +1105,11 @@ static bool insert_netDB_device(sqlite3 *db, const char *hwaddr, const time_t fi
 		goto insert_netDB_device_end;
 	}
 
-	// Get the ID of the newly inserted row
-	*new_id = sqlite3_last_insert_rowid(db);
+	// Mirror the newly inserted row in memory
+	*devID = netmap_new_device(map, sqlite3_last_insert_rowid(db), hwaddr, "N/A",
+	                           firstSeen, lastQuery, numQueriesARP);
 
-	success = true;
+	success = *devID > -1;
 
 insert_netDB_device_end:
 	if(!success)
@@ -611,22 +1126,24 @@ insert_netDB_device_end:
  * @brief Updates the network table in the database with the provided hardware address and MAC vendor.
  *
  * @param db A pointer to the SQLite database.
+ * @param map Pointer to the network mirror.
  * @param hwaddr The hardware address to update in the network table.
  * @param macVendor The MAC vendor to update in the network table. This can be NULL.
- * @param dbID The database ID of the entry to update.
+ * @param devID The index of the device in the network mirror.
  * @return true if the update is successful, false otherwise.
  */
-static bool unmock_netDB_device(sqlite3 *db, const char *hwaddr, const char *macVendor, const int dbID)
+static bool unmock_netDB_device(sqlite3 *db, struct netmap *map, const char *hwaddr, const char *macVendor, const int devID)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
 		return false;
 
-	// Check for invalid network ID
-	if(dbID < 0)
+	// Check for invalid device
+	if(devID < 0)
 		return false;
 
 	bool success = false;
+	const int dbID = map->devices[devID].id;
 	sqlite3_stmt *query_stmt = NULL;
 	const char querystr[] = "UPDATE network SET "\
 	                        "hwaddr = ?1, macVendor=?2 WHERE id = ?3;";
@@ -674,6 +1191,9 @@ static bool unmock_netDB_device(sqlite3 *db, const char *hwaddr, const char *mac
 		goto unmock_netDB_device_end;
 	}
 
+	// Keep the network mirror in sync
+	netmap_rename_device(map, devID, hwaddr);
+
 	success = true;
 
 unmock_netDB_device_end:
@@ -688,87 +1208,37 @@ unmock_netDB_device_end:
 }
 
 /**
- * @brief Updates the network interface in the database for a given network ID.
+ * @brief Updates the network interface of a device in the network mirror.
  *
- * @param db Pointer to the SQLite database connection.
- * @param network_id The ID of the network to update.
+ * @param map Pointer to the network mirror.
+ * @param devID The index of the device to update.
  * @param iface The new interface value to set.
- * @return true if the update was successful, false otherwise.
  */
-static bool update_netDB_interface(sqlite3 *db, const int network_id, const char *iface)
+static void update_netDB_interface(struct netmap *map, const int devID, const char *iface)
 {
-	// Return early if database is known to be broken
-	if(FTLDBerror())
-		return false;
-
-	// Check for invalid network ID
-	if(network_id < 0)
-		return false;
-
 	// Return early if there is nothing to be done in here
-	if(iface == NULL || strlen(iface) == 0)
-		return true;
-
-	bool success = false;
-	sqlite3_stmt *query_stmt = NULL;
-	const char querystr[] = "UPDATE network SET interface = ?1 WHERE id = ?2";
-
-	int rc = sqlite3_prepare_v2(db, querystr, -1, &query_stmt, NULL);
-	if(rc != SQLITE_OK)
-	{
-		log_err("update_netDB_interface(%i, \"%s\") - SQL error prepare (%i): %s",
-		        network_id, iface, rc, sqlite3_errstr(rc));
-		goto update_netDB_interface_end;
-	}
-
-	log_debug(DEBUG_DATABASE, "dbquery: \"%s\" with arguments ?1 = \"%s\" and ?2 = %i",
-		     querystr, iface, network_id);
-
-	// Bind iface to prepared statement (1st argument)
-	if((rc = sqlite3_bind_text(query_stmt, 1, iface, -1, SQLITE_STATIC)) != SQLITE_OK)
-	{
-		log_err("update_netDB_interface(%i, \"%s\"): Failed to bind iface (error %d): %s",
-		        network_id, iface, rc, sqlite3_errstr(rc));
-		goto update_netDB_interface_end;
-	}
-	// Bind network_id to prepared statement (2nd argument)
-	if((rc = sqlite3_bind_int(query_stmt, 2, network_id)) != SQLITE_OK)
-	{
-		log_err("update_netDB_interface(%i, \"%s\"): Failed to bind name (error %d): %s",
-		        network_id, iface, rc, sqlite3_errstr(rc));
-		goto update_netDB_interface_end;
-	}
-
-	// Perform step
-	if ((rc = sqlite3_step(query_stmt)) != SQLITE_DONE)
-	{
-		log_err("update_netDB_interface(%i, \"%s\"): Failed to step (error %d): %s",
-		        network_id, iface, rc, sqlite3_errstr(rc));
-		goto update_netDB_interface_end;
-	}
-
-	success = true;
-
-update_netDB_interface_end:
-	if(!success)
-		checkFTLDBrc(rc);
+	if(devID < 0 || iface == NULL || strlen(iface) == 0)
+		return;
 
-	// Finalize statement
-	sqlite3_reset(query_stmt);
-	sqlite3_finalize(query_stmt);
+	struct netmap_device *device = &map->devices[devID];
+	if(device->iface != NULL && strcmp(device->iface, iface) == 0)
+		return;
 
-	return true;
+	free(device->iface);
+	device->iface = strdup(iface);
+	device->dirty = true;
+	device->changed = true;
 }
 
 // Loop over all clients known to FTL and ensure we add them all to the database
-static bool add_FTL_clients_to_network_table(sqlite3 *db, const enum arp_status *client_status,
+static bool add_FTL_clients_to_network_table(sqlite3 *db, struct netmap *map, const enum arp_status *client_status,
                                              const unsigned int clients, const time_t now, unsigned int *additional_entries)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
 		return false;
 
-	int rc = SQLITE_OK;
+	bool success = true;
 	char hwaddr[128];
 	for(unsigned int clientID = 0; clientID < clients; clientID++)
 	{
@@ -793,31 +1263,28 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, const enum arp_status
 			continue;
 		}
 
-		// Get hostname and IP address of this client
-		char *hostname, *ipaddr, *interface;
-		ipaddr = strdup(getstr(client->ippos));
-		hostname = strdup(getstr(client->namepos));
-		interface = strdup(getstr(client->ifacepos));
-
 		// Skip if already handled above (first check against clients_array_size as we might have added
 		// more clients to FTL's memory herein (those known only from the database))
 		if(client_status[clientID] != CLIENT_NOT_HANDLED)
 		{
 			log_debug(DEBUG_ARP, "Network table: Client %s known through ARP/neigh cache",
-			          ipaddr);
-			if(ipaddr) free(ipaddr);
-			if(hostname) free(hostname);
-			if(interface) free(interface);
+			          getstr(client->ippos));
 			unlock_shm();
 			continue;
 		}
-		else
-			log_debug(DEBUG_ARP, "Network table: %s NOT known through ARP/neigh cache", ipaddr);
+
+		// Get hostname and IP address of this client
+		char *hostname, *ipaddr, *interface;
+		ipaddr = strdup(getstr(client->ippos));
+		hostname = strdup(getstr(client->namepos));
+		interface = strdup(getstr(client->ifacepos));
+
+		log_debug(DEBUG_ARP, "Network table: %s NOT known through ARP/neigh cache", ipaddr);
 
 		//
 		// Variant 1: Try to find a device with an EDNS(0)-provided hardware address
 		//
-		int dbID = DB_NODATA;
+		int devID = -1;
 		if(client->hwlen == 6)
 		{
 			snprintf(hwaddr, sizeof(hwaddr), "%02X:%02X:%02X:%02X:%02X:%02X",
@@ -826,15 +1293,9 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, const enum arp_status
 			         client->hwaddr[4], client->hwaddr[5]);
 			hwaddr[6*2+5] = '\0';
 
-			unlock_shm();
-			dbID = find_device_by_hwaddr(db, hwaddr);
-			lock_shm();
-
-			// Reacquire client pointer (if may have changed when unlocking above)
-			client = getClient(clientID, true);
-
-			if(dbID >= 0)
-				log_debug(DEBUG_ARP, "Network table: Client with MAC %s is network ID %i", hwaddr, dbID);
+			devID = netmap_find_device(map, hwaddr);
+			if(devID > -1)
+				log_debug(DEBUG_ARP, "Network table: Client with MAC %s is network ID %i", hwaddr, map->devices[devID].id);
 		}
 		else
 		{
@@ -842,36 +1303,24 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, const enum arp_status
 			// Variant 2: Try to find a device using the same IP address within the last 24 hours
 			// Only try this when there is no EDNS(0) MAC address available
 			//
-			unlock_shm();
-			dbID = find_device_by_recent_ip(db, ipaddr);
-			lock_shm();
-
-			// Reacquire client pointer (if may have changed when unlocking above)
-			client = getClient(clientID, true);
-
-			if(dbID > DB_NODATA)
+			devID = find_device_by_recent_ip(map, ipaddr, now);
+			if(devID > -1)
 			{
 				log_debug(DEBUG_ARP, "Network table: Client with IP %s has no MAC info but was recently be seen for network ID %i",
-				          ipaddr, dbID);
+				          ipaddr, map->devices[devID].id);
 			}
 
 			//
 			// Variant 3: Try to find a device with mock IP address
 			// Only try this when there is no EDNS(0) MAC address available
 			//
-			if(dbID < 0)
+			if(devID < 0)
 			{
-				unlock_shm();
-				dbID = find_device_by_mock_hwaddr(db, ipaddr);
-				lock_shm();
-
-				// Reacquire client pointer (if may have changed when unlocking above)
-				client = getClient(clientID, true);
-
-				if(dbID > DB_NODATA)
+				devID = find_device_by_mock_hwaddr(map, ipaddr);
+				if(devID > -1)
 				{
 					log_debug(DEBUG_ARP, "Network table: Client with IP %s has no MAC info but is known as mock-hwaddr client with network ID %i",
-					          ipaddr, dbID);
+					          ipaddr, map->devices[devID].id);
 				}
 			}
 
@@ -881,17 +1330,8 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, const enum arp_status
 			hwaddr[sizeof(hwaddr)-1] = '\0';
 		}
 
-		if(dbID == DB_FAILED)
-		{
-			// SQLite error
-			if(ipaddr) free(ipaddr);
-			if(hostname) free(hostname);
-			if(interface) free(interface);
-			break;
-		}
-
 		// Device not in database, add new entry
-		else if(dbID == DB_NODATA)
+		if(devID < 0)
 		{
 			char *macVendor = NULL;
 			if(client->hwlen == 6)
@@ -913,11 +1353,17 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, const enum arp_status
 			const time_t firstSeen = client->firstSeen;
 			const unsigned int numQueries = client->count;
 			unlock_shm();
-			if(!insert_netDB_device(db, hwaddr, firstSeen, lastQuery, numQueries, macVendor, &dbID))
+			success = insert_netDB_device(db, map, hwaddr, firstSeen, lastQuery, numQueries, macVendor, &devID);
+
+			// Free allocated memory (if allocated)
+			if(macVendor != NULL)
+				free(macVendor);
+
+			if(!success)
 			{
-				if(ipaddr) free(ipaddr);
-				if(hostname) free(hostname);
-				if(interface) free(interface);
+				free(ipaddr);
+				free(hostname);
+				free(interface);
 				break;
 			}
 			lock_shm();
@@ -926,116 +1372,53 @@ static bool add_FTL_clients_to_network_table(sqlite3 *db, const enum arp_status
 			client = getClient(clientID, true);
 
 			// Reset client counter
-			client->numQueriesARP = 0;
-
-			// Free allocated memory (if allocated)
-			if(macVendor != NULL)
-			{
-				free(macVendor);
-				macVendor = NULL;
-			}
+			if(client != NULL)
+				client->numQueriesARP = 0;
 		}
 		else	// Device already in database
 		{
 			log_debug(DEBUG_ARP, "Network table: Updating existing FTL device MAC = %s, IP = %s, hostname = \"%s\", interface = \"%s\"",
 			          hwaddr, ipaddr, hostname, interface);
 
-			// Update timestamp of last query if applicable
-			const time_t lastQuery = client->lastQuery;
-			const unsigned int numQueriesARP = client->numQueriesARP;
-			unlock_shm();
-			if(!update_netDB_lastQuery(db, dbID, lastQuery))
-			{
-				if(ipaddr) free(ipaddr);
-				if(hostname) free(hostname);
-				if(interface) free(interface);
-				break;
-			}
-
-			// Update number of queries if applicable
-			if(!update_netDB_numQueries(db, dbID, numQueriesARP))
-			{
-				if(ipaddr) free(ipaddr);
-				if(hostname) free(hostname);
-				if(interface) free(interface);
-				break;
-			}
-
-			lock_shm();
-			// Reacquire client pointer (if may have changed when unlocking above)
-			client = getClient(clientID, true);
+			// Update timestamp of last query and number of queries if applicable
+			update_netDB_lastQuery(map, devID, client->lastQuery);
+			update_netDB_numQueries(map, devID, client->numQueriesARP);
 			client->numQueriesARP = 0;
 		}
 
 		unlock_shm();
 
-		// Break early if we failed to add the new device to the
-		// database above, continuing is not possible anymore
-		if(dbID < 0)
-		{
-			if(ipaddr) free(ipaddr);
-			if(hostname) free(hostname);
-			if(interface) free(interface);
-			break;
-		}
-
 		// Add unique IP address / mock-MAC pair to network_addresses table
 		// ipaddr is a local copy
-		if(!add_netDB_network_address(db, dbID, ipaddr))
-		{
-			if(ipaddr) free(ipaddr);
-			if(hostname) free(hostname);
-			if(interface) free(interface);
-			break;
-		}
+		success = add_netDB_network_address(map, devID, ipaddr, now);
 
-		// Update hostname if available
-		// hostname is a local copy
-		if(!update_netDB_name(db, ipaddr, hostname))
+		// Update hostname and interface if available
+		// hostname and interface are local copies
+		if(success)
 		{
-			if(ipaddr) free(ipaddr);
-			if(hostname) free(hostname);
-			if(interface) free(interface);
-			break;
-		}
+			update_netDB_name(map, ipaddr, hostname, now);
+			update_netDB_interface(map, devID, interface);
 
-		// Update interface if available
-		// interface is a local copy
-		if(!update_netDB_interface(db, dbID, interface))
-		{
-			if(ipaddr) free(ipaddr);
-			if(hostname) free(hostname);
-			if(interface) free(interface);
-			break;
+			// Add to number of processed ARP cache entries
+			(*additional_entries)++;
 		}
 
-		// Add to number of processed ARP cache entries
-		(*additional_entries)++;
-
 		// Free allocated memory
 		free(ipaddr);
 		free(hostname);
 		free(interface);
-	}
-
-	// Check for possible error in loop
-	if(rc != SQLITE_OK)
-	{
-		const char *text;
-		if( rc == SQLITE_BUSY )
-			text = "WARNING";
-		else
-			text = "ERROR";
 
-		log_err("%s: Storing devices in network table failed: %s", text, sqlite3_errstr(rc));
-		checkFTLDBrc(rc);
-		return false;
+		if(!success)
+			break;
 	}
 
-	return true;
+	if(!success)
+		log_err("Storing devices in network table failed");
+
+	return success;
 }
 
-static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsigned int *additional_entries)
+static bool add_local_interfaces_to_network_table(sqlite3 *db, struct netmap *map, time_t now, unsigned int *additional_entries)
 {
 	// Return early if database is known to be broken
 	if(FTLDBerror())
@@ -1055,7 +1438,7 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 	char *linebuffer = NULL;
 	size_t linebuffersize = 0u;
 	int iface_no;
-	bool has_iface = false, has_hwaddr = false;
+	bool has_iface = false, has_hwaddr = false, success = true;
 	char ipaddr[128], hwaddr[128], iface[128];
 
 	// Read response line by line
@@ -1125,42 +1508,36 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 		          iface, hwaddr, ipaddr);
 
 		// Try to find the device we parsed above
-		int dbID = find_device_by_hwaddr(db, hwaddr);
-		if(dbID >= 0)
-		{
-			log_debug(DEBUG_ARP, "Network table (ip a): Client with MAC %s was recently be seen for network ID %i",
-			          hwaddr, dbID);
-		}
-
-		// Break on SQLite error
-		if(dbID == DB_FAILED)
-		{
-			// SQLite error
-			break;
-		}
-
-		// Get vendor
-		char *macVendor = getMACVendor(hwaddr);
+		int devID = netmap_find_device(map, hwaddr);
 
 		// Device not in database, add new entry
-		if(dbID == DB_NODATA)
+		if(devID < 0)
 		{
+			// Get vendor
+			char *macVendor = getMACVendor(hwaddr);
 
 			log_debug(DEBUG_ARP, "Network table: Creating new ip a device MAC = %s, IP = %s, vendor = \"%s\", interface = \"%s\"",
 			          hwaddr, ipaddr, macVendor, iface);
 
 			// Try to import query data from a possibly previously existing mock-device
-			int mockID = find_device_by_mock_hwaddr(db, ipaddr);
-			int lastQuery = 0, firstSeen = now, numQueries = 0;
-			if(mockID >= 0)
+			const int mockID = find_device_by_mock_hwaddr(map, ipaddr);
+			time_t lastQuery = 0, firstSeen = now;
+			unsigned int numQueries = 0;
+			if(mockID > -1)
 			{
-				lastQuery = db_query_int_int(db, "SELECT lastQuery from network where id = ?1", mockID);
-				firstSeen = db_query_int_int(db, "SELECT firstSeen from network where id = ?1", mockID);
-				numQueries = db_query_int_int(db, "SELECT numQueries from network where id = ?1", mockID);
+				lastQuery = map->devices[mockID].lastQuery;
+				firstSeen = map->devices[mockID].firstSeen;
+				numQueries = map->devices[mockID].numQueries;
 			}
 
 			// Add new device to database
-			if(!insert_netDB_device(db, hwaddr, firstSeen, lastQuery, numQueries, macVendor, &dbID))
+			success = insert_netDB_device(db, map, hwaddr, firstSeen, lastQuery, numQueries, macVendor, &devID);
+
+			//Free allocated memory
+			if(macVendor != NULL)
+				free(macVendor);
+
+			if(!success)
 				break;
 		}
 		else	// Device already in database
@@ -1169,17 +1546,12 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 			          hwaddr, ipaddr, iface);
 		}
 
-		//Free allocated memory
-		if(macVendor != NULL)
-			free(macVendor);
-
 		// Add unique IP address / mock-MAC pair to network_addresses table
-		if(!add_netDB_network_address(db, dbID, ipaddr))
+		if(!(success = add_netDB_network_address(map, devID, ipaddr, now)))
 			break;
 
 		// Update interface if available
-		if(!update_netDB_interface(db, dbID, iface))
-			break;
+		update_netDB_interface(map, devID, iface);
 
 		// Add to number of processed ARP cache entries
 		(*additional_entries)++;
@@ -1190,7 +1562,7 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
 	if(linebuffer != NULL)
 		free(linebuffer);
 
-	return true;
+	return success;
 }
 
 /**
@@ -1205,64 +1577,397 @@ static bool add_local_interfaces_to_network_table(sqlite3 *db, time_t now, unsig
  * will not perform any cleaning and will return true immediately.
  *
  * @param db A pointer to the SQLite database connection.
+ * @param changed Pointer to a flag set if any rows were removed or changed.
  * @return true if the cleaning operations were successful or if cleaning is disabled.
  * @return false if any of the cleaning operations failed.
  */
-static bool clean_network_table(sqlite3 *db)
+static bool clean_network_table(sqlite3 *db, bool *changed)
 {
 	// Do not clean if disabled
 	if(config.database.network.expire.v.ui == 0)
 		return true;
 
-	// Remove all but the most recent IP addresses not seen for more than a certain time
-	const time_t limit = time(NULL)-24*3600*config.database.network.expire.v.ui;
-	int rc = dbquery(db, "DELETE FROM network_addresses "
-	                     "WHERE lastSeen < %lu;", (unsigned long)limit);
-	if(rc != SQLITE_OK)
-		return false;
+	// Remove all but the most recent IP addresses not seen for more than a certain time
+	const time_t limit = time(NULL)-24*3600*config.database.network.expire.v.ui;
+	int rc = dbquery(db, "DELETE FROM network_addresses "
+	                     "WHERE lastSeen < %lu;", (unsigned long)limit);
+	if(rc != SQLITE_OK)
+		return false;
+	*changed = sqlite3_changes(db) > 0;
+
+	rc = dbquery(db, "UPDATE network_addresses SET name = NULL "
+	                 "WHERE nameUpdated < %lu;", (unsigned long)limit);
+	if(rc != SQLITE_OK)
+		return false;
+	*changed |= sqlite3_changes(db) > 0;
+
+	return true;
+}
+
+/**
+ * @brief Flushes the network table by removing all IP addresses and devices.
+ *
+ * This function opens the database, deletes all entries from the
+ * `network_addresses` and `network` tables, and then closes the database.
+ *
+ * @return true if the operation was successful, false otherwise.
+ */
+bool flush_network_table(void)
+{
+	sqlite3 *db = dbopen(false, false);
+	if(db == NULL)
+		return false;
+
+	// Remove all IP addresses
+	if(dbquery(db, "DELETE FROM network_addresses;") != SQLITE_OK)
+		return false;
+
+	// Remove all devices
+	if(dbquery(db, "DELETE FROM network;") != SQLITE_OK)
+		return false;
+
+	// Forget all cached lookups
+	network_cache_flush();
+
+	// Close database
+	dbclose(&db);
+
+	return true;
+}
+
+// Parse kernel's neighbor cache
+// Mirror of the kernel's neighbor cache. It is filled by one dump when
+// subscribing to neighbor events and kept up to date by the events afterwards
+// so the cache does not have to be read in full periodically. Another dump is
+// only needed when events have been lost. Used by the database thread only
+struct neighbor {
+	struct nl_neigh neigh;
+	// Changed since it has last been stored in the network table
+	bool changed;
+};
+
+static struct {
+	struct neighbor *entries;
+	unsigned int num;
+	unsigned int size;
+	int fd;
+	// Any entry changed
+	bool changed;
+} neighbors = { NULL, 0u, 0u, -1, false };
+
+// Apply a neighbor event to the mirror
+static void neighbor_event(const struct nl_neigh *neigh)
+{
+	unsigned int i = 0;
+	for(; i < neighbors.num; i++)
+		if(neighbors.entries[i].neigh.ifindex == neigh->ifindex &&
+		   strcmp(neighbors.entries[i].neigh.ip, neigh->ip) == 0)
+			break;
+
+	if(neigh->deleted)
+	{
+		// Keep the array dense
+		if(i < neighbors.num)
+			neighbors.entries[i] = neighbors.entries[--neighbors.num];
+		return;
+	}
+
+	if(i < neighbors.num)
+	{
+		// Most events are state changes like REACHABLE -> STALE which
+		// do not change anything we store
+		struct nl_neigh *old = &neighbors.entries[i].neigh;
+		if(old->complete == neigh->complete && strcmp(old->hwaddr, neigh->hwaddr) == 0 &&
+		   strcmp(old->iface, neigh->iface) == 0)
+			return;
+	}
+	else
+	{
+		if(neighbors.num == neighbors.size)
+		{
+			const unsigned int size = neighbors.size > 0 ? 2*neighbors.size : 64u;
+			struct neighbor *entries = realloc(neighbors.entries, size * sizeof(*entries));
+			if(entries == NULL)
+				return;
+			neighbors.entries = entries;
+			neighbors.size = size;
+		}
+		neighbors.num++;
+	}
+
+	neighbors.entries[i].neigh = *neigh;
+	neighbors.entries[i].changed = true;
+	neighbors.changed = true;
+}
+
+// Wait for the next message on the neighbor event socket
+static bool wait_neighbor_events(void)
+{
+	struct pollfd pfd = { .fd = neighbors.fd, .events = POLLIN };
+	return poll(&pfd, 1, 1000) > 0;
+}
+
+// Subscribe to neighbor events if not done yet, apply all pending events and
+// dump the neighbor cache again when events have been lost. Returns false if
+// the mirror is not available
+static bool sync_neighbors(void)
+{
+	bool dump = false;
+	if(neighbors.fd < 0)
+	{
+		if((neighbors.fd = nlneigh_subscribe()) < 0)
+			return false;
+		dump = true;
+	}
+
+	unsigned int events = nlneigh_read(neighbors.fd, neighbor_event);
+	for(unsigned int tries = 0; tries < 3 && (dump || events & NL_EVENTS_OVERFLOW); tries++)
+	{
+		log_debug(DEBUG_ARP, "Reading the entire neighbor cache (%s)", dump ? "subscribed" : "events lost");
+
+		// Start over, entries which are gone would be kept otherwise
+		neighbors.num = 0;
+		if(!nlneigh_dump(neighbors.fd))
+			break;
+		do
+			events = nlneigh_read(neighbors.fd, neighbor_event);
+		while(!(events & (NL_EVENTS_DONE | NL_EVENTS_OVERFLOW)) && wait_neighbor_events());
+
+		// Everything needs to be stored again
+		for(unsigned int i = 0; i < neighbors.num; i++)
+			neighbors.entries[i].changed = true;
+		neighbors.changed = true;
+		dump = false;
+
+		// Local interfaces may have changed as well
+		events |= NL_EVENTS_IFACE;
+	}
+
+	// Addresses or interfaces of this host changed, update them in the
+	// network table as well
+	if(events & NL_EVENTS_IFACE)
+		set_event(PARSE_NEIGHBOR_CACHE);
+
+	return true;
+}
+
+/**
+ * @brief Process pending neighbor, address and link events
+ *
+ * This is called frequently by the database thread. It only reads from the
+ * netlink socket, the database is not touched.
+ *
+ * @return true if neighbors changed and update_neighbors() should be called
+ */
+bool read_neighbor_events(void)
+{
+	if(!config.database.network.parseARPcache.v.b)
+	{
+		if(neighbors.fd > -1)
+		{
+			close(neighbors.fd);
+			neighbors.fd = -1;
+			neighbors.num = 0;
+		}
+		return false;
+	}
+
+	return sync_neighbors() && neighbors.changed;
+}
+
+// Add or update the network table entry of a neighbor cache entry. Without
+// client_status (incremental updates), unknown clients are not remembered
+static int process_neighbor(sqlite3 *db, struct netmap *map, const struct nl_neigh *neigh,
+                            enum arp_status *client_status, const int clients, const time_t now)
+{
+	const char *ip = neigh->ip, *hwaddr = neigh->hwaddr, *iface = neigh->iface;
+
+	if(!neigh->complete)
+	{
+		// This entry is incomplete, remember this to skip
+		// mock-device creation after ARP processing
+		// both false = do not create a new record if the client
+		//              is unknown (only DNS requesting clients
+		//              do this), the now value is ignored
+		lock_shm();
+		const int clientID = findClientID(ip, false, false, 0.0);
+		unlock_shm();
+		if(client_status != NULL && clientID >= 0 && clientID < clients)
+			client_status[clientID] = CLIENT_ARP_INCOMPLETE;
+
+		return SQLITE_OK;
+	}
+
+	// Get ID of this device in our network database. If it cannot be
+	// found, then this is a new device. We only use the hardware address
+	// to uniquely identify clients.
+	//
+	// Same MAC, two IPs: Non-deterministic (sequential) DHCP server, we
+	// update the IP address to the last seen one.
+	int devID = netmap_find_device(map, hwaddr);
+
+	// If we reach this point, we can check if this client
+	// is known to pihole-FTL
+	// both false = do not create a new record if the client
+	//              is unknown (only DNS requesting clients
+	//              do this), the now value is ignored
+	lock_shm();
+	const int clientID = findClientID(ip, false, false, 0.0);
+
+	// Set default values for a new device, may be updated
+	// below if the client is known to pihole-FTL
+	char *hostname = NULL;
+	bool client_valid = false;
+	time_t lastQuery = 0;
+	time_t firstSeen = now;
+	unsigned int numQueries = 0, totalQueries = 0;
+
+	// This client is known (by its IP address) to pihole-FTL if
+	// findClientID() returned a non-negative index
+	if(clientID >= 0 && clientID < clients)
+	{
+		clientsData *client = getClient(clientID, true);
+		if(!client)
+		{
+			unlock_shm();
+			return SQLITE_OK;
+		}
+
+		// Client is known to Pi-hole, update properties
+		// with their real values
+		client_valid = true;
+		hostname = strdup(getstr(client->namepos));
+		firstSeen = client->firstSeen;
+		lastQuery = client->lastQuery;
+		numQueries = client->numQueriesARP;
+		totalQueries = client->count;
+		if(client_status != NULL)
+			client_status[clientID] = CLIENT_ARP_COMPLETE;
+	}
+	else
+	{
+		// Client is not known to Pi-hole, create a
+		// mock-device with the default values set above
+		// and an empty hostname
+		hostname = strdup("");
+	}
+	unlock_shm();
+
+	// Device not in database, add new entry
+	if(client_valid && devID < 0)
+	{
+		// Try to obtain vendor from MAC database
+		char *macVendor = getMACVendor(hwaddr);
+
+		// Check if we recently added a mock-device with the same IP address
+		// and the ARP entry just came a bit delayed (reported by at least one user)
+		devID = find_recent_device_by_mock_hwaddr(map, ip, now);
+
+		// Exception for the case where the device is
+		// not yet in the database: Use total count of
+		// queries as the number of queries for the new
+		// device instead of the special ARP cache
+		// counter to add also the number of queries in
+		// the DNS history imported from the long-term
+		// database
+		numQueries = totalQueries;
+
+		bool success;
+		if(devID < 0)
+		{
+			// Device not known AND no recent mock-device found ---> create new device record
+			log_debug(DEBUG_ARP, "Network table: Creating new ARP device MAC = %s, IP = %s, hostname = \"%s\", vendor = \"%s\"",
+			          hwaddr, ip, hostname, macVendor);
+
+			// Create new record (INSERT)
+			success = insert_netDB_device(db, map, hwaddr, firstSeen, lastQuery, numQueries, macVendor, &devID);
+
+			if(success)
+			{
+				lock_shm();
+				clientsData *client = getClient(clientID, true);
+				if(client != NULL)
+				{
+					// Reset client ARP counter (we stored the entry in the database)
+					client->numQueriesARP = 0;
+				}
+				unlock_shm();
+
+				// Store hostname in the appropriate network_address record (if available)
+				update_netDB_name(map, ip, hostname, now);
+			}
+		}
+		else
+		{
+			// Device is ALREADY KNOWN ---> convert mock-device to a "real" one
+			log_debug(DEBUG_ARP, "Network table: Un-mocking ARP device MAC = %s, IP = %s, hostname = \"%s\", vendor = \"%s\"",
+			          hwaddr, ip, hostname, macVendor);
+
+			// Update/replace important device properties
+			success = unmock_netDB_device(db, map, hwaddr, macVendor, devID);
+
+			// Host name, count and last query timestamp will be set in the next
+			// loop iteration for the sake of simplicity
+		}
+
+		// Free allocated memory
+		free(hostname);
+		free(macVendor);
+
+		if(!success)
+		{
+			// Get SQLite error code
+			const int rc = sqlite3_errcode(db);
+			return rc == SQLITE_OK ? SQLITE_ERROR : rc;
+		}
+	}
+	// Device in database AND client known to Pi-hole
+	else if(client_valid)
+	{
+		log_debug(DEBUG_ARP, "Network table: Updating existing ARP device MAC = %s, IP = %s, hostname = \"%s\"",
+		          hwaddr, ip, hostname);
+
+		// Update timestamp of last query and number of queries if applicable
+		update_netDB_lastQuery(map, devID, lastQuery);
+		update_netDB_numQueries(map, devID, numQueries);
 
-	rc = dbquery(db, "UPDATE network_addresses SET name = NULL "
-	                 "WHERE nameUpdated < %lu;", (unsigned long)limit);
+		lock_shm();
+		// Acquire client pointer
+		clientsData *client = getClient(clientID, true);
+		if(client != NULL)
+		{
+			// Reset client ARP counter (we stored the entry in the network mirror)
+			client->numQueriesARP = 0;
+		}
+		unlock_shm();
 
-	return rc == SQLITE_OK;
-}
+		// Update hostname if available
+		update_netDB_name(map, ip, hostname, now);
 
-/**
- * @brief Flushes the network table by removing all IP addresses and devices.
- *
- * This function opens the database, deletes all entries from the
- * `network_addresses` and `network` tables, and then closes the database.
- *
- * @return true if the operation was successful, false otherwise.
- */
-bool flush_network_table(void)
-{
-	sqlite3 *db = dbopen(false, false);
-	if(db == NULL)
-		return false;
+		free(hostname);
+	}
+	// else: Device in database but not known to Pi-hole
+	else
+		free(hostname);
 
-	// Remove all IP addresses
-	if(dbquery(db, "DELETE FROM network_addresses;") != SQLITE_OK)
-		return false;
+	hostname = NULL;
 
-	// Remove all devices
-	if(dbquery(db, "DELETE FROM network;") != SQLITE_OK)
-		return false;
+	// Store interface if available
+	update_netDB_interface(map, devID, iface);
 
-	// Close database
-	dbclose(&db);
+	// Add unique IP address / mock-MAC pair to network_addresses table
+	if(devID > -1 && !add_netDB_network_address(map, devID, ip, now))
+		return SQLITE_NOMEM;
 
-	return true;
+	return SQLITE_OK;
 }
 
-// Parse kernel's neighbor cache
 void parse_neighbor_cache(sqlite3 *db)
 {
-	// Prepare buffers
-	char *linebuffer = NULL;
-	size_t linebuffersize = 0u;
 	unsigned int entries = 0u, additional_entries = 0u;
 	const time_t now = time(NULL);
+	enum arp_status *client_status = NULL;
+	struct netmap map = { 0 };
 
 	// Start ARP timer
 	if(config.debug.arp.v.b)
@@ -1285,317 +1990,75 @@ void parse_neighbor_cache(sqlite3 *db)
 	}
 
 	// Delete old entries from network table
-	if(!clean_network_table(db))
+	bool cleaned = false;
+	if(!clean_network_table(db, &cleaned))
 		return;
 
+	// Mirror the network tables in memory, all lookups below are done
+	// against this copy
+	if(!netmap_load(db, &map))
+		goto parse_neighbor_cache_end;
+
 	// Initialize array of status for individual clients used to
 	// remember the status of a client already seen in the neigh cache
 	lock_shm();
 	const int clients = counters->clients;
 	unlock_shm();
-	enum arp_status *client_status = calloc(clients, sizeof(enum arp_status));
+	client_status = calloc(clients, sizeof(enum arp_status));
+	if(client_status == NULL)
+		goto parse_neighbor_cache_end;
 	for(int i = 0; i < clients; i++)
 		client_status[i] = CLIENT_NOT_HANDLED;
 
-	// Try to access the kernel's neighbor cache
-	if(config.database.network.parseARPcache.v.b)
+	// Process the kernel's neighbor cache
+	if(config.database.network.parseARPcache.v.b && sync_neighbors())
 	{
-		// Parse ARP cache and add new entries to network table
-		FILE *arpfp = NULL;
-		const char cmd[] = "ip neigh show";
-		errno = ENOMEM;
-		if((arpfp = popen(cmd, "r")) == NULL)
+		for(unsigned int i = 0; i < neighbors.num; i++)
 		{
-			log_warn("Command \"%s\" failed: %s", cmd, strerror(errno));
-			free(client_status);
-			return;
-		}
-
-		// Read ARP cache line by line
-		while(getline(&linebuffer, &linebuffersize, arpfp) != -1)
-		{
-			// Skip if line buffer is invalid
-			if(linebuffer == NULL)
-				continue;
-
 			// Check thread cancellation
 			if(killed)
 				break;
 
-			// Analyze line
-			char ip[128], hwaddr[128], iface[128];
-			int num = sscanf(linebuffer, "%99s dev %99s lladdr %99s",
-			                 ip, iface, hwaddr);
-
-			// Ensure strings are null-terminated in case we hit the max.
-			// length limitation
-			ip[sizeof(ip)-1] = '\0';
-			iface[sizeof(iface)-1] = '\0';
-			hwaddr[sizeof(hwaddr)-1] = '\0';
-
-			// Check if we want to process the line we just read
-			if(num != 3)
-			{
-				if(num == 2)
-				{
-					// This line is incomplete, remember this to skip
-					// mock-device creation after ARP processing
-					// both false = do not create a new record if the client
-					//              is unknown (only DNS requesting clients
-					//              do this), the now value is ignored
-					lock_shm();
-					int clientID = findClientID(ip, false, false, 0.0);
-					unlock_shm();
-					if(clientID >= 0 && clientID < clients)
-						client_status[clientID] = CLIENT_ARP_INCOMPLETE;
-				}
-
-				// Skip to the next row in the neigh cache rather when
-				// marking as incomplete client
-				continue;
-			}
-
-			// Get ID of this device in our network database. If it cannot be
-			// found, then this is a new device. We only use the hardware address
-			// to uniquely identify clients and only use the first returned ID.
-			//
-			// Same MAC, two IPs: Non-deterministic (sequential) DHCP server, we
-			// update the IP address to the last seen one.
-			//
-			// We can run this SELECT inside the currently active transaction as
-			// only the changed to the database are collected for latter
-			// commitment. Read-only access such as this SELECT command will be
-			// executed immediately on the database.
-			int dbID = find_device_by_hwaddr(db, hwaddr);
-
-			if(dbID == DB_FAILED)
-			{
-				// Get SQLite error code and return early from loop
-				rc = sqlite3_errcode(db);
-				break;
-			}
-
-			// If we reach this point, we can check if this client
-			// is known to pihole-FTL
-			// both false = do not create a new record if the client
-			//              is unknown (only DNS requesting clients
-			//              do this), the now value is ignored
-			lock_shm();
-			const int clientID = findClientID(ip, false, false, 0.0);
-
-			// Set default values for a new device, may be updated
-			// below if the client is known to pihole-FTL
-			char *hostname = NULL;
-			bool client_valid = false;
-			time_t lastQuery = 0;
-			time_t firstSeen = now;
-			unsigned int numQueries = 0, totalQueries = 0;
-
-			// This client is known (by its IP address) to pihole-FTL if
-			// findClientID() returned a non-negative index
-			if(clientID >= 0 && clientID < clients)
-			{
-				clientsData *client = getClient(clientID, true);
-				if(!client)
-					continue;
-
-				// Client is known to Pi-hole, update properties
-				// with their real values
-				client_valid = true;
-				hostname = strdup(getstr(client->namepos));
-				firstSeen = client->firstSeen;
-				lastQuery = client->lastQuery;
-				numQueries = client->numQueriesARP;
-				totalQueries = client->count;
-				client_status[clientID] = CLIENT_ARP_COMPLETE;
-			}
-			else
-			{
-				// Client is not known to Pi-hole, create a
-				// mock-device with the default values set above
-				// and an empty hostname
-				hostname = strdup("");
-			}
-			unlock_shm();
-
-			// Device not in database, add new entry
-			if(client_valid && dbID == DB_NODATA)
-			{
-				// Try to obtain vendor from MAC database
-				char *macVendor = getMACVendor(hwaddr);
-
-				// Check if we recently added a mock-device with the same IP address
-				// and the ARP entry just came a bit delayed (reported by at least one user)
-				dbID = find_recent_device_by_mock_hwaddr(db, ip);
-
-				// Exception for the case where the device is
-				// not yet in the database: Use total count of
-				// queries as the number of queries for the new
-				// device instead of the special ARP cache
-				// counter to add also the number of queries in
-				// the DNS history imported from the long-term
-				// database
-				numQueries = totalQueries;
-
-				if(dbID == DB_NODATA)
-				{
-					// Device not known AND no recent mock-device found ---> create new device record
-					log_debug(DEBUG_ARP, "Network table: Creating new ARP device MAC = %s, IP = %s, hostname = \"%s\", vendor = \"%s\"",
-					          hwaddr, ip, hostname, macVendor);
-
-					// Create new record (INSERT)
-					if(!insert_netDB_device(db, hwaddr, firstSeen, lastQuery, numQueries, macVendor, &dbID))
-					{
-						// Free allocated memory
-						free(hostname);
-						free(macVendor);
-						break;
-					}
-
-					lock_shm();
-					clientsData *client = getClient(clientID, true);
-					if(client != NULL)
-					{
-						// Reset client ARP counter (we stored the entry in the database)
-						client->numQueriesARP = 0;
-					}
-					unlock_shm();
-
-					// Store hostname in the appropriate network_address record (if available)
-					if(strlen(hostname) > 0)
-					{
-						if(!update_netDB_name(db, ip, hostname))
-						{
-							// Free allocated memory
-							free(hostname);
-							free(macVendor);
-							break;
-						}
-					}
-				}
-				else
-				{
-					// Device is ALREADY KNOWN ---> convert mock-device to a "real" one
-					log_debug(DEBUG_ARP, "Network table: Un-mocking ARP device MAC = %s, IP = %s, hostname = \"%s\", vendor = \"%s\"",
-					          hwaddr, ip, hostname, macVendor);
-
-					// Update/replace important device properties
-					if(!unmock_netDB_device(db, hwaddr, macVendor, dbID))
-					{
-						// Free allocated memory
-						free(hostname);
-						free(macVendor);
-						break;
-					}
-
-					// Host name, count and last query timestamp will be set in the next
-					// loop iteration for the sake of simplicity
-				}
-
-				// Free allocated memory
-				free(macVendor);
-			}
-			// Device in database AND client known to Pi-hole
-			else if(client_valid)
+			rc = process_neighbor(db, &map, &neighbors.entries[i].neigh, client_status, clients, now);
+			if(rc != SQLITE_OK)
 			{
-				log_debug(DEBUG_ARP, "Network table: Updating existing ARP device MAC = %s, IP = %s, hostname = \"%s\"",
-				          hwaddr, ip, hostname);
-
-				// Update timestamp of last query if applicable
-				if(!update_netDB_lastQuery(db, dbID, lastQuery))
-				{
-					// Free allocated memory
-					free(hostname);
-					break;
-				}
-
-				// Update number of queries if applicable
-				if(!update_netDB_numQueries(db, dbID, numQueries))
-				{
-					// Free allocated memory
-					free(hostname);
-					break;
-				}
-
-				lock_shm();
-				// Acquire client pointer
-				clientsData *client = getClient(clientID, true);
-				if(client != NULL)
-				{
-					// Reset client ARP counter (we stored the entry in the database)
-					client->numQueriesARP = 0;
-				}
-				unlock_shm();
-
-				// Update hostname if available
-				if(!update_netDB_name(db, ip, hostname))
-				{
-					// Free allocated memory
-					free(hostname);
-					break;
-				}
+				log_err("Database error in ARP cache processing loop");
+				goto parse_neighbor_cache_end;
 			}
-			// else: Device in database but not known to Pi-hole
-
-			free(hostname);
-			hostname = NULL;
-
-			// Store interface if available
-			if(dbID > DB_NODATA && !update_netDB_interface(db, dbID, iface))
-				break;
-
-			// Add unique IP address / mock-MAC pair to network_addresses table
-			if(dbID > DB_NODATA && !add_netDB_network_address(db, dbID, ip))
-				break;
+			neighbors.entries[i].changed = false;
 
 			// Count number of processed ARP cache entries
 			entries++;
 		}
-
-		// Close pipe handle and free allocated memory
-		pclose(arpfp);
-		if(linebuffer != NULL)
-			free(linebuffer);
-
-		if(rc != SQLITE_OK)
-		{
-			log_err("Database error in ARP cache processing loop");
-			free(client_status);
-			return;
-		}
+		neighbors.changed = false;
 	}
 
 	// Check thread cancellation
 	if(killed)
-	{
-		free(client_status);
-		return;
-	}
+		goto parse_neighbor_cache_end;
 
 	// Loop over all clients known to FTL and ensure we add them all to the
 	// database
-	if(!add_FTL_clients_to_network_table(db, client_status, clients, now, &additional_entries))
-	{
-		free(client_status);
-		return;
-	}
-
-	free(client_status);
-	client_status = NULL;
+	if(!add_FTL_clients_to_network_table(db, &map, client_status, clients, now, &additional_entries))
+		goto parse_neighbor_cache_end;
 
 	// Check thread cancellation
 	if(killed)
-		return;
+		goto parse_neighbor_cache_end;
 
 	// Finally, loop over the available interfaces to ensure we list the
 	// IP addresses correctly (local addresses are NOT contained in the
 	// ARP/neighbor cache).
-	if(!add_local_interfaces_to_network_table(db, now, &additional_entries))
-		return;
+	if(!add_local_interfaces_to_network_table(db, &map, now, &additional_entries))
+		goto parse_neighbor_cache_end;
 
 	// Check thread cancellation
 	if(killed)
-		return;
+		goto parse_neighbor_cache_end;
+
+	// Write all changed devices and addresses to the database
+	if(!netmap_flush(db, &map))
+		goto parse_neighbor_cache_end;
 
 	// Ensure mock-devices which are not assigned to any addresses any more
 	// (they have been converted to "real" devices), are removed at this point
@@ -1606,7 +2069,7 @@ void parse_neighbor_cache(sqlite3 *db)
 	{
 		log_err("Database error in mock-device cleaning statement");
 		checkFTLDBrc(rc);
-		return;
+		goto parse_neighbor_cache_end;
 	}
 
 	// Actually update the database
@@ -1618,12 +2081,101 @@ void parse_neighbor_cache(sqlite3 *db)
 			log_err("Storing devices in network table failed: %s", sqlite3_errstr(rc));
 
 		checkFTLDBrc(rc);
-		return;
+		goto parse_neighbor_cache_end;
 	}
 
+	// Drop cached lookups which may be outdated now. Expiring addresses
+	// and names may affect any device so everything is forgotten then
+	if(cleaned)
+		network_cache_flush();
+	else
+		netmap_invalidate_cache(&map);
+
 	// Debug logging
 	log_debug(DEBUG_ARP, "ARP table processing (%u entries from ARP, %u from FTL's cache) took %.1f ms",
 	          entries, additional_entries, timer_elapsed_msec(ARP_TIMER));
+
+parse_neighbor_cache_end:
+	free(client_status);
+	netmap_free(&map);
+}
+
+/**
+ * @brief Store changed neighbors in the network table
+ *
+ * Only neighbors which changed since the last update are processed. Clients
+ * not in the neighbor cache, the local interfaces and the cleanup of old
+ * entries are left to the periodic parse_neighbor_cache().
+ *
+ * @param db Open database connection
+ */
+void update_neighbors(sqlite3 *db)
+{
+	const time_t now = time(NULL);
+	struct netmap map = { 0 };
+	unsigned int entries = 0u;
+
+	if(!neighbors.changed)
+		return;
+
+	// Start ARP timer
+	if(config.debug.arp.v.b)
+		timer_start(ARP_TIMER);
+
+	const char sql[] = "BEGIN TRANSACTION IMMEDIATE";
+	int rc = dbquery(db, sql);
+	if(rc != SQLITE_OK)
+	{
+		// dbquery() above already logs the reason for why the query
+		// failed, the changes are kept for the next attempt
+		log_warn("Storing devices in network table (\"%s\") failed", sql);
+		return;
+	}
+
+	if(!netmap_load(db, &map))
+		goto update_neighbors_end;
+
+	lock_shm();
+	const int clients = counters->clients;
+	unlock_shm();
+
+	for(unsigned int i = 0; i < neighbors.num; i++)
+	{
+		if(!neighbors.entries[i].changed)
+			continue;
+
+		rc = process_neighbor(db, &map, &neighbors.entries[i].neigh, NULL, clients, now);
+		if(rc != SQLITE_OK)
+		{
+			log_err("Database error in ARP cache processing loop");
+			goto update_neighbors_end;
+		}
+		entries++;
+	}
+
+	if(!netmap_flush(db, &map))
+		goto update_neighbors_end;
+
+	if((rc = dbquery(db, "END TRANSACTION")) != SQLITE_OK)
+	{
+		log_warn("Storing devices in network table failed: %s", sqlite3_errstr(rc));
+		checkFTLDBrc(rc);
+		goto update_neighbors_end;
+	}
+
+	// Everything has been stored
+	for(unsigned int i = 0; i < neighbors.num; i++)
+		neighbors.entries[i].changed = false;
+	neighbors.changed = false;
+	netmap_invalidate_cache(&map);
+
+	log_debug(DEBUG_ARP, "Stored %u changed neighbors in %.1f ms",
+	          entries, timer_elapsed_msec(ARP_TIMER));
+
+update_neighbors_end:
+	if(neighbors.changed)
+		dbquery(db, "ROLLBACK TRANSACTION");
+	netmap_free(&map);
 }
 
 // Loop over all entries in network table and unify entries by their hwaddr
@@ -1930,6 +2482,11 @@ char *__attribute__((malloc)) getMACfromIP(sqlite3 *db, const char *ipaddr)
 	if(FTLDBerror())
 		return NULL;
 
+	// Check for a cached result first
+	char *hwaddr = NULL;
+	if(network_cache_get(ipaddr, NETWORK_CACHE_MAC, &hwaddr, NULL))
+		return hwaddr;
+
 	// Open pihole-FTL.db database file if needed
 	bool db_opened = false;
 	if(db == NULL)
@@ -1947,7 +2504,6 @@ char *__attribute__((malloc)) getMACfromIP(sqlite3 *db, const char *ipaddr)
 	// Prepare SQLite statement
 	// We request the most recent IP entry in case there an IP appears
 	// multiple times in the network_addresses table
-	char *hwaddr = NULL;
 	bool success = false;
 	sqlite3_stmt *stmt = NULL;
 	const char *querystr = "SELECT hwaddr FROM network WHERE id = "
@@ -1990,6 +2546,7 @@ char *__attribute__((malloc)) getMACfromIP(sqlite3 *db, const char *ipaddr)
 	if(hwaddr != NULL)
 		log_debug(DEBUG_DATABASE, "Found database hardware address %s -> %s", ipaddr, hwaddr);
 
+	network_cache_put(ipaddr, NETWORK_CACHE_MAC, hwaddr, 0);
 	success = true;
 
 getMACfromIP_end:
@@ -2015,6 +2572,11 @@ int getAliasclientIDfromIP(sqlite3 *db, const char *ipaddr)
 	if(FTLDBerror())
 		return DB_FAILED;
 
+	// Check for a cached result first
+	int aliasclient_id = DB_FAILED;
+	if(network_cache_get(ipaddr, NETWORK_CACHE_ALIAS, NULL, &aliasclient_id))
+		return aliasclient_id;
+
 	// Open pihole-FTL.db database file if needed
 	bool db_opened = false;
 	if(db == NULL)
@@ -2034,7 +2596,6 @@ int getAliasclientIDfromIP(sqlite3 *db, const char *ipaddr)
 	// multiple times in the network_addresses table
 	bool success = false;
 	sqlite3_stmt *stmt = NULL;
-	int aliasclient_id = DB_FAILED;
 	const char *querystr = "SELECT aliasclient_id FROM network WHERE id = "
 	                       "(SELECT network_id FROM network_addresses "
 	                       "WHERE ip = ? "
@@ -2076,6 +2637,7 @@ int getAliasclientIDfromIP(sqlite3 *db, const char *ipaddr)
 	log_debug(DEBUG_ALIASCLIENTS, "   Aliasclient ID %s -> %i%s", ipaddr, aliasclient_id,
 	          aliasclient_id < 0 ? " (NOT FOUND)" : "");
 
+	network_cache_put(ipaddr, NETWORK_CACHE_ALIAS, NULL, aliasclient_id);
 	success = true;
 
 getAliasclientIDfromIP_end:
@@ -2108,6 +2670,14 @@ char *__attribute__((malloc)) getNameFromIP(sqlite3 *db, const char *ipaddr)
 		return NULL;
 	}
 
+	// Check for a cached result first
+	char *name = NULL;
+	if(network_cache_get(ipaddr, NETWORK_CACHE_NAME, &name, NULL))
+	{
+		log_debug(DEBUG_RESOLVER, "Found cached host name %s -> %s", ipaddr, name != NULL ? name : "(none)");
+		return name;
+	}
+
 	// Open pihole-FTL.db database file if needed
 	bool db_opened = false;
 	if(db == NULL)
@@ -2123,7 +2693,6 @@ char *__attribute__((malloc)) getNameFromIP(sqlite3 *db, const char *ipaddr)
 	}
 
 	// Check for a host name associated with the same IP address
-	char *name = NULL;
 	bool success = false;
 	sqlite3_stmt *stmt = NULL;
 	const char *querystr = "SELECT name FROM network_addresses WHERE name IS NOT NULL AND ip = ?;";
@@ -2168,6 +2737,8 @@ char *__attribute__((malloc)) getNameFromIP(sqlite3 *db, const char *ipaddr)
 	// Return here if we found the name
 	if(name != NULL)
 	{
+		network_cache_put(ipaddr, NETWORK_CACHE_NAME, name, 0);
+
 		if(db_opened)
 			dbclose(&db);
 
@@ -2226,6 +2797,7 @@ char *__attribute__((malloc)) getNameFromIP(sqlite3 *db, const char *ipaddr)
 		goto getNameFromIP_end;
 	}
 
+	network_cache_put(ipaddr, NETWORK_CACHE_NAME, name, 0);
 	success = true;
 
 getNameFromIP_end:
@@ -2331,6 +2903,11 @@ char *__attribute__((malloc)) getIfaceFromIP(sqlite3 *db, const char *ipaddr)
 	if(FTLDBerror())
 		return NULL;
 
+	// Check for a cached result first
+	char *iface = NULL;
+	if(network_cache_get(ipaddr, NETWORK_CACHE_IFACE, &iface, NULL))
+		return iface;
+
 	// Open pihole-FTL.db database file if needed
 	bool db_opened = false;
 	if(db == NULL)
@@ -2346,7 +2923,6 @@ char *__attribute__((malloc)) getIfaceFromIP(sqlite3 *db, const char *ipaddr)
 	}
 
 	// Prepare SQLite statement
-	char *iface = NULL;
 	bool success = false;
 	sqlite3_stmt *stmt = NULL;
 	const char *querystr = "SELECT interface FROM network "
@@ -2391,6 +2967,7 @@ char *__attribute__((malloc)) getIfaceFromIP(sqlite3 *db, const char *ipaddr)
 	if(iface != NULL)
 		log_debug(DEBUG_DATABASE, "Found database interface %s -> %s", ipaddr, iface);
 
+	network_cache_put(ipaddr, NETWORK_CACHE_IFACE, iface, 0);
 	success = true;
 
 getIfaceFromIP_end:
@@ -2408,24 +2985,50 @@ getIfaceFromIP_end:
 	return iface;
 }
 
-// Select records from the network table
-bool networkTable_readDevices(sqlite3 *db, sqlite3_stmt **read_stmt, const char **message)
+// Select a page of devices together with their most recently seen addresses
+// using a single query. Each row contains one address, devices without any
+// address are returned once with a NULL address. Devices are sorted by their
+// last query (and ID), the last device of a page is the key of the next one
+bool networkTable_readDevices(sqlite3 *db, sqlite3_stmt **read_stmt, const network_page *page, const char **message)
 {
 	// Prepare SQLite statement
-	const char *querystr = "SELECT id,hwaddr,interface,firstSeen,lastQuery,numQueries,macVendor FROM network ORDER BY lastQuery DESC;";
-	const int rc = sqlite3_prepare_v2(db, querystr, -1, read_stmt, NULL);
-	if(rc != SQLITE_OK){
+	const char *querystr =
+		"WITH d AS (SELECT id,hwaddr,interface,firstSeen,lastQuery,numQueries,macVendor FROM network "
+		           "WHERE ?1 < 0 OR (lastQuery,id) < (?1,?2) "
+		           "ORDER BY lastQuery DESC, id DESC LIMIT ?3), "
+		     "a AS (SELECT network_id,ip,lastSeen,name,nameUpdated,"
+		                  "row_number() OVER (PARTITION BY network_id ORDER BY lastSeen DESC) AS n "
+		           "FROM network_addresses WHERE network_id IN (SELECT id FROM d)) "
+		"SELECT d.*,a.ip,a.lastSeen,a.name,a.nameUpdated FROM d "
+		"LEFT JOIN a ON a.network_id = d.id AND a.n <= ?4 "
+		"ORDER BY d.lastQuery DESC, d.id DESC, a.n;";
+	int rc = sqlite3_prepare_v2(db, querystr, -1, read_stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
 		*message = sqlite3_errstr(rc);
 		log_err("networkTable_readDevices() - SQL error prepare (%i): %s",
 		        rc, *message);
 		return false;
 	}
 
+	if((rc = sqlite3_bind_int64(*read_stmt, 1, page->lastQuery)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_int(*read_stmt, 2, page->id)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_int64(*read_stmt, 3, page->devices)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_int64(*read_stmt, 4, page->addresses)) != SQLITE_OK)
+	{
+		*message = sqlite3_errstr(rc);
+		log_err("networkTable_readDevices(): Failed to bind page (error %d) - %s",
+		        rc, *message);
+		return false;
+	}
+
 	return true;
 }
 
-// Get a record from the network table
-bool networkTable_readDevicesGetRecord(sqlite3_stmt *read_stmt, network_record *network, const char **message)
+// Get a row of networkTable_readDevices(), the address is NULL if the
+// device has none
+bool networkTable_readDevicesGetRecord(sqlite3_stmt *read_stmt, network_record *network,
+                                       network_addresses_record *network_address, const char **message)
 {
 	// Perform step
 	const int rc = sqlite3_step(read_stmt);
@@ -2440,6 +3043,10 @@ bool networkTable_readDevicesGetRecord(sqlite3_stmt *read_stmt, network_record *
 		network->lastQuery = sqlite3_column_int(read_stmt, 4);
 		network->numQueries = sqlite3_column_int(read_stmt, 5);
 		network->macVendor = (char*)sqlite3_column_text(read_stmt, 6);
+		network_address->ip = (char*)sqlite3_column_text(read_stmt, 7);
+		network_address->lastSeen = sqlite3_column_int64(read_stmt, 8);
+		network_address->name = (char*)sqlite3_column_text(read_stmt, 9);
+		network_address->nameUpdated = sqlite3_column_int64(read_stmt, 10);
 		return true;
 	}
 
@@ -2465,69 +3072,6 @@ void networkTable_readDevicesFinalize(sqlite3_stmt *read_stmt)
 	sqlite3_finalize(read_stmt);
 }
 
-// Select records from the network table (IPs)
-bool networkTable_readIPs(sqlite3 *db, sqlite3_stmt **read_stmt, const int id, const char **message)
-{
-	// Prepare SQLite statement
-	const char *querystr = "SELECT ip,lastSeen,name,nameUpdated FROM network_addresses WHERE network_id = ? ORDER BY lastSeen DESC;";
-	int rc = sqlite3_prepare_v2(db, querystr, -1, read_stmt, NULL);
-	if( rc != SQLITE_OK ){
-		*message = sqlite3_errstr(rc);
-		log_err("networkTable_readIPs(%i) - SQL error prepare (%i): %s",
-		        id, rc, *message);
-		return false;
-	}
-
-	// Bind ipaddr to prepared statement
-	if((rc = sqlite3_bind_int(*read_stmt, 1, id)) != SQLITE_OK)
-	{
-		*message = sqlite3_errstr(rc);
-		log_err("networkTable_readIPs(%i): Failed to bind domain (error %d) - %s",
-		        id, rc, *message);
-		return false;
-	}
-
-	return true;
-}
-
-// Get a record from the network_addresses table (IPs)
-bool networkTable_readIPsGetRecord(sqlite3_stmt *read_stmt, network_addresses_record *network_addresses, const char **message)
-{
-	// Perform step
-	const int rc = sqlite3_step(read_stmt);
-
-	// Valid row
-	if(rc == SQLITE_ROW)
-	{
-		network_addresses->ip = (char*)sqlite3_column_text(read_stmt, 0);
-		network_addresses->lastSeen = sqlite3_column_int64(read_stmt, 1);
-		network_addresses->name = (char*)sqlite3_column_text(read_stmt, 2);
-		network_addresses->nameUpdated = sqlite3_column_int64(read_stmt, 1);
-		return true;
-	}
-
-	// Check for error. An error happened when the result is neither
-	// SQLITE_ROW (we returned earlier in this case), nor
-	// SQLITE_DONE (we are finished reading the table)
-	if(rc != SQLITE_DONE)
-	{
-		*message = sqlite3_errstr(rc);
-		log_err("networkTable_readDevicesGetIP() - SQL error step (%i): %s",
-		        rc, *message);
-		return false;
-	}
-
-	// Finished reading, nothing to get here
-	return false;
-}
-
-// Finalize statement of a gravity database transaction
-void networkTable_readIPsFinalize(sqlite3_stmt *read_stmt)
-{
-	// Finalize statement
-	sqlite3_finalize(read_stmt);
-}
-
 // Delete a device from the network table
 bool networkTable_deleteDevice(sqlite3 *db, const int id, int *deleted, const char **message)
 {
@@ -2601,6 +3145,9 @@ bool networkTable_deleteDevice(sqlite3 *db, const int id, int *deleted, const ch
 	// Check if we deleted any rows
 	*deleted += sqlite3_changes(db);
 
+	// Forget all cached lookups, we do not know the addresses of this device
+	network_cache_flush();
+
 	success = true;
 
 networkTable_deleteDevice_end:
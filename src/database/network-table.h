@@ -17,6 +17,8 @@ bool create_network_addresses_table(sqlite3 *db);
 bool create_network_addresses_with_names_table(sqlite3 *db);
 bool create_network_addresses_network_id_index(sqlite3 *db);
 void parse_neighbor_cache(sqlite3 *db);
+bool read_neighbor_events(void);
+void update_neighbors(sqlite3 *db);
 bool updateMACVendorRecords(sqlite3 *db);
 bool unify_hwaddr(sqlite3 *db);
 char *getMACfromIP(sqlite3 *db, const char* ipaddr) __attribute__((malloc));
@@ -26,6 +28,7 @@ char *getNameFromMAC(const char *client) __attribute__((malloc));
 char *getIfaceFromIP(sqlite3 *db, const char* ipaddr) __attribute__((malloc));
 void resolveNetworkTableNames(void);
 bool flush_network_table(void);
+void network_cache_flush(void);
 bool isMAC(const char *input) __attribute__ ((pure));
 
 typedef struct {
@@ -38,9 +41,6 @@ typedef struct {
 	time_t lastQuery;
 } network_record;
 
-bool networkTable_readDevices(sqlite3 *db, sqlite3_stmt **read_stmt, const char **message);
-bool networkTable_readDevicesGetRecord(sqlite3_stmt *read_stmt, network_record *network, const char **message);
-void networkTable_readDevicesFinalize(sqlite3_stmt *read_stmt);
 
 typedef struct {
 	const char *ip;
@@ -49,9 +49,17 @@ typedef struct {
 	time_t nameUpdated;
 } network_addresses_record;
 
-bool networkTable_readIPs(sqlite3 *db, sqlite3_stmt **read_stmt, const int id, const char **message);
-bool networkTable_readIPsGetRecord(sqlite3_stmt *read_stmt, network_addresses_record *network_addresses, const char **message);
-void networkTable_readIPsFinalize(sqlite3_stmt *read_stmt);
+typedef struct {
+	time_t lastQuery; // only devices before this one (negative = from the start)
+	int id;
+	unsigned int devices;
+	unsigned int addresses;
+} network_page;
+
+bool networkTable_readDevices(sqlite3 *db, sqlite3_stmt **read_stmt, const network_page *page, const char **message);
+bool networkTable_readDevicesGetRecord(sqlite3_stmt *read_stmt, network_record *network,
+                                       network_addresses_record *network_address, const char **message);
+void networkTable_readDevicesFinalize(sqlite3_stmt *read_stmt);
 
 bool networkTable_deleteDevice(sqlite3 *db, const int id, int *deleted, const char **message);
 
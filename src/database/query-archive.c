@@ -0,0 +1,848 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Columnar query archive
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file query-archive.c
+* @brief Compressed columnar storage of old queries.
+*
+* Old partitions of the long-term query storage are only ever aggregated.
+* They are converted into chunks of up to ARCHIVE_CHUNK_ROWS queries stored in
+* the query_archive table. Each chunk stores its columns one after another:
+* IDs and timestamps (in milliseconds) are delta-encoded as variable-length
+* integers, type, status and reply type are bit-packed with the width their
+* largest value needs and domain, client and upstream IDs are replaced by
+* bit-packed indices into a sorted dictionary of the values used in the chunk.
+* The result is additionally deflated.
+*
+* Only the columns needed by the long-term statistics are kept. Archived
+* queries are read through the virtual table query_archive_rows which has the
+* same columns as query_storage (the columns not kept are NULL) and is part of
+* the query_storage view. Constraints on timestamp and ID are used to skip
+* chunks which cannot contain matching queries.
+*/
+
+#include "FTL.h"
+#include "database/query-archive.h"
+#include "database/common.h"
+#include "log.h"
+// mz_compress2()
+#include "zip/miniz/miniz.h"
+// DBL_MAX
+#include <float.h>
+// llround()
+#include <math.h>
+
+#define ARCHIVE_VERSION 1u
+// Wider values could overflow the bit accumulators below
+#define ARCHIVE_MAX_WIDTH 56u
+
+struct buffer {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+};
+
+struct reader {
+	const unsigned char *data;
+	size_t len;
+	size_t pos;
+};
+
+static bool reserve(struct buffer *buf, const size_t len)
+{
+	if(buf->len + len <= buf->size)
+		return true;
+
+	size_t size = buf->size > 0 ? buf->size : 4096u;
+	while(size < buf->len + len)
+		size *= 2;
+
+	unsigned char *data = realloc(buf->data, size);
+	if(data == NULL)
+		return false;
+
+	buf->data = data;
+	buf->size = size;
+	return true;
+}
+
+static bool put_varint(struct buffer *buf, uint64_t value)
+{
+	if(!reserve(buf, 10))
+		return false;
+
+	do
+	{
+		const unsigned char byte = value & 0x7F;
+		value >>= 7;
+		buf->data[buf->len++] = byte | (value > 0 ? 0x80 : 0x00);
+	} while(value > 0);
+
+	return true;
+}
+
+static bool get_varint(struct reader *rd, uint64_t *value)
+{
+	*value = 0;
+	for(unsigned int shift = 0; shift < 64; shift += 7)
+	{
+		if(rd->pos >= rd->len)
+			return false;
+
+		const unsigned char byte = rd->data[rd->pos++];
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if((byte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+// Map signed to unsigned integers so small negative deltas stay small
+static inline uint64_t __attribute__((const)) zigzag(const int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t __attribute__((const)) unzigzag(const uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1u);
+}
+
+static inline unsigned int __attribute__((const)) bit_width(const uint64_t value)
+{
+	return value == 0 ? 0u : 64u - (unsigned int)__builtin_clzll(value);
+}
+
+static bool put_bits(struct buffer *buf, const sqlite3_int64 *values, const unsigned int count, const unsigned int width)
+{
+	const size_t bytes = ((size_t)count * width + 7u) / 8u;
+	if(!reserve(buf, bytes))
+		return false;
+
+	uint64_t acc = 0;
+	unsigned int have = 0;
+	for(unsigned int i = 0; i < count; i++)
+	{
+		acc |= (uint64_t)values[i] << have;
+		for(have += width; have >= 8; have -= 8, acc >>= 8)
+			buf->data[buf->len++] = acc & 0xFF;
+	}
+	if(have > 0)
+		buf->data[buf->len++] = acc & 0xFF;
+
+	return true;
+}
+
+static bool get_bits(struct reader *rd, sqlite3_int64 *values, const unsigned int count, const unsigned int width)
+{
+	const size_t bytes = ((size_t)count * width + 7u) / 8u;
+	if(width > ARCHIVE_MAX_WIDTH || rd->len - rd->pos < bytes)
+		return false;
+
+	const unsigned char *data = rd->data + rd->pos;
+	const uint64_t mask = (1ULL << width) - 1u;
+	uint64_t acc = 0;
+	unsigned int have = 0;
+	for(unsigned int i = 0; i < count; i++)
+	{
+		for(; have < width; have += 8)
+			acc |= (uint64_t)*data++ << have;
+		values[i] = acc & mask;
+		acc >>= width;
+		have -= width;
+	}
+	rd->pos += bytes;
+
+	return true;
+}
+
+static void free_chunk(struct archive_chunk *chunk)
+{
+	free(chunk->id);
+	free(chunk->timestamp);
+	for(unsigned int c = 0; c < ARCHIVE_COLUMNS; c++)
+		free(chunk->column[c]);
+	memset(chunk, 0, sizeof(*chunk));
+}
+
+static bool alloc_chunk(struct archive_chunk *chunk, const unsigned int count)
+{
+	free_chunk(chunk);
+	bool okay = (chunk->id = calloc(count, sizeof(*chunk->id))) != NULL &&
+	            (chunk->timestamp = calloc(count, sizeof(*chunk->timestamp))) != NULL;
+	for(unsigned int c = 0; okay && c < ARCHIVE_COLUMNS; c++)
+		okay = (chunk->column[c] = calloc(count, sizeof(*chunk->column[c]))) != NULL;
+
+	if(!okay)
+		free_chunk(chunk);
+
+	return okay;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	const sqlite3_int64 x = *(const sqlite3_int64*)a, y = *(const sqlite3_int64*)b;
+	return (x > y) - (x < y);
+}
+
+static bool encode_chunk(const struct archive_chunk *chunk, struct buffer *buf)
+{
+	const unsigned int count = chunk->count;
+	bool okay = put_varint(buf, ARCHIVE_VERSION) && put_varint(buf, count);
+
+	// IDs are strictly increasing, timestamps nearly so
+	sqlite3_int64 prev_id = 0, prev_ms = 0;
+	for(unsigned int i = 0; okay && i < count; i++)
+	{
+		const sqlite3_int64 ms = llround(1e3 * chunk->timestamp[i]);
+		okay = put_varint(buf, zigzag(chunk->id[i] - prev_id)) &&
+		       put_varint(buf, zigzag(ms - prev_ms));
+		prev_id = chunk->id[i];
+		prev_ms = ms;
+	}
+
+	// Small enumerations are bit-packed as they are
+	for(unsigned int c = ARCHIVE_TYPE; okay && c <= ARCHIVE_REPLY_TYPE; c++)
+	{
+		sqlite3_int64 max = 0;
+		for(unsigned int i = 0; i < count; i++)
+			if(chunk->column[c][i] > max)
+				max = chunk->column[c][i];
+
+		const unsigned int width = bit_width(max);
+		okay = width <= ARCHIVE_MAX_WIDTH && put_varint(buf, width) &&
+		       put_bits(buf, chunk->column[c], count, width);
+	}
+
+	// IDs referring to other tables are replaced by indices into a
+	// dictionary of the values used in this chunk
+	sqlite3_int64 *dict = okay ? malloc(count * sizeof(*dict)) : NULL;
+	sqlite3_int64 *index = okay ? malloc(count * sizeof(*index)) : NULL;
+	okay = okay && dict != NULL && index != NULL;
+	for(unsigned int c = ARCHIVE_DOMAIN; okay && c <= ARCHIVE_FORWARD; c++)
+	{
+		memcpy(dict, chunk->column[c], count * sizeof(*dict));
+		qsort(dict, count, sizeof(*dict), cmp_int64);
+		unsigned int size = 0;
+		for(unsigned int i = 0; i < count; i++)
+			if(size == 0 || dict[size - 1] != dict[i])
+				dict[size++] = dict[i];
+
+		okay = put_varint(buf, size);
+		for(unsigned int i = 0; okay && i < size; i++)
+			okay = put_varint(buf, (uint64_t)(dict[i] - (i > 0 ? dict[i - 1] : 0)));
+
+		for(unsigned int i = 0; okay && i < count; i++)
+		{
+			const sqlite3_int64 *found = bsearch(&chunk->column[c][i], dict, size, sizeof(*dict), cmp_int64);
+			index[i] = found - dict;
+		}
+
+		const unsigned int width = size > 0 ? bit_width(size - 1) : 0u;
+		okay = okay && put_bits(buf, index, count, width);
+	}
+	free(dict);
+	free(index);
+
+	return okay;
+}
+
+static bool decode_chunk(struct reader *rd, struct archive_chunk *chunk)
+{
+	uint64_t version = 0, count = 0;
+	if(!get_varint(rd, &version) || version != ARCHIVE_VERSION ||
+	   !get_varint(rd, &count) || count > ARCHIVE_CHUNK_ROWS ||
+	   !alloc_chunk(chunk, count))
+		return false;
+	chunk->count = count;
+
+	sqlite3_int64 prev_id = 0, prev_ms = 0;
+	for(unsigned int i = 0; i < count; i++)
+	{
+		uint64_t id = 0, ms = 0;
+		if(!get_varint(rd, &id) || !get_varint(rd, &ms))
+			return false;
+		chunk->id[i] = prev_id += unzigzag(id);
+		prev_ms += unzigzag(ms);
+		chunk->timestamp[i] = 1e-3 * prev_ms;
+	}
+
+	for(unsigned int c = ARCHIVE_TYPE; c <= ARCHIVE_REPLY_TYPE; c++)
+	{
+		uint64_t width = 0;
+		if(!get_varint(rd, &width) || !get_bits(rd, chunk->column[c], count, width))
+			return false;
+	}
+
+	sqlite3_int64 *dict = malloc((count > 0 ? count : 1) * sizeof(*dict));
+	if(dict == NULL)
+		return false;
+	bool okay = true;
+	for(unsigned int c = ARCHIVE_DOMAIN; okay && c <= ARCHIVE_FORWARD; c++)
+	{
+		uint64_t size = 0, width = 0;
+		okay = get_varint(rd, &size) && size <= count;
+		for(unsigned int i = 0; okay && i < size; i++)
+		{
+			uint64_t delta = 0;
+			okay = get_varint(rd, &delta);
+			dict[i] = (i > 0 ? dict[i - 1] : 0) + delta;
+		}
+
+		width = size > 0 ? bit_width(size - 1) : 0u;
+		okay = okay && get_bits(rd, chunk->column[c], count, width);
+		for(unsigned int i = 0; okay && i < count; i++)
+		{
+			if((uint64_t)chunk->column[c][i] >= size)
+				okay = false;
+			else
+				chunk->column[c][i] = dict[chunk->column[c][i]];
+		}
+	}
+	free(dict);
+
+	return okay;
+}
+
+// Encode, compress and store a chunk of queries
+static bool store_chunk(sqlite3 *db, const struct archive_chunk *chunk)
+{
+	struct buffer buf = { NULL, 0, 0 };
+	if(!encode_chunk(chunk, &buf))
+	{
+		free(buf.data);
+		return false;
+	}
+
+	mz_ulong compressed_len = mz_compressBound(buf.len);
+	unsigned char *compressed = malloc(compressed_len);
+	if(compressed == NULL ||
+	   mz_compress2(compressed, &compressed_len, buf.data, buf.len, MZ_DEFAULT_LEVEL) != MZ_OK)
+	{
+		free(buf.data);
+		free(compressed);
+		return false;
+	}
+
+	double first = chunk->timestamp[0], last = chunk->timestamp[0];
+	for(unsigned int i = 1; i < chunk->count; i++)
+	{
+		if(chunk->timestamp[i] < first)
+			first = chunk->timestamp[i];
+		if(chunk->timestamp[i] > last)
+			last = chunk->timestamp[i];
+	}
+
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "INSERT INTO query_archive (first_id, last_id, first, last, count, size, data) "
+	                                "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7);", -1, &stmt, NULL);
+	if(rc == SQLITE_OK)
+	{
+		sqlite3_bind_int64(stmt, 1, chunk->id[0]);
+		sqlite3_bind_int64(stmt, 2, chunk->id[chunk->count - 1]);
+		sqlite3_bind_double(stmt, 3, first);
+		sqlite3_bind_double(stmt, 4, last);
+		sqlite3_bind_int(stmt, 5, chunk->count);
+		sqlite3_bind_int64(stmt, 6, buf.len);
+		sqlite3_bind_blob(stmt, 7, compressed, compressed_len, SQLITE_STATIC);
+		rc = sqlite3_step(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	log_debug(DEBUG_DATABASE, "Archived %u queries in %lu bytes (%zu bytes before compression)",
+	          chunk->count, (unsigned long)compressed_len, buf.len);
+
+	free(buf.data);
+	free(compressed);
+
+	if(rc != SQLITE_DONE)
+	{
+		log_err("store_chunk(): Failed to store archived queries: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Check if the database contains archived queries
+ *
+ * @param db The on-disk database
+ * @return true if the archive tables exist
+ */
+bool query_archive_exists(sqlite3 *db)
+{
+	return db_query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'query_archive_rows';") > 0;
+}
+
+/**
+ * Copy all queries of a table into the archive. This has to be called from
+ * within a transaction which also drops the table afterwards.
+ *
+ * @param db The on-disk database
+ * @param table The table holding the queries
+ * @return Number of archived queries or -1 on error
+ */
+int archive_query_table(sqlite3 *db, const char *table)
+{
+	if(dbquery(db, CREATE_QUERY_ARCHIVE_TABLE) != SQLITE_OK ||
+	   dbquery(db, CREATE_QUERY_ARCHIVE_LAST_INDEX) != SQLITE_OK ||
+	   dbquery(db, CREATE_QUERY_ARCHIVE_ROWS) != SQLITE_OK)
+		return -1;
+
+	struct archive_chunk chunk = { 0 };
+	if(!alloc_chunk(&chunk, ARCHIVE_CHUNK_ROWS))
+		return -1;
+
+	char *querystr = sqlite3_mprintf("SELECT id, timestamp, type, status, reply_type, domain, client, forward "
+	                                 "FROM \"%w\" ORDER BY id;", table);
+	sqlite3_stmt *stmt = NULL;
+	int rc = querystr != NULL ? sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL) : SQLITE_NOMEM;
+	sqlite3_free(querystr);
+	if(rc != SQLITE_OK)
+	{
+		log_err("archive_query_table(): SQL error prepare: %s", sqlite3_errstr(rc));
+		free_chunk(&chunk);
+		return -1;
+	}
+
+	int total = 0;
+	bool okay = true;
+	while(okay && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const unsigned int i = chunk.count;
+		chunk.id[i] = sqlite3_column_int64(stmt, 0);
+		chunk.timestamp[i] = sqlite3_column_double(stmt, 1);
+		for(unsigned int c = 0; okay && c < ARCHIVE_COLUMNS; c++)
+		{
+			// Very old databases may still contain strings instead of IDs,
+			// such queries cannot be archived
+			const int type = sqlite3_column_type(stmt, 2 + c);
+			const sqlite3_int64 value = sqlite3_column_int64(stmt, 2 + c);
+			if(type == SQLITE_NULL)
+				chunk.column[c][i] = 0;
+			else if(type == SQLITE_INTEGER && value >= 0)
+				chunk.column[c][i] = value + 1;
+			else
+				okay = false;
+		}
+
+		if(okay && ++chunk.count == ARCHIVE_CHUNK_ROWS)
+		{
+			okay = store_chunk(db, &chunk);
+			total += chunk.count;
+			chunk.count = 0;
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	if(okay && rc != SQLITE_DONE)
+	{
+		log_err("archive_query_table(): Failed to read queries: %s", sqlite3_errstr(rc));
+		okay = false;
+	}
+	else if(!okay)
+		log_warn("Queries in %s cannot be archived", table);
+
+	if(okay && chunk.count > 0)
+	{
+		okay = store_chunk(db, &chunk);
+		total += chunk.count;
+	}
+	free_chunk(&chunk);
+
+	return okay ? total : -1;
+}
+
+// Iterator over the archived queries matching the given bounds
+struct archive_iter {
+	sqlite3_stmt *stmt;
+	struct archive_chunk chunk;
+	unsigned int row;
+	double from;
+	double until;
+	sqlite3_int64 min_id;
+	sqlite3_int64 max_id;
+};
+
+static bool iter_open(struct archive_iter *it, sqlite3 *db, const char *schema)
+{
+	char *querystr = sqlite3_mprintf("SELECT data, size FROM \"%w\".query_archive "
+	                                 "WHERE last >= ?1 AND first <= ?2 AND last_id >= ?3 AND first_id <= ?4 "
+	                                 "ORDER BY first_id;", schema);
+	int rc = querystr != NULL ? sqlite3_prepare_v2(db, querystr, -1, &it->stmt, NULL) : SQLITE_NOMEM;
+	sqlite3_free(querystr);
+	if(rc != SQLITE_OK)
+	{
+		log_err("Cannot read archived queries: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	sqlite3_bind_double(it->stmt, 1, it->from);
+	sqlite3_bind_double(it->stmt, 2, it->until);
+	sqlite3_bind_int64(it->stmt, 3, it->min_id);
+	sqlite3_bind_int64(it->stmt, 4, it->max_id);
+	it->chunk.count = 0;
+	it->row = 0;
+
+	return true;
+}
+
+// Load the next chunk, returns false at the end or on error
+static bool iter_load(struct archive_iter *it)
+{
+	if(sqlite3_step(it->stmt) != SQLITE_ROW)
+		return false;
+
+	const unsigned char *blob = sqlite3_column_blob(it->stmt, 0);
+	const mz_ulong blob_len = sqlite3_column_bytes(it->stmt, 0);
+	mz_ulong size = sqlite3_column_int64(it->stmt, 1);
+	unsigned char *data = malloc(size > 0 ? size : 1);
+	if(data == NULL || blob == NULL || mz_uncompress(data, &size, blob, blob_len) != MZ_OK)
+	{
+		log_err("Cannot decompress archived queries");
+		free(data);
+		return false;
+	}
+
+	struct reader rd = { data, size, 0 };
+	const bool okay = decode_chunk(&rd, &it->chunk);
+	free(data);
+	if(!okay)
+	{
+		log_err("Archived queries are corrupted");
+		return false;
+	}
+
+	it->row = 0;
+	return true;
+}
+
+// Advance to the next matching query, returns false at the end
+static bool iter_next(struct archive_iter *it)
+{
+	while(true)
+	{
+		for(; it->row < it->chunk.count; it->row++)
+		{
+			const unsigned int i = it->row;
+			if(it->chunk.timestamp[i] >= it->from && it->chunk.timestamp[i] <= it->until &&
+			   it->chunk.id[i] >= it->min_id && it->chunk.id[i] <= it->max_id)
+				return true;
+		}
+
+		if(!iter_load(it))
+			return false;
+	}
+}
+
+static void iter_close(struct archive_iter *it)
+{
+	sqlite3_finalize(it->stmt);
+	it->stmt = NULL;
+	free_chunk(&it->chunk);
+}
+
+/**
+ * Call a function for every archived query in a time range
+ *
+ * @param db Database connection
+ * @param schema Schema of the on-disk database ("main" or "disk")
+ * @param from Beginning of the range
+ * @param until End of the range (inclusive)
+ * @param callback Called with the chunk and the row of every query, the scan
+ * stops when it returns false
+ * @param arg Passed to the callback
+ * @return true if the scan completed
+ */
+bool scan_query_archive(sqlite3 *db, const char *schema, const double from, const double until,
+                        bool (*callback)(const struct archive_chunk *chunk, const unsigned int row, void *arg),
+                        void *arg)
+{
+	struct archive_iter it = { .from = from, .until = until, .min_id = 0, .max_id = INT64_MAX };
+	if(!iter_open(&it, db, schema))
+		return false;
+
+	bool okay = true;
+	for(; iter_next(&it); it.row++)
+		if(!(okay = callback(&it.chunk, it.row, arg)))
+			break;
+	iter_close(&it);
+
+	return okay;
+}
+
+// Virtual table query_archive_rows
+enum archive_vtab_column {
+	VTAB_ID,
+	VTAB_TIMESTAMP,
+	VTAB_TYPE,
+	VTAB_STATUS,
+	VTAB_DOMAIN,
+	VTAB_CLIENT,
+	VTAB_FORWARD,
+	VTAB_ADDITIONAL_INFO,
+	VTAB_REPLY_TYPE,
+	VTAB_REPLY_TIME,
+	VTAB_DNSSEC,
+	VTAB_LIST_ID,
+	VTAB_EDE
+};
+
+// Bounds passed to xFilter (bit positions in idxNum, in the order of the
+// arguments)
+enum archive_vtab_bound {
+	BOUND_FROM,
+	BOUND_UNTIL,
+	BOUND_MIN_ID,
+	BOUND_MAX_ID,
+	BOUNDS
+};
+
+struct archive_vtab {
+	sqlite3_vtab base;
+	sqlite3 *db;
+	char *schema;
+};
+
+struct archive_cursor {
+	sqlite3_vtab_cursor base;
+	struct archive_iter it;
+	bool eof;
+};
+
+static int archive_connect(sqlite3 *db, void *aux, int argc, const char *const *argv,
+                           sqlite3_vtab **vtab, char **err)
+{
+	int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(id INTEGER, timestamp INTEGER, type INTEGER, status INTEGER, "
+	                                  "domain INTEGER, client INTEGER, forward INTEGER, additional_info INTEGER, "
+	                                  "reply_type INTEGER, reply_time REAL, dnssec INTEGER, list_id INTEGER, ede INTEGER)");
+	if(rc != SQLITE_OK)
+		return rc;
+
+	struct archive_vtab *new = sqlite3_malloc(sizeof(*new));
+	if(new == NULL)
+		return SQLITE_NOMEM;
+	memset(new, 0, sizeof(*new));
+
+	// argv[1] is the name of the database the table is in
+	new->db = db;
+	if((new->schema = sqlite3_mprintf("%s", argv[1])) == NULL)
+	{
+		sqlite3_free(new);
+		return SQLITE_NOMEM;
+	}
+
+	*vtab = &new->base;
+	return SQLITE_OK;
+}
+
+static int archive_disconnect(sqlite3_vtab *vtab)
+{
+	struct archive_vtab *archive = (struct archive_vtab*)vtab;
+	sqlite3_free(archive->schema);
+	sqlite3_free(archive);
+	return SQLITE_OK;
+}
+
+static int archive_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+	int constraint[BOUNDS] = { -1, -1, -1, -1 };
+	for(int i = 0; i < info->nConstraint; i++)
+	{
+		const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+		if(!c->usable || (c->iColumn != VTAB_ID && c->iColumn != VTAB_TIMESTAMP))
+			continue;
+
+		// Strict comparisons are treated as inclusive ones, SQLite
+		// checks all constraints again
+		const unsigned int lower = c->iColumn == VTAB_ID ? BOUND_MIN_ID : BOUND_FROM;
+		unsigned int bound;
+		if(c->op == SQLITE_INDEX_CONSTRAINT_GE || c->op == SQLITE_INDEX_CONSTRAINT_GT)
+			bound = lower;
+		else if(c->op == SQLITE_INDEX_CONSTRAINT_LE || c->op == SQLITE_INDEX_CONSTRAINT_LT)
+			bound = lower + 1;
+		else
+			continue;
+
+		if(constraint[bound] < 0)
+			constraint[bound] = i;
+	}
+
+	int args = 0;
+	info->idxNum = 0;
+	for(unsigned int b = 0; b < BOUNDS; b++)
+	{
+		if(constraint[b] < 0)
+			continue;
+		info->aConstraintUsage[constraint[b]].argvIndex = ++args;
+		info->idxNum |= 1 << b;
+	}
+
+	// Each bound excludes chunks without reading them
+	info->estimatedCost = 1e6 / (1 + args);
+
+	return SQLITE_OK;
+}
+
+static int archive_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+	struct archive_cursor *new = sqlite3_malloc(sizeof(*new));
+	if(new == NULL)
+		return SQLITE_NOMEM;
+	memset(new, 0, sizeof(*new));
+	new->eof = true;
+
+	*cursor = &new->base;
+	return SQLITE_OK;
+}
+
+static int archive_close(sqlite3_vtab_cursor *cursor)
+{
+	struct archive_cursor *cur = (struct archive_cursor*)cursor;
+	iter_close(&cur->it);
+	sqlite3_free(cur);
+	return SQLITE_OK;
+}
+
+static int archive_filter(sqlite3_vtab_cursor *cursor, int idxNum, const char *idxStr,
+                          int argc, sqlite3_value **argv)
+{
+	struct archive_cursor *cur = (struct archive_cursor*)cursor;
+	const struct archive_vtab *archive = (const struct archive_vtab*)cursor->pVtab;
+	iter_close(&cur->it);
+
+	struct archive_iter *it = &cur->it;
+	it->from = -DBL_MAX;
+	it->until = DBL_MAX;
+	it->min_id = INT64_MIN;
+	it->max_id = INT64_MAX;
+
+	int arg = 0;
+	for(unsigned int b = 0; b < BOUNDS && arg < argc; b++)
+	{
+		if((idxNum & (1 << b)) == 0)
+			continue;
+
+		sqlite3_value *value = argv[arg++];
+		if(b == BOUND_FROM)
+			it->from = sqlite3_value_double(value);
+		else if(b == BOUND_UNTIL)
+			it->until = sqlite3_value_double(value);
+		else if(b == BOUND_MIN_ID)
+			it->min_id = sqlite3_value_int64(value);
+		else
+			it->max_id = sqlite3_value_int64(value);
+	}
+
+	if(!iter_open(it, archive->db, archive->schema))
+		return SQLITE_ERROR;
+
+	cur->eof = !iter_next(it);
+	return SQLITE_OK;
+}
+
+static int archive_next(sqlite3_vtab_cursor *cursor)
+{
+	struct archive_cursor *cur = (struct archive_cursor*)cursor;
+	cur->it.row++;
+	cur->eof = !iter_next(&cur->it);
+	return SQLITE_OK;
+}
+
+static int archive_eof(sqlite3_vtab_cursor *cursor)
+{
+	return ((struct archive_cursor*)cursor)->eof;
+}
+
+static int archive_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col)
+{
+	const struct archive_cursor *cur = (const struct archive_cursor*)cursor;
+	const struct archive_chunk *chunk = &cur->it.chunk;
+	const unsigned int i = cur->it.row;
+
+	enum archive_column column;
+	switch((enum archive_vtab_column)col)
+	{
+		case VTAB_ID:
+			sqlite3_result_int64(ctx, chunk->id[i]);
+			return SQLITE_OK;
+		case VTAB_TIMESTAMP:
+			sqlite3_result_double(ctx, chunk->timestamp[i]);
+			return SQLITE_OK;
+		case VTAB_TYPE:
+			column = ARCHIVE_TYPE;
+			break;
+		case VTAB_STATUS:
+			column = ARCHIVE_STATUS;
+			break;
+		case VTAB_REPLY_TYPE:
+			column = ARCHIVE_REPLY_TYPE;
+			break;
+		case VTAB_DOMAIN:
+			column = ARCHIVE_DOMAIN;
+			break;
+		case VTAB_CLIENT:
+			column = ARCHIVE_CLIENT;
+			break;
+		case VTAB_FORWARD:
+			column = ARCHIVE_FORWARD;
+			break;
+		case VTAB_ADDITIONAL_INFO:
+		case VTAB_REPLY_TIME:
+		case VTAB_DNSSEC:
+		case VTAB_LIST_ID:
+		case VTAB_EDE:
+		default:
+			// Not kept in the archive
+			sqlite3_result_null(ctx);
+			return SQLITE_OK;
+	}
+
+	// Values are stored with an offset of one, zero is NULL
+	const sqlite3_int64 value = chunk->column[column][i];
+	if(value == 0)
+		sqlite3_result_null(ctx);
+	else
+		sqlite3_result_int64(ctx, value - 1);
+
+	return SQLITE_OK;
+}
+
+static int archive_rowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+	const struct archive_cursor *cur = (const struct archive_cursor*)cursor;
+	*rowid = cur->it.chunk.id[cur->it.row];
+	return SQLITE_OK;
+}
+
+// Read-only, xUpdate is not implemented
+static sqlite3_module archive_module = {
+	.iVersion = 0,
+	.xCreate = archive_connect,
+	.xConnect = archive_connect,
+	.xBestIndex = archive_best_index,
+	.xDisconnect = archive_disconnect,
+	.xDestroy = archive_disconnect,
+	.xOpen = archive_open,
+	.xClose = archive_close,
+	.xFilter = archive_filter,
+	.xNext = archive_next,
+	.xEof = archive_eof,
+	.xColumn = archive_column,
+	.xRowid = archive_rowid,
+};
+
+// Register the query_archive module on a database connection
+int sqlite3_query_archive_init(sqlite3 *db)
+{
+	return sqlite3_create_module(db, "query_archive", &archive_module, NULL);
+}
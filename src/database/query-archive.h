@@ -0,0 +1,54 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Columnar query archive prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef QUERY_ARCHIVE_H
+#define QUERY_ARCHIVE_H
+
+#include "sqlite3.h"
+
+// Maximum number of queries encoded together
+#define ARCHIVE_CHUNK_ROWS 65536u
+
+// Archived queries, all columns besides ID and timestamp are stored with an
+// offset of one so zero can represent NULL
+enum archive_column {
+	ARCHIVE_TYPE,
+	ARCHIVE_STATUS,
+	ARCHIVE_REPLY_TYPE,
+	ARCHIVE_DOMAIN,
+	ARCHIVE_CLIENT,
+	ARCHIVE_FORWARD,
+	ARCHIVE_COLUMNS
+} __attribute__ ((packed));
+
+struct archive_chunk {
+	unsigned int count;
+	sqlite3_int64 *id;
+	double *timestamp;
+	sqlite3_int64 *column[ARCHIVE_COLUMNS];
+};
+
+#define CREATE_QUERY_ARCHIVE_TABLE "CREATE TABLE IF NOT EXISTS query_archive ( first_id INTEGER PRIMARY KEY, " \
+                                                                              "last_id INTEGER NOT NULL, " \
+                                                                              "first REAL NOT NULL, " \
+                                                                              "last REAL NOT NULL, " \
+                                                                              "count INTEGER NOT NULL, " \
+                                                                              "size INTEGER NOT NULL, " \
+                                                                              "data BLOB NOT NULL );"
+#define CREATE_QUERY_ARCHIVE_LAST_INDEX "CREATE INDEX IF NOT EXISTS idx_query_archive_last ON query_archive (last);"
+#define CREATE_QUERY_ARCHIVE_ROWS "CREATE VIRTUAL TABLE IF NOT EXISTS query_archive_rows USING query_archive;"
+
+bool query_archive_exists(sqlite3 *db);
+int archive_query_table(sqlite3 *db, const char *table);
+bool scan_query_archive(sqlite3 *db, const char *schema, const double from, const double until,
+                        bool (*callback)(const struct archive_chunk *chunk, const unsigned int row, void *arg),
+                        void *arg);
+int sqlite3_query_archive_init(sqlite3 *db);
+
+#endif // QUERY_ARCHIVE_H
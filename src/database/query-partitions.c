@@ -0,0 +1,448 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Time-partitioned query storage
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file query-partitions.c
+* @brief Splits the long-term query storage into one table per period.
+*
+* When database.partitionDays is set, queries are stored in tables named
+* query_storage_<start> each covering this many days. query_storage becomes a
+* UNION ALL view of all partitions so everything reading queries keeps working
+* unchanged. INSTEAD OF triggers on the view forward inserts to the newest
+* partition and deletes to all of them.
+*
+* Expired queries can then be removed by dropping whole partitions instead of
+* deleting millions of rows in long-running transactions which bloat the WAL
+* file. The table which existed before partitioning has been enabled becomes
+* the partition query_storage_0 and is dropped once all of its queries expired.
+*/
+
+#include "FTL.h"
+#include "database/query-partitions.h"
+#include "database/query-table.h"
+// archive_query_table()
+#include "database/query-archive.h"
+#include "database/common.h"
+#include "config/config.h"
+#include "log.h"
+
+#define PARTITION_PREFIX "query_storage_"
+#define PARTITION_SQL_LEN 96u
+
+// Get the start timestamps of all partitions in ascending order
+static int get_partitions(sqlite3 *db, long long **starts)
+{
+	*starts = NULL;
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT CAST(substr(name, 15) AS INTEGER) start FROM sqlite_master "
+	                                "WHERE type = 'table' AND name GLOB '" PARTITION_PREFIX "[0-9]*' "
+	                                "ORDER BY start;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("get_partitions(): SQL error prepare: %s", sqlite3_errstr(rc));
+		return -1;
+	}
+
+	int num = 0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		long long *new = realloc(*starts, (num + 1)*sizeof(**starts));
+		if(new == NULL)
+		{
+			rc = SQLITE_NOMEM;
+			break;
+		}
+		*starts = new;
+		(*starts)[num++] = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		log_err("get_partitions(): Failed to list partitions: %s", sqlite3_errstr(rc));
+		free(*starts);
+		*starts = NULL;
+		return -1;
+	}
+
+	return num;
+}
+
+// (Re-)create the query_storage view and its triggers for the given partitions,
+// the last one receives all new queries
+static bool create_partition_view(sqlite3 *db, const long long *starts, const int num)
+{
+	SQL_bool(db, "DROP VIEW IF EXISTS query_storage;");
+	if(num < 1)
+		return true;
+
+	char *view = calloc(num + 1, PARTITION_SQL_LEN);
+	char *delete = calloc(num + 1, PARTITION_SQL_LEN);
+	if(view == NULL || delete == NULL)
+	{
+		free(view);
+		free(delete);
+		return false;
+	}
+
+	size_t vlen = 0, dlen = 0;
+	for(int i = 0; i < num; i++)
+	{
+		vlen += sprintf(view + vlen, "%sSELECT * FROM " PARTITION_PREFIX "%lld",
+		                i > 0 ? " UNION ALL " : "", starts[i]);
+		dlen += sprintf(delete + dlen, "DELETE FROM " PARTITION_PREFIX "%lld WHERE id = OLD.id; ",
+		                starts[i]);
+	}
+
+	// Archived queries are part of the view as well
+	if(query_archive_exists(db))
+		strcat(view, " UNION ALL SELECT * FROM query_archive_rows");
+
+	const bool okay =
+		dbquery(db, "CREATE VIEW query_storage AS %s;", view) == SQLITE_OK &&
+		dbquery(db, "CREATE TRIGGER query_storage_insert INSTEAD OF INSERT ON query_storage BEGIN "
+		            "INSERT INTO " PARTITION_PREFIX "%lld VALUES (NEW.id, NEW.timestamp, NEW.type, NEW.status, "
+		            "NEW.domain, NEW.client, NEW.forward, NEW.additional_info, NEW.reply_type, "
+		            "NEW.reply_time, NEW.dnssec, NEW.list_id, NEW.ede); END;", starts[num - 1]) == SQLITE_OK &&
+		dbquery(db, "CREATE TRIGGER query_storage_delete INSTEAD OF DELETE ON query_storage BEGIN %s END;",
+		        delete) == SQLITE_OK;
+
+	free(view);
+	free(delete);
+
+	if(!okay)
+		log_err("create_partition_view() failed!");
+
+	return okay;
+}
+
+/**
+ * Check if the query storage of the database is partitioned
+ *
+ * @param db The on-disk database
+ * @return true if query_storage is a view of partitions
+ */
+bool query_storage_partitioned(sqlite3 *db)
+{
+	return db_query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'view' AND name = 'query_storage';") > 0;
+}
+
+// Copy all partitions back into a single query_storage table
+static bool merge_query_partitions(sqlite3 *db)
+{
+	long long *starts = NULL;
+	const int num = get_partitions(db, &starts);
+	if(num < 0)
+		return false;
+
+	log_info("Merging %d partitions of the long-term database, this may take a while...", num);
+
+	SQL_bool(db, "BEGIN TRANSACTION;");
+	SQL_bool(db, "DROP VIEW query_storage;");
+	SQL_bool(db, CREATE_QUERY_STORAGE_TABLE);
+	for(int i = 0; i < num; i++)
+	{
+		if(dbquery(db, "INSERT INTO query_storage SELECT * FROM " PARTITION_PREFIX "%lld;", starts[i]) != SQLITE_OK ||
+		   dbquery(db, "DROP TABLE " PARTITION_PREFIX "%lld;", starts[i]) != SQLITE_OK)
+		{
+			log_err("merge_query_partitions() failed!");
+			dbquery(db, "ROLLBACK;");
+			free(starts);
+			return false;
+		}
+	}
+	free(starts);
+
+	// Restore archived queries (without the columns not kept in the archive)
+	if(query_archive_exists(db))
+	{
+		SQL_bool(db, "INSERT INTO query_storage SELECT * FROM query_archive_rows;");
+		SQL_bool(db, "DROP TABLE query_archive_rows;");
+		SQL_bool(db, "DROP TABLE query_archive;");
+	}
+
+	// The indices of the former query_storage table have been dropped
+	// together with partition 0
+	SQL_bool(db, "CREATE INDEX IF NOT EXISTS idx_queries_timestamp ON query_storage (timestamp);");
+	SQL_bool(db, CREATE_QUERY_STORAGE_CLIENT_TIMESTAMP_INDEX);
+	SQL_bool(db, CREATE_QUERY_STORAGE_DOMAIN_TIMESTAMP_INDEX);
+	SQL_bool(db, "COMMIT;");
+
+	return true;
+}
+
+/**
+ * Create the partition for the current period if needed. The unpartitioned
+ * query_storage table is turned into the first partition when partitioning is
+ * enabled and all partitions are merged again when it is disabled.
+ *
+ * @param db The on-disk database
+ * @return true on success
+ */
+bool update_query_partitions(sqlite3 *db)
+{
+	const unsigned int days = config.database.partitionDays.v.ui;
+	const bool partitioned = query_storage_partitioned(db);
+	if(days == 0)
+		return partitioned ? merge_query_partitions(db) : true;
+
+	const time_t now = time(NULL);
+	const long long start = now - now % ((time_t)days * 86400);
+
+	long long *starts = NULL;
+	int num = 0;
+	if(partitioned && (num = get_partitions(db, &starts)) < 0)
+		return false;
+
+	// Nothing to do if the current period has its partition already
+	if(num > 0 && starts[num - 1] >= start)
+	{
+		free(starts);
+		return true;
+	}
+
+	if(num >= (int)QUERY_PARTITIONS_MAX)
+	{
+		log_warn("Not adding another partition to the long-term database, there are already %d", num);
+		free(starts);
+		return true;
+	}
+
+	long long *new = realloc(starts, (num + 2)*sizeof(*starts));
+	if(new == NULL)
+	{
+		free(starts);
+		return false;
+	}
+	starts = new;
+
+	if(dbquery(db, "BEGIN TRANSACTION;") != SQLITE_OK)
+	{
+		free(starts);
+		return false;
+	}
+
+	bool okay = true;
+	if(!partitioned)
+	{
+		// Keep the view "queries" referring to query_storage while renaming
+		// the table and continue its AUTOINCREMENT sequence under the
+		// original name as the IDs are exported from the in-memory database
+		log_info("Partitioning the long-term database");
+		okay = dbquery(db, "PRAGMA legacy_alter_table = ON;") == SQLITE_OK &&
+		       dbquery(db, "ALTER TABLE query_storage RENAME TO " PARTITION_PREFIX "0;") == SQLITE_OK &&
+		       dbquery(db, "PRAGMA legacy_alter_table = OFF;") == SQLITE_OK &&
+		       dbquery(db, "INSERT INTO sqlite_sequence (name, seq) SELECT 'query_storage', seq FROM sqlite_sequence "
+		                   "WHERE name = '" PARTITION_PREFIX "0';") == SQLITE_OK;
+		starts[num++] = 0;
+	}
+
+	// IDs are assigned by the in-memory database, no AUTOINCREMENT needed
+	okay = okay &&
+	       dbquery(db, "CREATE TABLE " PARTITION_PREFIX "%lld ( id INTEGER PRIMARY KEY, " QUERY_STORAGE_COLUMNS " );", start) == SQLITE_OK &&
+	       dbquery(db, "CREATE INDEX idx_" PARTITION_PREFIX "%lld_timestamp ON " PARTITION_PREFIX "%lld (timestamp);", start, start) == SQLITE_OK &&
+	       dbquery(db, "CREATE INDEX idx_" PARTITION_PREFIX "%lld_client_timestamp ON " PARTITION_PREFIX "%lld (client, timestamp);", start, start) == SQLITE_OK &&
+	       dbquery(db, "CREATE INDEX idx_" PARTITION_PREFIX "%lld_domain_timestamp ON " PARTITION_PREFIX "%lld (domain, timestamp);", start, start) == SQLITE_OK;
+	starts[num++] = start;
+
+	okay = okay && create_partition_view(db, starts, num);
+	free(starts);
+
+	if(!okay)
+	{
+		log_err("update_query_partitions(): Failed to add partition %lld", start);
+		dbquery(db, "ROLLBACK;");
+		return false;
+	}
+
+	SQL_bool(db, "COMMIT;");
+	log_debug(DEBUG_DATABASE, "Added partition %lld to the long-term database", start);
+
+	return true;
+}
+
+/**
+ * Drop all partitions (except the newest one) whose queries are all older than
+ * mintime. The newest partition always remains as it receives new queries.
+ *
+ * @param db The on-disk database
+ * @param mintime Timestamp queries have to be older than (or equal to)
+ * @return Number of dropped partitions or -1 on error
+ */
+int drop_query_partitions(sqlite3 *db, const double mintime)
+{
+	long long *starts = NULL;
+	const int num = get_partitions(db, &starts);
+	if(num < 1)
+	{
+		free(starts);
+		return num < 0 ? -1 : 0;
+	}
+
+	int dropped = 0, kept = 0;
+	bool okay = dbquery(db, "BEGIN TRANSACTION;") == SQLITE_OK;
+	for(int i = 0; okay && i < num; i++)
+	{
+		// MAX(timestamp) is answered by the index of the partition
+		char querystr[PARTITION_SQL_LEN];
+		snprintf(querystr, sizeof(querystr), "SELECT IFNULL(MAX(timestamp), 0) FROM " PARTITION_PREFIX "%lld;", starts[i]);
+		const double newest = db_query_double(db, querystr);
+		if(i == num - 1 || newest < 0.0 || newest > mintime)
+		{
+			starts[kept++] = starts[i];
+			continue;
+		}
+
+		okay = dbquery(db, "DROP TABLE " PARTITION_PREFIX "%lld;", starts[i]) == SQLITE_OK;
+		dropped++;
+	}
+
+	// Archived chunks are deleted as soon as their newest query expired
+	if(okay && query_archive_exists(db))
+	{
+		okay = dbquery(db, "DELETE FROM query_archive WHERE last <= %f;", mintime) == SQLITE_OK;
+		log_debug(DEBUG_DATABASE, "Deleted %d expired chunks of archived queries", sqlite3_changes(db));
+	}
+
+	okay = okay && (dropped == 0 || create_partition_view(db, starts, kept));
+	free(starts);
+
+	if(!okay)
+	{
+		log_err("drop_query_partitions(): Failed to drop expired partitions");
+		dbquery(db, "ROLLBACK;");
+		return -1;
+	}
+
+	if(dbquery(db, "COMMIT;") != SQLITE_OK)
+		return -1;
+
+	if(dropped > 0)
+		log_debug(DEBUG_DATABASE, "Dropped %d expired partitions of the long-term database", dropped);
+
+	return dropped;
+}
+
+/**
+ * Run ANALYZE on all tables except the partitions no longer receiving queries.
+ * Their statistics cannot have changed since they were last analyzed.
+ *
+ * @param db The on-disk database
+ * @return true on success
+ */
+bool analyze_query_partitions(sqlite3 *db)
+{
+	// The active partition is the one with the largest start timestamp
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT name FROM sqlite_master WHERE type = 'table' AND name NOT LIKE 'sqlite_%' AND "
+	                                "(name NOT GLOB '" PARTITION_PREFIX "[0-9]*' OR "
+	                                 "CAST(substr(name, 15) AS INTEGER) = (SELECT MAX(CAST(substr(name, 15) AS INTEGER)) FROM sqlite_master "
+	                                  "WHERE type = 'table' AND name GLOB '" PARTITION_PREFIX "[0-9]*'));", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("analyze_query_partitions(): SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	char **tables = NULL;
+	unsigned int count = 0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		char **new = realloc(tables, (count + 1)*sizeof(*tables));
+		if(new == NULL)
+			break;
+		tables = new;
+		if((tables[count] = strdup((const char*)sqlite3_column_text(stmt, 0))) != NULL)
+			count++;
+	}
+	sqlite3_finalize(stmt);
+
+	// ANALYZE cannot run while the statement listing the tables is active
+	bool okay = true;
+	for(unsigned int i = 0; i < count; i++)
+	{
+		if(okay && dbquery(db, "ANALYZE \"%s\";", tables[i]) != SQLITE_OK)
+			okay = false;
+		free(tables[i]);
+	}
+	free(tables);
+
+	return okay;
+}
+
+/**
+ * Convert the oldest partition whose queries are all older than
+ * database.archiveDays into the compressed columnar archive. Only one partition
+ * is archived per call to keep the transaction short.
+ *
+ * @param db The on-disk database
+ * @return true on success (also when nothing had to be archived)
+ */
+bool archive_query_partitions(sqlite3 *db)
+{
+	const unsigned int days = config.database.archiveDays.v.ui;
+	if(days == 0 || !query_storage_partitioned(db))
+		return true;
+
+	long long *starts = NULL;
+	const int num = get_partitions(db, &starts);
+	if(num < 0)
+		return false;
+
+	// The newest partition is never archived as it receives new queries
+	const double mintime = (double)(time(NULL) - (time_t)days * 86400);
+	int archive = -1;
+	for(int i = 0; i < num - 1 && archive < 0; i++)
+	{
+		char querystr[PARTITION_SQL_LEN];
+		snprintf(querystr, sizeof(querystr), "SELECT IFNULL(MAX(timestamp), 0) FROM " PARTITION_PREFIX "%lld;", starts[i]);
+		const double newest = db_query_double(db, querystr);
+		if(newest >= 0.0 && newest <= mintime)
+			archive = i;
+	}
+
+	if(archive < 0)
+	{
+		free(starts);
+		return true;
+	}
+
+	char table[PARTITION_SQL_LEN];
+	snprintf(table, sizeof(table), PARTITION_PREFIX "%lld", starts[archive]);
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	int archived = -1;
+	bool okay = dbquery(db, "BEGIN TRANSACTION;") == SQLITE_OK &&
+	            (archived = archive_query_table(db, table)) >= 0 &&
+	            dbquery(db, "DROP TABLE \"%s\";", table) == SQLITE_OK;
+
+	// Remove the partition from the list and recreate the view, which now
+	// includes the archive
+	memmove(&starts[archive], &starts[archive + 1], (num - archive - 1)*sizeof(*starts));
+	okay = okay && create_partition_view(db, starts, num - 1);
+	free(starts);
+
+	if(!okay)
+	{
+		log_err("archive_query_partitions(): Failed to archive %s", table);
+		dbquery(db, "ROLLBACK;");
+		return false;
+	}
+
+	SQL_bool(db, "COMMIT;");
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	log_info("Archived %d queries of %s in %.3f seconds", archived, table,
+	         (double)(end.tv_sec - begin.tv_sec) + 1e-9*(end.tv_nsec - begin.tv_nsec));
+
+	return true;
+}
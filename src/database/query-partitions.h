@@ -0,0 +1,24 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Query storage partition prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef QUERY_PARTITIONS_H
+#define QUERY_PARTITIONS_H
+
+#include "sqlite3.h"
+
+// SQLite refuses views combining more than 500 SELECTs
+#define QUERY_PARTITIONS_MAX 400u
+
+bool query_storage_partitioned(sqlite3 *db);
+bool update_query_partitions(sqlite3 *db);
+int drop_query_partitions(sqlite3 *db, const double mintime);
+bool analyze_query_partitions(sqlite3 *db);
+bool archive_query_partitions(sqlite3 *db);
+
+#endif // QUERY_PARTITIONS_H
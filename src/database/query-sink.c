@@ -0,0 +1,484 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Streaming export of completed queries
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file query-sink.c
+* @brief Streams completed queries as JSON lines to another process.
+*
+* When database.sink.target is set, every query is serialized as one line of
+* JSON (NDJSON) once its first reply is known. The queries are taken from the
+* list of changed queries the database thread copies into the in-memory
+* database every second, so the sink sees each query exactly once and does
+* not need the SHM lock. The lines of one second are written in one batch to
+* a Unix socket, a TCP connection or a named pipe.
+*
+* The target is written to without blocking. Lines which cannot be written
+* right away are kept in a queue bounded by database.sink.buffer, further
+* queries are dropped (and counted) while it is full. Lost connections are
+* re-established every SINK_RETRY seconds, a line interrupted by a lost
+* connection is dropped as well so the receiver only ever sees complete lines.
+*/
+
+#include "FTL.h"
+#include "database/query-sink.h"
+#include "config/config.h"
+#include "log.h"
+// inet_pton()
+#include <arpa/inet.h>
+// struct sockaddr_un
+#include <sys/un.h>
+// mkfifo()
+#include <sys/stat.h>
+// open()
+#include <fcntl.h>
+// poll()
+#include <poll.h>
+// PRId64
+#include <inttypes.h>
+
+// Seconds between attempts to (re-)connect to the target
+#define SINK_RETRY 5
+// Lower bound for the size of the queue [bytes]
+#define SINK_BUFFER_MIN (64u*1024u)
+// Length of a line without its strings
+#define SINK_LINE_FIXED 512u
+
+static struct {
+	char *buf;
+	size_t start;
+	size_t len;
+	size_t size;
+} queue = { NULL, 0u, 0u, 0u };
+
+static int sink_fd = -1;
+static bool connecting = false;
+// Whether the last attempt to reach the target failed (logged only once)
+static bool failed = false;
+// Whether queries are currently dropped (logged only once)
+static bool dropping = false;
+static time_t next_connect = 0;
+// Target of the current connection, config strings may be replaced at any time
+static char *current_target = NULL;
+static struct sink_target target = { 0 };
+
+static struct query_sink_stats stats = { 0 };
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void get_query_sink_stats(struct query_sink_stats *out)
+{
+	pthread_mutex_lock(&stats_lock);
+	*out = stats;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Parse a sink target of the form "unix:<path>", "tcp:<IP>:<port>" (IPv6
+ * addresses in brackets) or "fifo:<path>"
+ *
+ * @param str The target
+ * @param out Parsed target, the path points into str
+ * @return true if the target is valid
+ */
+bool parse_sink_target(const char *str, struct sink_target *out)
+{
+	memset(out, 0, sizeof(*out));
+
+	if(strncmp(str, "unix:", 5) == 0 || strncmp(str, "fifo:", 5) == 0)
+	{
+		const char *path = str + 5;
+		if(path[0] != '/' || strlen(path) >= sizeof(((struct sockaddr_un*)0)->sun_path))
+			return false;
+
+		out->type = str[0] == 'u' ? SINK_UNIX : SINK_FIFO;
+		out->path = path;
+		if(out->type == SINK_UNIX)
+		{
+			struct sockaddr_un *sun = (struct sockaddr_un*)&out->addr;
+			sun->sun_family = AF_UNIX;
+			strcpy(sun->sun_path, path);
+			out->addrlen = sizeof(*sun);
+		}
+		return true;
+	}
+
+	if(strncmp(str, "tcp:", 4) != 0)
+		return false;
+
+	// Split address and port
+	char host[INET6_ADDRSTRLEN + 2];
+	const char *colon = strrchr(str + 4, ':');
+	if(colon == NULL || (size_t)(colon - (str + 4)) >= sizeof(host))
+		return false;
+	memcpy(host, str + 4, colon - (str + 4));
+	host[colon - (str + 4)] = '\0';
+
+	char *end = NULL;
+	const long port = strtol(colon + 1, &end, 10);
+	if(end == colon + 1 || *end != '\0' || port < 1 || port > 65535)
+		return false;
+
+	const size_t hostlen = strlen(host);
+	if(hostlen > 2 && host[0] == '[' && host[hostlen - 1] == ']')
+	{
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&out->addr;
+		host[hostlen - 1] = '\0';
+		if(inet_pton(AF_INET6, host + 1, &sin6->sin6_addr) != 1)
+			return false;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		out->addrlen = sizeof(*sin6);
+	}
+	else
+	{
+		struct sockaddr_in *sin = (struct sockaddr_in*)&out->addr;
+		if(inet_pton(AF_INET, host, &sin->sin_addr) != 1)
+			return false;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		out->addrlen = sizeof(*sin);
+	}
+
+	out->type = SINK_TCP;
+	return true;
+}
+
+bool __attribute__((pure)) query_sink_enabled(void)
+{
+	return config.database.sink.target.v.s != NULL &&
+	       config.database.sink.target.v.s[0] != '\0';
+}
+
+static void set_connected(const bool connected)
+{
+	pthread_mutex_lock(&stats_lock);
+	stats.connected = connected;
+	if(connected)
+		stats.connects++;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+// Close the connection, a partially written line cannot be completed on the
+// next connection and is dropped
+static void close_sink(void)
+{
+	if(sink_fd < 0)
+		return;
+
+	close(sink_fd);
+	sink_fd = -1;
+	connecting = false;
+	set_connected(false);
+
+	if(queue.start > 0 && queue.buf[queue.start - 1] != '\n')
+	{
+		const char *eol = memchr(queue.buf + queue.start, '\n', queue.len - queue.start);
+		queue.start = eol != NULL ? (size_t)(eol - queue.buf) + 1 : queue.len;
+		pthread_mutex_lock(&stats_lock);
+		stats.dropped++;
+		pthread_mutex_unlock(&stats_lock);
+	}
+}
+
+static void sink_failed(const char *what, const int err)
+{
+	close_sink();
+	if(!failed)
+		log_warn("Cannot %s query sink %s: %s", what, current_target, strerror(err));
+	else
+		log_debug(DEBUG_DATABASE, "Cannot %s query sink %s: %s", what, current_target, strerror(err));
+	failed = true;
+}
+
+static void sink_ready(void)
+{
+	connecting = false;
+	set_connected(true);
+	log_info("Streaming queries to %s", current_target);
+	failed = false;
+}
+
+// Open the target without blocking
+static void open_sink(void)
+{
+	if(target.type == SINK_FIFO)
+	{
+		if(mkfifo(target.path, 0640) != 0 && errno != EEXIST)
+		{
+			sink_failed("create", errno);
+			return;
+		}
+
+		// Fails with ENXIO while nobody is reading from the pipe
+		sink_fd = open(target.path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if(sink_fd < 0)
+		{
+			sink_failed("open", errno);
+			return;
+		}
+
+		struct stat st;
+		if(fstat(sink_fd, &st) != 0 || !S_ISFIFO(st.st_mode))
+		{
+			sink_failed("use", ENOTSUP);
+			return;
+		}
+
+		sink_ready();
+		return;
+	}
+
+	sink_fd = socket(target.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(sink_fd < 0)
+	{
+		sink_failed("connect to", errno);
+		return;
+	}
+
+	if(connect(sink_fd, (struct sockaddr*)&target.addr, target.addrlen) == 0)
+		sink_ready();
+	else if(errno == EINPROGRESS)
+		connecting = true;
+	else
+		sink_failed("connect to", errno);
+}
+
+// Check whether a non-blocking connect() has finished
+static bool sink_connected(void)
+{
+	struct pollfd pfd = { .fd = sink_fd, .events = POLLOUT };
+	if(poll(&pfd, 1, 0) < 1)
+		return false;
+
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if(getsockopt(sink_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+		err = errno;
+	if(err != 0)
+	{
+		sink_failed("connect to", err);
+		return false;
+	}
+
+	sink_ready();
+	return true;
+}
+
+// Make room for len more bytes, returns false if the queue is full
+static bool reserve(const size_t len)
+{
+	const size_t limit = max(SINK_BUFFER_MIN, 1024u*(size_t)config.database.sink.buffer.v.ui);
+	if(queue.len - queue.start + len > limit)
+		return false;
+
+	// Move the data not yet written to the front of the queue
+	if(queue.start > 0 && queue.len + len > queue.size)
+	{
+		memmove(queue.buf, queue.buf + queue.start, queue.len - queue.start);
+		queue.len -= queue.start;
+		queue.start = 0;
+	}
+
+	if(queue.len + len <= queue.size)
+		return true;
+
+	size_t size = queue.size > 0 ? queue.size : 16384u;
+	while(size < queue.len + len)
+		size *= 2;
+	char *buf = realloc(queue.buf, size);
+	if(buf == NULL)
+		return false;
+	queue.buf = buf;
+	queue.size = size;
+
+	return true;
+}
+
+// Append a JSON string (or null), the caller reserved 6 bytes per character
+// plus the quotes
+static char *put_string(char *p, const char *str)
+{
+	if(str == NULL)
+	{
+		memcpy(p, "null", 4);
+		return p + 4;
+	}
+
+	*p++ = '"';
+	for(; *str != '\0'; str++)
+	{
+		const unsigned char c = *str;
+		if(c == '"' || c == '\\')
+		{
+			*p++ = '\\';
+			*p++ = c;
+		}
+		else if(c < 0x20)
+			p += sprintf(p, "\\u%04x", c);
+		else
+			*p++ = c;
+	}
+	*p++ = '"';
+
+	return p;
+}
+
+static inline size_t string_space(const char *str)
+{
+	return str != NULL ? 6*strlen(str) + 2 : 4;
+}
+
+/**
+ * Queue a completed query, it is dropped if the queue is full. Only called by
+ * the database thread
+ *
+ * @param r The query
+ */
+void query_sink_add(const struct sink_record *r)
+{
+	const size_t space = SINK_LINE_FIXED +
+	                     string_space(r->domain) + string_space(r->client_ip) +
+	                     string_space(r->client_name) + string_space(r->upstream) +
+	                     string_space(r->cname);
+	if(!reserve(space))
+	{
+		pthread_mutex_lock(&stats_lock);
+		stats.dropped++;
+		pthread_mutex_unlock(&stats_lock);
+		if(!dropping)
+			log_warn("Query sink %s is not accepting queries fast enough, dropping queries",
+			         config.database.sink.target.v.s);
+		dropping = true;
+		return;
+	}
+
+	char *p = queue.buf + queue.len;
+	p += sprintf(p, "{\"id\":%" PRId64 ",\"time\":%.6f,\"domain\":", r->id, r->timestamp);
+	p = put_string(p, r->domain);
+	p += sprintf(p, ",\"client\":");
+	p = put_string(p, r->client_ip);
+	p += sprintf(p, ",\"name\":");
+	p = put_string(p, r->client_name);
+	p += sprintf(p, ",\"type\":\"%s\",\"status\":\"%s\",\"reply\":\"%s\",\"dnssec\":\"%s\",\"upstream\":",
+	             r->type, r->status, r->reply, r->dnssec);
+	p = put_string(p, r->upstream);
+	if(r->reply_time >= 0.0)
+		p += sprintf(p, ",\"response\":%.6f", r->reply_time);
+	else
+		p += sprintf(p, ",\"response\":null");
+	p += sprintf(p, ",\"list_id\":%d,\"ede\":%d,\"cname\":", r->list_id, r->ede);
+	p = put_string(p, r->cname);
+	*p++ = '}';
+	*p++ = '\n';
+	queue.len = p - queue.buf;
+
+	pthread_mutex_lock(&stats_lock);
+	stats.records++;
+	stats.queued = queue.len - queue.start;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Write the queued queries to the target as far as it accepts them without
+ * blocking. Called by the database thread once per second
+ */
+void flush_query_sink(void)
+{
+	if(!query_sink_enabled())
+	{
+		close_query_sink();
+		return;
+	}
+
+	// The target changed, queued queries go to the new one
+	if(current_target == NULL || strcmp(current_target, config.database.sink.target.v.s) != 0)
+	{
+		close_sink();
+		if(current_target != NULL)
+			free(current_target);
+		current_target = strdup(config.database.sink.target.v.s);
+		if(current_target == NULL || !parse_sink_target(current_target, &target))
+		{
+			// Cannot happen for validated config values
+			target.type = SINK_NONE;
+			return;
+		}
+		failed = false;
+		next_connect = 0;
+	}
+
+	if(target.type == SINK_NONE)
+		return;
+
+	if(sink_fd < 0)
+	{
+		const time_t now = time(NULL);
+		if(now < next_connect)
+			return;
+		next_connect = now + SINK_RETRY;
+		open_sink();
+	}
+
+	if(sink_fd < 0 || (connecting && !sink_connected()))
+		return;
+
+	while(queue.start < queue.len)
+	{
+		const ssize_t n = write(sink_fd, queue.buf + queue.start, queue.len - queue.start);
+		if(n > 0)
+		{
+			queue.start += n;
+			pthread_mutex_lock(&stats_lock);
+			stats.sent += n;
+			pthread_mutex_unlock(&stats_lock);
+			continue;
+		}
+		if(n < 0 && errno == EINTR)
+			continue;
+		// The receiver is too slow, try again next time
+		if(n < 0 && errno == EAGAIN)
+			break;
+
+		sink_failed("write to", n < 0 ? errno : EPIPE);
+		break;
+	}
+
+	if(queue.start == queue.len)
+	{
+		queue.start = queue.len = 0;
+		if(dropping)
+			log_info("Query sink %s is accepting queries again", current_target);
+		dropping = false;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	stats.queued = queue.len - queue.start;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Close the connection and discard all queued queries
+ */
+void close_query_sink(void)
+{
+	close_sink();
+	if(current_target != NULL)
+		free(current_target);
+	current_target = NULL;
+	target.type = SINK_NONE;
+	if(queue.buf != NULL)
+		free(queue.buf);
+	queue.buf = NULL;
+	queue.start = queue.len = queue.size = 0;
+	dropping = false;
+
+	pthread_mutex_lock(&stats_lock);
+	stats.queued = 0;
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,67 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Streaming export of completed queries prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef DATABASE_QUERY_SINK_H
+#define DATABASE_QUERY_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+// struct sockaddr_storage
+#include <sys/socket.h>
+
+enum sink_type {
+	SINK_NONE,
+	SINK_UNIX,
+	SINK_TCP,
+	SINK_FIFO
+} __attribute__ ((packed));
+
+struct sink_target {
+	enum sink_type type;
+	socklen_t addrlen;
+	struct sockaddr_storage addr;
+	// Path of SINK_UNIX and SINK_FIFO targets
+	const char *path;
+};
+
+// One completed query, all strings but the client name are mandatory
+struct sink_record {
+	int64_t id;
+	double timestamp;
+	double reply_time; // negative if unknown
+	const char *domain;
+	const char *client_ip;
+	const char *client_name;
+	const char *type;
+	const char *status;
+	const char *reply;
+	const char *dnssec;
+	const char *upstream; // NULL if not forwarded
+	const char *cname; // NULL unless blocked during deep CNAME inspection
+	int list_id;
+	int ede;
+};
+
+struct query_sink_stats {
+	bool connected;
+	unsigned long records;
+	unsigned long dropped;
+	unsigned long connects;
+	unsigned long long sent;
+	size_t queued;
+};
+
+bool parse_sink_target(const char *target, struct sink_target *out);
+bool query_sink_enabled(void) __attribute__((pure));
+void query_sink_add(const struct sink_record *record);
+void flush_query_sink(void);
+void close_query_sink(void);
+void get_query_sink_stats(struct query_sink_stats *stats);
+
+#endif //DATABASE_QUERY_SINK_H
@@ -21,15 +21,51 @@
 #include "overTime.h"
 #include "database/common.h"
 #include "timers.h"
-// runGC()
+// runGC(), demote_queries()
 #include "gc.h"
+// top_lists_domain_changed()
+#include "top-lists.h"
+// client_sketch_add()
+#include "client-sketch.h"
+// update_query_rollup()
+#include "database/rollup-table.h"
+// drop_query_partitions()
+#include "database/query-partitions.h"
+// query_sink_add()
+#include "database/query-sink.h"
+// FTL_PROBE()
+#include "probes.h"
+
+// The in-memory database lives in the memdb VFS so that other connections
+// can open it by name (the leading slash makes it shared within the process)
+#define MEMDB_URI "file:/pihole-FTL-memdb?vfs=memdb"
+// Largest size of the in-memory database, it is a single allocation
+#define MEMDB_MAX_SIZE 0x7fff0000LL
 
 static sqlite3 *_memdb = NULL;
+// Read-only connections of API threads to the in-memory database (see
+// get_memdb_reader())
+static __thread sqlite3 *memdb_reader = NULL;
+static sqlite3 **memdb_readers = NULL;
+static unsigned int num_memdb_readers = 0;
+static pthread_mutex_t readers_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool store_in_database = false;
 static double new_last_timestamp = 0;
 static unsigned int new_total = 0, new_blocked = 0;
 static unsigned long last_mem_db_idx = 0, last_disk_db_idx = 0;
+// Number of queries in the in-memory and on-disk databases. They are counted
+// once and adjusted whenever queries are stored or deleted afterwards so the
+// API does not need to count them over and over again
 static unsigned int mem_db_num = 0, disk_db_num = 0;
+static bool disk_db_counted = false;
+// Largest ID of the queries evicted from the in-memory database after they
+// have been stored on disk, and the timestamp up to which the garbage
+// collection has removed queries from the in-memory database
+static unsigned long evicted_db_idx = 0;
+static double memdb_mintime = 0.0;
+// Queries are not copied into the in-memory database but written from the
+// export buffers straight into the long-term database (database.inMemory)
+static bool direct_storage = false;
 static sqlite3_stmt *query_stmt = NULL;
 static sqlite3_stmt *domain_stmt = NULL;
 static sqlite3_stmt *client_stmt = NULL;
@@ -41,8 +77,13 @@ static sqlite3_stmt **stmts[] = { &query_stmt,
                                   &forward_stmt,
                                   &addinfo_stmt };
 
+// Signalled whenever queries_to_database() has stored new queries
+static pthread_mutex_t stored_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stored_cond = PTHREAD_COND_INITIALIZER;
+
 // Private prototypes
 static void load_queries_from_disk(void);
+static bool store_direct_queries(const double time, unsigned int *stored);
 
 // Return the maximum ID of the in-memory database
 unsigned long __attribute__((pure)) get_max_db_idx(void)
@@ -53,8 +94,84 @@ unsigned long __attribute__((pure)) get_max_db_idx(void)
 void db_counts(unsigned long *last_idx, unsigned long *mem_num, unsigned long *disk_num)
 {
 	*last_idx = last_mem_db_idx;
-	*mem_num = mem_db_num;
-	*disk_num = disk_db_num;
+	// Without in-memory database, the recent queries are those in shared
+	// memory
+	*mem_num = direct_storage ? counters->queries : __atomic_load_n(&mem_db_num, __ATOMIC_RELAXED);
+	*disk_num = __atomic_load_n(&disk_db_num, __ATOMIC_RELAXED);
+}
+
+/**
+ * Account for queries deleted from the on-disk database outside of this file.
+ *
+ * @param deleted Number of deleted queries or -1 if unknown (e.g. after
+ * dropping partitions). In the latter case, the queries are counted again
+ * during the next export
+ */
+void disk_queries_deleted(const int deleted)
+{
+	if(deleted < 0)
+		__atomic_store_n(&disk_db_counted, false, __ATOMIC_RELAXED);
+	else if(deleted > 0)
+		__atomic_sub_fetch(&disk_db_num, (unsigned int)deleted, __ATOMIC_RELAXED);
+}
+
+/**
+ * Wait until queries with a database ID larger than last_idx have been stored
+ * in the in-memory database. Waiting threads are woken up by
+ * queries_to_database() so they cost nothing while there are no new queries.
+ *
+ * @param last_idx Largest database ID already known to the caller
+ * @param timeout_ms Maximum time to wait
+ * @return true if new queries are available, false on timeout
+ */
+bool wait_for_stored_queries(const unsigned long last_idx, const unsigned int timeout_ms)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&stored_lock);
+	int rc = 0;
+	while(last_mem_db_idx <= last_idx && rc == 0)
+		rc = pthread_cond_timedwait(&stored_cond, &stored_lock, &deadline);
+	const bool stored = last_mem_db_idx > last_idx;
+	pthread_mutex_unlock(&stored_lock);
+
+	return stored;
+}
+
+// Attach the on-disk database to a connection to the in-memory database.
+// ATTACH uses the VFS of the main database unless the URI names another one
+static bool attach_disk_database(sqlite3 *db)
+{
+	const char *path = config.files.database.v.s;
+	const sqlite3_vfs *vfs = sqlite3_vfs_find(NULL);
+	const char *vfs_name = vfs != NULL ? vfs->zName : "unix";
+
+	// Characters with a meaning in URIs have to be escaped
+	const size_t len = 3*strlen(path) + strlen(vfs_name) + 16;
+	char *uri = calloc(len, sizeof(char));
+	if(uri == NULL)
+		return false;
+	size_t pos = strlen(strcpy(uri, "file:"));
+	for(const char *c = path; *c != '\0'; c++)
+	{
+		if(*c == '%' || *c == '?' || *c == '#')
+			pos += sprintf(uri + pos, "%%%02X", (unsigned char)*c);
+		else
+			uri[pos++] = *c;
+	}
+	snprintf(uri + pos, len - pos, "?vfs=%s", vfs_name);
+
+	const bool attached = attach_database(db, NULL, uri, "disk");
+	free(uri);
+	return attached;
 }
 
 // Initialize in-memory database, add queries table and indices
@@ -77,9 +194,10 @@ bool init_memory_database(void)
 {
 	int rc;
 	// Try to open in-memory database
-	// The :memory: database always has synchronous=OFF since the content of
+	// The memdb database always has synchronous=OFF since the content of
 	// it is ephemeral and is not expected to survive a power outage.
-	rc = sqlite3_open_v2(":memory:", &_memdb, SQLITE_OPEN_READWRITE, NULL);
+	rc = sqlite3_open_v2(MEMDB_URI, &_memdb,
+	                     SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL);
 	if( rc != SQLITE_OK )
 	{
 		log_err("init_memory_database(): Step error while trying to open database: %s",
@@ -87,6 +205,10 @@ bool init_memory_database(void)
 		return false;
 	}
 
+	// Raise the default size limit of memdb databases (1 GiB)
+	sqlite3_int64 size_limit = MEMDB_MAX_SIZE;
+	sqlite3_file_control(_memdb, "main", SQLITE_FCNTL_SIZE_LIMIT, &size_limit);
+
 	// Explicitly set busy handler to value defined in FTL.h
 	rc = sqlite3_busy_timeout(_memdb, DATABASE_BUSY_TIMEOUT);
 	if( rc != SQLITE_OK )
@@ -97,8 +219,30 @@ bool init_memory_database(void)
 		return false;
 	}
 
+	// Allow returning the memory of evicted queries (see
+	// limit_memory_database()). This has to be set before any table is
+	// created
+	rc = sqlite3_exec(_memdb, "PRAGMA auto_vacuum=INCREMENTAL", NULL, NULL, NULL);
+	if( rc != SQLITE_OK )
+	{
+		log_err("init_memory_database(): Step error while trying to set auto_vacuum: %s",
+		        sqlite3_errstr(rc));
+		sqlite3_close(_memdb);
+		return false;
+	}
+
+	// Without in-memory copy of the queries, the query tables are not
+	// created. Their names then refer to the tables of the attached
+	// long-term database
+	direct_storage = !config.database.inMemory.v.b;
+	if(direct_storage && (config.database.maxDBdays.v.ui == 0 || FTLDBerror()))
+	{
+		log_warn("database.inMemory = false needs the long-term database, keeping queries in memory");
+		direct_storage = false;
+	}
+
 	// Create query_storage table in the database
-	for(unsigned int i = 0; i < ArraySize(table_creation); i++)
+	for(unsigned int i = 0; !direct_storage && i < ArraySize(table_creation); i++)
 	{
 		log_debug(DEBUG_DATABASE, "init_memory_database(): Executing %s", table_creation[i]);
 		rc = sqlite3_exec(_memdb, table_creation[i], NULL, NULL, NULL);
@@ -112,7 +256,7 @@ bool init_memory_database(void)
 
 	// Add indices on all columns of the in-memory database
 	// as well as index on auxiliary tables
-	for(unsigned int i = 0; i < ArraySize(index_creation); i++)
+	for(unsigned int i = 0; !direct_storage && i < ArraySize(index_creation); i++)
 	{
 		log_debug(DEBUG_DATABASE, "init_memory_database(): Executing %s", index_creation[i]);
 		rc = sqlite3_exec(_memdb, index_creation[i], NULL, NULL, NULL);
@@ -125,7 +269,7 @@ bool init_memory_database(void)
 	}
 
 	// Attach disk database. This may fail if the database is unavailable
-	const bool attached = attach_database(_memdb, NULL, config.files.database.v.s, "disk");
+	const bool attached = attach_disk_database(_memdb);
 
 	// Enable WAL mode for the on-disk database (pihole-FTL.db) if
 	// configured (default is yes). User may not want to enable WAL
@@ -147,6 +291,10 @@ bool init_memory_database(void)
 			sqlite3_close(_memdb);
 			return false;
 		}
+
+		// Checkpoints are scheduled by the database thread so they do
+		// not coincide with storing queries
+		sqlite3_wal_autocheckpoint(_memdb, 0);
 	}
 	else if(attached)
 	{
@@ -249,6 +397,15 @@ void close_memory_database(void)
 		*stmts[i] = NULL;
 	}
 
+	// Close read-only connections of the API threads
+	pthread_mutex_lock(&readers_lock);
+	for(unsigned int i = 0; i < num_memdb_readers; i++)
+		sqlite3_close_v2(memdb_readers[i]);
+	if(memdb_readers != NULL)
+		free(memdb_readers);
+	num_memdb_readers = 0;
+	pthread_mutex_unlock(&readers_lock);
+
 	// Detach disk database
 	if(!detach_database(_memdb, NULL, "disk"))
 		log_err("close_memory_database(): Failed to detach disk database");
@@ -271,6 +428,60 @@ sqlite3 *__attribute__((pure)) get_memdb(void)
 	return _memdb;
 }
 
+/**
+ * @brief Get a read-only connection to the in-memory database for the calling
+ * thread. Unlike the connection returned by get_memdb(), which is shared by
+ * all threads, readers of different threads run concurrently. They only wait
+ * for writers while a transaction is being committed. The on-disk database is
+ * attached as "disk" as well. The connection is opened on first use and kept
+ * until the in-memory database is closed.
+ *
+ * @return Connection of this thread, the shared connection if opening a
+ * separate one failed, or NULL if there is no in-memory database
+ */
+sqlite3 *get_memdb_reader(void)
+{
+	if(_memdb == NULL)
+		return NULL;
+	if(memdb_reader != NULL)
+		return memdb_reader;
+
+	sqlite3 *db = NULL;
+	int rc = sqlite3_open_v2(MEMDB_URI, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_warn("get_memdb_reader(): Cannot open in-memory database: %s",
+		         sqlite3_errstr(rc));
+		sqlite3_close(db);
+		return _memdb;
+	}
+	sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT);
+
+	// Attached databases inherit the read-only flag
+	attach_disk_database(db);
+
+	// Remember the connection so it can be closed at exit
+	pthread_mutex_lock(&readers_lock);
+	sqlite3 **readers = realloc(memdb_readers, (num_memdb_readers + 1) * sizeof(*readers));
+	if(readers != NULL)
+	{
+		memdb_readers = readers;
+		memdb_readers[num_memdb_readers++] = db;
+	}
+	pthread_mutex_unlock(&readers_lock);
+	if(readers == NULL)
+	{
+		sqlite3_close(db);
+		return _memdb;
+	}
+
+	log_debug(DEBUG_DATABASE, "Opened read-only connection %u to in-memory database",
+	          num_memdb_readers);
+
+	memdb_reader = db;
+	return db;
+}
+
 // Get memory usage and size of in-memory tables
 static bool get_memdb_size(sqlite3 *db, size_t *memsize, int *queries)
 {
@@ -332,7 +543,7 @@ static bool get_memdb_size(sqlite3 *db, size_t *memsize, int *queries)
 // Log the memory usage of in-memory databases
 static void log_in_memory_usage(void)
 {
-	if(!(config.debug.database.v.b))
+	if(!(config.debug.database.v.b) || direct_storage)
 		return;
 
 	size_t memsize = 0;
@@ -348,6 +559,123 @@ static void log_in_memory_usage(void)
 	}
 }
 
+// Number of queries evicted from the in-memory database per statement
+#define MEMDB_EVICT_CHUNK 1000
+
+// Pages of the in-memory database currently in use [bytes]
+static sqlite3_int64 get_memdb_used(void)
+{
+	const int page_count = db_query_int(_memdb, "PRAGMA page_count");
+	const int freelist = db_query_int(_memdb, "PRAGMA freelist_count");
+	const int page_size = db_query_int(_memdb, "PRAGMA page_size");
+	if(page_count < 0 || freelist < 0 || page_size < 0)
+		return -1;
+
+	return (sqlite3_int64)(page_count - freelist) * page_size;
+}
+
+/**
+ * @brief Keep the in-memory database within database.memoryLimit. When the
+ * limit is exceeded, queries are stored on disk early and the oldest stored
+ * queries are evicted until the database is 10% below the limit. The queries
+ * API reads evicted queries from the on-disk database (see
+ * get_memdb_query_source()).
+ */
+static void limit_memory_database(void)
+{
+	static bool logged = false;
+	if(config.database.memoryLimit.v.ui == 0 || direct_storage)
+		return;
+
+	const sqlite3_int64 limit = (sqlite3_int64)config.database.memoryLimit.v.ui * 1024 * 1024;
+	sqlite3_int64 used = get_memdb_used();
+	if(used <= limit)
+		return;
+
+	// Store everything possible on disk so it can be evicted. When queries
+	// are not stored on disk, the oldest queries are dropped from the
+	// in-memory database (they are still in shared memory)
+	const bool on_disk = config.database.maxDBdays.v.ui > 0 && !FTLDBerror();
+	if(on_disk)
+		export_queries_to_disk(false);
+	const unsigned long max_idx = on_disk ? last_disk_db_idx : last_mem_db_idx;
+
+	const sqlite3_int64 target = limit - limit / 10;
+	unsigned int evicted = 0;
+	while(used > target)
+	{
+		if(dbquery(_memdb, "DELETE FROM query_storage WHERE id IN "
+		                   "(SELECT id FROM query_storage WHERE id <= %lu ORDER BY id LIMIT %d);",
+		                   max_idx, MEMDB_EVICT_CHUNK) != SQLITE_OK)
+			break;
+
+		const int deleted = sqlite3_changes(_memdb);
+		evicted += deleted;
+		if(deleted == 0 || (used = get_memdb_used()) < 0)
+			break;
+	}
+
+	if(evicted == 0)
+	{
+		if(!logged)
+			log_warn("In-memory database exceeds database.memoryLimit (%u MB) but there are no queries which could be evicted",
+			         config.database.memoryLimit.v.ui);
+		logged = true;
+		return;
+	}
+
+	// Remember which queries are only available on disk now
+	if(on_disk)
+	{
+		sqlite3_stmt *stmt = NULL;
+		if(sqlite3_prepare_v2(_memdb, "SELECT IFNULL(MIN(id), ?1 + 1) - 1 FROM query_storage;", -1, &stmt, NULL) == SQLITE_OK)
+		{
+			sqlite3_bind_int64(stmt, 1, max_idx);
+			if(sqlite3_step(stmt) == SQLITE_ROW)
+				evicted_db_idx = sqlite3_column_int64(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	// Give the memory of the evicted queries back
+	dbquery(_memdb, "PRAGMA incremental_vacuum;");
+	__atomic_sub_fetch(&mem_db_num, evicted, __ATOMIC_RELAXED);
+
+	if(!logged)
+		log_info("In-memory database reached database.memoryLimit (%u MB), evicted %u queries%s",
+		         config.database.memoryLimit.v.ui, evicted, on_disk ? " already stored on disk" : "");
+	else
+		log_debug(DEBUG_DATABASE, "In-memory database reached database.memoryLimit (%u MB), evicted %u queries",
+		          config.database.memoryLimit.v.ui, evicted);
+	logged = true;
+}
+
+/**
+ * @brief Get the table expression the queries API should read the in-memory
+ * queries from. Queries evicted due to database.memoryLimit are read from the
+ * on-disk database. Without in-memory database, the recent queries already
+ * stored on disk are used.
+ *
+ * @param buf Buffer to store the expression in.
+ * @param len Size of the buffer.
+ * @return buf
+ */
+const char *get_memdb_query_source(char *buf, const size_t len)
+{
+	const unsigned long evicted = evicted_db_idx;
+	if(direct_storage)
+		snprintf(buf, len, "(SELECT * FROM query_storage WHERE timestamp > %f)", memdb_mintime);
+	else if(evicted == 0)
+		snprintf(buf, len, "query_storage");
+	else
+		snprintf(buf, len, "(SELECT * FROM query_storage WHERE id > %lu "
+		                   "UNION ALL "
+		                   "SELECT * FROM disk.query_storage WHERE id <= %lu AND timestamp > %f)",
+		         evicted, evicted, memdb_mintime);
+
+	return buf;
+}
+
 // Attach database using specified path and alias
 bool attach_database(sqlite3* db, const char **message, const char *path, const char *alias)
 {
@@ -504,9 +832,19 @@ bool import_queries_from_disk(void)
 	const double mintime = now - config.webserver.api.maxHistory.v.ui;
 	const char *querystr = "INSERT INTO query_storage SELECT * FROM disk.query_storage WHERE timestamp >= ?";
 
+	// There is nothing to import when the queries are read from disk
+	// directly
+	sqlite3 *memdb = get_memdb();
+	if(direct_storage)
+	{
+		disk_db_num = get_number_of_queries_in_DB(memdb, "disk.query_storage");
+		disk_db_counted = true;
+		log_info("Reading queries from the on-disk database (it has %u rows)", disk_db_num);
+		return true;
+	}
+
 	// Begin transaction
 	int rc;
-	sqlite3 *memdb = get_memdb();
 	if((rc = sqlite3_exec(memdb, "BEGIN TRANSACTION", NULL, NULL, NULL)) != SQLITE_OK)
 	{
 		log_err("import_queries_from_disk(): Cannot start transaction: %s", sqlite3_errstr(rc));
@@ -574,12 +912,73 @@ bool import_queries_from_disk(void)
 	// Get number of queries on disk before detaching
 	disk_db_num = get_number_of_queries_in_DB(memdb, "disk.query_storage");
 	mem_db_num = get_number_of_queries_in_DB(memdb, "query_storage");
+	disk_db_counted = true;
 
 	log_info("Imported %u queries from the on-disk database (it has %u rows)", mem_db_num, disk_db_num);
 
 	return okay;
 }
 
+// Copy the queries of the in-memory database older than time to disk
+static bool copy_queries_to_disk(sqlite3 *memdb, const double time, unsigned int *insertions)
+{
+	int rc;
+	sqlite3_stmt *stmt = NULL;
+	bool okay = false;
+	const char *querystr = "INSERT INTO disk.query_storage SELECT * FROM query_storage WHERE id > ? AND timestamp < ?";
+
+	log_debug(DEBUG_DATABASE, "Storing queries on disk WHERE id > %lu (max is %lu) and timestamp < %f",
+	          last_disk_db_idx, last_mem_db_idx, time);
+
+	// Prepare SQLite3 statement
+	log_debug(DEBUG_DATABASE, "Accessing in-memory database");
+	if((rc = sqlite3_prepare_v2(memdb, querystr, -1, &stmt, NULL)) != SQLITE_OK)
+	{
+		log_err("export_queries_to_disk(): SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	// Bind index
+	if((rc = sqlite3_bind_int64(stmt, 1, last_disk_db_idx)) != SQLITE_OK)
+	{
+		log_err("export_queries_to_disk(): Failed to bind id: %s", sqlite3_errstr(rc));
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	// Bind upper time limit
+	// This prevents queries from the last 30 seconds from being stored
+	// immediately on-disk to give them some time to complete before finally
+	// exported. We do not limit anything when storing during termination.
+	if((rc = sqlite3_bind_double(stmt, 2, time)) != SQLITE_OK)
+	{
+		log_err("export_queries_to_disk(): Failed to bind time: %s", sqlite3_errstr(rc));
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	// Perform step
+	const sqlite3_int64 changes = sqlite3_total_changes64(memdb);
+	if((rc = sqlite3_step(stmt)) == SQLITE_DONE)
+		okay = true;
+	else
+	{
+		log_err("export_queries_to_disk(): Failed to export queries: %s", sqlite3_errstr(rc));
+		log_info("    SQL query was: \"%s\"", querystr);
+		log_info("    with parameters: id = %lu, timestamp = %f", last_disk_db_idx, time);
+	}
+
+	// Get number of queries actually inserted by the INSERT INTO ...
+	// SELECT * FROM ... sqlite3_changes() does not count the rows
+	// inserted by the triggers of the partitioned storage
+	*insertions = sqlite3_total_changes64(memdb) - changes;
+
+	// Finalize statement
+	sqlite3_finalize(stmt);
+
+	return okay;
+}
+
 // Export in-memory queries to disk - either due to periodic dumping (final =
 // false) or because of a shutdown (final = true)
 // When final is false, we only export queries that are older than REPLY_TIMEOUT
@@ -600,6 +999,11 @@ bool export_queries_to_disk(const bool final)
 	// Start database timer
 	timer_start(DATABASE_WRITE_TIMER);
 
+	// Queries without in-memory copy are written from the export buffers
+	// in a transaction of their own
+	const bool direct_okay = direct_storage && config.database.maxDBdays.v.ui > 0 &&
+	                         store_direct_queries(time, &insertions);
+
 	// Start transaction
 	sqlite3 *memdb = get_memdb();
 	sqlite3_stmt *stmt = NULL;
@@ -608,61 +1012,30 @@ bool export_queries_to_disk(const bool final)
 	// Only store queries if database.maxDBdays > 0
 	if(config.database.maxDBdays.v.ui > 0)
 	{
-		const char *querystr = "INSERT INTO disk.query_storage SELECT * FROM query_storage WHERE id > ? AND timestamp < ?";
-
-		log_debug(DEBUG_DATABASE, "Storing queries on disk WHERE id > %lu (max is %lu) and timestamp < %f",
-		          last_disk_db_idx, last_mem_db_idx, time);
-
-		// Prepare SQLite3 statement
-		log_debug(DEBUG_DATABASE, "Accessing in-memory database");
-		if((rc = sqlite3_prepare_v2(memdb, querystr, -1, &stmt, NULL)) != SQLITE_OK)
-		{
-			log_err("export_queries_to_disk(): SQL error prepare: %s", sqlite3_errstr(rc));
-			return false;
-		}
-
-		// Bind index
-		if((rc = sqlite3_bind_int64(stmt, 1, last_disk_db_idx)) != SQLITE_OK)
-		{
-			log_err("export_queries_to_disk(): Failed to bind id: %s", sqlite3_errstr(rc));
-			return false;
-		}
-
-		// Bind upper time limit
-		// This prevents queries from the last 30 seconds from being stored
-		// immediately on-disk to give them some time to complete before finally
-		// exported. We do not limit anything when storing during termination.
-		if((rc = sqlite3_bind_double(stmt, 2, time)) != SQLITE_OK)
-		{
-			log_err("export_queries_to_disk(): Failed to bind time: %s", sqlite3_errstr(rc));
-			return false;
-		}
-
-		// Perform step
-		if((rc = sqlite3_step(stmt)) == SQLITE_DONE)
-			okay = true;
+		if(direct_storage)
+			okay = direct_okay;
 		else
-		{
-			log_err("export_queries_to_disk(): Failed to export queries: %s", sqlite3_errstr(rc));
-			log_info("    SQL query was: \"%s\"", querystr);
-			log_info("    with parameters: id = %lu, timestamp = %f", last_disk_db_idx, time);
-		}
+			okay = copy_queries_to_disk(memdb, time, &insertions);
 
-		// Get number of queries actually inserted by the INSERT INTO ... SELECT * FROM ...
-		insertions = sqlite3_changes(memdb);
-
-		// Finalize statement
-		sqlite3_finalize(stmt);
+		// Add the exported queries to the pre-aggregated counts used for
+		// long-term statistics
+		if(okay && insertions > 0)
+			update_query_rollup(memdb, last_disk_db_idx, time);
 
 
 		// Update last_disk_db_idx
-		// Prepare SQLite3 statement
-		rc = sqlite3_prepare_v2(memdb, "SELECT MAX(id) FROM disk.query_storage;", -1, &stmt, NULL);
+		// Prepare SQLite3 statement. The lower bound lets SQLite look up
+		// the maximum in the index of every partition when the on-disk
+		// storage is partitioned instead of scanning all of them. If
+		// nothing is found above it, the unbounded maximum is used
+		rc = sqlite3_prepare_v2(memdb, "SELECT IFNULL((SELECT MAX(id) FROM disk.query_storage WHERE id >= ?), "
+		                                              "(SELECT MAX(id) FROM disk.query_storage));", -1, &stmt, NULL);
 		if(rc != SQLITE_OK)
 		{
 			log_err("export_queries_to_disk(): SQL error prepare: %s", sqlite3_errstr(rc));
 			return false;
 		}
+		sqlite3_bind_int64(stmt, 1, last_disk_db_idx);
 
 		// Perform step
 		if((rc = sqlite3_step(stmt)) == SQLITE_ROW)
@@ -703,8 +1076,12 @@ bool export_queries_to_disk(const bool final)
 				new_blocked = 0;
 		}
 
-		// Update number of queries in the disk database
-		disk_db_num = get_number_of_queries_in_DB(memdb, "disk.query_storage");
+		// Update number of queries in the disk database. It is counted
+		// only once, afterwards the exported queries are added
+		if(__atomic_exchange_n(&disk_db_counted, true, __ATOMIC_RELAXED))
+			__atomic_add_fetch(&disk_db_num, insertions, __ATOMIC_RELAXED);
+		else
+			__atomic_store_n(&disk_db_num, get_number_of_queries_in_DB(memdb, "disk.query_storage"), __ATOMIC_RELAXED);
 
 		// All temp queries were stored to disk, update the IDs
 		last_disk_db_idx += insertions;
@@ -726,8 +1103,9 @@ bool export_queries_to_disk(const bool final)
 		"UPDATE disk.sqlite_sequence SET seq = (SELECT seq FROM sqlite_sequence WHERE disk.sqlite_sequence.name = sqlite_sequence.name)"
 	};
 
-	// Export linking tables
-	for(unsigned int i = 0; i < ArraySize(subtable_sql); i++)
+	// Export linking tables (they are written directly without in-memory
+	// database)
+	for(unsigned int i = 0; !direct_storage && i < ArraySize(subtable_sql); i++)
 	{
 		if((rc = sqlite3_exec(memdb, subtable_sql[i], NULL, NULL, NULL)) != SQLITE_OK)
 			log_err("export_queries_to_disk(disk.%s): Cannot export subtable: %s",
@@ -755,12 +1133,25 @@ bool delete_old_queries_from_db(const bool use_memdb, const double mintime)
 	bool okay = false;
 	const char *querystr = "DELETE FROM query_storage WHERE timestamp <= ?";
 
+	// Without in-memory database, the long-term database must not be
+	// touched here. Only the time window of the queries API moves on
+	if(use_memdb && direct_storage)
+	{
+		memdb_mintime = mintime;
+		return true;
+	}
+
 	sqlite3 *db = NULL;
 	if(use_memdb)
 		db = get_memdb();
 	else
 		db = dbopen(false, false);
 
+	// Drop entirely expired partitions of the on-disk database first, the
+	// remaining queries are deleted through the triggers of the view
+	if(!use_memdb && db != NULL && query_storage_partitioned(db))
+		drop_query_partitions(db, mintime);
+
 	// Prepare SQLite3 statement
 	sqlite3_stmt *stmt = NULL;
 	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
@@ -784,17 +1175,33 @@ bool delete_old_queries_from_db(const bool use_memdb, const double mintime)
 		log_err("delete_old_queries_from_db(): Failed to delete queries with timestamp >= %f: %s",
 		        mintime, sqlite3_errstr(rc));
 
-	// Update number of queries in in-memory database
-	const int new_num = get_number_of_queries_in_DB(NULL, "query_storage");
-	log_debug(DEBUG_GC, "delete_old_queries_from_db(): Deleted %i (%u) queries, new number of queries in memory: %i",
-	          sqlite3_changes(db), (mem_db_num - new_num), new_num);
-	mem_db_num = new_num;
+	// Evicted queries older than this are not part of the in-memory
+	// queries anymore
+	if(use_memdb && okay)
+		memdb_mintime = mintime;
+
+	// Update number of queries in the database
+	const int deleted = okay ? sqlite3_changes(db) : 0;
+	if(use_memdb)
+	{
+		const unsigned int new_num = __atomic_sub_fetch(&mem_db_num, deleted, __ATOMIC_RELAXED);
+		log_debug(DEBUG_GC, "delete_old_queries_from_db(): Deleted %i queries, new number of queries in memory: %u",
+		          deleted, new_num);
+	}
+	else
+		// Queries deleted through the triggers of the partitioned
+		// storage are not counted by sqlite3_changes()
+		disk_queries_deleted(-1);
 
 	// Finalize statement
 	sqlite3_finalize(stmt);
 
+	// Also delete the pre-aggregated counts of these queries
 	if(!use_memdb)
+	{
+		delete_query_rollup(db, mintime, true);
 		dbclose(&db);
+	}
 
 	return okay;
 }
@@ -967,6 +1374,29 @@ bool add_query_storage_column_ede(sqlite3 *db)
 	return true;
 }
 
+bool create_query_storage_timestamp_indices(sqlite3 *db)
+{
+	// Start transaction of database update
+	SQL_bool(db, "BEGIN TRANSACTION");
+
+	// Add indices for filtering by client or domain and sorting by time at
+	// the same time
+	SQL_bool(db, CREATE_QUERY_STORAGE_CLIENT_TIMESTAMP_INDEX);
+	SQL_bool(db, CREATE_QUERY_STORAGE_DOMAIN_TIMESTAMP_INDEX);
+
+	// Update database version to 22
+	if(!db_set_FTL_property(db, DB_VERSION, 22))
+	{
+		log_err("create_query_storage_timestamp_indices(): Failed to update database version!");
+		return false;
+	}
+
+	// Finish transaction
+	SQL_bool(db, "COMMIT");
+
+	return true;
+}
+
 bool optimize_queries_table(sqlite3 *db)
 {
 	// Start transaction of database update
@@ -1063,6 +1493,194 @@ bool create_addinfo_table(sqlite3 *db)
 }
 
 // Get most recent 24 hours data from long-term database
+// Linking table rows referenced by the queries imported on startup. The FTL
+// ID of each row is resolved on its first use so strings are only hashed and
+// looked up once per distinct domain, client, upstream and additional info
+struct id_map_entry {
+	sqlite3_int64 dbid;
+	int ftlid; // -1 until resolved
+	int num; // content as integer (additional info only)
+	int type; // type (additional info only)
+	size_t str; // offset into the string buffer
+};
+
+struct id_map {
+	struct id_map_entry *entries;
+	unsigned int num;
+	char *strings;
+	size_t len;
+	size_t size;
+};
+
+static bool id_map_add(struct id_map *map, sqlite3_stmt *stmt)
+{
+	const char *str = (const char *)sqlite3_column_text(stmt, 1);
+	if(str == NULL)
+		return true;
+
+	const size_t len = strlen(str) + 1;
+	if(map->len + len > map->size)
+	{
+		const size_t size = MAX(2*map->size, map->len + len + 4096u);
+		char *strings = realloc(map->strings, size);
+		if(strings == NULL)
+			return false;
+		map->strings = strings;
+		map->size = size;
+	}
+	memcpy(map->strings + map->len, str, len);
+
+	// Grow in powers of two, starting at 64 entries
+	if(map->num == 0 || (map->num >= 64u && (map->num & (map->num - 1)) == 0))
+	{
+		const unsigned int capacity = map->num > 0 ? 2*map->num : 64u;
+		struct id_map_entry *entries = realloc(map->entries, capacity*sizeof(*entries));
+		if(entries == NULL)
+			return false;
+		map->entries = entries;
+	}
+
+	struct id_map_entry *entry = &map->entries[map->num++];
+	entry->dbid = sqlite3_column_int64(stmt, 0);
+	entry->ftlid = -1;
+	entry->num = sqlite3_column_int(stmt, 1);
+	entry->type = sqlite3_column_count(stmt) > 2 ? sqlite3_column_int(stmt, 2) : 0;
+	entry->str = map->len;
+	map->len += len;
+
+	return true;
+}
+
+// Read all rows of a linking table referenced by queries newer than mintime,
+// the rows are returned sorted by their ID
+static bool id_map_load(sqlite3 *db, struct id_map *map, const char *querystr, const double mintime)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("DB_read_queries() - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	sqlite3_bind_double(stmt, 1, mintime);
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		if(!id_map_add(map, stmt))
+		{
+			log_err("DB_read_queries() - Memory allocation failed");
+			break;
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		log_err("DB_read_queries() - SQL error step: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+static void id_map_free(struct id_map *map)
+{
+	if(map->entries != NULL)
+		free(map->entries);
+	if(map->strings != NULL)
+		free(map->strings);
+	memset(map, 0, sizeof(*map));
+}
+
+// Get the linking table entry referenced by the given column, NULL if the
+// column holds the value itself (databases written by old versions of FTL)
+static struct id_map_entry *id_map_find(const struct id_map *map, sqlite3_stmt *stmt, const int col)
+{
+	if(sqlite3_column_type(stmt, col) != SQLITE_INTEGER)
+		return NULL;
+
+	const sqlite3_int64 dbid = sqlite3_column_int64(stmt, col);
+	unsigned int lo = 0, hi = map->num;
+	while(lo < hi)
+	{
+		const unsigned int mid = lo + (hi - lo) / 2;
+		if(map->entries[mid].dbid < dbid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < map->num && map->entries[lo].dbid == dbid ? &map->entries[lo] : NULL;
+}
+
+// Get the string referenced by the given column
+static const char *id_map_text(const struct id_map *map, const struct id_map_entry *entry,
+                               sqlite3_stmt *stmt, const int col)
+{
+	if(entry != NULL)
+		return map->strings + entry->str;
+	if(sqlite3_column_type(stmt, col) == SQLITE_INTEGER)
+		return NULL; // dangling reference
+	return (const char *)sqlite3_column_text(stmt, col);
+}
+
+// Find (and count) the domain of an imported query
+static int import_domainID(struct id_map_entry *entry, const char *domainname)
+{
+	if(entry == NULL)
+		return findDomainID(domainname, true);
+
+	if(entry->ftlid < 0)
+		return entry->ftlid = findDomainID(domainname, true);
+
+	domainsData *domain = getDomain(entry->ftlid, true);
+	if(domain != NULL)
+	{
+		domain->count++;
+		top_lists_domain_changed(entry->ftlid, domain);
+	}
+
+	return entry->ftlid;
+}
+
+// Find (and count) the client of an imported query
+static int import_clientID(struct id_map_entry *entry, const char *clientIP, const double timestamp)
+{
+	if(entry == NULL)
+		return findClientID(clientIP, true, false, timestamp);
+
+	if(entry->ftlid < 0)
+		return entry->ftlid = findClientID(clientIP, true, false, timestamp);
+
+	clientsData *client = getClient(entry->ftlid, true);
+	if(client != NULL)
+		change_clientcount(client, 1, 0, -1, 0);
+
+	return entry->ftlid;
+}
+
+// Find the upstream of an imported query given as "address#port"
+static int import_upstreamID(struct id_map_entry *entry, const char *forward)
+{
+	if(entry != NULL && entry->ftlid >= 0)
+		return entry->ftlid;
+
+	// Get IP address and port of upstream destination
+	char serv_addr[INET6_ADDRSTRLEN + 16] = { 0 };
+	unsigned int serv_port = 53;
+	// We limit the number of bytes written into the serv_addr buffer
+	// to prevent buffer overflows. If there is no port available in
+	// the database, we skip extracting them and use the default port
+	sscanf(forward, "%"xstr(INET6_ADDRSTRLEN)"[^#]#%u", serv_addr, &serv_port);
+	serv_addr[INET6_ADDRSTRLEN + 15] = '\0';
+	const int upstreamID = findUpstreamID(serv_addr, (in_port_t)serv_port);
+
+	if(entry != NULL)
+		entry->ftlid = upstreamID;
+
+	return upstreamID;
+}
+
 void DB_read_queries(void)
 {
 	// Prepare request
@@ -1080,7 +1698,7 @@ void DB_read_queries(void)
 	                              "reply_type,"\
 	                              "reply_time,"\
 	                              "dnssec "\
-	                       "FROM queries WHERE timestamp >= ?";
+	                       "FROM query_storage WHERE timestamp >= ?";
 
 	// Only try to import from database if it is known to not be broken
 	if(FTLDBerror())
@@ -1088,14 +1706,35 @@ void DB_read_queries(void)
 
 	log_info("Parsing queries in database");
 
-	// Prepare SQLite3 statement
-	sqlite3_stmt *stmt = NULL;
+	// Read the linking tables first instead of resolving the references of
+	// every single query through the queries view
 	sqlite3 *memdb = get_memdb();
-	int rc = sqlite3_prepare_v2(memdb, querystr, -1, &stmt, NULL);
+	struct id_map domain_map = { 0 }, client_map = { 0 }, forward_map = { 0 }, addinfo_map = { 0 };
+	if(!id_map_load(memdb, &domain_map, "SELECT id,domain FROM domain_by_id WHERE id IN "
+	                                    "(SELECT domain FROM query_storage WHERE timestamp >= ?) ORDER BY id", mintime) ||
+	   !id_map_load(memdb, &client_map, "SELECT id,ip FROM client_by_id WHERE id IN "
+	                                    "(SELECT client FROM query_storage WHERE timestamp >= ?) ORDER BY id", mintime) ||
+	   !id_map_load(memdb, &forward_map, "SELECT id,forward FROM forward_by_id WHERE id IN "
+	                                     "(SELECT forward FROM query_storage WHERE timestamp >= ?) ORDER BY id", mintime) ||
+	   !id_map_load(memdb, &addinfo_map, "SELECT id,content,type FROM addinfo_by_id WHERE id IN "
+	                                     "(SELECT additional_info FROM query_storage WHERE timestamp >= ?) ORDER BY id", mintime))
+	{
+		id_map_free(&domain_map);
+		id_map_free(&client_map);
+		id_map_free(&forward_map);
+		id_map_free(&addinfo_map);
+		return;
+	}
+	log_debug(DEBUG_DATABASE, "Read %u domains, %u clients, %u upstreams, and %u additional infos",
+	          domain_map.num, client_map.num, forward_map.num, addinfo_map.num);
+
+	// Prepare SQLite3 statement
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(memdb, querystr, -1, &stmt, NULL);
 	if( rc != SQLITE_OK )
 	{
 		log_err("DB_read_queries() - SQL error prepare: %s", sqlite3_errstr(rc));
-		return;
+		goto end_of_DB_read_queries;
 	}
 
 	// Bind limit
@@ -1103,13 +1742,14 @@ void DB_read_queries(void)
 	{
 		log_err("DB_read_queries() - Failed to bind mintime: %s", sqlite3_errstr(rc));
 		sqlite3_finalize(stmt);
-		return;
+		goto end_of_DB_read_queries;
 	}
 
 	// Lock shared memory
 	lock_shm();
 
 	// Loop through returned database rows
+	unsigned int imported = 0;
 	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
 	{
 		const sqlite3_int64 dbID = sqlite3_column_int64(stmt, 0);
@@ -1145,7 +1785,8 @@ void DB_read_queries(void)
 		}
 		const enum query_status status = status_int;
 
-		const char *domainname = (const char *)sqlite3_column_text(stmt, 4);
+		struct id_map_entry *domain_entry = id_map_find(&domain_map, stmt, 4);
+		const char *domainname = id_map_text(&domain_map, domain_entry, stmt, 4);
 		if(domainname == NULL)
 		{
 			log_warn("Database: DOMAIN should never be NULL, ID = %lld, timestamp = %f",
@@ -1153,7 +1794,8 @@ void DB_read_queries(void)
 			continue;
 		}
 
-		const char *clientIP = (const char *)sqlite3_column_text(stmt, 5);
+		struct id_map_entry *client_entry = id_map_find(&client_map, stmt, 5);
+		const char *clientIP = id_map_text(&client_map, client_entry, stmt, 5);
 		if(clientIP == NULL)
 		{
 			log_warn("Database: CLIENT should never be NULL, ID = %lld, timestamp = %f",
@@ -1189,22 +1831,12 @@ void DB_read_queries(void)
 		// Ensure we have enough shared memory available for new data
 		shm_ensure_size();
 
-		const char *buffer = NULL;
 		int upstreamID = -1; // Default if not forwarded
 		// Try to extract the upstream from the "forward" column if non-empty
-		if(sqlite3_column_bytes(stmt, 6) > 0 &&
-		   (buffer = (const char *)sqlite3_column_text(stmt, 6)) != NULL)
-		{
-			// Get IP address and port of upstream destination
-			char serv_addr[INET6_ADDRSTRLEN + 16] = { 0 };
-			unsigned int serv_port = 53;
-			// We limit the number of bytes written into the serv_addr buffer
-			// to prevent buffer overflows. If there is no port available in
-			// the database, we skip extracting them and use the default port
-			sscanf(buffer, "%"xstr(INET6_ADDRSTRLEN)"[^#]#%u", serv_addr, &serv_port);
-			serv_addr[INET6_ADDRSTRLEN + 15] = '\0';
-			upstreamID = findUpstreamID(serv_addr, (in_port_t)serv_port);
-		}
+		struct id_map_entry *forward_entry = id_map_find(&forward_map, stmt, 6);
+		const char *forward = id_map_text(&forward_map, forward_entry, stmt, 6);
+		if(forward != NULL && forward[0] != '\0')
+			upstreamID = import_upstreamID(forward_entry, forward);
 
 		double reply_time = 0.0;
 		bool reply_time_avail = false;
@@ -1223,8 +1855,8 @@ void DB_read_queries(void)
 
 		// Obtain IDs only after filtering which queries we want to keep
 		const int timeidx = getOverTimeID(queryTimeStamp);
-		const int domainID = findDomainID(domainname, true);
-		const int clientID = findClientID(clientIP, true, false, queryTimeStamp);
+		const int domainID = import_domainID(domain_entry, domainname);
+		const int clientID = import_clientID(client_entry, clientIP, queryTimeStamp);
 
 		// Set index for this query
 		const int queryIndex = counters->queries;
@@ -1232,7 +1864,7 @@ void DB_read_queries(void)
 		// Store this query in memory
 		queriesData *query = getQuery(queryIndex, false);
 		query->magic = MAGICBYTE;
-		query->timestamp = queryTimeStamp;
+		set_query_timestamp(query, queryTimeStamp);
 		if(type < 100)
 		{
 			// Mapped query type
@@ -1252,8 +1884,8 @@ void DB_read_queries(void)
 			query->type = TYPE_OTHER;
 			query->qtype = type - 100;
 		}
-		counters->querytype[query->type]++;
-		log_debug(DEBUG_STATUS, "query type %d set (database), ID = %u, new count = %u", query->type, counters->queries, counters->querytype[query->type]);
+		change_querytype_count(query->type, 1);
+		log_debug(DEBUG_STATUS, "query type %d set (database), ID = %u, new count = %u", query->type, counters->queries, get_querytype_count(query->type));
 
 		// Status is set below
 		query->domainID = domainID;
@@ -1261,19 +1893,20 @@ void DB_read_queries(void)
 		query->upstreamID = upstreamID;
 		query->cacheID = -1;
 		query->id = counters->queries;
-		query->response = 0;
+		set_query_dbid(query, dbID);
 		query->flags.response_calculated = reply_time_avail;
 		query->dnssec = dnssec;
 		query->reply = reply;
-		counters->reply[query->reply]++;
-		log_debug(DEBUG_STATUS, "reply type %u set (database), ID = %u, new count = %u", query->reply, counters->queries, counters->reply[query->reply]);
-		query->response = reply_time;
+		change_reply_count(query->reply, 1);
+		log_debug(DEBUG_STATUS, "reply type %u set (database), ID = %u, new count = %u", query->reply, counters->queries, get_reply_count(query->reply));
+		set_query_response(query, reply_time);
 		query->CNAME_domainID = -1;
 		// Initialize flags
 		query->flags.complete = true; // Mark as all information is available
 		query->flags.blocked = false;
 		query->flags.allowed = false;
 		query->flags.database.stored = true;
+		query->flags.database.streamed = true;
 		query->flags.database.changed = false;
 		query->ede = -1; // EDE_UNSET == -1
 
@@ -1283,6 +1916,8 @@ void DB_read_queries(void)
 
 		// Update client's overTime data structure
 		change_clientcount(client, 0, 0, timeidx, 1);
+		change_overTime_tiers(queryTimeStamp, 1, 0, 0, 0);
+		client_sketch_add(clientID, domainID, CLIENT_SKETCH_PERMITTED);
 
 		// Get domain pointer
 		domainsData *domain = getDomain(domainID, true);
@@ -1290,21 +1925,28 @@ void DB_read_queries(void)
 
 		// Increase DNS queries counter
 		counters->queries++;
+		imported++;
 
 		// Get additional information from the additional_info column if applicable
+		struct id_map_entry *addinfo_entry = id_map_find(&addinfo_map, stmt, 7);
 		if(status == QUERY_GRAVITY_CNAME ||
 		   status == QUERY_REGEX_CNAME ||
 		   status == QUERY_DENYLIST_CNAME )
 		{
 			// QUERY_*_CNAME: Get domain causing the blocking
-			const char *CNAMEdomain = (const char *)sqlite3_column_text(stmt, 7);
+			const char *CNAMEdomain = id_map_text(&addinfo_map, addinfo_entry, stmt, 7);
 			if(CNAMEdomain != NULL && strlen(CNAMEdomain) > 0)
 			{
 				// Add domain to FTL's memory but do not count it. Seeing a
 				// domain in the middle of a CNAME trajectory does not mean
 				// it was queried intentionally.
-				const int CNAMEdomainID = findDomainID(CNAMEdomain, false);
-				query->CNAME_domainID = CNAMEdomainID;
+				if(addinfo_entry == NULL)
+					query->CNAME_domainID = findDomainID(CNAMEdomain, false);
+				else if(addinfo_entry->ftlid < 0)
+					query->CNAME_domainID = addinfo_entry->ftlid = findDomainID(CNAMEdomain, false);
+				else
+					query->CNAME_domainID = addinfo_entry->ftlid;
+				const int CNAMEdomainID = query->CNAME_domainID;
 
 				// Get domain pointer and update lastQuery timer
 				domainsData *cdomain = getDomain(CNAMEdomainID, true);
@@ -1323,9 +1965,13 @@ void DB_read_queries(void)
 			//  a) we have a cache entry
 			//  b) the value of additional_info is not NULL (0 bytes storage size)
 			if(cache != NULL && sqlite3_column_bytes(stmt, 7) != 0)
-				cache->list_id = sqlite3_column_int(stmt, 7);
+				cache->list_id = addinfo_entry != NULL ? addinfo_entry->num : sqlite3_column_int(stmt, 7);
 		}
 
+		// Reference domain, client, CNAME domain and cache record of
+		// this query so they are not recycled while it is in memory
+		ref_query(query);
+
 		// Increment status counters
 		query_set_status_init(query, status);
 
@@ -1350,7 +1996,9 @@ void DB_read_queries(void)
 				query->flags.blocked = true;
 				// Get domain pointer
 				domain->blockedcount++;
+				top_lists_domain_changed(domainID, domain);
 				change_clientcount(client, 0, 1, -1, 0);
+				client_sketch_blocked(clientID, domainID);
 				break;
 
 			case QUERY_FORWARDED: // Forwarded
@@ -1385,23 +2033,31 @@ void DB_read_queries(void)
 				break;
 		}
 
-		if(counters->queries % 10000 == 0)
-			log_info("  %u queries parsed...", counters->queries);
+		if(imported % 10000 == 0)
+		{
+			log_info("  %u queries parsed...", imported);
+			// Move queries outside of the hot window into the cold
+			// tier right away so the queries do not grow beyond it
+			demote_queries(time(NULL));
+		}
 	}
 
 	// Release shared memory
 	unlock_shm();
 
 	if( rc != SQLITE_DONE )
-	{
 		log_err("DB_read_queries() - SQL error step: %s", sqlite3_errstr(rc));
-		return;
-	}
+	else
+		log_info("Imported %u queries from the long-term database", imported);
 
 	// Finalize SQLite3 statement
 	sqlite3_finalize(stmt);
 
-	log_info("Imported %u queries from the long-term database", counters->queries);
+end_of_DB_read_queries:
+	id_map_free(&domain_map);
+	id_map_free(&client_map);
+	id_map_free(&forward_map);
+	id_map_free(&addinfo_map);
 }
 
 void init_disk_db_idx(void)
@@ -1442,116 +2098,378 @@ void init_disk_db_idx(void)
 	last_mem_db_idx = last_disk_db_idx;
 }
 
-bool queries_to_database(void)
+// Copy of a changed query taken while holding the SHM lock. Strings are stored
+// as offsets into the string buffer of the export buffer
+#define NO_STRING SIZE_MAX
+struct export_query {
+	sqlite3_int64 id;
+	double timestamp;
+	double reply_time;
+	int type;
+	int status;
+	int reply;
+	int dnssec;
+	int ede;
+	int list_id;
+	enum addinfo_type addinfo;
+	size_t domain;
+	size_t client_ip;
+	size_t client_name;
+	size_t forward;
+	size_t cname;
+	bool reply_time_valid;
+	bool new;
+	bool blocked;
+	bool stream;
+};
+
+struct export_buffer {
+	struct export_query *queries;
+	unsigned int num;
+	unsigned int size;
+	char *strings;
+	size_t strings_len;
+	size_t strings_size;
+	double since;
+};
+
+// Changed queries are copied into one buffer while the other one may still
+// hold queries which could not be stored yet and are retried first. Without
+// in-memory database, the third one takes the queries which are too recent to
+// be written to disk (see store_direct_queries())
+static struct export_buffer export_buffers[3] = {{ 0 }};
+static struct export_buffer *fill_buffer = &export_buffers[0];
+static struct export_buffer *retry_buffer = &export_buffers[1];
+static struct export_buffer *spare_buffer = &export_buffers[2];
+static unsigned long next_mem_db_idx = 0;
+
+// Queue depth and age of the oldest query not yet stored, read by the API
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int export_pending = 0;
+static double export_since = 0.0;
+
+// Append a string to the buffer and return its offset
+static size_t buffer_string(struct export_buffer *buf, const char *str)
 {
-	int rc;
-	unsigned int added = 0, updated = 0;
-	sqlite3_int64 idx = 0;
+	if(str == NULL)
+		return NO_STRING;
 
-	// Only try to export to database if it is known to not be broken
-	if(FTLDBerror())
+	const size_t len = strlen(str) + 1;
+	if(buf->strings_len + len > buf->strings_size)
+	{
+		size_t size = buf->strings_size > 0 ? buf->strings_size : 16384u;
+		while(size < buf->strings_len + len)
+			size *= 2;
+		char *strings = realloc(buf->strings, size);
+		if(strings == NULL)
+			return NO_STRING;
+		buf->strings = strings;
+		buf->strings_size = size;
+	}
+
+	const size_t offset = buf->strings_len;
+	memcpy(buf->strings + offset, str, len);
+	buf->strings_len += len;
+
+	return offset;
+}
+
+static inline const char *buffer_str(const struct export_buffer *buf, const size_t offset)
+{
+	return offset == NO_STRING ? NULL : buf->strings + offset;
+}
+
+// Get the next free (zeroed) query of the export buffer
+static struct export_query *buffer_query(struct export_buffer *buf)
+{
+	if(buf->num == buf->size)
+	{
+		const unsigned int size = buf->size > 0 ? 2*buf->size : 1024u;
+		struct export_query *queries = realloc(buf->queries, size*sizeof(*queries));
+		if(queries == NULL)
+			return NULL;
+		buf->queries = queries;
+		buf->size = size;
+	}
+
+	struct export_query *q = &buf->queries[buf->num];
+	memset(q, 0, sizeof(*q));
+
+	return q;
+}
+
+// Copy a query from one export buffer into another one
+static bool copy_buffer_query(struct export_buffer *dst, const struct export_buffer *src,
+                              const struct export_query *query)
+{
+	struct export_query *q = buffer_query(dst);
+	if(q == NULL)
 		return false;
 
-	// Skip, we never store nor count queries recorded while have been in
-	// maximum privacy mode in the database
-	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_MAXIMUM)
+	*q = *query;
+	q->domain = buffer_string(dst, buffer_str(src, query->domain));
+	q->client_ip = buffer_string(dst, buffer_str(src, query->client_ip));
+	q->client_name = buffer_string(dst, buffer_str(src, query->client_name));
+	q->forward = buffer_string(dst, buffer_str(src, query->forward));
+	q->cname = buffer_string(dst, buffer_str(src, query->cname));
+	if(q->domain == NO_STRING || q->client_ip == NO_STRING || q->client_name == NO_STRING)
+		return false;
+
+	if(dst->num++ == 0)
+		dst->since = src->since;
+
+	return true;
+}
+
+// Copy a query into the export buffer, this needs the SHM lock
+static bool snapshot_query(struct export_buffer *buf, queriesData *query)
+{
+	struct export_query *q = buffer_query(buf);
+	if(q == NULL)
+		return false;
+
+	q->timestamp = get_query_timestamp(query);
+	q->blocked = query->flags.blocked;
+
+	// Store query type + offset if query->type is OTHER
+	q->type = query->type != TYPE_OTHER ? (int)query->type : query->qtype + 100;
+	q->status = query->status;
+	q->reply = query->reply;
+	q->dnssec = query->dnssec;
+	q->ede = query->ede;
+
+	q->domain = buffer_string(buf, getDomainString(query));
+	q->client_ip = buffer_string(buf, getClientIPString(query));
+	q->client_name = buffer_string(buf, getClientNameString(query));
+	if(q->domain == NO_STRING || q->client_ip == NO_STRING || q->client_name == NO_STRING)
+		return false;
+
+	q->forward = NO_STRING;
+	if(query->upstreamID > -1)
 	{
-		log_debug(DEBUG_DATABASE, "Not storing query in database due to privacy level settings");
-		return true;
+		const upstreamsData *upstream = getUpstream(query->upstreamID, true);
+		char *forward = NULL;
+		if(upstream != NULL && asprintf(&forward, "%s#%u", getstr(upstream->ippos), upstream->port) > 0)
+		{
+			q->forward = buffer_string(buf, forward);
+			free(forward);
+		}
 	}
-	if(counters->queries == 0)
+
+	// Get cache entry for this query
+	const unsigned int cacheID = query->cacheID > -1 ? query->cacheID : findCacheID(query->domainID, query->clientID, query->type, false);
+	const DNSCacheData *cache = getDNSCache(cacheID, true);
+	q->list_id = cache != NULL ? cache->list_id : -1;
+
+	q->cname = NO_STRING;
+	if(query->status == QUERY_GRAVITY_CNAME ||
+	   query->status == QUERY_REGEX_CNAME ||
+	   query->status == QUERY_DENYLIST_CNAME)
 	{
-		log_debug(DEBUG_DATABASE, "Not storing query in database as there are none");
-		return true;
+		// Save domain blocked during deep CNAME inspection
+		q->addinfo = ADDINFO_CNAME_DOMAIN;
+		q->cname = buffer_string(buf, getCNAMEDomainString(query));
 	}
-	if(!store_in_database)
+	else if(q->list_id != -1)
 	{
-		log_debug(DEBUG_DATABASE, "Not storing query in database as this is disabled");
-		return true;
+		// Restore regex ID if applicable
+		q->addinfo = ADDINFO_LIST_ID;
 	}
 
-	// Loop over recent queries and store new or changed ones in the
-	// in-memory database
-	// The upper bound is the last query in the array, the lower bound is
-	// indirectly given by the first query older than 30 seconds - we do not
-	// expect replies to still arrive after 30 seconds - they are anyway
-	// useless as the client will have already timed out tis particular
-	// query and retried or failed
+	q->reply_time_valid = query->flags.response_calculated;
+	if(q->reply_time_valid)
+		q->reply_time = get_query_response(query);
+
+	// Explicitly set ID to match what is in the on-disk database. New
+	// queries get their ID right away so later changes update the same row
+	q->new = get_query_dbid(query) == -1;
+	if(q->new)
+	{
+		if(next_mem_db_idx < last_mem_db_idx)
+			next_mem_db_idx = last_mem_db_idx;
+		set_query_dbid(query, (int64_t)++next_mem_db_idx);
+	}
+	q->id = get_query_dbid(query);
+
+	// Queries are streamed once their first reply is known
+	// (database.sink.target)
+	q->stream = !query->flags.database.streamed && query->reply != REPLY_UNKNOWN &&
+	            query_sink_enabled();
+	if(q->stream)
+		query->flags.database.streamed = true;
+
+	if(buf->num++ == 0)
+		buf->since = double_time();
+
+	// Memorize query as copied, it is copied again if it changes before
+	// the copy has been stored
+	query->flags.database.changed = false;
+
+	return true;
+}
+
+// Copy all changed queries into the export buffer. This has to be called while
+// holding the SHM lock
+static void snapshot_changed_queries(struct export_buffer *buf)
+{
+	// Store new or changed queries in the in-memory database. These are
+	// usually taken from the list of changed queries. If it overflowed,
+	// we fall back to scanning the recent queries backwards. The lower
+	// bound is then indirectly given by the first query older than 30
+	// seconds - we do not expect replies to still arrive after 30 seconds
+	// - they are anyway useless as the client will have already timed out
+	// this particular query and retried or failed
+	unsigned int num = 0;
+	const bool from_list = get_dirty_queries(&num);
+	if(!from_list)
+	{
+		log_debug(DEBUG_DATABASE, "List of changed queries is incomplete, scanning recent queries");
+		num = counters->queries;
+	}
+	else if(num == 0)
+		return;
+
 	const double limit_timestamp = double_time() - REPLY_TIMEOUT;
-	for(unsigned int queryID = counters->queries - 1; queryID > 0; queryID--)
+	bool done = false;
+	unsigned int i = 0;
+	for(i = 0; i < num; i++)
 	{
-		// Get query pointer
-		queriesData *query = getQuery(queryID, true);
-		if(query == NULL)
+		queriesData *query = NULL;
+		if(from_list)
 		{
-			// Encountered memory error, skip query
-			log_err("Memory error in queries_to_database() when trying to access query %u", queryID);
-			break;
+			// Skip queries which have been expired in the meantime
+			if((query = get_dirty_query(i)) == NULL)
+				continue;
 		}
+		else
+		{
+			// Get query pointer
+			const unsigned int queryID = num - 1 - i;
+			if((query = getQuery(queryID, true)) == NULL)
+			{
+				// Encountered memory error, skip query
+				log_err("Memory error in queries_to_database() when trying to access query %u", queryID);
+				break;
+			}
 
-		// Skip too old queries (see note above the loop)
-		if(query->timestamp < limit_timestamp)
-			break;
+			// Skip too old queries (see note above the loop)
+			if(get_query_timestamp(query) < limit_timestamp)
+			{
+				done = true;
+				break;
+			}
+		}
 
 		// Skip queries which have not changed since the last iteration
 		if(!query->flags.database.changed)
 			continue;
 
-		// Explicitly set ID to match what is in the on-disk database
-		if(query->db > -1)
+		if(!snapshot_query(buf, query))
 		{
-			// We update an existing query
-			idx = query->db;
-		}
-		else
-		{
-			// We create a new query
-			idx = last_mem_db_idx + 1;
+			log_err("Memory error in queries_to_database() when trying to copy a query");
+			break;
 		}
+	}
+
+	// Start a new list of changed queries if all of them have been copied.
+	// Otherwise, the remaining ones are tried again next time
+	if(i == num || done)
+		reset_dirty_queries();
+}
+
+// Hand the completed queries copied since the first one to the query sink.
+// This does not need the SHM lock
+static void stream_queries(const struct export_buffer *buf, const unsigned int first)
+{
+	for(unsigned int i = first; i < buf->num; i++)
+	{
+		const struct export_query *q = &buf->queries[i];
+		if(!q->stream)
+			continue;
+
+		// Types without a name are stored with an offset (see
+		// snapshot_query())
+		const bool other = q->type >= 100;
+		const queriesData query = { .qtype = other ? q->type - 100 : 0 };
+		char type[20];
+
+		const struct sink_record record = {
+			.id = q->id,
+			.timestamp = q->timestamp,
+			.reply_time = q->reply_time_valid ? q->reply_time : -1.0,
+			.domain = buffer_str(buf, q->domain),
+			.client_ip = buffer_str(buf, q->client_ip),
+			.client_name = buffer_str(buf, q->client_name),
+			.type = get_query_type_str(other ? TYPE_OTHER : (enum query_type)q->type, &query, type),
+			.status = get_query_status_str(q->status),
+			.reply = get_query_reply_str(q->reply),
+			.dnssec = get_query_dnssec_str(q->dnssec),
+			.upstream = buffer_str(buf, q->forward),
+			.cname = buffer_str(buf, q->cname),
+			.list_id = q->list_id,
+			.ede = q->ede
+		};
+		query_sink_add(&record);
+	}
+}
+
+// Store the queries of an export buffer in the in-memory database (or in the
+// long-term database when there is none). This does not need the SHM lock
+static bool store_export_buffer(struct export_buffer *buf, unsigned int *added, unsigned int *updated)
+{
+	if(buf->num == 0)
+		return true;
+
+	// Store all queries in a single transaction
+	sqlite3 *memdb = get_memdb();
+	int rc = sqlite3_exec(memdb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("queries_to_database(): Cannot start transaction: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	bool okay = true;
+	unsigned long max_idx = last_mem_db_idx;
+	unsigned int new_queries = 0, blocked = 0;
+	double last_timestamp = new_last_timestamp;
+	for(unsigned int i = 0; okay && i < buf->num; i++)
+	{
+		const struct export_query *q = &buf->queries[i];
 
 		// ID
-		sqlite3_bind_int64(query_stmt, 1, idx);
+		sqlite3_bind_int64(query_stmt, 1, q->id);
 
 		// TIMESTAMP
-		sqlite3_bind_double(query_stmt, 2, query->timestamp);
+		sqlite3_bind_double(query_stmt, 2, q->timestamp);
 
 		// TYPE
-		if(query->type != TYPE_OTHER)
-		{
-			// Store mapped type if query->type is not OTHER
-			sqlite3_bind_int(query_stmt, 3, query->type);
-		}
-		else
-		{
-			// Store query type + offset if query-> type is OTHER
-			sqlite3_bind_int(query_stmt, 3, query->qtype + 100);
-		}
+		sqlite3_bind_int(query_stmt, 3, q->type);
 
 		// STATUS
-		sqlite3_bind_int(query_stmt, 4, query->status);
+		sqlite3_bind_int(query_stmt, 4, q->status);
 
 		// DOMAIN
-		const char *domain = getDomainString(query);
+		const char *domain = buffer_str(buf, q->domain);
 		sqlite3_bind_text(query_stmt, 5, domain, -1, SQLITE_STATIC);
 		sqlite3_bind_text(domain_stmt, 1, domain, -1, SQLITE_STATIC);
 
 		// Execute prepare domain statement and check if successful
 		rc = sqlite3_step(domain_stmt);
+		sqlite3_clear_bindings(domain_stmt);
+		sqlite3_reset(domain_stmt);
 		if(rc != SQLITE_DONE)
 		{
 			log_err("Encountered error while trying to store domain");
-			sqlite3_clear_bindings(domain_stmt);
-			sqlite3_reset(domain_stmt);
+			okay = false;
 			break;
 		}
-		sqlite3_clear_bindings(domain_stmt);
-		sqlite3_reset(domain_stmt);
 
 		// CLIENT
-		const char *clientIP = getClientIPString(query);
+		const char *clientIP = buffer_str(buf, q->client_ip);
 		sqlite3_bind_text(query_stmt, 6, clientIP, -1, SQLITE_STATIC);
 		sqlite3_bind_text(client_stmt, 1, clientIP, -1, SQLITE_STATIC);
-		const char *clientName = getClientNameString(query);
+		const char *clientName = buffer_str(buf, q->client_name);
 		sqlite3_bind_text(query_stmt, 7, clientName, -1, SQLITE_STATIC);
 		sqlite3_bind_text(client_stmt, 2, clientName, -1, SQLITE_STATIC);
 
@@ -1562,43 +2480,26 @@ bool queries_to_database(void)
 		if(rc != SQLITE_DONE)
 		{
 			log_err("Encountered error while trying to store client");
+			okay = false;
 			break;
 		}
 
 		// FORWARD
-		if(query->upstreamID > -1)
+		const char *forward = buffer_str(buf, q->forward);
+		if(forward != NULL)
 		{
-			// Get forward pointer
-			const upstreamsData *upstream = getUpstream(query->upstreamID, true);
-			if(upstream != NULL)
-			{
-				char *buffer = NULL;
-				const char *forwardIP = getstr(upstream->ippos);
-				int len = 0; // The length of the string WITHOUT the NUL byte. This is what sqlite3_bind_text() expects.
-				if((len = asprintf(&buffer, "%s#%u", forwardIP, upstream->port)) > 0)
-				{
-					// Use transient here as we step only after the buffer is freed below
-					sqlite3_bind_text(query_stmt, 8, buffer, len, SQLITE_TRANSIENT);
-					// Use static here as we insert right away
-					sqlite3_bind_text(forward_stmt, 1, buffer, len, SQLITE_STATIC);
-
-					// Execute prepared forward statement and check if successful
-					rc = sqlite3_step(forward_stmt);
-					sqlite3_clear_bindings(forward_stmt);
-					sqlite3_reset(forward_stmt);
-					if(rc != SQLITE_DONE)
-					{
-						log_err("Encountered error while trying to store forward");
-						break;
-					}
-				}
-				else
-				{
-					// Memory error: Do not store the forward destination
-					sqlite3_bind_null(query_stmt, 8);
-				}
+			sqlite3_bind_text(query_stmt, 8, forward, -1, SQLITE_STATIC);
+			sqlite3_bind_text(forward_stmt, 1, forward, -1, SQLITE_STATIC);
 
-				if(buffer) free(buffer);
+			// Execute prepared forward statement and check if successful
+			rc = sqlite3_step(forward_stmt);
+			sqlite3_clear_bindings(forward_stmt);
+			sqlite3_reset(forward_stmt);
+			if(rc != SQLITE_DONE)
+			{
+				log_err("Encountered error while trying to store forward");
+				okay = false;
+				break;
 			}
 		}
 		else
@@ -1607,81 +2508,70 @@ bool queries_to_database(void)
 			sqlite3_bind_null(query_stmt, 8);
 		}
 
-		// Get cache entry for this query
-		const unsigned int cacheID = query->cacheID > -1 ? query->cacheID : findCacheID(query->domainID, query->clientID, query->type, false);
-		DNSCacheData *cache = getDNSCache(cacheID, true);
-
 		// ADDITIONAL_INFO
-		if(query->status == QUERY_GRAVITY_CNAME ||
-		   query->status == QUERY_REGEX_CNAME ||
-		   query->status == QUERY_DENYLIST_CNAME)
+		const char *cname = buffer_str(buf, q->cname);
+		bool addinfo = true;
+		if(q->addinfo == ADDINFO_CNAME_DOMAIN && cname != NULL)
 		{
 			// Save domain blocked during deep CNAME inspection
-			const char *cname = getCNAMEDomainString(query);
-			const int len = strlen(cname);
 			sqlite3_bind_int(query_stmt, 9, ADDINFO_CNAME_DOMAIN);
-			sqlite3_bind_text(query_stmt, 10, cname, len, SQLITE_STATIC);
-
-			// Execute prepared addinfo statement and check if successful
+			sqlite3_bind_text(query_stmt, 10, cname, -1, SQLITE_STATIC);
 			sqlite3_bind_int(addinfo_stmt, 1, ADDINFO_CNAME_DOMAIN);
-			sqlite3_bind_text(addinfo_stmt, 2, cname, len, SQLITE_STATIC);
-			rc = sqlite3_step(addinfo_stmt);
-			sqlite3_clear_bindings(addinfo_stmt);
-			sqlite3_reset(addinfo_stmt);
-			if(rc != SQLITE_DONE)
-			{
-				log_err("Encountered error while trying to store addinfo");
-				break;
-			}
+			sqlite3_bind_text(addinfo_stmt, 2, cname, -1, SQLITE_STATIC);
 		}
-		else if(cache != NULL && cache->list_id != -1)
+		else if(q->addinfo == ADDINFO_LIST_ID)
 		{
 			// Restore regex ID if applicable
 			sqlite3_bind_int(query_stmt, 9, ADDINFO_LIST_ID);
-			sqlite3_bind_int(query_stmt, 10, cache->list_id);
-
-			// Execute prepared addinfo statement and check if successful
+			sqlite3_bind_int(query_stmt, 10, q->list_id);
 			sqlite3_bind_int(addinfo_stmt, 1, ADDINFO_LIST_ID);
-			sqlite3_bind_int(addinfo_stmt, 2, cache->list_id);
+			sqlite3_bind_int(addinfo_stmt, 2, q->list_id);
+		}
+		else
+		{
+			// Nothing to add here
+			sqlite3_bind_null(query_stmt, 9);
+			sqlite3_bind_null(query_stmt, 10);
+			addinfo = false;
+		}
+
+		// Execute prepared addinfo statement and check if successful
+		if(addinfo)
+		{
 			rc = sqlite3_step(addinfo_stmt);
 			sqlite3_clear_bindings(addinfo_stmt);
 			sqlite3_reset(addinfo_stmt);
 			if(rc != SQLITE_DONE)
 			{
 				log_err("Encountered error while trying to store addinfo");
+				okay = false;
 				break;
 			}
 		}
-		else
-		{
-			// Nothing to add here
-			sqlite3_bind_null(query_stmt, 9);
-			sqlite3_bind_null(query_stmt, 10);
-		}
 
 		// REPLY_TYPE
-		sqlite3_bind_int(query_stmt, 11, query->reply);
+		sqlite3_bind_int(query_stmt, 11, q->reply);
 
 		// REPLY_TIME
-		if(query->flags.response_calculated)
+		if(q->reply_time_valid)
 			// Store difference (in seconds) when applicable
-			sqlite3_bind_double(query_stmt, 12, query->response);
+			sqlite3_bind_double(query_stmt, 12, q->reply_time);
 		else
 			// Store NULL otherwise
 			sqlite3_bind_null(query_stmt, 12);
 
 		// DNSSEC
-		sqlite3_bind_int(query_stmt, 13, query->dnssec);
+		sqlite3_bind_int(query_stmt, 13, q->dnssec);
 
 		// LIST_ID
-		if(cache != NULL && cache->list_id != -1)
-			sqlite3_bind_int(query_stmt, 14, cache->list_id);
+		if(q->list_id != -1)
+			sqlite3_bind_int(query_stmt, 14, q->list_id);
 		else
 			// Not applicable, setting NULL
 			sqlite3_bind_null(query_stmt, 14);
 
 		// EDE
-		sqlite3_bind_int(query_stmt, 15, query->ede);
+		sqlite3_bind_int(query_stmt, 15, q->ede);
 
 		// Step and check if successful
 		rc = sqlite3_step(query_stmt);
@@ -1691,37 +2581,157 @@ bool queries_to_database(void)
 		if( rc != SQLITE_DONE )
 		{
 			log_err("Encountered error while trying to store queries in query_storage: %s", sqlite3_errstr(rc));
+			okay = false;
 			break;
 		}
 
-		// Update fields if this is a new query (skip if we are only updating an
-		// existing entry)
-		if(query->db == -1)
-		{
-			// Store database index for this query (in case we need to
-			// update it later on)
-			query->db = (int64_t)++last_mem_db_idx;
+		if((unsigned long)q->id > max_idx)
+			max_idx = q->id;
 
+		if(q->new)
+		{
 			// Total counter information (delta computation)
-			new_total++;
-			if(query->flags.blocked)
-				new_blocked++;
+			new_queries++;
+			if(q->blocked)
+				blocked++;
 
 			// Update lasttimestamp variable with timestamp of the latest stored query
-			if(query->timestamp > new_last_timestamp)
-				new_last_timestamp = query->timestamp;
+			if(q->timestamp > last_timestamp)
+				last_timestamp = q->timestamp;
+		}
+	}
+
+	// The whole buffer is tried again next time if anything failed
+	if(!okay)
+	{
+		sqlite3_exec(memdb, "ROLLBACK", NULL, NULL, NULL);
+		return false;
+	}
+
+	if((rc = sqlite3_exec(memdb, "END TRANSACTION", NULL, NULL, NULL)) != SQLITE_OK)
+	{
+		log_err("queries_to_database(): Cannot end transaction: %s", sqlite3_errstr(rc));
+		sqlite3_exec(memdb, "ROLLBACK", NULL, NULL, NULL);
+		return false;
+	}
+
+	new_total += new_queries;
+	new_blocked += blocked;
+	new_last_timestamp = last_timestamp;
+	*added += new_queries;
+	*updated += buf->num - new_queries;
+
+	// Wake up threads waiting for new queries (live query streams)
+	pthread_mutex_lock(&stored_lock);
+	last_mem_db_idx = max_idx;
+	if(new_queries > 0)
+		pthread_cond_broadcast(&stored_cond);
+	pthread_mutex_unlock(&stored_lock);
+
+	buf->num = 0;
+	buf->strings_len = 0;
+
+	return true;
+}
+
+// Publish the queue of query copies waiting to be stored
+static void update_export_queue(void)
+{
+	pthread_mutex_lock(&export_lock);
+	export_pending = retry_buffer->num + fill_buffer->num;
+	export_since = retry_buffer->num > 0 ? retry_buffer->since : fill_buffer->since;
+	pthread_mutex_unlock(&export_lock);
+}
+
+/**
+ * Store new and changed queries in the in-memory database. The queries are
+ * copied under a short SHM lock, all database work happens without holding it.
+ * Queries which could not be stored are retried (before newer copies of them)
+ * the next time. Without in-memory database, the copies are kept until
+ * export_queries_to_disk() writes them into the long-term database.
+ *
+ * @return true on success
+ */
+bool queries_to_database(void)
+{
+	// Only try to export to database if it is known to not be broken
+	if(FTLDBerror())
+		return false;
+
+	// Skip, we never store nor count queries recorded while have been in
+	// maximum privacy mode in the database
+	if(config.misc.privacylevel.v.privacy_level >= PRIVACY_MAXIMUM)
+	{
+		log_debug(DEBUG_DATABASE, "Not storing query in database due to privacy level settings");
+		return true;
+	}
+	if(counters->queries == 0)
+	{
+		log_debug(DEBUG_DATABASE, "Not storing query in database as there are none");
+		return true;
+	}
+	if(!store_in_database)
+	{
+		log_debug(DEBUG_DATABASE, "Not storing query in database as this is disabled");
+		return true;
+	}
+
+	const double start = double_time();
+	const unsigned int first = fill_buffer->num;
+	lock_shm();
+	snapshot_changed_queries(fill_buffer);
+	unlock_shm();
 
-			added++;
+	// Stream completed queries before storing them, the sink does not
+	// depend on the database
+	stream_queries(fill_buffer, first);
+	flush_query_sink();
+
+	if(direct_storage)
+	{
+		// Nothing is going to store the copies when the long-term
+		// database is disabled at runtime
+		if(config.database.maxDBdays.v.ui == 0)
+		{
+			fill_buffer->num = 0;
+			fill_buffer->strings_len = 0;
 		}
-		else
-			updated++;
+		update_export_queue();
 
-		// Memorize query as updated in the database
-		query->flags.database.changed = false;
+		// The new queries can be read from shared memory already, wake
+		// up threads waiting for them (live query streams)
+		pthread_mutex_lock(&stored_lock);
+		if(next_mem_db_idx > last_mem_db_idx)
+		{
+			last_mem_db_idx = next_mem_db_idx;
+			pthread_cond_broadcast(&stored_cond);
+		}
+		pthread_mutex_unlock(&stored_lock);
+
+		FTL_PROBE(db_store, 0u, 0u, export_pending,
+		          (uint64_t)((double_time() - start)*1e9));
+		return true;
+	}
+
+	// Queries which failed before are stored first so newer copies of the
+	// same queries overwrite them. If they fail again, the new copies have
+	// to wait as well
+	unsigned int added = 0, updated = 0;
+	bool okay = store_export_buffer(retry_buffer, &added, &updated) &&
+	            store_export_buffer(fill_buffer, &added, &updated);
+	if(retry_buffer->num == 0 && fill_buffer->num > 0)
+	{
+		struct export_buffer *tmp = retry_buffer;
+		retry_buffer = fill_buffer;
+		fill_buffer = tmp;
 	}
 
+	update_export_queue();
+	FTL_PROBE(db_store, added, updated, export_pending,
+	          (uint64_t)((double_time() - start)*1e9));
+
 	// Update number of queries in in-memory database
-	mem_db_num = get_number_of_queries_in_DB(NULL, "query_storage");
+	__atomic_add_fetch(&mem_db_num, added, __ATOMIC_RELAXED);
 
 	if(config.debug.database.v.b && updated + added > 0)
 	{
@@ -1729,7 +2739,111 @@ bool queries_to_database(void)
 		log_in_memory_usage();
 	}
 
-	return true;
+	// Evict queries if the in-memory database grew too large
+	limit_memory_database();
+
+	return okay;
+}
+
+/**
+ * Write the query copies taken by queries_to_database() older than time into
+ * the long-term database. This is used instead of copying them from the
+ * in-memory database when there is none. More recent copies are kept for the
+ * next time. Copies which cannot be written are retried first the next time.
+ *
+ * @param time Upper limit of the timestamps of the queries to be written
+ * @param stored Set to the number of queries added to the database
+ * @return true on success
+ */
+static bool store_direct_queries(const double time, unsigned int *stored)
+{
+	// Queries are copied again whenever they change. All copies of a
+	// query share its timestamp so they are written together and the
+	// last copy replaces the previous ones
+	for(unsigned int i = 0; i < fill_buffer->num; i++)
+	{
+		const struct export_query *q = &fill_buffer->queries[i];
+		struct export_buffer *dst = q->timestamp < time ? retry_buffer : spare_buffer;
+		if(!copy_buffer_query(dst, fill_buffer, q))
+			log_err("Memory error in export_queries_to_disk() when trying to copy a query");
+	}
+	fill_buffer->num = 0;
+	fill_buffer->strings_len = 0;
+
+	struct export_buffer *tmp = fill_buffer;
+	fill_buffer = spare_buffer;
+	spare_buffer = tmp;
+
+	unsigned int updated = 0;
+	const bool okay = store_export_buffer(retry_buffer, stored, &updated);
+	update_export_queue();
+
+	return okay;
+}
+
+/**
+ * Get the number of queries waiting to be stored in the in-memory database (or
+ * the long-term database when there is none)
+ *
+ * @param age Set to the age of the oldest waiting query copy [seconds]
+ * @return Number of waiting queries
+ */
+unsigned int get_export_queue(double *age)
+{
+	pthread_mutex_lock(&export_lock);
+	const unsigned int pending = export_pending;
+	*age = pending > 0 ? double_time() - export_since : 0.0;
+	pthread_mutex_unlock(&export_lock);
+
+	return pending;
+}
+
+// Restore the snapshot saved by save_query_snapshot()
+static bool restore_query_snapshot(void)
+{
+	const char *path = config.files.snapshot.v.s;
+	if(path == NULL || strlen(path) == 0 || FTLDBerror())
+		return false;
+
+	// The snapshot has to match the newest query in the long-term database
+	init_disk_db_idx();
+	const bool restored = load_shmem_snapshot(path, last_disk_db_idx);
+
+	// The snapshot is outdated as soon as new queries arrive
+	if(unlink(path) != 0 && errno != ENOENT)
+		log_warn("Cannot remove shared memory snapshot %s: %s", path, strerror(errno));
+
+	return restored;
+}
+
+/**
+ * Store all changed queries in the long-term database and save a snapshot of
+ * the shared memory objects so the next start does not need to replay them
+ * from the database. Called during shutdown after all threads have terminated
+ */
+void save_query_snapshot(void)
+{
+	const char *path = config.files.snapshot.v.s;
+	if(path == NULL || strlen(path) == 0)
+		return;
+
+	// Only queries in the long-term database can be restored together
+	// with it
+	if(!store_in_database || FTLDBerror() ||
+	   !config.database.DBimport.v.b ||
+	   config.database.maxDBdays.v.ui == 0 ||
+	   config.misc.privacylevel.v.privacy_level >= PRIVACY_MAXIMUM)
+		return;
+
+	double age = 0.0;
+	if(!queries_to_database() || (!direct_storage && get_export_queue(&age) > 0) ||
+	   !export_queries_to_disk(true) || get_export_queue(&age) > 0)
+	{
+		log_warn("Not saving shared memory snapshot as not all queries could be stored in the database");
+		return;
+	}
+
+	save_shmem_snapshot(path, last_disk_db_idx);
 }
 
 static void load_queries_from_disk(void)
@@ -1741,9 +2855,14 @@ static void load_queries_from_disk(void)
 	if(!config.database.DBimport.v.b)
 		return;
 
-	// Try to import queries from long-term database if available
+	// Try to import queries from long-term database if available. The
+	// shared memory objects are restored from the snapshot saved on
+	// shutdown if it is still valid, otherwise all queries are replayed
 	import_queries_from_disk();
-	DB_read_queries();
+	if(restore_query_snapshot())
+		runGC(time(NULL), NULL, false);
+	else
+		DB_read_queries();
 
 	// Log some information about the imported queries (if any)
 	log_counter_info();
@@ -23,20 +23,20 @@
                                                        "client TEXT NOT NULL, " \
                                                        "forward TEXT );"
 
-#define MEMDB_VERSION 21
-#define CREATE_QUERY_STORAGE_TABLE "CREATE TABLE query_storage ( id INTEGER PRIMARY KEY AUTOINCREMENT, " \
-                                                                "timestamp INTEGER NOT NULL, " \
-                                                                "type INTEGER NOT NULL, " \
-                                                                "status INTEGER NOT NULL, " \
-                                                                "domain INTEGER NOT NULL, " \
-                                                                "client INTEGER NOT NULL, " \
-                                                                "forward INTEGER, " \
-                                                                "additional_info INTEGER, " \
-                                                                "reply_type INTEGER, " \
-                                                                "reply_time REAL, " \
-                                                                "dnssec INTEGER, " \
-                                                                "list_id INTEGER, " \
-                                                                "ede INTEGER );"
+#define MEMDB_VERSION 24
+#define QUERY_STORAGE_COLUMNS "timestamp INTEGER NOT NULL, " \
+                              "type INTEGER NOT NULL, " \
+                              "status INTEGER NOT NULL, " \
+                              "domain INTEGER NOT NULL, " \
+                              "client INTEGER NOT NULL, " \
+                              "forward INTEGER, " \
+                              "additional_info INTEGER, " \
+                              "reply_type INTEGER, " \
+                              "reply_time REAL, " \
+                              "dnssec INTEGER, " \
+                              "list_id INTEGER, " \
+                              "ede INTEGER"
+#define CREATE_QUERY_STORAGE_TABLE "CREATE TABLE query_storage ( id INTEGER PRIMARY KEY AUTOINCREMENT, " QUERY_STORAGE_COLUMNS " );"
 
 #define CREATE_QUERIES_VIEW "CREATE VIEW queries AS " \
                                     "SELECT id, timestamp, type, status, " \
@@ -65,6 +65,9 @@
 #define CREATE_QUERY_STORAGE_REPLY_TIME_INDEX		"CREATE INDEX idx_query_storage_reply_time ON query_storage (reply_time);"
 #define CREATE_QUERY_STORAGE_DNSSEC_INDEX		"CREATE INDEX idx_query_storage_dnssec ON query_storage (dnssec);"
 #define CREATE_QUERY_STORAGE_LIST_ID_INDEX		"CREATE INDEX idx_query_storage_list_id ON query_storage (list_id);"
+// Version 22
+#define CREATE_QUERY_STORAGE_CLIENT_TIMESTAMP_INDEX	"CREATE INDEX IF NOT EXISTS idx_query_storage_client_timestamp ON query_storage (client, timestamp);"
+#define CREATE_QUERY_STORAGE_DOMAIN_TIMESTAMP_INDEX	"CREATE INDEX IF NOT EXISTS idx_query_storage_domain_timestamp ON query_storage (domain, timestamp);"
 
 #define CREATE_DOMAINS_BY_ID "CREATE TABLE domain_by_id (id INTEGER PRIMARY KEY, domain TEXT NOT NULL);"
 #define CREATE_CLIENTS_BY_ID "CREATE TABLE client_by_id (id INTEGER PRIMARY KEY, ip TEXT NOT NULL, name TEXT);"
@@ -97,7 +100,9 @@ const char *index_creation[] = {
 	CREATE_QUERY_STORAGE_REPLY_TYPE_INDEX,
 	CREATE_QUERY_STORAGE_REPLY_TIME_INDEX,
 	CREATE_QUERY_STORAGE_DNSSEC_INDEX,
-	CREATE_QUERY_STORAGE_LIST_ID_INDEX
+	CREATE_QUERY_STORAGE_LIST_ID_INDEX,
+	CREATE_QUERY_STORAGE_CLIENT_TIMESTAMP_INDEX,
+	CREATE_QUERY_STORAGE_DOMAIN_TIMESTAMP_INDEX,
 	CREATE_DOMAIN_BY_ID_DOMAIN_INDEX,
 	CREATE_CLIENTS_BY_ID_IPNAME_INDEX,
 	CREATE_FORWARD_BY_ID_FORWARD_INDEX,
@@ -107,8 +112,11 @@ const char *index_creation[] = {
 
 unsigned long get_max_db_idx(void) __attribute__((pure));
 void db_counts(unsigned long *last_idx, unsigned long *mem_num, unsigned long *disk_num);
+void disk_queries_deleted(const int deleted);
+bool wait_for_stored_queries(const unsigned long last_idx, const unsigned int timeout_ms);
 bool init_memory_database(void);
 sqlite3 *get_memdb(void) __attribute__((pure));
+sqlite3 *get_memdb_reader(void);
 void close_memory_database(void);
 bool import_queries_from_disk(void);
 bool attach_database(sqlite3* db, const char **message, const char *path, const char *alias);
@@ -116,10 +124,13 @@ bool detach_database(sqlite3* db, const char **message, const char *alias);
 int get_number_of_queries_in_DB(sqlite3 *db, const char *tablename);
 bool export_queries_to_disk(const bool final);
 bool delete_old_queries_from_db(const bool use_memdb, const double mintime);
+const char *get_memdb_query_source(char *buf, const size_t len);
 bool add_additional_info_column(sqlite3 *db);
 void DB_read_queries(void);
 void init_disk_db_idx(void);
 bool queries_to_database(void);
+unsigned int get_export_queue(double *age);
+void save_query_snapshot(void);
 
 bool optimize_queries_table(sqlite3 *db);
 bool create_addinfo_table(sqlite3 *db);
@@ -128,5 +139,6 @@ bool add_query_storage_column_regex_id(sqlite3 *db);
 bool add_ftl_table_description(sqlite3 *db);
 bool rename_query_storage_column_regex_id(sqlite3 *db);
 bool add_query_storage_column_ede(sqlite3 *db);
+bool create_query_storage_timestamp_indices(sqlite3 *db);
 
 #endif //QUERY_TABLE_PRIVATE_H
@@ -0,0 +1,278 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Database replication
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file replication.c
+* @brief Pushes the long-term database to a standby node.
+*
+* When database.replication.replica is set, the database thread periodically
+* runs the embedded sqlite3_rsync tool in a child process. It compares page
+* hashes with the replica and only transfers pages which changed since the last
+* run over SSH, so replicating a large database takes a fraction of copying it.
+* The database thread only polls the child process and is never blocked by a
+* running replication.
+*/
+
+#include "FTL.h"
+#include "database/replication.h"
+#include "config/config.h"
+#include "log.h"
+// waitpid()
+#include <sys/wait.h>
+// fcntl()
+#include <fcntl.h>
+
+// Output of sqlite3_rsync we keep for logging and parsing its summary
+#define REPLICATION_OUTPUT_SIZE 4096u
+
+static pid_t replication_pid = 0;
+static int replication_fd = -1;
+static double replication_start = 0.0;
+static time_t last_replication = 0;
+static char output[REPLICATION_OUTPUT_SIZE];
+static size_t output_len = 0;
+
+static struct replication_stats stats = { 0 };
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void get_replication_stats(struct replication_stats *out)
+{
+	pthread_mutex_lock(&stats_lock);
+	*out = stats;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static bool start_replication(void)
+{
+	// Create a pipe for reading the output of our child
+	int pipefd[2];
+	if(pipe(pipefd) != 0)
+	{
+		log_err("Cannot create pipe for database replication: %s", strerror(errno));
+		return false;
+	}
+
+	// Prepare everything before forking, the child only calls exec
+	char bwlimit[16];
+	snprintf(bwlimit, sizeof(bwlimit), "%u", config.database.replication.bwlimit.v.ui);
+
+	const pid_t cpid = fork();
+	if(cpid < 0)
+	{
+		log_err("Cannot fork for database replication: %s", strerror(errno));
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return false;
+	}
+
+	if(cpid == 0)
+	{
+		/*** CHILD ***/
+		// Redirect STDOUT and STDERR into our pipe
+		close(pipefd[0]);
+		dup2(pipefd[1], STDOUT_FILENO);
+		dup2(pipefd[1], STDERR_FILENO);
+		close(pipefd[1]);
+
+		// Run the embedded sqlite3_rsync tool (drop-in mode selected by
+		// the program name)
+		execl("/proc/self/exe", "sqlite3_rsync", "-v", "--bwlimit", bwlimit,
+		      config.files.database.v.s, config.database.replication.replica.v.s,
+		      (char*)NULL);
+
+		// Only reached if exec failed
+		_exit(EXIT_FAILURE);
+	}
+
+	/*** PARENT ***/
+	// Close the writing end of the pipe, the reading end is polled
+	close(pipefd[1]);
+	fcntl(pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK);
+
+	replication_pid = cpid;
+	replication_fd = pipefd[0];
+	replication_start = double_time();
+	output_len = 0;
+	output[0] = '\0';
+
+	pthread_mutex_lock(&stats_lock);
+	stats.running = true;
+	pthread_mutex_unlock(&stats_lock);
+
+	log_debug(DEBUG_DATABASE, "Started replication of %s to %s (PID %d)",
+	          config.files.database.v.s, config.database.replication.replica.v.s, cpid);
+
+	return true;
+}
+
+// Read whatever the child wrote since the last call, only the most recent
+// output is kept if it does not fit into the buffer
+static void read_replication_output(void)
+{
+	char buf[512];
+	ssize_t len;
+	while((len = read(replication_fd, buf, sizeof(buf))) > 0)
+	{
+		// Drop the oldest output if the buffer is full (buf is much
+		// smaller than output)
+		if(output_len + len >= sizeof(output))
+		{
+			const size_t drop = output_len + len - (sizeof(output) - 1);
+			memmove(output, output + drop, output_len - drop);
+			output_len -= drop;
+		}
+		memcpy(output + output_len, buf, len);
+		output_len += len;
+		output[output_len] = '\0';
+	}
+}
+
+// Parse a number printed with thousands separators, e.g., "1,234,567"
+static unsigned long long __attribute__((pure)) parse_bytes(const char *str)
+{
+	unsigned long long value = 0;
+	for(; *str != '\0'; str++)
+	{
+		if(*str >= '0' && *str <= '9')
+			value = 10*value + (*str - '0');
+		else if(*str != ',')
+			break;
+	}
+	return value;
+}
+
+static void finish_replication(const int status, const bool status_known)
+{
+	read_replication_output();
+	close(replication_fd);
+	replication_fd = -1;
+	replication_pid = 0;
+
+	// sqlite3_rsync -v summarizes the transfer as
+	// "sent 1,234 bytes, received 5,678 bytes, ..."
+	unsigned long long sent = 0, received = 0;
+	const char *summary = strstr(output, "sent ");
+	if(summary != NULL)
+	{
+		sent = parse_bytes(summary + strlen("sent "));
+		const char *recv = strstr(summary, "received ");
+		if(recv != NULL)
+			received = parse_bytes(recv + strlen("received "));
+	}
+
+	// The exit code is the number of errors. If the child has already
+	// been reaped elsewhere, we have to rely on its output
+	bool success = summary != NULL && strstr(output, "not synced") == NULL;
+	if(status_known)
+		success &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+	const double duration = double_time() - replication_start;
+	pthread_mutex_lock(&stats_lock);
+	stats.running = false;
+	stats.runs++;
+	stats.last_duration = duration;
+	stats.last_sent = sent;
+	stats.total_sent += sent;
+	stats.total_received += received;
+	if(success)
+		stats.last_success = double_time();
+	else
+		stats.failures++;
+	pthread_mutex_unlock(&stats_lock);
+
+	if(success)
+	{
+		log_info("Replicated database to %s in %.1f seconds (sent %llu bytes, received %llu bytes)",
+		         config.database.replication.replica.v.s, duration, sent, received);
+		return;
+	}
+
+	// Log the last line of the output, it usually contains the reason
+	while(output_len > 0 && isspace((unsigned char)output[output_len - 1]))
+		output[--output_len] = '\0';
+	const char *reason = strrchr(output, '\n');
+	reason = reason != NULL ? reason + 1 : output;
+	if(status_known && WIFSIGNALED(status))
+		log_warn("Database replication to %s failed with signal %d",
+		         config.database.replication.replica.v.s, WTERMSIG(status));
+	else
+		log_warn("Database replication to %s failed: %s",
+		         config.database.replication.replica.v.s,
+		         reason[0] != '\0' ? reason : "no output");
+}
+
+/**
+ * @brief Starts a replication when it is due and checks on a running one.
+ * Called by the database thread in every iteration, this never blocks.
+ *
+ * @param now The current time.
+ */
+void replicate_database(const time_t now)
+{
+	// Check if a running replication has finished
+	if(replication_pid > 0)
+	{
+		read_replication_output();
+
+		int status = 0;
+		const pid_t pid = waitpid(replication_pid, &status, WNOHANG);
+		if(pid == replication_pid)
+			finish_replication(status, true);
+		else if(pid < 0 && errno == ECHILD)
+		{
+			// Already reaped by dnsmasq's SIGCHLD handling
+			finish_replication(0, false);
+		}
+		else if(pid < 0 && errno != EINTR)
+		{
+			log_err("Cannot wait for database replication: %s", strerror(errno));
+			finish_replication(0, false);
+		}
+
+		return;
+	}
+
+	// Replication disabled
+	if(config.database.replication.replica.v.s == NULL ||
+	   config.database.replication.replica.v.s[0] == '\0')
+		return;
+
+	if(now - last_replication < (time_t)config.database.replication.interval.v.ui)
+		return;
+	last_replication = now;
+
+	// sqlite3_rsync can only read a database in WAL mode while it is being
+	// written to
+	if(!config.database.useWAL.v.b)
+	{
+		log_warn("Database replication requires database.useWAL to be enabled");
+		return;
+	}
+
+	start_replication();
+}
+
+// Abort a running replication, the replica keeps its previous state
+void stop_database_replication(void)
+{
+	if(replication_pid <= 0)
+		return;
+
+	log_info("Aborting database replication to %s", config.database.replication.replica.v.s);
+	kill(replication_pid, SIGTERM);
+	waitpid(replication_pid, NULL, 0);
+	close(replication_fd);
+	replication_fd = -1;
+	replication_pid = 0;
+
+	pthread_mutex_lock(&stats_lock);
+	stats.running = false;
+	pthread_mutex_unlock(&stats_lock);
+}
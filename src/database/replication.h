@@ -0,0 +1,30 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Database replication prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef DATABASE_REPLICATION_H
+#define DATABASE_REPLICATION_H
+
+struct replication_stats {
+	bool running;
+	unsigned long runs;
+	unsigned long failures;
+	// Timestamp of the last successful run
+	double last_success;
+	// Duration of the last run [s]
+	double last_duration;
+	unsigned long long last_sent;
+	unsigned long long total_sent;
+	unsigned long long total_received;
+};
+
+void replicate_database(const time_t now);
+void stop_database_replication(void);
+void get_replication_stats(struct replication_stats *stats);
+
+#endif //DATABASE_REPLICATION_H
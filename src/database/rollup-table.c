@@ -0,0 +1,172 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Query rollup table routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file rollup-table.c
+* @brief Pre-aggregated query counts for the long-term statistics.
+*
+* The query_rollup table of the on-disk database holds the number of queries
+* per (status, type, client, domain, upstream) for every ten-minute and every
+* day-long period. It is updated in the same transaction which exports queries
+* to disk so it always matches the contents of the query_storage table.
+* Long-term statistics covering whole periods are answered from this table
+* instead of aggregating millions of raw queries.
+*/
+
+#include "FTL.h"
+#include "database/rollup-table.h"
+#include "database/common.h"
+// DBL_MAX
+#include <float.h>
+// floor()
+#include <math.h>
+
+// Aggregate queries with id > ?1 and timestamp < ?2 into both periods (?3 and
+// ?4). Queries without upstream are stored with forward = 0 as NULL would not
+// be considered equal in the primary key
+#define ROLLUP_INSERT(schema) "WITH p(period) AS (VALUES (?3), (?4)) " \
+                              "INSERT INTO " schema "query_rollup (period, timestamp, status, type, client, domain, forward, count) " \
+                              "SELECT p.period, (CAST(q.timestamp AS INTEGER)/p.period)*p.period, q.status, q.type, q.client, q.domain, IFNULL(q.forward, 0), COUNT(*) " \
+                              "FROM query_storage q, p WHERE q.id > ?1 AND q.timestamp < ?2 " \
+                              "GROUP BY 1, 2, 3, 4, 5, 6, 7 " \
+                              "ON CONFLICT (period, timestamp, status, type, client, domain, forward) DO UPDATE SET count = count + excluded.count"
+
+static bool aggregate_queries(sqlite3 *db, const char *querystr, const sqlite3_int64 last_id, const double until)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		log_err("aggregate_queries(): SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	if((rc = sqlite3_bind_int64(stmt, 1, last_id)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_double(stmt, 2, until)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_int(stmt, 3, ROLLUP_PERIOD_SHORT)) != SQLITE_OK ||
+	   (rc = sqlite3_bind_int(stmt, 4, ROLLUP_PERIOD_DAY)) != SQLITE_OK)
+	{
+		log_err("aggregate_queries(): Failed to bind parameters: %s", sqlite3_errstr(rc));
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	const bool okay = (rc = sqlite3_step(stmt)) == SQLITE_DONE;
+	if(!okay)
+		log_err("aggregate_queries(): Failed to aggregate queries: %s", sqlite3_errstr(rc));
+	else
+		log_debug(DEBUG_DATABASE, "Updated %i rows of the query rollup", sqlite3_changes(db));
+
+	sqlite3_finalize(stmt);
+	return okay;
+}
+
+bool create_query_rollup_table(sqlite3 *db)
+{
+	// Start transaction of database update
+	SQL_bool(db, "BEGIN TRANSACTION;");
+
+	// Create rollup table
+	SQL_bool(db, CREATE_QUERY_ROLLUP_TABLE);
+
+	// Aggregate all queries already in the database. This may take a while
+	// on large databases but has to be done only once
+	log_info("Aggregating queries in the long-term database, this may take a while...");
+	if(!aggregate_queries(db, ROLLUP_INSERT(""), 0, DBL_MAX))
+		return false;
+
+	// Update database version to 23
+	if(!db_set_FTL_property(db, DB_VERSION, 23))
+	{
+		log_err("create_query_rollup_table(): Failed to update database version!");
+		return false;
+	}
+
+	// Finish transaction
+	SQL_bool(db, "COMMIT");
+
+	return true;
+}
+
+/**
+ * Add queries about to be exported to the rollup table of the attached on-disk
+ * database. This has to be called from within the export transaction with the
+ * same bounds as used for the export.
+ *
+ * @param memdb The in-memory database with the on-disk database attached
+ * @param last_id Only queries with a larger ID are aggregated
+ * @param until Only queries older than this timestamp are aggregated
+ * @return true on success
+ */
+bool update_query_rollup(sqlite3 *memdb, const sqlite3_int64 last_id, const double until)
+{
+	return aggregate_queries(memdb, ROLLUP_INSERT("disk."), last_id, until);
+}
+
+/**
+ * Delete aggregated counts of old queries
+ *
+ * @param db The on-disk database
+ * @param mintime Delete counts of queries up to this timestamp
+ * @param partial Also delete periods which only partially precede mintime
+ * @return true on success
+ */
+bool delete_query_rollup(sqlite3 *db, const double mintime, const bool partial)
+{
+	if(partial)
+	{
+		SQL_bool(db, "DELETE FROM query_rollup WHERE timestamp <= %f;", mintime);
+	}
+	else
+	{
+		SQL_bool(db, "DELETE FROM query_rollup WHERE timestamp + period <= %f;", mintime);
+	}
+
+	log_debug(DEBUG_DATABASE, "Deleted %i rows of the query rollup", sqlite3_changes(db));
+
+	return true;
+}
+
+/**
+ * Check if a time range can be answered from the rollup table. This is the case
+ * if the range starts at the beginning of a period and ends right before the
+ * beginning of another one, i.e., until is the last second of a period.
+ *
+ * @param from Beginning of the range
+ * @param until End of the range (inclusive). This is replaced by the
+ * (exclusive) end of the last period if the rollup table can be used
+ * @param interval Interval of the requested time series (0 if there is none).
+ * Only periods fitting into this interval are considered
+ * @return The longest usable period or 0 if the raw queries have to be used
+ */
+unsigned int get_rollup_period(const double from, double *until, const unsigned int interval)
+{
+	// The range has to start at a whole second
+	const double end = floor(*until) + 1.0;
+	if(from < 0.0 || end <= from || from > floor(from))
+		return 0u;
+
+	const unsigned long long ifrom = (unsigned long long)from;
+	const unsigned long long iend = (unsigned long long)end;
+	const unsigned int periods[] = { ROLLUP_PERIOD_DAY, ROLLUP_PERIOD_SHORT };
+	for(unsigned int i = 0; i < ArraySize(periods); i++)
+	{
+		if(interval > 0 && interval % periods[i] != 0)
+			continue;
+
+		if(ifrom % periods[i] != 0 || iend % periods[i] != 0)
+			continue;
+
+		*until = end;
+		return periods[i];
+	}
+
+	return 0u;
+}
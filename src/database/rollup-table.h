@@ -0,0 +1,35 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Query rollup table prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef ROLLUP_TABLE_H
+#define ROLLUP_TABLE_H
+
+#include "sqlite3.h"
+
+// Periods (in seconds) the queries are pre-aggregated for. The short period
+// matches the interval of the long-term history graphs
+#define ROLLUP_PERIOD_SHORT 600u
+#define ROLLUP_PERIOD_DAY 86400u
+
+#define CREATE_QUERY_ROLLUP_TABLE "CREATE TABLE query_rollup ( period INTEGER NOT NULL, " \
+                                                              "timestamp INTEGER NOT NULL, " \
+                                                              "status INTEGER NOT NULL, " \
+                                                              "type INTEGER NOT NULL, " \
+                                                              "client INTEGER NOT NULL, " \
+                                                              "domain INTEGER NOT NULL, " \
+                                                              "forward INTEGER NOT NULL, " \
+                                                              "count INTEGER NOT NULL, " \
+                                                              "PRIMARY KEY (period, timestamp, status, type, client, domain, forward) ) WITHOUT ROWID;"
+
+bool create_query_rollup_table(sqlite3 *db);
+bool update_query_rollup(sqlite3 *memdb, const sqlite3_int64 last_id, const double until);
+bool delete_query_rollup(sqlite3 *db, const double mintime, const bool partial);
+unsigned int get_rollup_period(const double from, double *until, const unsigned int interval);
+
+#endif // ROLLUP_TABLE_H
@@ -28,6 +28,8 @@
 
 // isMAC()
 #include "network-table.h"
+// sqlite3_query_archive_init()
+#include "query-archive.h"
 
 static void subnet_match_impl(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
@@ -228,6 +230,10 @@ static int sqlite3_pihole_extensions_init(sqlite3 *db, char **pzErrMsg, const st
 	// Initialize the percentile extension
 	sqlite3_percentile_init(db, pzErrMsg, pApi);
 
+	// Register the virtual table module reading archived queries
+	if(sqlite3_query_archive_init(db) != SQLITE_OK)
+		log_err("Error while initializing the SQLite3 module query_archive");
+
 	return rc;
 }
 
@@ -30,6 +30,7 @@ static const char zUsage[] =
   "\n"
   "OPTIONS:\n"
   "\n"
+  "   --bwlimit KB  Limit the outgoing data rate to KB kilobytes per second\n"
   "   --exe PATH    Name of the sqlite3_rsync program on the remote side\n"
   "   --help        Show this help screen\n"
   "   --ssh PATH    Name of the SSH program used to reach the remote side\n"
@@ -63,6 +64,8 @@ struct SQLiteRsync {
   unsigned int szPage;     /* Database page size */
   unsigned int nHashSent;  /* Hashes sent (replica to origin) */
   unsigned int nPageSent;  /* Page contents sent (origin to replica) */
+  unsigned int nBwLimit;   /* Max. outgoing kilobytes per second, 0 = no limit */
+  sqlite3_int64 tmBwStart; /* Time the first byte was sent */
 };
 
 /* The version number of the protocol.  Sent in the *_BEGIN message
@@ -922,12 +925,33 @@ void readBytes(SQLiteRsync *p, int nByte, void *pData){
   }
 }
 
+sqlite3_int64 currentTime(void);
+
+/* Sleep as long as needed to keep the outgoing data rate within the
+** limit set by --bwlimit.
+*/
+static void throttleOutput(SQLiteRsync *p){
+  sqlite3_int64 tmNeeded, tmElapsed;
+  if( p->nBwLimit==0 ) return;
+  if( p->tmBwStart==0 ){
+    p->tmBwStart = currentTime();
+    return;
+  }
+  tmNeeded = (sqlite3_int64)(p->nOut/p->nBwLimit);
+  tmElapsed = currentTime() - p->tmBwStart;
+  if( tmNeeded>tmElapsed+10 ){
+    fflush(p->pOut);
+    sqlite3_sleep((int)(tmNeeded - tmElapsed));
+  }
+}
+
 /* Write an array of bytes onto the wire.
 */
 void writeBytes(SQLiteRsync *p, int nByte, const void *pData){
   if( p->pLog ) fwrite(pData, 1, nByte, p->pLog);
   if( fwrite(pData, 1, nByte, p->pOut)==nByte ){
     p->nOut += nByte;
+    throttleOutput(p);
   }else{
     logError(p, "failed to write %d bytes\n", nByte);
     p->nWrErr++;
@@ -1674,6 +1698,10 @@ int sqlite3_rsync_main(int argc, char const * const *argv){
       zExe = cli_opt_val;
       continue;
     }
+    if( strcmp(z, "--bwlimit")==0 ){
+      ctx.nBwLimit = (unsigned int)atoi(cli_opt_val);
+      continue;
+    }
     if( strcmp(z, "--logfile")==0 ){
       /* DEBUG OPTION:  --logfile FILENAME
       ** Cause all local output traffic to be duplicated in FILENAME */
@@ -30,44 +30,126 @@
 #include "files.h"
 // lookup_insert
 #include "lookup-table.h"
+// top_lists_domain_changed()
+#include "top-lists.h"
+// client_sketch_reset()
+#include "client-sketch.h"
+// add_domain_suffixes()
+#include "domain-suffixes.h"
+// set_domain_excluded()
+#include "exclude-filter.h"
+
+// Domains and client IPs are processed eight bytes at a time. The words are
+// loaded with memcpy() so the strings do not need to be aligned and no byte
+// beyond the terminating NUL is accessed
+#define HASH_WORD sizeof(uint64_t)
+#define HASH_ONES 0x0101010101010101ULL
+
+// Convert the ASCII upper case letters in a word to lower case, all other bytes
+// (including those of multi-byte UTF-8 characters) are left unchanged
+static inline uint64_t __attribute__ ((const)) lower_word(const uint64_t w)
+{
+	// Clearing the most significant bit of each byte ensures that the
+	// additions below cannot carry into the next byte
+	const uint64_t heptets = w & (0x7F*HASH_ONES);
+	const uint64_t ge_A = heptets + (0x80 - 'A')*HASH_ONES;
+	const uint64_t gt_Z = heptets + (0x80 - 'Z' - 1)*HASH_ONES;
+	const uint64_t upper = ge_A & ~gt_Z & ~w & (0x80*HASH_ONES);
+
+	// 0x80 >> 2 == 0x20 == 'a' - 'A'
+	return w | (upper >> 2);
+}
+
+// Load the last len < 8 bytes of a string into a zero-padded word
+static inline uint64_t load_tail(const char *s, const size_t len)
+{
+	uint64_t w = 0;
+	memcpy(&w, s, len);
+	return w;
+}
+
+// Mix one word into the hash state (multiply-xorshift)
+static inline uint64_t __attribute__ ((const)) hash_word(const uint64_t h, const uint64_t w)
+{
+	const uint64_t x = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+	return x ^ (x >> 29);
+}
+
+// Final avalanche (MurmurHash3's fmix64) folded to 32 bits
+static inline uint32_t __attribute__ ((const)) hash_final(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return (uint32_t)(h ^ (h >> 32));
+}
 
 // converts upper to lower case, and leaves other characters unchanged
 void strtolower(char *str)
 {
-	int i = 0;
-	while(str[i]){ str[i] = tolower(str[i]); i++; }
+	strtolower_hash(str);
+}
+
+/**
+ * @brief Converts a string to lower case and computes its hash in a single
+ * pass.
+ *
+ * The result is identical to calling hashStr() on the lower-cased string. Only
+ * ASCII letters are converted, this matches tolower() in the C locale.
+ *
+ * @param str The string to be converted (in place) and hashed.
+ * @return The computed hash value as a 32-bit unsigned integer.
+ */
+uint32_t strtolower_hash(char *str)
+{
+	const size_t len = strlen(str);
+	uint64_t h = len * 0x9E3779B97F4A7C15ULL;
+	size_t i = 0;
+	for(; i + HASH_WORD <= len; i += HASH_WORD)
+	{
+		uint64_t w;
+		memcpy(&w, str + i, HASH_WORD);
+		w = lower_word(w);
+		memcpy(str + i, &w, HASH_WORD);
+		h = hash_word(h, w);
+	}
+	if(i < len)
+	{
+		const uint64_t w = lower_word(load_tail(str + i, len - i));
+		memcpy(str + i, &w, len - i);
+		h = hash_word(h, w);
+	}
+
+	return hash_final(h);
 }
 
 /**
- * @brief Computes a hash value for a given string using Jenkins' One-at-a-Time
- * hash algorithm.
+ * @brief Computes a hash value for a given string, eight bytes at a time.
  *
  * This function is marked as pure, indicating that it has no side effects and
- * its return value depends only on the input parameters.
+ * its return value depends only on the input parameters. The hash is only
+ * used for the lookup tables in shared memory and is not stored persistently.
  *
  * @param s The input string to be hashed.
  * @return The computed hash value as a 32-bit unsigned integer.
- *
- * @note Jenkins' One-at-a-Time hash is a simple and effective hash function for
- *       strings. More details can be found at:
- *       http://www.burtleburtle.net/bob/hash/doobs.html
  */
-static uint32_t __attribute__ ((pure)) hashStr(const char *s)
+uint32_t __attribute__ ((pure)) hashStr(const char *s)
 {
-	// Jenkins' One-at-a-Time hash
-	// (http://www.burtleburtle.net/bob/hash/doobs.html)
-	uint32_t hash = 0;
-	for(; *s; ++s)
+	const size_t len = strlen(s);
+	uint64_t h = len * 0x9E3779B97F4A7C15ULL;
+	size_t i = 0;
+	for(; i + HASH_WORD <= len; i += HASH_WORD)
 	{
-		hash += *s;
-		hash += hash << 10;
-		hash ^= hash >> 6;
+		uint64_t w;
+		memcpy(&w, s + i, HASH_WORD);
+		h = hash_word(h, w);
 	}
+	if(i < len)
+		h = hash_word(h, load_tail(s + i, len - i));
 
-	hash += hash << 3;
-	hash ^= hash >> 11;
-	hash += hash << 15;
-	return hash;
+	return hash_final(h);
 }
 
 /**
@@ -95,7 +177,7 @@ static uint32_t __attribute__ ((pure)) hashCacheIDs(const unsigned int domainID,
 	// return unique hash values.
 	//
 	// Even if more than 65536 domains or more than 2048 clients are used,
-	// the hash works as our binsearch implementation handles collisions
+	// the hash works as our lookup table implementation handles collisions
 	// gracefully. Furthermore, it is rather unlikely that collisions will
 	// ever really occur in practice even if the numbers above are exceeded
 	// as not every single domain will be queried by every single client for
@@ -112,52 +194,50 @@ static uint32_t __attribute__ ((pure)) hashCacheIDs(const unsigned int domainID,
 
 int findQueryID(const int id)
 {
-	// Loop over all queries - we loop in reverse order (start from the most recent query and
-	// continuously walk older queries while trying to find a match. Ideally, we should always
-	// find the correct query with zero iterations, but it may happen that queries are processed
-	// asynchronously, e.g. for slow upstream relies to a huge amount of requests.
-	// We iterate from the most recent query down to at most MAXITER queries in the past to avoid
-	// iterating through the entire array of queries
-	// MAX(0, a) is used to return 0 in case a is negative (negative array indices are harmful)
-	const unsigned int until = counters->queries > MAXITER ? counters->queries - MAXITER : 0;
-	const unsigned int start = counters->queries > 0 ? counters->queries - 1 : 0;
-
-	// Check UUIDs of queries
-	for(unsigned int i = start; i >= until; i--)
-	{
-		const queriesData *query = getQuery(i, true);
+	// Look up the query in the map of IDs assigned by dnsmasq. Queries
+	// are found no matter how many newer queries have been received in
+	// the meantime, e.g. for slow upstream replies at a high query rate
+	const int queryID = find_query_id(id);
+	if(queryID < 0)
+		return -1;
 
-		// Check if the returned pointer is valid before trying to access it
-		if(query != NULL && query->id == id)
-			return i;
+	// Check if the returned pointer is valid and still refers to this query
+	const queriesData *query = getQuery(queryID, true);
+	if(query == NULL || query->id != id)
+		return -1;
 
-		// If we reached the beginning of the array, we can stop
-		if(i == 0)
-			break;
-	}
+	return queryID;
+}
 
-	// If not found
-	return -1;
+static bool cmp_upstream(const struct lookup_table *entry, const struct lookup_data *lookup_data)
+{
+	// Get upstream pointer
+	const upstreamsData *upstream = getUpstream(entry->id, true);
+
+	// Check if the returned pointer is valid before trying to access it
+	if(upstream == NULL)
+		return false;
+
+	// Compare port and address
+	return upstream->port == lookup_data->port &&
+	       strcmp(getstr(upstream->ippos), lookup_data->string) == 0;
 }
 
 int _findUpstreamID(const char *upstreamString, const in_port_t port, int line, const char *func, const char *file)
 {
-	// Go through already knows upstream servers and see if we used one of those
-	for(unsigned int upstreamID = 0; upstreamID < counters->upstreams; upstreamID++)
-	{
-		// Get upstream pointer
-		const upstreamsData *upstream = _getUpstream(upstreamID, true, line, func, file);
+	// Get upstream hash, the port is mixed in as the same address may be
+	// used with different ports
+	const uint32_t hash = hashStr(upstreamString) ^ ((uint32_t)port * 2654435761u);
 
-		// Check if the returned pointer is valid before trying to access it
-		if(upstream == NULL)
-			continue;
+	// Use lookup table to speed up upstream lookups
+	const struct lookup_data lookup_data = { .string = upstreamString, .port = port };
+	unsigned int upstreamID = 0;
+	if(lookup_find_id(UPSTREAMS_LOOKUP, hash, &lookup_data, &upstreamID, cmp_upstream))
+		return upstreamID;
 
-		if(strcmp(getstr(upstream->ippos), upstreamString) == 0 && upstream->port == port)
-			return upstreamID;
-	}
 	// This upstream server is not known
 	// Store ID
-	const unsigned int upstreamID = counters->upstreams;
+	upstreamID = counters->upstreams;
 	log_debug(DEBUG_GC, "New upstream server: %s:%u (ID %u)", upstreamString, port, upstreamID);
 
 	// Get upstream pointer
@@ -182,7 +262,10 @@ int _findUpstreamID(const char *upstreamString, const in_port_t port, int line,
 	// Initialize response time values
 	upstream->rtime = 0.0;
 	upstream->rtuncertainty = 0.0;
+	upstream->ewma_rtime = 0.0;
+	upstream->ewma_failed = 0.0;
 	upstream->responses = 0u;
+	memset(&upstream->circuit, 0, sizeof(upstream->circuit));
 	// This is a new upstream server
 	set_event(RESOLVE_NEW_HOSTNAMES);
 	upstream->lastQuery = 0.0;
@@ -191,6 +274,9 @@ int _findUpstreamID(const char *upstreamString, const in_port_t port, int line,
 	// Increase counter by one
 	counters->upstreams++;
 
+	// Add upstream to lookup table
+	lookup_insert(UPSTREAMS_LOOKUP, upstreamID, hash);
+
 	return upstreamID;
 }
 
@@ -215,14 +301,13 @@ static bool cmp_domain(const struct lookup_table *entry, const struct lookup_dat
 		return false;
 
 	// Compare domain strings
+	if(domain->suffix != SUFFIX_ROOT)
+		return domain_suffix_equals(domain->suffix, lookup_data->domain);
 	return strcmp(getstr(domain->domainpos), lookup_data->domain) == 0;
 }
 
-int _findDomainID(const char *domainString, const bool count, int line, const char *func, const char *file)
+int _findDomainID(const char *domainString, const uint32_t hash, const bool count, int line, const char *func, const char *file)
 {
-	// Get domain hash
-	const uint32_t hash = hashStr(domainString);
-
 	// Use lookup table to speed up domain lookups
 	const struct lookup_data lookup_data = { .domain = domainString	};
 	unsigned int domainID = 0;
@@ -236,7 +321,11 @@ int _findDomainID(const char *domainString, const bool count, int line, const ch
 			return -1;
 
 		// Add one if count == true (do not add one, e.g., during CNAME inspection)
-		if(count) domain->count++;
+		if(count)
+		{
+			domain->count++;
+			top_lists_domain_changed(domainID, domain);
+		}
 		return domainID;
 	}
 
@@ -266,14 +355,28 @@ int _findDomainID(const char *domainString, const bool count, int line, const ch
 	domain->count = count ? 1 : 0;
 	// Set blocked counter to zero
 	domain->blockedcount = 0;
+	// Set cache counters to zero
+	domain->cachehits = 0;
+	domain->cachemisses = 0;
+	// Not yet referenced by any query
+	domain->refs = 0;
+	// Not yet in any top list
+	domain->toplists = 0;
 	// Store domain name - no need to check for NULL here as it doesn't harm
-	domain->domainpos = addstr(domainString);
+	// Names which cannot be split into labels are always stored as one
+	// string
+	domain->suffix = config.misc.domainSuffixes.v.b ? add_domain_suffixes(domainString) : SUFFIX_ROOT;
+	domain->domainpos = domain->suffix == SUFFIX_ROOT ? addstr(domainString) : 0;
+	// Check if this domain is hidden from the top lists
+	set_domain_excluded(domain);
 	// Store pre-computed hash for faster lookups later on
 	domain->hash = hash;
 	domain->lastQuery = 0.0;
 	// Increase counter by one
 	counters->domains++;
 
+	top_lists_domain_changed(domainID, domain);
+
 	return domainID;
 }
 
@@ -297,18 +400,69 @@ static bool cmp_client(const struct lookup_table *entry, const struct lookup_dat
 	if(client == NULL)
 		return false;
 
+	// Compare binary addresses, the (unused) remainder of the address
+	// union is always zeroed
+	if(lookup_data->client_addr != NULL)
+		return client->addr.family == lookup_data->client_addr->family &&
+		       memcmp(&client->addr.addr, &lookup_data->client_addr->addr, sizeof(client->addr.addr)) == 0;
+
 	// Compare client strings
-	return strcmp(getstr(client->ippos), lookup_data->client) == 0;
+	return client->addr.family == AF_UNSPEC &&
+	       strcmp(getstr(client->ippos), lookup_data->client) == 0;
 }
 
-int _findClientID(const char *clientIP, const bool count, const bool aliasclient,
-                  const double now, int line, const char *func, const char *file)
+/**
+ * @brief Computes the lookup hash of a binary client address.
+ *
+ * Clients identified by an IP address are hashed by their binary address so
+ * queries can be attributed to their client without formatting the address as
+ * text first. Only alias-clients are hashed by their name.
+ *
+ * @param addr The binary address of the client.
+ * @return The computed hash value as a 32-bit unsigned integer.
+ */
+static uint32_t __attribute__ ((pure)) hash_client_addr(const struct client_addr *addr)
+{
+	uint64_t h = addr->family * 0x9E3779B97F4A7C15ULL;
+	if(addr->family == AF_INET)
+		return hash_final(hash_word(h, addr->addr.in.s_addr));
+
+	uint64_t w[2];
+	memcpy(w, addr->addr.in6.s6_addr, sizeof(w));
+	h = hash_word(h, w[0]);
+	h = hash_word(h, w[1]);
+	return hash_final(h);
+}
+
+/**
+ * @brief Parses the text form of a client address into its binary form.
+ *
+ * @param ip The IPv4 or IPv6 address of the client.
+ * @param addr The binary address, family is AF_UNSPEC if ip is not an address
+ * @return true if ip is an IPv4 or IPv6 address, false otherwise.
+ */
+bool parse_client_addr(const char *ip, struct client_addr *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	if(inet_pton(AF_INET, ip, &addr->addr.in) == 1)
+		addr->family = AF_INET;
+	else if(inet_pton(AF_INET6, ip, &addr->addr.in6) == 1)
+		addr->family = AF_INET6;
+
+	return addr->family != AF_UNSPEC;
+}
+
+// Find a client either by its binary address (addr != NULL) or by its text
+// form. The text form is only formatted when a new client is created
+static int find_client(const struct client_addr *addr, const char *clientIP,
+                       const bool count, const bool aliasclient, const double now,
+                       int line, const char *func, const char *file)
 {
 	// Get client hash
-	const uint32_t hash = hashStr(clientIP);
+	const uint32_t hash = addr != NULL ? hash_client_addr(addr) : hashStr(clientIP);
 
-	// Use lookup table to speed up domain lookups
-	const struct lookup_data lookup_data = { .client = clientIP };
+	// Use lookup table to speed up client lookups
+	const struct lookup_data lookup_data = { .client = clientIP, .client_addr = addr };
 	unsigned int clientID = 0;
 	if(lookup_find_id(CLIENTS_LOOKUP, hash, &lookup_data, &clientID, cmp_client))
 	{
@@ -341,21 +495,39 @@ int _findClientID(const char *clientIP, const bool count, const bool aliasclient
 		return -1;
 	}
 
+	char ipstr[INET6_ADDRSTRLEN] = { 0 };
+	if(clientIP == NULL)
+	{
+		inet_ntop(addr->family, &addr->addr, ipstr, sizeof(ipstr));
+		clientIP = ipstr;
+	}
+
 	log_debug(DEBUG_GC, "New client: %s (ID %u)", clientIP, clientID);
 
-	// Insert domain into lookup table
+	// Insert client into lookup table
 	lookup_insert(CLIENTS_LOOKUP, clientID, hash);
 
 	// Set magic byte
 	client->magic = MAGICBYTE;
 	// Set its counter to 1
-	client->count = (count && !aliasclient)? 1 : 0;
+	client->count = 0;
+	set_clientcount(client, (count && !aliasclient)? 1 : 0);
 	// Initialize blocked count to zero
 	client->blockedcount = 0;
+	// Not yet referenced by any query
+	client->refs = 0;
+	// Not yet in any top list
+	client->toplists = 0;
+	// Recycled clients may have left counts behind
+	client_sketch_reset(clientID);
 	// Store client IP - no need to check for NULL here as it doesn't harm
 	client->ippos = addstr(clientIP);
-	// Store pre-computed hash for faster lookups later on
+	// Store pre-computed hash and binary address for faster lookups later on
 	client->hash = hash;
+	if(addr != NULL)
+		client->addr = *addr;
+	else
+		memset(&client->addr, 0, sizeof(client->addr));
 	// Initialize client hostname
 	// Due to the nature of us being the resolver,
 	// the actual resolving of the host name has
@@ -399,7 +571,8 @@ int _findClientID(const char *clientIP, const bool count, const bool aliasclient
 	// Note 2: We don't do this before starting up is done as the gravity
 	//         database may not be available. All clients initialized
 	//         during history reading get their enabled regexs reloaded
-	//         in the initial call to FTL_reload_all_domainlists()
+	//         on their first query after the initial call to
+	//         FTL_reload_all_domainlists()
 	if(!startup && !aliasclient)
 		reload_per_client_regex(client);
 
@@ -407,9 +580,43 @@ int _findClientID(const char *clientIP, const bool count, const bool aliasclient
 	if(!aliasclient)
 		reset_aliasclient(NULL, client);
 
+	// Check if this client is hidden from the top lists
+	set_client_excluded(client);
+
+	top_lists_client_changed(client);
+
 	return clientID;
 }
 
+int _findClientID(const char *clientIP, const bool count, const bool aliasclient,
+                  const double now, int line, const char *func, const char *file)
+{
+	// Clients identified by an IP address are keyed by their binary address
+	struct client_addr addr;
+	if(parse_client_addr(clientIP, &addr))
+		return find_client(&addr, clientIP, count, aliasclient, now, line, func, file);
+
+	return find_client(NULL, clientIP, count, aliasclient, now, line, func, file);
+}
+
+int _findClientIDaddr(const struct client_addr *addr, const bool count, const double now,
+                      int line, const char *func, const char *file)
+{
+	return find_client(addr, NULL, count, false, now, line, func, file);
+}
+
+// Set the number of queries of a client and keep the number of active clients
+// (clients with at least one query in memory) in sync. All modifications of
+// client->count have to go through this function
+void set_clientcount(clientsData *client, const int count)
+{
+	if(client->count <= 0 && count > 0)
+		counters->active_clients++;
+	else if(client->count > 0 && count <= 0)
+		counters->active_clients--;
+	client->count = count;
+}
+
 /**
  * @brief Updates the client count, blocked count, and overtime data for a given
  * client.
@@ -429,8 +636,10 @@ int _findClientID(const char *clientIP, const bool count, const bool aliasclient
 void change_clientcount(clientsData *client, const int total, const int blocked,
                         const int overTimeIdx, const int overTimeMod)
 {
-		client->count += total;
+		set_clientcount(client, client->count + total);
 		client->blockedcount += blocked;
+		if(total != 0 || blocked != 0)
+			top_lists_client_changed(client);
 		if(overTimeIdx > -1 && (unsigned int)overTimeIdx < OVERTIME_SLOTS)
 		{
 			overTime[overTimeIdx].total += overTimeMod;
@@ -449,13 +658,149 @@ void change_clientcount(clientsData *client, const int total, const int blocked,
 		if(client->aliasclient_id > -1)
 		{
 			clientsData *aliasclient = getClient(client->aliasclient_id, true);
-			aliasclient->count += total;
+			set_clientcount(aliasclient, aliasclient->count + total);
 			aliasclient->blockedcount += blocked;
+			if(total != 0 || blocked != 0)
+				top_lists_client_changed(aliasclient);
 			if(overTimeIdx > -1 && (unsigned int)overTimeIdx < OVERTIME_SLOTS)
 				aliasclient->overTime[overTimeIdx] += overTimeMod;
 		}
 }
 
+// Change the reference counter of the given object. References are taken
+// whenever a query or cache record starts pointing to a domain, client or
+// cache record and dropped again when it stops doing so. Objects without any
+// remaining reference can be recycled by the garbage collector without
+// having to scan all queries in memory.
+static void change_refs(unsigned int *refs, const int delta, const char *what, const int id)
+{
+	if(delta < 0 && *refs < (unsigned int)-delta)
+	{
+		log_warn("Reference counter of %s %d would underflow (%u%+d)",
+		         what, id, *refs, delta);
+		*refs = 0;
+		return;
+	}
+	*refs += delta;
+}
+
+static void change_domain_refs(const int domainID, const int delta)
+{
+	if(domainID < 0)
+		return;
+	domainsData *domain = getDomain(domainID, true);
+	if(domain != NULL)
+		change_refs(&domain->refs, delta, "domain", domainID);
+}
+
+static void change_client_refs(const int clientID, const int delta)
+{
+	if(clientID < 0)
+		return;
+	clientsData *client = getClient(clientID, true);
+	if(client != NULL)
+		change_refs(&client->refs, delta, "client", clientID);
+}
+
+static void change_cache_refs(const int cacheID, const int delta)
+{
+	if(cacheID < 0)
+		return;
+	DNSCacheData *cache = getDNSCache(cacheID, true);
+	if(cache != NULL)
+		change_refs(&cache->refs, delta, "cache record", cacheID);
+}
+
+/**
+ * @brief Take references on all objects the given query points to. This has
+ * to be called once when the query has been fully initialized. Later changes
+ * of the CNAME domain have to go through set_query_CNAME().
+ *
+ * @param query The query whose domain, client, CNAME domain and cache record
+ * are referenced.
+ */
+void ref_query(const queriesData *query)
+{
+	change_domain_refs(query->domainID, +1);
+	change_client_refs(query->clientID, +1);
+	change_domain_refs(query->CNAME_domainID, +1);
+	change_cache_refs(query->cacheID, +1);
+}
+
+/**
+ * @brief Drop all references the given query holds. This is called when the
+ * query is removed from memory.
+ *
+ * @param query The query whose references are dropped.
+ */
+void unref_query(const queriesData *query)
+{
+	change_domain_refs(query->domainID, -1);
+	change_client_refs(query->clientID, -1);
+	change_domain_refs(query->CNAME_domainID, -1);
+	change_cache_refs(query->cacheID, -1);
+}
+
+/**
+ * @brief Take or drop the references of a record of the cold tier on its
+ * domain and client.
+ *
+ * @param cold The record of the cold tier.
+ * @param delta +1 when the record is created, -1 when it is expired.
+ */
+void ref_cold_query(const struct cold_query *cold, const int delta)
+{
+	change_domain_refs(cold->domainID, delta);
+	change_client_refs(cold->clientID, delta);
+}
+
+/**
+ * @brief Set the domain that caused blocking of the query during CNAME
+ * inspection, moving the reference from the previous CNAME domain (if any).
+ *
+ * @param query The query to be updated.
+ * @param domainID The ID of the CNAME domain, -1 to clear it.
+ */
+void set_query_CNAME(queriesData *query, const int domainID)
+{
+	if(query->CNAME_domainID == domainID)
+		return;
+	change_domain_refs(domainID, +1);
+	change_domain_refs(query->CNAME_domainID, -1);
+	query->CNAME_domainID = domainID;
+}
+
+/**
+ * @brief Set the domain that caused blocking of this cache record during CNAME
+ * inspection, moving the reference from the previous CNAME domain (if any).
+ *
+ * @param cache The cache record to be updated.
+ * @param domainID The ID of the CNAME domain.
+ */
+void set_cache_CNAME(DNSCacheData *cache, const unsigned int domainID)
+{
+	if(cache->flags.cname_ref && cache->CNAME_domainID == domainID)
+		return;
+	change_domain_refs(domainID, +1);
+	unref_cache_CNAME(cache);
+	cache->CNAME_domainID = domainID;
+	cache->flags.cname_ref = true;
+}
+
+/**
+ * @brief Drop the reference a cache record holds on its CNAME domain (if any).
+ * This is called before the cache record is recycled.
+ *
+ * @param cache The cache record to be updated.
+ */
+void unref_cache_CNAME(DNSCacheData *cache)
+{
+	if(!cache->flags.cname_ref)
+		return;
+	change_domain_refs(cache->CNAME_domainID, -1);
+	cache->flags.cname_ref = false;
+}
+
 static int get_next_free_cacheID(void)
 {
 	// First, try to obtain a previously recycled cache ID
@@ -534,6 +879,9 @@ int _findCacheID(const unsigned int domainID, const unsigned int clientID, const
 	dns_cache->query_type = query_type;
 	dns_cache->force_reply = 0u;
 	dns_cache->list_id = -1; // -1 = not set
+	dns_cache->generation = get_gravity_generation();
+	dns_cache->refs = 0;
+	dns_cache->flags.cname_ref = false;
 
 	// Increase counter by one
 	counters->dns_cache_size++;
@@ -541,6 +889,29 @@ int _findCacheID(const unsigned int domainID, const unsigned int clientID, const
 	return cacheID;
 }
 
+// Get the key identifying a client in the DNS cache. Blocking decisions depend
+// only on the groups of a client (exact lists, gravity and the enabled regex
+// filters are all group-based). Hence, clients with identical group
+// memberships share one cache record per (domain, query type). Until the
+// groups of a client are known, it gets records of its own
+unsigned int __attribute__((pure)) cache_client_key(const clientsData *client)
+{
+	if(!client->flags.found_group || client->groupspos >= CACHE_SHARED_KEY)
+		return client->id;
+
+	return CACHE_SHARED_KEY | (unsigned int)client->groupspos;
+}
+
+// Change the client key of a DNS cache record, e.g., when the groups string a
+// shared key is derived from has been moved by compact_strings()
+void rekey_dns_cache(DNSCacheData *cache, const unsigned int cacheID, const unsigned int clientID)
+{
+	lookup_remove(DNS_CACHE_LOOKUP, cacheID, cache->hash);
+	cache->clientID = clientID;
+	cache->hash = hashCacheIDs(cache->domainID, clientID, cache->query_type);
+	lookup_insert(DNS_CACHE_LOOKUP, cacheID, cache->hash);
+}
+
 bool isValidIPv4(const char *addr)
 {
 	struct sockaddr_in sa;
@@ -553,8 +924,174 @@ bool isValidIPv6(const char *addr)
 	return inet_pton(AF_INET6, addr, &(sa.sin6_addr)) != 0;
 }
 
+// Timestamps of queries are stored as millisecond offsets from
+// counters->query_base.timestamp. The base lags this far behind the first
+// timestamp stored after a rebase so older queries (e.g. imported from the
+// database) still fit. A 32-bit offset covers more than 49 days which is
+// much longer than queries are kept in memory (MAXLOGAGE)
+#define QUERY_TIMESTAMP_LOOKBEHIND (2*MAXLOGAGE*3600)
+
+// Move the timestamp base of all queries in memory. This is only necessary
+// every couple of weeks (or when the system time jumps) so we can afford
+// looping over all queries
+static void rebase_query_timestamps(const time_t base)
+{
+	const int64_t shift = ((int64_t)counters->query_base.timestamp - base) * 1000;
+	for(unsigned int queryID = 0; queryID < counters->queries; queryID++)
+	{
+		queriesData *query = getQuery(queryID, false);
+		if(query == NULL)
+			continue;
+
+		// Timestamps which cannot be represented any longer are clamped,
+		// they can only stem from time jumps and will be removed by the
+		// garbage collection anyway
+		const int64_t ms = shift + query->timestamp;
+		query->timestamp = ms < 0 ? 0 : ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ms;
+	}
+
+	log_debug(DEBUG_SHMEM, "Moved timestamp base of %u queries from %lld to %lld",
+	          counters->queries, (long long)counters->query_base.timestamp, (long long)base);
+
+	counters->query_base.timestamp = base;
+	rebuild_query_columns();
+}
+
+double get_query_timestamp(const queriesData *query)
+{
+	return (double)counters->query_base.timestamp + 1e-3*query->timestamp;
+}
+
+void set_query_timestamp(queriesData *query, const double timestamp)
+{
+	int64_t ms = (int64_t)((timestamp - (double)counters->query_base.timestamp)*1e3);
+	if(counters->query_base.timestamp == 0 || ms < 0 || ms > UINT32_MAX)
+	{
+		// Timestamp is out of range, move the base
+		rebase_query_timestamps((time_t)timestamp - QUERY_TIMESTAMP_LOOKBEHIND);
+		ms = (int64_t)((timestamp - (double)counters->query_base.timestamp)*1e3);
+	}
+
+	query->timestamp = (uint32_t)ms;
+	update_query_columns(query);
+}
+
+// Wrapping microsecond clock used to measure response times with full
+// resolution although the query timestamp itself has only milliseconds
+static inline uint32_t __attribute__ ((const)) response_clock(const double now)
+{
+	return (uint32_t)(uint64_t)(now*1e6);
+}
+
+// Response time in seconds, zero if it has not been calculated yet
+double get_query_response(const queriesData *query)
+{
+	return query->flags.response_calculated ? 1e-6*query->response : 0.0;
+}
+
+// Set response time (in seconds), this is used when importing queries
+void set_query_response(queriesData *query, const double response)
+{
+	const double us = response*1e6;
+	query->response = us < 0.0 ? 0u : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+// Start measuring the response time of a query
+void start_query_response(queriesData *query, const double now)
+{
+	query->response = response_clock(now);
+	query->flags.response_calculated = false;
+}
+
+// Compute cache/upstream response time
+void finish_query_response(queriesData *query, const double now)
+{
+	// Do this only if this is the first time we set a reply
+	if(query->flags.response_calculated)
+		return;
+
+	// Convert absolute timestamp to relative timestamp, unsigned arithmetic
+	// takes care of the wrapping of the clock
+	query->response = response_clock(now) - query->response;
+	query->flags.response_calculated = true;
+}
+
+// Database IDs are stored relative to counters->query_base.db with 0 meaning
+// that the query has not been stored in the database yet
+int64_t get_query_dbid(const queriesData *query)
+{
+	if(query->db == 0)
+		return -1;
+
+	return counters->query_base.db + query->db;
+}
+
+void set_query_dbid(queriesData *query, const int64_t id)
+{
+	if(id < 0)
+	{
+		query->db = 0;
+		return;
+	}
+
+	if(id - counters->query_base.db < 1 || id - counters->query_base.db > UINT32_MAX)
+	{
+		// The ID is out of range, move the base directly below the
+		// smallest database ID currently in memory. This is always
+		// possible as there are much less than 2^32 queries kept in
+		// memory
+		int64_t min_id = id;
+		for(unsigned int queryID = 0; queryID < counters->queries; queryID++)
+		{
+			const queriesData *q = getQuery(queryID, false);
+			const int64_t qid = q != NULL ? get_query_dbid(q) : -1;
+			if(qid > -1 && qid < min_id)
+				min_id = qid;
+		}
+
+		const int64_t base = min_id - 1;
+		for(unsigned int queryID = 0; queryID < counters->queries; queryID++)
+		{
+			queriesData *q = getQuery(queryID, false);
+			if(q != NULL && q->db != 0)
+				q->db = (uint32_t)(counters->query_base.db + q->db - base);
+		}
+
+		log_debug(DEBUG_SHMEM, "Moved database ID base of %u queries from %lld to %lld",
+		          counters->queries, (long long)counters->query_base.db, (long long)base);
+
+		counters->query_base.db = base;
+
+		if(id - base > UINT32_MAX)
+		{
+			log_err("Database ID %lld of query %d cannot be stored", (long long)id, query->id);
+			query->db = 0;
+			return;
+		}
+	}
+
+	query->db = (uint32_t)(id - counters->query_base.db);
+}
+
 // Privacy-level sensitive subroutine that returns the domain name
 // only when appropriate for the requested query
+// Get the name of a domain. Names stored as label suffixes are reconstructed
+// into one of a few per-thread buffers, the returned string remains valid until
+// the function has been called DOMAIN_NAME_BUFFERS more times by this thread
+#define DOMAIN_NAME_BUFFERS 8u
+const char *getDomainName(const domainsData *domain)
+{
+	if(domain->suffix == SUFFIX_ROOT)
+		return getstr(domain->domainpos);
+
+	static __thread char buffers[DOMAIN_NAME_BUFFERS][DOMAIN_NAME_MAX];
+	static __thread unsigned int next = 0;
+	char *buffer = buffers[next];
+	next = (next + 1) % DOMAIN_NAME_BUFFERS;
+
+	return domain_suffix_name(domain_suffixes, counters->suffixes, NULL, 0, domain->suffix, buffer);
+}
+
 const char *getDomainString(const queriesData *query)
 {
 	// Check if the returned pointer is valid before trying to access it
@@ -571,7 +1108,7 @@ const char *getDomainString(const queriesData *query)
 			return "";
 
 		// Return string
-		return getstr(domain->domainpos);
+		return getDomainName(domain);
 	}
 	else
 		return HIDDEN_DOMAIN;
@@ -595,7 +1132,7 @@ const char *getCNAMEDomainString(const queriesData *query)
 			return "";
 
 		// Return string
-		return getstr(domain->domainpos);
+		return getDomainName(domain);
 	}
 	else
 		return HIDDEN_DOMAIN;
@@ -649,32 +1186,72 @@ const char *getClientNameString(const queriesData *query)
 		return HIDDEN_CLIENT;
 }
 
-void FTL_reset_per_client_domain_data(void)
-{
-	log_debug(DEBUG_DATABASE, "Resetting per-client DNS cache, size is %u", counters->dns_cache_size);
+// Exact domains added to, changed in, or removed from the domainlist since the
+// lists have been reloaded last. Only the DNS cache records of these domains
+// are re-validated by FTL_reload_changed_domains(), too many changes at once
+// fall back to a full reload
+#define CHANGED_DOMAINS_MAX 64u
+struct changed_domains {
+	bool overflow;
+	unsigned int count;
+	char domain[CHANGED_DOMAINS_MAX][256];
+};
+static struct changed_domains changed_domains = { 0 };
+static pthread_mutex_t changed_domains_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	for(unsigned int cacheID = 0; cacheID < counters->dns_cache_size; cacheID++)
+/**
+ * Remember an exact domain whose domainlist entry has been changed. The caller
+ * is expected to set the RELOAD_DOMAINLIST event afterwards
+ *
+ * @param domain The domain of the changed entry
+ */
+void domainlist_changed(const char *domain)
+{
+	pthread_mutex_lock(&changed_domains_lock);
+	const size_t len = strlen(domain);
+	if(changed_domains.count < CHANGED_DOMAINS_MAX && len < sizeof(changed_domains.domain[0]))
 	{
-		// Get cache pointer
-		DNSCacheData *dns_cache = getDNSCache(cacheID, true);
-
-		// Check if the returned pointer is valid before trying to access it
-		if(dns_cache == NULL)
-			continue;
-
-		// Reset blocking status
-		dns_cache->blocking_status = QUERY_UNKNOWN;
-		// Reset expiry
-		dns_cache->expires = 0;
-		// Reset domainlist ID
-		dns_cache->list_id = -1;
+		// Domains are stored in lowercase in FTL's memory
+		char *dst = changed_domains.domain[changed_domains.count++];
+		for(size_t i = 0; i <= len; i++)
+			dst[i] = tolower(domain[i]);
 	}
+	else
+		changed_domains.overflow = true;
+	pthread_mutex_unlock(&changed_domains_lock);
+}
+
+// Take the domains changed so far, changes recorded from now on are handled by
+// the next reload
+static void take_changed_domains(struct changed_domains *domains)
+{
+	pthread_mutex_lock(&changed_domains_lock);
+	if(domains != NULL)
+		memcpy(domains, &changed_domains, sizeof(*domains));
+	memset(&changed_domains, 0, sizeof(changed_domains));
+	pthread_mutex_unlock(&changed_domains_lock);
 }
 
 // Reloads all domainlists and performs a few extra tasks such as cleaning the
 // message table
 // May only be called from the database thread
 void FTL_reload_all_domainlists(void)
+{
+	// The full reload covers all domains changed so far
+	take_changed_domains(NULL);
+
+	// Compile the new lookup structures before acquiring the lock as this
+	// may take a while for large lists. The current ones keep serving DNS
+	// queries until they are swapped in gravityDB_reopen()
+	gravityDB_compile_next(true);
+
+	FTL_publish_domainlists();
+}
+
+// Publish the lookup structures compiled by gravityDB_compile_next(true) and
+// reload everything else depending on the domainlists
+// May only be called from the database thread (or before it is started)
+void FTL_publish_domainlists(void)
 {
 	lock_shm();
 
@@ -701,9 +1278,88 @@ void FTL_reload_all_domainlists(void)
 	// Check for restored gravity database
 	check_restored_gravity();
 
-	// Reset FTL's internal DNS cache storing whether a specific domain
-	// has already been validated for a specific user
-	FTL_reset_per_client_domain_data();
+	// FTL's internal DNS cache storing whether a specific domain has
+	// already been validated for a specific client (or group set) needs
+	// no reset here: gravityDB_reopen() incremented the gravity
+	// generation, so all existing records are re-validated on their next
+	// use
+
+	unlock_shm();
+}
+
+// Check if a DNS cache record depends on one of the given domains, either
+// directly or through the CNAME target it has been blocked for
+static bool __attribute__((pure)) cache_uses_domain(const DNSCacheData *dns_cache, const unsigned int *domainIDs,
+                                                    const unsigned int num)
+{
+	for(unsigned int i = 0; i < num; i++)
+		if(dns_cache->domainID == domainIDs[i] ||
+		   (dns_cache->flags.cname_ref && dns_cache->CNAME_domainID == domainIDs[i]))
+			return true;
+
+	return false;
+}
+
+// Reloads the domainlists after only exact domains have been changed (see
+// domainlist_changed()). Unlike FTL_reload_all_domainlists(), gravity and the
+// regex filters are not touched, and only the DNS cache records of the changed
+// domains are re-validated
+// May only be called from the database thread
+void FTL_reload_changed_domains(void)
+{
+	static struct changed_domains domains = { 0 };
+	take_changed_domains(&domains);
+	if(domains.overflow)
+	{
+		log_debug(DEBUG_DATABASE, "Too many changed domains, reloading all domainlists");
+		FTL_reload_all_domainlists();
+		return;
+	}
+
+	// The exact domainlists are part of the compiled index, so it has to
+	// be recompiled. The gravity prefilter is kept
+	gravityDB_compile_next(false);
+
+	lock_shm();
+
+	// (Re-)open gravity database connection. This starts a new gravity
+	// generation invalidating all records in FTL's DNS cache
+	const unsigned int previous = get_gravity_generation();
+	gravityDB_reopen();
+	const unsigned int current = get_gravity_generation();
+
+	counters->database.domains.allowed.exact = gravityDB_count(EXACT_WHITELIST_TABLE);
+	counters->database.domains.denied.exact = gravityDB_count(EXACT_BLACKLIST_TABLE);
+
+	// Get the IDs of the changed domains. Domains which have never been
+	// queried have no cache records
+	unsigned int domainIDs[CHANGED_DOMAINS_MAX];
+	unsigned int num = 0u;
+	for(unsigned int i = 0; i < domains.count; i++)
+	{
+		const struct lookup_data lookup_data = { .domain = domains.domain[i] };
+		if(lookup_find_id(DOMAINS_LOOKUP, hashStr(domains.domain[i]), &lookup_data,
+		                  &domainIDs[num], cmp_domain))
+			num++;
+	}
+
+	// Carry all records which were valid before over into the new generation
+	// except the ones of the changed domains
+	unsigned int revalidate = 0u;
+	for(unsigned int cacheID = 0; cacheID < counters->dns_cache_size; cacheID++)
+	{
+		DNSCacheData *dns_cache = getDNSCache(cacheID, true);
+		if(dns_cache == NULL || dns_cache->generation != previous)
+			continue;
+
+		if(cache_uses_domain(dns_cache, domainIDs, num))
+			revalidate++;
+		else
+			dns_cache->generation = current;
+	}
+
+	log_debug(DEBUG_DATABASE, "Reloaded %u changed domain%s, re-validating %u DNS cache record%s",
+	          domains.count, domains.count == 1 ? "" : "s", revalidate, revalidate == 1 ? "" : "s");
 
 	unlock_shm();
 }
@@ -842,6 +1498,8 @@ const char * __attribute__ ((const)) get_query_reply_str(const enum reply_type r
 			return "NONE";
 		case REPLY_BLOB:
 			return "BLOB";
+		case REPLY_SYNTHESIZED:
+			return "SYNTHESIZED";
 		case QUERY_REPLY_MAX:
 		default:
 			return "N/A";
@@ -1055,26 +1713,106 @@ const char * __attribute__ ((pure)) get_permitted_statuslist(void)
 	return permitted_list;
 }
 
-unsigned int __attribute__ ((pure)) get_blocked_count(void)
+// The following counters are maintained by query_set_status() and
+// set_clientcount() and can be read without locking the shared memory
+// Queries in memory, including the ones moved into the cold tier
+unsigned int __attribute__ ((pure)) get_total_queries(void)
 {
-	int blocked = 0;
-	for(enum query_status status = 0; status < QUERY_STATUS_MAX; status++)
-		if(is_blocked(status))
-			blocked += counters->status[status];
+	return __atomic_load_n(&counters->queries, __ATOMIC_RELAXED) +
+	       __atomic_load_n(&counters->queries_cold, __ATOMIC_RELAXED);
+}
 
-	return blocked;
+// Shard of the query counters this process adds to
+static unsigned int counter_shard = 0;
+
+// Called by workers when they are created, see COUNTER_SHARDS
+void set_counter_shard(const unsigned int shard)
+{
+	counter_shard = shard < COUNTER_SHARDS ? shard : COUNTER_SHARD_TCP;
+}
+
+// Sum up a counter over all shards, the offset of the counter is the same in
+// every shard
+static unsigned int __attribute__ ((pure)) sum_shards(const unsigned int *counter)
+{
+	const size_t idx = counter - (const unsigned int*)&counters->shards[0];
+	unsigned int sum = 0;
+	for(unsigned int i = 0; i < COUNTER_SHARDS; i++)
+		sum += __atomic_load_n((const unsigned int*)&counters->shards[i] + idx, __ATOMIC_RELAXED);
+	return sum;
+}
+
+static void add_shard(unsigned int *counter, const int mod)
+{
+	__atomic_fetch_add(counter, (unsigned int)mod, __ATOMIC_RELAXED);
+}
+
+unsigned int __attribute__ ((pure)) get_blocked_count(void)
+{
+	return sum_shards(&counters->shards[0].blocked);
 }
 
 unsigned int __attribute__ ((pure)) get_forwarded_count(void)
 {
-	return counters->status[QUERY_FORWARDED] +
-	       counters->status[QUERY_RETRIED] +
-	       counters->status[QUERY_RETRIED_DNSSEC];
+	return sum_shards(&counters->shards[0].forwarded);
 }
 
 unsigned int __attribute__ ((pure)) get_cached_count(void)
 {
-	return counters->status[QUERY_CACHE] + counters->status[QUERY_CACHE_STALE];
+	return sum_shards(&counters->shards[0].cached);
+}
+
+unsigned int __attribute__ ((pure)) get_status_count(const enum query_status status)
+{
+	return status < QUERY_STATUS_MAX ? sum_shards(&counters->shards[0].status[status]) : 0u;
+}
+
+unsigned int __attribute__ ((pure)) get_querytype_count(const enum query_type type)
+{
+	return type < TYPE_MAX ? sum_shards(&counters->shards[0].querytype[type]) : 0u;
+}
+
+unsigned int __attribute__ ((pure)) get_reply_count(const enum reply_type reply)
+{
+	return reply < QUERY_REPLY_MAX ? sum_shards(&counters->shards[0].reply[reply]) : 0u;
+}
+
+// Add mod to the number of queries of the given type or reply. This does not
+// need the SHM lock
+void change_querytype_count(const enum query_type type, const int mod)
+{
+	if(type < TYPE_MAX)
+		add_shard(&counters->shards[counter_shard].querytype[type], mod);
+}
+
+void change_reply_count(const enum reply_type reply, const int mod)
+{
+	if(reply < QUERY_REPLY_MAX)
+		add_shard(&counters->shards[counter_shard].reply[reply], mod);
+}
+
+unsigned int __attribute__ ((pure)) get_active_clients(void)
+{
+	return __atomic_load_n(&counters->active_clients, __ATOMIC_RELAXED);
+}
+
+// Add mod to the number of queries with the given status and to the aggregated
+// counter (if any) the status belongs to. This does not need the SHM lock
+void change_status_count(const enum query_status status, const int mod)
+{
+	if(status >= QUERY_STATUS_MAX)
+		return;
+
+	struct counter_shard *shard = &counters->shards[counter_shard];
+	add_shard(&shard->status[status], mod);
+	if(is_blocked(status))
+		add_shard(&shard->blocked, mod);
+	else if(status == QUERY_FORWARDED ||
+	        status == QUERY_RETRIED ||
+	        status == QUERY_RETRIED_DNSSEC)
+		add_shard(&shard->forwarded, mod);
+	else if(status == QUERY_CACHE || status == QUERY_CACHE_STALE)
+		add_shard(&shard->cached, mod);
 }
 
 bool __attribute__ ((const)) is_cached(const enum query_status status)
@@ -1203,7 +1941,10 @@ void _query_set_status(queriesData *query, const enum query_status new_status, c
 	   new_status != QUERY_RETRIED &&
 	   new_status != QUERY_RETRIED_DNSSEC)
 	{
-		const unsigned int cacheID = query->cacheID > 0 ? query->cacheID : findCacheID(query->domainID, query->clientID, query->type, true);
+		// Use the same (possibly shared) record as the query itself
+		const clientsData *client = query->cacheID > 0 ? NULL : getClient(query->clientID, true);
+		const unsigned int cache_key = client != NULL ? cache_client_key(client) : (unsigned int)query->clientID;
+		const unsigned int cacheID = query->cacheID > 0 ? query->cacheID : findCacheID(query->domainID, cache_key, query->type, true);
 		DNSCacheData *dns_cache = getDNSCache(cacheID, true);
 		if(dns_cache != NULL && dns_cache->blocking_status != new_status)
 		{
@@ -1250,14 +1991,14 @@ void _query_set_status(queriesData *query, const enum query_status new_status, c
 	// else: update global counters, ...
 	if(!init)
 	{
-		counters->status[old_status]--;
-		log_debug(DEBUG_STATUS, "status %d removed (!init), ID = %d, new count = %u", QUERY_UNKNOWN, query->id, counters->status[QUERY_UNKNOWN]);
+		change_status_count(old_status, -1);
+		log_debug(DEBUG_STATUS, "status %d removed (!init), ID = %d, new count = %u", QUERY_UNKNOWN, query->id, get_status_count(QUERY_UNKNOWN));
 	}
-	counters->status[new_status]++;
-	log_debug(DEBUG_STATUS, "status %d set, ID = %d, new count = %u", new_status, query->id, counters->status[new_status]);
+	change_status_count(new_status, 1);
+	log_debug(DEBUG_STATUS, "status %d set, ID = %d, new count = %u", new_status, query->id, get_status_count(new_status));
 
 	// ... update overTime counters, ...
-	const int timeidx = getOverTimeID(query->timestamp);
+	const int timeidx = getOverTimeID(get_query_timestamp(query));
 	if(is_blocked(old_status) && !init)
 	{
 		overTime[timeidx].blocked--;
@@ -1297,8 +2038,30 @@ void _query_set_status(queriesData *query, const enum query_status new_status, c
 		          timeidx, overTime[timeidx].forwarded, get_query_status_str(new_status), query->id);
 	}
 
+	// ... update the finer overTime tiers, ...
+	const bool old_cached = !init && (old_status == QUERY_CACHE || old_status == QUERY_CACHE_STALE);
+	const bool new_cached = new_status == QUERY_CACHE || new_status == QUERY_CACHE_STALE;
+	change_overTime_tiers(get_query_timestamp(query), 0,
+	                      (is_blocked(new_status) ? 1 : 0) - (!init && is_blocked(old_status) ? 1 : 0),
+	                      (new_cached ? 1 : 0) - (old_cached ? 1 : 0),
+	                      (new_status == QUERY_FORWARDED ? 1 : 0) - (!init && old_status == QUERY_FORWARDED ? 1 : 0));
+
+	// ... update the cache hit and miss counters of the domain, ...
+	const bool old_forwarded = !init && old_status == QUERY_FORWARDED;
+	const bool new_forwarded = new_status == QUERY_FORWARDED;
+	if(old_cached != new_cached || old_forwarded != new_forwarded)
+	{
+		domainsData *domain = getDomain(query->domainID, true);
+		if(domain != NULL)
+		{
+			domain->cachehits += (new_cached ? 1 : 0) - (old_cached ? 1 : 0);
+			domain->cachemisses += (new_forwarded ? 1 : 0) - (old_forwarded ? 1 : 0);
+		}
+	}
+
 	// ... and set new status
 	query->status = new_status;
+	update_query_columns(query);
 }
 
 const char * __attribute__ ((const)) get_ptr_type_str(const enum ptr_type piholePTR)
@@ -19,24 +19,22 @@
 // Definitions like OVERTIME_SLOT
 #include "FTL.h"
 
+// struct rate_bucket
+#include "ratelimit.h"
+// struct upstream_circuit
+#include "upstream-health.h"
+
 typedef struct {
 	unsigned char magic;
-	enum query_status status;
-	enum query_type type;
-	enum privacy_level privacylevel;
-	enum reply_type reply;
-	enum dnssec_status dnssec;
+	// The enums are stored in eight bits each which is plenty for all of
+	// their values. This keeps the type checking of the enums while
+	// saving 16 bytes per query (there may be millions of them)
+	enum query_status status :8;
+	enum query_type type :8;
+	enum privacy_level privacylevel :8;
+	enum reply_type reply :8;
+	enum dnssec_status dnssec :8;
 	uint16_t qtype;
-	unsigned int domainID;
-	unsigned int clientID;
-	int upstreamID; // -1 if not forwarded
-	int cacheID;
-	int id; // the ID is a (signed) int in dnsmasq, so no need for a long int here
-	int CNAME_domainID; // only valid if query has a CNAME blocking status, -1 otherwise
-	int ede;
-	double response;
-	double timestamp;
-	int64_t db;
 	// Adjacent bit field members in the struct flags may be packed to share
 	// and straddle the individual bytes. It is useful to pack the memory as
 	// tightly as possible as there may be dozens of thousands of these
@@ -51,10 +49,44 @@ typedef struct {
 		struct database_flags {
 			bool changed :1;
 			bool stored :1;
+			bool streamed :1;
 		} database;
 	} flags;
+	int16_t ede;
+	unsigned int domainID;
+	unsigned int clientID;
+	int upstreamID; // -1 if not forwarded
+	int cacheID;
+	int id; // the ID is a (signed) int in dnsmasq, so no need for a long int here
+	int CNAME_domainID; // only valid if query has a CNAME blocking status, -1 otherwise
+	// The following fields are encoded, use the get_query_*() and
+	// set_query_*() accessors below instead of accessing them directly:
+	// - response: microseconds (wrapping) when the query arrived while
+	//   flags.response_calculated is false, the response time in
+	//   microseconds afterwards
+	// - timestamp: milliseconds since counters->query_base.timestamp
+	// - db: database ID relative to counters->query_base.db, 0 if the query
+	//   has not been stored in the database yet
+	uint32_t response;
+	uint32_t timestamp;
+	uint32_t db;
 } queriesData;
 
+// Queries older than misc.hotQueries seconds are moved out of the queries
+// struct into the cold tier. Only the fields needed by the statistics are kept
+// and all queries of the same minute sharing them are counted in one record.
+// Each record holds a reference on its domain and client
+struct cold_query {
+	uint32_t timestamp; // start of the minute
+	unsigned int domainID;
+	unsigned int clientID;
+	int upstreamID;
+	unsigned int count;
+	enum query_status status :8;
+	enum query_type type :8;
+	enum reply_type reply :8;
+};
+
 typedef struct {
 	unsigned char magic;
 	struct upstream_flags {
@@ -68,28 +100,46 @@ typedef struct {
 	size_t namepos;
 	double rtime;
 	double rtuncertainty;
+	// Exponentially weighted moving averages of the response time (seconds)
+	// and of the fraction of queries which had to be retried
+	double ewma_rtime;
+	double ewma_failed;
 	double lastQuery;
+	struct upstream_circuit circuit;
 } upstreamsData;
 
+// Binary form of a client's IP address, used as key of the client lookup table
+struct client_addr {
+	sa_family_t family; // AF_UNSPEC for clients without an address (alias-clients)
+	union {
+		struct in_addr in;
+		struct in6_addr in6;
+	} addr;
+};
+
 typedef struct {
 	unsigned char magic;
 	unsigned char reread_groups;
+	unsigned char toplists; // bitmask of the top lists this client is a member of
 	char hwlen;
 	unsigned char hwaddr[16]; // See DHCP_CHADDR_MAX in dnsmasq/dhcp-protocol.h
 	struct client_flags {
 		bool new:1;
 		bool found_group:1;
 		bool aliasclient:1;
-		bool rate_limited:1;
+		bool excluded:1; // matches webserver.api.excludeClients
 	} flags;
 	int count;
 	int blockedcount;
 	int aliasclient_id; // -1 if not an alias-client
 	unsigned int id;
-	unsigned int rate_limit;
+	unsigned int regex_generation; // per-client regex are stale if != counters->client_regex_generation
+	struct rate_bucket rate_limit;
 	unsigned int numQueriesARP;
+	unsigned int refs; // number of queries referencing this client
 	int overTime[OVERTIME_SLOTS];
 	uint32_t hash;
+	struct client_addr addr;
 	size_t groupspos;
 	size_t ippos;
 	size_t namepos;
@@ -100,9 +150,17 @@ typedef struct {
 
 typedef struct {
 	unsigned char magic;
+	unsigned char toplists; // bitmask of the top lists this domain is a member of
+	struct domain_flags {
+		bool excluded:1; // matches webserver.api.excludeDomains
+	} flags;
 	int count;
 	int blockedcount;
+	int cachehits; // queries answered from the cache
+	int cachemisses; // queries forwarded upstream
+	unsigned int refs; // number of queries and cache records referencing this domain
 	uint32_t hash;
+	unsigned int suffix; // node of the leftmost label, 0 if the name is stored at domainpos
 	size_t domainpos;
 	double lastQuery;
 } domainsData;
@@ -111,37 +169,56 @@ typedef struct {
 	unsigned char magic;
 	struct {
 		bool allowed :1;
+		bool cname_ref :1; // CNAME_domainID holds a reference, see set_cache_CNAME()
 	} flags;
 	enum query_status blocking_status;
 	enum reply_type force_reply;
 	enum query_type query_type;
 	unsigned int domainID;
-	unsigned int clientID;
+	unsigned int clientID; // client ID or shared group key, see cache_client_key()
 	unsigned int CNAME_domainID; // only valid if query has a CNAME blocking status
+	unsigned int generation; // gravity generation this record is valid for
+	unsigned int refs; // number of queries referencing this cache record
 	int list_id;
 	uint32_t hash;
 	time_t expires;
 	char *cname_target;
 } DNSCacheData;
 
+// DNS cache records of clients with known group memberships are shared between
+// all clients with the same groups, their key has this bit set
+#define CACHE_SHARED_KEY 0x80000000u
+
 struct lookup_data {
 	const char *domain;
 	const char *client;
+	const struct client_addr *client_addr;
+	const char *string;
+	in_port_t port;
+	unsigned int parent;
 	unsigned int domainID;
 	unsigned int clientID;
 	enum query_type query_type;
 };
 
 void strtolower(char *str);
+uint32_t strtolower_hash(char *str);
+uint32_t hashStr(const char *s) __attribute__ ((pure));
 int findQueryID(const int id);
 #define findUpstreamID(upstream, port) _findUpstreamID(upstream, port, __LINE__, __FUNCTION__, __FILE__)
 int _findUpstreamID(const char *upstream, const in_port_t port, int line, const char *func, const char *file);
-#define findDomainID(domain, count) _findDomainID(domain, count, __LINE__, __FUNCTION__, __FILE__)
-int _findDomainID(const char *domain, const bool count, int line, const char *func, const char *file);
+#define findDomainID(domain, count) _findDomainID(domain, hashStr(domain), count, __LINE__, __FUNCTION__, __FILE__)
+#define findHashedDomainID(domain, hash, count) _findDomainID(domain, hash, count, __LINE__, __FUNCTION__, __FILE__)
+int _findDomainID(const char *domain, const uint32_t hash, const bool count, int line, const char *func, const char *file);
 #define findClientID(client, count, aliasclient, now) _findClientID(client, count, aliasclient, now, __LINE__, __FUNCTION__, __FILE__)
 int _findClientID(const char *client, const bool count, const bool aliasclient, const double now, int line, const char *func, const char *file);
+#define findClientIDaddr(addr, count, now) _findClientIDaddr(addr, count, now, __LINE__, __FUNCTION__, __FILE__)
+int _findClientIDaddr(const struct client_addr *addr, const bool count, const double now, int line, const char *func, const char *file);
+bool parse_client_addr(const char *ip, struct client_addr *addr);
 #define findCacheID(domainID, clientID, query_type, create_new) _findCacheID(domainID, clientID, query_type, create_new, __FUNCTION__, __LINE__, __FILE__)
 int _findCacheID(const unsigned int domainID, const unsigned int clientID, const enum query_type query_type, const bool create_new, const char *func, const int line, const char *file);
+unsigned int cache_client_key(const clientsData *client) __attribute__((pure));
+void rekey_dns_cache(DNSCacheData *cache, const unsigned int cacheID, const unsigned int clientID);
 bool isValidIPv4(const char *addr);
 bool isValidIPv6(const char *addr);
 
@@ -150,22 +227,50 @@ bool is_cached(const enum query_status status) __attribute__ ((const));
 const char *get_blocked_statuslist(void) __attribute__ ((pure));
 const char *get_cached_statuslist(void) __attribute__ ((pure));
 const char *get_permitted_statuslist(void) __attribute__ ((pure));
+unsigned int get_total_queries(void) __attribute__ ((pure));
 unsigned int get_blocked_count(void) __attribute__ ((pure));
 unsigned int get_forwarded_count(void) __attribute__ ((pure));
 unsigned int get_cached_count(void) __attribute__ ((pure));
+unsigned int get_active_clients(void) __attribute__ ((pure));
+void set_counter_shard(const unsigned int shard);
+unsigned int get_status_count(const enum query_status status) __attribute__ ((pure));
+unsigned int get_querytype_count(const enum query_type type) __attribute__ ((pure));
+unsigned int get_reply_count(const enum reply_type reply) __attribute__ ((pure));
+void change_status_count(const enum query_status status, const int mod);
+void change_querytype_count(const enum query_type type, const int mod);
+void change_reply_count(const enum reply_type reply, const int mod);
 #define query_set_status(query, new_status) _query_set_status(query, new_status, false, __FUNCTION__, __LINE__, __FILE__)
 #define query_set_status_init(query, new_status) _query_set_status(query, new_status, true, __FUNCTION__, __LINE__, __FILE__)
 void _query_set_status(queriesData *query, const enum query_status new_status, const bool init, const char *func, const int line, const char *file);
 
 void FTL_reload_all_domainlists(void);
-void FTL_reset_per_client_domain_data(void);
+void FTL_publish_domainlists(void);
+void FTL_reload_changed_domains(void);
+void domainlist_changed(const char *domain);
+
+double get_query_timestamp(const queriesData *query) __attribute__ ((pure));
+void set_query_timestamp(queriesData *query, const double timestamp);
+double get_query_response(const queriesData *query) __attribute__ ((pure));
+void set_query_response(queriesData *query, const double response);
+void start_query_response(queriesData *query, const double now);
+void finish_query_response(queriesData *query, const double now);
+int64_t get_query_dbid(const queriesData *query) __attribute__ ((pure));
+void set_query_dbid(queriesData *query, const int64_t id);
 
+const char *getDomainName(const domainsData *domain);
 const char *getDomainString(const queriesData *query);
 const char *getCNAMEDomainString(const queriesData *query);
 const char *getClientIPString(const queriesData *query);
 const char *getClientNameString(const queriesData *query);
 
+void set_clientcount(clientsData *client, const int count);
 void change_clientcount(clientsData *client, const int total, const int blocked, const int overTimeIdx, const int overTimeMod);
+void ref_query(const queriesData *query);
+void unref_query(const queriesData *query);
+void ref_cold_query(const struct cold_query *cold, const int delta);
+void set_query_CNAME(queriesData *query, const int domainID);
+void set_cache_CNAME(DNSCacheData *cache, const unsigned int domainID);
+void unref_cache_CNAME(DNSCacheData *cache);
 const char *get_query_type_str(const enum query_type type, const queriesData *query, char buffer[20]);
 const char *get_query_status_str(const enum query_status status) __attribute__ ((const));
 const char *get_query_dnssec_str(const enum dnssec_status dnssec) __attribute__ ((const));
@@ -0,0 +1,1007 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  DNS-over-TLS server
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file dns-over-tls.c
+* @brief DNS-over-TLS (RFC 7858) server handling all connections in one thread.
+*
+* TLS connections are terminated by a single thread polling all of them, no
+* process is forked per connection. Connections are kept open for further
+* queries, queries may be pipelined and their replies are sent as soon as
+* they arrive (possibly out of order as permitted by RFC 7766). TLS sessions
+* can be resumed using the session cache and the session tickets configured
+* for the web server, its certificate is used as well.
+*
+* The queries of each connection are relayed to the DNS server over UDP from
+* a loopback socket of its own. The port of this socket is stored in shared
+* memory together with the address of the TLS client so all processes
+* receiving DNS queries attribute them to the actual client (dot_client()).
+* Replies truncated over UDP are fetched again over TCP. These fetches use
+* non-blocking sockets polled together with the connections, so a slow fetch
+* does not delay the replies to other queries.
+*/
+
+#include "FTL.h"
+#include "dns-over-tls.h"
+#include "log.h"
+// config struct
+#include "config/config.h"
+// counters
+#include "shmem.h"
+// thread_names[], killed
+#include "signals.h"
+// set_thread_placement()
+#include "daemon.h"
+// file_readable()
+#include "files.h"
+// generate_certificate(), load_certificate()
+#include "webserver/x509.h"
+// poll()
+#include <poll.h>
+
+#ifdef HAVE_MBEDTLS
+# include <mbedtls/ssl.h>
+# include <mbedtls/net_sockets.h>
+# include <mbedtls/entropy.h>
+# include <mbedtls/ctr_drbg.h>
+# if defined(MBEDTLS_SSL_CACHE_C)
+#  include <mbedtls/ssl_cache.h>
+# endif
+# if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_TICKET_C)
+#  include <mbedtls/ssl_ticket.h>
+#  define DOT_TICKETS
+# endif
+# if defined(MBEDTLS_PSA_CRYPTO_C)
+#  include <psa/crypto.h>
+# endif
+
+// Connections without any traffic are closed after this many seconds
+#define DOT_IDLE_TIMEOUT 60
+// Queries of a connection waiting for their reply, further queries are only
+// read once replies have been sent
+#define DOT_MAX_INFLIGHT 64u
+// Queries without reply are forgotten after this many seconds
+#define DOT_QUERY_TIMEOUT 10
+// Connections of clients not reading their replies are closed once this many
+// bytes are waiting
+#define DOT_MAX_OUTPUT (256u*1024u)
+// Timeout of fetching truncated replies over TCP (seconds) and number of
+// attempts before the truncated reply is sent instead
+#define DOT_TCP_TIMEOUT 2
+#define DOT_TCP_ATTEMPTS 2u
+// Truncated replies fetched over TCP at the same time, further truncated
+// replies are sent as they are
+#define DOT_MAX_FETCHES 16u
+// Size of the DNS header and the truncation flag in its third byte
+#define DNS_HEADER_LEN 12u
+#define DNS_FLAG_TC 0x02u
+
+struct dot_query {
+	unsigned char *msg;
+	uint16_t len;
+	uint16_t id;
+	time_t sent;
+};
+
+struct dot_conn {
+	mbedtls_net_context net;
+	mbedtls_ssl_context ssl;
+	bool established;
+	// The TLS layer waits for the socket to become writable
+	bool want_write;
+	time_t last_active;
+	struct client_addr addr;
+	char ip[INET6_ADDRSTRLEN];
+	// Connected UDP socket the queries are relayed through
+	int relay;
+	in_port_t relay_port;
+	// Received data not yet relayed (messages with their length prefix)
+	unsigned char in[2u + UINT16_MAX];
+	size_t inlen;
+	// Replies not yet sent (with their length prefix). write_len is the
+	// length passed to an interrupted mbedtls_ssl_write() which has to be
+	// repeated with the same arguments
+	unsigned char *out;
+	size_t outsize, outlen, outpos, write_len;
+	// Relayed queries waiting for their reply
+	struct dot_query inflight[DOT_MAX_INFLIGHT];
+	unsigned int ninflight;
+	// Truncated replies being fetched over TCP
+	unsigned int nfetching;
+};
+
+/**
+ * struct dot_fetch - Complete reply to a query being fetched over TCP
+ * @conn: The connection the reply is sent to, NULL if unused
+ * @slot: The slot of the connection
+ * @fd: The TCP socket of the current attempt
+ * @attempt: Number of the current attempt
+ * @started: Start of the current attempt
+ * @query: The query with its length prefix
+ * @query_len: Length of the query (including the prefix)
+ * @query_pos: Number of bytes of the query sent so far
+ * @truncated: The truncated reply with its length prefix, it is sent when the
+ * complete reply cannot be fetched
+ * @truncated_len: Length of the truncated reply (including the prefix)
+ * @buf: The reply with its length prefix
+ * @received: Number of bytes of the reply received so far
+ */
+struct dot_fetch {
+	struct dot_conn *conn;
+	unsigned int slot;
+	int fd;
+	unsigned int attempt;
+	time_t started;
+	unsigned char *query;
+	size_t query_len, query_pos;
+	unsigned char *truncated;
+	size_t truncated_len;
+	unsigned char *buf;
+	size_t received;
+};
+
+static struct dot_conn *conns[DOT_MAX_CONNS] = { NULL };
+static struct dot_fetch fetches[DOT_MAX_FETCHES] = {{ 0 }};
+
+static mbedtls_ssl_config tls_conf;
+static mbedtls_x509_crt tls_cert;
+static mbedtls_pk_context tls_key;
+static mbedtls_entropy_context tls_entropy;
+static mbedtls_ctr_drbg_context tls_drbg;
+#if defined(MBEDTLS_SSL_CACHE_C)
+static mbedtls_ssl_cache_context tls_cache;
+#endif
+#if defined(DOT_TICKETS)
+static mbedtls_ssl_ticket_context tls_ticket;
+#endif
+
+// Reply buffer (with length prefix), only used by the DNS-over-TLS thread
+static unsigned char reply[2u + UINT16_MAX];
+
+// Publish the client of a connection slot (or clear it if conn is NULL)
+static void set_peer(const unsigned int slot, const struct dot_conn *conn)
+{
+	struct dot_peer *peer = &counters->dot_peers[slot];
+	__atomic_store_n(&peer->port, 0, __ATOMIC_RELEASE);
+	if(conn == NULL)
+		return;
+
+	memcpy(&peer->addr, &conn->addr, sizeof(peer->addr));
+	__atomic_store_n(&peer->port, conn->relay_port, __ATOMIC_RELEASE);
+}
+
+static bool setup_tls(void)
+{
+	mbedtls_ssl_config_init(&tls_conf);
+	mbedtls_x509_crt_init(&tls_cert);
+	mbedtls_pk_init(&tls_key);
+	mbedtls_entropy_init(&tls_entropy);
+	mbedtls_ctr_drbg_init(&tls_drbg);
+#if defined(MBEDTLS_SSL_CACHE_C)
+	mbedtls_ssl_cache_init(&tls_cache);
+#endif
+#if defined(DOT_TICKETS)
+	mbedtls_ssl_ticket_init(&tls_ticket);
+#endif
+
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+	// Mandatory with TLS 1.3, repeated calls have no effect
+	if(psa_crypto_init() != PSA_SUCCESS)
+	{
+		log_err("DNS-over-TLS: Cannot initialize PSA crypto");
+		return false;
+	}
+#endif
+
+	// Use the certificate of the web server, it is created if it does not
+	// exist yet
+	const char *certfile = config.webserver.tls.cert.v.s;
+	if(!file_readable(certfile) &&
+	   generate_certificate(certfile, false, config.webserver.domain.v.s))
+		log_info("Created SSL/TLS certificate for %s at %s",
+		         config.webserver.domain.v.s, certfile);
+	if(!load_certificate(certfile, &tls_cert, &tls_key))
+		return false;
+
+	int rc = mbedtls_ctr_drbg_seed(&tls_drbg, mbedtls_entropy_func, &tls_entropy,
+	                               (const unsigned char *)"pihole-FTL DoT", strlen("pihole-FTL DoT"));
+	if(rc != 0)
+	{
+		log_err("DNS-over-TLS: Cannot seed random number generator: Error code %d", rc);
+		return false;
+	}
+
+	rc = mbedtls_ssl_config_defaults(&tls_conf, MBEDTLS_SSL_IS_SERVER,
+	                                 MBEDTLS_SSL_TRANSPORT_STREAM,
+	                                 MBEDTLS_SSL_PRESET_DEFAULT);
+	if(rc != 0)
+	{
+		log_err("DNS-over-TLS: Cannot set TLS defaults: Error code %d", rc);
+		return false;
+	}
+	mbedtls_ssl_conf_rng(&tls_conf, mbedtls_ctr_drbg_random, &tls_drbg);
+	mbedtls_ssl_conf_authmode(&tls_conf, MBEDTLS_SSL_VERIFY_NONE);
+	if((rc = mbedtls_ssl_conf_own_cert(&tls_conf, &tls_cert, &tls_key)) != 0)
+	{
+		log_err("DNS-over-TLS: Cannot use certificate: Error code %d", rc);
+		return false;
+	}
+
+#if defined(MBEDTLS_SSL_ALPN)
+	// Protocol identifier registered for DNS-over-TLS
+	static const char *alpn[] = { "dot", NULL };
+	mbedtls_ssl_conf_alpn_protocols(&tls_conf, alpn);
+#endif
+
+	// Session resumption as configured for the web server, TLS 1.3 does
+	// not allow tickets to live longer than seven days
+	const unsigned int lifetime = min(config.webserver.tls.lifetime.v.ui, 604800u);
+#if defined(MBEDTLS_SSL_CACHE_C)
+	if(config.webserver.tls.cache.v.ui > 0)
+	{
+		mbedtls_ssl_cache_set_max_entries(&tls_cache, (int)config.webserver.tls.cache.v.ui);
+# if defined(MBEDTLS_HAVE_TIME)
+		mbedtls_ssl_cache_set_timeout(&tls_cache, (int)lifetime);
+# endif
+		mbedtls_ssl_conf_session_cache(&tls_conf, &tls_cache,
+		                               mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+	}
+#endif
+#if defined(DOT_TICKETS)
+	if(config.webserver.tls.tickets.v.b)
+	{
+		rc = mbedtls_ssl_ticket_setup(&tls_ticket, mbedtls_ctr_drbg_random, &tls_drbg,
+		                              MBEDTLS_CIPHER_AES_256_GCM, lifetime);
+		if(rc == 0)
+			mbedtls_ssl_conf_session_tickets_cb(&tls_conf, mbedtls_ssl_ticket_write,
+			                                    mbedtls_ssl_ticket_parse, &tls_ticket);
+		else
+			log_warn("DNS-over-TLS: Cannot set up session tickets: Error code %d", rc);
+	}
+#endif
+	(void)lifetime;
+
+	return true;
+}
+
+static void free_tls(void)
+{
+	mbedtls_ssl_config_free(&tls_conf);
+	mbedtls_x509_crt_free(&tls_cert);
+	mbedtls_pk_free(&tls_key);
+	mbedtls_ctr_drbg_free(&tls_drbg);
+	mbedtls_entropy_free(&tls_entropy);
+#if defined(MBEDTLS_SSL_CACHE_C)
+	mbedtls_ssl_cache_free(&tls_cache);
+#endif
+#if defined(DOT_TICKETS)
+	mbedtls_ssl_ticket_free(&tls_ticket);
+#endif
+}
+
+// Listen on all addresses, using a dual-stack IPv6 socket if possible
+static int open_listener(void)
+{
+	const in_port_t port = config.dns.dotPort.v.u16;
+	const int on = 1, off = 0;
+
+	int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd > -1)
+	{
+		struct sockaddr_in6 addr6 = { 0 };
+		addr6.sin6_family = AF_INET6;
+		addr6.sin6_port = htons(port);
+		addr6.sin6_addr = in6addr_any;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+		if(bind(fd, (struct sockaddr *)&addr6, sizeof(addr6)) == 0 && listen(fd, 64) == 0)
+			return fd;
+		close(fd);
+	}
+
+	// IPv6 is not available
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd > -1)
+	{
+		struct sockaddr_in addr4 = { 0 };
+		addr4.sin_family = AF_INET;
+		addr4.sin_port = htons(port);
+		addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(bind(fd, (struct sockaddr *)&addr4, sizeof(addr4)) == 0 && listen(fd, 64) == 0)
+			return fd;
+		const int _errno = errno;
+		close(fd);
+		errno = _errno;
+	}
+
+	log_err("Cannot bind DNS-over-TLS server to port %u: %s", port, strerror(errno));
+	return -1;
+}
+
+// Open the UDP socket relaying the queries of a connection to the DNS server
+static bool open_relay(struct dot_conn *conn)
+{
+	conn->relay = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(conn->relay < 0)
+		return false;
+
+	struct sockaddr_in addr = { 0 };
+	socklen_t addrlen = sizeof(addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(conn->relay, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	   getsockname(conn->relay, (struct sockaddr *)&addr, &addrlen) != 0)
+		return false;
+	conn->relay_port = ntohs(addr.sin_port);
+
+	addr.sin_port = htons(config.dns.port.v.u16);
+	return connect(conn->relay, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+}
+
+static void free_fetch(struct dot_fetch *fetch)
+{
+	if(fetch->fd > -1)
+		close(fetch->fd);
+	if(fetch->query != NULL)
+		free(fetch->query);
+	if(fetch->truncated != NULL)
+		free(fetch->truncated);
+	if(fetch->buf != NULL)
+		free(fetch->buf);
+	if(fetch->conn != NULL)
+		fetch->conn->nfetching--;
+	memset(fetch, 0, sizeof(*fetch));
+}
+
+static void close_conn(const unsigned int slot)
+{
+	struct dot_conn *conn = conns[slot];
+	set_peer(slot, NULL);
+
+	// Cancel the fetches of truncated replies of this connection
+	for(unsigned int i = 0; i < DOT_MAX_FETCHES && conn->nfetching > 0; i++)
+		if(fetches[i].conn == conn)
+			free_fetch(&fetches[i]);
+
+	if(conn->established)
+		mbedtls_ssl_close_notify(&conn->ssl);
+	mbedtls_ssl_free(&conn->ssl);
+	close(conn->net.fd);
+	if(conn->relay > -1)
+		close(conn->relay);
+	for(unsigned int i = 0; i < conn->ninflight; i++)
+		free(conn->inflight[i].msg);
+	if(conn->out != NULL)
+		free(conn->out);
+	log_debug(DEBUG_TLS, "DNS-over-TLS connection from %s closed", conn->ip);
+
+	free(conn);
+	conns[slot] = NULL;
+}
+
+static void accept_conn(const int listener)
+{
+	struct sockaddr_storage addr = { 0 };
+	socklen_t addrlen = sizeof(addr);
+	const int fd = accept4(listener, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd < 0)
+		return;
+
+	unsigned int slot = 0;
+	while(slot < DOT_MAX_CONNS && conns[slot] != NULL)
+		slot++;
+	struct dot_conn *conn = slot < DOT_MAX_CONNS ? calloc(1, sizeof(*conn)) : NULL;
+	if(conn == NULL)
+	{
+		log_debug(DEBUG_TLS, "DNS-over-TLS connection refused, %u connections are open", slot);
+		close(fd);
+		return;
+	}
+	conns[slot] = conn;
+	conn->net.fd = fd;
+	conn->relay = -1;
+	conn->last_active = time(NULL);
+	mbedtls_ssl_init(&conn->ssl);
+
+	// Clients connecting to the dual-stack socket over IPv4 are
+	// attributed to their IPv4 address
+	const struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&addr;
+	if(addr.ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr))
+	{
+		conn->addr.family = AF_INET;
+		memcpy(&conn->addr.addr.in, &addr6->sin6_addr.s6_addr[12], sizeof(conn->addr.addr.in));
+	}
+	else if(addr.ss_family == AF_INET6)
+	{
+		conn->addr.family = AF_INET6;
+		conn->addr.addr.in6 = addr6->sin6_addr;
+	}
+	else
+	{
+		conn->addr.family = AF_INET;
+		conn->addr.addr.in = ((struct sockaddr_in *)&addr)->sin_addr;
+	}
+	inet_ntop(conn->addr.family, &conn->addr.addr, conn->ip, sizeof(conn->ip));
+
+	if(!open_relay(conn))
+	{
+		log_warn("DNS-over-TLS: Cannot open relay socket: %s", strerror(errno));
+		close_conn(slot);
+		return;
+	}
+
+	const int rc = mbedtls_ssl_setup(&conn->ssl, &tls_conf);
+	if(rc != 0)
+	{
+		log_warn("DNS-over-TLS: Cannot set up TLS connection: Error code %d", rc);
+		close_conn(slot);
+		return;
+	}
+	mbedtls_ssl_set_bio(&conn->ssl, &conn->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+	set_peer(slot, conn);
+	log_debug(DEBUG_TLS, "DNS-over-TLS connection from %s (relayed from port %u)",
+	          conn->ip, conn->relay_port);
+}
+
+static bool handshake(struct dot_conn *conn)
+{
+	const int rc = mbedtls_ssl_handshake(&conn->ssl);
+	conn->want_write = rc == MBEDTLS_ERR_SSL_WANT_WRITE;
+	if(rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE)
+		return true;
+	if(rc != 0)
+	{
+		log_debug(DEBUG_TLS, "DNS-over-TLS handshake with %s failed: Error code %d", conn->ip, rc);
+		return false;
+	}
+
+	conn->established = true;
+	log_debug(DEBUG_TLS, "DNS-over-TLS connection from %s established using %s",
+	          conn->ip, mbedtls_ssl_get_version(&conn->ssl));
+	return true;
+}
+
+// Send replies waiting in the output buffer
+static bool flush_output(struct dot_conn *conn)
+{
+	conn->want_write = false;
+	while(conn->outpos < conn->outlen)
+	{
+		const size_t len = conn->write_len > 0 ? conn->write_len : conn->outlen - conn->outpos;
+		const int rc = mbedtls_ssl_write(&conn->ssl, conn->out + conn->outpos, len);
+		if(rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE)
+		{
+			conn->write_len = len;
+			conn->want_write = rc == MBEDTLS_ERR_SSL_WANT_WRITE;
+			return true;
+		}
+		if(rc < 0)
+		{
+			log_debug(DEBUG_TLS, "DNS-over-TLS: Cannot send to %s: Error code %d", conn->ip, rc);
+			return false;
+		}
+		conn->write_len = 0;
+		conn->outpos += rc;
+	}
+
+	conn->outpos = conn->outlen = 0;
+	return true;
+}
+
+static bool queue_output(struct dot_conn *conn, const unsigned char *data, const size_t len)
+{
+	// Move the waiting replies to the front unless they are being written
+	if(conn->write_len == 0 && conn->outpos > 0)
+	{
+		memmove(conn->out, conn->out + conn->outpos, conn->outlen - conn->outpos);
+		conn->outlen -= conn->outpos;
+		conn->outpos = 0;
+	}
+
+	if(conn->outlen + len > DOT_MAX_OUTPUT)
+	{
+		log_debug(DEBUG_TLS, "DNS-over-TLS: %s does not read its replies", conn->ip);
+		return false;
+	}
+
+	if(conn->outlen + len > conn->outsize)
+	{
+		const size_t size = max(2*conn->outsize, conn->outlen + len);
+		unsigned char *out = realloc(conn->out, size);
+		if(out == NULL)
+			return false;
+		conn->out = out;
+		conn->outsize = size;
+	}
+
+	memcpy(conn->out + conn->outlen, data, len);
+	conn->outlen += len;
+	return true;
+}
+
+// Connect to the DNS server over TCP for the next attempt of a fetch. The
+// query is sent from the port of the relay socket (if possible) on the first
+// attempt so it is attributed to the client of the connection as well
+static bool connect_fetch(struct dot_fetch *fetch)
+{
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for(; fetch->attempt < DOT_TCP_ATTEMPTS; fetch->attempt++)
+	{
+		const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(fd < 0)
+			return false;
+
+		if(fetch->attempt == 0)
+		{
+			const int on = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			addr.sin_port = htons(fetch->conn->relay_port);
+			if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+			{
+				close(fd);
+				continue;
+			}
+		}
+
+		addr.sin_port = htons(config.dns.port.v.u16);
+		if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS)
+		{
+			close(fd);
+			continue;
+		}
+
+		fetch->fd = fd;
+		fetch->started = time(NULL);
+		fetch->query_pos = 0;
+		fetch->received = 0;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Start fetching the complete reply to a query over TCP
+ *
+ * @param conn The connection the reply is sent to
+ * @param slot The slot of the connection
+ * @param query The query, its message is taken over on success
+ * @param truncated The truncated reply with its length prefix
+ * @param len Length of the truncated reply (including the prefix)
+ * @return Whether the fetch has been started
+ */
+static bool start_fetch(struct dot_conn *conn, const unsigned int slot, struct dot_query *query,
+                        const unsigned char *truncated, const size_t len)
+{
+	unsigned int i = 0;
+	while(i < DOT_MAX_FETCHES && fetches[i].conn != NULL)
+		i++;
+	if(i == DOT_MAX_FETCHES)
+		return false;
+
+	struct dot_fetch *fetch = &fetches[i];
+	fetch->fd = -1;
+	fetch->conn = conn;
+	fetch->slot = slot;
+	conn->nfetching++;
+	fetch->query_len = 2u + query->len;
+	if((fetch->query = malloc(fetch->query_len)) == NULL ||
+	   (fetch->truncated = malloc(len)) == NULL ||
+	   (fetch->buf = malloc(2u + UINT16_MAX)) == NULL ||
+	   !connect_fetch(fetch))
+	{
+		free_fetch(fetch);
+		return false;
+	}
+
+	fetch->query[0] = query->len >> 8;
+	fetch->query[1] = query->len & 0xff;
+	memcpy(fetch->query + 2, query->msg, query->len);
+	memcpy(fetch->truncated, truncated, len);
+	fetch->truncated_len = len;
+	free(query->msg);
+
+	return true;
+}
+
+/**
+ * Send the query and receive the reply of a fetch as far as possible without
+ * blocking
+ *
+ * @param fetch The fetch
+ * @return 1 if the reply is complete, 0 if the fetch has to wait for the
+ * socket and -1 if the attempt failed
+ */
+static int fetch_io(struct dot_fetch *fetch)
+{
+	while(fetch->query_pos < fetch->query_len)
+	{
+		const ssize_t n = send(fetch->fd, fetch->query + fetch->query_pos,
+		                       fetch->query_len - fetch->query_pos, MSG_NOSIGNAL);
+		if(n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		fetch->query_pos += n;
+	}
+
+	while(true)
+	{
+		// Length prefix first, the reply itself afterwards
+		const size_t len = fetch->received < 2u ? 2u :
+			2u + (fetch->buf[0] << 8 | fetch->buf[1]);
+		if(fetch->received == len && len > 2u)
+			return len - 2u >= DNS_HEADER_LEN ? 1 : -1;
+
+		const ssize_t n = recv_nowarn(fetch->fd, fetch->buf + fetch->received,
+		                              len - fetch->received, 0);
+		if(n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		if(n == 0)
+			return -1;
+		fetch->received += n;
+	}
+}
+
+/**
+ * Continue fetching a reply. When it is complete (or cannot be fetched in the
+ * given number of attempts), it is sent to the client instead of the truncated
+ * reply (or the truncated reply is sent).
+ *
+ * @param fetch The fetch
+ * @param now The current time
+ * @return Whether the connection is still okay
+ */
+static bool continue_fetch(struct dot_fetch *fetch, const time_t now)
+{
+	int rc = fetch_io(fetch);
+	while(rc < 0 || (rc == 0 && now - fetch->started >= DOT_TCP_TIMEOUT))
+	{
+		// Try again using a new connection
+		close(fetch->fd);
+		fetch->fd = -1;
+		fetch->attempt++;
+		if(!connect_fetch(fetch))
+		{
+			rc = -1;
+			break;
+		}
+		rc = fetch_io(fetch);
+	}
+	if(rc == 0)
+		return true;
+
+	struct dot_conn *conn = fetch->conn;
+	bool okay;
+	if(rc > 0)
+		okay = queue_output(conn, fetch->buf, fetch->received);
+	else
+	{
+		log_debug(DEBUG_TLS, "DNS-over-TLS: Cannot fetch truncated reply over TCP");
+		okay = queue_output(conn, fetch->truncated, fetch->truncated_len);
+	}
+	free_fetch(fetch);
+
+	return okay && flush_output(conn);
+}
+
+// Send the replies received from the DNS server to the client
+static bool relay_replies(struct dot_conn *conn, const unsigned int slot)
+{
+	ssize_t len;
+	while((len = recv_nowarn(conn->relay, reply + 2, UINT16_MAX, 0)) > 0)
+	{
+		if((size_t)len < DNS_HEADER_LEN)
+			continue;
+
+		// Find the query this reply belongs to
+		uint16_t id;
+		memcpy(&id, reply + 2, sizeof(id));
+		unsigned int i = 0;
+		while(i < conn->ninflight && conn->inflight[i].id != id)
+			i++;
+
+		reply[0] = len >> 8;
+		reply[1] = len & 0xff;
+		if(i < conn->ninflight)
+		{
+			// A truncated reply is replaced by the complete one once
+			// it has been fetched over TCP (see continue_fetch())
+			bool fetching = false;
+			if(reply[4] & DNS_FLAG_TC)
+			{
+				fetching = start_fetch(conn, slot, &conn->inflight[i], reply, len + 2);
+				if(!fetching)
+					log_debug(DEBUG_TLS, "DNS-over-TLS: Cannot fetch truncated reply over TCP");
+			}
+			if(!fetching)
+				free(conn->inflight[i].msg);
+			conn->inflight[i] = conn->inflight[--conn->ninflight];
+			if(fetching)
+				continue;
+		}
+
+		if(!queue_output(conn, reply, len + 2))
+			return false;
+	}
+
+	return flush_output(conn);
+}
+
+// Relay the complete queries received so far
+static bool relay_queries(struct dot_conn *conn)
+{
+	size_t pos = 0;
+	while(conn->ninflight < DOT_MAX_INFLIGHT && conn->inlen - pos >= 2)
+	{
+		const uint16_t len = conn->in[pos] << 8 | conn->in[pos + 1];
+		if(conn->inlen - pos < 2u + len)
+			break;
+
+		const unsigned char *msg = conn->in + pos + 2;
+		pos += 2u + len;
+		if(len < DNS_HEADER_LEN)
+		{
+			log_debug(DEBUG_TLS, "DNS-over-TLS: Invalid query from %s", conn->ip);
+			return false;
+		}
+
+		// Keep the query in case its reply is truncated
+		struct dot_query *query = &conn->inflight[conn->ninflight];
+		if((query->msg = malloc(len)) == NULL)
+			return false;
+		memcpy(query->msg, msg, len);
+		memcpy(&query->id, msg, sizeof(query->id));
+		query->len = len;
+		query->sent = time(NULL);
+		conn->ninflight++;
+
+		if(send(conn->relay, msg, len, MSG_NOSIGNAL) != len)
+			log_debug(DEBUG_TLS, "DNS-over-TLS: Cannot relay query: %s", strerror(errno));
+	}
+
+	memmove(conn->in, conn->in + pos, conn->inlen - pos);
+	conn->inlen -= pos;
+	return true;
+}
+
+// Read and relay queries while not too many of them are waiting for replies
+static bool read_queries(struct dot_conn *conn)
+{
+	while(true)
+	{
+		if(!relay_queries(conn))
+			return false;
+		if(conn->ninflight == DOT_MAX_INFLIGHT)
+			return true;
+
+		const int rc = mbedtls_ssl_read(&conn->ssl, conn->in + conn->inlen, sizeof(conn->in) - conn->inlen);
+		if(rc == MBEDTLS_ERR_SSL_WANT_READ)
+			return true;
+		if(rc == MBEDTLS_ERR_SSL_WANT_WRITE)
+		{
+			conn->want_write = true;
+			return true;
+		}
+		if(rc <= 0)
+			return false;
+
+		conn->inlen += rc;
+		conn->last_active = time(NULL);
+	}
+}
+
+// Close idle connections and forget queries which never got a reply
+static void housekeeping(const time_t now)
+{
+	for(unsigned int slot = 0; slot < DOT_MAX_CONNS; slot++)
+	{
+		struct dot_conn *conn = conns[slot];
+		if(conn == NULL)
+			continue;
+
+		for(unsigned int i = 0; i < conn->ninflight;)
+		{
+			if(now - conn->inflight[i].sent < DOT_QUERY_TIMEOUT)
+			{
+				i++;
+				continue;
+			}
+			free(conn->inflight[i].msg);
+			conn->inflight[i] = conn->inflight[--conn->ninflight];
+		}
+
+		if(conn->ninflight == 0 && conn->nfetching == 0 &&
+		   now - conn->last_active >= DOT_IDLE_TIMEOUT)
+			close_conn(slot);
+	}
+}
+
+static void serve(const int listener)
+{
+	// The listener, the TLS and the relay socket of every connection and
+	// the sockets fetching truncated replies
+	struct pollfd pfds[1u + 2u*DOT_MAX_CONNS + DOT_MAX_FETCHES];
+	unsigned int index[DOT_MAX_CONNS] = { 0 }, fetch_index[DOT_MAX_FETCHES] = { 0 };
+	time_t last_housekeeping = time(NULL);
+
+	while(!killed)
+	{
+		unsigned int nfds = 0;
+		bool pending = false;
+		pfds[nfds++] = (struct pollfd){ .fd = listener, .events = POLLIN };
+		for(unsigned int slot = 0; slot < DOT_MAX_CONNS; slot++)
+		{
+			struct dot_conn *conn = conns[slot];
+			if(conn == NULL)
+				continue;
+
+			// Do not read further queries while too many are in
+			// flight, already received data may be buffered by
+			// the TLS layer
+			const bool paused = conn->ninflight == DOT_MAX_INFLIGHT;
+			if(conn->established && !paused && mbedtls_ssl_check_pending(&conn->ssl))
+				pending = true;
+
+			index[slot] = nfds;
+			pfds[nfds++] = (struct pollfd){ .fd = conn->net.fd,
+			                                .events = conn->want_write ? POLLOUT : paused ? 0 : POLLIN };
+			pfds[nfds++] = (struct pollfd){ .fd = conn->relay, .events = POLLIN };
+		}
+		for(unsigned int i = 0; i < DOT_MAX_FETCHES; i++)
+		{
+			const struct dot_fetch *fetch = &fetches[i];
+			fetch_index[i] = 0;
+			if(fetch->conn == NULL)
+				continue;
+
+			fetch_index[i] = nfds;
+			pfds[nfds++] = (struct pollfd){ .fd = fetch->fd,
+			                                .events = fetch->query_pos < fetch->query_len ? POLLOUT : POLLIN };
+		}
+
+		if(poll(pfds, nfds, pending ? 0 : 1000) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			log_err("DNS-over-TLS: Cannot poll connections: %s", strerror(errno));
+			break;
+		}
+
+		for(unsigned int slot = 0; slot < DOT_MAX_CONNS; slot++)
+		{
+			struct dot_conn *conn = conns[slot];
+			if(conn == NULL)
+				continue;
+
+			const short tls = pfds[index[slot]].revents;
+			const short relay = pfds[index[slot] + 1].revents;
+			bool okay = true;
+			if(!conn->established)
+			{
+				if(tls != 0)
+					okay = handshake(conn);
+			}
+			else
+			{
+				if(relay & POLLIN)
+					okay = relay_replies(conn, slot);
+				if(okay && (tls & POLLOUT))
+					okay = flush_output(conn);
+				if(okay && ((tls & (POLLIN | POLLHUP | POLLERR)) || conn->inlen > 0 ||
+				            mbedtls_ssl_check_pending(&conn->ssl)))
+					okay = read_queries(conn);
+			}
+
+			if(!okay)
+				close_conn(slot);
+		}
+
+		// Fetches started in this round are polled in the next one
+		const time_t now = time(NULL);
+		for(unsigned int i = 0; i < DOT_MAX_FETCHES; i++)
+		{
+			struct dot_fetch *fetch = &fetches[i];
+			if(fetch->conn == NULL || fetch_index[i] == 0 ||
+			   (pfds[fetch_index[i]].revents == 0 && now - fetch->started < DOT_TCP_TIMEOUT))
+				continue;
+
+			const unsigned int slot = fetch->slot;
+			if(!continue_fetch(fetch, now))
+				close_conn(slot);
+		}
+
+		// Connections accepted now are polled in the next round
+		if(pfds[0].revents & POLLIN)
+			accept_conn(listener);
+
+		if(now != last_housekeeping)
+		{
+			housekeeping(now);
+			last_housekeeping = now;
+		}
+	}
+
+	for(unsigned int slot = 0; slot < DOT_MAX_CONNS; slot++)
+		if(conns[slot] != NULL)
+			close_conn(slot);
+}
+#endif
+
+/**
+ * Thread serving DNS-over-TLS on dns.dotPort until FTL terminates.
+ *
+ * @param val unused
+ * @return NULL
+ */
+void *dot_thread(void *val)
+{
+	(void)val;
+	prctl(PR_SET_NAME, thread_names[DOT], 0, 0, 0);
+	set_thread_placement(ROLE_DNS);
+
+	// Forget the clients of connections of an earlier run
+	memset(counters->dot_peers, 0, sizeof(counters->dot_peers));
+
+#ifdef HAVE_MBEDTLS
+	if(setup_tls())
+	{
+		const int listener = open_listener();
+		if(listener > -1)
+		{
+			log_info("DNS-over-TLS server listening on port %u", config.dns.dotPort.v.u16);
+			serve(listener);
+			close(listener);
+		}
+	}
+	else
+		log_err("DNS-over-TLS server not available");
+	free_tls();
+#else
+	log_warn("FTL was not compiled with mbedtls support, DNS-over-TLS server not available");
+#endif
+
+	return NULL;
+}
+
+/**
+ * Attribute a query relayed by the DNS-over-TLS server to the client of its
+ * TLS connection.
+ *
+ * @param addr Address the query was received from, replaced by the address of
+ *             the TLS client if the query has been relayed
+ * @param port Port the query was received from
+ */
+void dot_client(struct client_addr *addr, const in_port_t port)
+{
+	if(config.dns.dotPort.v.u16 == 0 || counters == NULL)
+		return;
+
+	// Queries are relayed from the loopback interface
+	if(!(addr->family == AF_INET && addr->addr.in.s_addr == htonl(INADDR_LOOPBACK)))
+		return;
+
+	for(unsigned int i = 0; i < DOT_MAX_CONNS; i++)
+	{
+		struct dot_peer *peer = &counters->dot_peers[i];
+		if(__atomic_load_n(&peer->port, __ATOMIC_ACQUIRE) != port)
+			continue;
+
+		struct client_addr client;
+		memcpy(&client, &peer->addr, sizeof(client));
+		// The slot may have been reused while copying
+		if(__atomic_load_n(&peer->port, __ATOMIC_ACQUIRE) == port)
+			memcpy(addr, &client, sizeof(*addr));
+		return;
+	}
+}
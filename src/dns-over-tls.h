@@ -0,0 +1,29 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  DNS-over-TLS server prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef DNS_OVER_TLS_H
+#define DNS_OVER_TLS_H
+
+// struct client_addr
+#include "datastructure.h"
+
+// Concurrent DNS-over-TLS connections, further connections are refused
+#define DOT_MAX_CONNS 256u
+
+// Client of a DNS-over-TLS connection. Its queries reach the DNS server from
+// the loopback port used for relaying them
+struct dot_peer {
+	in_port_t port; // 0 if the connection slot is unused
+	struct client_addr addr;
+};
+
+void *dot_thread(void *val);
+void dot_client(struct client_addr *addr, const in_port_t port);
+
+#endif // DNS_OVER_TLS_H
@@ -58,12 +58,22 @@ void blockdata_report(void)
 	    blockdata_alloced * sizeof(struct blockdata));
 } 
 
+/* Pi-hole modification */
+void blockdata_stats(unsigned int *used, unsigned int *hwm, unsigned int *alloced)
+{
+  *used = blockdata_count;
+  *hwm = blockdata_hwm;
+  *alloced = blockdata_alloced;
+}
+
 static struct blockdata *new_block(void)
 {
   struct blockdata *block;
 
+  /* Pi-hole modification: grow the pool in slabs proportional to the
+     cache size so large caches don't end up as many small allocations */
   if (!keyblock_free)
-    add_blocks(50);
+    add_blocks(daemon->cachesize > 50*64 ? daemon->cachesize/64 : 50);
   
   if (keyblock_free)
     {
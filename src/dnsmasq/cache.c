@@ -17,6 +17,8 @@
 #include "dnsmasq.h"
 #include "dnsmasq_interface.h"
 #include "webserver/webserver.h"
+/* Pi-hole modification: mmap() */
+#include <sys/mman.h>
 
 static struct crec *cache_head = NULL, *cache_tail = NULL, **hash_table = NULL;
 #ifdef HAVE_DHCP
@@ -26,6 +28,17 @@ static struct crec *new_chain = NULL;
 static int insert_error;
 static union bigname *big_free = NULL;
 static int bignames_left, hash_size;
+/* Pi-hole modification: entries removed after their TTL ended and entries
+   dropped by flushing (or shrinking) the cache */
+static unsigned int expired_freed = 0, flushed = 0;
+/* Pi-hole modification: occupancy of the big name pool */
+static unsigned int bignames_used = 0, bignames_hwm = 0, bignames_alloced = 0;
+/* Pi-hole modification: big names are allocated in slabs of this size */
+#define BIGNAME_SLAB 16
+/* Pi-hole modification: bytes per name assumed when sizing the hash tables
+   for the hosts files (a typical line like "0.0.0.0 ads.example.com" is
+   longer, so the estimate errs on the large side) */
+#define HOSTS_BYTES_PER_NAME 24
 
 static void make_non_terminals(struct crec *source);
 static struct crec *really_insert(char *name, union all_addr *addr, unsigned short class,
@@ -331,6 +344,7 @@ static void cache_free(struct crec *crecp)
       crecp->name.bname->next = big_free;
       big_free = crecp->name.bname;
       crecp->flags &= ~F_BIGNAME;
+      bignames_used--; /* Pi-hole modification */
     }
 
   cache_blockdata_free(crecp);
@@ -444,6 +458,128 @@ static int is_expired(time_t now, struct crec *crecp)
   return 1;
 }
 
+/***************** Pi-hole modification *****************/
+/* Blocks of cache entries added by cache_grow(). The block allocated by
+   cache_init() is never released, the most recent block is the first one
+   to be removed again by cache_shrink(). */
+struct cache_block {
+  struct cache_block *next;
+  int size;
+  struct crec crecs[];
+};
+static struct cache_block *cache_blocks = NULL;
+
+static int in_cache_block(const struct cache_block *block, const struct crec *crecp)
+{
+  return crecp >= block->crecs && crecp < block->crecs + block->size;
+}
+
+/* Add count free entries to the cache. Returns 0 if there was not enough memory */
+int cache_grow(int count)
+{
+  struct cache_block *block;
+  int i;
+
+  if (count <= 0 || !(block = whine_malloc(sizeof(struct cache_block) + count*sizeof(struct crec))))
+    return 0;
+
+  /* New entries are appended to the LRU list as if they were freed, they
+     are hence used before any entry still in use gets evicted */
+  for (i = 0; i < count; i++)
+    {
+      block->crecs[i].flags = 0;
+      cache_free(&block->crecs[i]);
+    }
+
+  block->size = count;
+  block->next = cache_blocks;
+  cache_blocks = block;
+
+  daemon->cachesize += count;
+  bignames_left += count/10;
+  rehash(daemon->cachesize);
+
+  return 1;
+}
+
+/* Release the most recently added block of entries. Entries stored in it
+   are dropped as well as CNAMEs pointing to them. Returns the number of
+   dropped entries whose TTL has not yet expired or -1 if there is no block
+   which could be released. The hash table is kept at its size. */
+int cache_shrink(time_t now)
+{
+  struct cache_block *block = cache_blocks;
+  struct crec *crecp, **up;
+  int i, dropped = 0;
+
+  if (!block)
+    return -1;
+
+  /* Entries of an incomplete insert are not in the hash table */
+  cache_start_insert();
+
+  for (i = 0; i < hash_size; i++)
+    for (up = &hash_table[i], crecp = *up; crecp; crecp = crecp->hash_next)
+      {
+	const int inside = in_cache_block(block, crecp);
+	if (!inside &&
+	    ((crecp->flags & F_CNAME) && !crecp->addr.cname.is_name_ptr &&
+	     crecp->addr.cname.target.cache && in_cache_block(block, crecp->addr.cname.target.cache)))
+	  {
+	    /* Never remove configured records, the target is looked up
+	       again when this pointer is found to be outdated */
+	    if (crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG))
+	      {
+		crecp->addr.cname.target.cache = NULL;
+		up = &crecp->hash_next;
+		continue;
+	      }
+	  }
+	else if (!inside)
+	  {
+	    up = &crecp->hash_next;
+	    continue;
+	  }
+
+	if (inside && difftime(now, crecp->ttd) < 0)
+	  dropped++;
+	flushed++;
+
+	*up = crecp->hash_next;
+	cache_unlink(crecp);
+	cache_free(crecp);
+      }
+
+  /* All entries of the block are now in the LRU list exactly once */
+  for (i = 0; i < block->size; i++)
+    cache_unlink(&block->crecs[i]);
+
+  daemon->cachesize -= block->size;
+  bignames_left -= block->size/10;
+  if (bignames_left < 0)
+    bignames_left = 0;
+
+  cache_blocks = block->next;
+  free(block);
+
+  return dropped;
+}
+
+/* Number of entries in use whose TTL has not yet expired */
+int cache_live_entries(time_t now)
+{
+  struct crec *crecp;
+  int live = 0;
+
+  for (crecp = cache_head; crecp; crecp = crecp->next)
+    if ((crecp->flags & (F_FORWARD | F_REVERSE)) && !(crecp->flags & F_IMMORTAL) &&
+	difftime(now, crecp->ttd) < 0)
+      live++;
+
+  return live;
+}
+/********************************************************/
+
 /* Remove entries with a given UID from the cache */
 unsigned int cache_remove_uid(const unsigned int uid)
 {
@@ -551,6 +687,7 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 		{
 		  cache_unlink(crecp);
 		  cache_free(crecp);
+		  expired_freed++; /* Pi-hole modification */
 		}
 	      continue;
 	    } 
@@ -574,6 +711,7 @@ static struct crec *cache_scan_free(char *name, union all_addr *addr, unsigned s
 		{ 
 		  cache_unlink(crecp);
 		  cache_free(crecp);
+		  expired_freed++; /* Pi-hole modification */
 		}
 	    }
 	  else if (!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)) &&
@@ -725,6 +863,8 @@ static struct crec *really_insert(char *name, union all_addr *addr, unsigned sho
 	  /* condition valid when stale-caching */
 	  if (difftime(now, new->ttd) < 0)
 	    daemon->metrics[METRIC_DNS_CACHE_LIVE_FREED]++;
+	  else
+	    expired_freed++; /* Pi-hole modification */
 	  
 	  cache_scan_free(cache_get_name(new), &new->addr, new->uid, now, new->flags, NULL, NULL); 
 	}
@@ -744,15 +884,36 @@ static struct crec *really_insert(char *name, union all_addr *addr, unsigned sho
 	  big_name = big_free;
 	  big_free = big_free->next;
 	}
-      else if ((bignames_left == 0 && !(flags & (F_DS | F_DNSKEY))) ||
-	       !(big_name = (union bigname *)whine_malloc(sizeof(union bigname))))
+      else if (bignames_left == 0 && !(flags & (F_DS | F_DNSKEY)))
 	{
 	  insert_error = 1;
 	  return NULL;
 	}
-      else if (bignames_left != 0)
-	bignames_left--;
-      
+      else
+	{
+	  /* Pi-hole modification: allocate a slab of big names at once
+	     (but never more than we are allowed to) and keep the spare
+	     ones on the free list */
+	  int i, n = bignames_left > BIGNAME_SLAB ? BIGNAME_SLAB : bignames_left;
+	  if (n == 0)
+	    n = 1;
+	  if (!(big_name = (union bigname *)whine_malloc(n * sizeof(union bigname))))
+	    {
+	      insert_error = 1;
+	      return NULL;
+	    }
+	  for (i = 1; i < n; i++)
+	    {
+	      big_name[i].next = big_free;
+	      big_free = &big_name[i];
+	    }
+	  bignames_alloced += n;
+	  bignames_left = bignames_left > n ? bignames_left - n : 0;
+	}
+
+      /* Pi-hole modification */
+      if (++bignames_used > bignames_hwm)
+	bignames_hwm = bignames_used;
     }
 
   /* If we freed a cache entry for our name which was a CNAME target, use that.
@@ -787,6 +948,8 @@ static struct crec *really_insert(char *name, union all_addr *addr, unsigned sho
     new->addr = *addr;	
 
   new->ttd = now + (time_t)ttl;
+  /* Pi-hole modification */
+  new->ttl = (unsigned int)ttl;
   new->next = new_chain;
   new_chain = new;
   
@@ -1295,8 +1458,12 @@ void add_hosts_entry(struct crec *cache, union all_addr *addr, int addrlen,
   if (rhash)
     {
       /* hash address */
-      for (j = 0, i = 0; i < addrlen; i++)
-	j = (j*2 +((unsigned char *)addr)[i]) % hashsz;
+      /* Pi-hole modification: mix the bytes (FNV-1a), the original hash
+	 has only a few thousand distinct values for IPv4 addresses which
+	 makes the chains very long for large hosts files */
+      for (j = 2166136261u, i = 0; i < addrlen; i++)
+	j = (j ^ ((unsigned char *)addr)[i]) * 16777619u;
+      j %= hashsz;
       
       for (lookup = rhash[j]; lookup; lookup = lookup->next)
 	if ((lookup->flags & cache->flags & (F_IPV4 | F_IPV6)) &&
@@ -1327,45 +1494,120 @@ void add_hosts_entry(struct crec *cache, union all_addr *addr, int addrlen,
   make_non_terminals(cache);
 }
 
-static int eatspace(FILE *f)
+/* Pi-hole modification: hosts files are mapped into memory and tokenized in
+   place instead of reading them character by character */
+struct hostsbuf {
+  char *data, *pos, *end;
+  size_t len;
+  int mapped;
+};
+
+static int map_hostsfile(char *filename, struct hostsbuf *f)
 {
-  int c, nl = 0;
+  struct stat st;
+  ssize_t n;
+  int fd = open(filename, O_RDONLY);
+
+  memset(f, 0, sizeof(*f));
+  if (fd == -1)
+    return 0;
+
+  if (fstat(fd, &st) == -1)
+    {
+      close(fd);
+      return 0;
+    }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (f->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    {
+      madvise(f->data, st.st_size, MADV_SEQUENTIAL);
+      f->len = st.st_size;
+      f->mapped = 1;
+    }
+  else
+    {
+      /* Not a regular file (or it cannot be mapped), read it into memory */
+      size_t size = 0;
+      char *tmp;
+
+      f->data = NULL;
+      do
+	{
+	  if (f->len == size)
+	    {
+	      size = size ? 2*size : 65536;
+	      if (!(tmp = whine_realloc(f->data, size)))
+		{
+		  if (f->data)
+		    free(f->data);
+		  close(fd);
+		  return 0;
+		}
+	      f->data = tmp;
+	    }
+	  if ((n = read(fd, f->data + f->len, size - f->len)) > 0)
+	    f->len += n;
+	  else if (n == -1 && errno != EINTR)
+	    {
+	      free(f->data);
+	      close(fd);
+	      return 0;
+	    }
+	}
+      while (n != 0);
+    }
+
+  close(fd);
+  f->pos = f->data;
+  f->end = f->data + f->len;
+  return 1;
+}
+
+static void unmap_hostsfile(struct hostsbuf *f)
+{
+  if (f->mapped)
+    munmap(f->data, f->len);
+  else if (f->data)
+    free(f->data);
+}
+
+static int eatspace(struct hostsbuf *f)
+{
+  int nl = 0;
 
   while (1)
     {
-      if ((c = getc(f)) == '#')
-	while (c != '\n' && c != EOF)
-	  c = getc(f);
+      if (f->pos < f->end && *f->pos == '#')
+	while (f->pos < f->end && *f->pos != '\n')
+	  f->pos++;
       
-      if (c == EOF)
+      if (f->pos == f->end)
 	return 1;
 
-      if (!isspace(c))
-	{
-	  ungetc(c, f);
-	  return nl;
-	}
+      if (!isspace((unsigned char)*f->pos))
+	return nl;
 
-      if (c == '\n')
+      if (*f->pos++ == '\n')
 	nl++;
     }
 }
 	 
-static int gettok(FILE *f, char *token)
+static int gettok(struct hostsbuf *f, char *token)
 {
-  int c, count = 0;
+  int count = 0;
+  char c;
  
   while (1)
     {
-      if ((c = getc(f)) == EOF)
+      if (f->pos == f->end)
 	return (count == 0) ? -1 : 1;
 
-      if (isspace(c) || c == '#')
-	{
-	  ungetc(c, f);
-	  return eatspace(f);
-	}
+      c = *f->pos;
+      if (isspace((unsigned char)c) || c == '#')
+	return eatspace(f);
       
+      f->pos++;
       if (count < (MAXDNAME - 1))
 	{
 	  token[count++] = c;
@@ -1374,16 +1616,35 @@ static int gettok(FILE *f, char *token)
     }
 }
 
+/* Pi-hole modification: estimate the number of names in the hosts files from
+   their sizes */
+static int hosts_names_estimate(void)
+{
+  struct hostsfile *ah;
+  struct stat st;
+  off_t size = 0;
+
+  if (!option_bool(OPT_NO_HOSTS) && stat(HOSTSFILE, &st) == 0 && S_ISREG(st.st_mode))
+    size += st.st_size;
+
+  for (ah = daemon->addn_hosts; ah; ah = ah->next)
+    if (!(ah->flags & AH_INACTIVE) && stat(ah->fname, &st) == 0 && S_ISREG(st.st_mode))
+      size += st.st_size;
+
+  size /= HOSTS_BYTES_PER_NAME;
+  return size > INT_MAX / 2 ? INT_MAX / 2 : (int)size;
+}
+
 int read_hostsfile(char *filename, unsigned int index, int cache_size, struct crec **rhash, int hashsz)
 {  
-  FILE *f = fopen(filename, "r");
+  struct hostsbuf file, *f = &file;
   char *token = daemon->namebuff, *domain_suffix = NULL;
   int names_done = 0, name_count = cache_size, lineno = 1;
   unsigned int flags = 0;
   union all_addr addr;
   int atnl, addrlen = 0;
 
-  if (!f)
+  if (!map_hostsfile(filename, f))
     {
       my_syslog(LOG_ERR, _("failed to load names from %s: %s"), filename, strerror(errno));
       return cache_size;
@@ -1466,7 +1727,7 @@ int read_hostsfile(char *filename, unsigned int index, int cache_size, struct cr
       lineno += atnl;
     } 
 
-  fclose(f);
+  unmap_hostsfile(f);
   
   if (rhash)
     rehash(name_count); 
@@ -1484,7 +1745,7 @@ void cache_reload(void)
   struct host_record *hr;
   struct name_list *nl;
   struct cname *a;
-  struct crec lrec;
+  struct crec lrec, **rhash, **big_rhash = NULL;
   struct mx_srv_record *mx;
   struct txt_record *txt;
   struct interface_name *intr;
@@ -1496,6 +1757,7 @@ void cache_reload(void)
 
   daemon->metrics[METRIC_DNS_CACHE_INSERTED] = 0;
   daemon->metrics[METRIC_DNS_CACHE_LIVE_FREED] = 0;
+  expired_freed = 0; /* Pi-hole modification */
   
   for (i=0; i<hash_size; i++)
     for (cache = hash_table[i], up = &hash_table[i]; cache; cache = tmp)
@@ -1515,8 +1777,10 @@ void cache_reload(void)
 	      {
 		cache->name.bname->next = big_free;
 		big_free = cache->name.bname;
+		bignames_used--; /* Pi-hole modification */
 	      }
 	    cache->flags = 0;
+	    flushed++; /* Pi-hole modification */
 	  }
 	else
 	  up = &cache->hash_next;
@@ -1564,9 +1828,24 @@ void cache_reload(void)
   /* borrow the packet buffer for a temporary by-address hash */
   memset(daemon->packet, 0, daemon->packet_buff_sz);
   revhashsz = daemon->packet_buff_sz / sizeof(struct crec *);
+  rhash = (struct crec **)daemon->packet;
   /* we overwrote the buffer... */
   daemon->srv_save = NULL;
 
+  /* Pi-hole modification: size the hash tables for the hosts files right
+     away instead of growing them while reading. The packet buffer only
+     has room for a few hundred buckets which is far too few for large
+     files */
+  if ((i = hosts_names_estimate()) > 0)
+    {
+      rehash(total_size + i);
+      if (i / 4 > revhashsz && (big_rhash = whine_malloc((i / 4) * sizeof(struct crec *))))
+	{
+	  rhash = big_rhash;
+	  revhashsz = i / 4;
+	}
+    }
+
   /* Do host_records in config. */
   for (hr = daemon->host_records; hr; hr = hr->next)
     for (nl = hr->names; nl; nl = nl->next)
@@ -1577,7 +1856,7 @@ void cache_reload(void)
 	    cache->name.namep = nl->name;
 	    cache->ttd = hr->ttl;
 	    cache->flags = F_HOSTS | F_IMMORTAL | F_FORWARD | F_REVERSE | F_IPV4 | F_NAMEP | F_CONFIG;
-	    add_hosts_entry(cache, (union all_addr *)&hr->addr, INADDRSZ, SRC_CONFIG, (struct crec **)daemon->packet, revhashsz);
+	    add_hosts_entry(cache, (union all_addr *)&hr->addr, INADDRSZ, SRC_CONFIG, rhash, revhashsz);
 	  }
 
 	if ((hr->flags & HR_6) &&
@@ -1586,7 +1865,7 @@ void cache_reload(void)
 	    cache->name.namep = nl->name;
 	    cache->ttd = hr->ttl;
 	    cache->flags = F_HOSTS | F_IMMORTAL | F_FORWARD | F_REVERSE | F_IPV6 | F_NAMEP | F_CONFIG;
-	    add_hosts_entry(cache, (union all_addr *)&hr->addr6, IN6ADDRSZ, SRC_CONFIG, (struct crec **)daemon->packet, revhashsz);
+	    add_hosts_entry(cache, (union all_addr *)&hr->addr6, IN6ADDRSZ, SRC_CONFIG, rhash, revhashsz);
 	  }
       }
 	
@@ -1598,12 +1877,12 @@ void cache_reload(void)
   else
     {
       if (!option_bool(OPT_NO_HOSTS))
-	total_size = read_hostsfile(HOSTSFILE, SRC_HOSTS, total_size, (struct crec **)daemon->packet, revhashsz);
+	total_size = read_hostsfile(HOSTSFILE, SRC_HOSTS, total_size, rhash, revhashsz);
       
       daemon->addn_hosts = expand_filelist(daemon->addn_hosts);
       for (ah = daemon->addn_hosts; ah; ah = ah->next)
 	if (!(ah->flags & AH_INACTIVE))
-	  total_size = read_hostsfile(ah->fname, ah->index, total_size, (struct crec **)daemon->packet, revhashsz);
+	  total_size = read_hostsfile(ah->fname, ah->index, total_size, rhash, revhashsz);
     }
   
   /* Make non-terminal records for all locally-define RRs */
@@ -1640,8 +1919,12 @@ void cache_reload(void)
     }
   
 #ifdef HAVE_INOTIFY
-  set_dynamic_inotify(AH_HOSTS, total_size, (struct crec **)daemon->packet, revhashsz);
+  set_dynamic_inotify(AH_HOSTS, total_size, rhash, revhashsz);
 #endif
+
+  /* Pi-hole modification */
+  if (big_rhash)
+    free(big_rhash);
   
 } 
 
@@ -2111,6 +2394,19 @@ void get_dnsmasq_metrics(struct metrics *ci)
   ci->dns.cache.size = daemon->cachesize;
   ci->dns.cache.inserted = daemon->metrics[METRIC_DNS_CACHE_INSERTED];
   ci->dns.cache.live_freed = daemon->metrics[METRIC_DNS_CACHE_LIVE_FREED];
+  ci->dns.cache.expired_freed = expired_freed;
+  ci->dns.cache.flushed = flushed;
+  blockdata_stats(&ci->dns.blockdata.used, &ci->dns.blockdata.hwm, &ci->dns.blockdata.allocated);
+  ci->dns.bignames.used = bignames_used;
+  ci->dns.bignames.hwm = bignames_hwm;
+  ci->dns.bignames.allocated = bignames_alloced;
+  for (struct frec *f = daemon->frec_list; f; f = f->next)
+    {
+      ci->dns.frecs.allocated++;
+      if (f->sentto)
+	ci->dns.frecs.used++;
+    }
+  ci->dns.frecs.hwm = daemon->frec_hwm;
   ci->dns.local_answered = daemon->metrics[METRIC_DNS_LOCAL_ANSWERED];
   ci->dns.stale_answered = daemon->metrics[METRIC_DNS_STALE_ANSWERED];
   ci->dns.auth_answered = daemon->metrics[METRIC_DNS_AUTH_ANSWERED];
@@ -2177,6 +2473,338 @@ void get_dnsmasq_metrics(struct metrics *ci)
 }
 /********************************************************/
 
+/* Pi-hole modification: save the cache content to a file and restore it from
+   there. Records are stored in the native layout of this binary, files
+   written by a different version are ignored. */
+#define CACHE_FILE_MAGIC 0x46544c43 /* "FTLC" */
+#define CACHE_FILE_VERSION 1
+/* Upper limit for the size of a cache file we are willing to read */
+#define CACHE_FILE_MAX (64*1024*1024)
+/* Maximum length of the CNAME chains which are restored */
+#define CACHE_FILE_CNAME_PASSES 8
+
+struct cache_file_header {
+  u32 magic;
+  u32 version;
+  u32 addrsize;
+  u32 records;
+};
+
+/* Followed by the name, the data of block records or the name of the
+   target of a CNAME */
+struct cache_file_record {
+  time_t ttd;
+  unsigned int flags;
+  unsigned int ttl;
+  u16 class;
+  u16 namelen;
+  u16 datalen;
+  u16 target_rrtype;
+  unsigned int target_flags;
+  union all_addr addr;
+};
+
+#define CACHE_TYPE_FLAGS (F_IPV4 | F_IPV6 | F_CNAME | F_RR | F_DS | F_DNSKEY)
+
+static unsigned short crec_rrtype(const struct crec *crecp)
+{
+  if (!(crecp->flags & F_RR))
+    return 0;
+  return (crecp->flags & F_KEYTAG) ? crecp->addr.rrblock.rrtype : crecp->addr.rrdata.rrtype;
+}
+
+/* Length of the data kept in a blockdata chain for this record */
+static size_t crec_blocklen(unsigned int flags, const union all_addr *addr)
+{
+  if ((flags & F_RR) && !(flags & F_NEG) && (flags & F_KEYTAG))
+    return addr->rrblock.datalen;
+#ifdef HAVE_DNSSEC
+  if (flags & F_DNSKEY)
+    return addr->key.keylen;
+  if ((flags & F_DS) && !(flags & F_NEG))
+    return addr->ds.keylen;
+#endif
+  return 0;
+}
+
+static struct blockdata *crec_block(struct crec *crecp)
+{
+  if ((crecp->flags & F_RR) && !(crecp->flags & F_NEG) && (crecp->flags & F_KEYTAG))
+    return crecp->addr.rrblock.rrdata;
+#ifdef HAVE_DNSSEC
+  if (crecp->flags & F_DNSKEY)
+    return crecp->addr.key.keydata;
+  if ((crecp->flags & F_DS) && !(crecp->flags & F_NEG))
+    return crecp->addr.ds.keydata;
+#endif
+  return NULL;
+}
+
+static void set_crec_block(unsigned int flags, union all_addr *addr, struct blockdata *block)
+{
+  if ((flags & F_RR) && !(flags & F_NEG) && (flags & F_KEYTAG))
+    addr->rrblock.rrdata = block;
+#ifdef HAVE_DNSSEC
+  else if (flags & F_DNSKEY)
+    addr->key.keydata = block;
+  else if ((flags & F_DS) && !(flags & F_NEG))
+    addr->ds.keydata = block;
+#endif
+}
+
+/* Write all records received from upstream servers which can still be used
+   to the file at path. CNAMEs follow all other records so their targets exist when they
+   are restored. Returns the number of records written or -1 on error */
+int cache_save(const char *path, time_t now)
+{
+  struct cache_file_header header = { CACHE_FILE_MAGIC, CACHE_FILE_VERSION, sizeof(union all_addr), 0 };
+  struct crec *crecp;
+  int i, pass, ok = 0;
+  FILE *fp;
+
+  if (!(fp = fopen(path, "w")))
+    return -1;
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    goto end;
+
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < hash_size; i++)
+      for (crecp = hash_table[i]; crecp; crecp = crecp->hash_next)
+	{
+	  struct cache_file_record record;
+	  const char *name = cache_get_name(crecp);
+	  const char *target = NULL;
+	  struct blockdata *block;
+
+	  if ((crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG | F_IMMORTAL)) ||
+	      !(crecp->flags & (F_FORWARD | F_REVERSE)) ||
+	      !(crecp->flags & CACHE_TYPE_FLAGS) ||
+	      is_expired(now, crecp) || is_outdated_cname_pointer(crecp) ||
+	      (pass == 0) == ((crecp->flags & F_CNAME) != 0))
+	    continue;
+
+	  memset(&record, 0, sizeof(record));
+	  record.ttd = crecp->ttd;
+	  record.flags = crecp->flags & ~(F_BIGNAME | F_NAMEP);
+	  record.ttl = crecp->ttl;
+	  record.class = (crecp->flags & (F_DS | F_DNSKEY)) ? crecp->uid : C_IN;
+	  record.namelen = strlen(name);
+
+	  if (crecp->flags & F_CNAME)
+	    {
+	      struct crec *tcrec = crecp->addr.cname.target.cache;
+	      if (crecp->addr.cname.is_name_ptr || !tcrec)
+		continue;
+	      target = cache_get_name(tcrec);
+	      record.datalen = strlen(target);
+	      record.target_flags = tcrec->flags & CACHE_TYPE_FLAGS;
+	      record.target_rrtype = crec_rrtype(tcrec);
+	    }
+	  else
+	    {
+	      record.addr = crecp->addr;
+	      record.datalen = crec_blocklen(crecp->flags, &crecp->addr);
+	      if (record.datalen > daemon->packet_buff_sz)
+		continue;
+	    }
+
+	  if (fwrite(&record, sizeof(record), 1, fp) != 1 ||
+	      fwrite(name, 1, record.namelen, fp) != record.namelen)
+	    goto end;
+
+	  if (target)
+	    {
+	      if (fwrite(target, 1, record.datalen, fp) != record.datalen)
+		goto end;
+	    }
+	  else if (record.datalen > 0 && (block = crec_block(crecp)))
+	    {
+	      blockdata_retrieve(block, record.datalen, daemon->packet);
+	      if (fwrite(daemon->packet, 1, record.datalen, fp) != record.datalen)
+		goto end;
+	    }
+
+	  header.records++;
+	}
+
+  /* Store the final number of records */
+  ok = fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+
+ end:
+  if (fclose(fp) != 0)
+    ok = 0;
+
+  return ok ? (int)header.records : -1;
+}
+
+/* Find the record a restored CNAME points to */
+static struct crec *find_cname_target(char *name, unsigned int flags, unsigned short rrtype)
+{
+  struct crec *crecp;
+
+  for (crecp = *hash_bucket(name); crecp; crecp = crecp->hash_next)
+    if ((crecp->flags & F_FORWARD) &&
+	!(crecp->flags & (F_HOSTS | F_DHCP | F_CONFIG)) &&
+	(crecp->flags & CACHE_TYPE_FLAGS) == flags &&
+	crec_rrtype(crecp) == rrtype &&
+	hostname_isequal(cache_get_name(crecp), name))
+      return crecp;
+
+  return NULL;
+}
+
+/* Insert a single record read from a cache file. Returns 1 if it was inserted */
+static int restore_record(const struct cache_file_record *record, const unsigned char *name,
+			  const unsigned char *data, time_t now)
+{
+  union all_addr addr = record->addr;
+  struct blockdata *block = NULL;
+  struct crec *crecp, *target = NULL, expiry;
+  unsigned long ttl;
+
+  /* Discard records which expired in the meantime */
+  expiry.flags = record->flags;
+  expiry.ttd = record->ttd;
+  if (is_expired(now, &expiry))
+    return 0;
+  ttl = difftime(record->ttd, now) > 0 ? (unsigned long)difftime(record->ttd, now) : 0;
+
+  memcpy(daemon->namebuff, name, record->namelen);
+  daemon->namebuff[record->namelen] = 0;
+
+  if (record->flags & F_CNAME)
+    {
+      memcpy(daemon->workspacename, data, record->datalen);
+      daemon->workspacename[record->datalen] = 0;
+      if (!(target = find_cname_target(daemon->workspacename, record->target_flags, record->target_rrtype)))
+	return 0;
+    }
+  else if (record->datalen > 0)
+    {
+      if (!(block = blockdata_alloc((char *)data, record->datalen)))
+	return 0;
+      set_crec_block(record->flags, &addr, block);
+    }
+
+  cache_start_insert();
+  if (!(crecp = really_insert(daemon->namebuff, (record->flags & F_CNAME) ? NULL : &addr,
+			      record->class, now, ttl, record->flags)))
+    {
+      blockdata_free(block);
+      cache_start_insert();
+      return 0;
+    }
+
+  /* Keep the original expiry (records may be served stale) and TTL */
+  crecp->ttd = record->ttd;
+  crecp->ttl = record->ttl;
+
+  if (target)
+    {
+      next_uid(target);
+      crecp->addr.cname.is_name_ptr = 0;
+      crecp->addr.cname.target.cache = target;
+      crecp->addr.cname.uid = target->uid;
+    }
+
+  cache_end_insert();
+  return 1;
+}
+
+/* Insert the records of a file written by cache_save(). Returns the number of
+   restored records or -1 on error */
+int cache_restore(const char *path, time_t now)
+{
+  struct cache_file_header header;
+  unsigned char *buffer = NULL, **pending = NULL;
+  int restored = -1, npending = 0, pass;
+  size_t len, pos;
+  struct stat st;
+  u32 i;
+  FILE *fp;
+
+  if (!(fp = fopen(path, "r")))
+    return -1;
+
+  if (fstat(fileno(fp), &st) != 0)
+    goto end;
+
+  if (st.st_size < (off_t)sizeof(header) || st.st_size > CACHE_FILE_MAX)
+    {
+      errno = EINVAL;
+      goto end;
+    }
+
+  len = st.st_size;
+  if (!(buffer = whine_malloc(len)) || fread(buffer, 1, len, fp) != len)
+    goto end;
+
+  memcpy(&header, buffer, sizeof(header));
+  if (header.magic != CACHE_FILE_MAGIC || header.version != CACHE_FILE_VERSION ||
+      header.addrsize != sizeof(union all_addr) ||
+      !(pending = whine_malloc((header.records > 0 ? header.records : 1) * sizeof(*pending))))
+    {
+      errno = EINVAL;
+      goto end;
+    }
+
+  /* Insert all records but CNAMEs, which need their targets to exist */
+  restored = 0;
+  for (i = 0, pos = sizeof(header); i < header.records; i++)
+    {
+      struct cache_file_record record;
+
+      if (len - pos < sizeof(record))
+	break;
+      memcpy(&record, buffer + pos, sizeof(record));
+      if (len - pos - sizeof(record) < (size_t)record.namelen + record.datalen ||
+	  record.namelen > MAXDNAME ||
+	  ((record.flags & F_CNAME) && record.datalen > MAXDNAME) ||
+	  crec_blocklen(record.flags, &record.addr) != ((record.flags & F_CNAME) ? 0 : record.datalen))
+	break;
+
+      if (record.flags & F_CNAME)
+	pending[npending++] = buffer + pos;
+      else
+	restored += restore_record(&record, buffer + pos + sizeof(record),
+				   buffer + pos + sizeof(record) + record.namelen, now);
+
+      pos += sizeof(record) + record.namelen + record.datalen;
+    }
+
+  /* CNAMEs pointing to other CNAMEs need their target to be restored first */
+  for (pass = 0; pass < CACHE_FILE_CNAME_PASSES && npending > 0; pass++)
+    {
+      int left = 0, j;
+
+      for (j = 0; j < npending; j++)
+	{
+	  struct cache_file_record record;
+	  memcpy(&record, pending[j], sizeof(record));
+	  if (restore_record(&record, pending[j] + sizeof(record),
+			     pending[j] + sizeof(record) + record.namelen, now))
+	    restored++;
+	  else
+	    pending[left++] = pending[j];
+	}
+
+      if (left == npending)
+	break;
+      npending = left;
+    }
+
+ end:
+  if (pending)
+    free(pending);
+  if (buffer)
+    free(buffer);
+  fclose(fp);
+
+  return restored;
+}
+/********************************************************/
+
 void dump_cache(time_t now)
 {
   struct server *serv, *serv1;
@@ -2327,6 +2955,18 @@ char *querystr(char *desc, unsigned short type)
   return buff ? buff : "";
 }
 
+/* Pi-hole modification: get the type for a name, 0 if it is unknown */
+unsigned short querytype(const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; i < (sizeof(typestr)/sizeof(typestr[0])); i++)
+    if (strcasecmp(typestr[i].name, name) == 0)
+      return typestr[i].type;
+
+  return 0;
+}
+
 /**** Pi-hole modified: removed static and added prototype to dnsmasq.h ****/
 const char *edestr(int ede)
 {
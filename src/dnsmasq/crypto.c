@@ -15,6 +15,8 @@
 */
 
 #include "dnsmasq.h"
+/* Pi-hole modification */
+#include "dnsmasq_interface.h"
 
 #if defined(HAVE_DNSSEC)
 
@@ -39,6 +41,8 @@
 #if MIN_VERSION(3, 6)
 #  include <nettle/gostdsa.h>
 #endif
+/* Pi-hole modification */
+#include <nettle/sha2.h>
 
 #if MIN_VERSION(3, 1)
 /* Implement a "hash-function" to the nettle API, which simply returns
@@ -400,19 +404,74 @@ static int (*verify_func(int algo))(struct blockdata *key_data, unsigned int key
   return NULL;
 }
 
+/* Pi-hole modification: signatures which have been verified successfully
+   are remembered, so a signature contained in many replies (e.g. when the
+   records of signed zones expire from the cache at the same time) costs
+   only one public key operation. Entries are identified by a SHA-256 hash
+   over the algorithm, the key, the signature and the digest of the signed
+   data. The latter includes the validity period of the signature which is
+   checked before verify() is called. Each entry maps onto one slot. */
+#define VERIFY_MEMO_SIZE 1024
+
+static unsigned char (*verify_memo)[SHA256_DIGEST_SIZE] = NULL;
+
+static void verify_memo_update(struct sha256_ctx *ctx, size_t len, const unsigned char *data)
+{
+  unsigned char l[4];
+
+  l[0] = len >> 24;
+  l[1] = len >> 16;
+  l[2] = len >> 8;
+  l[3] = len;
+  sha256_update(ctx, sizeof(l), l);
+  sha256_update(ctx, len, data);
+}
+
 int verify(struct blockdata *key_data, unsigned int key_len, unsigned char *sig, size_t sig_len,
 	   unsigned char *digest, size_t digest_len, int algo)
 {
 
   int (*func)(struct blockdata *key_data, unsigned int key_len, unsigned char *sig, size_t sig_len,
 	      unsigned char *digest, size_t digest_len, int algo);
+  unsigned char id[SHA256_DIGEST_SIZE], a = (unsigned char)algo, *key;
+  struct sha256_ctx ctx;
+  unsigned int slot = 0;
+  int ret;
   
   func = verify_func(algo);
   
   if (!func)
     return 0;
 
-  return (*func)(key_data, key_len, sig, sig_len, digest, digest_len, algo);
+  /* Pi-hole modification */
+  if ((key = blockdata_retrieve(key_data, key_len, NULL)))
+    {
+      sha256_init(&ctx);
+      sha256_update(&ctx, 1, &a);
+      verify_memo_update(&ctx, key_len, key);
+      verify_memo_update(&ctx, sig_len, sig);
+      verify_memo_update(&ctx, digest_len, digest);
+      sha256_digest(&ctx, SHA256_DIGEST_SIZE, id);
+      slot = ((unsigned int)id[0] << 8 | id[1]) % VERIFY_MEMO_SIZE;
+      
+      if (verify_memo && memcmp(verify_memo[slot], id, SHA256_DIGEST_SIZE) == 0)
+	{
+	  FTL_dnssec_signature(true);
+	  return 1;
+	}
+    }
+
+  ret = (*func)(key_data, key_len, sig, sig_len, digest, digest_len, algo);
+
+  /* Pi-hole modification */
+  if (ret)
+    {
+      FTL_dnssec_signature(false);
+      if (key && (verify_memo || (verify_memo = whine_malloc(VERIFY_MEMO_SIZE * SHA256_DIGEST_SIZE))))
+	memcpy(verify_memo[slot], id, SHA256_DIGEST_SIZE);
+    }
+
+  return ret;
 }
 
 /* Note the ds_digest_name(), algo_digest_name() and nsec3_digest_name()
@@ -147,9 +147,178 @@ int pxe_ok(struct dhcp_opt *opt, int pxemode)
   return 0;
 }
 
-struct dhcp_netid *option_filter(struct dhcp_netid *tags, struct dhcp_netid *context_tags, struct dhcp_opt *opts, int pxemode)
+/* Pi-hole modification: the options selected by option_filter() only depend
+   on the set of tags (before and after adding the context tags) and pxemode,
+   not on the order of the tags. With hundreds of tagged options selecting
+   them is costly, so the selection is cached for the most recently seen tag
+   combinations and only restored when a client with the same tags asks again.
+   The cache is flushed whenever options are added or removed. */
+#define FILTER_CACHE_SIZE 256
+
+struct filter_cache {
+  struct dhcp_opt *opts;
+  char *key;
+  size_t keylen;
+  unsigned int hash, used;
+  int nsel;
+  struct dhcp_opt **sel;
+};
+
+static struct filter_cache filter_cache[FILTER_CACHE_SIZE];
+static unsigned int filter_used;
+static char *filter_key;
+static size_t filter_keysize;
+static struct dhcp_netid *filter_tags;
+static int filter_tagsize;
+
+void option_filter_flush(void)
+{
+  int i;
+
+  for (i = 0; i < FILTER_CACHE_SIZE; i++)
+    {
+      free(filter_cache[i].key);
+      free(filter_cache[i].sel);
+    }
+  memset(filter_cache, 0, sizeof(filter_cache));
+}
+
+static int filter_key_add(size_t *len, const char *s, size_t slen)
+{
+  if (*len + slen + 1 > filter_keysize)
+    {
+      size_t size = (*len + slen + 1) * 2;
+      char *key = whine_realloc(filter_key, size);
+
+      if (!key)
+	return 0;
+      filter_key = key;
+      filter_keysize = size;
+    }
+
+  memcpy(filter_key + *len, s, slen);
+  filter_key[*len + slen] = 0;
+  *len += slen + 1;
+  return 1;
+}
+
+/* Append the names of the tags sorted and without duplicates, the set ends
+   with an empty name. */
+static int filter_key_tags(size_t *len, struct dhcp_netid *tags)
+{
+  const char *last = NULL;
+  struct dhcp_netid *t;
+
+  while (1)
+    {
+      const char *next = NULL;
+
+      for (t = tags; t; t = t->next)
+	if ((!last || strcmp(t->net, last) > 0) && (!next || strcmp(t->net, next) < 0))
+	  next = t->net;
+
+      if (!next)
+	return filter_key_add(len, "", 0);
+      if (!filter_key_add(len, next, strlen(next)))
+	return 0;
+      last = next;
+    }
+}
+
+/* Copy of the tags as run_tag_if() on the context tags relinks the tags it
+   sets. Returns NULL if out of memory (or no tags). */
+static struct dhcp_netid *filter_copy_tags(struct dhcp_netid *tags)
+{
+  struct dhcp_netid *t;
+  int n = 0;
+
+  for (t = tags; t; t = t->next)
+    n++;
+
+  if (n > filter_tagsize)
+    {
+      struct dhcp_netid *copy = whine_realloc(filter_tags, n * sizeof(struct dhcp_netid));
+
+      if (!copy)
+	return NULL;
+      filter_tags = copy;
+      filter_tagsize = n;
+    }
+
+  for (n = 0, t = tags; t; t = t->next, n++)
+    {
+      filter_tags[n].net = t->net;
+      filter_tags[n].next = t->next ? &filter_tags[n + 1] : NULL;
+    }
+
+  return n ? filter_tags : NULL;
+}
+
+static struct filter_cache *filter_cache_find(struct dhcp_opt *opts, size_t keylen, unsigned int hash)
+{
+  int i;
+
+  for (i = 0; i < FILTER_CACHE_SIZE; i++)
+    {
+      struct filter_cache *c = &filter_cache[i];
+
+      if (c->key && c->opts == opts && c->hash == hash &&
+	  c->keylen == keylen && memcmp(c->key, filter_key, keylen) == 0)
+	{
+	  c->used = ++filter_used;
+	  return c;
+	}
+    }
+
+  return NULL;
+}
+
+static void filter_cache_store(struct dhcp_opt *opts, size_t keylen, unsigned int hash)
+{
+  struct filter_cache *c = &filter_cache[0];
+  struct dhcp_opt *opt, **sel;
+  char *key;
+  int i, nsel = 0;
+
+  for (opt = opts; opt; opt = opt->next)
+    if (opt->flags & DHOPT_TAGOK)
+      nsel++;
+
+  if (!(key = whine_malloc(keylen)))
+    return;
+  if (!(sel = whine_malloc((nsel ? nsel : 1) * sizeof(struct dhcp_opt *))))
+    {
+      free(key);
+      return;
+    }
+
+  /* replace the least recently used entry */
+  for (i = 1; i < FILTER_CACHE_SIZE; i++)
+    if (!filter_cache[i].key || (c->key && filter_cache[i].used < c->used))
+      c = &filter_cache[i];
+  free(c->key);
+  free(c->sel);
+
+  memcpy(key, filter_key, keylen);
+  for (nsel = 0, opt = opts; opt; opt = opt->next)
+    if (opt->flags & DHOPT_TAGOK)
+      sel[nsel++] = opt;
+
+  c->opts = opts;
+  c->key = key;
+  c->keylen = keylen;
+  c->hash = hash;
+  c->used = ++filter_used;
+  c->nsel = nsel;
+  c->sel = sel;
+}
+
+/* The original option_filter(). The context tags are added unless
+   context_tagif has already been set up from them. */
+static struct dhcp_netid *filter_options(struct dhcp_netid *tagif, struct dhcp_netid *tags,
+					 struct dhcp_netid *context_tags, struct dhcp_netid *context_tagif,
+					 struct dhcp_opt *opts, int pxemode)
 {
-  struct dhcp_netid *tagif = run_tag_if(tags);
   struct dhcp_opt *opt;
   struct dhcp_opt *tmp;  
   
@@ -167,11 +336,16 @@ struct dhcp_netid *option_filter(struct dhcp_netid *tags, struct dhcp_netid *con
      otherwise valid options are inhibited if we found a higher priority one above */
   if (context_tags)
     {
-      struct dhcp_netid *last_tag;
-
-      for (last_tag = context_tags; last_tag->next; last_tag = last_tag->next);
-      last_tag->next = tags;
-      tagif = run_tag_if(context_tags);
+      if (context_tagif)
+	tagif = context_tagif;
+      else
+	{
+	  struct dhcp_netid *last_tag;
+	  
+	  for (last_tag = context_tags; last_tag->next; last_tag = last_tag->next);
+	  last_tag->next = tags;
+	  tagif = run_tag_if(context_tags);
+	}
       
       /* reset stuff with tag:!<tag> which now matches. */
       for (opt = opts; opt; opt = opt->next)
@@ -218,6 +392,53 @@ struct dhcp_netid *option_filter(struct dhcp_netid *tags, struct dhcp_netid *con
   
   return tagif;
 }
+
+struct dhcp_netid *option_filter(struct dhcp_netid *tags, struct dhcp_netid *context_tags, struct dhcp_opt *opts, int pxemode)
+{
+  struct dhcp_netid *tagif = run_tag_if(tags), *context_tagif = NULL;
+  struct filter_cache *cached;
+  unsigned int hash = 2166136261u;
+  unsigned char mode = pxemode;
+  size_t i, keylen = 0;
+  int j;
+
+  /* Pi-hole modification: the tags are copied before adding the context
+     tags as run_tag_if() relinks the tags it sets */
+  if (!filter_key_add(&keylen, (char *)&mode, 1) || !filter_key_tags(&keylen, tagif) ||
+      (context_tags && tagif && !(tagif = filter_copy_tags(tagif))))
+    return filter_options(run_tag_if(tags), tags, context_tags, NULL, opts, pxemode);
+
+  if (context_tags)
+    {
+      struct dhcp_netid *last_tag;
+
+      for (last_tag = context_tags; last_tag->next; last_tag = last_tag->next);
+      last_tag->next = tags;
+      context_tagif = run_tag_if(context_tags);
+      if (!filter_key_tags(&keylen, context_tagif))
+	return filter_options(tagif, tags, context_tags, context_tagif, opts, pxemode);
+    }
+
+  for (i = 0; i < keylen; i++)
+    hash = (hash ^ (unsigned char)filter_key[i]) * 16777619u;
+
+  if ((cached = filter_cache_find(opts, keylen, hash)))
+    {
+      struct dhcp_opt *opt;
+
+      for (opt = opts; opt; opt = opt->next)
+	opt->flags &= ~DHOPT_TAGOK;
+      for (j = 0; j < cached->nsel; j++)
+	cached->sel[j]->flags |= DHOPT_TAGOK;
+
+      return context_tags ? context_tagif : tagif;
+    }
+
+  tagif = filter_options(tagif, tags, context_tags, context_tagif, opts, pxemode);
+  filter_cache_store(opts, keylen, hash);
+
+  return tagif;
+}
 	
 /* Is every member of check matched by a member of pool? 
    If tagnotneeded, untagged is OK */
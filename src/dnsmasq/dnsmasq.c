@@ -36,6 +36,17 @@ struct daemon *daemon;
 static volatile pid_t pid = 0;
 static volatile int pipewrite;
 
+/* Pi-hole modification: additional processes receiving UDP queries */
+static pid_t *udp_worker_pids = NULL;
+static unsigned int udp_worker_count = 0;
+static unsigned int udp_worker_index = 0; /* 0 in the main process */
+/* Pi-hole modification: pool of processes accepting TCP connections */
+static pid_t *tcp_worker_pids = NULL;
+static int *tcp_worker_pipes = NULL;
+static unsigned int tcp_worker_count = 0;
+static int tcp_workers_missing = 0;
+static int workers_stale = 0;
+
 static void set_dns_listeners(void);
 #ifdef HAVE_TFTP
 static void set_tftp_listeners(void);
@@ -47,6 +58,14 @@ static void async_event(int pipe, time_t now);
 static void fatal_event(struct event_desc *ev, char *msg);
 static int read_event(int fd, struct event_desc *evp, char **msg);
 static void poll_resolv(int force, int do_reload, time_t now);
+/* Pi-hole modification */
+static void start_udp_workers(time_t now);
+static void stop_udp_workers(void);
+static int udp_worker_exited(pid_t p);
+static void start_tcp_workers(time_t now);
+static void stop_tcp_workers(void);
+static int tcp_worker_exited(pid_t p);
+static int tcp_workers_running(void);
 
 int main_dnsmasq (int argc, char **argv)
 {
@@ -1099,6 +1118,18 @@ int main_dnsmasq (int argc, char **argv)
   while (!killed)
     {
       int timeout = fast_retry(now);
+
+      /* Pi-hole modification: (re)start UDP and TCP workers after changes
+	 of the configuration, the listeners or when one of them died */
+      if (workers_stale && daemon->port != 0)
+	{
+	  workers_stale = 0;
+	  stop_tcp_workers();
+	  start_udp_workers(now);
+	  start_tcp_workers(now);
+	}
+      else if (tcp_workers_missing && daemon->port != 0)
+	start_tcp_workers(now);
       
       poll_reset();
       
@@ -1304,7 +1335,12 @@ int main_dnsmasq (int argc, char **argv)
 #endif
       
       if (daemon->port != 0)
-	check_dns_listeners(now);
+	{
+	  check_dns_listeners(now);
+	  /* Pi-hole modification */
+	  FTL_cache_autosize(now);
+	  FTL_cache_save(now, false);
+	}
 
 #ifdef HAVE_TFTP
       check_tftp_listeners(now);
@@ -1334,6 +1370,12 @@ int main_dnsmasq (int argc, char **argv)
 #endif
 
     }
+
+    /* Pi-hole modification */
+    if (daemon->port != 0)
+      FTL_cache_save(dnsmasq_time(), true);
+    stop_udp_workers();
+    stop_tcp_workers();
     return 0;
 }
 
@@ -1356,8 +1398,12 @@ static void sig_handler(int sig)
       if (sig == SIGALRM)
         {
 	  /*** Pi-hole modification ***/
-	  // TCP workers ignore all signals except SIGALRM
-	  FTL_TCP_worker_terminating(false);
+	  // TCP and UDP workers ignore all signals except SIGALRM,
+	  // workers of the TCP pool terminate like TCP workers
+	  if (udp_worker_index != 0)
+	    FTL_UDP_worker_terminating();
+	  else
+	    FTL_TCP_worker_terminating(false);
 	  /*** Pi-hole modification ***/
 	  _exit(0);
         }
@@ -1582,7 +1628,7 @@ static void async_event(int pipe, time_t now)
 	      if (errno != EINTR)
 		break;
 	    }      
-	  else if (daemon->port != 0)
+	  else if (daemon->port != 0 && !udp_worker_exited(p) && !tcp_worker_exited(p)) /* Pi-hole modification */
 	    for (i = 0 ; i < daemon->max_procs; i++)
 	      if (daemon->tcp_pids[i] == p)
 		{
@@ -1620,6 +1666,13 @@ static void async_event(int pipe, time_t now)
       case EVENT_SIGNAL:
 	log_debug(DEBUG_ANY, "dnsmasq received signal %d", ev.data);
 	break;
+
+	/* Re-read the upstream servers without clearing the cache,
+	   check_servers() restarts the workers */
+      case EVENT_SERVERS:
+	if (daemon->port != 0 && daemon->servers_file)
+	  read_servers_file();
+	break;
   /**************************** */
 
       case EVENT_EXEC_ERR:
@@ -1799,12 +1852,16 @@ static void poll_resolv(int force, int do_reload, time_t now)
 
 void clear_cache_and_reload(time_t now)
 {
-  (void)now;
-
   FTL_dnsmasq_reload();
+  /* Pi-hole modification */
+  reload_workers();
 
   if (daemon->port != 0)
-    cache_reload();
+    {
+      cache_reload();
+      /* Pi-hole modification */
+      FTL_cache_restore(now);
+    }
   
 #ifdef HAVE_DHCP
   if (daemon->dhcp || daemon->doing_dhcp6)
@@ -1878,8 +1935,9 @@ static void set_dns_listeners(void)
       /* Only listen for TCP connections when a process slot
 	 is available. Death of a child goes through the select loop, so
 	 we don't need to explicitly arrange to wake up here,
-	 we'll be called again when a slot becomes available. */
-      if  (listener->tcpfd != -1 && i >= 0)
+	 we'll be called again when a slot becomes available.
+	 Pi-hole modification: leave them to the TCP workers if any */
+      if  (listener->tcpfd != -1 && i >= 0 && !tcp_workers_running())
 	poll_listen(listener->tcpfd, POLLIN);
     }
   
@@ -1887,6 +1945,11 @@ static void set_dns_listeners(void)
     for (i = 0; i < daemon->max_procs; i++)
       if (daemon->tcp_pipes[i] != -1)
 	poll_listen(daemon->tcp_pipes[i], POLLIN);
+
+  /* Pi-hole modification: cache inserts of the TCP workers */
+  for (i = 0; i < (int)tcp_worker_count; i++)
+    if (tcp_worker_pipes[i] != -1)
+      poll_listen(tcp_worker_pipes[i], POLLIN);
 }
 
 static void check_dns_listeners(time_t now)
@@ -1924,6 +1987,20 @@ static void check_dns_listeners(time_t now)
 	  return;
 	}
 
+  /* Pi-hole modification: the pipes of the TCP workers stay open as
+     long as the worker is running */
+  for (i = 0; i < (int)tcp_worker_count; i++)
+    if (tcp_worker_pipes[i] != -1 &&
+	poll_check(tcp_worker_pipes[i], POLLIN | POLLHUP))
+      {
+	if (!cache_recv_insert(now, tcp_worker_pipes[i]))
+	  {
+	    close(tcp_worker_pipes[i]);
+	    tcp_worker_pipes[i] = -1;
+	  }
+	return;
+      }
+
   for (serverfdp = daemon->sfds; serverfdp; serverfdp = serverfdp->next)
     if (poll_check(serverfdp->fd, POLLIN))
       {
@@ -1950,7 +2027,13 @@ static void check_dns_listeners(time_t now)
   for (listener = daemon->listeners; listener; listener = listener->next)
     if (listener->fd != -1 && poll_check(listener->fd, POLLIN))
       {
-	receive_query(listener, now); 
+	/* Pi-hole modification: process all queries read in one batch
+	   and send their replies together */
+	FTL_batch_begin();
+	do
+	  receive_query(listener, now);
+	while (FTL_batch_pending(listener->fd));
+	FTL_batch_flush();
 	return;
       }
   
@@ -1963,7 +2046,7 @@ static void check_dns_listeners(time_t now)
     if (daemon->tcp_pids[i] == 0 && daemon->tcp_pipes[i] == -1)
       break;
 
-  if (i >= 0)
+  if (i >= 0 && !tcp_workers_running())
     for (listener = daemon->listeners; listener; listener = listener->next)
       if (listener->tcpfd != -1 && poll_check(listener->tcpfd, POLLIN))
 	{
@@ -1972,9 +2055,398 @@ static void check_dns_listeners(time_t now)
 	}
 }
 
+/**** Pi-hole modification ****/
+/* Additional processes receiving UDP queries. Each worker opens its own
+   sockets for the addresses of all listeners (the kernel distributes
+   the queries among them using SO_REUSEPORT) and has its own cache and
+   forwarding state. Workers (including those of the TCP pool below)
+   are restarted whenever the configuration, the upstream servers or
+   the listeners change. */
+void reload_workers(void)
+{
+  if (pid != 0 && pid == getpid())
+    workers_stale = 1;
+}
+
+static void stop_udp_workers(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < udp_worker_count; i++)
+    if (udp_worker_pids[i] > 0)
+      {
+	kill(udp_worker_pids[i], SIGALRM);
+	while (waitpid(udp_worker_pids[i], NULL, 0) == -1 && errno == EINTR);
+	udp_worker_pids[i] = 0;
+      }
+}
+
+/* Returns 1 if p was a UDP worker, which is then restarted */
+static int udp_worker_exited(pid_t p)
+{
+  unsigned int i;
+
+  for (i = 0; i < udp_worker_count; i++)
+    if (udp_worker_pids[i] == p)
+      {
+	my_syslog(LOG_WARNING, _("UDP worker process %u exited unexpectedly"), (unsigned int)p);
+	udp_worker_pids[i] = 0;
+	workers_stale = 1;
+	return 1;
+      }
+
+  return 0;
+}
+
+static void udp_worker(unsigned int index, unsigned int count, time_t now)
+{
+  struct listener *listener;
+  int i;
+
+  udp_worker_index = index;
+
+  /* Each worker assigns log IDs from its own range so the queries of
+     different processes can be told apart */
+  daemon->log_id = (int)(index * ((unsigned int)INT_MAX / (count + 1)));
+
+  /* The TCP helpers and their pipes belong to the main process */
+  for (i = 0; i < daemon->max_procs; i++)
+    {
+      if (daemon->tcp_pipes[i] != -1)
+	close(daemon->tcp_pipes[i]);
+      daemon->tcp_pipes[i] = -1;
+      daemon->tcp_pids[i] = 0;
+    }
+
+  /* Forget queries in flight in the main process */
+  forget_frecs();
+
+  /* Use own sockets where the kernel supports it, share the listener of
+     the main process otherwise */
+  for (listener = daemon->listeners; listener; listener = listener->next)
+    {
+      int fd = udp_worker_sock(listener);
+      if (fd != -1)
+	{
+	  close(listener->fd);
+	  listener->fd = fd;
+	}
+      if (listener->tcpfd != -1)
+	close(listener->tcpfd);
+      listener->tcpfd = -1;
+      if (listener->tftpfd != -1)
+	close(listener->tftpfd);
+      listener->tftpfd = -1;
+    }
+
+#ifdef HAVE_LINUX_NETWORK
+  /* Terminate when the main process is gone */
+  prctl(PR_SET_PDEATHSIG, SIGALRM);
+#endif
+
+  FTL_UDP_worker_created(index);
+
+  while (1)
+    {
+      int timeout = fast_retry(now);
+      pid_t p;
+
+      /* Reap TCP helpers started for DNSSEC validation */
+      while ((p = waitpid(-1, NULL, WNOHANG)) > 0)
+	for (i = 0; i < daemon->max_procs; i++)
+	  if (daemon->tcp_pids[i] == p)
+	    daemon->tcp_pids[i] = 0;
+
+      poll_reset();
+      set_dns_listeners();
+
+      set_log_writer();
+
+      if (do_poll(timeout) < 0)
+	continue;
+
+      now = dnsmasq_time();
+      check_log_writer(0);
+      check_dns_listeners(now);
+      /* Pi-hole modification */
+      FTL_cache_autosize(now);
+    }
+}
+
+static void start_udp_workers(time_t now)
+{
+  unsigned int i, count = FTL_udp_workers();
+#ifdef HAVE_LINUX_NETWORK
+  unsigned char a = 0;
+#endif
+
+  stop_udp_workers();
+
+  if (count == 0 || option_bool(OPT_DEBUG))
+    return;
+
+  /* Replies to sockets with a fixed source address may be received by
+     any of the processes sharing them */
+  if (daemon->sfds)
+    {
+      my_syslog(LOG_WARNING, _("not starting UDP workers, upstream servers use fixed source addresses"));
+      return;
+    }
+
+  if (!udp_worker_pids)
+    {
+      udp_worker_pids = safe_malloc(count * sizeof(pid_t));
+      memset(udp_worker_pids, 0, count * sizeof(pid_t));
+      udp_worker_count = count;
+    }
+
+  for (i = 0; i < udp_worker_count; i++)
+    {
+      pid_t p;
+      int pipefd[2];
+
+      if (pipe(pipefd) != 0)
+	break;
+
+      if ((p = fork()) == -1)
+	{
+	  close(pipefd[0]);
+	  close(pipefd[1]);
+	  break;
+	}
+
+      if (p != 0)
+	{
+	  /* parent, see do_tcp_connection() for the netlink race */
+	  close(pipefd[1]);
+#ifdef HAVE_LINUX_NETWORK
+	  read_write(pipefd[0], &a, 1, RW_READ);
+#endif
+	  close(pipefd[0]);
+	  udp_worker_pids[i] = p;
+	  continue;
+	}
+
+      /* child: use our own netlink socket */
+      close(pipefd[0]);
+#ifdef HAVE_LINUX_NETWORK
+      close(daemon->netlinkfd);
+      read_write(pipefd[1], &a, 1, RW_WRITE);
+      netlink_init();
+#endif
+      close(pipefd[1]);
+
+      udp_worker(i + 1, udp_worker_count, now);
+      _exit(0);
+    }
+
+  my_syslog(LOG_INFO, _("started %u UDP workers"), i);
+}
+
+/* Pool of processes accepting TCP connections on the listeners of the
+   main process. Unlike the TCP helpers forked for every connection,
+   they are kept running and handle one connection after another with
+   their database connections, cache and connections to the upstream
+   servers still open. Cache inserts are sent to the main process as
+   usual, the pipe stays open as long as the worker is running. A
+   worker running into CHILD_LIFETIME is replaced by a new one. */
+static int tcp_workers_running(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < tcp_worker_count; i++)
+    if (tcp_worker_pids[i] > 0)
+      return 1;
+
+  return 0;
+}
+
+static void stop_tcp_workers(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < tcp_worker_count; i++)
+    {
+      if (tcp_worker_pids[i] > 0)
+	{
+	  kill(tcp_worker_pids[i], SIGALRM);
+	  while (waitpid(tcp_worker_pids[i], NULL, 0) == -1 && errno == EINTR);
+	  tcp_worker_pids[i] = 0;
+	}
+      if (tcp_worker_pipes[i] != -1)
+	{
+	  close(tcp_worker_pipes[i]);
+	  tcp_worker_pipes[i] = -1;
+	}
+    }
+
+  tcp_workers_missing = 0;
+}
+
+/* Returns 1 if p was a TCP worker, which is then replaced */
+static int tcp_worker_exited(pid_t p)
+{
+  unsigned int i;
+
+  for (i = 0; i < tcp_worker_count; i++)
+    if (tcp_worker_pids[i] == p)
+      {
+	tcp_worker_pids[i] = 0;
+	tcp_workers_missing = 1;
+	return 1;
+      }
+
+  return 0;
+}
+
+static void tcp_worker(unsigned int index, unsigned int count, int pipefd, time_t now)
+{
+  struct listener *listener;
+  unsigned int j;
+  int i;
+
+  /* See udp_worker(), TCP queries are told apart from UDP queries by FTL
+     anyway */
+  daemon->log_id = (int)(index * ((unsigned int)INT_MAX / (count + 1)));
+
+  /* The TCP helpers and the pipes of the other workers belong to the
+     main process */
+  for (i = 0; i < daemon->max_procs; i++)
+    {
+      if (daemon->tcp_pipes[i] != -1)
+	close(daemon->tcp_pipes[i]);
+      daemon->tcp_pipes[i] = -1;
+      daemon->tcp_pids[i] = 0;
+    }
+  for (j = 0; j < tcp_worker_count; j++)
+    {
+      if (tcp_worker_pipes[j] != -1)
+	close(tcp_worker_pipes[j]);
+      tcp_worker_pipes[j] = -1;
+      tcp_worker_pids[j] = 0;
+    }
+  tcp_worker_count = 0;
+
+#ifdef HAVE_LINUX_NETWORK
+  /* Terminate when the main process is gone */
+  prctl(PR_SET_PDEATHSIG, SIGALRM);
+#endif
+
+  daemon->pipe_to_parent = pipefd;
+  FTL_TCP_pool_worker_created(index);
+
+  while (1)
+    {
+      poll_reset();
+      for (listener = daemon->listeners; listener; listener = listener->next)
+	if (listener->tcpfd != -1)
+	  poll_listen(listener->tcpfd, POLLIN);
+
+      if (do_poll(-1) < 0)
+	continue;
+
+      now = dnsmasq_time();
+      enumerate_interfaces(1);
+
+      /* All workers are woken up, accept() fails in all but one of them
+	 as the listening sockets are non-blocking */
+      for (listener = daemon->listeners; listener; listener = listener->next)
+	if (listener->tcpfd != -1 && poll_check(listener->tcpfd, POLLIN))
+	  do_tcp_connection(listener, now, -1);
+    }
+}
+
+/* Fork workers for all free places of the pool */
+static void start_tcp_workers(time_t now)
+{
+  unsigned int i, started = 0, count = FTL_tcp_workers();
+#ifdef HAVE_LINUX_NETWORK
+  unsigned char a = 0;
+#endif
+
+  tcp_workers_missing = 0;
+
+  if (count == 0 || option_bool(OPT_DEBUG))
+    return;
+
+  if (!tcp_worker_pids)
+    {
+      tcp_worker_pids = safe_malloc(count * sizeof(pid_t));
+      tcp_worker_pipes = safe_malloc(count * sizeof(int));
+      for (i = 0; i < count; i++)
+	{
+	  tcp_worker_pids[i] = 0;
+	  tcp_worker_pipes[i] = -1;
+	}
+      tcp_worker_count = count;
+    }
+
+  for (i = 0; i < tcp_worker_count; i++)
+    {
+      pid_t p;
+      int pipefd[2];
+
+      if (tcp_worker_pids[i] != 0)
+	continue;
+
+      /* The last cache inserts of the previous worker may still be
+	 waiting to be read */
+      if (tcp_worker_pipes[i] != -1)
+	{
+	  while (cache_recv_insert(now, tcp_worker_pipes[i]));
+	  close(tcp_worker_pipes[i]);
+	  tcp_worker_pipes[i] = -1;
+	}
+
+      if (pipe(pipefd) != 0)
+	{
+	  tcp_workers_missing = 1;
+	  break;
+	}
+
+      if ((p = fork()) == -1)
+	{
+	  close(pipefd[0]);
+	  close(pipefd[1]);
+	  tcp_workers_missing = 1;
+	  break;
+	}
+
+      if (p != 0)
+	{
+	  /* parent, see do_tcp_connection() for the netlink race */
+	  close(pipefd[1]);
+#ifdef HAVE_LINUX_NETWORK
+	  read_write(pipefd[0], &a, 1, RW_READ);
+#endif
+	  tcp_worker_pids[i] = p;
+	  tcp_worker_pipes[i] = pipefd[0];
+	  started++;
+	  continue;
+	}
+
+      /* child: use our own netlink socket */
+      close(pipefd[0]);
+#ifdef HAVE_LINUX_NETWORK
+      close(daemon->netlinkfd);
+      read_write(pipefd[1], &a, 1, RW_WRITE);
+      netlink_init();
+#endif
+
+      tcp_worker(i + 1, tcp_worker_count, pipefd[1], now);
+      _exit(0);
+    }
+
+  if (started != 0)
+    my_syslog(LOG_INFO, _("started %u TCP workers"), started);
+}
+/******************************/
+
+/* Pi-hole modification: slot is -1 in the workers of the TCP pool,
+   which handle the connection themselves instead of forking */
 static void do_tcp_connection(struct listener *listener, time_t now, int slot)
 {
-  int confd, client_ok = 1;
+  int confd, client_ok = 1, pooled = (slot == -1);
   struct irec *iface = NULL;
   pid_t p;
   union mysockaddr tcp_addr;
@@ -2063,7 +2535,7 @@ static void do_tcp_connection(struct listener *listener, time_t now, int slot)
   if (!client_ok)
     goto closeconandreturn;
   
-  if (!option_bool(OPT_DEBUG))
+  if (!option_bool(OPT_DEBUG) && !pooled)
     {
       if (pipe(pipefd) == -1)
 	goto closeconandreturn; /* pipe failed */
@@ -2133,7 +2605,9 @@ static void do_tcp_connection(struct listener *listener, time_t now, int slot)
   
   /* Arrange for SIGALRM after CHILD_LIFETIME seconds to
      terminate the process. */
-  if (!option_bool(OPT_DEBUG))
+  if (pooled)
+    alarm(CHILD_LIFETIME); /* Pi-hole modification: the pool replaces us */
+  else if (!option_bool(OPT_DEBUG))
     {
 #ifdef HAVE_LINUX_NETWORK
       /* See comment above re: netlink socket. */
@@ -2152,7 +2626,8 @@ static void do_tcp_connection(struct listener *listener, time_t now, int slot)
     while(retry_send(fcntl(confd, F_SETFL, flags & ~O_NONBLOCK)));
 
   /************ Pi-hole modification ************/
-  FTL_TCP_worker_created(confd);
+  if (!pooled)
+    FTL_TCP_worker_created(confd);
   // Store interface this fork is handling exclusively
   FTL_iface(iface, NULL, 0);
   /**********************************************/
@@ -2160,6 +2635,19 @@ static void do_tcp_connection(struct listener *listener, time_t now, int slot)
   buff = tcp_request(confd, now, &tcp_addr, netmask, auth_dns);
 
   /************ Pi-hole modification ************/
+  if (pooled)
+    {
+      // Keep the connections to the upstream servers open for the
+      // next client
+      alarm(0);
+      if (buff)
+	free(buff);
+#ifdef HAVE_DNSSEC
+      cache_update_hwm();
+#endif
+      return;
+    }
+
   FTL_TCP_worker_terminating(true);
   /**********************************************/
 	      
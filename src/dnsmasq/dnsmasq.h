@@ -203,6 +203,7 @@ struct event_desc {
 #define EVENT_TIME       26
 
 // Pi-hole
+#define EVENT_SERVERS    254
 #define EVENT_SIGNAL     255
 
 /* Exit codes. */
@@ -507,6 +508,7 @@ struct crec {
   /* used as class if DNSKEY/DS, index to source for F_HOSTS */
   unsigned int uid; 
   unsigned int flags;
+  unsigned int ttl; /* Pi-hole modification: TTL at insertion */
   union {
     char sname[SMALLDNAME];
     union bigname *bname;
@@ -627,6 +629,7 @@ struct server {
   unsigned int ifindex; /* corresponding to interface, above */
   struct serverfd *sfd; 
   int tcpfd;
+  time_t tcp_used; /* Pi-hole modification: last reply on tcpfd */
   unsigned int queries, failed_queries, nxdomain_replies, retrys;
   unsigned int query_latency, mma_latency;
   time_t forwardtime;
@@ -861,6 +864,7 @@ struct frec {
 #define LEASE_TA            64  /* IPv6 temporary lease */
 #define LEASE_HAVE_HWADDR  128  /* Have set hwaddress */
 #define LEASE_EXP_CHANGED  256  /* Lease expiry time changed */
+#define LEASE_JOURNAL      512  /* Pi-hole modification: not yet appended to the lease file */
 
 #define LIMIT_SIG_FAIL    0
 #define LIMIT_CRYPTO      1
@@ -900,6 +904,9 @@ struct dhcp_lease {
   int vendorclass_count;
 #endif
   struct dhcp_lease *next;
+  /* Pi-hole modification: hash chains of the lease indexes */
+  struct dhcp_lease *clid_next, *hwaddr_next, *addr_next;
+  unsigned int serial;
 };
 
 struct dhcp_netid {
@@ -1287,6 +1294,7 @@ extern struct daemon {
   struct frec *frec_list;
   struct frec_src *free_frec_src;
   int frec_src_count;
+  unsigned int frec_hwm; /* Pi-hole modification */
   struct serverfd *sfds;
   struct irec *interfaces;
   struct listener *listeners;
@@ -1374,6 +1382,11 @@ void next_uid(struct crec *crecp);
 #define log_query(flags,name,addr,arg,type) _log_query(flags, name, addr, arg, type, __FILE__, __LINE__)
 void _log_query(unsigned int flags, char *name, union all_addr *addr, char *arg, unsigned short type, const char* file, const int line);
 #include "../metrics.h"
+int cache_grow(int count);
+int cache_shrink(time_t now);
+int cache_live_entries(time_t now);
+int cache_save(const char *path, time_t now);
+int cache_restore(const char *path, time_t now);
 /******************************************************************************************************************/
 char *record_source(unsigned int index);
 int cache_find_non_terminal(char *name, time_t now);
@@ -1412,6 +1425,8 @@ int read_hostsfile(char *filename, unsigned int index, int cache_size,
 /* blockdata.c */
 void blockdata_init(void);
 void blockdata_report(void);
+/* Pi-hole modification */
+void blockdata_stats(unsigned int *used, unsigned int *hwm, unsigned int *alloced);
 struct blockdata *blockdata_alloc(char *data, size_t len);
 int blockdata_expand(struct blockdata *block, size_t oldlen,
 		     char *data, size_t newlen);
@@ -1430,6 +1445,7 @@ int is_rev_synth(int flag, union all_addr *addr, char *name);
 int do_doctor(struct dns_header *header, size_t qlen, char *namebuff);
 int extract_name(struct dns_header *header, size_t plen, unsigned char **pp, 
                  char *name, int func, unsigned int parm);
+extern int extract_name_vector; /* Pi-hole modification */
 unsigned char *skip_name(unsigned char *ansp, struct dns_header *header, size_t plen, int extrabytes);
 unsigned char *skip_questions(struct dns_header *header, size_t plen);
 unsigned char *skip_section(unsigned char *ansp, int count, struct dns_header *header, size_t plen);
@@ -1568,6 +1584,7 @@ int option_read_dynfile(char *file, int flags);
 void reply_query(int fd, time_t now);
 void receive_query(struct listener *listen, time_t now);
 void return_reply(time_t now, struct frec *forward, struct dns_header *header, ssize_t n, int status);
+void forget_frecs(void); /* Pi-hole modification */
 #ifdef HAVE_DNSSEC
 void pop_and_retry_query(struct frec *forward, int status, time_t now);
 int tcp_from_udp(time_t now, int status, struct dns_header *header, ssize_t *n, 
@@ -1591,6 +1608,7 @@ int local_bind(int fd, union mysockaddr *addr, char *intname, unsigned int ifind
 void pre_allocate_sfds(void);
 int reload_servers(char *fname);
 void check_servers(int no_loop_call);
+int udp_worker_sock(struct listener *listener); /* Pi-hole modification */
 int enumerate_interfaces(int reset);
 void create_wildcard_listeners(void);
 void create_bound_listeners(int dienow);
@@ -1697,6 +1715,7 @@ void queue_event(int event);
 void send_alarm(time_t event, time_t now);
 void send_event(int fd, int event, int data, char *msg);
 void clear_cache_and_reload(time_t now);
+void reload_workers(void); /* Pi-hole modification */
 #ifdef HAVE_DNSSEC
 int swap_to_tcp(struct frec *forward, time_t now, int status, struct dns_header *header,
 		ssize_t *plen, char *name, int class, struct server *server, int *keycount, int *validatecount);
@@ -1840,6 +1859,7 @@ struct dhcp_netid *run_tag_if(struct dhcp_netid *tags);
 int pxe_ok(struct dhcp_opt *opt, int pxemode);
 struct dhcp_netid *option_filter(struct dhcp_netid *tags, struct dhcp_netid *context_tags,
 				 struct dhcp_opt *opts, int pxemode);
+void option_filter_flush(void); /* Pi-hole modification */
 int match_netid(struct dhcp_netid *check, struct dhcp_netid *pool, int tagnotneeded);
 char *strip_hostname(char *hostname);
 void log_tags(struct dhcp_netid *netid, u32 xid);
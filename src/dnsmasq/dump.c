@@ -19,6 +19,8 @@
 #ifdef HAVE_DUMPFILE
 
 #include <netinet/icmp6.h>
+/* Pi-hole modification */
+#include "pcap-writer.h"
 
 static u32 packet_count;
 static void do_dump_packet(int mask, void *packet, size_t len,
@@ -89,6 +91,9 @@ void dump_init(void)
 	  packet_count++;
 	}
     }
+
+  /* Pi-hole modification: buffer, filter and rotate the capture */
+  pcap_writer_init(daemon->dumpfd, daemon->dump_file, &header, sizeof(header));
 }
 
 void dump_packet_udp(int mask, void *packet, size_t len,
@@ -146,6 +151,14 @@ static void do_dump_packet(int mask, void *packet, size_t len,
   void *iphdr;
   size_t ipsz;
   int rc;
+  /* Pi-hole modification */
+  struct iovec iov[4];
+  int iovcnt = 0;
+  union mysockaddr *client = (mask & DUMP_QUERY) ? src : (mask & DUMP_REPLY) ? dst : NULL;
+
+  if (!pcap_keep(packet, len, client ? &client->sa : NULL, mask & 0x00ff,
+		 mask & (DUMP_REPLY | DUMP_UP_REPLY | DUMP_SEC_REPLY | DUMP_BOGUS | DUMP_SEC_BOGUS)))
+    return;
      
   /* if port != -1 it carries a port number 
      which we use as a source or destination when not otherwise
@@ -287,11 +300,20 @@ static void do_dump_packet(int mask, void *packet, size_t len,
   pcap_header.ts_sec = time.tv_sec;
   pcap_header.ts_usec = time.tv_usec;
   
-  if (rc == -1 ||
-      !read_write(daemon->dumpfd, (void *)&pcap_header, sizeof(pcap_header), RW_WRITE) ||
-      !read_write(daemon->dumpfd, iphdr, ipsz, RW_WRITE) ||
-      (proto == IPPROTO_UDP && !read_write(daemon->dumpfd, (void *)&udp, sizeof(udp), RW_WRITE)) ||
-      !read_write(daemon->dumpfd, (void *)packet, len, RW_WRITE))
+  /* Pi-hole modification: one buffered write per record */
+  iov[iovcnt].iov_base = &pcap_header;
+  iov[iovcnt++].iov_len = sizeof(pcap_header);
+  iov[iovcnt].iov_base = iphdr;
+  iov[iovcnt++].iov_len = ipsz;
+  if (proto == IPPROTO_UDP)
+    {
+      iov[iovcnt].iov_base = &udp;
+      iov[iovcnt++].iov_len = sizeof(udp);
+    }
+  iov[iovcnt].iov_base = packet;
+  iov[iovcnt++].iov_len = len;
+
+  if (rc == -1 || !pcap_write(iov, iovcnt))
     my_syslog(LOG_ERR, _("failed to write packet dump"));
   else if (option_bool(OPT_EXTRALOG) && (mask & 0x00ff))
     my_syslog(LOG_INFO, _("%u dumping packet %u mask 0x%04x"),  daemon->log_display_id, ++packet_count, mask);
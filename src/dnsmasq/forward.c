@@ -17,6 +17,10 @@
 #include "dnsmasq.h"
 #include "dnsmasq_interface.h"
 
+/* Pi-hole modification: forwarding records and their sources are
+   allocated in slabs of this size */
+#define FREC_SLAB 8
+
 static struct frec *get_new_frec(time_t now, struct server *serv, int force);
 static struct frec *lookup_frec(char *target, int class, int rrtype, int id, int flags, int flagmask);
 #ifdef HAVE_DNSSEC
@@ -94,6 +98,10 @@ int send_from(int fd, int nowild, char *packet, size_t len,
 	}
     }
   
+  /* Pi-hole modification: replies to a batch of queries are sent together */
+  if (FTL_batch_send(fd, &msg))
+    return 1;
+
   while (retry_send(sendmsg(fd, &msg, 0)));
 
   if (errno != 0)
@@ -232,13 +240,26 @@ static void forward_query(int udpfd, union mysockaddr *udpaddr,
 	     client to the list that will get the reply.*/
 	  
 	  /* Note whine_malloc() zeros memory. */
+	  /* Pi-hole modification: allocate a slab of sources at once,
+	     bounded by the forwarding table size */
 	  if (!daemon->free_frec_src &&
-	      daemon->frec_src_count < daemon->ftabsize &&
-	      (daemon->free_frec_src = whine_malloc(sizeof(struct frec_src))))
+	      daemon->frec_src_count < daemon->ftabsize)
 	    {
-	      daemon->frec_src_count++;
-	      daemon->free_frec_src->next = NULL;
-	      daemon->free_frec_src->encode_bigmap = NULL;
+	      int i, n = daemon->ftabsize - daemon->frec_src_count;
+	      struct frec_src *slab;
+
+	      if (n > FREC_SLAB)
+		n = FREC_SLAB;
+	      if ((slab = whine_malloc(n * sizeof(struct frec_src))))
+		{
+		  for (i = 0; i < n; i++)
+		    {
+		      slab[i].next = i + 1 < n ? &slab[i+1] : NULL;
+		      slab[i].encode_bigmap = NULL;
+		    }
+		  daemon->free_frec_src = slab;
+		  daemon->frec_src_count += n;
+		}
 	    }
 	  
 	  /* If we've been spammed with many duplicates, return REFUSED. */
@@ -445,6 +466,11 @@ static void forward_query(int udpfd, union mysockaddr *udpaddr,
 	    }
 	  else
 	    start = master->last_server;
+
+	  /* Pi-hole modification: prefer the fastest healthy upstream */
+	  int fastest = FTL_select_upstream(first, last);
+	  if (fastest != -1)
+	    start = fastest;
 	}
     }
   else
@@ -525,6 +551,9 @@ static void forward_query(int udpfd, union mysockaddr *udpaddr,
 
   if (forward->forwardall)
     start = first;
+  /* Pi-hole modification: skip upstreams considered down */
+  else if (!option_bool(OPT_ORDER))
+    start = FTL_upstream_start(first, last, start);
 
   forwarded = 0;
 
@@ -540,6 +569,15 @@ static void forward_query(int udpfd, union mysockaddr *udpaddr,
       int fd;
       struct server *srv = daemon->serverarray[start];
       
+      /**** Pi-hole modification ****/
+      if (forward->forwardall && FTL_upstream_skip(first, last, start))
+	{
+	  if (++start == last)
+	    break;
+	  continue;
+	}
+      /******************************/
+
       if ((fd = allocate_rfd(&forward->rfds, srv)) != -1)
 	{
 	  
@@ -995,6 +1033,9 @@ static void dnssec_validate(struct frec *forward, struct dns_header *header,
 	}
       else
 	{
+	  /* Pi-hole modification */
+	  const unsigned long long start = FTL_dnssec_validation_start();
+
 	  /* As soon as anything returns BOGUS, we stop and unwind, to do otherwise
 	     would invite infinite loops, since the answers to DNSKEY and DS queries
 	     will not be cached, so they'll be repeated. */
@@ -1006,6 +1047,9 @@ static void dnssec_validate(struct frec *forward, struct dns_header *header,
 	    status = dnssec_validate_reply(now, header, plen, daemon->namebuff, daemon->keyname, &forward->class, 
 					   !option_bool(OPT_DNSSEC_IGN_NS), NULL, NULL, NULL, &orig->validate_counter);
 	  
+	  /* Pi-hole modification */
+	  FTL_dnssec_validation_done(start);
+
 	  if (STAT_ISEQUAL(status, STAT_ABANDONED))
 	    log_resource = 1;
 	}
@@ -1049,6 +1093,7 @@ static void dnssec_validate(struct frec *forward, struct dns_header *header,
 		  forward->blocking_query = old;
 		  forward->stash_len = plen;
 		  forward->stash = stash;
+		  FTL_dnssec_queued(1); /* Pi-hole modification */
 		  return;
 		}
 	    }
@@ -1102,6 +1147,7 @@ static void dnssec_validate(struct frec *forward, struct dns_header *header,
 		  blockdata_free(forward->stash);
 		  forward->stash_len = plen;
 		  forward->stash = stash;
+		  FTL_dnssec_queued(1); /* Pi-hole modification */
 		  
 		  new->new_id = ntohs(header->id);
 		  /* Save query for retransmission and de-dup */
@@ -1175,6 +1221,7 @@ void pop_and_retry_query(struct frec *forward, int status, time_t now)
       /* ->next_dependent will have changed after return from recursive call below. */
       nxt = prev->next_dependent;
       prev->blocking_query = NULL; /* already gone */
+      FTL_dnssec_queued(-1); /* Pi-hole modification */
       blockdata_retrieve(prev->stash, prev->stash_len, (void *)header);
       dnssec_validate(prev, header, prev->stash_len, status, now);
     }
@@ -1431,7 +1478,12 @@ void return_reply(time_t now, struct frec *forward, struct dns_header *header, s
 
 	  
 	  if (STAT_ISEQUAL(status, STAT_SECURE))
-	    cache_secure = 1;
+	    {
+	      cache_secure = 1;
+	      /* Pi-hole modification: keep validated NSEC records (RFC 8198) */
+	      if (!(forward->flags & FREC_NO_CACHE))
+		FTL_nsec_store(header, (size_t)n, now);
+	    }
 	  else if (STAT_ISEQUAL(status, STAT_BOGUS))
 	    {
 	      if (ede == EDE_UNSET)
@@ -1497,6 +1549,10 @@ void return_reply(time_t now, struct frec *forward, struct dns_header *header, s
 	     were recorded relative to the flipped name sent upstream. */
 	  if (prev)
 	    flip_queryname(header, nn, prev, src);
+
+	  /* Pi-hole modification */
+	  if (src != &forward->frec_src)
+	    FTL_coalesced_answer(forward->frec_src.log_id, src->log_id);
 	  
 	  if (src->fd != -1)
 	    {
@@ -1506,6 +1562,8 @@ void return_reply(time_t now, struct frec *forward, struct dns_header *header, s
 		{
 		  send_from(src->fd, option_bool(OPT_NOWILD) || option_bool (OPT_CLEVERBIND), daemon->packet, nn, 
 			    &src->source, &src->dest, src->iface);
+		  /* Pi-hole modification */
+		  FTL_answer_sent(src->log_id);
 #ifdef HAVE_DUMPFILE
 		  dump_packet_udp(DUMP_REPLY, daemon->packet, (size_t)nn, NULL, &src->source, src->fd);
 #endif
@@ -1555,6 +1613,8 @@ void return_reply(time_t now, struct frec *forward, struct dns_header *header, s
 		  header->id = htons(src->orig_id);
 		  send_from(src->fd, option_bool(OPT_NOWILD) || option_bool (OPT_CLEVERBIND), daemon->packet, new, 
 			    &src->source, &src->dest, src->iface);
+		  /* Pi-hole modification */
+		  FTL_answer_sent(src->log_id);
 		  
 #ifdef HAVE_DUMPFILE
 		  dump_packet_udp(DUMP_REPLY, daemon->packet, (size_t)new, NULL, &src->source, src->fd);
@@ -1691,7 +1751,8 @@ void receive_query(struct listener *listen, time_t now)
   msg.msg_iov = iov;
   msg.msg_iovlen = 1;
   
-  if ((n = recvmsg(listen->fd, &msg, 0)) == -1)
+  /* Pi-hole modification: queries are read in batches */
+  if ((n = FTL_batch_recvmsg(listen->fd, &msg)) == -1)
     return;
   
   if (n < (int)sizeof(struct dns_header) || 
@@ -1987,6 +2048,7 @@ void receive_query(struct listener *listen, time_t now)
     }
     send_from(listen->fd, option_bool(OPT_NOWILD) || option_bool(OPT_CLEVERBIND),
 	      (char *)header, (size_t)n, &source_addr, &dst_addr, if_index);
+    FTL_answer_sent(daemon->log_display_id);
     daemon->metrics[METRIC_DNS_LOCAL_ANSWERED]++;
     return;
   }
@@ -2037,6 +2099,14 @@ void receive_query(struct listener *listen, time_t now)
 			 dst_addr_4, netmask, now, fwd_flags & FREC_AD_QUESTION, do_bit, !cacheable, &stale, &filtered);
       
       metric = stale ? METRIC_DNS_STALE_ANSWERED : METRIC_DNS_LOCAL_ANSWERED;
+
+      /* Pi-hole modification: answer names proven not to exist by cached
+	 NSEC records without forwarding (RFC 8198) */
+      if (m == 0 && cacheable && !do_bit && !(fwd_flags & FREC_CHECKING_DISABLED) && saved_question)
+	{
+	  blockdata_retrieve(saved_question, (size_t)n, (void *)header);
+	  m = FTL_nsec_answer(header, (size_t)n, fwd_flags & FREC_AD_QUESTION, now);
+	}
       
       if (m == 0)
 	do_forward = 1;
@@ -2080,6 +2150,8 @@ void receive_query(struct listener *listen, time_t now)
       
       send_from(listen->fd, option_bool(OPT_NOWILD) || option_bool(OPT_CLEVERBIND),
 		(char *)header, m, &source_addr, &dst_addr, if_index);
+      /* Pi-hole modification */
+      FTL_answer_sent(daemon->log_display_id);
 
       daemon->metrics[metric]++;
       
@@ -2096,6 +2168,14 @@ void receive_query(struct listener *listen, time_t now)
 	     when it comes back. */
 	  fd = -1;
 	}
+      /* Pi-hole modification: refresh popular records about to expire
+	 the same way as stale ones */
+      else if (FTL_prefetch_due(daemon->log_display_id))
+	{
+	  do_forward = 1;
+	  daemon->log_source_addr = NULL;
+	  fd = -1;
+	}
     }
   
   if (do_forward && saved_question)
@@ -2113,6 +2193,50 @@ void receive_query(struct listener *listen, time_t now)
 }
 
  
+/**** Pi-hole modification ****/
+/* Connections to upstream servers are kept open and reused for further
+   queries (by the same TCP worker). Before reusing one, make sure the
+   server has neither closed it nor sent anything unasked in the
+   meantime, and don't reuse it after it has been idle for longer than
+   servers usually keep connections open (RFC 7766, 6.2.3). Either would
+   cost another round trip to find out the hard way. */
+static int tcp_conn_stale(struct server *serv)
+{
+  struct pollfd pfd;
+
+  if (difftime(dnsmasq_time(), serv->tcp_used) > TCP_IDLE_TIMEOUT)
+    return 1;
+
+  pfd.fd = serv->tcpfd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return poll(&pfd, 1, 0) != 0;
+}
+
+/* Read the reply to the query with ID qid. Replies may arrive out of
+   order (RFC 7766, 7), so replies to other queries, e.g. one given up
+   on, are skipped. */
+static int tcp_read_reply(int fd, u16 *length, unsigned char *payload, u16 qid,
+			  unsigned int *rsize, char *where)
+{
+  int skipped;
+
+  for (skipped = 0; skipped <= TCP_MAX_SKIPPED; skipped++)
+    {
+      if (((*where = 3) && !read_write(fd, (unsigned char *)length, sizeof(*length), RW_READ_ONCE)) ||
+	  ((*where = 4) && !read_write(fd, payload, (*rsize = ntohs(*length)), RW_READ_ONCE)))
+	return 0;
+
+      if (*rsize >= sizeof(struct dns_header) &&
+	  ((struct dns_header *)payload)->id == qid)
+	return 1;
+    }
+
+  return 0;
+}
+/******************************/
+
 /* Send query in packet, qsize to a server determined by first,last,start and
    get the reply. return reply size. */
 static ssize_t tcp_talk(int first, int last, int start, unsigned char *packet,  size_t qsize,
@@ -2130,6 +2254,7 @@ static ssize_t tcp_talk(int first, int last, int start, unsigned char *packet,
 
   // Pi-hole
   char where = 0;
+  u16 qid = header->id;
   
   (void)mark;
   (void)have_mark;
@@ -2169,6 +2294,13 @@ static ssize_t tcp_talk(int first, int last, int start, unsigned char *packet,
       blockdata_retrieve(saved_question, qsize, header);
       
       *length = htons(qsize);
+
+      /* Pi-hole modification */
+      if (serv->tcpfd != -1 && tcp_conn_stale(serv))
+	{
+	  close(serv->tcpfd);
+	  serv->tcpfd = -1;
+	}
       
       if (serv->tcpfd == -1)
 	{
@@ -2235,8 +2367,7 @@ static ssize_t tcp_talk(int first, int last, int start, unsigned char *packet,
       /* We us the _ONCE veriant of read_write() here because we've set a timeout on the tcp socket
 	 and wish to abort if the whole data is not read/written within the timeout. */      
 	if ((!data_sent && (where = 2) && !read_write(serv->tcpfd, (unsigned char *)packet, qsize + sizeof(u16), RW_WRITE_ONCE)) ||
-	  ((where = 3) && !read_write(serv->tcpfd, (unsigned char *)length, sizeof (*length), RW_READ_ONCE)) ||
-	  ((where = 4) && !read_write(serv->tcpfd, payload, (rsize = ntohs(*length)), RW_READ_ONCE)))
+	    !tcp_read_reply(serv->tcpfd, length, payload, qid, &rsize, &where)) /* Pi-hole modification */
 	{
 	  /* We get data then EOF, reopen connection to same server,
 	     else try next. This avoids DoS from a server which accepts
@@ -2265,6 +2396,7 @@ static ssize_t tcp_talk(int first, int last, int start, unsigned char *packet,
 	continue;
       
       serv->flags |= SERV_GOT_TCP;
+      serv->tcp_used = dnsmasq_time(); /* Pi-hole modification */
       
       *servp = serv;
       blockdata_free(saved_question);
@@ -2736,6 +2868,15 @@ unsigned char *tcp_request(int confd, time_t now,
 		    start = first;
 		  else
 		    start = master->last_server;
+
+		  /* Pi-hole modification: prefer the fastest healthy upstream */
+		  int fastest = option_bool(OPT_ORDER) ? -1 : FTL_select_upstream(first, last);
+		  if (fastest != -1)
+		    start = fastest;
+
+		  /* Pi-hole modification: skip upstreams considered down */
+		  if (!option_bool(OPT_ORDER))
+		    start = FTL_upstream_start(first, last, start);
 		  
 #ifdef HAVE_DNSSEC
 		  if (option_bool(OPT_DNSSEC_VALID))
@@ -2881,6 +3022,8 @@ unsigned char *tcp_request(int confd, time_t now,
       
       if (!read_write(confd, packet, m + sizeof(u16), RW_WRITE))
 	break;
+      /* Pi-hole modification */
+      FTL_answer_sent(daemon->log_display_id);
       
       /* If we answered with stale data, this process will now try and get fresh data into
 	 the cache and cannot therefore accept new queries. Close the incoming
@@ -3222,6 +3365,8 @@ static void free_frec(struct frec *f)
     {
       struct frec *n, **up;
 
+      FTL_dnssec_queued(-1); /* Pi-hole modification */
+
       /* unlink outselves from the blocking query's dependents list. */
       for (n = f->blocking_query->dependent, up = &f->blocking_query->dependent; n; n = n->next_dependent)
 	if (n == f)
@@ -3255,6 +3400,7 @@ static struct frec *get_new_frec(time_t now, struct server *master, int force)
 {
   struct frec *f, *oldest, *target;
   int count;
+  unsigned int inuse = 0; /* Pi-hole modification */
 #ifdef HAVE_DNSSEC
   static int next_uid = 0;
 #endif
@@ -3266,6 +3412,7 @@ static struct frec *get_new_frec(time_t now, struct server *master, int force)
 	target = f;
       else
 	{
+	  inuse++; /* Pi-hole modification */
 #ifdef HAVE_DNSSEC
 	  /* Don't free DNSSEC sub-queries here, as we may end up with
 	     dangling references to them. They'll go when their "real" query 
@@ -3302,12 +3449,22 @@ static struct frec *get_new_frec(time_t now, struct server *master, int force)
       target = oldest;
     }
   
-  if (!target && (target = (struct frec *)whine_malloc(sizeof(struct frec))))
+  /* Pi-hole modification: allocate a slab of records at once, the spare
+     ones are zeroed by whine_malloc() and hence show up as free above */
+  if (!target && (target = (struct frec *)whine_malloc(FREC_SLAB * sizeof(struct frec))))
     {
-      target->next = daemon->frec_list;
-      daemon->frec_list = target;
+      int i;
+      for (i = FREC_SLAB - 1; i >= 0; i--)
+	{
+	  target[i].next = daemon->frec_list;
+	  daemon->frec_list = &target[i];
+	}
     }
 
+  /* Pi-hole modification */
+  if (target && ++inuse > daemon->frec_hwm)
+    daemon->frec_hwm = inuse;
+
   if (target)
     {
       target->time = now;
@@ -3399,6 +3556,17 @@ void resend_query(void)
 		daemon->packet, daemon->packet_len, 0);
 }
 
+/* Pi-hole modification: drop all queries in flight, used by UDP workers
+   which inherit the queries of the main process when they are forked */
+void forget_frecs(void)
+{
+  struct frec *f;
+
+  for (f = daemon->frec_list; f; f = f->next)
+    if (f->sentto)
+      free_frec(f);
+}
+
 /* A server record is going away, remove references to it */
 void server_gone(struct server *server)
 {
@@ -20,6 +20,215 @@
 static struct dhcp_lease *leases = NULL, *old_leases = NULL;
 static int dns_dirty, file_dirty, leases_left;
 
+/* Pi-hole modification: hash indexes of the leases by client-id, hardware
+   address and address, so finding the lease of a client does not need to
+   walk the list of all leases. A lease is linked into the chains of its
+   current keys and has to be unlinked before any of them changes. When
+   several leases share a key, the one coming first in the list of leases
+   (the newest one) is returned as before, the serial number tells them
+   apart. DHCPv6 leases are indexed by address only. The list is still
+   walked if the indexes could not be allocated. */
+#define LEASE_HASH_MIN 64
+
+static struct dhcp_lease **hash_clid = NULL, **hash_hwaddr = NULL, **hash_addr = NULL;
+static unsigned int hash_size = 0, hash_leases = 0, lease_serial = 0;
+
+static int lease_is6(struct dhcp_lease *lease)
+{
+#ifdef HAVE_DHCP6
+  return (lease->flags & (LEASE_TA | LEASE_NA)) != 0;
+#else
+  (void)lease;
+  return 0;
+#endif
+}
+
+/* FNV-1a */
+static unsigned int hash_bytes(unsigned int h, const unsigned char *p, int len)
+{
+  while (len-- > 0)
+    h = (h ^ *p++) * 16777619u;
+
+  return h;
+}
+
+static unsigned int clid_bucket(const unsigned char *clid, int clid_len)
+{
+  return hash_bytes(2166136261u, clid, clid_len) & (hash_size - 1);
+}
+
+static unsigned int hwaddr_bucket(const unsigned char *hwaddr, int hw_len, int hw_type)
+{
+  unsigned char type = hw_type;
+  unsigned int h = hash_bytes(2166136261u, &type, 1);
+
+  /* Leases without a hardware address yet have an illegal length */
+  if (hw_len > 0 && hw_len <= DHCP_CHADDR_MAX)
+    h = hash_bytes(h, hwaddr, hw_len);
+
+  return h & (hash_size - 1);
+}
+
+static unsigned int addr_bucket(const void *addr, int len)
+{
+  return hash_bytes(2166136261u, addr, len) & (hash_size - 1);
+}
+
+static unsigned int lease_addr_bucket(struct dhcp_lease *lease)
+{
+#ifdef HAVE_DHCP6
+  if (lease_is6(lease))
+    return addr_bucket(&lease->addr6, IN6ADDRSZ);
+#endif
+
+  return addr_bucket(&lease->addr, INADDRSZ);
+}
+
+static void lease_hash_link(struct dhcp_lease *lease)
+{
+  unsigned int b;
+
+  if (hash_size == 0)
+    return;
+
+  b = lease_addr_bucket(lease);
+  lease->addr_next = hash_addr[b];
+  hash_addr[b] = lease;
+
+  if (!lease_is6(lease))
+    {
+      if (lease->clid)
+	{
+	  b = clid_bucket(lease->clid, lease->clid_len);
+	  lease->clid_next = hash_clid[b];
+	  hash_clid[b] = lease;
+	}
+
+      b = hwaddr_bucket(lease->hwaddr, lease->hwaddr_len, lease->hwaddr_type);
+      lease->hwaddr_next = hash_hwaddr[b];
+      hash_hwaddr[b] = lease;
+    }
+
+  hash_leases++;
+}
+
+static void lease_hash_unlink(struct dhcp_lease *lease)
+{
+  struct dhcp_lease **up;
+
+  if (hash_size == 0)
+    return;
+
+  for (up = &hash_addr[lease_addr_bucket(lease)]; *up; up = &(*up)->addr_next)
+    if (*up == lease)
+      {
+	*up = lease->addr_next;
+	break;
+      }
+
+  if (!lease_is6(lease))
+    {
+      if (lease->clid)
+	for (up = &hash_clid[clid_bucket(lease->clid, lease->clid_len)]; *up; up = &(*up)->clid_next)
+	  if (*up == lease)
+	    {
+	      *up = lease->clid_next;
+	      break;
+	    }
+
+      for (up = &hash_hwaddr[hwaddr_bucket(lease->hwaddr, lease->hwaddr_len, lease->hwaddr_type)]; *up; up = &(*up)->hwaddr_next)
+	if (*up == lease)
+	  {
+	    *up = lease->hwaddr_next;
+	    break;
+	  }
+    }
+
+  hash_leases--;
+}
+
+/* Make room for one more lease, this relinks all leases when the indexes
+   grow. If they cannot grow, the chains just get longer */
+static void lease_hash_grow(void)
+{
+  struct dhcp_lease **new_clid, **new_hwaddr, **new_addr, *lease;
+  unsigned int new_size = hash_size == 0 ? LEASE_HASH_MIN : 2 * hash_size;
+
+  if (hash_leases < hash_size)
+    return;
+
+  new_clid = whine_malloc(new_size * sizeof(*new_clid));
+  new_hwaddr = whine_malloc(new_size * sizeof(*new_hwaddr));
+  new_addr = whine_malloc(new_size * sizeof(*new_addr));
+  if (!new_clid || !new_hwaddr || !new_addr)
+    {
+      free(new_clid);
+      free(new_hwaddr);
+      free(new_addr);
+      return;
+    }
+
+  /* Leases allocated while the indexes were unavailable are linked, too */
+  free(hash_clid);
+  free(hash_hwaddr);
+  free(hash_addr);
+  hash_clid = new_clid;
+  hash_hwaddr = new_hwaddr;
+  hash_addr = new_addr;
+  hash_size = new_size;
+  hash_leases = 0;
+  memset(hash_clid, 0, new_size * sizeof(*hash_clid));
+  memset(hash_hwaddr, 0, new_size * sizeof(*hash_hwaddr));
+  memset(hash_addr, 0, new_size * sizeof(*hash_addr));
+
+  for (lease = leases; lease; lease = lease->next)
+    lease_hash_link(lease);
+}
+
+/* The newer of two leases, either may be NULL */
+static struct dhcp_lease *lease_newer(struct dhcp_lease *found, struct dhcp_lease *lease)
+{
+  return (!found || lease->serial > found->serial) ? lease : found;
+}
+
+/* Pi-hole modification: the lease file is used as append-only journal.
+   Instead of rewriting the whole file whenever a lease changes, only the
+   changed leases are appended to it. Leases which are removed are appended
+   with an expiry time in the past (a tombstone). When reading the file, a
+   later line for an address replaces the earlier ones and the tombstones
+   are pruned as expired leases. The file is compacted by rewriting it
+   completely once it contains more than twice as many lines as there are
+   leases and whenever an append failed (to get rid of partial lines). Both
+   appends and rewrites are synced to disk the same way. */
+#define LEASE_JOURNAL_SLACK 256
+
+static int journal_records, journal_compact = 1;
+
+static void lease_journal(struct dhcp_lease *lease)
+{
+  file_dirty = 1;
+  lease->flags |= LEASE_JOURNAL;
+}
+
+/* Pi-hole modification: forget everything a lease has been read with before
+   when it is found again further down in the lease file */
+static void lease_reset(struct dhcp_lease *lease)
+{
+  lease_hash_unlink(lease);
+  free(lease->clid);
+  free(lease->hostname);
+  free(lease->fqdn);
+  free(lease->agent_id);
+  free(lease->vendorclass);
+  lease->clid = NULL;
+  lease->clid_len = 0;
+  lease->hostname = lease->fqdn = NULL;
+  lease->agent_id = lease->vendorclass = NULL;
+  lease->agent_id_len = lease->vendorclass_len = 0;
+  lease->flags &= ~LEASE_AUTH_NAME;
+  lease_hash_link(lease);
+}
+
 static int read_leases(time_t now, FILE *leasestream)
 {
   unsigned long ei;
@@ -95,7 +304,11 @@ static int read_leases(time_t now, FILE *leasestream)
 		
 	if (inet_pton(AF_INET, daemon->namebuff, &addr.addr4))
 	  {
-	    lease = lease4_allocate(addr.addr4);
+	    /* Pi-hole modification: later lines replace earlier ones */
+	    if ((lease = lease_find_by_addr(addr.addr4)))
+	      lease_reset(lease);
+	    else
+	      lease = lease4_allocate(addr.addr4);
 	    
 	    
 	    hw_len = parse_hex(daemon->dhcp_buff2, (unsigned char *)daemon->dhcp_buff2, DHCP_CHADDR_MAX, NULL, &hw_type);
@@ -115,7 +328,16 @@ static int read_leases(time_t now, FILE *leasestream)
 		s++;
 	      }
 	    
-	    if ((lease = lease6_allocate(&addr.addr6, lease_type)))
+	    /* Pi-hole modification: later lines replace earlier ones */
+	    if ((lease = lease6_find_by_plain_addr(&addr.addr6)))
+	      {
+		lease_reset(lease);
+		lease->flags = (lease->flags & ~(LEASE_TA | LEASE_NA)) | lease_type;
+	      }
+	    else
+	      lease = lease6_allocate(&addr.addr6, lease_type);
+
+	    if (lease)
 	      lease_set_iaid(lease, strtoul(s, NULL, 10));
 	  }
 #endif
@@ -156,6 +378,10 @@ static int read_leases(time_t now, FILE *leasestream)
 	/* set these correctly: the "old" events are generated later from
 	   the startup synthesised SIGHUP. */
 	lease->flags &= ~(LEASE_NEW | LEASE_CHANGED);
+
+	/* Pi-hole modification: the lease is in the file already */
+	lease->flags &= ~LEASE_JOURNAL;
+	journal_records++;
 	
 	*daemon->dhcp_buff3 = *daemon->dhcp_buff2 = '\0';
       }
@@ -241,6 +467,12 @@ void lease_init(time_t now)
 
   /* Some leases may have expired */
   file_dirty = 0;
+
+  /* Pi-hole modification: compact the lease file right away if it
+     contains replaced leases */
+  if ((journal_compact = journal_records > daemon->dhcp_max - leases_left))
+    file_dirty = 1;
+
   lease_prune(NULL, now);
   dns_dirty = 1;
 }
@@ -275,6 +507,153 @@ static void ourprintf(int *errp, char *format, ...)
   va_end(ap);
 }
 
+/* Pi-hole modification: one line of the lease file. Tombstones are written
+   with an expiry time in the past */
+static void write_lease(int *err, struct dhcp_lease *lease, int tombstone)
+{
+  int i;
+
+#ifdef HAVE_DHCP6
+  if (lease->flags & (LEASE_TA | LEASE_NA))
+    {
+#ifdef HAVE_BROKEN_RTC
+      ourprintf(err, "%u ", lease->length);
+#else
+      ourprintf(err, "%lu ", tombstone ? 1UL : (unsigned long)lease->expires);
+#endif
+    
+      inet_ntop(AF_INET6, &lease->addr6, daemon->addrbuff, ADDRSTRLEN);
+	 
+      ourprintf(err, "%s%u %s ", (lease->flags & LEASE_TA) ? "T" : "",
+		lease->iaid, daemon->addrbuff);
+    }
+  else
+#endif
+    {
+#ifdef HAVE_BROKEN_RTC
+      ourprintf(err, "%u ", lease->length);
+#else
+      ourprintf(err, "%lu ", tombstone ? 1UL : (unsigned long)lease->expires);
+#endif
+
+      if (lease->hwaddr_type != ARPHRD_ETHER || lease->hwaddr_len == 0) 
+	ourprintf(err, "%.2x-", lease->hwaddr_type);
+      for (i = 0; i < lease->hwaddr_len; i++)
+	{
+	  ourprintf(err, "%.2x", lease->hwaddr[i]);
+	  if (i != lease->hwaddr_len - 1)
+	    ourprintf(err, ":");
+	}
+      
+      inet_ntop(AF_INET, &lease->addr, daemon->addrbuff, ADDRSTRLEN); 
+
+      ourprintf(err, " %s ", daemon->addrbuff);
+    }
+
+  ourprintf(err, "%s ", lease->hostname ? lease->hostname : "*");
+	  	  
+  if (lease->clid && lease->clid_len != 0)
+    {
+      for (i = 0; i < lease->clid_len - 1; i++)
+	ourprintf(err, "%.2x:", lease->clid[i]);
+      ourprintf(err, "%.2x\n", lease->clid[i]);
+    }
+  else
+    ourprintf(err, "*\n");	  
+}
+
+/* Pi-hole modification: the extra fields of a lease, they refer to it by
+   address */
+static void write_lease_extras(int *err, struct dhcp_lease *lease)
+{
+  int i;
+
+#ifdef HAVE_DHCP6
+  if (lease->flags & (LEASE_TA | LEASE_NA))
+    inet_ntop(AF_INET6, &lease->addr6, daemon->addrbuff, ADDRSTRLEN);
+  else
+#endif
+    inet_ntop(AF_INET, &lease->addr, daemon->addrbuff, ADDRSTRLEN);
+  
+  if (lease->agent_id)
+    {
+      ourprintf(err, "agent-info %s ", daemon->addrbuff);
+      for (i = 0; i < lease->agent_id_len - 1; i++)
+	ourprintf(err, "%.2x:", lease->agent_id[i]);
+      ourprintf(err, "%.2x\n", lease->agent_id[i]);
+    }
+  
+  if (lease->vendorclass)
+    {
+      ourprintf(err, "vendorclass %s ", daemon->addrbuff);
+      for (i = 0; i < lease->vendorclass_len - 1; i++)
+	ourprintf(err, "%.2x:", lease->vendorclass[i]);
+      ourprintf(err, "%.2x\n", lease->vendorclass[i]);
+    }
+}
+
+/* Pi-hole modification: whether changes can be appended to the lease file
+   or it has to be rewritten */
+static int journal_usable(void)
+{
+#ifdef HAVE_BROKEN_RTC
+  /* The file holds lease lengths, there are no tombstones */
+  return 0;
+#else
+  return !journal_compact &&
+    journal_records <= 2 * (daemon->dhcp_max - leases_left) + LEASE_JOURNAL_SLACK;
+#endif
+}
+
+/* Pi-hole modification: append the lines of all changed leases */
+static void lease_append_file(int *err)
+{
+  struct dhcp_lease *lease;
+
+  for (lease = leases; lease; lease = lease->next)
+    {
+      if (!(lease->flags & LEASE_JOURNAL))
+	continue;
+
+      lease->flags &= ~LEASE_JOURNAL;
+
+#ifdef HAVE_DHCP6
+      if ((lease->flags & (LEASE_TA | LEASE_NA)) && !daemon->duid)
+	continue;
+#endif
+
+      write_lease(err, lease, 0);
+      write_lease_extras(err, lease);
+      journal_records++;
+    }
+}
+
+/* Pi-hole modification: record the removal of a lease. The tombstone is
+   synced to disk by the next lease_update_file() */
+static void lease_append_tombstone(struct dhcp_lease *lease)
+{
+  int err = 0;
+
+  if (!daemon->lease_stream)
+    return;
+
+#ifdef HAVE_DHCP6
+  if ((lease->flags & (LEASE_TA | LEASE_NA)) && !daemon->duid)
+    return;
+#endif
+
+  if (!journal_usable())
+    {
+      journal_compact = 1;
+      return;
+    }
+
+  write_lease(&err, lease, 1);
+  journal_records++;
+  if (err)
+    journal_compact = 1;
+}
+
 void lease_update_file(time_t now)
 {
   struct dhcp_lease *lease;
@@ -283,13 +662,23 @@ void lease_update_file(time_t now)
   
   if (file_dirty != 0 && daemon->lease_stream)
     {
-      errno = 0;
-      rewind(daemon->lease_stream);
-      if (errno != 0 || ftruncate(fileno(daemon->lease_stream), 0) != 0)
-	err = errno;
+      /* Pi-hole modification: append only changed leases if possible */
+      const int append = journal_usable();
+
+      if (append)
+	lease_append_file(&err);
+      else
+	{
+	  errno = 0;
+	  rewind(daemon->lease_stream);
+	  if (errno != 0 || ftruncate(fileno(daemon->lease_stream), 0) != 0)
+	    err = errno;
+	  journal_records = 0;
+	}
       
-      for (extras = 0, lease = leases; lease; lease = lease->next)
+      for (extras = 0, lease = leases; !append && lease; lease = lease->next)
 	{
+	  lease->flags &= ~LEASE_JOURNAL;
 	  if (lease->agent_id || lease->vendorclass)
 	    extras = 1;
 	  
@@ -298,38 +687,12 @@ void lease_update_file(time_t now)
 	    continue;
 #endif
 
-#ifdef HAVE_BROKEN_RTC
-	  ourprintf(&err, "%u ", lease->length);
-#else
-	  ourprintf(&err, "%lu ", (unsigned long)lease->expires);
-#endif
-
-	  if (lease->hwaddr_type != ARPHRD_ETHER || lease->hwaddr_len == 0) 
-	    ourprintf(&err, "%.2x-", lease->hwaddr_type);
-	  for (i = 0; i < lease->hwaddr_len; i++)
-	    {
-	      ourprintf(&err, "%.2x", lease->hwaddr[i]);
-	      if (i != lease->hwaddr_len - 1)
-		ourprintf(&err, ":");
-	    }
-	  
-	  inet_ntop(AF_INET, &lease->addr, daemon->addrbuff, ADDRSTRLEN); 
-
-	  ourprintf(&err, " %s ", daemon->addrbuff);
-	  ourprintf(&err, "%s ", lease->hostname ? lease->hostname : "*");
-	  	  
-	  if (lease->clid && lease->clid_len != 0)
-	    {
-	      for (i = 0; i < lease->clid_len - 1; i++)
-		ourprintf(&err, "%.2x:", lease->clid[i]);
-	      ourprintf(&err, "%.2x\n", lease->clid[i]);
-	    }
-	  else
-	    ourprintf(&err, "*\n");	  
+	  write_lease(&err, lease, 0);
+	  journal_records++;
 	}
       
 #ifdef HAVE_DHCP6  
-      if (daemon->duid)
+      if (!append && daemon->duid)
 	{
 	  ourprintf(&err, "duid ");
 	  for (i = 0; i < daemon->duid_len - 1; i++)
@@ -342,26 +705,8 @@ void lease_update_file(time_t now)
 	      if (!(lease->flags & (LEASE_TA | LEASE_NA)))
 		continue;
 
-#ifdef HAVE_BROKEN_RTC
-	      ourprintf(&err, "%u ", lease->length);
-#else
-	      ourprintf(&err, "%lu ", (unsigned long)lease->expires);
-#endif
-    
-	      inet_ntop(AF_INET6, &lease->addr6, daemon->addrbuff, ADDRSTRLEN);
-	 
-	      ourprintf(&err, "%s%u %s ", (lease->flags & LEASE_TA) ? "T" : "",
-			lease->iaid, daemon->addrbuff);
-	      ourprintf(&err, "%s ", lease->hostname ? lease->hostname : "*");
-	      
-	      if (lease->clid && lease->clid_len != 0)
-		{
-		  for (i = 0; i < lease->clid_len - 1; i++)
-		    ourprintf(&err, "%.2x:", lease->clid[i]);
-		  ourprintf(&err, "%.2x\n", lease->clid[i]);
-		}
-	      else
-		ourprintf(&err, "*\n");	  
+	      write_lease(&err, lease, 0);
+	      journal_records++;
 	    }
 	}
 #endif      
@@ -370,30 +715,7 @@ void lease_update_file(time_t now)
 	{
 	  /* Dump this at the end for least confusion with older parsing code. */
 	  for (lease = leases; lease; lease = lease->next)
-	    {
-#ifdef HAVE_DHCP6
-	      if (lease->flags & (LEASE_TA | LEASE_NA))
-		inet_ntop(AF_INET6, &lease->addr6, daemon->addrbuff, ADDRSTRLEN);
-	      else
-#endif
-		inet_ntop(AF_INET, &lease->addr, daemon->addrbuff, ADDRSTRLEN);
-	      
-	      if (lease->agent_id)
-		{
-		  ourprintf(&err, "agent-info %s ", daemon->addrbuff);
-		  for (i = 0; i < lease->agent_id_len - 1; i++)
-		    ourprintf(&err, "%.2x:", lease->agent_id[i]);
-		  ourprintf(&err, "%.2x\n", lease->agent_id[i]);
-		}
-	      
-	      if (lease->vendorclass)
-		{
-		  ourprintf(&err, "vendorclass %s ", daemon->addrbuff);
-		  for (i = 0; i < lease->vendorclass_len - 1; i++)
-		    ourprintf(&err, "%.2x:", lease->vendorclass[i]);
-		  ourprintf(&err, "%.2x\n", lease->vendorclass[i]);
-		}
-	    }
+	    write_lease_extras(&err, lease);
 	}
       
       if (fflush(daemon->lease_stream) != 0 ||
@@ -402,6 +724,10 @@ void lease_update_file(time_t now)
       
       if (!err)
 	file_dirty = 0;
+
+      /* Pi-hole modification: a failed write may have left a partial line
+	 behind, start over with a fresh file */
+      journal_compact = err != 0;
     }
   
   /* Set alarm for when the first lease expires. */
@@ -545,6 +871,7 @@ void lease_make_duid(time_t now)
   if (!daemon->duid && daemon->doing_dhcp6)
     {
       file_dirty = 1;
+      journal_compact = 1; /* Pi-hole modification */
       make_duid(now);
     }
 }
@@ -625,6 +952,8 @@ void lease_prune(struct dhcp_lease *target, time_t now)
 
 	  daemon->metrics[lease->addr.s_addr ? METRIC_LEASES_PRUNED_4 : METRIC_LEASES_PRUNED_6]++;
 
+	  lease_hash_unlink(lease); /* Pi-hole modification */
+	  lease_append_tombstone(lease); /* Pi-hole modification */
  	  *up = lease->next; /* unlink */
 	  
 	  /* Put on old_leases list 'till we
@@ -645,6 +974,33 @@ struct dhcp_lease *lease_find_by_client(unsigned char *hwaddr, int hw_len, int h
 {
   struct dhcp_lease *lease;
 
+  /* Pi-hole modification: use the indexes */
+  if (hash_size != 0)
+    {
+      struct dhcp_lease *found = NULL;
+
+      if (clid)
+	{
+	  for (lease = hash_clid[clid_bucket(clid, clid_len)]; lease; lease = lease->clid_next)
+	    if (lease->clid && clid_len == lease->clid_len &&
+		memcmp(clid, lease->clid, clid_len) == 0)
+	      found = lease_newer(found, lease);
+
+	  if (found)
+	    return found;
+	}
+
+      if (hw_len != 0)
+	for (lease = hash_hwaddr[hwaddr_bucket(hwaddr, hw_len, hw_type)]; lease; lease = lease->hwaddr_next)
+	  if ((!lease->clid || !clid) &&
+	      lease->hwaddr_len == hw_len &&
+	      lease->hwaddr_type == hw_type &&
+	      memcmp(hwaddr, lease->hwaddr, hw_len) == 0)
+	    found = lease_newer(found, lease);
+
+      return found;
+    }
+
   if (clid)
     for (lease = leases; lease; lease = lease->next)
       {
@@ -678,6 +1034,18 @@ struct dhcp_lease *lease_find_by_addr(struct in_addr addr)
 {
   struct dhcp_lease *lease;
 
+  /* Pi-hole modification: use the index */
+  if (hash_size != 0)
+    {
+      struct dhcp_lease *found = NULL;
+
+      for (lease = hash_addr[addr_bucket(&addr, INADDRSZ)]; lease; lease = lease->addr_next)
+	if (!lease_is6(lease) && lease->addr.s_addr == addr.s_addr)
+	  found = lease_newer(found, lease);
+
+      return found;
+    }
+
   for (lease = leases; lease; lease = lease->next)
     {
 #ifdef HAVE_DHCP6
@@ -697,7 +1065,20 @@ struct dhcp_lease *lease6_find(unsigned char *clid, int clid_len,
 			       int lease_type, unsigned int iaid,
 			       struct in6_addr *addr)
 {
-  struct dhcp_lease *lease;
+  struct dhcp_lease *lease, *found = NULL;
+
+  /* Pi-hole modification: use the index */
+  if (hash_size != 0)
+    {
+      for (lease = hash_addr[addr_bucket(addr, IN6ADDRSZ)]; lease; lease = lease->addr_next)
+	if ((lease->flags & lease_type) && lease->iaid == iaid &&
+	    IN6_ARE_ADDR_EQUAL(&lease->addr6, addr) &&
+	    clid_len == lease->clid_len &&
+	    memcmp(clid, lease->clid, clid_len) == 0)
+	  found = lease_newer(found, lease);
+
+      return found;
+    }
   
   for (lease = leases; lease; lease = lease->next)
     {
@@ -759,6 +1140,10 @@ struct dhcp_lease *lease6_find_by_client(struct dhcp_lease *first, int lease_typ
 struct dhcp_lease *lease6_find_by_addr(struct in6_addr *net, int prefix, u64 addr)
 {
   struct dhcp_lease *lease;
+
+  /* Pi-hole modification: a full prefix is a plain address */
+  if (prefix == 128 && hash_size != 0)
+    return lease6_find_by_plain_addr(net);
     
   for (lease = leases; lease; lease = lease->next)
     {
@@ -775,7 +1160,17 @@ struct dhcp_lease *lease6_find_by_addr(struct in6_addr *net, int prefix, u64 add
 
 struct dhcp_lease *lease6_find_by_plain_addr(struct in6_addr *addr)
 {
-  struct dhcp_lease *lease;
+  struct dhcp_lease *lease, *found = NULL;
+
+  /* Pi-hole modification: use the index */
+  if (hash_size != 0)
+    {
+      for (lease = hash_addr[addr_bucket(addr, IN6ADDRSZ)]; lease; lease = lease->addr_next)
+	if (lease_is6(lease) && IN6_ARE_ADDR_EQUAL(&lease->addr6, addr))
+	  found = lease_newer(found, lease);
+
+      return found;
+    }
     
   for (lease = leases; lease; lease = lease->next)
     {
@@ -848,10 +1243,14 @@ static struct dhcp_lease *lease_allocate(void)
   lease->length = 0xffffffff; /* illegal value */
 #endif
   lease->hwaddr_len = 256; /* illegal value */
+  /* Pi-hole modification: the lease is linked into the indexes once its
+     address is known */
+  lease->serial = ++lease_serial;
+  lease_hash_grow();
   lease->next = leases;
   leases = lease;
   
-  file_dirty = 1;
+  lease_journal(lease); /* Pi-hole modification */
   leases_left--;
 
   return lease;
@@ -863,6 +1262,7 @@ struct dhcp_lease *lease4_allocate(struct in_addr addr)
   if (lease)
     {
       lease->addr = addr;
+      lease_hash_link(lease); /* Pi-hole modification */
       daemon->metrics[METRIC_LEASES_ALLOCATED_4]++;
     }
   
@@ -879,6 +1279,7 @@ struct dhcp_lease *lease6_allocate(struct in6_addr *addrp, int lease_type)
       lease->addr6 = *addrp;
       lease->flags |= lease_type;
       lease->iaid = 0;
+      lease_hash_link(lease); /* Pi-hole modification */
 
       daemon->metrics[METRIC_LEASES_ALLOCATED_6]++;
     }
@@ -912,7 +1313,7 @@ void lease_set_expires(struct dhcp_lease *lease, unsigned int len, time_t now)
       lease->expires = exp;
 #ifndef HAVE_BROKEN_RTC
       lease->flags |= LEASE_AUX_CHANGED | LEASE_EXP_CHANGED;
-      file_dirty = 1;
+      lease_journal(lease); /* Pi-hole modification */
 #endif
     }
   
@@ -921,7 +1322,7 @@ void lease_set_expires(struct dhcp_lease *lease, unsigned int len, time_t now)
     {
       lease->length = len;
       lease->flags |= LEASE_AUX_CHANGED;
-      file_dirty = 1; 
+      lease_journal(lease); /* Pi-hole modification */
     }
 #endif
 } 
@@ -933,6 +1334,7 @@ void lease_set_iaid(struct dhcp_lease *lease, unsigned int iaid)
     {
       lease->iaid = iaid;
       lease->flags |= LEASE_CHANGED;
+      lease->flags |= LEASE_JOURNAL; /* Pi-hole modification */
     }
 }
 #endif
@@ -949,6 +1351,9 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
   (void)force;
   (void)now;
 
+  /* Pi-hole modification: the keys of the lease may change */
+  lease_hash_unlink(lease);
+
   if (hw_len != lease->hwaddr_len ||
       hw_type != lease->hwaddr_type || 
       (hw_len != 0 && memcmp(lease->hwaddr, hwaddr, hw_len) != 0))
@@ -958,7 +1363,7 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
       lease->hwaddr_len = hw_len;
       lease->hwaddr_type = hw_type;
       lease->flags |= LEASE_CHANGED;
-      file_dirty = 1; /* run script on change */
+      lease_journal(lease); /* Pi-hole modification: run script on change */
     }
 
   /* only update clid when one is available, stops packets
@@ -972,10 +1377,13 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
       if (lease->clid_len != clid_len)
 	{
 	  lease->flags |= LEASE_AUX_CHANGED;
-	  file_dirty = 1;
+	  lease_journal(lease); /* Pi-hole modification */
 	  free(lease->clid);
 	  if (!(lease->clid = whine_malloc(clid_len)))
-	    return;
+	    {
+	      lease_hash_link(lease); /* Pi-hole modification */
+	      return;
+	    }
 #ifdef HAVE_DHCP6
 	  change = 1;
 #endif	   
@@ -983,7 +1391,7 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
       else if (memcmp(lease->clid, clid, clid_len) != 0)
 	{
 	  lease->flags |= LEASE_AUX_CHANGED;
-	  file_dirty = 1;
+	  lease_journal(lease); /* Pi-hole modification */
 #ifdef HAVE_DHCP6
 	  change = 1;
 #endif	
@@ -992,6 +1400,8 @@ void lease_set_hwaddr(struct dhcp_lease *lease, const unsigned char *hwaddr,
       lease->clid_len = clid_len;
       memcpy(lease->clid, clid, clid_len);
     }
+
+  lease_hash_link(lease); /* Pi-hole modification */
   
 #ifdef HAVE_DHCP6
   if (change)
@@ -1019,6 +1429,7 @@ static void kill_name(struct dhcp_lease *lease)
     lease->old_hostname = lease->hostname;
 
   lease->hostname = lease->fqdn = NULL;
+  lease_journal(lease); /* Pi-hole modification */
 }
 
 void lease_calc_fqdns(void)
@@ -1140,7 +1551,7 @@ void lease_set_hostname(struct dhcp_lease *lease, const char *name, int auth, ch
   if (auth)
     lease->flags |= LEASE_AUTH_NAME;
   
-  file_dirty = 1;
+  lease_journal(lease); /* Pi-hole modification */
   dns_dirty = 1; 
   lease->flags |= LEASE_CHANGED; /* run script on change */
 }
@@ -1169,7 +1580,7 @@ void lease_set_agent_id(struct dhcp_lease *lease, unsigned char *new, int len)
   if (lease->agent_id && new && lease->agent_id_len == len && memcmp(lease->agent_id, new, len) == 0)
     return;
 
-  file_dirty = 1;
+  lease_journal(lease); /* Pi-hole modification */
   free(lease->agent_id);
   lease->agent_id = NULL;
   
@@ -1188,7 +1599,7 @@ void lease_set_vendorclass(struct dhcp_lease *lease, unsigned char *new, int len
   if (lease->vendorclass && new && lease->vendorclass_len == len && memcmp(lease->vendorclass, new, len) == 0)
     return;
 
-  file_dirty = 1;
+  lease_journal(lease); /* Pi-hole modification */
   free(lease->vendorclass);
   lease->vendorclass = NULL;
   
@@ -725,6 +725,7 @@ static int release_listener(struct listener *l)
     close(l->tftpfd);
 
   free(l);
+  reload_workers(); /* Pi-hole modification */
   return 1;
 }
 
@@ -953,6 +954,14 @@ static int make_sock(union mysockaddr *addr, int type, int dienow)
   
   if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 || !fix_fd(fd))
     goto err;
+
+  /* Pi-hole modification: UDP workers bind their own sockets to the
+     addresses of the listeners */
+#ifdef SO_REUSEPORT
+  if (type == SOCK_DGRAM && FTL_udp_workers() > 0 &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    goto err;
+#endif
   
   if (family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)) == -1)
     goto err;
@@ -990,6 +999,21 @@ static int make_sock(union mysockaddr *addr, int type, int dienow)
   return fd;
 }
 
+/* Pi-hole modification: open another socket receiving the UDP queries of
+   a listener, returns -1 if this is not possible */
+int udp_worker_sock(struct listener *listener)
+{
+  union mysockaddr addr;
+  socklen_t len = sizeof(addr);
+
+#ifdef SO_REUSEPORT
+  if (listener->fd != -1 && getsockname(listener->fd, &addr.sa, &len) != -1)
+    return make_sock(&addr, SOCK_DGRAM, 0);
+#endif
+
+  return -1;
+}
+
 int set_ipv6pktinfo(int fd)
 {
   int opt = 1;
@@ -1209,6 +1233,7 @@ void create_bound_listeners(int dienow)
 	    new->next = daemon->listeners;
 	    daemon->listeners = new;
 	    iface->done = 1;
+	    reload_workers(); /* Pi-hole modification */
 
 	    /* Don't log the initial set of listen addresses created
                at startup, since this is happening before the logging
@@ -1712,6 +1737,7 @@ void check_servers(int no_loop_check)
   
   cleanup_servers(); /* remove servers we just deleted. */
   build_server_array(); 
+  reload_workers(); /* Pi-hole modification */
 }
 
 /* Return zero if no servers found, in that case we keep polling.
@@ -1988,6 +1988,8 @@ static int parse_dhcp_opt(char *errstr, char *arg, int flags)
       new->next = daemon->dhcp_opts;
       daemon->dhcp_opts = new;
     }
+
+  option_filter_flush(); /* Pi-hole modification */
     
   return 1;
 on_error:
@@ -4441,6 +4443,7 @@ static int one_opt(int option, char *arg, char *errstr, char *gen_err, int comma
 	     new->next = daemon->dhcp_opts;
 	     daemon->dhcp_opts = new;
 	     daemon->enable_pxe = 1;
+	     option_filter_flush(); /* Pi-hole modification */
 	   }
 	 
 	 break;
@@ -5870,6 +5873,7 @@ static void clear_dhcp_opt(struct dhcp_opt **dhcp_opts)
 
 static void clear_dynamic_opt(void)
 {
+  option_filter_flush(); /* Pi-hole modification */
   clear_dhcp_opt(&daemon->dhcp_opts);
 #ifdef HAVE_DHCP6
   clear_dhcp_opt(&daemon->dhcp_opts6);
@@ -17,6 +17,97 @@
 #include "dnsmasq.h"
 #include "dnsmasq_interface.h"
 
+/* Pi-hole modification: extract_name() copies and compares labels 16 bytes
+   at a time where the label (and the name compared against) are long enough.
+   Blocks needing escapes or not matching exactly are left to the byte loop
+   which thus sees the same bytes in the same state. extract_name_vector can
+   be cleared to use the byte loop only (for comparing both). */
+int extract_name_vector = 1;
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define HAVE_NAME_VECTOR
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define HAVE_NAME_VECTOR
+#endif
+
+#ifdef HAVE_NAME_VECTOR
+#  define NAME_VECTOR 16
+#  if defined(__SSE2__)
+/* Lower case A-Z only, bytes >= 0x80 are negative and never match */
+static inline __m128i name_lower(__m128i v)
+{
+  const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+				      _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+/* Can these bytes of a label be copied to the name as they are? */
+static inline int label_plain(const unsigned char *p)
+{
+  const __m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+  const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+						    _mm_cmpeq_epi8(v, _mm_set1_epi8('.'))),
+				       _mm_cmpeq_epi8(v, _mm_set1_epi8(NAME_ESCAPE)));
+  return _mm_movemask_epi8(special) == 0;
+}
+
+/* Do these bytes of a label match the name without escapes? */
+static inline int label_equal(const unsigned char *name, const unsigned char *p, int case_insens)
+{
+  __m128i n = _mm_loadu_si128((const __m128i *)(const void *)name);
+  __m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(n, _mm_set1_epi8(NAME_ESCAPE))) != 0)
+    return 0;
+  if (case_insens)
+    {
+      n = name_lower(n);
+      v = name_lower(v);
+    }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(n, v)) == 0xffff;
+}
+#  else
+/* NEON has no movemask, narrowing the comparison results leaves four bits
+   per byte */
+static inline uint64_t name_mask(uint8x16_t v)
+{
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+}
+
+static inline uint8x16_t name_lower(uint8x16_t v)
+{
+  const uint8x16_t upper = vcleq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8('Z' - 'A'));
+  return vorrq_u8(v, vandq_u8(upper, vdupq_n_u8(0x20)));
+}
+
+static inline int label_plain(const unsigned char *p)
+{
+  const uint8x16_t v = vld1q_u8(p);
+  const uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(0)),
+					       vceqq_u8(v, vdupq_n_u8('.'))),
+				      vceqq_u8(v, vdupq_n_u8(NAME_ESCAPE)));
+  return name_mask(special) == 0;
+}
+
+static inline int label_equal(const unsigned char *name, const unsigned char *p, int case_insens)
+{
+  uint8x16_t n = vld1q_u8(name);
+  uint8x16_t v = vld1q_u8(p);
+
+  if (name_mask(vceqq_u8(n, vdupq_n_u8(NAME_ESCAPE))) != 0)
+    return 0;
+  if (case_insens)
+    {
+      n = name_lower(n);
+      v = name_lower(v);
+    }
+  return name_mask(vceqq_u8(n, v)) == UINT64_MAX;
+}
+#  endif
+#endif
+
 /* EXTR_NAME_EXTRACT -> extract name
    EXTR_NAME_COMPARE -> compare name, case insensitive
    EXTR_NAME_NOCASE -> compare name, case sensitive
@@ -42,6 +133,9 @@ int extract_name(struct dns_header *header, size_t plen, unsigned char **pp,
   int retvalue = 1, case_insens = 1, isExtract = 0, flip = 0, extrabytes = (int)parm;
   unsigned int *bigmap = (unsigned int *)name;
   unsigned char *p = pp ? *pp : (unsigned char *)(header+1);
+#ifdef HAVE_NAME_VECTOR
+  unsigned char *name_end = NULL; /* Pi-hole modification */
+#endif
   
   if (func == EXTR_NAME_EXTRACT)
     isExtract = 1, *cp = 0;
@@ -115,7 +209,26 @@ int extract_name(struct dns_header *header, size_t plen, unsigned char **pp,
 	  if (!CHECK_LEN(header, p, plen, l))
 	    return 0;
 	  
-	  for (j=0; j<l; j++, p++)
+	  j = 0;
+#ifdef HAVE_NAME_VECTOR
+	  /* Pi-hole modification: whole blocks copied or matching as they are */
+	  if (l >= NAME_VECTOR && extract_name_vector)
+	    {
+	      if (isExtract)
+		for (; j + NAME_VECTOR <= l && label_plain(p); j += NAME_VECTOR, p += NAME_VECTOR, cp += NAME_VECTOR)
+		  memcpy(cp, p, NAME_VECTOR);
+	      else if (!flip)
+		{
+		  /* The name is only read up to its end */
+		  if (!name_end)
+		    name_end = cp + strlen((char *)cp);
+		  for (; j + NAME_VECTOR <= l && name_end - cp >= NAME_VECTOR && label_equal(cp, p, case_insens);
+		       j += NAME_VECTOR, p += NAME_VECTOR, cp += NAME_VECTOR);
+		}
+	    }
+#endif
+
+	  for (; j<l; j++, p++)
 	    if (isExtract)
 	      {
 		unsigned char c = *p;
@@ -890,7 +1003,7 @@ int extract_addresses(struct dns_header *header, size_t qlen, char *name, time_t
 	      
 	      // ****************************** Pi-hole modification ******************************
 	      const char *src = cpp != NULL ? cache_get_name(cpp) : NULL;
-	      if(FTL_CNAME(name, src, daemon->log_display_id))
+	      if(FTL_CNAME(name, src, daemon->log_display_id, ttl))
 		{
 		  // Found while processing a reply from upstream. We prevent cache insertion here
 		  // This query is to be blocked as we found a blocked
@@ -1584,6 +1697,10 @@ int add_resource_record(struct dns_header *header, char *limit, int *truncp, int
 
 static int crec_isstale(struct crec *crecp, time_t now)
 {
+  /* Pi-hole modification */
+  if (!(crecp->flags & (F_IMMORTAL | F_HOSTS | F_DHCP | F_CONFIG)))
+    FTL_cache_hit(crecp->ttd, crecp->ttl, now);
+
   return (!(crecp->flags & F_IMMORTAL)) && difftime(crecp->ttd, now) < 0; 
 }
 
@@ -2099,7 +2216,7 @@ size_t answer_request(struct dns_header *header, char *limit, size_t qlen,
 				  record_source(crecp->uid), 0);
 			    // ****************************** Pi-hole modification ******************************
 			    const char *src = crecp != NULL ? cache_get_name(crecp) : NULL;
-			    if(FTL_CNAME(name, src, daemon->log_display_id))
+			    if(FTL_CNAME(name, src, daemon->log_display_id, crec_ttl(crecp, now)))
 			      {
 			        // Served from cache. This can happen if a domain hidden in the CNAME path
 			        // is only blocked for some but not all clients. In this case, the entire
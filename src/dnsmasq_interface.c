@@ -44,8 +44,12 @@
 #include <stddef.h>
 // logg_rate_limit_message()
 #include "database/message-table.h"
+// rate_limit_query()
+#include "ratelimit.h"
 // http_init()
 #include "webserver/webserver.h"
+// dot_thread(), dot_client()
+#include "dns-over-tls.h"
 // type struct sqlite3_stmt_vec
 #include "vector.h"
 // query_to_database()
@@ -58,6 +62,30 @@
 #include "ntp/ntp.h"
 // get_process_name()
 #include "procps.h"
+// top_lists_domain_changed()
+#include "top-lists.h"
+// client_sketch_add()
+#include "client-sketch.h"
+// latency_trace_mark()
+#include "latency.h"
+// upstream_health_result()
+#include "upstream-health.h"
+// start_log_writer()
+#include "log-writer.h"
+// querylog_add()
+#include "querylog.h"
+// federation_thread()
+#include "federation.h"
+// special_domain_type()
+#include "special-domains.h"
+// FTL_PROBE()
+#include "probes.h"
+// count_list_hit()
+#include "database/list-hits.h"
+// apply_capacity_plan()
+#include "database/capacity-plan.h"
+// init_exclude_filters()
+#include "exclude-filter.h"
 
 // Private prototypes
 static void print_flags(const unsigned int flags);
@@ -78,18 +106,66 @@ static void _query_set_dnssec(queriesData *query, const enum dnssec_status dnsse
 static char *get_ptrname(const struct in_addr *addr);
 static const char *check_dnsmasq_name(const char *name);
 static void get_rcode(const unsigned short rcode, const char **rcodestr, enum reply_type *reply);
+static void update_upstream_ewma(upstreamsData *upstream, const double response, const bool failed);
 
-// Static blocking metadata
+// Static blocking metadata. The metadata set while evaluating the lists is
+// thread-local as FTL_refresh_dns_cache() evaluates them in the database
+// thread while the DNS thread may still be answering the previous query
 static bool aabit = false, adbit = false, rabit = false;
-static const char *blockingreason = "";
-static enum reply_type force_next_DNS_reply = REPLY_UNKNOWN;
+static __thread const char *blockingreason = "";
+static __thread enum reply_type force_next_DNS_reply = REPLY_UNKNOWN;
 static enum query_status cacheStatus = QUERY_UNKNOWN;
-static int last_regex_idx = -1;
-static char *pihole_suffix = NULL;
-static char *hostname_suffix = NULL;
-static char *cname_target = NULL;
+static __thread int last_regex_idx = -1;
+// Lists consulted by FTL_check_blocking() (enum latency_check)
+static __thread unsigned char list_checks = 0;
+// Whether the lists were available during the most recent FTL_check_blocking()
+static bool lists_available = true;
+// Fork-private cache prefetching state of the most recent query
+// (dns.cache.prefetch)
+static struct {
+	int id;
+	bool popular;
+	bool due;
+	bool refreshing;
+} prefetch = { 0, false, false, false };
+// Remaining TTL of the most recent cache record used for an answer
+static enum cache_hit_ttl hit_ttl = CACHE_HIT_TTL_MAX;
+static __thread char *cname_target = NULL;
 #define HOSTNAME "Pi-hole hostname"
 
+// Hot DNS cache records re-validated by FTL_refresh_dns_cache() after the
+// lists have been reloaded. Records referenced by fewer queries are left to
+// be re-validated by their next query
+#define CACHE_REFRESH_MAX 1024u
+#define CACHE_REFRESH_MIN_REFS 4u
+// Records re-validated per acquisition of the SHM lock
+#define CACHE_REFRESH_BATCH 32u
+
+// Verdicts of deep CNAME inspection. The verdict for a CNAME target depends
+// only on the query type and the groups of the client, so it can be reused by
+// all clients sharing these groups. The cache is private to each process
+// (forks inherit a copy) and bounded, each target maps onto exactly one slot.
+// Entries expire with the CNAME record and are only valid in the gravity
+// generation they have been stored in (see bump_gravity_generation())
+#define CNAME_VERDICT_SLOTS 1024u
+struct cname_verdict {
+	uint32_t hash;
+	uint32_t groups;
+	int domainID;
+	enum query_type type;
+	unsigned int generation;
+	time_t expires;
+	bool blocked;
+	bool allowed;
+	enum query_status status;
+	enum reply_type force_reply;
+	int list_id;
+	int regex_idx;
+	const char *reason;
+	char *cname_target;
+};
+static struct cname_verdict *cname_verdicts = NULL;
+
 // Fork-private copy of the interface data the most recent query came from
 static struct {
 	bool haveIPv4;
@@ -102,6 +178,10 @@ static struct {
 // Fork-private copy of the server data the most recent reply came from
 static union mysockaddr last_server = {{ 0 }};
 
+// Slot of this process in counters->dnssec.queued, -1 in processes not
+// validating replies of UDP queries
+static int dnssec_slot = 0;
+
 const char *flagnames[] = {"F_IMMORTAL ", "F_NAMEP ", "F_REVERSE ", "F_FORWARD ", "F_DHCP ", "F_NEG ", "F_HOSTS ", "F_IPV4 ", "F_IPV6 ", "F_BIGNAME ", "F_NXDOMAIN ", "F_CNAME ", "F_DNSKEY ", "F_CONFIG ", "F_DS ", "F_DNSSECOK ", "F_UPSTREAM ", "F_RRNAME ", "F_SERVER ", "F_QUERY ", "F_NOERR ", "F_AUTH ", "F_DNSSEC ", "F_KEYTAG ", "F_SECSTAT ", "F_NO_RR ", "F_IPSET ", "F_NOEXTRA ", "F_DOMAINSRV", "F_RCODE", "F_RR", "F_STALE" };
 
 void FTL_hook(unsigned int flags, const char *name, const union all_addr *addr, char *arg, int id, unsigned short type, const char *file, const int line)
@@ -185,6 +265,110 @@ void FTL_hook(unsigned int flags, const char *name, const union all_addr *addr,
 		FTL_reply(flags, name, addr, arg, id, path, line);
 }
 
+// Wire format of the A and AAAA records of blocked replies: the owner name is a
+// compression pointer to the question, type, class, TTL, and address are
+// already encoded. Adding a record is a single copy. Templates are rebuilt
+// when the TTL or the address change (after a configuration change or for a
+// query arriving on another interface). Indexed by [AAAA][reply to hostname]
+#define ANSWER_TEMPLATE_SIZE (2 + RRFIXEDSZ + IN6ADDRSZ)
+static struct answer_template {
+	unsigned int ttl;
+	size_t len;
+	unsigned char rr[ANSWER_TEMPLATE_SIZE];
+} answer_templates[2][2] = {{{ 0 }}};
+
+static bool add_answer_template(char *limit, int *trunc, unsigned char **pp,
+                                const unsigned short type, const unsigned int ttl,
+                                const void *addr, const bool hostn)
+{
+	const size_t addrlen = type == T_AAAA ? IN6ADDRSZ : INADDRSZ;
+	struct answer_template *tpl = &answer_templates[type == T_AAAA][hostn];
+	unsigned char *rdata = tpl->rr + 2 + RRFIXEDSZ;
+
+	if(tpl->len == 0 || tpl->ttl != ttl || memcmp(rdata, addr, addrlen) != 0)
+	{
+		unsigned char *t = tpl->rr;
+		PUTSHORT(sizeof(struct dns_header) | 0xc000, t);
+		PUTSHORT(type, t);
+		PUTSHORT(C_IN, t);
+		PUTLONG(ttl, t);
+		PUTSHORT(addrlen, t);
+		memcpy(t, addr, addrlen);
+		tpl->ttl = ttl;
+		tpl->len = 2 + RRFIXEDSZ + addrlen;
+	}
+
+	// Same truncation handling as add_resource_record()
+	if(*trunc || (limit && *pp + tpl->len > (unsigned char *)limit))
+	{
+		*trunc = 1;
+		return false;
+	}
+
+	memcpy(*pp, tpl->rr, tpl->len);
+	*pp += tpl->len;
+
+	return true;
+}
+
+// EDE code and text added to replies with the given status by FTL_make_answer()
+int get_status_ede(const enum query_status status, const char **text)
+{
+	*text = NULL;
+	switch(status)
+	{
+		case QUERY_UNKNOWN:
+//		case QUERY_CACHE:
+		case QUERY_FORWARDED:
+		case QUERY_RETRIED:
+		case QUERY_RETRIED_DNSSEC:
+		case QUERY_IN_PROGRESS:
+		case QUERY_DBBUSY:
+		case QUERY_CACHE_STALE:
+		case QUERY_STATUS_MAX:
+			// Not going through FTL_make_answer()
+			break;
+		case QUERY_GRAVITY:
+			*text = "gravity";
+			return EDE_BLOCKED;
+		case QUERY_GRAVITY_CNAME:
+			*text = "gravity (CNAME)";
+			return EDE_BLOCKED;
+		case QUERY_DENYLIST:
+			*text = "denylist";
+			return EDE_BLOCKED;
+		case QUERY_DENYLIST_CNAME:
+			*text = "denylist (CNAME)";
+			return EDE_BLOCKED;
+		case QUERY_REGEX:
+			*text = "regex";
+			return EDE_BLOCKED;
+		case QUERY_REGEX_CNAME:
+			*text = "regex (CNAME)";
+			return EDE_BLOCKED;
+		case QUERY_SPECIAL_DOMAIN:
+			*text = "special";
+			return EDE_BLOCKED;
+		case QUERY_EXTERNAL_BLOCKED_NXRA:
+			*text = "upstream NXRA";
+			return EDE_BLOCKED;
+		case QUERY_EXTERNAL_BLOCKED_NULL:
+			*text = "upstream NULL";
+			return EDE_BLOCKED;
+		case QUERY_EXTERNAL_BLOCKED_IP:
+			*text = "upstream IP";
+			return EDE_BLOCKED;
+		case QUERY_EXTERNAL_BLOCKED_EDE15:
+			*text = "upstream EDE 15";
+			return EDE_BLOCKED;
+		case QUERY_CACHE:
+			*text = "synthesized";
+			return EDE_SYNTHESIZED;
+	}
+
+	return EDE_UNSET;
+}
+
 // This is inspired by make_local_answer()
 size_t _FTL_make_answer(struct dns_header *header, char *limit, const size_t len,
                         unsigned char ede_data[MAX_EDE_DATA], size_t *ede_len,
@@ -325,70 +509,8 @@ size_t _FTL_make_answer(struct dns_header *header, char *limit, const size_t len
 	}
 
 	// Derive EDE code and text from cacheStatus
-	int ede_code = EDE_UNSET;
 	const char *ede_text = NULL;
-	switch(cacheStatus)
-	{
-		case QUERY_UNKNOWN:
-//		case QUERY_CACHE:
-		case QUERY_FORWARDED:
-		case QUERY_RETRIED:
-		case QUERY_RETRIED_DNSSEC:
-		case QUERY_IN_PROGRESS:
-		case QUERY_DBBUSY:
-		case QUERY_CACHE_STALE:
-		case QUERY_STATUS_MAX:
-			// Not going through this function
-			break;
-		case QUERY_GRAVITY:
-			ede_code = EDE_BLOCKED;
-			ede_text = "gravity";
-			break;
-		case QUERY_GRAVITY_CNAME:
-			ede_code = EDE_BLOCKED;
-			ede_text = "gravity (CNAME)";
-			break;
-		case QUERY_DENYLIST:
-			ede_code = EDE_BLOCKED;
-			ede_text = "denylist";
-			break;
-		case QUERY_DENYLIST_CNAME:
-			ede_code = EDE_BLOCKED;
-			ede_text = "denylist (CNAME)";
-			break;
-		case QUERY_REGEX:
-			ede_code = EDE_BLOCKED;
-			ede_text = "regex";
-			break;
-		case QUERY_REGEX_CNAME:
-			ede_code = EDE_BLOCKED;
-			ede_text = "regex (CNAME)";
-			break;
-		case QUERY_SPECIAL_DOMAIN:
-			ede_code = EDE_BLOCKED;
-			ede_text = "special";
-			break;
-		case QUERY_EXTERNAL_BLOCKED_NXRA:
-			ede_code = EDE_BLOCKED;
-			ede_text = "upstream NXRA";
-			break;
-		case QUERY_EXTERNAL_BLOCKED_NULL:
-			ede_code = EDE_BLOCKED;
-			ede_text = "upstream NULL";
-			break;
-		case QUERY_EXTERNAL_BLOCKED_IP:
-			ede_code = EDE_BLOCKED;
-			ede_text = "upstream IP";
-			break;
-		case QUERY_EXTERNAL_BLOCKED_EDE15:
-			ede_code = EDE_BLOCKED;
-			ede_text = "upstream EDE 15";
-			break;
-		case QUERY_CACHE:
-			ede_code = EDE_SYNTHESIZED;
-			ede_text = "synthesized";
-			break;
-	}
+	const int ede_code = get_status_ede(cacheStatus, &ede_text);
 
 	// Reset global DNS cache status
 	cacheStatus = QUERY_UNKNOWN;
@@ -490,9 +612,9 @@ size_t _FTL_make_answer(struct dns_header *header, char *limit, const size_t len
 
 		// Add A resource record
 		header->ancount = htons(ntohs(header->ancount) + 1);
-		if(add_resource_record(header, limit, &trunc, sizeof(struct dns_header),
-		                       &p, hostn ? daemon->local_ttl : config.dns.blockTTL.v.ui,
-		                       NULL, T_A, C_IN, (char*)"4", &addr.addr4))
+		if(add_answer_template(limit, &trunc, &p, T_A,
+		                       hostn ? daemon->local_ttl : config.dns.blockTTL.v.ui,
+		                       &addr.addr4, hostn))
 			log_query(flags & ~F_IPV6, name, &addr, (char*)blockingreason, 0);
 	}
 
@@ -525,9 +647,9 @@ size_t _FTL_make_answer(struct dns_header *header, char *limit, const size_t len
 
 		// Add AAAA resource record
 		header->ancount = htons(ntohs(header->ancount) + 1);
-		if(add_resource_record(header, limit, &trunc, sizeof(struct dns_header),
-		                       &p, hostn ? daemon->local_ttl : config.dns.blockTTL.v.ui,
-		                       NULL, T_AAAA, C_IN, (char*)"6", &addr.addr6))
+		if(add_answer_template(limit, &trunc, &p, T_AAAA,
+		                       hostn ? daemon->local_ttl : config.dns.blockTTL.v.ui,
+		                       &addr.addr6, hostn))
 			log_query(flags & ~F_IPV4, name, &addr, (char*)blockingreason, 0);
 	}
 
@@ -562,25 +684,9 @@ size_t _FTL_make_answer(struct dns_header *header, char *limit, const size_t len
 
 static bool is_pihole_domain(const char *domain)
 {
-	if(!pihole_suffix && daemon->domain_suffix)
-	{
-		// Build "pi.hole.<local suffix>" domain
-		pihole_suffix = calloc(strlen(daemon->domain_suffix) + 9, sizeof(char));
-		strcpy(pihole_suffix, "pi.hole.");
-		strcat(pihole_suffix, daemon->domain_suffix);
-		log_debug(DEBUG_QUERIES, "Domain suffix is \"%s\"", daemon->domain_suffix);
-	}
-	if(!hostname_suffix && daemon->domain_suffix)
-	{
-		// Build "<hostname>.<local suffix>" domain
-		hostname_suffix = calloc(strlen(hostname()) + strlen(daemon->domain_suffix) + 2, sizeof(char));
-		strcpy(hostname_suffix, hostname());
-		strcat(hostname_suffix, ".");
-		strcat(hostname_suffix, daemon->domain_suffix);
-	}
-	return strcasecmp(domain, "pi.hole") == 0 || strcasecmp(domain, hostname()) == 0 ||
-	       (pihole_suffix && strcasecmp(domain, pihole_suffix) == 0) ||
-	       (hostname_suffix && strcasecmp(domain, hostname_suffix) == 0);
+	// "pi.hole", the hostname and both with the local domain suffix
+	// appended (if configured)
+	return special_domain_type(domain, daemon->domain_suffix) == SPECIAL_PIHOLE;
 }
 
 bool _FTL_new_query(const unsigned int flags, const char *name,
@@ -593,6 +699,14 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 
 	// Get timestamp
 	const double querytimestamp = double_time();
+	const uint64_t trace_start = latency_trace_start();
+
+	// Forget prefetching state of the previous query
+	prefetch.id = id;
+	prefetch.popular = false;
+	prefetch.due = false;
+	prefetch.refreshing = false;
+	hit_ttl = CACHE_HIT_TTL_MAX;
 
 	// Save request time
 	struct timeval request;
@@ -705,42 +819,61 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	if(querytype == TYPE_PTR && config.dns.piholePTR.v.ptr_type != PTR_NONE)
 		check_pihole_PTR((char*)name);
 
-	// Convert domain to lower case
+	// Convert domain to lower case (and hash it for the lookup below)
 	char *domainString = strdup(name);
-	strtolower(domainString);
+	const uint32_t domainHash = strtolower_hash(domainString);
 
 	// Get client IP address
 	// The requestor's IP address can be rewritten using EDNS(0) client
 	// subnet (ECS) data), however, we do not rewrite the IPs ::1 and
 	// 127.0.0.1 to avoid queries originating from localhost of the
 	// *distant* machine as queries coming from the *local* machine
+	// The client is looked up by its binary address, the text form is only
+	// needed when the client is new
 	const sa_family_t family = addr ? addr->sa.sa_family : AF_INET;
 	in_port_t clientPort = daemon->port;
 	bool internal_query = false;
-	char clientIP[ADDRSTRLEN+1] = { 0 };
+	struct client_addr client_addr;
+	memset(&client_addr, 0, sizeof(client_addr));
 	ednsData *edns = getEDNS();
 	if(config.dns.EDNS0ECS.v.b && edns && edns->client_set)
 	{
 		// Use ECS provided client
-		strncpy(clientIP, edns->client, ADDRSTRLEN);
-		clientIP[ADDRSTRLEN] = '\0';
+		client_addr.family = edns->client_family;
+		memcpy(&client_addr.addr, &edns->client_addr, sizeof(client_addr.addr));
 	}
 	else if(addr)
 	{
 		// Use original requestor
-		mysockaddr_extract_ip_port(addr, clientIP, &clientPort);
+		client_addr.family = family;
+		if(family == AF_INET)
+		{
+			client_addr.addr.in = addr->in.sin_addr;
+			clientPort = ntohs(addr->in.sin_port);
+		}
+		else
+		{
+			client_addr.addr.in6 = addr->in6.sin6_addr;
+			clientPort = ntohs(addr->in6.sin6_port);
+		}
 	}
 	else
 	{
 		// No client address available, this is an automatically generated (e.g.
-		// DNSSEC) query
+		// DNSSEC) query, it is attributed to "::"
 		internal_query = true;
-		strcpy(clientIP, "::");
+		client_addr.family = AF_INET6;
 	}
 
+	// Queries relayed by the DNS-over-TLS server are attributed to the
+	// client of the TLS connection
+	if(addr && !internal_query)
+		dot_client(&client_addr, clientPort);
+
 	// Check if user wants to skip queries coming from localhost
 	if(config.dns.ignoreLocalhost.v.b &&
-	   (strcmp(clientIP, "127.0.0.1") == 0 || strcmp(clientIP, "::1") == 0))
+	   ((client_addr.family == AF_INET && client_addr.addr.in.s_addr == htonl(INADDR_LOOPBACK)) ||
+	    (client_addr.family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&client_addr.addr.in6))))
 	{
 		free(domainString);
 		return false;
@@ -751,7 +884,7 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	const int queryID = counters->queries;
 
 	// Find client IP
-	const int clientID = findClientID(clientIP, true, false, querytimestamp);
+	const int clientID = findClientIDaddr(&client_addr, true, querytimestamp);
 
 	// Get client pointer
 	clientsData *client = getClient(clientID, true);
@@ -765,6 +898,11 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 		return false;
 	}
 
+	// Text form of the client address for logging, the string memory may
+	// move when new strings are added below
+	char clientIP[ADDRSTRLEN+1] = { 0 };
+	strncpy(clientIP, getstr(client->ippos), ADDRSTRLEN);
+
 	// Update rolling window of queries per second
 	update_qps(querytimestamp);
 
@@ -773,23 +911,8 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	const char *interface = internal_query ? "-" : next_iface.name;
 
 	// Check rate-limit for this client
-	if(!internal_query && config.dns.rateLimit.count.v.ui > 0 &&
-	   (++client->rate_limit > config.dns.rateLimit.count.v.ui  || client->flags.rate_limited))
+	if(!internal_query && rate_limit_query(&client->rate_limit, clientIP, querytimestamp))
 	{
-		if(!client->flags.rate_limited)
-		{
-			// Log the first rate-limited query for this client in
-			// this interval. We do not log the blocked domain for
-			// privacy reasons
-			logg_rate_limit_message(clientIP, client->rate_limit);
-			// Reset rate-limiting counter so we can count what
-			// comes within the adjacent interval
-			client->rate_limit = 0;
-		}
-
-		// Memorize this client needs rate-limiting
-		client->flags.rate_limited = true;
-
 		// Block this query
 		force_next_DNS_reply = REPLY_REFUSED;
 		blockingreason = "Rate-limiting";
@@ -844,7 +967,7 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	}
 
 	// Go through already knows domains and see if it is one of them
-	const int domainID = findDomainID(domainString, true);
+	const int domainID = findHashedDomainID(domainString, domainHash, true);
 
 	// Save everything
 	queriesData *query = getQuery(queryID, false);
@@ -861,27 +984,29 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 
 	// Fill query object with available data
 	query->magic = MAGICBYTE;
-	query->timestamp = querytimestamp;
+	set_query_timestamp(query, querytimestamp);
 	query->type = querytype;
-	counters->querytype[querytype]++;
-	log_debug(DEBUG_STATUS, "query type %d set (new query), ID = %d, new count = %u", query->type, id, counters->querytype[query->type]);
+	change_querytype_count(querytype, 1);
+	log_debug(DEBUG_STATUS, "query type %d set (new query), ID = %d, new count = %u", query->type, id, get_querytype_count(query->type));
 	query->qtype = qtype;
 	query->id = id; // Has to be set before calling query_set_status()
+	add_query_id(id, queryID);
 
 	// This query is unknown as long as no reply has been found and analyzed
 	query_set_status_init(query, QUERY_UNKNOWN);
 	query->domainID = domainID;
 	query->clientID = clientID;
+	update_query_columns(query);
 	// Initialize database field, will be set when the query is stored in the long-term DB
 	query->flags.database.stored = false;
-	query->flags.database.changed = true;
+	query->flags.database.streamed = false;
+	mark_query_changed(query);
 	query->flags.complete = false;
-	query->response = querytimestamp;
-	query->flags.response_calculated = false;
+	start_query_response(query, querytimestamp);
 	// Initialize reply type
 	query->reply = REPLY_UNKNOWN;
-	counters->reply[REPLY_UNKNOWN]++;
-	log_debug(DEBUG_STATUS, "reply type %u set (new query), ID = %d, new count = %u", query->reply, query->id, counters->reply[query->reply]);
+	change_reply_count(REPLY_UNKNOWN, 1);
+	log_debug(DEBUG_STATUS, "reply type %u set (new query), ID = %d, new count = %u", query->reply, query->id, get_reply_count(query->reply));
 	// Store DNSSEC result for this domain
 	query->dnssec = DNSSEC_UNKNOWN;
 	query->CNAME_domainID = -1;
@@ -902,16 +1027,27 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 
 	// Initialize cache ID, may be reusing an existing one if this
 	// (domain,client,type) tuple was already seen before
-	query->cacheID = findCacheID(domainID, clientID, querytype, true);
+	query->cacheID = findCacheID(domainID, cache_client_key(client), querytype, true);
+
+	// Reference domain, client and cache record of this query so they are
+	// not recycled while the query is in memory
+	ref_query(query);
 
 	// This query is new and not yet known to the database
-	query->db = -1;
+	set_query_dbid(query, -1);
+
+	// Client and domain are known now
+	if(!internal_query)
+		latency_trace_begin(id, domainID, clientID, trace_start);
 
 	// Increase DNS queries counter
 	counters->queries++;
+	FTL_PROBE(query_new, queryID, id, domainString, clientIP, querytype);
 
 	// Update overTime data structure with the new client
 	change_clientcount(client, 0, 0, timeidx, 1);
+	change_overTime_tiers(querytimestamp, 1, 0, 0, 0);
+	client_sketch_add(clientID, domainID, CLIENT_SKETCH_PERMITTED);
 
 	// Set lastQuery timer and add one query for network table
 	client->lastQuery = querytimestamp;
@@ -922,6 +1058,10 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	if(domain != NULL)
 		domain->lastQuery = querytimestamp;
 
+	// Popular domains are refreshed before their cache records expire
+	if(domain != NULL && !internal_query && config.dns.cache.prefetch.v.ui > 0)
+		prefetch.popular = (unsigned int)domain->count >= config.dns.cache.prefetchHits.v.ui;
+
 	// Process interface information of client (if available)
 	// Skip interface name length 1 to skip "-". No real interface should
 	// have a name with a length of 1...
@@ -987,13 +1127,24 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	// Check if this should be blocked only for active queries
 	// (skipped for internally generated ones, e.g., DNSSEC)
 	if(!internal_query && querytype != TYPE_NONE)
+	{
+		list_checks = 0;
 		blockDomain = FTL_check_blocking(queryID, domainID, clientID);
+		latency_trace_checked(id, list_checks);
+		FTL_PROBE(query_checked, queryID, blockDomain, query->status, list_checks);
+
+		// Count the query for the list which allowed or blocked it
+		const DNSCacheData *cache = blockDomain || query->flags.allowed ?
+		                            getDNSCache(query->cacheID, true) : NULL;
+		if(cache != NULL && cache->list_id != -1)
+			count_list_hit(cache->list_id, querytimestamp);
+	}
 
 	// Free allocated memory
 	free(domainString);
 
 	// Store query in database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Release thread lock
 	unlock_shm();
@@ -1273,6 +1424,7 @@ static bool check_domain_blocked(const char *domain,
 		return false;
 
 	// Check domains against exact blacklist
+	list_checks |= LATENCY_CHECK_DENY_EXACT;
 	const enum db_result blacklist = in_denylist(domain, dns_cache, client);
 	if(blacklist == FOUND)
 	{
@@ -1286,6 +1438,7 @@ static bool check_domain_blocked(const char *domain,
 
 	// Check domain against antigravity
 	int list_id = -1;
+	list_checks |= LATENCY_CHECK_ANTIGRAVITY;
 	const enum db_result antigravity = in_gravity(domain, client, true, &list_id);
 	if(antigravity == FOUND)
 	{
@@ -1308,6 +1461,7 @@ static bool check_domain_blocked(const char *domain,
 	}
 
 	// Check domains against gravity domains
+	list_checks |= LATENCY_CHECK_GRAVITY;
 	const enum db_result gravity = in_gravity(domain, client, false, &list_id);
 	if(gravity == FOUND)
 	{
@@ -1366,6 +1520,7 @@ static bool check_domain_blocked(const char *domain,
 
 	// Check domain against blacklist regex filters
 	// Skipped when the domain is whitelisted or blocked by exact blacklist or gravity
+	list_checks |= LATENCY_CHECK_DENY_REGEX;
 	if(in_regex(domain, dns_cache, client->id, REGEX_DENY))
 	{
 		// Set new status
@@ -1391,6 +1546,11 @@ static bool check_domain_blocked(const char *domain,
 // Special domain checking
 static bool special_domain(const queriesData *query, const char *domain)
 {
+	// Only domains enabled in the config are contained in the table
+	const enum special_domain_type type = special_domain_type(domain, daemon->domain_suffix);
+	if(type == SPECIAL_NONE || type == SPECIAL_PIHOLE)
+		return false;
+
 	// Mozilla canary domain
 	// Network administrators may configure their networks as follows to signal
 	// that their local DNS resolver implemented special features that make the
@@ -1400,8 +1560,7 @@ static bool special_domain(const queriesData *query, const char *domain)
 	// than NOERROR, such as NXDOMAIN (non-existent domain) or SERVFAIL; or
 	// respond with NOERROR, but return no A or AAAA records.
 	// https://support.mozilla.org/en-US/kb/configuring-networks-disable-dns-over-https
-	if(config.dns.specialDomains.mozillaCanary.v.b &&
-	   strcasecmp(domain, "use-application-dns.net") == 0 &&
+	if(type == SPECIAL_MOZILLA_CANARY &&
 	   (query->type == TYPE_A || query->type == TYPE_AAAA))
 	{
 		blockingreason = "Mozilla canary domain";
@@ -1424,9 +1583,7 @@ static bool special_domain(const queriesData *query, const char *domain)
 	// > mask.icloud.com
 	// > mask-h2.icloud.com
 	// https://developer.apple.com/support/prepare-your-network-for-icloud-private-relay
-	if(config.dns.specialDomains.iCloudPrivateRelay.v.b &&
-	   (strcasecmp(domain, "mask.icloud.com") == 0 ||
-	    strcasecmp(domain, "mask-h2.icloud.com") == 0))
+	if(type == SPECIAL_ICLOUD_RELAY)
 	{
 		blockingreason = "Apple iCloud Private Relay domain";
 		force_next_DNS_reply = REPLY_NXDOMAIN;
@@ -1452,8 +1609,7 @@ static bool special_domain(const queriesData *query, const char *domain)
 	// Resolvers, it SHOULD return NODATA for queries to the "resolver.arpa"
 	// zone, to provide a consistent and accurate signal to clients that it
 	// does not have a Designated Resolver.
-	if(config.dns.specialDomains.designatedResolver.v.b &&
-	   strlen(domain) > 13 && strcasecmp(&domain[strlen(domain) - 13], "resolver.arpa") == 0)
+	if(type == SPECIAL_DESIGNATED_RESOLVER)
 	{
 		blockingreason = "Designated Resolver domain";
 		force_next_DNS_reply = REPLY_NODATA;
@@ -1503,6 +1659,17 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 		dns_cache->list_id = -1;
 	}
 
+	// Records created before the lists have been reloaded may be outdated
+	if(dns_cache->generation != get_gravity_generation())
+	{
+		log_debug(DEBUG_QUERIES, "DNS cache record predates list reload");
+		dns_cache->blocking_status = QUERY_UNKNOWN;
+		dns_cache->flags.allowed = false;
+		dns_cache->expires = 0;
+		dns_cache->list_id = -1;
+		dns_cache->generation = get_gravity_generation();
+	}
+
 	// Check if the cache record we have applies to the current query
 	// If not, ensure we re-check the domain (happens during CNAME inspection)
 	enum query_status blocking_status = QUERY_UNKNOWN;
@@ -1512,10 +1679,13 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 	// Memorize blocking status DNS cache for the domain/client combination
 	cacheStatus = blocking_status;
 	log_debug(DEBUG_QUERIES, "Set global cache status to %d", cacheStatus);
+	if(blocking_status != QUERY_UNKNOWN)
+		list_checks |= LATENCY_CHECK_CACHE;
 
 	// Skip the entire chain of tests if we already know the answer for this
 	// particular client
-	char *domainstr = (char*)getstr(domain->domainpos);
+	lists_available = true;
+	char *domainstr = (char*)getDomainName(domain);
 	switch(blocking_status)
 	{
 		case QUERY_UNKNOWN:
@@ -1539,7 +1709,7 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 				force_next_DNS_reply = dns_cache->force_reply;
 				query_blocked(query, domain, client, blocking_status);
 				if(blocking_status == QUERY_DENYLIST_CNAME)
-					query->CNAME_domainID = dns_cache->CNAME_domainID;
+					set_query_CNAME(query, dns_cache->CNAME_domainID);
 				return true;
 			}
 			break;
@@ -1558,7 +1728,7 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 				force_next_DNS_reply = dns_cache->force_reply;
 				query_blocked(query, domain, client, blocking_status);
 				if(blocking_status == QUERY_GRAVITY_CNAME)
-					query->CNAME_domainID = dns_cache->CNAME_domainID;
+					set_query_CNAME(query, dns_cache->CNAME_domainID);
 				return true;
 			}
 			break;
@@ -1579,7 +1749,7 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 				last_regex_idx = dns_cache->list_id;
 				query_blocked(query, domain, client, blocking_status);
 				if(blocking_status == QUERY_REGEX_CNAME)
-					query->CNAME_domainID = dns_cache->CNAME_domainID;
+					set_query_CNAME(query, dns_cache->CNAME_domainID);
 				return true;
 			}
 			break;
@@ -1689,13 +1859,19 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 	const char *blockedDomain = domainstr;
 
 	// Check exact whitelist for match
+	list_checks |= LATENCY_CHECK_ALLOW_EXACT;
 	query->flags.allowed = in_allowlist(domainstr, dns_cache, client) == FOUND;
 
 	// If not found: Check regex whitelist for match
 	if(!query->flags.allowed)
+	{
+		list_checks |= LATENCY_CHECK_ALLOW_REGEX;
 		query->flags.allowed = in_regex(domainstr, dns_cache, client->id, REGEX_ALLOW);
+	}
 
 	// Check if this is a special domain
+	if(!query->flags.allowed)
+		list_checks |= LATENCY_CHECK_SPECIAL;
 	if(!query->flags.allowed && special_domain(query, domainstr))
 	{
 		// Set DNS cache properties
@@ -1744,6 +1920,8 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 		}
 	}
 
+	lists_available = db_okay;
+
 	// Common actions regardless what the possible blocking reason is
 	if(blockDomain)
 	{
@@ -1777,10 +1955,290 @@ static bool FTL_check_blocking(const unsigned int queryID, const unsigned int do
 	return blockDomain;
 }
 
-bool FTL_CNAME(const char *dst, const char *src, const int id)
+// Get the slot of the verdict for a CNAME target, key is filled with the
+// fields identifying the verdict
+static struct cname_verdict *get_cname_verdict(const int domainID, const uint32_t hash,
+                                               const clientsData *client, const enum query_type type,
+                                               struct cname_verdict *key)
+{
+	if(cname_verdicts == NULL &&
+	   (cname_verdicts = calloc(CNAME_VERDICT_SLOTS, sizeof(*cname_verdicts))) == NULL)
+		return NULL;
+
+	// Clients share verdicts when they are in the same groups. The groups
+	// string is hashed as its position may change (see compact_strings())
+	memset(key, 0, sizeof(*key));
+	key->hash = hash;
+	key->groups = client->flags.found_group ? hashStr(getstr(client->groupspos)) : hashStr(getstr(client->ippos));
+	key->domainID = domainID;
+	key->type = type;
+	key->generation = get_gravity_generation();
+
+	return &cname_verdicts[(hash ^ key->groups ^ type) % CNAME_VERDICT_SLOTS];
+}
+
+// Check blocking of a CNAME target, reusing the verdict of an earlier
+// inspection of the same target if possible
+static bool check_CNAME_blocking(const unsigned int queryID, const int domainID, const uint32_t hash,
+                                 const unsigned int clientID, const unsigned long ttl)
+{
+	queriesData *query = getQuery(queryID, true);
+	clientsData *client = getClient(clientID, true);
+	domainsData *domain = domainID < 0 ? NULL : getDomain(domainID, true);
+	DNSCacheData *dns_cache = query == NULL ? NULL : getDNSCache(query->cacheID, true);
+
+	// Verdicts are not cached when blocking is disabled, when an allowlist
+	// entry has already matched along the CNAME path or when caching of
+	// blocking decisions is disabled altogether
+	struct cname_verdict key, *verdict = NULL;
+	if(query != NULL && client != NULL && domain != NULL && dns_cache != NULL &&
+	   ttl > 0 && !query->flags.allowed &&
+	   get_blockingstatus() != BLOCKING_DISABLED &&
+	   config.dns.cache.upstreamBlockedTTL.v.ui > 0)
+		verdict = get_cname_verdict(domainID, hash, client, query->type, &key);
+
+	if(verdict == NULL)
+		return FTL_check_blocking(queryID, domainID, clientID);
+
+	const time_t now = time(NULL);
+	if(verdict->hash == key.hash && verdict->groups == key.groups &&
+	   verdict->domainID == key.domainID && verdict->type == key.type &&
+	   verdict->generation == key.generation && verdict->expires >= now)
+	{
+		counters->cname_verdicts.hits++;
+		list_checks |= LATENCY_CHECK_CACHE;
+		cacheStatus = QUERY_UNKNOWN;
+		log_debug(DEBUG_QUERIES, "%s is known as %s during CNAME inspection (expires in %lis)",
+		          getDomainName(domain), verdict->blocked ? verdict->reason :
+		          verdict->allowed ? "allowed" : "not blocked", (long)(verdict->expires - now));
+
+		if(verdict->allowed)
+		{
+			query->flags.allowed = true;
+			dns_cache->list_id = verdict->list_id;
+		}
+
+		if(!verdict->blocked)
+			return false;
+
+		blockingreason = verdict->reason;
+		force_next_DNS_reply = verdict->force_reply;
+		last_regex_idx = verdict->regex_idx;
+		cname_target = verdict->cname_target;
+		dns_cache->list_id = verdict->list_id;
+		dns_cache->force_reply = verdict->force_reply;
+		if(verdict->status == QUERY_SPECIAL_DOMAIN)
+			dns_cache->blocking_status = QUERY_SPECIAL_DOMAIN;
+		query_blocked(query, domain, client, verdict->status);
+
+		return true;
+	}
+
+	counters->cname_verdicts.misses++;
+	const bool block = FTL_check_blocking(queryID, domainID, clientID);
+
+	// Do not remember verdicts obtained while the database was busy
+	if(!lists_available)
+		return block;
+
+	// The shared memory may have been resized in the meantime
+	query = getQuery(queryID, true);
+	dns_cache = query == NULL ? NULL : getDNSCache(query->cacheID, true);
+	if(dns_cache == NULL)
+		return block;
+
+	*verdict = key;
+	verdict->expires = now + (time_t)ttl;
+	verdict->blocked = block;
+	verdict->allowed = query->flags.allowed;
+	verdict->status = query->status;
+	verdict->force_reply = force_next_DNS_reply;
+	verdict->list_id = dns_cache->list_id;
+	verdict->regex_idx = last_regex_idx;
+	verdict->reason = blockingreason;
+	verdict->cname_target = cname_target;
+
+	return block;
+}
+
+// Get a client the blocking decisions of a DNS cache record can be evaluated
+// for, i.e., a client with the groups the shared client key of the record
+// has been derived from (see cache_client_key()). Reloading the lists makes
+// all clients look up their groups again, this is done while evaluating the
+// lists so the key may only be compared afterwards
+static clientsData *get_cache_client(const DNSCacheData *dns_cache)
+{
+	if(dns_cache->clientID < CACHE_SHARED_KEY)
+		return getClient(dns_cache->clientID, true);
+
+	const size_t groupspos = dns_cache->clientID & ~CACHE_SHARED_KEY;
+	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		clientsData *client = getClient(clientID, true);
+		if(client != NULL && !client->flags.aliasclient && client->groupspos == groupspos)
+			return client;
+	}
+
+	return NULL;
+}
+
+// Re-evaluate the blocking decision of a DNS cache record created before the
+// lists have been reloaded and carry it over into the current generation. Only
+// decisions depending on nothing but the domain, the client's groups and the
+// query type can be refreshed: decisions of deep CNAME inspection, for special
+// domains or made by the upstream server are left to the next query. The SHM
+// lock has to be held
+static bool refresh_cache_record(DNSCacheData *dns_cache, const unsigned int generation)
+{
+	const enum query_status old_status = dns_cache->blocking_status;
+	const bool was_blocked = old_status == QUERY_DENYLIST || old_status == QUERY_GRAVITY || old_status == QUERY_REGEX;
+	if(!was_blocked && old_status != QUERY_FORWARDED && old_status != QUERY_CACHE && old_status != QUERY_CACHE_STALE)
+		return false;
+
+	const domainsData *domain = getDomain(dns_cache->domainID, true);
+	clientsData *client = get_cache_client(dns_cache);
+	if(domain == NULL || client == NULL)
+		return false;
+
+	// The string memory may be reorganized while the lists are evaluated
+	char *domainstr = strdup(getDomainName(domain));
+	if(domainstr == NULL)
+		return false;
+	const enum special_domain_type type = special_domain_type(domainstr, daemon->domain_suffix);
+	if((type != SPECIAL_NONE && type != SPECIAL_PIHOLE) ||
+	   (config.dns.blockESNI.v.b && strncasecmp(domainstr, "_esni.", 6u) == 0))
+	{
+		free(domainstr);
+		return false;
+	}
+
+	// Evaluate the lists the same way FTL_check_blocking() does, the record
+	// is restored if the decision cannot be refreshed
+	const DNSCacheData old = *dns_cache;
+	dns_cache->flags.allowed = false;
+	dns_cache->list_id = -1;
+	queriesData query = { .type = dns_cache->query_type };
+	query.flags.allowed = in_allowlist(domainstr, dns_cache, client) == FOUND;
+	if(!query.flags.allowed)
+		query.flags.allowed = in_regex(domainstr, dns_cache, client->id, REGEX_ALLOW);
+
+	enum query_status new_status = QUERY_UNKNOWN;
+	bool db_okay = true;
+	force_next_DNS_reply = REPLY_UNKNOWN;
+	const bool blocked = check_domain_blocked(domainstr, client, &query, dns_cache, &new_status, &db_okay);
+	free(domainstr);
+
+	// The decision is only carried over if the lists were available, the
+	// client still has the groups of the record and a domain which has been
+	// blocked so far remains blocked (the status of an allowed query is
+	// only known once it has been answered)
+	if(!db_okay || cache_client_key(client) != old.clientID || (!blocked && was_blocked))
+	{
+		*dns_cache = old;
+		return false;
+	}
+
+	if(blocked)
+	{
+		dns_cache->blocking_status = new_status;
+		if(new_status != QUERY_REGEX)
+			dns_cache->force_reply = REPLY_UNKNOWN;
+	}
+	else
+		dns_cache->flags.allowed = query.flags.allowed;
+	dns_cache->expires = 0;
+	dns_cache->generation = generation;
+
+	return true;
+}
+
+// Order DNS cache records by the number of queries referencing them (most
+// referenced first)
+static int cmp_cache_refs(const void *a, const void *b)
+{
+	const unsigned int refs_a = ((const unsigned int *)a)[1];
+	const unsigned int refs_b = ((const unsigned int *)b)[1];
+	return refs_a < refs_b ? 1 : refs_a > refs_b ? -1 : 0;
+}
+
+/**
+ * Re-validate the most frequently used DNS cache records after the lists have
+ * been reloaded. Reloading starts a new gravity generation so the next query
+ * for every domain would have to evaluate all lists again while the client is
+ * waiting. Doing this in the background for the hottest records means the
+ * popular domains are still answered from the cache. Called by the database
+ * thread after reloading the lists
+ */
+void FTL_refresh_dns_cache(void)
+{
+	if(get_blockingstatus() == BLOCKING_DISABLED ||
+	   config.dns.cache.upstreamBlockedTTL.v.ui == 0)
+		return;
+
+	// Find the hottest records of a previous generation (pairs of cache ID
+	// and references)
+	const double start = double_time();
+	unsigned int (*hot)[2] = NULL;
+	unsigned int num = 0u;
+	lock_shm_read();
+	const unsigned int generation = get_gravity_generation();
+	if(counters->dns_cache_size > 0)
+		hot = calloc(counters->dns_cache_size, sizeof(*hot));
+	for(unsigned int cacheID = 0; hot != NULL && cacheID < counters->dns_cache_size; cacheID++)
+	{
+		const DNSCacheData *dns_cache = getDNSCache(cacheID, false);
+		if(dns_cache == NULL || dns_cache->magic != MAGICBYTE ||
+		   dns_cache->generation == generation || dns_cache->refs < CACHE_REFRESH_MIN_REFS)
+			continue;
+		hot[num][0] = cacheID;
+		hot[num][1] = dns_cache->refs;
+		num++;
+	}
+	unlock_shm_read();
+
+	if(num == 0)
+	{
+		if(hot != NULL)
+			free(hot);
+		return;
+	}
+
+	qsort(hot, num, sizeof(*hot), cmp_cache_refs);
+	if(num > CACHE_REFRESH_MAX)
+		num = CACHE_REFRESH_MAX;
+
+	// Keep the lock only briefly so queries are not delayed noticeably
+	unsigned int refreshed = 0u;
+	for(unsigned int i = 0; i < num && !killed; i += CACHE_REFRESH_BATCH)
+	{
+		lock_shm();
+		// Stop if the lists have been reloaded again in the meantime
+		if(get_gravity_generation() != generation)
+		{
+			unlock_shm();
+			break;
+		}
+		for(unsigned int j = i; j < num && j < i + CACHE_REFRESH_BATCH; j++)
+		{
+			DNSCacheData *dns_cache = getDNSCache(hot[j][0], false);
+			// Skip records which have been re-validated by a query or
+			// recycled in the meantime
+			if(dns_cache != NULL && dns_cache->magic == MAGICBYTE && dns_cache->generation != generation &&
+			   refresh_cache_record(dns_cache, generation))
+				refreshed++;
+		}
+		unlock_shm();
+	}
+
+	log_debug(DEBUG_DATABASE, "Refreshed %u of %u hot DNS cache record%s in %.1f ms",
+	          refreshed, num, num == 1 ? "" : "s", 1e3*(double_time() - start));
+	free(hot);
+}
+
+bool FTL_CNAME(const char *dst, const char *src, const int id, const unsigned long ttl)
 {
 	const double now = double_time();
-	log_debug(DEBUG_QUERIES, "FTL_CNAME called with: src = %s, dst = %s, id = %d", src, dst, id);
+	log_debug(DEBUG_QUERIES, "FTL_CNAME called with: src = %s, dst = %s, id = %d, ttl = %lu", src, dst, id, ttl);
 
 	// Does the user want to skip deep CNAME inspection?
 	if(!config.dns.CNAMEdeepInspect.v.b)
@@ -1829,8 +2287,8 @@ bool FTL_CNAME(const char *dst, const char *src, const int id)
 	// This is the domain which was queried later in this chain
 	char *child_domain = strdup(dst);
 	// Convert to lowercase for matching
-	strtolower(child_domain);
-	const int child_domainID = findDomainID(child_domain, false);
+	const uint32_t child_hash = strtolower_hash(child_domain);
+	const int child_domainID = findHashedDomainID(child_domain, child_hash, false);
 
 	// Set child domains's last query time
 	if(child_domainID >= 0)
@@ -1845,7 +2303,7 @@ bool FTL_CNAME(const char *dst, const char *src, const int id)
 	const int clientID = query->clientID;
 
 	// Check per-client blocking for the child domain
-	const bool block = FTL_check_blocking(queryID, child_domainID, clientID);
+	const bool block = check_CNAME_blocking(queryID, child_domainID, child_hash, clientID, ttl);
 
 	// If we find during a CNAME inspection that we want to block the entire chain,
 	// the originally queried domain itself was not counted as blocked. We have to
@@ -1862,18 +2320,29 @@ bool FTL_CNAME(const char *dst, const char *src, const int id)
 			return false;
 		}
 		parent_domain->blockedcount++;
+		top_lists_domain_changed(parent_domainID, parent_domain);
 
 		// Store query response as CNAME type
 		query_set_reply(F_CNAME, 0, NULL, query, now);
 
 		// Store domain that was the reason for blocking the entire chain
-		query->CNAME_domainID = child_domainID;
+		set_query_CNAME(query, child_domainID);
 
 		// Store CNAME domain ID in DNS cache
-		const int parent_cacheID = query->cacheID > -1 ? query->cacheID : findCacheID(parent_domainID, clientID, query->type, false);
+		const clientsData *client = getClient(clientID, true);
+		const unsigned int cache_key = client != NULL ? cache_client_key(client) : (unsigned int)clientID;
+		const int parent_cacheID = query->cacheID > -1 ? query->cacheID : findCacheID(parent_domainID, cache_key, query->type, false);
 		DNSCacheData *parent_cache = parent_cacheID < 0 ? NULL : getDNSCache(parent_cacheID, true);
 		if(parent_cache != NULL)
-			parent_cache->CNAME_domainID = child_domainID;
+			set_cache_CNAME(parent_cache, child_domainID);
+
+		// Get child DNS cache entry
+		const int child_cacheID = findCacheID(child_domainID, cache_key, query->type, false);
+		const DNSCacheData *child_cache = child_cacheID < 0 ? NULL : getDNSCache(child_cacheID, true);
+
+		// Count the query for the list which blocked the CNAME target
+		if(child_cache != NULL && child_cache->list_id != -1)
+			count_list_hit(child_cache->list_id, now);
 
 		// Change blocking reason into CNAME-caused blocking
 		if(query->status == QUERY_GRAVITY)
@@ -1882,12 +2351,6 @@ bool FTL_CNAME(const char *dst, const char *src, const int id)
 		}
 		else if(query->status == QUERY_REGEX)
 		{
-			// Get child DNS cache entries
-			const int child_cacheID = findCacheID(child_domainID, clientID, query->type, false);
-
-			// Get child's cache pointer
-			const DNSCacheData *child_cache = child_cacheID < 0 ? NULL : getDNSCache(child_cacheID, true);
-
 			// Propagate ID of responsible regex up from the child to the parent
 			// domain (but only if set)
 			if(parent_cache != NULL && child_cache != NULL && child_cache->list_id != -1)
@@ -1907,7 +2370,7 @@ bool FTL_CNAME(const char *dst, const char *src, const int id)
 	log_debug(DEBUG_QUERIES, "Query %d: CNAME %s ---> %s", id, src, dst);
 
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Return result
 	free(child_domain);
@@ -1920,6 +2383,7 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 {
 	// Save that this query got forwarded to an upstream server
 	const double now = double_time();
+	latency_trace_mark(id, LATENCY_FORWARD);
 
 	// Lock shared memory
 	lock_shm();
@@ -1987,6 +2451,7 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 	// if not found in current data structure
 	const unsigned int upstreamID = findUpstreamID(upstreamIP, upstreamPort);
 	query->upstreamID = upstreamID;
+	FTL_PROBE(query_forwarded, queryID, upstreamIP, upstreamPort);
 
 	upstreamsData *upstream = getUpstream(upstreamID, true);
 	if(upstream != NULL)
@@ -1995,6 +2460,17 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 		upstream->lastQuery = now;
 	}
 
+	// The client has already been answered from cache, this only refreshes
+	// the cache record so the query keeps its status
+	if(prefetch.refreshing && prefetch.id == id)
+	{
+		prefetch.refreshing = false;
+		counters->prefetch.issued++;
+		free(upstreamIP);
+		unlock_shm();
+		return;
+	}
+
 	// Proceed only if
 	// - current query has not been marked as replied to so far
 	//   (it could be that answers from multiple forward
@@ -2034,8 +2510,7 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 			// can go back in time to measure both the initial cache
 			// lookup and the (now starting) time it takes for the
 			// upstream to respond
-			query->response = now - query->response;
-			query->flags.response_calculated = false;
+			start_query_response(query, now - get_query_response(query));
 		}
 	}
 	else
@@ -2043,6 +2518,10 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 		// Normal forwarded query (status is set below)
 		// Hereby, this query is now fully determined
 		query->flags.complete = true;
+
+		// Prefetching did not keep this popular domain in the cache
+		if(prefetch.popular && prefetch.id == id)
+			counters->prefetch.misses++;
 	}
 
 	// Set query status to forwarded only after the
@@ -2055,13 +2534,15 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 	free(upstreamIP);
 
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Unlock shared memory
 	unlock_shm();
 }
 
 static unsigned int reload = 0u;
+// Whether the domainlists have been loaded during startup
+static bool domainlists_loaded = false;
 void FTL_dnsmasq_reload(void)
 {
 	// This function is called by the dnsmasq code on receive of SIGHUP
@@ -2075,7 +2556,10 @@ void FTL_dnsmasq_reload(void)
 	// - check adlist table for inaccessible adlists
 	// - Read and compile regex filters (incl. per-client)
 	// - Flush FTL's DNS cache
-	set_event(RELOAD_GRAVITY);
+	// The lists have been loaded during startup already, there is no need
+	// to do this again when dnsmasq starts
+	if(reload > 1 || !domainlists_loaded)
+		set_event(RELOAD_GRAVITY);
 
 	// Print current set of capabilities if requested via debug flag
 	if(config.debug.caps.v.b)
@@ -2086,6 +2570,12 @@ void FTL_dnsmasq_reload(void)
 	if(reload > 1)
 		reread_config();
 
+	// The local domain suffix may have changed
+	special_domains_invalidate();
+
+	// The cache is about to be cleared, NSEC records go with it
+	nsec_cache_flush();
+
 	// Report blocking mode
 	log_info("Blocking status is %s", config.dns.blocking.active.v.b ? "enabled" : "disabled");
 
@@ -2093,47 +2583,366 @@ void FTL_dnsmasq_reload(void)
 	resolver_ready = true;
 }
 
-static void alladdr_extract_ip(union all_addr *addr, const sa_family_t family, char ip[ADDRSTRLEN+1])
-{
-	// Extract IP address
-	inet_ntop(family, addr, ip, ADDRSTRLEN);
-}
+// Adaptive DNS cache sizing (dns.cache.autosize)
+#define CACHE_AUTOSIZE_INTERVAL 60
+// Grow when at least 1/CACHE_GROW_EVICTIONS of the cache has been evicted
+// within one interval
+#define CACHE_GROW_EVICTIONS 100
+// Shrink when less than 1/CACHE_SHRINK_LIVE of the cache holds valid records
+// for CACHE_SHRINK_INTERVALS consecutive intervals without any evictions
+#define CACHE_SHRINK_LIVE 4
+#define CACHE_SHRINK_INTERVALS 5u
+// Never spend more than 1/CACHE_MEMORY_SHARE of the available memory on a
+// single growth step
+#define CACHE_MEMORY_SHARE 10
 
-static void mysockaddr_extract_ip_port(const union mysockaddr *server, char ip[ADDRSTRLEN+1], in_port_t *port)
+/**
+ * @brief Grow or shrink the DNS cache depending on how it has been used since
+ * the last check. Called from the event loops of all processes owning a cache
+ *
+ * @param now Current time
+ */
+void FTL_cache_autosize(const time_t now)
 {
-	// Extract IP address
-	inet_ntop(server->sa.sa_family,
-	          server->sa.sa_family == AF_INET ?
-	            (void*)&server->in.sin_addr :
-	            (void*)&server->in6.sin6_addr,
-	          ip, ADDRSTRLEN);
+	static time_t next_check = 0;
+	static unsigned int last_inserted = 0u, last_evicted = 0u, idle_intervals = 0u;
+	static bool refused = false;
 
-	// Extract port (only if requested)
-	if(port != NULL)
+	if(now < next_check)
+		return;
+	next_check = now + CACHE_AUTOSIZE_INTERVAL;
+
+	// Counters are reset when the cache is flushed
+	const unsigned int inserted = daemon->metrics[METRIC_DNS_CACHE_INSERTED];
+	const unsigned int evicted = daemon->metrics[METRIC_DNS_CACHE_LIVE_FREED];
+	const unsigned int new_inserted = inserted >= last_inserted ? inserted - last_inserted : inserted;
+	const unsigned int new_evicted = evicted >= last_evicted ? evicted - last_evicted : evicted;
+	last_inserted = inserted;
+	last_evicted = evicted;
+
+	// A cache size of zero disables caching altogether
+	const int size = daemon->cachesize;
+	if(!config.dns.cache.autosize.v.b || size <= 0)
+		return;
+
+	if(new_evicted > 0 && new_evicted * CACHE_GROW_EVICTIONS >= (unsigned int)size)
 	{
-		*port = ntohs(server->sa.sa_family == AF_INET ?
-		                server->in.sin_port :
-		                server->in6.sin6_port);
-	}
-}
+		idle_intervals = 0;
 
-// Compute cache/upstream response time
-static inline void set_response_time(queriesData *query, const double now)
-{
-	// Do this only if this is the first time we set a reply
-	if(query->flags.response_calculated)
-		return;
+		// Double the cache but stay within the configured limit
+		const unsigned int max_size = config.dns.cache.maxSize.v.ui;
+		const int count = (unsigned int)size >= max_size ? 0 :
+		                  (int)min((unsigned int)size, max_size - (unsigned int)size);
+		if(count == 0)
+		{
+			if(!refused)
+				log_info("DNS cache: %u records evicted before their TTL expired within the last %d seconds, not growing beyond dns.cache.maxSize = %u",
+				         new_evicted, CACHE_AUTOSIZE_INTERVAL, max_size);
+			refused = true;
+			return;
+		}
 
-	// Convert absolute timestamp to relative timestamp
-	query->response = now - query->response;
-	query->flags.response_calculated = true;
-}
+		// Check there is enough memory left for the new entries
+		struct proc_meminfo mem = { 0 };
+		const size_t needed = count * sizeof(struct crec);
+		if(!parse_proc_meminfo(&mem) || needed / 1024 > mem.avail / CACHE_MEMORY_SHARE)
+		{
+			if(!refused)
+				log_info("DNS cache: %u records evicted before their TTL expired within the last %d seconds, not growing as only %lu kB of memory are available",
+				         new_evicted, CACHE_AUTOSIZE_INTERVAL, mem.avail);
+			refused = true;
+			return;
+		}
 
-// Changes upstream server (only relevant when multiple servers are defined)
-// If this is an upstream response and the answering upstream is known (may not
-// be the case for internally generated DNSSEC queries), we have to check if the
-// first answering upstream server is also the first one we sent the query to.
-// If not, we need to change the upstream server associated with this query to
+		lock_shm();
+		const bool grown = cache_grow(count);
+		unlock_shm();
+
+		if(grown)
+		{
+			log_info("DNS cache: %u of %u inserted records evicted before their TTL expired within the last %d seconds, growing cache from %d to %d entries",
+			         new_evicted, new_inserted, CACHE_AUTOSIZE_INTERVAL, size, daemon->cachesize);
+			refused = false;
+		}
+		return;
+	}
+
+	// Do not shrink while records are still being evicted
+	if(new_evicted > 0)
+	{
+		idle_intervals = 0;
+		return;
+	}
+
+	const int live = cache_live_entries(now);
+	if(live * CACHE_SHRINK_LIVE >= size)
+	{
+		idle_intervals = 0;
+		return;
+	}
+
+	if(++idle_intervals < CACHE_SHRINK_INTERVALS)
+		return;
+	idle_intervals = 0;
+
+	// Release the most recent growth step, the initial cache (of size
+	// dns.cache.size) is never released
+	lock_shm();
+	const int dropped = cache_shrink(now);
+	unlock_shm();
+
+	if(dropped < 0)
+		return;
+
+	log_info("DNS cache: only %d of %d entries hold valid records and none were evicted within the last %u seconds, shrinking cache to %d entries (%d valid records dropped)",
+	         live, size, CACHE_SHRINK_INTERVALS * CACHE_AUTOSIZE_INTERVAL, daemon->cachesize, dropped);
+	refused = false;
+}
+
+// Persistent DNS cache (dns.cache.persist)
+#define DNS_CACHE_FILE "/etc/pihole/dns_cache.bin"
+// Save the DNS cache this often so not everything is lost on a crash
+#define CACHE_SAVE_INTERVAL 3600
+
+/**
+ * @brief Restore the DNS cache saved by FTL_cache_save(). Only done once
+ * while starting up, flushing the cache later on must not bring the records
+ * back
+ *
+ * @param now Current time
+ */
+void FTL_cache_restore(const time_t now)
+{
+	if(reload != 1 || !config.dns.cache.persist.v.b || daemon->cachesize <= 0)
+		return;
+
+	lock_shm();
+	const int restored = cache_restore(DNS_CACHE_FILE, now);
+	unlock_shm();
+
+	if(restored >= 0)
+		log_info("Restored %d DNS cache records", restored);
+	else if(errno != ENOENT)
+		log_warn("Cannot restore DNS cache from %s: %s", DNS_CACHE_FILE, strerror(errno));
+}
+
+/**
+ * @brief Save the DNS cache of the main process so it can be restored after a
+ * restart. Called from the main event loop and once more when shutting down
+ *
+ * @param now Current time
+ * @param force Save regardless of when the cache has been saved last
+ */
+void FTL_cache_save(const time_t now, const bool force)
+{
+	static time_t next_save = 0;
+
+	// Do not save the cache right after it has been restored
+	if(next_save == 0)
+		next_save = now + CACHE_SAVE_INTERVAL;
+
+	if(!config.dns.cache.persist.v.b || daemon->cachesize <= 0 ||
+	   (!force && now < next_save))
+		return;
+	next_save = now + CACHE_SAVE_INTERVAL;
+
+	// Write to a temporary file first so an interrupted write cannot
+	// destroy the previous copy
+	const char *tmpfile = DNS_CACHE_FILE".tmp";
+	lock_shm();
+	const int saved = cache_save(tmpfile, now);
+	unlock_shm();
+
+	if(saved < 0 || rename(tmpfile, DNS_CACHE_FILE) != 0)
+	{
+		log_warn("Cannot save DNS cache to %s: %s", DNS_CACHE_FILE, strerror(errno));
+		unlink(tmpfile);
+		return;
+	}
+
+	log_debug(DEBUG_QUERIES, "Saved %d DNS cache records", saved);
+}
+
+static void alladdr_extract_ip(union all_addr *addr, const sa_family_t family, char ip[ADDRSTRLEN+1])
+{
+	// Extract IP address
+	inet_ntop(family, addr, ip, ADDRSTRLEN);
+}
+
+static void mysockaddr_extract_ip_port(const union mysockaddr *server, char ip[ADDRSTRLEN+1], in_port_t *port)
+{
+	// Extract IP address
+	inet_ntop(server->sa.sa_family,
+	          server->sa.sa_family == AF_INET ?
+	            (void*)&server->in.sin_addr :
+	            (void*)&server->in6.sin6_addr,
+	          ip, ADDRSTRLEN);
+
+	// Extract port (only if requested)
+	if(port != NULL)
+	{
+		*port = ntohs(server->sa.sa_family == AF_INET ?
+		                server->in.sin_port :
+		                server->in6.sin6_port);
+	}
+}
+
+// Get the ID of the upstream a dnsmasq server corresponds to, the SHM lock has
+// to be held
+static int server_upstreamID(const union mysockaddr *addr)
+{
+	char ip[ADDRSTRLEN+1] = { 0 };
+	in_port_t port = 53;
+	mysockaddr_extract_ip_port(addr, ip, &port);
+	strtolower(ip);
+
+	return findUpstreamID(ip, port);
+}
+
+/**
+ * Get the first server a query is sent to when upstreams considered down are
+ * skipped (dns.circuitBreaker)
+ *
+ * @param first Index of the first candidate in daemon->serverarray
+ * @param last Index after the last candidate
+ * @param start Index of the server chosen so far
+ * @return Index of the first server accepting queries starting at start
+ * (wrapping around) or start if none does
+ */
+int FTL_upstream_start(const int first, const int last, const int start)
+{
+	if(!config.dns.circuitBreaker.v.b || last - first < 2 ||
+	   start < first || start >= last)
+		return start;
+
+	int selected = start;
+	lock_shm();
+	for(int n = 0; n < last - first; n++)
+	{
+		const int i = first + (start - first + n) % (last - first);
+		if(upstream_accepts_queries(server_upstreamID(&daemon->serverarray[i]->addr)))
+		{
+			selected = i;
+			break;
+		}
+	}
+	unlock_shm();
+
+	if(selected != start)
+		log_debug(DEBUG_QUERIES, "Skipping upstreams considered down, using server %d instead of %d",
+		          selected, start);
+
+	return selected;
+}
+
+/**
+ * Check if a query sent to all servers should skip one of them as it is
+ * considered down (dns.circuitBreaker)
+ *
+ * @param first Index of the first candidate in daemon->serverarray
+ * @param last Index after the last candidate
+ * @param index Index of the server to check
+ * @return true if the server is considered down and another one is not
+ */
+bool FTL_upstream_skip(const int first, const int last, const int index)
+{
+	if(!config.dns.circuitBreaker.v.b || last - first < 2)
+		return false;
+
+	bool skip = false;
+	lock_shm();
+	if(!upstream_accepts_queries(server_upstreamID(&daemon->serverarray[index]->addr)))
+	{
+		for(int i = first; i < last; i++)
+		{
+			if(i != index && upstream_accepts_queries(server_upstreamID(&daemon->serverarray[i]->addr)))
+			{
+				skip = true;
+				break;
+			}
+		}
+	}
+	unlock_shm();
+
+	return skip;
+}
+
+// Latency-aware upstream selection (dns.fastestUpstream): Weight of a new
+// sample in the moving averages, the time a failed query is assumed to cost
+// (seconds) and how often another upstream is probed
+#define UPSTREAM_EWMA_WEIGHT 0.1
+#define UPSTREAM_FAILURE_PENALTY 2.0
+#define UPSTREAM_PROBE_INTERVAL 32u
+
+// Update the moving averages of an upstream after it answered a query (after
+// response seconds) or failed to do so
+static void update_upstream_ewma(upstreamsData *upstream, const double response, const bool failed)
+{
+	upstream->ewma_failed += UPSTREAM_EWMA_WEIGHT * ((failed ? 1.0 : 0.0) - upstream->ewma_failed);
+	if(failed)
+		return;
+
+	// The first response initializes the average
+	if(upstream->responses == 1)
+		upstream->ewma_rtime = response;
+	else
+		upstream->ewma_rtime += UPSTREAM_EWMA_WEIGHT * (response - upstream->ewma_rtime);
+}
+
+/**
+ * Select the upstream server a new query should be sent to
+ *
+ * Upstreams are ranked by their expected response time, i.e., their smoothed
+ * response time plus a penalty proportional to their recent failure rate.
+ * Upstreams which have not answered yet are expected to be fast so they are
+ * tried early. Every UPSTREAM_PROBE_INTERVAL-th query is sent to the next
+ * upstream in turn instead so slower upstreams get a chance to recover.
+ *
+ * @param first Index of the first candidate in daemon->serverarray
+ * @param last Index after the last candidate
+ * @return Index of the selected server or -1 to leave the choice to dnsmasq
+ */
+int FTL_select_upstream(const int first, const int last)
+{
+	if(!config.dns.fastestUpstream.v.b || last - first < 2)
+		return -1;
+
+	// Probe the other upstreams from time to time
+	static unsigned int selections = 0;
+	if(++selections % UPSTREAM_PROBE_INTERVAL == 0)
+		return first + (selections / UPSTREAM_PROBE_INTERVAL) % (last - first);
+
+	int best = -1;
+	double best_score = 0.0;
+	lock_shm();
+	for(int i = first; i < last; i++)
+	{
+		// Upstreams considered down are skipped
+		const int upstreamID = server_upstreamID(&daemon->serverarray[i]->addr);
+		const upstreamsData *upstream = getUpstream(upstreamID, true);
+		if(upstream == NULL || !upstream_accepts_queries(upstreamID))
+			continue;
+
+		const double score = upstream->ewma_rtime + UPSTREAM_FAILURE_PENALTY * upstream->ewma_failed;
+		if(best < 0 || score < best_score)
+		{
+			best = i;
+			best_score = score;
+		}
+	}
+	unlock_shm();
+
+	log_debug(DEBUG_QUERIES, "Selected upstream %d of %d..%d (expected response time %.1f ms)",
+	          best, first, last - 1, 1e3*best_score);
+
+	return best;
+}
+
+// Changes upstream server (only relevant when multiple servers are defined)
+// If this is an upstream response and the answering upstream is known (may not
+// be the case for internally generated DNSSEC queries), we have to check if the
+// first answering upstream server is also the first one we sent the query to.
+// If not, we need to change the upstream server associated with this query to
 // get accurate statistics
 static void update_upstream(queriesData *query, const int id)
 {
@@ -2171,6 +2980,8 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
                       const char *arg, const int id, const char *file, const int line)
 {
 	const double now = double_time();
+	latency_trace_mark(id, LATENCY_REPLY);
+
 	// If domain is "pi.hole", we skip this query
 	// We compare case-insensitive here
 	// Hint: name can be NULL, e.g. for NODATA/NXDOMAIN replies
@@ -2332,7 +3143,7 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 
 	// Save response time
 	// Skipped internally if already computed
-	set_response_time(query, now);
+	finish_query_response(query, now);
 
 	// We only process the first reply further in here
 	// Check if reply type is still UNKNOWN
@@ -2362,6 +3173,16 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 	// to be from cache because of flags containing F_HOSTS)
 	if(cached)
 	{
+		// Popular domain answered from cache (count only the first record)
+		if(prefetch.popular && prefetch.id == id && !query->flags.complete &&
+		   !is_blocked(query->status))
+			counters->prefetch.hits++;
+
+		// Remaining TTL of the (first) record served from the cache
+		if(hit_ttl < CACHE_HIT_TTL_MAX && prefetch.id == id &&
+		   !query->flags.complete && !is_blocked(query->status))
+			counters->cache_hit_ttl[hit_ttl]++;
+
 		// Set status of this query only if this is not a blocked query
 		if(!is_blocked(query->status))
 			query_set_status(query, qs);
@@ -2380,7 +3201,7 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 		query->flags.complete = true;
 
 		// Mark query for updating in the database
-		query->flags.database.changed = true;
+		mark_query_changed(query);
 
 		unlock_shm();
 		return;
@@ -2388,7 +3209,7 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 
 	// else: This is a reply from upstream
 	// Check if this domain matches exactly
-	const bool isExactMatch = name != NULL && strcasecmp(name, getstr(domain->domainpos)) == 0;
+	const bool isExactMatch = name != NULL && strcasecmp(name, getDomainName(domain)) == 0;
 
 	if((flags & F_CONFIG) && isExactMatch && !query->flags.complete)
 	{
@@ -2406,7 +3227,7 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 		query->flags.complete = true;
 
 		// Mark query for updating in the database
-		query->flags.database.changed = true;
+		mark_query_changed(query);
 	}
 	else if((flags & (F_FORWARD | F_UPSTREAM)) && isExactMatch && query->type != TYPE_NONE)
 	{
@@ -2431,9 +3252,12 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 		upstream->responses++;
 
 		// Re-compute upstream average response time and uncertainty
-		upstream->rtime += query->response;
+		const double response = get_query_response(query);
+		upstream->rtime += response;
 		const double mean = upstream->rtime / upstream->responses;
-		upstream->rtuncertainty += (mean - query->response)*(mean - query->response);
+		upstream->rtuncertainty += (mean - response)*(mean - response);
+		update_upstream_ewma(upstream, response, false);
+		upstream_health_result(query->upstreamID, false);
 
 		// Only proceed if query is not already known to have been
 		// blocked upstream AND short-circuited.
@@ -2477,7 +3301,7 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 		query_set_reply(reply_flags, 0, addr, query, now);
 
 		// Mark query for updating in the database
-		query->flags.database.changed = true;
+		mark_query_changed(query);
 	}
 	else if(flags & F_REVERSE || query->type == TYPE_PTR)
 	{
@@ -2509,7 +3333,7 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 		query->flags.complete = true;
 
 		// Mark query for updating in the database
-		query->flags.database.changed = true;
+		mark_query_changed(query);
 	}
 	else if(flags & F_UPSTREAM && flags & F_RCODE)
 	{
@@ -2524,7 +3348,7 @@ static void FTL_reply(const unsigned int flags, const char *name, const union al
 		query->flags.complete = true;
 
 		// Mark query for updating in the database
-		query->flags.database.changed = true;
+		mark_query_changed(query);
 	}
 	else if(isExactMatch && !query->flags.complete)
 	{
@@ -2671,9 +3495,13 @@ static void query_blocked(queriesData *query, domainsData *domain, clientsData *
 	{
 		// Count as blocked query
 		if(domain != NULL)
+		{
 			domain->blockedcount++;
+			top_lists_domain_changed(query->domainID, domain);
+		}
 		if(client != NULL)
 			change_clientcount(client, 0, 1, -1, 0);
+		client_sketch_blocked(query->clientID, query->domainID);
 
 		query->flags.blocked = true;
 	}
@@ -2682,7 +3510,7 @@ static void query_blocked(queriesData *query, domainsData *domain, clientsData *
 	query_set_status(query, new_status);
 
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 }
 
 static void FTL_dnssec(const char *arg, const union all_addr *addr, const int id, const char *file, const int line)
@@ -2717,7 +3545,7 @@ static void FTL_dnssec(const char *arg, const union all_addr *addr, const int id
 		// Get domain pointer
 		const domainsData *domain = getDomain(query->domainID, true);
 		if(domain != NULL)
-			log_debug(DEBUG_QUERIES, "**** DNSSEC %s is %s (ID %i, %s:%i)", getstr(domain->domainpos), arg, id, file, line);
+			log_debug(DEBUG_QUERIES, "**** DNSSEC %s is %s (ID %i, %s:%i)", getDomainName(domain), arg, id, file, line);
 		if(addr && addr->log.ede != EDE_UNSET) // This function is only called if (flags & F_SECSTAT)
 			log_debug(DEBUG_QUERIES, "     EDE: %s (%d)", edestr(addr->log.ede), addr->log.ede);
 	}
@@ -2750,7 +3578,7 @@ static void FTL_dnssec(const char *arg, const union all_addr *addr, const int id
 	}
 
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Unlock shared memory
 	unlock_shm();
@@ -2838,7 +3666,7 @@ static void FTL_upstream_error(const union all_addr *addr, const unsigned int fl
 		const domainsData *domain = getDomain(query->domainID, true);
 
 		// Get domain name
-		const char *domainName = domain != NULL ? getstr(domain->domainpos) : "<cannot access domain struct>";
+		const char *domainName = domain != NULL ? getDomainName(domain) : "<cannot access domain struct>";
 
 		if(flags & F_CONFIG)
 		{
@@ -2876,7 +3704,7 @@ static void FTL_upstream_error(const union all_addr *addr, const unsigned int fl
 	query_set_reply(0, reply, addr, query, now);
 
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Reset last_server
 	memset(&last_server, 0, sizeof(last_server));
@@ -2924,7 +3752,7 @@ static void FTL_blocked_upstream_by_header(const enum query_status new_status, c
 	if(config.debug.queries.v.b)
 	{
 		// Get domain name (domain cannot be NULL here)
-		const char *domainstr = getstr(domain->domainpos);
+		const char *domainstr = getDomainName(domain);
 		log_debug(DEBUG_QUERIES, "**** %s externally blocked by header (ID %i, FTL %i, %s:%i)", domainstr, id, queryID, file, line);
 	}
 
@@ -2943,7 +3771,7 @@ static void FTL_blocked_upstream_by_header(const enum query_status new_status, c
 	query_set_reply(F_NEG | F_NXDOMAIN, 0, NULL, query, now);
 
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Unlock shared memory
 	unlock_shm();
@@ -2982,12 +3810,12 @@ static void FTL_blocked_upstream_by_addr(const enum query_status new_status, con
 	if(config.debug.queries.v.b)
 	{
 		// Get domain name (domain cannot be NULL here)
-		const char *domainName = domain ? getstr(domain->domainpos) : "<cannot access domain>";
+		const char *domainName = domain ? getDomainName(domain) : "<cannot access domain>";
 		log_debug(DEBUG_QUERIES, "**** %s externally blocked by address (ID %i, FTL %i, %s:%i)", domainName, id, queryID, file, line);
 	}
 
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Unlock shared memory
 	unlock_shm();
@@ -3193,21 +4021,56 @@ static void _query_set_reply(const unsigned int flags, const enum reply_type rep
 	}
 
 	// Subtract from old reply counter
-	counters->reply[query->reply]--;
-	log_debug(DEBUG_STATUS, "reply type %u removed (set_reply), ID = %d, new count = %u", query->reply, query->id, counters->reply[query->reply]);
+	const enum reply_type old_reply = query->reply;
+	change_reply_count(query->reply, -1);
+	log_debug(DEBUG_STATUS, "reply type %u removed (set_reply), ID = %d, new count = %u", query->reply, query->id, get_reply_count(query->reply));
 	// Add to new reply counter
-	counters->reply[new_reply]++;
+	change_reply_count(new_reply, 1);
 	// Store reply type
 	query->reply = new_reply;
-	log_debug(DEBUG_STATUS, "reply type %u added (set_reply), ID = %d, new count = %u", query->reply, query->id, counters->reply[query->reply]);
+	log_debug(DEBUG_STATUS, "reply type %u added (set_reply), ID = %d, new count = %u", query->reply, query->id, get_reply_count(query->reply));
 
 	// Save response time
 	// Skipped internally if already computed
-	set_response_time(query, now);
+	finish_query_response(query, now);
+
+	// Add the query to the binary query log once its first reply is known
+	if(old_reply == REPLY_UNKNOWN)
+	{
+		querylog_add(query);
+		FTL_PROBE(query_reply, query->id, new_reply,
+		          query->flags.response_calculated ? query->response : 0u);
+	}
+}
+
+// Startup work independent of the query history, it runs while the history is
+// imported
+static void *startup_worker(void *val)
+{
+	(void)val;
+	prctl(PR_SET_NAME, "startup", 0, 0, 0);
+
+	// Compile the lookup structures of gravity and the domainlists so
+	// blocking works from the first query on
+	double start = double_time();
+	gravityDB_compile_next(true);
+	startup_stage_parallel("gravity", 1e3*(double_time() - start));
+
+	// Verify checksum of this binary early on to ensure that the binary
+	// is not corrupted and that the binary is not tampered with. We can
+	// only do this after the database has been initialized in case we
+	// need to store the verification result
+	start = double_time();
+	verify_FTL(false);
+	startup_stage_parallel("verification", 1e3*(double_time() - start));
+
+	return NULL;
 }
 
 void FTL_fork_and_bind_sockets(struct passwd *ent_pw, bool dnsmasq_start)
 {
+	startup_stage("dnsmasq");
+
 	// Going into daemon mode involves storing the
 	// PID of the generated child process. If FTL
 	// is asked to stay in foreground, we just save
@@ -3219,6 +4082,20 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw, bool dnsmasq_start)
 
 	// Initialize query database (pihole-FTL.db)
 	db_init();
+	startup_stage("database");
+
+	// Size the shared memory for the usage observed over the last day so
+	// neither the history import nor the queries arriving afterwards have
+	// to grow it step by step
+	apply_capacity_plan();
+
+	// Compile the domainlists and verify the binary while importing the
+	// query history. The history itself cannot be imported in the
+	// background as queries have to be stored in the order they arrived
+	pthread_t worker;
+	const bool parallel = pthread_create(&worker, NULL, startup_worker, NULL) == 0;
+	if(!parallel)
+		startup_worker(NULL);
 
 	// Initialize in-memory databases
 	if(!init_memory_database())
@@ -3228,11 +4105,19 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw, bool dnsmasq_start)
 	if(!FTLDBerror())
 		flush_message_table();
 
-	// Verify checksum of this binary early on to ensure that the binary is
-	// not corrupted and that the binary is not tampered with. We can only
-	// do this here as we need the database to be properly initialized
-	// in case we need to store the verification result
-	verify_FTL(false);
+	// A restored snapshot has replaced the shared memory objects
+	apply_capacity_plan();
+	lock_shm();
+	init_exclude_filters();
+	unlock_shm();
+	startup_stage("history");
+
+	// Load the domainlists before we answer the first query
+	if(parallel)
+		pthread_join(worker, NULL);
+	FTL_publish_domainlists();
+	domainlists_loaded = true;
+	startup_stage("domainlists");
 
 	// Initialize in-memory database starting index
 	init_disk_db_idx();
@@ -3248,6 +4133,12 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw, bool dnsmasq_start)
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
 
+	// Threads sleep until they are woken up for events
+	init_thread_wakeups();
+
+	// Write FTL's and the web server's log files from a separate thread
+	start_log_writer();
+
 	// Start NTP sync thread
 	ntp_start_sync_thread(&attr);
 
@@ -3285,6 +4176,14 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw, bool dnsmasq_start)
 		exit(EXIT_FAILURE);
 	}
 
+	// Start thread that fetches the statistics of other Pi-hole instances
+	// (webserver.api.federation.peers)
+	if(pthread_create( &threads[FEDERATION], &attr, federation_thread, NULL ) != 0)
+	{
+		log_crit("Unable to create federation thread. Exiting...");
+		exit(EXIT_FAILURE);
+	}
+
 	// Chown files if FTL started as user root but a dnsmasq config
 	// option states to run as a different user/group (e.g. "nobody")
 	if(getuid() == 0)
@@ -3345,8 +4244,22 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw, bool dnsmasq_start)
 
 	// Initialize FTL HTTP server
 	http_init();
+	startup_stage("webserver");
+
+	// Start DNS-over-TLS server thread (if enabled)
+	if(config.dns.dotPort.v.u16 != 0 &&
+	   pthread_create( &threads[DOT], &attr, dot_thread, NULL ) != 0)
+	{
+		log_crit("Unable to create DNS-over-TLS thread. Exiting...");
+		exit(EXIT_FAILURE);
+	}
+
+	// Place the DNS resolver only now as all other threads have been
+	// started with their own placement and would inherit it otherwise
+	set_thread_placement(ROLE_DNS);
 
 	forked = true;
+	log_startup_stages();
 }
 
 static char *get_ptrname(const struct in_addr *addr)
@@ -3468,7 +4381,11 @@ void FTL_forwarding_retried(struct frec *forward, const int newID, const bool dn
 
 	// Update counter
 	if(upstream != NULL)
+	{
 		upstream->failed++;
+		update_upstream_ewma(upstream, 0.0, true);
+		upstream_health_result(upstreamID, true);
+	}
 
 	// Search for corresponding query identified by ID
 	// Retried DNSSEC queries are ignored, we have to flag themselves (newID)
@@ -3499,7 +4416,7 @@ void FTL_forwarding_retried(struct frec *forward, const int newID, const bool dn
 			}
 
 			// Mark query for updating in the database
-			query->flags.database.changed = true;
+			mark_query_changed(query);
 		}
 	}
 
@@ -3549,6 +4466,9 @@ void FTL_TCP_worker_terminating(bool finished)
 
 	// Close dedicated database connections of this fork
 	gravityDB_close();
+
+	// Hand over the remaining log lines and free our log ring
+	release_log_ring();
 	unlock_shm();
 }
 
@@ -3560,6 +4480,10 @@ void FTL_TCP_worker_terminating(bool finished)
 // to ending up with a corrupted database.
 void FTL_TCP_worker_created(const int confd)
 {
+	// Traces of queries are owned by the process handling them
+	latency_trace_forked();
+	dnssec_slot = -1;
+
 	if(get_dnsmasq_debug())
 	{
 		// Nothing to be done here, TCP worker forking does not happen
@@ -3609,10 +4533,127 @@ void FTL_TCP_worker_created(const int confd)
 		return;
 	}
 
+	// Queries of all TCP workers forked per connection are counted in one
+	// shard
+	set_counter_shard(COUNTER_SHARD_TCP);
+
 	// Reopen gravity database handle in this fork as the main process's
 	// handle isn't valid here
 	log_debug(DEBUG_ANY, "Reopening Gravity database for this fork");
 	gravityDB_forked();
+
+	// Log dnsmasq lines of this fork without the SHM lock
+	claim_log_ring();
+}
+
+// Number of additional processes receiving UDP queries (dns.udpWorkers)
+#define MAX_UDP_WORKERS 64u
+unsigned int __attribute__ ((pure)) FTL_udp_workers(void)
+{
+	return min(config.dns.udpWorkers.v.ui, MAX_UDP_WORKERS);
+}
+
+void FTL_UDP_worker_created(const unsigned int index)
+{
+	// Traces of queries are owned by the process handling them
+	latency_trace_forked();
+
+	// Replies put aside by a previous worker in this slot are gone
+	dnssec_slot = index < DNSSEC_QUEUE_SLOTS ? (int)index : -1;
+	if(dnssec_slot > -1)
+		__atomic_store_n(&counters->dnssec.queued[dnssec_slot], 0, __ATOMIC_RELAXED);
+
+	// Queries counted by a previous worker in this shard are still in memory,
+	// the shard is hence not reset
+	set_counter_shard(COUNTER_SHARD_UDP + index - 1);
+
+	log_debug(DEBUG_ANY, "UDP worker %u started", index);
+
+	// Reopen gravity database handle in this fork as the main process's
+	// handle isn't valid here
+	gravityDB_forked();
+
+	// Log dnsmasq lines of this fork without the SHM lock
+	claim_log_ring();
+}
+
+// A reply has been put aside until DNSKEY/DS records needed for its validation
+// have been received (delta = 1) or has been taken up again (delta = -1)
+void FTL_dnssec_queued(const int delta)
+{
+	if(dnssec_slot > -1)
+		__atomic_fetch_add(&counters->dnssec.queued[dnssec_slot], delta, __ATOMIC_RELAXED);
+}
+
+// Time validation of a reply [microseconds of the monotonic clock]
+unsigned long long FTL_dnssec_validation_start(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000u;
+}
+
+void FTL_dnssec_validation_done(const unsigned long long start)
+{
+	const unsigned long long usec = FTL_dnssec_validation_start() - start;
+	__atomic_fetch_add(&counters->dnssec.validations, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counters->dnssec.usec, usec, __ATOMIC_RELAXED);
+}
+
+// A signature has been verified, possibly remembered from an earlier reply
+void FTL_dnssec_signature(const bool memoized)
+{
+	__atomic_fetch_add(memoized ? &counters->dnssec.memo_hits : &counters->dnssec.verified, 1, __ATOMIC_RELAXED);
+}
+
+void FTL_UDP_worker_terminating(void)
+{
+	log_debug(DEBUG_ANY, "UDP worker terminating");
+
+	// The worker may be terminated while holding the lock
+	if(!is_our_lock())
+		lock_shm();
+
+	// Close dedicated database connections of this fork
+	gravityDB_close();
+
+	// Hand over the remaining log lines and free our log ring
+	release_log_ring();
+	unlock_shm();
+}
+
+// Number of processes accepting TCP connections in advance (dns.tcpWorkers)
+#define MAX_TCP_WORKERS 64u
+unsigned int __attribute__ ((pure)) FTL_tcp_workers(void)
+{
+	return min(config.dns.tcpWorkers.v.ui, MAX_TCP_WORKERS);
+}
+
+// Workers of the TCP pool handle many connections, everything set up here is
+// kept until they terminate through FTL_TCP_worker_terminating()
+void FTL_TCP_pool_worker_created(const unsigned int index)
+{
+	// Traces of queries are owned by the process handling them
+	latency_trace_forked();
+	dnssec_slot = -1;
+	set_counter_shard(COUNTER_SHARD_TCP_POOL + index - 1);
+
+	log_debug(DEBUG_ANY, "TCP worker %u started", index);
+
+	// Reopen gravity database handle in this fork as the main process's
+	// handle isn't valid here
+	gravityDB_forked();
+
+	// Log dnsmasq lines of this fork without the SHM lock
+	claim_log_ring();
+}
+
+// Ask the resolver to re-read the upstream servers file. This is handled by
+// the main dnsmasq process in its event loop
+void FTL_reload_servers(void)
+{
+	log_info("Reloading upstream servers");
+	queue_event(EVENT_SERVERS);
 }
 
 bool FTL_unlink_DHCP_lease(const char *ipaddr, const char **hint)
@@ -3701,20 +4742,206 @@ void FTL_query_in_progress(const int id)
 		const domainsData *domain = getDomain(query->domainID, true);
 		if(domain != NULL)
 		{
-			log_debug(DEBUG_QUERIES, "**** query for %s is already in progress (ID %i)", getstr(domain->domainpos), id);
+			log_debug(DEBUG_QUERIES, "**** query for %s is already in progress (ID %i)", getDomainName(domain), id);
 		}
 	}
 
 	// Store status
 	query_set_status(query, QUERY_IN_PROGRESS);
 
+	// This query will not be sent upstream
+	counters->coalesced.saved++;
+
 	// Mark query for updating in the database
-	query->flags.database.changed = true;
+	mark_query_changed(query);
 
 	// Unlock shared memory
 	unlock_shm();
 }
 
+/**
+ * Called for every query which waited for the reply to an identical query in
+ * flight when this reply is sent to it. The waiting query inherits reply type,
+ * DNSSEC status and EDE of the query which has been forwarded. Its response
+ * time is measured from its own arrival. The upstream server is not copied as
+ * the waiting query did not cause any traffic to it
+ *
+ * @param primary_id dnsmasq ID of the query which has been forwarded
+ * @param waiter_id dnsmasq ID of the waiting query
+ */
+void FTL_coalesced_answer(const int primary_id, const int waiter_id)
+{
+	// Record response time before queuing for the lock
+	const double now = double_time();
+
+	// Lock shared memory
+	lock_shm();
+
+	// Search for both queries
+	const int primaryID = findQueryID(primary_id);
+	const int waiterID = findQueryID(waiter_id);
+	if(primaryID < 0 || waiterID < 0)
+	{
+		// One of the queries may already have been garbage collected
+		unlock_shm();
+		return;
+	}
+
+	const queriesData *primary = getQuery(primaryID, true);
+	queriesData *waiter = getQuery(waiterID, true);
+	if(primary == NULL || waiter == NULL)
+	{
+		// Memory error, skip this query
+		unlock_shm();
+		return;
+	}
+
+	// Only update queries still waiting for this reply and only if we know
+	// what the reply was
+	if(waiter->status != QUERY_IN_PROGRESS || primary->reply == REPLY_UNKNOWN)
+	{
+		unlock_shm();
+		return;
+	}
+
+	log_debug(DEBUG_QUERIES, "**** answered waiting query (ID %i) with reply to ID %i",
+	          waiter_id, primary_id);
+
+	query_set_reply(0, primary->reply, NULL, waiter, now);
+	if(primary->dnssec != DNSSEC_UNKNOWN)
+		query_set_dnssec(waiter, primary->dnssec);
+	waiter->ede = primary->ede;
+	counters->coalesced.answered++;
+
+	// Mark query for updating in the database
+	mark_query_changed(waiter);
+
+	// Unlock shared memory
+	unlock_shm();
+}
+
+/**
+ * Called before a query which could not be answered from the cache is
+ * forwarded. If validated NSEC records prove that the name or the requested
+ * type does not exist, the query is answered right away (RFC 8198). Queries
+ * with the DO bit are always forwarded as the records needed to prove the
+ * negative answer are not included.
+ *
+ * @param header Query, turned into the reply on success
+ * @param len Length of the query
+ * @param ad Whether the client set the AD bit
+ * @param now Current time
+ * @return size_t Length of the reply, 0 if the query needs to be forwarded
+ */
+size_t FTL_nsec_answer(struct dns_header *header, const size_t len, const bool ad, const time_t now)
+{
+	if(!config.dns.cache.aggressiveNSEC.v.b || !option_bool(OPT_DNSSEC_VALID) ||
+	   ntohs(header->qdcount) != 1)
+		return 0;
+
+	// Get question
+	char name[MAXDNAME];
+	unsigned char *p = (unsigned char *)(header + 1);
+	unsigned short qtype, qclass;
+	if(!extract_name(header, len, &p, name, EXTR_NAME_EXTRACT, 4))
+		return 0;
+	GETSHORT(qtype, p);
+	GETSHORT(qclass, p);
+	if(qclass != C_IN)
+		return 0;
+
+	const enum nsec_verdict verdict = nsec_cache_lookup(name, qtype, now);
+	if(verdict == NSEC_UNKNOWN)
+		return 0;
+
+	// Turn the query into an empty reply
+	header->hb3 = HB3_QR | (header->hb3 & HB3_RD);
+	header->hb4 = HB4_RA | (ad ? HB4_AD : 0);
+	SET_RCODE(header, (verdict == NSEC_NXDOMAIN ? NXDOMAIN : NOERROR));
+	header->ancount = htons(0);
+	header->nscount = htons(0);
+	header->arcount = htons(0);
+
+	// Record response time before queuing for the lock
+	const double response = double_time();
+
+	// Lock shared memory
+	lock_shm();
+
+	// Search for corresponding query identified by ID
+	const int queryID = findQueryID(daemon->log_display_id);
+	queriesData *query = queryID < 0 ? NULL : getQuery(queryID, true);
+	if(query != NULL)
+	{
+		query_set_status(query, QUERY_CACHE);
+		query_set_reply(0, REPLY_SYNTHESIZED, NULL, query, response);
+		query_set_dnssec(query, DNSSEC_SECURE);
+		query->flags.complete = true;
+
+		// Mark query for updating in the database
+		mark_query_changed(query);
+	}
+
+	// Unlock shared memory
+	unlock_shm();
+
+	return p - (unsigned char *)header;
+}
+
+// Called after the answer to a query has been sent to the client
+void FTL_answer_sent(const int id)
+{
+	latency_trace_mark(id, LATENCY_ANSWER);
+}
+
+/**
+ * Called by dnsmasq for every cache record used to answer the current query.
+ * The remaining TTL of the record is remembered for the cache analytics.
+ * Records of popular domains used within the last dns.cache.prefetch percent
+ * of their TTL are due to be refreshed
+ *
+ * @param ttd Time the record expires
+ * @param ttl TTL of the record when it was inserted into the cache
+ * @param now Current time
+ */
+void FTL_cache_hit(const time_t ttd, const unsigned int ttl, const time_t now)
+{
+	if(ttl == 0)
+		return;
+
+	const double remaining = difftime(ttd, now);
+	if(remaining < 0.0)
+		hit_ttl = CACHE_HIT_STALE;
+	else if(10.0 * remaining < ttl)
+		hit_ttl = CACHE_HIT_BELOW_10;
+	else if(4.0 * remaining < ttl)
+		hit_ttl = CACHE_HIT_BELOW_25;
+	else if(2.0 * remaining < ttl)
+		hit_ttl = CACHE_HIT_BELOW_50;
+	else
+		hit_ttl = CACHE_HIT_ABOVE_50;
+
+	if(!prefetch.popular)
+		return;
+
+	const unsigned int percent = min(config.dns.cache.prefetch.v.ui, 100u);
+	if(remaining >= 0.0 && 100.0 * remaining < (double)ttl * percent)
+		prefetch.due = true;
+}
+
+// Should the query just answered from cache be forwarded anyway to refresh
+// the cache before the records expire?
+bool FTL_prefetch_due(const int id)
+{
+	if(!prefetch.due || prefetch.id != id)
+		return false;
+
+	log_debug(DEBUG_QUERIES, "**** prefetching (ID %i)", id);
+	prefetch.due = false;
+	prefetch.refreshing = true;
+	return true;
+}
+
 void FTL_multiple_replies(const int id, int *firstID)
 {
 	// We are in the loop that iterates over all aggregated queries for the same
@@ -3770,15 +4997,15 @@ void FTL_multiple_replies(const int id, int *firstID)
 	log_debug(DEBUG_QUERIES, "**** sending reply %d also to %d", *firstID, queryID);
 
 	// Copy relevant information over
-	counters->reply[duplicated_query->reply]--;
-	log_debug(DEBUG_STATUS, "duplicated_query reply type %u removed, ID = %d, new count = %u", duplicated_query->reply, duplicated_query->id, counters->reply[duplicated_query->reply]);
+	change_reply_count(duplicated_query->reply, -1);
+	log_debug(DEBUG_STATUS, "duplicated_query reply type %u removed, ID = %d, new count = %u", duplicated_query->reply, duplicated_query->id, get_reply_count(duplicated_query->reply));
 	duplicated_query->reply = source_query->reply;
-	counters->reply[duplicated_query->reply]++;
-	log_debug(DEBUG_STATUS, "duplicated_query reply type %u set, ID = %d, new count = %u", duplicated_query->reply, duplicated_query->id, counters->reply[duplicated_query->reply]);
+	change_reply_count(duplicated_query->reply, 1);
+	log_debug(DEBUG_STATUS, "duplicated_query reply type %u set, ID = %d, new count = %u", duplicated_query->reply, duplicated_query->id, get_reply_count(duplicated_query->reply));
 
 	duplicated_query->dnssec = source_query->dnssec;
 	duplicated_query->flags.complete = true;
-	duplicated_query->CNAME_domainID = source_query->CNAME_domainID;
+	set_query_CNAME(duplicated_query, source_query->CNAME_domainID);
 
 	// The original query may have been blocked during CNAME inspection,
 	// correct status in this case
@@ -3786,7 +5013,7 @@ void FTL_multiple_replies(const int id, int *firstID)
 		query_set_status(duplicated_query, source_query->status);
 
 	// Mark query for updating in the database
-	duplicated_query->flags.database.changed = true;
+	mark_query_changed(duplicated_query);
 
 	// Unlock shared memory
 	unlock_shm();
@@ -3812,9 +5039,18 @@ static void _query_set_dnssec(queriesData *query, const enum dnssec_status dnsse
 // Add dnsmasq log line to internal FIFO buffer (can be queried via the API)
 void FTL_dnsmasq_log(const char *payload, const int length)
 {
+	// TCP workers owning a log ring hand their lines to the main process
+	// without taking the lock
+	if(push_log_ring(payload, length))
+		return;
+
 	// Lock SHM
 	lock_shm();
 
+	// Collect lines buffered by TCP workers first, they were logged before
+	// this one
+	drain_log_rings();
+
 	// Add to FIFO buffer
 	add_to_fifo_buffer(FIFO_DNSMASQ, payload, NULL, length);
 
@@ -3885,6 +5121,22 @@ void FTL_connection_error(const char *reason, const union mysockaddr *addr, cons
 	// Log to pihole.log
 	my_syslog(priority, "%s: %s", reason, error);
 
+	// Queries which could not be sent upstream count as failures of the
+	// upstream (failing to send replies to clients does not)
+	if(addr != NULL && (strcmp(reason, "failed to send UDP request") == 0 ||
+	                    strcmp(reason, "TCP connection failed") == 0))
+	{
+		lock_shm();
+		const int upstreamID = server_upstreamID(addr);
+		upstreamsData *upstream = getUpstream(upstreamID, true);
+		if(upstream != NULL)
+		{
+			update_upstream_ewma(upstream, 0.0, true);
+			upstream_health_result(upstreamID, true);
+		}
+		unlock_shm();
+	}
+
 	// Add to Pi-hole diagnostics but do not add messages more often than
 	// once every five seconds to avoid hammering the database with errors
 	// on continuously failing connections
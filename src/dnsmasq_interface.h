@@ -15,6 +15,10 @@
 
 #include "edns0.h"
 #include "metrics.h"
+#include "nsec-cache.h"
+#include "udp_batch.h"
+// enum query_status
+#include "enums.h"
 
 enum protocol { TCP, UDP, INTERNAL };
 
@@ -37,17 +41,40 @@ void FTL_forwarding_retried(struct frec *forward, const int newID, const bool dn
 #define MAX_EDE_DATA 128
 #define FTL_make_answer(header, limit, len, ede_data, ede_len) _FTL_make_answer(header, limit, len, ede_data, ede_len, __FILE__, __LINE__)
 size_t _FTL_make_answer(struct dns_header *header, char *limit, const size_t len, unsigned char ede_data[MAX_EDE_DATA], size_t *ede_len, const char *file, const int line);
+int get_status_ede(const enum query_status status, const char **text);
 
-bool FTL_CNAME(const char *dst, const char *src, const int id);
+bool FTL_CNAME(const char *dst, const char *src, const int id, const unsigned long ttl);
 
 void FTL_query_in_progress(const int id);
+void FTL_coalesced_answer(const int primary_id, const int waiter_id);
+size_t FTL_nsec_answer(struct dns_header *header, const size_t len, const bool ad, const time_t now);
 void FTL_multiple_replies(const int id, int *firstID);
+void FTL_answer_sent(const int id);
+int FTL_select_upstream(const int first, const int last);
+int FTL_upstream_start(const int first, const int last, const int start);
+bool FTL_upstream_skip(const int first, const int last, const int index);
+void FTL_cache_hit(const time_t ttd, const unsigned int ttl, const time_t now);
+bool FTL_prefetch_due(const int id);
 
 void FTL_dnsmasq_reload(void);
+void FTL_refresh_dns_cache(void);
+void FTL_cache_autosize(const time_t now);
+void FTL_cache_restore(const time_t now);
+void FTL_cache_save(const time_t now, const bool force);
 void FTL_TCP_worker_created(const int confd);
 void FTL_TCP_worker_terminating(bool finished);
+unsigned int FTL_udp_workers(void) __attribute__ ((pure));
+void FTL_UDP_worker_created(const unsigned int index);
+void FTL_UDP_worker_terminating(void);
+unsigned int FTL_tcp_workers(void) __attribute__ ((pure));
+void FTL_TCP_pool_worker_created(const unsigned int index);
+void FTL_dnssec_queued(const int delta);
+unsigned long long FTL_dnssec_validation_start(void);
+void FTL_dnssec_validation_done(const unsigned long long start);
+void FTL_dnssec_signature(const bool memoized);
 
 bool FTL_unlink_DHCP_lease(const char *ipaddr, const char **hint);
+void FTL_reload_servers(void);
 
 void FTL_connection_error(const char *reason, const union mysockaddr *addr, const char where);
 
@@ -55,6 +82,7 @@ bool get_dnsmasq_debug(void) __attribute__ ((pure));
 
 // defined in src/dnsmasq/cache.c
 extern char *querystr(char *desc, unsigned short type);
+extern unsigned short querytype(const char *name);
 
 extern void FTL_dnsmasq_log(const char *payload, const int length);
 
@@ -0,0 +1,243 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Label-suffix shared domain storage
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file domain-suffixes.c
+* @brief Stores domain names as chains of shared label suffixes.
+*
+* When misc.domainSuffixes is enabled, new domains are split into their labels
+* which are added from right to left as nodes of a tree rooted at SUFFIX_ROOT.
+* Each node refers to its (deduplicated) label in the strings buffer and to the
+* node of the remaining suffix, a domain only refers to the node of its
+* leftmost label. Common suffixes like cdn.example.com are hence only stored
+* once, no matter how many domains end in them. Nodes are found by their label
+* and parent using a lookup table.
+*
+* Names are reconstructed by following the chain of parents. Nodes are never
+* removed individually, the tree is rebuilt from the domains still in memory
+* when the strings buffer is compacted.
+*
+* The nodes live in shared memory and are only modified while holding the
+* exclusive SHM lock, they can be read while holding the shared lock.
+*/
+
+#include "FTL.h"
+#include "domain-suffixes.h"
+// counters, addstr(), getstr()
+#include "shmem.h"
+// lookup_find_id()
+#include "lookup-table.h"
+// hashStr()
+#include "datastructure.h"
+// log_err()
+#include "log.h"
+
+static uint32_t __attribute__((pure)) node_hash(const char *label, const unsigned int parent)
+{
+	// Mix in the parent so equal labels below different suffixes (e.g.
+	// www) are spread over the table
+	return hashStr(label) ^ (parent * UINT32_C(0x9E3779B1));
+}
+
+static bool cmp_suffix(const struct lookup_table *entry, const struct lookup_data *lookup_data)
+{
+	if(entry->id >= counters->suffixes)
+		return false;
+
+	const struct suffix_node *node = &domain_suffixes[entry->id];
+	return node->parent == lookup_data->parent &&
+	       strcmp(getstr(node->labelpos), lookup_data->string) == 0;
+}
+
+// Forget all nodes. Only the root node remains
+void reset_domain_suffixes(void)
+{
+	memset(&domain_suffixes[SUFFIX_ROOT], 0, sizeof(*domain_suffixes));
+	counters->suffixes = SUFFIX_ROOT + 1;
+	lookup_init(SUFFIXES_LOOKUP);
+}
+
+// Find the node of a label below the given parent
+static int find_node(const char *label, const unsigned int parent, const uint32_t hash)
+{
+	const struct lookup_data lookup_data = { .string = label, .parent = parent };
+	unsigned int nodeID = 0;
+	if(lookup_find_id(SUFFIXES_LOOKUP, hash, &lookup_data, &nodeID, cmp_suffix))
+		return nodeID;
+
+	return -1;
+}
+
+// Copy the label ending before end into buffer and return its start
+static const char *prev_label(const char *domain, const char *end, char buffer[DOMAIN_NAME_MAX])
+{
+	const char *start = end;
+	while(start > domain && start[-1] != '.')
+		start--;
+
+	memcpy(buffer, start, end - start);
+	buffer[end - start] = '\0';
+	return start;
+}
+
+/**
+ * Add all labels of a domain to the tree. The caller has to ensure there is
+ * space for DOMAIN_LABELS_MAX more nodes.
+ *
+ * @param domain The domain to add
+ * @return The node of the leftmost label, SUFFIX_ROOT if the domain cannot be
+ * stored as labels (it is empty, too long, or contains empty labels) and has to
+ * be stored as one string
+ */
+unsigned int add_domain_suffixes(const char *domain)
+{
+	const size_t len = strlen(domain);
+	if(len == 0 || len >= DOMAIN_NAME_MAX || domain[0] == '.' || domain[len - 1] == '.' ||
+	   strstr(domain, "..") != NULL)
+		return SUFFIX_ROOT;
+
+	char label[DOMAIN_NAME_MAX];
+	unsigned int parent = SUFFIX_ROOT;
+	const char *end = domain + len;
+	while(end > domain)
+	{
+		const char *start = prev_label(domain, end, label);
+		const uint32_t hash = node_hash(label, parent);
+		int nodeID = find_node(label, parent, hash);
+		if(nodeID < 0)
+		{
+			if(counters->suffixes >= counters->suffixes_MAX)
+			{
+				log_err("No space left for suffix of %s", domain);
+				return SUFFIX_ROOT;
+			}
+
+			nodeID = counters->suffixes++;
+			struct suffix_node *node = &domain_suffixes[nodeID];
+			node->labelpos = addstr(label);
+			node->parent = parent;
+			node->hash = hash;
+			lookup_insert(SUFFIXES_LOOKUP, nodeID, hash);
+		}
+
+		parent = nodeID;
+		// Skip the dot
+		end = start > domain ? start - 1 : start;
+	}
+
+	return parent;
+}
+
+/**
+ * Find the node of a suffix without adding it.
+ *
+ * @param suffix The suffix, e.g., example.com
+ * @return The node of the suffix, -1 if no stored domain ends in it
+ */
+int find_domain_suffix(const char *suffix)
+{
+	const size_t len = strlen(suffix);
+	if(len == 0 || len >= DOMAIN_NAME_MAX)
+		return -1;
+
+	char label[DOMAIN_NAME_MAX];
+	unsigned int parent = SUFFIX_ROOT;
+	const char *end = suffix + len;
+	while(end > suffix)
+	{
+		const char *start = prev_label(suffix, end, label);
+		const int nodeID = find_node(label, parent, node_hash(label, parent));
+		if(nodeID < 0)
+			return -1;
+
+		parent = nodeID;
+		end = start > suffix ? start - 1 : start;
+	}
+
+	return parent;
+}
+
+// Compare the name of a node with a domain without reconstructing the name
+bool domain_suffix_equals(unsigned int node, const char *domain)
+{
+	while(node != SUFFIX_ROOT && node < counters->suffixes)
+	{
+		const char *label = getstr(domain_suffixes[node].labelpos);
+		const size_t len = strlen(label);
+		if(strncmp(domain, label, len) != 0)
+			return false;
+		domain += len;
+
+		node = domain_suffixes[node].parent;
+		if(node != SUFFIX_ROOT)
+		{
+			if(*domain != '.')
+				return false;
+			domain++;
+		}
+	}
+
+	return node == SUFFIX_ROOT && *domain == '\0';
+}
+
+// Check if the name of a node ends in ".<name of suffix>"
+bool domain_has_suffix(unsigned int node, const unsigned int suffix)
+{
+	if(node >= counters->suffixes)
+		return false;
+
+	for(node = domain_suffixes[node].parent; node != SUFFIX_ROOT && node < counters->suffixes;
+	    node = domain_suffixes[node].parent)
+		if(node == suffix)
+			return true;
+
+	return false;
+}
+
+/**
+ * Reconstruct the name of a node.
+ *
+ * @param nodes The tree of labels
+ * @param num Number of nodes of the tree
+ * @param strings The strings buffer the labels are stored in, NULL for the
+ * shared strings buffer
+ * @param strings_size Size of the strings buffer (unused if strings is NULL)
+ * @param node The node
+ * @param buffer Buffer receiving the name
+ * @return buffer
+ */
+const char *domain_suffix_name(const struct suffix_node *nodes, const unsigned int num,
+                               const char *strings, const size_t strings_size,
+                               unsigned int node, char buffer[DOMAIN_NAME_MAX])
+{
+	size_t pos = 0;
+	buffer[0] = '\0';
+	while(node != SUFFIX_ROOT && node < num)
+	{
+		const size_t labelpos = nodes[node].labelpos;
+		const char *label = strings == NULL ? getstr(labelpos) :
+		                    labelpos < strings_size ? &strings[labelpos] : "";
+		const size_t len = strlen(label);
+
+		// The name of a node cannot get longer than the domain it was
+		// added for, this only guards against corrupted nodes
+		if(pos + len + 1 >= DOMAIN_NAME_MAX)
+			break;
+
+		if(pos > 0)
+			buffer[pos++] = '.';
+		memcpy(&buffer[pos], label, len + 1);
+		pos += len;
+
+		node = nodes[node].parent;
+	}
+
+	return buffer;
+}
@@ -0,0 +1,58 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Label-suffix shared domain storage header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef DOMAIN_SUFFIXES_H
+#define DOMAIN_SUFFIXES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+// uint32_t
+#include <stdint.h>
+
+// Longest domain name (including the terminating character) which can be
+// stored as labels, longer names are stored as one string
+#define DOMAIN_NAME_MAX 256u
+// Largest number of labels of a domain name, i.e., of nodes added at once
+#define DOMAIN_LABELS_MAX (DOMAIN_NAME_MAX / 2u)
+// The root node, it has no label and terminates every chain of suffixes
+#define SUFFIX_ROOT 0u
+
+/**
+ * struct suffix_node - Node of the tree of domain labels
+ * @labelpos: Position of the label in the strings buffer
+ * @parent: Node of the remaining labels to the right, SUFFIX_ROOT for
+ * top-level domains
+ * @hash: Hash of the label and the parent used by the lookup table
+ *
+ * The name of a node is its label followed by a dot and the name of its
+ * parent. Domains sharing a suffix share the nodes of this suffix, e.g.,
+ * a.cdn.example.com and b.cdn.example.com only differ in their leftmost node.
+ */
+struct suffix_node {
+	size_t labelpos;
+	unsigned int parent;
+	uint32_t hash;
+};
+
+extern struct suffix_node *domain_suffixes;
+
+// Called with the exclusive SHM lock held
+void reset_domain_suffixes(void);
+unsigned int add_domain_suffixes(const char *domain);
+
+// Called with (at least) the shared SHM lock held
+int find_domain_suffix(const char *suffix);
+bool domain_suffix_equals(unsigned int node, const char *domain) __attribute__((pure));
+bool domain_has_suffix(unsigned int node, const unsigned int suffix) __attribute__((pure));
+const char *domain_suffix_name(const struct suffix_node *nodes, const unsigned int num,
+                               const char *strings, const size_t strings_size,
+                               unsigned int node, char buffer[DOMAIN_NAME_MAX]);
+
+#endif //DOMAIN_SUFFIXES_H
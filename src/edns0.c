@@ -17,6 +17,8 @@
 #include "config/config.h"
 #include "datastructure.h"
 #include "shmem.h"
+// cli_info()
+#include "args.h"
 
 // EDNS(0) Client Subnet [Optional, RFC7871]
 #define EDNS0_ECS EDNS0_OPTION_CLIENT_SUBNET
@@ -41,6 +43,9 @@
 // dnsmasq option: --add-cpe-id=...
 #define EDNS0_CPE_ID EDNS0_OPTION_NOMCPEID
 
+// Longest data printed as hex dump when debugging, longer data is truncated
+#define EDNS0_DUMP_BYTES 64u
+
 static ednsData edns = { 0 };
 
 ednsData *getEDNS(void)
@@ -57,6 +62,143 @@ ednsData *getEDNS(void)
 	return NULL;
 }
 
+// Format data as hex bytes separated by sep (empty for none) into buf. Data
+// longer than EDNS0_DUMP_BYTES is truncated, buf needs to hold at least
+// EDNS0_DUMP_BYTES*(2 + strlen(sep)) + 4 bytes
+static const char *hexdump(char *buf, const unsigned char *data, const size_t len, const char *sep)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	const size_t seplen = strlen(sep);
+	const size_t n = len < EDNS0_DUMP_BYTES ? len : EDNS0_DUMP_BYTES;
+	char *pp = buf;
+	for(size_t i = 0; i < n; i++)
+	{
+		if(i > 0)
+		{
+			memcpy(pp, sep, seplen);
+			pp += seplen;
+		}
+		*pp++ = hex[data[i] >> 4];
+		*pp++ = hex[data[i] & 0x0F];
+	}
+	if(n < len)
+	{
+		memcpy(pp, "...", 3);
+		pp += 3;
+	}
+	*pp = '\0';
+
+	return buf;
+}
+
+static inline int __attribute__((const)) hexval(const unsigned char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// Decode a MAC address in text format (aa:bb:cc:dd:ee:ff)
+static bool parse_mac_text(const unsigned char *text, char mac[6])
+{
+	for(unsigned int i = 0; i < 6; i++)
+	{
+		const unsigned char *t = text + 3*i;
+		const int hi = hexval(t[0]), lo = hexval(t[1]);
+		if(hi < 0 || lo < 0 || (i < 5 && t[2] != ':'))
+			return false;
+		mac[i] = (char)((hi << 4) | lo);
+	}
+
+	return true;
+}
+
+// EDNS(0) CLIENT SUBNET
+static void parse_ecs(const unsigned char *opt, const unsigned short optlen)
+{
+	// RFC 7871              Client Subnet in DNS Queries              6.  Option Format
+	//   This protocol uses an EDNS0 [RFC6891] option to include client
+	//   address information in DNS messages.  The option is structured as
+	//   follows:
+	//
+	//                +0 (MSB)                            +1 (LSB)
+	//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+	//   0: |                          OPTION-CODE                          |
+	//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+	//   2: |                         OPTION-LENGTH                         |
+	//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+	//   4: |                            FAMILY                             |
+	//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+	//   6: |     SOURCE PREFIX-LENGTH      |     SCOPE PREFIX-LENGTH       |
+	//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+	//   8: |                           ADDRESS...                          /
+	//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+	if(optlen < 4)
+		return;
+	const unsigned short family = (unsigned short)((opt[0] << 8) | opt[1]);
+	const unsigned char source_netmask = opt[2];
+	// We are not interested in the scope prefix-length. It MUST be 0 in queries
+	const size_t addrlen = optlen - 4u;
+
+	union all_addr addr = {{ 0 }};
+	if(family == 1 && addrlen <= sizeof(addr.addr4.s_addr)) // IPv4
+		memcpy(&addr.addr4.s_addr, opt + 4, addrlen);
+	else if(family == 2 && addrlen <= sizeof(addr.addr6.s6_addr)) // IPv6
+		memcpy(addr.addr6.s6_addr, opt + 4, addrlen);
+	else
+		return;
+
+	// Only use /32 (IPv4) and /128 (IPv6) addresses
+	const bool full = family == 1 ? source_netmask == 32 : source_netmask == 128;
+	if(!full && !config.debug.edns0.v.b)
+		return;
+
+	char ipaddr[ADDRSTRLEN] = { 0 };
+	inet_ntop(family == 1 ? AF_INET : AF_INET6, &addr, ipaddr, sizeof(ipaddr));
+	if(!full)
+	{
+		log_debug(DEBUG_EDNS0, "CLIENT SUBNET: %s/%u found (IPv%u)",
+		          ipaddr, source_netmask, family == 1 ? 4u : 6u);
+		return;
+	}
+
+	// Copy data to edns struct
+	memcpy(edns.client, ipaddr, sizeof(edns.client));
+	memset(&edns.client_addr, 0, sizeof(edns.client_addr));
+	edns.client_family = family == 1 ? AF_INET : AF_INET6;
+	if(family == 1)
+		edns.client_addr.in = addr.addr4;
+	else
+		edns.client_addr.in6 = addr.addr6;
+
+	// Only set the address as useful when it is not the
+	// loopback address of the distant machine (127.0.0.0/8 or ::1)
+	if((family == 1 && (ntohl(addr.addr4.s_addr) & 0xFF000000) == 0x7F000000) ||
+	   (family == 2 && IN6_IS_ADDR_LOOPBACK(&addr.addr6)))
+	{
+		log_debug(DEBUG_EDNS0, "CLIENT SUBNET: Skipped %s/%u (IPv%u loopback address)",
+		          ipaddr, source_netmask, family == 1 ? 4u : 6u);
+	}
+	else
+	{
+		edns.client_set = true;
+		log_debug(DEBUG_EDNS0, "CLIENT SUBNET: %s/%u - OK (IPv%u)",
+		          ipaddr, source_netmask, family == 1 ? 4u : 6u);
+	}
+}
+
+/**
+ * Parse the OPT pseudoheader of a query in a single pass. Options are decoded
+ * straight into the EDNS(0) data of the query, no memory is allocated. Options
+ * extending beyond the pseudoheader end the parsing
+ *
+ * @param pheader The OPT RR (starting at its NAME)
+ * @param plen Length of the OPT RR
+ */
 void FTL_parse_pseudoheaders(unsigned char *pheader, const size_t plen)
 {
 	// Return early if we have no pseudoheader (a.k.a. additional records)
@@ -67,15 +209,13 @@ void FTL_parse_pseudoheaders(unsigned char *pheader, const size_t plen)
 	}
 
 	// Debug logging
-	if(config.debug.edns0.v.b)
-	{
-		char *payload = calloc(3*plen+1, sizeof(char));
-		for(unsigned int i = 0; i < plen; i++)
-			sprintf(&payload[3*i], "%02X ", pheader[i]);
-		log_debug(DEBUG_EDNS0, "pheader: %s (%lu bytes)",
-		          payload, (long unsigned int)plen);
-		free(payload);
-	}
+	char dump[EDNS0_DUMP_BYTES*3 + 4];
+	log_debug(DEBUG_EDNS0, "pheader: %s (%lu bytes)",
+	          hexdump(dump, pheader, plen, " "), (long unsigned int)plen);
+
+	// The fixed part of the OPT RR is 11 bytes long
+	if(plen < 11)
+		return;
 
 	// Working pointer
 	unsigned char *p = pheader;
@@ -168,7 +308,7 @@ void FTL_parse_pseudoheaders(unsigned char *pheader, const size_t plen)
 //      level of the responder.  In this way, a requestor will learn the
 //      implementation level of a responder as a side effect of every
 //      response, including error responses and including RCODE=BADVERS.
-	unsigned char edns0_version = (ttl >> 16) % 0xFF;
+	unsigned char edns0_version = (ttl >> 16) & 0xFF;
 	if(edns0_version != 0x00)
 		return;
 
@@ -177,249 +317,286 @@ void FTL_parse_pseudoheaders(unsigned char *pheader, const size_t plen)
 	edns.ede = EDE_UNSET;
 	edns.valid = true;
 
-	size_t offset; // The header is 11 bytes before the beginning of OPTION-DATA
-	while ((offset = (p - pheader - 11u)) < rdlen && rdlen < UINT16_MAX)
+	// Options must not extend beyond the pseudoheader
+	const unsigned char *end = p + rdlen;
+	if(rdlen > plen - 11u)
+	{
+		log_warn("Found malicious EDNS payload (payload larger than advertised), skipping record.");
+		end = pheader + plen;
+	}
+
+	while(end - p >= 4)
 	{
 		unsigned short code, optlen;
 		GETSHORT(code, p);
 		GETSHORT(optlen, p);
-		offset += 4;
 
 		// Avoid buffer overflow due to an malicious packet
-		if(offset + optlen > rdlen)
+		if(optlen > end - p)
 		{
 			log_warn("Found malicious EDNS payload (payload larger than advertised), skipping record.");
 			break;
 		}
 
+		// Every option is handled in place, the working pointer is
+		// advanced past it right away
+		const unsigned char *opt = p;
+		p += optlen;
+
 		// Debug logging
 		log_debug(DEBUG_EDNS0, "code %u, optlen %u (bytes %zu - %zu of %u)",
-		          code, optlen, offset, offset + optlen, rdlen);
+		          code, optlen, (size_t)(opt - pheader - 11), (size_t)(p - pheader - 11), rdlen);
 
-		if (code == EDNS0_ECS && config.dns.EDNS0ECS.v.b)
+		switch(code)
 		{
-			// EDNS(0) CLIENT SUBNET
-			// RFC 7871              Client Subnet in DNS Queries              6.  Option Format
-			//   This protocol uses an EDNS0 [RFC6891] option to include client
-			//   address information in DNS messages.  The option is structured as
-			//   follows:
-			//
-			//                +0 (MSB)                            +1 (LSB)
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   0: |                          OPTION-CODE                          |
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   2: |                         OPTION-LENGTH                         |
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   4: |                            FAMILY                             |
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			short family;
-			GETSHORT(family, p);
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   6: |     SOURCE PREFIX-LENGTH      |     SCOPE PREFIX-LENGTH       |
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			unsigned char source_netmask = *p++;
-			p++; // We are not interested in the scope prefix-length. It MUST be 0 in queries
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   8: |                           ADDRESS...                          /
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			union all_addr addr = {{ 0 }};
-			const size_t addrlen = optlen - 4;
-			if(family == 1 && addrlen <= sizeof(addr.addr4.s_addr)) // IPv4
-				memcpy(&addr.addr4.s_addr, p, addrlen);
-			else if(family == 2 && addrlen <= sizeof(addr.addr6.s6_addr)) // IPv6
-				memcpy(addr.addr6.s6_addr, p, addrlen);
-			else
-				continue;
+			case EDNS0_ECS:
+				if(config.dns.EDNS0ECS.v.b)
+					parse_ecs(opt, optlen);
+				break;
+
+			case EDNS0_COOKIE:
+				// EDNS(0) COOKIE, client-only (8 bytes) or client +
+				// server (16 - 40 bytes)
+				if(optlen == 8)
+				{
+					log_debug(DEBUG_EDNS0, "COOKIE (client-only): %s",
+					          hexdump(dump, opt, 8, ""));
+				}
+				else if(optlen >= 16 && optlen <= 40 && config.debug.edns0.v.b)
+				{
+					char server[EDNS0_DUMP_BYTES*2 + 4];
+					log_debug(DEBUG_EDNS0, "COOKIE (client + server): %s (client), %s (server, %u bytes)",
+					          hexdump(dump, opt, 8, ""), hexdump(server, opt + 8, optlen - 8u, ""),
+					          optlen - 8u);
+				}
+				break;
+
+			case EDNS0_MAC_ADDR_BYTE:
+				if(optlen != 6)
+					break;
+				// EDNS(0) MAC address (BYTE format)
+				memcpy(edns.mac_byte, opt, sizeof(edns.mac_byte));
+				print_mac(edns.mac_text, (unsigned char*)edns.mac_byte, sizeof(edns.mac_byte));
+				edns.mac_set = true;
+				log_debug(DEBUG_EDNS0, "MAC address (BYTE format): %s", edns.mac_text);
+				break;
+
+			case EDNS0_MAC_ADDR_TEXT:
+				// EDNS(0) MAC address (TEXT format, BASE64 uses
+				// the same option code with 8 bytes)
+				if(optlen == 17)
+				{
+					if(parse_mac_text(opt, edns.mac_byte))
+					{
+						memcpy(edns.mac_text, opt, 17);
+						edns.mac_text[17] = '\0';
+						edns.mac_set = true;
+						log_debug(DEBUG_EDNS0, "MAC address (TEXT format): %s", edns.mac_text);
+					}
+					else
+						log_debug(DEBUG_EDNS0, "Received MAC address has invalid format!");
+				}
+				else if(optlen == 8)
+					log_debug(DEBUG_EDNS0, "MAC address (BASE64 format): NOT IMPLEMENTED");
+				break;
+
+			case EDNS0_CPE_ID:
+				// EDNS(0) CPE-ID, 256 byte arbitrary limit
+				if(optlen < 256)
+					log_debug(DEBUG_EDNS0, "CPE-ID (payload size %u): \"%.*s\" (%s)",
+					          optlen, (int)optlen, (const char*)opt, hexdump(dump, opt, optlen, " "));
+				break;
+
+			case EDNS0_OPTION_EDE:
+				// EDNS(0) EDE
+				// https://datatracker.ietf.org/doc/rfc8914/
+				//
+				//                                                1   1   1   1   1   1
+				//        0   1   2   3   4   5   6   7   8   9   0   1   2   3   4   5
+				//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+				//   0: |                            OPTION-CODE                        |
+				//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+				//   2: |                           OPTION-LENGTH                       |
+				//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+				//   4: | INFO-CODE                                                     |
+				//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+				//   6: / EXTRA-TEXT ...                                                /
+				//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
+				//
+				// The INFO-CODE from the EDE EDNS option is used to
+				// serve as an index into the "Extended DNS Error" IANA
+				// registry, the initial values for which are defined in
+				// this document. The value of the INFO-CODE is encoded
+				// as a two-octet unsigned integer in network byte
+				// order.
+				if(optlen < 2)
+					break;
+				edns.ede = (opt[0] << 8) | opt[1];
+				log_debug(DEBUG_EDNS0, "EDE: %s (code %d)", edestr(edns.ede), edns.ede);
+				if(optlen > 2)
+					log_debug(DEBUG_EDNS0, "EDE: EXTRA-TEXT: %.*s", optlen - 2, opt + 2);
+				break;
+
+			default:
+				// Not implemented, skip this record
+				log_debug(DEBUG_EDNS0, "Unknown option %u with length %u", code, optlen);
+				break;
+		}
+	}
+}
 
-			// Advance working pointer (we already walked 4 bytes above)
-			p += optlen - 4;
+// Read OPT records from file (one per line as hex string, whitespace between
+// bytes and comment lines are ignored)
+static unsigned char **read_bench_records(const char *filename, size_t **lens, size_t *num)
+{
+	FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+	if(fp == NULL)
+	{
+		log_err("Cannot open %s: %s", filename, strerror(errno));
+		return NULL;
+	}
 
-			char ipaddr[ADDRSTRLEN] = { 0 };
-			inet_ntop(family == 1 ? AF_INET : AF_INET6, &addr.addr4.s_addr, ipaddr, sizeof(ipaddr));
+	unsigned char **records = NULL;
+	size_t size = 0;
+	char *line = NULL;
+	size_t len = 0;
+	*num = 0;
+	while(getline(&line, &len, fp) != -1)
+	{
+		if(line[0] == '#')
+			continue;
 
-			// Only use /32 (IPv4) and /128 (IPv6) addresses
-			if(!(family == 1 && source_netmask == 32) &&
-			   !(family == 2 && source_netmask == 128))
-			{
-				log_debug(DEBUG_EDNS0, "CLIENT SUBNET: %s/%u found (IPv%u)",
-				          ipaddr, source_netmask, family == 1 ? 4u : 6u);
+		// Decode hex string in place
+		size_t n = 0;
+		int hi = -1;
+		for(const char *c = line; *c != '\0'; c++)
+		{
+			const int v = hexval((unsigned char)*c);
+			if(v < 0)
 				continue;
-			}
-
-			// Copy data to edns struct
-			strncpy(edns.client, ipaddr, ADDRSTRLEN);
-			edns.client[ADDRSTRLEN-1] = '\0';
-
-			// Only set the address as useful when it is not the
-			// loopback address of the distant machine (127.0.0.0/8 or ::1)
-			if((family == 1 && (ntohl(addr.addr4.s_addr) & 0xFF000000) == 0x7F000000) ||
-			   (family == 2 && IN6_IS_ADDR_LOOPBACK(&addr.addr6)))
-			{
-				log_debug(DEBUG_EDNS0, "CLIENT SUBNET: Skipped %s/%u (IPv%u loopback address)",
-				          ipaddr, source_netmask, family == 1 ? 4u : 6u);
-			}
+			if(hi < 0)
+				hi = v;
 			else
 			{
-				edns.client_set = true;
-				log_debug(DEBUG_EDNS0, "CLIENT SUBNET: %s/%u - OK (IPv%u)",
-				          ipaddr, source_netmask, family == 1 ? 4u : 6u);
+				line[n++] = (char)((hi << 4) | v);
+				hi = -1;
 			}
 		}
-		else if(code == EDNS0_COOKIE && optlen == 8)
-		{
-			// EDNS(0) COOKIE client
-			unsigned char client_cookie[8];
-			memcpy(client_cookie, p, 8);
-			if(config.debug.edns0.v.b)
-			{
-				char pretty_client_cookie[8*2 + 1]; // client: fixed length
-				char *pp = pretty_client_cookie;
-				for(unsigned int j = 0; j < 8; j++)
-					pp += sprintf(pp, "%02X", client_cookie[j]);
-				log_debug(DEBUG_EDNS0, "COOKIE (client-only): %s",
-				     pretty_client_cookie);
-			}
-
-			// Advance working pointer
-			p += 8;
-		}
-		else if(code == EDNS0_COOKIE && optlen >= 16 && optlen <= 40)
-		{
-			// EDNS(0) COOKIE client + server
-			unsigned char client_cookie[8];
-			memcpy(client_cookie, p, 8);
-
-			unsigned short server_cookie_len = optlen - 8;
-			unsigned char *server_cookie = calloc(server_cookie_len, sizeof(unsigned char));
-			memcpy(server_cookie, p + 8u, server_cookie_len);
-			if(config.debug.edns0.v.b)
-			{
-				char pretty_client_cookie[8*2 + 1]; // client: fixed length
-				char *pp = pretty_client_cookie;
-				for(unsigned int j = 0; j < 8; j++)
-					pp += sprintf(pp, "%02X", client_cookie[j]);
-				char *pretty_server_cookie = calloc(server_cookie_len*2 + 1u, sizeof(char)); // server: variable length
-				pp = pretty_server_cookie;
-				for(unsigned int j = 0; j < server_cookie_len; j++)
-					pp += sprintf(pp, "%02X", server_cookie[j]);
-				log_debug(DEBUG_EDNS0, "COOKIE (client + server): %s (client), %s (server, %u bytes)",
-				     pretty_client_cookie, pretty_server_cookie, server_cookie_len);
-				free(pretty_server_cookie);
-			}
-			free(server_cookie);
+		if(n == 0)
+			continue;
 
-			// Advance working pointer
-			p += optlen;
-		}
-		else if(code == EDNS0_MAC_ADDR_BYTE && optlen == 6)
+		if(*num == size)
 		{
-			// EDNS(0) MAC address (BYTE format)
-			memcpy(edns.mac_byte, p, sizeof(edns.mac_byte));
-			print_mac(edns.mac_text, (unsigned char*)edns.mac_byte, sizeof(edns.mac_byte));
-			edns.mac_set = true;
-			log_debug(DEBUG_EDNS0, "MAC address (BYTE format): %s", edns.mac_text);
-
-			// Advance working pointer
-			p += 6;
+			size = size > 0 ? 2*size : 64;
+			unsigned char **new = realloc(records, size * sizeof(*records));
+			size_t *newlens = realloc(*lens, size * sizeof(**lens));
+			if(new != NULL)
+				records = new;
+			if(newlens != NULL)
+				*lens = newlens;
+			if(new == NULL || newlens == NULL)
+				break;
 		}
-		else if(code == EDNS0_MAC_ADDR_TEXT && optlen == 17)
-		{
-			// EDNS(0) MAC address (TEXT format)
-			memcpy(edns.mac_text, p, 17);
-			edns.mac_text[17] = '\0';
-			if(sscanf(edns.mac_text, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
-			          (unsigned char*)&edns.mac_byte[0],
-			          (unsigned char*)&edns.mac_byte[1],
-			          (unsigned char*)&edns.mac_byte[2],
-			          (unsigned char*)&edns.mac_byte[3],
-			          (unsigned char*)&edns.mac_byte[4],
-			          (unsigned char*)&edns.mac_byte[5]) == 6)
-			{
-				edns.mac_set = true;
-				log_debug(DEBUG_EDNS0, "MAC address (TEXT format): %s", edns.mac_text);
-			}
-			else
-			{
-				log_debug(DEBUG_EDNS0, "Received MAC address has invalid format!");
-			}
+		if((records[*num] = malloc(n)) == NULL)
+			break;
+		memcpy(records[*num], line, n);
+		(*lens)[*num] = n;
+		(*num)++;
+	}
 
-			// Advance working pointer
-			p += 17;
-		}
-		else if(code == EDNS0_MAC_ADDR_BASE64 && optlen == 8)
-		{
-			// EDNS(0) MAC address (BASE format)
-			log_debug(DEBUG_EDNS0, "MAC address (BASE64 format): NOT IMPLEMENTED");
+	free(line);
+	if(fp != stdin)
+		fclose(fp);
 
-			// Advance working pointer
-			p += 8;
-		}
-		else if(code == EDNS0_CPE_ID && optlen < 256)
-		{
-			// EDNS(0) CPE-ID, 256 byte arbitrary limit
-			unsigned char *payload = calloc(optlen + 1u, sizeof(unsigned char));
-			memcpy(payload, p, optlen);
-			payload[optlen] = '\0';
-			if(config.debug.edns0.v.b)
-			{
-				char *pretty_payload = calloc(optlen*5 + 1u, sizeof(char));
-				char *pp = pretty_payload;
-				for(unsigned int j = 0; j < optlen; j++)
-					pp += sprintf(pp, "0x%02X ", payload[j]);
-				pretty_payload[optlen*5 - 1] = '\0'; // Truncate away the trailing whitespace
-				log_debug(DEBUG_EDNS0, "CPE-ID (payload size %u): \"%s\" (%s)",
-				     optlen, payload, pretty_payload);
-				free(pretty_payload);
-			}
-			free(payload);
+	return records;
+}
 
-			// Advance working pointer
-			p += optlen;
-		}
-		else if(code == EDNS0_OPTION_EDE && optlen >= 2)
-		{
-			// EDNS(0) EDE
-			// https://datatracker.ietf.org/doc/rfc8914/
-			//
-			//                                                1   1   1   1   1   1
-			//        0   1   2   3   4   5   6   7   8   9   0   1   2   3   4   5
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   0: |                            OPTION-CODE                        |
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   2: |                           OPTION-LENGTH                       |
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   4: | INFO-CODE                                                     |
-			edns.ede = ntohs(((int)p[1] << 8) | p[0]);
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//   6: / EXTRA-TEXT ...                                                /
-			//      +---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+---+
-			//
-			// The INFO-CODE from the EDE EDNS option is used to
-			// serve as an index into the "Extended DNS Error" IANA
-			// registry, the initial values for which are defined in
-			// this document. The value of the INFO-CODE is encoded
-			// as a two-octet unsigned integer in network byte
-			// order.
-
-			// Debug output
-			log_debug(DEBUG_EDNS0, "EDE: %s (code %d)", edestr(edns.ede), edns.ede);
-
-			if(optlen > 2)
-			{
-				// Debug output
-				log_debug(DEBUG_EDNS0, "EDE: EXTRA-TEXT: %.*s", optlen - 2, p + 2);
-			}
+/**
+ * Benchmark and fuzz FTL_parse_pseudoheaders() with captured OPT records
+ *
+ * Every record is parsed rounds times to measure the parsing cost. Afterwards,
+ * each record is parsed rounds times more with random bytes flipped and a
+ * random length, using exactly sized copies so out-of-bounds reads are caught
+ * when running under a memory sanitizer
+ *
+ * @param debug_mode Keep debug flags of the config file
+ * @param quiet Suppress output
+ * @param filename File with OPT records (hex, one per line), "-" for stdin
+ * @param rounds Number of times every record is parsed (0 = default)
+ * @return Exit code
+ */
+int edns0_bench(const bool debug_mode, const bool quiet, const char *filename, unsigned int rounds)
+{
+	// Disable terminal output during config config file parsing
+	log_ctrl(false, false);
+	readFTLconf(&config, false);
+	if(!debug_mode)
+		clear_debug_flags(); // No debug printing wanted
+	log_ctrl(false, !quiet);
+
+	if(rounds == 0)
+		rounds = 100000u;
+
+	log_info("%s Reading OPT records from %s...", cli_info(), filename);
+	size_t num = 0, *lens = NULL;
+	unsigned char **records = read_bench_records(filename, &lens, &num);
+	if(records == NULL || num == 0)
+	{
+		log_info("    No OPT records to benchmark");
+		free(records);
+		free(lens);
+		return EXIT_FAILURE;
+	}
+	log_info("    Read %zu records\n", num);
 
-			// Advance working pointer
-			p += optlen;
+	// Benchmark
+	unsigned long parsed = 0, valid = 0;
+	double t0 = double_time();
+	for(unsigned int r = 0; r < rounds; r++)
+	{
+		for(size_t i = 0; i < num; i++)
+		{
+			FTL_parse_pseudoheaders(records[i], lens[i]);
+			valid += getEDNS() != NULL;
+			parsed++;
 		}
-		else
+	}
+	double elapsed = double_time() - t0;
+	log_info("%s Parsed %lu records (%lu valid) in %.3f msec (%.1f nsec/record)",
+	         cli_info(), parsed, valid, 1e3*elapsed, 1e9*elapsed/parsed);
+
+	// Fuzzing, malicious records are expected here so warnings are not
+	// printed
+	log_ctrl(false, false);
+	unsigned int seed = (unsigned int)time(NULL);
+	parsed = 0;
+	t0 = double_time();
+	for(size_t i = 0; i < num; i++)
+	{
+		for(unsigned int r = 0; r < rounds; r++)
 		{
-			log_debug(DEBUG_EDNS0, "Unknown option %u with length %u", code, optlen);
-			// Not implemented, skip this record
-
-			// Advance working pointer
-			p += optlen;
+			const size_t len = (size_t)rand_r(&seed) % (lens[i] + 1u);
+			unsigned char *buf = malloc(len > 0 ? len : 1u);
+			if(buf == NULL)
+				break;
+			memcpy(buf, records[i], len);
+			for(unsigned int flips = (unsigned int)rand_r(&seed) % 4u; flips > 0 && len > 0; flips--)
+				buf[(size_t)rand_r(&seed) % len] ^= (unsigned char)(1u + rand_r(&seed) % 255);
+			FTL_parse_pseudoheaders(buf, len);
+			getEDNS();
+			free(buf);
+			parsed++;
 		}
 	}
+	elapsed = double_time() - t0;
+	log_ctrl(false, !quiet);
+	log_info("%s Fuzzed %lu mutated records in %.3f msec",
+	         cli_info(), parsed, 1e3*elapsed);
+
+	for(size_t i = 0; i < num; i++)
+		free(records[i]);
+	free(records);
+	free(lens);
+
+	return EXIT_SUCCESS;
 }
@@ -15,6 +15,12 @@ typedef struct {
 	bool mac_set :1;
 	bool valid :1;
 	char client[ADDRSTRLEN];
+	// Binary form of client (see struct client_addr)
+	sa_family_t client_family;
+	union {
+		struct in_addr in;
+		struct in6_addr in6;
+	} client_addr;
 	char mac_byte[6];
 	char mac_text[18];
 	int ede;
@@ -22,5 +28,6 @@ typedef struct {
 
 ednsData *getEDNS(void);
 void FTL_parse_pseudoheaders(unsigned char *pheader, const size_t plen);
+int edns0_bench(const bool debug_mode, const bool quiet, const char *filename, unsigned int rounds);
 
 #endif // EDNS0_HEADER
@@ -21,6 +21,10 @@ enum memory_type {
 	CLIENTS_LOOKUP,
 	DOMAINS_LOOKUP,
 	DNS_CACHE_LOOKUP,
+	STRINGS_LOOKUP,
+	SUFFIXES,
+	SUFFIXES_LOOKUP,
+	UPSTREAMS_LOOKUP,
 } __attribute__ ((packed));
 
 enum dnssec_status {
@@ -71,6 +75,7 @@ enum reply_type {
 	REPLY_DNSSEC,
 	REPLY_NONE,
 	REPLY_BLOB,
+	REPLY_SYNTHESIZED,
 	QUERY_REPLY_MAX
 }  __attribute__ ((packed));
 
@@ -161,6 +166,7 @@ enum debug_flag {
 
 enum events {
 	RELOAD_GRAVITY,
+	RELOAD_DOMAINLIST,
 	RESOLVE_NEW_HOSTNAMES,
 	RERESOLVE_HOSTNAMES,
 	RERESOLVE_HOSTNAMES_FORCE,
@@ -245,9 +251,18 @@ enum thread_types {
 	NTP_CLIENT,
 	NTP_SERVER4,
 	NTP_SERVER6,
+	FEDERATION,
+	DOT,
 	THREADS_MAX
 } __attribute__ ((packed));
 
+enum thread_role {
+	ROLE_DNS,
+	ROLE_BACKGROUND,
+	ROLE_WEBSERVER,
+	ROLE_MAX
+} __attribute__ ((packed));
+
 enum telnet_type {
 	TELNETv4,
 	TELNETv6,
@@ -343,6 +358,9 @@ enum api_flags {
 	API_DOMAINS = 1 << 0,
 	API_PARSE_JSON = 1 << 1,
 	API_BATCHDELETE = 1 << 2,
+	API_CACHE = 1 << 3,
+	API_HEAVY = 1 << 4,
+	API_BULK = 1 << 5,
 };
 
 enum verify_result {
@@ -352,4 +370,22 @@ enum verify_result {
 	VERIFY_NO_CHECKSUM
 } __attribute__ ((packed));
 
+enum shm_lock_path {
+	SHM_LOCK_DNS,
+	SHM_LOCK_READ,
+	SHM_LOCK_OTHER,
+	SHM_LOCK_PATHS
+};
+
+// Remaining TTL (relative to the TTL at insertion) of records served from
+// the cache
+enum cache_hit_ttl {
+	CACHE_HIT_STALE,
+	CACHE_HIT_BELOW_10,
+	CACHE_HIT_BELOW_25,
+	CACHE_HIT_BELOW_50,
+	CACHE_HIT_ABOVE_50,
+	CACHE_HIT_TTL_MAX
+} __attribute__ ((packed));
+
 #endif // ENUMS_H
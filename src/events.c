@@ -18,6 +18,8 @@
 #include "config/config.h"
 // logging
 #include "log.h"
+// wake_thread()
+#include "signals.h"
 
 // Private prototypes
 static const char *eventtext(const enum events event);
@@ -25,6 +27,18 @@ static const char *eventtext(const enum events event);
 // Queue containing all possible events
 static volatile atomic_flag eventqueue[EVENTS_MAX] = { ATOMIC_FLAG_INIT };
 
+// Threads processing the events, they are woken up when an event is set
+static const enum thread_types event_threads[EVENTS_MAX] = {
+	[RELOAD_GRAVITY] = DB,
+	[RELOAD_DOMAINLIST] = DB,
+	[RESOLVE_NEW_HOSTNAMES] = DNSclient,
+	[RERESOLVE_HOSTNAMES] = DNSclient,
+	[RERESOLVE_HOSTNAMES_FORCE] = DNSclient,
+	[REIMPORT_ALIASCLIENTS] = DB,
+	[PARSE_NEIGHBOR_CACHE] = DB,
+	[SEARCH_LOOKUP_HASH_COLLISIONS] = GC
+};
+
 // Set/Request event
 // We set the events atomically to ensure no race collisions can happen. If an
 // event has already been requested, this has no consequences as event cannot be
@@ -36,6 +50,10 @@ void _set_event(const enum events event, int line, const char *function, const c
 	if(atomic_flag_test_and_set(&eventqueue[event]))
 		is_set = true;
 
+	// Handle the event right away instead of when the thread wakes up the
+	// next time
+	wake_thread(event_threads[event]);
+
 	// Possible debug logging
 	if(config.debug.events.v.b)
 	{
@@ -88,6 +106,8 @@ static const char *eventtext(const enum events event)
 	{
 		case RELOAD_GRAVITY:
 			return "RELOAD_GRAVITY";
+		case RELOAD_DOMAINLIST:
+			return "RELOAD_DOMAINLIST";
 		case RERESOLVE_HOSTNAMES:
 			return "RERESOLVE_HOSTNAMES";
 		case RERESOLVE_HOSTNAMES_FORCE:
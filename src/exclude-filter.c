@@ -0,0 +1,326 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API exclusion filter routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file exclude-filter.c
+* @brief Caches whether domains and clients are hidden from the top lists.
+*
+* The regular expressions in webserver.api.excludeDomains and
+* webserver.api.excludeClients are compiled once (per process) and evaluated
+* when a domain or client is created, when a client's host name changes, and
+* when the filters themselves change. The verdict is stored in the flags of
+* the object so the API can skip excluded objects without running any regex.
+*
+* Workers forked from the resolver keep the configuration they have been forked
+* with. The main process therefore stores the patterns in the shared strings
+* buffer and increments a shared generation counter whenever they change. Each
+* process compares this counter with the one its filters have been compiled
+* for and compiles them again from the shared patterns when it differs.
+*/
+
+#include "FTL.h"
+#include "exclude-filter.h"
+// getstr()
+#include "shmem.h"
+// log_warn()
+#include "log.h"
+// regex_t
+#include <regex.h>
+
+// Size of the shared strings holding the newline-terminated patterns. This
+// stays below the longest string addstr() stores without shortening it
+#define EXCLUDE_CHUNK_SIZE 4000u
+
+struct exclude_filter {
+	bool compiled;
+	unsigned int generation;
+	unsigned int N;
+	regex_t *regex;
+};
+
+static struct exclude_filter domain_filter = { 0 };
+static struct exclude_filter client_filter = { 0 };
+
+static void free_filter(struct exclude_filter *filter)
+{
+	for(unsigned int i = 0; i < filter->N; i++)
+		regfree(&filter->regex[i]);
+	if(filter->regex != NULL)
+		free(filter->regex);
+	filter->N = 0;
+	filter->compiled = false;
+}
+
+static void compile_pattern(struct exclude_filter *filter, const char *pattern,
+                            const char *path, const unsigned int i)
+{
+	// Skip non-string, invalid and empty values
+	if(pattern == NULL || strlen(pattern) == 0)
+	{
+		log_warn("Skipping invalid regex at %s.%u", path, i);
+		return;
+	}
+
+	const int rc = regcomp(&filter->regex[filter->N], pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+	if(rc != 0)
+	{
+		char errbuf[1024] = { 0 };
+		regerror(rc, &filter->regex[filter->N], errbuf, sizeof(errbuf));
+		log_warn("Failed to compile regex \"%s\" at %s.%u: %s",
+		         pattern, path, i, errbuf);
+	}
+	else
+		filter->N++;
+}
+
+// Compile the filter from the configuration of this process. This is used only
+// until the main process stored the patterns in shared memory
+static void compile_filter(struct exclude_filter *filter, const char *path, cJSON *json)
+{
+	free_filter(filter);
+	filter->compiled = true;
+
+	const int N = cJSON_GetArraySize(json);
+	if(N < 1)
+		return;
+
+	filter->regex = calloc(N, sizeof(regex_t));
+	if(filter->regex == NULL)
+	{
+		log_err("Memory allocation failed in %s()", __FUNCTION__);
+		return;
+	}
+
+	unsigned int i = 0;
+	cJSON *item = NULL;
+	cJSON_ArrayForEach(item, json)
+		compile_pattern(filter, cJSON_IsString(item) ? item->valuestring : NULL, path, i++);
+}
+
+// Compile the filter from the patterns stored by publish_filter()
+static void compile_shared(struct exclude_filter *filter, const char *path, const size_t *pos)
+{
+	free_filter(filter);
+	filter->compiled = true;
+
+	unsigned int N = 0;
+	for(unsigned int c = 0; c < EXCLUDE_FILTER_CHUNKS; c++)
+		for(const char *s = pos[c] != 0 ? getstr(pos[c]) : ""; *s != '\0'; s++)
+			N += *s == '\n';
+
+	if(N < 1)
+		return;
+
+	filter->regex = calloc(N, sizeof(regex_t));
+	if(filter->regex == NULL)
+	{
+		log_err("Memory allocation failed in %s()", __FUNCTION__);
+		return;
+	}
+
+	unsigned int i = 0;
+	for(unsigned int c = 0; c < EXCLUDE_FILTER_CHUNKS; c++)
+	{
+		if(pos[c] == 0)
+			continue;
+
+		const char *s = getstr(pos[c]);
+		for(const char *end = NULL; (end = strchr(s, '\n')) != NULL; s = end + 1)
+		{
+			char pattern[EXCLUDE_CHUNK_SIZE];
+			const size_t len = min((size_t)(end - s), sizeof(pattern) - 1);
+			memcpy(pattern, s, len);
+			pattern[len] = '\0';
+			compile_pattern(filter, pattern, path, i++);
+		}
+	}
+}
+
+// Make sure the filter has been compiled for the current patterns
+static void check_filter(struct exclude_filter *filter, const bool clients,
+                         const char *path, cJSON *json)
+{
+	const unsigned int generation = get_exclude_generation();
+	if(filter->compiled && filter->generation == generation)
+		return;
+
+	// There is no shared copy of the patterns when running without shared
+	// memory or before the main process stored them during startup
+	const size_t *pos = get_exclude_patterns(clients);
+	if(generation == 0 || pos == NULL)
+		compile_filter(filter, path, json);
+	else
+		compile_shared(filter, path, pos);
+
+	filter->generation = generation;
+}
+
+// Store the patterns as newline-terminated lines in shared strings. Invalid
+// patterns are stored as empty lines so the indices in warnings match the
+// configuration. Has to be called with the SHM lock held
+static void publish_filter(size_t *pos, const char *path, cJSON *json)
+{
+	char chunk[EXCLUDE_CHUNK_SIZE];
+	size_t len = 0;
+	unsigned int c = 0, i = 0;
+	memset(pos, 0, EXCLUDE_FILTER_CHUNKS*sizeof(*pos));
+
+	cJSON *item = NULL;
+	cJSON_ArrayForEach(item, json)
+	{
+		const char *pattern = cJSON_IsString(item) && item->valuestring != NULL &&
+		                      strchr(item->valuestring, '\n') == NULL ? item->valuestring : "";
+		size_t plen = strlen(pattern);
+		if(plen + 2 > sizeof(chunk))
+		{
+			log_warn("Skipping too long regex at %s.%u", path, i);
+			pattern = "";
+			plen = 0;
+		}
+
+		// Store the chunk when the pattern does not fit anymore
+		if(len + plen + 2 > sizeof(chunk))
+		{
+			chunk[len] = '\0';
+			pos[c++] = addstr(chunk);
+			len = 0;
+		}
+		if(c >= EXCLUDE_FILTER_CHUNKS)
+		{
+			log_warn("Too many regex in %s, ignoring all from %s.%u on", path, path, i);
+			return;
+		}
+
+		memcpy(&chunk[len], pattern, plen);
+		len += plen;
+		chunk[len++] = '\n';
+		i++;
+	}
+
+	if(len > 0)
+	{
+		chunk[len] = '\0';
+		pos[c] = addstr(chunk);
+	}
+}
+
+static bool matches_filter(const struct exclude_filter *filter, const char *string)
+{
+	if(string == NULL)
+		return false;
+
+	for(unsigned int i = 0; i < filter->N; i++)
+		if(regexec(&filter->regex[i], string, 0, NULL, 0) == 0)
+			return true;
+
+	return false;
+}
+
+void set_domain_excluded(domainsData *domain)
+{
+	check_filter(&domain_filter, false, "webserver.api.excludeDomains",
+	             config.webserver.api.excludeDomains.v.json);
+
+	domain->flags.excluded = matches_filter(&domain_filter, getDomainName(domain));
+}
+
+void set_client_excluded(clientsData *client)
+{
+	check_filter(&client_filter, true, "webserver.api.excludeClients",
+	             config.webserver.api.excludeClients.v.json);
+
+	// Clients are excluded if either their IP address or their host name
+	// matches any of the filters
+	client->flags.excluded = matches_filter(&client_filter, getstr(client->ippos)) ||
+	                         (client->namepos != 0 && matches_filter(&client_filter, getstr(client->namepos)));
+}
+
+// Store the patterns of both filters in shared memory and let all processes
+// compile them again on their next use
+static bool publish_filters(void)
+{
+	size_t *domains = get_exclude_patterns(false);
+	size_t *clients = get_exclude_patterns(true);
+
+	// Nothing to share without shared memory (e.g., when running
+	// pihole-FTL --config)
+	if(domains == NULL || clients == NULL)
+		return false;
+
+	publish_filter(domains, "webserver.api.excludeDomains",
+	               config.webserver.api.excludeDomains.v.json);
+	publish_filter(clients, "webserver.api.excludeClients",
+	               config.webserver.api.excludeClients.v.json);
+	bump_exclude_generation();
+
+	return true;
+}
+
+static void update_domains(void)
+{
+	for(unsigned int domainID = 0; domainID < counters->domains; domainID++)
+	{
+		domainsData *domain = getDomain(domainID, true);
+		if(domain != NULL)
+			set_domain_excluded(domain);
+	}
+}
+
+static void update_clients(void)
+{
+	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		clientsData *client = getClient(clientID, true);
+		if(client != NULL)
+			set_client_excluded(client);
+	}
+}
+
+void init_exclude_filters(void)
+{
+	if(!publish_filters())
+		return;
+
+	// Domains and clients restored from a snapshot carry the verdicts of
+	// the filters of the previous process
+	update_domains();
+	update_clients();
+}
+
+void update_exclude_filters(const struct config *old_conf)
+{
+	const bool domains = !cJSON_Compare(old_conf->webserver.api.excludeDomains.v.json,
+	                                    config.webserver.api.excludeDomains.v.json, true);
+	const bool clients = !cJSON_Compare(old_conf->webserver.api.excludeClients.v.json,
+	                                    config.webserver.api.excludeClients.v.json, true);
+	if(!domains && !clients)
+		return;
+
+	// Nothing to update without shared memory (e.g., when running
+	// pihole-FTL --config)
+	if(!publish_filters())
+	{
+		free_filter(&domain_filter);
+		free_filter(&client_filter);
+		return;
+	}
+
+	if(domains)
+	{
+		log_debug(DEBUG_API, "webserver.api.excludeDomains changed, updating domains");
+		update_domains();
+	}
+
+	if(clients)
+	{
+		log_debug(DEBUG_API, "webserver.api.excludeClients changed, updating clients");
+		update_clients();
+	}
+}
@@ -0,0 +1,36 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  API exclusion filter header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef EXCLUDE_FILTER_H
+#define EXCLUDE_FILTER_H
+
+#include <stdbool.h>
+// domainsData, clientsData
+#include "datastructure.h"
+// struct config
+#include "config/config.h"
+
+// Update the excluded flag of a domain or client. This needs to be called
+// whenever the domain name or the client's IP address or host name changes.
+// The caller must hold the exclusive SHM lock
+void set_domain_excluded(domainsData *domain);
+void set_client_excluded(clientsData *client);
+
+// Store the patterns in shared memory for the workers and update all domains
+// and clients. Called by the main process during startup with the exclusive SHM
+// lock held
+void init_exclude_filters(void);
+
+// Recompile the filters and update all domains and clients if
+// webserver.api.excludeDomains or webserver.api.excludeClients changed. The
+// caller must hold the exclusive SHM lock
+void update_exclude_filters(const struct config *old_conf);
+
+#endif //EXCLUDE_FILTER_H
@@ -0,0 +1,1093 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Federated statistics
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file federation.c
+* @brief Cluster-wide statistics of several FTL instances.
+*
+* Every node exports a compact summary of its statistics at
+* /api/federation/summary: the counters shown by /api/stats/summary, the
+* overTime slots and the exact head of its top lists (the heavy hitters, see
+* top-lists.c). Nodes listing other nodes in webserver.api.federation.peers
+* fetch these summaries every webserver.api.federation.interval seconds in the
+* federation thread. Only overTime slots which may have changed since the last
+* fetch are requested, all other parts of a summary are small and of fixed
+* size. Raw queries are never exchanged.
+*
+* Peers authenticate every request with an HMAC keyed with the shared
+* webserver.api.federation.token (see federation_sign_request()), the token
+* itself is never sent. The HMAC covers the request, its time and a random
+* nonce. Requests whose time differs too much from the time of the receiving
+* node and nonces seen before are rejected, so captured requests cannot be
+* replayed.
+*
+* The summaries are kept in memory and merged with the local statistics when
+* a cluster view (e.g. /api/history?cluster=true) is requested. Counters and
+* overTime slots are summed up, slots are matched by their timestamp which is
+* aligned to OVERTIME_INTERVAL on all nodes. Top lists are merged by summing up
+* the counts of identical domains (or client IP addresses). An item missing
+* from a node's list is counted as zero for this node, so counts of merged top
+* lists are lower bounds.
+*/
+
+#include "FTL.h"
+#include "federation.h"
+// config
+#include "config/config.h"
+// lock_shm_read(), counters, get_qps()
+#include "shmem.h"
+// getDomain(), getClient(), get_blocked_count(), get_active_clients()
+#include "datastructure.h"
+// overTime
+#include "overTime.h"
+// get_max_overtime_slot()
+#include "gc.h"
+// killed, thread_sleepms()
+#include "signals.h"
+// log_warn()
+#include "log.h"
+// mg_connect_client()
+#include "webserver/civetweb/civetweb.h"
+// gravity_image_update()
+#include "database/gravity-image.h"
+// prctl()
+#include <sys/prctl.h>
+// set_thread_placement()
+#include "daemon.h"
+// get_secure_randomness()
+#include "config/password.h"
+// struct hmac_sha256_ctx
+#include <nettle/hmac.h>
+// memeql_sec()
+#include <nettle/memops.h>
+
+// Size of the nonce of an authenticated request [bytes]
+#define NONCE_SIZE 16u
+// Number of nonces remembered to detect replayed requests. Each of them is
+// remembered until the request it belongs to would be rejected as too old
+// anyway. Requests are rejected while all of them are in use
+#define MAX_NONCES 4096u
+
+// Keys of the top lists in the summaries (indexed by enum top_list_type)
+static const char * const top_list_names[TOP_LIST_TYPES] = {
+	"domains",
+	"blocked",
+	"clients",
+	"clients_blocked"
+};
+
+// Everything received from the peers. Peers are only added, removed and
+// updated by the federation thread, the lock has to be held for this and for
+// reading them from other threads
+static pthread_mutex_t fed_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fed_node *peers = NULL;
+static unsigned int num_peers = 0u;
+
+// Nonces of the requests accepted recently (ring buffer), the lock has to be
+// held for accessing them
+static pthread_mutex_t nonce_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	time_t timestamp;
+	uint8_t nonce[NONCE_SIZE];
+} nonces[MAX_NONCES] = {{ 0 }};
+static unsigned int next_nonce = 0u;
+
+// Slot of the ring of overTime slots a timestamp belongs to
+static inline unsigned int fed_slot_index(const time_t timestamp)
+{
+	return (unsigned int)((timestamp / OVERTIME_INTERVAL) % OVERTIME_SLOTS);
+}
+
+static inline bool is_client_list(const enum top_list_type type)
+{
+	return type == TOP_CLIENTS_TOTAL || type == TOP_CLIENTS_BLOCKED;
+}
+
+/**
+ * Get the exact head of one of the local top lists. Hidden and excluded
+ * domains and clients are skipped as they are in /api/stats/top_*.
+ *
+ * @param type The list to get
+ * @param out Array of FEDERATION_TOP_SIZE elements
+ * @return The number of entries returned
+ */
+static unsigned int collect_top(const enum top_list_type type, struct fed_top *out)
+{
+	struct top_list_entry list[TOP_LIST_SIZE];
+	bool complete = false;
+	lock_shm_read();
+	unsigned int num = get_top_list(type, list, &complete);
+	unlock_shm_read();
+
+	// Rebuilding needs the exclusive lock which cannot be obtained while
+	// the caller holds the shared one (e.g. within /api/batch)
+	if(num == 0 && !complete && !holds_shm_read_lock())
+	{
+		lock_shm();
+		rebuild_top_list(type);
+		unlock_shm();
+
+		lock_shm_read();
+		num = get_top_list(type, list, &complete);
+		unlock_shm_read();
+	}
+
+	unsigned int n = 0;
+	lock_shm_read();
+	for(unsigned int i = 0; i < num && n < FEDERATION_TOP_SIZE; i++)
+	{
+		if(list[i].count < 1)
+			continue;
+
+		struct fed_top *top = &out[n];
+		if(is_client_list(type))
+		{
+			// Skip e.g. recycled, hidden and excluded clients
+			const clientsData *client = getClient(list[i].id, true);
+			if(client == NULL || client->ippos == 0 || client->flags.excluded)
+				continue;
+			const char *ip = getstr(client->ippos);
+			if(strcmp(ip, HIDDEN_CLIENT) == 0)
+				continue;
+			strncpy(top->ip, ip, sizeof(top->ip) - 1);
+			top->ip[sizeof(top->ip) - 1] = '\0';
+			strncpy(top->name, getstr(client->namepos), sizeof(top->name) - 1);
+			top->name[sizeof(top->name) - 1] = '\0';
+		}
+		else
+		{
+			const domainsData *domain = getDomain(list[i].id, true);
+			if(domain == NULL || domain->flags.excluded)
+				continue;
+			const char *name = getDomainName(domain);
+			if(name[0] == '\0' || strcmp(name, HIDDEN_DOMAIN) == 0)
+				continue;
+			top->ip[0] = '\0';
+			strncpy(top->name, name, sizeof(top->name) - 1);
+			top->name[sizeof(top->name) - 1] = '\0';
+		}
+		top->count = list[i].count;
+		n++;
+	}
+	unlock_shm_read();
+
+	return n;
+}
+
+/**
+ * Collect the statistics of this node
+ *
+ * @param node The node to fill, it is overwritten completely
+ * @param with_top Whether the top lists should be collected, too
+ */
+static void collect_local(struct fed_node *node, const bool with_top)
+{
+	memset(node, 0, sizeof(*node));
+	strcpy(node->name, "localhost");
+	node->updated = time(NULL);
+
+	lock_shm_read();
+	node->frequency = get_qps();
+	node->total = get_total_queries();
+	node->blocked = get_blocked_count();
+	node->cached = get_cached_count();
+	node->forwarded = get_forwarded_count();
+	node->domains = counters->domains;
+	node->gravity = counters->database.gravity;
+	node->clients_active = get_active_clients();
+	node->clients_total = counters->clients;
+	for(enum query_type type = 0; type < TYPE_MAX; type++)
+		node->types[type] = get_querytype_count(type);
+	for(enum query_status status = 0; status < QUERY_STATUS_MAX; status++)
+		node->status[status] = get_status_count(status);
+	for(enum reply_type reply = 0; reply < QUERY_REPLY_MAX; reply++)
+		node->reply[reply] = get_reply_count(reply);
+
+	const unsigned int max_slot = get_max_overtime_slot();
+	for(unsigned int slot = 0; slot <= max_slot && slot < OVERTIME_SLOTS; slot++)
+	{
+		struct fed_slot *out = &node->overTime[fed_slot_index(overTime[slot].timestamp)];
+		out->timestamp = overTime[slot].timestamp;
+		out->total = overTime[slot].total;
+		out->blocked = overTime[slot].blocked;
+		out->cached = overTime[slot].cached;
+		out->forwarded = overTime[slot].forwarded;
+	}
+	unlock_shm_read();
+
+	if(!with_top)
+		return;
+
+	for(enum top_list_type type = 0; type < TOP_LIST_TYPES; type++)
+		node->top_num[type] = collect_top(type, node->top[type]);
+}
+
+// Name of a query type in the summaries, TYPE_OTHER is "OTHER"
+static inline const char *type_name(const enum query_type type)
+{
+	return get_query_type_str(type, NULL, NULL);
+}
+
+/**
+ * Serialize the statistics of a node
+ *
+ * @param node The node
+ * @param since Only overTime slots starting at this time are included
+ * @return The summary or NULL if memory allocation failed
+ */
+static cJSON *node_to_json(const struct fed_node *node, const time_t since)
+{
+	cJSON *json = cJSON_CreateObject();
+	if(json == NULL)
+		return NULL;
+
+	cJSON_AddNumberToObject(json, "time", node->updated);
+	cJSON_AddNumberToObject(json, "frequency", node->frequency);
+	cJSON_AddNumberToObject(json, "total", node->total);
+	cJSON_AddNumberToObject(json, "blocked", node->blocked);
+	cJSON_AddNumberToObject(json, "cached", node->cached);
+	cJSON_AddNumberToObject(json, "forwarded", node->forwarded);
+	cJSON_AddNumberToObject(json, "domains", node->domains);
+	cJSON_AddNumberToObject(json, "gravity", node->gravity);
+	cJSON_AddNumberToObject(json, "clients_active", node->clients_active);
+	cJSON_AddNumberToObject(json, "clients_total", node->clients_total);
+
+	cJSON *types = cJSON_AddObjectToObject(json, "types");
+	for(enum query_type type = TYPE_A; type < TYPE_MAX; type++)
+		cJSON_AddNumberToObject(types, type_name(type), node->types[type]);
+
+	cJSON *status = cJSON_AddObjectToObject(json, "status");
+	for(enum query_status s = 0; s < QUERY_STATUS_MAX; s++)
+		cJSON_AddNumberToObject(status, get_query_status_str(s), node->status[s]);
+
+	cJSON *replies = cJSON_AddObjectToObject(json, "replies");
+	for(enum reply_type r = 0; r < QUERY_REPLY_MAX; r++)
+		cJSON_AddNumberToObject(replies, get_query_reply_str(r), node->reply[r]);
+
+	// Slots as [timestamp, total, blocked, cached, forwarded] in
+	// chronological order, starting with the oldest slot of the ring
+	cJSON *slots = cJSON_AddArrayToObject(json, "overTime");
+	const unsigned int first = fed_slot_index(node->updated) + 1;
+	for(unsigned int i = 0; i < OVERTIME_SLOTS; i++)
+	{
+		const struct fed_slot *slot = &node->overTime[(first + i) % OVERTIME_SLOTS];
+		if(slot->timestamp == 0 || slot->timestamp < since)
+			continue;
+
+		const int values[] = { slot->total, slot->blocked, slot->cached, slot->forwarded };
+		cJSON *item = cJSON_CreateIntArray(values, ArraySize(values));
+		cJSON_InsertItemInArray(item, 0, cJSON_CreateNumber(slot->timestamp));
+		cJSON_AddItemToArray(slots, item);
+	}
+
+	// Top lists as [domain, count] or [ip, name, count]
+	cJSON *top = cJSON_AddObjectToObject(json, "top");
+	for(enum top_list_type type = 0; type < TOP_LIST_TYPES; type++)
+	{
+		cJSON *list = cJSON_AddArrayToObject(top, top_list_names[type]);
+		for(unsigned int i = 0; i < node->top_num[type]; i++)
+		{
+			const struct fed_top *entry = &node->top[type][i];
+			cJSON *item = cJSON_CreateArray();
+			if(is_client_list(type))
+				cJSON_AddItemToArray(item, cJSON_CreateString(entry->ip));
+			cJSON_AddItemToArray(item, cJSON_CreateString(entry->name));
+			cJSON_AddItemToArray(item, cJSON_CreateNumber(entry->count));
+			cJSON_AddItemToArray(list, item);
+		}
+	}
+
+	return json;
+}
+
+/**
+ * Get the summary of this node as exported at /api/federation/summary
+ *
+ * @param since Only overTime slots starting at this time are included
+ * @return The summary or NULL if memory allocation failed
+ */
+cJSON *federation_summary_json(const time_t since)
+{
+	struct fed_node *node = calloc(1, sizeof(*node));
+	if(node == NULL)
+		return NULL;
+
+	collect_local(node, true);
+	cJSON *json = node_to_json(node, since);
+	free(node);
+
+	return json;
+}
+
+static int json_int(const cJSON *json, const char *key)
+{
+	const cJSON *item = cJSON_GetObjectItemCaseSensitive(json, key);
+	return cJSON_IsNumber(item) ? item->valueint : 0;
+}
+
+// Copy a string received from a peer, anything too long is truncated
+static void json_str(char *dst, const size_t len, const cJSON *item)
+{
+	const char *str = cJSON_GetStringValue(item);
+	strncpy(dst, str != NULL ? str : "", len - 1);
+	dst[len - 1] = '\0';
+}
+
+/**
+ * Apply a summary received from a peer. The overTime slots contained in the
+ * summary replace the slots with the same timestamp, all other statistics are
+ * replaced entirely.
+ *
+ * @param node The peer, the caller holds fed_lock
+ * @param json The summary
+ * @return Whether the summary could be parsed
+ */
+static bool node_from_json(struct fed_node *node, const cJSON *json)
+{
+	const cJSON *types = cJSON_GetObjectItemCaseSensitive(json, "types");
+	const cJSON *status = cJSON_GetObjectItemCaseSensitive(json, "status");
+	const cJSON *replies = cJSON_GetObjectItemCaseSensitive(json, "replies");
+	const cJSON *slots = cJSON_GetObjectItemCaseSensitive(json, "overTime");
+	const cJSON *top = cJSON_GetObjectItemCaseSensitive(json, "top");
+	if(!cJSON_IsObject(types) || !cJSON_IsObject(status) || !cJSON_IsObject(replies) ||
+	   !cJSON_IsArray(slots) || !cJSON_IsObject(top))
+		return false;
+
+	const cJSON *frequency = cJSON_GetObjectItemCaseSensitive(json, "frequency");
+	node->frequency = cJSON_IsNumber(frequency) ? frequency->valuedouble : 0.0;
+	node->total = json_int(json, "total");
+	node->blocked = json_int(json, "blocked");
+	node->cached = json_int(json, "cached");
+	node->forwarded = json_int(json, "forwarded");
+	node->domains = json_int(json, "domains");
+	node->gravity = json_int(json, "gravity");
+	node->clients_active = json_int(json, "clients_active");
+	node->clients_total = json_int(json, "clients_total");
+
+	// Counters are matched by their names so nodes running different
+	// versions can be combined
+	for(enum query_type type = TYPE_A; type < TYPE_MAX; type++)
+		node->types[type] = json_int(types, type_name(type));
+	for(enum query_status s = 0; s < QUERY_STATUS_MAX; s++)
+		node->status[s] = json_int(status, get_query_status_str(s));
+	for(enum reply_type r = 0; r < QUERY_REPLY_MAX; r++)
+		node->reply[r] = json_int(replies, get_query_reply_str(r));
+
+	const cJSON *slot_item = NULL;
+	cJSON_ArrayForEach(slot_item, slots)
+	{
+		if(cJSON_GetArraySize(slot_item) != 5)
+			continue;
+
+		const time_t timestamp = (time_t)cJSON_GetArrayItem(slot_item, 0)->valuedouble;
+		if(timestamp <= 0)
+			continue;
+		struct fed_slot *slot = &node->overTime[fed_slot_index(timestamp)];
+		slot->timestamp = timestamp;
+		slot->total = cJSON_GetArrayItem(slot_item, 1)->valueint;
+		slot->blocked = cJSON_GetArrayItem(slot_item, 2)->valueint;
+		slot->cached = cJSON_GetArrayItem(slot_item, 3)->valueint;
+		slot->forwarded = cJSON_GetArrayItem(slot_item, 4)->valueint;
+	}
+
+	for(enum top_list_type type = 0; type < TOP_LIST_TYPES; type++)
+	{
+		const cJSON *list = cJSON_GetObjectItemCaseSensitive(top, top_list_names[type]);
+		const int fields = is_client_list(type) ? 3 : 2;
+		unsigned int n = 0;
+		const cJSON *item = NULL;
+		cJSON_ArrayForEach(item, list)
+		{
+			if(n >= FEDERATION_TOP_SIZE)
+				break;
+			if(cJSON_GetArraySize(item) != fields)
+				continue;
+
+			struct fed_top *entry = &node->top[type][n++];
+			if(is_client_list(type))
+				json_str(entry->ip, sizeof(entry->ip), cJSON_GetArrayItem(item, 0));
+			else
+				entry->ip[0] = '\0';
+			json_str(entry->name, sizeof(entry->name), cJSON_GetArrayItem(item, fields - 2));
+			entry->count = cJSON_GetArrayItem(item, fields - 1)->valueint;
+		}
+		node->top_num[type] = n;
+	}
+
+	const cJSON *updated = cJSON_GetObjectItemCaseSensitive(json, "time");
+	node->updated = cJSON_IsNumber(updated) ? (time_t)updated->valuedouble : time(NULL);
+
+	return true;
+}
+
+/**
+ * Split a peer given as "[http://]host[:port][/]" into host and port. IPv6
+ * addresses have to be enclosed in brackets when a port is given.
+ *
+ * @param peer The peer as configured
+ * @param host Buffer receiving the host
+ * @param port Receives the port (80 if none is given)
+ * @return NULL on success, an error message otherwise
+ */
+static const char *parse_peer(const char *peer, char host[128], int *port)
+{
+	if(strncasecmp(peer, "https://", 8) == 0)
+		return "HTTPS is not supported for peers, use http://";
+	if(strncasecmp(peer, "http://", 7) == 0)
+		peer += 7;
+
+	const char *end = NULL;
+	if(peer[0] == '[')
+	{
+		// [IPv6 address]:port
+		end = strchr(++peer, ']');
+		if(end == NULL)
+			return "Missing closing bracket";
+	}
+	else
+	{
+		end = peer + strcspn(peer, ":/");
+		// IPv6 address without port
+		if(*end == ':' && strchr(end + 1, ':') != NULL)
+			end = peer + strcspn(peer, "/");
+	}
+
+	const size_t len = end - peer;
+	if(len == 0 || len >= 128)
+		return "Invalid host";
+	memcpy(host, peer, len);
+	host[len] = '\0';
+
+	if(*end == ']')
+		end++;
+	*port = 80;
+	if(*end == ':')
+	{
+		char *endptr = NULL;
+		const long p = strtol(end + 1, &endptr, 10);
+		if(p < 1 || p > 65535 || (*endptr != '\0' && *endptr != '/'))
+			return "Invalid port";
+		*port = (int)p;
+	}
+
+	return NULL;
+}
+
+// HMAC authenticating a request
+static void request_mac(const char *method, const char *uri, const char *token,
+                        const long long timestamp, const uint8_t nonce[NONCE_SIZE],
+                        uint8_t mac[SHA256_DIGEST_SIZE])
+{
+	char head[64];
+	const int len = snprintf(head, sizeof(head), "%lld\n", timestamp);
+
+	struct hmac_sha256_ctx ctx;
+	hmac_sha256_set_key(&ctx, strlen(token), (const uint8_t*)token);
+	hmac_sha256_update(&ctx, strlen(method), (const uint8_t*)method);
+	hmac_sha256_update(&ctx, 1, (const uint8_t*)"\n");
+	hmac_sha256_update(&ctx, strlen(uri), (const uint8_t*)uri);
+	hmac_sha256_update(&ctx, 1, (const uint8_t*)"\n");
+	hmac_sha256_update(&ctx, len, (const uint8_t*)head);
+	hmac_sha256_update(&ctx, NONCE_SIZE, nonce);
+	hmac_sha256_digest(&ctx, SHA256_DIGEST_SIZE, mac);
+}
+
+/**
+ * Authenticate a request sent to a peer
+ *
+ * @param method The request method
+ * @param uri The requested URI including the query string
+ * @param token The shared secret
+ * @param header Receives the value of the FEDERATION_AUTH_HEADER header as
+ * "<time> <nonce> <HMAC>" (nonce and HMAC in hex representation)
+ * @return Whether the request could be authenticated
+ */
+bool federation_sign_request(const char *method, const char *uri, const char *token,
+                             char header[FEDERATION_AUTH_SIZE])
+{
+	uint8_t nonce[NONCE_SIZE], mac[SHA256_DIGEST_SIZE];
+	if(!get_secure_randomness(nonce, sizeof(nonce)))
+		return false;
+
+	const long long timestamp = time(NULL);
+	request_mac(method, uri, token, timestamp, nonce, mac);
+
+	int len = snprintf(header, FEDERATION_AUTH_SIZE, "%lld ", timestamp);
+	for(unsigned int i = 0; i < NONCE_SIZE; i++)
+		len += sprintf(header + len, "%02x", nonce[i]);
+	header[len++] = ' ';
+	sha256_raw_to_hex(mac, header + len);
+
+	return true;
+}
+
+static bool hex_to_raw(const char *hex, uint8_t *out, const size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		unsigned int byte = 0;
+		if(!isxdigit(hex[2*i]) || !isxdigit(hex[2*i + 1]) ||
+		   sscanf(hex + 2*i, "%2x", &byte) != 1)
+			return false;
+		out[i] = byte;
+	}
+	return true;
+}
+
+/**
+ * Verify the authentication of a request received from a peer. Each request is
+ * accepted only once.
+ *
+ * @param method The request method
+ * @param uri The requested URI including the query string
+ * @param header The value of the FEDERATION_AUTH_HEADER header
+ * @param token The shared secret
+ * @return Whether the request has been sent by a peer knowing the token
+ */
+bool federation_verify_request(const char *method, const char *uri, const char *header,
+                               const char *token)
+{
+	long long timestamp = 0;
+	int pos = 0;
+	uint8_t nonce[NONCE_SIZE], mac[SHA256_DIGEST_SIZE], expected[SHA256_DIGEST_SIZE];
+	if(sscanf(header, "%lld %n", &timestamp, &pos) != 1 ||
+	   strlen(header + pos) != 2*NONCE_SIZE + 1 + 2*SHA256_DIGEST_SIZE ||
+	   header[pos + 2*NONCE_SIZE] != ' ' ||
+	   !hex_to_raw(header + pos, nonce, NONCE_SIZE) ||
+	   !hex_to_raw(header + pos + 2*NONCE_SIZE + 1, mac, SHA256_DIGEST_SIZE))
+		return false;
+
+	const time_t now = time(NULL);
+	if(llabs(now - timestamp) > FEDERATION_MAX_SKEW)
+	{
+		log_debug(DEBUG_API, "Rejecting federation request %s: time differs by %lld s",
+		          uri, (long long)(now - timestamp));
+		return false;
+	}
+
+	request_mac(method, uri, token, timestamp, nonce, expected);
+	if(!memeql_sec(mac, expected, sizeof(mac)))
+		return false;
+
+	// Reject replayed requests. Nonces are remembered until the request
+	// they belong to would be rejected as too old
+	bool okay = true;
+	pthread_mutex_lock(&nonce_lock);
+	for(unsigned int i = 0; i < MAX_NONCES && okay; i++)
+		okay = nonces[i].timestamp + FEDERATION_MAX_SKEW < now ||
+		       memcmp(nonces[i].nonce, nonce, NONCE_SIZE) != 0;
+	if(!okay)
+		log_warn("Rejecting replayed federation request %s", uri);
+	else if(nonces[next_nonce].timestamp + FEDERATION_MAX_SKEW >= now)
+	{
+		log_warn("Rejecting federation request %s: too many requests", uri);
+		okay = false;
+	}
+	else
+	{
+		nonces[next_nonce].timestamp = timestamp;
+		memcpy(nonces[next_nonce].nonce, nonce, NONCE_SIZE);
+		next_nonce = (next_nonce + 1) % MAX_NONCES;
+	}
+	pthread_mutex_unlock(&nonce_lock);
+
+	return okay;
+}
+
+/**
+ * Send a GET request to a peer
+ *
+ * @param peer The peer as configured
+ * @param uri The requested URI including the query string
+ * @param token The shared secret authenticating the request
+ * @param max_len Largest accepted response body [bytes]
+ * @param body Receives the (NUL-terminated) body of a response with status 200
+ * which has to be freed by the caller, NULL for any other status
+ * @param len Receives the length of the body
+ * @param error Buffer receiving an error message if no response was received
+ * @param error_len Size of the error buffer
+ * @return The HTTP status code or -1 on error
+ */
+int federation_http_get(const char *peer, const char *uri, const char *token, const size_t max_len,
+                        char **body, size_t *len, char *error, const size_t error_len)
+{
+	*body = NULL;
+	*len = 0u;
+
+	char host[128];
+	int port = 0;
+	const char *msg = parse_peer(peer, host, &port);
+	if(msg != NULL)
+	{
+		snprintf(error, error_len, "%s", msg);
+		return -1;
+	}
+
+	char auth[FEDERATION_AUTH_SIZE];
+	if(!federation_sign_request("GET", uri, token, auth))
+	{
+		snprintf(error, error_len, "Cannot authenticate request");
+		return -1;
+	}
+
+	struct mg_connection *conn = mg_connect_client(host, port, 0, error, error_len);
+	if(conn == NULL)
+		return -1;
+
+	mg_printf(conn, "GET %s HTTP/1.1\r\n"
+	                "Host: %s\r\n"
+	                FEDERATION_AUTH_HEADER ": %s\r\n"
+	                "Connection: close\r\n\r\n",
+	          uri, host, auth);
+
+	int status = -1;
+	char *buffer = NULL;
+	if(mg_get_response(conn, error, error_len, FEDERATION_TIMEOUT) < 0)
+		goto end_of_http_get;
+
+	const struct mg_response_info *ri = mg_get_response_info(conn);
+	if(ri == NULL)
+	{
+		snprintf(error, error_len, "Invalid response");
+		goto end_of_http_get;
+	}
+	if(ri->status_code != 200)
+	{
+		status = ri->status_code;
+		goto end_of_http_get;
+	}
+
+	// Read the body until the peer closes the connection
+	size_t used = 0, size = 0;
+	while(true)
+	{
+		if(used + 1 >= size)
+		{
+			// One more byte than accepted is read (plus the terminating
+			// NUL) to detect bodies which are too large
+			size = size > 0 ? 2*size : 64*1024;
+			if(size > max_len + 2)
+				size = max_len + 2;
+			char *new_buffer = realloc(buffer, size);
+			if(new_buffer == NULL)
+			{
+				snprintf(error, error_len, "Out of memory");
+				goto end_of_http_get;
+			}
+			buffer = new_buffer;
+		}
+
+		const int n = mg_read(conn, buffer + used, size - used - 1);
+		if(n < 0)
+		{
+			snprintf(error, error_len, "Read error");
+			goto end_of_http_get;
+		}
+		if(n == 0)
+			break;
+		used += n;
+		if(used > max_len)
+		{
+			snprintf(error, error_len, "Response too large");
+			goto end_of_http_get;
+		}
+	}
+	buffer[used] = '\0';
+
+	*body = buffer;
+	*len = used;
+	buffer = NULL;
+	status = 200;
+
+end_of_http_get:
+	mg_close_connection(conn);
+	if(buffer != NULL)
+		free(buffer);
+
+	return status;
+}
+
+/**
+ * Fetch the summary of a peer
+ *
+ * @param peer The peer as configured
+ * @param since Only overTime slots starting at this time are requested
+ * @param token The shared secret authenticating the request
+ * @param error Buffer receiving an error message if the summary could not be
+ * fetched
+ * @param error_len Size of the error buffer
+ * @return The parsed summary or NULL on error
+ */
+static cJSON *fetch_summary(const char *peer, const time_t since, const char *token,
+                            char *error, const size_t error_len)
+{
+	char uri[64];
+	snprintf(uri, sizeof(uri), "/api/federation/summary?since=%lld", (long long)since);
+
+	char *body = NULL;
+	size_t len = 0u;
+	const int status = federation_http_get(peer, uri, token, FEDERATION_MAX_SUMMARY,
+	                                       &body, &len, error, error_len);
+	if(status < 0)
+		return NULL;
+	if(status != 200)
+	{
+		snprintf(error, error_len, "HTTP status %d", status);
+		return NULL;
+	}
+
+	cJSON *json = cJSON_Parse(body);
+	if(json == NULL)
+		snprintf(error, error_len, "Invalid JSON");
+	free(body);
+
+	return json;
+}
+
+// Newest overTime slot received from a peer
+static time_t __attribute__((pure)) newest_slot(const struct fed_node *node)
+{
+	time_t newest = 0;
+	for(unsigned int i = 0; i < OVERTIME_SLOTS; i++)
+		if(node->overTime[i].timestamp > newest)
+			newest = node->overTime[i].timestamp;
+	return newest;
+}
+
+/**
+ * Adopt the configured peers. Statistics of peers which are still configured
+ * are kept, peers no longer configured are forgotten.
+ *
+ * @param names The configured peers
+ * @param num Number of configured peers
+ * @return Whether the peers could be adopted
+ */
+static bool set_peers(char **names, const unsigned int num)
+{
+	// Nothing to do if the peers did not change
+	bool changed = num != num_peers;
+	for(unsigned int i = 0; i < num && !changed; i++)
+		changed = strcmp(names[i], peers[i].name) != 0;
+	if(!changed)
+		return true;
+
+	struct fed_node *new_peers = NULL;
+	if(num > 0 && (new_peers = calloc(num, sizeof(*new_peers))) == NULL)
+		return false;
+
+	pthread_mutex_lock(&fed_lock);
+	for(unsigned int i = 0; i < num; i++)
+	{
+		for(unsigned int j = 0; j < num_peers; j++)
+		{
+			if(strcmp(names[i], peers[j].name) == 0)
+			{
+				memcpy(&new_peers[i], &peers[j], sizeof(new_peers[i]));
+				break;
+			}
+		}
+		strncpy(new_peers[i].name, names[i], sizeof(new_peers[i].name) - 1);
+	}
+
+	if(peers != NULL)
+		free(peers);
+	peers = new_peers;
+	num_peers = num;
+	pthread_mutex_unlock(&fed_lock);
+
+	return true;
+}
+
+// Fetch the summaries of all peers
+static void update_peers(void)
+{
+	// Copy the configuration as it may be replaced at any time
+	cJSON *conf_peers = cJSON_Duplicate(config.webserver.api.federation.peers.v.json, true);
+	char *token = strdup(config.webserver.api.federation.token.v.s);
+	const unsigned int num = cJSON_GetArraySize(conf_peers);
+	char **names = calloc(num > 0 ? num : 1, sizeof(char *));
+	if(conf_peers == NULL || token == NULL || names == NULL)
+		goto end_of_update;
+
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const char *name = cJSON_GetStringValue(cJSON_GetArrayItem(conf_peers, i));
+		names[i] = (char*)(name != NULL ? name : "");
+	}
+	if(!set_peers(names, num))
+		goto end_of_update;
+
+	for(unsigned int i = 0; i < num_peers && !killed; i++)
+	{
+		struct fed_node *node = &peers[i];
+
+		// Request the newest slot again as it may still have changed.
+		// Replies arriving late may even change the slot before
+		pthread_mutex_lock(&fed_lock);
+		const time_t newest = newest_slot(node);
+		pthread_mutex_unlock(&fed_lock);
+		const time_t since = newest > OVERTIME_INTERVAL ? newest - OVERTIME_INTERVAL : 0;
+
+		char error[sizeof(node->error)] = { 0 };
+		cJSON *summary = fetch_summary(node->name, since, token, error, sizeof(error));
+
+		pthread_mutex_lock(&fed_lock);
+		const bool failed_before = node->error[0] != '\0';
+		if(summary != NULL && !node_from_json(node, summary))
+			strcpy(error, "Invalid summary");
+		else if(summary == NULL && error[0] == '\0')
+			strcpy(error, "Unknown error");
+		strcpy(node->error, error);
+		pthread_mutex_unlock(&fed_lock);
+		cJSON_Delete(summary);
+
+		const bool failed = error[0] != '\0';
+
+		// Only log changes of the state of a peer
+		if(failed && !failed_before)
+			log_warn("Cannot get statistics of federation peer %s: %s", node->name, error);
+		else if(!failed && failed_before)
+			log_info("Receiving statistics of federation peer %s again", node->name);
+		else if(!failed)
+		{
+			log_debug(DEBUG_API, "Received statistics of federation peer %s (since %lld)",
+			          node->name, (long long)since);
+		}
+	}
+
+end_of_update:
+	if(names != NULL)
+		free(names);
+	if(token != NULL)
+		free(token);
+	cJSON_Delete(conf_peers);
+}
+
+void *federation_thread(void *val)
+{
+	(void)val;
+	// Set thread name
+	prctl(PR_SET_NAME, thread_names[FEDERATION], 0, 0, 0);
+	set_thread_placement(ROLE_BACKGROUND);
+
+	while(!killed)
+	{
+		update_peers();
+
+		// Publish or receive the gravity image (see gravity-image.c)
+		gravity_image_update();
+
+		const unsigned int interval = config.webserver.api.federation.interval.v.ui;
+		thread_sleepms(FEDERATION, 1000 * (interval > 0 ? interval : 1));
+	}
+
+	pthread_mutex_lock(&fed_lock);
+	if(peers != NULL)
+		free(peers);
+	peers = NULL;
+	num_peers = 0;
+	pthread_mutex_unlock(&fed_lock);
+	gravity_image_free();
+
+	log_info("Terminating federation thread");
+	return NULL;
+}
+
+/**
+ * Sum up the counters of all nodes of the cluster. The top lists and overTime
+ * slots are not filled in.
+ *
+ * @param sum Receives the counters
+ * @param nodes Receives the number of nodes (including this one)
+ * @return Whether the counters could be collected
+ */
+bool federation_cluster_counters(struct fed_node *sum, unsigned int *nodes)
+{
+	collect_local(sum, false);
+	*nodes = 1;
+
+	pthread_mutex_lock(&fed_lock);
+	for(unsigned int i = 0; i < num_peers; i++)
+	{
+		const struct fed_node *peer = &peers[i];
+		// Nothing received from this peer so far
+		if(peer->updated == 0)
+			continue;
+
+		sum->frequency += peer->frequency;
+		sum->total += peer->total;
+		sum->blocked += peer->blocked;
+		sum->cached += peer->cached;
+		sum->forwarded += peer->forwarded;
+		// Domains and clients seen by several nodes are counted several
+		// times, this is an upper bound
+		sum->domains += peer->domains;
+		sum->clients_active += peer->clients_active;
+		sum->clients_total += peer->clients_total;
+		for(unsigned int j = 0; j < TYPE_MAX; j++)
+			sum->types[j] += peer->types[j];
+		for(unsigned int j = 0; j < QUERY_STATUS_MAX; j++)
+			sum->status[j] += peer->status[j];
+		for(unsigned int j = 0; j < QUERY_REPLY_MAX; j++)
+			sum->reply[j] += peer->reply[j];
+		(*nodes)++;
+	}
+	pthread_mutex_unlock(&fed_lock);
+
+	return true;
+}
+
+/**
+ * Sum up the overTime slots of all nodes of the cluster. The slots covered are
+ * the ones of this node.
+ *
+ * @param out Receives the slots in chronological order
+ * @return The number of slots
+ */
+unsigned int federation_cluster_history(struct fed_slot out[OVERTIME_SLOTS])
+{
+	lock_shm_read();
+	const unsigned int num = min(get_max_overtime_slot() + 1, OVERTIME_SLOTS);
+	for(unsigned int slot = 0; slot < num; slot++)
+	{
+		out[slot].timestamp = overTime[slot].timestamp;
+		out[slot].total = overTime[slot].total;
+		out[slot].blocked = overTime[slot].blocked;
+		out[slot].cached = overTime[slot].cached;
+		out[slot].forwarded = overTime[slot].forwarded;
+	}
+	unlock_shm_read();
+
+	pthread_mutex_lock(&fed_lock);
+	for(unsigned int i = 0; i < num_peers; i++)
+	{
+		for(unsigned int slot = 0; slot < num; slot++)
+		{
+			const struct fed_slot *peer_slot = &peers[i].overTime[fed_slot_index(out[slot].timestamp)];
+			if(peer_slot->timestamp != out[slot].timestamp)
+				continue;
+
+			out[slot].total += peer_slot->total;
+			out[slot].blocked += peer_slot->blocked;
+			out[slot].cached += peer_slot->cached;
+			out[slot].forwarded += peer_slot->forwarded;
+		}
+	}
+	pthread_mutex_unlock(&fed_lock);
+
+	return num;
+}
+
+// Domains are identified by their name, clients by their IP address as they
+// may be known under different names on different nodes. The IP address of
+// domains is empty
+static int __attribute__((pure)) cmp_top_key(const void *a, const void *b)
+{
+	const struct fed_top *ta = a, *tb = b;
+	const int cmp = strcmp(ta->ip, tb->ip);
+	return cmp != 0 || ta->ip[0] != '\0' ? cmp : strcmp(ta->name, tb->name);
+}
+
+static int __attribute__((pure)) cmp_top_count(const void *a, const void *b)
+{
+	const struct fed_top *ta = a, *tb = b;
+	if(ta->count != tb->count)
+		return ta->count > tb->count ? -1 : 1;
+	return cmp_top_key(a, b);
+}
+
+/**
+ * Merge one of the top lists of all nodes of the cluster
+ *
+ * @param type The list to merge
+ * @param out Receives the merged list sorted by decreasing count
+ * @param max Maximum number of entries returned
+ * @return The number of entries returned or -1 if memory allocation failed
+ */
+int federation_cluster_top(const enum top_list_type type, struct fed_top *out, const unsigned int max)
+{
+	// Upper limit of the number of entries, peers may change in the
+	// meantime but their number can only be changed by the federation
+	// thread while holding the lock
+	pthread_mutex_lock(&fed_lock);
+	const unsigned int limit = (num_peers + 1) * FEDERATION_TOP_SIZE;
+	pthread_mutex_unlock(&fed_lock);
+
+	struct fed_top *all = calloc(limit, sizeof(*all));
+	if(all == NULL)
+		return -1;
+
+	unsigned int num = collect_top(type, all);
+	pthread_mutex_lock(&fed_lock);
+	for(unsigned int i = 0; i < num_peers; i++)
+	{
+		const unsigned int n = min(peers[i].top_num[type], limit - num);
+		memcpy(&all[num], peers[i].top[type], n * sizeof(*all));
+		num += n;
+	}
+	pthread_mutex_unlock(&fed_lock);
+
+	// Combine the entries of identical domains or clients. The first
+	// non-empty name of a client is used
+	qsort(all, num, sizeof(*all), cmp_top_key);
+	unsigned int merged = 0;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		if(merged > 0 && cmp_top_key(&all[merged - 1], &all[i]) == 0)
+		{
+			all[merged - 1].count += all[i].count;
+			if(all[merged - 1].name[0] == '\0')
+				strcpy(all[merged - 1].name, all[i].name);
+			continue;
+		}
+		if(merged != i)
+			memcpy(&all[merged], &all[i], sizeof(*all));
+		merged++;
+	}
+
+	qsort(all, merged, sizeof(*all), cmp_top_count);
+	const unsigned int n = min(merged, max);
+	memcpy(out, all, n * sizeof(*out));
+	free(all);
+
+	return n;
+}
+
+/**
+ * Get the state of all peers
+ *
+ * @return Array of the peers or NULL if memory allocation failed
+ */
+cJSON *federation_peers_json(void)
+{
+	cJSON *json = cJSON_CreateArray();
+	if(json == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&fed_lock);
+	for(unsigned int i = 0; i < num_peers; i++)
+	{
+		const struct fed_node *peer = &peers[i];
+		cJSON *item = cJSON_CreateObject();
+		cJSON_AddStringToObject(item, "peer", peer->name);
+		cJSON_AddBoolToObject(item, "ok", peer->updated > 0 && peer->error[0] == '\0');
+		if(peer->error[0] != '\0')
+			cJSON_AddStringToObject(item, "error", peer->error);
+		else
+			cJSON_AddNullToObject(item, "error");
+		cJSON_AddNumberToObject(item, "updated", peer->updated);
+		cJSON_AddNumberToObject(item, "total", peer->total);
+		cJSON_AddNumberToObject(item, "blocked", peer->blocked);
+		cJSON_AddItemToArray(json, item);
+	}
+	pthread_mutex_unlock(&fed_lock);
+
+	return json;
+}
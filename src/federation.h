@@ -0,0 +1,104 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Federated statistics header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <stdbool.h>
+// INET6_ADDRSTRLEN
+#include <netinet/in.h>
+// cJSON
+#include "webserver/cJSON/cJSON.h"
+// OVERTIME_SLOTS
+#include "FTL.h"
+// TYPE_MAX, QUERY_STATUS_MAX, QUERY_REPLY_MAX
+#include "enums.h"
+// TOP_LIST_TYPES
+#include "top-lists.h"
+
+// Number of entries of each top list exchanged between nodes
+#define FEDERATION_TOP_SIZE 64u
+// Time to wait for a peer to answer [milliseconds] and upper limit of the size
+// of a summary [bytes]
+#define FEDERATION_TIMEOUT 5000
+#define FEDERATION_MAX_SUMMARY (4u << 20)
+// Header authenticating requests of peers, it carries the time of the request,
+// a random nonce and an HMAC of both and the request keyed with
+// webserver.api.federation.token (which is never sent itself)
+#define FEDERATION_AUTH_HEADER "X-FTL-Federation-Auth"
+#define FEDERATION_AUTH_SIZE 128u
+// Requests of peers are only accepted if their time differs by at most this
+// many seconds from the time of this node [seconds]
+#define FEDERATION_MAX_SKEW 30
+
+struct fed_slot {
+	time_t timestamp;
+	int total;
+	int blocked;
+	int cached;
+	int forwarded;
+};
+
+// Entry of a top list, clients are identified by their IP address, domains by
+// their name
+struct fed_top {
+	int count;
+	char ip[INET6_ADDRSTRLEN];
+	char name[256];
+};
+
+/**
+ * struct fed_node - Statistics of one node of the cluster
+ * @name: The peer as configured (or "localhost" for this node)
+ * @error: Why the statistics of the peer could not be fetched the last time, an
+ * empty string if they could
+ * @updated: When the statistics of this node have last been received
+ * @overTime: The overTime slots of the node indexed by the timestamp of the slot
+ * (see fed_slot_index()), slots are updated individually
+ * @top: The exact head of the node's top lists, sorted by decreasing count
+ *
+ * All other members are the node's counters as shown by /api/stats/summary.
+ */
+struct fed_node {
+	char name[128];
+	char error[128];
+	time_t updated;
+	double frequency;
+	int total;
+	int blocked;
+	int cached;
+	int forwarded;
+	int domains;
+	int gravity;
+	unsigned int clients_active;
+	unsigned int clients_total;
+	int types[TYPE_MAX];
+	int status[QUERY_STATUS_MAX];
+	int reply[QUERY_REPLY_MAX];
+	struct fed_slot overTime[OVERTIME_SLOTS];
+	unsigned int top_num[TOP_LIST_TYPES];
+	struct fed_top top[TOP_LIST_TYPES][FEDERATION_TOP_SIZE];
+};
+
+void *federation_thread(void *val);
+bool federation_sign_request(const char *method, const char *uri, const char *token,
+                             char header[FEDERATION_AUTH_SIZE]);
+bool federation_verify_request(const char *method, const char *uri, const char *header,
+                               const char *token);
+int federation_http_get(const char *peer, const char *uri, const char *token, const size_t max_len,
+                        char **body, size_t *len, char *error, const size_t error_len);
+
+cJSON *federation_summary_json(const time_t since);
+bool federation_cluster_counters(struct fed_node *sum, unsigned int *nodes);
+unsigned int federation_cluster_history(struct fed_slot out[OVERTIME_SLOTS]);
+int federation_cluster_top(const enum top_list_type type, struct fed_top *out, const unsigned int max);
+cJSON *federation_peers_json(void);
+
+#endif //FEDERATION_H
@@ -22,7 +22,7 @@
 #include "datastructure.h"
 // delete_old_queries_from_db()
 #include "database/query-table.h"
-// logg_rate_limit_message()
+// log_resource_shortage()
 #include "database/message-table.h"
 // get_nprocs()
 #include <sys/sysinfo.h>
@@ -34,8 +34,26 @@
 #include "config/inotify.h"
 // lookup_remove()
 #include "lookup-table.h"
+// top_lists_remove_domain()
+#include "top-lists.h"
+// client_sketch_remove()
+#include "client-sketch.h"
 // get_and_clear_event()
 #include "events.h"
+// upstream_health_probe()
+#include "upstream-health.h"
+// flush_querylog()
+#include "querylog.h"
+// pcap_flush()
+#include "pcap-writer.h"
+// expire_sessions()
+#include "api/api.h"
+// flush_config_write()
+#include "config/toml_writer.h"
+// sched_yield()
+#include <sched.h>
+// FTL_PROBE()
+#include "probes.h"
 
 // Resource checking interval
 // default: 300 seconds
@@ -45,6 +63,19 @@
 // default: 10 seconds
 #define CPU_AVERAGE_INTERVAL 10
 
+// Maximum number of queries expired in one slice of an incremental GC run
+// and how often the time spent in the slice is checked
+#define GC_SLICE_QUERIES 65536u
+#define GC_CLOCK_CHECK 256u
+
+// Queries are kept in memory with all their details at least this long [s]
+// when the cold tier is enabled (see misc.hotQueries)
+#define HOT_QUERIES_MIN 3600u
+
+// Number of entries of the table used to find the records of the cold tier
+// belonging to the minute currently being moved
+#define COLD_TABLE_SIZE 4096u
+
 // Global boolean indicating whether garbage collection is requested at the next
 // opportunity
 bool doGC = false;
@@ -61,76 +92,163 @@ static unsigned int GCinterval = 600;
 // seconds on really slow systems
 static unsigned int GCdelay = 60;
 
-// Recycle old clients and domains in our internal data structure
-// This has the side-effect of recycling intermediate domains
-// seen during CNAME inspection, too, as they are never referenced
-// by any query (only head and tail of the CNAME chain are)
-static void recycle(void)
+// Clock used for measuring how long the GC holds the lock [nanoseconds]
+static uint64_t gc_clock(void)
 {
-	// Get current time
-	const double now = double_time();
-	const double twentyfour_hrs_ago = now - 24*3600;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Upper bounds of the pause histogram buckets [microseconds], the last
+// bucket collects everything longer
+static const unsigned int gc_pause_bounds[GC_PAUSE_BUCKETS - 1] = {
+	100, 500, 1000, 5000, 10000, 50000, 100000
+};
+static struct gc_pause_stats gc_pauses = { 0 };
+
+// Account one section during which the GC was holding the lock
+static void account_gc_pause(const uint64_t start)
+{
+	const uint64_t pause = gc_clock() - start;
+	unsigned int bucket = 0;
+	while(bucket < GC_PAUSE_BUCKETS - 1 && pause > 1000u*gc_pause_bounds[bucket])
+		bucket++;
+
+	gc_pauses.count++;
+	gc_pauses.total += pause;
+	gc_pauses.buckets[bucket]++;
+	if(pause > gc_pauses.max)
+		gc_pauses.max = pause;
+}
 
-	// Allocate memory for recycling
-	bool *client_used = calloc(counters->clients, sizeof(bool));
-	bool *domain_used = calloc(counters->domains, sizeof(bool));
-	bool *cache_used = calloc(counters->dns_cache_size, sizeof(bool));
-	if(client_used == NULL || domain_used == NULL || cache_used == NULL)
+// Get a copy of the GC pause statistics, has to be called with the SHM lock
+// held as they are updated by the GC while it is holding the lock
+void get_gc_pause_stats(struct gc_pause_stats *stats, unsigned int bounds[GC_PAUSE_BUCKETS - 1])
+{
+	memcpy(stats, &gc_pauses, sizeof(*stats));
+	memcpy(bounds, gc_pause_bounds, sizeof(gc_pause_bounds));
+}
+
+// Give other processes and threads a chance to obtain the lock once the
+// current slice of an incremental GC run took longer than max_pause. Has to be
+// called with the SHM lock held, it is held again on return
+static void gc_yield(uint64_t *slice_start, const uint64_t max_pause)
+{
+	if(max_pause == 0 || gc_clock() - *slice_start < max_pause)
+		return;
+
+	account_gc_pause(*slice_start);
+	unlock_shm();
+	sched_yield();
+	lock_shm();
+	*slice_start = gc_clock();
+}
+
+// Cross-check the reference counters against a full scan of all queries and
+// cache records. This is only done in debug mode as it is exactly the
+// O(queries) work the counters are meant to avoid
+static void verify_refs(void)
+{
+	unsigned int *client_refs = calloc(counters->clients, sizeof(unsigned int));
+	unsigned int *domain_refs = calloc(counters->domains, sizeof(unsigned int));
+	unsigned int *cache_refs = calloc(counters->dns_cache_size, sizeof(unsigned int));
+	if(client_refs == NULL || domain_refs == NULL || cache_refs == NULL)
 	{
-		log_err("Cannot allocate memory for recycling");
+		log_err("Cannot allocate memory for verifying reference counters");
+		free(client_refs);
+		free(domain_refs);
+		free(cache_refs);
 		return;
 	}
 
-	// Find list of client and domain IDs no active query is referencing anymore
-	// and recycle them
 	for(unsigned int queryID = 0; queryID < counters->queries; queryID++)
 	{
 		const queriesData *query = getQuery(queryID, true);
 		if(query == NULL)
 			continue;
 
-		// Mark client and domain as used
-		client_used[query->clientID] = true;
-		domain_used[query->domainID] = true;
-
-		// Mark CNAME domain as used (if any)
+		client_refs[query->clientID]++;
+		domain_refs[query->domainID]++;
 		if(query->CNAME_domainID > -1)
-			domain_used[query->CNAME_domainID] = true;
-
-		// Mark cache entry as used (if any)
+			domain_refs[query->CNAME_domainID]++;
 		if(query->cacheID > -1)
-			cache_used[query->cacheID] = true;
+			cache_refs[query->cacheID]++;
+	}
+
+	for(unsigned int recordID = 0; recordID < counters->cold_records; recordID++)
+	{
+		const struct cold_query *cold = get_cold_record(recordID);
+		client_refs[cold->clientID]++;
+		domain_refs[cold->domainID]++;
 	}
 
-	// Scan cache records for CNAME domain pointers that prevent domains
-	// from being recyclable
 	for(unsigned int cacheID = 0; cacheID < counters->dns_cache_size; cacheID++)
 	{
 		const DNSCacheData *cache = getDNSCache(cacheID, true);
 		if(cache == NULL)
 			continue;
 
-		// Mark domains as used when this is a CNAME-related cache
-		// record
-		if(cache->blocking_status == QUERY_GRAVITY_CNAME ||
-		   cache->blocking_status == QUERY_REGEX_CNAME ||
-		   cache->blocking_status == QUERY_DENYLIST_CNAME)
-		   domain_used[cache->CNAME_domainID] = true;
+		if(cache->flags.cname_ref)
+			domain_refs[cache->CNAME_domainID]++;
+		if(cache->refs != cache_refs[cacheID])
+			log_warn("Cache record %u has %u references, expected %u",
+			         cacheID, cache->refs, cache_refs[cacheID]);
+	}
+
+	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		const clientsData *client = getClient(clientID, true);
+		if(client != NULL && client->refs != client_refs[clientID])
+			log_warn("Client %u has %u references, expected %u",
+			         clientID, client->refs, client_refs[clientID]);
 	}
 
+	for(unsigned int domainID = 0; domainID < counters->domains; domainID++)
+	{
+		const domainsData *domain = getDomain(domainID, true);
+		if(domain != NULL && domain->refs != domain_refs[domainID])
+			log_warn("Domain %u has %u references, expected %u",
+			         domainID, domain->refs, domain_refs[domainID]);
+	}
+
+	free(client_refs);
+	free(domain_refs);
+	free(cache_refs);
+}
+
+// Recycle old clients and domains in our internal data structure
+// This has the side-effect of recycling intermediate domains
+// seen during CNAME inspection, too, as they are never referenced
+// by any query (only head and tail of the CNAME chain are)
+//
+// Queries and CNAME-blocked cache records keep reference counters on the
+// objects they point to (see ref_query()), so we only need to walk the
+// (comparably small) object arrays here instead of all queries in memory.
+// Incremental GC runs may release the lock in between (see gc_yield()), the
+// references of every object are checked right before recycling it
+static void recycle(const uint64_t max_pause, uint64_t *slice_start)
+{
+	// Get current time
+	const double now = double_time();
+	const double twentyfour_hrs_ago = now - 24*3600;
+
+	if(config.debug.gc.v.b)
+		verify_refs();
+
 	// Recycle clients
 	unsigned int clients_recycled = 0;
 	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
 	{
-		if(client_used[clientID])
-			continue;
+		if(clientID % GC_CLOCK_CHECK == GC_CLOCK_CHECK - 1)
+			gc_yield(slice_start, max_pause);
 
 		clientsData *client = getClient(clientID, true);
-		if(client == NULL)
+		if(client == NULL || client->refs > 0)
 			continue;
 
-		// Never recycle aliasclients (they are not counted above but
-		// are only indirectly referenced by other clients)
+		// Never recycle aliasclients (they are not referenced by
+		// queries but only indirectly by other clients)
 		if(client->flags.aliasclient)
 			continue;
 
@@ -143,13 +261,15 @@ static void recycle(void)
 			          getstr(client->ippos), clientID, timestring);
 		}
 
-		// Remove client from lookup table
+		// Remove client from lookup table and top lists
 		lookup_remove(CLIENTS_LOOKUP, clientID, client->hash);
+		top_lists_remove_client(client);
 
 		// Add ID of recycled client to recycle table
 		set_next_recycled_ID(CLIENTS, clientID);
 
 		// Wipe client's memory
+		set_clientcount(client, 0);
 		memset(client, 0, sizeof(clientsData));
 
 		clients_recycled++;
@@ -159,11 +279,11 @@ static void recycle(void)
 	unsigned int domains_recycled = 0;
 	for(unsigned int domainID = 0; domainID < counters->domains; domainID++)
 	{
-		if(domain_used[domainID])
-			continue;
+		if(domainID % GC_CLOCK_CHECK == GC_CLOCK_CHECK - 1)
+			gc_yield(slice_start, max_pause);
 
 		domainsData *domain = getDomain(domainID, true);
-		if(domain == NULL)
+		if(domain == NULL || domain->refs > 0)
 			continue;
 
 		// Only recycle domains when their last query was more than 24
@@ -179,11 +299,12 @@ static void recycle(void)
 			get_timestr(timestring, domain->lastQuery, true, false);
 
 			log_debug(DEBUG_GC, "Recycling domain %s (ID %u, last query was %s)",
-			          getstr(domain->domainpos), domainID, timestring);
+			          getDomainName(domain), domainID, timestring);
 		}
 
-		// Remove domain from lookup table
+		// Remove domain from lookup table and top lists
 		lookup_remove(DOMAINS_LOOKUP, domainID, domain->hash);
+		top_lists_remove_domain(domainID, domain);
 
 		// Add ID of recycled domain to recycle table
 		set_next_recycled_ID(DOMAINS, domainID);
@@ -198,15 +319,19 @@ static void recycle(void)
 	unsigned int cache_recycled = 0;
 	for(unsigned int cacheID = 0; cacheID < counters->dns_cache_size; cacheID++)
 	{
-		if(cache_used[cacheID])
-			continue;
+		if(cacheID % GC_CLOCK_CHECK == GC_CLOCK_CHECK - 1)
+			gc_yield(slice_start, max_pause);
 
 		DNSCacheData *cache = getDNSCache(cacheID, true);
-		if(cache == NULL)
+		if(cache == NULL || cache->refs > 0)
 			continue;
 
 		log_debug(DEBUG_GC, "Recycling cache entry with ID %u", cacheID);
 
+		// Release the CNAME domain of this cache entry (if any), it
+		// becomes recyclable during the next run
+		unref_cache_CNAME(cache);
+
 		// Remove cache entry from lookup table
 		lookup_remove(DNS_CACHE_LOOKUP, cacheID, cache->hash);
 
@@ -219,11 +344,6 @@ static void recycle(void)
 		cache_recycled++;
 	}
 
-	// Free memory
-	free(client_used);
-	free(domain_used);
-	free(cache_used);
-
 	// Scan number of recycled clients and domains if in debug mode
 	if(config.debug.gc.v.b)
 	{
@@ -284,48 +404,6 @@ unsigned int __attribute__((pure)) get_max_overtime_slot(void)
 	return min(config.webserver.api.maxHistory.v.ui, MAXLOGAGE * 3600) / OVERTIME_INTERVAL;
 }
 
-// Subtract rate-limitation count from individual client counters
-// As long as client->rate_limit is still larger than the allowed
-// maximum count, the rate-limitation will just continue
-static void reset_rate_limiting(void)
-{
-	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
-	{
-		clientsData *client = getClient(clientID, true);
-		if(!client)
-			continue;
-
-		// Check if we are currently rate-limiting this client
-		if(client->flags.rate_limited)
-		{
-			const char *clientIP = getstr(client->ippos);
-
-			// Check if we want to continue rate limiting
-			if(client->rate_limit > config.dns.rateLimit.count.v.ui)
-			{
-				log_info("Still rate-limiting %s as it made additional %u queries", clientIP, client->rate_limit);
-			}
-			// or if rate-limiting ends for this client now
-			else
-			{
-				log_info("Ending rate-limitation of %s", clientIP);
-				         client->flags.rate_limited = false;
-			}
-		}
-
-		// Reset counter
-		client->rate_limit = 0;
-	}
-}
-
-static time_t lastRateLimitCleaner = 0;
-// Returns how many more seconds until the current rate-limiting interval is over
-int get_rate_limit_turnaround(const unsigned int rate_limit_count)
-{
-	const unsigned int how_often = rate_limit_count/config.dns.rateLimit.count.v.ui;
-	return (int)((long)config.dns.rateLimit.interval.v.ui * how_often) - (time(NULL) - lastRateLimitCleaner);
-}
-
 static int check_space(const char *file, unsigned int LastUsage)
 {
 	if(config.misc.check.disk.v.ui == 0)
@@ -365,6 +443,282 @@ static void check_load(void)
 		log_resource_shortage(load[2], nprocs, -1, -1, NULL, NULL);
 }
 
+// Remove a query from all counters it contributed to. The query itself is
+// dropped from memory afterwards by expire_queries()
+static void expire_query(queriesData *query)
+{
+	// Check if this query is blocked
+	const bool blocked = is_blocked(query->status);
+
+	// Adjust client counter (total and overTime)
+	const int timeidx = getOverTimeID(get_query_timestamp(query));
+	clientsData *client = getClient(query->clientID, true);
+	if(client != NULL)
+		change_clientcount(client, -1, blocked ? -1 : 0, timeidx, -1);
+	client_sketch_remove(query->clientID, query->domainID,
+	                     blocked ? CLIENT_SKETCH_BLOCKED : CLIENT_SKETCH_PERMITTED);
+	// The blocked, cached and forwarded counts of the finer overTime tiers
+	// are removed when the status is reset below
+	change_overTime_tiers(get_query_timestamp(query), -1, 0, 0, 0);
+
+	// Adjust domain counter (no overTime information). The cache hits and
+	// misses are removed when the status is reset below
+	domainsData *domain = getDomain(query->domainID, true);
+	if(domain != NULL)
+	{
+		domain->count--;
+		if(blocked)
+			domain->blockedcount--;
+		top_lists_domain_changed(query->domainID, domain);
+	}
+
+	// Adjust upstream counter (no overTime information)
+	if(query->upstreamID > -1)
+	{
+		upstreamsData *upstream = getUpstream(query->upstreamID, true);
+		if(upstream != NULL)
+			// Adjust upstream counter
+			upstream->count--;
+	}
+
+	// Update reply counters
+	change_reply_count(query->reply, -1);
+	log_debug(DEBUG_STATUS, "reply type %u removed (GC), ID = %d, new count = %u", query->reply, query->id, get_reply_count(query->reply));
+
+	// Update type counters
+	change_querytype_count(query->type, -1);
+	log_debug(DEBUG_STATUS, "query type %u removed (GC), ID = %d, new count = %u", query->type, query->id, get_querytype_count(query->type));
+
+	// Subtract UNKNOWN from the counters before
+	// setting the status if different.
+	// Minus one here and plus one below = net zero
+	change_status_count(QUERY_UNKNOWN, -1);
+	log_debug(DEBUG_STATUS, "status %d removed (GC), ID = %d, new count = %u", QUERY_UNKNOWN, query->id, get_status_count(QUERY_UNKNOWN));
+
+	// Set query again to UNKNOWN to reset the counters
+	query_set_status(query, QUERY_UNKNOWN);
+}
+
+// Expire the records of the cold tier older than mintime. Their queries are
+// removed from the counters the same way as the individual queries, using a
+// temporary query carrying the fields kept in the record. Has to be called
+// with the SHM lock held, it is held again on return
+static unsigned int expire_cold(const time_t mintime, const uint64_t max_pause, uint64_t *slice_start)
+{
+	unsigned int removed = 0, expired = 0;
+	const struct cold_query *cold = NULL;
+	while((cold = get_cold_record(removed)) != NULL)
+	{
+		// Test if this minute is too new
+		if((time_t)cold->timestamp + 60 > mintime)
+			break;
+
+		queriesData query = { 0 };
+		query.magic = MAGICBYTE;
+		query.type = cold->type;
+		query.reply = cold->reply;
+		query.domainID = cold->domainID;
+		query.clientID = cold->clientID;
+		query.upstreamID = cold->upstreamID;
+		query.cacheID = -1;
+		query.CNAME_domainID = -1;
+		set_query_timestamp(&query, cold->timestamp);
+		for(unsigned int i = 0; i < cold->count; i++)
+		{
+			query.status = cold->status;
+			expire_query(&query);
+		}
+		expired += cold->count;
+		removed++;
+
+		// Drop the expired records before other processes and threads
+		// may obtain the lock
+		if(max_pause > 0 && gc_clock() - *slice_start >= max_pause)
+		{
+			expire_cold_records(removed);
+			removed = 0;
+			gc_yield(slice_start, max_pause);
+		}
+	}
+
+	expire_cold_records(removed);
+	return expired;
+}
+
+// Hash of the fields of a query kept in the cold tier
+static unsigned int __attribute__((pure)) cold_hash(const queriesData *query)
+{
+	uint32_t hash = query->domainID * 2654435761u;
+	hash ^= query->clientID * 2246822519u;
+	hash ^= (uint32_t)(query->upstreamID + 1) * 3266489917u;
+	hash ^= ((uint32_t)query->status | (uint32_t)query->type << 8 | (uint32_t)query->reply << 16) * 668265263u;
+	return (hash ^ (hash >> 15)) % COLD_TABLE_SIZE;
+}
+
+static bool __attribute__((pure)) cold_matches(const struct cold_query *cold, const uint32_t minute,
+                                               const queriesData *query)
+{
+	return cold->timestamp == minute && cold->domainID == query->domainID &&
+	       cold->clientID == query->clientID && cold->upstreamID == query->upstreamID &&
+	       cold->status == query->status && cold->type == query->type && cold->reply == query->reply;
+}
+
+/**
+ * Move the queries older than misc.hotQueries seconds into the cold tier. This
+ * only happens once they have been stored in the in-memory database as
+ * /api/queries lists them from there afterwards. Whole minutes are moved,
+ * queries of the same minute with the same domain, client, upstream, status,
+ * type, and reply share one record. Has to be called with the SHM lock held.
+ *
+ * @param now The current time
+ * @return The number of queries moved
+ */
+unsigned int demote_queries(const time_t now)
+{
+	if(config.misc.hotQueries.v.ui == 0)
+		return 0;
+
+	time_t cutoff = now - max(config.misc.hotQueries.v.ui, HOT_QUERIES_MIN);
+	cutoff -= cutoff % 60;
+
+	// IDs (+1) of the records of the current minute, records are only added
+	// while at most half of the table is used to keep the probing short
+	static unsigned int table[COLD_TABLE_SIZE];
+	unsigned int used = 0;
+	uint32_t minute = 0;
+
+	unsigned int moved = 0;
+	for(; moved < counters->queries; moved++)
+	{
+		const queriesData *query = getQuery(moved, true);
+		if(query == NULL)
+			break;
+
+		const double timestamp = get_query_timestamp(query);
+		if(timestamp >= cutoff || !query->flags.database.stored || query->flags.database.changed)
+			break;
+
+		if((uint32_t)timestamp - (uint32_t)timestamp % 60 != minute)
+		{
+			// Start a new minute, the previous GC run may already have
+			// moved queries of it
+			minute = (uint32_t)timestamp - (uint32_t)timestamp % 60;
+			memset(table, 0, sizeof(table));
+			used = 0;
+			for(unsigned int recordID = counters->cold_records; recordID-- > 0 && used < COLD_TABLE_SIZE/2;)
+			{
+				const struct cold_query *cold = get_cold_record(recordID);
+				if(cold->timestamp != minute)
+					break;
+
+				queriesData key = { 0 };
+				key.domainID = cold->domainID;
+				key.clientID = cold->clientID;
+				key.upstreamID = cold->upstreamID;
+				key.status = cold->status;
+				key.type = cold->type;
+				key.reply = cold->reply;
+				unsigned int i = cold_hash(&key);
+				while(table[i] != 0)
+					i = (i + 1) % COLD_TABLE_SIZE;
+				table[i] = recordID + 1;
+				used++;
+			}
+		}
+
+		// Find the record of this minute counting queries like this one
+		unsigned int i = cold_hash(query);
+		struct cold_query *cold = NULL;
+		for(; table[i] != 0; i = (i + 1) % COLD_TABLE_SIZE)
+		{
+			cold = get_cold_record(table[i] - 1);
+			if(cold_matches(cold, minute, query))
+				break;
+			cold = NULL;
+		}
+
+		if(cold == NULL)
+		{
+			cold = add_cold_record();
+			cold->timestamp = minute;
+			cold->domainID = query->domainID;
+			cold->clientID = query->clientID;
+			cold->upstreamID = query->upstreamID;
+			cold->status = query->status;
+			cold->type = query->type;
+			cold->reply = query->reply;
+			ref_cold_query(cold, +1);
+			if(used < COLD_TABLE_SIZE/2)
+			{
+				table[i] = counters->cold_records;
+				used++;
+			}
+		}
+
+		cold->count++;
+		counters->queries_cold++;
+	}
+
+	// Drop the moved queries from the ring, this releases their references
+	expire_queries(moved);
+
+	return moved;
+}
+
+// Expire queries older than mintime in slices. Each slice processes at most
+// GC_SLICE_QUERIES queries and ends early once it held the lock for longer
+// than max_pause nanoseconds. The expired queries of a slice are dropped from
+// the ring before the lock is released so the data is consistent between
+// slices and the next slice can simply continue with the (new) oldest query.
+// Has to be called with the SHM lock held, it is held again on return.
+static unsigned int expire_sliced(const time_t mintime, const uint64_t max_pause, uint64_t *slice_start)
+{
+	unsigned int removed = 0, slices = 1;
+	bool done = false;
+	while(!done)
+	{
+		unsigned int i = 0, expired = 0;
+		for(; i < counters->queries && i < GC_SLICE_QUERIES; i++)
+		{
+			queriesData *query = getQuery(i, true);
+			if(query == NULL)
+				continue;
+
+			// Test if this query is too new
+			if(get_query_timestamp(query) > mintime)
+			{
+				done = true;
+				break;
+			}
+
+			expire_query(query);
+			expired++;
+
+			// Check the clock only every now and then
+			if(expired % GC_CLOCK_CHECK == 0 && gc_clock() - *slice_start >= max_pause)
+				break;
+		}
+
+		expire_queries(expired);
+		removed += expired;
+
+		// Done when there is nothing left to expire
+		if(done || expired == 0 || counters->queries == 0)
+			break;
+
+		// Let waiting DNS and API threads continue before the next slice
+		account_gc_pause(*slice_start);
+		unlock_shm();
+		sched_yield();
+		lock_shm();
+		*slice_start = gc_clock();
+		slices++;
+	}
+
+	log_debug(DEBUG_GC, "GC expired %u queries in %u slice%s", removed, slices, slices == 1 ? "" : "s");
+	return removed;
+}
+
 void runGC(const time_t now, time_t *lastGCrun, const bool flush)
 {
 	doGC = false;
@@ -372,10 +726,20 @@ void runGC(const time_t now, time_t *lastGCrun, const bool flush)
 	if(lastGCrun != NULL)
 		*lastGCrun = now + GCdelay - (now + GCdelay)%GCinterval;
 
+	// Maximum time the lock may be held at once when expiring queries [ns],
+	// zero expires all queries in a single step. A flush always runs in a
+	// single step as the caller is already holding the lock
+	const uint64_t max_pause = flush ? 0u : 1000u*(uint64_t)config.misc.gcPause.v.ui;
+
 	// Lock FTL's data structure, since it is likely that it will be changed here
 	// Requests should not be processed/answered when data is about to change
+	uint64_t slice_start = gc_clock();
 	if(!flush)
+	{
 		lock_shm();
+		slice_start = gc_clock();
+		gc_pauses.runs++;
+	}
 
 	// Get minimum timestamp to keep
 	time_t mintime = now;
@@ -389,6 +753,10 @@ void runGC(const time_t now, time_t *lastGCrun, const bool flush)
 		mintime -= mintime % GCinterval;
 	}
 
+	const uint64_t gc_begin = gc_clock();
+	uint64_t phase_start = gc_begin;
+	FTL_PROBE(gc_start, mintime, counters->queries);
+
 	if(config.debug.gc.v.b)
 	{
 		timer_start(GC_TIMER);
@@ -398,131 +766,83 @@ void runGC(const time_t now, time_t *lastGCrun, const bool flush)
 		          timestring, (unsigned long)mintime, counters->queries);
 	}
 
-	// Process all queries
+	// Process all queries, starting with the ones in the cold tier
+	const unsigned int cold_removed = expire_cold(mintime, max_pause, &slice_start);
 	unsigned int removed = 0;
-	for(unsigned int i = 0; i < counters->queries; i++)
+	if(max_pause > 0)
+		removed = expire_sliced(mintime, max_pause, &slice_start);
+	else
 	{
-		queriesData *query = getQuery(i, true);
-		if(query == NULL)
-			continue;
-
-		// Test if this query is too new
-		if(query->timestamp > mintime)
-			break;
-
-		// Check if this query is blocked
-		const bool blocked = is_blocked(query->status);
-
-		// Adjust client counter (total and overTime)
-		const int timeidx = getOverTimeID(query->timestamp);
-		clientsData *client = getClient(query->clientID, true);
-		if(client != NULL)
-			change_clientcount(client, -1, blocked ? -1 : 0, timeidx, -1);
-
-		// Adjust domain counter (no overTime information)
-		domainsData *domain = getDomain(query->domainID, true);
-		if(domain != NULL)
+		for(unsigned int i = 0; i < counters->queries; i++)
 		{
-			domain->count--;
-			if(blocked)
-				domain->blockedcount--;
-		}
-
-		// Adjust upstream counter (no overTime information)
-		if(query->upstreamID > -1)
-		{
-			upstreamsData *upstream = getUpstream(query->upstreamID, true);
-			if(upstream != NULL)
-				// Adjust upstream counter
-				upstream->count--;
-		}
-
-		// Update reply counters
-		counters->reply[query->reply]--;
-		log_debug(DEBUG_STATUS, "reply type %u removed (GC), ID = %d, new count = %u", query->reply, query->id, counters->reply[query->reply]);
-
-		// Update type counters
-		counters->querytype[query->type]--;
-		log_debug(DEBUG_STATUS, "query type %u removed (GC), ID = %d, new count = %u", query->type, query->id, counters->querytype[query->type]);
+			queriesData *query = getQuery(i, true);
+			if(query == NULL)
+				continue;
 
-		// Subtract UNKNOWN from the counters before
-		// setting the status if different.
-		// Minus one here and plus one below = net zero
-		counters->status[QUERY_UNKNOWN]--;
-		log_debug(DEBUG_STATUS, "status %d removed (GC), ID = %d, new count = %u", QUERY_UNKNOWN, query->id, counters->status[QUERY_UNKNOWN]);
+			// Test if this query is too new
+			if(get_query_timestamp(query) > mintime)
+				break;
 
-		// Set query again to UNKNOWN to reset the counters
-		query_set_status(query, QUERY_UNKNOWN);
+			expire_query(query);
 
-		// Count removed queries
-		removed++;
+			// Count removed queries
+			removed++;
+		}
 	}
+	FTL_PROBE(gc_phase, "expire", gc_clock() - phase_start);
 
 	// Remove query from queries table (temp), we can release the lock for this
 	// action to prevent blocking the DNS service too long
 	if(!flush)
+	{
+		account_gc_pause(slice_start);
 		unlock_shm();
+	}
+	phase_start = gc_clock();
 	delete_old_queries_from_db(true, mintime);
+	FTL_PROBE(gc_phase, "database", gc_clock() - phase_start);
 	if(!flush)
-		lock_shm();
-
-	// Only perform memory operations when we actually removed queries
-	if(removed > 0)
 	{
-		// Move memory forward to keep only what we want
-		// Note: for overlapping memory blocks, memmove() is a safer approach than memcpy()
-		//
-		//  ┌──────────────────────┐
-		//  │ Example: removed = 5 │▒
-		//  │                      │▒
-		//  │ query with ID = 6    │▒
-		//  │ is moved to ID = 0,  │▒
-		//  │ 7 ─> 1, 8 ─> 2, etc. │▒
-		//  │                      │▒
-		//  │ ID:         111111   │▒
-		//  │   0123456789012345   │▒
-		//  │                      │▒
-		//  │   ......QQQQ------   │▒
-		//  │         vvvv         │▒
-		//  │   ┌─────┘│││         │▒
-		//  │   │┌─────┘││         │▒
-		//  │   ││┌─────┘│         │▒
-		//  │   │││┌─────┘         │▒
-		//  │   vvvv               │▒
-		//  │   QQQQ------------   │▒
-		//  └──────────────────────┘▒
-		//    ▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒▒
-		//
-		// Legend: . = removed queries, Q = valid queries, - = free space
-		//
-		// We move the memory block starting at the first valid query (index 5) to the
-		// beginning of the memory block, overwriting the invalid queries (index 0-4).
-		// The remaining memory (index 5-15) is then zeroed out by memset() below.
-		queriesData *dest = getQuery(0, true);
-		queriesData *src = getQuery(removed, true);
-		if(dest != NULL && src != NULL)
-			memmove(dest, src, (counters->queries - removed)*sizeof(queriesData));
-
-		// Update queries counter
-		counters->queries -= removed;
-
-		// Ensure remaining memory is zeroed out (marked as "F" in the above example)
-		queriesData *tail = getQuery(counters->queries, true);
-		if(tail)
-			memset(tail, 0, (counters->queries_MAX - counters->queries)*sizeof(queriesData));
+		lock_shm();
+		slice_start = gc_clock();
 	}
 
+	// Drop the removed queries from the ring of queries. This only advances
+	// the position of the oldest query, the remaining queries stay where
+	// they are. Sliced expiry has already done this for each slice
+	if(max_pause == 0)
+		expire_queries(removed);
+
+	// Move queries out of the hot window into the cold tier
+	phase_start = gc_clock();
+	const unsigned int demoted = flush ? 0u : demote_queries(now);
+	FTL_PROBE(gc_phase, "demote", gc_clock() - phase_start);
+
 	// Recycle old clients and domains
-	recycle();
+	phase_start = gc_clock();
+	recycle(max_pause, &slice_start);
+	FTL_PROBE(gc_phase, "recycle", gc_clock() - phase_start);
+
+	// Drop strings no longer referenced by any of them
+	phase_start = gc_clock();
+	compact_strings(flush);
+	FTL_PROBE(gc_phase, "strings", gc_clock() - phase_start);
 
 	// Determine if overTime memory needs to get moved
+	phase_start = gc_clock();
 	moveOverTimeMemory(mintime);
+	FTL_PROBE(gc_phase, "overtime", gc_clock() - phase_start);
+	FTL_PROBE(gc_done, removed + cold_removed, gc_clock() - gc_begin);
 
-	log_debug(DEBUG_GC, "GC removed %u queries (took %.2f ms)", removed, timer_elapsed_msec(GC_TIMER));
+	log_debug(DEBUG_GC, "GC removed %u queries and moved %u queries into the cold tier (took %.2f ms)",
+	          removed + cold_removed, demoted, timer_elapsed_msec(GC_TIMER));
 
 	// Release thread lock
 	if(!flush)
+	{
+		account_gc_pause(slice_start);
 		unlock_shm();
+	}
 
 	// After storing data in the database for the next time,
 	// we should scan for old entries, which will then be deleted
@@ -579,10 +899,10 @@ void *GC_thread(void *val)
 
 	// Set thread name
 	prctl(PR_SET_NAME, thread_names[GC], 0, 0, 0);
+	set_thread_placement(ROLE_BACKGROUND);
 
 	// Remember when we last ran the actions
 	time_t lastGCrun = time(NULL) - time(NULL)%GCinterval;
-	lastRateLimitCleaner = time(NULL);
 	time_t lastResourceCheck = 0;
 	time_t lastCPUcheck = 0;
 
@@ -604,15 +924,6 @@ void *GC_thread(void *val)
 	{
 		const time_t now = time(NULL);
 		const double time_start = double_time();
-		if(config.dns.rateLimit.interval.v.ui > 0 &&
-		   (unsigned int)(now - lastRateLimitCleaner) >= config.dns.rateLimit.interval.v.ui)
-		{
-			lastRateLimitCleaner = now;
-			lock_shm();
-			reset_rate_limiting();
-			unlock_shm();
-		}
-
 		// Intermediate cancellation-point
 		if(killed)
 			break;
@@ -664,11 +975,35 @@ void *GC_thread(void *val)
 		if(killed)
 			break;
 
-		// Reset the queries-per-second counter
+		// Reset the queries-per-second counter and collect log lines
+		// of TCP workers when the main process is idle
 		lock_shm();
 		reset_qps(now);
+		drain_log_rings();
 		unlock_shm();
 
+		// Intermediate cancellation-point
+		if(killed)
+			break;
+
+		// Probe upstreams which stopped answering queries
+		upstream_health_probe();
+
+		// Write the binary query log and buffered packets of the capture
+		flush_querylog();
+		pcap_flush(false);
+
+		// Free expired API sessions
+		expire_sessions(now);
+
+		// Free replaced configurations after their grace period
+		reclaim_configs(now);
+
+		// Write pihole.toml and restart after changes made through
+		// the API have settled
+		flush_config_write(false);
+		check_scheduled_restart();
+
 		// Intermediate cancellation-point
 		if(killed)
 			break;
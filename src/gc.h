@@ -11,13 +11,27 @@
 #define GC_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
+// Number of buckets of the GC pause histogram
+#define GC_PAUSE_BUCKETS 8
+
+// Time the GC was holding the lock (times in nanoseconds)
+struct gc_pause_stats {
+	uint64_t runs;
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t buckets[GC_PAUSE_BUCKETS];
+};
+
 void *GC_thread(void *val);
 void runGC(const time_t now, time_t *lastGCrun, const bool flush);
 unsigned int get_max_overtime_slot(void) __attribute__((pure));
-int get_rate_limit_turnaround(const unsigned int rate_limit_count);
 unsigned int set_gc_interval(void);
+unsigned int demote_queries(const time_t now);
+void get_gc_pause_stats(struct gc_pause_stats *stats, unsigned int bounds[GC_PAUSE_BUCKETS - 1]);
 
 // Defined in src/dnsmasq_interface.c
 void set_dnsmasq_debug(const bool debug, const pid_t pid);
@@ -0,0 +1,221 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-stage query latency tracing
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file latency.c
+* @brief Measures the time queries spend in the stages of the DNS pipeline.
+*
+* When misc.traceLatency is enabled, the hooks called by dnsmasq record the
+* time a query passed each event of its processing in a trace slot chosen by
+* the query's dnsmasq ID. The time since the previous event is sorted into the
+* log-linear histogram of the stage (the same one used for the API endpoint
+* statistics). Traces are ended once the answer has been sent or when their
+* slot is taken by another query.
+*
+* Traces are owned by the process handling the query (the main process for UDP
+* and the TCP worker for TCP queries). The process ID is part of the key as
+* TCP workers forked at the same time use the same dnsmasq IDs.
+*/
+
+#include "FTL.h"
+#include "latency.h"
+// config
+#include "config/config.h"
+// double_time()
+#include "log.h"
+
+latencyData *latency = NULL;
+
+// PID of this process, updated by latency_trace_forked() in TCP workers
+static pid_t trace_pid = 0;
+
+static const char *const stage_names[LATENCY_STAGES] = {
+	[LATENCY_TOTAL] = "total",
+	[LATENCY_INTERN] = "intern",
+	[LATENCY_BLOCKING] = "blocking",
+	[LATENCY_FORWARD] = "forward",
+	[LATENCY_REPLY] = "reply",
+	[LATENCY_ANSWER] = "answer"
+};
+
+const char *latency_stage_name(const enum latency_stage stage)
+{
+	return stage < LATENCY_STAGES ? stage_names[stage] : "unknown";
+}
+
+// Monotonic clock used for tracing [microseconds]
+static uint64_t latency_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static struct latency_trace *find_trace(const int id)
+{
+	if(latency == NULL)
+		return NULL;
+
+	struct latency_trace *trace = &latency->trace[(unsigned int)id % LATENCY_TRACE_SLOTS];
+	if(trace->id != id || trace->pid != trace_pid)
+		return NULL;
+
+	return trace;
+}
+
+// Account the duration of a stage and possibly keep the query as example
+static void latency_record(const enum latency_stage stage, const uint64_t usec,
+                           const struct latency_trace *trace)
+{
+	struct latency_stage_data *data = &latency->stage[stage];
+	atomic_fetch_add_explicit(&data->buckets[api_histogram_bucket(usec)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&data->sum, usec, memory_order_relaxed);
+	const uint64_t count = atomic_fetch_add_explicit(&data->count, 1, memory_order_relaxed);
+
+	if(count % LATENCY_SAMPLE_RATE != 0)
+		return;
+
+	// Readers may see a partially written example, they are only meant to
+	// point at queries worth a closer look
+	const unsigned int idx = atomic_fetch_add_explicit(&data->next_exemplar, 1, memory_order_relaxed);
+	struct latency_exemplar *exemplar = &data->exemplar[idx % LATENCY_EXEMPLARS];
+	exemplar->id = trace->id;
+	exemplar->domainID = trace->domainID;
+	exemplar->clientID = trace->clientID;
+	exemplar->checks = trace->checks;
+	exemplar->usec = usec < UINT32_MAX ? usec : UINT32_MAX;
+	exemplar->timestamp = double_time();
+}
+
+/**
+ * Get the time a query has been received if tracing is enabled
+ *
+ * @return Current time or 0 if queries are not traced
+ */
+uint64_t latency_trace_start(void)
+{
+	if(!config.misc.traceLatency.v.b || latency == NULL)
+		return 0;
+
+	return latency_clock();
+}
+
+/**
+ * Start tracing a query once its client and domain are known
+ *
+ * @param id The dnsmasq ID of the query
+ * @param domainID The ID of the queried domain
+ * @param clientID The ID of the requesting client
+ * @param start Time the query has been received (from latency_trace_start())
+ */
+void latency_trace_begin(const int id, const int domainID, const int clientID, const uint64_t start)
+{
+	if(start == 0 || latency == NULL)
+		return;
+
+	if(trace_pid == 0)
+		trace_pid = getpid();
+
+	struct latency_trace *trace = &latency->trace[(unsigned int)id % LATENCY_TRACE_SLOTS];
+	memset(trace, 0, sizeof(*trace));
+	trace->id = id;
+	trace->pid = trace_pid;
+	trace->domainID = domainID;
+	trace->clientID = clientID;
+	trace->mark[LATENCY_TOTAL] = start;
+
+	latency_trace_mark(id, LATENCY_INTERN);
+}
+
+// The blocking checks of a query are done, checks is a combination of enum
+// latency_check
+void latency_trace_checked(const int id, const unsigned char checks)
+{
+	struct latency_trace *trace = find_trace(id);
+	if(trace == NULL)
+		return;
+
+	trace->checks = checks;
+	latency_trace_mark(id, LATENCY_BLOCKING);
+}
+
+/**
+ * Record that a query has passed the event ending a stage. Only the first time
+ * a query passes an event is accounted, e.g., retries of forwarded queries are
+ * not. Sending the answer ends the trace
+ *
+ * @param id The dnsmasq ID of the query
+ * @param stage The stage which ends
+ */
+void latency_trace_mark(const int id, const enum latency_stage stage)
+{
+	if(stage == LATENCY_TOTAL || stage >= LATENCY_STAGES ||
+	   !config.misc.traceLatency.v.b)
+		return;
+
+	struct latency_trace *trace = find_trace(id);
+	if(trace == NULL || trace->mark[stage] != 0)
+		return;
+
+	const uint64_t now = latency_clock();
+	trace->mark[stage] = now;
+
+	// The stage started with the last event the query has passed
+	uint64_t previous = trace->mark[LATENCY_TOTAL];
+	for(unsigned int i = stage - 1; i > LATENCY_TOTAL; i--)
+	{
+		if(trace->mark[i] != 0)
+		{
+			previous = trace->mark[i];
+			break;
+		}
+	}
+	latency_record(stage, now - previous, trace);
+
+	if(stage == LATENCY_ANSWER)
+	{
+		latency_record(LATENCY_TOTAL, now - trace->mark[LATENCY_TOTAL], trace);
+		trace->id = 0;
+	}
+}
+
+// Called in new TCP workers, traces are keyed by the PID of their owner
+void latency_trace_forked(void)
+{
+	trace_pid = getpid();
+}
+
+/**
+ * Get a snapshot of the statistics of all stages
+ *
+ * @param stats Array to be filled, indexed by enum latency_stage
+ */
+void get_latency_stats(struct latency_stage_stats stats[LATENCY_STAGES])
+{
+	memset(stats, 0, LATENCY_STAGES * sizeof(*stats));
+	if(latency == NULL)
+		return;
+
+	for(unsigned int s = 0; s < LATENCY_STAGES; s++)
+	{
+		struct latency_stage_data *data = &latency->stage[s];
+		stats[s].count = atomic_load_explicit(&data->count, memory_order_relaxed);
+		stats[s].sum = atomic_load_explicit(&data->sum, memory_order_relaxed);
+		for(unsigned int i = 0; i < API_HISTOGRAM_BUCKETS; i++)
+			stats[s].hist.buckets[i] = atomic_load_explicit(&data->buckets[i], memory_order_relaxed);
+
+		// Copy the examples starting with the oldest one
+		const unsigned int next = atomic_load_explicit(&data->next_exemplar, memory_order_relaxed);
+		const unsigned int num = next < LATENCY_EXEMPLARS ? next : LATENCY_EXEMPLARS;
+		for(unsigned int i = 0; i < num; i++)
+			stats[s].exemplar[i] = data->exemplar[(next - num + i) % LATENCY_EXEMPLARS];
+		stats[s].exemplars = num;
+	}
+}
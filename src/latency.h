@@ -0,0 +1,115 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-stage query latency tracing header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdbool.h>
+// uint64_t
+#include <stdint.h>
+// pid_t
+#include <sys/types.h>
+// atomic_uint
+#include <stdatomic.h>
+// API_HISTOGRAM_BUCKETS
+#include "api/endpoint_stats.h"
+
+// Number of queries which can be traced at the same time. Queries are assigned
+// a slot by their dnsmasq ID, a query overwriting the slot of another one
+// still in flight ends the trace of the latter
+#define LATENCY_TRACE_SLOTS 1024u
+// Every LATENCY_SAMPLE_RATE-th query passing through a stage is kept as
+// example, the last LATENCY_EXEMPLARS of them are remembered per stage
+#define LATENCY_SAMPLE_RATE 64u
+#define LATENCY_EXEMPLARS 8u
+
+// Stages of the DNS pipeline. Each stage ends with the named event and starts
+// with the last event the query has passed before, e.g., the answer stage of a
+// blocked query starts when the blocking checks are done. The total covers the
+// time from receiving the query until the answer has been sent
+enum latency_stage {
+	LATENCY_TOTAL,
+	LATENCY_INTERN,
+	LATENCY_BLOCKING,
+	LATENCY_FORWARD,
+	LATENCY_REPLY,
+	LATENCY_ANSWER,
+	LATENCY_STAGES
+} __attribute__ ((packed));
+
+// Lists (or caches) FTL_check_blocking() consulted for a query
+enum latency_check {
+	LATENCY_CHECK_CACHE       = (1 << 0),
+	LATENCY_CHECK_ALLOW_EXACT = (1 << 1),
+	LATENCY_CHECK_ALLOW_REGEX = (1 << 2),
+	LATENCY_CHECK_SPECIAL     = (1 << 3),
+	LATENCY_CHECK_DENY_EXACT  = (1 << 4),
+	LATENCY_CHECK_ANTIGRAVITY = (1 << 5),
+	LATENCY_CHECK_GRAVITY     = (1 << 6),
+	LATENCY_CHECK_DENY_REGEX  = (1 << 7)
+};
+
+// Query currently being traced, times are in microseconds of the monotonic
+// clock, zero if the query has not (yet) passed the event ending the stage.
+// mark[LATENCY_TOTAL] holds the time the query has been received
+struct latency_trace {
+	int id;
+	pid_t pid;
+	int domainID;
+	int clientID;
+	unsigned char checks;
+	uint64_t mark[LATENCY_STAGES];
+};
+
+struct latency_exemplar {
+	int id;
+	int domainID;
+	int clientID;
+	unsigned char checks;
+	uint32_t usec;
+	double timestamp;
+};
+
+struct latency_stage_data {
+	atomic_uint buckets[API_HISTOGRAM_BUCKETS];
+	atomic_uint_least64_t count;
+	atomic_uint_least64_t sum;
+	atomic_uint next_exemplar;
+	struct latency_exemplar exemplar[LATENCY_EXEMPLARS];
+};
+
+// Lives in shared memory so TCP workers account their queries, too. All
+// counters are updated atomically, the SHM lock is not needed
+typedef struct {
+	struct latency_stage_data stage[LATENCY_STAGES];
+	struct latency_trace trace[LATENCY_TRACE_SLOTS];
+} latencyData;
+
+extern latencyData *latency;
+
+// Snapshot of the statistics of one stage (sum in microseconds), exemplars
+// are ordered from the oldest to the most recent one
+struct latency_stage_stats {
+	uint64_t count;
+	uint64_t sum;
+	struct api_histogram hist;
+	unsigned int exemplars;
+	struct latency_exemplar exemplar[LATENCY_EXEMPLARS];
+};
+
+uint64_t latency_trace_start(void);
+void latency_trace_begin(const int id, const int domainID, const int clientID, const uint64_t start);
+void latency_trace_checked(const int id, const unsigned char checks);
+void latency_trace_mark(const int id, const enum latency_stage stage);
+void latency_trace_forked(void);
+void get_latency_stats(struct latency_stage_stats stats[LATENCY_STAGES]);
+const char *latency_stage_name(const enum latency_stage stage) __attribute__((const));
+
+#endif // LATENCY_H
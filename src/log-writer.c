@@ -0,0 +1,391 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Asynchronous log writer
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file log-writer.c
+* @brief Writing FTL's and the web server's log files off the logging threads.
+*
+* Log lines of the main process (and batches of binary query log records) are
+* put into a bounded lock-free queue with room for LOG_QUEUE_SIZE lines
+* (multiple producers, one consumer) and written by a dedicated thread. The thread collects up to LOG_WRITER_BATCH lines per
+* file and writes them with a single writev() call. Files are opened for each
+* batch so log rotation keeps working. Lines with priority LOG_ERR or higher
+* are synced to disk right away, everything else at most every
+* LOG_WRITER_SYNC_INTERVAL seconds.
+*
+* Logging never blocks: when the queue is full, the line is dropped and
+* counted. Forks of the main process (TCP workers) have no writer thread,
+* they write synchronously as before, just like the main process does before
+* the writer is started, after it has been stopped and after a crash.
+*/
+
+#include "FTL.h"
+#include "log-writer.h"
+// config
+#include "config/config.h"
+// log_warn()
+#include "log.h"
+// daemonmode
+#include "args.h"
+// open()
+#include <fcntl.h>
+// write_querylog_header()
+#include "querylog.h"
+// writev()
+#include <sys/uio.h>
+// sem_post()
+#include <semaphore.h>
+// set_thread_placement()
+#include "daemon.h"
+
+// Slot of the queue. seq tells producers and the consumer whose turn it is:
+// slot i is free for the line with position pos if seq == pos and holds that
+// line if seq == pos + 1
+static struct log_slot {
+	atomic_size_t seq;
+	struct log_line line;
+} queue[LOG_QUEUE_SIZE];
+static atomic_size_t enqueue_pos = 0;
+static size_t dequeue_pos = 0;
+
+// Only one thread at a time may take lines out of the queue
+static pthread_mutex_t consumer_lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t wakeup;
+static pthread_t writer;
+static atomic_bool running = false;
+static atomic_bool stopping = false;
+static pid_t writer_pid = 0;
+
+static struct log_writer_stats stats = { 0 };
+
+void get_log_writer_stats(struct log_writer_stats *out)
+{
+	out->written = __atomic_load_n(&stats.written, __ATOMIC_RELAXED);
+	out->dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+	out->batches = __atomic_load_n(&stats.batches, __ATOMIC_RELAXED);
+	out->syncs = __atomic_load_n(&stats.syncs, __ATOMIC_RELAXED);
+}
+
+/**
+ * Hand a log line to the writer thread
+ *
+ * @param line The line, its memory is taken over (and freed) on success
+ * @return false if the line has to be written by the caller as there is no
+ * writer thread in this process. Lines are dropped when the queue is full
+ */
+bool queue_log_line(struct log_line *line)
+{
+	if(!atomic_load_explicit(&running, memory_order_acquire) || getpid() != writer_pid)
+		return false;
+
+	size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+	struct log_slot *slot = NULL;
+	while(true)
+	{
+		slot = &queue[pos % LOG_QUEUE_SIZE];
+		const size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		const ssize_t diff = (ssize_t)(seq - pos);
+		if(diff == 0)
+		{
+			// The slot is free, try to claim it
+			if(atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+			                                         memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if(diff < 0)
+		{
+			// The queue is full, drop the line
+			__atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+			free(line->line);
+			return true;
+		}
+		else
+			// Another producer claimed this slot, try the next one
+			pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+	}
+
+	slot->line = *line;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	sem_post(&wakeup);
+
+	return true;
+}
+
+// Take the next line out of the queue, requires the consumer lock
+static bool dequeue_log_line(struct log_line *line)
+{
+	struct log_slot *slot = &queue[dequeue_pos % LOG_QUEUE_SIZE];
+	if(atomic_load_explicit(&slot->seq, memory_order_acquire) != dequeue_pos + 1)
+		return false;
+
+	*line = slot->line;
+	atomic_store_explicit(&slot->seq, dequeue_pos + LOG_QUEUE_SIZE, memory_order_release);
+	dequeue_pos++;
+
+	return true;
+}
+
+static const char *target_path(const enum log_target target)
+{
+	switch(target)
+	{
+		case LOG_TARGET_FTL:
+			return config.files.log.ftl.v.s;
+		case LOG_TARGET_WEB:
+			return config.files.log.webserver.v.s;
+		case LOG_TARGET_QUERIES:
+			return config.files.log.queries.v.s;
+		case LOG_TARGETS:
+		default:
+			return NULL;
+	}
+}
+
+/**
+ * Append lines to the log file of a target. FTL's lines go to syslog if its
+ * log file cannot be written
+ *
+ * @param target The log file
+ * @param lines The lines, all of this target
+ * @param num Number of lines
+ * @param sync Sync the file to disk after writing
+ */
+void write_log_lines(const enum log_target target, const struct log_line *lines, const unsigned int num, const bool sync)
+{
+	const char *path = target_path(target);
+	const int fd = path != NULL ? open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644) : -1;
+
+	bool written = false;
+	if(fd >= 0)
+	{
+		// New (or rotated) binary query logs start with a header
+		if(target == LOG_TARGET_QUERIES && lseek(fd, 0, SEEK_END) == 0)
+			write_querylog_header(fd);
+
+		struct iovec iov[LOG_WRITER_BATCH];
+		written = true;
+		for(unsigned int i = 0; i < num && written; i += LOG_WRITER_BATCH)
+		{
+			const unsigned int n = min(num - i, LOG_WRITER_BATCH);
+			for(unsigned int j = 0; j < n; j++)
+			{
+				iov[j].iov_base = lines[i + j].line;
+				iov[j].iov_len = lines[i + j].len;
+			}
+			written = writev(fd, iov, (int)n) >= 0;
+		}
+
+		if(written && sync)
+		{
+			fdatasync(fd);
+			__atomic_fetch_add(&stats.syncs, 1, __ATOMIC_RELAXED);
+		}
+		close(fd);
+	}
+
+	if(written)
+		__atomic_fetch_add(&stats.written, num, __ATOMIC_RELAXED);
+	else if(target == LOG_TARGET_FTL)
+	{
+		if(path != NULL && !daemonmode)
+		{
+			printf("!!! WARNING: Writing to FTL\'s log file failed!\n");
+			syslog(LOG_ERR, "Writing to FTL\'s log file failed!");
+		}
+
+		// Syslog logging (without the trailing newline)
+		for(unsigned int i = 0; i < num; i++)
+			syslog(lines[i].priority, "%.*s", (int)(lines[i].len - lines[i].msg - 1),
+			       lines[i].line + lines[i].msg);
+	}
+	else if(target == LOG_TARGET_WEB && !daemonmode)
+	{
+		printf("!!! WARNING: Writing to web log file failed!\n");
+		syslog(LOG_ERR, "Writing to web log file failed!");
+	}
+	else if(target == LOG_TARGET_QUERIES && !daemonmode)
+	{
+		printf("!!! WARNING: Writing to binary query log failed!\n");
+		syslog(LOG_ERR, "Writing to binary query log failed!");
+	}
+}
+
+// Write all queued lines, requires the consumer lock. Returns the targets
+// which have been written to
+static unsigned int drain_queue(const bool sync_all)
+{
+	struct log_line batch[LOG_TARGETS][LOG_WRITER_BATCH];
+	unsigned int num[LOG_TARGETS] = { 0 };
+	bool sync[LOG_TARGETS] = { false };
+	unsigned int written = 0;
+
+	bool more = true;
+	while(more)
+	{
+		// Collect lines until one of the batches is full
+		struct log_line line;
+		while((more = dequeue_log_line(&line)))
+		{
+			const enum log_target target = line.target < LOG_TARGETS ? line.target : LOG_TARGET_FTL;
+			batch[target][num[target]++] = line;
+			if(line.priority <= LOG_ERR)
+				sync[target] = true;
+			if(num[target] == LOG_WRITER_BATCH)
+				break;
+		}
+
+		for(unsigned int t = 0; t < LOG_TARGETS; t++)
+		{
+			if(num[t] == 0)
+				continue;
+
+			write_log_lines(t, batch[t], num[t], sync[t] || sync_all);
+			__atomic_fetch_add(&stats.batches, 1, __ATOMIC_RELAXED);
+			for(unsigned int i = 0; i < num[t]; i++)
+				free(batch[t][i].line);
+
+			written |= 1u << t;
+			num[t] = 0;
+			sync[t] = false;
+		}
+	}
+
+	return written;
+}
+
+// Sync a log file to disk
+static void sync_target(const enum log_target target)
+{
+	const char *path = target_path(target);
+	const int fd = path != NULL ? open(path, O_WRONLY | O_APPEND | O_CLOEXEC) : -1;
+	if(fd < 0)
+		return;
+
+	fdatasync(fd);
+	close(fd);
+	__atomic_fetch_add(&stats.syncs, 1, __ATOMIC_RELAXED);
+}
+
+static void *log_writer_thread(void *val)
+{
+	(void)val;
+	prctl(PR_SET_NAME, "log-writer", 0, 0, 0);
+	set_thread_placement(ROLE_BACKGROUND);
+
+	unsigned int dirty = 0;
+	double last_sync = double_time();
+	unsigned long dropped = 0;
+	while(true)
+	{
+		// Wait for new lines, but wake up regularly to sync
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		sem_timedwait(&wakeup, &ts);
+
+		const bool stop = atomic_load(&stopping);
+		pthread_mutex_lock(&consumer_lock);
+		dirty |= drain_queue(stop);
+		pthread_mutex_unlock(&consumer_lock);
+
+		if(stop)
+			break;
+
+		const double now = double_time();
+		if(dirty != 0 && now - last_sync >= LOG_WRITER_SYNC_INTERVAL)
+		{
+			for(unsigned int t = 0; t < LOG_TARGETS; t++)
+				if(dirty & (1u << t))
+					sync_target(t);
+			dirty = 0;
+			last_sync = now;
+		}
+
+		// Report dropped lines once there is room in the queue again
+		const unsigned long total = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+		if(total != dropped)
+		{
+			log_warn("Log queue overflow, %lu log lines have been dropped", total - dropped);
+			dropped = total;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Start the writer thread, log lines of the main process are written by it
+ * from now on
+ */
+void start_log_writer(void)
+{
+	for(unsigned int i = 0; i < LOG_QUEUE_SIZE; i++)
+		atomic_init(&queue[i].seq, i);
+	atomic_store(&enqueue_pos, 0);
+	dequeue_pos = 0;
+	atomic_store(&stopping, false);
+
+	if(sem_init(&wakeup, 0, 0) != 0)
+	{
+		log_warn("Unable to initialize log writer, writing logs synchronously: %s", strerror(errno));
+		return;
+	}
+
+	if(pthread_create(&writer, NULL, log_writer_thread, NULL) != 0)
+	{
+		log_warn("Unable to create log writer thread, writing logs synchronously");
+		sem_destroy(&wakeup);
+		return;
+	}
+
+	writer_pid = getpid();
+	atomic_store_explicit(&running, true, memory_order_release);
+}
+
+/**
+ * Stop the writer thread after it has written all queued lines. Logging is
+ * synchronous again afterwards
+ */
+void stop_log_writer(void)
+{
+	if(!atomic_load(&running) || getpid() != writer_pid)
+		return;
+
+	// New lines are written synchronously from now on, the writer thread
+	// writes what is left in the queue before it terminates
+	atomic_store_explicit(&running, false, memory_order_release);
+	atomic_store(&stopping, true);
+	sem_post(&wakeup);
+	pthread_join(writer, NULL);
+	sem_destroy(&wakeup);
+
+	// Lines queued by threads which raced with us
+	pthread_mutex_lock(&consumer_lock);
+	drain_queue(true);
+	pthread_mutex_unlock(&consumer_lock);
+}
+
+/**
+ * Write the lines queued so far and log synchronously from now on. Called by
+ * the crash handler, so this does not wait for the writer thread: if the
+ * writer crashed itself, its lines are lost
+ */
+void log_writer_crash(void)
+{
+	if(!atomic_load(&running) || getpid() != writer_pid)
+		return;
+
+	atomic_store_explicit(&running, false, memory_order_release);
+	if(pthread_mutex_trylock(&consumer_lock) == 0)
+	{
+		drain_queue(true);
+		pthread_mutex_unlock(&consumer_lock);
+	}
+}
@@ -0,0 +1,60 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Asynchronous log writer header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <stdbool.h>
+// size_t
+#include <stddef.h>
+
+// Number of log lines which can wait for the writer thread (power of two).
+// Lines are dropped when the queue is full
+#define LOG_QUEUE_SIZE 1024u
+// Maximum number of lines written with one writev() call
+#define LOG_WRITER_BATCH 64u
+// Log files are synced at most this often (seconds), errors are synced right
+// away
+#define LOG_WRITER_SYNC_INTERVAL 5.0
+
+enum log_target {
+	LOG_TARGET_FTL,
+	LOG_TARGET_WEB,
+	LOG_TARGET_QUERIES,
+	LOG_TARGETS
+} __attribute__ ((packed));
+
+// A formatted log line including its trailing newline. The message starts at
+// offset msg (after time, process and priority), it is what goes to syslog
+// when the log file cannot be written. Lines of the binary query log are
+// batches of records
+struct log_line {
+	char *line;
+	size_t len;
+	size_t msg;
+	int priority;
+	enum log_target target;
+};
+
+struct log_writer_stats {
+	unsigned long written;
+	unsigned long dropped;
+	unsigned long batches;
+	unsigned long syncs;
+};
+
+bool queue_log_line(struct log_line *line);
+void write_log_lines(const enum log_target target, const struct log_line *lines, const unsigned int num, const bool sync);
+void start_log_writer(void);
+void stop_log_writer(void);
+void log_writer_crash(void);
+void get_log_writer_stats(struct log_writer_stats *stats);
+
+#endif // LOG_WRITER_H
@@ -28,6 +28,8 @@
 #include "database/query-table.h"
 // runGC()
 #include "gc.h"
+// queue_log_line()
+#include "log-writer.h"
 
 static bool print_log = true, print_stdout = true;
 static const char *process = "";
@@ -232,6 +234,45 @@ const char *debugstr(const enum debug_flag flag)
 	}
 }
 
+// Format a log line and hand it to the log writer. Returns false if the line
+// could not be formatted
+static bool __attribute__ ((format (printf, 4, 0))) emit_log_line(const enum log_target target, const int priority,
+                                                                 const char *prefix, const char *format, va_list args)
+{
+	char *msg = NULL;
+	const int msglen = vasprintf(&msg, format, args);
+	if(msglen < 0)
+		return false;
+
+	const size_t prefixlen = strlen(prefix);
+	struct log_line line = {
+		.line = malloc(prefixlen + msglen + 2),
+		.len = prefixlen + msglen + 1,
+		.msg = prefixlen,
+		.priority = priority,
+		.target = target
+	};
+	if(line.line == NULL)
+	{
+		free(msg);
+		return false;
+	}
+	memcpy(line.line, prefix, prefixlen);
+	memcpy(line.line + prefixlen, msg, msglen);
+	line.line[line.len - 1] = '\n';
+	line.line[line.len] = '\0';
+	free(msg);
+
+	// Write the line ourselves if there is no writer thread
+	if(!queue_log_line(&line))
+	{
+		write_log_lines(target, &line, 1, false);
+		free(line.line);
+	}
+
+	return true;
+}
+
 void __attribute__ ((format (printf, 3, 4))) _FTL_log(const int priority, const enum debug_flag flag, const char *format, ...)
 {
 	char timestring[TIMESTR_SIZE];
@@ -291,37 +332,15 @@ void __attribute__ ((format (printf, 3, 4))) _FTL_log(const int priority, const
 		va_end(args);
 		add_to_fifo_buffer(FIFO_FTL, buffer, prio, len > MAX_MSG_FIFO ? MAX_MSG_FIFO : len);
 
-		bool logged = false;
-		if(config.files.log.ftl.v.s != NULL)
-		{
-			// Open log file
-			FILE *logfile = fopen(config.files.log.ftl.v.s, "a+");
-
-			// Write to log file
-			if(logfile != NULL)
-			{
-				// Prepend message with identification string and priority
-				fprintf(logfile, "%s [%s] %s: ", timestring, idstr, prio);
-
-				// Log message
-				va_start(args, format);
-				vfprintf(logfile, format, args);
-				va_end(args);
-
-				// Append newline character to the end of the file
-				fputc('\n', logfile);
-
-				// Close file after writing
-				fclose(logfile);
+		// Prepend message with identification string and priority and
+		// hand it to the log writer (or write it right away). The line
+		// goes to syslog when the log file cannot be written
+		char prefix[TIMESTR_SIZE + sizeof(idstr) + 32];
+		snprintf(prefix, sizeof(prefix), "%s [%s] %s: ", timestring, idstr, prio);
+		va_start(args, format);
+		const bool logged = emit_log_line(LOG_TARGET_FTL, priority, prefix, format, args);
+		va_end(args);
 
-				logged = true;
-			}
-			else if(!daemonmode)
-			{
-				printf("!!! WARNING: Writing to FTL\'s log file failed!\n");
-				syslog(LOG_ERR, "Writing to FTL\'s log file failed!");
-			}
-		}
 		if(!logged)
 		{
 			// Syslog logging
@@ -352,24 +371,12 @@ void __attribute__ ((format (printf, 1, 2))) log_web(const char *format, ...)
 	// pihole-FTL instance is logging into the same file
 	const long pid = (long)getpid();
 
-	// Open web log file
-	FILE *weblog = fopen(config.files.log.webserver.v.s, "a+");
-
 	// Write to web log file
-	if(weblog != NULL)
-	{
-		fprintf(weblog, "[%s %ld] ", timestring, pid);
-		va_start(args, format);
-		vfprintf(weblog, format, args);
-		va_end(args);
-		fputc('\n',weblog);
-		fclose(weblog);
-	}
-	else if(!daemonmode)
-	{
-		printf("!!! WARNING: Writing to web log file failed!\n");
-		syslog(LOG_ERR, "Writing to web log file failed!");
-	}
+	char prefix[TIMESTR_SIZE + 32];
+	snprintf(prefix, sizeof(prefix), "[%s %ld] ", timestring, pid);
+	va_start(args, format);
+	emit_log_line(LOG_TARGET_WEB, LOG_INFO, prefix, format, args);
+	va_end(args);
 }
 
 // Log helper activity (may be script or lua)
@@ -485,11 +492,11 @@ void FTL_log_dnsmasq_fatal(const char *format, ...)
 
 void log_counter_info(void)
 {
-	log_info(" -> Total DNS queries: %u", counters->queries);
+	log_info(" -> Total DNS queries: %u", get_total_queries());
 	log_info(" -> Cached DNS queries: %u", get_cached_count());
 	log_info(" -> Forwarded DNS queries: %u", get_forwarded_count());
 	log_info(" -> Blocked DNS queries: %u", get_blocked_count());
-	log_info(" -> Unknown DNS queries: %u", counters->status[QUERY_UNKNOWN]);
+	log_info(" -> Unknown DNS queries: %u", get_status_count(QUERY_UNKNOWN));
 	log_info(" -> Unique domains: %u", counters->domains);
 	log_info(" -> Unique clients: %u", counters->clients);
 	log_info(" -> DNS cache records: %u", counters->dns_cache_size);
@@ -672,24 +679,15 @@ void dnsmasq_diagnosis_warning(char *message)
 	logg_warn_dnsmasq_message(skipStr("warning: ", message));
 }
 
-void add_to_fifo_buffer(const enum fifo_logs which, const char *payload, const char *prio, const size_t length)
+static void fifo_append(const enum fifo_logs which, const char *payload, const char *prio, const size_t length, const double now)
 {
-	const double now = double_time();
-
 	// Do not try to log when shared memory isn't initialized yet
 	if(!fifo_log)
 		return;
 
-	unsigned int idx = fifo_log->logs[which].next_id++;
-	if(idx >= LOG_SIZE)
-	{
-		// Log is full, move everything one slot forward to make space for a new record at the end
-		// This pruges the oldest message from the list (it is overwritten by the second message)
-		memmove(&fifo_log->logs[which].message[0][0], &fifo_log->logs[which].message[1][0], (LOG_SIZE - 1u) * MAX_MSG_FIFO);
-		memmove(&fifo_log->logs[which].prio[0], &fifo_log->logs[which].prio[1], (LOG_SIZE - 1u) * sizeof(fifo_log->logs[which].prio[0]));
-		memmove(&fifo_log->logs[which].timestamp[0], &fifo_log->logs[which].timestamp[1], (LOG_SIZE - 1u) * sizeof(fifo_log->logs[which].timestamp[0]));
-		idx = LOG_SIZE - 1u;
-	}
+	// The buffer is a ring, message ID n lives in slot n % LOG_SIZE. Once
+	// the log is full, the oldest message is overwritten
+	const unsigned int idx = fifo_log->logs[which].next_id++ % LOG_SIZE;
 
 	// Copy string
 	// We need to use the pre-allocated buffer in shared memory as we share
@@ -715,6 +713,104 @@ void add_to_fifo_buffer(const enum fifo_logs which, const char *payload, const c
 	fifo_log->logs[which].prio[idx] = prio;
 }
 
+void add_to_fifo_buffer(const enum fifo_logs which, const char *payload, const char *prio, const size_t length)
+{
+	fifo_append(which, payload, prio, length, double_time());
+}
+
+// Ring of this process (TCP workers only)
+static struct log_ring *own_ring = NULL;
+
+// Claim a log ring for this TCP worker. Log lines go through the SHM lock as
+// usual if all rings are in use
+void claim_log_ring(void)
+{
+	if(log_rings == NULL)
+		return;
+
+	const pid_t pid = getpid();
+	for(unsigned int i = 0; i < LOG_RINGS; i++)
+	{
+		struct log_ring *ring = &log_rings->rings[i];
+		int owner = atomic_load(&ring->pid);
+
+		// Take over rings of workers that died without releasing them
+		if(owner != 0 && !(kill(owner, 0) == -1 && errno == ESRCH))
+			continue;
+
+		// Only reuse rings the main process has emptied completely
+		if(atomic_load(&ring->head) != atomic_load(&ring->tail))
+			continue;
+
+		if(atomic_compare_exchange_strong(&ring->pid, &owner, pid))
+		{
+			own_ring = ring;
+			log_debug(DEBUG_SHMEM, "Claimed log ring %u", i);
+			return;
+		}
+	}
+
+	log_debug(DEBUG_SHMEM, "No free log ring available, logging with SHM lock");
+}
+
+// Release the log ring of this TCP worker. Has to be called with the SHM lock
+// held so the remaining lines can be collected right away
+void release_log_ring(void)
+{
+	if(own_ring == NULL)
+		return;
+
+	drain_log_rings();
+	atomic_store(&own_ring->pid, 0);
+	own_ring = NULL;
+}
+
+// Append a log line to the ring of this process without taking the SHM lock.
+// Returns false if this process has no ring or if it is full
+bool push_log_ring(const char *payload, const size_t length)
+{
+	struct log_ring *ring = own_ring;
+	if(ring == NULL)
+		return false;
+
+	const unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE)
+		return false;
+
+	struct log_ring_line *line = &ring->lines[head % LOG_RING_SIZE];
+	line->length = length < MAX_MSG_FIFO ? length : MAX_MSG_FIFO;
+	memcpy(line->message, payload, line->length);
+	line->timestamp = double_time();
+
+	// Publish the line before announcing it
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	atomic_store_explicit(&log_rings->pending, 1, memory_order_release);
+
+	return true;
+}
+
+// Move all lines buffered by TCP workers into the FIFO buffer. Has to be
+// called with the SHM lock held
+void drain_log_rings(void)
+{
+	if(log_rings == NULL ||
+	   atomic_exchange_explicit(&log_rings->pending, 0, memory_order_acquire) == 0)
+		return;
+
+	for(unsigned int i = 0; i < LOG_RINGS; i++)
+	{
+		struct log_ring *ring = &log_rings->rings[i];
+		unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		const unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for(; tail != head; tail++)
+		{
+			const struct log_ring_line *line = &ring->lines[tail % LOG_RING_SIZE];
+			fifo_append(FIFO_DNSMASQ, line->message, NULL, line->length, line->timestamp);
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+}
+
 bool flush_dnsmasq_log(void)
 {
 	// Lock shared memory
@@ -17,6 +17,8 @@
 #include <sys/syslog.h>
 // uint64_t
 #include <stdint.h>
+// atomic_uint
+#include <stdatomic.h>
 
 #define DEBUG_ANY 0
 #define TIMESTR_SIZE 128
@@ -84,6 +86,8 @@ const char *short_path(const char *full_path) __attribute__ ((pure));
 // How many messages do we keep in memory (FIFO message buffer)?
 // This number multiplied by MAX_MSG_FIFO (see above) gives the total buffer size
 // Defaults to 512 [512 * 256 above = use 128 KB of memory for the log]
+// The buffer is a ring: the message with ID n is stored in slot n % LOG_SIZE,
+// the last LOG_SIZE messages (up to next_id - 1) are available
 #define LOG_SIZE 515u
 
 void add_to_fifo_buffer(const enum fifo_logs which, const char *payload, const char *prio, const size_t length);
@@ -101,4 +105,35 @@ typedef struct {
 
 extern fifologData *fifo_log;
 
+// How many TCP workers can log without the SHM lock and how many lines each
+// of them can buffer before the main process collects them
+#define LOG_RINGS 16u
+#define LOG_RING_SIZE 64u
+
+struct log_ring_line {
+	double timestamp;
+	unsigned int length;
+	char message[MAX_MSG_FIFO];
+};
+
+// Single-producer ring of dnsmasq log lines owned by one TCP worker
+struct log_ring {
+	atomic_int pid;
+	atomic_uint head;
+	atomic_uint tail;
+	struct log_ring_line lines[LOG_RING_SIZE];
+};
+
+typedef struct {
+	atomic_uint pending;
+	struct log_ring rings[LOG_RINGS];
+} logRingsData;
+
+extern logRingsData *log_rings;
+
+void claim_log_ring(void);
+void release_log_ring(void);
+bool push_log_ring(const char *payload, const size_t length);
+void drain_log_rings(void);
+
 #endif //LOG_H
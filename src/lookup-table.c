@@ -11,6 +11,15 @@
 /**
 * @file lookup-table.c
 * @brief Provides functionality to find/add/remove elements in a lookup table.
+*
+* The lookup tables are open-addressing hash tables living in shared memory.
+* Collisions are resolved by linear probing using Robin Hood hashing: an
+* element being inserted takes over the slot of any resident element that is
+* closer to its home slot than the new element is to its own. This keeps the
+* variance of probe lengths small and allows lookups to stop early as soon as
+* they encounter an element that is closer to its home than the searched key
+* would be. Removal uses backward-shift deletion, so no tombstones are needed
+* and the table never degrades over time.
 */
 
 #include "lookup-table.h"
@@ -20,120 +29,50 @@
 #include "shmem.h"
 // PRIu32
 #include <inttypes.h>
+// domain_suffixes
+#include "domain-suffixes.h"
 
 /**
- * @brief Compare two hash values.
+ * @brief Computes the home slot of a hash value in a table of given capacity.
  *
- * This function compares two 32-bit hash values and returns:
- * - -1 if the first hash is less than the second hash.
- * -  1 if the first hash is greater than the second hash.
- * -  0 if both hashes are equal.
+ * The hash is first scrambled using Fibonacci hashing to spread hashes with
+ * little entropy in their upper bits (such as the packed IDs used for the DNS
+ * cache) evenly across the table. The result is then mapped onto [0, capacity)
+ * using a multiply-shift range reduction which, unlike a modulo operation,
+ * works for arbitrary capacities without a division.
  *
- * @param a The first hash value to compare.
- * @param b The second hash value to compare.
- * @return An integer indicating the result of the comparison.
+ * @param hash The hash value of the element.
+ * @param capacity The number of slots in the table.
+ * @return The slot the element would ideally be stored in.
  */
-static inline int cmp_hash(const uint32_t a, const uint32_t b)
+static inline unsigned int __attribute__((const)) home_slot(const uint32_t hash, const unsigned int capacity)
 {
-	// Compare hash values
-	if(a < b)
-		// First hash is less than second hash
-		return -1;
-	if(a > b)
-		// First hash is greater than second hash
-		return 1;
-
-	// Match
-	return 0;
+	const uint32_t mixed = hash * UINT32_C(0x9E3779B1);
+	return (unsigned int)(((uint64_t)mixed * capacity) >> 32);
 }
 
 /**
- * @file datastructure.c
- * @brief Implements a binary search algorithm for lookup_table structures.
- *
- * @param key Pointer to the lookup_table structure to search for (element to find).
- * @param base Pointer to the base of the array of lookup_table structures to search in.
- * @param size Number of elements in the array to search in.
- * @param try Pointer to a pointer where the address of the found element will be stored.
- * @return true if the element is found, false otherwise.
- *
- * This function performs a binary search on an array of lookup_table structures.
- * It compares the key with the middle element of the array and decides whether
- * to search in the left or right half of the array. The search continues until
- * the element is found or the array is exhausted. This function is used to find
- * an element in a sorted array of lookup_table structures based on the hash value.
- * Finding the element in the array is done in O(log n) time complexity.
- *
- * This function is different from the standard bsearch function in that it
- * always returns the address of where the element would be found if it were in the
- * array - even if the element is not found. This is useful for inserting new
- * elements subsequently as we already have the correct position in the array
- * without resorting to do a linear search to find the insertion point later on.
- * We, instead, make the function return false if the element is not found.
+ * @brief Computes how far an element is displaced from its home slot.
  *
- * The standard library's bsearch() function, however, returns a pointer to the
- * found element or NULL (!) if the element is not found which provides no
- * information about the position where the element would need to be inserted.
+ * @param entry The element to check.
+ * @param pos The slot the element is currently stored in.
+ * @param capacity The number of slots in the table.
+ * @return The number of slots between the home slot and the current slot.
  */
-static bool binsearch(struct lookup_table *base, const uint32_t hash,
-                      size_t size, struct lookup_table **try)
+static inline unsigned int __attribute__((pure)) probe_distance(const struct lookup_table *entry,
+                                                                const unsigned int pos,
+                                                                const unsigned int capacity)
 {
-	// Initialize the base pointer to the start of the array
-	*try = base;
-
-	// Run while there are elements left to be searched in the base array
-	while(size > 0)
-	{
-		// Use unsigned arithmetic to avoid overflow when calculating
-		// the middle element of the array
-		const size_t mid = size / 2;
-		// Update the base pointer to the middle element of the array
-		*try = base + mid;
-
-		// Compare the key with the current element
-		const int sign = cmp_hash(hash, (*try)->hash);
-
-		if(sign == 0)
-		{
-			// If the key matches the element, we found at least one
-			// occurrence of the key in the array
-			return true;
-		}
-		else if(size == 1)
-		{
-			// If there's only one element left and it doesn't
-			// match, break the loop as the key is not in the array
-			// => return false
-
-			// If the key is greater than the middle element, the
-			// key would be inserted after the middle element
-			if(sign > 0)
-				(*try)++;
-
-			// Break the loop, we have not found the key but
-			// know that it would need to be inserted at *try
-			break;
-		}
-		else if(sign < 0)
-		{
-			// If the key is less than the middle element, search in
-			// the (relative) left half (XXXX-----) and try again
-
-			// base stays the same
-			size = mid; // size is now the left half
-		}
-		else
-		{
-			// If the key is greater than the middle element, search
-			// in the (relative) right half (-----XXXX) and try again
-
-			base = *try; // base is now the beginning of the right half
-			size -= mid; // size is now the right half
-		}
-	}
+	const unsigned int home = home_slot(entry->hash, capacity);
+	return pos >= home ? pos - home : pos + capacity - home;
+}
 
-	// If the key was not found, return false
-	return false;
+/**
+ * @brief Advances to the next slot, wrapping around at the end of the table.
+ */
+static inline unsigned int __attribute__((const)) next_slot(const unsigned int pos, const unsigned int capacity)
+{
+	return pos + 1 < capacity ? pos + 1 : 0;
 }
 
 /**
@@ -147,12 +86,17 @@ static bool binsearch(struct lookup_table *base, const uint32_t hash,
  *             - CLIENTS_LOOKUP
  *             - DOMAINS_LOOKUP
  *             - DNS_CACHE_LOOKUP
+ *             - STRINGS_LOOKUP
+ *             - SUFFIXES_LOOKUP
+ *             - UPSTREAMS_LOOKUP
  * @param table A pointer to a pointer that will be assigned the address of the appropriate lookup table.
  * @param size A pointer to a pointer that will be assigned the address of the size of the appropriate lookup table.
+ * @param capacity A pointer that will be assigned the number of slots of the appropriate lookup table.
  * @param name A pointer to a pointer that will be assigned the name of the appropriate lookup table.
  * @return true if the lookup table and size were successfully retrieved, false if the memory type is invalid.
  */
-static bool get_table(const enum memory_type type, struct lookup_table **table, unsigned int **size, const char **name)
+static bool get_table(const enum memory_type type, struct lookup_table **table, unsigned int **size,
+                      unsigned int *capacity, const char **name)
 {
 	// Get the correct lookup_table array based on the type
 	if(type == CLIENTS_LOOKUP)
@@ -160,18 +104,42 @@ static bool get_table(const enum memory_type type, struct lookup_table **table,
 		*name = "clients";
 		*table = clients_lookup;
 		*size = &counters->clients_lookup_size;
+		*capacity = counters->clients_lookup_MAX;
 	}
 	else if(type == DOMAINS_LOOKUP)
 	{
 		*name = "domains";
 		*table = domains_lookup;
 		*size = &counters->domains_lookup_size;
+		*capacity = counters->domains_lookup_MAX;
 	}
 	else if(type == DNS_CACHE_LOOKUP)
 	{
 		*name = "DNS cache";
 		*table = dns_cache_lookup;
 		*size = &counters->dns_cache_lookup_size;
+		*capacity = counters->dns_cache_lookup_MAX;
+	}
+	else if(type == STRINGS_LOOKUP)
+	{
+		*name = "strings";
+		*table = strings_lookup;
+		*size = &counters->strings_lookup_size;
+		*capacity = counters->strings_lookup_MAX;
+	}
+	else if(type == SUFFIXES_LOOKUP)
+	{
+		*name = "domain suffixes";
+		*table = suffixes_lookup;
+		*size = &counters->suffixes_lookup_size;
+		*capacity = counters->suffixes_lookup_MAX;
+	}
+	else if(type == UPSTREAMS_LOOKUP)
+	{
+		*name = "upstreams";
+		*table = upstreams_lookup;
+		*size = &counters->upstreams_lookup_size;
+		*capacity = counters->upstreams_lookup_MAX;
 	}
 	else
 	{
@@ -182,12 +150,59 @@ static bool get_table(const enum memory_type type, struct lookup_table **table,
 	return true;
 }
 
+/**
+ * @brief Places an element into the table using Robin Hood insertion.
+ *
+ * The caller has to ensure that there is at least one free slot.
+ *
+ * @param table The table to insert into.
+ * @param capacity The number of slots in the table.
+ * @param element The element to insert.
+ * @return The probe distance the inserted element ended up at.
+ */
+static unsigned int place_element(struct lookup_table *table, const unsigned int capacity,
+                                  struct lookup_table element)
+{
+	unsigned int pos = home_slot(element.hash, capacity);
+	unsigned int dist = 0, inserted_dist = 0;
+	bool swapped = false;
+
+	while(table[pos].id != LOOKUP_EMPTY)
+	{
+		// If the resident element is closer to its home than we are to
+		// ours, it is "richer" and has to give up its slot. We continue
+		// with finding a new place for the displaced element
+		const unsigned int resident_dist = probe_distance(&table[pos], pos, capacity);
+		if(resident_dist < dist)
+		{
+			const struct lookup_table tmp = table[pos];
+			table[pos] = element;
+			element = tmp;
+			if(!swapped)
+			{
+				inserted_dist = dist;
+				swapped = true;
+			}
+			dist = resident_dist;
+		}
+
+		pos = next_slot(pos, capacity);
+		dist++;
+	}
+
+	table[pos] = element;
+
+	return swapped ? inserted_dist : dist;
+}
+
 /**
  * @brief Inserts an element into the lookup table.
  *
  * This function inserts an element with the specified ID and hash into the
- * lookup table corresponding to the given memory type. If the element already
- * exists in the table, it logs a message and returns without making any changes.
+ * lookup table corresponding to the given memory type. Elements with identical
+ * hashes may coexist, they are told apart by the comparison function passed to
+ * lookup_find_id(). Insertion runs in amortized O(1) time as the table is kept
+ * below its maximum load factor by shm_ensure_size().
  *
  * @param type The memory type that determines which lookup table to use.
  * @param id The ID of the element to be inserted.
@@ -196,34 +211,24 @@ static bool get_table(const enum memory_type type, struct lookup_table **table,
  */
 bool lookup_insert(const enum memory_type type, const unsigned int id, const uint32_t hash)
 {
-
 	// Get the correct lookup_table array based on the type
 	struct lookup_table *table = NULL;
-	unsigned int *size = NULL;
+	unsigned int *size = NULL, capacity = 0;
 	const char *name = NULL;
-	if(!get_table(type, &table, &size, &name))
+	if(!get_table(type, &table, &size, &capacity, &name))
 		return false;
 
-	// Find the correct position in the lookup_table array
-	// We do not check the return value as we are inserting a new element
-	// and don't care if elements with the same hash value exist already
-	struct lookup_table *try = table;
-	binsearch(table, hash, *size, &try);
-
-	// Calculate the position where the element would be inserted
-	const size_t pos = try - table;
-
-	// Move all elements from the insertion point to the end of the array
-	// one position to the right to make space for the new element
-	// Don't move anything if the element is added at the end of the array
-	if(pos < *size)
-		memmove(try + 1, try, (*size - pos) * sizeof(struct lookup_table));
+	// Always keep at least one slot free so probe sequences terminate
+	if(*size + 1 >= capacity)
+	{
+		log_err("Cannot insert ID %u into full %s lookup table (%u/%u)",
+		        id, name, *size, capacity);
+		return false;
+	}
 
-	// Prepare the new lookup_table element and insert it at the correct
-	// position
-	table[pos] = (struct lookup_table){ .id = id, .hash = hash };
+	place_element(table, capacity, (struct lookup_table){ .id = id, .hash = hash });
 
-	// Increase the number of elements in the array
+	// Increase the number of elements in the table
 	(*size)++;
 
 	return true;
@@ -235,8 +240,9 @@ bool lookup_insert(const enum memory_type type, const unsigned int id, const uin
  * This function removes an element with the specified ID and hash from the
  * lookup table corresponding to the given memory type. If the element does not
  * exist in the table, it logs a message and returns without making any changes.
- * If the element is found, it is removed from the table and the remaining
- * elements are shifted to the left to fill the gap and maintain the order.
+ * If the element is found, all following elements of the same cluster are
+ * shifted back by one slot (backward-shift deletion) so that no tombstones are
+ * left behind.
  *
  * @param type The memory type that determines which lookup table to use.
  * @param id The ID of the element to be removed.
@@ -247,59 +253,47 @@ bool lookup_remove(const enum memory_type type, const unsigned int id, const uin
 {
 	// Get the correct lookup_table array based on the type
 	struct lookup_table *table = NULL;
-	unsigned int *size = NULL;
+	unsigned int *size = NULL, capacity = 0;
 	const char *name = NULL;
-	if(!get_table(type, &table, &size, &name))
+	if(!get_table(type, &table, &size, &capacity, &name))
 		return false;
 
-	// Find the correct position in the lookup_table array
-	struct lookup_table *try = NULL;
-	if(!binsearch(table, hash, *size, &try))
+	// Walk the probe sequence of this hash
+	unsigned int pos = home_slot(hash, capacity);
+	for(unsigned int dist = 0; table[pos].id != LOOKUP_EMPTY; dist++)
 	{
-		// The element is not in the array
-		log_warn("Element to be removed (hash %u) is not in the %s lookup table",
-		         hash, name);
-		return true;
-	}
+		// Robin Hood invariant: once we reach an element closer to its
+		// home than we are to ours, the element cannot be further down
+		if(probe_distance(&table[pos], pos, capacity) < dist)
+			break;
 
-	// Calculate the position where the element is located
-	size_t pos = try - table;
+		if(table[pos].hash == hash && table[pos].id == id)
+		{
+			// Shift all following displaced elements back by one
+			// slot until we reach an empty slot or an element
+			// sitting in its home slot
+			unsigned int next = next_slot(pos, capacity);
+			while(table[next].id != LOOKUP_EMPTY &&
+			      probe_distance(&table[next], next, capacity) > 0)
+			{
+				table[pos] = table[next];
+				pos = next;
+				next = next_slot(next, capacity);
+			}
 
-	// If binsearch finds the element, it returns the address *one*
-	// of the elements matching the hash value. We need to find the
-	// first element with the same hash value and then iterate over
-	// all elements with the same hash value to find the correct one
-	// where the ID matches as well.
-	while(pos > 0 && table[pos - 1].hash == hash)
-		pos--;
+			// Mark the last moved slot as free
+			table[pos] = (struct lookup_table){ .id = LOOKUP_EMPTY, .hash = 0 };
 
-	// Iterate over all elements with the same hash value
-	while(pos < *size && table[pos].hash == hash)
-	{
-		// If the ID matches, we found the correct element
-		if(table[pos].id == id)
-		{
-			// Move all elements from the position to the end of the array
-			// one position to the left to remove the element
-			// Don't move anything if the element is removed from the end of the array
-			if(pos < *size - 1)
-				memmove(table + pos, table + pos + 1,
-				        (*size - pos - 1) * sizeof(struct lookup_table));
-
-			// Decrease the number of elements in the array
+			// Decrease the number of elements in the table
 			(*size)--;
 
-			// Zero out the memory of the removed element
-			memset(table + *size, 0, sizeof(struct lookup_table));
-
 			return true;
 		}
 
-		// Move to the next element with the same hash value
-		pos++;
+		pos = next_slot(pos, capacity);
 	}
 
-	// The element is not in the array
+	// The element is not in the table
 	log_warn("Element to be removed (ID %u, hash %u) not in %s lookup table",
 	         id, hash, name);
 
@@ -309,10 +303,10 @@ bool lookup_remove(const enum memory_type type, const unsigned int id, const uin
 /**
  * @brief Finds an element in the lookup table based on the given type and hash.
  *
- * This function searches for an element in the lookup table that matches the
- * specified type and hash. If an element with the same hash is found, it iterates
- * over all elements with the same hash to find the correct one where the ID matches
- * as well.
+ * This function walks the probe sequence of the specified hash and calls the
+ * comparison function on every element with a matching hash until it confirms
+ * a match. The walk ends early when an empty slot or an element closer to its
+ * home slot than the searched key would be is encountered.
  *
  * @param type The type of memory to search in.
  * @param hash The hash value of the element to find.
@@ -327,32 +321,20 @@ bool lookup_find_id(const enum memory_type type, const uint32_t hash, const stru
 {
 	// Get the correct lookup_table array based on the type
 	struct lookup_table *table = NULL;
-	unsigned int *size = NULL;
+	unsigned int *size = NULL, capacity = 0;
 	const char *name = NULL;
-	if(!get_table(type, &table, &size, &name))
+	if(!get_table(type, &table, &size, &capacity, &name))
 		return false;
 
-	// Find the correct position in the lookup_table array
-	struct lookup_table *try = NULL;
-	if(!binsearch(table, hash, *size, &try))
-		return false;
-
-	// Calculate the position where the element is located
-	size_t pos = try - table;
-
-	// If binsearch finds the element, it returns the address *one*
-	// of the elements matching the hash value. We need to find the
-	// first element with the same hash value and then iterate over
-	// all elements with the same hash value to find the correct one
-	// where the ID matches as well.
-	while(pos > 0 && table[pos - 1].hash == hash)
-		pos--;
-
-	// Iterate over all elements with the same hash value
-	while(pos < *size && table[pos].hash == hash)
+	unsigned int pos = home_slot(hash, capacity);
+	for(unsigned int dist = 0; table[pos].id != LOOKUP_EMPTY; dist++)
 	{
-		// If the ID matches, we found the correct element
-		if(cmp_func(&table[pos], lookup_data))
+		if(probe_distance(&table[pos], pos, capacity) < dist)
+			break;
+
+		// Check the hash first to avoid calling the (expensive)
+		// comparison function on unrelated elements
+		if(table[pos].hash == hash && cmp_func(&table[pos], lookup_data))
 		{
 			// Store the matching ID
 			*matchingID = table[pos].id;
@@ -361,13 +343,92 @@ bool lookup_find_id(const enum memory_type type, const uint32_t hash, const stru
 			return true;
 		}
 
-		// Move to the next element with the same hash value
-		pos++;
+		pos = next_slot(pos, capacity);
 	}
 
 	return false;
 }
 
+/**
+ * @brief Marks all slots of a lookup table as free.
+ *
+ * This has to be called once after the shared memory object of the table was
+ * created as a zero-filled table would consist of elements with ID 0.
+ *
+ * @param type The memory type that determines which lookup table to use.
+ */
+void lookup_init(const enum memory_type type)
+{
+	struct lookup_table *table = NULL;
+	unsigned int *size = NULL, capacity = 0;
+	const char *name = NULL;
+	if(!get_table(type, &table, &size, &capacity, &name))
+		return;
+
+	// LOOKUP_EMPTY has all bits set
+	memset(table, 0xFF, (size_t)capacity * sizeof(struct lookup_table));
+	*size = 0;
+}
+
+/**
+ * @brief Redistributes all elements after the lookup table has been enlarged.
+ *
+ * The home slot of an element depends on the capacity of the table, hence all
+ * elements need to be placed again after shm_ensure_size() grew the table.
+ *
+ * @param type The memory type that determines which lookup table to use.
+ * @param old_capacity The number of slots before the table was enlarged.
+ * @return true on success, false if memory allocation failed.
+ */
+bool lookup_rehash(const enum memory_type type, const unsigned int old_capacity)
+{
+	struct lookup_table *table = NULL;
+	unsigned int *size = NULL, capacity = 0;
+	const char *name = NULL;
+	if(!get_table(type, &table, &size, &capacity, &name))
+		return false;
+
+	// Copy the old table aside so we can place the elements again
+	const size_t old_bytes = (size_t)old_capacity * sizeof(struct lookup_table);
+	struct lookup_table *old = malloc(old_bytes);
+	if(old == NULL)
+	{
+		log_err("Failed to allocate memory for rehashing %s lookup table", name);
+		return false;
+	}
+	memcpy(old, table, old_bytes);
+
+	// Clear the enlarged table
+	memset(table, 0xFF, (size_t)capacity * sizeof(struct lookup_table));
+
+	// Place all elements at their new positions
+	unsigned int moved = 0, longest = 0;
+	for(unsigned int i = 0; i < old_capacity; i++)
+	{
+		if(old[i].id == LOOKUP_EMPTY)
+			continue;
+
+		const unsigned int dist = place_element(table, capacity, old[i]);
+		if(dist > longest)
+			longest = dist;
+		moved++;
+	}
+
+	free(old);
+
+	log_debug(DEBUG_SHMEM, "Rehashed %u elements of %s lookup table (%u -> %u slots, longest probe %u)",
+	          moved, name, old_capacity, capacity, longest);
+
+	if(moved != *size)
+	{
+		log_warn("%s lookup table should contain %u elements but %u were found during rehashing",
+		         name, *size, moved);
+		*size = moved;
+	}
+
+	return true;
+}
+
 /**
  * @brief Searches for hash collisions in the lookup table of the specified memory type.
  *
@@ -377,32 +438,63 @@ bool lookup_find_id(const enum memory_type type, const uint32_t hash, const stru
  *             - CLIENTS_LOOKUP: Searches for collisions in the clients lookup table.
  *             - DOMAINS_LOOKUP: Searches for collisions in the domains lookup table.
  *             - DNS_CACHE_LOOKUP: Searches for collisions in the DNS cache lookup table.
+ *             - STRINGS_LOOKUP: Searches for collisions in the strings lookup table.
+ *             - SUFFIXES_LOOKUP: Searches for collisions in the domain suffixes lookup table.
+ *             - UPSTREAMS_LOOKUP: Searches for collisions in the upstreams lookup table.
  *
  * The function retrieves the appropriate lookup table based on the provided type and iterates
- * through it to find and log any hash collisions. The logged information varies depending on the
- * type of lookup table being searched.
+ * through it to find and log any hash collisions. Elements with identical hashes share the same
+ * home slot and are therefore stored within the same run of the table. The logged information
+ * varies depending on the type of lookup table being searched. Furthermore, the Robin Hood
+ * invariant is verified for each slot as a violation would make elements unreachable.
  */
 static void lookup_find_hash_collisions_table(const enum memory_type type)
 {
 	// Get the correct lookup_table array based on the type
 	struct lookup_table *table = NULL;
-	unsigned int *size = NULL;
+	unsigned int *size = NULL, capacity = 0;
 	const char *name = NULL;
-	if(!get_table(type, &table, &size, &name))
+	if(!get_table(type, &table, &size, &capacity, &name))
 		return;
 
 	log_info("Searching for hash collisions in %s lookup table", name);
 
-	// Do a linear search to find hash collisions in the sorted array
-	unsigned int collisions = 0, errors = 0;
-	for(size_t i = 1; i < *size; i++)
+	unsigned int collisions = 0, errors = 0, elements = 0, longest = 0;
+	for(unsigned int i = 0; i < capacity; i++)
 	{
-		// If the hash value of the current element is the same as the previous element
-		if(table[i].hash == table[i - 1].hash)
+		if(table[i].id == LOOKUP_EMPTY)
+			continue;
+
+		elements++;
+		const unsigned int dist = probe_distance(&table[i], i, capacity);
+		if(dist > longest)
+			longest = dist;
+
+		// The previous slot has to be occupied by an element which is
+		// displaced by at least dist - 1 slots, otherwise this element
+		// cannot be found by lookup_find_id()
+		const unsigned int prev = i > 0 ? i - 1 : capacity - 1;
+		if(dist > 0 && (table[prev].id == LOOKUP_EMPTY ||
+		                probe_distance(&table[prev], prev, capacity) + 1 < dist))
+		{
+			log_err("Element at position %u (ID %u, hash %"PRIu32") is misplaced (probe distance %u)",
+			        i, table[i].id, table[i].hash, dist);
+			errors++;
+		}
+
+		// Compare against the following elements sharing the same home
+		// slot, elements with identical hashes are always found here
+		const unsigned int home = home_slot(table[i].hash, capacity);
+		for(unsigned int j = next_slot(i, capacity);
+		    j != i && table[j].id != LOOKUP_EMPTY && home_slot(table[j].hash, capacity) == home;
+		    j = next_slot(j, capacity))
 		{
-			// Get the corresponding ID of the previous and this element
-			unsigned int id1 = table[i - 1].id;
-			unsigned int id2 = table[i].id;
+			if(table[j].hash != table[i].hash)
+				continue;
+
+			// Get the corresponding ID of both elements
+			const unsigned int id1 = table[i].id;
+			const unsigned int id2 = table[j].id;
 
 			if(type == CLIENTS_LOOKUP)
 			{
@@ -413,8 +505,8 @@ static void lookup_find_hash_collisions_table(const enum memory_type type)
 				const char *name1 = client1 ? getstr(client1->namepos) : "<invalid>";
 				const char *name2 = client2 ? getstr(client2->namepos) : "<invalid>";
 
-				log_info("Hash collision %"PRIu32" found at position %zu/%zu between client IDs %u (%s) and %u (%s)",
-				         table[i].hash, i - 1, i, id1, name1, id2, name2);
+				log_info("Hash collision %"PRIu32" found at position %u/%u between client IDs %u (%s) and %u (%s)",
+				         table[i].hash, i, j, id1, name1, id2, name2);
 			}
 			else if(type == DOMAINS_LOOKUP)
 			{
@@ -422,11 +514,11 @@ static void lookup_find_hash_collisions_table(const enum memory_type type)
 				const domainsData *domain1 = getDomain(id1, true);
 				const domainsData *domain2 = getDomain(id2, true);
 
-				const char *name1 = domain1 ? getstr(domain1->domainpos) : "<invalid>";
-				const char *name2 = domain2 ? getstr(domain2->domainpos) : "<invalid>";
+				const char *name1 = domain1 ? getDomainName(domain1) : "<invalid>";
+				const char *name2 = domain2 ? getDomainName(domain2) : "<invalid>";
 
-				log_info("Hash collision %"PRIu32" found at position %zu/%zu between domain IDs %u (%s) and %u (%s)",
-				         table[i].hash, i - 1, i, id1, name1, id2, name2);
+				log_info("Hash collision %"PRIu32" found at position %u/%u between domain IDs %u (%s) and %u (%s)",
+				         table[i].hash, i, j, id1, name1, id2, name2);
 			}
 			else if(type == DNS_CACHE_LOOKUP)
 			{
@@ -434,36 +526,56 @@ static void lookup_find_hash_collisions_table(const enum memory_type type)
 				const DNSCacheData *cache1 = getDNSCache(id1, true);
 				const DNSCacheData *cache2 = getDNSCache(id2, true);
 
-				log_info("Hash collision %"PRIu32" found at position %zu/%zu between DNS cache IDs %u (%u/%u/%u) and %u (%u/%u/%u)",
-				         table[i].hash, i - 1, i,
-				         id1, cache1->clientID, cache1->domainID, cache1->query_type,
-				         id2, cache2->clientID, cache2->domainID, cache2->query_type);
+				if(cache1 != NULL && cache2 != NULL)
+					log_info("Hash collision %"PRIu32" found at position %u/%u between DNS cache IDs %u (%u/%u/%u) and %u (%u/%u/%u)",
+					         table[i].hash, i, j,
+					         id1, cache1->clientID, cache1->domainID, cache1->query_type,
+					         id2, cache2->clientID, cache2->domainID, cache2->query_type);
+			}
+			else if(type == STRINGS_LOOKUP)
+			{
+				// Get and log the correlated strings (strings lookup only)
+				log_info("Hash collision %"PRIu32" found at position %u/%u between strings at %u (%s) and %u (%s)",
+				         table[i].hash, i, j, id1, getstr(id1), id2, getstr(id2));
+			}
+			else if(type == SUFFIXES_LOOKUP)
+			{
+				// Get and log the correlated labels (domain suffixes only)
+				const char *label1 = id1 < counters->suffixes ? getstr(domain_suffixes[id1].labelpos) : "<invalid>";
+				const char *label2 = id2 < counters->suffixes ? getstr(domain_suffixes[id2].labelpos) : "<invalid>";
+
+				log_info("Hash collision %"PRIu32" found at position %u/%u between suffix nodes %u (%s) and %u (%s)",
+				         table[i].hash, i, j, id1, label1, id2, label2);
+			}
+			else if(type == UPSTREAMS_LOOKUP)
+			{
+				// Get and log the correlated addresses (upstreams lookup only)
+				const upstreamsData *upstream1 = getUpstream(id1, true);
+				const upstreamsData *upstream2 = getUpstream(id2, true);
+
+				if(upstream1 != NULL && upstream2 != NULL)
+					log_info("Hash collision %"PRIu32" found at position %u/%u between upstream IDs %u (%s#%u) and %u (%s#%u)",
+					         table[i].hash, i, j,
+					         id1, getstr(upstream1->ippos), upstream1->port,
+					         id2, getstr(upstream2->ippos), upstream2->port);
 			}
 
 			collisions++;
 		}
-		else if(table[i].hash < table[i - 1].hash)
-		{
-			// Log an error if the array is not sorted, the equality
-			// check was already done in the previous if statement
-			//
-			// This is really an error as, when the array is not
-			// sorted, the binary search algorithm will not be able
-			// to find elements possibly even causing artificial
-			// hash collisions above as the same entry might be
-			// inserted multiple times
-			log_err("Array is not sorted at position %zu/%zu: %"PRIu32" > %"PRIu32,
-			        i - 1, i, table[i - 1].hash, table[i].hash);
+	}
 
-			errors++;
-		}
+	if(elements != *size)
+	{
+		log_err("%s lookup table should contain %u elements but %u were found",
+		        name, *size, elements);
+		errors++;
 	}
 
 	// Log results, if there are any collisions or errors, log as error,
 	// otherwise as info message
 	const int priority = collisions > 0 || errors > 0 ? LOG_ERR : LOG_INFO;
-	log_lvl(priority, "Found %u hash collisions and %u sorting errors in %s lookup table (scanned %u elements)",
-	        collisions, errors, name, *size);
+	log_lvl(priority, "Found %u hash collisions and %u placement errors in %s lookup table (scanned %u elements in %u slots, longest probe %u)",
+	        collisions, errors, name, elements, capacity, longest);
 }
 
 /**
@@ -481,4 +593,13 @@ void lookup_find_hash_collisions(void)
 
 	// Search for hash collisions in the DNS cache lookup table
 	lookup_find_hash_collisions_table(DNS_CACHE_LOOKUP);
+
+	// Search for hash collisions in the strings lookup table
+	lookup_find_hash_collisions_table(STRINGS_LOOKUP);
+
+	// Search for hash collisions in the domain suffixes lookup table
+	lookup_find_hash_collisions_table(SUFFIXES_LOOKUP);
+
+	// Search for hash collisions in the upstreams lookup table
+	lookup_find_hash_collisions_table(UPSTREAMS_LOOKUP);
 }
@@ -15,6 +15,8 @@
 #include <stddef.h>
 // uint32_t
 #include <stdint.h>
+// UINT_MAX
+#include <limits.h>
 // memmove
 #include <string.h>
 // enum memory_type
@@ -26,13 +28,14 @@
 
 /**
  * @struct lookup_table
- * @brief A structure to hold binary search data.
+ * @brief A slot of an open-addressing lookup table.
  *
- * This structure is used to store data for binary search operations.
- * It contains an identifier and a hash value.
+ * This structure is used to store the elements of the shared memory hash
+ * tables used to find clients, domains, and DNS cache entries. It contains an
+ * identifier and a hash value.
  *
  * @var lookup_table::id
- * The identifier for the data.
+ * The identifier for the data, LOOKUP_EMPTY marks a free slot.
  *
  * @var lookup_table::hash
  * The hash value associated with the data.
@@ -42,6 +45,16 @@ struct lookup_table {
 	uint32_t hash;
 };
 
+// ID marking a free slot. This is never a valid ID as IDs are array indices
+#define LOOKUP_EMPTY UINT_MAX
+
+// Maximum load factor (in percent) before shm_ensure_size() grows a table
+#define LOOKUP_MAX_LOAD 75u
+// Check if a lookup table with the given size and capacity needs to be grown
+#define LOOKUP_NEEDS_RESIZE(size, capacity) ((uint64_t)(size) * 100u >= (uint64_t)(capacity) * LOOKUP_MAX_LOAD)
+
+void lookup_init(const enum memory_type type);
+bool lookup_rehash(const enum memory_type type, const unsigned int old_capacity);
 bool lookup_insert(const enum memory_type type, const unsigned int id, const uint32_t hash);
 bool lookup_remove(const enum memory_type type, const unsigned int id, const uint32_t hash);
 bool lookup_find_id(const enum memory_type type, const uint32_t hash, const struct lookup_data *lookup_data,
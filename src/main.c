@@ -27,10 +27,16 @@
 #include "overTime.h"
 // export_queries_to_disk()
 #include "database/query-table.h"
+// store_final_list_hits()
+#include "database/list-hits.h"
 // verify_FTL()
 #include "files.h"
 // init_entropy()
 #include "webserver/x509.h"
+// init_alloc_stats()
+#include "syscalls/alloc-stats.h"
+// init_json_arena()
+#include "webserver/json-arena.h"
 
 char *username;
 bool startup = true;
@@ -39,6 +45,14 @@ jmp_buf exit_jmp;
 
 int main (int argc, char *argv[])
 {
+	// Start attributing heap memory to the code allocating it. This has to
+	// happen before any thread is started
+	init_alloc_stats();
+
+	// Allocate the cJSON objects of API requests from an arena. This has to
+	// happen before any cJSON object is allocated
+	init_json_arena();
+
 	// Initialize locale (needed for libidn)
 	init_locale();
 
@@ -76,6 +90,7 @@ int main (int argc, char *argv[])
 	// settings are present and have a valid value
 	if(readFTLconf(&config, true))
 		log_info("Parsed config file "GLOBALTOMLPATH" successfully");
+	startup_stage("config");
 
 	// Check if another FTL process is already running
 	if(another_FTL())
@@ -90,6 +105,7 @@ int main (int argc, char *argv[])
 		log_crit("Initialization of shared memory failed.");
 		return EXIT_FAILURE;
 	}
+	startup_stage("shmem");
 
 	// pihole-FTL should really be run as user "pihole" to not mess up with file permissions
 	// print warning otherwise
@@ -105,6 +121,7 @@ int main (int argc, char *argv[])
 	// useful for interfaces that aren't ready but also for fake-hwclocks
 	// which aren't ready at this point
 	delay_startup();
+	startup_stage("delay");
 
 	// Initialize overTime datastructure
 	initOverTime();
@@ -151,6 +168,7 @@ int main (int argc, char *argv[])
 
 	// Save new queries to database
 	export_queries_to_disk(true);
+	store_final_list_hits();
 	log_info("Finished final database update");
 
 	cleanup(exit_code);
@@ -52,6 +52,11 @@ struct metrics
 			int inserted;
 			// <expired> cache entries (to be removed when space is needed)
 			int expired;
+			// <expired_freed> entries were removed after the end of their
+			// time-to-live, <flushed> entries were dropped when the cache was
+			// flushed (or shrunk)
+			int expired_freed;
+			int flushed;
 			// <immortal> cache records never expire (e.g. from /etc/hosts)
 			int immortal;
 			// <content> are cache entries with positive remaining TTL
@@ -60,6 +65,13 @@ struct metrics
 				int count[CACHE_LIVE_MAX]; // 0 = valid, 1 = stale
 			} content[RRTYPES];
 		} cache;
+		// Record pools backing the cache and the forwarding table,
+		// <used> records are handed out, <allocated> are reserved
+		struct pool {
+			unsigned int used;
+			unsigned int hwm;
+			unsigned int allocated;
+		} blockdata, bignames, frecs;
 		int local_answered;
 		int forwarded_queries;
 		int stale_answered;
@@ -0,0 +1,572 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Aggressive use of DNSSEC-validated cache
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file nsec-cache.c
+ * @brief Synthesize negative answers from validated NSEC records (RFC 8198)
+ *
+ * An NSEC record proves that no name exists between its owner and the next
+ * name in the zone (in canonical order, RFC 4034, Section 6.1) and lists the
+ * types existing at its owner. Validated NSEC records found in the authority
+ * section of secure replies are kept per zone (the signer of the record) in
+ * arrays sorted by owner name. Before a query is forwarded, the record
+ * preceding the queried name is found by binary search:
+ *
+ *  - If the record's owner is the queried name and the type is not listed,
+ *    the name exists but has no data of this type (NODATA).
+ *  - If the queried name lies between owner and next name and another record
+ *    proves that no wildcard exists at the closest encloser, the name does not
+ *    exist (NXDOMAIN).
+ *
+ * Records at delegation points (NS but no SOA) and DNAME records do not prove
+ * anything about names below them. NSEC3 records are not used, they would
+ * require hashing every queried name. Only the window of the type bitmap
+ * covering types 0 - 255 is stored, NODATA is never synthesized for other
+ * types.
+ *
+ * The table is private to each process handling queries and bounded, the
+ * zone used least recently is replaced when a new zone does not fit. Within a
+ * zone, the record expiring first is replaced.
+ */
+
+#define FTLDNS
+#include "dnsmasq/dnsmasq.h"
+#undef __USE_XOPEN
+#include "FTL.h"
+#include "nsec-cache.h"
+// config
+#include "config/config.h"
+// log_debug()
+#include "log.h"
+
+// Number of zones we keep NSEC records for
+#define NSEC_ZONES 64u
+// Number of NSEC records kept per zone
+#define NSEC_RANGES 64u
+// Size of the first window of the type bitmap (types 0 - 255)
+#define NSEC_BITMAP_SIZE 32u
+
+struct nsec_range {
+	char *owner;
+	char *next;
+	time_t expires;
+	unsigned char bitmap[NSEC_BITMAP_SIZE];
+};
+
+struct nsec_zone {
+	char *name;
+	uint32_t hash;
+	time_t last_used;
+	unsigned int count;
+	struct nsec_range ranges[NSEC_RANGES];
+};
+
+static struct nsec_zone *zones = NULL;
+
+// Scratch space for names extracted from packets
+static char owner_buf[MAXDNAME], next_buf[MAXDNAME], signer_buf[MAXDNAME], name_buf[MAXDNAME];
+
+static uint32_t __attribute__((pure)) zone_hash(const char *name, const size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Convert a name to lower case in place. Names containing characters dnsmasq
+// escapes in its presentation format are rejected, their canonical order
+// cannot be determined from the escaped form
+static bool normalize_name(char *name)
+{
+	for(char *p = name; *p != '\0'; p++)
+	{
+		if(*p == NAME_ESCAPE)
+			return false;
+		if(*p >= 'A' && *p <= 'Z')
+			*p += 'a' - 'A';
+	}
+	return true;
+}
+
+// Canonical DNS name order (RFC 4034, Section 6.1) of two lower-case names:
+// labels are compared from right to left as octet strings
+static int __attribute__((pure)) canonical_cmp(const char *a, const char *b)
+{
+	const char *ea = a + strlen(a), *eb = b + strlen(b);
+
+	while(true)
+	{
+		// Find the start of the current label of both names
+		const char *sa = ea, *sb = eb;
+		while(sa > a && sa[-1] != '.')
+			sa--;
+		while(sb > b && sb[-1] != '.')
+			sb--;
+
+		// Compare labels
+		const size_t la = ea - sa, lb = eb - sb;
+		const int cmp = memcmp(sa, sb, la < lb ? la : lb);
+		if(cmp != 0)
+			return cmp;
+		if(la != lb)
+			return la < lb ? -1 : 1;
+
+		// All labels are equal so far, the name with fewer labels
+		// sorts first
+		if(sa == a || sb == b)
+			return (sa == a ? 0 : 1) - (sb == b ? 0 : 1);
+
+		// Skip the dot preceding the label
+		ea = sa - 1;
+		eb = sb - 1;
+	}
+}
+
+// Is name equal to or below zone?
+static bool __attribute__((pure)) name_in_zone(const char *name, const char *zone)
+{
+	const size_t nlen = strlen(name), zlen = strlen(zone);
+	if(zlen == 0)
+		return true;
+	if(nlen < zlen || strcmp(name + nlen - zlen, zone) != 0)
+		return false;
+	return nlen == zlen || name[nlen - zlen - 1] == '.';
+}
+
+// Is name strictly below ancestor?
+static bool __attribute__((pure)) below(const char *name, const char *ancestor)
+{
+	return strcmp(name, ancestor) != 0 && name_in_zone(name, ancestor);
+}
+
+// Longest common ancestor of a and b, returned as a suffix of a
+static const char *common_ancestor(const char *a, const char *b)
+{
+	const char *ea = a + strlen(a), *eb = b + strlen(b);
+	const char *ancestor = ea;
+
+	while(ea > a && eb > b)
+	{
+		const char *sa = ea, *sb = eb;
+		while(sa > a && sa[-1] != '.')
+			sa--;
+		while(sb > b && sb[-1] != '.')
+			sb--;
+
+		if(ea - sa != eb - sb || memcmp(sa, sb, ea - sa) != 0)
+			break;
+		ancestor = sa;
+
+		if(sa == a || sb == b)
+			break;
+		ea = sa - 1;
+		eb = sb - 1;
+	}
+
+	return ancestor;
+}
+
+static bool __attribute__((pure)) has_type(const struct nsec_range *range, const unsigned short type)
+{
+	if(type >= 8*NSEC_BITMAP_SIZE)
+		return false;
+	return range->bitmap[type / 8] & (0x80 >> (type % 8));
+}
+
+// NSEC records at delegation points are from the parent zone, they prove
+// nothing about the child zone
+static bool __attribute__((pure)) is_delegation(const struct nsec_range *range)
+{
+	return has_type(range, T_NS) && !has_type(range, T_SOA);
+}
+
+static void free_range(struct nsec_range *range)
+{
+	if(range->owner != NULL)
+		free(range->owner);
+	if(range->next != NULL)
+		free(range->next);
+	range->owner = NULL;
+	range->next = NULL;
+}
+
+static void free_zone(struct nsec_zone *zone)
+{
+	for(unsigned int i = 0; i < zone->count; i++)
+		free_range(&zone->ranges[i]);
+	if(zone->name != NULL)
+		free(zone->name);
+	memset(zone, 0, sizeof(*zone));
+}
+
+// Find a zone by name
+static struct nsec_zone *find_zone(const char *name, const size_t len)
+{
+	const uint32_t hash = zone_hash(name, len);
+	for(unsigned int i = 0; i < NSEC_ZONES; i++)
+	{
+		struct nsec_zone *zone = &zones[i];
+		if(zone->name != NULL && zone->hash == hash &&
+		   strlen(zone->name) == len && memcmp(zone->name, name, len) == 0)
+			return zone;
+	}
+	return NULL;
+}
+
+// Index of the last record whose owner sorts before or equal to name, -1 if
+// there is none
+static int __attribute__((pure)) predecessor(const struct nsec_zone *zone, const char *name)
+{
+	int lo = 0, hi = (int)zone->count - 1, found = -1;
+	while(lo <= hi)
+	{
+		const int mid = lo + (hi - lo) / 2;
+		if(canonical_cmp(zone->ranges[mid].owner, name) <= 0)
+		{
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+			hi = mid - 1;
+	}
+	return found;
+}
+
+static void add_range(const char *signer, const char *owner, const char *next,
+                      const unsigned char bitmap[NSEC_BITMAP_SIZE],
+                      const unsigned long ttl, const time_t now)
+{
+	if(zones == NULL && (zones = calloc(NSEC_ZONES, sizeof(*zones))) == NULL)
+		return;
+
+	struct nsec_zone *zone = find_zone(signer, strlen(signer));
+	if(zone == NULL)
+	{
+		// Use a free slot or replace the zone used least recently
+		zone = &zones[0];
+		for(unsigned int i = 0; i < NSEC_ZONES && zone->name != NULL; i++)
+			if(zones[i].name == NULL || zones[i].last_used < zone->last_used)
+				zone = &zones[i];
+		free_zone(zone);
+
+		if((zone->name = strdup(signer)) == NULL)
+			return;
+		zone->hash = zone_hash(signer, strlen(signer));
+	}
+	zone->last_used = now;
+
+	char *owner_copy = strdup(owner), *next_copy = strdup(next);
+	if(owner_copy == NULL || next_copy == NULL)
+	{
+		if(owner_copy != NULL)
+			free(owner_copy);
+		if(next_copy != NULL)
+			free(next_copy);
+		return;
+	}
+
+	int idx = predecessor(zone, owner);
+	struct nsec_range *range = NULL;
+	if(idx >= 0 && strcmp(zone->ranges[idx].owner, owner) == 0)
+	{
+		// Replace record with the same owner
+		range = &zone->ranges[idx];
+		free_range(range);
+	}
+	else
+	{
+		if(zone->count == NSEC_RANGES)
+		{
+			// Remove the record expiring first
+			unsigned int victim = 0;
+			for(unsigned int i = 1; i < zone->count; i++)
+				if(zone->ranges[i].expires < zone->ranges[victim].expires)
+					victim = i;
+			free_range(&zone->ranges[victim]);
+			memmove(&zone->ranges[victim], &zone->ranges[victim + 1],
+			        (zone->count - victim - 1) * sizeof(*zone->ranges));
+			zone->count--;
+			idx = predecessor(zone, owner);
+		}
+
+		// Insert after the predecessor
+		const unsigned int pos = idx + 1;
+		memmove(&zone->ranges[pos + 1], &zone->ranges[pos],
+		        (zone->count - pos) * sizeof(*zone->ranges));
+		zone->count++;
+		range = &zone->ranges[pos];
+		memset(range, 0, sizeof(*range));
+	}
+
+	range->owner = owner_copy;
+	range->next = next_copy;
+	range->expires = now + ttl;
+	memcpy(range->bitmap, bitmap, NSEC_BITMAP_SIZE);
+
+	log_debug(DEBUG_QUERIES, "Stored NSEC %s -> %s of zone \"%s\" (TTL %lu)",
+	          owner, next, signer, ttl);
+}
+
+// Find the signer of the NSEC record owned by owner_buf in the authority
+// section
+static bool find_signer(struct dns_header *header, const size_t plen, unsigned char *auth)
+{
+	unsigned char *p = auth;
+	for(unsigned int i = 0; i < ntohs(header->nscount); i++)
+	{
+		unsigned short type, class, rdlen, covered;
+		if(!extract_name(header, plen, &p, name_buf, EXTR_NAME_EXTRACT, 10))
+			return false;
+		GETSHORT(type, p);
+		GETSHORT(class, p);
+		p += 4; // TTL
+		GETSHORT(rdlen, p);
+
+		unsigned char *rdata = p;
+		if(!ADD_RDLEN(header, p, plen, rdlen))
+			return false;
+		if(type != T_RRSIG || class != C_IN || rdlen < 18 ||
+		   !normalize_name(name_buf) || strcmp(name_buf, owner_buf) != 0)
+			continue;
+
+		GETSHORT(covered, rdata);
+		if(covered != T_NSEC)
+			continue;
+
+		// Skip algorithm, labels, original TTL, expiration, inception
+		// and key tag
+		rdata += 16;
+		if(!extract_name(header, plen, &rdata, signer_buf, EXTR_NAME_EXTRACT, 0))
+			return false;
+		return normalize_name(signer_buf);
+	}
+	return false;
+}
+
+/**
+ * Store the validated NSEC records of a reply. Called for every reply
+ * validated as secure while daemon->rr_status still describes it.
+ *
+ * @param header DNS reply
+ * @param plen Length of the reply
+ * @param now Current time
+ */
+void FTL_nsec_store(struct dns_header *header, const size_t plen, const time_t now)
+{
+	if(!config.dns.cache.aggressiveNSEC.v.b || ntohs(header->nscount) == 0)
+		return;
+
+	unsigned char *p = skip_questions(header, plen);
+	if(p == NULL || (p = skip_section(p, ntohs(header->ancount), header, plen)) == NULL)
+		return;
+	unsigned char *auth = p;
+
+	// RFC 8198, Section 5.4: Limit the TTL of records to the SOA MINIMUM
+	unsigned long soa_ttl = ULONG_MAX;
+	for(unsigned int i = 0; i < ntohs(header->nscount); i++)
+	{
+		unsigned short type, class, rdlen;
+		unsigned long ttl;
+		if(!(p = skip_name(p, header, plen, 10)))
+			return;
+		GETSHORT(type, p);
+		GETSHORT(class, p);
+		GETLONG(ttl, p);
+		GETSHORT(rdlen, p);
+		unsigned char *rdata = p;
+		if(!ADD_RDLEN(header, p, plen, rdlen))
+			return;
+
+		if(type != T_SOA || class != C_IN)
+			continue;
+
+		// Skip MNAME and RNAME, SERIAL, REFRESH, RETRY and EXPIRE
+		unsigned long minimum;
+		if(!(rdata = skip_name(rdata, header, plen, 0)) ||
+		   !(rdata = skip_name(rdata, header, plen, 20)))
+			return;
+		rdata += 16;
+		GETLONG(minimum, rdata);
+		soa_ttl = ttl < minimum ? ttl : minimum;
+	}
+
+	p = auth;
+	for(unsigned int i = 0; i < ntohs(header->nscount); i++)
+	{
+		unsigned short type, class, rdlen;
+		unsigned long ttl;
+		if(!extract_name(header, plen, &p, owner_buf, EXTR_NAME_EXTRACT, 10))
+			return;
+		GETSHORT(type, p);
+		GETSHORT(class, p);
+		GETLONG(ttl, p);
+		GETSHORT(rdlen, p);
+		unsigned char *rdata = p;
+		if(!ADD_RDLEN(header, p, plen, rdlen))
+			return;
+
+		// Only use records which have been validated
+		const int idx = ntohs(header->ancount) + (int)i;
+		if(type != T_NSEC || class != C_IN ||
+		   idx >= daemon->rr_status_sz || daemon->rr_status[idx] == 0)
+			continue;
+
+		// Next domain name (never compressed) followed by the type
+		// bitmap
+		unsigned char *end = rdata + rdlen;
+		if(!extract_name(header, plen, &rdata, next_buf, EXTR_NAME_EXTRACT, 0) ||
+		   !normalize_name(owner_buf) || !normalize_name(next_buf))
+			continue;
+
+		unsigned char bitmap[NSEC_BITMAP_SIZE] = { 0 };
+		while(rdata + 2 <= end)
+		{
+			const unsigned char window = rdata[0], len = rdata[1];
+			if(len == 0 || len > NSEC_BITMAP_SIZE || rdata + 2 + len > end)
+				break;
+			if(window == 0)
+				memcpy(bitmap, rdata + 2, len);
+			rdata += 2 + len;
+		}
+
+		// Both names have to be within the zone which signed the record
+		if(!find_signer(header, plen, auth) ||
+		   !name_in_zone(owner_buf, signer_buf) || !name_in_zone(next_buf, signer_buf))
+			continue;
+
+		// The TTL is limited by the signature and the SOA MINIMUM as well
+		// as by the configured maximum TTL of cache entries
+		if(daemon->rr_status[idx] < ttl)
+			ttl = daemon->rr_status[idx];
+		if(soa_ttl < ttl)
+			ttl = soa_ttl;
+		if(daemon->max_cache_ttl != 0 && daemon->max_cache_ttl < ttl)
+			ttl = daemon->max_cache_ttl;
+		if(ttl == 0)
+			continue;
+
+		add_range(signer_buf, owner_buf, next_buf, bitmap, ttl, now);
+	}
+}
+
+// Does the record prove that name does not exist?
+static bool covers(const struct nsec_range *range, const char *name)
+{
+	if(canonical_cmp(range->owner, name) >= 0)
+		return false;
+
+	// The last record of a zone points back to the zone's apex
+	if(canonical_cmp(range->next, range->owner) > 0 &&
+	   canonical_cmp(name, range->next) >= 0)
+		return false;
+
+	// Names below a delegation point or a DNAME are not part of this zone
+	if((is_delegation(range) || has_type(range, T_DNAME)) && below(name, range->owner))
+		return false;
+
+	return true;
+}
+
+static const struct nsec_range * __attribute__((pure)) find_range(const struct nsec_zone *zone, const char *name, const time_t now)
+{
+	const int idx = predecessor(zone, name);
+	if(idx < 0 || zone->ranges[idx].expires <= now)
+		return NULL;
+	return &zone->ranges[idx];
+}
+
+/**
+ * Check whether cached NSEC records prove that a name or the requested type
+ * does not exist.
+ *
+ * @param name Queried name
+ * @param qtype Queried type
+ * @param now Current time
+ * @return enum nsec_verdict Type of negative answer, NSEC_UNKNOWN if the query
+ * needs to be forwarded
+ */
+enum nsec_verdict nsec_cache_lookup(const char *name, const unsigned short qtype, const time_t now)
+{
+	if(zones == NULL || qtype == T_DS || qtype == T_ANY)
+		return NSEC_UNKNOWN;
+
+	const size_t len = strlen(name);
+	if(len >= sizeof(name_buf))
+		return NSEC_UNKNOWN;
+	memcpy(name_buf, name, len + 1);
+	if(!normalize_name(name_buf))
+		return NSEC_UNKNOWN;
+
+	// Find the closest zone we have records for, starting with the name
+	// itself and continuing with its ancestors up to the root zone
+	struct nsec_zone *zone = NULL;
+	const char *suffix = name_buf;
+	while((zone = find_zone(suffix, strlen(suffix))) == NULL && *suffix != '\0')
+	{
+		const char *dot = strchr(suffix, '.');
+		suffix = dot != NULL ? dot + 1 : suffix + strlen(suffix);
+	}
+	if(zone == NULL)
+		return NSEC_UNKNOWN;
+
+	const struct nsec_range *range = find_range(zone, name_buf, now);
+	if(range == NULL)
+		return NSEC_UNKNOWN;
+
+	// The name exists, check whether the type exists as well
+	if(strcmp(range->owner, name_buf) == 0)
+	{
+		if(has_type(range, qtype) || has_type(range, T_CNAME) ||
+		   is_delegation(range) || qtype >= 8*NSEC_BITMAP_SIZE)
+			return NSEC_UNKNOWN;
+
+		zone->last_used = now;
+		log_debug(DEBUG_QUERIES, "NSEC %s -> %s proves %s has no type %u",
+		          range->owner, range->next, name_buf, qtype);
+		return NSEC_NODATA;
+	}
+
+	if(!covers(range, name_buf))
+		return NSEC_UNKNOWN;
+
+	// The closest encloser is the longest existing ancestor of the name
+	const char *ce1 = common_ancestor(name_buf, range->owner);
+	const char *ce2 = common_ancestor(name_buf, range->next);
+	const char *ce = ce1 < ce2 ? ce1 : ce2;
+
+	// There must not be a wildcard at the closest encloser
+	char wildcard[MAXDNAME];
+	if(snprintf(wildcard, sizeof(wildcard), *ce == '\0' ? "*" : "*.%s", ce) >= (int)sizeof(wildcard))
+		return NSEC_UNKNOWN;
+	const struct nsec_range *wrange = find_range(zone, wildcard, now);
+	if(wrange == NULL || strcmp(wrange->owner, wildcard) == 0 || !covers(wrange, wildcard))
+		return NSEC_UNKNOWN;
+
+	zone->last_used = now;
+	log_debug(DEBUG_QUERIES, "NSEC %s -> %s proves %s does not exist (wildcard %s denied by %s -> %s)",
+	          range->owner, range->next, name_buf, wildcard, wrange->owner, wrange->next);
+	return NSEC_NXDOMAIN;
+}
+
+/**
+ * Forget all NSEC records, e.g., when the DNS cache is cleared
+ */
+void nsec_cache_flush(void)
+{
+	if(zones == NULL)
+		return;
+
+	for(unsigned int i = 0; i < NSEC_ZONES; i++)
+		free_zone(&zones[i]);
+}
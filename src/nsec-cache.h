@@ -0,0 +1,28 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Aggressive use of DNSSEC-validated cache prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef NSEC_CACHE_H
+#define NSEC_CACHE_H
+
+// time_t
+#include <time.h>
+
+struct dns_header;
+
+enum nsec_verdict {
+	NSEC_UNKNOWN,
+	NSEC_NXDOMAIN,
+	NSEC_NODATA
+} __attribute__ ((packed));
+
+void FTL_nsec_store(struct dns_header *header, const size_t plen, const time_t now);
+enum nsec_verdict nsec_cache_lookup(const char *name, const unsigned short qtype, const time_t now);
+void nsec_cache_flush(void);
+
+#endif //NSEC_CACHE_H
@@ -43,6 +43,8 @@
 #include "capabilities.h"
 // search_proc()
 #include "procps.h"
+// poll()
+#include <poll.h>
 
 // Required accuracy of the NTP sync in seconds in order to start the NTP server
 // thread. If the NTP sync is less accurate than this value, the NTP server
@@ -57,14 +59,49 @@
 // Maximum number of NTP syncs to attempt before giving up
 #define RETRY_ATTEMPTS 5
 
+// Maximum number of server addresses queried concurrently
+#define NTP_MAX_PEERS 8
+// Time to wait for outstanding replies after the last request in seconds
+#define NTP_TIMEOUT 5.0
+// Minimum number of servers kept by the cluster algorithm (RFC 5905, NMIN)
+#define NTP_MIN_SURVIVORS 3
+
 struct ntp_sync
 {
 	bool valid;
+	uint8_t stratum;
 	uint64_t org;
 	uint64_t xmt;
 	double theta;
 	double delta;
 	double precision;
+	double root_distance;
+};
+
+// One address of a (possibly multi-homed) NTP server
+struct ntp_peer
+{
+	bool kissed;
+	bool survivor;
+	uint8_t stratum;
+	int fd;
+	unsigned int sent;
+	socklen_t addrlen;
+	const char *server;
+	struct ntp_sync *samples;
+	double offset;
+	double delay;
+	double jitter;
+	double distance;
+	struct sockaddr_storage addr;
+	char ip[INET6_ADDRSTRLEN];
+};
+
+// Endpoint of a correctness interval used by the selection algorithm
+struct ntp_edge
+{
+	double value;
+	int type;
 };
 
 // Kiss codes as defined in RFC 5905, Section 7.4
@@ -92,7 +129,7 @@ static struct {
 
 // Create minimal NTP request, see server implementation for details about the
 // packet structure
-static bool request(int fd, const char *server, struct addrinfo *saddr, struct ntp_sync *ntp)
+static bool request(struct ntp_peer *peer)
 {
 	// NTP Packet buffer
 	unsigned char buf[48] = {0};
@@ -108,23 +145,20 @@ static bool request(int fd, const char *server, struct addrinfo *saddr, struct n
 	memset(&buf[8], 0, sizeof(uint64_t));
 
 	// Set Origin Timestamp (org) in NTP format
+	struct ntp_sync *ntp = &peer->samples[peer->sent];
 	ntp->org = gettime64();
 	const uint64_t norg = hton64(ntp->org);
 	memcpy(&buf[40], &norg, sizeof(norg));
 
 	// Send request
-	if(send(fd, buf, 48, 0) != 48)
+	if(sendto(peer->fd, buf, 48, 0, (struct sockaddr *)&peer->addr, peer->addrlen) != 48)
 	{
-		// Get IP address of server
-		char ip[INET6_ADDRSTRLEN] = { 0 };
-		if(getnameinfo(saddr->ai_addr, saddr->ai_addrlen, ip, sizeof(ip), NULL, 0, NI_NUMERICHOST) != 0)
-			strncpy(ip, server, sizeof(ip) - 1);
-
 		log_err("Failed to send data to NTP server %s (%s): %s",
-		        server, ip, errno == EAGAIN ? "Timeout" : strerror(errno));
+		        peer->server, peer->ip, strerror(errno));
 		return false;
 	}
 
+	peer->sent++;
 	return true;
 }
 
@@ -257,23 +291,10 @@ static bool settime_skew(const double offset)
 	return true;
 }
 
-static bool reply(const int fd, const char *server, struct addrinfo *saddr, struct ntp_sync *ntp)
+// Parse the reply to the request ntp, dst is the time the reply arrived
+static bool reply(const unsigned char buf[48], const uint64_t dst, struct ntp_peer *peer, struct ntp_sync *ntp)
 {
-	// NTP Packet buffer
-	unsigned char buf[48];
-
-	// Receive reply
-	if(recv_nowarn(fd, buf, 48, 0) < 48)
-	{
-		// Get IP address of server
-		char ip[INET6_ADDRSTRLEN] = { 0 };
-		if(getnameinfo(saddr->ai_addr, saddr->ai_addrlen, ip, sizeof(ip), NULL, 0, NI_NUMERICHOST) != 0)
-			strncpy(ip, server, sizeof(ip) - 1);
-
-		log_err("Failed to receive data from NTP server %s (%s): %s",
-		        server, ip, errno == EAGAIN ? "Timeout" : strerror(errno));
-		return false;
-	}
+	log_debug(DEBUG_NTP, "Received NTP reply from %s (%s)", peer->server, peer->ip);
 
 	// Extract precision of server clock
 	signed char rho = (signed char)buf[3];
@@ -309,9 +330,6 @@ static bool reply(const int fd, const char *server, struct addrinfo *saddr, stru
 		log_warn("Received NTP reply has zero reference timestamp, server is not synchronized, ignoring");
 		return false;
 	}
-	// org = Origin Timestamp (Transmit Timestamp @ Client)
-	memcpy(&netbuffer, &buf[24], sizeof(netbuffer));
-	const uint64_t org = ntoh64(netbuffer);
 	// rec = Receive Timestamp (Receive Timestamp @ Server)
 	memcpy(&netbuffer, &buf[32], sizeof(netbuffer));
 	const uint64_t rec = ntoh64(netbuffer);
@@ -319,20 +337,6 @@ static bool reply(const int fd, const char *server, struct addrinfo *saddr, stru
 	memcpy(&netbuffer, &buf[40], sizeof(netbuffer));
 	ntp->xmt = ntoh64(netbuffer);
 
-	// dst = Destination Timestamp (Receive Timestamp @ Client)
-	uint64_t dst = gettime64();
-
-	// Check org_ and org are identical (otherwise, the reply corresponds to
-	// a different request and should be ignored), note that the byte order
-	// of the received packet is already converted while org_ is still in
-	// network byte order
-	if(ntp->org != org)
-	{
-		log_warn("Received NTP reply does not match request (request %"PRIx64", reply %"PRIx64"), ignoring",
-		         ntp->org, org);
-		return false;
-	}
-
 	// Check stratum, mode, version, etc.
 	if((buf[0] & 0x07) != 4)
 	{
@@ -341,8 +345,9 @@ static bool reply(const int fd, const char *server, struct addrinfo *saddr, stru
 		{
 			if(memcmp(kiss_code, kiss_codes[i].code, sizeof(kiss_code)) == 0)
 			{
-				log_warn("Received NTP reply has Kiss code %s: %s, ignoring",
-				         kiss_codes[i].code, kiss_codes[i].meaning);
+				log_warn("Received NTP reply from %s has Kiss code %s: %s, ignoring server",
+				         peer->ip, kiss_codes[i].code, kiss_codes[i].meaning);
+				peer->kissed = true;
 				return false;
 			}
 		}
@@ -370,7 +375,13 @@ static bool reply(const int fd, const char *server, struct addrinfo *saddr, stru
 		return false;
 	}
 
-	ntp_stratum = buf[1] + 1;
+	ntp->stratum = buf[1];
+
+	// Root distance of the server (half its root delay plus its root
+	// dispersion)
+	const uint32_t root_delay = ntohl(srv_root_delay);
+	const uint32_t root_dispersion = ntohl(srv_root_dispersion);
+	ntp->root_distance = FP2D(root_delay) / 2 + FP2D(root_dispersion);
 
 	// Calculate delay and offset
 	const double T1 = ntp->org / FRAC;
@@ -420,19 +431,16 @@ static bool reply(const int fd, const char *server, struct addrinfo *saddr, stru
 	// Print offset and delay
 	log_debug(DEBUG_NTP, "Time offset: %e s", ntp->theta);
 	log_debug(DEBUG_NTP, "Round-trip delay: %e s", ntp->delta);
-	const uint32_t root_delay = ntohl(srv_root_delay);
 	log_debug(DEBUG_NTP, "Root delay: %e s", FP2D(root_delay));
-	const uint32_t root_dispersion = ntohl(srv_root_dispersion);
 	log_debug(DEBUG_NTP, "Root dispersion: %e s", FP2D(root_dispersion));
 
 	return true;
 }
 
-static int getsock(const struct addrinfo *saddr)
+static int getsock(const int family)
 {
-	// Create UDP socket
-	const int protocol = saddr->ai_addrlen == sizeof(struct sockaddr_in6) ? AF_INET6 : AF_INET;
-	const int s = socket(protocol, SOCK_DGRAM, IPPROTO_UDP);
+	// Create UDP socket, it is shared by all servers of this address family
+	const int s = socket(family, SOCK_DGRAM, IPPROTO_UDP);
 	if(s == -1)
 	{
 		char errbuf[1024];
@@ -443,217 +451,475 @@ static int getsock(const struct addrinfo *saddr)
 		return -1;
 	}
 
-	// Set socket timeout to 5 seconds
-	struct timeval tv;
-	tv.tv_sec = 5;
-	tv.tv_usec = 0;
-	if(setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0)
+	// Return socket
+	return s;
+}
+
+// Resolve all addresses of the space or comma separated list of servers
+static unsigned int resolve_peers(char *servers, struct ntp_peer peers[NTP_MAX_PEERS])
+{
+	unsigned int npeers = 0;
+	char *saveptr = NULL;
+	for(char *server = strtok_r(servers, " ,", &saveptr);
+	    server != NULL && npeers < NTP_MAX_PEERS;
+	    server = strtok_r(NULL, " ,", &saveptr))
 	{
-		char errbuf[1024];
-		strncpy(errbuf, "Cannot set socket timeout: ", sizeof(errbuf));
-		strncat(errbuf, strerror(errno), sizeof(errbuf) - strlen(errbuf) - 1);
-		errbuf[sizeof(errbuf) - 1] = '\0';
-		log_ntp_message(true, false, errbuf);
-		close(s);
-		return -1;
+		// Resolve server address, port 123 is used for NTP
+		int eai;
+		struct addrinfo *saddr, hints = { 0 };
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_protocol = IPPROTO_UDP;
+		if((eai = getaddrinfo(server, "123", &hints, &saddr)) != 0)
+		{
+			char errbuf[1024];
+			strncpy(errbuf, "Cannot resolve NTP server address: ", sizeof(errbuf));
+			strncat(errbuf, errno == EAI_SYSTEM ? strerror(errno) : gai_strerror(eai),
+			        sizeof(errbuf) - strlen(errbuf) - 1);
+			if(eai == EAI_NONAME || eai == EAI_NODATA)
+			{
+				strncat(errbuf, " \"", sizeof(errbuf) - strlen(errbuf) - 1);
+				strncat(errbuf, server, sizeof(errbuf) - strlen(errbuf) - 1);
+				strncat(errbuf, "\"", sizeof(errbuf) - strlen(errbuf) - 1);
+			}
+			errbuf[sizeof(errbuf) - 1] = '\0';
+			log_ntp_message(true, false, errbuf);
+			continue;
+		}
+
+		for(struct addrinfo *ai = saddr; ai != NULL && npeers < NTP_MAX_PEERS; ai = ai->ai_next)
+		{
+			if(ai->ai_addrlen > sizeof(peers[npeers].addr))
+				continue;
+
+			// Skip addresses listed more than once
+			bool duplicate = false;
+			for(unsigned int i = 0; i < npeers; i++)
+				if(peers[i].addrlen == ai->ai_addrlen &&
+				   memcmp(&peers[i].addr, ai->ai_addr, ai->ai_addrlen) == 0)
+					duplicate = true;
+			if(duplicate)
+				continue;
+
+			struct ntp_peer *peer = &peers[npeers++];
+			peer->server = server;
+			peer->fd = -1;
+			peer->addrlen = ai->ai_addrlen;
+			memcpy(&peer->addr, ai->ai_addr, ai->ai_addrlen);
+			if(getnameinfo(ai->ai_addr, ai->ai_addrlen, peer->ip, sizeof(peer->ip), NULL, 0, NI_NUMERICHOST) != 0)
+				strncpy(peer->ip, server, sizeof(peer->ip) - 1);
+		}
+
+		freeaddrinfo(saddr);
 	}
 
-	// Set address to send to/receive from
-	if(connect(s, saddr->ai_addr, saddr->ai_addrlen) != 0)
+	return npeers;
+}
+
+// Find the request a reply was received for
+static struct ntp_sync *find_request(struct ntp_peer *peers, const unsigned int npeers,
+                                     const struct sockaddr_storage *addr, const socklen_t addrlen,
+                                     const unsigned char buf[48], struct ntp_peer **peer)
+{
+	// org = Origin Timestamp (Transmit Timestamp @ Client)
+	uint64_t netbuffer;
+	memcpy(&netbuffer, &buf[24], sizeof(netbuffer));
+	const uint64_t org = ntoh64(netbuffer);
+
+	for(unsigned int i = 0; i < npeers; i++)
 	{
-		char errbuf[1024];
-		strncpy(errbuf, "Cannot connect to NTP server: ", sizeof(errbuf));
-		strncat(errbuf, strerror(errno), sizeof(errbuf) - strlen(errbuf) - 1);
-		errbuf[sizeof(errbuf) - 1] = '\0';
-		log_ntp_message(true, false, errbuf);
-		close(s);
-		return -1;
+		if(peers[i].addrlen != addrlen || memcmp(&peers[i].addr, addr, addrlen) != 0)
+			continue;
+
+		// The origin timestamp has to match one of our requests to
+		// this server, otherwise, the reply corresponds to a different
+		// request and is ignored
+		*peer = &peers[i];
+		for(unsigned int j = 0; j < peers[i].sent; j++)
+			if(!peers[i].samples[j].valid && peers[i].samples[j].org == org)
+				return &peers[i].samples[j];
+
+		log_warn("Received NTP reply from %s does not match any request (reply %"PRIx64"), ignoring",
+		         peers[i].ip, org);
+		return NULL;
 	}
 
-	// Return socket
-	return s;
+	return NULL;
 }
 
-bool ntp_client(const char *server, const bool settime, const bool print)
+// Receive all replies waiting on a socket, returns the number of valid replies
+static unsigned int receive_replies(const int fd, struct ntp_peer *peers, const unsigned int npeers, const bool print)
 {
-	// Resolve server address
-	int eai;
-	struct addrinfo *saddr;
-	// Resolve server address, port 123 is used for NTP
-	if((eai = getaddrinfo(server, "123", NULL, &saddr)) != 0)
+	unsigned int valid = 0;
+	while(true)
 	{
-		char errbuf[1024];
-		strncpy(errbuf, "Cannot resolve NTP server address: ", sizeof(errbuf));
-		strncat(errbuf, errno == EAI_SYSTEM ? strerror(errno) : gai_strerror(eai),
-		        sizeof(errbuf) - strlen(errbuf) - 1);
-		if(eai == EAI_NONAME || eai == EAI_NODATA)
+		// NTP Packet buffer
+		unsigned char buf[48];
+		struct sockaddr_storage addr;
+		socklen_t addrlen = sizeof(addr);
+		const ssize_t len = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&addr, &addrlen);
+
+		// dst = Destination Timestamp (Receive Timestamp @ Client)
+		const uint64_t dst = gettime64();
+
+		if(len < 0)
+			break;
+		if(len < (ssize_t)sizeof(buf))
+			continue;
+
+		struct ntp_peer *peer = NULL;
+		struct ntp_sync *ntp = find_request(peers, npeers, &addr, addrlen, buf, &peer);
+		if(ntp == NULL || !reply(buf, dst, peer, ntp))
+			continue;
+
+		valid++;
+		if(print)
 		{
-			strncat(errbuf, " \"", sizeof(errbuf) - strlen(errbuf) - 1);
-			strncat(errbuf, server, sizeof(errbuf) - strlen(errbuf) - 1);
-			strncat(errbuf, "\"", sizeof(errbuf) - strlen(errbuf) - 1);
+			printf(".");
+			fflush(stdout);
 		}
-		errbuf[sizeof(errbuf) - 1] = '\0';
-		log_ntp_message(true, false, errbuf);
-		return false;
 	}
 
-	const unsigned int count = config.ntp.sync.count.v.ui;
-	struct ntp_sync *ntp = calloc(count, sizeof(struct ntp_sync));
-	if(ntp == NULL)
-	{
-		log_err("Cannot allocate memory for NTP client");
-		return false;
-	}
+	return valid;
+}
 
-	// Send and receive NTP packets
-	for(unsigned int i = 0; i < count; i++)
+// Query all servers concurrently until count valid replies have been received
+// or all requests have been answered or timed out. Every server is sent at most
+// count requests NTP_DELAY apart to avoid flooding it
+static unsigned int collect_samples(struct ntp_peer *peers, const unsigned int npeers,
+                                    const int fds[2], const unsigned int count, const bool print)
+{
+	unsigned int valid = 0, rounds = 0;
+	struct timespec now;
+	double next_send = 0.0, deadline = 0.0;
+	while(valid < count)
 	{
-		// Create socket
-		const int s = getsock(saddr);
-		if(s == -1)
-			continue;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const double t = now.tv_sec + 1e-9*now.tv_nsec;
 
-		// Send request
-		if(!request(s, server, saddr, &ntp[i]))
+		// Send the next round of requests
+		if(rounds < count && t >= next_send)
 		{
-			close(s);
-			free(ntp);
-			freeaddrinfo(saddr);
-			return false;
+			for(unsigned int i = 0; i < npeers; i++)
+				if(peers[i].fd != -1 && !peers[i].kissed)
+					request(&peers[i]);
+			rounds++;
+			next_send = t + 1e-6*NTP_DELAY;
+			deadline = t + NTP_TIMEOUT;
 		}
-		// Get reply
-		if(!reply(s, server, saddr, &ntp[i]))
+		else if(rounds == count && t >= deadline)
+			break;
+
+		// Wait for replies until the next round is due
+		const double wait = (rounds < count ? next_send : deadline) - t;
+		struct pollfd pfds[2];
+		nfds_t nfds = 0;
+		for(unsigned int i = 0; i < 2; i++)
 		{
-			close(s);
-			continue;
+			if(fds[i] == -1)
+				continue;
+			pfds[nfds].fd = fds[i];
+			pfds[nfds].events = POLLIN;
+			pfds[nfds].revents = 0;
+			nfds++;
+		}
+		if(poll(pfds, nfds, wait > 0.0 ? (int)(1e3*wait) + 1 : 0) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			log_err("Failed to wait for NTP replies: %s", strerror(errno));
+			break;
 		}
 
-		// Close socket
-		close(s);
-
-		// Sleep for some time to avoid flooding the server
-		if(print)
-			printf(".");
-		fflush(stdout);
-		usleep(NTP_DELAY);
+		for(nfds_t i = 0; i < nfds; i++)
+			if(pfds[i].revents & POLLIN)
+				valid += receive_replies(pfds[i].fd, peers, npeers, print);
 	}
-	if(print)
-		printf("\n");
 
-	// Free allocated memory
-	freeaddrinfo(saddr);
+	return valid;
+}
 
-	// Compute average and standard deviation
-	unsigned int valid = 0;
-	double theta_avg = 0.0, theta_stdev = 0.0;
-	double delta_avg = 0.0, delta_stdev = 0.0;
-	for(unsigned int i = 0; i < count; i++)
-	{
-		// Skip invalid values
-		if(fabs(ntp[i].theta) < ntp[i].precision ||
-		   fabs(ntp[i].delta) < ntp[i].precision ||
-		   !ntp[i].valid)
+static int edge_cmp(const void *a, const void *b)
+{
+	const struct ntp_edge *ea = a, *eb = b;
+	if(ea->value < eb->value)
+		return -1;
+	if(ea->value > eb->value)
+		return 1;
+	return 0;
+}
+
+// Select the servers agreeing on the time and combine their offsets following
+// the clock filter, selection, cluster and combine algorithms of RFC 5905,
+// Section 10 and 11.2
+static bool select_peers(struct ntp_peer *peers, const unsigned int npeers, double *offset,
+                         double *delay, double *jitter, uint8_t *stratum)
+{
+	// Clock filter: use the sample with the lowest round-trip delay of each
+	// server as it is least affected by network queuing, the spread of all
+	// samples is the jitter of the server
+	unsigned int n = 0;
+	for(unsigned int i = 0; i < npeers; i++)
+	{
+		struct ntp_peer *peer = &peers[i];
+		const struct ntp_sync *best = NULL;
+		for(unsigned int j = 0; j < peer->sent; j++)
+			if(peer->samples[j].valid && (best == NULL || peer->samples[j].delta < best->delta))
+				best = &peer->samples[j];
+		if(best == NULL)
 			continue;
 
-		theta_avg += ntp[i].theta;
-		delta_avg += ntp[i].delta;
-		valid++;
+		unsigned int m = 0;
+		double sum = 0.0;
+		for(unsigned int j = 0; j < peer->sent; j++)
+		{
+			if(!peer->samples[j].valid)
+				continue;
+			sum += pow(peer->samples[j].theta - best->theta, 2);
+			m++;
+		}
+
+		peer->offset = best->theta;
+		peer->delay = best->delta;
+		peer->stratum = best->stratum;
+		peer->jitter = m > 1 ? sqrt(sum / (m - 1)) : 0.0;
+		peer->distance = best->delta / 2 + best->root_distance + best->precision + peer->jitter;
+		log_debug(DEBUG_NTP, "NTP server %s: offset %e s, delay %e s, jitter %e s, distance %e s (%u/%u replies)",
+		          peer->ip, peer->offset, peer->delay, peer->jitter, peer->distance, m, peer->sent);
+
+		// Reject servers whose time offset varies by more than 1 second
+		if(peer->jitter > 1.0)
+			continue;
+
+		peer->survivor = true;
+		n++;
 	}
 
-	if(valid == 0)
+	if(n == 0)
 	{
-		log_ntp_message(false, false, "No valid NTP replies received, check server and network connectivity");
-		free(ntp);
+		log_ntp_message(false, false, "Standard deviation of time offset is too large, rejecting synchronization");
 		return false;
 	}
-	log_info("Received %u/%u valid NTP replies from %s", valid, count, server);
 
-	theta_avg /= valid;
-	delta_avg /= valid;
-	for(unsigned int i = 0; i < count; i++)
+	// Selection: find the smallest interval containing the offsets of the
+	// majority of servers, where the offset of each server is known to be
+	// correct within its root distance (Marzullo's algorithm)
+	struct ntp_edge edges[3*NTP_MAX_PEERS];
+	unsigned int nedges = 0;
+	for(unsigned int i = 0; i < npeers; i++)
 	{
-		// Skip invalid values
-		if(fabs(ntp[i].theta) < ntp[i].precision ||
-		   fabs(ntp[i].delta) < ntp[i].precision ||
-		   !ntp[i].valid)
+		if(!peers[i].survivor)
 			continue;
-
-		theta_stdev += pow(ntp[i].theta - theta_avg, 2);
-		delta_stdev += pow(ntp[i].delta - delta_avg, 2);
+		edges[nedges++] = (struct ntp_edge){ peers[i].offset - peers[i].distance, -1 };
+		edges[nedges++] = (struct ntp_edge){ peers[i].offset, 0 };
+		edges[nedges++] = (struct ntp_edge){ peers[i].offset + peers[i].distance, 1 };
 	}
-	theta_stdev = sqrt(theta_stdev / valid);
-	delta_stdev = sqrt(delta_stdev / valid);
+	qsort(edges, nedges, sizeof(*edges), edge_cmp);
 
-	log_debug(DEBUG_NTP, "Average time offset: (%e +/- %e) s", theta_avg, theta_stdev);
-	log_debug(DEBUG_NTP, "Average round-trip delay: (%e +/- %e) s", delta_avg, delta_stdev);
+	double low = 0.0, high = 0.0;
+	unsigned int allow;
+	for(allow = 0; 2*allow < n; allow++)
+	{
+		int found = 0, chime = 0;
+		for(unsigned int i = 0; i < nedges; i++)
+		{
+			chime -= edges[i].type;
+			if(chime >= (int)(n - allow))
+			{
+				low = edges[i].value;
+				break;
+			}
+			if(edges[i].type == 0)
+				found++;
+		}
+		chime = 0;
+		for(unsigned int i = nedges; i-- > 0;)
+		{
+			chime += edges[i].type;
+			if(chime >= (int)(n - allow))
+			{
+				high = edges[i].value;
+				break;
+			}
+			if(edges[i].type == 0)
+				found++;
+		}
 
-	// Reject synchronization if the standard deviation of the time offset
-	// or round-trip delay is larger than 1 second
-	if(theta_stdev > 1.0 || delta_stdev > 1.0)
+		if(found > (int)allow)
+			continue;
+		if(high > low)
+			break;
+	}
+	if(2*allow >= n)
 	{
-		log_ntp_message(false, false, "Standard deviation of time offset is too large, rejecting synchronization");
-		free(ntp);
+		log_ntp_message(false, false, "NTP servers do not agree on the time, rejecting synchronization");
 		return false;
 	}
 
-	// Compute trimmed mean (average excluding outliers)
-	double theta_trim = 0.0, delta_trim = 0.0;
-	unsigned int trim = 0;
-	for(unsigned int i = 0; i < count; i++)
+	// Servers whose offset lies outside of the interval are falsetickers
+	for(unsigned int i = 0; i < npeers; i++)
 	{
-		// Skip invalid values
-		if(fabs(ntp[i].theta) < ntp[i].precision ||
-		   fabs(ntp[i].delta) < ntp[i].precision ||
-		   !ntp[i].valid)
+		if(!peers[i].survivor || (peers[i].offset >= low && peers[i].offset <= high))
 			continue;
+		log_debug(DEBUG_NTP, "NTP server %s is a falseticker", peers[i].ip);
+		peers[i].survivor = false;
+		n--;
+	}
 
-		// Skip outliers
-		// We consider values > 2 standard deviations from the mean as
-		// outliers
-		if(fabs(ntp[i].theta - theta_avg) > 2 * theta_stdev ||
-		   fabs(ntp[i].delta - delta_avg) > 2 * delta_stdev)
-			continue;
+	// Cluster: remove the outlier with the largest selection jitter as
+	// long as this is larger than the jitter of the most stable server
+	while(n > NTP_MIN_SURVIVORS)
+	{
+		struct ntp_peer *worst = NULL;
+		double max_phi = 0.0, min_jitter = HUGE_VAL;
+		for(unsigned int i = 0; i < npeers; i++)
+		{
+			if(!peers[i].survivor)
+				continue;
+			double phi = 0.0;
+			for(unsigned int j = 0; j < npeers; j++)
+				if(peers[j].survivor)
+					phi += pow(peers[j].offset - peers[i].offset, 2);
+			phi = sqrt(phi / (n - 1));
+			if(worst == NULL || phi > max_phi)
+			{
+				worst = &peers[i];
+				max_phi = phi;
+			}
+			if(peers[i].jitter < min_jitter)
+				min_jitter = peers[i].jitter;
+		}
+		if(worst == NULL || max_phi <= min_jitter)
+			break;
+		log_debug(DEBUG_NTP, "NTP server %s is an outlier", worst->ip);
+		worst->survivor = false;
+		n--;
+	}
 
-		theta_trim += ntp[i].theta;
-		delta_trim += ntp[i].delta;
-		trim++;
+	// Combine: average the survivors weighted by the inverse of their root
+	// distance, the system jitter combines the jitter of the best server
+	// with the spread of all survivors
+	const struct ntp_peer *best = NULL;
+	double weights = 0.0, theta = 0.0, delta = 0.0;
+	for(unsigned int i = 0; i < npeers; i++)
+	{
+		if(!peers[i].survivor)
+			continue;
+		const double weight = 1.0 / peers[i].distance;
+		weights += weight;
+		theta += weight * peers[i].offset;
+		delta += weight * peers[i].delay;
+		if(best == NULL || peers[i].distance < best->distance)
+			best = &peers[i];
 	}
+	theta /= weights;
+	delta /= weights;
+
+	double spread = 0.0;
+	for(unsigned int i = 0; i < npeers; i++)
+		if(peers[i].survivor)
+			spread += pow(peers[i].offset - theta, 2) / peers[i].distance;
+	spread /= weights;
 
-	// Free allocated memory
-	free(ntp);
+	*offset = theta;
+	*delay = delta;
+	*jitter = sqrt(pow(best->jitter, 2) + spread);
+	*stratum = best->stratum;
+
+	return true;
+}
 
-	if(trim == 0)
+bool ntp_client(const char *server, const bool settime, const bool print)
+{
+	bool success = false;
+	int fds[2] = { -1, -1 };
+	struct ntp_peer peers[NTP_MAX_PEERS] = { 0 };
+	struct ntp_sync *samples = NULL;
+
+	// Resolve server addresses
+	char *servers = strdup(server);
+	if(servers == NULL)
 	{
-		log_warn("No valid NTP replies after outlier removal, check server and network connectivity");
+		log_err("Cannot allocate memory for NTP client");
 		return false;
 	}
-	theta_trim /= trim;
-	delta_trim /= trim;
+	const unsigned int npeers = resolve_peers(servers, peers);
+	if(npeers == 0)
+		goto end;
+
+	const unsigned int count = config.ntp.sync.count.v.ui > 0 ? config.ntp.sync.count.v.ui : 1;
+	samples = calloc(npeers * count, sizeof(struct ntp_sync));
+	if(samples == NULL)
+	{
+		log_err("Cannot allocate memory for NTP client");
+		goto end;
+	}
+
+	// Create one socket for each address family and share it among all
+	// servers of this family
+	for(unsigned int i = 0; i < npeers; i++)
+	{
+		const int family = peers[i].addr.ss_family;
+		const unsigned int f = family == AF_INET6 ? 1 : 0;
+		if(fds[f] == -1)
+			fds[f] = getsock(family);
+		peers[i].fd = fds[f];
+		peers[i].samples = &samples[i * count];
+	}
+
+	// Send and receive NTP packets
+	const unsigned int valid = collect_samples(peers, npeers, fds, count, print);
+	if(print)
+		printf("\n");
+
+	if(valid == 0)
+	{
+		log_ntp_message(false, false, "No valid NTP replies received, check server and network connectivity");
+		goto end;
+	}
+	unsigned int sent = 0;
+	for(unsigned int i = 0; i < npeers; i++)
+		sent += peers[i].sent;
+	log_info("Received %u/%u valid NTP replies from %s (%u addresses)", valid, sent, server, npeers);
 
-	log_info("Time offset: %e ms (excluded %u outliers)", 1e3*theta_trim, count - trim);
-	log_info("Round-trip delay: %e ms (excluded %u outliers)", 1e3*delta_trim, count - trim);
+	// Select the servers agreeing on the time and combine their offsets
+	double offset = 0.0, delay = 0.0, jitter = 0.0;
+	uint8_t stratum = 0;
+	if(!select_peers(peers, npeers, &offset, &delay, &jitter, &stratum))
+		goto end;
+
+	unsigned int survivors = 0;
+	for(unsigned int i = 0; i < npeers; i++)
+		if(peers[i].survivor)
+			survivors++;
+
+	log_debug(DEBUG_NTP, "System jitter: %e s", jitter);
+	log_info("Time offset: %e ms (selected %u/%u addresses)", 1e3*offset, survivors, npeers);
+	log_info("Round-trip delay: %e ms (selected %u/%u addresses)", 1e3*delay, survivors, npeers);
+
+	// Our stratum is one greater than the one of the best server
+	ntp_stratum = stratum + 1;
 
 	// Set time if requested
 	if(settime)
 	{
 		// Calculate corrected time
 		struct timeval unix_time;
-		const uint64_t ntp_time = get_new_time(&unix_time, theta_trim);
+		const uint64_t ntp_time = get_new_time(&unix_time, offset);
 
 		// If the clock deviates more than 0.5 seconds from the NTP server,
 		// the time is updated immediately.  Otherwise, the time is updated
 		// gradually to avoid sudden jumps in the system clock.
 		// The threshold of 0.5 seconds is hard-wired into the kernel
 		// since Linux 2.6.26, see man ntp_adjtime(2) for details.
-		bool success;
-		if(fabs(theta_trim) > 0.5)
-			success = settime_step(&unix_time, theta_trim);
+		bool updated;
+		if(fabs(offset) > 0.5)
+			updated = settime_step(&unix_time, offset);
 		else
-			success = settime_skew(theta_trim);
+			updated = settime_skew(offset);
 
 		// Return early if time could not be set
-		if(!success)
-			return false;
+		if(!updated)
+			goto end;
 
 		// Update last NTP sync time
 		ntp_last_sync = ntp_time;
@@ -664,8 +930,8 @@ bool ntp_client(const char *server, const bool settime, const bool print)
 		// dispersion is the maximum error of the server's time relative
 		// to the reference time, while the root delay is the maximum
 		// delay of the server's time relative to the reference time
-		ntp_root_delay = D2FP(theta_trim);
-		ntp_root_dispersion = D2FP(theta_stdev);
+		ntp_root_delay = D2FP(offset);
+		ntp_root_dispersion = D2FP(jitter);
 
 		// Finally, adjust RTC if configured
 		if(config.ntp.sync.rtc.set.v.b)
@@ -674,7 +940,17 @@ bool ntp_client(const char *server, const bool settime, const bool print)
 
 	// Offset and delay larger than ACCURACY seconds are considered as invalid
 	// during local testing (e.g., when the server is on the same machine)
-	return theta_trim < ACCURACY && delta_trim < ACCURACY;
+	success = offset < ACCURACY && delay < ACCURACY;
+
+end:
+	for(unsigned int i = 0; i < 2; i++)
+		if(fds[i] != -1)
+			close(fds[i]);
+	if(samples != NULL)
+		free(samples);
+	free(servers);
+
+	return success;
 }
 
 static void *ntp_client_thread(void *arg)
@@ -682,6 +958,7 @@ static void *ntp_client_thread(void *arg)
 	(void)arg;
 	// Set thread name
 	prctl(PR_SET_NAME, thread_names[NTP_CLIENT], 0, 0, 0);
+	set_thread_placement(ROLE_BACKGROUND);
 
 	// Run NTP client
 	unsigned int retry_count = 0;
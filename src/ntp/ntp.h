@@ -29,6 +29,23 @@ void print_debug_time(const char *label, const uint32_t *u32p, const uint64_t nt
 // Start NTP server
 bool ntp_server_start(void);
 
+// Statistics of an NTP server thread, latencies are the time between the
+// kernel receiving a request and the reply being sent [microseconds]
+struct ntp_server_stats {
+	bool active;
+	uint64_t requests;
+	uint64_t replies;
+	uint64_t invalid;
+	uint64_t errors;
+	uint64_t recv_calls;
+	uint64_t send_calls;
+	uint64_t latency_sum;
+	uint64_t latency_max;
+};
+
+// Get statistics of the IPv4 (first) and IPv6 (second) NTP server
+void get_ntp_server_stats(struct ntp_server_stats stats[2]);
+
 // Start NTP client
 bool ntp_client(const char *server, const bool settime, const bool print);
 
@@ -45,11 +45,20 @@
 // sleepms()
 #include "timers.h"
 
+// Maximum number of requests received and replies sent with a single system
+// call
+#define NTP_BATCH_SIZE 32u
+// Size of an NTP packet without extension fields and MAC
+#define NTP_PACKET_SIZE 48u
+
 uint64_t ntp_last_sync = 0u;
 int32_t ntp_root_delay = 0u;
 uint32_t ntp_root_dispersion = 0u;
 uint8_t ntp_stratum = 0u;
 
+// Statistics of the IPv4 and IPv6 NTP server threads
+static struct ntp_server_stats ntp_stats[2] = { 0 };
+
 // RFC 5905 Appendix A.4: Kernel System Clock Interface
 uint64_t gettime64(void)
 {
@@ -58,13 +67,19 @@ uint64_t gettime64(void)
 	return (U2LFP(unix_time));
 }
 
-// Create and send an NTP reply to the client
-static bool ntp_reply(const int socket_fd, const struct sockaddr *saddr_p, const socklen_t saddrlen,
-                      const unsigned char recv_buf[], const uint64_t *recv_time)
+// Convert a timespec to NTP (64bit) format
+static uint64_t __attribute__((pure)) timespec2ntp(const struct timespec *ts)
 {
-	// Buffer for the response
-	unsigned char send_buf[48];
-	memset(send_buf, 0, sizeof(send_buf));
+	return ((uint64_t)(ts->tv_sec + DIFF_SEC_1900_1970) << 32) + (uint64_t)(ts->tv_nsec / 1e9 * FRAC);
+}
+
+// Create an NTP reply to the client. The transmit timestamp is left empty and
+// filled in immediately before the replies of a batch are sent
+static bool ntp_reply(unsigned char send_buf[NTP_PACKET_SIZE], const unsigned char recv_buf[NTP_PACKET_SIZE],
+                      const uint64_t recv_time)
+{
+	// Clear the response
+	memset(send_buf, 0, NTP_PACKET_SIZE);
 
 	// DWORD-aligned pointer to the send buffer
 	uint32_t *u32p = (uint32_t*)((void*)&send_buf[0]);
@@ -80,7 +95,7 @@ static bool ntp_reply(const int socket_fd, const struct sockaddr *saddr_p, const
 
  	// Check if the first byte is valid: mode is expected to be 3 ("client")
 	if ((recv_buf[0] & 0x07) != 0x3) {
-		log_warn("Received invalid NTP request: not from an NTP client, ignoring");
+		log_debug(DEBUG_NTP, "Received invalid NTP request: not from an NTP client, ignoring");
 		return false;
 	}
         // Check NTP version, log if it is an old unsupported version (< v4)
@@ -173,7 +188,7 @@ static bool ntp_reply(const int socket_fd, const struct sockaddr *saddr_p, const
 
 	// Time at the server when the request arrived from the client, in NTP
 	// timestamp format. (this is the server's receive time)
-	const uint64_t net_recv_time = hton64(*recv_time);
+	const uint64_t net_recv_time = hton64(recv_time);
 	memcpy(u32p, &net_recv_time, sizeof(uint64_t));
 	if(config.debug.ntp.v.b)
 		print_debug_time("Receive Timestamp", u32p, 0);
@@ -188,13 +203,8 @@ static bool ntp_reply(const int socket_fd, const struct sockaddr *saddr_p, const
 //      +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 
 	// Time at the server when the response left for the client, in NTP
-	// timestamp format. (this is the server's transmit time)
-	const uint64_t transmit_time = gettime64();
-	const uint64_t net_transmit_time = hton64(transmit_time);
-	memcpy(u32p, &net_transmit_time, sizeof(uint64_t));
-	if(config.debug.ntp.v.b)
-		print_debug_time("Transmit Timestamp", u32p, 0);
-	u32p += 2;
+	// timestamp format. (this is the server's transmit time). This is set
+	// in request_process_loop() right before the reply is sent
 
 //       0                   1                   2                   3
 //       0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -220,64 +230,177 @@ static bool ntp_reply(const int socket_fd, const struct sockaddr *saddr_p, const
 //
 //                      Figure 8: Packet Header Format
 
-	// Send the response
-	errno = 0;
-	if(sendto(socket_fd, send_buf, sizeof(send_buf), 0, saddr_p, saddrlen) < 48)
+	return true;
+}
+
+// Get the time the kernel received a request, fall back to the current time if
+// the request has not been timestamped
+static void get_recv_time(struct msghdr *msg, struct timespec *ts)
+{
+#ifdef SO_TIMESTAMPNS
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
 	{
-		log_err("NTP send error: %s", strerror(errno));
-		return false;
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(*ts));
+			return;
+		}
 	}
+#else
+	(void)msg;
+#endif
+	clock_gettime(CLOCK_REALTIME, ts);
+}
 
-	return true;
+// Print the source of a request
+static void print_request(const struct sockaddr_storage *src_addr)
+{
+	char ip[INET6_ADDRSTRLEN] = { 0 };
+	if(src_addr->ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)src_addr;
+		inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip));
+		log_debug(DEBUG_NTP, "Received NTP request from [%s]:%u", ip, ntohs(sin6->sin6_port));
+	}
+	else
+	{
+		const struct sockaddr_in *sin = (const struct sockaddr_in *)src_addr;
+		inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+		log_debug(DEBUG_NTP, "Received NTP request from %s:%u", ip, ntohs(sin->sin_port));
+	}
 }
 
 // Process incoming NTP requests
 static void request_process_loop(const int fd, const char *ipstr, const int protocol)
 {
+	struct ntp_server_stats *stats = &ntp_stats[protocol == AF_INET ? 0 : 1];
+
+	// Buffers for a batch of requests and their replies
+	unsigned char recv_buf[NTP_BATCH_SIZE][NTP_PACKET_SIZE];
+	unsigned char send_buf[NTP_BATCH_SIZE][NTP_PACKET_SIZE];
+	struct sockaddr_storage src_addr[NTP_BATCH_SIZE];
+	union {
+		char buf[CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control[NTP_BATCH_SIZE];
+	struct iovec recv_iov[NTP_BATCH_SIZE], send_iov[NTP_BATCH_SIZE];
+	struct mmsghdr recv_msgs[NTP_BATCH_SIZE], send_msgs[NTP_BATCH_SIZE];
+	struct timespec recv_ts[NTP_BATCH_SIZE];
+	uint64_t reply_recv_ns[NTP_BATCH_SIZE];
+
+	memset(recv_msgs, 0, sizeof(recv_msgs));
+	memset(send_msgs, 0, sizeof(send_msgs));
+	for(unsigned int i = 0; i < NTP_BATCH_SIZE; i++)
+	{
+		recv_iov[i].iov_base = recv_buf[i];
+		recv_iov[i].iov_len = NTP_PACKET_SIZE;
+		recv_msgs[i].msg_hdr.msg_iov = &recv_iov[i];
+		recv_msgs[i].msg_hdr.msg_iovlen = 1;
+		recv_msgs[i].msg_hdr.msg_name = &src_addr[i];
+		recv_msgs[i].msg_hdr.msg_control = control[i].buf;
+
+		send_iov[i].iov_base = send_buf[i];
+		send_iov[i].iov_len = NTP_PACKET_SIZE;
+		send_msgs[i].msg_hdr.msg_iov = &send_iov[i];
+		send_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
 	log_info("NTP server listening on %s:123 (%s)", ipstr, protocol == AF_INET ? "IPv4" : "IPv6");
+	__atomic_store_n(&stats->active, true, __ATOMIC_RELAXED);
 	while (true)
 	{
-		unsigned char buf[48];
-		struct sockaddr src_addr;
-		socklen_t src_addrlen = sizeof(src_addr);
-		while(recvfrom(fd, buf, sizeof(buf), 0, &src_addr, &src_addrlen) < 48);  // ignore invalid requests
-
-		// Get the current time in NTP format directly after receiving
-		// the request
-		const uint64_t recv_time = gettime64();
+		// Wait for at least one request and take all further requests
+		// which are already queued
+		for(unsigned int i = 0; i < NTP_BATCH_SIZE; i++)
+		{
+			recv_msgs[i].msg_hdr.msg_namelen = sizeof(src_addr[i]);
+			recv_msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+		}
+		const int received = recvmmsg(fd, recv_msgs, NTP_BATCH_SIZE, MSG_WAITFORONE);
+		__atomic_add_fetch(&stats->recv_calls, 1, __ATOMIC_RELAXED);
+		if(received < 1)
+		{
+			__atomic_add_fetch(&stats->errors, 1, __ATOMIC_RELAXED);
+			sleepms(100);
+			continue;
+		}
+		__atomic_add_fetch(&stats->requests, received, __ATOMIC_RELAXED);
 
-		// Print the request
-		if(config.debug.ntp.v.b)
+		// Create the replies
+		unsigned int replies = 0;
+		for(unsigned int i = 0; i < (unsigned int)received; i++)
 		{
-			if(protocol == AF_INET6)
+			// Get the time the request arrived, this is taken by
+			// the kernel if supported
+			get_recv_time(&recv_msgs[i].msg_hdr, &recv_ts[i]);
+
+			// Ignore invalid requests
+			if(recv_msgs[i].msg_len < NTP_PACKET_SIZE ||
+			   !ntp_reply(send_buf[replies], recv_buf[i], timespec2ntp(&recv_ts[i])))
 			{
-				struct sockaddr_in6 sin6;
-				memcpy(&sin6, &src_addr, sizeof(sin6));
+				__atomic_add_fetch(&stats->invalid, 1, __ATOMIC_RELAXED);
+				continue;
+			}
+
+			// Print the request
+			if(config.debug.ntp.v.b)
+				print_request(&src_addr[i]);
 
-				char ip[INET6_ADDRSTRLEN];
-				const in_port_t port = ntohs(sin6.sin6_port);
-				inet_ntop(protocol, &sin6.sin6_addr, ip, sizeof(ip));
-				log_debug(DEBUG_NTP, "Received NTP request from [%s]:%u", ip, port);
+			send_msgs[replies].msg_hdr.msg_name = &src_addr[i];
+			send_msgs[replies].msg_hdr.msg_namelen = recv_msgs[i].msg_hdr.msg_namelen;
+			reply_recv_ns[replies] = (uint64_t)recv_ts[i].tv_sec * 1000000000u + recv_ts[i].tv_nsec;
+			replies++;
+		}
+
+		if(replies > 0)
+		{
+			// Set the transmit timestamp of all replies right
+			// before sending them
+			struct timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			const uint64_t net_transmit_time = hton64(timespec2ntp(&now));
+			const uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+			uint64_t latency_sum = 0, latency_max = __atomic_load_n(&stats->latency_max, __ATOMIC_RELAXED);
+			for(unsigned int i = 0; i < replies; i++)
+			{
+				memcpy(&send_buf[i][40], &net_transmit_time, sizeof(net_transmit_time));
+				const uint64_t latency = now_ns > reply_recv_ns[i] ? (now_ns - reply_recv_ns[i]) / 1000u : 0u;
+				latency_sum += latency;
+				if(latency > latency_max)
+					latency_max = latency;
 			}
-			else
+			if(config.debug.ntp.v.b)
+				print_debug_time("Transmit Timestamp", NULL, timespec2ntp(&now));
+			__atomic_add_fetch(&stats->latency_sum, latency_sum, __ATOMIC_RELAXED);
+			__atomic_store_n(&stats->latency_max, latency_max, __ATOMIC_RELAXED);
+
+			// Send the replies, sendmmsg() may send fewer
+			// messages than requested
+			unsigned int sent = 0;
+			while(sent < replies)
 			{
-				struct sockaddr_in sin;
-				memcpy(&sin, &src_addr, sizeof(sin));
-
-				char ip[INET6_ADDRSTRLEN];
-				const in_port_t port = ntohs(sin.sin_port);
-				inet_ntop(protocol, &sin.sin_addr, ip, sizeof(ip));
-				log_debug(DEBUG_NTP, "Received NTP request from %s:%u", ip, port);
+				const int ret = sendmmsg(fd, &send_msgs[sent], replies - sent, 0);
+				__atomic_add_fetch(&stats->send_calls, 1, __ATOMIC_RELAXED);
+				if(ret < 1)
+				{
+					log_err("NTP send error: %s", strerror(errno));
+					__atomic_add_fetch(&stats->errors, 1, __ATOMIC_RELAXED);
+					break;
+				}
+				sent += ret;
 			}
+			__atomic_add_fetch(&stats->replies, sent, __ATOMIC_RELAXED);
+			log_debug(DEBUG_NTP, "%u NTP replies sent", sent);
 		}
 
-		// Handle the request
-		ntp_reply(fd, &src_addr, src_addrlen, buf, &recv_time);
-		log_debug(DEBUG_NTP, "NTP reply sent");
-
-		// Sleep for 100 msec, this allows no more than 10 requests per
-		// second
-		sleepms(100);
+		// Limit the number of requests answered per second
+		const unsigned int rate_limit = config.ntp.rateLimit.v.ui;
+		if(rate_limit > 0)
+		{
+			const unsigned int delay = 1000u * received / rate_limit;
+			if(delay > 0)
+				sleepms(delay);
+		}
 	}
 }
 
@@ -312,11 +435,19 @@ static void *ntp_bind_and_listen(void *param)
 	setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
 #endif
 
-	// Set socket receive buffer to 1 KB to avoid (near) endless queueing of
-	// NTP requests
-	const int recvbuf = 1024;
+	// Limit the socket receive buffer to about one batch of requests to
+	// avoid (near) endless queueing of NTP requests
+	const int recvbuf = NTP_BATCH_SIZE * 1024;
 	setsockopt(s, SOL_SOCKET, SO_RCVBUF, &recvbuf, sizeof(recvbuf));
 
+#ifdef SO_TIMESTAMPNS
+	// Let the kernel timestamp incoming requests so the receive timestamp
+	// of replies is not affected by the time requests spend queued
+	int timestamp = 1;
+	if(setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &timestamp, sizeof(timestamp)) != 0)
+		log_debug(DEBUG_NTP, "Cannot enable kernel timestamps for NTP requests: %s", strerror(errno));
+#endif
+
 	// Bind the socket to the NTP port
 	char ipstr[INET6_ADDRSTRLEN + 1];
 	memset(ipstr, 0, sizeof(ipstr));
@@ -422,3 +553,20 @@ bool ntp_server_start(void)
 
 	return true;
 }
+
+// Get statistics of the IPv4 and IPv6 NTP servers
+void get_ntp_server_stats(struct ntp_server_stats stats[2])
+{
+	for(unsigned int i = 0; i < 2; i++)
+	{
+		stats[i].active = __atomic_load_n(&ntp_stats[i].active, __ATOMIC_RELAXED);
+		stats[i].requests = __atomic_load_n(&ntp_stats[i].requests, __ATOMIC_RELAXED);
+		stats[i].replies = __atomic_load_n(&ntp_stats[i].replies, __ATOMIC_RELAXED);
+		stats[i].invalid = __atomic_load_n(&ntp_stats[i].invalid, __ATOMIC_RELAXED);
+		stats[i].errors = __atomic_load_n(&ntp_stats[i].errors, __ATOMIC_RELAXED);
+		stats[i].recv_calls = __atomic_load_n(&ntp_stats[i].recv_calls, __ATOMIC_RELAXED);
+		stats[i].send_calls = __atomic_load_n(&ntp_stats[i].send_calls, __ATOMIC_RELAXED);
+		stats[i].latency_sum = __atomic_load_n(&ntp_stats[i].latency_sum, __ATOMIC_RELAXED);
+		stats[i].latency_max = __atomic_load_n(&ntp_stats[i].latency_max, __ATOMIC_RELAXED);
+	}
+}
@@ -209,3 +209,136 @@ void moveOverTimeMemory(const time_t mintime)
 		initSlot(timeidx, timestamp);
 	}
 }
+
+// The finer tiers are rings stored behind the regular overTime slots
+static overTimeData *get_tier_base(const enum overtime_tier tier)
+{
+	if(tier == OVERTIME_TIER_FINE)
+		return overTime + OVERTIME_SLOTS;
+	return overTime + OVERTIME_SLOTS + OVERTIME_FINE_SLOTS;
+}
+
+unsigned int __attribute__((const)) get_overTime_tier_interval(const enum overtime_tier tier)
+{
+	switch(tier)
+	{
+		case OVERTIME_TIER_FINE:
+			return OVERTIME_FINE_INTERVAL;
+		case OVERTIME_TIER_MINUTE:
+			return OVERTIME_MINUTE_INTERVAL;
+		case OVERTIME_TIER_DEFAULT:
+		default:
+			return OVERTIME_INTERVAL;
+	}
+}
+
+unsigned int __attribute__((const)) get_overTime_tier_slots(const enum overtime_tier tier)
+{
+	switch(tier)
+	{
+		case OVERTIME_TIER_FINE:
+			return OVERTIME_FINE_SLOTS;
+		case OVERTIME_TIER_MINUTE:
+			return OVERTIME_MINUTE_SLOTS;
+		case OVERTIME_TIER_DEFAULT:
+		default:
+			return OVERTIME_SLOTS;
+	}
+}
+
+enum overtime_tier __attribute__((pure)) get_overTime_tier(const unsigned int interval)
+{
+	if(interval == 0 || !config.webserver.api.fineHistory.v.b)
+		return OVERTIME_TIER_DEFAULT;
+	if(interval < OVERTIME_MINUTE_INTERVAL)
+		return OVERTIME_TIER_FINE;
+	if(interval < OVERTIME_INTERVAL)
+		return OVERTIME_TIER_MINUTE;
+	return OVERTIME_TIER_DEFAULT;
+}
+
+/**
+ * Get the slot of a finer tier the given timestamp falls into. Slots are
+ * reused once the ring wrapped around, a slot still holding an older interval
+ * is reset if create is true.
+ *
+ * @param tier The tier
+ * @param timestamp The timestamp
+ * @param create Whether to reset a slot holding an older interval
+ * @return Pointer to the slot or NULL if the timestamp is outside of the
+ * period covered by this tier (or the slot has not been created)
+ */
+static overTimeData *get_tier_slot(const enum overtime_tier tier, const time_t timestamp, const bool create)
+{
+	const unsigned int interval = get_overTime_tier_interval(tier);
+	const unsigned int slots = get_overTime_tier_slots(tier);
+
+	// Skip timestamps that are too old for this tier
+	if(timestamp < time(NULL) - (time_t)(interval * slots))
+		return NULL;
+
+	// Center timestamp in the interval, this is the same convention as for
+	// the regular overTime slots
+	const time_t center = timestamp - timestamp % interval + interval / 2;
+	overTimeData *slot = &get_tier_base(tier)[(center / interval) % slots];
+
+	if(slot->magic == MAGICBYTE && slot->timestamp == center)
+		return slot;
+
+	// Never overwrite a newer interval with an older one
+	if(!create || (slot->magic == MAGICBYTE && slot->timestamp > center))
+		return NULL;
+
+	memset(slot, 0, sizeof(*slot));
+	slot->magic = MAGICBYTE;
+	slot->timestamp = center;
+
+	return slot;
+}
+
+void change_overTime_tiers(const double timestamp, const int total, const int blocked,
+                           const int cached, const int forwarded)
+{
+	if(!config.webserver.api.fineHistory.v.b)
+		return;
+
+	// Only adding to a slot may (re)create it, removing from a slot that is
+	// not present anymore is a no-op
+	const bool create = total > 0 || blocked > 0 || cached > 0 || forwarded > 0;
+	for(enum overtime_tier tier = OVERTIME_TIER_FINE; tier < OVERTIME_TIER_DEFAULT; tier++)
+	{
+		overTimeData *slot = get_tier_slot(tier, (time_t)timestamp, create);
+		if(slot == NULL)
+			continue;
+
+		slot->total += total;
+		slot->blocked += blocked;
+		slot->cached += cached;
+		slot->forwarded += forwarded;
+	}
+}
+
+unsigned int copy_overTime_tier(const enum overtime_tier tier, const time_t now, overTimeData *out)
+{
+	const unsigned int interval = get_overTime_tier_interval(tier);
+	const unsigned int slots = get_overTime_tier_slots(tier);
+	const time_t newest = now - now % interval;
+
+	for(unsigned int i = 0; i < slots; i++)
+	{
+		const time_t timestamp = newest - (time_t)((slots - 1 - i) * interval);
+		const overTimeData *slot = get_tier_slot(tier, timestamp, false);
+		if(slot != NULL)
+		{
+			out[i] = *slot;
+			continue;
+		}
+
+		// Empty slot
+		memset(&out[i], 0, sizeof(out[i]));
+		out[i].magic = MAGICBYTE;
+		out[i].timestamp = timestamp + interval / 2;
+	}
+
+	return slots;
+}
@@ -38,4 +38,50 @@ typedef struct {
 
 extern overTimeData *overTime;
 
+// The finer tiers are stored as rings behind the OVERTIME_SLOTS regular slots
+// in the same shared memory object
+#define OVERTIME_ALL_SLOTS (OVERTIME_SLOTS + OVERTIME_FINE_SLOTS + OVERTIME_MINUTE_SLOTS)
+
+enum overtime_tier {
+	OVERTIME_TIER_FINE,
+	OVERTIME_TIER_MINUTE,
+	OVERTIME_TIER_DEFAULT
+} __attribute__ ((packed));
+
+/**
+ * Add to the counters of the finer overTime tiers. The regular overTime slots
+ * are not touched by this function.
+ *
+ * @param timestamp The timestamp of the query
+ * @param total The amount to add to the total number of queries
+ * @param blocked The amount to add to the number of blocked queries
+ * @param cached The amount to add to the number of cached queries
+ * @param forwarded The amount to add to the number of forwarded queries
+ */
+void change_overTime_tiers(const double timestamp, const int total, const int blocked,
+                           const int cached, const int forwarded);
+
+/**
+ * Get the coarsest tier whose resolution is at least as fine as the requested
+ * interval. Finer tiers are only used when webserver.api.fineHistory is
+ * enabled.
+ *
+ * @param interval The requested interval [seconds], 0 for the default
+ * @return The tier to use
+ */
+enum overtime_tier get_overTime_tier(const unsigned int interval) __attribute__((pure));
+unsigned int get_overTime_tier_interval(const enum overtime_tier tier) __attribute__((const));
+unsigned int get_overTime_tier_slots(const enum overtime_tier tier) __attribute__((const));
+
+/**
+ * Copy the slots of a finer tier into a chronologically ordered array. Slots
+ * without any queries are returned with zero counts.
+ *
+ * @param tier The tier to copy (must not be OVERTIME_TIER_DEFAULT)
+ * @param now The current time, this is the end of the newest slot returned
+ * @param out Array of at least get_overTime_tier_slots(tier) elements
+ * @return The number of slots copied
+ */
+unsigned int copy_overTime_tier(const enum overtime_tier tier, const time_t now, overTimeData *out);
+
 #endif //OVERTIME_H
@@ -0,0 +1,397 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Buffered pcap writer
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file pcap-writer.c
+* @brief Buffering, filtering and rotation of the packet capture (files.pcap).
+*
+* dnsmasq's packet dumper hands every record (pcap record header, IP and UDP
+* headers and payload) to pcap_write(). Records are collected in a buffer of
+* misc.pcap.buffer KiB which is written with a single write() call when it is
+* full and by the GC thread at least every misc.pcap.flushInterval seconds.
+*
+* Packets are only recorded if they pass the filters (pcap_keep()):
+* misc.pcap.clients only keeps queries of and replies to the given clients,
+* misc.pcap.types only keeps DNS packets with one of the given query types
+* and misc.pcap.rcodes only keeps replies with one of the given RCODEs.
+* Packets other than DNS are not recorded when any filter is set.
+*
+* When the capture grows beyond misc.pcap.maxSize MiB, it is renamed to
+* <file>.1 and a new file is started. Named pipes are never rotated. Forks of
+* the main process (TCP workers) write their packets right away.
+*/
+
+#include "FTL.h"
+#include "pcap-writer.h"
+// config
+#include "config/config.h"
+// log_warn()
+#include "log.h"
+// main_pid()
+#include "signals.h"
+// inet_pton()
+#include <arpa/inet.h>
+// open()
+#include <fcntl.h>
+
+// defined in src/dnsmasq/cache.c
+extern unsigned short querytype(const char *name);
+
+static struct {
+	pthread_mutex_t lock;
+	int fd;
+	bool regular;
+	char *path;
+	unsigned char header[64];
+	size_t header_len;
+	unsigned char *buf;
+	size_t size;
+	size_t used;
+	off_t filesize;
+	double last_flush;
+} pcap = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+// Filters, read from the config once when the capture is opened
+static struct {
+	unsigned int num_clients;
+	struct pcap_client {
+		sa_family_t family;
+		unsigned char addr[16];
+	} *clients;
+	unsigned int num_types;
+	uint16_t *types;
+	uint16_t rcodes; // bitmask
+	bool any;
+} filter = { 0 };
+
+static const char * const rcodes[] = {
+	"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+};
+
+/**
+ * Get the number of a query type given by name (e.g. "AAAA") or number
+ *
+ * @param name The query type
+ * @return The query type or -1 if it is unknown
+ */
+int pcap_qtype(const char *name)
+{
+	char *end = NULL;
+	const long num = strtol(name, &end, 10);
+	if(end != name && *end == '\0')
+		return num > 0 && num <= UINT16_MAX ? (int)num : -1;
+
+	const unsigned short type = querytype(name);
+	return type > 0 ? type : -1;
+}
+
+/**
+ * Get the number of an RCODE given by name (e.g. "NXDOMAIN")
+ *
+ * @param name The RCODE
+ * @return The RCODE or -1 if it is unknown
+ */
+int pcap_rcode(const char *name)
+{
+	for(unsigned int i = 0; i < ArraySize(rcodes); i++)
+		if(strcasecmp(name, rcodes[i]) == 0)
+			return (int)i;
+
+	return -1;
+}
+
+// Read the filters from the config, invalid entries have been rejected by
+// the validators
+static void read_filters(void)
+{
+	cJSON *clients = config.misc.pcap.clients.v.json;
+	cJSON *types = config.misc.pcap.types.v.json;
+	const int num_clients = cJSON_GetArraySize(clients);
+	const int num_types = cJSON_GetArraySize(types);
+
+	filter.clients = calloc(num_clients > 0 ? num_clients : 1, sizeof(*filter.clients));
+	filter.types = calloc(num_types > 0 ? num_types : 1, sizeof(*filter.types));
+	if(filter.clients == NULL || filter.types == NULL)
+		return;
+
+	for(int i = 0; i < num_clients; i++)
+	{
+		const char *ip = cJSON_GetStringValue(cJSON_GetArrayItem(clients, i));
+		struct pcap_client *client = &filter.clients[filter.num_clients];
+		if(ip == NULL)
+			continue;
+		if(inet_pton(AF_INET, ip, client->addr) == 1)
+			client->family = AF_INET;
+		else if(inet_pton(AF_INET6, ip, client->addr) == 1)
+			client->family = AF_INET6;
+		else
+			continue;
+		filter.num_clients++;
+	}
+
+	for(int i = 0; i < num_types; i++)
+	{
+		const char *name = cJSON_GetStringValue(cJSON_GetArrayItem(types, i));
+		const int type = name != NULL ? pcap_qtype(name) : -1;
+		if(type > 0)
+			filter.types[filter.num_types++] = (uint16_t)type;
+	}
+
+	cJSON *item = NULL;
+	cJSON_ArrayForEach(item, config.misc.pcap.rcodes.v.json)
+	{
+		const int rcode = cJSON_IsString(item) ? pcap_rcode(item->valuestring) : -1;
+		if(rcode >= 0)
+			filter.rcodes |= (uint16_t)(1u << rcode);
+	}
+
+	filter.any = filter.num_clients > 0 || filter.num_types > 0 || filter.rcodes != 0;
+}
+
+/**
+ * Set up buffering and rotation of the capture, called by dnsmasq once the
+ * capture file has been opened
+ *
+ * @param fd The capture file
+ * @param path Its path
+ * @param header The pcap file header, written to rotated files
+ * @param header_len Length of the header
+ */
+void pcap_writer_init(const int fd, const char *path, const void *header, const size_t header_len)
+{
+	pthread_mutex_lock(&pcap.lock);
+
+	struct stat st;
+	pcap.fd = fd;
+	pcap.regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+	pcap.filesize = pcap.regular ? st.st_size : 0;
+	pcap.path = strdup(path);
+	pcap.header_len = min(header_len, sizeof(pcap.header));
+	memcpy(pcap.header, header, pcap.header_len);
+	pcap.last_flush = double_time();
+
+	pcap.size = 1024u*config.misc.pcap.buffer.v.ui;
+	if(pcap.size > 0 && (pcap.buf = malloc(pcap.size)) == NULL)
+		pcap.size = 0;
+
+	read_filters();
+
+	pthread_mutex_unlock(&pcap.lock);
+}
+
+// Get the query type of a DNS packet, -1 if it has no question
+static int __attribute__((pure)) packet_qtype(const unsigned char *packet, const size_t len)
+{
+	// We need the header and at least one question
+	if(len < 12 || (packet[4] << 8 | packet[5]) == 0)
+		return -1;
+
+	// Skip the name of the first question, it is not compressed
+	size_t pos = 12;
+	while(pos < len && packet[pos] != 0)
+	{
+		if(packet[pos] & 0xC0)
+			return -1;
+		pos += packet[pos] + 1u;
+	}
+
+	if(pos + 3 > len)
+		return -1;
+
+	return packet[pos + 1] << 8 | packet[pos + 2];
+}
+
+// Check if an address is one of the filtered clients
+static bool client_matches(const struct sockaddr *client)
+{
+	if(client == NULL)
+		return false;
+
+	const void *addr = NULL;
+	if(client->sa_family == AF_INET)
+		addr = &((const struct sockaddr_in *)(const void *)client)->sin_addr;
+	else if(client->sa_family == AF_INET6)
+		addr = &((const struct sockaddr_in6 *)(const void *)client)->sin6_addr;
+	else
+		return false;
+
+	const size_t addrlen = client->sa_family == AF_INET ? 4 : 16;
+	for(unsigned int i = 0; i < filter.num_clients; i++)
+		if(filter.clients[i].family == client->sa_family &&
+		   memcmp(filter.clients[i].addr, addr, addrlen) == 0)
+			return true;
+
+	return false;
+}
+
+/**
+ * Check if a packet is to be recorded
+ *
+ * @param packet The packet
+ * @param len Length of the packet
+ * @param client The client for queries of and replies to clients, NULL for
+ * other packets
+ * @param dns true for DNS packets
+ * @param reply true for DNS replies
+ * @return true if the packet passes the filters
+ */
+bool pcap_keep(const unsigned char *packet, const size_t len, const struct sockaddr *client,
+               const bool dns, const bool reply)
+{
+	if(!filter.any)
+		return true;
+	if(!dns)
+		return false;
+
+	if(filter.num_clients > 0 && !client_matches(client))
+		return false;
+
+	if(filter.rcodes != 0 && (!reply || len < 4 || !(filter.rcodes & (1u << (packet[3] & 0x0F)))))
+		return false;
+
+	if(filter.num_types > 0)
+	{
+		const int qtype = packet_qtype(packet, len);
+		unsigned int i = 0;
+		while(i < filter.num_types && filter.types[i] != qtype)
+			i++;
+		if(i == filter.num_types)
+			return false;
+	}
+
+	return true;
+}
+
+// Write the buffer to the capture file, requires the lock
+static bool write_buffer(void)
+{
+	bool ok = true;
+	size_t done = 0;
+	while(done < pcap.used)
+	{
+		const ssize_t ret = write(pcap.fd, pcap.buf + done, pcap.used - done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+		{
+			ok = false;
+			break;
+		}
+		done += ret;
+	}
+
+	pcap.filesize += done;
+	pcap.used = 0;
+	pcap.last_flush = double_time();
+
+	return ok;
+}
+
+static inline off_t max_size(void)
+{
+	return (off_t)config.misc.pcap.maxSize.v.ui*1024*1024;
+}
+
+// Start a new capture file once the current one is too large, requires the
+// lock
+static void rotate(void)
+{
+	if(!pcap.regular || max_size() == 0 || pcap.filesize < max_size() || getpid() != main_pid())
+		return;
+
+	char *rotated = NULL;
+	if(asprintf(&rotated, "%s%s", pcap.path, PCAP_ROTATED_SUFFIX) < 0)
+		return;
+
+	int fd = -1;
+	if(rename(pcap.path, rotated) != 0 ||
+	   (fd = open(pcap.path, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) < 0 ||
+	   write(fd, pcap.header, pcap.header_len) != (ssize_t)pcap.header_len ||
+	   dup2(fd, pcap.fd) < 0)
+	{
+		log_warn("Cannot rotate packet capture %s: %s", pcap.path, strerror(errno));
+		// Try again once the capture has grown by another maxSize
+		pcap.filesize = 0;
+	}
+	else
+		pcap.filesize = (off_t)pcap.header_len;
+
+	if(fd >= 0)
+		close(fd);
+	free(rotated);
+}
+
+/**
+ * Add a record to the capture
+ *
+ * @param iov The parts of the record
+ * @param num Number of parts
+ * @return false if writing failed
+ */
+bool pcap_write(const struct iovec *iov, const int num)
+{
+	size_t len = 0;
+	for(int i = 0; i < num; i++)
+		len += iov[i].iov_len;
+
+	pthread_mutex_lock(&pcap.lock);
+
+	bool ok = true;
+	if(pcap.used + len > pcap.size)
+		ok = write_buffer();
+
+	if(len > pcap.size || getpid() != main_pid())
+	{
+		// Unbuffered, too large for the buffer or a fork which exits
+		// before the buffer would be written
+		const ssize_t ret = writev(pcap.fd, iov, num);
+		ok = ok && ret == (ssize_t)len;
+		if(ret > 0)
+			pcap.filesize += ret;
+	}
+	else
+	{
+		for(int i = 0; i < num; i++)
+		{
+			memcpy(pcap.buf + pcap.used, iov[i].iov_base, iov[i].iov_len);
+			pcap.used += iov[i].iov_len;
+		}
+	}
+
+	if(max_size() > 0 && pcap.filesize + (off_t)pcap.used >= max_size())
+	{
+		ok = write_buffer() && ok;
+		rotate();
+	}
+
+	pthread_mutex_unlock(&pcap.lock);
+
+	return ok;
+}
+
+/**
+ * Write buffered records. Called by the GC thread once per second and on exit
+ *
+ * @param force Write them even if misc.pcap.flushInterval has not passed yet
+ */
+void pcap_flush(const bool force)
+{
+	if(pcap.fd < 0)
+		return;
+
+	pthread_mutex_lock(&pcap.lock);
+	if(pcap.used > 0 && (force || double_time() - pcap.last_flush >= config.misc.pcap.flushInterval.v.ui))
+	{
+		if(!write_buffer())
+			log_warn("Cannot write packet capture %s: %s", pcap.path, strerror(errno));
+		rotate();
+	}
+	pthread_mutex_unlock(&pcap.lock);
+}
@@ -0,0 +1,33 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Buffered pcap writer header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef PCAP_WRITER_H
+#define PCAP_WRITER_H
+
+#include <stdbool.h>
+// size_t
+#include <stddef.h>
+// struct iovec
+#include <sys/uio.h>
+// struct sockaddr
+#include <sys/socket.h>
+
+// Rotated capture files get this suffix, only one old file is kept
+#define PCAP_ROTATED_SUFFIX ".1"
+
+void pcap_writer_init(const int fd, const char *path, const void *header, const size_t header_len);
+bool pcap_keep(const unsigned char *packet, const size_t len, const struct sockaddr *client,
+               const bool dns, const bool reply);
+bool pcap_write(const struct iovec *iov, const int num);
+void pcap_flush(const bool force);
+int pcap_qtype(const char *name) __attribute__((pure));
+int pcap_rcode(const char *name) __attribute__((pure));
+
+#endif // PCAP_WRITER_H
@@ -0,0 +1,75 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Static tracing probes header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+// Statically defined tracing probes (USDT) for bpftrace, perf, SystemTap, ...
+// Each probe compiles into a single nop which is only patched while a tracer
+// is attached, so they are always built in when <sys/sdt.h> is available.
+// Building with -DFTL_NO_PROBES omits them. All probes belong to the provider
+// pihole_ftl, e.g.
+//
+//   bpftrace -e 'usdt:/usr/bin/pihole-FTL:pihole_ftl:shm_lock
+//                { @wait_us[str(arg0)] = hist(arg1 / 1000); }'
+//
+// lists the probes with
+//
+//   bpftrace -l 'usdt:/usr/bin/pihole-FTL:pihole_ftl:*'
+//
+// Durations are in nanoseconds. Arguments in order:
+//
+//   query_new        queryID, dnsmasq ID, domain, client IP, query type
+//                    A new query has been added (before it is checked)
+//   query_checked    queryID, blocked (0/1), query status, list checks
+//                    Blocking checks are done, the status tells the list
+//                    which matched (gravity, regex, denylist, ...), list
+//                    checks is the bitmask of the lists tried
+//                    (LATENCY_CHECK_*)
+//   query_forwarded  queryID, upstream IP, upstream port
+//   query_reply      dnsmasq ID, reply type, response time [us]
+//                    The first reply to the query is known
+//   shm_lock         function, wait time, readers waited for
+//   shm_unlock       function, hold time
+//   shm_lock_read    function, wait time
+//   shm_unlock_read  function, hold time
+//   gc_start         oldest timestamp to keep, number of queries
+//   gc_phase         phase (expire, database, demote, recycle, strings, overtime),
+//                    duration
+//   gc_done          removed queries, duration
+//   db_store         queries added to and updated in the in-memory database
+//                    (both zero without it), queries waiting to be stored on
+//                    disk, duration
+//   api_request      endpoint, HTTP method (enum http_method), return code,
+//                    duration
+//
+// Probes on the same query measure the latency of its stages, e.g.
+// query_new -> query_checked -> query_forwarded (matched by queryID) or
+// query_new -> query_reply (matched by dnsmasq ID).
+
+#if !defined(FTL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+// STAP_PROBEV()
+#define SDT_USE_VARIADIC
+#include <sys/sdt.h>
+#define FTL_PROBES
+#endif
+#endif
+
+#ifdef FTL_PROBES
+#define FTL_PROBE(name, ...) STAP_PROBEV(pihole_ftl, name, __VA_ARGS__)
+#else
+// Arguments are never evaluated, this only keeps variables which are only
+// passed to probes from being reported as unused
+static inline void __attribute__((always_inline)) ftl_no_probe(const int dummy, ...) { (void)dummy; }
+#define FTL_PROBE(name, ...) do { if(0) ftl_no_probe(0, __VA_ARGS__); } while(0)
+#endif
+
+#endif //PROBES_H
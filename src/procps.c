@@ -416,3 +416,106 @@ pid_t search_proc(const char *name)
 	closedir(dir);
 	return -1;
 }
+
+// Read the CPU times and the name of a thread from /proc/self/task/<tid>/stat
+static bool parse_thread_stat(const char *dir, struct proc_thread *thread)
+{
+	char filename[64];
+	snprintf(filename, sizeof(filename), "/proc/self/task/%s/stat", dir);
+	FILE *file = fopen(filename, "r");
+	if(file == NULL)
+		return false;
+
+	char line[1024];
+	const bool read = fgets(line, sizeof(line), file) != NULL;
+	fclose(file);
+	if(!read)
+		return false;
+
+	// The name is enclosed in parentheses and may contain spaces and
+	// parentheses itself
+	char *start = strchr(line, '(');
+	char *end = strrchr(line, ')');
+	if(start == NULL || end == NULL || end < start)
+		return false;
+	*end = '\0';
+	strncpy(thread->name, start + 1, sizeof(thread->name) - 1);
+	thread->name[sizeof(thread->name) - 1] = '\0';
+
+	// Skip fields 3 (state) to 13 (cmajflt) to get utime and stime
+	unsigned long utime = 0, stime = 0;
+	if(sscanf(end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+		return false;
+
+	static long user_hz = 0;
+	if(user_hz == 0)
+		user_hz = sysconf(_SC_CLK_TCK);
+	thread->user = (double)utime / user_hz;
+	thread->system = (double)stime / user_hz;
+
+	return true;
+}
+
+/**
+ * @brief Collects the scheduling statistics of all threads of this process.
+ *
+ * CPU times are read from /proc/self/task/<tid>/stat, context switches from
+ * .../status and wakeups as well as the time spent waiting on a run queue
+ * from .../schedstat (if the kernel provides it).
+ *
+ * @param out Array receiving the statistics
+ * @param max Size of the array, further threads are ignored
+ * @return Number of threads
+ */
+unsigned int parse_proc_threads(struct proc_thread *out, const unsigned int max)
+{
+	DIR *dir = opendir("/proc/self/task");
+	if(dir == NULL)
+		return 0;
+
+	unsigned int num = 0;
+	struct dirent *entry;
+	while(num < max && (entry = readdir(dir)) != NULL)
+	{
+		if(!isdigit(entry->d_name[0]))
+			continue;
+
+		// Threads may have ended since the directory has been read
+		struct proc_thread *thread = &out[num];
+		memset(thread, 0, sizeof(*thread));
+		thread->tid = atoi(entry->d_name);
+		if(!parse_thread_stat(entry->d_name, thread))
+			continue;
+
+		char filename[64];
+		snprintf(filename, sizeof(filename), "/proc/self/task/%s/status", entry->d_name);
+		FILE *file = fopen(filename, "r");
+		if(file != NULL)
+		{
+			char line[256];
+			while(fgets(line, sizeof(line), file))
+			{
+				sscanf(line, "voluntary_ctxt_switches: %lu", &thread->voluntary);
+				sscanf(line, "nonvoluntary_ctxt_switches: %lu", &thread->involuntary);
+			}
+			fclose(file);
+		}
+
+		// Time on the CPU (ns), time waiting on a run queue (ns), number
+		// of timeslices run on this CPU
+		snprintf(filename, sizeof(filename), "/proc/self/task/%s/schedstat", entry->d_name);
+		file = fopen(filename, "r");
+		if(file != NULL)
+		{
+			unsigned long long runqueue = 0;
+			if(fscanf(file, "%*u %llu %llu", &runqueue, &thread->wakeups) == 2)
+				thread->runqueue = 1e-9 * runqueue;
+			fclose(file);
+		}
+
+		num++;
+	}
+	closedir(dir);
+
+	return num;
+}
@@ -49,6 +49,26 @@ struct proc_meminfo {
 bool getProcessMemory(struct proc_mem *mem, const unsigned long total_memory);
 bool parse_proc_meminfo(struct proc_meminfo *mem);
 bool parse_proc_stat(unsigned long *total_sum, unsigned long *idle_sum);
+
+// Scheduling statistics of one thread of this process
+struct proc_thread {
+	pid_t tid;
+	char name[16];
+	// CPU time spent in user and kernel mode (in seconds)
+	double user;
+	double system;
+	// Context switches because the thread waited for something (voluntary)
+	// or has been preempted (involuntary)
+	unsigned long voluntary;
+	unsigned long involuntary;
+	// Number of times the thread has been put on a CPU and the time it
+	// spent waiting for one (in seconds), zero if the kernel does not
+	// provide schedstat
+	unsigned long long wakeups;
+	double runqueue;
+};
+
+unsigned int parse_proc_threads(struct proc_thread *out, const unsigned int max);
 pid_t search_proc(const char *name);
 
 #endif // PROCPS_H
@@ -0,0 +1,277 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Sampling CPU profiler
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "profiler.h"
+#include "log.h"
+// sleepms()
+#include "timers.h"
+// killed
+#include "signals.h"
+// setitimer()
+#include <sys/time.h>
+// sched_yield()
+#include <sched.h>
+// atomic_uint
+#include <stdatomic.h>
+#if defined(__GLIBC__)
+// backtrace(), backtrace_symbols()
+#include <execinfo.h>
+#endif
+
+// Frames recorded per sample, deeper stacks lose their outermost frames
+#define PROFILE_DEPTH 40
+// Characters kept per frame in the folded output
+#define PROFILE_FRAME_LEN 64
+// Samples kept per run, any further samples are only counted. This bounds the
+// memory used while profiling to about 2.6 MB
+#define PROFILE_MAX_SAMPLES 8192u
+// Frames of the signal handler itself (handler and signal trampoline)
+#define PROFILE_SKIP 2
+
+#if defined(__GLIBC__)
+struct profile_sample {
+	void *pc[PROFILE_DEPTH];
+	int depth;
+	char thread[16];
+};
+
+static struct profile_sample *samples = NULL;
+static atomic_uint next_sample = 0;
+static atomic_uint in_handler = 0;
+static atomic_bool sampling = false;
+static atomic_flag profiling = ATOMIC_FLAG_INIT;
+
+// SIGPROF is sent by the ITIMER_PROF timer to the thread consuming CPU time
+// when it expires so busy threads are sampled more often than idle ones
+static void profile_handler(int signum, siginfo_t *si, void *context)
+{
+	const int saved_errno = errno;
+	atomic_fetch_add(&in_handler, 1);
+	if(atomic_load(&sampling))
+	{
+		const unsigned int i = atomic_fetch_add(&next_sample, 1);
+		if(i < PROFILE_MAX_SAMPLES)
+		{
+			struct profile_sample *sample = &samples[i];
+			sample->depth = backtrace(sample->pc, PROFILE_DEPTH);
+			prctl(PR_GET_NAME, sample->thread, 0, 0, 0);
+		}
+	}
+	atomic_fetch_sub(&in_handler, 1);
+	errno = saved_errno;
+}
+
+// Append [from, to) to the buffer, spaces and semicolons are reserved by the
+// folded format
+static size_t copy_frame(char *buf, const size_t size, const char *from, const char *to)
+{
+	size_t len = 0;
+	for(; from < to && len + 1 < size; from++)
+		buf[len++] = (*from == ';' || *from == ' ') ? '_' : *from;
+	buf[len] = '\0';
+	return len;
+}
+
+// Shorten a backtrace_symbols() entry, e.g.
+//   /usr/bin/pihole-FTL(runGC+0x1a) [0x55d1c0a1e2b4] -> runGC
+//   /usr/bin/pihole-FTL(+0x1a2b4) [0x55d1c0a1e2b4]   -> pihole-FTL+0x1a2b4
+// Functions which are not exported keep the offset into their object which
+// can be resolved offline using addr2line
+static size_t frame_name(const char *symbol, char *buf, size_t size)
+{
+	if(size > PROFILE_FRAME_LEN)
+		size = PROFILE_FRAME_LEN;
+
+	const char *open = strchr(symbol, '(');
+	const char *close = open != NULL ? strchr(open, ')') : NULL;
+	if(open == NULL || close == NULL)
+	{
+		const char *space = strchr(symbol, ' ');
+		return copy_frame(buf, size, symbol, space != NULL ? space : symbol + strlen(symbol));
+	}
+
+	const char *plus = memchr(open, '+', close - open);
+	if(plus != NULL && plus > open + 1)
+		return copy_frame(buf, size, open + 1, plus);
+
+	const char *object = symbol;
+	for(const char *p = symbol; p < open; p++)
+		if(*p == '/')
+			object = p + 1;
+	const size_t len = copy_frame(buf, size, object, open);
+	return len + copy_frame(buf + len, size - len, plus != NULL ? plus : open + 1, close);
+}
+
+// Turn a sample into "thread;outermost;...;innermost"
+static char *fold_sample(const struct profile_sample *sample)
+{
+	const int depth = sample->depth - PROFILE_SKIP;
+	if(depth < 1)
+		return NULL;
+
+	char **symbols = backtrace_symbols(sample->pc + PROFILE_SKIP, depth);
+	if(symbols == NULL)
+		return NULL;
+
+	char line[sizeof(sample->thread) + PROFILE_DEPTH * PROFILE_FRAME_LEN];
+	size_t len = copy_frame(line, sizeof(line), sample->thread,
+	                        sample->thread + strnlen(sample->thread, sizeof(sample->thread)));
+	for(int j = depth - 1; j >= 0 && len + 2 < sizeof(line); j--)
+	{
+		line[len++] = ';';
+		len += frame_name(symbols[j], line + len, sizeof(line) - len);
+	}
+	line[len] = '\0';
+	free(symbols);
+
+	return strdup(line);
+}
+
+static int cmp_lines(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Aggregate identical stacks of the recorded samples
+static char *fold_samples(const unsigned int num)
+{
+	char **lines = calloc(num > 0 ? num : 1, sizeof(*lines));
+	if(lines == NULL)
+		return NULL;
+
+	unsigned int valid = 0;
+	size_t size = 1;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		char *line = fold_sample(&samples[i]);
+		if(line == NULL)
+			continue;
+		// Reserve space for the count and the newline
+		size += strlen(line) + 12;
+		lines[valid++] = line;
+	}
+	qsort(lines, valid, sizeof(*lines), cmp_lines);
+
+	char *out = malloc(size);
+	if(out != NULL)
+	{
+		size_t len = 0;
+		out[0] = '\0';
+		for(unsigned int i = 0; i < valid;)
+		{
+			unsigned int j = i + 1;
+			while(j < valid && strcmp(lines[j], lines[i]) == 0)
+				j++;
+			len += snprintf(out + len, size - len, "%s %u\n", lines[i], j - i);
+			i = j;
+		}
+	}
+
+	for(unsigned int i = 0; i < valid; i++)
+		free(lines[i]);
+	free(lines);
+
+	return out;
+}
+#endif
+
+/**
+ * Sample the call stacks of all FTL threads for the given time. Samples are
+ * taken whenever the process used another 1/hz seconds of CPU time. Only one
+ * profile can run at a time.
+ *
+ * @param seconds Duration of the profile, at most PROFILE_MAX_SECONDS
+ * @param hz Sampling frequency, at most PROFILE_MAX_HZ
+ * @param result Folded stacks and the number of samples (on success). The
+ *               caller has to free result->folded
+ * @return PROFILE_OK on success
+ */
+enum profile_status run_profile(const unsigned int seconds, const unsigned int hz,
+                                struct profile_result *result)
+{
+#if defined(__GLIBC__)
+	if(atomic_flag_test_and_set(&profiling))
+		return PROFILE_BUSY;
+
+	enum profile_status status = PROFILE_FAILED;
+	samples = calloc(PROFILE_MAX_SAMPLES, sizeof(*samples));
+	if(samples == NULL)
+	{
+		log_err("Cannot allocate memory for profiling");
+		goto end;
+	}
+
+	// backtrace() loads libgcc_s when used for the first time, this must
+	// not happen in the signal handler
+	void *warmup[1];
+	backtrace(warmup, 1);
+
+	atomic_store(&next_sample, 0);
+	atomic_store(&sampling, true);
+
+	struct sigaction action = { 0 }, old_action = { 0 };
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	action.sa_sigaction = &profile_handler;
+	if(sigaction(SIGPROF, &action, &old_action) != 0)
+	{
+		log_err("Cannot install profiling signal handler: %s", strerror(errno));
+		goto end;
+	}
+
+	const struct timeval interval = { .tv_sec = 0, .tv_usec = 1000000 / hz };
+	const struct itimerval timer = { .it_interval = interval, .it_value = interval };
+	if(setitimer(ITIMER_PROF, &timer, NULL) != 0)
+	{
+		log_err("Cannot start profiling timer: %s", strerror(errno));
+		sigaction(SIGPROF, &old_action, NULL);
+		goto end;
+	}
+
+	log_info("Profiling all threads for %u seconds at %u Hz", seconds, hz);
+	for(unsigned int ms = 0; ms < 1000*seconds && !killed; ms += 100)
+		sleepms(100);
+
+	// Stop sampling. Ignoring SIGPROF discards signals which are still
+	// pending, handlers already running finish before the samples are read
+	const struct itimerval stop = { 0 };
+	setitimer(ITIMER_PROF, &stop, NULL);
+	atomic_store(&sampling, false);
+	signal(SIGPROF, SIG_IGN);
+	while(atomic_load(&in_handler) > 0)
+		sched_yield();
+	sigaction(SIGPROF, &old_action, NULL);
+
+	const unsigned int taken = atomic_load(&next_sample);
+	result->samples = min(taken, PROFILE_MAX_SAMPLES);
+	result->dropped = taken - result->samples;
+	result->folded = fold_samples(result->samples);
+	if(result->folded == NULL)
+	{
+		log_err("Cannot allocate memory for profile");
+		goto end;
+	}
+
+	log_info("Profile finished: %u samples (%u dropped)", result->samples, result->dropped);
+	status = PROFILE_OK;
+
+end:
+	if(samples != NULL)
+	{
+		free(samples);
+		samples = NULL;
+	}
+	atomic_flag_clear(&profiling);
+	return status;
+#else
+	return PROFILE_UNSUPPORTED;
+#endif
+}
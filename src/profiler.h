@@ -0,0 +1,38 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Sampling CPU profiler prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+
+// Defaults and limits of a profile run
+#define PROFILE_SECONDS 10u
+#define PROFILE_MAX_SECONDS 60u
+#define PROFILE_HZ 99u
+#define PROFILE_MAX_HZ 999u
+
+enum profile_status {
+	PROFILE_OK,
+	PROFILE_BUSY,
+	PROFILE_UNSUPPORTED,
+	PROFILE_FAILED
+} __attribute__ ((packed));
+
+struct profile_result {
+	// Folded stacks, one "thread;outermost;...;innermost count" per line
+	char *folded;
+	unsigned int samples;
+	unsigned int dropped;
+};
+
+enum profile_status run_profile(const unsigned int seconds, const unsigned int hz,
+                                struct profile_result *result);
+
+#endif //PROFILER_H
@@ -0,0 +1,237 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Binary query log
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file querylog.c
+* @brief Compact binary log of all queries.
+*
+* When files.log.queries is set, a fixed-size record (struct querylog_record)
+* is written for every query once its first reply is known. This is an
+* alternative to parsing the text lines of pihole.log (dns.queryLogging) which
+* costs formatting them in dnsmasq and parsing them again in the consumer.
+*
+* Records are collected in memory and handed to the log writer thread in
+* batches of QUERYLOG_BATCH records or once per second by the GC thread. The
+* writer appends them to the file with O_APPEND and writes the header when the
+* file is empty (e.g. after it has been rotated). Forks of the main process
+* write their records right away as they have no writer thread.
+*
+* `pihole-FTL querylog <file>` decodes a log into JSON lines.
+*/
+
+#include "FTL.h"
+#include "querylog.h"
+// config
+#include "config/config.h"
+// lock_shm()
+#include "shmem.h"
+// main_pid()
+#include "signals.h"
+// log_warn()
+#include "log.h"
+// queue_log_line()
+#include "log-writer.h"
+// inet_pton()
+#include <arpa/inet.h>
+
+_Static_assert(sizeof(struct querylog_header) == 16, "Padding in the query log header");
+_Static_assert(sizeof(struct querylog_record) == 64, "Padding in the query log records");
+
+// Records not yet handed to the log writer, protected by the SHM lock
+static struct querylog_record records[QUERYLOG_BATCH];
+static unsigned int num_records = 0;
+static pid_t records_pid = 0;
+
+// Store an IP address, returns true for IPv6 addresses
+static bool store_ip(uint8_t addr[16], const char *ip)
+{
+	if(inet_pton(AF_INET, ip, addr) == 1)
+		return false;
+
+	return inet_pton(AF_INET6, ip, addr) == 1;
+}
+
+// Hand the collected records to the log writer. Requires the SHM lock
+static void hand_over_records(void)
+{
+	if(num_records == 0)
+		return;
+
+	const size_t len = num_records * sizeof(*records);
+	struct log_line line = {
+		.line = malloc(len),
+		.len = len,
+		.msg = 0,
+		.priority = LOG_INFO,
+		.target = LOG_TARGET_QUERIES
+	};
+	num_records = 0;
+	if(line.line == NULL)
+		return;
+
+	memcpy(line.line, records, len);
+	if(!queue_log_line(&line))
+	{
+		write_log_lines(LOG_TARGET_QUERIES, &line, 1, false);
+		free(line.line);
+	}
+}
+
+/**
+ * Add a query to the binary query log. Requires the SHM lock
+ *
+ * @param query The query whose first reply has just been received
+ */
+void querylog_add(const queriesData *query)
+{
+	if(config.files.log.queries.v.s == NULL || config.files.log.queries.v.s[0] == '\0')
+		return;
+
+	// Forks inherit the records of the main process which will write them
+	// itself
+	const pid_t pid = getpid();
+	if(records_pid != pid)
+	{
+		records_pid = pid;
+		num_records = 0;
+	}
+
+	struct querylog_record *record = &records[num_records];
+	memset(record, 0, sizeof(*record));
+	record->timestamp = (int64_t)(get_query_timestamp(query)*1e6);
+	record->response = query->flags.response_calculated ? query->response : 0u;
+	record->id = query->id;
+	record->qtype = query->qtype;
+	record->type = query->type;
+	record->status = query->status;
+	record->reply = query->reply;
+	record->dnssec = query->dnssec;
+	record->ede = query->ede;
+
+	const clientsData *client = getClient(query->clientID, true);
+	if(client != NULL && store_ip(record->client, getstr(client->ippos)))
+		record->flags |= QUERYLOG_CLIENT_V6;
+
+	const upstreamsData *upstream = query->upstreamID < 0 ? NULL : getUpstream(query->upstreamID, true);
+	if(upstream != NULL)
+	{
+		record->flags |= QUERYLOG_UPSTREAM;
+		record->port = upstream->port;
+		if(store_ip(record->upstream, getstr(upstream->ippos)))
+			record->flags |= QUERYLOG_UPSTREAM_V6;
+	}
+
+	num_records++;
+	if(num_records == QUERYLOG_BATCH || pid != main_pid())
+		hand_over_records();
+}
+
+/**
+ * Hand the records collected so far to the log writer. Called by the GC
+ * thread once per second and on exit
+ */
+void flush_querylog(void)
+{
+	lock_shm();
+	if(records_pid == getpid())
+		hand_over_records();
+	unlock_shm();
+}
+
+/**
+ * Write the header of a new binary query log
+ *
+ * @param fd The empty log file
+ */
+void write_querylog_header(const int fd)
+{
+	struct querylog_header header = {
+		.version = QUERYLOG_VERSION,
+		.record_size = sizeof(struct querylog_record),
+		.byte_order = QUERYLOG_BYTE_ORDER
+	};
+	memcpy(header.magic, QUERYLOG_MAGIC, sizeof(QUERYLOG_MAGIC));
+
+	if(write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+		log_warn("Cannot write header of binary query log: %s", strerror(errno));
+}
+
+// Print an IP address stored in a record
+static const char *record_ip(const uint8_t addr[16], const bool ipv6, char buffer[INET6_ADDRSTRLEN])
+{
+	if(inet_ntop(ipv6 ? AF_INET6 : AF_INET, addr, buffer, INET6_ADDRSTRLEN) == NULL)
+		strcpy(buffer, "?");
+
+	return buffer;
+}
+
+/**
+ * Decode a binary query log and print its records as JSON lines
+ *
+ * @param path The log file
+ * @return Exit code
+ */
+int decode_querylog(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+	{
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	int ret = EXIT_FAILURE;
+	struct querylog_header header;
+	if(fread(&header, sizeof(header), 1, fp) != 1 ||
+	   memcmp(header.magic, QUERYLOG_MAGIC, sizeof(QUERYLOG_MAGIC)) != 0)
+	{
+		printf("%s is not a binary query log\n", path);
+		goto end_of_decode;
+	}
+	if(header.byte_order != QUERYLOG_BYTE_ORDER ||
+	   header.version != QUERYLOG_VERSION ||
+	   header.record_size != sizeof(struct querylog_record))
+	{
+		printf("%s has been written by an incompatible version of FTL or on another architecture\n", path);
+		goto end_of_decode;
+	}
+
+	struct querylog_record record;
+	while(fread(&record, sizeof(record), 1, fp) == 1)
+	{
+		char client[INET6_ADDRSTRLEN], upstream[INET6_ADDRSTRLEN + 8] = "null";
+		if(record.flags & QUERYLOG_UPSTREAM)
+		{
+			char ip[INET6_ADDRSTRLEN];
+			snprintf(upstream, sizeof(upstream), "\"%s#%u\"",
+			         record_ip(record.upstream, record.flags & QUERYLOG_UPSTREAM_V6, ip), record.port);
+		}
+
+		// get_query_type_str() needs the query for types without a name
+		queriesData query = { .qtype = record.qtype };
+		char type[20];
+
+		printf("{\"time\":%.6f,\"id\":%d,\"client\":\"%s\",\"type\":\"%s\",\"status\":\"%s\","
+		       "\"reply\":\"%s\",\"dnssec\":\"%s\",\"upstream\":%s,\"response\":%.6f,\"ede\":%d}\n",
+		       1e-6*record.timestamp, record.id,
+		       record_ip(record.client, record.flags & QUERYLOG_CLIENT_V6, client),
+		       get_query_type_str(record.type, &query, type),
+		       get_query_status_str(record.status),
+		       get_query_reply_str(record.reply),
+		       get_query_dnssec_str(record.dnssec),
+		       upstream, 1e-6*record.response, record.ede);
+	}
+
+	ret = EXIT_SUCCESS;
+
+end_of_decode:
+	fclose(fp);
+	return ret;
+}
@@ -0,0 +1,62 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Binary query log header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef QUERYLOG_H
+#define QUERYLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+// queriesData
+#include "datastructure.h"
+
+#define QUERYLOG_MAGIC "FTLQLOG"
+#define QUERYLOG_VERSION 1u
+// Written in native byte order, the decoder refuses files with another one
+#define QUERYLOG_BYTE_ORDER 0x01020304u
+// Number of records collected before they are handed to the log writer
+#define QUERYLOG_BATCH 128u
+
+// Every file starts with this header. The fields of both structs are ordered
+// so that they contain no padding
+struct querylog_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t byte_order;
+};
+
+#define QUERYLOG_CLIENT_V6 (1u << 0)
+#define QUERYLOG_UPSTREAM (1u << 1)
+#define QUERYLOG_UPSTREAM_V6 (1u << 2)
+
+// One record per query, written when the first reply is known
+struct querylog_record {
+	int64_t timestamp; // microseconds since the epoch
+	uint32_t response; // microseconds
+	int32_t id;
+	uint8_t client[16]; // IPv4 addresses use the first four bytes
+	uint8_t upstream[16];
+	uint16_t port;
+	uint16_t qtype;
+	uint8_t type;
+	uint8_t status;
+	uint8_t reply;
+	uint8_t dnssec;
+	int16_t ede;
+	uint8_t flags;
+	uint8_t reserved[5];
+};
+
+void querylog_add(const queriesData *query);
+void flush_querylog(void);
+void write_querylog_header(const int fd);
+int decode_querylog(const char *path);
+
+#endif // QUERYLOG_H
@@ -0,0 +1,178 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-client rate-limiting
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file ratelimit.c
+* @brief Token bucket rate-limiting of clients and networks.
+*
+* Every client has a bucket of dns.rateLimit.count tokens, each query takes
+* one of them. Buckets are refilled continuously at a rate of
+* dns.rateLimit.count tokens per dns.rateLimit.interval seconds. Instead of
+* periodically refilling all buckets, a bucket is refilled for the time passed
+* since it has been used last whenever a query arrives. Queries of clients with
+* an empty bucket are refused, refused queries do not take a token.
+*
+* When dns.rateLimit.prefixV4 or dns.rateLimit.prefixV6 are shorter than the
+* address, all clients of a network share one bucket. These buckets live in a
+* fixed-size table in shared memory. All functions require the SHM lock.
+*/
+
+#include "FTL.h"
+#include "ratelimit.h"
+// config
+#include "config/config.h"
+// log_info()
+#include "log.h"
+// hashStr()
+#include "datastructure.h"
+// logg_rate_limit_message()
+#include "database/message-table.h"
+// inet_pton(), inet_ntop()
+#include <arpa/inet.h>
+
+rateLimitData *rate_limits = NULL;
+
+// Get the network a client belongs to when rate-limiting is aggregated
+// per prefix, returns false if the client is rate-limited on its own
+static bool get_prefix(const char *clientIP, char prefix[INET6_ADDRSTRLEN + 4])
+{
+	unsigned char addr[sizeof(struct in6_addr)] = { 0 };
+	unsigned int bits, len;
+	int family;
+
+	if(inet_pton(AF_INET, clientIP, addr) == 1)
+	{
+		family = AF_INET;
+		len = 32;
+		bits = config.dns.rateLimit.prefixV4.v.ui;
+	}
+	else if(inet_pton(AF_INET6, clientIP, addr) == 1)
+	{
+		family = AF_INET6;
+		len = 128;
+		bits = config.dns.rateLimit.prefixV6.v.ui;
+	}
+	else
+		return false;
+
+	if(bits >= len)
+		return false;
+
+	// Clear the host part of the address
+	for(unsigned int i = 0; i < len / 8; i++)
+	{
+		const unsigned int first = 8 * i;
+		if(first >= bits)
+			addr[i] = 0;
+		else if(first + 8 > bits)
+			addr[i] &= (unsigned char)(0xFF << (first + 8 - bits));
+	}
+
+	char ip[INET6_ADDRSTRLEN] = { 0 };
+	if(inet_ntop(family, addr, ip, sizeof(ip)) == NULL)
+		return false;
+
+	snprintf(prefix, INET6_ADDRSTRLEN + 4, "%s/%u", ip, bits);
+	return true;
+}
+
+// Get the bucket of a network, the least recently used bucket of the probed
+// slots is taken over if the network has none yet
+static struct rate_bucket *get_prefix_bucket(const char *prefix)
+{
+	const uint32_t hash = hashStr(prefix);
+	struct rate_prefix *victim = NULL;
+
+	for(unsigned int i = 0; i < RATE_LIMIT_PROBES; i++)
+	{
+		struct rate_prefix *slot = &rate_limits->slot[(hash + i) % RATE_LIMIT_PREFIX_SLOTS];
+		if(slot->hash == hash && strcmp(slot->prefix, prefix) == 0)
+			return &slot->bucket;
+
+		if(victim == NULL || slot->bucket.last < victim->bucket.last)
+			victim = slot;
+	}
+
+	memset(victim, 0, sizeof(*victim));
+	victim->hash = hash;
+	strcpy(victim->prefix, prefix);
+
+	return &victim->bucket;
+}
+
+// Take a token from the bucket, returns true if the query has to be refused
+static bool take_token(struct rate_bucket *bucket, const char *who, const double now)
+{
+	const float capacity = config.dns.rateLimit.count.v.ui;
+	const unsigned int interval = config.dns.rateLimit.interval.v.ui;
+
+	// Refill the bucket for the time passed since it has been used last.
+	// Buckets are never refilled when there is no interval
+	if(bucket->last <= 0.0)
+		bucket->tokens = capacity;
+	else if(interval > 0 && now > bucket->last)
+		bucket->tokens += (float)((now - bucket->last) * capacity / interval);
+	if(bucket->tokens > capacity)
+		bucket->tokens = capacity;
+	bucket->last = now;
+
+	if(bucket->tokens >= 1.0f)
+	{
+		bucket->tokens -= 1.0f;
+		if(bucket->limited)
+		{
+			log_info("Ending rate-limitation of %s after refusing %u queries",
+			         who, bucket->refused);
+			bucket->limited = false;
+		}
+		return false;
+	}
+
+	if(!bucket->limited)
+	{
+		// Log the first rate-limited query. We do not log the blocked
+		// domain for privacy reasons
+		int turnaround = 0;
+		if(interval > 0)
+		{
+			const float wait = (1.0f - bucket->tokens) * interval / capacity;
+			turnaround = (int)wait;
+			if(turnaround < wait)
+				turnaround++;
+		}
+		logg_rate_limit_message(who, turnaround);
+
+		bucket->limited = true;
+		bucket->refused = 0;
+	}
+	bucket->refused++;
+
+	return true;
+}
+
+/**
+ * Check if a query has to be refused due to rate-limiting
+ *
+ * @param client_bucket The bucket of the client
+ * @param clientIP The IP address of the client
+ * @param now Time the query has been received
+ * @return true if the query has to be refused
+ */
+bool rate_limit_query(struct rate_bucket *client_bucket, const char *clientIP, const double now)
+{
+	if(config.dns.rateLimit.count.v.ui == 0)
+		return false;
+
+	char prefix[INET6_ADDRSTRLEN + 4] = { 0 };
+	if(rate_limits != NULL && get_prefix(clientIP, prefix))
+		return take_token(get_prefix_bucket(prefix), prefix, now);
+
+	return take_token(client_bucket, clientIP, now);
+}
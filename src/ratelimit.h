@@ -0,0 +1,49 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-client rate-limiting header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdbool.h>
+// uint32_t
+#include <stdint.h>
+// INET6_ADDRSTRLEN
+#include <netinet/in.h>
+
+// Number of buckets shared by the clients of a network when rate-limiting is
+// aggregated per prefix (dns.rateLimit.prefixV4/V6). A prefix is assigned one
+// of RATE_LIMIT_PROBES consecutive slots, the least recently used one of them
+// is replaced when none belongs to the prefix
+#define RATE_LIMIT_PREFIX_SLOTS 2048u
+#define RATE_LIMIT_PROBES 8u
+
+// Token bucket holding up to dns.rateLimit.count queries, refilled at a rate
+// of dns.rateLimit.count per dns.rateLimit.interval seconds. Buckets are
+// refilled when they are used, new buckets (last == 0) are full
+struct rate_bucket {
+	double last;
+	float tokens;
+	unsigned int refused; // queries refused since the bucket ran empty
+	bool limited;
+};
+
+typedef struct {
+	struct rate_prefix {
+		struct rate_bucket bucket;
+		uint32_t hash;
+		char prefix[INET6_ADDRSTRLEN + 4];
+	} slot[RATE_LIMIT_PREFIX_SLOTS];
+} rateLimitData;
+
+extern rateLimitData *rate_limits;
+
+bool rate_limit_query(struct rate_bucket *client_bucket, const char *clientIP, const double now);
+
+#endif // RATELIMIT_H
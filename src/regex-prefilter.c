@@ -0,0 +1,504 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Regex literal prefilter
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file regex-prefilter.c
+ * @brief Skip regex which cannot match because a required literal is missing
+ *
+ * Most regex filters contain a literal string every match has to contain
+ * ("ads", "telemetry", "doubleclick", ...). When adding a pattern, the
+ * longest such literal is extracted from it. All literals are combined into
+ * an Aho-Corasick automaton (compiled into a DFA over byte classes) so a
+ * single scan of the domain reveals which literals it contains. Only regex
+ * whose literal was found, and all regex without usable literal, have to be
+ * matched afterwards.
+ *
+ * The extraction is conservative: Anything not certainly required by the
+ * pattern (alternatives, optional or repeated atoms, groups, ...) ends the
+ * current literal. Like TRE with REG_ICASE, literals are compared
+ * case-insensitively.
+ */
+
+#include "FTL.h"
+#include "regex-prefilter.h"
+// isprint(), ...
+#include <ctype.h>
+
+// Shorter literals are too common to be worth it
+#define MIN_LITERAL 3u
+#define MAX_LITERAL 64u
+// The transition table is not allowed to grow beyond this size, the literals
+// of further patterns are ignored
+#define MAX_TABLE_SIZE (4u << 20)
+
+#define NONE UINT32_MAX
+
+struct regex_prefilter {
+	unsigned int patterns;
+	unsigned int words;
+	// Literals of the patterns (only until the automaton is built)
+	char **literal;
+	unsigned int literals;
+	// Patterns to be matched regardless of the input (no literal)
+	uint64_t *always;
+	// Result of the most recent scan
+	uint64_t *candidates;
+	// Automaton
+	uint8_t byte_class[256];
+	unsigned int num_classes;
+	unsigned int num_nodes;
+	uint32_t *delta;
+	// First pattern whose literal ends in this node, further ones are
+	// reached via next_out
+	uint32_t *out;
+	uint32_t *next_out;
+	// Nearest node along the suffix links with output (or NONE)
+	uint32_t *dict;
+	// First node with output to report when reaching this node
+	uint32_t *report;
+	// Statistics
+	unsigned long scans;
+	unsigned long num_candidates;
+	unsigned long hits;
+	unsigned long skipped;
+};
+
+struct regex_prefilter *regex_prefilter_new(const unsigned int patterns)
+{
+	struct regex_prefilter *pf = calloc(1, sizeof(*pf));
+	if(pf == NULL)
+		return NULL;
+
+	pf->patterns = patterns;
+	pf->words = (patterns + 63u) / 64u;
+	pf->literal = calloc(patterns > 0 ? patterns : 1u, sizeof(*pf->literal));
+	pf->always = calloc(pf->words > 0 ? pf->words : 1u, sizeof(uint64_t));
+	pf->candidates = calloc(pf->words > 0 ? pf->words : 1u, sizeof(uint64_t));
+	if(pf->literal == NULL || pf->always == NULL || pf->candidates == NULL)
+	{
+		regex_prefilter_free(pf);
+		return NULL;
+	}
+
+	// Every pattern is a candidate until it gets a literal
+	for(unsigned int id = 0; id < patterns; id++)
+		pf->always[id / 64] |= 1ULL << (id % 64);
+
+	return pf;
+}
+
+// Skip a bracket expression, p points at the opening bracket. Returns NULL if
+// the expression is not terminated
+static const char * __attribute__((pure)) skip_bracket(const char *p)
+{
+	p++;
+	if(*p == '^')
+		p++;
+	// A leading "]" is a literal
+	if(*p == ']')
+		p++;
+	while(*p != '\0' && *p != ']')
+	{
+		if(p[0] == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.'))
+		{
+			const char delim[3] = { p[1], ']', '\0' };
+			const char *end = strstr(p + 2, delim);
+			if(end == NULL)
+				return NULL;
+			p = end + 2;
+		}
+		else
+			p++;
+	}
+
+	return *p == ']' ? p + 1 : NULL;
+}
+
+// Skip a bound, p points at the opening brace. Returns NULL for anything but
+// plain "{m}", "{m,}", "{m,n}" (e.g., TRE's approximate matching parameters)
+static const char * __attribute__((pure)) skip_bound(const char *p)
+{
+	for(p++; *p != '}'; p++)
+		if(!isdigit((unsigned char)*p) && *p != ',')
+			return NULL;
+
+	return p + 1;
+}
+
+static void end_literal(char *run, unsigned int *len, char *best, unsigned int *best_len)
+{
+	if(*len > *best_len)
+	{
+		memcpy(best, run, *len);
+		*best_len = *len;
+	}
+	*len = 0;
+}
+
+/**
+ * @brief Find the longest literal every match of pattern has to contain
+ *
+ * @param pattern Extended regular expression (without FTL-specific options)
+ * @param best Buffer of at least MAX_LITERAL bytes receiving the literal (in
+ * lowercase, not terminated)
+ * @return Length of the literal (0 if there is none)
+ */
+static unsigned int required_literal(const char *pattern, char *best)
+{
+	// Temporarily literal text ("\Q...\E") and TRE's flag groups ("(?i)",
+	// which may also change the grouping) are not analyzed
+	if(strstr(pattern, "\\Q") != NULL || strstr(pattern, "(?") != NULL)
+		return 0;
+
+	char run[MAX_LITERAL];
+	unsigned int len = 0, best_len = 0, depth = 0;
+	const char *p = pattern;
+	while(*p != '\0')
+	{
+		// Literal character of this atom (or -1 if it is not a literal)
+		int c = -1;
+		switch(*p)
+		{
+			case '\\':
+				// Hex escapes are followed by further digits
+				if(p[1] == '\0' || p[1] == 'x')
+					return 0;
+				// Escaped letters and digits are macros,
+				// back-references, or assertions, so are
+				// "\<" and "\>"
+				if(isascii((unsigned char)p[1]) && isprint((unsigned char)p[1]) &&
+				   !isalnum((unsigned char)p[1]) &&
+				   p[1] != '<' && p[1] != '>')
+					c = (unsigned char)p[1];
+				p += 2;
+				break;
+
+			case '[':
+				if((p = skip_bracket(p)) == NULL)
+					return 0;
+				break;
+
+			case '(':
+				depth++;
+				p++;
+				break;
+
+			case ')':
+				if(depth > 0)
+					depth--;
+				p++;
+				break;
+
+			case '|':
+				// Top-level alternatives have nothing in common
+				if(depth == 0)
+					return 0;
+				p++;
+				break;
+
+			case '{':
+				if((p = skip_bound(p)) == NULL)
+					return 0;
+				break;
+
+			case '.':
+			case '^':
+			case '$':
+			case '*':
+			case '+':
+			case '?':
+				p++;
+				break;
+
+			default:
+				if(isascii((unsigned char)*p) && isprint((unsigned char)*p))
+					c = tolower((unsigned char)*p);
+				p++;
+				break;
+		}
+
+		// Check for repetition operators applying to this atom
+		const char *q = p;
+		while(*q == '*' || *q == '+' || *q == '?' || *q == '{')
+		{
+			if(*q != '{')
+				q++;
+			else if((q = skip_bound(q)) == NULL)
+				return 0;
+		}
+
+		if(c < 0 || depth > 0)
+		{
+			// Not a literal or nested in a group
+			end_literal(run, &len, best, &best_len);
+		}
+		else if(q == p)
+		{
+			// Plain literal
+			if(len < MAX_LITERAL)
+				run[len++] = c;
+		}
+		else if(strncmp(p, "+", q - p) == 0 || strncmp(p, "+?", q - p) == 0)
+		{
+			// Required once, but anything may follow
+			if(len < MAX_LITERAL)
+				run[len++] = c;
+			end_literal(run, &len, best, &best_len);
+		}
+		else
+		{
+			// Optional
+			end_literal(run, &len, best, &best_len);
+		}
+
+		p = q;
+	}
+	end_literal(run, &len, best, &best_len);
+
+	return best_len >= MIN_LITERAL ? best_len : 0;
+}
+
+/**
+ * @brief Add a pattern to the prefilter
+ *
+ * @param pf Prefilter
+ * @param id ID of the pattern (< number of patterns)
+ * @param pattern Extended regular expression (without FTL-specific options)
+ * @return true if a literal has been found, false if the pattern is always a
+ * candidate
+ */
+bool regex_prefilter_add(struct regex_prefilter *pf, const unsigned int id, const char *pattern)
+{
+	if(id >= pf->patterns || pf->literal[id] != NULL || pf->delta != NULL)
+		return false;
+
+	char literal[MAX_LITERAL];
+	const unsigned int len = required_literal(pattern, literal);
+	if(len == 0)
+		return false;
+
+	pf->literal[id] = strndup(literal, len);
+	if(pf->literal[id] == NULL)
+		return false;
+
+	pf->literals++;
+	return true;
+}
+
+static void free_literals(struct regex_prefilter *pf)
+{
+	for(unsigned int id = 0; id < pf->patterns; id++)
+	{
+		// Patterns without a required literal have none stored
+		if(pf->literal[id] == NULL)
+			continue;
+		free(pf->literal[id]);
+		pf->literal[id] = NULL;
+	}
+}
+
+/**
+ * @brief Build the automaton after all patterns have been added
+ *
+ * @return true if the prefilter can be used, false if no literal is known
+ * (every pattern is a candidate anyway) or on error
+ */
+bool regex_prefilter_finalize(struct regex_prefilter *pf)
+{
+	if(pf->literals == 0 || pf->delta != NULL)
+		return false;
+
+	// Byte classes: all bytes not used by any literal share class 0,
+	// uppercase letters share the class of their lowercase counterpart
+	size_t total = 1u;
+	pf->num_classes = 1u;
+	for(unsigned int id = 0; id < pf->patterns; id++)
+	{
+		const char *literal = pf->literal[id];
+		for(const char *c = literal; c != NULL && *c != '\0'; c++)
+		{
+			const unsigned char b = *c;
+			if(pf->byte_class[b] == 0)
+			{
+				pf->byte_class[b] = pf->num_classes;
+				pf->byte_class[toupper(b)] = pf->num_classes++;
+			}
+			total++;
+		}
+	}
+
+	// Limit the number of nodes to keep the table bounded
+	const size_t max_nodes = MAX_TABLE_SIZE / (pf->num_classes * sizeof(uint32_t));
+	if(total > max_nodes)
+		total = max_nodes;
+	const unsigned int nc = pf->num_classes;
+	pf->delta = malloc(total * nc * sizeof(uint32_t));
+	pf->out = malloc(total * sizeof(uint32_t));
+	pf->dict = malloc(total * sizeof(uint32_t));
+	pf->report = malloc(total * sizeof(uint32_t));
+	pf->next_out = malloc(pf->patterns * sizeof(uint32_t));
+	uint32_t *fail = malloc(total * sizeof(uint32_t));
+	if(pf->delta == NULL || pf->out == NULL || pf->dict == NULL ||
+	   pf->report == NULL || pf->next_out == NULL || fail == NULL)
+	{
+		free(fail);
+		free_literals(pf);
+		return false;
+	}
+
+	// Build the trie
+	memset(pf->delta, 0xff, nc * sizeof(uint32_t));
+	pf->out[0] = NONE;
+	pf->num_nodes = 1u;
+	for(unsigned int id = 0; id < pf->patterns; id++)
+	{
+		const char *literal = pf->literal[id];
+		if(literal == NULL)
+			continue;
+
+		// Literals not fitting into the table are not used
+		if(pf->num_nodes + strlen(literal) > total)
+		{
+			pf->literals--;
+			continue;
+		}
+
+		uint32_t node = 0;
+		for(const char *c = literal; *c != '\0'; c++)
+		{
+			uint32_t *next = &pf->delta[node * nc + pf->byte_class[(unsigned char)*c]];
+			if(*next == NONE)
+			{
+				*next = pf->num_nodes++;
+				memset(&pf->delta[*next * nc], 0xff, nc * sizeof(uint32_t));
+				pf->out[*next] = NONE;
+			}
+			node = *next;
+		}
+
+		pf->next_out[id] = pf->out[node];
+		pf->out[node] = id;
+		pf->always[id / 64] &= ~(1ULL << (id % 64));
+	}
+	free_literals(pf);
+
+	// Compute the suffix links in breadth-first order and turn the trie
+	// into a DFA by replacing missing transitions with those of the
+	// suffix
+	uint32_t *queue = malloc(pf->num_nodes * sizeof(uint32_t));
+	if(queue == NULL)
+	{
+		free(fail);
+		return false;
+	}
+	unsigned int head = 0, tail = 0;
+	fail[0] = 0;
+	pf->dict[0] = NONE;
+	queue[tail++] = 0;
+	while(head < tail)
+	{
+		const uint32_t node = queue[head++];
+		for(unsigned int c = 0; c < nc; c++)
+		{
+			uint32_t *next = &pf->delta[node * nc + c];
+			const uint32_t suffix = node == 0 ? 0 : pf->delta[fail[node] * nc + c];
+			if(*next == NONE)
+			{
+				*next = suffix;
+				continue;
+			}
+
+			fail[*next] = suffix;
+			pf->dict[*next] = pf->out[suffix] != NONE ? suffix : pf->dict[suffix];
+			queue[tail++] = *next;
+		}
+	}
+	free(queue);
+	free(fail);
+
+	for(unsigned int node = 0; node < pf->num_nodes; node++)
+		pf->report[node] = pf->out[node] != NONE ? node : pf->dict[node];
+
+	return pf->literals > 0;
+}
+
+/**
+ * @brief Determine the patterns which may match input
+ *
+ * @param pf Prefilter
+ * @param input String to be scanned
+ * @param candidates Number of candidates (may be NULL)
+ * @return Bitmap of the candidate patterns, it remains valid until the next
+ * scan
+ */
+const uint64_t *regex_prefilter_scan(struct regex_prefilter *pf, const char *input, unsigned int *candidates)
+{
+	memcpy(pf->candidates, pf->always, pf->words * sizeof(uint64_t));
+
+	const unsigned int nc = pf->num_classes;
+	uint32_t node = 0;
+	for(const unsigned char *c = (const unsigned char*)input; *c != '\0'; c++)
+	{
+		node = pf->delta[node * nc + pf->byte_class[*c]];
+		for(uint32_t n = pf->report[node]; n != NONE; n = pf->dict[n])
+			for(uint32_t id = pf->out[n]; id != NONE; id = pf->next_out[id])
+				pf->candidates[id / 64] |= 1ULL << (id % 64);
+	}
+
+	unsigned int num = 0;
+	for(unsigned int w = 0; w < pf->words; w++)
+		num += __builtin_popcountll(pf->candidates[w]);
+
+	pf->scans++;
+	pf->num_candidates += num;
+	pf->hits += num - (pf->patterns - pf->literals);
+	pf->skipped += pf->patterns - num;
+	if(candidates != NULL)
+		*candidates = num;
+
+	return pf->candidates;
+}
+
+void regex_prefilter_stats(const struct regex_prefilter *pf, struct regex_prefilter_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->patterns = pf->patterns;
+	stats->literals = pf->literals;
+	stats->nodes = pf->num_nodes;
+	stats->byte_classes = pf->num_classes;
+	stats->memory = sizeof(*pf) + 2u * pf->words * sizeof(uint64_t) +
+	                pf->patterns * (sizeof(char*) + sizeof(uint32_t)) +
+	                pf->num_nodes * (pf->num_classes + 3u) * sizeof(uint32_t);
+	stats->scans = pf->scans;
+	stats->candidates = pf->num_candidates;
+	stats->hits = pf->hits;
+	stats->skipped = pf->skipped;
+}
+
+void regex_prefilter_free(struct regex_prefilter *pf)
+{
+	if(pf == NULL)
+		return;
+
+	if(pf->literal != NULL)
+	{
+		free_literals(pf);
+		free(pf->literal);
+	}
+
+	// The automaton is only allocated once the prefilter has been
+	// finalized successfully
+	void *ptrs[] = { pf->always, pf->candidates, pf->delta, pf->out,
+	                 pf->next_out, pf->dict, pf->report };
+	for(unsigned int i = 0; i < ArraySize(ptrs); i++)
+		if(ptrs[i] != NULL)
+			free(ptrs[i]);
+	free(pf);
+}
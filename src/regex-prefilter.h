@@ -0,0 +1,39 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Regex literal prefilter prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef REGEX_PREFILTER_H
+#define REGEX_PREFILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct regex_prefilter_stats {
+	unsigned int patterns;
+	unsigned int literals;
+	unsigned int nodes;
+	unsigned int byte_classes;
+	size_t memory;
+	// Matching statistics (of this process)
+	unsigned long scans;
+	unsigned long candidates;
+	unsigned long hits;
+	unsigned long skipped;
+};
+
+struct regex_prefilter;
+
+struct regex_prefilter *regex_prefilter_new(const unsigned int patterns) __attribute__((malloc));
+bool regex_prefilter_add(struct regex_prefilter *pf, const unsigned int id, const char *pattern);
+bool regex_prefilter_finalize(struct regex_prefilter *pf);
+const uint64_t *regex_prefilter_scan(struct regex_prefilter *pf, const char *input, unsigned int *candidates);
+void regex_prefilter_stats(const struct regex_prefilter *pf, struct regex_prefilter_stats *stats);
+void regex_prefilter_free(struct regex_prefilter *pf);
+
+#endif //REGEX_PREFILTER_H
@@ -0,0 +1,1207 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Multi-pattern regex engine
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file regex-set.c
+ * @brief Match a whole set of regular expressions in a single pass
+ *
+ * Every configured regex is translated into a Thompson NFA and the NFAs of
+ * all patterns are joined into one automaton. Matching simulates this
+ * automaton as a DFA whose states (sets of NFA states) are constructed lazily
+ * and cached, so the per-character cost of a cached transition is a single
+ * table lookup regardless of the number of patterns. Each DFA state knows
+ * which patterns have matched once it is reached (or once the input ends in
+ * it), and a scan hence reports the IDs of all matching patterns at once.
+ *
+ * Only the subset of TRE's extended syntax with unambiguous semantics is
+ * supported: literals, ".", bracket expressions, anchors, grouping,
+ * alternation and the usual repetition operators (including bounds). All
+ * regex are matched case-insensitively like TRE does with REG_ICASE. Anything
+ * else (back-references, word boundaries, approximate matching, ...) is
+ * rejected by regex_set_add() and has to be matched individually by the
+ * caller.
+ *
+ * The DFA cache is bounded. Once it grows too large, it is flushed and
+ * rebuilt on demand.
+ */
+
+#include "FTL.h"
+#include "regex-set.h"
+// isalnum(), ...
+#include <ctype.h>
+
+// Limits keeping the automaton (and the time to build it) bounded
+#define MAX_NFA_NODES (1u << 20)
+#define MAX_PATTERN_NODES 4096u
+#define MAX_DEPTH 32u
+#define MAX_BRACKET_ITEMS 256u
+// Same as TRE's RE_DUP_MAX
+#define MAX_REPEAT 255u
+// The lazily constructed DFA is flushed once it exceeds this size
+#define DFA_CACHE_LIMIT (8u << 20)
+
+#define NONE UINT32_MAX
+
+enum nfa_type {
+	NFA_CHAR,
+	NFA_SPLIT,
+	NFA_EPS,
+	NFA_BOL,
+	NFA_EOL,
+	NFA_MATCH
+} __attribute__ ((packed));
+
+struct nfa_node {
+	uint32_t out;
+	// Second successor of NFA_SPLIT, character set of NFA_CHAR, pattern ID
+	// of NFA_MATCH
+	uint32_t arg;
+	enum nfa_type type;
+};
+
+struct charset {
+	uint64_t bits[4];
+};
+
+struct dfa_state {
+	uint64_t hash;
+	// Transitions per byte class (NONE if not yet known)
+	uint32_t *next;
+	// Patterns matched once this state is reached (NULL if none)
+	uint64_t *match;
+	// Patterns matched if the input ends in this state (NULL if none)
+	uint64_t *eol;
+	// Sorted NFA states making up this DFA state
+	uint32_t *nodes;
+	uint32_t num_nodes;
+	bool start;
+	// Bitmaps, NFA states and transitions (in this order)
+	uint64_t data[];
+};
+
+struct regex_set {
+	unsigned int patterns;
+	unsigned int words;
+	unsigned int supported;
+	bool finalized;
+	uint64_t *contains;
+
+	// Combined NFA
+	struct nfa_node *nfa;
+	uint32_t num_nfa, max_nfa;
+	struct charset *charsets;
+	uint32_t num_charsets, max_charsets;
+	uint32_t *roots;
+	uint32_t num_roots;
+
+	// Bytes are mapped onto classes that cannot be distinguished by any pattern
+	uint8_t byte_class[256];
+	uint8_t class_rep[256];
+	unsigned int num_classes;
+
+	// Lazily constructed DFA
+	struct dfa_state **states;
+	uint32_t num_states, max_states;
+	uint32_t *table;
+	uint32_t table_mask;
+	uint32_t start;
+	size_t dfa_memory;
+	unsigned int flushes;
+
+	// Scratch space
+	uint32_t *work, *stack, *visited;
+	uint32_t stamp;
+	uint64_t *tmp_match, *tmp_eol, *result;
+};
+
+struct parser {
+	struct regex_set *set;
+	const char *p;
+	uint32_t first;
+	unsigned int depth;
+	unsigned int bounds;
+	bool ok;
+};
+
+struct frag {
+	uint32_t start;
+	uint32_t end;
+	// May match the empty string (anchors are not counted as such)
+	bool nullable;
+	// Contains an anchor
+	bool anchored;
+};
+
+struct range {
+	int min;
+	int max;
+};
+
+static const struct frag no_frag = { NONE, NONE, false, false };
+
+static inline void cs_add(struct charset *cs, const int min, const int max)
+{
+	for(int c = min; c <= max; c++)
+		cs->bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline bool __attribute__((pure)) cs_test(const struct charset *cs, const unsigned char c)
+{
+	return (cs->bits[c >> 6] >> (c & 63)) & 1u;
+}
+
+static inline void set_bit(uint64_t *bitmap, const unsigned int bit)
+{
+	bitmap[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static struct frag fail(struct parser *ps)
+{
+	ps->ok = false;
+	return no_frag;
+}
+
+static uint32_t new_node(struct parser *ps, const enum nfa_type type, const uint32_t out, const uint32_t arg)
+{
+	struct regex_set *set = ps->set;
+	if(!ps->ok || set->num_nfa - ps->first >= MAX_PATTERN_NODES || set->num_nfa >= MAX_NFA_NODES)
+	{
+		ps->ok = false;
+		return NONE;
+	}
+
+	if(set->num_nfa == set->max_nfa)
+	{
+		const uint32_t max = set->max_nfa > 0 ? 2*set->max_nfa : 1024;
+		struct nfa_node *nfa = realloc(set->nfa, max * sizeof(*nfa));
+		if(nfa == NULL)
+		{
+			ps->ok = false;
+			return NONE;
+		}
+		set->nfa = nfa;
+		set->max_nfa = max;
+	}
+
+	struct nfa_node *node = &set->nfa[set->num_nfa];
+	node->type = type;
+	node->out = out;
+	node->arg = arg;
+
+	return set->num_nfa++;
+}
+
+static struct frag new_char(struct parser *ps, const struct charset *cs)
+{
+	struct regex_set *set = ps->set;
+	if(!ps->ok)
+		return no_frag;
+
+	if(set->num_charsets == set->max_charsets)
+	{
+		const uint32_t max = set->max_charsets > 0 ? 2*set->max_charsets : 256;
+		struct charset *charsets = realloc(set->charsets, max * sizeof(*charsets));
+		if(charsets == NULL)
+			return fail(ps);
+		set->charsets = charsets;
+		set->max_charsets = max;
+	}
+
+	const uint32_t n = new_node(ps, NFA_CHAR, NONE, set->num_charsets);
+	if(n == NONE)
+		return no_frag;
+	set->charsets[set->num_charsets++] = *cs;
+
+	return (struct frag){ n, n, false, false };
+}
+
+static struct frag new_single(struct parser *ps, const enum nfa_type type)
+{
+	const uint32_t n = new_node(ps, type, NONE, 0);
+	const bool anchor = type == NFA_BOL || type == NFA_EOL;
+	return (struct frag){ n, n, !anchor, anchor };
+}
+
+static struct frag cat(struct parser *ps, const struct frag a, const struct frag b)
+{
+	if(!ps->ok)
+		return no_frag;
+	ps->set->nfa[a.end].out = b.start;
+	return (struct frag){ a.start, b.end, a.nullable && b.nullable, a.anchored || b.anchored };
+}
+
+static struct frag alt(struct parser *ps, const struct frag a, const struct frag b)
+{
+	// TRE ignores empty alternatives next to anchors, e.g., "a($|)"
+	// does not match "ab"
+	if((a.anchored || b.anchored) && (a.nullable || b.nullable))
+		return fail(ps);
+
+	const uint32_t e = new_node(ps, NFA_EPS, NONE, 0);
+	const uint32_t s = new_node(ps, NFA_SPLIT, a.start, b.start);
+	if(!ps->ok)
+		return no_frag;
+	ps->set->nfa[a.end].out = e;
+	ps->set->nfa[b.end].out = e;
+	return (struct frag){ s, e, a.nullable || b.nullable, a.anchored || b.anchored };
+}
+
+// x* (loop = true) or x? (loop = false)
+static struct frag optional(struct parser *ps, const struct frag a, const bool loop)
+{
+	const uint32_t e = new_node(ps, NFA_EPS, NONE, 0);
+	const uint32_t s = new_node(ps, NFA_SPLIT, a.start, e);
+	if(!ps->ok)
+		return no_frag;
+	ps->set->nfa[a.end].out = loop ? s : e;
+	return (struct frag){ s, e, true, a.anchored };
+}
+
+static struct frag plus(struct parser *ps, const struct frag a)
+{
+	const uint32_t e = new_node(ps, NFA_EPS, NONE, 0);
+	const uint32_t s = new_node(ps, NFA_SPLIT, a.start, e);
+	if(!ps->ok)
+		return no_frag;
+	ps->set->nfa[a.end].out = s;
+	return (struct frag){ a.start, e, a.nullable, a.anchored };
+}
+
+static bool add_item(struct range *items, unsigned int *num, const int min, const int max)
+{
+	if(*num >= MAX_BRACKET_ITEMS)
+		return false;
+	items[*num].min = min;
+	items[*num].max = max;
+	(*num)++;
+	return true;
+}
+
+// Add opposite-case counterpoints of a range exactly like TRE does with
+// REG_ICASE. The resulting items matter for negated bracket expressions
+static bool add_counterpoints(struct range *items, unsigned int *num, int min, const int max)
+{
+	while(min <= max)
+	{
+		int cmin, ccurr;
+		if(islower(min))
+		{
+			cmin = ccurr = toupper(min++);
+			while(islower(min) && toupper(min) == ccurr + 1 && min <= max)
+				ccurr = toupper(min++);
+		}
+		else if(isupper(min))
+		{
+			cmin = ccurr = tolower(min++);
+			while(isupper(min) && tolower(min) == ccurr + 1 && min <= max)
+				ccurr = tolower(min++);
+		}
+		else
+		{
+			min++;
+			continue;
+		}
+		if(!add_item(items, num, cmin, ccurr))
+			return false;
+	}
+
+	return true;
+}
+
+static int is_alnum(int c) { return isalnum(c); }
+static int is_alpha(int c) { return isalpha(c); }
+static int is_ascii(int c) { return isascii(c); }
+static int is_blank(int c) { return isblank(c); }
+static int is_cntrl(int c) { return iscntrl(c); }
+static int is_digit(int c) { return isdigit(c); }
+static int is_graph(int c) { return isgraph(c); }
+static int is_lower(int c) { return islower(c); }
+static int is_print(int c) { return isprint(c); }
+static int is_punct(int c) { return ispunct(c); }
+static int is_space(int c) { return isspace(c); }
+static int is_upper(int c) { return isupper(c); }
+static int is_xdigit(int c) { return isxdigit(c); }
+
+static const struct {
+	const char *name;
+	int (*func)(int);
+} ctype_map[] = {
+	{ "alnum", is_alnum }, { "alpha", is_alpha }, { "ascii", is_ascii },
+	{ "blank", is_blank }, { "cntrl", is_cntrl }, { "digit", is_digit },
+	{ "graph", is_graph }, { "lower", is_lower }, { "print", is_print },
+	{ "punct", is_punct }, { "space", is_space }, { "upper", is_upper },
+	{ "xdigit", is_xdigit }
+};
+
+// Expand a character class into ranges (see tre_expand_ctype())
+static bool add_class(struct range *items, unsigned int *num, const char *name, const size_t len)
+{
+	int (*func)(int) = NULL;
+	for(unsigned int i = 0; i < ArraySize(ctype_map); i++)
+		if(strlen(ctype_map[i].name) == len && strncmp(ctype_map[i].name, name, len) == 0)
+			func = ctype_map[i].func;
+	if(func == NULL)
+		return false;
+
+	int min = -1, max = 0;
+	for(int c = 0; c < 256; c++)
+	{
+		if(func(c) || func(tolower(c)) || func(toupper(c)))
+		{
+			if(min < 0)
+				min = c;
+			max = c;
+		}
+		else if(min >= 0)
+		{
+			if(!add_item(items, num, min, max))
+				return false;
+			min = -1;
+		}
+	}
+	if(min >= 0 && !add_item(items, num, min, max))
+		return false;
+
+	return true;
+}
+
+static int cmp_range(const void *a, const void *b)
+{
+	const struct range *ra = a, *rb = b;
+	if(ra->min != rb->min)
+		return ra->min < rb->min ? -1 : 1;
+	if(ra->max != rb->max)
+		return ra->max < rb->max ? -1 : 1;
+	return 0;
+}
+
+// Parse a bracket expression, ps->p points behind the opening bracket
+static struct frag parse_bracket(struct parser *ps)
+{
+	struct range items[MAX_BRACKET_ITEMS];
+	unsigned int num = 0;
+
+	bool negate = false;
+	if(*ps->p == '^')
+	{
+		negate = true;
+		ps->p++;
+	}
+
+	const char *start = ps->p;
+	while(true)
+	{
+		const char *re = ps->p;
+		if(*re == '\0')
+			return fail(ps);
+		if(*re == ']' && re > start)
+		{
+			ps->p++;
+			break;
+		}
+
+		if(re[1] == '-' && re[2] != '\0' && re[2] != ']')
+		{
+			// Range
+			const int min = (unsigned char)re[0], max = (unsigned char)re[2];
+			ps->p += 3;
+			if(min > max || !add_item(items, &num, min, max) ||
+			   !add_counterpoints(items, &num, min, max))
+				return fail(ps);
+		}
+		else if(re[0] == '[' && (re[1] == '.' || re[1] == '='))
+		{
+			// Collating elements and equivalence classes
+			return fail(ps);
+		}
+		else if(re[0] == '[' && re[1] == ':')
+		{
+			// Character class
+			const char *end = strchr(re + 2, ':');
+			if(end == NULL || end[1] != ']' ||
+			   !add_class(items, &num, re + 2, end - re - 2))
+				return fail(ps);
+			ps->p = end + 2;
+		}
+		else
+		{
+			// Two ranges are not allowed to share an endpoint
+			if(re[0] == '-' && re[1] != ']' && re != start)
+				return fail(ps);
+			const int c = (unsigned char)re[0];
+			ps->p++;
+			if(!add_item(items, &num, c, c) ||
+			   !add_counterpoints(items, &num, c, c))
+				return fail(ps);
+		}
+	}
+
+	struct charset cs = { 0 };
+	if(!negate)
+	{
+		for(unsigned int i = 0; i < num; i++)
+			cs_add(&cs, items[i].min, items[i].max);
+		return new_char(ps, &cs);
+	}
+
+	// Build the complement the way TRE does. TRE gets the complement wrong
+	// if a range partially overlaps a preceding one (its result then even
+	// depends on the sort order), so we reject such expressions
+	qsort(items, num, sizeof(*items), cmp_range);
+	int curr_min = 0, curr_max = 0;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		if(items[i].min < curr_max)
+		{
+			if(items[i].max + 1 > curr_max)
+				return fail(ps);
+			continue;
+		}
+
+		curr_max = items[i].min - 1;
+		if(curr_max >= curr_min)
+			cs_add(&cs, curr_min, curr_max);
+		curr_min = curr_max = items[i].max + 1;
+	}
+	cs_add(&cs, curr_min, 255);
+
+	return new_char(ps, &cs);
+}
+
+static struct frag parse_alt(struct parser *ps);
+
+static struct frag parse_escape(struct parser *ps)
+{
+	static const struct {
+		char c;
+		const char *expansion;
+	} macros[] = {
+		{ 'w', "[:alnum:]_]" }, { 'W', "^[:alnum:]_]" },
+		{ 's', "[:space:]]" },  { 'S', "^[:space:]]" },
+		{ 'd', "[:digit:]]" },  { 'D', "^[:digit:]]" }
+	};
+	static const char control[][2] = {
+		{ 't', '\t' }, { 'n', '\n' }, { 'r', '\r' },
+		{ 'f', '\f' }, { 'a', '\a' }, { 'e', '\033' }
+	};
+
+	const char c = ps->p[1];
+	for(unsigned int i = 0; i < ArraySize(macros); i++)
+	{
+		if(macros[i].c != c)
+			continue;
+
+		// Parse the expanded bracket expression instead
+		const char *next = ps->p + 2;
+		ps->p = macros[i].expansion;
+		const struct frag f = parse_bracket(ps);
+		ps->p = next;
+		return f;
+	}
+
+	struct charset cs = { 0 };
+	for(unsigned int i = 0; i < ArraySize(control); i++)
+	{
+		if(control[i][0] != c)
+			continue;
+
+		ps->p += 2;
+		cs_add(&cs, control[i][1], control[i][1]);
+		return new_char(ps, &cs);
+	}
+
+	// Back-references, word boundaries ("\b", "\<", "\>"), hex escapes,
+	// etc. are not supported
+	if(c == '\0' || c == '<' || c == '>' || isalnum((unsigned char)c))
+		return fail(ps);
+
+	// Escaped character (no case folding)
+	ps->p += 2;
+	cs_add(&cs, (unsigned char)c, (unsigned char)c);
+	return new_char(ps, &cs);
+}
+
+static struct frag parse_atom(struct parser *ps)
+{
+	if(!ps->ok)
+		return no_frag;
+
+	struct charset cs = { 0 };
+	const unsigned char c = *ps->p;
+	switch(c)
+	{
+		case '(':
+		{
+			// TRE's "(?...)" extensions are not supported
+			if(ps->p[1] == '?' || ++ps->depth > MAX_DEPTH)
+				return fail(ps);
+			ps->p++;
+			const struct frag f = parse_alt(ps);
+			if(!ps->ok || *ps->p != ')')
+				return fail(ps);
+			ps->p++;
+			ps->depth--;
+			return f;
+		}
+
+		case '.':
+			ps->p++;
+			cs_add(&cs, 0, 255);
+			return new_char(ps, &cs);
+
+		case '^':
+			ps->p++;
+			return new_single(ps, NFA_BOL);
+
+		case '$':
+			ps->p++;
+			return new_single(ps, NFA_EOL);
+
+		case '[':
+			ps->p++;
+			return parse_bracket(ps);
+
+		case '\\':
+			return parse_escape(ps);
+
+		// Unbalanced parentheses and repetitions without anything to
+		// repeat
+		case ')':
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+		case '|':
+		case '\0':
+			return fail(ps);
+
+		default:
+			ps->p++;
+			cs_add(&cs, c, c);
+			if(isupper(c) || islower(c))
+			{
+				cs_add(&cs, toupper(c), toupper(c));
+				cs_add(&cs, tolower(c), tolower(c));
+			}
+			return new_char(ps, &cs);
+	}
+}
+
+static bool parse_number(struct parser *ps, unsigned int *num)
+{
+	if(!isdigit((unsigned char)*ps->p))
+		return false;
+
+	*num = 0;
+	while(isdigit((unsigned char)*ps->p))
+	{
+		*num = 10 * *num + (*ps->p++ - '0');
+		if(*num > MAX_REPEAT)
+			return false;
+	}
+
+	return true;
+}
+
+// Parse a bound "{m}", "{m,}", or "{m,n}" and repeat the atom starting at
+// atom accordingly
+static struct frag parse_bound(struct parser *ps, const char *atom)
+{
+	unsigned int min = 0, max = 0;
+	bool infinite = false;
+
+	ps->p++;
+	if(!parse_number(ps, &min))
+		return fail(ps);
+	max = min;
+	if(*ps->p == ',')
+	{
+		ps->p++;
+		if(*ps->p == '}')
+			infinite = true;
+		else if(!parse_number(ps, &max))
+			return fail(ps);
+	}
+	// Approximate matching parameters and minimal bounds are not supported
+	if(*ps->p != '}' || ps->p[1] == '?' || (!infinite && min > max))
+		return fail(ps);
+	const char *next = ps->p + 1;
+	ps->bounds++;
+
+	// Build min mandatory copies of the atom followed by either a loop or
+	// (max - min) nested optional copies
+	struct frag f = new_single(ps, NFA_EPS);
+	for(unsigned int i = 0; i < min; i++)
+	{
+		ps->p = atom;
+		f = cat(ps, f, parse_atom(ps));
+	}
+
+	if(infinite)
+	{
+		ps->p = atom;
+		f = cat(ps, f, optional(ps, parse_atom(ps), true));
+	}
+	else if(max > min)
+	{
+		struct frag opt = new_single(ps, NFA_EPS);
+		for(unsigned int i = min; i < max; i++)
+		{
+			ps->p = atom;
+			opt = optional(ps, cat(ps, parse_atom(ps), opt), false);
+		}
+		f = cat(ps, f, opt);
+	}
+
+	ps->p = next;
+	return f;
+}
+
+static struct frag parse_piece(struct parser *ps)
+{
+	const char *atom = ps->p;
+	const unsigned int bounds = ps->bounds;
+	struct frag f = parse_atom(ps);
+	bool repeated = false;
+
+	while(ps->ok)
+	{
+		const char c = *ps->p;
+		// TRE does not handle repeated anchors consistently (e.g., "^?"
+		// never matches after the first character) and may match too
+		// much when repeating groups containing bounds, we leave both
+		// to TRE
+		if((c == '*' || c == '+' || c == '?' || c == '{') &&
+		   (f.anchored || ps->bounds != bounds))
+			return fail(ps);
+		if(c == '*' || c == '+' || c == '?')
+		{
+			ps->p++;
+			// A trailing "?" only selects minimal matching, this
+			// does not change whether the pattern matches at all
+			if(*ps->p == '?')
+				ps->p++;
+			f = c == '+' ? plus(ps, f) : optional(ps, f, c == '*');
+		}
+		else if(c == '{')
+		{
+			// Bounds have to be applied directly to an atom
+			if(repeated)
+				return fail(ps);
+			f = parse_bound(ps, atom);
+		}
+		else
+			break;
+
+		repeated = true;
+	}
+
+	return f;
+}
+
+static struct frag parse_branch(struct parser *ps)
+{
+	struct frag f = new_single(ps, NFA_EPS);
+	while(ps->ok && *ps->p != '\0' && *ps->p != '|' && !(*ps->p == ')' && ps->depth > 0))
+		f = cat(ps, f, parse_piece(ps));
+
+	return f;
+}
+
+static struct frag parse_alt(struct parser *ps)
+{
+	struct frag f = parse_branch(ps);
+	while(ps->ok && *ps->p == '|')
+	{
+		ps->p++;
+		f = alt(ps, f, parse_branch(ps));
+	}
+
+	return f;
+}
+
+/**
+ * @brief Create a new, empty regex set
+ *
+ * @param patterns Number of pattern IDs (IDs are 0 ... patterns-1)
+ * @return New set or NULL on error
+ */
+struct regex_set *regex_set_new(const unsigned int patterns)
+{
+	struct regex_set *set = calloc(1, sizeof(*set));
+	if(set == NULL)
+		return NULL;
+
+	set->patterns = patterns;
+	set->words = (patterns + 63) / 64;
+	set->start = NONE;
+	set->contains = calloc(set->words + 1, sizeof(uint64_t));
+	set->roots = calloc(patterns + 1, sizeof(uint32_t));
+	if(set->contains == NULL || set->roots == NULL)
+	{
+		regex_set_free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+/**
+ * @brief Add a regex to the set
+ *
+ * @param set Set to add the regex to
+ * @param id Pattern ID reported by regex_set_match()
+ * @param pattern Regular expression (TRE extended syntax, without FTL's
+ * ";option" extensions)
+ * @return true if the regex has been added, false if it cannot be represented
+ * by the combined automaton and has to be matched individually
+ */
+bool regex_set_add(struct regex_set *set, const unsigned int id, const char *pattern)
+{
+	if(set->finalized || id >= set->patterns || regex_set_contains(set, id))
+		return false;
+
+	// Only printable ASCII is supported, anything else depends on the locale
+	for(const char *c = pattern; *c != '\0'; c++)
+		if(*c < 0x20 || *c > 0x7e)
+			return false;
+
+	const uint32_t nfa_mark = set->num_nfa;
+	const uint32_t charset_mark = set->num_charsets;
+	struct parser ps = { .set = set, .p = pattern, .first = nfa_mark, .depth = 0, .bounds = 0, .ok = true };
+
+	const struct frag f = parse_alt(&ps);
+	if(ps.ok && *ps.p != '\0')
+		ps.ok = false;
+	const uint32_t match = new_node(&ps, NFA_MATCH, NONE, id);
+	if(!ps.ok)
+	{
+		// Roll back everything this pattern has added
+		set->num_nfa = nfa_mark;
+		set->num_charsets = charset_mark;
+		return false;
+	}
+
+	set->nfa[f.end].out = match;
+	set->roots[set->num_roots++] = f.start;
+	set_bit(set->contains, id);
+	set->supported++;
+
+	return true;
+}
+
+static void new_stamp(struct regex_set *set)
+{
+	if(++set->stamp == 0)
+	{
+		memset(set->visited, 0, set->num_nfa * sizeof(*set->visited));
+		set->stamp = 1;
+	}
+}
+
+// Collect all NFA states reachable from seed without consuming input
+static void closure(struct regex_set *set, const uint32_t seed, const bool at_start, uint32_t *num)
+{
+	uint32_t sp = 0;
+	set->stack[sp++] = seed;
+	while(sp > 0)
+	{
+		const uint32_t x = set->stack[--sp];
+		if(set->visited[x] == set->stamp)
+			continue;
+		set->visited[x] = set->stamp;
+
+		const struct nfa_node *node = &set->nfa[x];
+		switch(node->type)
+		{
+			case NFA_CHAR:
+			case NFA_EOL:
+			case NFA_MATCH:
+				set->work[(*num)++] = x;
+				break;
+			case NFA_SPLIT:
+				set->stack[sp++] = node->arg;
+				set->stack[sp++] = node->out;
+				break;
+			case NFA_BOL:
+				if(!at_start)
+					break;
+				// Fall through
+			case NFA_EPS:
+				set->stack[sp++] = node->out;
+				break;
+		}
+	}
+}
+
+// Determine which patterns match if the input ends in a state consisting of
+// the given NFA states
+static bool eol_matches(struct regex_set *set, const uint32_t *nodes, const uint32_t num, const bool start)
+{
+	bool any = false;
+	memset(set->tmp_eol, 0, set->words * sizeof(uint64_t));
+	new_stamp(set);
+
+	uint32_t sp = 0;
+	for(uint32_t i = 0; i < num; i++)
+		if(set->nfa[nodes[i]].type == NFA_EOL)
+			set->stack[sp++] = set->nfa[nodes[i]].out;
+
+	while(sp > 0)
+	{
+		const uint32_t x = set->stack[--sp];
+		if(set->visited[x] == set->stamp)
+			continue;
+		set->visited[x] = set->stamp;
+
+		const struct nfa_node *node = &set->nfa[x];
+		switch(node->type)
+		{
+			case NFA_MATCH:
+				set_bit(set->tmp_eol, node->arg);
+				any = true;
+				break;
+			case NFA_SPLIT:
+				set->stack[sp++] = node->arg;
+				set->stack[sp++] = node->out;
+				break;
+			case NFA_BOL:
+				// Only possible for empty input
+				if(!start)
+					break;
+				// Fall through
+			case NFA_EPS:
+			case NFA_EOL:
+				set->stack[sp++] = node->out;
+				break;
+			case NFA_CHAR:
+				break;
+		}
+	}
+
+	return any;
+}
+
+static uint64_t __attribute__((pure)) hash_nodes(const uint32_t *nodes, const uint32_t num, const bool start)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ start;
+	for(uint32_t i = 0; i < num; i++)
+	{
+		h ^= nodes[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h ^ (h >> 32);
+}
+
+static int cmp_node(const void *a, const void *b)
+{
+	const uint32_t na = *(const uint32_t*)a, nb = *(const uint32_t*)b;
+	return (na > nb) - (na < nb);
+}
+
+static void flush_cache(struct regex_set *set)
+{
+	for(uint32_t i = 0; i < set->num_states; i++)
+		free(set->states[i]);
+	set->num_states = 0;
+	set->dfa_memory = 0;
+	set->start = NONE;
+	if(set->table != NULL)
+		memset(set->table, 0xff, (set->table_mask + 1) * sizeof(*set->table));
+	set->flushes++;
+}
+
+static bool grow_table(struct regex_set *set)
+{
+	const uint32_t size = set->table != NULL ? 2*(set->table_mask + 1) : 1024;
+	uint32_t *table = malloc(size * sizeof(*table));
+	if(table == NULL)
+		return false;
+	memset(table, 0xff, size * sizeof(*table));
+
+	for(uint32_t i = 0; i < set->num_states; i++)
+	{
+		uint32_t pos = set->states[i]->hash & (size - 1);
+		while(table[pos] != NONE)
+			pos = (pos + 1) & (size - 1);
+		table[pos] = i;
+	}
+
+	if(set->table != NULL)
+		free(set->table);
+	set->table = table;
+	set->table_mask = size - 1;
+
+	return true;
+}
+
+// Find or create the DFA state consisting of the given (sorted) NFA states
+static uint32_t get_state(struct regex_set *set, const uint32_t *nodes, const uint32_t num, const bool start)
+{
+	const uint64_t hash = hash_nodes(nodes, num, start);
+	for(uint32_t pos = hash & set->table_mask; set->table[pos] != NONE; pos = (pos + 1) & set->table_mask)
+	{
+		const struct dfa_state *state = set->states[set->table[pos]];
+		if(state->hash == hash && state->start == start && state->num_nodes == num &&
+		   memcmp(state->nodes, nodes, num * sizeof(*nodes)) == 0)
+			return set->table[pos];
+	}
+
+	// Determine the patterns matched by this state
+	bool match = false;
+	memset(set->tmp_match, 0, set->words * sizeof(uint64_t));
+	for(uint32_t i = 0; i < num; i++)
+	{
+		if(set->nfa[nodes[i]].type == NFA_MATCH)
+		{
+			set_bit(set->tmp_match, set->nfa[nodes[i]].arg);
+			match = true;
+		}
+	}
+	const bool eol = eol_matches(set, nodes, num, start);
+
+	const unsigned int words = (match ? set->words : 0) + (eol ? set->words : 0);
+	const size_t size = sizeof(struct dfa_state) + words * sizeof(uint64_t) +
+	                    num * sizeof(*nodes) + set->num_classes * sizeof(uint32_t);
+
+	// Start over if the cache is full
+	if(set->dfa_memory + size > DFA_CACHE_LIMIT && set->num_states > 0)
+		flush_cache(set);
+
+	if(set->num_states == set->max_states)
+	{
+		const uint32_t max = set->max_states > 0 ? 2*set->max_states : 256;
+		struct dfa_state **states = realloc(set->states, max * sizeof(*states));
+		if(states == NULL)
+			return NONE;
+		set->states = states;
+		set->max_states = max;
+	}
+	if(2*(set->num_states + 1) > set->table_mask + 1 && !grow_table(set))
+		return NONE;
+
+	struct dfa_state *state = malloc(size);
+	if(state == NULL)
+		return NONE;
+
+	state->hash = hash;
+	state->start = start;
+	state->match = NULL;
+	state->eol = NULL;
+	uint64_t *bitmap = state->data;
+	if(match)
+	{
+		state->match = bitmap;
+		memcpy(state->match, set->tmp_match, set->words * sizeof(uint64_t));
+		bitmap += set->words;
+	}
+	if(eol)
+	{
+		state->eol = bitmap;
+		memcpy(state->eol, set->tmp_eol, set->words * sizeof(uint64_t));
+	}
+	state->nodes = (uint32_t*)(state->data + words);
+	state->num_nodes = num;
+	memcpy(state->nodes, nodes, num * sizeof(*nodes));
+	state->next = state->nodes + num;
+	memset(state->next, 0xff, set->num_classes * sizeof(uint32_t));
+
+	const uint32_t id = set->num_states++;
+	set->states[id] = state;
+	set->dfa_memory += size;
+
+	uint32_t pos = hash & set->table_mask;
+	while(set->table[pos] != NONE)
+		pos = (pos + 1) & set->table_mask;
+	set->table[pos] = id;
+
+	return id;
+}
+
+static uint32_t start_state(struct regex_set *set)
+{
+	uint32_t num = 0;
+	new_stamp(set);
+	for(uint32_t i = 0; i < set->num_roots; i++)
+		closure(set, set->roots[i], true, &num);
+	qsort(set->work, num, sizeof(*set->work), cmp_node);
+
+	return set->start = get_state(set, set->work, num, true);
+}
+
+static uint32_t next_state(struct regex_set *set, const uint32_t current, const uint8_t class)
+{
+	const struct dfa_state *state = set->states[current];
+	const unsigned char c = set->class_rep[class];
+
+	uint32_t num = 0;
+	new_stamp(set);
+	for(uint32_t i = 0; i < state->num_nodes; i++)
+	{
+		const struct nfa_node *node = &set->nfa[state->nodes[i]];
+		if(node->type == NFA_CHAR && cs_test(&set->charsets[node->arg], c))
+			closure(set, node->out, false, &num);
+	}
+
+	// Unanchored search: every pattern may start at any position
+	for(uint32_t i = 0; i < set->num_roots; i++)
+		closure(set, set->roots[i], false, &num);
+	qsort(set->work, num, sizeof(*set->work), cmp_node);
+
+	const unsigned int flushes = set->flushes;
+	const uint32_t next = get_state(set, set->work, num, false);
+	// The current state is gone if the cache has been flushed
+	if(next != NONE && flushes == set->flushes)
+		set->states[current]->next[class] = next;
+
+	return next;
+}
+
+/**
+ * @brief Finish the set after all patterns have been added
+ *
+ * @return true if the set can be used for matching (at least one pattern
+ * has been added successfully)
+ */
+bool regex_set_finalize(struct regex_set *set)
+{
+	if(set->finalized || set->supported == 0)
+		return false;
+
+	// Partition the bytes into classes the patterns cannot distinguish
+	unsigned int num_classes = 1;
+	memset(set->byte_class, 0, sizeof(set->byte_class));
+	for(uint32_t i = 0; i < set->num_charsets; i++)
+	{
+		uint16_t map[2*256];
+		uint8_t refined[256];
+		unsigned int num = 0;
+		memset(map, 0xff, sizeof(map));
+		for(unsigned int c = 0; c < 256; c++)
+		{
+			const unsigned int key = 2*set->byte_class[c] + cs_test(&set->charsets[i], c);
+			if(map[key] == UINT16_MAX)
+				map[key] = num++;
+			refined[c] = map[key];
+		}
+		memcpy(set->byte_class, refined, sizeof(refined));
+		num_classes = num;
+	}
+	set->num_classes = num_classes;
+	for(int c = 255; c >= 0; c--)
+		set->class_rep[set->byte_class[c]] = c;
+
+	set->work = calloc(set->num_nfa, sizeof(*set->work));
+	set->stack = calloc(3*set->num_nfa + 2, sizeof(*set->stack));
+	set->visited = calloc(set->num_nfa, sizeof(*set->visited));
+	set->tmp_match = calloc(set->words, sizeof(uint64_t));
+	set->tmp_eol = calloc(set->words, sizeof(uint64_t));
+	set->result = calloc(set->words, sizeof(uint64_t));
+	if(set->work == NULL || set->stack == NULL || set->visited == NULL ||
+	   set->tmp_match == NULL || set->tmp_eol == NULL || set->result == NULL ||
+	   !grow_table(set))
+		return false;
+
+	set->finalized = true;
+
+	return start_state(set) != NONE;
+}
+
+/**
+ * @brief Match an input against all patterns of the set
+ *
+ * @param set Finalized set
+ * @param input Input string
+ * @return Bitmap of matching pattern IDs (regex_set_words() words, valid
+ * until the next call) or NULL on error
+ */
+const uint64_t *regex_set_match(struct regex_set *set, const char *input)
+{
+	if(!set->finalized)
+		return NULL;
+
+	uint32_t current = set->start;
+	if(current == NONE && (current = start_state(set)) == NONE)
+		return NULL;
+
+	uint64_t *result = set->result;
+	memset(result, 0, set->words * sizeof(uint64_t));
+
+	const struct dfa_state *state = set->states[current];
+	if(state->match != NULL)
+		for(unsigned int w = 0; w < set->words; w++)
+			result[w] |= state->match[w];
+
+	for(const unsigned char *c = (const unsigned char*)input; *c != '\0'; c++)
+	{
+		const uint8_t class = set->byte_class[*c];
+		uint32_t next = state->next[class];
+		if(next == NONE && (next = next_state(set, current, class)) == NONE)
+			return NULL;
+
+		current = next;
+		state = set->states[current];
+		if(state->match != NULL)
+			for(unsigned int w = 0; w < set->words; w++)
+				result[w] |= state->match[w];
+	}
+
+	if(state->eol != NULL)
+		for(unsigned int w = 0; w < set->words; w++)
+			result[w] |= state->eol[w];
+
+	return result;
+}
+
+bool regex_set_contains(const struct regex_set *set, const unsigned int id)
+{
+	return id < set->patterns && ((set->contains[id / 64] >> (id % 64)) & 1u);
+}
+
+unsigned int regex_set_words(const struct regex_set *set)
+{
+	return set->words;
+}
+
+void regex_set_stats(const struct regex_set *set, struct regex_set_stats *stats)
+{
+	stats->patterns = set->patterns;
+	stats->supported = set->supported;
+	stats->nfa_nodes = set->num_nfa;
+	stats->byte_classes = set->num_classes;
+	stats->dfa_states = set->num_states;
+	stats->cache_flushes = set->flushes;
+	stats->memory = sizeof(*set) + set->dfa_memory +
+	                set->max_nfa * sizeof(*set->nfa) +
+	                set->max_charsets * sizeof(*set->charsets) +
+	                (set->table != NULL ? (set->table_mask + 1) * sizeof(*set->table) : 0);
+}
+
+void regex_set_free(struct regex_set *set)
+{
+	if(set == NULL)
+		return;
+
+	for(uint32_t i = 0; i < set->num_states; i++)
+		free(set->states[i]);
+	free(set->states);
+	free(set->table);
+	free(set->nfa);
+	free(set->charsets);
+	free(set->roots);
+	free(set->contains);
+	free(set->work);
+	free(set->stack);
+	free(set->visited);
+	free(set->tmp_match);
+	free(set->tmp_eol);
+	free(set->result);
+	free(set);
+}
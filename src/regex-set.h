@@ -0,0 +1,38 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2025 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Multi-pattern regex engine prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef REGEX_SET_H
+#define REGEX_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct regex_set_stats {
+	unsigned int patterns;
+	unsigned int supported;
+	unsigned int nfa_nodes;
+	unsigned int byte_classes;
+	unsigned int dfa_states;
+	unsigned int cache_flushes;
+	size_t memory;
+};
+
+struct regex_set;
+
+struct regex_set *regex_set_new(const unsigned int patterns) __attribute__((malloc));
+bool regex_set_add(struct regex_set *set, const unsigned int id, const char *pattern);
+bool regex_set_finalize(struct regex_set *set);
+const uint64_t *regex_set_match(struct regex_set *set, const char *input);
+bool regex_set_contains(const struct regex_set *set, const unsigned int id) __attribute__((pure));
+unsigned int regex_set_words(const struct regex_set *set) __attribute__((pure));
+void regex_set_stats(const struct regex_set *set, struct regex_set_stats *stats);
+void regex_set_free(struct regex_set *set);
+
+#endif //REGEX_SET_H
@@ -25,6 +25,14 @@
 #include "config/config.h"
 // cli_stuff()
 #include "args.h"
+// struct regex_set
+#include "regex-set.h"
+// struct regex_prefilter
+#include "regex-prefilter.h"
+// gravity_hash()
+#include "database/gravity-index.h"
+// UINT_MAX
+#include <limits.h>
 
 const char *regextype[REGEX_MAX] = { "deny", "allow", "CLI" };
 // Safety-measure for future extensions
@@ -39,6 +47,47 @@ static unsigned int num_regex[REGEX_MAX] = { 0 };
 unsigned int regex_change = 0;
 static char regex_msg[REGEX_MSG_LEN] = { 0 };
 
+// Combined automata matching all deny or allow regex at once (NULL if not in
+// use) and bitmaps of the regex which have to be matched individually because
+// the automaton cannot represent them (or because they are inverted)
+static struct regex_set *regex_set[REGEX_MAX] = { NULL };
+static uint64_t *regex_recheck[REGEX_MAX] = { NULL };
+
+// Literal prefilters selecting the regex which may match a domain at all
+// (NULL if there are no regex with a usable literal)
+static struct regex_prefilter *regex_prefilter[REGEX_MAX] = { NULL };
+
+// Whether any regex of this type is restricted to specific query types
+static bool regex_query_type[REGEX_MAX] = { false };
+
+// Compiled regex of the previous reload. read_regex_table() takes over
+// unchanged entries (same string including all options) instead of compiling
+// them again, whatever is left over is freed afterwards
+static struct regex_cache {
+	regexData *regex;
+	unsigned int count;
+	unsigned int mask;
+	unsigned int *index; // open addressing, UINT_MAX marks empty slots
+} regex_cache[REGEX_MAX] = {{ NULL, 0, 0, NULL }};
+
+// Memoized results of in_regex(). The memo is private to each process (forks
+// inherit a copy) and bounded, each domain maps onto exactly one slot. Entries
+// are only valid in the generation they have been stored in, the generation
+// changes whenever the regex are reloaded (see free_regex())
+#define REGEX_MEMO_SIZE 4096u
+struct regex_memo {
+	uint64_t domain;
+	uint64_t mask;
+	unsigned int generation;
+	int query_type;
+	enum regex_type regexid;
+	int database_id;
+	enum reply_type force_reply;
+	char *cname_target;
+};
+static struct regex_memo *regex_memo = NULL;
+static unsigned int regex_memo_generation = 1u;
+
 static inline regexData *get_regex_ptr(const enum regex_type regexid)
 {
 	switch (regexid)
@@ -367,6 +416,149 @@ bool compile_regex(const char *regexin, regexData *regex, char **message)
 	return true;
 }
 
+// Apply extended regex settings of a matching regex to the DNS cache entry.
+// Returns false if the regex does not apply to this query (query type
+// mismatch)
+static bool apply_regex_ext(const regexData *regex, const char *input, DNSCacheData *dns_cache,
+                            const enum regex_type regexid, const unsigned int index)
+{
+	if(dns_cache == NULL)
+		return true;
+
+	// Check query type filtering
+	if(regex->ext.query_type != 0)
+	{
+		if(!(regex->ext.query_type & (1 << dns_cache->query_type)))
+		{
+			log_debug(DEBUG_REGEX, "Regex %s (%u, DB ID %i) NO match: \"%s\" vs. \"%s\""
+			                       " (skipped because of query type mismatch)",
+			          regextype[regexid], index, regex->database_id,
+			          input, regex->string);
+			return false;
+		}
+	}
+	// Set special reply type if configured for this regex
+	if(regex->ext.reply != REPLY_UNKNOWN)
+		dns_cache->force_reply = regex->ext.reply;
+
+	// Set CNAME target if configured for this regex
+	if(regex->ext.cname_target != NULL)
+		dns_cache->cname_target = regex->ext.cname_target;
+
+	return true;
+}
+
+// Try to match a single compiled regular expression against input (ignoring
+// possible inversion)
+bool regex_matches(regexData *regex, const char *input)
+{
+#ifdef USE_TRE_REGEX
+	regmatch_t match[1] = {{ 0 }}; // This also disables any sub-matching
+	return tre_regexec(&regex->regex, input, 0, match, 0) == REG_OK;
+#else
+	return regexec(&regex->regex, input, 0, NULL, 0) == REG_OK;
+#endif
+}
+
+// Check if the regex with this index is a candidate for the input scanned by
+// prefilter_regex()
+static inline bool is_candidate(const uint64_t *candidates, const unsigned int index)
+{
+	return candidates == NULL || ((candidates[index / 64] >> (index % 64)) & 1u);
+}
+
+// Scan input for the literals required by the regex of this type. Returns a
+// bitmap of the regex which may match or NULL if all regex have to be checked
+static const uint64_t *prefilter_regex(const char *input, const enum regex_type regexid)
+{
+	struct regex_prefilter *pf = regex_prefilter[regexid];
+	if(pf == NULL)
+		return NULL;
+
+	unsigned int num = 0;
+	const uint64_t *candidates = regex_prefilter_scan(pf, input, &num);
+
+	if(config.debug.regex.v.b)
+	{
+		struct regex_prefilter_stats stats = { 0 };
+		regex_prefilter_stats(pf, &stats);
+		log_debug(DEBUG_REGEX, "Regex %s: Literal prefilter selected %u of %u regex for \"%s\" "
+		                       "(%.1f skipped per query, %.1f%% hit rate over %lu queries)",
+		          regextype[regexid], num, stats.patterns, input,
+		          (double)stats.skipped / stats.scans,
+		          stats.literals > 0 ? 100.0 * stats.hits / ((double)stats.literals * stats.scans) : 0.0,
+		          stats.scans);
+	}
+
+	return candidates;
+}
+
+// Match input against the combined automaton of this regex type. Only the
+// regex reported by the automaton (and those which have to be checked
+// individually and pass the prefilter) are considered further, in the same
+// order as in match_regex(). Returns -2 if the automaton failed and the caller
+// should fall back to matching one regex after another
+static int match_regex_set(const char *input, DNSCacheData *dns_cache, const int clientID,
+                           const enum regex_type regexid, const uint64_t *candidates)
+{
+	struct regex_set *set = regex_set[regexid];
+	const uint64_t *matches = regex_set_match(set, input);
+	if(matches == NULL)
+		return -2;
+
+	regexData *regexes = get_regex_ptr(regexid);
+	const unsigned int offset = regexid == REGEX_ALLOW ? num_regex[REGEX_DENY] : 0;
+	const uint64_t *recheck = regex_recheck[regexid];
+
+	// Verify the combined automaton when debugging regex
+	if(config.debug.regex.v.b)
+	{
+		for(unsigned int index = 0; index < num_regex[regexid]; index++)
+		{
+			if(!regex_set_contains(set, index))
+				continue;
+			const bool automaton = (matches[index / 64] >> (index % 64)) & 1u;
+			if(automaton != regex_matches(&regexes[index], input))
+				log_warn("Regex %s (%u, DB ID %d) \"%s\": combined automaton %s \"%s\" but TRE does not",
+				         regextype[regexid], index, regexes[index].database_id, regexes[index].string,
+				         automaton ? "matches" : "does not match", input);
+		}
+	}
+
+	for(unsigned int w = 0; w < regex_set_words(set); w++)
+	{
+		uint64_t bits = matches[w] | (recheck[w] & (candidates != NULL ? candidates[w] : UINT64_MAX));
+		while(bits != 0)
+		{
+			const unsigned int index = 64*w + __builtin_ctzll(bits);
+			const bool individual = (recheck[w] >> (index % 64)) & 1u;
+			bits &= bits - 1;
+
+			regexData *regex = &regexes[index];
+			// Only use regular expressions enabled for this client
+			if(clientID >= 0 && !get_per_client_regex(clientID, offset + index))
+				continue;
+
+			if(individual && regex_matches(regex, input) == regex->ext.inverted)
+				continue;
+
+			if(!apply_regex_ext(regex, input, dns_cache, regexid, index))
+				continue;
+
+			log_debug(DEBUG_REGEX, "Regex %s (%u, DB ID %i) >> MATCH: \"%s\" vs. \"%s\"",
+			          regextype[regexid], index, regex->database_id,
+			          input, regex->string);
+
+			return regex->database_id;
+		}
+	}
+
+	log_debug(DEBUG_REGEX, "Regex %s: NO match for \"%s\" (combined automaton)",
+	          regextype[regexid], input);
+
+	return -1;
+}
+
 static int match_regex(const char *input, DNSCacheData *dns_cache, const int clientID,
                        const enum regex_type regexid, const bool regextest, cJSON *json)
 {
@@ -384,6 +576,20 @@ static int match_regex(const char *input, DNSCacheData *dns_cache, const int cli
 		read_regex_from_database();
 	}
 
+	// Skip regex lacking literals they require (not when testing regex so
+	// all of them are reported)
+	const uint64_t *candidates = regextest ? NULL : prefilter_regex(input, regexid);
+
+	// Use the combined automaton (if available) when only looking for the
+	// first match
+	if(!regextest && json == NULL && regex_set[regexid] != NULL)
+	{
+		match_idx = match_regex_set(input, dns_cache, clientID, regexid, candidates);
+		if(match_idx != -2)
+			return match_idx;
+		match_idx = -1;
+	}
+
 	// Loop over all configured regex filters of this type
 	for(unsigned int index = 0; index < num_regex[regexid]; index++)
 	{
@@ -420,6 +626,15 @@ static int match_regex(const char *input, DNSCacheData *dns_cache, const int cli
 			continue;
 		}
 
+		// Skip regex whose required literal is not contained in input
+		if(!is_candidate(candidates, index))
+		{
+			log_debug(DEBUG_REGEX, "Regex %s (FTL %u, DB %i) NO match: \"%s\" (input) vs. \"%s\" (regex)"
+			                       " (skipped by literal prefilter)",
+			          regextype[regexid], index, regex->database_id, input, regex->string);
+			continue;
+		}
+
 		// Try to match the compiled regular expression against input
 #ifdef USE_TRE_REGEX
 		int retval = tre_regexec(&regex->regex, input, 0, match, 0);
@@ -431,28 +646,8 @@ static int match_regex(const char *input, DNSCacheData *dns_cache, const int cli
 		    (retval == REG_NOMATCH && regex->ext.inverted))
 		{
 			// Check possible additional regex settings
-			if(dns_cache != NULL)
-			{
-				// Check query type filtering
-				if(regex->ext.query_type != 0)
-				{
-					if(!(regex->ext.query_type & (1 << dns_cache->query_type)))
-					{
-						log_debug(DEBUG_REGEX, "Regex %s (%u, DB ID %i) NO match: \"%s\" vs. \"%s\""
-						                       " (skipped because of query type mismatch)",
-						          regextype[regexid], index, regex->database_id,
-						          input, regex->string);
-						continue;
-					}
-				}
-				// Set special reply type if configured for this regex
-				if(regex->ext.reply != REPLY_UNKNOWN)
-					dns_cache->force_reply = regex->ext.reply;
-
-				// Set CNAME target if configured for this regex
-				if(regex->ext.cname_target != NULL)
-					dns_cache->cname_target = regex->ext.cname_target;
-			}
+			if(!apply_regex_ext(regex, input, dns_cache, regexid, index))
+				continue;
 
 			// Match, return true
 			match_idx = regex->database_id;
@@ -537,14 +732,128 @@ static int match_regex(const char *input, DNSCacheData *dns_cache, const int cli
 	return match_idx;
 }
 
+// Get the memo slot of this domain for the given client. The result depends on
+// the domain, the regex enabled for the client and (only if any regex of this
+// type uses it) the query type. key receives the identity of the result.
+// Returns NULL if the result cannot be memoized
+static struct regex_memo *get_regex_memo(const char *domain, const DNSCacheData *dns_cache,
+                                         const int clientID, const enum regex_type regexid,
+                                         struct regex_memo *key)
+{
+	// Nothing to memoize or the regex are about to be reloaded
+	if(num_regex[regexid] == 0 || regex_change != counters->regex_change)
+		return NULL;
+
+	if(regex_memo == NULL && (regex_memo = calloc(REGEX_MEMO_SIZE, sizeof(*regex_memo))) == NULL)
+		return NULL;
+
+	// Fingerprint of the regex enabled for this client
+	uint64_t mask = FNV64_OFFSET;
+	if(clientID >= 0)
+	{
+		const unsigned int offset = regexid == REGEX_ALLOW ? num_regex[REGEX_DENY] : 0;
+		const bool *enabled = get_per_client_regex_array(clientID, offset, num_regex[regexid]);
+		if(enabled == NULL)
+			return NULL;
+		for(unsigned int i = 0; i < num_regex[regexid]; i++)
+			mask = (mask ^ enabled[i]) * FNV64_PRIME;
+	}
+
+	memset(key, 0, sizeof(*key));
+	key->domain = gravity_hash(domain);
+	key->mask = mask;
+	key->generation = regex_memo_generation;
+	key->query_type = regex_query_type[regexid] ? (int)dns_cache->query_type : -1;
+	key->regexid = regexid;
+
+	const uint64_t slot = gravity_hash_finalize(key->domain ^ mask ^ regexid);
+	return &regex_memo[slot % REGEX_MEMO_SIZE];
+}
+
+static inline bool __attribute__((pure)) regex_memo_valid(const struct regex_memo *memo, const struct regex_memo *key)
+{
+	return memo->generation == key->generation &&
+	       memo->domain == key->domain &&
+	       memo->mask == key->mask &&
+	       memo->query_type == key->query_type &&
+	       memo->regexid == key->regexid;
+}
+
+// Reload the per-client regex data of this client if the regex or groups have
+// been changed since it was loaded the last time
+static void check_per_client_regex(const int clientID)
+{
+	if(clientID < 0)
+		return;
+
+	clientsData *client = getClient(clientID, true);
+	if(client == NULL || client->flags.aliasclient ||
+	   client->regex_generation == counters->client_regex_generation)
+		return;
+
+	log_debug(DEBUG_REGEX, "Reloading stale per-client regex data of client %s",
+	          getstr(client->ippos));
+	reload_per_client_regex(client);
+}
+
 bool in_regex(const char *domain, DNSCacheData *dns_cache, const int clientID, const enum regex_type regexid)
 {
+	// Reload regex (in case they were changed in another fork) before
+	// checking whether the data of this client is still up-to-date
+	if(regex_change != counters->regex_change)
+	{
+		log_info("Reloading externally changed regular expressions");
+		read_regex_from_database();
+	}
+	check_per_client_regex(clientID);
+
+	// Repeated evaluations (e.g., for clients with different groups or
+	// during deep CNAME inspection) are answered from the memo
+	struct regex_memo key;
+	struct regex_memo *memo = get_regex_memo(domain, dns_cache, clientID, regexid, &key);
+	if(memo != NULL && regex_memo_valid(memo, &key))
+	{
+		log_debug(DEBUG_REGEX, "Regex %s: Memoized %s for \"%s\" (DB ID %i)",
+		          regextype[regexid], memo->database_id != -1 ? "MATCH" : "NO match",
+		          domain, memo->database_id);
+		if(memo->database_id == -1)
+			return false;
+
+		if(memo->force_reply != REPLY_UNKNOWN)
+			dns_cache->force_reply = memo->force_reply;
+		if(memo->cname_target != NULL)
+			dns_cache->cname_target = memo->cname_target;
+		dns_cache->list_id = memo->database_id;
+		return true;
+	}
+
+	// Record the extended settings applied by the matching regex (if any)
+	const enum reply_type force_reply = dns_cache->force_reply;
+	char *cname_target = dns_cache->cname_target;
+	dns_cache->force_reply = REPLY_UNKNOWN;
+	dns_cache->cname_target = NULL;
+
 	// For performance reasons, the regex evaluations is executed only if the
 	// exact whitelist lookup does not deliver a positive match. This is an
 	// optimization as the database lookup will most likely hit (a) more domains
 	// and (b) will be faster (given a sufficiently large number of regex
 	// whitelisting filters).
 	const int regex_id = match_regex(domain, dns_cache, clientID, regexid, false, NULL);
+
+	if(memo != NULL)
+	{
+		key.database_id = regex_id;
+		key.force_reply = dns_cache->force_reply;
+		key.cname_target = dns_cache->cname_target;
+		*memo = key;
+	}
+
+	// Restore previous settings not overwritten by the regex
+	if(dns_cache->force_reply == REPLY_UNKNOWN)
+		dns_cache->force_reply = force_reply;
+	if(dns_cache->cname_target == NULL)
+		dns_cache->cname_target = cname_target;
+
 	if(regex_id != -1)
 	{
 		// We found a match
@@ -622,8 +931,123 @@ void resolve_regex_cnames(void)
 	}
 }
 
-void free_regex(void)
+static void free_regex_set(const enum regex_type regexid)
+{
+	regex_set_free(regex_set[regexid]);
+	regex_set[regexid] = NULL;
+	if(regex_recheck[regexid] != NULL)
+		free(regex_recheck[regexid]);
+}
+
+static void free_regex_prefilter(const enum regex_type regexid)
 {
+	regex_prefilter_free(regex_prefilter[regexid]);
+	regex_prefilter[regexid] = NULL;
+}
+
+void free_regex_entry(regexData *regex)
+{
+	regfree(&regex->regex);
+
+	// Also free buffered regex strings
+	if(regex->string != NULL)
+	{
+		free(regex->string);
+		regex->string = NULL;
+	}
+
+	// Also free buffered CNAME target (if any)
+	if(regex->ext.cname_target != NULL)
+	{
+		free(regex->ext.cname_target);
+		regex->ext.cname_target = NULL;
+	}
+}
+
+// Keep the compiled regex of this type for the next reload
+static void cache_regex(const enum regex_type regexid, regexData *regex, const unsigned int count)
+{
+	struct regex_cache *cache = &regex_cache[regexid];
+	cache->regex = regex;
+	cache->count = count;
+
+	// Size the index to at most half full
+	unsigned int size = 16u;
+	while(size < 2u*count)
+		size <<= 1;
+	cache->mask = size - 1u;
+	cache->index = malloc(size * sizeof(*cache->index));
+	if(cache->index == NULL)
+		return;
+	memset(cache->index, 0xff, size * sizeof(*cache->index));
+
+	for(unsigned int i = 0; i < count; i++)
+	{
+		if(!regex[i].available || regex[i].string == NULL)
+			continue;
+
+		unsigned int slot = hashStr(regex[i].string) & cache->mask;
+		while(cache->index[slot] != UINT_MAX)
+			slot = (slot + 1u) & cache->mask;
+		cache->index[slot] = i;
+	}
+}
+
+// Move a compiled regex with this string out of the cache, returns false if
+// there is none and the regex needs to be compiled
+static bool reuse_regex(const enum regex_type regexid, const char *string, regexData *regex)
+{
+	struct regex_cache *cache = &regex_cache[regexid];
+	if(cache->index == NULL)
+		return false;
+
+	for(unsigned int slot = hashStr(string) & cache->mask;
+	    cache->index[slot] != UINT_MAX;
+	    slot = (slot + 1u) & cache->mask)
+	{
+		regexData *cached = &cache->regex[cache->index[slot]];
+		if(!cached->available || strcmp(cached->string, string) != 0)
+			continue;
+
+		// The compiled regex and its strings now belong to the new entry
+		*regex = *cached;
+		memset(cached, 0, sizeof(*cached));
+		return true;
+	}
+
+	return false;
+}
+
+// Free all cached regex which have not been reused
+static void free_regex_cache(const enum regex_type regexid)
+{
+	struct regex_cache *cache = &regex_cache[regexid];
+	if(cache->regex != NULL)
+	{
+		for(unsigned int i = 0; i < cache->count; i++)
+			if(cache->regex[i].available)
+				free_regex_entry(&cache->regex[i]);
+		free(cache->regex);
+	}
+	if(cache->index != NULL)
+		free(cache->index);
+	memset(cache, 0, sizeof(*cache));
+}
+
+// Free all regex data. If keep is true, compiled regex are moved into the
+// cache for read_regex_table() instead of being freed
+static void free_regex_data(const bool keep)
+{
+	// Free combined automata and prefilters
+	free_regex_set(REGEX_DENY);
+	free_regex_set(REGEX_ALLOW);
+	free_regex_prefilter(REGEX_DENY);
+	free_regex_prefilter(REGEX_ALLOW);
+
+	// Invalidate all memoized results
+	regex_memo_generation++;
+	regex_query_type[REGEX_DENY] = regex_query_type[REGEX_ALLOW] = false;
+
 	// Return early if we don't use any regex filters
 	if(allow_regex == NULL &&
 	    deny_regex == NULL)
@@ -653,6 +1077,20 @@ void free_regex(void)
 		if(regex == NULL)
 			continue;
 
+		if(keep && regexid != REGEX_CLI)
+		{
+			log_debug(DEBUG_DATABASE, "Keeping %u entries in %s regex struct for reuse",
+			          oldcount, regextype[regexid]);
+
+			// The array is now owned by the cache
+			cache_regex(regexid, regex, oldcount);
+			if(regexid == REGEX_DENY)
+				deny_regex = NULL;
+			else
+				allow_regex = NULL;
+			continue;
+		}
+
 		log_debug(DEBUG_DATABASE, "Going to free %u entries in %s regex struct",
 		          oldcount, regextype[regexid]);
 
@@ -662,21 +1100,7 @@ void free_regex(void)
 			if(!regex[index].available)
 				continue;
 
-			regfree(&regex[index].regex);
-
-			// Also free buffered regex strings
-			if(regex[index].string != NULL)
-			{
-				free(regex[index].string);
-				regex[index].string = NULL;
-			}
-
-			// Also free buffered CNAME target (if any)
-			if(regex[index].ext.cname_target != NULL)
-			{
-				free(regex[index].ext.cname_target);
-				regex[index].ext.cname_target = NULL;
-			}
+			free_regex_entry(&regex[index]);
 		}
 
 		log_debug(DEBUG_DATABASE, "Loop done, freeing regex pointer (%p)", regex);
@@ -686,6 +1110,11 @@ void free_regex(void)
 	}
 }
 
+void free_regex(void)
+{
+	free_regex_data(false);
+}
+
 // This function does three things:
 //   1. Allocate additional memory if required
 //   2. Reset all regex to false for this client
@@ -709,9 +1138,12 @@ void reload_per_client_regex(clientsData *client)
 		gravityDB_get_regex_client_groups(client, num_regex[REGEX_ALLOW],
 		                                  allow_regex, REGEX_ALLOW,
 		                                  "vw_regex_whitelist");
+
+	client->regex_generation = counters->client_regex_generation;
 }
 
-static void read_regex_table(const enum regex_type regexid)
+// Returns the number of regex reused from before the reload
+static unsigned int read_regex_table(const enum regex_type regexid)
 {
 	// Get table ID
 	const enum gravity_tables tableID = (regexid == REGEX_DENY) ? REGEX_DENY_TABLE : REGEX_ALLOW_TABLE;
@@ -724,12 +1156,12 @@ static void read_regex_table(const enum regex_type regexid)
 
 	if(count == 0)
 	{
-		return;
+		return 0;
 	}
 	else if(count < 0)
 	{
 		log_warn("Database query failed, assuming there are no %s regex entries", regextype[regexid]);
-		return;
+		return 0;
 	}
 
 	// Allocate memory for regex
@@ -750,10 +1182,11 @@ static void read_regex_table(const enum regex_type regexid)
 	{
 		log_warn("read_regex_from_database(): Error getting %s regex table from database",
 		         regextype[regexid]);
-		return;
+		return 0;
 	}
 
 	// Walk database table
+	unsigned int reused = 0;
 	const char *regex_string = NULL;
 	int rowid = 0;
 	while((regex_string = gravityDB_getDomain(&rowid)) != NULL)
@@ -776,24 +1209,36 @@ static void read_regex_table(const enum regex_type regexid)
 		if(strlen(regex_string) < 1)
 			continue;
 
-		// Debug logging
-		log_debug(DEBUG_REGEX, "Compiling %s regex %u (DB ID %i): %s",
-		          regextype[regexid], num_regex[regexid], rowid, regex_string);
-
 		const int index = num_regex[regexid]++;
 		char *message = NULL;
 
-		// Compile this regex
-		if(!compile_regex(regex_string, &regex[index], &message) && message != NULL)
+		// Reuse this regex if it was already compiled before the reload
+		if(reuse_regex(regexid, regex_string, &regex[index]))
 		{
-			logg_regex_warning(regextype[regexid], message,
-			                   rowid, regex_string);
-			free(message);
+			reused++;
+		}
+		else
+		{
+			// Debug logging
+			log_debug(DEBUG_REGEX, "Compiling %s regex %d (DB ID %i): %s",
+			          regextype[regexid], index, rowid, regex_string);
+
+			// Compile this regex
+			if(!compile_regex(regex_string, &regex[index], &message) && message != NULL)
+			{
+				logg_regex_warning(regextype[regexid], message,
+				                   rowid, regex_string);
+				free(message);
+			}
 		}
 
 		// Store database ID
 		regex[num_regex[regexid]-1].database_id = rowid;
 
+		// Remember if the result depends on the query type
+		if(regex[index].ext.query_type != 0)
+			regex_query_type[regexid] = true;
+
 		// Signal other forks that the regex data has changed and should be updated
 		regex_change = ++counters->regex_change;
 	}
@@ -805,44 +1250,170 @@ static void read_regex_table(const enum regex_type regexid)
 	log_debug(DEBUG_DATABASE, "Read %u %s regex entries",
 	          num_regex[regexid],
 	          regextype[regexid]);
+
+	return reused;
+}
+
+// Extract the regular expression in front of FTL-specific options (see
+// compile_regex())
+char *get_regex_pattern(const char *string)
+{
+	if(strstr(string, FTL_REGEX_SEP) == NULL)
+		return strdup(string);
+
+	char *buf = strdup(string);
+	if(buf == NULL)
+		return NULL;
+	char *saveptr = NULL;
+	char *part = strtok_r(buf, FTL_REGEX_SEP, &saveptr);
+	char *pattern = part != NULL ? strdup(part) : NULL;
+	free(buf);
+
+	return pattern;
+}
+
+// Compile all regex of this type into a combined automaton. Regex which can
+// not be represented are remembered to be matched individually
+static void build_regex_set(const enum regex_type regexid)
+{
+	if(!config.dns.blocking.combinedRegex.v.b || num_regex[regexid] == 0)
+		return;
+
+	const regexData *regex = get_regex_ptr(regexid);
+	struct regex_set *set = regex_set_new(num_regex[regexid]);
+	if(set == NULL)
+		return;
+	uint64_t *recheck = calloc(regex_set_words(set), sizeof(uint64_t));
+	if(recheck == NULL)
+	{
+		regex_set_free(set);
+		return;
+	}
+
+	for(unsigned int index = 0; index < num_regex[regexid]; index++)
+	{
+		if(!regex[index].available)
+			continue;
+
+		// Inverted regex are always checked individually
+		char *pattern = regex[index].ext.inverted ? NULL : get_regex_pattern(regex[index].string);
+		if(pattern == NULL || !regex_set_add(set, index, pattern))
+		{
+			log_debug(DEBUG_REGEX, "Regex %s (%u, DB ID %d) \"%s\" is matched individually",
+			          regextype[regexid], index, regex[index].database_id, regex[index].string);
+			recheck[index / 64] |= 1ULL << (index % 64);
+		}
+		free(pattern);
+	}
+
+	if(!regex_set_finalize(set))
+	{
+		log_debug(DEBUG_REGEX, "Not using a combined automaton for %s regex", regextype[regexid]);
+		regex_set_free(set);
+		free(recheck);
+		return;
+	}
+
+	struct regex_set_stats stats = { 0 };
+	regex_set_stats(set, &stats);
+	log_info("Combined %u of %u %s regex into a single automaton (%u states, %u byte classes)",
+	         stats.supported, stats.patterns, regextype[regexid],
+	         stats.nfa_nodes, stats.byte_classes);
+
+	regex_set[regexid] = set;
+	regex_recheck[regexid] = recheck;
+}
+
+// Collect the literals required by the regex of this type which are matched
+// individually
+static void build_regex_prefilter(const enum regex_type regexid)
+{
+	if(num_regex[regexid] == 0)
+		return;
+
+	const regexData *regex = get_regex_ptr(regexid);
+	const uint64_t *recheck = regex_recheck[regexid];
+	struct regex_prefilter *pf = regex_prefilter_new(num_regex[regexid]);
+	if(pf == NULL)
+		return;
+
+	for(unsigned int index = 0; index < num_regex[regexid]; index++)
+	{
+		// Inverted regex match domains lacking the literal
+		if(!regex[index].available || regex[index].ext.inverted)
+			continue;
+
+		// Regex represented by the combined automaton are not
+		// matched individually
+		if(recheck != NULL && !((recheck[index / 64] >> (index % 64)) & 1u))
+			continue;
+
+		char *pattern = get_regex_pattern(regex[index].string);
+		if(pattern != NULL)
+			regex_prefilter_add(pf, index, pattern);
+		free(pattern);
+	}
+
+	if(!regex_prefilter_finalize(pf))
+	{
+		log_debug(DEBUG_REGEX, "Not using a literal prefilter for %s regex", regextype[regexid]);
+		regex_prefilter_free(pf);
+		return;
+	}
+
+	struct regex_prefilter_stats stats = { 0 };
+	regex_prefilter_stats(pf, &stats);
+	char prefix[2] = { 0 };
+	double formatted = 0.0;
+	format_memory_size(prefix, stats.memory, &formatted);
+	log_debug(DEBUG_REGEX, "Literal prefilter: %u of %u %s regex require a literal (%u nodes, %u byte classes, %.1f %sB)",
+	          stats.literals, stats.patterns, regextype[regexid],
+	          stats.nodes, stats.byte_classes, formatted, prefix);
+
+	regex_prefilter[regexid] = pf;
 }
 
 void read_regex_from_database(void)
 {
-	// Free regex filters
+	// Free regex filters but keep the compiled regex for reuse
 	// This routine is safe to be called even when there
 	// are no regex filters at the moment
-	free_regex();
+	free_regex_data(true);
 
 	// Start timer for regex compilation analysis
 	timer_start(REGEX_TIMER);
 
 	// Read and compile regex blacklist
-	read_regex_table(REGEX_DENY);
+	unsigned int reused[REGEX_MAX] = { 0 };
+	reused[REGEX_DENY] = read_regex_table(REGEX_DENY);
 
 	// Read and compile regex whitelist
-	read_regex_table(REGEX_ALLOW);
+	reused[REGEX_ALLOW] = read_regex_table(REGEX_ALLOW);
 
-	// Loop over all clients and ensure we have enough space and load
-	// per-client regex data, not all of the regex read and compiled above
-	// will also be used by all clients
-	log_debug(DEBUG_DATABASE, "Loading per-client regex data");
-	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
-	{
-		// Get client pointer
-		clientsData *client = getClient(clientID, true);
-		// Skip invalid and alias-clients
-		if(client == NULL || client->flags.aliasclient)
-			continue;
+	// Free compiled regex which are no longer in the database
+	free_regex_cache(REGEX_DENY);
+	free_regex_cache(REGEX_ALLOW);
 
-		reload_per_client_regex(client);
-	}
+	// Build combined automata (if enabled)
+	build_regex_set(REGEX_DENY);
+	build_regex_set(REGEX_ALLOW);
+
+	// Build literal prefilters for the regex matched individually
+	build_regex_prefilter(REGEX_DENY);
+	build_regex_prefilter(REGEX_ALLOW);
+
+	// Not all of the regex read and compiled above will also be used by
+	// all clients. Instead of loading the per-client regex data of all
+	// known clients (most of which may be idle) right now, mark them as
+	// stale. Each client is reloaded on its next query (see in_regex())
+	counters->client_regex_generation++;
 
 	// Print message to FTL's log after reloading regex filters
-	log_info("Compiled %u allow and %u deny regex for %u client%s in %.1f msec",
+	log_info("Compiled %u allow and %u deny regex in %.1f msec",
 	         num_regex[REGEX_ALLOW], num_regex[REGEX_DENY],
-	         counters->clients, counters->clients > 1 ? "s" : "",
 	         timer_elapsed_msec(REGEX_TIMER));
+	log_debug(DEBUG_REGEX, "Reused %u allow and %u deny regex compiled before",
+	          reused[REGEX_ALLOW], reused[REGEX_DENY]);
 }
 
 int regex_test(const bool debug_mode, const bool quiet, const char *domainin, const char *regexin)
@@ -922,6 +1493,284 @@ int regex_test(const bool debug_mode, const bool quiet, const char *domainin, co
 	return matchidx > -1 ? EXIT_SUCCESS : 2;
 }
 
+// Number of regex listed as slowest by regex_bench()
+#define REGEX_BENCH_SLOWEST 10u
+
+struct regex_bench_thread {
+	pthread_t thread;
+	bool started;
+	unsigned int id;
+	unsigned int threads;
+	char **domains;
+	size_t num_domains;
+	unsigned int num_regex;
+	// Per-regex statistics
+	uint64_t *nsec;
+	uint64_t *max_nsec;
+	uint64_t *matches;
+	// Number of domains matching any deny or allow regex
+	unsigned long matched[2];
+	unsigned long evaluations;
+};
+
+struct regex_bench_result {
+	unsigned int index;
+	uint64_t nsec;
+	uint64_t max_nsec;
+	unsigned long matches;
+};
+
+static inline uint64_t bench_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Match every n-th domain against all regex one after another. TRE does not
+// modify compiled regex while matching so all threads share them
+static void *regex_bench_worker(void *arg)
+{
+	struct regex_bench_thread *thread = arg;
+	for(size_t i = thread->id; i < thread->num_domains; i += thread->threads)
+	{
+		bool matched[2] = { false, false };
+		for(unsigned int index = 0; index < thread->num_regex; index++)
+		{
+			regexData *regex = get_regex_ptr_from_id(index);
+			if(regex == NULL || !regex->available)
+				continue;
+
+			const uint64_t start = bench_nsec();
+			const bool match = regex_matches(regex, thread->domains[i]) != regex->ext.inverted;
+			const uint64_t nsec = bench_nsec() - start;
+
+			thread->nsec[index] += nsec;
+			if(nsec > thread->max_nsec[index])
+				thread->max_nsec[index] = nsec;
+			thread->evaluations++;
+			if(match)
+			{
+				thread->matches[index]++;
+				matched[index < num_regex[REGEX_DENY] ? 0 : 1] = true;
+			}
+		}
+		thread->matched[0] += matched[0];
+		thread->matched[1] += matched[1];
+	}
+
+	return NULL;
+}
+
+static int cmp_bench_result(const void *a, const void *b)
+{
+	const struct regex_bench_result *ra = a, *rb = b;
+	if(ra->nsec != rb->nsec)
+		return ra->nsec < rb->nsec ? 1 : -1;
+	return ra->index < rb->index ? -1 : 1;
+}
+
+// Read domains from file (one per line, anything behind the first whitespace
+// and comment lines are ignored)
+static char **read_bench_domains(const char *filename, size_t *num)
+{
+	FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+	if(fp == NULL)
+	{
+		log_err("Cannot open %s: %s", filename, strerror(errno));
+		return NULL;
+	}
+
+	char **domains = NULL;
+	size_t size = 0;
+	char *line = NULL;
+	size_t len = 0;
+	*num = 0;
+	while(getline(&line, &len, fp) != -1)
+	{
+		char *saveptr = NULL;
+		char *domain = strtok_r(line, " \t\r\n", &saveptr);
+		if(domain == NULL || domain[0] == '#')
+			continue;
+
+		// Remove trailing dot of fully qualified domain names
+		const size_t dlen = strlen(domain);
+		if(dlen > 1 && domain[dlen - 1] == '.')
+			domain[dlen - 1] = '\0';
+		strtolower(domain);
+
+		if(*num == size)
+		{
+			size = size > 0 ? 2*size : 1024;
+			char **new = realloc(domains, size * sizeof(char*));
+			if(new == NULL)
+				break;
+			domains = new;
+		}
+		if((domains[*num] = strdup(domain)) == NULL)
+			break;
+		(*num)++;
+	}
+
+	free(line);
+	if(fp != stdin)
+		fclose(fp);
+
+	return domains;
+}
+
+int regex_bench(const bool debug_mode, const bool quiet, const char *filename, unsigned int threads)
+{
+	// Prepare counters and regex memories
+	counters = calloc(1, sizeof(countersStruct));
+	// Disable terminal output during config config file parsing
+	log_ctrl(false, false);
+
+	// Process pihole-FTL.conf to get gravity.db path
+	// Do not overwrite the file after reading it
+	readFTLconf(&config, false);
+
+	// Disable all debugging output if not explicitly in debug mode (CLI argument "d")
+	if(!debug_mode)
+		clear_debug_flags(); // No debug printing wanted
+	// Re-enable terminal output
+	log_ctrl(false, !quiet);
+
+	// Read and compile regex lists from database
+	log_info("%s Loading regex filters from database...", cli_info());
+	timer_start(REGEX_TIMER);
+	log_ctrl(false, true); // Temporarily re-enable terminal output for error logging
+	read_regex_table(REGEX_DENY);
+	read_regex_table(REGEX_ALLOW);
+	log_ctrl(false, !quiet); // Re-apply quiet option after compilation
+	log_info("    Compiled %u deny and %u allow regex in %.3f msec\n",
+	         num_regex[REGEX_DENY], num_regex[REGEX_ALLOW],
+	         timer_elapsed_msec(REGEX_TIMER));
+
+	const unsigned int total = num_regex[REGEX_DENY] + num_regex[REGEX_ALLOW];
+	if(total == 0)
+	{
+		log_info("    No regex filters to benchmark");
+		return EXIT_FAILURE;
+	}
+
+	// Read domains
+	log_info("%s Reading domains from %s...", cli_info(), filename);
+	size_t num_domains = 0;
+	char **domains = read_bench_domains(filename, &num_domains);
+	if(domains == NULL || num_domains == 0)
+	{
+		log_info("    No domains to benchmark");
+		if(domains != NULL)
+			free(domains);
+		return EXIT_FAILURE;
+	}
+	log_info("    Read %zu domains\n", num_domains);
+
+	if(threads == 0)
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int)cpus : 1u;
+	}
+	if(threads > num_domains)
+		threads = num_domains;
+
+	struct regex_bench_thread *thread = calloc(threads, sizeof(*thread));
+	uint64_t *stats = calloc(3u * (size_t)threads * total, sizeof(uint64_t));
+	if(thread == NULL || stats == NULL)
+	{
+		log_err("Memory allocation failed in regex_bench()");
+		free(thread);
+		free(stats);
+		return EXIT_FAILURE;
+	}
+
+	log_info("%s Matching %zu domains against %u regex using %u thread%s...",
+	         cli_info(), num_domains, total, threads, threads > 1 ? "s" : "");
+	const double t0 = double_time();
+	for(unsigned int i = 0; i < threads; i++)
+	{
+		thread[i].id = i;
+		thread[i].threads = threads;
+		thread[i].domains = domains;
+		thread[i].num_domains = num_domains;
+		thread[i].num_regex = total;
+		thread[i].nsec = &stats[(3u * i + 0u) * total];
+		thread[i].max_nsec = &stats[(3u * i + 1u) * total];
+		thread[i].matches = &stats[(3u * i + 2u) * total];
+		const int rc = pthread_create(&thread[i].thread, NULL, regex_bench_worker, &thread[i]);
+		if(rc != 0)
+		{
+			// Process this share of the domains ourselves
+			log_warn("Cannot create benchmark thread: %s", strerror(rc));
+			regex_bench_worker(&thread[i]);
+			continue;
+		}
+		thread[i].started = true;
+	}
+	for(unsigned int i = 0; i < threads; i++)
+		if(thread[i].started)
+			pthread_join(thread[i].thread, NULL);
+	const double elapsed = double_time() - t0;
+
+	// Merge per-thread statistics
+	struct regex_bench_result *result = calloc(total, sizeof(*result));
+	unsigned long matched[2] = { 0, 0 }, evaluations = 0;
+	uint64_t sum_nsec = 0;
+	for(unsigned int index = 0; index < total && result != NULL; index++)
+	{
+		result[index].index = index;
+		for(unsigned int i = 0; i < threads; i++)
+		{
+			result[index].nsec += thread[i].nsec[index];
+			result[index].max_nsec = MAX(result[index].max_nsec, thread[i].max_nsec[index]);
+			result[index].matches += thread[i].matches[index];
+		}
+		sum_nsec += result[index].nsec;
+	}
+	for(unsigned int i = 0; i < threads; i++)
+	{
+		matched[0] += thread[i].matched[0];
+		matched[1] += thread[i].matched[1];
+		evaluations += thread[i].evaluations;
+	}
+
+	log_info("    Time: %.3f msec (%.0f domains/s, %.0f regex evaluations/s)",
+	         1e3*elapsed, num_domains / elapsed, evaluations / elapsed);
+	log_info("    Domains matching deny regex: %lu, allow regex: %lu\n",
+	         matched[0], matched[1]);
+
+	if(result != NULL)
+	{
+		qsort(result, total, sizeof(*result), cmp_bench_result);
+		const unsigned int slowest = total < REGEX_BENCH_SLOWEST ? total : REGEX_BENCH_SLOWEST;
+		log_info("%s Slowest regex (cumulative time over all threads):", cli_info());
+		for(unsigned int i = 0; i < slowest; i++)
+		{
+			const regexData *regex = get_regex_ptr_from_id(result[i].index);
+			if(regex == NULL || !regex->available)
+				continue;
+			const bool deny = result[i].index < num_regex[REGEX_DENY];
+			log_info("    %2u. %s%s%s (%s, DB ID %i)", i + 1, cli_bold(), regex->string, cli_normal(),
+			         deny ? "deny" : "allow", regex->database_id);
+			log_info("        %.3f msec (%.1f%%), avg %.2f usec, max %.2f usec, %lu matches",
+			         1e-6*result[i].nsec, sum_nsec > 0 ? 100.0*result[i].nsec/sum_nsec : 0.0,
+			         1e-3*result[i].nsec/num_domains, 1e-3*result[i].max_nsec,
+			         result[i].matches);
+		}
+	}
+
+	if(result != NULL)
+		free(result);
+	free(stats);
+	free(thread);
+	for(size_t i = 0; i < num_domains; i++)
+		free(domains[i]);
+	free(domains);
+
+	return EXIT_SUCCESS;
+}
+
 bool check_all_regex(const char *domainin, cJSON *json)
 {
 	// Check user-provided domain against all loaded regular expressions
@@ -46,6 +46,9 @@ typedef struct {
 
 #define REGEX_MSG_LEN 256
 bool compile_regex(const char *regexin, regexData *regex, char **message);
+char *get_regex_pattern(const char *string) __attribute__((malloc));
+bool regex_matches(regexData *regex, const char *input);
+void free_regex_entry(regexData *regex);
 unsigned int get_num_regex(const enum regex_type regexid) __attribute__((pure));
 bool in_regex(const char *domain, DNSCacheData *dns_cache, const int clientID, const enum regex_type regexid);
 void allocate_regex_client_enabled(clientsData *client, const int clientID);
@@ -57,5 +60,6 @@ bool check_all_regex(const char *domainin, cJSON *json);
 void resolve_regex_cnames(void);
 
 int regex_test(const bool debug_mode, const bool quiet, const char *domainin, const char *regexin);
+int regex_bench(const bool debug_mode, const bool quiet, const char *filename, unsigned int threads);
 
 #endif //REGEX_H
@@ -35,6 +35,26 @@
 #include <assert.h>
 // TCP_MAX_QUERIES
 #include "dnsmasq/config.h"
+// set_client_excluded()
+#include "exclude-filter.h"
+// DHCPLEASESFILE, DNSMASQ_CUSTOM_LIST
+#include "config/dnsmasq_config.h"
+// poll()
+#include <poll.h>
+
+// Number of PTR queries sent at the same time when resolving host names of
+// clients and upstream servers and the time to wait for each reply (seconds)
+#define RESOLVE_IN_FLIGHT 64u
+#define RESOLVE_TIMEOUT 2.0
+
+// Results of PTR lookups are cached for the TTL of the host name, at least
+// PTR_CACHE_MIN_TTL and at most PTR_CACHE_MAX_TTL seconds. Negative results
+// are cached for PTR_CACHE_NEG_TTL seconds, doubled for every further negative
+// result up to PTR_CACHE_MAX_TTL
+#define PTR_CACHE_BUCKETS 1024u
+#define PTR_CACHE_MIN_TTL 60u
+#define PTR_CACHE_MAX_TTL 86400u
+#define PTR_CACHE_NEG_TTL 60u
 
 // Function Prototypes
 static void nameToDNS(unsigned char *dns, const size_t dnslen, const char *host, const size_t hostlen) __attribute__((nonnull(1,3)));
@@ -284,19 +304,13 @@ int create_socket(bool tcp, struct sockaddr_in *dest)
 // Helper macro to reduce code duplication
 #define log_resolve_info(host, port, tcp) { log_info("Tried to resolve PTR \"%s\" on 127.0.0.1#%u (%s)", host, port, tcp ? "TCP" : "UDP"); }
 
-// Perform a name lookup by sending a packet to ourselves
-static char *__attribute__((malloc)) ngethostbyname(const int sock, const bool tcp, struct sockaddr_in *dest,
-                                                    const char *host, const char *ipaddr, bool *truncated)
+// Build a standard PTR query for host, returns the length of the query or 0
+// on error
+static size_t build_ptr_query(uint8_t *buf, const size_t bufsize, const char *host, const uint16_t id)
 {
-	uint8_t buf[4096] = { 0 }; // buffer for DNS query
-	uint8_t *qname = NULL, *reader = NULL;
-	struct RES_RECORD answers[20] = { 0 }; // buffer for DNS replies
-	struct DNS_HEADER *dns = NULL;
-	struct QUESTION *qinfo = NULL;
-
 	// Set the DNS structure to standard queries
-	dns = (struct DNS_HEADER *)&buf;
-	dns->id = (unsigned short) htons(random()); // random query ID
+	struct DNS_HEADER *dns = (struct DNS_HEADER *)buf;
+	dns->id = htons(id); // query ID
 	dns->qr = 0; // This is a query
 	dns->opcode = 0; // This is a standard query
 	dns->aa = 0; // Not Authoritative
@@ -313,101 +327,49 @@ static char *__attribute__((malloc)) ngethostbyname(const int sock, const bool t
 	dns->add_count = 0; // No additional
 
 	// Point to the query portion
-	qname = &buf[sizeof(struct DNS_HEADER)];
+	uint8_t *qname = &buf[sizeof(struct DNS_HEADER)];
 
 	// Make a copy of the hostname with two extra bytes for the length and
 	// the final dot, copy the hostname into it and convert to convert to
 	// DNS format
 	const size_t hnamelen = strlen(host) + 2;
+	if(sizeof(struct DNS_HEADER) + hnamelen + 1 + sizeof(struct QUESTION) > bufsize)
+	{
+		log_err("PTR name \"%s\" is too long", host);
+		return 0;
+	}
 	char *hname = calloc(hnamelen, sizeof(char));
 	if(hname == NULL)
 	{
 		log_err("Unable to allocate memory for hname");
-		return NULL;
+		return 0;
 	}
 	strncpy(hname, host, hnamelen);
 	strncat(hname, ".", hnamelen - strlen(hname));
 	hname[hnamelen - 1] = '\0';
 
-	nameToDNS(qname, sizeof(buf) - sizeof(struct DNS_HEADER), hname, hnamelen);
+	nameToDNS(qname, bufsize - sizeof(struct DNS_HEADER), hname, hnamelen);
 	free(hname);
-	qinfo = (void*)&buf[sizeof(struct DNS_HEADER) + (strlen((const char*)qname) + 1)];
+	struct QUESTION *qinfo = (void*)&buf[sizeof(struct DNS_HEADER) + (strlen((const char*)qname) + 1)];
 
 	qinfo->qtype = htons(T_PTR); // Type of the query, A, MX, CNAME, NS etc
 	qinfo->qclass = htons(1); // IN
-	const size_t len = sizeof(struct DNS_HEADER) + (strlen((const char*)qname) + 1) + sizeof(struct QUESTION);
-
-	// Log query in debug mode
-	log_debug(DEBUG_RESOLVER, "Resolving PTR \"%s\" on 127.0.0.1#%u (%s)",
-	          host, config.dns.port.v.u16, tcp ? "TCP" : "UDP");
-
-	if(!tcp)
-	{
-		// Send the query
-		socklen_t addrlen = sizeof(*dest);
-		if(sendto(sock, buf, len, 0, (struct sockaddr*)dest, addrlen) < 0)
-		{
-			log_err("Cannot send UDP DNS query: %s", strsockerr(errno));
-			log_resolve_info(host, config.dns.port.v.u16, tcp);
-			return NULL;
-		}
-
-		// Receive the answer
-		if(recvfrom (sock, buf, sizeof(buf), 0, (struct sockaddr*)dest, &addrlen) < 0)
-		{
-			log_err("Cannot receive UDP DNS reply: %s", strsockerr(errno));
-			log_resolve_info(host, config.dns.port.v.u16, tcp);
-			return NULL;
-		}
-	}
-	else
-	{
-		// Send the query
-		// For TCP streams, we first have to send the length of the data
-		// we are sending. The reason for this is that with TCP, we are
-		// not sending messages (datagrams) but a continuous stream of
-		// bytes. We therefore need a way to tell the receiver about
-		// this length of the message.
-		uint16_t prefix = htons(len & 0xffffu);
-		if(send(sock, &prefix, sizeof(prefix), 0) < 0 ||
-		   send(sock, buf, len, 0) < 0)
-		{
-			log_err("Cannot send TCP DNS query: %s", strsockerr(errno));
-			log_resolve_info(host, config.dns.port.v.u16, tcp);
-			return NULL;
-		}
-
-		// Receive the answer, first the length of the message ...
-		prefix = 0;
-		if(recv(sock, &prefix, sizeof(prefix), 0) < 0)
-		{
-			log_err("Cannot receive TCP DNS reply (1): %s", strsockerr(errno));
-			log_resolve_info(host, config.dns.port.v.u16, tcp);
-			return NULL;
-		}
-		prefix = ntohs(prefix);
+	return sizeof(struct DNS_HEADER) + (strlen((const char*)qname) + 1) + sizeof(struct QUESTION);
+}
 
-		// Sanity check the length of the message
-		if(prefix > sizeof(buf))
-		{
-			log_err("Received TCP DNS reply is too long (%u bytes)", prefix);
-			log_resolve_info(host, config.dns.port.v.u16, tcp);
-			return NULL;
-		}
-		bzero(buf, prefix + 1);
-		// ... then the message itself
-		if(recv(sock, buf, sizeof(buf), 0) < 0)
-		{
-			log_err("Cannot receive TCP DNS reply (2): %s", strsockerr(errno));
-			log_resolve_info(host, config.dns.port.v.u16, tcp);
-			return NULL;
-		}
-	}
+// Parse the reply to a PTR query of length len. Returns the host name (an
+// empty string if the reply has no valid one) or NULL if the reply was
+// truncated. The TTL of the host name is stored in ttl (if not NULL). The
+// reply buffer has to be zero-terminated
+static char *__attribute__((malloc)) parse_ptr_reply(uint8_t *buf, const size_t len, const char *host,
+                                                     const char *ipaddr, bool *truncated, uint32_t *ttl)
+{
+	struct RES_RECORD answers[20] = { 0 }; // buffer for DNS replies
 
 	// Parse the reply
-	dns = (struct DNS_HEADER*) buf;
+	struct DNS_HEADER *dns = (struct DNS_HEADER*) buf;
 	// Move ahead of the dns header and the query field
-	reader = &buf[len];
+	uint8_t *reader = &buf[len];
 
 	// Log the status of the query
 	log_debug(DEBUG_RESOLVER, "DNS query for PTR \"%s\" returned status %s (%i)",
@@ -457,6 +419,8 @@ static char *__attribute__((malloc)) ngethostbyname(const int sock, const bool t
 		// We break out of the loop if this is a valid hostname
 		if(strlen(name) > 0 && valid_hostname(name, ipaddr))
 		{
+			if(ttl != NULL)
+				*ttl = ntohl(answers[i].resource->ttl);
 			free(answers[i].name);
 			break;
 		}
@@ -482,6 +446,84 @@ static char *__attribute__((malloc)) ngethostbyname(const int sock, const bool t
 	}
 }
 
+// Perform a name lookup by sending a packet to ourselves
+static char *__attribute__((malloc)) ngethostbyname(const int sock, const bool tcp, struct sockaddr_in *dest,
+                                                    const char *host, const char *ipaddr, bool *truncated)
+{
+	uint8_t buf[4096] = { 0 }; // buffer for DNS query
+	const size_t len = build_ptr_query(buf, sizeof(buf), host, (uint16_t)random());
+	if(len == 0)
+		return NULL;
+
+	// Log query in debug mode
+	log_debug(DEBUG_RESOLVER, "Resolving PTR \"%s\" on 127.0.0.1#%u (%s)",
+	          host, config.dns.port.v.u16, tcp ? "TCP" : "UDP");
+	if(!tcp)
+	{
+		// Send the query
+		socklen_t addrlen = sizeof(*dest);
+		if(sendto(sock, buf, len, 0, (struct sockaddr*)dest, addrlen) < 0)
+		{
+			log_err("Cannot send UDP DNS query: %s", strsockerr(errno));
+			log_resolve_info(host, config.dns.port.v.u16, tcp);
+			return NULL;
+		}
+
+		// Receive the answer
+		if(recvfrom (sock, buf, sizeof(buf), 0, (struct sockaddr*)dest, &addrlen) < 0)
+		{
+			log_err("Cannot receive UDP DNS reply: %s", strsockerr(errno));
+			log_resolve_info(host, config.dns.port.v.u16, tcp);
+			return NULL;
+		}
+	}
+	else
+	{
+		// Send the query
+		// For TCP streams, we first have to send the length of the data
+		// we are sending. The reason for this is that with TCP, we are
+		// not sending messages (datagrams) but a continuous stream of
+		// bytes. We therefore need a way to tell the receiver about
+		// this length of the message.
+		uint16_t prefix = htons(len & 0xffffu);
+		if(send(sock, &prefix, sizeof(prefix), 0) < 0 ||
+		   send(sock, buf, len, 0) < 0)
+		{
+			log_err("Cannot send TCP DNS query: %s", strsockerr(errno));
+			log_resolve_info(host, config.dns.port.v.u16, tcp);
+			return NULL;
+		}
+
+		// Receive the answer, first the length of the message ...
+		prefix = 0;
+		if(recv(sock, &prefix, sizeof(prefix), 0) < 0)
+		{
+			log_err("Cannot receive TCP DNS reply (1): %s", strsockerr(errno));
+			log_resolve_info(host, config.dns.port.v.u16, tcp);
+			return NULL;
+		}
+		prefix = ntohs(prefix);
+
+		// Sanity check the length of the message
+		if(prefix > sizeof(buf))
+		{
+			log_err("Received TCP DNS reply is too long (%u bytes)", prefix);
+			log_resolve_info(host, config.dns.port.v.u16, tcp);
+			return NULL;
+		}
+		bzero(buf, prefix + 1);
+		// ... then the message itself
+		if(recv(sock, buf, sizeof(buf), 0) < 0)
+		{
+			log_err("Cannot receive TCP DNS reply (2): %s", strsockerr(errno));
+			log_resolve_info(host, config.dns.port.v.u16, tcp);
+			return NULL;
+		}
+	}
+
+	return parse_ptr_reply(buf, len, host, ipaddr, truncated, NULL);
+}
+
 // Convert hostname from network to host representation
 // This routine supports DNS compression pointers
 // 3www6google3com -> www.google.com
@@ -608,22 +650,20 @@ static void __attribute__((nonnull(1,3))) nameToDNS(unsigned char *dns, const si
 	*dns++ = '\0';
 }
 
-char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, struct sockaddr_in *dest,
-                                              const char *addr, const bool force, bool *truncated)
+// Get the host name of addresses which are not looked up. Returns false if
+// the address has to be looked up
+static bool special_hostname(const char *addr, const bool force, char **hostn)
 {
-	// Get host name
-	char *hostn = NULL;
-
 	// Check if we want to resolve host names
 	if(!force && !resolve_this_name(addr))
 	{
 		log_debug(DEBUG_RESOLVER, "Configured to not resolve host name for %s", addr);
 
 		// Return an empty host name
-		hostn = strdup("");
-		if(hostn == NULL)
+		*hostn = strdup("");
+		if(*hostn == NULL)
 			log_err("Unable to allocate memory for empty host name");
-		return hostn;
+		return true;
 	}
 
 	log_debug(DEBUG_RESOLVER, "Trying to resolve %s", addr);
@@ -632,24 +672,31 @@ char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, st
 	// if so, return "hidden" as hostname
 	if(strcmp(addr, "0.0.0.0") == 0)
 	{
-		hostn = strdup("hidden");
-		if(hostn == NULL)
+		*hostn = strdup("hidden");
+		if(*hostn == NULL)
 			log_err("Unable to allocate memory for hidden host name");
-		log_debug(DEBUG_RESOLVER, "---> \"%s\" (privacy settings)", hostn);
-		return hostn;
+		log_debug(DEBUG_RESOLVER, "---> \"%s\" (privacy settings)", *hostn);
+		return true;
 	}
 
 	// Check if this is the internal client
 	// if so, return "hidden" as hostname
 	if(strcmp(addr, "::") == 0)
 	{
-		hostn = strdup("pi.hole");
-		if(hostn == NULL)
+		*hostn = strdup("pi.hole");
+		if(*hostn == NULL)
 			log_err("Unable to allocate memory for internal host name");
-		log_debug(DEBUG_RESOLVER, "---> \"%s\" (special)", hostn);
-		return hostn;
+		log_debug(DEBUG_RESOLVER, "---> \"%s\" (special)", *hostn);
+		return true;
 	}
 
+	return false;
+}
+
+// Get the name used for the reverse lookup of an address. Returns false if
+// the address is invalid, *inaddr is NULL if memory could not be allocated
+static bool ptr_name(const char *addr, char **inaddr)
+{
 	// Test if we want to resolve an IPv6 address
 	bool IPv6 = false;
 	if(strstr(addr,":") != NULL)
@@ -657,7 +704,7 @@ char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, st
 
 	// Convert address into binary form
 	struct sockaddr_storage ss = { 0 };
-	char *inaddr = NULL;
+	*inaddr = NULL;
 	if(IPv6)
 	{
 		// Get binary form of IPv6 address
@@ -665,16 +712,16 @@ char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, st
 		if(!inet_pton(ss.ss_family, addr, &(((struct sockaddr_in6 *)&ss)->sin6_addr)))
 		{
 			log_warn("Invalid IPv6 address when trying to resolve hostname: %s", addr);
-			return strdup("");
+			return false;
 		}
 
 		// Need extra space for ".ip6.arpa" suffix
 		// The 1.2.3.4... string is 63 + terminating \0 = 64 bytes long
-		inaddr = calloc(64 + 10, sizeof(char));
-		if(inaddr == NULL)
+		*inaddr = calloc(64 + 10, sizeof(char));
+		if(*inaddr == NULL)
 		{
 			log_err("Unable to allocate memory for reverse lookup");
-			return NULL;
+			return true;
 		}
 
 		// Convert IPv6 address to reverse lookup format
@@ -698,16 +745,16 @@ char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, st
 				c = 'a' + nibble - 10;
 
 			// Prepend to string
-			inaddr[62-2*i] = c;
+			(*inaddr)[62-2*i] = c;
 
 			// Add dot after (actually: before) every nibble except
 			// the last one
 			if(i != 31)
-				inaddr[62-2*i-1] = '.';
+				(*inaddr)[62-2*i-1] = '.';
 		}
 
 		// Add suffix
-		strcat(inaddr, ".ip6.arpa");
+		strcat(*inaddr, ".ip6.arpa");
 	}
 	else
 	{
@@ -716,29 +763,48 @@ char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, st
 		if(!inet_pton(ss.ss_family, addr, &(((struct sockaddr_in *)&ss)->sin_addr)))
 		{
 			log_warn("Invalid IPv4 address when trying to resolve hostname: %s", addr);
-			hostn = strdup("");
-			if(hostn == NULL)
-				log_err("Unable to allocate memory for empty host name");
-			return hostn;
+			return false;
 		}
 
 		// Need extra space for ".in-addr.arpa" suffix
-		inaddr = calloc(INET_ADDRSTRLEN + 14, sizeof(char));
-		if(inaddr == NULL)
+		*inaddr = calloc(INET_ADDRSTRLEN + 14, sizeof(char));
+		if(*inaddr == NULL)
 		{
 			log_err("Unable to allocate memory for reverse lookup");
-			return NULL;
+			return true;
 		}
 
 		// Convert IPv4 address to reverse lookup format
 		// 12.34.56.78 -> 78.56.34.12.in-addr.arpa
-		snprintf(inaddr, INET_ADDRSTRLEN + 14, "%d.%d.%d.%d.in-addr.arpa",
+		snprintf(*inaddr, INET_ADDRSTRLEN + 14, "%d.%d.%d.%d.in-addr.arpa",
 		        (int)((uint8_t *)&(((struct sockaddr_in *)&ss)->sin_addr))[3],
 		        (int)((uint8_t *)&(((struct sockaddr_in *)&ss)->sin_addr))[2],
 		        (int)((uint8_t *)&(((struct sockaddr_in *)&ss)->sin_addr))[1],
 		        (int)((uint8_t *)&(((struct sockaddr_in *)&ss)->sin_addr))[0]);
 	}
 
+	return true;
+}
+
+char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, struct sockaddr_in *dest,
+                                              const char *addr, const bool force, bool *truncated)
+{
+	// Get host name
+	char *hostn = NULL;
+	if(special_hostname(addr, force, &hostn))
+		return hostn;
+
+	char *inaddr = NULL;
+	if(!ptr_name(addr, &inaddr))
+	{
+		hostn = strdup("");
+		if(hostn == NULL)
+			log_err("Unable to allocate memory for empty host name");
+		return hostn;
+	}
+	if(inaddr == NULL)
+		return NULL;
+
 	// Get host name by making a reverse lookup to ourselves (server at 127.0.0.1 with port 53)
 	// We implement a minimalistic resolver here as we cannot rely on the system resolver using whatever
 	// nameserver we configured in /etc/resolv.conf
@@ -751,149 +817,712 @@ char *__attribute__((malloc)) resolveHostname(const int sock, const bool tcp, st
 	return hostn;
 }
 
-// Resolve upstream destination host names
-static size_t resolveAndAddHostname(const int udp_sock, struct sockaddr_in *dest,
-                                    size_t ippos, size_t oldnamepos, bool *success)
+// Host name lookup of a client or an upstream server, see resolve_jobs()
+struct resolve_job {
+	unsigned int id; // client or upstream ID
+	size_t ippos;
+	size_t oldnamepos;
+	bool success; // false if the name could not be resolved
+	bool truncated; // the UDP reply was truncated, retry via TCP
+	bool queried; // a PTR query has been sent, the result is cached
+	bool done; // the name is known without asking DNS
+	enum name_source source; // source of newname, NAME_SOURCES if none
+	uint32_t ttl; // TTL of newname
+	char *newname; // NULL if the old name is kept
+	char ip[INET6_ADDRSTRLEN];
+};
+
+// PTR query of a job in flight
+struct resolve_query {
+	struct resolve_job *job; // NULL if the slot is free
+	char *host; // PTR name
+	double sent;
+	size_t len;
+	uint16_t id;
+	uint8_t query[128];
+};
+
+// Add a lookup to the list of jobs, returns false on error
+static bool add_resolve_job(struct resolve_job **jobs, unsigned int *num, unsigned int *size,
+                            const unsigned int id, const size_t ippos, const size_t oldnamepos)
 {
-	// Get IP and host name strings. They are cloned in case shared memory is
-	// resized before the next lock
-	lock_shm();
-	char *ipaddr = strdup(getstr(ippos));
-	char *oldname = strdup(getstr(oldnamepos));
-	unlock_shm();
+	if(*num == *size)
+	{
+		const unsigned int newsize = *size > 0 ? 2 * *size : 64;
+		struct resolve_job *newjobs = realloc(*jobs, newsize * sizeof(**jobs));
+		if(newjobs == NULL)
+		{
+			log_err("Unable to allocate memory for host name lookups");
+			return false;
+		}
+		*jobs = newjobs;
+		*size = newsize;
+	}
 
-	if(ipaddr == NULL || oldname == NULL)
+	struct resolve_job *job = &(*jobs)[(*num)++];
+	memset(job, 0, sizeof(*job));
+	job->id = id;
+	job->ippos = ippos;
+	job->oldnamepos = oldnamepos;
+	job->success = true;
+	job->source = NAME_SOURCES;
+	strncpy(job->ip, getstr(ippos), sizeof(job->ip) - 1);
+	return true;
+}
+
+// Remove a query from the in-flight window
+static void finish_query(struct resolve_query *q, unsigned int *in_flight)
+{
+	free(q->host);
+	q->host = NULL;
+	q->job = NULL;
+	(*in_flight)--;
+}
+
+// Match the replies received so far to the queries in flight
+static void receive_replies(const int sock, struct resolve_query *flight, unsigned int *in_flight)
+{
+	uint8_t buf[4096];
+	while(*in_flight > 0)
 	{
-		log_err("Unable to allocate memory for IP address or host name");
+		// Keep space for the terminating zero parse_ptr_reply() relies
+		// on
+		memset(buf, 0, sizeof(buf));
+		const ssize_t len = recv_nowarn(sock, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+		if(len < 0)
+			break;
+		if((size_t)len < sizeof(struct DNS_HEADER))
+			continue;
+
+		// Find the query by its ID and make sure the reply is for the
+		// question we asked. Stray replies (e.g., of queries which
+		// timed out before) are ignored
+		const uint16_t id = ntohs(((struct DNS_HEADER *)buf)->id);
+		struct resolve_query *q = NULL;
+		for(unsigned int i = 0; i < RESOLVE_IN_FLIGHT; i++)
+		{
+			if(flight[i].job != NULL && flight[i].id == id)
+			{
+				q = &flight[i];
+				break;
+			}
+		}
+		if(q == NULL || (size_t)len < q->len ||
+		   memcmp(buf + sizeof(struct DNS_HEADER), q->query + sizeof(struct DNS_HEADER),
+		          q->len - sizeof(struct DNS_HEADER)) != 0)
+			continue;
 
-		// Free allocated memory
-		if(ipaddr != NULL)
-			free(ipaddr);
-		if(oldname != NULL)
-			free(oldname);
+		struct resolve_job *job = q->job;
+		job->newname = parse_ptr_reply(buf, q->len, q->host, job->ip, &job->truncated, &job->ttl);
+		if(job->newname == NULL && !job->truncated)
+			job->success = false;
 
-		// Return old namepos
-		*success = false;
-		return oldnamepos;
+		finish_query(q, in_flight);
 	}
+}
 
-	// Test if we want to resolve host names, otherwise all calls to resolveHostname()
-	// and getNameFromIP() can be skipped as they will all return empty names (= no records)
-	if(!resolve_this_name(ipaddr))
+// Cached result of a PTR lookup. Entries are only used by the DNSclient
+// thread, only the statistics are shared
+struct ptr_cache_entry {
+	struct ptr_cache_entry *next;
+	char *name; // NULL if the lookup failed
+	double expires;
+	unsigned int failures; // consecutive negative results
+	char ip[INET6_ADDRSTRLEN];
+};
+static struct ptr_cache_entry *ptr_cache[PTR_CACHE_BUCKETS] = { NULL };
+static struct ptr_cache_stats ptr_stats = { 0 };
+static unsigned long name_stats[NAME_SOURCES] = { 0 };
+static pthread_mutex_t ptr_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void get_ptr_cache_stats(struct ptr_cache_stats *stats)
+{
+	pthread_mutex_lock(&ptr_stats_lock);
+	*stats = ptr_stats;
+	pthread_mutex_unlock(&ptr_stats_lock);
+}
+
+void get_name_source_stats(unsigned long answered[NAME_SOURCES])
+{
+	pthread_mutex_lock(&ptr_stats_lock);
+	memcpy(answered, name_stats, sizeof(name_stats));
+	pthread_mutex_unlock(&ptr_stats_lock);
+}
+
+static struct ptr_cache_entry *ptr_cache_find(const char *ip)
+{
+	struct ptr_cache_entry *entry = ptr_cache[hashStr(ip) % PTR_CACHE_BUCKETS];
+	while(entry != NULL && strcmp(entry->ip, ip) != 0)
+		entry = entry->next;
+	return entry;
+}
+
+// Use the cached result of a job's address if it has not expired yet
+static bool ptr_cache_get(struct resolve_job *job, const double now)
+{
+	const struct ptr_cache_entry *entry = ptr_cache_find(job->ip);
+	if(entry == NULL || entry->expires <= now)
+		return false;
+
+	if(entry->name != NULL)
+		job->newname = strdup(entry->name);
+	else
+		job->success = false;
+
+	log_debug(DEBUG_RESOLVER, " ---> \"%s\" (cached for %.0f more seconds)",
+	          entry->name != NULL ? entry->name : "<failed>", entry->expires - now);
+	return true;
+}
+
+// Cache the result of a job. Host names are kept for their TTL, negative
+// results (no name, errors and timeouts) for PTR_CACHE_NEG_TTL seconds,
+// doubled for every further negative result of the same address
+static void ptr_cache_put(const struct resolve_job *job, const double now)
+{
+	struct ptr_cache_entry *entry = ptr_cache_find(job->ip);
+	if(entry == NULL)
 	{
-		log_debug(DEBUG_RESOLVER, " ---> \"\" (configured to not resolve host name)");
+		entry = calloc(1, sizeof(*entry));
+		if(entry == NULL)
+			return;
+		strcpy(entry->ip, job->ip);
+		const uint32_t bucket = hashStr(job->ip) % PTR_CACHE_BUCKETS;
+		entry->next = ptr_cache[bucket];
+		ptr_cache[bucket] = entry;
+	}
 
-		// Free allocated memory
-		free(ipaddr);
-		free(oldname);
+	if(entry->name != NULL)
+		free(entry->name);
+	entry->name = job->success && job->newname != NULL ? strdup(job->newname) : NULL;
 
-		// Return fixed position of empty string
-		return 0;
+	if(entry->name != NULL && strlen(entry->name) > 0)
+	{
+		entry->failures = 0;
+		const uint32_t ttl = max(job->ttl, PTR_CACHE_MIN_TTL);
+		entry->expires = now + min(ttl, PTR_CACHE_MAX_TTL);
+		return;
+	}
+
+	const unsigned int backoff = PTR_CACHE_NEG_TTL << min(entry->failures, 12u);
+	entry->expires = now + min(backoff, PTR_CACHE_MAX_TTL);
+	entry->failures++;
+}
+
+// Remove entries which expired more than PTR_CACHE_MAX_TTL seconds ago and
+// update the statistics
+static void ptr_cache_maintain(const double now, const unsigned int hits, const unsigned int misses)
+{
+	unsigned int entries = 0, negative = 0;
+	for(unsigned int i = 0; i < PTR_CACHE_BUCKETS; i++)
+	{
+		struct ptr_cache_entry **entry = &ptr_cache[i];
+		while(*entry != NULL)
+		{
+			if((*entry)->expires + PTR_CACHE_MAX_TTL < now)
+			{
+				struct ptr_cache_entry *old = *entry;
+				*entry = old->next;
+				if(old->name != NULL)
+					free(old->name);
+				free(old);
+				continue;
+			}
+
+			entries++;
+			if((*entry)->name == NULL || strlen((*entry)->name) == 0)
+				negative++;
+			entry = &(*entry)->next;
+		}
+	}
+
+	pthread_mutex_lock(&ptr_stats_lock);
+	ptr_stats.entries = entries;
+	ptr_stats.negative = negative;
+	ptr_stats.hits += hits;
+	ptr_stats.misses += misses;
+	pthread_mutex_unlock(&ptr_stats_lock);
+}
+
+static const char *const name_source_names[NAME_SOURCES] = { "hosts", "leases", "dns", "network" };
+
+const char *__attribute__((const)) name_source_str(const enum name_source source)
+{
+	return source < NAME_SOURCES ? name_source_names[source] : "unknown";
+}
+
+// Host name of an address in /etc/hosts, the custom DNS records or the DHCP
+// leases file
+struct local_name {
+	unsigned int seq; // earlier entries win
+	char ip[INET6_ADDRSTRLEN];
+	char name[256];
+};
+
+// Sources of host names in the configured order and the local names read
+// for this run
+struct name_sources {
+	enum name_source order[NAME_SOURCES];
+	unsigned int num;
+	unsigned int dns; // position of NAME_SOURCE_DNS in order, num if unused
+	struct local_name *names[NAME_SOURCES];
+	unsigned int count[NAME_SOURCES];
+};
+
+static int cmp_local_name(const void *a, const void *b)
+{
+	const struct local_name *x = a, *y = b;
+	const int cmp = strcmp(x->ip, y->ip);
+	if(cmp != 0)
+		return cmp;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Add a local name, the address is brought into the form used by FTL
+static void add_local_name(struct name_sources *sources, const enum name_source source,
+                           const char *ip, const char *name)
+{
+	unsigned char addr[sizeof(struct in6_addr)];
+	const int family = strchr(ip, ':') != NULL ? AF_INET6 : AF_INET;
+	if(inet_pton(family, ip, addr) != 1 || strlen(name) >= sizeof(((struct local_name *)0)->name))
+		return;
+
+	const unsigned int n = sources->count[source];
+	if(n % 64 == 0)
+	{
+		struct local_name *names = realloc(sources->names[source], (n + 64) * sizeof(*names));
+		if(names == NULL)
+			return;
+		sources->names[source] = names;
+	}
+
+	struct local_name *entry = &sources->names[source][n];
+	if(inet_ntop(family, addr, entry->ip, sizeof(entry->ip)) == NULL)
+		return;
+	entry->seq = n;
+	strcpy(entry->name, name);
+	sources->count[source]++;
+}
+
+// Read a file in HOSTS format ("IP name [aliases]")
+static void read_hosts_file(struct name_sources *sources, const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+		return;
+
+	char *line = NULL;
+	size_t len = 0;
+	while(getline(&line, &len, fp) != -1)
+	{
+		// Strip comments
+		char *comment = strchr(line, '#');
+		if(comment != NULL)
+			*comment = '\0';
+
+		char *saveptr = NULL;
+		const char *ip = strtok_r(line, " \t\r\n", &saveptr);
+		const char *name = strtok_r(NULL, " \t\r\n", &saveptr);
+		if(ip != NULL && name != NULL)
+			add_local_name(sources, NAME_SOURCE_HOSTS, ip, name);
+	}
+	free(line);
+	fclose(fp);
+}
+
+// Read the names of active leases from the DHCP leases file
+static void read_leases_file(struct name_sources *sources, const double now)
+{
+	FILE *fp = fopen(DHCPLEASESFILE, "r");
+	if(fp == NULL)
+		return;
+
+	char *line = NULL;
+	size_t len = 0;
+	while(getline(&line, &len, fp) != -1)
+	{
+		// DHCPv4 leases are "<expires> <hwaddr> <ip> <name> <clientid>",
+		// DHCPv6 leases have the IAID instead of the hardware address.
+		// Leases without a name have "*"
+		unsigned long expires = 0;
+		char ip[INET6_ADDRSTRLEN] = { 0 };
+		char name[256] = { 0 };
+		if(sscanf(line, "%lu %*s %45s %255s", &expires, ip, name) != 3 ||
+		   strcmp(name, "*") == 0 || (expires != 0 && expires < now))
+			continue;
+
+		add_local_name(sources, NAME_SOURCE_LEASES, ip, name);
+	}
+	free(line);
+	fclose(fp);
+}
+
+// Get the configured order of the sources and read the local names
+static void load_name_sources(struct name_sources *sources, const double now)
+{
+	memset(sources, 0, sizeof(*sources));
+	cJSON *item = NULL;
+	cJSON_ArrayForEach(item, config.resolver.nameSources.v.json)
+	{
+		for(unsigned int i = 0; i < NAME_SOURCES; i++)
+		{
+			if(!cJSON_IsString(item) || strcmp(item->valuestring, name_source_names[i]) != 0)
+				continue;
+
+			// Ignore duplicates
+			bool known = false;
+			for(unsigned int j = 0; j < sources->num; j++)
+				if(sources->order[j] == i)
+					known = true;
+			if(!known)
+				sources->order[sources->num++] = i;
+		}
 	}
 
-	// Important: Don't hold a lock while resolving as the main thread
-	// (dnsmasq) needs to be operable during the call to resolveHostname()
-	bool truncated = false;
-	char *newname = resolveHostname(udp_sock, false, dest, ipaddr, false, &truncated);
-	if(newname == NULL && truncated)
+	sources->dns = sources->num;
+	for(unsigned int i = 0; i < sources->num; i++)
 	{
-		// Retry with TCP if UDP failed due to truncation (RFC 7766)
-		const int tcp_sock = create_socket(true, dest);
-		if(tcp_sock > 0)
+		if(sources->order[i] == NAME_SOURCE_DNS)
+			sources->dns = i;
+		else if(sources->order[i] == NAME_SOURCE_HOSTS)
 		{
-			// Only attempt to resolve the hostname if we have a
-			// valid socket
-			newname = resolveHostname(tcp_sock, true, dest, ipaddr, false, NULL);
-			close(tcp_sock);
+			read_hosts_file(sources, "/etc/hosts");
+			read_hosts_file(sources, DNSMASQ_CUSTOM_LIST);
 		}
+		else if(sources->order[i] == NAME_SOURCE_LEASES)
+			read_leases_file(sources, now);
+	}
+
+	for(unsigned int i = 0; i < NAME_SOURCES; i++)
+		if(sources->count[i] > 0)
+			qsort(sources->names[i], sources->count[i], sizeof(struct local_name), cmp_local_name);
+}
+
+// Find the first entry of an address in a sorted list of local names
+static struct local_name *find_local_name(struct local_name *names, const unsigned int count, const char *ip)
+{
+	unsigned int lo = 0, hi = count;
+	while(lo < hi)
+	{
+		const unsigned int mid = lo + (hi - lo) / 2;
+		if(strcmp(names[mid].ip, ip) < 0)
+			lo = mid + 1;
 		else
-			log_warn("Unable to create TCP socket for DNS resolution");
+			hi = mid;
 	}
 
-	if(newname == NULL)
+	return lo < count && strcmp(names[lo].ip, ip) == 0 ? &names[lo] : NULL;
+}
+
+static void free_name_sources(struct name_sources *sources)
+{
+	for(unsigned int i = 0; i < NAME_SOURCES; i++)
+		if(sources->names[i] != NULL)
+			free(sources->names[i]);
+}
+
+// Try the sources at positions first to last - 1 in the configured order,
+// returns true if one of them knows a name
+static bool local_name(const struct name_sources *sources, struct resolve_job *job,
+                       const unsigned int first, const unsigned int last)
+{
+	for(unsigned int i = first; i < last; i++)
 	{
-		// We could not resolve the hostname, so we keep the old one
-		// and mark the entry as not new
-		log_debug(DEBUG_RESOLVER, " ---> \"%s\" (failed to resolve via TCP, too)", oldname);
-
-		// Free allocated memory
-		*success = false;
-		free(ipaddr);
-		free(oldname);
-		return oldnamepos;
+		const enum name_source source = sources->order[i];
+		char *name = NULL;
+		if(source == NAME_SOURCE_NETWORK)
+		{
+			// This may be disabled due to a user setting
+			if(config.resolver.networkNames.v.b)
+				name = getNameFromIP(NULL, job->ip);
+		}
+		else if(sources->count[source] > 0)
+		{
+			struct local_name *entry = find_local_name(sources->names[source], sources->count[source], job->ip);
+			if(entry != NULL && valid_hostname(entry->name, job->ip))
+				name = strdup(entry->name);
+		}
+
+		if(name == NULL || strlen(name) == 0)
+		{
+			if(name != NULL)
+				free(name);
+			continue;
+		}
+
+		log_debug(DEBUG_RESOLVER, " ---> \"%s\" (provided by %s)", name, name_source_str(source));
+		if(job->newname != NULL)
+			free(job->newname);
+		job->newname = name;
+		job->source = source;
+		return true;
 	}
 
-	// If no hostname was found, try to obtain hostname from the network table
-	// This may be disabled due to a user setting
-	if(strlen(newname) == 0 && config.resolver.networkNames.v.b)
+	return false;
+}
+
+// Resolve the host names of all jobs not done yet via PTR queries. Up to
+// RESOLVE_IN_FLIGHT queries are sent at the same time over one socket, replies
+// are matched to their queries by ID. Unless forced, addresses whose cached
+// result has not yet expired are not queried again
+static void resolve_ptr(struct resolve_job *jobs, const unsigned int num, const bool force, const double start)
+{
+	// Only used by the DNSclient thread
+	static struct resolve_query flight[RESOLVE_IN_FLIGHT];
+	memset(flight, 0, sizeof(flight));
+	const in_port_t port = config.dns.port.v.u16;
+
+	struct sockaddr_in dest = { 0 };
+	const int sock = create_socket(false, &dest);
+	if(sock < 0)
 	{
-		free(newname);
-		newname = getNameFromIP(NULL, ipaddr);
-		if(newname != NULL)
-			log_debug(DEBUG_RESOLVER, " ---> \"%s\" (provided by database)", newname);
+		log_err("Unable to create DNS resolver socket, host name resolution failed");
+		for(unsigned int i = 0; i < num; i++)
+			if(!jobs[i].done)
+				jobs[i].success = false;
+		return;
 	}
 
-	// Only store new newname if it is valid and differs from oldname
-	// We do not need to check for oldname == NULL as names are
-	// always initialized with an empty string at position 0
-	if(newname != NULL && strcmp(oldname, newname) != 0)
+	unsigned int next = 0, in_flight = 0, hits = 0, misses = 0;
+	while((next < num || in_flight > 0) && !killed)
 	{
-		lock_shm();
-		const size_t newnamepos = addstr(newname);
-		unlock_shm();
-
-		// Free allocated memory
-		// newname has already been checked against NULL
-		// so we can safely free it
-		free(newname);
-		free(ipaddr);
-		free(oldname);
-		return newnamepos;
+		// Fill the window with new queries
+		while(next < num && in_flight < RESOLVE_IN_FLIGHT)
+		{
+			struct resolve_job *job = &jobs[next++];
+			if(job->done)
+				continue;
+			job->source = NAME_SOURCE_DNS;
+
+			// Use the cached result unless it expired
+			if(!force && ptr_cache_get(job, start))
+			{
+				hits++;
+				continue;
+			}
+			misses++;
+
+			char *inaddr = NULL;
+			if(!ptr_name(job->ip, &inaddr))
+			{
+				// Invalid addresses get an empty host name
+				job->newname = strdup("");
+				continue;
+			}
+			if(inaddr == NULL)
+			{
+				job->success = false;
+				continue;
+			}
+
+			// Take a free slot
+			struct resolve_query *q = flight;
+			while(q->job != NULL)
+				q++;
+
+			// Use an ID which is not in flight
+			uint16_t id;
+			bool used;
+			do
+			{
+				id = (uint16_t)random();
+				used = false;
+				for(unsigned int i = 0; i < RESOLVE_IN_FLIGHT; i++)
+					if(flight[i].job != NULL && flight[i].id == id)
+						used = true;
+			} while(used);
+
+			// Log query in debug mode
+			log_debug(DEBUG_RESOLVER, "Resolving PTR \"%s\" on 127.0.0.1#%u (UDP)", inaddr, port);
+
+			q->len = build_ptr_query(q->query, sizeof(q->query), inaddr, id);
+			if(q->len == 0 ||
+			   sendto(sock, q->query, q->len, 0, (struct sockaddr*)&dest, sizeof(dest)) < 0)
+			{
+				if(q->len > 0)
+				{
+					log_err("Cannot send UDP DNS query: %s", strsockerr(errno));
+					log_resolve_info(inaddr, port, false);
+				}
+				job->success = false;
+				free(inaddr);
+				continue;
+			}
+
+			job->queried = true;
+			q->job = job;
+			q->host = inaddr;
+			q->id = id;
+			q->sent = double_time();
+			in_flight++;
+		}
+
+		if(in_flight == 0)
+			continue;
+
+		// Wait for replies until the oldest query times out
+		double deadline = double_time() + RESOLVE_TIMEOUT;
+		for(unsigned int i = 0; i < RESOLVE_IN_FLIGHT; i++)
+			if(flight[i].job != NULL && flight[i].sent + RESOLVE_TIMEOUT < deadline)
+				deadline = flight[i].sent + RESOLVE_TIMEOUT;
+
+		const double now = double_time();
+		struct pollfd pfd = { .fd = sock, .events = POLLIN, .revents = 0 };
+		const int timeout = deadline > now ? (int)(1e3*(deadline - now)) + 1 : 0;
+		if(poll(&pfd, 1, timeout) > 0)
+			receive_replies(sock, flight, &in_flight);
+
+		// Give up on queries which timed out
+		const double later = double_time();
+		for(unsigned int i = 0; i < RESOLVE_IN_FLIGHT; i++)
+		{
+			struct resolve_query *q = &flight[i];
+			if(q->job == NULL || later < q->sent + RESOLVE_TIMEOUT)
+				continue;
+
+			log_err("Cannot receive UDP DNS reply: %s", strsockerr(EAGAIN));
+			log_resolve_info(q->host, port, false);
+			q->job->success = false;
+			finish_query(q, &in_flight);
+		}
 	}
-	else
+
+	close(sock);
+
+	// Lookups which did not finish before we were killed failed
+	for(unsigned int i = 0; i < RESOLVE_IN_FLIGHT; i++)
+		if(flight[i].job != NULL)
+		{
+			flight[i].job->success = false;
+			finish_query(&flight[i], &in_flight);
+		}
+	for(; next < num; next++)
+		if(!jobs[next].done)
+			jobs[next].success = false;
+
+	for(unsigned int i = 0; i < num && !killed; i++)
+	{
+		struct resolve_job *job = &jobs[i];
+		if(job->truncated)
+		{
+			// Retry with TCP if UDP failed due to truncation (RFC 7766)
+			const int tcp_sock = create_socket(true, &dest);
+			if(tcp_sock > 0)
+			{
+				// Only attempt to resolve the hostname if we
+				// have a valid socket
+				job->newname = resolveHostname(tcp_sock, true, &dest, job->ip, false, NULL);
+				close(tcp_sock);
+			}
+			else
+				log_warn("Unable to create TCP socket for DNS resolution");
+
+			if(job->newname == NULL)
+			{
+				log_debug(DEBUG_RESOLVER, " ---> %s (failed to resolve via TCP, too)", job->ip);
+				job->success = false;
+			}
+		}
+
+		if(job->queried)
+			ptr_cache_put(job, start);
+	}
+
+	ptr_cache_maintain(start, hits, misses);
+}
+
+// Resolve the host names of all jobs. The sources configured in
+// resolver.nameSources are tried in their order until one of them knows a
+// name, PTR queries of all remaining addresses are sent at once when "dns" is
+// reached. Important: Don't hold a lock while resolving as the main thread
+// (dnsmasq) needs to be operable meanwhile
+static void resolve_jobs(struct resolve_job *jobs, const unsigned int num, const bool force)
+{
+	if(num == 0)
+		return;
+
+	const double start = double_time();
+	struct name_sources sources;
+	load_name_sources(&sources, start);
+
+	// Addresses which are not looked up and local sources before DNS
+	for(unsigned int i = 0; i < num; i++)
+	{
+		struct resolve_job *job = &jobs[i];
+		if(special_hostname(job->ip, false, &job->newname))
+			job->done = true;
+		else
+			job->done = local_name(&sources, job, 0, sources.dns);
+	}
+
+	if(sources.dns < sources.num)
+		resolve_ptr(jobs, num, force, start);
+
+	// Sources after DNS are tried for addresses without a name
+	unsigned long answered[NAME_SOURCES] = { 0 };
+	for(unsigned int i = 0; i < num && !killed; i++)
 	{
-		// Debugging output
-		log_debug(DEBUG_SHMEM, "Not adding \"%s\" to buffer (unchanged)", oldname);
+		struct resolve_job *job = &jobs[i];
+		if(!job->done && sources.dns == sources.num && job->newname == NULL)
+			job->newname = strdup("");
+		if(!job->done && job->success && job->newname != NULL && strlen(job->newname) == 0)
+			local_name(&sources, job, sources.dns + 1, sources.num);
+
+		if(job->source < NAME_SOURCES && job->newname != NULL && strlen(job->newname) > 0)
+			answered[job->source]++;
 	}
 
-	if(newname != NULL)
-		free(newname);
-	free(ipaddr);
-	free(oldname);
+	free_name_sources(&sources);
+
+	pthread_mutex_lock(&ptr_stats_lock);
+	for(unsigned int i = 0; i < NAME_SOURCES; i++)
+		name_stats[i] += answered[i];
+	pthread_mutex_unlock(&ptr_stats_lock);
+}
+
+// Get the position of the new host name of a job in the string buffer.
+// Requires the SHM lock
+static size_t store_name(const struct resolve_job *job)
+{
+	// Only store new newname if it is valid and differs from oldname
+	// We do not need to check for oldname == NULL as names are
+	// always initialized with an empty string at position 0
+	const char *oldname = getstr(job->oldnamepos);
+	if(job->newname != NULL && strcmp(oldname, job->newname) != 0)
+		return addstr(job->newname);
+
+	// Debugging output
+	log_debug(DEBUG_SHMEM, "Not adding \"%s\" to buffer (unchanged)", oldname);
 
 	// Not changed, return old namepos
-	return oldnamepos;
+	return job->oldnamepos;
+}
+
+static void free_resolve_jobs(struct resolve_job *jobs, const unsigned int num)
+{
+	for(unsigned int i = 0; i < num; i++)
+		if(jobs[i].newname != NULL)
+			free(jobs[i].newname);
+	if(jobs != NULL)
+		free(jobs);
 }
 
 // Resolve client host names
 static void resolveClients(const bool onlynew, const bool force_refreshing)
 {
 	const double now = double_time();
-	// Lock counter access here, we use a copy in the following loop
+	struct resolve_job *jobs = NULL;
+	unsigned int num = 0, size = 0, skipped = 0;
+
+	// Collect the clients to be resolved in one go
 	lock_shm();
 	const unsigned int clientscount = counters->clients;
-	unlock_shm();
-
-	// Create DNS client socket
-	struct sockaddr_in dest = { 0 };
-	const int udp_sock = create_socket(false, &dest);
-	if(udp_sock < 0)
-	{
-		log_err("Unable to create DNS resolver socket, client host name resolution failed");
-		return;
-	}
-
-	unsigned int skipped = 0;
+	const unsigned int string_generation = get_string_generation();
 	for(unsigned int clientID = 0; clientID < clientscount; clientID++)
 	{
-		// Memory access needs to get locked
-		lock_shm();
-		// Get client pointer for the first time (reading data)
 		clientsData *client = getClient(clientID, true);
 		if(client == NULL)
 		{
 			// Client has been recycled, skip it
-			unlock_shm();
 			skipped++;
 			continue;
 		}
@@ -901,14 +1530,13 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 		// Skip alias-clients
 		if(client->flags.aliasclient)
 		{
-			unlock_shm();
 			skipped++;
 			continue;
 		}
 
-		bool newflag = client->flags.new;
-		size_t ippos = client->ippos;
-		size_t oldnamepos = client->namepos;
+		const bool newflag = client->flags.new;
+		const size_t ippos = client->ippos;
+		const size_t oldnamepos = client->namepos;
 
 		// Only try to resolve host names of clients which were recently active if we are re-resolving
 		// Limit for a "recently active" client is two hours ago
@@ -917,7 +1545,6 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 			log_debug(DEBUG_RESOLVER, "Skipping client %s -> \"%s\" because it was inactive for %i seconds",
 			          getstr(ippos), getstr(oldnamepos), (int)(now - client->lastQuery));
 
-			unlock_shm();
 			skipped++;
 			continue;
 		}
@@ -929,19 +1556,12 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 			log_debug(DEBUG_RESOLVER, "Skipping client %s -> \"%s\" because it is not new",
 			          getstr(ippos), getstr(oldnamepos));
 
-			unlock_shm();
 			skipped++;
 			continue;
 		}
 
-		// Get IP address of client
-		const char *ipaddr = getstr(ippos);
-		unlock_shm();
-
 		// Check if we want to resolve an IPv6 address
-		bool IPv6 = false;
-		if(strstr(ipaddr, ":") != NULL)
-			IPv6 = true;
+		const bool IPv6 = strstr(getstr(ippos), ":") != NULL;
 
 		// If onlynew flag is set, we will only resolve new clients.
 		// However, if this is a IPv6 client, we postpone the resolution
@@ -984,59 +1604,71 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 				else if(config.resolver.refreshNames.v.refresh_hostnames == REFRESH_UNKNOWN)
 					reason = "Looking only for unknown hostnames";
 
-				lock_shm();
 				log_debug(DEBUG_RESOLVER, "Skipping client %s -> \"%s\" because it should not be refreshed: %s",
 				          getstr(ippos), getstr(oldnamepos), reason);
-				unlock_shm();
 			}
 			skipped++;
 			continue;
 		}
 
-		// Obtain/update hostname of this client
-		bool success = true;
-		size_t newnamepos = resolveAndAddHostname(udp_sock, &dest, ippos, oldnamepos, &success);
+		if(!add_resolve_job(&jobs, &num, &size, clientID, ippos, oldnamepos))
+			skipped++;
+	}
+	unlock_shm();
+
+	// Obtain/update host names of these clients
+	resolve_jobs(jobs, num, force_refreshing);
+
+	// Store all results under one lock
+	lock_shm();
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const struct resolve_job *job = &jobs[i];
 
-		lock_shm();
-		// Get client pointer for the second time (writing data)
-		// We cannot use the same pointer again as we released
-		// the lock in between so we cannot know if something
-		// happened to the shared memory object (resize event)
-		client = getClient(clientID, true);
+		// We cannot use the client pointer from above as we released
+		// the lock in between so we cannot know if something happened
+		// to the shared memory object (resize event)
+		clientsData *client = getClient(job->id, true);
 		if(client == NULL)
 		{
-			log_warn("Unable to get client pointer (2) with ID %u in resolveClients(), skipping...", clientID);
+			log_warn("Unable to get client pointer (2) with ID %u in resolveClients(), skipping...", job->id);
 			skipped++;
-			unlock_shm();
 			continue;
 		}
 
-		if(!success)
+		// The strings have been compacted while we were resolving, the
+		// positions we obtained are no longer valid. Leave the client as
+		// it is, it will be retried during the next run
+		if(string_generation != get_string_generation() || client->ippos != job->ippos)
+		{
+			log_debug(DEBUG_RESOLVER, "Client %s changed while resolving, retrying later", job->ip);
+			skipped++;
+			continue;
+		}
+
+		if(!job->success)
 		{
 			// We could not resolve the hostname, so we keep the old one
 			// and mark the entry as not new - it will be retried later
 			client->flags.new = false;
 
 			log_debug(DEBUG_RESOLVER, "Client %s -> \"%s\" could not be resolved, retrying later",
-			          getstr(ippos), getstr(oldnamepos));
-
-			unlock_shm();
+			          job->ip, getstr(job->oldnamepos));
 			continue;
 		}
 
-		// else:
 		// Store obtained host name (may be unchanged)
+		const size_t newnamepos = store_name(job);
 		client->namepos = newnamepos;
+		set_client_excluded(client);
 		// Mark entry as not new
 		client->flags.new = false;
 
-		log_debug(DEBUG_RESOLVER, "Client %s -> \"%s\" is new", getstr(ippos), getstr(newnamepos));
-
-		unlock_shm();
+		log_debug(DEBUG_RESOLVER, "Client %s -> \"%s\" is new", job->ip, getstr(newnamepos));
 	}
+	unlock_shm();
 
-	// Close socket
-	close(udp_sock);
+	free_resolve_jobs(jobs, num);
 
 	log_debug(DEBUG_RESOLVER, "%u / %u client host names resolved",
 	          clientscount - skipped, clientscount);
@@ -1046,38 +1678,27 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 static void resolveUpstreams(const bool onlynew)
 {
 	const time_t now = time(NULL);
-	// Lock counter access here, we use a copy in the following loop
+	struct resolve_job *jobs = NULL;
+	unsigned int num = 0, size = 0;
+	int skipped = 0;
+
+	// Collect the upstream servers to be resolved in one go
 	lock_shm();
 	const int upstreams = counters->upstreams;
-	unlock_shm();
-
-	// Create socket
-	struct sockaddr_in dest = { 0 };
-	const int udp_sock = create_socket(false, &dest);
-	if(udp_sock < 0)
-	{
-		log_err("Unable to create DNS resolver socket, client host name resolution failed");
-		return;
-	}
-
-	int skipped = 0;
+	const unsigned int string_generation = get_string_generation();
 	for(int upstreamID = 0; upstreamID < upstreams; upstreamID++)
 	{
-		// Memory access needs to get locked
-		lock_shm();
-		// Get upstream pointer for the first time (reading data)
 		upstreamsData *upstream = getUpstream(upstreamID, true);
 		if(upstream == NULL)
 		{
 			// This is not a fatal error, as the upstream may have been recycled
 			skipped++;
-			unlock_shm();
 			continue;
 		}
 
-		bool newflag = upstream->flags.new;
-		size_t ippos = upstream->ippos;
-		size_t oldnamepos = upstream->namepos;
+		const bool newflag = upstream->flags.new;
+		const size_t ippos = upstream->ippos;
+		const size_t oldnamepos = upstream->namepos;
 
 		// Only try to resolve host names of upstream servers which were recently active
 		// Limit for a "recently active" upstream server is two hours ago
@@ -1085,69 +1706,72 @@ static void resolveUpstreams(const bool onlynew)
 		{
 			log_debug(DEBUG_RESOLVER, "Skipping upstream %s -> \"%s\" because it was inactive for %i seconds",
 			          getstr(ippos), getstr(oldnamepos), (int)(now - upstream->lastQuery));
-
-			unlock_shm();
 			continue;
 		}
-		unlock_shm();
 
 		// If onlynew flag is set, we will only resolve new upstream destinations
 		// If not, we will try to re-resolve all known upstream destinations
 		if(onlynew && !newflag)
 		{
 			skipped++;
-			if(config.debug.resolver.v.b)
-			{
-				lock_shm();
-				log_debug(DEBUG_RESOLVER, "Upstream %s -> \"%s\" already known", getstr(ippos), getstr(oldnamepos));
-				unlock_shm();
-			}
+			log_debug(DEBUG_RESOLVER, "Upstream %s -> \"%s\" already known", getstr(ippos), getstr(oldnamepos));
 			continue;
 		}
 
-		// Obtain/update hostname of this client
-		bool success = true;
-		size_t newnamepos = resolveAndAddHostname(udp_sock, &dest, ippos, oldnamepos, &success);
+		if(!add_resolve_job(&jobs, &num, &size, upstreamID, ippos, oldnamepos))
+			skipped++;
+	}
+	unlock_shm();
+
+	// Obtain/update host names of these upstream servers
+	resolve_jobs(jobs, num, false);
 
-		lock_shm();
-		// Get upstream pointer for the second time (writing data)
-		// We cannot use the same pointer again as we released
-		// the lock in between so we cannot know if something
-		// happened to the shared memory object (resize event)
-		upstream = getUpstream(upstreamID, true);
+	// Store all results under one lock
+	lock_shm();
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const struct resolve_job *job = &jobs[i];
+
+		// See resolveClients()
+		upstreamsData *upstream = getUpstream(job->id, true);
 		if(upstream == NULL)
 		{
-			log_warn("Unable to get upstream pointer (2) with ID %i in resolveUpstreams(), skipping...", upstreamID);
+			log_warn("Unable to get upstream pointer (2) with ID %u in resolveUpstreams(), skipping...", job->id);
 			skipped++;
-			unlock_shm();
 			continue;
 		}
 
-		if(!success)
+		// The strings have been compacted while we were resolving, see
+		// resolveClients()
+		if(string_generation != get_string_generation() || upstream->ippos != job->ippos)
+		{
+			log_debug(DEBUG_RESOLVER, "Upstream %s changed while resolving, retrying later", job->ip);
+			skipped++;
+			continue;
+		}
+
+		if(!job->success)
 		{
 			// We could not resolve the hostname, so we keep the old one
 			// and mark the entry as not new - it will be retried later
 			upstream->flags.new = false;
 
 			log_debug(DEBUG_RESOLVER, "Upstream %s -> \"%s\" could not be resolved, retrying later",
-			          getstr(ippos), getstr(oldnamepos));
-
-			unlock_shm();
+			          job->ip, getstr(job->oldnamepos));
 			continue;
 		}
 
 		// Store obtained host name (may be unchanged)
+		const size_t newnamepos = store_name(job);
 		upstream->namepos = newnamepos;
 		// Mark entry as not new
 		upstream->flags.new = false;
 
-		log_debug(DEBUG_RESOLVER, "Upstream %s -> \"%s\" is new", getstr(ippos), getstr(newnamepos));
-
-		unlock_shm();
+		log_debug(DEBUG_RESOLVER, "Upstream %s -> \"%s\" is new", job->ip, getstr(newnamepos));
 	}
+	unlock_shm();
 
-	// Close socket
-	close(udp_sock);
+	free_resolve_jobs(jobs, num);
 
 	log_debug(DEBUG_RESOLVER, "%i / %i upstream server host names resolved",
 	          upstreams-skipped, upstreams);
@@ -1157,6 +1781,7 @@ void *DNSclient_thread(void *val)
 {
 	// Set thread name
 	prctl(PR_SET_NAME, thread_names[DNSclient], 0, 0, 0);
+	set_thread_placement(ROLE_BACKGROUND);
 
 	// Test struct sizes
 	if(!check_struct_sizes())
@@ -1168,6 +1793,10 @@ void *DNSclient_thread(void *val)
 	// Initial delay until we first try to resolve anything
 	thread_sleepms(DNSclient, 2000);
 
+	// Re-resolve all host names at full multiples of RERESOLVE_INTERVAL
+	time_t next_reresolve = time(NULL);
+	next_reresolve += RERESOLVE_INTERVAL - next_reresolve % RERESOLVE_INTERVAL;
+
 	// Run as long as this thread is not canceled
 	while(!killed)
 	{
@@ -1192,9 +1821,11 @@ void *DNSclient_thread(void *val)
 			break;
 
 		// Run every hour to update possibly changed client host names
-		if(resolver_ready && (time(NULL) % RERESOLVE_INTERVAL == 0))
+		const time_t now = time(NULL);
+		if(resolver_ready && now >= next_reresolve)
 		{
 			set_event(RERESOLVE_HOSTNAMES);      // done below
+			next_reresolve = now - now % RERESOLVE_INTERVAL + RERESOLVE_INTERVAL;
 		}
 
 		bool force_refreshing = false;
@@ -1220,8 +1851,11 @@ void *DNSclient_thread(void *val)
 			resolveUpstreams(false);
 		}
 
-		// Idle for 1 sec
-		thread_sleepms(DNSclient, 1000);
+		// Idle until the next periodic run or until woken up by an
+		// event. Poll every second until the resolver is ready as
+		// events are not handled before
+		const time_t sleep_time = resolver_ready ? next_reresolve - time(NULL) : 1;
+		thread_sleepms(DNSclient, 1000 * (sleep_time > 0 ? (int)sleep_time : 1));
 	}
 
 	log_info("Terminating resolver thread");
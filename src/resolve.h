@@ -17,6 +17,26 @@ char *resolveHostname(const int sock, const bool tcp, struct sockaddr_in *dest,
 bool resolve_names(void) __attribute__((pure));
 bool resolve_this_name(const char *ipaddr) __attribute__((pure));
 
+// Usage of the cache of PTR lookups of client and upstream host names
+struct ptr_cache_stats {
+	unsigned int entries;
+	unsigned int negative; // entries without a host name
+	unsigned long hits;
+	unsigned long misses;
+};
+void get_ptr_cache_stats(struct ptr_cache_stats *stats);
+
+// Sources of client and upstream host names, see resolver.nameSources
+enum name_source {
+	NAME_SOURCE_HOSTS,
+	NAME_SOURCE_LEASES,
+	NAME_SOURCE_DNS,
+	NAME_SOURCE_NETWORK,
+	NAME_SOURCES
+};
+const char *name_source_str(const enum name_source source) __attribute__((const));
+void get_name_source_stats(unsigned long answered[NAME_SOURCES]);
+
 // musl does not define MAXHOSTNAMELEN
 // If it is not defined, we set the value
 // found on a x86_64 glibc instance
@@ -34,9 +34,31 @@
 #include "database/message-table.h"
 // struct lookup_table
 #include "lookup-table.h"
+// topListsData
+#include "top-lists.h"
+// clientSketchData
+#include "client-sketch.h"
+// struct suffix_node
+#include "domain-suffixes.h"
+// latencyData
+#include "latency.h"
+// FTL_PROBE()
+#include "probes.h"
+// rateLimitData
+#include "ratelimit.h"
+// listHitsData
+#include "database/list-hits.h"
+// atomic_uint
+#include <stdatomic.h>
+// sched_yield()
+#include <sched.h>
+// git_hash()
+#include "version.h"
+// mz_crc32()
+#include "zip/miniz/miniz.h"
 
 /// The version of shared memory used
-#define SHARED_MEMORY_VERSION 14
+#define SHARED_MEMORY_VERSION 30
 
 /// The name of the shared memory. Use this when connecting to the shared memory.
 #define SHMEM_PATH "/dev/shm"
@@ -54,7 +76,20 @@
 #define SHARED_CLIENTS_LOOKUP_NAME "clients-lookup"
 #define SHARED_DOMAINS_LOOKUP_NAME "domains-lookup"
 #define SHARED_DNS_CACHE_LOOKUP_NAME "dns-cache-lookup"
+#define SHARED_STRINGS_LOOKUP_NAME "strings-lookup"
+#define SHARED_SUFFIXES_NAME "domain-suffixes"
+#define SHARED_SUFFIXES_LOOKUP_NAME "domain-suffixes-lookup"
+#define SHARED_UPSTREAMS_LOOKUP_NAME "upstreams-lookup"
 #define SHARED_RECYCLER_NAME "recycler"
+#define SHARED_QUERY_COLUMNS_NAME "query-columns"
+#define SHARED_QUERY_IDS_NAME "query-ids"
+#define SHARED_TOP_LISTS_NAME "top-lists"
+#define SHARED_CLIENT_SKETCHES_NAME "client-sketches"
+#define SHARED_DIRTY_QUERIES_NAME "dirty-queries"
+#define SHARED_LATENCY_NAME "latency"
+#define SHARED_RATE_LIMITS_NAME "rate-limits"
+#define SHARED_LIST_HITS_NAME "list-hits"
+#define SHARED_COLD_QUERIES_NAME "cold-queries"
 
 // Allocation step for FTL-strings bucket. This is somewhat special as we use
 // this as a general-purpose storage which should always be large enough. If,
@@ -63,9 +98,13 @@
 // the next lock round
 #define STRINGS_ALLOC_STEP (10*pagesize)
 
+// Minimum number of records the cold tier grows by
+#define COLD_RECORDS_ALLOC_STEP 4096u
+
 // Global counters struct
 countersStruct *counters = NULL;
 #define SHARED_FIFO_LOG_NAME "fifo-log"
+#define SHARED_LOG_RINGS_NAME "log-rings"
 
 /// The pointer in shared memory to the shared string buffer
 static SharedMemory shm_lock = { 0 };
@@ -80,10 +119,24 @@ static SharedMemory shm_settings = { 0 };
 static SharedMemory shm_dns_cache = { 0 };
 static SharedMemory shm_per_client_regex = { 0 };
 static SharedMemory shm_fifo_log = { 0 };
+static SharedMemory shm_log_rings = { 0 };
 static SharedMemory shm_clients_lookup = { 0 };
 static SharedMemory shm_domains_lookup = { 0 };
 static SharedMemory shm_dns_cache_lookup = { 0 };
+static SharedMemory shm_strings_lookup = { 0 };
+static SharedMemory shm_suffixes = { 0 };
+static SharedMemory shm_suffixes_lookup = { 0 };
+static SharedMemory shm_upstreams_lookup = { 0 };
 static SharedMemory shm_recycler = { 0 };
+static SharedMemory shm_query_columns = { 0 };
+static SharedMemory shm_query_ids = { 0 };
+static SharedMemory shm_top_lists = { 0 };
+static SharedMemory shm_client_sketches = { 0 };
+static SharedMemory shm_dirty_queries = { 0 };
+static SharedMemory shm_latency = { 0 };
+static SharedMemory shm_rate_limits = { 0 };
+static SharedMemory shm_list_hits = { 0 };
+static SharedMemory shm_cold_queries = { 0 };
 
 static SharedMemory *sharedMemories[] = { &shm_lock,
                                           &shm_strings,
@@ -97,10 +150,69 @@ static SharedMemory *sharedMemories[] = { &shm_lock,
                                           &shm_dns_cache,
                                           &shm_per_client_regex,
                                           &shm_fifo_log,
+                                          &shm_log_rings,
                                           &shm_clients_lookup,
                                           &shm_domains_lookup,
                                           &shm_dns_cache_lookup,
-                                          &shm_recycler };
+                                          &shm_strings_lookup,
+                                          &shm_suffixes,
+                                          &shm_suffixes_lookup,
+                                          &shm_upstreams_lookup,
+                                          &shm_recycler,
+                                          &shm_query_columns,
+                                          &shm_query_ids,
+                                          &shm_top_lists,
+                                          &shm_client_sketches,
+                                          &shm_dirty_queries,
+                                          &shm_latency,
+                                          &shm_rate_limits,
+                                          &shm_list_hits,
+                                          &shm_cold_queries };
+
+// Objects growing at runtime, these may get address space reserved up front
+static SharedMemory *growingMemories[] = { &shm_strings,
+                                           &shm_domains,
+                                           &shm_clients,
+                                           &shm_queries,
+                                           &shm_upstreams,
+                                           &shm_dns_cache,
+                                           &shm_per_client_regex,
+                                           &shm_clients_lookup,
+                                           &shm_domains_lookup,
+                                           &shm_dns_cache_lookup,
+                                           &shm_strings_lookup,
+                                           &shm_suffixes,
+                                           &shm_suffixes_lookup,
+                                           &shm_upstreams_lookup,
+                                           &shm_query_columns,
+                                           &shm_query_ids,
+                                           &shm_client_sketches,
+                                           &shm_cold_queries };
+
+// Objects saved in a snapshot on shutdown. The lock, settings, logs, and
+// per-client regex data are always created afresh
+static SharedMemory *snapshotMemories[] = { &shm_counters,
+                                            &shm_strings,
+                                            &shm_domains,
+                                            &shm_clients,
+                                            &shm_queries,
+                                            &shm_query_columns,
+                                            &shm_query_ids,
+                                            &shm_cold_queries,
+                                            &shm_upstreams,
+                                            &shm_overTime,
+                                            &shm_dns_cache,
+                                            &shm_clients_lookup,
+                                            &shm_domains_lookup,
+                                            &shm_dns_cache_lookup,
+                                            &shm_strings_lookup,
+                                            &shm_suffixes,
+                                            &shm_suffixes_lookup,
+                                            &shm_upstreams_lookup,
+                                            &shm_recycler,
+                                            &shm_top_lists,
+                                            &shm_client_sketches,
+                                            &shm_dirty_queries };
 
 // Variable size array structs
 static queriesData *queries = NULL;
@@ -109,10 +221,22 @@ static domainsData *domains = NULL;
 static upstreamsData *upstreams = NULL;
 static DNSCacheData *dns_cache = NULL;
 fifologData *fifo_log = NULL;
+logRingsData *log_rings = NULL;
 struct lookup_table *clients_lookup = NULL;
 struct lookup_table *domains_lookup = NULL;
 struct lookup_table *dns_cache_lookup = NULL;
+struct lookup_table *strings_lookup = NULL;
+struct suffix_node *domain_suffixes = NULL;
+struct lookup_table *suffixes_lookup = NULL;
+struct lookup_table *upstreams_lookup = NULL;
 struct recycler_tables *recycler = NULL;
+topListsData *top_lists = NULL;
+clientSketchData *client_sketches = NULL;
+static struct dirty_queries *dirty_queries = NULL;
+static struct query_id_slot *query_ids = NULL;
+static struct cold_query *cold_records = NULL;
+// Pointers into shm_query_columns, all NULL if the mirror is disabled
+static struct query_columns query_columns = { 0 };
 
 static void **global_pointers[] = {(void**)&queries,
                                    (void**)&clients,
@@ -120,10 +244,44 @@ static void **global_pointers[] = {(void**)&queries,
                                    (void**)&upstreams,
                                    (void**)&dns_cache,
                                    (void**)&fifo_log,
+                                   (void**)&log_rings,
                                    (void**)&clients_lookup,
                                    (void**)&domains_lookup,
                                    (void**)&dns_cache_lookup,
-                                   (void**)&recycler};
+                                   (void**)&strings_lookup,
+                                   (void**)&domain_suffixes,
+                                   (void**)&suffixes_lookup,
+                                   (void**)&upstreams_lookup,
+                                   (void**)&recycler,
+                                   (void**)&top_lists,
+                                   (void**)&client_sketches,
+                                   (void**)&dirty_queries,
+                                   (void**)&query_ids,
+                                   (void**)&cold_records,
+                                   (void**)&latency,
+                                   (void**)&rate_limits,
+                                   (void**)&list_hits};
+
+// Contention profile of one call site of lock_shm() or lock_shm_read(). Sites
+// are told apart by the address of their function name and their line, both
+// are the same in all processes as they are forked from the same binary. Sites
+// are only added while holding the outer mutex, func is set last so readers
+// never see a half-initialized site. The counters are updated atomically as
+// shared lock holders release the lock concurrently (times in nanoseconds,
+// histograms of times in microseconds)
+struct shm_lock_site_data {
+	const char *_Atomic func;
+	const char *file;
+	int line;
+	bool shared;
+	atomic_uint_least64_t count;
+	atomic_uint_least64_t wait;
+	atomic_uint_least64_t hold;
+	atomic_uint_least64_t max_wait;
+	atomic_uint_least64_t max_hold;
+	atomic_uint wait_hist[API_HISTOGRAM_BUCKETS];
+	atomic_uint hold_hist[API_HISTOGRAM_BUCKETS];
+};
 
 typedef struct {
 	struct {
@@ -134,18 +292,41 @@ typedef struct {
 		volatile pid_t pid;
 		volatile pid_t tid;
 	} owner;
+	// Number of threads currently holding the shared lock
+	atomic_uint readers;
+	// Lock wait statistics per access path
+	struct shm_lock_stats stats[SHM_LOCK_PATHS];
+	// Contention profile per call site (see find_lock_site())
+	struct shm_lock_site_data sites[SHM_LOCK_SITES];
+	atomic_uint_least64_t sites_dropped;
 } ShmLock;
 static ShmLock *shmLock = NULL;
+
+// Nesting depth of the shared lock held by this thread and whether it had to
+// be obtained exclusively (see _lock_shm_read())
+static __thread unsigned int read_locks = 0u;
+static __thread bool read_exclusive = false;
+// Time this thread spent waiting for and holding SHM locks (in nanoseconds)
+static __thread uint64_t lock_time = 0u;
+static __thread uint64_t lock_since = 0u;
+// Call site of the outermost lock held by this thread and the time it has been
+// obtained (in nanoseconds)
+static __thread unsigned int lock_site = SHM_LOCK_SITES;
+static __thread uint64_t lock_acquired = 0u;
 static ShmSettings *shmSettings = NULL;
 
 static int pagesize;
 static unsigned int local_shm_counter = 0;
+static unsigned int remap_calls = 0;
+static size_t shm_reserve = 0u;
 static pid_t shmem_pid = 0;
 static size_t used_shmem = 0u;
+// Numbers of objects planned at startup (see preallocate_shmem())
+static unsigned int projected[PLAN_ITEMS] = { 0 };
 static size_t get_optimal_object_size(const size_t objsize, const size_t minsize);
 
 // Private prototypes
-static void *enlarge_shmem_struct(const char type);
+static void *enlarge_shmem_struct(const char type, const size_t capacity);
 
 // Calculate and format the memory usage of the shared memory segment used by
 // FTL
@@ -198,6 +379,11 @@ static bool chown_shmem(SharedMemory *sharedMemory, struct passwd *ent_pw)
 	return true;
 }
 
+static bool cmp_string(const struct lookup_table *entry, const struct lookup_data *lookup_data)
+{
+	return strcmp(&((const char*)shm_strings.ptr)[entry->id], lookup_data->string) == 0;
+}
+
 // Add string to our shared memory buffer
 // This function checks if the string already exists in the buffer and returns
 // the position of the existing string if it does. Otherwise, it adds the
@@ -233,15 +419,20 @@ size_t _addstr(const char *input, const char *func, const int line, const char *
 		len = avail_mem;
 	}
 
-	// Search buffer for existence of exact same string
-	char *str_pos = memmem(shm_strings.ptr, shmSettings->next_str_pos, input, len);
-	if(str_pos != NULL)
+	// Return the position of an identical string if we have stored it
+	// before. Shortened strings are not indexed as their content differs
+	// from the input
+	const bool indexed = len == strlen(input) + 1 && shmSettings->next_str_pos < LOOKUP_EMPTY;
+	const uint32_t hash = indexed ? hashStr(input) : 0u;
+	const struct lookup_data lookup_data = { .string = input };
+	unsigned int str_pos = 0;
+	if(indexed && lookup_find_id(STRINGS_LOOKUP, hash, &lookup_data, &str_pos, cmp_string))
 	{
-		log_debug(DEBUG_SHMEM, "Reusing existing string \"%s\" at %zd in %s() (%s:%i)",
-		          input, str_pos - (char*)shm_strings.ptr, func, short_path(file), line);
+		log_debug(DEBUG_SHMEM, "Reusing existing string \"%s\" at %u in %s() (%s:%i)",
+		          input, str_pos, func, short_path(file), line);
 
 		// Return position of existing string
-		return (str_pos - (char*)shm_strings.ptr);
+		return str_pos;
 	}
 
 	// Debugging output
@@ -249,16 +440,21 @@ size_t _addstr(const char *input, const char *func, const int line, const char *
 	          input, len, func, short_path(file), line, shmSettings->next_str_pos);
 
 	// Copy the C string pointed by input into the shared string buffer
-	strncpy(&((char*)shm_strings.ptr)[shmSettings->next_str_pos], input, len);
+	const size_t pos = shmSettings->next_str_pos;
+	strncpy(&((char*)shm_strings.ptr)[pos], input, len);
 
 	// Increment string length counter
 	shmSettings->next_str_pos += len;
 
+	// Remember the new string. If the index is full, the string is simply
+	// not deduplicated
+	if(indexed)
+		lookup_insert(STRINGS_LOOKUP, (unsigned int)pos, hash);
+
 	// Return start of stored string
-	return (shmSettings->next_str_pos - len);
+	return pos;
 }
 
-// Get string from shared memory buffer
 const char *_getstr(const size_t pos, const char *func, const int line, const char *file)
 {
 	// Only access the string memory if this memory region has already been set
@@ -310,18 +506,430 @@ static void create_mutex(pthread_mutex_t *lock) {
 	pthread_mutexattr_destroy(&lock_attr);
 }
 
+// Position of the queryID-th query (counted from the oldest one) in the ring
+static inline unsigned int ring_slot(const unsigned int queryID)
+{
+	const unsigned int slot = counters->queries_oldest + queryID;
+	return slot < counters->queries_MAX ? slot : slot - counters->queries_MAX;
+}
+
+unsigned int __attribute__((pure)) query_slot(const unsigned int queryID)
+{
+	return ring_slot(queryID);
+}
+
+// Keep a ring buffer in order after its capacity has grown. The elements from
+// the oldest one up to the old end of the buffer are moved to the end of the
+// enlarged buffer so they are followed again by the wrapped around elements at
+// the beginning. Returns the new position of the oldest element
+static unsigned int grow_ring(unsigned char *base, const size_t width, const unsigned int old_capacity,
+                              const unsigned int new_capacity, const unsigned int oldest)
+{
+	if(oldest == 0)
+		return 0;
+
+	const unsigned int new_oldest = new_capacity - (old_capacity - oldest);
+	memmove(base + new_oldest*width, base + oldest*width, (old_capacity - oldest)*width);
+	memset(base + oldest*width, 0, (new_oldest - oldest)*width);
+
+	return new_oldest;
+}
+
+// Clear num elements of a ring buffer starting at position first
+static void clear_ring(unsigned char *base, const size_t width, const unsigned int capacity,
+                       const unsigned int first, const unsigned int num)
+{
+	const unsigned int head = num < capacity - first ? num : capacity - first;
+	memset(base + first*width, 0, head*width);
+	memset(base, 0, (num - head)*width);
+}
+
+// Bytes needed per query for the columnar mirror
+#define QUERY_COLUMN_BYTES (sizeof(uint32_t) + sizeof(int) + 2*sizeof(unsigned int) + sizeof(uint8_t))
+
+// Size of the shared memory object holding the query columns. The columns
+// are stored one after another in the same object so they can be grown
+// together with the queries
+static size_t __attribute__((const)) query_columns_size(const unsigned int capacity)
+{
+	// Placeholder when the mirror is disabled
+	if(capacity == 0)
+		return pagesize;
+
+	return (size_t)capacity * QUERY_COLUMN_BYTES;
+}
+
+// Compute the column pointers into the (possibly remapped) shared memory
+// object. The four-byte columns come first to keep them aligned
+static void set_query_columns(void)
+{
+	const size_t capacity = counters->query_columns_MAX;
+	if(capacity == 0 || shm_query_columns.ptr == NULL)
+	{
+		memset(&query_columns, 0, sizeof(query_columns));
+		return;
+	}
+
+	// The shared memory object is page-aligned and all offsets are multiples
+	// of four, hence the columns are suitably aligned
+	unsigned char *base = shm_query_columns.ptr;
+	query_columns.timestamp = (void*)base;
+	query_columns.id = (void*)(base + capacity*sizeof(uint32_t));
+	query_columns.clientID = (void*)(base + capacity*(sizeof(uint32_t) + sizeof(int)));
+	query_columns.domainID = (void*)(base + capacity*(sizeof(uint32_t) + sizeof(int) + sizeof(unsigned int)));
+	query_columns.status = base + capacity*(sizeof(uint32_t) + sizeof(int) + 2*sizeof(unsigned int));
+}
+
+// Grow the query columns to the current size of the queries struct
+static void enlarge_query_columns(void)
+{
+	const unsigned int old_capacity = counters->query_columns_MAX;
+	const unsigned int new_capacity = counters->queries_MAX;
+	if(old_capacity == 0 || new_capacity <= old_capacity)
+		return;
+
+	realloc_shm(&shm_query_columns, query_columns_size(new_capacity), 1, true);
+
+	// Offsets and widths of the columns (in units of the capacity)
+	unsigned char *base = shm_query_columns.ptr;
+	const size_t offsets[] = { 0, sizeof(uint32_t), sizeof(uint32_t) + sizeof(int),
+	                           sizeof(uint32_t) + sizeof(int) + sizeof(unsigned int),
+	                           sizeof(uint32_t) + sizeof(int) + 2*sizeof(unsigned int) };
+	const size_t widths[] = { sizeof(uint32_t), sizeof(int), sizeof(unsigned int), sizeof(unsigned int), sizeof(uint8_t) };
+
+	// Move the columns to their new positions. We have to start at the end
+	// as every column moves towards the end of the object and would
+	// otherwise overwrite the following column before it has been moved
+	for(unsigned int i = ArraySize(offsets); i-- > 1;)
+		memmove(base + offsets[i]*new_capacity, base + offsets[i]*old_capacity, widths[i]*old_capacity);
+
+	// Keep the columns in the same order as the ring of queries
+	for(unsigned int i = 0; i < ArraySize(offsets); i++)
+		grow_ring(base + offsets[i]*new_capacity, widths[i], old_capacity, new_capacity, counters->queries_oldest);
+
+	counters->query_columns_MAX = new_capacity;
+	set_query_columns();
+}
+
+// Number of slots of the query ID map needed for the current capacity of the
+// ring. The map is kept at most half full so probe sequences stay short
+static unsigned int __attribute__((pure)) query_ids_capacity(void)
+{
+	unsigned int capacity = 1024u;
+	while(capacity < 2*counters->queries_MAX)
+		capacity *= 2;
+	return capacity;
+}
+
+// Store the position of a query in the ring under its ID. dnsmasq IDs are
+// unique, should an ID nevertheless be reused, the most recent query wins (as
+// it did when the queries were searched backwards)
+static void insert_query_id(const int id, const unsigned int slot)
+{
+	const unsigned int mask = counters->query_ids_MAX - 1;
+	unsigned int i = (unsigned int)id & mask;
+	while(query_ids[i].pos != 0 && query_ids[i].id != id)
+		i = (i + 1) & mask;
+
+	if(query_ids[i].pos == 0)
+		counters->query_ids++;
+	query_ids[i].id = id;
+	query_ids[i].pos = slot + 1;
+}
+
+// Remove an ID from the map if it (still) refers to the given position in the
+// ring. The following entries of the cluster are shifted backwards so no
+// tombstones are needed
+static void remove_query_id(const int id, const unsigned int slot)
+{
+	const unsigned int mask = counters->query_ids_MAX - 1;
+	unsigned int i = (unsigned int)id & mask;
+	while(query_ids[i].pos != 0 && query_ids[i].id != id)
+		i = (i + 1) & mask;
+
+	if(query_ids[i].pos != slot + 1)
+		return;
+
+	for(unsigned int j = (i + 1) & mask; query_ids[j].pos != 0; j = (j + 1) & mask)
+	{
+		// Move the entry into the gap unless its home slot lies
+		// cyclically in (i, j]
+		const unsigned int home = (unsigned int)query_ids[j].id & mask;
+		if(i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		query_ids[i] = query_ids[j];
+		i = j;
+	}
+
+	query_ids[i].id = 0;
+	query_ids[i].pos = 0;
+	counters->query_ids--;
+}
+
+// Grow the query ID map after the ring has grown and translate the positions
+// of the queries grow_ring() has moved towards the end of the ring
+static void enlarge_query_ids(const unsigned int old_capacity, const unsigned int old_oldest)
+{
+	const unsigned int old_slots = counters->query_ids_MAX;
+	const unsigned int new_slots = query_ids_capacity();
+	if(new_slots == old_slots && old_oldest == counters->queries_oldest)
+		return;
+
+	struct query_id_slot *old = malloc(old_slots*sizeof(*old));
+	if(old == NULL)
+	{
+		log_crit("Memory allocation failed! Exiting");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(old, query_ids, old_slots*sizeof(*old));
+
+	if(new_slots != old_slots)
+	{
+		realloc_shm(&shm_query_ids, new_slots, sizeof(struct query_id_slot), true);
+		query_ids = (struct query_id_slot*)shm_query_ids.ptr;
+		counters->query_ids_MAX = new_slots;
+	}
+	memset(query_ids, 0, new_slots*sizeof(*query_ids));
+	counters->query_ids = 0;
+
+	const unsigned int moved = counters->queries_MAX - old_capacity;
+	for(unsigned int i = 0; i < old_slots; i++)
+	{
+		if(old[i].pos == 0)
+			continue;
+
+		unsigned int slot = old[i].pos - 1;
+		if(old_oldest != 0 && slot >= old_oldest)
+			slot += moved;
+		insert_query_id(old[i].id, slot);
+	}
+
+	free(old);
+}
+
+/**
+ * Remember which query dnsmasq refers to by the given ID. Has to be called
+ * with the exclusive SHM lock held.
+ *
+ * @param id ID assigned to the query by dnsmasq
+ * @param queryID ID of the query in FTL's memory
+ */
+void add_query_id(const int id, const unsigned int queryID)
+{
+	insert_query_id(id, ring_slot(queryID));
+}
+
+/**
+ * Find the query dnsmasq refers to by the given ID.
+ *
+ * @param id ID assigned to the query by dnsmasq
+ * @return ID of the query in FTL's memory or -1 if it is not known (anymore)
+ */
+int __attribute__((pure)) find_query_id(const int id)
+{
+	const unsigned int mask = counters->query_ids_MAX - 1;
+	unsigned int i = (unsigned int)id & mask;
+	while(query_ids[i].pos != 0 && query_ids[i].id != id)
+		i = (i + 1) & mask;
+
+	if(query_ids[i].pos == 0)
+		return -1;
+
+	// Translate the position in the ring into the query ID
+	const unsigned int slot = query_ids[i].pos - 1;
+	const unsigned int oldest = counters->queries_oldest;
+	const unsigned int queryID = slot >= oldest ? slot - oldest : slot + counters->queries_MAX - oldest;
+
+	return queryID < counters->queries ? (int)queryID : -1;
+}
+
+// Drop the oldest queries from the ring. Only their slots are cleared, none of
+// the remaining queries has to be moved
+void expire_queries(const unsigned int removed)
+{
+	if(removed == 0 || removed > counters->queries)
+		return;
+
+	// Release the domains, clients and cache records the expired queries
+	// are referencing and forget their IDs
+	for(unsigned int i = 0; i < removed; i++)
+	{
+		const unsigned int slot = ring_slot(i);
+		unref_query(&queries[slot]);
+		remove_query_id(queries[slot].id, slot);
+	}
+
+	const unsigned int capacity = counters->queries_MAX;
+	clear_ring((void*)queries, sizeof(queriesData), capacity, counters->queries_oldest, removed);
+	if(query_columns.status != NULL)
+	{
+		clear_ring((void*)query_columns.timestamp, sizeof(*query_columns.timestamp), capacity, counters->queries_oldest, removed);
+		clear_ring((void*)query_columns.id, sizeof(*query_columns.id), capacity, counters->queries_oldest, removed);
+		clear_ring((void*)query_columns.clientID, sizeof(*query_columns.clientID), capacity, counters->queries_oldest, removed);
+		clear_ring((void*)query_columns.domainID, sizeof(*query_columns.domainID), capacity, counters->queries_oldest, removed);
+		clear_ring(query_columns.status, sizeof(*query_columns.status), capacity, counters->queries_oldest, removed);
+	}
+
+	counters->queries_oldest = ring_slot(removed);
+	counters->queries -= removed;
+
+	// Start over at the beginning once the ring is empty
+	if(counters->queries == 0)
+		counters->queries_oldest = 0;
+}
+
+// Position of the recordID-th record of the cold tier in its ring
+static inline unsigned int cold_slot(const unsigned int recordID)
+{
+	const unsigned int slot = counters->cold_records_oldest + recordID;
+	return slot < counters->cold_records_MAX ? slot : slot - counters->cold_records_MAX;
+}
+
+/**
+ * Get a record of the cold tier.
+ *
+ * @param recordID Index of the record, counted from the oldest one
+ * @return Pointer to the record or NULL if there is no such record
+ */
+struct cold_query * __attribute__((pure)) get_cold_record(const unsigned int recordID)
+{
+	if(recordID >= counters->cold_records)
+		return NULL;
+
+	return &cold_records[cold_slot(recordID)];
+}
+
+/**
+ * Append a record to the cold tier, the ring is enlarged if needed. The record
+ * is zeroed, the caller has to fill it and take its references.
+ *
+ * @return Pointer to the new record
+ */
+struct cold_query *add_cold_record(void)
+{
+	if(counters->cold_records >= counters->cold_records_MAX)
+	{
+		const unsigned int old_capacity = counters->cold_records_MAX;
+		const unsigned int new_capacity = old_capacity + max(old_capacity / 2, COLD_RECORDS_ALLOC_STEP);
+		realloc_shm(&shm_cold_queries, new_capacity, sizeof(struct cold_query), true);
+		cold_records = (struct cold_query*)shm_cold_queries.ptr;
+		counters->cold_records_MAX = new_capacity;
+		counters->cold_records_oldest = grow_ring((void*)cold_records, sizeof(struct cold_query), old_capacity,
+		                                          new_capacity, counters->cold_records_oldest);
+	}
+
+	struct cold_query *cold = &cold_records[cold_slot(counters->cold_records++)];
+	memset(cold, 0, sizeof(*cold));
+	return cold;
+}
+
+// Drop the oldest records of the cold tier after the queries they count have
+// been removed from all counters
+void expire_cold_records(const unsigned int removed)
+{
+	if(removed == 0 || removed > counters->cold_records)
+		return;
+
+	for(unsigned int i = 0; i < removed; i++)
+	{
+		const struct cold_query *cold = &cold_records[cold_slot(i)];
+		ref_cold_query(cold, -1);
+		counters->queries_cold -= cold->count;
+	}
+
+	clear_ring((void*)cold_records, sizeof(struct cold_query), counters->cold_records_MAX,
+	           counters->cold_records_oldest, removed);
+	counters->cold_records_oldest = cold_slot(removed);
+	counters->cold_records -= removed;
+
+	// Start over at the beginning once the ring is empty
+	if(counters->cold_records == 0)
+		counters->cold_records_oldest = 0;
+}
+
+/**
+ * Mark a query as changed so it is (again) stored in the database. The
+ * position of the query is appended to the list of changed queries the first
+ * time the query changes after it has last been stored. Has to be called with
+ * the exclusive SHM lock held.
+ *
+ * @param query The changed query
+ */
+void mark_query_changed(queriesData *query)
+{
+	if(query->flags.database.changed)
+		return;
+
+	query->flags.database.changed = true;
+	if(dirty_queries == NULL || dirty_queries->overflow)
+		return;
+
+	if(dirty_queries->num >= DIRTY_QUERIES_MAX)
+	{
+		// The database thread falls back to scanning all recent
+		// queries in this case
+		dirty_queries->overflow = true;
+		return;
+	}
+
+	dirty_queries->slot[dirty_queries->num++] = query - queries;
+}
+
+/**
+ * Get the number of queries in the list of changed queries
+ *
+ * @param num Set to the number of list entries
+ * @return false if the list is incomplete because it overflowed (or queries
+ * have been moved) since it has last been reset
+ */
+bool get_dirty_queries(unsigned int *num)
+{
+	*num = dirty_queries->num;
+	return !dirty_queries->overflow;
+}
+
+// Get the i-th changed query, NULL if it has been expired in the meantime. The
+// same query may be returned more than once if it has been recycled
+queriesData * __attribute__((pure)) get_dirty_query(const unsigned int i)
+{
+	if(i >= dirty_queries->num || dirty_queries->slot[i] >= counters->queries_MAX)
+		return NULL;
+
+	queriesData *query = &queries[dirty_queries->slot[i]];
+	return query->magic == MAGICBYTE ? query : NULL;
+}
+
+void reset_dirty_queries(void)
+{
+	dirty_queries->num = 0;
+	dirty_queries->overflow = false;
+}
+
 // Remap shared object pointers which might have changed
 static void remap_shm(void)
 {
 	realloc_shm(&shm_queries, counters->queries_MAX, sizeof(queriesData), false);
 	queries = (queriesData*)shm_queries.ptr;
 
+	realloc_shm(&shm_query_columns, query_columns_size(counters->query_columns_MAX), 1, false);
+	set_query_columns();
+
+	realloc_shm(&shm_query_ids, counters->query_ids_MAX, sizeof(struct query_id_slot), false);
+	query_ids = (struct query_id_slot*)shm_query_ids.ptr;
+
+	realloc_shm(&shm_cold_queries, counters->cold_records_MAX, sizeof(struct cold_query), false);
+	cold_records = (struct cold_query*)shm_cold_queries.ptr;
+
 	realloc_shm(&shm_domains, counters->domains_MAX, sizeof(domainsData), false);
 	domains = (domainsData*)shm_domains.ptr;
 
 	realloc_shm(&shm_clients, counters->clients_MAX, sizeof(clientsData), false);
 	clients = (clientsData*)shm_clients.ptr;
 
+	realloc_shm(&shm_client_sketches, counters->clients_MAX, sizeof(clientSketchData), false);
+	client_sketches = (clientSketchData*)shm_client_sketches.ptr;
+
 	realloc_shm(&shm_upstreams, counters->upstreams_MAX, sizeof(upstreamsData), false);
 	upstreams = (upstreamsData*)shm_upstreams.ptr;
 
@@ -343,8 +951,149 @@ static void remap_shm(void)
 	realloc_shm(&shm_dns_cache_lookup, counters->dns_cache_lookup_MAX, sizeof(struct lookup_table), false);
 	dns_cache_lookup = (struct lookup_table*)shm_dns_cache_lookup.ptr;
 
+	realloc_shm(&shm_strings_lookup, counters->strings_lookup_MAX, sizeof(struct lookup_table), false);
+	strings_lookup = (struct lookup_table*)shm_strings_lookup.ptr;
+
+	realloc_shm(&shm_suffixes, counters->suffixes_MAX, sizeof(struct suffix_node), false);
+	domain_suffixes = (struct suffix_node*)shm_suffixes.ptr;
+
+	realloc_shm(&shm_suffixes_lookup, counters->suffixes_lookup_MAX, sizeof(struct lookup_table), false);
+	suffixes_lookup = (struct lookup_table*)shm_suffixes_lookup.ptr;
+
+	realloc_shm(&shm_upstreams_lookup, counters->upstreams_lookup_MAX, sizeof(struct lookup_table), false);
+	upstreams_lookup = (struct lookup_table*)shm_upstreams_lookup.ptr;
+
 	// Update local counter to reflect that we absorbed this change
 	local_shm_counter = shmSettings->global_shm_counter;
+	remap_calls++;
+}
+
+// Monotonic clock in nanoseconds used for the lock wait statistics
+static uint64_t lock_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Lock one of the two robust SHM mutexes
+static void lock_mutex(pthread_mutex_t *mutex, const char *which)
+{
+	int result = pthread_mutex_lock(mutex);
+
+	if(result != 0)
+		log_err("Error when obtaining %s SHM lock: %s", which, strerror(result));
+
+	if(result == EOWNERDEAD) {
+		// Try to make the lock consistent if the other process died while
+		// holding the lock
+		log_debug(DEBUG_LOCKS, "Owner of %s SHM lock died, making lock consistent", which);
+
+		result = pthread_mutex_consistent(mutex);
+		if(result != 0)
+			log_err("Failed to make %s SHM lock consistent: %s", which, strerror(result));
+	}
+}
+
+// Wait until all shared lock holders are gone. The caller holds the outer
+// mutex so no new readers can enter in the meantime. Returns the time spent
+// waiting (in nanoseconds)
+static uint64_t wait_for_readers(void)
+{
+	if(atomic_load(&shmLock->readers) == 0)
+		return 0;
+
+	const uint64_t start = lock_clock();
+	for(unsigned int spins = 0; atomic_load(&shmLock->readers) > 0; spins++)
+	{
+		// Readers typically hold the lock for a short scan only, yield
+		// first and start sleeping only when this takes longer
+		if(spins < 64)
+			sched_yield();
+		else
+			nanosleep(&(struct timespec){ 0, 50000 }, NULL);
+	}
+
+	return lock_clock() - start;
+}
+
+// Account the time a lock acquisition had to wait. This has to be called with
+// the outer mutex held as the statistics are shared between all processes
+static void account_lock_wait(const enum shm_lock_path path, const uint64_t wait, const uint64_t readers)
+{
+	struct shm_lock_stats *stats = &shmLock->stats[path];
+	stats->count++;
+	stats->wait += wait;
+	stats->readers += readers;
+	if(wait > stats->max)
+		stats->max = wait;
+}
+
+// Find the profile of a lock call site, a new one is added if the site has not
+// been seen before. This has to be called with the outer mutex held. Returns
+// SHM_LOCK_SITES if the table is full
+static unsigned int find_lock_site(const char *func, const char *file, const int line, const bool shared)
+{
+	const uint64_t key = ((uint64_t)(uintptr_t)func + (uint64_t)line) * 0x9E3779B97F4A7C15ULL;
+	for(unsigned int i = 0; i < SHM_LOCK_SITES; i++)
+	{
+		const unsigned int pos = ((key >> 32) + i) % SHM_LOCK_SITES;
+		struct shm_lock_site_data *site = &shmLock->sites[pos];
+		const char *site_func = atomic_load_explicit(&site->func, memory_order_relaxed);
+		if(site_func == func && site->line == line)
+			return pos;
+		if(site_func != NULL)
+			continue;
+
+		// Unused slot, add this site
+		site->file = file;
+		site->line = line;
+		site->shared = shared;
+		atomic_store_explicit(&site->func, func, memory_order_release);
+		return pos;
+	}
+
+	atomic_fetch_add_explicit(&shmLock->sites_dropped, 1, memory_order_relaxed);
+	return SHM_LOCK_SITES;
+}
+
+// Raise a maximum atomically
+static void atomic_max(atomic_uint_least64_t *max, const uint64_t value)
+{
+	uint64_t old = atomic_load_explicit(max, memory_order_relaxed);
+	while(value > old &&
+	      !atomic_compare_exchange_weak_explicit(max, &old, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+// Account the time a lock acquisition had to wait to its call site and
+// remember the site for releasing the lock
+static void account_site_wait(const char *func, const char *file, const int line, const bool shared,
+                              const uint64_t start, const uint64_t wait)
+{
+	lock_acquired = start + wait;
+	lock_site = find_lock_site(func, file, line, shared);
+	if(lock_site >= SHM_LOCK_SITES)
+		return;
+
+	struct shm_lock_site_data *site = &shmLock->sites[lock_site];
+	atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->wait, wait, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->wait_hist[api_histogram_bucket(wait / 1000u)], 1, memory_order_relaxed);
+	atomic_max(&site->max_wait, wait);
+}
+
+// Account the time the lock has been held to the call site it was obtained at
+static void account_site_hold(const uint64_t now)
+{
+	if(lock_site >= SHM_LOCK_SITES)
+		return;
+
+	const uint64_t hold = now - lock_acquired;
+	struct shm_lock_site_data *site = &shmLock->sites[lock_site];
+	atomic_fetch_add_explicit(&site->hold, hold, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->hold_hist[api_histogram_bucket(hold / 1000u)], 1, memory_order_relaxed);
+	atomic_max(&site->max_hold, hold);
+	lock_site = SHM_LOCK_SITES;
 }
 
 // Obtain SHMEM lock
@@ -355,23 +1104,26 @@ void _lock_shm(const char *func, const int line, const char *file)
 	if(shmLock == NULL)
 		return;
 
+	// Obtaining the exclusive lock while holding the shared lock would
+	// wait for ourselves forever
+	if(read_locks > 0)
+	{
+		log_err("Tried to obtain SHM lock while holding a shared SHM lock in %s() (%s:%i)",
+		        func, short_path(file), line);
+		generate_backtrace();
+	}
+
 	log_debug(DEBUG_LOCKS, "Waiting for SHM lock in %s() (%s:%i)", func, file, line);
 	log_debug(DEBUG_LOCKS, "SHM lock: %p", shmLock);
 
-	int result = pthread_mutex_lock(&shmLock->lock.outer);
-
-	if(result != 0)
-		log_err("Error when obtaining outer SHM lock: %s", strerror(result));
+	const uint64_t start = lock_clock();
+	lock_since = start;
+	lock_mutex(&shmLock->lock.outer, "outer");
 
-	if(result == EOWNERDEAD) {
-		// Try to make the lock consistent if the other process died while
-		// holding the lock
-		log_debug(DEBUG_LOCKS, "Owner of outer SHM lock died, making lock consistent");
-
-		result = pthread_mutex_consistent(&shmLock->lock.outer);
-		if(result != 0)
-			log_err("Failed to make outer SHM lock consistent: %s", strerror(result));
-	}
+	// Wait for all readers to leave. No new readers can enter as long as
+	// we hold the outer lock
+	const uint64_t readers = wait_for_readers();
+	const uint64_t waited = lock_clock() - start;
 
 	// Store lock owner after lock has been acquired and was made consistent (if required)
 	shmLock->owner.pid = getpid();
@@ -389,22 +1141,15 @@ void _lock_shm(const char *func, const int line, const char *file)
 	// Ensure we have enough shared memory available for new data
 	shm_ensure_size();
 
-	result = pthread_mutex_lock(&shmLock->lock.inner);
+	lock_mutex(&shmLock->lock.inner, "inner");
 
 	log_debug(DEBUG_LOCKS, "Obtained SHM lock for %s() (%s:%i)", func, file, line);
 
-	if(result != 0)
-		log_err("Error when obtaining inner SHM lock: %s", strerror(result));
-
-	if(result == EOWNERDEAD) {
-		// Try to make the lock consistent if the other process died while
-		// holding the lock
-		log_debug(DEBUG_LOCKS, "Owner of inner SHM lock died, making lock consistent");
-
-		result = pthread_mutex_consistent(&shmLock->lock.inner);
-		if(result != 0)
-			log_err("Failed to make inner SHM lock consistent: %s", strerror(result));
-	}
+	// The resolver runs in the main thread of FTL and of each TCP worker,
+	// everything else (API, database, GC, ...) runs in dedicated threads
+	account_lock_wait(gettid() == getpid() ? SHM_LOCK_DNS : SHM_LOCK_OTHER, waited, readers);
+	account_site_wait(func, file, line, false, start, waited);
+	FTL_PROBE(shm_lock, func, waited, readers);
 }
 
 // Release SHM lock
@@ -421,6 +1166,13 @@ void _unlock_shm(const char *func, const int line, const char * file)
 		        (long int)shmLock->owner.pid, (long int)shmLock->owner.tid);
 	}
 
+	// Anything may have changed while we held the lock exclusively
+	if(shmSettings != NULL)
+		shmSettings->data_generation++;
+
+	const uint64_t now = lock_clock();
+	account_site_hold(now);
+
 	// Unlock mutex
 	int result = pthread_mutex_unlock(&shmLock->lock.inner);
 	shmLock->owner.pid = 0;
@@ -433,9 +1185,106 @@ void _unlock_shm(const char *func, const int line, const char * file)
 	if(result != 0)
 		log_err("Failed to unlock outer SHM lock: %s", strerror(result));
 
+	lock_time += now - lock_since;
+	FTL_PROBE(shm_unlock, func, now - lock_since);
+
 	log_debug(DEBUG_LOCKS, "Removed SHM lock in %s() (%s:%i)", func, file, line);
 }
 
+// Obtain shared SHMEM lock. Any number of threads may hold this lock at the
+// same time, writers wait until the last of them has left. The lock holder
+// must not modify the shared memory objects in any way. Readers only pass
+// through the outer mutex so they queue behind a waiting writer instead of
+// starving it
+void _lock_shm_read(const char *func, const int line, const char *file)
+{
+	// There is no need to lock if we are the only thread
+	if(shmLock == NULL)
+		return;
+
+	// Nested shared locks only increase the depth. Going through the outer
+	// mutex again could deadlock against a writer waiting for us to leave
+	if(read_locks++ > 0)
+		return;
+
+	log_debug(DEBUG_LOCKS, "Waiting for shared SHM lock in %s() (%s:%i)", func, file, line);
+
+	const uint64_t start = lock_clock();
+	lock_since = start;
+	lock_mutex(&shmLock->lock.outer, "outer");
+
+	// Remapping changes the pointers all threads of this process use. This
+	// is only safe when nobody else is reading so we obtain the lock
+	// exclusively in this (rare) case
+	if(shmSettings != NULL &&
+	   local_shm_counter != shmSettings->global_shm_counter)
+	{
+		const uint64_t readers = wait_for_readers();
+		shmLock->owner.pid = getpid();
+		shmLock->owner.tid = gettid();
+
+		log_debug(DEBUG_SHMEM, "Remapping shared memory for current process %u %u",
+		          local_shm_counter, shmSettings->global_shm_counter);
+		remap_shm();
+
+		lock_mutex(&shmLock->lock.inner, "inner");
+		const uint64_t waited = lock_clock() - start;
+		account_lock_wait(SHM_LOCK_READ, waited, readers);
+		account_site_wait(func, file, line, true, start, waited);
+		FTL_PROBE(shm_lock_read, func, waited);
+		read_exclusive = true;
+
+		log_debug(DEBUG_LOCKS, "Obtained exclusive SHM lock for %s() (%s:%i)", func, file, line);
+		return;
+	}
+
+	atomic_fetch_add(&shmLock->readers, 1);
+	const uint64_t waited = lock_clock() - start;
+	account_lock_wait(SHM_LOCK_READ, waited, 0);
+	account_site_wait(func, file, line, true, start, waited);
+	FTL_PROBE(shm_lock_read, func, waited);
+
+	const int result = pthread_mutex_unlock(&shmLock->lock.outer);
+	if(result != 0)
+		log_err("Failed to unlock outer SHM lock: %s", strerror(result));
+
+	log_debug(DEBUG_LOCKS, "Obtained shared SHM lock for %s() (%s:%i)", func, file, line);
+}
+
+// Release shared SHM lock
+void _unlock_shm_read(const char *func, const int line, const char *file)
+{
+	// There is no need to unlock if we are the only thread
+	if(shmLock == NULL)
+		return;
+
+	if(read_locks == 0)
+	{
+		log_err("Tried to release shared SHM lock without holding it in %s() (%s:%i)",
+		        func, short_path(file), line);
+		return;
+	}
+
+	// Only the outermost unlock releases the lock
+	if(--read_locks > 0)
+		return;
+
+	if(read_exclusive)
+	{
+		read_exclusive = false;
+		_unlock_shm(func, line, file);
+		return;
+	}
+
+	const uint64_t now = lock_clock();
+	account_site_hold(now);
+	atomic_fetch_sub(&shmLock->readers, 1);
+	lock_time += now - lock_since;
+	FTL_PROBE(shm_unlock_read, func, now - lock_since);
+
+	log_debug(DEBUG_LOCKS, "Removed shared SHM lock in %s() (%s:%i)", func, file, line);
+}
+
 // Return if we locked this mutex (PID and TID match)
 bool is_our_lock(void)
 {
@@ -445,11 +1294,137 @@ bool is_our_lock(void)
 	return false;
 }
 
+// Return if this thread holds the shared lock. Obtaining the exclusive lock
+// would deadlock in this case
+bool __attribute__((pure)) holds_shm_read_lock(void)
+{
+	return read_locks > 0;
+}
+
+// Return the total time (in nanoseconds) this thread spent waiting for and
+// holding the exclusive or the shared SHM lock
+uint64_t __attribute__((pure)) get_thread_lock_time(void)
+{
+	return lock_time;
+}
+
+// Return if this thread may read from shared memory, i.e., holds either the
+// exclusive or the shared lock
+static bool may_read_shm(void)
+{
+	return read_locks > 0 || is_our_lock();
+}
+
+// Copy the lock wait statistics of all access paths
+void get_shm_lock_stats(struct shm_lock_stats stats[SHM_LOCK_PATHS])
+{
+	if(shmLock == NULL)
+	{
+		memset(stats, 0, SHM_LOCK_PATHS * sizeof(*stats));
+		return;
+	}
+
+	memcpy(stats, shmLock->stats, SHM_LOCK_PATHS * sizeof(*stats));
+}
+
+/**
+ * @brief Copy the contention profiles of all lock call sites used since the
+ * last reset
+ *
+ * @param sites Array receiving the profiles
+ * @param dropped Set to the number of lock acquisitions which could not be
+ * accounted because the table of call sites was full
+ * @return Number of call sites
+ */
+unsigned int get_shm_lock_sites(struct shm_lock_site sites[SHM_LOCK_SITES], uint64_t *dropped)
+{
+	*dropped = 0;
+	if(shmLock == NULL)
+		return 0;
+
+	unsigned int num = 0;
+	for(unsigned int i = 0; i < SHM_LOCK_SITES; i++)
+	{
+		struct shm_lock_site_data *data = &shmLock->sites[i];
+		const char *func = atomic_load_explicit(&data->func, memory_order_acquire);
+		const uint64_t count = atomic_load_explicit(&data->count, memory_order_relaxed);
+		if(func == NULL || count == 0)
+			continue;
+
+		struct shm_lock_site *site = &sites[num++];
+		site->func = func;
+		site->file = data->file;
+		site->line = data->line;
+		site->shared = data->shared;
+		site->count = count;
+		site->wait = atomic_load_explicit(&data->wait, memory_order_relaxed);
+		site->hold = atomic_load_explicit(&data->hold, memory_order_relaxed);
+		site->max_wait = atomic_load_explicit(&data->max_wait, memory_order_relaxed);
+		site->max_hold = atomic_load_explicit(&data->max_hold, memory_order_relaxed);
+		for(unsigned int j = 0; j < API_HISTOGRAM_BUCKETS; j++)
+		{
+			site->wait_hist.buckets[j] = atomic_load_explicit(&data->wait_hist[j], memory_order_relaxed);
+			site->hold_hist.buckets[j] = atomic_load_explicit(&data->hold_hist[j], memory_order_relaxed);
+		}
+	}
+
+	*dropped = atomic_load_explicit(&shmLock->sites_dropped, memory_order_relaxed);
+	return num;
+}
+
+/**
+ * @brief Reset the contention profiles of all lock call sites
+ *
+ * The sites themselves are kept as threads may currently hold the lock
+ * obtained at one of them. Locks released while resetting may still be
+ * accounted partially.
+ */
+void reset_shm_lock_sites(void)
+{
+	if(shmLock == NULL)
+		return;
+
+	for(unsigned int i = 0; i < SHM_LOCK_SITES; i++)
+	{
+		struct shm_lock_site_data *data = &shmLock->sites[i];
+		atomic_store_explicit(&data->count, 0, memory_order_relaxed);
+		atomic_store_explicit(&data->wait, 0, memory_order_relaxed);
+		atomic_store_explicit(&data->hold, 0, memory_order_relaxed);
+		atomic_store_explicit(&data->max_wait, 0, memory_order_relaxed);
+		atomic_store_explicit(&data->max_hold, 0, memory_order_relaxed);
+		for(unsigned int j = 0; j < API_HISTOGRAM_BUCKETS; j++)
+		{
+			atomic_store_explicit(&data->wait_hist[j], 0, memory_order_relaxed);
+			atomic_store_explicit(&data->hold_hist[j], 0, memory_order_relaxed);
+		}
+	}
+	atomic_store_explicit(&shmLock->sites_dropped, 0, memory_order_relaxed);
+}
+
+// Ask the kernel to back a large, frequently scanned object with transparent
+// huge pages to reduce TLB misses. This only has an effect if huge pages are
+// enabled for shared memory (/sys/kernel/mm/transparent_hugepage/shmem_enabled
+// set to "advise" or "within_size"). The advice is kept when the mapping
+// grows later on
+static void advise_hugepages(SharedMemory *sharedMemory)
+{
+#ifdef MADV_HUGEPAGE
+	if(madvise(sharedMemory->ptr, sharedMemory->mapped, MADV_HUGEPAGE) != 0)
+		log_debug(DEBUG_SHMEM, "madvise(%s, MADV_HUGEPAGE) failed: %s",
+		          sharedMemory->name, strerror(errno));
+#else
+	(void)sharedMemory;
+#endif
+}
+
 bool init_shmem()
 {
 	// Get kernel's page size
 	pagesize = getpagesize();
 
+	// Address space to reserve for each growing object
+	shm_reserve = (size_t)config.misc.shmReserve.v.ui * 1024u * 1024u;
+
 	/****************************** shared memory lock ******************************/
 	// Try to create shared memory object
 	create_shm(SHARED_LOCK_NAME, &shm_lock, sizeof(ShmLock));
@@ -527,11 +1502,43 @@ bool init_shmem()
 	if(shm_queries.ptr == NULL)
 		return false;
 	queries = (queriesData*)shm_queries.ptr;
+	advise_hugepages(&shm_queries);
 
 	counters->queries_MAX = pagesize;
 
+	/****************************** shared query columns ******************************/
+	// The columnar mirror grows together with the queries struct. If it is
+	// disabled, we only create a placeholder
+	counters->query_columns_MAX = config.misc.queryColumns.v.b ? counters->queries_MAX : 0;
+	// Try to create shared memory object
+	create_shm(SHARED_QUERY_COLUMNS_NAME, &shm_query_columns, query_columns_size(counters->query_columns_MAX));
+	if(shm_query_columns.ptr == NULL)
+		return false;
+	set_query_columns();
+	if(config.misc.queryColumns.v.b)
+		advise_hugepages(&shm_query_columns);
+
+	/****************************** shared query ID map ******************************/
+	// Maps the IDs dnsmasq assigns to queries to their position in the
+	// ring, it has at least twice as many slots as there are queries
+	counters->query_ids_MAX = query_ids_capacity();
+	// Try to create shared memory object
+	create_shm(SHARED_QUERY_IDS_NAME, &shm_query_ids, counters->query_ids_MAX*sizeof(struct query_id_slot));
+	if(shm_query_ids.ptr == NULL)
+		return false;
+	query_ids = (struct query_id_slot*)shm_query_ids.ptr;
+
+	/****************************** shared cold queries ******************************/
+	// Ring of the records of the cold tier (see misc.hotQueries)
+	counters->cold_records_MAX = (unsigned int)get_optimal_object_size(sizeof(struct cold_query), COLD_RECORDS_ALLOC_STEP);
+	// Try to create shared memory object
+	create_shm(SHARED_COLD_QUERIES_NAME, &shm_cold_queries, counters->cold_records_MAX*sizeof(struct cold_query));
+	if(shm_cold_queries.ptr == NULL)
+		return false;
+	cold_records = (struct cold_query*)shm_cold_queries.ptr;
+
 	/****************************** shared overTime struct ******************************/
-	size = get_optimal_object_size(sizeof(overTimeData), OVERTIME_SLOTS);
+	size = get_optimal_object_size(sizeof(overTimeData), OVERTIME_ALL_SLOTS);
 	// Try to create shared memory object
 	create_shm(SHARED_OVERTIME_NAME, &shm_overTime, size*sizeof(overTimeData));
 	if(shm_overTime.ptr == NULL)
@@ -566,6 +1573,13 @@ bool init_shmem()
 		return false;
 	fifo_log = (fifologData*)shm_fifo_log.ptr;
 
+	/****************************** shared TCP worker log rings ******************************/
+	// Try to create shared memory object
+	create_shm(SHARED_LOG_RINGS_NAME, &shm_log_rings, sizeof(logRingsData));
+	if(shm_log_rings.ptr == NULL)
+		return false;
+	log_rings = (logRingsData*)shm_log_rings.ptr;
+
 	/****************************** shared clients_lookup struct ******************************/
 	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
 	// Try to create shared memory object
@@ -574,56 +1588,487 @@ bool init_shmem()
 		return false;
 	clients_lookup = (struct lookup_table*)shm_clients_lookup.ptr;
 	counters->clients_lookup_MAX = size;
+	lookup_init(CLIENTS_LOOKUP);
+
+	/****************************** shared domains_lookup struct ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	create_shm(SHARED_DOMAINS_LOOKUP_NAME, &shm_domains_lookup, size*sizeof(struct lookup_table));
+	if(shm_domains_lookup.ptr == NULL)
+		return false;
+	domains_lookup = (struct lookup_table*)shm_domains_lookup.ptr;
+	counters->domains_lookup_MAX = size;
+	lookup_init(DOMAINS_LOOKUP);
+
+	/****************************** shared dns_cache_lookup struct ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	create_shm(SHARED_DNS_CACHE_LOOKUP_NAME, &shm_dns_cache_lookup, size*sizeof(struct lookup_table));
+	if(shm_dns_cache_lookup.ptr == NULL)
+		return false;
+	dns_cache_lookup = (struct lookup_table*)shm_dns_cache_lookup.ptr;
+	counters->dns_cache_lookup_MAX = size;
+	lookup_init(DNS_CACHE_LOOKUP);
+
+	/****************************** shared strings_lookup struct ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	create_shm(SHARED_STRINGS_LOOKUP_NAME, &shm_strings_lookup, size*sizeof(struct lookup_table));
+	if(shm_strings_lookup.ptr == NULL)
+		return false;
+	strings_lookup = (struct lookup_table*)shm_strings_lookup.ptr;
+	counters->strings_lookup_MAX = size;
+	lookup_init(STRINGS_LOOKUP);
+
+	/****************************** shared upstreams_lookup struct ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	create_shm(SHARED_UPSTREAMS_LOOKUP_NAME, &shm_upstreams_lookup, size*sizeof(struct lookup_table));
+	if(shm_upstreams_lookup.ptr == NULL)
+		return false;
+	upstreams_lookup = (struct lookup_table*)shm_upstreams_lookup.ptr;
+	counters->upstreams_lookup_MAX = size;
+	lookup_init(UPSTREAMS_LOOKUP);
+
+	/****************************** shared domain suffixes struct ******************************/
+	// A domain may add one node per label at once
+	size = get_optimal_object_size(sizeof(struct suffix_node), DOMAIN_LABELS_MAX);
+	// Try to create shared memory object
+	create_shm(SHARED_SUFFIXES_NAME, &shm_suffixes, size*sizeof(struct suffix_node));
+	if(shm_suffixes.ptr == NULL)
+		return false;
+	domain_suffixes = (struct suffix_node*)shm_suffixes.ptr;
+	counters->suffixes_MAX = size;
+
+	/****************************** shared suffixes_lookup struct ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	create_shm(SHARED_SUFFIXES_LOOKUP_NAME, &shm_suffixes_lookup, size*sizeof(struct lookup_table));
+	if(shm_suffixes_lookup.ptr == NULL)
+		return false;
+	suffixes_lookup = (struct lookup_table*)shm_suffixes_lookup.ptr;
+	counters->suffixes_lookup_MAX = size;
+	reset_domain_suffixes();
+
+	/****************************** shared recycler struct ******************************/
+	// Try to create shared memory object
+	create_shm(SHARED_RECYCLER_NAME, &shm_recycler, sizeof(struct recycler_tables));
+	if(shm_recycler.ptr == NULL)
+		return false;
+	recycler = (struct recycler_tables*)shm_recycler.ptr;
+
+	/****************************** shared top lists ******************************/
+	// Try to create shared memory object
+	// The lists are built on the first request for them
+	create_shm(SHARED_TOP_LISTS_NAME, &shm_top_lists, sizeof(topListsData));
+	if(shm_top_lists.ptr == NULL)
+		return false;
+	top_lists = (topListsData*)shm_top_lists.ptr;
+
+	/****************************** shared client sketches ******************************/
+	// Sketches are stored at the index of the client they belong to and
+	// grow together with the clients struct
+	create_shm(SHARED_CLIENT_SKETCHES_NAME, &shm_client_sketches, counters->clients_MAX*sizeof(clientSketchData));
+	if(shm_client_sketches.ptr == NULL)
+		return false;
+	client_sketches = (clientSketchData*)shm_client_sketches.ptr;
+
+	/****************************** shared dirty queries list ******************************/
+	// Try to create shared memory object
+	create_shm(SHARED_DIRTY_QUERIES_NAME, &shm_dirty_queries, sizeof(struct dirty_queries));
+	if(shm_dirty_queries.ptr == NULL)
+		return false;
+	dirty_queries = (struct dirty_queries*)shm_dirty_queries.ptr;
+
+	/****************************** shared latency traces ******************************/
+	// Try to create shared memory object
+	create_shm(SHARED_LATENCY_NAME, &shm_latency, sizeof(latencyData));
+	if(shm_latency.ptr == NULL)
+		return false;
+	latency = (latencyData*)shm_latency.ptr;
+
+	/****************************** shared rate-limiting buckets ******************************/
+	// Try to create shared memory object
+	create_shm(SHARED_RATE_LIMITS_NAME, &shm_rate_limits, sizeof(rateLimitData));
+	if(shm_rate_limits.ptr == NULL)
+		return false;
+	rate_limits = (rateLimitData*)shm_rate_limits.ptr;
+
+	/****************************** shared list hit counters ******************************/
+	// Try to create shared memory object
+	// Counters are loaded from the database later on
+	create_shm(SHARED_LIST_HITS_NAME, &shm_list_hits, sizeof(listHitsData));
+	if(shm_list_hits.ptr == NULL)
+		return false;
+	list_hits = (listHitsData*)shm_list_hits.ptr;
+
+	return true;
+}
+
+// CHOWN all shared memory objects to supplied user/group
+void chown_all_shmem(struct passwd *ent_pw)
+{
+	for(unsigned int i = 0; i < ArraySize(sharedMemories); i++)
+		chown_shmem(sharedMemories[i], ent_pw);
+}
+
+// Log size, reserved address space, and number of resizes and remaps of all
+// shared memory objects as seen by this process
+void log_shmem_details(void)
+{
+	log_debug(DEBUG_SHMEM, "Shared memory details (%u remaps of changed objects, %zu bytes in use):",
+	          remap_calls, used_shmem);
+	for(unsigned int i = 0; i < ArraySize(sharedMemories); i++)
+	{
+		const SharedMemory *sharedMemory = sharedMemories[i];
+		if(sharedMemory->name == NULL)
+			continue;
+
+		char prefix_size[2] = { 0 }, prefix_mapped[2] = { 0 };
+		double formatted_size = 0.0, formatted_mapped = 0.0;
+		format_memory_size(prefix_size, sharedMemory->size, &formatted_size);
+		format_memory_size(prefix_mapped, sharedMemory->mapped, &formatted_mapped);
+
+		log_debug(DEBUG_SHMEM, " -> %s: %.1f%sB of %.1f%sB mapped, %u resizes, %u remaps",
+		          sharedMemory->name, formatted_size, prefix_size,
+		          formatted_mapped, prefix_mapped,
+		          sharedMemory->resizes, sharedMemory->remaps);
+	}
+
+	// Compare the capacity plan with the objects actually stored
+	static const char *plan_names[PLAN_ITEMS] = { "queries", "domains", "clients", "DNS cache", "strings" };
+	const unsigned int capacity[PLAN_ITEMS] = { counters->queries_MAX, counters->domains_MAX, counters->clients_MAX,
+	                                            counters->dns_cache_MAX, counters->strings_MAX };
+	unsigned int usage[PLAN_ITEMS];
+	get_shmem_usage(usage);
+	log_debug(DEBUG_SHMEM, "Capacity plan (projected / in use / capacity):");
+	for(unsigned int i = 0; i < PLAN_ITEMS; i++)
+		log_debug(DEBUG_SHMEM, " -> %s: %u / %u / %u", plan_names[i], projected[i], usage[i], capacity[i]);
+}
+
+// Get all shared memory objects as seen by this process together with the
+// number of remaps of changed objects and the bytes in use (the same details
+// log_shmem_details() logs). Objects without name are not in use. The SHM
+// lock has to be held while accessing the objects
+SharedMemory *const *get_shmem_details(unsigned int *num, unsigned int *remaps, size_t *used)
+{
+	*num = ArraySize(sharedMemories);
+	*remaps = remap_calls;
+	*used = used_shmem;
+	return sharedMemories;
+}
+
+// Destroy mutex and, subsequently, delete all shared memory objects
+void destroy_shmem(void)
+{
+	// First, we destroy the mutex
+	if(shmLock != NULL)
+	{
+		pthread_mutex_destroy(&shmLock->lock.inner);
+		pthread_mutex_destroy(&shmLock->lock.outer);
+	}
+	shmLock = NULL;
+
+	// Then, we delete the shared memory objects
+	for(unsigned int i = 0; i < ArraySize(sharedMemories); i++)
+		delete_shm(sharedMemories[i]);
+}
+
+#define SNAPSHOT_MAGIC "FTLSHMS"
+
+struct shm_snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t crc; // CRC-32 of the header (with this set to zero) and all objects
+	char git_hash[48];
+	uint32_t objsize[8];
+	bool query_columns;
+	int64_t dbid;
+	double timestamp;
+	uint64_t next_str_pos;
+	uint64_t compacted_str_pos;
+	uint32_t gravity_generation;
+	uint64_t size[ArraySize(snapshotMemories)];
+};
+
+// Sizes of the structs stored in the snapshot, the snapshot can only be
+// restored by a binary using the same memory layout
+static void snapshot_objsizes(uint32_t objsize[8])
+{
+	objsize[0] = sizeof(countersStruct);
+	objsize[1] = sizeof(queriesData);
+	objsize[2] = sizeof(clientsData);
+	objsize[3] = sizeof(domainsData);
+	objsize[4] = sizeof(upstreamsData);
+	objsize[5] = sizeof(DNSCacheData);
+	objsize[6] = sizeof(overTimeData);
+	objsize[7] = sizeof(struct lookup_table);
+}
+
+static bool __attribute__((pure)) is_growing(const SharedMemory *sharedMemory)
+{
+	for(unsigned int i = 0; i < ArraySize(growingMemories); i++)
+		if(growingMemories[i] == sharedMemory)
+			return true;
+
+	return false;
+}
+
+/**
+ * Save the shared memory objects holding queries, clients, domains, upstreams,
+ * strings, the overTime data and all lookup tables into a file. The file is
+ * written to a temporary file first and renamed afterwards so a crash while
+ * saving cannot leave a truncated snapshot behind.
+ *
+ * @param path The file to write
+ * @param dbid ID of the newest query in the long-term database, the snapshot
+ * is only restored if the database still matches
+ * @return true on success
+ */
+bool save_shmem_snapshot(const char *path, const int64_t dbid)
+{
+	const double start = double_time();
+	char *tmp = calloc(strlen(path) + 5, sizeof(char));
+	if(tmp == NULL)
+		return false;
+	sprintf(tmp, "%s.tmp", path);
+
+	FILE *fp = fopen(tmp, "wb");
+	if(fp == NULL)
+	{
+		log_warn("Cannot save shared memory snapshot to %s: %s", tmp, strerror(errno));
+		free(tmp);
+		return false;
+	}
+
+	struct shm_snapshot_header header = { 0 };
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SHARED_MEMORY_VERSION;
+	strncpy(header.git_hash, git_hash(), sizeof(header.git_hash) - 1);
+	snapshot_objsizes(header.objsize);
+	header.query_columns = config.misc.queryColumns.v.b;
+	header.dbid = dbid;
+	header.timestamp = double_time();
+
+	lock_shm();
+	header.next_str_pos = shmSettings->next_str_pos;
+	header.compacted_str_pos = shmSettings->compacted_str_pos;
+	header.gravity_generation = shmSettings->gravity_generation;
+	for(unsigned int i = 0; i < ArraySize(snapshotMemories); i++)
+		header.size[i] = snapshotMemories[i]->size;
+
+	// Write the header twice, the checksum is only known after all objects
+	// have been written
+	uint32_t crc = mz_crc32(MZ_CRC32_INIT, (const unsigned char*)&header, sizeof(header));
+	bool okay = fwrite(&header, sizeof(header), 1, fp) == 1;
+	for(unsigned int i = 0; okay && i < ArraySize(snapshotMemories); i++)
+	{
+		const SharedMemory *sharedMemory = snapshotMemories[i];
+		crc = mz_crc32(crc, sharedMemory->ptr, sharedMemory->size);
+		okay = fwrite(sharedMemory->ptr, 1, sharedMemory->size, fp) == sharedMemory->size;
+	}
+	unlock_shm();
+
+	header.crc = crc;
+	okay = okay && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+	okay = fclose(fp) == 0 && okay;
+
+	if(okay && rename(tmp, path) != 0)
+	{
+		log_warn("Cannot rename %s to %s: %s", tmp, path, strerror(errno));
+		okay = false;
+	}
+	else if(!okay)
+		log_warn("Cannot save shared memory snapshot to %s: %s", tmp, strerror(errno));
+
+	if(!okay)
+		unlink(tmp);
+	else
+		log_info("Saved shared memory snapshot with %u queries in %.1f ms",
+		         counters->queries, 1e3*(double_time() - start));
+
+	free(tmp);
+	return okay;
+}
+
+// Check if the snapshot can be restored into the current shared memory
+// objects, returns the reason why it cannot or NULL if it can
+static const char *check_shmem_snapshot(const unsigned char *data, const size_t size, const int64_t dbid)
+{
+	if(size < sizeof(struct shm_snapshot_header))
+		return "file is truncated";
+
+	struct shm_snapshot_header header;
+	memcpy(&header, data, sizeof(header));
+	if(memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+		return "not a snapshot";
+
+	uint32_t objsize[8] = { 0 };
+	snapshot_objsizes(objsize);
+	if(header.version != SHARED_MEMORY_VERSION ||
+	   strncmp(header.git_hash, git_hash(), sizeof(header.git_hash) - 1) != 0 ||
+	   memcmp(header.objsize, objsize, sizeof(objsize)) != 0)
+		return "saved by a different version of FTL";
+
+	if(header.query_columns != config.misc.queryColumns.v.b)
+		return "misc.queryColumns has been changed";
+
+	if(header.dbid != dbid)
+		return "long-term database has been changed";
+
+	const double now = double_time();
+	if(header.timestamp > now || now - header.timestamp > config.webserver.api.maxHistory.v.ui)
+		return "outdated";
+
+	size_t expected = sizeof(header);
+	for(unsigned int i = 0; i < ArraySize(snapshotMemories); i++)
+	{
+		// Objects can only grow, fixed-size objects have to match exactly
+		const SharedMemory *sharedMemory = snapshotMemories[i];
+		if(header.size[i] < sharedMemory->size ||
+		   (header.size[i] != sharedMemory->size && !is_growing(sharedMemory)))
+			return "object sizes do not match";
+		expected += header.size[i];
+	}
+	if(size != expected)
+		return "file is truncated";
+
+	const uint32_t crc = header.crc;
+	header.crc = 0;
+	uint32_t check = mz_crc32(MZ_CRC32_INIT, (const unsigned char*)&header, sizeof(header));
+	check = mz_crc32(check, data + sizeof(header), size - sizeof(header));
+	if(check != crc)
+		return "checksum mismatch";
+
+	return NULL;
+}
+
+/**
+ * Restore the shared memory objects from a snapshot saved on shutdown. The
+ * snapshot is only used if it has been saved by this version of FTL, its
+ * checksum matches, and the long-term database has not been changed since.
+ *
+ * @param path The file to read
+ * @param dbid ID of the newest query in the long-term database
+ * @return true if the snapshot has been restored
+ */
+bool load_shmem_snapshot(const char *path, const int64_t dbid)
+{
+	const double start = double_time();
+	const int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		if(errno != ENOENT)
+			log_warn("Cannot open shared memory snapshot %s: %s", path, strerror(errno));
+		return false;
+	}
 
-	/****************************** shared domains_lookup struct ******************************/
-	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
-	// Try to create shared memory object
-	create_shm(SHARED_DOMAINS_LOOKUP_NAME, &shm_domains_lookup, size*sizeof(struct lookup_table));
-	if(shm_domains_lookup.ptr == NULL)
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
 		return false;
-	domains_lookup = (struct lookup_table*)shm_domains_lookup.ptr;
-	counters->domains_lookup_MAX = size;
+	}
 
-	/****************************** shared dns_cache_lookup struct ******************************/
-	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
-	// Try to create shared memory object
-	create_shm(SHARED_DNS_CACHE_LOOKUP_NAME, &shm_dns_cache_lookup, size*sizeof(struct lookup_table));
-	if(shm_dns_cache_lookup.ptr == NULL)
+	// Map the snapshot instead of reading it, the objects are copied only
+	// once into the shared memory
+	const size_t size = st.st_size;
+	unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+	{
+		log_warn("Cannot map shared memory snapshot %s: %s", path, strerror(errno));
 		return false;
-	dns_cache_lookup = (struct lookup_table*)shm_dns_cache_lookup.ptr;
-	counters->dns_cache_lookup_MAX = size;
+	}
 
-	/****************************** shared recycler struct ******************************/
-	// Try to create shared memory object
-	create_shm(SHARED_RECYCLER_NAME, &shm_recycler, sizeof(struct recycler_tables));
-	if(shm_recycler.ptr == NULL)
+	const char *reason = check_shmem_snapshot(data, size, dbid);
+	if(reason != NULL)
+	{
+		log_info("Not restoring shared memory snapshot %s: %s", path, reason);
+		munmap(data, size);
 		return false;
+	}
+
+	struct shm_snapshot_header header;
+	memcpy(&header, data, sizeof(header));
+
+	lock_shm();
+
+	// These are not part of the snapshot
+	const unsigned int per_client_regex_MAX = counters->per_client_regex_MAX;
+	const unsigned int regex_change = counters->regex_change;
+
+	const unsigned char *obj = data + sizeof(header);
+	for(unsigned int i = 0; i < ArraySize(snapshotMemories); i++)
+	{
+		SharedMemory *sharedMemory = snapshotMemories[i];
+		realloc_shm(sharedMemory, header.size[i], 1, true);
+		memcpy(sharedMemory->ptr, obj, header.size[i]);
+		obj += header.size[i];
+	}
+
+	counters = (countersStruct*)shm_counters.ptr;
+	counters->per_client_regex_MAX = per_client_regex_MAX;
+	counters->regex_change = regex_change;
+	memset(counters->dnssec.queued, 0, sizeof(counters->dnssec.queued));
+
+	queries = (queriesData*)shm_queries.ptr;
+	clients = (clientsData*)shm_clients.ptr;
+	domains = (domainsData*)shm_domains.ptr;
+	upstreams = (upstreamsData*)shm_upstreams.ptr;
+	overTime = (overTimeData*)shm_overTime.ptr;
+	dns_cache = (DNSCacheData*)shm_dns_cache.ptr;
+	clients_lookup = (struct lookup_table*)shm_clients_lookup.ptr;
+	domains_lookup = (struct lookup_table*)shm_domains_lookup.ptr;
+	dns_cache_lookup = (struct lookup_table*)shm_dns_cache_lookup.ptr;
+	strings_lookup = (struct lookup_table*)shm_strings_lookup.ptr;
+	domain_suffixes = (struct suffix_node*)shm_suffixes.ptr;
+	suffixes_lookup = (struct lookup_table*)shm_suffixes_lookup.ptr;
+	upstreams_lookup = (struct lookup_table*)shm_upstreams_lookup.ptr;
 	recycler = (struct recycler_tables*)shm_recycler.ptr;
+	top_lists = (topListsData*)shm_top_lists.ptr;
+	client_sketches = (clientSketchData*)shm_client_sketches.ptr;
+	dirty_queries = (struct dirty_queries*)shm_dirty_queries.ptr;
+	query_ids = (struct query_id_slot*)shm_query_ids.ptr;
+	cold_records = (struct cold_query*)shm_cold_queries.ptr;
+	set_query_columns();
+
+	shmSettings->next_str_pos = header.next_str_pos;
+	shmSettings->compacted_str_pos = header.compacted_str_pos;
+
+	// Cached DNS records are re-validated against the freshly loaded lists
+	// on their next use
+	shmSettings->gravity_generation = header.gravity_generation + 1;
+	for(unsigned int i = 0; i < counters->dns_cache_size; i++)
+		dns_cache[i].cname_target = NULL;
+
+	// Upstreams start with closed circuits, the probes of the previous
+	// process are gone
+	for(unsigned int i = 0; i < counters->upstreams; i++)
+		memset(&upstreams[i].circuit, 0, sizeof(upstreams[i].circuit));
+
+	unlock_shm();
+	munmap(data, size);
+
+	log_info("Restored %u queries, %u clients, and %u domains from shared memory snapshot in %.1f ms",
+	         counters->queries, counters->clients, counters->domains, 1e3*(double_time() - start));
 
 	return true;
 }
 
-// CHOWN all shared memory objects to supplied user/group
-void chown_all_shmem(struct passwd *ent_pw)
+// Get the number of bytes of address space to reserve for a shared memory
+// object, zero if it should only be mapped as large as it is
+static size_t shm_reservation(const SharedMemory *sharedMemory)
 {
-	for(unsigned int i = 0; i < ArraySize(sharedMemories); i++)
-		chown_shmem(sharedMemories[i], ent_pw);
-}
+	// The columnar mirror is only a placeholder when it is disabled
+	if(sharedMemory == &shm_query_columns && !config.misc.queryColumns.v.b)
+		return 0u;
 
-// Destroy mutex and, subsequently, delete all shared memory objects
-void destroy_shmem(void)
-{
-	// First, we destroy the mutex
-	if(shmLock != NULL)
-	{
-		pthread_mutex_destroy(&shmLock->lock.inner);
-		pthread_mutex_destroy(&shmLock->lock.outer);
-	}
-	shmLock = NULL;
+	for(unsigned int i = 0; i < ArraySize(growingMemories); i++)
+		if(growingMemories[i] == sharedMemory)
+			return shm_reserve;
 
-	// Then, we delete the shared memory objects
-	for(unsigned int i = 0; i < ArraySize(sharedMemories); i++)
-		delete_shm(sharedMemories[i]);
+	return 0u;
 }
 
 /// Create shared memory
@@ -705,8 +2150,20 @@ static bool create_shm(const char *suffix, SharedMemory *sharedMemory, const siz
 	// We only add here as this is a new file
 	used_shmem += size;
 
-	// Create shared memory mapping
-	void *shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sharedMemory->fd, 0);
+	// Create shared memory mapping. Growing objects may map more than the
+	// current size of the file. Pages beyond the end of the file are not
+	// backed by memory and must not be accessed before the file has been
+	// enlarged, this only reserves the address space so the object can
+	// later grow without moving
+	size_t mapped = MAX(size, shm_reservation(sharedMemory));
+	void *shm = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, sharedMemory->fd, 0);
+	if(shm == MAP_FAILED && mapped > size)
+	{
+		log_warn("create_shm(): Failed to reserve %zu bytes of address space for \"%s\": %s",
+		         mapped, sharedMemory->name, strerror(errno));
+		mapped = size;
+		shm = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, sharedMemory->fd, 0);
+	}
 
 	// Check for `mmap` error
 	if(shm == MAP_FAILED)
@@ -720,10 +2177,11 @@ static bool create_shm(const char *suffix, SharedMemory *sharedMemory, const siz
 	memset(shm, 0, size);
 
 	sharedMemory->ptr = shm;
+	sharedMemory->mapped = mapped;
 	return sharedMemory;
 }
 
-static void *enlarge_shmem_struct(const char type)
+static void *enlarge_shmem_struct(const char type, const size_t capacity)
 {
 	SharedMemory *sharedMemory = NULL;
 	size_t sizeofobj, allocation_step;
@@ -770,27 +2228,77 @@ static void *enlarge_shmem_struct(const char type)
 			break;
 		case CLIENTS_LOOKUP:
 			sharedMemory = &shm_clients_lookup;
-			allocation_step = get_optimal_object_size(sizeof(struct lookup_table), 1);
+			// Lookup tables grow geometrically as all elements
+			// have to be rehashed after each resize
+			allocation_step = counters->clients_lookup_MAX;
 			sizeofobj = sizeof(struct lookup_table);
 			size = &counters->clients_lookup_MAX;
 			break;
 		case DOMAINS_LOOKUP:
 			sharedMemory = &shm_domains_lookup;
-			allocation_step = get_optimal_object_size(sizeof(struct lookup_table), 1);
+			// Lookup tables grow geometrically as all elements
+			// have to be rehashed after each resize
+			allocation_step = counters->domains_lookup_MAX;
 			sizeofobj = sizeof(struct lookup_table);
 			size = &counters->domains_lookup_MAX;
 			break;
 		case DNS_CACHE_LOOKUP:
 			sharedMemory = &shm_dns_cache_lookup;
-			allocation_step = get_optimal_object_size(sizeof(struct lookup_table), 1);
+			// Lookup tables grow geometrically as all elements
+			// have to be rehashed after each resize
+			allocation_step = counters->dns_cache_lookup_MAX;
 			sizeofobj = sizeof(struct lookup_table);
 			size = &counters->dns_cache_lookup_MAX;
 			break;
+		case STRINGS_LOOKUP:
+			sharedMemory = &shm_strings_lookup;
+			// Lookup tables grow geometrically as all elements
+			// have to be rehashed after each resize
+			allocation_step = counters->strings_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			size = &counters->strings_lookup_MAX;
+			break;
+		case SUFFIXES:
+			sharedMemory = &shm_suffixes;
+			allocation_step = get_optimal_object_size(sizeof(struct suffix_node), DOMAIN_LABELS_MAX);
+			sizeofobj = sizeof(struct suffix_node);
+			size = &counters->suffixes_MAX;
+			break;
+		case SUFFIXES_LOOKUP:
+			sharedMemory = &shm_suffixes_lookup;
+			// Lookup tables grow geometrically as all elements
+			// have to be rehashed after each resize
+			allocation_step = counters->suffixes_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			size = &counters->suffixes_lookup_MAX;
+			break;
+		case UPSTREAMS_LOOKUP:
+			sharedMemory = &shm_upstreams_lookup;
+			// Lookup tables grow geometrically as all elements
+			// have to be rehashed after each resize
+			allocation_step = counters->upstreams_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			size = &counters->upstreams_lookup_MAX;
+			break;
 		default:
 			log_err("Invalid argument in enlarge_shmem_struct(%i)", type);
 			return 0;
 	}
 
+	// Grow by at least a quarter of the current size (in multiples of the
+	// allocation step) so that the number of resizes - and of remaps in
+	// all other processes - only grows logarithmically with the number of
+	// objects stored
+	if(*size / 4 > allocation_step)
+		allocation_step *= (*size / 4) / allocation_step;
+
+	// Grow to the requested capacity at once
+	if(*size + allocation_step < capacity)
+	{
+		const size_t missing = capacity - *size;
+		allocation_step *= missing / allocation_step + (missing % allocation_step != 0 ? 1u : 0u);
+	}
+
 	// Reallocate enough space for requested object
 	const size_t current = sharedMemory->size/sizeofobj;
 	realloc_shm(sharedMemory, current + allocation_step, sizeofobj, true);
@@ -798,6 +2306,13 @@ static void *enlarge_shmem_struct(const char type)
 	// Add allocated memory to corresponding size
 	*size += allocation_step;
 
+	// The client sketches grow together with the clients
+	if(type == CLIENTS)
+	{
+		realloc_shm(&shm_client_sketches, *size, sizeof(clientSketchData), true);
+		client_sketches = (clientSketchData*)shm_client_sketches.ptr;
+	}
+
 	return sharedMemory->ptr;
 }
 
@@ -806,6 +2321,10 @@ static bool realloc_shm(SharedMemory *sharedMemory, const size_t size1, const si
 	// Absolute target size
 	const size_t size = size1 * size2;
 
+	// Nothing to do if this object has not changed since we last mapped it
+	if(!resize && size == sharedMemory->size)
+		return true;
+
 	// Log that we are doing something here
 	char df[64] =  { 0 };
 	const unsigned int percentage = get_dev_shm_usage(df);
@@ -848,30 +2367,49 @@ static bool realloc_shm(SharedMemory *sharedMemory, const size_t size1, const si
 		local_shm_counter++;
 	}
 
-	void *new_ptr = mremap(sharedMemory->ptr, sharedMemory->size, size, MREMAP_MAYMOVE);
-	if(new_ptr == MAP_FAILED)
-	{
-		log_crit("realloc_shm(): mremap(%p, %zu, %zu, MREMAP_MAYMOVE): Failed to reallocate \"%s\": %s",
-		         sharedMemory->ptr, sharedMemory->size, size, sharedMemory->name, strerror(errno));
-		exit(EXIT_FAILURE);
-	}
+	if(resize)
+		sharedMemory->resizes++;
 
 	// Update how much memory FTL uses
 	// We add the difference between updated and previous size
 	used_shmem += (size - sharedMemory->size);
 
-	if(sharedMemory->ptr == new_ptr)
+	// The object still fits into the address space reserved for it so it
+	// can grow in place. Otherwise, we have to extend (and possibly move)
+	// the mapping. If address space is reserved, we reserve twice as much
+	// as before to keep the number of such remaps small
+	if(size > sharedMemory->mapped)
 	{
-		log_debug(DEBUG_SHMEM, "SHMEM pointer not updated: %p (%zu %zu)",
-		          sharedMemory->ptr, sharedMemory->size, size);
+		const size_t mapped = shm_reservation(sharedMemory) > 0 ? MAX(size, 2*sharedMemory->mapped) : size;
+		void *new_ptr = mremap(sharedMemory->ptr, sharedMemory->mapped, mapped, MREMAP_MAYMOVE);
+		if(new_ptr == MAP_FAILED)
+		{
+			log_crit("realloc_shm(): mremap(%p, %zu, %zu, MREMAP_MAYMOVE): Failed to reallocate \"%s\": %s",
+			         sharedMemory->ptr, sharedMemory->mapped, mapped, sharedMemory->name, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		if(sharedMemory->ptr == new_ptr)
+		{
+			log_debug(DEBUG_SHMEM, "SHMEM pointer not updated: %p (%zu %zu)",
+			          sharedMemory->ptr, sharedMemory->mapped, mapped);
+		}
+		else
+		{
+			log_debug(DEBUG_SHMEM, "SHMEM pointer updated: %p -> %p (%zu %zu)",
+			          sharedMemory->ptr, new_ptr, sharedMemory->mapped, mapped);
+		}
+
+		sharedMemory->ptr = new_ptr;
+		sharedMemory->mapped = mapped;
+		sharedMemory->remaps++;
 	}
 	else
 	{
-		log_debug(DEBUG_SHMEM, "SHMEM pointer updated: %p -> %p (%zu %zu)",
-		          sharedMemory->ptr, new_ptr, sharedMemory->size, size);
+		log_debug(DEBUG_SHMEM, "SHMEM grows in place: %p (%zu of %zu)",
+		          sharedMemory->ptr, size, sharedMemory->mapped);
 	}
 
-	sharedMemory->ptr = new_ptr;
 	sharedMemory->size = size;
 
 	return true;
@@ -893,9 +2431,9 @@ static void delete_shm(SharedMemory *sharedMemory)
 				break;
 			}
 		}
-		if(munmap(sharedMemory->ptr, sharedMemory->size) != 0)
+		if(munmap(sharedMemory->ptr, sharedMemory->mapped) != 0)
 			log_warn("delete_shm(): munmap(%p, %zu) failed: %s",
-			         sharedMemory->ptr, sharedMemory->size, strerror(errno));
+			         sharedMemory->ptr, sharedMemory->mapped, strerror(errno));
 	}
 
 	// Set unmapped pointer to NULL
@@ -971,93 +2509,165 @@ static size_t get_optimal_object_size(const size_t objsize, const size_t minsize
 	}
 }
 
-// Enlarge shared memory to be able to hold at least one new record
-void shm_ensure_size(void)
+// Slots a lookup table needs to hold num elements without being resized
+static size_t __attribute__((const)) lookup_capacity(const unsigned int num)
+{
+	return num > 0 ? (size_t)num * 100u / LOOKUP_MAX_LOAD + 1u : 0u;
+}
+
+// Enlarge shared memory to be able to hold at least one new record and the
+// number of objects planned (if any)
+static void ensure_size(const unsigned int plan[PLAN_ITEMS])
 {
-	if(counters->queries >= counters->queries_MAX-1)
+	if(counters->queries >= counters->queries_MAX-1 || counters->queries_MAX < plan[PLAN_QUERIES])
 	{
 		// Have to reallocate shared memory
-		queries = enlarge_shmem_struct(QUERIES);
+		const unsigned int old_capacity = counters->queries_MAX;
+		queries = enlarge_shmem_struct(QUERIES, plan[PLAN_QUERIES]);
 		if(queries == NULL)
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
+
+		// Grow the query columns alongside (if enabled)
+		enlarge_query_columns();
+
+		// Close the gap the enlargement opened in the ring of queries
+		// This moves queries so the positions in the list of changed
+		// queries become meaningless
+		dirty_queries->overflow = true;
+		const unsigned int old_oldest = counters->queries_oldest;
+		counters->queries_oldest = grow_ring((void*)queries, sizeof(queriesData), old_capacity,
+		                                     counters->queries_MAX, counters->queries_oldest);
+		if(old_oldest != counters->queries_oldest)
+			log_debug(DEBUG_SHMEM, "Moved oldest query in ring from %u to %u",
+			          old_oldest, counters->queries_oldest);
+
+		// The positions stored in the query ID map have moved as well
+		enlarge_query_ids(old_capacity, old_oldest);
 	}
 	if(counters->upstreams >= counters->upstreams_MAX-1)
 	{
 		// Have to reallocate shared memory
-		upstreams = enlarge_shmem_struct(UPSTREAMS);
+		upstreams = enlarge_shmem_struct(UPSTREAMS, 0);
 		if(upstreams == NULL)
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
 	}
-	if(counters->clients >= counters->clients_MAX-1)
+	if(counters->clients >= counters->clients_MAX-1 || counters->clients_MAX < plan[PLAN_CLIENTS])
 	{
 		// Have to reallocate shared memory
-		clients = enlarge_shmem_struct(CLIENTS);
+		clients = enlarge_shmem_struct(CLIENTS, plan[PLAN_CLIENTS]);
 		if(clients == NULL)
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
 	}
-	if(counters->domains >= counters->domains_MAX-1)
+	if(counters->domains >= counters->domains_MAX-1 || counters->domains_MAX < plan[PLAN_DOMAINS])
 	{
 		// Have to reallocate shared memory
-		domains = enlarge_shmem_struct(DOMAINS);
+		domains = enlarge_shmem_struct(DOMAINS, plan[PLAN_DOMAINS]);
 		if(domains == NULL)
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
 	}
-	if(counters->dns_cache_size >= counters->dns_cache_MAX-1)
+	if(counters->dns_cache_size >= counters->dns_cache_MAX-1 || counters->dns_cache_MAX < plan[PLAN_DNS_CACHE])
 	{
 		// Have to reallocate shared memory
-		dns_cache = enlarge_shmem_struct(DNS_CACHE);
+		dns_cache = enlarge_shmem_struct(DNS_CACHE, plan[PLAN_DNS_CACHE]);
 		if(dns_cache == NULL)
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
 	}
-	if(shmSettings->next_str_pos + STRINGS_ALLOC_STEP >= shm_strings.size)
+	if(shmSettings->next_str_pos + STRINGS_ALLOC_STEP >= shm_strings.size || counters->strings_MAX < plan[PLAN_STRINGS])
+	{
+		// Have to reallocate shared memory
+		if(enlarge_shmem_struct(STRINGS, plan[PLAN_STRINGS]) == NULL)
+		{
+			log_crit("Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(LOOKUP_NEEDS_RESIZE(max(counters->clients_lookup_size, plan[PLAN_CLIENTS]), counters->clients_lookup_MAX))
+	{
+		// Have to reallocate shared memory
+		const unsigned int old_capacity = counters->clients_lookup_MAX;
+		clients_lookup = enlarge_shmem_struct(CLIENTS_LOOKUP, lookup_capacity(plan[PLAN_CLIENTS]));
+		if(clients_lookup == NULL || !lookup_rehash(CLIENTS_LOOKUP, old_capacity))
+		{
+			log_crit("Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(LOOKUP_NEEDS_RESIZE(max(counters->domains_lookup_size, plan[PLAN_DOMAINS]), counters->domains_lookup_MAX))
+	{
+		// Have to reallocate shared memory
+		const unsigned int old_capacity = counters->domains_lookup_MAX;
+		domains_lookup = enlarge_shmem_struct(DOMAINS_LOOKUP, lookup_capacity(plan[PLAN_DOMAINS]));
+		if(domains_lookup == NULL || !lookup_rehash(DOMAINS_LOOKUP, old_capacity))
+		{
+			log_crit("Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(LOOKUP_NEEDS_RESIZE(max(counters->dns_cache_lookup_size, plan[PLAN_DNS_CACHE]), counters->dns_cache_lookup_MAX))
+	{
+		// Have to reallocate shared memory
+		const unsigned int old_capacity = counters->dns_cache_lookup_MAX;
+		dns_cache_lookup = enlarge_shmem_struct(DNS_CACHE_LOOKUP, lookup_capacity(plan[PLAN_DNS_CACHE]));
+		if(dns_cache_lookup == NULL || !lookup_rehash(DNS_CACHE_LOOKUP, old_capacity))
+		{
+			log_crit("Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(LOOKUP_NEEDS_RESIZE(counters->strings_lookup_size, counters->strings_lookup_MAX))
 	{
 		// Have to reallocate shared memory
-		if(enlarge_shmem_struct(STRINGS) == NULL)
+		const unsigned int old_capacity = counters->strings_lookup_MAX;
+		strings_lookup = enlarge_shmem_struct(STRINGS_LOOKUP, 0);
+		if(strings_lookup == NULL || !lookup_rehash(STRINGS_LOOKUP, old_capacity))
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
 	}
-	if(counters->clients_lookup_size >= counters->clients_lookup_MAX-1)
+	if(LOOKUP_NEEDS_RESIZE(counters->upstreams_lookup_size, counters->upstreams_lookup_MAX))
 	{
 		// Have to reallocate shared memory
-		clients_lookup = enlarge_shmem_struct(CLIENTS_LOOKUP);
-		if(clients_lookup == NULL)
+		const unsigned int old_capacity = counters->upstreams_lookup_MAX;
+		upstreams_lookup = enlarge_shmem_struct(UPSTREAMS_LOOKUP, 0);
+		if(upstreams_lookup == NULL || !lookup_rehash(UPSTREAMS_LOOKUP, old_capacity))
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
 	}
-	if(counters->domains_lookup_size >= counters->domains_lookup_MAX-1)
+	// A new domain may add one suffix node per label
+	if(counters->suffixes + DOMAIN_LABELS_MAX >= counters->suffixes_MAX)
 	{
 		// Have to reallocate shared memory
-		domains_lookup = enlarge_shmem_struct(DOMAINS_LOOKUP);
-		if(domains_lookup == NULL)
+		domain_suffixes = enlarge_shmem_struct(SUFFIXES, 0);
+		if(domain_suffixes == NULL)
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
 		}
 	}
-	if(counters->dns_cache_lookup_size >= counters->dns_cache_lookup_MAX-1)
+	if(LOOKUP_NEEDS_RESIZE(counters->suffixes_lookup_size + DOMAIN_LABELS_MAX, counters->suffixes_lookup_MAX))
 	{
 		// Have to reallocate shared memory
-		dns_cache_lookup = enlarge_shmem_struct(DNS_CACHE_LOOKUP);
-		if(dns_cache_lookup == NULL)
+		const unsigned int old_capacity = counters->suffixes_lookup_MAX;
+		suffixes_lookup = enlarge_shmem_struct(SUFFIXES_LOOKUP, 0);
+		if(suffixes_lookup == NULL || !lookup_rehash(SUFFIXES_LOOKUP, old_capacity))
 		{
 			log_crit("Memory allocation failed! Exiting");
 			exit(EXIT_FAILURE);
@@ -1065,6 +2675,32 @@ void shm_ensure_size(void)
 	}
 }
 
+void shm_ensure_size(void)
+{
+	static const unsigned int no_plan[PLAN_ITEMS] = { 0 };
+	ensure_size(no_plan);
+}
+
+// Grow the shared memory objects to the planned number of objects at once
+// rather than in many steps while they are filled (see
+// database/capacity-plan.c). The SHM lock has to be held
+void preallocate_shmem(const unsigned int plan[PLAN_ITEMS])
+{
+	memcpy(projected, plan, sizeof(projected));
+	ensure_size(plan);
+}
+
+// Get the number of objects currently stored (strings in bytes). The SHM lock
+// has to be held
+void get_shmem_usage(unsigned int usage[PLAN_ITEMS])
+{
+	usage[PLAN_QUERIES] = counters->queries;
+	usage[PLAN_DOMAINS] = counters->domains;
+	usage[PLAN_CLIENTS] = counters->clients;
+	usage[PLAN_DNS_CACHE] = counters->dns_cache_size;
+	usage[PLAN_STRINGS] = shmSettings->next_str_pos;
+}
+
 void reset_per_client_regex(const unsigned int clientID)
 {
 	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
@@ -1102,6 +2738,60 @@ bool get_per_client_regex(const unsigned int clientID, const unsigned int regexI
 	return ((bool*) shm_per_client_regex.ptr)[id];
 }
 
+// Get the columnar mirror of the queries (or NULL if it is disabled)
+const struct query_columns *get_query_columns(void)
+{
+	return query_columns.status != NULL ? &query_columns : NULL;
+}
+
+// Copy the mirrored fields of a query into the columns. This has to be called
+// whenever one of the mirrored fields has been changed
+void update_query_columns(const queriesData *query)
+{
+	if(query_columns.status == NULL)
+		return;
+
+	// Skip queries that are not part of the shared memory queries struct
+	// (e.g., temporary objects used by the API)
+	const uintptr_t pos = (uintptr_t)query;
+	const uintptr_t first = (uintptr_t)queries;
+	if(pos < first || (pos - first) / sizeof(queriesData) >= counters->query_columns_MAX)
+		return;
+
+	const size_t slot = (pos - first) / sizeof(queriesData);
+	query_columns.timestamp[slot] = query->timestamp;
+	query_columns.id[slot] = query->id;
+	query_columns.clientID[slot] = query->clientID;
+	query_columns.domainID[slot] = query->domainID;
+	query_columns.status[slot] = query->status;
+}
+
+// Copy the mirrored fields of all queries into the columns
+void rebuild_query_columns(void)
+{
+	if(query_columns.status == NULL)
+		return;
+
+	for(unsigned int queryID = 0; queryID < counters->queries; queryID++)
+		update_query_columns(&queries[ring_slot(queryID)]);
+}
+
+// Get the enabled states of num consecutive regex of a client (or NULL if they
+// are out of bounds)
+const bool *get_per_client_regex_array(const unsigned int clientID, const unsigned int regexID, const unsigned int num)
+{
+	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
+	const size_t id = (size_t)clientID * num_regex_tot + regexID;
+	const size_t maxval = shm_per_client_regex.size / sizeof(bool);
+	if(id + num > maxval)
+	{
+		log_err("get_per_client_regex_array(%u, %u, %u): Out of bounds (%zu > %zu)!",
+		        clientID, regexID, num, id + num, maxval);
+		return NULL;
+	}
+	return &((const bool*) shm_per_client_regex.ptr)[id];
+}
+
 void set_per_client_regex(const unsigned int clientID, const unsigned int regexID, const bool value)
 {
 	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
@@ -1154,7 +2844,7 @@ static inline bool check_magic(const unsigned int ID, const bool checkMagic, con
 queriesData *_getQuery(const unsigned int queryID, const bool checkMagic, const int line, const char *func, const char *file)
 {
 	// We are not in a locked situation, return a NULL pointer
-	if(config.debug.locks.v.b && !is_our_lock())
+	if(config.debug.locks.v.b && !may_read_shm())
 	{
 		if(debug_flags[DEBUG_ANY])
 		{
@@ -1169,14 +2859,17 @@ queriesData *_getQuery(const unsigned int queryID, const bool checkMagic, const
 	if(!check_range(queryID, counters->queries_MAX, "query", func, line, file))
 		return NULL;
 
+	// Translate the query ID into its position in the ring
+	const unsigned int slot = ring_slot(queryID);
+
 	// May have been recycled, do not return recycled queries if we are checking
 	// the magic byte
-	if(checkMagic && queries[queryID].magic == 0x00)
+	if(checkMagic && queries[slot].magic == 0x00)
 		return NULL;
 
 	// Check magic byte
-	if(check_magic(queryID, checkMagic, queries[queryID].magic, "query", func, line, file))
-		return &queries[queryID];
+	if(check_magic(queryID, checkMagic, queries[slot].magic, "query", func, line, file))
+		return &queries[slot];
 
 	return NULL;
 }
@@ -1184,7 +2877,7 @@ queriesData *_getQuery(const unsigned int queryID, const bool checkMagic, const
 clientsData *_getClient(const unsigned int clientID, const bool checkMagic, const int line, const char *func, const char *file)
 {
 	// We are not in a locked situation, return a NULL pointer
-	if(config.debug.locks.v.b && !is_our_lock())
+	if(config.debug.locks.v.b && !may_read_shm())
 	{
 		if(debug_flags[DEBUG_ANY])
 		{
@@ -1214,7 +2907,7 @@ clientsData *_getClient(const unsigned int clientID, const bool checkMagic, cons
 domainsData *_getDomain(const unsigned int domainID, const bool checkMagic, const int line, const char *func, const char *file)
 {
 	// We are not in a locked situation, return a NULL pointer
-	if(config.debug.locks.v.b && !is_our_lock())
+	if(config.debug.locks.v.b && !may_read_shm())
 	{
 		if(debug_flags[DEBUG_ANY])
 		{
@@ -1244,7 +2937,7 @@ domainsData *_getDomain(const unsigned int domainID, const bool checkMagic, cons
 upstreamsData *_getUpstream(const unsigned int upstreamID, const bool checkMagic, const int line, const char *func, const char *file)
 {
 	// We are not in a locked situation, return a NULL pointer
-	if(config.debug.locks.v.b && !is_our_lock())
+	if(config.debug.locks.v.b && !may_read_shm())
 	{
 		if(debug_flags[DEBUG_ANY])
 		{
@@ -1274,7 +2967,7 @@ upstreamsData *_getUpstream(const unsigned int upstreamID, const bool checkMagic
 DNSCacheData *_getDNSCache(const unsigned int cacheID, const bool checkMagic, const int line, const char *func, const char *file)
 {
 	// We are not in a locked situation, return a NULL pointer
-	if(config.debug.locks.v.b && !is_our_lock())
+	if(config.debug.locks.v.b && !may_read_shm())
 	{
 		if(debug_flags[DEBUG_ANY])
 		{
@@ -1353,6 +3046,238 @@ double __attribute__((pure)) get_qps(void)
 	return qps / QPS_AVGLEN;
 }
 
+// Increment the gravity generation counter. This is done in shared memory so
+// TCP workers forked before the lists have been reloaded can detect that their
+// inherited copies of the lookup structures are outdated.
+unsigned int bump_gravity_generation(void)
+{
+	if(shmSettings == NULL)
+		return 0u;
+
+	return ++shmSettings->gravity_generation;
+}
+
+// Get the current gravity generation counter
+unsigned int __attribute__((pure)) get_gravity_generation(void)
+{
+	// There is no shared memory when running, e.g., pihole-FTL --config
+	if(shmSettings == NULL)
+		return 0u;
+
+	return shmSettings->gravity_generation;
+}
+
+// Get the current data generation counter. It is increased whenever the
+// exclusive SHM lock is released so everything derived from the shared memory
+// objects (e.g., cached API responses) can be detected as outdated
+unsigned int __attribute__((pure)) get_data_generation(void)
+{
+	// There is no shared memory when running, e.g., pihole-FTL --config
+	if(shmSettings == NULL)
+		return 0u;
+
+	return shmSettings->data_generation;
+}
+
+// Increment the client generation counter. This is done whenever the counts of
+// clients changed without a matching change of the overTime totals, e.g., when
+// clients joined or left alias-clients
+void bump_client_generation(void)
+{
+	if(shmSettings == NULL)
+		return;
+
+	shmSettings->client_generation++;
+}
+
+// Get the current client generation counter
+unsigned int __attribute__((pure)) get_client_generation(void)
+{
+	// There is no shared memory when running, e.g., pihole-FTL --config
+	if(shmSettings == NULL)
+		return 0u;
+
+	return shmSettings->client_generation;
+}
+
+// Increment the exclusion filter generation counter. This is done whenever the
+// patterns of webserver.api.excludeDomains or webserver.api.excludeClients have
+// been stored again so workers forked before the change recompile them
+unsigned int bump_exclude_generation(void)
+{
+	if(shmSettings == NULL)
+		return 0u;
+
+	return ++shmSettings->exclude_generation;
+}
+
+// Get the current exclusion filter generation counter
+unsigned int __attribute__((pure)) get_exclude_generation(void)
+{
+	// There is no shared memory when running, e.g., pihole-FTL --config
+	if(shmSettings == NULL)
+		return 0u;
+
+	return shmSettings->exclude_generation;
+}
+
+// Get the positions of the shared strings holding the patterns of the domain
+// or client exclusion filter
+size_t * __attribute__((pure)) get_exclude_patterns(const bool client)
+{
+	if(shmSettings == NULL)
+		return NULL;
+
+	return client ? shmSettings->exclude_clients : shmSettings->exclude_domains;
+}
+
+// Get the number of replies currently waiting for DNSKEY/DS records needed
+// for their validation in all processes
+int get_dnssec_queued(void)
+{
+	if(counters == NULL)
+		return 0;
+
+	int queued = 0;
+	for(unsigned int i = 0; i < DNSSEC_QUEUE_SLOTS; i++)
+		queued += __atomic_load_n(&counters->dnssec.queued[i], __ATOMIC_RELAXED);
+
+	return queued;
+}
+
+// Get the current string generation counter. It is increased whenever
+// compact_strings() moved the strings so cached string positions (e.g. in
+// process-local caches or across an unlock) can be detected as outdated
+unsigned int __attribute__((pure)) get_string_generation(void)
+{
+	// There is no shared memory when running, e.g., pihole-FTL --config
+	if(shmSettings == NULL)
+		return 0u;
+
+	return shmSettings->string_generation;
+}
+
+// Store a string of the old buffer again and return its new position
+static size_t move_string(const char *old, const size_t old_size, const size_t pos)
+{
+	if(pos == 0 || pos >= old_size)
+		return 0;
+
+	return addstr(&old[pos]);
+}
+
+// Rewrite the strings buffer so it contains only strings that are still
+// referenced by domains, clients, upstreams, shared DNS cache records and the
+// API exclusion filters.
+// Strings of recycled objects and outdated host names are dropped, so are the
+// suffix nodes of recycled domains. Unless forced, this is only done when the
+// buffer or the suffix nodes have at least doubled since the previous
+// compaction. Has to be called with the SHM lock held
+bool compact_strings(const bool force)
+{
+	const size_t old_size = shmSettings->next_str_pos;
+	const unsigned int old_suffixes = counters->suffixes;
+	if(!force && old_size < 2*MAX(shmSettings->compacted_str_pos, (size_t)STRINGS_ALLOC_STEP) &&
+	   old_suffixes < 2*MAX(counters->compacted_suffixes, DOMAIN_LABELS_MAX))
+		return false;
+
+	char *old = malloc(old_size);
+	struct suffix_node *old_nodes = calloc(old_suffixes, sizeof(*old_nodes));
+	if(old == NULL || old_nodes == NULL)
+	{
+		log_err("Failed to allocate memory for compacting the strings buffer");
+		if(old != NULL)
+			free(old);
+		if(old_nodes != NULL)
+			free(old_nodes);
+		return false;
+	}
+	memcpy(old, shm_strings.ptr, old_size);
+	memcpy(old_nodes, domain_suffixes, old_suffixes*sizeof(*old_nodes));
+
+	// Start over with an empty buffer, tree of suffixes, and index
+	shmSettings->next_str_pos = 1;
+	lookup_init(STRINGS_LOOKUP);
+	reset_domain_suffixes();
+
+	for(unsigned int domainID = 0; domainID < counters->domains; domainID++)
+	{
+		domainsData *domain = getDomain(domainID, true);
+		if(domain == NULL)
+			continue;
+
+		if(domain->suffix == SUFFIX_ROOT)
+		{
+			domain->domainpos = move_string(old, old_size, domain->domainpos);
+			continue;
+		}
+
+		// Add the labels of the domain again. There is space for all
+		// of them as there cannot be more nodes than before
+		char name[DOMAIN_NAME_MAX];
+		domain_suffix_name(old_nodes, old_suffixes, old, old_size, domain->suffix, name);
+		if((domain->suffix = add_domain_suffixes(name)) == SUFFIX_ROOT)
+			domain->domainpos = addstr(name);
+	}
+	free(old_nodes);
+
+	for(unsigned int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		clientsData *client = getClient(clientID, true);
+		if(client == NULL)
+			continue;
+
+		client->ippos = move_string(old, old_size, client->ippos);
+		client->namepos = move_string(old, old_size, client->namepos);
+		client->groupspos = move_string(old, old_size, client->groupspos);
+		client->ifacepos = move_string(old, old_size, client->ifacepos);
+	}
+
+	for(unsigned int upstreamID = 0; upstreamID < counters->upstreams; upstreamID++)
+	{
+		upstreamsData *upstream = getUpstream(upstreamID, true);
+		if(upstream == NULL)
+			continue;
+
+		upstream->ippos = move_string(old, old_size, upstream->ippos);
+		upstream->namepos = move_string(old, old_size, upstream->namepos);
+	}
+
+	for(unsigned int i = 0; i < EXCLUDE_FILTER_CHUNKS; i++)
+	{
+		shmSettings->exclude_domains[i] = move_string(old, old_size, shmSettings->exclude_domains[i]);
+		shmSettings->exclude_clients[i] = move_string(old, old_size, shmSettings->exclude_clients[i]);
+	}
+
+	// Clients with identical groups share DNS cache records keyed by the
+	// position of their groups string (see cache_client_key())
+	for(unsigned int cacheID = 0; cacheID < counters->dns_cache_size; cacheID++)
+	{
+		DNSCacheData *cache = getDNSCache(cacheID, true);
+		if(cache == NULL || !(cache->clientID & CACHE_SHARED_KEY))
+			continue;
+
+		const size_t newpos = move_string(old, old_size, cache->clientID & ~CACHE_SHARED_KEY);
+		const unsigned int key = CACHE_SHARED_KEY | (unsigned int)newpos;
+		if(key != cache->clientID)
+			rekey_dns_cache(cache, cacheID, key);
+	}
+
+	// Clear the now unused part of the buffer
+	const size_t new_size = shmSettings->next_str_pos;
+	memset(&((char*)shm_strings.ptr)[new_size], 0, old_size - new_size);
+	free(old);
+
+	shmSettings->compacted_str_pos = new_size;
+	counters->compacted_suffixes = counters->suffixes;
+	shmSettings->string_generation++;
+
+	log_debug(DEBUG_SHMEM, "Compacted strings buffer from %zu to %zu bytes (%u strings), suffix nodes from %u to %u",
+	          old_size, new_size, counters->strings_lookup_size, old_suffixes, counters->suffixes);
+
+	return true;
+}
+
 /**
  * @brief Retrieves the recycle table based on the specified memory type.
  *
@@ -17,21 +17,69 @@
 
 // TYPE_MAX
 #include "datastructure.h"
+// struct api_histogram
+#include "api/endpoint_stats.h"
+// struct dot_peer
+#include "dns-over-tls.h"
+
+// Processes validating DNSSEC asynchronously: the main process and up to 64 UDP
+// workers (see FTL_udp_workers())
+#define DNSSEC_QUEUE_SLOTS 65u
+
+// Shards of the query counters: the main process, up to 64 UDP workers, up to
+// 64 TCP pool workers and one shared by the TCP workers forked per connection
+// (see set_counter_shard())
+#define COUNTER_SHARDS 130u
+#define COUNTER_SHARD_UDP 1u
+#define COUNTER_SHARD_TCP_POOL 65u
+#define COUNTER_SHARD_TCP 129u
+
+// Query counters of one shard. Every process adds to its own shard with relaxed
+// atomics (so without the SHM lock) and readers sum up all shards. Other
+// processes may subtract what a shard added (e.g. the GC), the unsigned sums
+// are nevertheless correct as they wrap around. Shards are kept in separate
+// cache lines so processes counting queries at the same time do not contend
+struct counter_shard {
+	unsigned int blocked;
+	unsigned int forwarded;
+	unsigned int cached;
+	unsigned int querytype[TYPE_MAX];
+	unsigned int status[QUERY_STATUS_MAX];
+	unsigned int reply[QUERY_REPLY_MAX];
+} __attribute__ ((aligned (64)));
 
 typedef struct {
 	char *name;
 	size_t size;
+	// Length of the mapping, may exceed size if address space has been
+	// reserved for in-place growth (see misc.shmReserve)
+	size_t mapped;
 	void *ptr;
 	int fd;
 	struct flock lock;
+	// Resizes done by and mremap() calls needed in this process
+	unsigned int resizes;
+	unsigned int remaps;
 } SharedMemory;
 
+// Number of shared strings holding the patterns of one API exclusion filter
+// (see exclude-filter.c)
+#define EXCLUDE_FILTER_CHUNKS 8u
+
 typedef struct {
 	int version;
 	pid_t pid;
 	unsigned int global_shm_counter;
 	size_t next_str_pos;
 	unsigned int qps[QPS_AVGLEN];
+	unsigned int gravity_generation;
+	unsigned int string_generation;
+	size_t compacted_str_pos;
+	unsigned int data_generation;
+	unsigned int client_generation;
+	unsigned int exclude_generation;
+	size_t exclude_domains[EXCLUDE_FILTER_CHUNKS];
+	size_t exclude_clients[EXCLUDE_FILTER_CHUNKS];
 } ShmSettings;
 
 typedef struct {
@@ -40,6 +88,7 @@ typedef struct {
 	unsigned int clients;
 	unsigned int domains;
 	unsigned int queries_MAX;
+	unsigned int queries_oldest;
 	unsigned int upstreams_MAX;
 	unsigned int clients_MAX;
 	unsigned int domains_MAX;
@@ -58,7 +107,29 @@ typedef struct {
 	unsigned int domains_lookup_size;
 	unsigned int dns_cache_lookup_MAX;
 	unsigned int dns_cache_lookup_size;
+	unsigned int strings_lookup_MAX;
+	unsigned int strings_lookup_size;
 	unsigned int regex_change;
+	unsigned int client_regex_generation;
+	unsigned int query_columns_MAX;
+	unsigned int query_ids_MAX;
+	unsigned int query_ids;
+	// Records of the cold tier (ring) and the number of queries they count
+	unsigned int cold_records_MAX;
+	unsigned int cold_records;
+	unsigned int cold_records_oldest;
+	unsigned int queries_cold;
+	unsigned int suffixes;
+	unsigned int suffixes_MAX;
+	unsigned int suffixes_lookup_MAX;
+	unsigned int suffixes_lookup_size;
+	unsigned int upstreams_lookup_MAX;
+	unsigned int upstreams_lookup_size;
+	unsigned int compacted_suffixes;
+	struct {
+		time_t timestamp;
+		int64_t db;
+	} query_base;
 	struct {
 		int gravity;
 		int clients;
@@ -75,9 +146,51 @@ typedef struct {
 			} denied;
 		} domains;
 	} database;
-	unsigned int querytype[TYPE_MAX];
-	unsigned int status[QUERY_STATUS_MAX];
-	unsigned int reply[QUERY_REPLY_MAX];
+	// Rows in the message table, updated by every process writing to it
+	struct {
+		int total;
+		int dnsmasq_warn;
+	} messages;
+	struct {
+		unsigned int issued;
+		unsigned int hits;
+		unsigned int misses;
+	} prefetch;
+	struct {
+		unsigned int hits;
+		unsigned int misses;
+	} cname_verdicts;
+	struct {
+		// Queries which waited for the reply to an identical query already
+		// in flight instead of being forwarded themselves
+		unsigned int saved;
+		// Waiting queries which have been answered with that reply
+		unsigned int answered;
+	} coalesced;
+	// Queries answered from the cache by the remaining TTL of the records
+	unsigned int cache_hit_ttl[CACHE_HIT_TTL_MAX];
+	struct {
+		uint64_t validations;
+		uint64_t usec;
+		unsigned int verified;
+		unsigned int memo_hits;
+		// Replies waiting for DNSKEY/DS records, one slot per process
+		int queued[DNSSEC_QUEUE_SLOTS];
+	} dnssec;
+	struct {
+		uint64_t recv_calls;
+		uint64_t received;
+		uint64_t send_calls;
+		uint64_t sent;
+	} udp;
+	// Sum over the clients, updated together with them so readers can get
+	// it without locking or iterating
+	unsigned int active_clients;
+	// Query counters by status, type and reply, see struct counter_shard
+	struct counter_shard shards[COUNTER_SHARDS];
+	// Clients of the DNS-over-TLS connections by the port their queries are
+	// relayed from
+	struct dot_peer dot_peers[DOT_MAX_CONNS];
 } countersStruct;
 
 extern countersStruct *counters;
@@ -139,6 +252,9 @@ struct recycler_tables {
 extern struct lookup_table *clients_lookup;
 extern struct lookup_table *domains_lookup;
 extern struct lookup_table *dns_cache_lookup;
+extern struct lookup_table *strings_lookup;
+extern struct lookup_table *suffixes_lookup;
+extern struct lookup_table *upstreams_lookup;
 #endif
 
 /// Block until a lock can be obtained
@@ -147,6 +263,8 @@ void _lock_shm(const char* func, const int line, const char* file);
 
 // Return if the current mutex locked the SHM lock
 bool is_our_lock(void);
+// Return if this thread holds the shared SHM lock
+bool holds_shm_read_lock(void) __attribute__((pure));
 
 // This ensures we have enough space available for more objects
 // The function should only be called from within _lock() and when reading
@@ -157,10 +275,51 @@ void shm_ensure_size(void);
 #define unlock_shm() _unlock_shm(__FUNCTION__, __LINE__, __FILE__)
 void _unlock_shm(const char* func, const int line, const char* file);
 
+/// Block until a shared lock can be obtained. Use this for read-only access
+/// only, any number of readers may hold the lock concurrently
+#define lock_shm_read() _lock_shm_read(__FUNCTION__, __LINE__, __FILE__)
+void _lock_shm_read(const char* func, const int line, const char* file);
+
+/// Release the shared lock
+#define unlock_shm_read() _unlock_shm_read(__FUNCTION__, __LINE__, __FILE__)
+void _unlock_shm_read(const char* func, const int line, const char* file);
+
+// Lock wait statistics (times in nanoseconds)
+struct shm_lock_stats {
+	uint64_t count;
+	uint64_t wait;
+	uint64_t max;
+	uint64_t readers; // Part of wait spent waiting for shared lock holders
+};
+void get_shm_lock_stats(struct shm_lock_stats stats[SHM_LOCK_PATHS]);
+
+// Lock contention profile of one call site of lock_shm() or lock_shm_read()
+// (times in nanoseconds, histograms of times in microseconds). The wait ends
+// when the lock has been obtained, the hold time ends when it is released
+#define SHM_LOCK_SITES 128u
+struct shm_lock_site {
+	const char *func;
+	const char *file;
+	int line;
+	bool shared;
+	uint64_t count;
+	uint64_t wait;
+	uint64_t hold;
+	uint64_t max_wait;
+	uint64_t max_hold;
+	struct api_histogram wait_hist;
+	struct api_histogram hold_hist;
+};
+unsigned int get_shm_lock_sites(struct shm_lock_site sites[SHM_LOCK_SITES], uint64_t *dropped);
+void reset_shm_lock_sites(void);
+uint64_t get_thread_lock_time(void) __attribute__((pure));
+
 /// Block until a lock can be obtained
 
 bool init_shmem(void);
 void destroy_shmem(void);
+bool save_shmem_snapshot(const char *path, const int64_t dbid);
+bool load_shmem_snapshot(const char *path, const int64_t dbid);
 #define addstr(str) _addstr(str, __FUNCTION__, __LINE__, __FILE__)
 size_t _addstr(const char *str, const char *func, const int line, const char *file);
 #define getstr(pos) _getstr(pos, __FUNCTION__, __LINE__, __FILE__)
@@ -181,15 +340,83 @@ void addOverTimeClientSlot(void);
 // Change ownership of shared memory objects
 void chown_all_shmem(struct passwd *ent_pw);
 
+// Objects the shared memory is preallocated for according to the usage
+// observed over the last day (see database/capacity-plan.c)
+enum shm_plan_item {
+	PLAN_QUERIES,
+	PLAN_DOMAINS,
+	PLAN_CLIENTS,
+	PLAN_DNS_CACHE,
+	PLAN_STRINGS, // bytes
+	PLAN_ITEMS
+};
+void preallocate_shmem(const unsigned int plan[PLAN_ITEMS]);
+void get_shmem_usage(unsigned int usage[PLAN_ITEMS]);
+
 // Get details about shared memory used by FTL
 void log_shmem_details(void);
+SharedMemory *const *get_shmem_details(unsigned int *num, unsigned int *remaps, size_t *used);
 
 // Per-client regex buffer storing whether or not a specific regex is enabled for a particular client
 void add_per_client_regex(unsigned int clientID);
 void reset_per_client_regex(const unsigned int clientID);
 bool get_per_client_regex(const unsigned int clientID, const unsigned int regexID);
+const bool *get_per_client_regex_array(const unsigned int clientID, const unsigned int regexID, const unsigned int num);
 void set_per_client_regex(const unsigned int clientID, const unsigned int regexID, const bool value);
 
+// Queries are kept in a ring buffer. Query IDs count from the oldest query in
+// memory, this returns the position of a query in the ring (and in the
+// columns below)
+unsigned int query_slot(const unsigned int queryID) __attribute__((pure));
+void expire_queries(const unsigned int removed);
+
+// Map from the ID dnsmasq assigned to a query to its position in the ring
+// (open addressing with linear probing). Queries are added when they are
+// created and removed when they expire, all later events (replies, DNSSEC
+// results, retries, ...) can find their query in constant time
+struct query_id_slot {
+	int id;
+	// Position in the ring + 1, 0 = empty slot
+	unsigned int pos;
+};
+void add_query_id(const int id, const unsigned int queryID);
+int find_query_id(const int id) __attribute__((pure));
+
+// Positions (in the ring) of the queries changed since they have last been
+// stored in the database. Only queries not already flagged as changed are
+// added so each query appears at most once
+#define DIRTY_QUERIES_MAX 65536u
+struct dirty_queries {
+	unsigned int num;
+	bool overflow;
+	unsigned int slot[DIRTY_QUERIES_MAX];
+};
+void mark_query_changed(queriesData *query);
+bool get_dirty_queries(unsigned int *num);
+queriesData *get_dirty_query(const unsigned int i) __attribute__((pure));
+void reset_dirty_queries(void);
+
+// Optional columnar mirror of the most frequently scanned query fields
+// (misc.queryColumns). All columns are indexed by the position of the query in
+// the ring (see query_slot()) and hold the same (encoded) values as the
+// corresponding fields in queriesData
+struct query_columns {
+	uint32_t *timestamp;
+	int *id;
+	unsigned int *clientID;
+	unsigned int *domainID;
+	uint8_t *status;
+};
+const struct query_columns *get_query_columns(void) __attribute__((pure));
+void update_query_columns(const queriesData *query);
+void rebuild_query_columns(void);
+
+// Cold tier of queries older than misc.hotQueries seconds, records are indexed
+// from the oldest one like the queries. Has to be called with the SHM lock held
+struct cold_query *get_cold_record(const unsigned int recordID) __attribute__((pure));
+struct cold_query *add_cold_record(void);
+void expire_cold_records(const unsigned int removed);
+
 // Used in dnsmasq/utils.c
 int is_shm_fd(const int fd);
 
@@ -197,6 +424,18 @@ void update_qps(const time_t timestamp);
 void reset_qps(const time_t timestamp);
 double get_qps(void) __attribute__((pure));
 
+unsigned int bump_gravity_generation(void);
+unsigned int get_gravity_generation(void) __attribute__((pure));
+unsigned int get_string_generation(void) __attribute__((pure));
+unsigned int get_data_generation(void) __attribute__((pure));
+void bump_client_generation(void);
+unsigned int get_client_generation(void) __attribute__((pure));
+unsigned int bump_exclude_generation(void);
+unsigned int get_exclude_generation(void) __attribute__((pure));
+size_t *get_exclude_patterns(const bool client) __attribute__((pure));
+int get_dnssec_queued(void);
+bool compact_strings(const bool force);
+
 // Recycler table functions
 bool set_next_recycled_ID(const enum memory_type type, const unsigned int id);
 bool get_next_recycled_ID(const enum memory_type type, unsigned int *id);
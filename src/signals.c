@@ -25,6 +25,12 @@
 #include "timers.h"
 // struct config
 #include "config/config.h"
+// log_writer_crash()
+#include "log-writer.h"
+// eventfd()
+#include <sys/eventfd.h>
+// poll()
+#include <poll.h>
 
 #define BINARY_NAME "pihole-FTL"
 
@@ -34,6 +40,11 @@ static time_t FTLstarttime = 0;
 volatile int exit_code = EXIT_SUCCESS;
 
 volatile sig_atomic_t thread_cancellable[THREADS_MAX] = { false };
+
+// Threads sleep in thread_sleepms() until their eventfd is written to, i.e.,
+// there is work for them or FTL is terminating
+static int wakeup_fds[THREADS_MAX] = { 0 };
+static volatile sig_atomic_t wakeups_ready = false;
 const char * const thread_names[THREADS_MAX] = {
 	"database",
 	"housekeeper",
@@ -42,6 +53,8 @@ const char * const thread_names[THREADS_MAX] = {
 	"ntp-client",
 	"ntp-server4",
 	"ntp-server6",
+	"federation",
+	"dns-over-tls",
  };
 
 // Return the (null-terminated) name of the calling thread
@@ -155,6 +168,9 @@ static void terminate_error(void)
 static void __attribute__((noreturn)) signal_handler(int sig, siginfo_t *si, void *context)
 {
 	(void)context;
+	// Write queued log lines and log synchronously from here on so the
+	// crash report makes it into the log file
+	log_writer_crash();
 	log_info("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!");
 	log_info("---------------------------->  FTL crashed!  <----------------------------");
 	log_info("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!");
@@ -450,6 +466,7 @@ static void SIGTERM_handler(int signum, siginfo_t *si, void *context)
 	{
 		log_debug(DEBUG_ANY, "Embedded dnsmasq failed, exiting on request");
 		killed = true;
+		wake_all_threads();
 	}
 }
 
@@ -515,13 +532,53 @@ pid_t main_pid(void)
 		return getpid();
 }
 
+// Create the eventfds used to wake up threads, this has to be done before
+// any thread is started. Threads without eventfd fall back to plain sleeping
+void init_thread_wakeups(void)
+{
+	for(unsigned int i = 0; i < THREADS_MAX; i++)
+		if((wakeup_fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+			log_warn("Cannot create eventfd for %s thread: %s", thread_names[i], strerror(errno));
+
+	wakeups_ready = true;
+}
+
+// Wake up a thread sleeping in thread_sleepms(). A thread not sleeping right
+// now returns from its next sleep immediately. This is async-signal-safe
+void wake_thread(const enum thread_types thread)
+{
+	if(!wakeups_ready || wakeup_fds[thread] < 0)
+		return;
+
+	const uint64_t one = 1;
+	const ssize_t ret = write(wakeup_fds[thread], &one, sizeof(one));
+	(void)ret;
+}
+
+void wake_all_threads(void)
+{
+	for(unsigned int i = 0; i < THREADS_MAX; i++)
+		wake_thread(i);
+}
+
+// Sleep for the given time or until the thread is woken up by wake_thread()
 void thread_sleepms(const enum thread_types thread, const int milliseconds)
 {
 	if(killed)
 		return;
 
 	thread_cancellable[thread] = true;
-	sleepms(milliseconds);
+	const int fd = wakeups_ready ? wakeup_fds[thread] : -1;
+	if(fd < 0)
+		sleepms(milliseconds);
+	else
+	{
+		struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+		uint64_t count = 0;
+		if(poll(&pfd, 1, milliseconds) > 0 && read(fd, &count, sizeof(count)) < 0)
+			log_debug(DEBUG_EXTRA, "Cannot read eventfd of %s thread: %s",
+			          thread_names[thread], strerror(errno));
+	}
 	thread_cancellable[thread] = false;
 }
 
@@ -565,6 +622,50 @@ void restart_ftl(const char *reason)
 	kill(main_pid(), SIGTERM);
 }
 
+// Restart requested by schedule_restart_ftl()
+static struct {
+	const char *reason;
+	double first;
+	double last;
+} deferred_restart = { NULL, 0.0, 0.0 };
+static pthread_mutex_t deferred_restart_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Restart FTL once changes requiring a restart have settled. A script
+ * changing several such settings one by one causes a single restart instead
+ * of one per request. The restart is performed by check_scheduled_restart().
+ */
+void schedule_restart_ftl(const char *reason)
+{
+	const double now = double_time();
+	pthread_mutex_lock(&deferred_restart_lock);
+	if(deferred_restart.reason == NULL)
+		deferred_restart.first = now;
+	deferred_restart.reason = reason;
+	deferred_restart.last = now;
+	pthread_mutex_unlock(&deferred_restart_lock);
+	log_info("FTL will restart shortly: %s", reason);
+}
+
+// Called periodically by the GC thread
+void check_scheduled_restart(void)
+{
+	const double now = double_time();
+	const char *reason = NULL;
+	pthread_mutex_lock(&deferred_restart_lock);
+	if(deferred_restart.reason != NULL &&
+	   (now - deferred_restart.last >= CHANGE_QUIET_PERIOD ||
+	    now - deferred_restart.first >= CHANGE_MAX_DELAY))
+	{
+		reason = deferred_restart.reason;
+		deferred_restart.reason = NULL;
+	}
+	pthread_mutex_unlock(&deferred_restart_lock);
+
+	if(reason != NULL)
+		restart_ftl(reason);
+}
+
 /**
  * @brief Checks if the current process is being debugged.
  *
@@ -21,10 +21,15 @@
 void handle_signals(void);
 void handle_realtime_signals(void);
 pid_t main_pid(void);
+void init_thread_wakeups(void);
+void wake_thread(const enum thread_types thread);
+void wake_all_threads(void);
 void thread_sleepms(const enum thread_types thread, const int milliseconds);
 void generate_backtrace(void);
 int sigtest(void);
 void restart_ftl(const char *reason);
+void schedule_restart_ftl(const char *reason);
+void check_scheduled_restart(void);
 pid_t debugger(void);
 
 extern volatile int exit_code;
@@ -0,0 +1,246 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Special domain table
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+ * @file special-domains.c
+ * @brief Classify the domains Pi-hole answers itself with a single hash probe
+ *
+ * All domains which need special treatment (pi.hole, the hostname, the Mozilla
+ * canary domain, ...) are known once the configuration has been read. They are
+ * stored in a small open-addressing table whose hash seed is chosen such that
+ * no two entries collide. Looking up a domain is hence a single hash
+ * computation followed by at most one string comparison instead of checking
+ * the domain against every special domain in turn.
+ *
+ * The table is rebuilt on the next lookup after the configuration changed or
+ * when dnsmasq's local domain suffix is different from the one the table has
+ * been built for.
+ */
+
+#include "FTL.h"
+#include "special-domains.h"
+// config
+#include "config/config.h"
+// hostname()
+#include "daemon.h"
+// log_debug()
+#include "log.h"
+// tolower()
+#include <ctype.h>
+
+// Upper limit for the number of entries in the table
+#define SPECIAL_DOMAINS_MAX 8u
+// Size of the largest table we try before giving up on finding a perfect seed
+#define SPECIAL_SLOTS_MAX 256u
+// Number of seeds tried for each table size
+#define SPECIAL_SEEDS 64u
+
+// Zone handled by SPECIAL_DESIGNATED_RESOLVER, the zone's apex itself is not
+// included
+#define RESOLVER_ZONE "resolver.arpa"
+
+struct special_slot {
+	const char *name;
+	enum special_domain_type type;
+	bool suffix;
+};
+
+static struct {
+	bool valid;
+	const char *local_suffix;
+	uint32_t seed;
+	unsigned int mask;
+	// Length of the suffix entries (0 = none)
+	size_t suffix_len;
+	unsigned int num;
+	unsigned int allocated;
+	char *names[SPECIAL_DOMAINS_MAX];
+	struct special_slot entries[SPECIAL_DOMAINS_MAX];
+	struct special_slot *slots;
+} table = { 0 };
+
+// Case-insensitive FNV-1a hash of the first len characters of s
+static uint32_t __attribute__((pure)) special_hash(const char *s, const size_t len, const uint32_t seed)
+{
+	uint32_t hash = 2166136261u ^ seed;
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)tolower((unsigned char)s[i]);
+		hash *= 16777619u;
+	}
+	return hash ^ (hash >> 16);
+}
+
+static void add_special(const char *name, const enum special_domain_type type, const bool suffix)
+{
+	if(table.num >= SPECIAL_DOMAINS_MAX)
+		return;
+
+	// The first entry of a domain wins, this preserves the order in which
+	// the individual checks used to be done
+	for(unsigned int i = 0; i < table.num; i++)
+		if(strcasecmp(table.entries[i].name, name) == 0 &&
+		   table.entries[i].suffix == suffix)
+			return;
+
+	table.entries[table.num].name = name;
+	table.entries[table.num].type = type;
+	table.entries[table.num].suffix = suffix;
+	table.num++;
+}
+
+static void add_special_concat(const char *first, const char *second,
+                               const enum special_domain_type type)
+{
+	if(table.allocated >= SPECIAL_DOMAINS_MAX)
+		return;
+
+	// Build "<first>.<second>"
+	const size_t len = strlen(first) + strlen(second) + 2;
+	char *name = calloc(len, sizeof(char));
+	if(name == NULL)
+		return;
+	snprintf(name, len, "%s.%s", first, second);
+
+	// Remember the string so we can free it on the next rebuild
+	table.names[table.allocated++] = name;
+	add_special(name, type, false);
+}
+
+// Try to place all entries into a table of the given size without collisions
+static bool place_entries(struct special_slot *slots, const unsigned int size, const uint32_t seed)
+{
+	memset(slots, 0, size * sizeof(*slots));
+	for(unsigned int i = 0; i < table.num; i++)
+	{
+		const struct special_slot *entry = &table.entries[i];
+		const uint32_t hash = special_hash(entry->name, strlen(entry->name), seed);
+		struct special_slot *slot = &slots[hash & (size - 1)];
+		if(slot->name != NULL)
+			return false;
+		*slot = *entry;
+	}
+	return true;
+}
+
+static void rebuild_special_domains(const char *local_suffix)
+{
+	// Free names built for the previous table
+	for(unsigned int i = 0; i < table.allocated; i++)
+		free(table.names[i]);
+	table.allocated = 0;
+	if(table.slots != NULL)
+		free(table.slots);
+	table.slots = NULL;
+	table.num = 0;
+	table.suffix_len = 0;
+
+	// Collect domains
+	add_special("pi.hole", SPECIAL_PIHOLE, false);
+	add_special(hostname(), SPECIAL_PIHOLE, false);
+	if(local_suffix != NULL)
+	{
+		add_special_concat("pi.hole", local_suffix, SPECIAL_PIHOLE);
+		add_special_concat(hostname(), local_suffix, SPECIAL_PIHOLE);
+	}
+	if(config.dns.specialDomains.mozillaCanary.v.b)
+		add_special("use-application-dns.net", SPECIAL_MOZILLA_CANARY, false);
+	if(config.dns.specialDomains.iCloudPrivateRelay.v.b)
+	{
+		add_special("mask.icloud.com", SPECIAL_ICLOUD_RELAY, false);
+		add_special("mask-h2.icloud.com", SPECIAL_ICLOUD_RELAY, false);
+	}
+	if(config.dns.specialDomains.designatedResolver.v.b)
+	{
+		add_special(RESOLVER_ZONE, SPECIAL_DESIGNATED_RESOLVER, true);
+		table.suffix_len = strlen(RESOLVER_ZONE);
+	}
+
+	// Find the smallest table (at least twice the number of entries) and a
+	// seed for which all entries end up in different slots
+	for(unsigned int size = 2*SPECIAL_DOMAINS_MAX; size <= SPECIAL_SLOTS_MAX; size *= 2)
+	{
+		struct special_slot *slots = calloc(size, sizeof(*slots));
+		if(slots == NULL)
+			break;
+
+		for(uint32_t seed = 0; seed < SPECIAL_SEEDS; seed++)
+		{
+			if(!place_entries(slots, size, seed))
+				continue;
+
+			table.slots = slots;
+			table.mask = size - 1;
+			table.seed = seed;
+			table.local_suffix = local_suffix;
+			table.valid = true;
+			log_debug(DEBUG_QUERIES, "Built special domain table with %u entries in %u slots (seed %u)",
+			          table.num, size, seed);
+			return;
+		}
+
+		free(slots);
+	}
+
+	// This cannot really happen for a handful of domains, we keep the table
+	// invalid so the next lookup tries again
+	log_warn("Could not build special domain table");
+}
+
+// Look up a domain (or its last len characters) in the table
+static const struct special_slot *probe(const char *domain, const size_t len)
+{
+	const struct special_slot *slot = &table.slots[special_hash(domain, len, table.seed) & table.mask];
+	if(slot->name == NULL || strcasecmp(slot->name, domain) != 0)
+		return NULL;
+	return slot;
+}
+
+/**
+ * @brief Classify a domain
+ *
+ * @param domain Domain (case-insensitive)
+ * @param local_suffix dnsmasq's local domain suffix (may be NULL)
+ * @return enum special_domain_type Type of the domain, SPECIAL_NONE for all
+ * domains not requiring special treatment
+ */
+enum special_domain_type special_domain_type(const char *domain, const char *local_suffix)
+{
+	if(!table.valid || table.local_suffix != local_suffix)
+		rebuild_special_domains(local_suffix);
+	if(!table.valid)
+		return SPECIAL_NONE;
+
+	// Exact match
+	const size_t len = strlen(domain);
+	const struct special_slot *slot = probe(domain, len);
+	if(slot != NULL && !slot->suffix)
+		return slot->type;
+
+	// Match of the zone (which has to be strictly shorter than the domain)
+	if(table.suffix_len > 0 && len > table.suffix_len)
+	{
+		slot = probe(&domain[len - table.suffix_len], table.suffix_len);
+		if(slot != NULL && slot->suffix)
+			return slot->type;
+	}
+
+	return SPECIAL_NONE;
+}
+
+/**
+ * @brief Rebuild the table on the next lookup. Has to be called whenever the
+ * configuration changed. The caller must hold the SHM lock unless it is the
+ * resolver thread itself
+ */
+void special_domains_invalidate(void)
+{
+	table.valid = false;
+}
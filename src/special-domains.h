@@ -0,0 +1,28 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Special domain table prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef SPECIAL_DOMAINS_H
+#define SPECIAL_DOMAINS_H
+
+enum special_domain_type {
+	SPECIAL_NONE,
+	// pi.hole, the hostname and both with the local domain suffix appended
+	SPECIAL_PIHOLE,
+	// use-application-dns.net
+	SPECIAL_MOZILLA_CANARY,
+	// mask.icloud.com and mask-h2.icloud.com
+	SPECIAL_ICLOUD_RELAY,
+	// Everything ending in resolver.arpa (RFC 9462)
+	SPECIAL_DESIGNATED_RESOLVER
+} __attribute__ ((packed));
+
+enum special_domain_type special_domain_type(const char *domain, const char *local_suffix);
+void special_domains_invalidate(void);
+
+#endif //SPECIAL_DOMAINS_H
@@ -0,0 +1,295 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Allocation statistics of the memory routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file alloc-stats.c
+* @brief Attribution of heap memory to the call sites allocating it.
+*
+* FTLcalloc(), FTLrealloc(), FTLstrdup() and FTLvasprintf() record every block
+* they return together with the call site (function and line) it has been
+* allocated at, FTLfree() and FTLrealloc() remove it again. Blocks are kept in
+* an open-addressing hash table keyed by their address, call sites are told
+* apart by the address of their function name and their line. The size of a
+* block is what the allocator really reserved for it (malloc_usable_size()).
+*
+* Memory allocated elsewhere (e.g., by libraries) and freed by FTL is simply
+* not found in the table. Blocks allocated by FTL but freed elsewhere remain
+* accounted until their address is handed out again.
+*/
+
+#include "FTL.h"
+//#include "syscalls.h" is implicitly done in FTL.h
+#include "syscalls/alloc-stats.h"
+#include <pthread.h>
+
+// The table itself must not be tracked, logging is not possible either as it
+// may allocate memory while we hold the lock
+#undef calloc
+#undef free
+#undef realloc
+#undef pthread_mutex_lock
+
+// malloc_usable_size() (after the #undefs as it declares the allocator)
+#include <malloc.h>
+
+// Initial number of slots of the block table, it grows by doubling whenever it
+// gets half full
+#define ALLOC_TABLE_MIN 4096u
+
+// Allocated block not freed so far
+struct alloc_block {
+	uintptr_t ptr; // 0 = unused slot
+	size_t size;
+	unsigned int site;
+};
+
+// Everything in this file is protected by this mutex. It is taken before fork()
+// and released in both processes afterwards so children never inherit it in
+// locked state
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct alloc_site sites[ALLOC_SITES] = {{ 0 }};
+static struct alloc_block *table = NULL;
+static size_t table_size = 0u;
+static size_t table_used = 0u;
+static uint64_t untracked = 0u;
+static time_t since = 0;
+
+static void lock_alloc(void)
+{
+	pthread_mutex_lock(&alloc_lock);
+}
+
+static void unlock_alloc(void)
+{
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+/**
+ * @brief Start collecting allocation statistics
+ *
+ * This has to be called before any other thread is started.
+ */
+void init_alloc_stats(void)
+{
+	since = time(NULL);
+	pthread_atfork(lock_alloc, unlock_alloc, unlock_alloc);
+}
+
+// Home slot of a block, the low bits of addresses are always zero due to the
+// alignment guaranteed by the allocator
+static inline size_t block_slot(const uintptr_t ptr, const size_t size)
+{
+	return (size_t)((((uint64_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+// Find the call site of an allocation, a new one is added if the site has not
+// been seen before. Returns ALLOC_SITES if the table is full
+static unsigned int find_site(const char *func, const char *file, const int line)
+{
+	const uint64_t key = ((uint64_t)(uintptr_t)func + (uint64_t)line) * 0x9E3779B97F4A7C15ULL;
+	for(unsigned int i = 0; i < ALLOC_SITES; i++)
+	{
+		const unsigned int pos = ((key >> 32) + i) % ALLOC_SITES;
+		struct alloc_site *site = &sites[pos];
+		if(site->func == func && site->line == line)
+			return pos;
+		if(site->func != NULL)
+			continue;
+
+		// Unused slot, add this site
+		site->func = func;
+		site->file = file;
+		site->line = line;
+		return pos;
+	}
+
+	return ALLOC_SITES;
+}
+
+// Double the size of the block table
+static bool grow_table(void)
+{
+	const size_t new_size = table_size > 0 ? 2*table_size : ALLOC_TABLE_MIN;
+	struct alloc_block *new_table = calloc(new_size, sizeof(*new_table));
+	if(new_table == NULL)
+		return false;
+
+	for(size_t i = 0; i < table_size; i++)
+	{
+		if(table[i].ptr == 0)
+			continue;
+
+		size_t pos = block_slot(table[i].ptr, new_size);
+		while(new_table[pos].ptr != 0)
+			pos = (pos + 1) & (new_size - 1);
+		new_table[pos] = table[i];
+	}
+
+	free(table);
+	table = new_table;
+	table_size = new_size;
+	return true;
+}
+
+// Remove a block from the live statistics of its call site
+static void account_free(const struct alloc_block *block)
+{
+	struct alloc_site *site = &sites[block->site];
+	site->live -= block->size;
+	site->blocks--;
+}
+
+// Add a block to the table, returns false if there is no memory for it
+static bool insert_block(const uintptr_t ptr, const size_t size, const unsigned int site)
+{
+	if(2*(table_used + 1) > table_size && !grow_table())
+		return false;
+
+	size_t pos = block_slot(ptr, table_size);
+	while(table[pos].ptr != 0 && table[pos].ptr != ptr)
+		pos = (pos + 1) & (table_size - 1);
+
+	// The block at this address has been freed without us noticing
+	if(table[pos].ptr == ptr)
+		account_free(&table[pos]);
+	else
+		table_used++;
+
+	table[pos].ptr = ptr;
+	table[pos].size = size;
+	table[pos].site = site;
+	sites[site].live += size;
+	sites[site].blocks++;
+
+	return true;
+}
+
+// Remove a block from the table, returns false if it is not known
+static bool remove_block(const uintptr_t ptr, struct alloc_block *block)
+{
+	if(table_size == 0)
+		return false;
+
+	const size_t mask = table_size - 1;
+	size_t pos = block_slot(ptr, table_size);
+	while(table[pos].ptr != ptr)
+	{
+		if(table[pos].ptr == 0)
+			return false;
+		pos = (pos + 1) & mask;
+	}
+	*block = table[pos];
+
+	// Move following blocks of the same probe sequence back into the hole so
+	// lookups do not stop early (no tombstones needed)
+	size_t hole = pos;
+	for(size_t next = (hole + 1) & mask; table[next].ptr != 0; next = (next + 1) & mask)
+	{
+		const size_t home = block_slot(table[next].ptr, table_size);
+		if(((next - home) & mask) >= ((next - hole) & mask))
+		{
+			table[hole] = table[next];
+			hole = next;
+		}
+	}
+	table[hole].ptr = 0;
+	table_used--;
+
+	return true;
+}
+
+/**
+ * @brief Account a block returned by the allocator
+ *
+ * @param ptr The block, nothing is done for NULL
+ * @param file File of the call site
+ * @param func Function of the call site, this has to be a static string
+ * @param line Line of the call site
+ */
+void alloc_track(void *ptr, const char *file, const char *func, const int line)
+{
+	if(ptr == NULL)
+		return;
+
+	const size_t size = malloc_usable_size(ptr);
+	lock_alloc();
+	const unsigned int site = find_site(func, file, line);
+	if(site < ALLOC_SITES && insert_block((uintptr_t)ptr, size, site))
+	{
+		sites[site].allocs++;
+		sites[site].bytes += size;
+	}
+	else
+		untracked++;
+	unlock_alloc();
+}
+
+/**
+ * @brief Remove a block which is about to be freed or reallocated
+ *
+ * This has to be called before the block is handed back to the allocator as
+ * its address may be reused by another thread right away.
+ *
+ * @param ptr The block
+ * @return The call site the block has been allocated at (to be passed to
+ * alloc_restore() if the block remains allocated after all), ALLOC_SITES if the
+ * block is not known
+ */
+unsigned int alloc_untrack(const void *ptr)
+{
+	struct alloc_block block = { 0 };
+	lock_alloc();
+	const bool found = remove_block((uintptr_t)ptr, &block);
+	if(found)
+		account_free(&block);
+	unlock_alloc();
+
+	return found ? block.site : ALLOC_SITES;
+}
+
+/**
+ * @brief Account a block again after alloc_untrack() (e.g., when realloc()
+ * failed)
+ *
+ * @param ptr The block
+ * @param site Call site returned by alloc_untrack()
+ */
+void alloc_restore(void *ptr, const unsigned int site)
+{
+	if(ptr == NULL || site >= ALLOC_SITES)
+		return;
+
+	const size_t size = malloc_usable_size(ptr);
+	lock_alloc();
+	insert_block((uintptr_t)ptr, size, site);
+	unlock_alloc();
+}
+
+/**
+ * @brief Get the statistics of all call sites which allocated memory
+ *
+ * @param out Array receiving the call sites
+ * @param stats Receives the global statistics
+ * @return Number of call sites
+ */
+unsigned int get_alloc_sites(struct alloc_site out[ALLOC_SITES], struct alloc_stats *stats)
+{
+	unsigned int num = 0;
+	lock_alloc();
+	for(unsigned int i = 0; i < ALLOC_SITES; i++)
+		if(sites[i].allocs > 0)
+			out[num++] = sites[i];
+	stats->since = since;
+	stats->untracked = untracked;
+	stats->table = table_size * sizeof(*table);
+	unlock_alloc();
+
+	return num;
+}
@@ -0,0 +1,49 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Allocation statistics prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stdbool.h>
+// uint64_t
+#include <stdint.h>
+// size_t
+#include <stddef.h>
+// time_t
+#include <time.h>
+
+// Number of call sites allocations can be attributed to, allocations at any
+// further site are counted but not tracked
+#define ALLOC_SITES 1024u
+
+// Allocations made at one call site of calloc(), realloc(), strdup() or
+// (v)asprintf(). Live bytes and blocks are those not freed so far
+struct alloc_site {
+	const char *func;
+	const char *file;
+	int line;
+	uint64_t allocs;
+	uint64_t bytes;
+	uint64_t live;
+	uint64_t blocks;
+};
+
+struct alloc_stats {
+	time_t since;
+	uint64_t untracked;
+	size_t table; // Memory used for tracking
+};
+
+void init_alloc_stats(void);
+void alloc_track(void *ptr, const char *file, const char *func, const int line);
+unsigned int alloc_untrack(const void *ptr);
+void alloc_restore(void *ptr, const unsigned int site);
+unsigned int get_alloc_sites(struct alloc_site sites[ALLOC_SITES], struct alloc_stats *stats);
+
+#endif // ALLOC_STATS_H
@@ -11,6 +11,8 @@
 #include "FTL.h"
 //#include "syscalls.h" is implicitly done in FTL.h
 #include "log.h"
+// alloc_track()
+#include "syscalls/alloc-stats.h"
 
 #undef calloc
 void* __attribute__((malloc)) __attribute__((alloc_size(1,2))) FTLcalloc(const size_t nmemb, const size_t size, const char *file, const char *func, const int line)
@@ -37,6 +39,8 @@ void* __attribute__((malloc)) __attribute__((alloc_size(1,2))) FTLcalloc(const s
 	if(ptr == NULL)
 		log_err("Memory allocation (%zu x %zu) failed in %s() (%s:%i)",
 		        nmemb, size, func, file, line);
+	else
+		alloc_track(ptr, file, func, line);
 
 	// Restore errno value
 	errno = _errno;
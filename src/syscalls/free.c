@@ -11,6 +11,10 @@
 #include "FTL.h"
 //#include "syscalls.h" is implicitly done in FTL.h
 #include "log.h"
+// alloc_untrack()
+#include "syscalls/alloc-stats.h"
+// json_arena_owns()
+#include "webserver/json-arena.h"
 
 #undef free
 bool FTLfree(void *ptr, const char *file, const char *func, const int line)
@@ -25,7 +29,16 @@ bool FTLfree(void *ptr, const char *file, const char *func, const int line)
 		return false;
 	}
 
-	// Actually free the memory
+	// Strings printed by cJSON may have been allocated from the arena
+	if(json_arena_owns(ptr))
+	{
+		json_arena_free(ptr);
+		return true;
+	}
+
+	// Actually free the memory. It has to be untracked before as the
+	// address may be reused by another thread right away
+	alloc_untrack(ptr);
 	free(ptr);
 
 	return true;
@@ -11,6 +11,10 @@
 #include "FTL.h"
 //#include "syscalls.h" is implicitly done in FTL.h
 #include "log.h"
+// alloc_track()
+#include "syscalls/alloc-stats.h"
+// json_arena_owns()
+#include "webserver/json-arena.h"
 
 #undef realloc
 void __attribute__((alloc_size(2))) *FTLrealloc(void *ptr_in, const size_t size, const char * file, const char * func, const int line)
@@ -24,6 +28,22 @@ void __attribute__((alloc_size(2))) *FTLrealloc(void *ptr_in, const size_t size,
 	// then the call is equivalent to free(ptr). Unless ptr is NULL, it must
 	// have been returned by an earlier call to malloc(), calloc() or realloc().
 	// If the area pointed to was moved, a free(ptr) is done implicitly.
+	// Untrack the block before for this reason
+	if(ptr_in != NULL && json_arena_owns(ptr_in))
+	{
+		// Blocks allocated by cJSON from the arena are moved to the
+		// heap
+		void *ptr_new = size > 0 ? FTLrealloc(NULL, size, file, func, line) : NULL;
+		if(ptr_new != NULL)
+		{
+			const size_t old = json_arena_size(ptr_in);
+			memcpy(ptr_new, ptr_in, old < size ? old : size);
+		}
+		if(ptr_new != NULL || size == 0)
+			json_arena_free(ptr_in);
+		return ptr_new;
+	}
+	const unsigned int site = ptr_in != NULL ? alloc_untrack(ptr_in) : ALLOC_SITES;
 	void *ptr_out = NULL;
 	do
 	{
@@ -39,8 +59,16 @@ void __attribute__((alloc_size(2))) *FTLrealloc(void *ptr_in, const size_t size,
 
 	// Handle other errors than EINTR
 	if(ptr_out == NULL)
+	{
 		log_err("Memory reallocation (-> %zu) failed in %s() (%s:%i)",
 		        size, func, file, line);
+		// The original block is still allocated (unless it was freed as
+		// the new size is zero)
+		if(size > 0)
+			alloc_restore(ptr_in, site);
+	}
+	else
+		alloc_track(ptr_out, file, func, line);
 
 	// Restore errno value
 	errno = _errno;
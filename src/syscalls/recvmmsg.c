@@ -0,0 +1,47 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Pi-hole syscall implementation for recvmmsg
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+//#include "syscalls.h" is implicitly done in FTL.h
+#include "log.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#undef recvmmsg
+int FTLrecvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const char *file, const char *func, const int line)
+{
+	int ret = 0;
+	do
+	{
+		// Reset errno before trying to read
+		errno = 0;
+		ret = recvmmsg(sockfd, msgvec, vlen, flags, NULL);
+	}
+	// Try again if the last recvmmsg() call failed due to an interruption
+	// by an incoming signal
+	while(ret < 0 && errno == EINTR);
+
+	// Backup errno value
+	const int _errno = errno;
+
+	// Final error checking. May have failed for some other reason then an
+	// EINTR = interrupted system call. In that case, log a warning However,
+	// if the error is EAGAIN, this is not an error, but just a non-blocking
+	// socket that has no data available. In that case, do not log a warning
+	if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		log_warn("Could not recvmmsg() in %s() (%s:%i): %s",
+		         func, file, line, strerror(errno));
+
+	// Restore errno value
+	errno = _errno;
+
+	return ret;
+}
@@ -0,0 +1,47 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Pi-hole syscall implementation for sendmmsg
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+//#include "syscalls.h" is implicitly done in FTL.h
+#include "log.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#undef sendmmsg
+int FTLsendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const char *file, const char *func, const int line)
+{
+	int ret = 0;
+	do
+	{
+		// Reset errno before trying to write
+		errno = 0;
+		ret = sendmmsg(sockfd, msgvec, vlen, flags);
+	}
+	// Try again if the last sendmmsg() call failed due to an interruption
+	// by an incoming signal
+	while(ret < 0 && errno == EINTR);
+
+	// Backup errno value
+	const int _errno = errno;
+
+	// Final error checking (may have failed for some other reason then an
+	// EINTR = interrupted system call), a full socket buffer (EAGAIN) is
+	// handled by the caller and EINVAL is expected while an interface is
+	// still in DAD state
+	if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINVAL)
+		log_warn("Could not sendmmsg() in %s() (%s:%i): %s",
+		         func, file, line, strerror(errno));
+
+	// Restore errno value
+	errno = _errno;
+
+	return ret;
+}
@@ -34,12 +34,16 @@ int FTLsnprintf(const char *file, const char *func, const int line, char *__rest
 int FTLvsnprintf(const char *file, const char *func, const int line, char *__restrict__ buffer, const size_t maxlen, const char *format, va_list args) __attribute__ ((format (printf, 6, 0)));
 
 // Interrupt-safe socket routines
+// (struct mmsghdr is only defined by <sys/socket.h> with _GNU_SOURCE)
+struct mmsghdr;
 ssize_t FTLwrite(int fd, const void *buf, size_t total, const char *file, const char *func, const int line);
 int FTLaccept(int sockfd, struct sockaddr *addr, socklen_t *addrlen, const char *file, const char *func, const int line);
 ssize_t FTLrecv(int sockfd, void *buf, size_t len, int flags, const bool warn, const char *file, const char *func, const int line);
 ssize_t FTLrecvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen, const char *file, const char *func, const int line);
+int FTLrecvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const char *file, const char *func, const int line);
 int FTLselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout, const char *file, const char *func, const int line);
 ssize_t FTLsendto(int sockfd, void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen, const char *file, const char *func, const int line);
+int FTLsendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, const char *file, const char *func, const int line);
 
 // Interrupt-safe thread routines
 int FTLpthread_mutex_lock(pthread_mutex_t *__mutex, const char *file, const char *func, const int line);
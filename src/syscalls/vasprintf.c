@@ -11,6 +11,8 @@
 #include "FTL.h"
 //#include "syscalls.h" is implicitly done in FTL.h
 #include "log.h"
+// alloc_track()
+#include "syscalls/alloc-stats.h"
 
 #undef vasprintf
 int FTLvasprintf(const char *file, const char *func, const int line, char **buffer, const char *format, va_list args)
@@ -53,6 +55,8 @@ int FTLvasprintf(const char *file, const char *func, const int line, char **buff
 		syscalls_report_error("vasprintf() failed to print into buffer",
 		                      stdout, _errno, format, func, file, line);
 	}
+	else
+		alloc_track(*buffer, file, func, line);
 
 	// Restore errno value
 	errno = _errno;
@@ -15,6 +15,10 @@
 #include "signals.h"
 // set_blockingmode()
 #include "config/config.h"
+// update_padd_snapshot()
+#include "api/api.h"
+// set_thread_placement()
+#include "daemon.h"
 
 static struct timespec t0[NUMTIMERS];
 
@@ -65,48 +69,120 @@ void sleepms(const int milliseconds)
 	select(0, NULL, NULL, NULL, &tv);
 }
 
-static double timer_delay = -1.0;
+// Startup stages and their duration in milliseconds. Stages run one after
+// another unless marked as parallel
+#define STARTUP_STAGES 16u
+static struct {
+	const char *name;
+	double msec;
+	bool parallel;
+} stages[STARTUP_STAGES];
+static unsigned int num_stages = 0u;
+static double last_stage = 0.0;
+static pthread_mutex_t stages_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_startup_stage(const char *name, const double msec, const bool parallel)
+{
+	pthread_mutex_lock(&stages_lock);
+	if(num_stages < STARTUP_STAGES)
+	{
+		stages[num_stages].name = name;
+		stages[num_stages].msec = msec;
+		stages[num_stages].parallel = parallel;
+		num_stages++;
+	}
+	pthread_mutex_unlock(&stages_lock);
+}
+
+// End a startup stage, it started when the previous stage ended (or FTL has
+// been started)
+void startup_stage(const char *name)
+{
+	const double now = timer_elapsed_msec(EXIT_TIMER);
+	add_startup_stage(name, now - last_stage, false);
+	last_stage = now;
+}
+
+// Add a stage which ran in parallel to the others
+void startup_stage_parallel(const char *name, const double msec)
+{
+	add_startup_stage(name, msec, true);
+}
+
+void log_startup_stages(void)
+{
+	char buf[512] = { 0 };
+	size_t len = 0;
+	pthread_mutex_lock(&stages_lock);
+	for(unsigned int i = 0; i < num_stages && len < sizeof(buf); i++)
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%s %.0f ms%s", i > 0 ? ", " : "",
+		                stages[i].name, stages[i].msec, stages[i].parallel ? " (parallel)" : "");
+	pthread_mutex_unlock(&stages_lock);
+
+	log_info("Startup finished after %.0f ms: %s", last_stage, buf);
+}
+
+// When the blocking mode is to be changed, negative if no timer is running
+static double timer_end = -1.0;
 static bool timer_target_status = true;
 
 void set_blockingmode_timer(double delay, bool target_status)
 {
-	timer_delay = delay;
 	timer_target_status = target_status;
+	timer_end = delay > -1.0 ? double_time() + (delay > 0.0 ? delay : 0.0) : -1.0;
+
+	// Let the timer thread sleep until the new timer expires
+	wake_thread(TIMER);
 }
 
 void get_blockingmode_timer(double *delay, bool *target_status)
 {
-	*delay = timer_delay;
+	const double end = timer_end;
+	*delay = end < 0.0 ? -1.0 : end > double_time() ? end - double_time() : 0.0;
 	*target_status = timer_target_status;
 }
 
-#define SLEEPING_TIME 0.1 // seconds
+// Refresh the PADD snapshot every this many seconds
+#define PADD_SNAPSHOT_INTERVAL 1.0
 void *timer(void *val)
 {
 	(void)val;
 	// Set thread name
 	prctl(PR_SET_NAME, thread_names[TIMER], 0, 0, 0);
+	set_thread_placement(ROLE_BACKGROUND);
 
-	// Save timestamp as we do not want to store immediately
-	// to the database
+	double next_padd = 0.0;
 	while(!killed)
 	{
-		if(timer_delay > 0)
-		{
-			log_debug(DEBUG_EXTRA, "Pi-hole will be %s in %.1f seconds...",
-			          timer_target_status ? "enabled" : "disabled", timer_delay);
-
-			timer_delay -= SLEEPING_TIME;
-		}
-		else if(timer_delay <= 0.0 && timer_delay > -1.0)
+		const double now = double_time();
+		const double end = timer_end;
+		if(end >= 0.0 && now >= end)
 		{
 			log_debug(DEBUG_EXTRA, "Timer expired, setting blocking mode to %s",
 			          timer_target_status ? "enabled" : "disabled");
 
 			set_blockingstatus(timer_target_status);
-			timer_delay = -1.0;
+			timer_end = -1.0;
 		}
-		thread_sleepms(TIMER, SLEEPING_TIME * 1000);
+		else if(end >= 0.0)
+		{
+			log_debug(DEBUG_EXTRA, "Pi-hole will be %s in %.1f seconds...",
+			          timer_target_status ? "enabled" : "disabled", end - now);
+		}
+
+		// Pre-build responses of /api/padd polled by PADD instances
+		if(now >= next_padd)
+		{
+			update_padd_snapshot();
+			next_padd = now + PADD_SNAPSHOT_INTERVAL;
+		}
+
+		// Sleep until the next snapshot or the timer is due, a new
+		// timer wakes us up
+		double sleep_time = next_padd - now;
+		if(timer_end >= 0.0 && timer_end - now < sleep_time)
+			sleep_time = timer_end - now;
+		thread_sleepms(TIMER, sleep_time > 0.0 ? (int)(1e3*sleep_time) + 1 : 1);
 	}
 
 	log_info("Terminating timer thread");
@@ -22,5 +22,8 @@ void sleepms(const int milliseconds);
 void set_blockingmode_timer(double delay, bool blocked);
 void get_blockingmode_timer(double *delay, bool *target_status);
 void *timer(void *val);
+void startup_stage(const char *name);
+void startup_stage_parallel(const char *name, const double msec);
+void log_startup_stages(void);
 
 #endif //TIMERS_H
@@ -14,8 +14,6 @@
 #include "log.h"
 // get_hardware_address()
 #include "dhcp-discover.h"
-// sleepms()
-#include "timers.h"
 // check_capability()
 #include "capabilities.h"
 #include <linux/capability.h>
@@ -23,13 +21,17 @@
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
 #include <linux/if_arp.h>
+// RTM_NEWNEIGH
+#include <linux/rtnetlink.h>
+// NDA_DST
+#include <linux/neighbour.h>
 //htons etc
 #include <arpa/inet.h>
+// epoll_wait()
+#include <sys/epoll.h>
 
-// How many threads do we spawn at maximum?
-// This is also the limit for interfaces
-// we scan for DHCP activity.
-#define MAXTHREADS 32
+// How many interfaces do we scan at maximum?
+#define MAXIFACES 32
 
 // How many MAC addresses do we store per IP address?
 #define MAX_MACS 3
@@ -37,9 +39,17 @@
 // How many ARP requests do we send per IP address?
 #define NUM_SCANS 10
 
-// How long do we wait for ARP replies in each scan [seconds]?
+// How many ARP requests do we send to addresses which never replied? They are
+// not probed any further afterwards (except in extreme mode)
+#define ARP_RETRIES 3
+
+// Minimum time between two scans of the same address, this is also how long
+// we wait for late replies after the last request [seconds]
 #define ARP_TIMEOUT 1
 
+// Default number of ARP requests sent per second and interface
+#define ARP_DEFAULT_RATE 5000u
+
 // Protocol definitions
 #define PROTO_ARP 0x0806
 #define ETH2_HEADER_LEN 14
@@ -49,6 +59,7 @@
 #define ARP_REQUEST 0x01
 #define ARP_REPLY 0x02
 #define BUF_SIZE 60
+#define ARP_PACKET_LEN 42
 
 // ARP header struct
 // See https://en.wikipedia.org/wiki/Address_Resolution_Protocol#Packet_structure
@@ -89,20 +100,29 @@ enum status {
 	STATUS_COMPLETE
 } __attribute__ ((packed));
 
-struct thread_data {
+struct scan_data {
 	bool scan_all :1;
 	bool extreme :1;
 	char iface[IF_NAMESIZE + 1];
 	char ipstr[INET_ADDRSTRLEN];
 	unsigned char mac[MAC_LENGTH];
 	enum status status;
+	int fd;
+	int ifindex;
 	int dst_cidr;
-	unsigned int num_scans;
+	unsigned int round;
 	unsigned int total_scans;
+	uint32_t next_addr;
 	size_t result_size;
 	uint32_t scanned_addresses;
+	uint32_t found_devices;
+	double round_start;
+	double next_send;
+	double last_send;
 	const char *error;
 	struct ifaddrs *ifa;
+	// Number of requests sent to each address so far
+	unsigned char *probes;
 	union {
 		struct arp_result_extreme *result_extreme;
 		struct arp_result *result;
@@ -110,30 +130,29 @@ struct thread_data {
 	struct sockaddr_in src_addr;
 	struct sockaddr_in dst_addr;
 	struct sockaddr_in mask;
+	// ARP request, only the target IP address changes between requests
+	unsigned char request[BUF_SIZE];
+	struct sockaddr_ll socket_address;
 };
 
-// Sends multiple ARP who-has request on interface ifindex, using source mac src_mac and source ip src_ip.
-// Iterates over all IP addresses in the range of dst_ip/cidr.
-static int send_arps(const int fd, const int ifindex, struct thread_data *thread_data)
+// Prepare the ARP who-has request sent on this interface, using our own MAC
+// and IP address as sender
+static void prepare_request(struct scan_data *scan)
 {
-	int err = -1;
-	unsigned char buffer[BUF_SIZE];
-	memset(buffer, 0, sizeof(buffer));
+	memset(scan->request, 0, sizeof(scan->request));
 
 	// Construct the Ethernet header
-	struct sockaddr_ll socket_address;
-	socket_address.sll_family = AF_PACKET;
-	socket_address.sll_protocol = htons(ETH_P_ARP);
-	socket_address.sll_ifindex = ifindex;
-	socket_address.sll_hatype = htons(ARPHRD_ETHER);
-	socket_address.sll_pkttype = PACKET_BROADCAST;
-	socket_address.sll_halen = MAC_LENGTH;
-	socket_address.sll_addr[6] = 0;
-	socket_address.sll_addr[7] = 0;
-
-	struct ethhdr *send_req = (struct ethhdr *) buffer;
-	struct arp_header *arp_req = (struct arp_header *) (buffer + ETH2_HEADER_LEN);
-	ssize_t ret;
+	struct sockaddr_ll *socket_address = &scan->socket_address;
+	memset(socket_address, 0, sizeof(*socket_address));
+	socket_address->sll_family = AF_PACKET;
+	socket_address->sll_protocol = htons(ETH_P_ARP);
+	socket_address->sll_ifindex = scan->ifindex;
+	socket_address->sll_hatype = htons(ARPHRD_ETHER);
+	socket_address->sll_pkttype = PACKET_BROADCAST;
+	socket_address->sll_halen = MAC_LENGTH;
+
+	struct ethhdr *send_req = (struct ethhdr *) scan->request;
+	struct arp_header *arp_req = (struct arp_header *) (scan->request + ETH2_HEADER_LEN);
 
 	// Destination is the broadcast address
 	memset(send_req->h_dest, 0xff, MAC_LENGTH);
@@ -142,9 +161,9 @@ static int send_arps(const int fd, const int ifindex, struct thread_data *thread
 	memset(arp_req->target_mac, 0x00, MAC_LENGTH);
 
 	// Source MAC to our own MAC address
-	memcpy(send_req->h_source, thread_data->mac, MAC_LENGTH);
-	memcpy(arp_req->sender_mac, thread_data->mac, MAC_LENGTH);
-	memcpy(socket_address.sll_addr, thread_data->mac, MAC_LENGTH);
+	memcpy(send_req->h_source, scan->mac, MAC_LENGTH);
+	memcpy(arp_req->sender_mac, scan->mac, MAC_LENGTH);
+	memcpy(socket_address->sll_addr, scan->mac, MAC_LENGTH);
 
 	// Protocol type is ARP
 	send_req->h_proto = htons(ETH_P_ARP);
@@ -157,44 +176,32 @@ static int send_arps(const int fd, const int ifindex, struct thread_data *thread
 	arp_req->opcode = htons(ARP_REQUEST);
 
 	// Copy IP address to arp_req
-	memcpy(arp_req->sender_ip, &thread_data->src_addr.sin_addr.s_addr, sizeof(thread_data->src_addr.sin_addr.s_addr));
-
-	// Loop over all possible IP addresses in the range dst_ip/cidr
-	// We start at 1 because the first IP address has already been set above
-	struct in_addr dst_ip = thread_data->dst_addr.sin_addr;
-	for(unsigned int i = 0; i < (1u << (32 - thread_data->dst_cidr)); i++)
-	{
-		// Fill in target IP address
-		memcpy(arp_req->target_ip, &dst_ip.s_addr, sizeof(dst_ip.s_addr));
-
-#ifdef DEBUG
-		printf("Sending ARP request for %s@%s\n", inet_ntoa(*dst_ip), iface);
-#endif
+	memcpy(arp_req->sender_ip, &scan->src_addr.sin_addr.s_addr, sizeof(scan->src_addr.sin_addr.s_addr));
+}
 
-		// Send ARP request
-		ret = sendto(fd, buffer, 42, 0, (struct sockaddr *) &socket_address, sizeof(socket_address));
-		if (ret == -1)
-		{
-			err = errno;
-			thread_data->error = strerror(err);
-			goto out;
-		}
+// Send an ARP who-has request for the i-th address of the scanned network.
+// Returns 0 on success, otherwise the errno of sendto()
+static int send_arp(struct scan_data *scan, const uint32_t i)
+{
+	struct arp_header *arp_req = (struct arp_header *) (scan->request + ETH2_HEADER_LEN);
 
-		// Increment IP address
-		dst_ip.s_addr = htonl(ntohl(dst_ip.s_addr) + 1);
+	// Fill in target IP address
+	const in_addr_t dst_ip = htonl(ntohl(scan->dst_addr.sin_addr.s_addr) + i);
+	memcpy(arp_req->target_ip, &dst_ip, sizeof(dst_ip));
 
-		thread_data->scanned_addresses++;
-	}
+	// Send ARP request
+	if(sendto(scan->fd, scan->request, ARP_PACKET_LEN, 0,
+	          (struct sockaddr *) &scan->socket_address, sizeof(scan->socket_address)) == -1)
+		return errno;
 
-	err = 0;
-out:
-	return err;
+	scan->scanned_addresses++;
+	return 0;
 }
 
 static int create_arp_socket(const int ifindex, const char *iface, const char **error)
 {
-	// Create socket for ARP communications
-	const int arp_socket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP));
+	// Create non-blocking socket for ARP communications
+	const int arp_socket = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ARP));
 	if(arp_socket < 0)
 	{
 		*error = strerror(errno);
@@ -219,43 +226,66 @@ static int create_arp_socket(const int ifindex, const char *iface, const char **
 		return -1;
 	}
 
-	// Set timeout
-	struct timeval tv;
-	tv.tv_sec = ARP_TIMEOUT;
-	tv.tv_usec = 0;
-	if (setsockopt(arp_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
-	{
-		*error = strerror(errno);
-#ifdef DEBUG
-		printf("Unable to set timeout for ARP communications on interface %s: %s\n", iface, *error);
-#endif
-		close(arp_socket);
-		return -1;
-	}
-
 	return arp_socket;
 }
 
-static void add_result(struct in_addr *rcv_ip, unsigned char *sender_mac,
-                       struct thread_data *thread_data, const unsigned int scan_id)
+// Add an entry to the kernel's neighbor cache so the device shows up in the
+// network table the next time FTL parses the cache. Existing entries are not
+// replaced, the error replies for them are not read
+static void add_neighbor(const int fd, const int ifindex, const struct in_addr *ip, const unsigned char *mac)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ndmsg ndm;
+		char attrs[RTA_SPACE(IPV4_LENGTH) + RTA_SPACE(MAC_LENGTH)];
+	} req;
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ndm));
+	req.nh.nlmsg_type = RTM_NEWNEIGH;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL;
+	req.ndm.ndm_family = AF_INET;
+	req.ndm.ndm_ifindex = ifindex;
+	req.ndm.ndm_state = NUD_STALE;
+	req.ndm.ndm_type = RTN_UNICAST;
+
+	struct rtattr *rta = (struct rtattr *)(void *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+	rta->rta_type = NDA_DST;
+	rta->rta_len = RTA_LENGTH(IPV4_LENGTH);
+	memcpy(RTA_DATA(rta), &ip->s_addr, IPV4_LENGTH);
+	req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + RTA_SPACE(IPV4_LENGTH);
+
+	rta = (struct rtattr *)(void *)((char *)&req + req.nh.nlmsg_len);
+	rta->rta_type = NDA_LLADDR;
+	rta->rta_len = RTA_LENGTH(MAC_LENGTH);
+	memcpy(RTA_DATA(rta), mac, MAC_LENGTH);
+	req.nh.nlmsg_len += RTA_SPACE(MAC_LENGTH);
+
+	if(send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+		printf("Unable to add %s to the neighbor cache: %s\n", inet_ntoa(*ip), strerror(errno));
+}
+
+// Returns true if a new device has been found
+static bool add_result(struct in_addr *rcv_ip, unsigned char *sender_mac,
+                       struct scan_data *scan, const unsigned int scan_id)
 {
 
 	// Check if we have already found this IP address
-	uint32_t i = ntohl(rcv_ip->s_addr) - ntohl(thread_data->dst_addr.sin_addr.s_addr);
-	if(i >= thread_data->result_size)
+	uint32_t i = ntohl(rcv_ip->s_addr) - ntohl(scan->dst_addr.sin_addr.s_addr);
+	if(i >= scan->result_size)
 	{
 		printf("Received IP address %s out of range for interface %s (%u >= %zu)\n",
-		       inet_ntoa(*rcv_ip), thread_data->iface, i, thread_data->result_size);
-		return;
+		       inet_ntoa(*rcv_ip), scan->iface, i, scan->result_size);
+		return false;
 	}
 
 	// Save MAC address
+	bool new_device = false;
 	unsigned int j = 0;
 	for(; j < MAX_MACS; j++)
 	{
-		unsigned char *mac = thread_data->extreme ?
-		                       thread_data->result_extreme[i].device[j].mac :
-		                       thread_data->result[i].device[j].mac;
+		unsigned char *mac = scan->extreme ?
+		                       scan->result_extreme[i].device[j].mac :
+		                       scan->result[i].device[j].mac;
 		// Check if received MAC is already stored in result[i].device[j].mac
 		if(memcmp(mac, sender_mac, MAC_LENGTH) == 0)
 		{
@@ -266,18 +296,35 @@ static void add_result(struct in_addr *rcv_ip, unsigned char *sender_mac,
 		{
 			// Copy MAC address to mac
 			memcpy(mac, sender_mac, MAC_LENGTH);
+			new_device = true;
 			break;
 		}
 	}
 
+	// More devices replied than we can store
+	if(j == MAX_MACS)
+		return false;
+
 	// Memorize that we have received a reply for this IP address
-	thread_data->extreme ?
-	  thread_data->result_extreme[i].device[j].replied[scan_id]++ :
-	  thread_data->result[i].device[j].replied[scan_id]++;
+	scan->extreme ?
+	  scan->result_extreme[i].device[j].replied[scan_id]++ :
+	  scan->result[i].device[j].replied[scan_id]++;
+
+	return new_device;
+}
+
+// Did any device reply for the i-th address so far?
+static bool __attribute__((pure)) responded(const struct scan_data *scan, const uint32_t i)
+{
+	const unsigned char *mac = scan->extreme ?
+	                             scan->result_extreme[i].device[0].mac :
+	                             scan->result[i].device[0].mac;
+	return memcmp(mac, "\x00\x00\x00\x00\x00\x00", MAC_LENGTH) != 0;
 }
 
-// Read all ARP responses
-static ssize_t read_arp(const int fd, struct thread_data *thread_data)
+// Read all ARP responses currently available, devices are reported as soon as
+// they reply for the first time
+static ssize_t read_arp(struct scan_data *scan, const int nl_fd)
 {
 	ssize_t ret = 0;
 	unsigned char buffer[BUF_SIZE];
@@ -285,21 +332,23 @@ static ssize_t read_arp(const int fd, struct thread_data *thread_data)
 	// Read ARP responses
 	while(ret >= 0)
 	{
-		ret = recvfrom(fd, buffer, BUF_SIZE, 0, NULL, NULL);
+		ret = recvfrom(scan->fd, buffer, BUF_SIZE, 0, NULL, NULL);
 		if (ret == -1)
 		{
-			if(errno == EAGAIN)
+			if(errno == EAGAIN || errno == EINTR)
 			{
-				// Timeout
+				// Nothing more to read for now
 				ret = 0;
 				break;
 			}
 
 			// Error
-			thread_data->error = strerror(errno);
-			printf("recvfrom(): %s", thread_data->error);
+			scan->error = strerror(errno);
+			printf("recvfrom(): %s", scan->error);
 			break;
 		}
+		if((size_t)ret < ETH2_HEADER_LEN + sizeof(struct arp_header))
+			continue;
 		struct ethhdr *rcv_resp = (struct ethhdr *) buffer;
 		struct arp_header *arp_resp = (struct arp_header *) (buffer + ETH2_HEADER_LEN);
 		if (ntohs(rcv_resp->h_proto) != PROTO_ARP)
@@ -322,22 +371,104 @@ static ssize_t read_arp(const int fd, struct thread_data *thread_data)
 		struct in_addr sender_a;
 		memcpy(&sender_a.s_addr, arp_resp->sender_ip, sizeof(sender_a.s_addr));
 
-#ifdef DEBUG
-		printf("%-16s %-20s\t%02x:%02x:%02x:%02x:%02x:%02x",
-		     thread_data->iface, inet_ntoa(sender_a),
-		     arp_resp->sender_mac[0],
-		     arp_resp->sender_mac[1],
-		     arp_resp->sender_mac[2],
-		     arp_resp->sender_mac[3],
-		     arp_resp->sender_mac[4],
-		     arp_resp->sender_mac[5]);
-#endif
-		add_result(&sender_a, arp_resp->sender_mac, thread_data, thread_data->num_scans);
+		// Count the reply for the last request sent to this address,
+		// replies for addresses we did not ask for are ignored
+		const uint32_t i = ntohl(sender_a.s_addr) - ntohl(scan->dst_addr.sin_addr.s_addr);
+		if(i < scan->result_size && scan->probes[i] == 0)
+			continue;
+		const unsigned int scan_id = i < scan->result_size ? scan->probes[i] - 1u : 0u;
+
+		if(!add_result(&sender_a, arp_resp->sender_mac, scan, scan_id))
+			continue;
+
+		// Stream new devices as they are found
+		const unsigned char *mac = arp_resp->sender_mac;
+		scan->found_devices++;
+		printf("%-16s %-16s %02x:%02x:%02x:%02x:%02x:%02x\n",
+		       inet_ntoa(sender_a), scan->iface,
+		       mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+		fflush(stdout);
+
+		if(nl_fd > -1)
+			add_neighbor(nl_fd, scan->ifindex, &sender_a, mac);
 	}
 
 	return ret;
 }
 
+// Should the i-th address be probed in the current round? Addresses which
+// replied are probed in every round to detect unreliable devices and IP
+// conflicts. Silent addresses are given up after ARP_RETRIES rounds, this is
+// what dominates the scan time of large, sparsely populated networks
+static bool __attribute__((pure)) needs_probe(const struct scan_data *scan, const uint32_t i)
+{
+	return scan->extreme || scan->round < ARP_RETRIES || responded(scan, i);
+}
+
+// Send all ARP requests which are due on this interface, at most one every
+// interval seconds. Returns the time this interface wants to continue or 0.0
+// once the scan is complete
+static double scan_step(struct scan_data *scan, const double now, const double interval)
+{
+	while(scan->status == STATUS_SCANNING)
+	{
+		// Current round is complete
+		if(scan->next_addr >= scan->result_size)
+		{
+			// Give devices time to reply before asking again and
+			// wait for late replies after the last round
+			const bool last_round = scan->round + 1 >= scan->total_scans;
+			const double round_end = (last_round ? scan->last_send : scan->round_start) + ARP_TIMEOUT;
+			if(now < round_end)
+				return round_end;
+
+			if(last_round)
+			{
+				scan->status = STATUS_COMPLETE;
+				break;
+			}
+
+			scan->round++;
+			scan->round_start = now;
+			scan->next_addr = 0;
+			continue;
+		}
+
+		// Skip addresses not to be probed in this round
+		if(!needs_probe(scan, scan->next_addr))
+		{
+			scan->next_addr++;
+			continue;
+		}
+
+		// Pace requests
+		if(scan->next_send > now)
+			return scan->next_send;
+
+		const int err = send_arp(scan, scan->next_addr);
+		if(err == EAGAIN || err == ENOBUFS)
+		{
+			// The interface queue is full, try again a little later
+			scan->next_send = now + 10*interval;
+			return scan->next_send;
+		}
+		else if(err != 0)
+		{
+			scan->error = strerror(err);
+			scan->status = STATUS_ERROR;
+			break;
+		}
+
+		scan->probes[scan->next_addr++]++;
+		scan->last_send = now;
+
+		// Do not catch up on more than 10 msec of missed requests at once
+		scan->next_send = MAX(scan->next_send, now - 0.01) + interval;
+	}
+
+	return 0.0;
+}
+
 // Convert netmask to CIDR
 static int netmask_to_cidr(struct in_addr *addr)
 {
@@ -360,182 +491,122 @@ static const char *get_hostname(const struct in_addr *addr)
 	return hostname;
 }
 
-static void *arp_scan_iface(void *args)
+// Prepare scanning an interface: create its socket and allocate the results
+static void arp_scan_iface(struct scan_data *scan)
 {
-	// Get thread_data pointer
-	struct thread_data *thread_data = (struct thread_data*)args;
-
 	// Get interface details
-	struct ifaddrs *ifa = thread_data->ifa;
+	struct ifaddrs *ifa = scan->ifa;
 
 	// Get interface name
-	const char *iface = thread_data->iface;
-
-	// Set interface name as thread name
-	prctl(PR_SET_NAME, iface, 0, 0, 0);
+	const char *iface = scan->iface;
 
 	// Get interface netmask
-	memcpy(&thread_data->mask, ifa->ifa_netmask, sizeof(thread_data->mask));
+	memcpy(&scan->mask, ifa->ifa_netmask, sizeof(scan->mask));
 
 	// Convert subnet to CIDR
-	thread_data->dst_cidr = netmask_to_cidr(&thread_data->mask.sin_addr);
+	scan->dst_cidr = netmask_to_cidr(&scan->mask.sin_addr);
 
 	// Get interface index
-	const int ifindex = (int)if_nametoindex(iface);
+	scan->ifindex = (int)if_nametoindex(iface);
 
 	// Scan only interfaces with CIDR >= 24
-	if(thread_data->dst_cidr < 24 && !thread_data->scan_all)
+	if(scan->dst_cidr < 24 && !scan->scan_all)
 	{
-		thread_data->status = STATUS_SKIPPED_CIDR_MISMATCH;
+		scan->status = STATUS_SKIPPED_CIDR_MISMATCH;
 #ifdef DEBUG
-		printf("Skipped interface %s (%s/%i)\n", iface, thread_data->ipstr, thread_data->dst_cidr);
+		printf("Skipped interface %s (%s/%i)\n", iface, scan->ipstr, scan->dst_cidr);
 #endif
-		pthread_exit(NULL);
+		return;
 	}
 #ifdef DEBUG
-	printf("Scanning interface %s (%s/%i)...\n", iface, thread_data->ipstr, thread_data->dst_cidr);
+	printf("Scanning interface %s (%s/%i)...\n", iface, scan->ipstr, scan->dst_cidr);
 #endif
-	thread_data->status = STATUS_SCANNING;
 
 	// Create socket for ARP communications
-	const int arp_socket = create_arp_socket(ifindex, iface, &thread_data->error);
+	scan->fd = create_arp_socket(scan->ifindex, iface, &scan->error);
 
 	// Cannot create socket, likely a permission error
-	if(arp_socket < 0)
+	if(scan->fd < 0)
 	{
-		thread_data->status = STATUS_ERROR;
-		pthread_exit(NULL);
+		scan->status = STATUS_ERROR;
+		return;
 	}
 
 	// Get hardware address of client machine
-	get_hardware_address(arp_socket, iface, thread_data->mac);
+	get_hardware_address(scan->fd, iface, scan->mac);
 
 	// Define destination IP address by masking source IP with netmask
-	thread_data->dst_addr.sin_addr.s_addr = thread_data->src_addr.sin_addr.s_addr & thread_data->mask.sin_addr.s_addr;
+	scan->dst_addr.sin_addr.s_addr = scan->src_addr.sin_addr.s_addr & scan->mask.sin_addr.s_addr;
 
 	// Allocate memory for ARP response buffer
-	const size_t arp_result_len = 1 << (32 - thread_data->dst_cidr);
-	thread_data->result_size = arp_result_len;
-	if(thread_data->extreme)
+	const size_t arp_result_len = 1 << (32 - scan->dst_cidr);
+	scan->result_size = arp_result_len;
+	if(scan->extreme)
 	{
 		// Allocate extreme memory for ARP response buffer
-		struct arp_result_extreme *result = calloc(arp_result_len, sizeof(struct arp_result_extreme));
-		if(result == NULL)
-		{
-			// Memory allocation failed due to insufficient memory being
-			// available
-			thread_data->status = STATUS_ERROR;
-			thread_data->error = strerror(ENOMEM);
-			pthread_exit(NULL);
-		}
-		thread_data->result_extreme = result;
+		scan->result_extreme = calloc(arp_result_len, sizeof(struct arp_result_extreme));
 	}
 	else
 	{
 		// Allocate memory for ARP response buffer
-		struct arp_result *result = calloc(arp_result_len, sizeof(struct arp_result));
-		if(result == NULL)
-		{
-			// Memory allocation failed due to insufficient memory being
-			// available
-			thread_data->status = STATUS_ERROR;
-			thread_data->error = strerror(ENOMEM);
-			pthread_exit(NULL);
-		}
-		thread_data->result = result;
+		scan->result = calloc(arp_result_len, sizeof(struct arp_result));
 	}
-
-	for(thread_data->num_scans = 0; thread_data->num_scans < thread_data->total_scans; thread_data->num_scans++)
+	scan->probes = calloc(arp_result_len, sizeof(*scan->probes));
+	if(scan->result == NULL || scan->probes == NULL)
 	{
-#ifdef DEBUG
-		printf("Still scanning interface %s (%s/%i) %i%%...\n", iface, thread_data->ipstr, thread_data->dst_cidr, 100*scan_id/thread_data->total_scans);
-#endif
-		// Send ARP requests to all IPs in subnet
-		if(send_arps(arp_socket, ifindex, thread_data) != 0)
-		{
-			thread_data->status = STATUS_ERROR;
-			break;
-		}
-
-		// Read ARP responses
-		if(read_arp(arp_socket, thread_data) != 0)
-		{
-			thread_data->status = STATUS_ERROR;
-			break;
-		}
+		// Memory allocation failed due to insufficient memory being
+		// available
+		scan->status = STATUS_ERROR;
+		scan->error = strerror(ENOMEM);
+		return;
 	}
 
-	// Close socket
-	if(close(arp_socket) != 0)
-		thread_data->status = STATUS_ERROR;
-
-	if(thread_data->status != STATUS_ERROR)
-		thread_data->status = STATUS_COMPLETE;
-
-	pthread_exit(NULL);
+	prepare_request(scan);
+	scan->status = STATUS_SCANNING;
 }
 
-static void print_results(struct thread_data *thread_data)
+static void print_results(struct scan_data *scan)
 {
 
-	if(thread_data->status == STATUS_SKIPPED_CIDR_MISMATCH)
+	if(scan->status == STATUS_SKIPPED_CIDR_MISMATCH)
 	{
 		printf("Skipped interface %s (%s/%i) because of too large network (use -a or -x to force scanning this interface)\n\n",
-		       thread_data->iface, thread_data->ipstr, thread_data->dst_cidr);
+		       scan->iface, scan->ipstr, scan->dst_cidr);
 		return;
 	}
 
-	if(thread_data->status == STATUS_ERROR)
+	if(scan->status == STATUS_ERROR)
 	{
 		printf("Error scanning interface %s (%s/%i)%s%s\n\n",
-		       thread_data->iface, thread_data->ipstr, thread_data->dst_cidr,
-		       thread_data->error ? ": " : "", thread_data->error ? thread_data->error : "");
+		       scan->iface, scan->ipstr, scan->dst_cidr,
+		       scan->error ? ": " : "", scan->error ? scan->error : "");
 		return;
 	}
 
-	// Check if there are any results
-	bool any_replies = false;
-	for(unsigned int i = 0; i < thread_data->result_size; i++)
-		for(unsigned int j = 0; j < MAX_MACS; j++)
-			for(unsigned int k = 0; k < thread_data->total_scans; k++)
-				if(thread_data->extreme)
-				{
-					if(thread_data->result_extreme[i].device[j].replied[k])
-					{
-						any_replies = true;
-						break;
-					}
-				}
-				else
-				{
-					if(thread_data->result[i].device[j].replied[k])
-					{
-						any_replies = true;
-						break;
-					}
-				}
-
 	// Exit early if there are no results
-	if(!any_replies)
+	if(scan->found_devices == 0)
 	{
 		printf("No devices replied on interface %s (%s/%i)\n\n",
-		       thread_data->iface, thread_data->ipstr, thread_data->dst_cidr);
+		       scan->iface, scan->ipstr, scan->dst_cidr);
 		return;
 	}
 
 	// If there is at least one result, print header
 	printf("ARP scan on interface %s (%s/%i) finished\n",
-	       thread_data->iface, thread_data->ipstr, thread_data->dst_cidr);
+	       scan->iface, scan->ipstr, scan->dst_cidr);
 	printf("%-16s %-16s %-24s %-17s  %s\n",
 	       "IP address", "Interface", "Hostname", "MAC address", "Reply rate");
 
 	// Add our own IP address to the results so IP conflicts can be detected
 	// (our own IP address is not included in the ARP scan)
-	for(unsigned int i = 0; i < thread_data->total_scans; i++)
-		add_result(&thread_data->src_addr.sin_addr, thread_data->mac, thread_data, i);
+	const uint32_t own = ntohl(scan->src_addr.sin_addr.s_addr) - ntohl(scan->dst_addr.sin_addr.s_addr);
+	if(own < scan->result_size)
+		scan->probes[own] = scan->total_scans;
+	for(unsigned int i = 0; i < scan->total_scans; i++)
+		add_result(&scan->src_addr.sin_addr, scan->mac, scan, i);
 
 	// Print results
-	for(unsigned int i = 0; i < thread_data->result_size; i++)
+	for(unsigned int i = 0; i < scan->result_size; i++)
 	{
 		unsigned int j = 0, replied_devices = 0;
 
@@ -543,21 +614,21 @@ static void print_results(struct thread_data *thread_data)
 		for(j = 0; j < MAX_MACS; j++)
 		{
 			// Check if result[i].mac[j] is all-zero, if so, skip this entry
-			unsigned char *mac = thread_data->extreme ?
-			                       thread_data->result_extreme[i].device[j].mac :
-			                       thread_data->result[i].device[j].mac;
+			unsigned char *mac = scan->extreme ?
+			                       scan->result_extreme[i].device[j].mac :
+			                       scan->result[i].device[j].mac;
 			if(memcmp(mac, "\x00\x00\x00\x00\x00\x00", 6) == 0)
 				break;
 
 			bool replied = false;
 			unsigned char replies = 0u;
 			unsigned char multiple_replies = 0;
-			const unsigned char *rp = thread_data->extreme ?
-							thread_data->result_extreme[i].device[j].replied :
-							thread_data->result[i].device[j].replied;
+			const unsigned char *rp = scan->extreme ?
+							scan->result_extreme[i].device[j].replied :
+							scan->result[i].device[j].replied;
 
 			// Check if IP address replied
-			for(unsigned int k = 0; k < thread_data->total_scans; k++)
+			for(unsigned int k = 0; k < scan->probes[i]; k++)
 			{
 				replied |= rp[k] > 0;
 				replies += rp[k] > 0 ? 1 : 0;
@@ -571,35 +642,50 @@ static void print_results(struct thread_data *thread_data)
 
 			// Convert IP address to string
 			struct in_addr ip = { 0 };
-			ip.s_addr = htonl(ntohl(thread_data->dst_addr.sin_addr.s_addr) + i);
-			inet_ntop(AF_INET, &ip, thread_data->ipstr, INET_ADDRSTRLEN);
+			ip.s_addr = htonl(ntohl(scan->dst_addr.sin_addr.s_addr) + i);
+			inet_ntop(AF_INET, &ip, scan->ipstr, INET_ADDRSTRLEN);
 
 			// Print MAC address
 			printf("%-16s %-16s %-24s %02x:%02x:%02x:%02x:%02x:%02x  %3u %%\n",
-			       thread_data->ipstr, thread_data->iface,
+			       scan->ipstr, scan->iface,
 			       get_hostname(&ip),
 			       mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-			       replies * 100 / thread_data->total_scans);
+			       replies * 100u / scan->probes[i]);
 
 #ifdef DEBUG
-			for(unsigned int k = 0; k < thread_data->total_scans; k++)
+			for(unsigned int k = 0; k < scan->probes[i]; k++)
 				printf(" %s", rp[k] > 0 ? "X" : "-");
 #endif
 		if(multiple_replies > 0)
 			printf("INFO: Received multiple replies from %02x:%02x:%02x:%02x:%02x:%02x for %s in %i scan%s\n",
 			       mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-			       thread_data->ipstr, multiple_replies, multiple_replies > 1 ? "s" : "");
+			       scan->ipstr, multiple_replies, multiple_replies > 1 ? "s" : "");
 		}
 
 		// Print warning if we received multiple replies
 		if(replied_devices > 1)
 			printf("WARNING: Received replies for %s from %u devices\n",
-			       thread_data->ipstr, replied_devices);
+			       scan->ipstr, replied_devices);
 	}
 	putc('\n', stdout);
 }
 
-int run_arp_scan(const bool scan_all, const bool extreme_mode)
+/**
+ * Scan all local IPv4 networks for devices using ARP
+ *
+ * All interfaces are scanned concurrently from a single thread: requests are
+ * sent at the given rate per interface and replies are collected using epoll
+ * as they arrive. New devices are printed immediately, the detailed results
+ * (reply rates, IP conflicts) once the scan is complete.
+ *
+ * @param scan_all Scan also networks larger than /24
+ * @param extreme_mode Scan all networks, 10x more often and without giving up
+ *                     on silent addresses
+ * @param rate ARP requests per second and interface (0 = default)
+ * @param update_neigh Add found devices to the kernel's neighbor cache
+ * @return Exit code
+ */
+int run_arp_scan(const bool scan_all, const bool extreme_mode, unsigned int rate, const bool update_neigh)
 {
 	// Check if we are capable of sending ARP packets
 	if(!check_capability(CAP_NET_RAW))
@@ -608,28 +694,51 @@ int run_arp_scan(const bool scan_all, const bool extreme_mode)
 		return EXIT_FAILURE;
 	}
 
+	// Adding neighbors needs more privileges
+	int nl_fd = -1;
+	if(update_neigh)
+	{
+		if(!check_capability(CAP_NET_ADMIN))
+		{
+			puts("Error: Insufficient permissions or capabilities (needs CAP_NET_ADMIN). Try running as root (sudo)");
+			return EXIT_FAILURE;
+		}
+		nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+		if(nl_fd < 0)
+		{
+			printf("Error: Unable to open netlink socket: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(rate == 0)
+		rate = ARP_DEFAULT_RATE;
+	const double interval = 1.0 / rate;
+
 	puts("Discovering IPv4 hosts on the network using the Address Resolution Protocol (ARP)...\n");
 
-	// Get interface names for available interfaces on this machine
-	// and launch a thread for each one
-	pthread_t scanthread[MAXTHREADS];
-	pthread_attr_t attr;
-	// Initialize thread attributes object with default attribute values
-	pthread_attr_init(&attr);
+	const int epoll_fd = epoll_create1(0);
+	if(epoll_fd < 0)
+	{
+		printf("Error: Unable to create epoll instance: %s\n", strerror(errno));
+		if(nl_fd > -1)
+			close(nl_fd);
+		return EXIT_FAILURE;
+	}
 
 	struct ifaddrs *addrs, *tmp;
 	getifaddrs(&addrs);
 	tmp = addrs;
 
 	// Loop until there are no more interfaces available
-	// or we reached the maximum number of threads
-	unsigned int tid = 0;
+	// or we reached the maximum number of interfaces
+	unsigned int num = 0;
 
-	struct thread_data thread_data[MAXTHREADS] = {0};
+	struct scan_data scans[MAXIFACES] = {0};
 
-	while(tmp != NULL && tid < MAXTHREADS)
+	while(tmp != NULL && num < MAXIFACES)
 	{
-		// Create a thread for interfaces of type AF_INET
+		// Scan interfaces of type AF_INET
 		if(tmp->ifa_addr && tmp->ifa_addr->sa_family == AF_INET)
 		{
 			// Skip interface scan if ...
@@ -644,29 +753,38 @@ int run_arp_scan(const bool scan_all, const bool extreme_mode)
 				continue;
 			}
 
-			thread_data[tid].ifa = tmp;
-			strncpy(thread_data[tid].iface, tmp->ifa_name, sizeof(thread_data[tid].iface) - 1);
+			struct scan_data *scan = &scans[num];
+			scan->fd = -1;
+			scan->ifa = tmp;
+			strncpy(scan->iface, tmp->ifa_name, sizeof(scan->iface) - 1);
 
 			// Get interface IPv4 address
-			memcpy(&thread_data[tid].src_addr, tmp->ifa_addr, sizeof(thread_data[tid].src_addr));
-			inet_ntop(AF_INET, &thread_data[tid].src_addr.sin_addr, thread_data[tid].ipstr, INET_ADDRSTRLEN);
+			memcpy(&scan->src_addr, tmp->ifa_addr, sizeof(scan->src_addr));
+			inet_ntop(AF_INET, &scan->src_addr.sin_addr, scan->ipstr, INET_ADDRSTRLEN);
 
-			thread_data[tid].extreme = extreme_mode;
-			thread_data[tid].scan_all = scan_all || extreme_mode;
-			thread_data[tid].total_scans = extreme_mode ? 10*NUM_SCANS : NUM_SCANS;
+			scan->extreme = extreme_mode;
+			scan->scan_all = scan_all || extreme_mode;
+			scan->total_scans = extreme_mode ? 10*NUM_SCANS : NUM_SCANS;
 
 			// Always skip the loopback interface
-			if(thread_data[tid].src_addr.sin_addr.s_addr != htonl(INADDR_LOOPBACK))
+			if(scan->src_addr.sin_addr.s_addr != htonl(INADDR_LOOPBACK))
 			{
-				// Create thread
-				if(pthread_create(&scanthread[tid], &attr, arp_scan_iface, &thread_data[tid] ) != 0)
+				arp_scan_iface(scan);
+				if(scan->status == STATUS_SCANNING)
 				{
-					printf("Unable to launch thread for interface %s, skipping...\n",
-						tmp->ifa_name);
+					struct epoll_event ev = { .events = EPOLLIN, .data.ptr = scan };
+					if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, scan->fd, &ev) != 0)
+					{
+						scan->error = strerror(errno);
+						scan->status = STATUS_ERROR;
+					}
+					else
+						printf("Scanning interface %s (%s/%i) at %u requests/s...\n",
+						       scan->iface, scan->ipstr, scan->dst_cidr, rate);
 				}
 
-				// Increase thread ID
-				tid++;
+				// Increase interface counter
+				num++;
 			}
 		}
 
@@ -674,73 +792,59 @@ int run_arp_scan(const bool scan_all, const bool extreme_mode)
 		tmp = tmp->ifa_next;
 	}
 
-	// Wait for all threads to finish scanning
-	bool all_done = false;
-	unsigned int progress = 0;
-	while(!all_done)
+	printf("\n%-16s %-16s %s\n", "IP address", "Interface", "MAC address");
+
+	// Send requests and process replies until all interfaces are done
+	const double start = double_time();
+	for(unsigned int i = 0; i < num; i++)
+		scans[i].round_start = scans[i].next_send = start;
+	while(true)
 	{
-		all_done = true;
-		uint64_t num_scans = 0, total_scans = 0;
-		for(unsigned int i = 0; i < tid; i++)
+		const double now = double_time();
+		double wakeup = 0.0;
+		for(unsigned int i = 0; i < num; i++)
 		{
-			if(thread_data[i].status == STATUS_INITIALIZING ||
-			   thread_data[i].status == STATUS_SCANNING)
-			{
-				// At least one thread is still scanning
-				all_done = false;
-			}
-			if(thread_data[i].status == STATUS_SCANNING ||
-			   thread_data[i].status == STATUS_COMPLETE)
-			{
-				// Also add up scans for completed threads
-				num_scans += thread_data[i].scanned_addresses;
-				total_scans +=  thread_data[i].total_scans * thread_data[i].result_size;
-			}
+			const double next = scan_step(&scans[i], now, interval);
+			if(next > 0.0 && (wakeup <= 0.0 || next < wakeup))
+				wakeup = next;
 		}
-		if(!all_done)
-		{
-			// Calculate progress (total number of scans / total number of addresses)
-			// We add 1 to total_scans to avoid division by zero
-			const unsigned int new_progress = 100 * (unsigned int)(num_scans / (total_scans + 1));
-			if(new_progress > progress)
-			{
-				// Print progress
-				printf(" %u%% ", new_progress);
-
-				// Update progress
-				progress = new_progress;
-			}
-
-			putc('.', stdout);
 
-			// Flush stdout
-			fflush(stdout);
+		// All interfaces are done
+		if(wakeup <= 0.0)
+			break;
 
-			// Sleep for 1 second
-			sleepms(1000);
+		struct epoll_event events[MAXIFACES];
+		const int timeout = MAX(0, (int)(1e3*(wakeup - now)));
+		const int n = epoll_wait(epoll_fd, events, MAXIFACES, timeout);
+		for(int i = 0; i < n; i++)
+		{
+			struct scan_data *scan = events[i].data.ptr;
+			if(scan->status == STATUS_SCANNING && read_arp(scan, nl_fd) != 0)
+				scan->status = STATUS_ERROR;
 		}
 	}
-	puts("100%\n");
-
-	// Wait for all threads to join back with us
-	for(unsigned int i = 0; i < tid; i++)
-		pthread_join(scanthread[i], NULL);
-
-	// Destroy the thread attributes object, since we are done with it
-	pthread_attr_destroy(&attr);
+	putc('\n', stdout);
 
 	// Free linked-list of interfaces on this client
 	freeifaddrs(addrs);
+	close(epoll_fd);
+	if(nl_fd > -1)
+		close(nl_fd);
 
-	// Loop over thread results and print them
-	for(unsigned int i = 0; i < tid; i++)
+	// Loop over interface results and print them
+	for(unsigned int i = 0; i < num; i++)
 	{
+		// Close socket
+		if(scans[i].fd > -1)
+			close(scans[i].fd);
+
 		// Print results
-		print_results(&thread_data[i]);
+		print_results(&scans[i]);
 
 		// Free allocated memory
-		if(thread_data[i].result != NULL)
-			free(thread_data[i].result);
+		if(scans[i].result != NULL)
+			free(scans[i].result);
+		free(scans[i].probes);
 	}
 
 	return EXIT_SUCCESS;
@@ -11,6 +11,6 @@
 #ifndef ARP_SCAN_H
 #define ARP_SCAN_H
 
-int run_arp_scan(const bool scan_all, const bool extreme_mode);
+int run_arp_scan(const bool scan_all, const bool extreme_mode, unsigned int rate, const bool update_neigh);
 
 #endif // ARP_SCAN_H
@@ -0,0 +1,1020 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  DNS load generator and latency benchmark
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#define FTLDNS
+#include "dnsmasq/dnsmasq.h"
+#undef __USE_XOPEN
+#include "FTL.h"
+#include "tools/dns-bench.h"
+#include "log.h"
+// cli_info()
+#include "args.h"
+// struct config
+#include "config/config.h"
+// get_query_status_str(), strtolower()
+#include "datastructure.h"
+// get_status_ede()
+#include "dnsmasq_interface.h"
+#include "database/sqlite3.h"
+// ppoll()
+#include <poll.h>
+
+// Replies arriving later are counted as timeouts (seconds)
+#define BENCH_TIMEOUT 2.0
+
+// Concurrent TCP connections, each of them carries one query at a time
+#define BENCH_TCP_CONNS 16u
+
+// Maximum number of queries sent at once when falling behind the target rate
+#define BENCH_BURST 64u
+
+// UDP payload size announced in the OPT record
+#define BENCH_UDP_SIZE 1232u
+
+// First address used for clients given via ECS (10.0.0.1)
+#define BENCH_CLIENT_NET 0x0a000001u
+
+// Latencies are collected per query status plus one bucket for blocked
+// replies which do not tell why they were blocked
+#define BENCH_BLOCKED QUERY_STATUS_MAX
+#define BENCH_BUCKETS (QUERY_STATUS_MAX + 1)
+
+// DNS types of the query types stored in the database
+static const uint16_t qtypes[TYPE_MAX] = {
+	[TYPE_A] = T_A,
+	[TYPE_AAAA] = T_AAAA,
+	[TYPE_ANY] = T_ANY,
+	[TYPE_SRV] = T_SRV,
+	[TYPE_SOA] = T_SOA,
+	[TYPE_PTR] = T_PTR,
+	[TYPE_TXT] = T_TXT,
+	[TYPE_NAPTR] = T_NAPTR,
+	[TYPE_MX] = T_MX,
+	[TYPE_DS] = T_DS,
+	[TYPE_RRSIG] = T_RRSIG,
+	[TYPE_DNSKEY] = T_DNSKEY,
+	[TYPE_NS] = T_NS,
+	[TYPE_SVCB] = 64,
+	[TYPE_HTTPS] = 65
+};
+
+struct bench_query {
+	char *name;
+	uint16_t qtype;
+	// When the answer is expected to expire in the cache of the server
+	double expires;
+	// First query of the corpus with the same name and type, it holds the
+	// expiry of all of them
+	size_t first;
+	// Replay only: time since the start of the window and the original
+	// client (family as used by ECS: 1 = IPv4, 2 = IPv6, 0 = unknown)
+	double offset;
+	unsigned char addr[16];
+	uint8_t family;
+};
+
+struct bench_corpus {
+	struct bench_query *queries;
+	size_t num;
+	size_t size;
+};
+
+// Query in flight, indexed by DNS ID
+struct bench_slot {
+	double sent;
+	size_t query;
+	unsigned int conn;
+	bool used;
+};
+
+struct bench_conn {
+	int fd;
+	// Reassembly buffer for TCP replies
+	unsigned char *buf;
+	size_t len;
+	// ID of the query waiting for a reply (TCP only), -1 if idle
+	int id;
+};
+
+struct bench_latency {
+	uint32_t *usec;
+	size_t num;
+	size_t size;
+};
+
+struct bench {
+	const struct dns_bench_opts *opts;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct bench_corpus corpus;
+	struct bench_slot *slots;
+	struct bench_conn *conns;
+	unsigned int nconns;
+	struct bench_latency latency[BENCH_BUCKETS];
+	uint64_t sent;
+	uint64_t replies;
+	uint64_t timeouts;
+	uint64_t errors;
+	double last_reply;
+};
+
+struct bench_reply {
+	uint16_t id;
+	int ede;
+	const unsigned char *ede_text;
+	size_t ede_len;
+	uint32_t ttl;
+};
+
+// Check that a name can be encoded as sequence of labels
+static bool valid_name(const char *name)
+{
+	const size_t len = strlen(name);
+	if(len == 0 || len > 253)
+		return false;
+
+	for(const char *label = name; *label != '\0';)
+	{
+		const char *dot = strchr(label, '.');
+		const size_t llen = dot != NULL ? (size_t)(dot - label) : strlen(label);
+		if(llen == 0 || llen > 63)
+			return false;
+		label += dot != NULL ? llen + 1 : llen;
+	}
+
+	return true;
+}
+
+static bool add_query(struct bench_corpus *corpus, const char *name, const uint16_t qtype)
+{
+	if(!valid_name(name) || qtype == 0)
+		return true;
+
+	if(corpus->num == corpus->size)
+	{
+		const size_t size = corpus->size > 0 ? 2*corpus->size : 1024;
+		struct bench_query *queries = realloc(corpus->queries, size * sizeof(*queries));
+		if(queries == NULL)
+			return false;
+		corpus->queries = queries;
+		corpus->size = size;
+	}
+
+	struct bench_query *query = &corpus->queries[corpus->num];
+	if((query->name = strdup(name)) == NULL)
+		return false;
+	query->qtype = qtype;
+	query->expires = 0.0;
+	query->first = corpus->num;
+	query->offset = 0.0;
+	query->family = 0;
+	corpus->num++;
+
+	return true;
+}
+
+// Get the DNS type from its name ("AAAA") or number ("TYPE28")
+static uint16_t parse_qtype(const char *str)
+{
+	if(str == NULL)
+		return T_A;
+
+	for(enum query_type type = TYPE_A; type < TYPE_MAX; type++)
+		if(qtypes[type] != 0 && strcasecmp(str, get_query_type_str(type, NULL, NULL)) == 0)
+			return qtypes[type];
+
+	unsigned int num = 0;
+	if(sscanf(str, "TYPE%u", &num) == 1 && num > 0 && num <= UINT16_MAX)
+		return num;
+
+	return 0;
+}
+
+// Read queries from file (one per line, the domain is optionally followed by
+// the query type, comment lines are ignored)
+static bool read_corpus(struct bench_corpus *corpus, const char *filename)
+{
+	FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+	if(fp == NULL)
+	{
+		log_err("Cannot open %s: %s", filename, strerror(errno));
+		return false;
+	}
+
+	bool okay = true;
+	char *line = NULL;
+	size_t len = 0;
+	while(okay && getline(&line, &len, fp) != -1)
+	{
+		char *saveptr = NULL;
+		char *domain = strtok_r(line, " \t\r\n", &saveptr);
+		if(domain == NULL || domain[0] == '#')
+			continue;
+
+		// Remove trailing dot of fully qualified domain names
+		const size_t dlen = strlen(domain);
+		if(dlen > 1 && domain[dlen - 1] == '.')
+			domain[dlen - 1] = '\0';
+		strtolower(domain);
+
+		const uint16_t qtype = parse_qtype(strtok_r(NULL, " \t\r\n", &saveptr));
+		okay = add_query(corpus, domain, qtype);
+	}
+
+	free(line);
+	if(fp != stdin)
+		fclose(fp);
+
+	return okay;
+}
+
+// Get the DNS type of a query type as stored in the database, 0 if unknown
+static uint16_t __attribute__((pure)) db_qtype(const int type)
+{
+	// Query types not known to FTL are stored with an offset of 100
+	if(type > 100 && type <= 100 + UINT16_MAX)
+		return type - 100;
+	else if(type > TYPE_NONE && type < TYPE_MAX)
+		return qtypes[type];
+
+	return 0;
+}
+
+// Sample queries from the long-term database so the mix of domains and
+// query types (and thereby of blocked, cached and forwarded queries) matches
+// the real traffic of this Pi-hole
+static bool sample_corpus(struct bench_corpus *corpus, const unsigned int samples)
+{
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	bool okay = false;
+	const char *dbfile = config.files.database.v.s;
+
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		log_err("Unable to open long-term database %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_sample_corpus;
+	}
+
+	// Domains are only looked up for the sampled queries
+	if(sqlite3_prepare_v2(db, "SELECT domain, type FROM queries "
+	                          "WHERE id IN (SELECT id FROM query_storage ORDER BY random() LIMIT ?1)",
+	                      -1, &stmt, NULL) != SQLITE_OK ||
+	   sqlite3_bind_int64(stmt, 1, samples) != SQLITE_OK)
+	{
+		log_err("Unable to sample queries from %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_sample_corpus;
+	}
+
+	int rc;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		const uint16_t qtype = db_qtype(sqlite3_column_int(stmt, 1));
+
+		if(domain != NULL && !add_query(corpus, domain, qtype))
+			goto end_of_sample_corpus;
+	}
+	if(rc != SQLITE_DONE)
+	{
+		log_err("Unable to sample queries from %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_sample_corpus;
+	}
+
+	okay = true;
+
+end_of_sample_corpus:
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	return okay;
+}
+
+// Read the queries of a time window from the long-term database in the order
+// they have been received
+static bool replay_corpus(struct bench_corpus *corpus, const struct dns_bench_opts *opts)
+{
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	bool okay = false;
+	const char *dbfile = config.files.database.v.s;
+	// Corpus index of every row, SIZE_MAX if the query has been skipped
+	size_t *rows = NULL;
+	size_t nrows = 0, rows_size = 0;
+
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		log_err("Unable to open long-term database %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_replay_corpus;
+	}
+
+	// Every row also gets the row number of the first query with the same
+	// name and type
+	if(sqlite3_prepare_v2(db, "SELECT timestamp, domain, type, client, MIN(n) OVER (PARTITION BY domain, type) "
+	                          "FROM (SELECT timestamp, domain, type, client, ROW_NUMBER() OVER (ORDER BY timestamp, id) - 1 AS n "
+	                                "FROM queries WHERE timestamp >= ?1 AND timestamp < ?2) "
+	                          "ORDER BY n",
+	                      -1, &stmt, NULL) != SQLITE_OK ||
+	   sqlite3_bind_double(stmt, 1, opts->from) != SQLITE_OK ||
+	   sqlite3_bind_double(stmt, 2, opts->until) != SQLITE_OK)
+	{
+		log_err("Unable to read queries from %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_replay_corpus;
+	}
+
+	int rc;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		if(nrows == rows_size)
+		{
+			const size_t size = rows_size > 0 ? 2*rows_size : 1024;
+			size_t *new_rows = realloc(rows, size * sizeof(*new_rows));
+			if(new_rows == NULL)
+				goto end_of_replay_corpus;
+			rows = new_rows;
+			rows_size = size;
+		}
+		rows[nrows] = SIZE_MAX;
+
+		const double timestamp = sqlite3_column_double(stmt, 0);
+		const char *domain = (const char*)sqlite3_column_text(stmt, 1);
+		const uint16_t qtype = db_qtype(sqlite3_column_int(stmt, 2));
+		const char *client = (const char*)sqlite3_column_text(stmt, 3);
+		const sqlite3_int64 first = sqlite3_column_int64(stmt, 4);
+
+		const size_t num = corpus->num;
+		if(domain != NULL && !add_query(corpus, domain, qtype))
+			goto end_of_replay_corpus;
+		if(corpus->num == num)
+		{
+			nrows++;
+			continue;
+		}
+		rows[nrows++] = num;
+
+		struct bench_query *query = &corpus->queries[num];
+		query->offset = timestamp - opts->from;
+		if(first >= 0 && (size_t)first < num)
+			query->first = rows[first];
+		if(client != NULL && inet_pton(AF_INET, client, query->addr) == 1)
+			query->family = 1;
+		else if(client != NULL && inet_pton(AF_INET6, client, query->addr) == 1)
+			query->family = 2;
+	}
+	if(rc != SQLITE_DONE)
+	{
+		log_err("Unable to read queries from %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_replay_corpus;
+	}
+
+	okay = true;
+
+end_of_replay_corpus:
+	if(rows != NULL)
+		free(rows);
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	return okay;
+}
+
+// Parse "ip" or "ip#port", localhost and the configured port if NULL
+static bool bench_server(struct bench *bench, const char *server, char *str, const size_t size)
+{
+	char ip[INET6_ADDRSTRLEN] = "127.0.0.1";
+	unsigned int port = config.dns.port.v.u16;
+	if(server != NULL)
+	{
+		const char *hash = strchr(server, '#');
+		const size_t iplen = hash != NULL ? (size_t)(hash - server) : strlen(server);
+		if(iplen >= sizeof(ip) ||
+		   (hash != NULL && (sscanf(hash + 1, "%u", &port) != 1 || port == 0 || port > UINT16_MAX)))
+			return false;
+		memcpy(ip, server, iplen);
+		ip[iplen] = '\0';
+	}
+
+	struct sockaddr_in *in4 = (struct sockaddr_in*)&bench->addr;
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6*)&bench->addr;
+	memset(&bench->addr, 0, sizeof(bench->addr));
+	if(inet_pton(AF_INET, ip, &in4->sin_addr) == 1)
+	{
+		in4->sin_family = AF_INET;
+		in4->sin_port = htons(port);
+		bench->addrlen = sizeof(*in4);
+	}
+	else if(inet_pton(AF_INET6, ip, &in6->sin6_addr) == 1)
+	{
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons(port);
+		bench->addrlen = sizeof(*in6);
+	}
+	else
+		return false;
+
+	snprintf(str, size, "%s#%u", ip, port);
+	return true;
+}
+
+static int open_conn(struct bench *bench)
+{
+	const bool tcp = bench->opts->tcp;
+	const int fd = socket(bench->addr.ss_family, tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if(fd < 0)
+	{
+		log_err("Cannot create socket: %s", strerror(errno));
+		return -1;
+	}
+
+	// Connected UDP sockets receive only replies from the server
+	if(connect(fd, (struct sockaddr*)&bench->addr, bench->addrlen) != 0 ||
+	   fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+	{
+		log_err("Cannot connect to DNS server: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	// Replies to a burst of queries must not be dropped by us
+	const int rcvbuf = 4 * 1024 * 1024;
+	if(!tcp)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	return fd;
+}
+
+// Close and reopen a TCP connection, e.g., after the server closed it or a
+// query timed out. The query waiting on it (if any) is lost
+static bool reconnect(struct bench *bench, struct bench_conn *conn)
+{
+	if(conn->id >= 0)
+		bench->slots[conn->id].used = false;
+	conn->id = -1;
+	conn->len = 0;
+	close(conn->fd);
+	return (conn->fd = open_conn(bench)) >= 0;
+}
+
+// Build a query (behind the two bytes reserved for the TCP length prefix)
+static size_t build_query(const struct bench *bench, unsigned char *pkt, const uint16_t id,
+                          const struct bench_query *query, const unsigned int client)
+{
+	unsigned char *p = pkt + 2;
+
+	// Header: recursion desired, one question and one OPT record
+	PUTSHORT(id, p);
+	PUTSHORT(HB3_RD << 8, p);
+	PUTSHORT(1, p);
+	PUTSHORT(0, p);
+	PUTSHORT(0, p);
+	PUTSHORT(1, p);
+
+	// Question as sequence of labels (validated when reading the corpus)
+	for(const char *label = query->name; *label != '\0';)
+	{
+		const char *dot = strchr(label, '.');
+		const size_t len = dot != NULL ? (size_t)(dot - label) : strlen(label);
+		*p++ = len;
+		memcpy(p, label, len);
+		p += len;
+		label += dot != NULL ? len + 1 : len;
+	}
+	*p++ = 0;
+	PUTSHORT(query->qtype, p);
+	PUTSHORT(C_IN, p);
+
+	// OPT record, the server can add EDE options to replies only if the
+	// query had one
+	*p++ = 0;
+	PUTSHORT(T_OPT, p);
+	PUTSHORT(BENCH_UDP_SIZE, p);
+	PUTLONG(0, p);
+	unsigned char *rdlen = p;
+	p += 2;
+	if(bench->opts->replay && bench->opts->ecs && query->family != 0)
+	{
+		// Client subnet holding only the original client address
+		const unsigned int addrlen = query->family == 1 ? 4 : 16;
+		PUTSHORT(EDNS0_OPTION_CLIENT_SUBNET, p);
+		PUTSHORT(4 + addrlen, p);
+		PUTSHORT(query->family, p);
+		*p++ = 8*addrlen; // Source prefix length
+		*p++ = 0; // Scope prefix length
+		memcpy(p, query->addr, addrlen);
+		p += addrlen;
+	}
+	else if(bench->opts->clients > 0 && bench->opts->mac)
+	{
+		// Locally administered MAC address
+		PUTSHORT(EDNS0_OPTION_MAC, p);
+		PUTSHORT(6, p);
+		*p++ = 0x02;
+		*p++ = 0x00;
+		PUTLONG(client, p);
+	}
+	else if(bench->opts->clients > 0)
+	{
+		// Client subnet holding only the client address
+		PUTSHORT(EDNS0_OPTION_CLIENT_SUBNET, p);
+		PUTSHORT(8, p);
+		PUTSHORT(1, p); // IPv4
+		*p++ = 32; // Source prefix length
+		*p++ = 0; // Scope prefix length
+		PUTLONG(BENCH_CLIENT_NET + client, p);
+	}
+	PUTSHORT(p - rdlen - 2, rdlen);
+
+	// TCP length prefix
+	const size_t len = p - pkt - 2;
+	PUTSHORT(len, pkt);
+
+	return len;
+}
+
+// Skip a (possibly compressed) name
+static const unsigned char * __attribute__((pure)) bench_skip_name(const unsigned char *p, const unsigned char *end)
+{
+	while(p < end)
+	{
+		if(*p == 0)
+			return p + 1;
+		if((*p & 0xc0) == 0xc0)
+			return p + 2 <= end ? p + 2 : NULL;
+		p += *p + 1;
+	}
+
+	return NULL;
+}
+
+// Get ID, EDE and the lowest TTL of all records of a reply
+static bool parse_reply(const unsigned char *pkt, const size_t len, struct bench_reply *reply)
+{
+	if(len < sizeof(struct dns_header))
+		return false;
+
+	// The receive buffer is not necessarily aligned
+	struct dns_header hdr;
+	memcpy(&hdr, pkt, sizeof(hdr));
+	const struct dns_header *header = &hdr;
+	const unsigned char *p = pkt + sizeof(struct dns_header), *end = pkt + len;
+	reply->id = ntohs(header->id);
+	reply->ede = -1;
+	reply->ede_text = NULL;
+	reply->ede_len = 0;
+	reply->ttl = UINT32_MAX;
+
+	for(unsigned int i = 0; i < ntohs(header->qdcount); i++)
+	{
+		if((p = bench_skip_name(p, end)) == NULL || p + 4 > end)
+			return false;
+		p += 4;
+	}
+
+	const unsigned int records = ntohs(header->ancount) + ntohs(header->nscount) + ntohs(header->arcount);
+	for(unsigned int i = 0; i < records; i++)
+	{
+		if((p = bench_skip_name(p, end)) == NULL || p + 10 > end)
+			return false;
+
+		uint16_t type, rdlen;
+		uint32_t ttl;
+		GETSHORT(type, p);
+		p += 2;
+		GETLONG(ttl, p);
+		GETSHORT(rdlen, p);
+		if(p + rdlen > end)
+			return false;
+
+		if(type == T_OPT)
+		{
+			// Get the first EDE option
+			const unsigned char *opt = p;
+			while(opt + 4 <= p + rdlen)
+			{
+				uint16_t code, olen;
+				GETSHORT(code, opt);
+				GETSHORT(olen, opt);
+				if(opt + olen > p + rdlen)
+					break;
+				if(code == EDNS0_OPTION_EDE && olen >= 2 && reply->ede < 0)
+				{
+					uint16_t ede;
+					const unsigned char *o = opt;
+					GETSHORT(ede, o);
+					reply->ede = ede;
+					reply->ede_text = o;
+					reply->ede_len = olen - 2;
+				}
+				opt += olen;
+			}
+		}
+		else if(ttl < reply->ttl)
+			reply->ttl = ttl;
+
+		p += rdlen;
+	}
+
+	return true;
+}
+
+// Derive the query status from the reply. Blocked replies carry the reason as
+// EDE text (if dns.blocking.edns is TEXT). Replies from the cache are not
+// marked, a reply is assumed to be cached if an earlier reply to the same
+// query has not expired yet
+static unsigned int reply_status(struct bench_query *query, const struct bench_reply *reply, const double now)
+{
+	if(reply->ede == EDE_BLOCKED)
+	{
+		for(enum query_status status = QUERY_UNKNOWN; status < QUERY_STATUS_MAX; status++)
+		{
+			const char *text = NULL;
+			if(get_status_ede(status, &text) == EDE_BLOCKED && text != NULL &&
+			   strlen(text) == reply->ede_len && memcmp(text, reply->ede_text, reply->ede_len) == 0)
+				return status;
+		}
+		return BENCH_BLOCKED;
+	}
+	else if(reply->ede == EDE_SYNTHESIZED)
+		return QUERY_CACHE;
+
+	if(now < query->expires)
+		return QUERY_CACHE;
+
+	if(reply->ttl != UINT32_MAX)
+		query->expires = now + reply->ttl;
+
+	return QUERY_FORWARDED;
+}
+
+static bool add_latency(struct bench_latency *latency, const double seconds)
+{
+	if(latency->num == latency->size)
+	{
+		const size_t size = latency->size > 0 ? 2*latency->size : 1024;
+		uint32_t *usec = realloc(latency->usec, size * sizeof(*usec));
+		if(usec == NULL)
+			return false;
+		latency->usec = usec;
+		latency->size = size;
+	}
+
+	latency->usec[latency->num++] = 1e6*seconds;
+	return true;
+}
+
+static void handle_reply(struct bench *bench, const unsigned char *pkt, const size_t len, const double now)
+{
+	struct bench_reply reply;
+	if(!parse_reply(pkt, len, &reply))
+	{
+		bench->errors++;
+		return;
+	}
+
+	// Ignore late replies to queries counted as timeouts already
+	struct bench_slot *slot = &bench->slots[reply.id];
+	if(!slot->used)
+		return;
+	slot->used = false;
+
+	bench->replies++;
+	bench->last_reply = now;
+	const struct bench_query *query = &bench->corpus.queries[slot->query];
+	const unsigned int status = reply_status(&bench->corpus.queries[query->first], &reply, now);
+	if(!add_latency(&bench->latency[status], now - slot->sent))
+		bench->errors++;
+}
+
+static bool read_replies(struct bench *bench, struct bench_conn *conn, const double now)
+{
+	if(!bench->opts->tcp)
+	{
+		ssize_t len;
+		while((len = recv_nowarn(conn->fd, conn->buf, UINT16_MAX, 0)) > 0)
+			handle_reply(bench, conn->buf, len, now);
+		if(errno != EAGAIN)
+			bench->errors++;
+		return true;
+	}
+
+	const ssize_t len = recv_nowarn(conn->fd, conn->buf + conn->len, UINT16_MAX + 2u - conn->len, 0);
+	if(len < 0 && errno == EAGAIN)
+		return true;
+	if(len <= 0)
+	{
+		// Connection closed by the server (dnsmasq limits the number
+		// of queries per connection)
+		if(conn->id >= 0)
+			bench->errors++;
+		return reconnect(bench, conn);
+	}
+
+	conn->len += len;
+	uint16_t msglen = 0;
+	const unsigned char *p = conn->buf;
+	if(conn->len >= 2)
+		GETSHORT(msglen, p);
+	if(conn->len < 2u + msglen)
+		return true;
+
+	handle_reply(bench, conn->buf + 2, msglen, now);
+	conn->len -= 2u + msglen;
+	memmove(conn->buf, conn->buf + 2 + msglen, conn->len);
+	conn->id = -1;
+
+	return true;
+}
+
+static bool send_query(struct bench *bench, const double now)
+{
+	// Use the next idle TCP connection, sending falls behind the target
+	// rate if there is none
+	unsigned int c = 0;
+	if(bench->opts->tcp)
+	{
+		for(c = 0; c < bench->nconns; c++)
+			if(bench->conns[(bench->sent + c) % bench->nconns].id < 0)
+				break;
+		if(c == bench->nconns)
+			return false;
+		c = (bench->sent + c) % bench->nconns;
+	}
+	struct bench_conn *conn = &bench->conns[c];
+
+	// More than 65536 queries in flight, the oldest one is lost
+	const uint16_t id = bench->sent & UINT16_MAX;
+	struct bench_slot *slot = &bench->slots[id];
+	if(slot->used)
+	{
+		bench->timeouts++;
+		slot->used = false;
+	}
+
+	unsigned char pkt[512];
+	const size_t query = bench->sent % bench->corpus.num;
+	const unsigned int client = bench->opts->clients > 0 ? bench->sent % bench->opts->clients : 0;
+	const size_t len = build_query(bench, pkt, id, &bench->corpus.queries[query], client);
+	bench->sent++;
+
+	const bool tcp = bench->opts->tcp;
+	if(send(conn->fd, tcp ? pkt : pkt + 2, tcp ? len + 2 : len, MSG_NOSIGNAL) < 0)
+	{
+		bench->errors++;
+		if(tcp)
+			reconnect(bench, conn);
+		return true;
+	}
+
+	slot->sent = now;
+	slot->query = query;
+	slot->conn = c;
+	slot->used = true;
+	if(tcp)
+		conn->id = id;
+
+	return true;
+}
+
+// Number of queries to be sent after the given time since the start
+static uint64_t __attribute__((pure)) queries_due(const struct bench *bench, const double elapsed)
+{
+	const struct dns_bench_opts *opts = bench->opts;
+	if(!opts->replay)
+		return (uint64_t)(elapsed * opts->rate) + 1;
+
+	uint64_t due = bench->sent;
+	while(due < bench->corpus.num && bench->corpus.queries[due].offset <= elapsed * opts->speed)
+		due++;
+	return due;
+}
+
+// Time since the start when the next query is due
+static double __attribute__((pure)) next_due(const struct bench *bench)
+{
+	const struct dns_bench_opts *opts = bench->opts;
+	if(!opts->replay)
+		return (double)bench->sent / opts->rate;
+
+	return bench->sent < bench->corpus.num ? bench->corpus.queries[bench->sent].offset / opts->speed : 0.0;
+}
+
+static int cmp_usec(const void *a, const void *b)
+{
+	const uint32_t ua = *(const uint32_t*)a, ub = *(const uint32_t*)b;
+	return ua < ub ? -1 : ua > ub;
+}
+
+// Latency percentile in milliseconds (latencies must be sorted)
+static double percentile(const struct bench_latency *latency, const double p)
+{
+	const size_t idx = p*(latency->num - 1) + 0.5;
+	return 1e-3*latency->usec[idx];
+}
+
+static void print_results(struct bench *bench, const double elapsed)
+{
+	const bool okay = bench->timeouts == 0 && bench->errors == 0;
+	log_info("%s Sent %lu queries, received %lu replies in %.1f s (%.0f replies/s)",
+	         okay ? cli_tick() : cli_cross(), (unsigned long)bench->sent,
+	         (unsigned long)bench->replies, elapsed, elapsed > 0.0 ? bench->replies/elapsed : 0.0);
+	if(!okay)
+		log_info("    %lu timeouts, %lu errors",
+		         (unsigned long)bench->timeouts, (unsigned long)bench->errors);
+	if(bench->replies == 0)
+		return;
+
+	log_info("\n%s Latency by query status (msec):", cli_info());
+	log_info("    %s%-28s %8s %8s %8s %8s %8s %8s%s", cli_bold(),
+	         "Status", "Count", "p50", "p90", "p99", "p99.9", "max", cli_normal());
+	for(unsigned int status = 0; status < BENCH_BUCKETS; status++)
+	{
+		struct bench_latency *latency = &bench->latency[status];
+		if(latency->num == 0)
+			continue;
+
+		qsort(latency->usec, latency->num, sizeof(*latency->usec), cmp_usec);
+		log_info("    %-28s %8zu %8.3f %8.3f %8.3f %8.3f %8.3f",
+		         status == BENCH_BLOCKED ? "BLOCKED" : get_query_status_str(status),
+		         latency->num, percentile(latency, 0.5), percentile(latency, 0.9),
+		         percentile(latency, 0.99), percentile(latency, 0.999),
+		         1e-3*latency->usec[latency->num - 1]);
+	}
+	log_info("\n    CACHE and FORWARDED are inferred from the TTLs of earlier replies");
+}
+
+/**
+ * Send queries to a DNS server at a fixed rate and report the latency of the
+ * replies broken down by query status.
+ *
+ * Queries are replayed from a file or sampled from the long-term database and
+ * optionally spread over many clients using ECS or MAC address options (which
+ * FTL uses to identify clients). Over UDP, any number of queries can be in
+ * flight, over TCP each of BENCH_TCP_CONNS connections carries one at a time.
+ *
+ * When replaying, the queries of a time window of the long-term database are
+ * sent with their original inter-arrival times (divided by the speed factor),
+ * optionally from their original clients via ECS.
+ */
+int run_dns_bench(const struct dns_bench_opts *opts)
+{
+	int ret = EXIT_FAILURE;
+	struct bench bench = { .opts = opts };
+	struct pollfd *pfds = NULL;
+
+	char server[INET6_ADDRSTRLEN + 8];
+	if(!bench_server(&bench, opts->server, server, sizeof(server)))
+	{
+		log_err("Invalid server address: %s", opts->server);
+		return EXIT_FAILURE;
+	}
+
+	if(opts->replay)
+	{
+		log_info("%s Reading queries received between %.0f and %.0f (%.0f s) from %s...", cli_info(),
+		         opts->from, opts->until, opts->until - opts->from, config.files.database.v.s);
+		if(!replay_corpus(&bench.corpus, opts))
+			goto end_of_run_dns_bench;
+	}
+	else if(opts->corpus != NULL)
+	{
+		log_info("%s Reading queries from %s...", cli_info(), opts->corpus);
+		if(!read_corpus(&bench.corpus, opts->corpus))
+			goto end_of_run_dns_bench;
+	}
+	else
+	{
+		log_info("%s Sampling %u queries from %s...", cli_info(), opts->samples, config.files.database.v.s);
+		if(!sample_corpus(&bench.corpus, opts->samples))
+			goto end_of_run_dns_bench;
+	}
+	if(bench.corpus.num == 0)
+	{
+		log_info("    No queries to send");
+		goto end_of_run_dns_bench;
+	}
+	log_info("    Got %zu queries\n", bench.corpus.num);
+
+	bench.nconns = opts->tcp ? BENCH_TCP_CONNS : 1u;
+	bench.slots = calloc(UINT16_MAX + 1u, sizeof(*bench.slots));
+	bench.conns = calloc(bench.nconns, sizeof(*bench.conns));
+	pfds = calloc(bench.nconns, sizeof(*pfds));
+	if(bench.slots == NULL || bench.conns == NULL || pfds == NULL)
+	{
+		log_err("Memory allocation failed in run_dns_bench()");
+		goto end_of_run_dns_bench;
+	}
+	for(unsigned int c = 0; c < bench.nconns; c++)
+	{
+		bench.conns[c].fd = -1;
+		bench.conns[c].id = -1;
+	}
+	for(unsigned int c = 0; c < bench.nconns; c++)
+	{
+		if((bench.conns[c].buf = malloc(UINT16_MAX + 2u)) == NULL ||
+		   (bench.conns[c].fd = open_conn(&bench)) < 0)
+			goto end_of_run_dns_bench;
+	}
+
+	if(opts->replay)
+		log_info("%s Replaying queries to %s over %s at %gx speed%s...",
+		         cli_info(), server, opts->tcp ? "TCP" : "UDP", opts->speed,
+		         opts->ecs ? " from their original clients (ECS)" : "");
+	else if(opts->clients > 0)
+		log_info("%s Sending queries to %s over %s at %u queries/s for %u s from %u clients (%s)...",
+		         cli_info(), server, opts->tcp ? "TCP" : "UDP", opts->rate, opts->duration,
+		         opts->clients, opts->mac ? "MAC" : "ECS");
+	else
+		log_info("%s Sending queries to %s over %s at %u queries/s for %u s...",
+		         cli_info(), server, opts->tcp ? "TCP" : "UDP", opts->rate, opts->duration);
+
+	const double start = double_time(), stop = start + opts->duration;
+	uint64_t oldest = 0;
+	bench.last_reply = start;
+	while(true)
+	{
+		double now = double_time();
+
+		// Send the queries due by now
+		bool behind = false;
+		const bool sending = opts->replay ? bench.sent < bench.corpus.num : now < stop;
+		if(sending)
+		{
+			const uint64_t due = queries_due(&bench, now - start);
+			for(unsigned int burst = 0; bench.sent < due; burst++)
+				if(burst == BENCH_BURST || !send_query(&bench, now))
+				{
+					behind = true;
+					break;
+				}
+		}
+		else if(oldest == bench.sent)
+			break;
+
+		// Expire queries without reply
+		for(; oldest < bench.sent; oldest++)
+		{
+			struct bench_slot *slot = &bench.slots[oldest & UINT16_MAX];
+			if(slot->used && now - slot->sent < BENCH_TIMEOUT)
+				break;
+			if(!slot->used)
+				continue;
+
+			bench.timeouts++;
+			slot->used = false;
+			if(opts->tcp && !reconnect(&bench, &bench.conns[slot->conn]))
+				goto end_of_run_dns_bench;
+		}
+
+		// Wait for replies until the next query is due
+		double wait = sending ? start + next_due(&bench) - now : 0.01;
+		if(behind || wait < 0.0)
+			wait = 0.0;
+		else if(wait > 0.01)
+			wait = 0.01;
+		const struct timespec timeout = { 0, (long)(1e9*wait) };
+		for(unsigned int c = 0; c < bench.nconns; c++)
+		{
+			pfds[c].fd = bench.conns[c].fd;
+			pfds[c].events = POLLIN;
+			pfds[c].revents = 0;
+		}
+		const int n = ppoll(pfds, bench.nconns, &timeout, NULL);
+		if(n < 0 && errno != EINTR)
+		{
+			log_err("Cannot wait for replies: %s", strerror(errno));
+			goto end_of_run_dns_bench;
+		}
+
+		now = double_time();
+		for(unsigned int c = 0; n > 0 && c < bench.nconns; c++)
+			if(pfds[c].revents != 0 && !read_replies(&bench, &bench.conns[c], now))
+				goto end_of_run_dns_bench;
+	}
+
+	print_results(&bench, bench.last_reply - start);
+	ret = bench.replies > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+end_of_run_dns_bench:
+	for(size_t i = 0; i < bench.corpus.num; i++)
+		free(bench.corpus.queries[i].name);
+	free(bench.corpus.queries);
+	for(unsigned int c = 0; bench.conns != NULL && c < bench.nconns; c++)
+	{
+		if(bench.conns[c].fd >= 0)
+			close(bench.conns[c].fd);
+		free(bench.conns[c].buf);
+	}
+	free(bench.conns);
+	free(bench.slots);
+	free(pfds);
+	for(unsigned int status = 0; status < BENCH_BUCKETS; status++)
+		if(bench.latency[status].usec != NULL)
+			free(bench.latency[status].usec);
+
+	return ret;
+}
@@ -0,0 +1,48 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  DNS load generator prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef DNS_BENCH_H
+#define DNS_BENCH_H
+
+// Defaults of pihole-FTL bench dns
+#define DNS_BENCH_RATE 1000u
+#define DNS_BENCH_DURATION 10u
+#define DNS_BENCH_SAMPLES 10000u
+
+// Defaults of pihole-FTL replay (the last hour at its original speed)
+#define DNS_REPLAY_WINDOW 3600u
+#define DNS_REPLAY_SPEED 1.0
+
+struct dns_bench_opts {
+	// Domains to replay (one per line, optionally followed by the query
+	// type), queries are sampled from the long-term database if NULL
+	const char *corpus;
+	unsigned int samples;
+	// Server address ("ip" or "ip#port"), localhost if NULL
+	const char *server;
+	unsigned int rate;
+	unsigned int duration;
+	bool tcp;
+	// Spread queries over this many clients using ECS or MAC options
+	unsigned int clients;
+	bool mac;
+	// Replay the queries of this time window of the long-term database
+	// with their original timing, sped up by the given factor. With ecs,
+	// every query carries the address of its original client
+	bool replay;
+	double from;
+	double until;
+	double speed;
+	bool ecs;
+};
+
+int run_dns_bench(const struct dns_bench_opts *opts);
+
+#endif // DNS_BENCH_H
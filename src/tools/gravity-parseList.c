@@ -11,6 +11,31 @@
 #include "tools/gravity-parseList.h"
 #include "args.h"
 #include "database/sqlite3.h"
+// CREATE_GRAVITY_SEARCH_TABLE()
+#include "database/gravity-db.h"
+// config.database.gravitySearchIndex
+#include "config/config.h"
+// double_time()
+#include "log.h"
+// mmap()
+#include <sys/mman.h>
+// open()
+#include <fcntl.h>
+// pthread_create()
+#include <pthread.h>
+// sha256_digest()
+#include <nettle/sha2.h>
+// sha256_raw_to_hex()
+#include "config/password.h"
+// gravity_hash(), gravity_hash_len()
+#include "database/gravity-index.h"
+#if defined(__SSE2__)
+// _mm_cmpeq_epi8()
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+// vceqq_u8()
+#include <arm_neon.h>
+#endif
 
 // A list of items of common local hostnames not to report as unusable
 // Some lists (i.e StevenBlack's) contain these as they are supposed to be used as HOST files
@@ -39,8 +64,111 @@ static const char *false_positives[] = {
 // Number of invalid domains to print before skipping the rest
 #define MAX_INVALID_DOMAINS 5
 
-// Validate domain name
-inline bool __attribute__((pure)) valid_domain(const char *domain, const size_t len, const bool fqdn_only)
+// Add the domains inserted after the given rowid to the trigram search index
+// used for partial matches in /api/search. Indexing all domains of a list at
+// once is much faster than updating the index with every single insertion
+static bool update_search_index(sqlite3 *db, const bool antigravity, const sqlite3_int64 last_rowid)
+{
+	const char *create = antigravity ?
+		CREATE_GRAVITY_SEARCH_TABLE("antigravity") :
+		CREATE_GRAVITY_SEARCH_TABLE("gravity");
+	if(sqlite3_exec(db, create, NULL, NULL, NULL) != SQLITE_OK)
+		return false;
+
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = antigravity ?
+		"INSERT INTO antigravity_search (rowid, domain) SELECT rowid, domain FROM antigravity WHERE rowid > ?;" :
+		"INSERT INTO gravity_search (rowid, domain) SELECT rowid, domain FROM gravity WHERE rowid > ?;";
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	const bool okay = sqlite3_bind_int64(stmt, 1, last_rowid) == SQLITE_OK &&
+	                  sqlite3_step(stmt) == SQLITE_DONE;
+	sqlite3_finalize(stmt);
+
+	return okay;
+}
+
+// Get the largest rowid of (anti)gravity, all domains inserted afterwards get
+// a larger one
+static sqlite3_int64 get_last_rowid(sqlite3 *db, const bool antigravity)
+{
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = antigravity ?
+		"SELECT IFNULL(MAX(rowid),0) FROM antigravity;" :
+		"SELECT IFNULL(MAX(rowid),0) FROM gravity;";
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return -1;
+
+	sqlite3_int64 rowid = -1;
+	if(sqlite3_step(stmt) == SQLITE_ROW)
+		rowid = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return rowid;
+}
+
+// Get the checksum of the list the domains of an adlist have been parsed from
+// the last time. The checksum is left empty if it is not known
+static bool get_list_checksum(sqlite3 *db, const int adlistID, char checksum[SHA256_DIGEST_SIZE*2 + 1])
+{
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = "SELECT value FROM info WHERE property = '" ADLIST_CHECKSUM_PROPERTY "' || ?;";
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	checksum[0] = '\0';
+	int rc = sqlite3_bind_int(stmt, 1, adlistID);
+	if(rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *value = (const char*)sqlite3_column_text(stmt, 0);
+		if(value != NULL && strlen(value) == SHA256_DIGEST_SIZE*2)
+			strcpy(checksum, value);
+		rc = SQLITE_DONE;
+	}
+	sqlite3_finalize(stmt);
+
+	return rc == SQLITE_DONE;
+}
+
+// Store the checksum of the list the domains of an adlist have been parsed from
+static bool set_list_checksum(sqlite3 *db, const int adlistID, const char *checksum)
+{
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = "INSERT OR REPLACE INTO info (property,value) VALUES ('" ADLIST_CHECKSUM_PROPERTY "' || ?, ?);";
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	const bool okay = sqlite3_bind_int(stmt, 1, adlistID) == SQLITE_OK &&
+	                  sqlite3_bind_text(stmt, 2, checksum, -1, SQLITE_STATIC) == SQLITE_OK &&
+	                  sqlite3_step(stmt) == SQLITE_DONE;
+	sqlite3_finalize(stmt);
+
+	return okay;
+}
+
+// Print the summary of a list which did not change since its domains have
+// been parsed the last time
+static void print_unchanged(sqlite3 *db, const int adlistID, const bool antigravity)
+{
+	int number = 0, abp_entries = 0, invalid_domains = 0;
+	sqlite3_stmt *stmt = NULL;
+	if(sqlite3_prepare_v2(db, "SELECT number, abp_entries, invalid_domains FROM adlist WHERE id = ?;", -1, &stmt, NULL) == SQLITE_OK &&
+	   sqlite3_bind_int(stmt, 1, adlistID) == SQLITE_OK &&
+	   sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		number = sqlite3_column_int(stmt, 0);
+		abp_entries = sqlite3_column_int(stmt, 1);
+		invalid_domains = sqlite3_column_int(stmt, 2);
+	}
+	sqlite3_finalize(stmt);
+
+	printf("%s  %s List unchanged, kept %d exact domains and %d ABP-style domains (%sing, ignored %d non-domain entries)\n",
+	       cli_over(), cli_tick(), number - abp_entries, abp_entries, antigravity ? "allow" : "block", invalid_domains);
+}
+
+// Validate domain name byte by byte
+static bool __attribute__((pure)) valid_domain_scalar(const char *domain, const size_t len, const bool fqdn_only)
 {
 	// Domain must not be NULL or empty, and they should not be longer than
 	// 255 characters
@@ -97,6 +225,123 @@ inline bool __attribute__((pure)) valid_domain(const char *domain, const size_t
 	return true;
 }
 
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define HAVE_VECTOR_VALIDATION
+// Number of bytes classified at once
+#define VECTOR_SIZE 16u
+
+#if defined(__SSE2__)
+// One bit per byte in the dot mask
+#define DOT_STRIDE 1u
+
+// Classify 16 bytes of a domain. Returns false if any of them is not one of
+// [a-zA-Z0-9._-], otherwise the positions of the dots are stored in *dots
+static inline bool classify_block(const char *p, uint64_t *dots)
+{
+	const __m128i v = _mm_loadu_si128((const __m128i*)(const void*)p);
+	// Bytes >= 0x80 are negative and fail the signed range checks
+	const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+	                                    _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+	                                    _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	const __m128i dot = _mm_cmpeq_epi8(v, _mm_set1_epi8('.'));
+	const __m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+	                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+	const __m128i okay = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_or_si128(dot, other));
+	if(_mm_movemask_epi8(okay) != 0xFFFF)
+		return false;
+
+	*dots = (unsigned int)_mm_movemask_epi8(dot);
+	return true;
+}
+#else
+// NEON has no movemask, narrowing the comparison results instead leaves four
+// bits per byte in the dot mask
+#define DOT_STRIDE 4u
+
+static inline uint64_t neon_mask(const uint8x16_t v)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+}
+
+// Classify 16 bytes of a domain. Returns false if any of them is not one of
+// [a-zA-Z0-9._-], otherwise the positions of the dots are stored in *dots
+static inline bool classify_block(const char *p, uint64_t *dots)
+{
+	const uint8x16_t v = vld1q_u8((const uint8_t*)p);
+	const uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+	const uint8x16_t alpha = vcleq_u8(vsubq_u8(lower, vdupq_n_u8('a')), vdupq_n_u8('z' - 'a'));
+	const uint8x16_t digit = vcleq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(9));
+	const uint8x16_t dot = vceqq_u8(v, vdupq_n_u8('.'));
+	const uint8x16_t other = vorrq_u8(vceqq_u8(v, vdupq_n_u8('-')), vceqq_u8(v, vdupq_n_u8('_')));
+	const uint8x16_t okay = vorrq_u8(vorrq_u8(alpha, digit), vorrq_u8(dot, other));
+	if(neon_mask(okay) != UINT64_MAX)
+		return false;
+
+	*dots = neon_mask(dot) & 0x1111111111111111ull;
+	return true;
+}
+#endif
+
+// Validate domain name 16 bytes at a time. The label lengths are checked
+// using the positions of the dots only. This accepts exactly the same domains
+// as valid_domain_scalar()
+static bool __attribute__((pure)) valid_domain_vector(const char *domain, const size_t len, const bool fqdn_only)
+{
+	if(domain == NULL || len == 0 || len > 255)
+		return false;
+
+	// Short domains are not worth it and would need reading beyond them
+	if(len < VECTOR_SIZE)
+		return valid_domain_scalar(domain, len, fqdn_only);
+
+	size_t last_dot = SIZE_MAX;
+	for(size_t i = 0; i < len; i += VECTOR_SIZE)
+	{
+		// The last block is moved back to end with the domain, the
+		// dots in the overlap have been seen already
+		const size_t start = i + VECTOR_SIZE <= len ? i : len - VECTOR_SIZE;
+		uint64_t dots = 0;
+		if(!classify_block(domain + start, &dots))
+			return false;
+		dots >>= (i - start) * DOT_STRIDE;
+
+		while(dots != 0)
+		{
+			const size_t pos = i + __builtin_ctzll(dots) / DOT_STRIDE;
+
+			// Labels must be between 1 and 63 characters long
+			if(pos - last_dot == 1 || pos - last_dot > 64)
+				return false;
+
+			last_dot = pos;
+			dots &= dots - 1;
+		}
+	}
+
+	// There must be at least two labels for exact domains
+	if(last_dot == SIZE_MAX && fqdn_only)
+		return false;
+
+	// TLD must not start or end with a hyphen
+	if(domain[last_dot + 1] == '-' || domain[len - 1] == '-')
+		return false;
+
+	return true;
+}
+#endif
+
+// Validate domain name
+inline bool __attribute__((pure)) valid_domain(const char *domain, const size_t len, const bool fqdn_only)
+{
+#ifdef HAVE_VECTOR_VALIDATION
+	return valid_domain_vector(domain, len, fqdn_only);
+#else
+	return valid_domain_scalar(domain, len, fqdn_only);
+#endif
+}
+
 // Validate ABP domain name
 static inline bool __attribute__((pure)) valid_abp_domain(const char *line, const size_t len, const bool antigravity)
 {
@@ -157,46 +402,657 @@ static void print_escaped(const char *str, const ssize_t len)
 			printf("\\x%02x", (unsigned char)str[j]);
 }
 
+// Size of the line-aligned chunks lists are split into for parsing
+#define PARSE_CHUNK_SIZE (4u*1024u*1024u)
+
+// Upper limit of the number of threads parsing a list
+#define MAX_PARSE_THREADS 16u
+
+// Number of domains inserted by a single multi-row INSERT statement
+#define INSERT_BATCH_SIZE 256u
+
+// Chunk of a list parsed by one of the parser threads. Domains to be inserted
+// (or the invalid entries when only checking a list) are collected as records
+// of line number, length and text in a single buffer
+struct parse_chunk {
+	// Input
+	const char *start;
+	size_t len;
+	bool checkOnly;
+	bool antigravity;
+	// Output
+	char *records;
+	size_t records_len;
+	size_t records_size;
+	size_t lines;
+	unsigned int exact_domains;
+	unsigned int abp_domains;
+	unsigned int invalid_domains;
+	char *invalid_domains_list[MAX_INVALID_DOMAINS];
+	ssize_t invalid_domains_list_lengths[MAX_INVALID_DOMAINS];
+	unsigned int invalid_domains_list_len;
+	bool oom;
+	// Line buffer, reused for all lines
+	char *line;
+	size_t line_size;
+};
+
+static void add_record(struct parse_chunk *chunk, const char *token, const size_t len)
+{
+	const size_t needed = 2*sizeof(size_t) + len;
+	if(chunk->records_len + needed > chunk->records_size)
+	{
+		const size_t size = max(2*chunk->records_size, chunk->records_len + needed);
+		char *records = realloc(chunk->records, size);
+		if(records == NULL)
+		{
+			chunk->oom = true;
+			return;
+		}
+		chunk->records = records;
+		chunk->records_size = size;
+	}
+
+	char *record = chunk->records + chunk->records_len;
+	memcpy(record, &chunk->lines, sizeof(size_t));
+	memcpy(record + sizeof(size_t), &len, sizeof(size_t));
+	memcpy(record + 2*sizeof(size_t), token, len);
+	chunk->records_len += needed;
+}
+
+// Get the next record of a chunk, returns NULL after the last one
+static const char *next_record(const struct parse_chunk *chunk, size_t *offset, size_t *lineno, size_t *len)
+{
+	if(*offset >= chunk->records_len)
+		return NULL;
+
+	const char *record = chunk->records + *offset;
+	memcpy(lineno, record, sizeof(size_t));
+	memcpy(len, record + sizeof(size_t), sizeof(size_t));
+	*offset += 2*sizeof(size_t) + *len;
+
+	return record + 2*sizeof(size_t);
+}
+
+// Remember an invalid entry as sample unless we have enough of them already
+static void add_invalid_sample(char *list[MAX_INVALID_DOMAINS], ssize_t lengths[MAX_INVALID_DOMAINS],
+                               unsigned int *list_len, const char *token, const size_t token_len)
+{
+	// Add the domain to invalid_domains_list only if the list contains
+	// < MAX_INVALID_DOMAINS
+	if(*list_len >= MAX_INVALID_DOMAINS)
+		return;
+
+	// Check if we have this domain already
+	for(unsigned int i = 0; i < *list_len; i++)
+	{
+		// Do not compare against unset entries
+		if(list[i] == NULL || lengths[i] == -1)
+			break;
+
+		// Compare against the current domain
+		if(memcmp(list[i], token, min((ssize_t)token_len, lengths[i])) == 0)
+			return;
+	}
+
+	// If not found, add it to the list
+	list[*list_len] = calloc(token_len + 1, sizeof(char));
+	if(list[*list_len] == NULL)
+		return;
+	memcpy(list[*list_len], token, token_len);
+	list[*list_len][token_len] = '\0';
+	lengths[*list_len] = token_len;
+	(*list_len)++;
+}
+
+// Parse a single line of a list
+static void parse_line(struct parse_chunk *chunk, char *line, ssize_t read)
+{
+	const bool antigravity = chunk->antigravity;
+
+	// Skip empty lines
+	if(read < 1)
+		return;
+
+	// Remove trailing newline
+	if(line[read-1] == '\n')
+		line[--read] = '\0';
+
+	// Skip empty lines
+	if(read < 1)
+		return;
+
+	// Remove trailing carriage return
+	if(line[read-1] == '\r')
+		line[--read] = '\0';
+
+	// Skip empty lines
+	if(read < 1)
+		return;
+
+	// Remove trailing whitespace
+	while(read > 0 && isspace(line[read-1]))
+		line[--read] = '\0';
+
+	// Skip empty lines
+	if(read < 1)
+		return;
+
+	// Skip lines having any of the following characters:
+	// ! = ABP-style comment
+	// # = bach-style comment
+	// ; = PHP-style comment
+	// [ = ABP header lines
+	if(line[0] == '!' || line[0] == '#' || line[0] == ';' || line[0] == '[')
+		return;
+
+	// Remove lines containing ABP extended CSS selectors ("##",
+	// "#$#", "#@#", "#?#") and Adguard JavaScript (#%#)
+	char *hash = strchr(line, '#');
+	if(hash != NULL && line < hash && (hash[1] == '#' || hash[1] == '$' || hash[1] == '@' || hash[1] == '?' || hash[1] == '%'))
+		return;
+
+	// Remove comments (text starting with "#", include possible spaces before the hash sign)
+	const size_t comment_start = strcspn(line, "#");
+	if (comment_start < (size_t)read)
+	{
+		line[comment_start] = '\0';
+		read = comment_start;
+	}
+
+	// Skip empty lines
+	if(read < 1)
+		return;
+
+	// Split by whitespace and tabs and look over the tokens
+	char *saveptr = NULL;
+	char *token = strtok_r(line, " \t", &saveptr);
+	while(token != NULL)
+	{
+		// Skip empty tokens
+		if(token[0] == '\0')
+			goto next_domain;
+
+		// Skip IP addresses
+		// IPv4 addresses
+		struct in_addr buffer = { 0 };
+		if (inet_pton(AF_INET, token, &buffer) == 1)
+			goto next_domain;
+
+		// IPv6 addresses
+		struct in6_addr buffer6 = { 0 };
+		if (inet_pton(AF_INET6, token, &buffer6) == 1)
+			goto next_domain;
+
+		// Remove trailing dot (convert FQDN to domain)
+		size_t token_len = strlen(token);
+		if(token[token_len - 1] == '.')
+			token[--token_len] = '\0';
+
+		// Skip empty tokens
+		if(token[0] == '\0')
+			goto next_domain;
+
+		// Convert all characters to lowercase
+		for(size_t i = 0; i < token_len; i++)
+			token[i] = tolower(token[i]);
+
+		// Validate line
+		if(line[0] != (antigravity ? '@' : '|') &&  // <- Not an ABP-style match
+		   valid_domain(token, token_len, true))
+		{
+			// Exact match found, append domain to the records
+			// to be inserted into the database
+			if(!chunk->checkOnly)
+				add_record(chunk, token, token_len);
+			chunk->exact_domains++;
+		}
+		else if(token[0] == (antigravity ? '@' : '|') &&         // <- ABP-style match
+		        valid_abp_domain(token, token_len, antigravity)) // <- Valid ABP domain
+		{
+			// ABP-style match (see comments above)
+			if(!chunk->checkOnly)
+				add_record(chunk, token, token_len);
+			chunk->abp_domains++;
+		}
+		else if(!is_false_positive(token))
+		{
+			// No match - This is an invalid domain or a false
+			// positive. False positives don't count as invalid
+			// domains. When checking a list, all invalid entries
+			// are reported together with their line number
+			if(chunk->checkOnly)
+				add_record(chunk, token, token_len);
+			else
+				add_invalid_sample(chunk->invalid_domains_list, chunk->invalid_domains_list_lengths,
+				                   &chunk->invalid_domains_list_len, token, token_len);
+			chunk->invalid_domains++;
+		}
+next_domain:
+		token = strtok_r(NULL, " \t", &saveptr);
+	}
+}
+
+// Thread parsing a chunk of a list line by line
+static void *parse_chunk(void *arg)
+{
+	struct parse_chunk *chunk = arg;
+	const char *p = chunk->start;
+	const char *end = chunk->start + chunk->len;
+
+	while(p < end)
+	{
+		// Find the end of the line (including the newline)
+		const char *nl = memchr(p, '\n', end - p);
+		const size_t read = (nl != NULL ? nl + 1 : end) - p;
+
+		// Copy the line as it is modified while parsing
+		if(read + 1 > chunk->line_size)
+		{
+			char *line = realloc(chunk->line, read + 1);
+			if(line == NULL)
+			{
+				chunk->oom = true;
+				return NULL;
+			}
+			chunk->line = line;
+			chunk->line_size = read + 1;
+		}
+		memcpy(chunk->line, p, read);
+		chunk->line[read] = '\0';
+
+		chunk->lines++;
+		parse_line(chunk, chunk->line, read);
+		p += read;
+	}
+
+	return NULL;
+}
+
+// Split the next line-aligned chunk off the list
+static void next_chunk(struct parse_chunk *chunk, const char *list, const size_t fsize, size_t *offset)
+{
+	chunk->start = list + *offset;
+	chunk->len = min(PARSE_CHUNK_SIZE, fsize - *offset);
+
+	// Extend the chunk to the end of the line
+	if(*offset + chunk->len < fsize)
+	{
+		const char *nl = memchr(chunk->start + chunk->len, '\n', fsize - *offset - chunk->len);
+		chunk->len = nl != NULL ? (size_t)(nl + 1 - chunk->start) : fsize - *offset;
+	}
+	*offset += chunk->len;
+
+	// Reset results
+	chunk->records_len = 0u;
+	chunk->lines = 0u;
+	chunk->exact_domains = chunk->abp_domains = chunk->invalid_domains = 0u;
+	for(unsigned int i = 0; i < chunk->invalid_domains_list_len; i++)
+		free(chunk->invalid_domains_list[i]);
+	chunk->invalid_domains_list_len = 0u;
+	chunk->oom = false;
+}
+
+// Build a statement inserting INSERT_BATCH_SIZE domains at once
+static sqlite3_stmt *prepare_batch_insert(sqlite3 *db, const bool antigravity, const int adlistID)
+{
+	const size_t size = 64 + INSERT_BATCH_SIZE * 16;
+	char *sql = calloc(size, sizeof(char));
+	if(sql == NULL)
+		return NULL;
+
+	size_t len = snprintf(sql, size, "INSERT INTO %s (domain, adlist_id) VALUES ",
+	                      antigravity ? "antigravity" : "gravity");
+	for(unsigned int i = 0; i < INSERT_BATCH_SIZE && len < size; i++)
+		len += snprintf(sql + len, size - len, "%s(?,%d)", i > 0 ? "," : "", adlistID);
+
+	sqlite3_stmt *stmt = NULL;
+	if(len >= size || sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		stmt = NULL;
+	free(sql);
+
+	return stmt;
+}
+
+// Insert the domains collected from a chunk. Full batches are inserted using
+// the multi-row statement, the remainder one by one
+static bool insert_chunk(const struct parse_chunk *chunk, sqlite3_stmt *batch, sqlite3_stmt *stmt)
+{
+	size_t offset = 0u, lineno = 0u, len = 0u;
+	size_t remaining = (chunk->exact_domains + chunk->abp_domains);
+	const char *domain = NULL;
+
+	while(remaining >= INSERT_BATCH_SIZE)
+	{
+		for(unsigned int i = 1; i <= INSERT_BATCH_SIZE; i++)
+		{
+			domain = next_record(chunk, &offset, &lineno, &len);
+			if(domain == NULL || sqlite3_bind_text(batch, i, domain, len, SQLITE_STATIC) != SQLITE_OK)
+				return false;
+		}
+		if(sqlite3_step(batch) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(batch);
+		remaining -= INSERT_BATCH_SIZE;
+	}
+
+	while((domain = next_record(chunk, &offset, &lineno, &len)) != NULL)
+	{
+		if(sqlite3_bind_text(stmt, 1, domain, len, SQLITE_STATIC) != SQLITE_OK ||
+		   sqlite3_step(stmt) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(stmt);
+	}
+
+	return true;
+}
+
+// Domains of an adlist stored in the database before an incremental update.
+// They are identified by their 64-bit hash (see gravity_hash()) like in the
+// compiled gravity index, the probability of a false match is negligible
+struct list_row {
+	uint64_t hash;
+	sqlite3_int64 rowid;
+	bool seen;
+};
+
+struct list_rows {
+	struct list_row *rows;
+	size_t num;
+	size_t cap;
+	// Hashes of the domains added so far (open addressing, 0 = empty)
+	uint64_t *added;
+	size_t num_added;
+	size_t cap_added;
+};
+
+static int cmp_list_row(const void *a, const void *b)
+{
+	const uint64_t ha = ((const struct list_row*)a)->hash;
+	const uint64_t hb = ((const struct list_row*)b)->hash;
+	return (ha > hb) - (ha < hb);
+}
+
+static int cmp_list_rowid(const void *a, const void *b)
+{
+	const sqlite3_int64 ra = ((const struct list_row*)a)->rowid;
+	const sqlite3_int64 rb = ((const struct list_row*)b)->rowid;
+	return (ra > rb) - (ra < rb);
+}
+
+// Read the domains the adlist had so far
+static bool load_list_rows(sqlite3 *db, const bool antigravity, const int adlistID, struct list_rows *old)
+{
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = antigravity ?
+		"SELECT rowid, domain FROM antigravity WHERE adlist_id = ?;" :
+		"SELECT rowid, domain FROM gravity WHERE adlist_id = ?;";
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	int rc = sqlite3_bind_int(stmt, 1, adlistID);
+	while(rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 1);
+		if(domain == NULL)
+		{
+			rc = SQLITE_OK;
+			continue;
+		}
+
+		if(old->num >= old->cap)
+		{
+			const size_t newcap = old->cap > 0 ? 2*old->cap : 4096u;
+			struct list_row *rows = realloc(old->rows, newcap * sizeof(*rows));
+			if(rows == NULL)
+				break;
+			old->rows = rows;
+			old->cap = newcap;
+		}
+
+		struct list_row *row = &old->rows[old->num++];
+		row->hash = gravity_hash(domain);
+		row->rowid = sqlite3_column_int64(stmt, 0);
+		row->seen = false;
+		rc = SQLITE_OK;
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+		return false;
+
+	qsort(old->rows, old->num, sizeof(*old->rows), cmp_list_row);
+	return true;
+}
+
+// Remember the hash of an added domain. Returns false if it has already been
+// added before (or on memory errors, see oom)
+static bool remember_added(struct list_rows *old, uint64_t hash, bool *oom)
+{
+	// Zero marks empty slots
+	if(hash == 0u)
+		hash = 1u;
+
+	// Keep the load factor below 50%
+	if(2*(old->num_added + 1) > old->cap_added)
+	{
+		const size_t newcap = old->cap_added > 0 ? 2*old->cap_added : 1024u;
+		uint64_t *added = calloc(newcap, sizeof(*added));
+		if(added == NULL)
+		{
+			*oom = true;
+			return false;
+		}
+		for(size_t i = 0; i < old->cap_added; i++)
+		{
+			if(old->added[i] == 0u)
+				continue;
+			size_t j = old->added[i] & (newcap - 1);
+			while(added[j] != 0u)
+				j = (j + 1) & (newcap - 1);
+			added[j] = old->added[i];
+		}
+		free(old->added);
+		old->added = added;
+		old->cap_added = newcap;
+	}
+
+	size_t i = hash & (old->cap_added - 1);
+	while(old->added[i] != 0u)
+	{
+		if(old->added[i] == hash)
+			return false;
+		i = (i + 1) & (old->cap_added - 1);
+	}
+	old->added[i] = hash;
+	old->num_added++;
+
+	return true;
+}
+
+// Compare the domains collected from a chunk with the ones the adlist had so
+// far. Known domains are marked as seen, new domains are inserted (once)
+static bool diff_chunk(const struct parse_chunk *chunk, struct list_rows *old, sqlite3_stmt *stmt, int *added)
+{
+	size_t offset = 0u, lineno = 0u, len = 0u;
+	const char *domain = NULL;
+	while((domain = next_record(chunk, &offset, &lineno, &len)) != NULL)
+	{
+		const struct list_row key = { .hash = gravity_hash_len(domain, len) };
+		struct list_row *row = bsearch(&key, old->rows, old->num, sizeof(*old->rows), cmp_list_row);
+		if(row != NULL)
+		{
+			row->seen = true;
+			continue;
+		}
+
+		bool oom = false;
+		if(!remember_added(old, key.hash, &oom))
+		{
+			if(oom)
+				return false;
+			continue;
+		}
+
+		if(sqlite3_bind_text(stmt, 1, domain, len, SQLITE_STATIC) != SQLITE_OK ||
+		   sqlite3_step(stmt) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(stmt);
+		(*added)++;
+	}
+
+	return true;
+}
+
+// Delete the domains which are no longer on the list. They are removed from
+// the search index (if any) first as it refers to their content. Rows are
+// deleted in the order of their rowids to touch every page only once
+static bool delete_unseen_rows(sqlite3 *db, const bool antigravity, const bool search_index,
+                               struct list_rows *old, int *removed)
+{
+	qsort(old->rows, old->num, sizeof(*old->rows), cmp_list_rowid);
+
+	sqlite3_stmt *unindex = NULL, *delete = NULL;
+	const char *sql = antigravity ?
+		"INSERT INTO antigravity_search (antigravity_search, rowid, domain) SELECT 'delete', rowid, domain FROM antigravity WHERE rowid = ?;" :
+		"INSERT INTO gravity_search (gravity_search, rowid, domain) SELECT 'delete', rowid, domain FROM gravity WHERE rowid = ?;";
+	if(search_index &&
+	   (sqlite3_exec(db, antigravity ? CREATE_GRAVITY_SEARCH_TABLE("antigravity") : CREATE_GRAVITY_SEARCH_TABLE("gravity"),
+	                 NULL, NULL, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, sql, -1, &unindex, NULL) != SQLITE_OK))
+		return false;
+
+	sql = antigravity ?
+		"DELETE FROM antigravity WHERE rowid = ?;" :
+		"DELETE FROM gravity WHERE rowid = ?;";
+	bool okay = sqlite3_prepare_v2(db, sql, -1, &delete, NULL) == SQLITE_OK;
+	for(size_t i = 0; okay && i < old->num; i++)
+	{
+		if(old->rows[i].seen)
+			continue;
+
+		if(unindex != NULL)
+		{
+			okay = sqlite3_bind_int64(unindex, 1, old->rows[i].rowid) == SQLITE_OK &&
+			       sqlite3_step(unindex) == SQLITE_DONE;
+			sqlite3_reset(unindex);
+		}
+
+		okay = okay && sqlite3_bind_int64(delete, 1, old->rows[i].rowid) == SQLITE_OK &&
+		       sqlite3_step(delete) == SQLITE_DONE;
+		sqlite3_reset(delete);
+		(*removed)++;
+	}
+
+	sqlite3_finalize(unindex);
+	sqlite3_finalize(delete);
+
+	return okay;
+}
+
+/**
+ * Parse a downloaded list and add its domains to the gravity database (or
+ * only check it). The list is mapped into memory and split into line-aligned
+ * chunks which are parsed in parallel. This thread inserts the domains found
+ * in the chunks in the order of the list while the next chunks are parsed.
+ *
+ * In incremental mode, the domains of the list in an existing database are
+ * updated instead. Nothing is done if the checksum of the list matches the
+ * one stored when it has been parsed the last time. Otherwise, the domains are
+ * compared with the ones the list had so far and only the ones added to or
+ * removed from the list are written.
+ */
 int gravity_parseList(const char *infile, const char *outfile, const char *adlistIDstr,
-                      const bool checkOnly, const bool antigravity)
+                      const bool checkOnly, const bool antigravity, const bool incremental)
 {
 	const char *info = cli_info();
 	const char *tick = cli_tick();
 	const char *cross = cli_cross();
 	const char *over = cli_over();
+	const double start = double_time();
+	int ret = EXIT_FAILURE;
 
 	// Open input file
-	FILE *fpin = fopen(infile, "r");
-	if(fpin == NULL)
+	const int fd = open(infile, O_RDONLY);
+	if(fd < 0)
 	{
 		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
 		return EXIT_FAILURE;
 	}
 
+	// Get size of input file
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		printf("%s  %s Unable to get size of %s\n", over, cross, infile);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	const size_t fsize = st.st_size;
+
+	// Map the input file into memory
+	const char *list = NULL;
+	if(fsize > 0)
+	{
+		list = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(list == MAP_FAILED)
+		{
+			printf("%s  %s Unable to map %s into memory\n", over, cross, infile);
+			close(fd);
+			return EXIT_FAILURE;
+		}
+		madvise((void*)list, fsize, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	// Compute checksum of the list, it is stored together with the domains
+	// so unchanged lists can be skipped by incremental updates
+	char checksum[SHA256_DIGEST_SIZE*2 + 1] = { 0 };
+	if(!checkOnly)
+	{
+		uint8_t raw[SHA256_DIGEST_SIZE];
+		struct sha256_ctx ctx;
+		sha256_init(&ctx);
+		if(fsize > 0)
+			sha256_update(&ctx, fsize, (const uint8_t*)list);
+		sha256_digest(&ctx, SHA256_DIGEST_SIZE, raw);
+		sha256_raw_to_hex(raw, checksum);
+	}
+
 	// Open output file (database)
 	sqlite3 *db = NULL;
-	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *stmt = NULL, *batch = NULL;
+	struct parse_chunk *chunks = NULL;
+	pthread_t *tids = NULL;
+	bool *running = NULL;
+	unsigned int threads = 0;
+	char *invalid_domains_list[MAX_INVALID_DOMAINS] = { NULL };
+	ssize_t invalid_domains_list_lengths[MAX_INVALID_DOMAINS] = { -1 };
+	unsigned int invalid_domains_list_len = 0;
+	unsigned int exact_domains = 0, abp_domains = 0, invalid_domains = 0;
+	size_t lineno = 0;
+	struct list_rows old = { 0 };
+	int added = 0, removed = 0;
+	const int adlistID = atoi(adlistIDstr);
 	if(!checkOnly && sqlite3_open_v2(outfile, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to open database file %s for writing\n", over, cross, outfile);
-		fclose(fpin);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
 	// Disable journaling
 	// Journaling is used to prevent database corruption in case of a power
 	// loss or operating system crash. However, this is not needed for the
 	// gravity database the database is created from scratch at every run
-	// of pihole -g.
+	// of pihole -g. Incremental updates of an existing database keep the
+	// journal.
 	// The OFF journaling mode disables the rollback journal completely. No
 	// rollback journal is ever created and hence there is never a rollback
 	// journal to delete.
-	if(!checkOnly && sqlite3_exec(db, "PRAGMA journal_mode = OFF;", NULL, NULL, NULL) != SQLITE_OK)
+	if(!checkOnly && !incremental && sqlite3_exec(db, "PRAGMA journal_mode = OFF;", NULL, NULL, NULL) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to disable journaling in database file %s\n", over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
 	// Disable synchronous mode
@@ -211,310 +1067,198 @@ int gravity_parseList(const char *infile, const char *outfile, const char *adlis
 	// If a power loss (or operating system crash) happens, the database
 	// created here will never be swapped into action and is discarded at
 	// the next run of pihole -g.
-	if(!checkOnly && sqlite3_exec(db, "PRAGMA synchronous = OFF;", NULL, NULL, NULL) != SQLITE_OK)
+	if(!checkOnly && !incremental && sqlite3_exec(db, "PRAGMA synchronous = OFF;", NULL, NULL, NULL) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to disable synchronous mode in database file %s\n", over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
-	// Get size of input file
-	fseek(fpin, 0L, SEEK_END);
-	const size_t fsize = ftell(fpin);
-	rewind(fpin);
+	// Skip lists which did not change since they have been parsed last
+	if(incremental)
+	{
+		char previous[SHA256_DIGEST_SIZE*2 + 1];
+		if(!get_list_checksum(db, adlistID, previous))
+		{
+			printf("%s  %s Unable to read list checksum from database file %s\n", over, cross, outfile);
+			goto end_of_parseList;
+		}
+		if(strcmp(previous, checksum) == 0)
+		{
+			print_unchanged(db, adlistID, antigravity);
+			ret = EXIT_SUCCESS;
+			goto end_of_parseList;
+		}
+	}
 
 	// Begin transaction
 	if(!checkOnly && sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to begin transaction to insert domains into database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
-	// Prepare SQL statement
+	// Get the domains the list had so far for incremental updates
+	if(incremental && !load_list_rows(db, antigravity, adlistID, &old))
+	{
+		printf("%s  %s Unable to read domains of adlist %d from database file %s\n",
+		       over, cross, adlistID, outfile);
+		goto end_of_parseList;
+	}
+
+	// Remember where the domains of this list start for the search index
+	const bool search_index = !checkOnly && config.database.gravitySearchIndex.v.b;
+	const sqlite3_int64 last_rowid = search_index ? get_last_rowid(db, antigravity) : -1;
+
+	// Prepare SQL statements
 	const char *sql = antigravity ?
 		"INSERT INTO antigravity (domain, adlist_id) VALUES (?, ?);" :
 		"INSERT INTO gravity (domain, adlist_id) VALUES (?, ?);";
-	if(!checkOnly && sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+	if(!checkOnly && (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK ||
+	                  (batch = prepare_batch_insert(db, antigravity, adlistID)) == NULL))
 	{
 		printf("%s  %s Unable to prepare SQL statement to insert domains into database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
 	// Bind adlistID
-	const int adlistID = atoi(adlistIDstr);
 	if(!checkOnly && sqlite3_bind_int(stmt, 2, adlistID) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind adlistID to SQL statement to insert domains into database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
-	// Parse list file line by line
-	char *line = NULL;
-	size_t lineno = 0;
-	size_t len = 0;
-	ssize_t read = 0;
-	size_t total_read = 0, last_print = 0;
+	// One parser thread per CPU, but not more than there are chunks. Each
+	// thread has two chunks so it can parse the next one while the domains
+	// of the previous one are inserted
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	const size_t num_chunks = (fsize + PARSE_CHUNK_SIZE - 1) / PARSE_CHUNK_SIZE;
+	threads = cpus > 0 ? (unsigned int)cpus : 1u;
+	if(threads > MAX_PARSE_THREADS)
+		threads = MAX_PARSE_THREADS;
+	if(threads > num_chunks && num_chunks > 0)
+		threads = num_chunks;
+	chunks = calloc(2*threads, sizeof(*chunks));
+	tids = calloc(2*threads, sizeof(*tids));
+	running = calloc(2*threads, sizeof(*running));
+	if(chunks == NULL || tids == NULL || running == NULL)
+	{
+		printf("%s  %s Unable to allocate memory for parsing %s\n", over, cross, infile);
+		goto end_of_parseList;
+	}
+
+	// Parse list file in rounds of one chunk per thread
+	size_t offset = 0, total_read = 0, last_print = 0;
 	const size_t print_step = fsize / 20; // Print progress every 100/20 = 5%
 	int last_progress = 0;
-	char *invalid_domains_list[MAX_INVALID_DOMAINS] = { NULL };
-	ssize_t invalid_domains_list_lengths[MAX_INVALID_DOMAINS] = { -1 };
-	unsigned int invalid_domains_list_len = 0;
-	unsigned int exact_domains = 0, abp_domains = 0, invalid_domains = 0;
-	while((read = getline(&line, &len, fpin)) != -1)
+	unsigned int round = 0, num = 0;
+	for(unsigned int i = 0; i < threads && offset < fsize; i++, num++)
 	{
-		// Update total read bytes
-		total_read += read;
-		lineno++;
-
-		// Skip empty lines
-		if(read < 1)
-			continue;
-
-		// Remove trailing newline
-		if(line[read-1] == '\n')
-			line[--read] = '\0';
-
-		// Skip empty lines
-		if(read < 1)
-			continue;
-
-		// Remove trailing carriage return
-		if(line[read-1] == '\r')
-			line[--read] = '\0';
-
-		// Skip empty lines
-		if(read < 1)
-			continue;
-
-		// Remove trailing whitespace
-		while(read > 0 && isspace(line[read-1]))
-			line[--read] = '\0';
-
-		// Skip empty lines
-		if(read < 1)
-			continue;
-
-		// Skip lines having any of the following characters:
-		// ! = ABP-style comment
-		// # = bach-style comment
-		// ; = PHP-style comment
-		// [ = ABP header lines
-		if(line[0] == '!' || line[0] == '#' || line[0] == ';' || line[0] == '[')
-			continue;
+		chunks[i].checkOnly = checkOnly;
+		chunks[i].antigravity = antigravity;
+		chunks[threads + i].checkOnly = checkOnly;
+		chunks[threads + i].antigravity = antigravity;
+		next_chunk(&chunks[i], list, fsize, &offset);
+		running[i] = pthread_create(&tids[i], NULL, parse_chunk, &chunks[i]) == 0;
+		if(!running[i])
+			parse_chunk(&chunks[i]);
+	}
+	while(num > 0)
+	{
+		struct parse_chunk *current = &chunks[round*threads];
+		const unsigned int next = 1 - round;
 
-		// Remove lines containing ABP extended CSS selectors ("##",
-		// "#$#", "#@#", "#?#") and Adguard JavaScript (#%#)
-		char *hash = strchr(line, '#');
-		if(hash != NULL && line < hash && (hash[1] == '#' || hash[1] == '$' || hash[1] == '@' || hash[1] == '?' || hash[1] == '%'))
-			continue;
+		// Wait for the current round to complete
+		for(unsigned int i = 0; i < num; i++)
+			if(running[round*threads + i])
+			{
+				pthread_join(tids[round*threads + i], NULL);
+				running[round*threads + i] = false;
+			}
 
-		// Remove comments (text starting with "#", include possible spaces before the hash sign)
-		const size_t comment_start = strcspn(line, "#");
-		if (comment_start < (size_t)read)
+		// Start parsing the next round while we insert the domains of
+		// this one
+		unsigned int next_num = 0;
+		for(unsigned int i = 0; i < threads && offset < fsize; i++, next_num++)
 		{
-			line[comment_start] = '\0';
-			read = comment_start;
+			struct parse_chunk *chunk = &chunks[next*threads + i];
+			next_chunk(chunk, list, fsize, &offset);
+			running[next*threads + i] = pthread_create(&tids[next*threads + i], NULL, parse_chunk, chunk) == 0;
+			if(!running[next*threads + i])
+				parse_chunk(chunk);
 		}
 
-		// Skip empty lines
-		if(read < 1)
-			continue;
-
-		// Split by whitespace and tabs and look over the tokens
-		char *token = strtok(line, " \t");
-		while(token != NULL)
+		for(unsigned int i = 0; i < num; i++)
 		{
-			// Skip empty tokens
-			if(token[0] == '\0')
-				goto next_domain;
-
-			// Skip IP addresses
-			// IPv4 addresses
-			struct in_addr buffer = { 0 };
-			if (inet_pton(AF_INET, token, &buffer) == 1)
-				goto next_domain;
-
-			// IPv6 addresses
-			struct in6_addr buffer6 = { 0 };
-			if (inet_pton(AF_INET6, token, &buffer6) == 1)
-				goto next_domain;
-
-			// Remove trailing dot (convert FQDN to domain)
-			size_t token_len = strlen(token);
-			if(token[token_len - 1] == '.')
-				token[--token_len] = '\0';
-
-			// Skip empty tokens
-			if(token[0] == '\0')
-				goto next_domain;
-
-			// Convert all characters to lowercase
-			for(size_t i = 0; i < token_len; i++)
-				token[i] = tolower(token[i]);
-
-			// Validate line
-			if(line[0] != (antigravity ? '@' : '|') &&  // <- Not an ABP-style match
-			   valid_domain(token, token_len, true))
+			struct parse_chunk *chunk = &current[i];
+			if(chunk->oom)
 			{
-				// Exact match found
-				if(checkOnly)
-				{
-					// Increment counter
-					exact_domains++;
-					goto next_domain;
-				}
-
-				// else: Append domain to database using prepared statement
-				// Append domain to database using prepared statement
-				if(sqlite3_bind_text(stmt, 1, token, token_len, SQLITE_STATIC) != SQLITE_OK)
-				{
-					printf("%s  %s Unable to bind domain to SQL statement to insert domains into database file %s\n",
-					over, cross, outfile);
-					fclose(fpin);
-					sqlite3_close(db);
-					return EXIT_FAILURE;
-				}
-				if(sqlite3_step(stmt) != SQLITE_DONE)
-				{
-					printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
-					fclose(fpin);
-					sqlite3_close(db);
-					return EXIT_FAILURE;
-				}
-				sqlite3_reset(stmt);
-				// Increment counter
-				exact_domains++;
+				printf("%s  %s Unable to allocate memory for parsing %s\n", over, cross, infile);
+				goto end_of_parseList;
 			}
-			else if(token[0] == (antigravity ? '@' : '|') &&         // <- ABP-style match
-			        valid_abp_domain(token, token_len, antigravity)) // <- Valid ABP domain
+
+			// Append domains to database (only the new ones for
+			// incremental updates)
+			if(!checkOnly && !(incremental ? diff_chunk(chunk, &old, stmt, &added) :
+			                                 insert_chunk(chunk, batch, stmt)))
 			{
-				// ABP-style match (see comments above)
-				if(checkOnly)
-				{
-					// Increment counter
-					abp_domains++;
-					goto next_domain;
-				}
+				printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
+				goto end_of_parseList;
+			}
 
-				// else: Append pattern to database using prepared statement
-				if(sqlite3_bind_text(stmt, 1, token, token_len, SQLITE_STATIC) != SQLITE_OK)
-				{
-					printf("%s  %s Unable to bind domain to SQL statement to insert domains into database file %s\n",
-					over, cross, outfile);
-					fclose(fpin);
-					sqlite3_close(db);
-					return EXIT_FAILURE;
-				}
-				if(sqlite3_step(stmt) != SQLITE_DONE)
-				{
-					printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
-					fclose(fpin);
-					sqlite3_close(db);
-					return EXIT_FAILURE;
-				}
-				sqlite3_reset(stmt);
-				abp_domains++;
+			// Report invalid entries in the order of the list
+			size_t roffset = 0u, rlineno = 0u, len = 0u;
+			const char *token = NULL;
+			while(checkOnly && (token = next_record(chunk, &roffset, &rlineno, &len)) != NULL)
+			{
+				printf("%s  %s Invalid domain on line %zu: ", over, cross, lineno + rlineno);
+				print_escaped(token, len);
+				puts("");
 			}
-			else
+			for(unsigned int j = 0; j < chunk->invalid_domains_list_len; j++)
+				add_invalid_sample(invalid_domains_list, invalid_domains_list_lengths, &invalid_domains_list_len,
+				                   chunk->invalid_domains_list[j], chunk->invalid_domains_list_lengths[j]);
+
+			// Update counters
+			exact_domains += chunk->exact_domains;
+			abp_domains += chunk->abp_domains;
+			invalid_domains += chunk->invalid_domains;
+			lineno += chunk->lines;
+			total_read += chunk->len;
+
+			// Print progress if the file is large enough
+			// This code cannot be reached if checkOnly is true
+			if(fsize > PRINT_PROGRESS_THRESHOLD && total_read - last_print > print_step)
 			{
-				// No match - This is an invalid domain or a false positive
-
-				// Ignore false positives - they don't count as invalid domains
-				if(!is_false_positive(token))
+				last_print = total_read;
+				// Calculate progress
+				const int progress = (int)(100.0*total_read/fsize);
+				// Print progress if it has changed
+				if(progress > last_progress)
 				{
-					if(checkOnly)
-					{
-						// Increment counter
-						invalid_domains++;
-						printf("%s  %s Invalid domain on line %zu: ", over, cross, lineno);
-						print_escaped(token, token_len);
-						puts("");
-						goto next_domain;
-					}
-					// Add the domain to invalid_domains_list only
-					// if the list contains < MAX_INVALID_DOMAINS
-					if(invalid_domains_list_len < MAX_INVALID_DOMAINS)
-					{
-						// Check if we have this domain already
-						bool found = false;
-						for(unsigned int i = 0; i < invalid_domains_list_len; i++)
-						{
-							// Do not compare against unset entries
-							if(invalid_domains_list[i] == NULL || invalid_domains_list_lengths[i] == -1)
-								break;
-
-							// Compare against the current domain
-							if(memcmp(invalid_domains_list[i], token, min((ssize_t)token_len, invalid_domains_list_lengths[i])) == 0)
-							{
-								found = true;
-								break;
-							}
-						}
-
-						// If not found, add it to the list
-						if(!found)
-						{
-							invalid_domains_list[invalid_domains_list_len] = calloc(token_len + 1, sizeof(char));
-							if(invalid_domains_list[invalid_domains_list_len] == NULL)
-							{
-								printf("%s  %s Unable to allocate memory for invalid domains list\n", over, cross);
-								fclose(fpin);
-								sqlite3_close(db);
-								return EXIT_FAILURE;
-							}
-							memcpy(invalid_domains_list[invalid_domains_list_len], token, token_len);
-							invalid_domains_list[invalid_domains_list_len][token_len] = '\0';
-							invalid_domains_list_lengths[invalid_domains_list_len] = token_len;
-							invalid_domains_list_len++;
-						}
-
-					}
-					invalid_domains++;
+					printf("%s  %s Processed %i%% of downloaded list", over, info, progress);
+					fflush(stdout);
+					last_progress = progress;
 				}
 			}
-next_domain:
-			token = strtok(NULL, " \t");
 		}
 
-		// Print progress if the file is large enough every 100 lines
-		// This code cannot be reached if checkOnly is true
-		if(fsize > PRINT_PROGRESS_THRESHOLD && total_read - last_print > print_step)
-		{
-			last_print = total_read;
-			// Calculate progress
-			const int progress = (int)(100.0*total_read/fsize);
-			// Print progress if it has changed
-			if(progress > last_progress)
-			{
-				printf("%s  %s Processed %i%% of downloaded list", over, info, progress);
-				fflush(stdout);
-				last_progress = progress;
-			}
-		}
+		round = next;
+		num = next_num;
 	}
 
 	// Skip to end of parseList if we are only checking the list
 	if(checkOnly)
-		goto end_of_parseList;
+		goto print_summary;
 
-	// Finalize SQL statement
-	if(sqlite3_finalize(stmt) != SQLITE_OK)
+	// Delete the domains no longer on the list
+	if(incremental && !delete_unseen_rows(db, antigravity, search_index, &old, &removed))
 	{
-		printf("%s  %s Unable to finalize SQL statement to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		printf("%s  %s Unable to update domains in database file %s: %s\n",
+		       over, cross, outfile, sqlite3_errmsg(db));
+		goto end_of_parseList;
 	}
 
 	// Update database properties
@@ -526,12 +1270,18 @@ next_domain:
 		{
 			printf("%s  %s Unable to update database properties in database file %s\n",
 			       over, cross, outfile);
-			fclose(fpin);
-			sqlite3_close(db);
-			return EXIT_FAILURE;
+			goto end_of_parseList;
 		}
 	}
 
+	// Add the domains of this list to the search index
+	if(search_index && (last_rowid < 0 || !update_search_index(db, antigravity, last_rowid)))
+	{
+		printf("%s  %s Unable to update search index in database file %s: %s\n",
+		       over, cross, outfile, sqlite3_errmsg(db));
+		goto end_of_parseList;
+	}
+
 	// Update number of domains and update timestamp on this list
 	// The `date_updated` column is updated conditionally using a `CASE`
 	// expression. If the `status` column of the row is `1` (= list has been
@@ -541,63 +1291,52 @@ next_domain:
 	// the `status` is not `1` (we used a cached list either because there
 	// are no changes or the download failed), the `date_updated` column
 	// retains its existing value.
+	sqlite3_finalize(stmt);
 	sql = "UPDATE adlist SET number = ?, invalid_domains = ?, abp_entries = ?, date_updated = CASE WHEN status = 1 THEN cast(strftime('%s', 'now') as int) ELSE date_updated END WHERE id = ?;";
 	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to prepare SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
 	if(sqlite3_bind_int(stmt, 1, exact_domains + abp_domains) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind number of entries to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 	if(sqlite3_bind_int(stmt, 2, invalid_domains) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind number of invalid domains to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 	if(sqlite3_bind_int(stmt, 3, abp_domains) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind number of ABP entries to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 	if(sqlite3_bind_int(stmt, 4, adlistID) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind adlist ID to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 	if(sqlite3_step(stmt) != SQLITE_DONE)
 	{
 		printf("%s  %s Unable to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
-	if(sqlite3_finalize(stmt) != SQLITE_OK)
+
+	// Remember which list the domains have been parsed from
+	if(!set_list_checksum(db, adlistID, checksum))
 	{
-		printf("%s  %s Unable to finalize SQL statement to update adlist properties in database file %s\n",
+		printf("%s  %s Unable to store list checksum in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
 	// End transaction
@@ -605,12 +1344,10 @@ next_domain:
 	{
 		printf("%s  %s Unable to end transaction to insert domains into database file %s (database file may be corrupted)\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		goto end_of_parseList;
 	}
 
-end_of_parseList:
+print_summary:
 	// Print summary
 	printf("%s  %s Parsed %u exact domains and %u ABP-style domains (%sing, ignored %u non-domain entries)\n",
 	       over, tick, exact_domains, abp_domains, antigravity ? "allow" : "block", invalid_domains);
@@ -626,18 +1363,171 @@ end_of_parseList:
 			puts("");
 		}
 	}
+	if(incremental)
+		printf("  %s Added %d and removed %d domains\n", info, added, removed);
+
+	// Print throughput
+	const double elapsed = max(double_time() - start, 1e-6);
+	printf("  %s Processed %zu lines (%.1f MB) in %.2f s using %u thread%s (%.0f lines/s, %.1f MB/s)\n",
+	       info, lineno, 1e-6*fsize, elapsed, threads, threads == 1 ? "" : "s",
+	       lineno/elapsed, 1e-6*fsize/elapsed);
+
+	ret = EXIT_SUCCESS;
+
+end_of_parseList:
+	// Wait for parser threads which may still be running after an error
+	if(running != NULL)
+		for(unsigned int i = 0; i < 2*threads; i++)
+			if(running[i])
+				pthread_join(tids[i], NULL);
 
 	// Free memory
-	free(line);
+	if(chunks != NULL)
+	{
+		for(unsigned int i = 0; i < 2*threads; i++)
+		{
+			free(chunks[i].records);
+			free(chunks[i].line);
+			for(unsigned int j = 0; j < chunks[i].invalid_domains_list_len; j++)
+				free(chunks[i].invalid_domains_list[j]);
+		}
+	}
+	free(chunks);
+	free(tids);
+	free(running);
+	free(old.rows);
+	free(old.added);
 	for(unsigned int i = 0; i < invalid_domains_list_len; i++)
 		if(invalid_domains_list[i] != NULL)
 			free(invalid_domains_list[i]);
 
 	// Close files
-	fclose(fpin);
+	if(list != NULL)
+		munmap((void*)list, fsize);
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(batch);
 	if(db != NULL)
 		sqlite3_close(db);
 
-	// Return success
-	return EXIT_SUCCESS;
+	return ret;
+}
+
+// Validate all domains of the benchmark corpus, returns the number of valid ones
+static size_t bench_validator(bool (*validator)(const char*, const size_t, const bool),
+                              const char *buffer, const size_t *offsets, const size_t num,
+                              bool *results, double *elapsed)
+{
+	size_t valid = 0;
+	const double t0 = double_time();
+	for(size_t i = 0; i < num; i++)
+	{
+		results[i] = validator(buffer + offsets[i], offsets[i + 1] - offsets[i], true);
+		valid += results[i];
+	}
+	*elapsed = double_time() - t0;
+
+	return valid;
+}
+
+/**
+ * Benchmark the domain validation on a list corpus
+ *
+ * All domains (one per line) are read into memory first and then validated
+ * byte by byte and using the vectorized validator (if available on this
+ * architecture). Both validators have to agree on every domain.
+ *
+ * @param filename File with domains (one per line), "-" for stdin
+ * @return Exit code
+ */
+int domain_bench(const char *filename)
+{
+	const char *info = cli_info();
+	FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+	if(fp == NULL)
+	{
+		printf("%s Cannot open %s: %s\n", cli_cross(), filename, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	// Store all domains back to back, domain i spans from offsets[i] to
+	// offsets[i+1]
+	char *buffer = NULL, *line = NULL;
+	size_t *offsets = NULL, bufsize = 0, used = 0, num = 0, cap = 0, len = 0;
+	bool *scalar = NULL, *vector = NULL;
+	int ret = EXIT_FAILURE;
+	ssize_t read = 0;
+	while((read = getline(&line, &len, fp)) != -1)
+	{
+		while(read > 0 && isspace(line[read-1]))
+			read--;
+		if(read < 1 || line[0] == '#')
+			continue;
+
+		if(used + read > bufsize)
+		{
+			bufsize = MAX(2*bufsize, used + read + 4096u);
+			char *new = realloc(buffer, bufsize);
+			if(new == NULL)
+				goto end_of_domain_bench;
+			buffer = new;
+		}
+		if(num + 2 > cap)
+		{
+			cap = cap > 0 ? 2*cap : 4096u;
+			size_t *new = realloc(offsets, cap * sizeof(*offsets));
+			if(new == NULL)
+				goto end_of_domain_bench;
+			offsets = new;
+		}
+		memcpy(buffer + used, line, read);
+		offsets[num++] = used;
+		used += read;
+		offsets[num] = used;
+	}
+	printf("%s Read %zu domains from %s\n", info, num, filename);
+	if(num == 0 || (scalar = calloc(num, sizeof(*scalar))) == NULL ||
+	   (vector = calloc(num, sizeof(*vector))) == NULL)
+		goto end_of_domain_bench;
+
+	double elapsed = 0.0;
+	const size_t valid = bench_validator(valid_domain_scalar, buffer, offsets, num, scalar, &elapsed);
+	printf("%s Scalar validator: %zu valid domains in %.3f msec (%.1f nsec/domain)\n",
+	       info, valid, 1e3*elapsed, 1e9*elapsed/num);
+
+#ifdef HAVE_VECTOR_VALIDATION
+	const size_t valid_vector = bench_validator(valid_domain_vector, buffer, offsets, num, vector, &elapsed);
+	printf("%s Vector validator: %zu valid domains in %.3f msec (%.1f nsec/domain)\n",
+	       info, valid_vector, 1e3*elapsed, 1e9*elapsed/num);
+
+	// Both validators must accept exactly the same domains
+	size_t mismatches = 0;
+	for(size_t i = 0; i < num; i++)
+	{
+		if(scalar[i] == vector[i])
+			continue;
+		if(mismatches++ < MAX_INVALID_DOMAINS)
+			printf("%s Validators disagree on \"%.*s\"\n", cli_cross(),
+			       (int)(offsets[i + 1] - offsets[i]), buffer + offsets[i]);
+	}
+	if(mismatches > 0)
+	{
+		printf("%s Validators disagree on %zu domains\n", cli_cross(), mismatches);
+		goto end_of_domain_bench;
+	}
+#else
+	printf("%s No vector validator available on this architecture\n", info);
+#endif
+
+	ret = EXIT_SUCCESS;
+
+end_of_domain_bench:
+	free(line);
+	free(buffer);
+	free(offsets);
+	free(scalar);
+	free(vector);
+	if(fp != stdin)
+		fclose(fp);
+
+	return ret;
 }
@@ -22,9 +22,32 @@
 // defined in src/dnsmasq/rfc1035.c
 extern int private_net(struct in_addr addr, int ban_localhost);
 
-static bool nlrequest(int fd, struct sockaddr_nl *sa, int nlmsg_type)
+// Large enough for any request header plus the filter attributes
+#define NLREQLEN 128
+
+// State of a running dump
+struct nl_query {
+	cJSON *json;
+	struct nl_filter *filter;
+	void (*callback)(cJSON *item, void *data);
+	void *data;
+	bool detailed;
+};
+
+// Append a 32 bit attribute to a request
+static void nlrequest_u32(struct nlmsghdr *nl, const unsigned short type, const uint32_t value)
 {
-	char buf[BUFLEN] = { 0 };
+	struct rtattr *rta = (struct rtattr*)(void*)((char*)nl + NLMSG_ALIGN(nl->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(sizeof(value));
+	memcpy(RTA_DATA(rta), &value, sizeof(value));
+	nl->nlmsg_len = NLMSG_ALIGN(nl->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static bool nlrequest(int fd, struct sockaddr_nl *sa, int nlmsg_type, const struct nl_filter *filter)
+{
+	// Use uint32_t to get the alignment netlink messages need
+	uint32_t buf[NLREQLEN / sizeof(uint32_t)] = { 0 };
 	// Assemble the message according to the netlink protocol
 	struct nlmsghdr *nl;
 	nl = (struct nlmsghdr*)(void*)buf;
@@ -38,6 +61,13 @@ static bool nlrequest(int fd, struct sockaddr_nl *sa, int nlmsg_type)
 
 		struct ifaddrmsg *ifa = (struct ifaddrmsg*)NLMSG_DATA(nl);
 		ifa->ifa_family = AF_LOCAL;
+
+		// Let the kernel filter the dump if possible (see nlquery())
+		if(filter != NULL)
+		{
+			ifa->ifa_family = filter->family;
+			ifa->ifa_index = filter->ifindex;
+		}
 	}
 	else if(nlmsg_type == RTM_GETROUTE)
 	{
@@ -46,6 +76,19 @@ static bool nlrequest(int fd, struct sockaddr_nl *sa, int nlmsg_type)
 
 		struct rtmsg *rt = (struct rtmsg*)NLMSG_DATA(nl);
 		rt->rtm_family = AF_LOCAL;
+
+		// Let the kernel filter the dump if possible (see nlquery())
+		if(filter != NULL)
+		{
+			rt->rtm_family = filter->family;
+			if(filter->table > 0)
+			{
+				rt->rtm_table = filter->table < 256 ? filter->table : RT_TABLE_UNSPEC;
+				nlrequest_u32(nl, RTA_TABLE, filter->table);
+			}
+			if(filter->ifindex > 0)
+				nlrequest_u32(nl, RTA_OIF, filter->ifindex);
+		}
 	}
 	else if(nlmsg_type == RTM_GETLINK)
 	{
@@ -55,6 +98,14 @@ static bool nlrequest(int fd, struct sockaddr_nl *sa, int nlmsg_type)
 		struct ifinfomsg *link = (struct ifinfomsg*)NLMSG_DATA(nl);
 		link->ifi_family = AF_UNSPEC;
 	}
+	else if(nlmsg_type == RTM_GETNEIGH)
+	{
+		// Request neighbor information
+		nl->nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+
+		struct ndmsg *ndm = (struct ndmsg*)NLMSG_DATA(nl);
+		ndm->ndm_family = AF_UNSPEC;
+	}
 	nl->nlmsg_type = nlmsg_type;
 
 	// Prepare struct msghdr for sending
@@ -98,7 +149,49 @@ static ssize_t nlgetmsg(int fd, struct sockaddr_nl *sa, void *buf, size_t len)
 	return rcv;
 }
 
-static int nlparsemsg_route(struct rtmsg *rt, void *buf, size_t len, cJSON *routes, const bool detailed)
+// Check a route against the filter without parsing it
+static bool __attribute__((pure)) nlfilter_route(const struct rtmsg *rt, void *buf, size_t len, const struct nl_filter *filter)
+{
+	if(filter->family != AF_UNSPEC && rt->rtm_family != filter->family)
+		return false;
+
+	// Routing tables above 255 are only given as attribute
+	uint32_t table = rt->rtm_table;
+	bool oif = filter->ifindex == 0;
+	struct rtattr *rta = NULL;
+	for_each_rattr(rta, buf, len)
+	{
+		if(rta->rta_type == RTA_TABLE)
+			table = *(uint32_t*)RTA_DATA(rta);
+		else if(rta->rta_type == RTA_OIF && *(uint32_t*)RTA_DATA(rta) == filter->ifindex)
+			oif = true;
+		else if(rta->rta_type == RTA_MULTIPATH)
+		{
+			// Multipath routes match if any of their nexthops does
+			struct rtnexthop *rtnh = (struct rtnexthop*)RTA_DATA(rta);
+			int nhlen = RTA_PAYLOAD(rta);
+			while(RTNH_OK(rtnh, nhlen))
+			{
+				if((unsigned int)rtnh->rtnh_ifindex == filter->ifindex)
+					oif = true;
+				nhlen -= NLMSG_ALIGN(rtnh->rtnh_len);
+				rtnh = RTNH_NEXT(rtnh);
+			}
+		}
+	}
+
+	return oif && (filter->table == 0 || table == filter->table);
+}
+
+// Count a matching object and check if it is on the requested page
+static bool nlfilter_page(struct nl_filter *filter)
+{
+	const unsigned int idx = filter->matched++;
+	return idx >= filter->start &&
+	       (filter->length < 0 || idx - filter->start < (unsigned int)filter->length);
+}
+
+static cJSON *nlparsemsg_route(struct rtmsg *rt, void *buf, size_t len, const bool detailed)
 {
 	char ifname[IF_NAMESIZE];
 	cJSON *route = cJSON_CreateObject();
@@ -303,8 +396,7 @@ static int nlparsemsg_route(struct rtmsg *rt, void *buf, size_t len, cJSON *rout
 		          via ? via->valuestring : "direct");
 	}
 
-	cJSON_AddItemToArray(routes, route);
-	return 0;
+	return route;
 }
 
 static int nlparsemsg_address(struct ifaddrmsg *ifa, void *buf, size_t len, cJSON *links, const bool detailed)
@@ -1106,8 +1198,10 @@ static int nlparsemsg_link(struct ifinfomsg *ifi, void *buf, size_t len, cJSON *
 	return 0;
 }
 
-static uint32_t parse_nl_msg(void *buf, size_t len, cJSON *json, const bool detailed)
+static uint32_t parse_nl_msg(void *buf, size_t len, struct nl_query *query)
 {
+	struct nl_filter *filter = query->filter;
+	const bool detailed = query->detailed;
 	struct nlmsghdr *nl = NULL;
 	for_each_nlmsg(nl, buf, len)
 	{
@@ -1128,20 +1222,39 @@ static uint32_t parse_nl_msg(void *buf, size_t len, cJSON *json, const bool deta
 		// Evaluate the message type
 		if (nl->nlmsg_type == RTM_NEWROUTE)
 		{
+			// Skip filtered routes before creating any JSON
+			// objects for them, dumps of full routing tables can
+			// be huge
 			struct rtmsg *rt = (struct rtmsg*)NLMSG_DATA(nl);
-			nlparsemsg_route(rt, RTM_RTA(rt), RTM_PAYLOAD(nl), json, detailed);
+			if(filter != NULL &&
+			   (!nlfilter_route(rt, RTM_RTA(rt), RTM_PAYLOAD(nl), filter) || !nlfilter_page(filter)))
+				continue;
+
+			cJSON *route = nlparsemsg_route(rt, RTM_RTA(rt), RTM_PAYLOAD(nl), detailed);
+			if(query->callback != NULL)
+				query->callback(route, query->data);
+			else
+				cJSON_AddItemToArray(query->json, route);
 			continue;
 		}
 		else if (nl->nlmsg_type == RTM_NEWADDR)
 		{
 			struct ifaddrmsg *ifa = (struct ifaddrmsg*)NLMSG_DATA(nl);
-			nlparsemsg_address(ifa, IFA_RTA(ifa), IFA_PAYLOAD(nl), json, detailed);
+			if(filter != NULL &&
+			   ((filter->family != AF_UNSPEC && ifa->ifa_family != filter->family) ||
+			    (filter->ifindex > 0 && ifa->ifa_index != filter->ifindex)))
+				continue;
+			nlparsemsg_address(ifa, IFA_RTA(ifa), IFA_PAYLOAD(nl), query->json, detailed);
 			continue;
 		}
 		else if (nl->nlmsg_type == RTM_NEWLINK)
 		{
 			struct ifinfomsg *ifi = (struct ifinfomsg*)NLMSG_DATA(nl);
-			nlparsemsg_link(ifi, IFLA_RTA(ifi), IFLA_PAYLOAD(nl), json, detailed);
+			if(filter != NULL &&
+			   ((filter->ifindex > 0 && (unsigned int)ifi->ifi_index != filter->ifindex) ||
+			    !nlfilter_page(filter)))
+				continue;
+			nlparsemsg_link(ifi, IFLA_RTA(ifi), IFLA_PAYLOAD(nl), query->json, detailed);
 			continue;
 		}
 		else
@@ -1151,6 +1264,11 @@ static uint32_t parse_nl_msg(void *buf, size_t len, cJSON *json, const bool deta
 
 	}
 
+	// All messages have been parsed, the dump continues in the next buffer
+	// (the receive buffer is reused so there is nothing beyond len)
+	if(!NLMSG_OK(nl, (uint32_t)len))
+		return NLMSG_NOOP;
+
 	// Print message properties in debug mode
 	if(config.debug.netlink.v.b)
 	{
@@ -1191,7 +1309,7 @@ static uint32_t parse_nl_msg(void *buf, size_t len, cJSON *json, const bool deta
 	return nl->nlmsg_type;
 }
 
-static int nlquery(const int type, cJSON *json, const bool detailed)
+static int nlquery(const int type, struct nl_query *query)
 {
 	// First of all, we need to create a socket with the AF_NETLINK domain
 	const int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
@@ -1212,6 +1330,12 @@ static int nlquery(const int type, cJSON *json, const bool detailed)
 	int on = 1;
 	setsockopt(fd, SOL_NETLINK, NETLINK_EXT_ACK, &on, sizeof(on));
 
+	// Ask the kernel to apply the filter to the dump already. This is
+	// supported since Linux 4.20, older kernels ignore it. Matching objects
+	// are checked again while parsing in any case
+	if(query->filter != NULL)
+		setsockopt(fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &on, sizeof(on));
+
 	// Prepare source address
 	struct sockaddr_nl local = { 0 };
 	local.nl_family = AF_NETLINK;
@@ -1229,32 +1353,42 @@ static int nlquery(const int type, cJSON *json, const bool detailed)
 
 	// Send the request
 	log_debug(DEBUG_NETLINK, "Calling nlrequest(type = %d)", type);
-	if(!nlrequest(fd, &kernel, type))
+	if(!nlrequest(fd, &kernel, type, query->filter))
 	{
 		log_err("nlrequest error: %s", strerror(errno));
 		close(fd);
 		return -1;
 	}
 
+	// Messages are parsed in place, the receive buffer is reused for the
+	// entire dump
+	char *buf = malloc(BUFLEN);
+	if(buf == NULL)
+	{
+		log_err("nlquery error: %s", strerror(ENOMEM));
+		close(fd);
+		return -1;
+	}
+
 	// Receive and parse the response, continue until we receive a
 	// NLMSG_DONE which indicates the end of the message (we explicitly
 	// request it via NLM_F_DUMP). We do NOT set NLM_F_ACK as we do not
 	// want to receive an ERROR-typed ACK message here.
 	while(true)
 	{
-		char buf[BUFLEN] = { 0 };
 		log_debug(DEBUG_NETLINK, "Calling nlgetmsg(type = %d)", type);
 		ssize_t len = nlgetmsg(fd, &kernel, buf, BUFLEN);
 		if(len < 0)
 		{
 			log_err("nlgetmsg error: %s", strerror(errno));
+			free(buf);
 			close(fd);
 			return -1;
 		}
 
 		// Parse the contained messages
 		log_debug(DEBUG_NETLINK, "Calling parse_nl_msg (len = %zd)", len);
-		const uint32_t nl_msg_type = parse_nl_msg(buf, len, json, detailed);
+		const uint32_t nl_msg_type = parse_nl_msg(buf, len, query);
 
 		// Break if nothing was received or the last received message
 		// was either a NLMSG_DONE or NLMSG_ERROR message. The latter
@@ -1268,6 +1402,7 @@ static int nlquery(const int type, cJSON *json, const bool detailed)
 			break;
 	}
 
+	free(buf);
 	close(fd);
 	return 0;
 
@@ -1276,17 +1411,216 @@ static int nlquery(const int type, cJSON *json, const bool detailed)
 bool nlroutes(cJSON *routes, const bool detailed)
 {
 	log_debug(DEBUG_NETLINK, "Called nlroutes");
-	return nlquery(RTM_GETROUTE, routes, detailed);
+	struct nl_query query = { .json = routes, .detailed = detailed };
+	return nlquery(RTM_GETROUTE, &query);
+}
+
+/**
+ * @brief Dump the routes matching the filter
+ *
+ * Routes are handed to the callback one by one as they are parsed (the
+ * callback owns them), so memory usage does not depend on the size of the
+ * routing table. Filtered routes are skipped before any JSON is created.
+ *
+ * @param filter Routes to return, filter->matched is set to the number of
+ * matching routes
+ * @param detailed Include detailed information
+ * @param callback Function receiving the routes
+ * @param data Passed to the callback
+ * @return true on success
+ */
+bool nlroutes_stream(struct nl_filter *filter, const bool detailed,
+                     void (*callback)(cJSON *route, void *data), void *data)
+{
+	log_debug(DEBUG_NETLINK, "Called nlroutes_stream");
+	filter->matched = 0;
+	struct nl_query query = { .filter = filter, .callback = callback, .data = data, .detailed = detailed };
+	return nlquery(RTM_GETROUTE, &query) == 0;
 }
 
-bool nladdrs(cJSON *interfaces, const bool detailed)
+bool nladdrs(cJSON *interfaces, struct nl_filter *filter, const bool detailed)
 {
 	log_debug(DEBUG_NETLINK, "Called nladdrs");
-	return nlquery(RTM_GETADDR, interfaces, detailed);
+	struct nl_query query = { .json = interfaces, .filter = filter, .detailed = detailed };
+	return nlquery(RTM_GETADDR, &query);
 }
 
-bool nllinks(cJSON *interfaces, const bool detailed)
+bool nllinks(cJSON *interfaces, struct nl_filter *filter, const bool detailed)
 {
 	log_debug(DEBUG_NETLINK, "Called nllinks");
-	return nlquery(RTM_GETLINK, interfaces, detailed);
+	if(filter != NULL)
+		filter->matched = 0;
+	struct nl_query query = { .json = interfaces, .filter = filter, .detailed = detailed };
+	return nlquery(RTM_GETLINK, &query);
+}
+
+/**
+ * @brief Subscribe to neighbor, address and link changes
+ *
+ * The returned non-blocking socket receives a message whenever the kernel's
+ * neighbor cache, the addresses or the links of this host change. Use
+ * nlneigh_dump() to get the current neighbor cache and nlneigh_read() to
+ * process both.
+ *
+ * @return Socket or -1 on error
+ */
+int nlneigh_subscribe(void)
+{
+	const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if(fd < 0)
+	{
+		log_err("netlink socket error: %s", strerror(errno));
+		return -1;
+	}
+
+	// Events are read only every now and then, a larger buffer makes
+	// overflows (and hence full dumps) less likely
+	const int buffer_size = NLNEIGH_RCVBUF;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+	struct sockaddr_nl local = { 0 };
+	local.nl_family = AF_NETLINK;
+	local.nl_groups = RTMGRP_NEIGH | RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if(bind(fd, (struct sockaddr*)&local, sizeof(local)) != 0)
+	{
+		log_err("netlink bind error: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief Request a dump of the neighbor cache on a subscribed socket
+ *
+ * The entries are received by nlneigh_read() like any other event.
+ *
+ * @param fd Socket returned by nlneigh_subscribe()
+ * @return true on success, false otherwise
+ */
+bool nlneigh_dump(const int fd)
+{
+	struct sockaddr_nl kernel = { 0 };
+	kernel.nl_family = AF_NETLINK;
+	if(!nlrequest(fd, &kernel, RTM_GETNEIGH, NULL))
+	{
+		log_err("nlrequest error: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+// Convert a neighbor message into what we need to know about it
+static bool nlparsemsg_neigh(const struct nlmsghdr *nh, struct nl_neigh *neigh)
+{
+	const struct ndmsg *ndm = NLMSG_DATA(nh);
+	if(ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6)
+		return false;
+
+	// Like "ip neigh show", we ignore entries not resolved via ARP/NDP
+	// (e.g., multicast addresses)
+	if(ndm->ndm_state & NUD_NOARP)
+		return false;
+
+	memset(neigh, 0, sizeof(*neigh));
+	neigh->deleted = nh->nlmsg_type == RTM_DELNEIGH;
+	neigh->ifindex = ndm->ndm_ifindex;
+
+	bool have_dst = false;
+	struct rtattr *rta = NULL;
+	int len = (int)RTM_PAYLOAD(nh);
+	for_each_rattr(rta, RTM_RTA(ndm), len)
+	{
+		if(rta->rta_type == NDA_DST)
+			have_dst = inet_ntop(ndm->ndm_family, RTA_DATA(rta), neigh->ip, sizeof(neigh->ip)) != NULL;
+		else if(rta->rta_type == NDA_LLADDR)
+		{
+			// Format the link-layer address the same way as "ip"
+			const unsigned char *addr = RTA_DATA(rta);
+			size_t pos = 0;
+			for(size_t i = 0; i < RTA_PAYLOAD(rta) && pos + 3 < sizeof(neigh->hwaddr); i++)
+				pos += snprintf(neigh->hwaddr + pos, sizeof(neigh->hwaddr) - pos, "%s%02x", i > 0 ? ":" : "", addr[i]);
+		}
+	}
+
+	// Entries without a link-layer address (yet) are incomplete
+	neigh->complete = neigh->hwaddr[0] != '\0' && !(ndm->ndm_state & (NUD_INCOMPLETE | NUD_FAILED));
+
+	return have_dst && if_indextoname(neigh->ifindex, neigh->iface) != NULL;
+}
+
+/**
+ * @brief Read all pending messages from a subscribed socket
+ *
+ * Neighbor changes are passed to the callback one by one, address and link
+ * changes are only reported in the return value.
+ *
+ * @param fd Socket returned by nlneigh_subscribe()
+ * @param callback Function called for every neighbor message
+ * @return Bitmask of enum nl_events
+ */
+unsigned int nlneigh_read(const int fd, void (*callback)(const struct nl_neigh *neigh))
+{
+	unsigned int events = NL_EVENTS_NONE;
+	// Use uint32_t to get the alignment netlink messages need
+	uint32_t buf[BUFLEN / sizeof(uint32_t)];
+	while(true)
+	{
+		const ssize_t rcv = recv_nowarn(fd, buf, sizeof(buf), 0);
+		if(rcv < 0)
+		{
+			// Messages have been lost, the caller needs to start over
+			if(errno == ENOBUFS)
+			{
+				events |= NL_EVENTS_OVERFLOW;
+				continue;
+			}
+			if(errno != EAGAIN && errno != EINTR)
+				log_err("netlink receive error: %s", strerror(errno));
+			break;
+		}
+
+		ssize_t len = rcv;
+		struct nlmsghdr *nh = NULL;
+		for_each_nlmsg(nh, buf, len)
+		{
+			switch(nh->nlmsg_type)
+			{
+				case RTM_NEWNEIGH:
+				case RTM_DELNEIGH:
+				{
+					struct nl_neigh neigh;
+					if(nlparsemsg_neigh(nh, &neigh))
+					{
+						callback(&neigh);
+						events |= NL_EVENTS_NEIGH;
+					}
+					break;
+				}
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					events |= NL_EVENTS_IFACE;
+					break;
+				case NLMSG_OVERRUN:
+					events |= NL_EVENTS_OVERFLOW;
+					break;
+				case NLMSG_ERROR:
+					// Acknowledgement of a dump request
+					events |= NL_EVENTS_DONE;
+					break;
+				default:
+					break;
+			}
+		}
+
+		// for_each_nlmsg() stops at the end of a dump
+		if(NLMSG_OK(nh, (uint32_t)len) && nh->nlmsg_type == NLMSG_DONE)
+			events |= NL_EVENTS_DONE;
+	}
+
+	return events;
 }
@@ -23,9 +23,48 @@
 #include <linux/if_addr.h>
 #include <linux/if_arp.h>
 
+// Restrict a dump to matching objects, members left at zero match anything.
+// Only objects from start to start + length (length < 0: all) of the matching
+// ones are returned, matched counts all of them
+struct nl_filter {
+	int family;
+	uint32_t table;
+	unsigned int ifindex;
+	unsigned int start;
+	int length;
+	unsigned int matched;
+};
+
 bool nlroutes(cJSON *routes, const bool detailed);
-bool nladdrs(cJSON *interfaces, const bool detailed);
-bool nllinks(cJSON *interfaces, const bool detailed);
+bool nlroutes_stream(struct nl_filter *filter, const bool detailed,
+                     void (*callback)(cJSON *route, void *data), void *data);
+bool nladdrs(cJSON *interfaces, struct nl_filter *filter, const bool detailed);
+bool nllinks(cJSON *interfaces, struct nl_filter *filter, const bool detailed);
+
+// Receive buffer of the neighbor event subscription
+#define NLNEIGH_RCVBUF (1024 * 1024)
+
+// A neighbor cache entry as reported by the kernel
+struct nl_neigh {
+	bool deleted;
+	bool complete;
+	int ifindex;
+	char ip[INET6_ADDRSTRLEN];
+	char iface[IF_NAMESIZE];
+	char hwaddr[3 * MAX_ADDR_LEN];
+};
+
+enum nl_events {
+	NL_EVENTS_NONE = 0,
+	NL_EVENTS_NEIGH = 1 << 0,
+	NL_EVENTS_IFACE = 1 << 1,
+	NL_EVENTS_OVERFLOW = 1 << 2,
+	NL_EVENTS_DONE = 1 << 3
+};
+
+int nlneigh_subscribe(void);
+bool nlneigh_dump(const int fd);
+unsigned int nlneigh_read(const int fd, void (*callback)(const struct nl_neigh *neigh));
 
 // Netlink expects that the user buffer will be at least 8kB or a page size of
 // the CPU architecture, whichever is bigger. Particular Netlink families may,
@@ -0,0 +1,713 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Simulation of candidate block lists against the long-term database
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "tools/simulate.h"
+#include "log.h"
+// cli_info(), cli_bold(), cli_normal()
+#include "args.h"
+// struct config
+#include "config/config.h"
+// get_blocked_statuslist(), strtolower()
+#include "datastructure.h"
+// compile_regex(), regex_matches()
+#include "regex_r.h"
+// struct regex_set
+#include "regex-set.h"
+// gravity_hash(), gravity_entry_hash()
+#include "database/gravity-index.h"
+#include "database/sqlite3.h"
+
+// Query types blocked by exact domains, ABP-style patterns and regex without
+// querytype option
+#define SIM_ALL_TYPES UINT32_MAX
+
+// The candidate block lists merged into one set
+struct sim_candidates {
+	// Hashes of exact domains and ABP-style patterns (see
+	// gravity_entry_hash()), sorted for bsearch()
+	uint64_t *hashes;
+	size_t num_hashes;
+	size_t size_hashes;
+	regexData *regex;
+	unsigned int num_regex;
+};
+
+struct sim_domain {
+	sqlite3_int64 id;
+	char *domain;
+	// Query types for which this domain would be blocked (bitmask)
+	uint32_t types;
+	unsigned long queries;
+	// Matching queries which have not been blocked before
+	unsigned long newly;
+	unsigned int clients;
+};
+
+struct sim_client {
+	sqlite3_int64 id;
+	unsigned long queries;
+	unsigned long newly;
+	unsigned int domains;
+};
+
+struct sim_thread {
+	pthread_t thread;
+	bool started;
+	unsigned int id;
+	unsigned int threads;
+	const struct sim_candidates *candidates;
+	struct sim_domain *domains;
+	size_t num_domains;
+	unsigned long matched;
+};
+
+static int cmp_hash(const void *a, const void *b)
+{
+	const uint64_t ha = *(const uint64_t*)a, hb = *(const uint64_t*)b;
+	return ha < hb ? -1 : ha > hb;
+}
+
+static bool add_entry(struct sim_candidates *cand, char *entry)
+{
+	strtolower(entry);
+
+	// Allowlist patterns ("@@||domain^") are not simulated
+	const char *start = NULL;
+	size_t len = 0u;
+	bool antigravity = false;
+	if(gravity_abp_unwrap(entry, &start, &len, &antigravity) && antigravity)
+		return true;
+
+	if(cand->num_hashes == cand->size_hashes)
+	{
+		const size_t size = cand->size_hashes > 0 ? 2*cand->size_hashes : 1024;
+		uint64_t *hashes = realloc(cand->hashes, size * sizeof(*hashes));
+		if(hashes == NULL)
+		{
+			log_err("Memory allocation failed in add_entry()");
+			return false;
+		}
+		cand->hashes = hashes;
+		cand->size_hashes = size;
+	}
+	cand->hashes[cand->num_hashes++] = gravity_entry_hash(entry);
+
+	return true;
+}
+
+static bool add_regex(struct sim_candidates *cand, const char *pattern)
+{
+	regexData *regex = realloc(cand->regex, (cand->num_regex + 1) * sizeof(*regex));
+	if(regex == NULL)
+	{
+		log_err("Memory allocation failed in add_regex()");
+		return false;
+	}
+	cand->regex = regex;
+	regex = &cand->regex[cand->num_regex];
+	memset(regex, 0, sizeof(*regex));
+
+	char *message = NULL;
+	if(!compile_regex(pattern, regex, &message))
+	{
+		log_err("Invalid regex \"%s\": %s", pattern, message != NULL ? message : "unknown error");
+		if(message != NULL)
+			free(message);
+		return false;
+	}
+	cand->num_regex++;
+
+	return true;
+}
+
+// Read domains or ABP-style patterns from file (one per line). Lines in HOSTS
+// format ("0.0.0.0 domain") contribute their second field, comments and
+// empty lines are skipped
+static bool add_file(struct sim_candidates *cand, const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL)
+	{
+		log_err("Cannot open %s: %s", filename, strerror(errno));
+		return false;
+	}
+
+	bool okay = true;
+	char *line = NULL;
+	size_t size = 0;
+	while(okay && getline(&line, &size, fp) != -1)
+	{
+		char *saveptr = NULL;
+		char *entry = strtok_r(line, " \t\r\n", &saveptr);
+		if(entry == NULL || entry[0] == '#' || entry[0] == '!' || entry[0] == '[')
+			continue;
+
+		char *second = strtok_r(NULL, " \t\r\n", &saveptr);
+		if(second != NULL && second[0] != '#')
+			entry = second;
+
+		okay = add_entry(cand, entry);
+	}
+
+	free(line);
+	fclose(fp);
+	return okay;
+}
+
+// Add all domains of this adlist in the gravity database
+static bool add_adlist(struct sim_candidates *cand, const char *arg)
+{
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	bool okay = false;
+	const char *dbfile = config.files.gravity.v.s;
+
+	int adlist_id = 0;
+	if(sscanf(arg, "%i", &adlist_id) != 1)
+	{
+		log_err("Invalid adlist ID \"%s\"", arg);
+		return false;
+	}
+
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		log_err("Unable to open gravity database %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_add_adlist;
+	}
+
+	if(sqlite3_prepare_v2(db, "SELECT domain FROM gravity WHERE adlist_id = ?1", -1, &stmt, NULL) != SQLITE_OK ||
+	   sqlite3_bind_int(stmt, 1, adlist_id) != SQLITE_OK)
+	{
+		log_err("Unable to read adlist %d from %s: %s", adlist_id, dbfile, sqlite3_errmsg(db));
+		goto end_of_add_adlist;
+	}
+
+	int rc;
+	size_t num = 0;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		if(domain == NULL)
+			continue;
+
+		char *entry = strdup(domain);
+		if(entry == NULL)
+		{
+			log_err("Memory allocation failed in add_adlist()");
+			goto end_of_add_adlist;
+		}
+		const bool added = add_entry(cand, entry);
+		free(entry);
+		if(!added)
+			goto end_of_add_adlist;
+		num++;
+	}
+	if(rc != SQLITE_DONE)
+	{
+		log_err("Unable to read adlist %d from %s: %s", adlist_id, dbfile, sqlite3_errmsg(db));
+		goto end_of_add_adlist;
+	}
+	if(num == 0)
+		log_warn("Adlist %d has no domains in %s", adlist_id, dbfile);
+
+	okay = true;
+
+end_of_add_adlist:
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	return okay;
+}
+
+static bool add_candidate(struct sim_candidates *cand, const char *candidate)
+{
+	const char *colon = strchr(candidate, ':');
+	if(colon == NULL || colon[1] == '\0')
+	{
+		log_err("Invalid candidate \"%s\", expected adlist:<id>, domain:<domain>, file:<path>, or regex:<regex>",
+		        candidate);
+		return false;
+	}
+	const char *arg = colon + 1;
+	const size_t typelen = colon - candidate;
+
+	if(typelen == 6 && strncmp(candidate, "adlist", typelen) == 0)
+		return add_adlist(cand, arg);
+	if(typelen == 4 && strncmp(candidate, "file", typelen) == 0)
+		return add_file(cand, arg);
+	if(typelen == 5 && strncmp(candidate, "regex", typelen) == 0)
+		return add_regex(cand, arg);
+	if(typelen == 6 && strncmp(candidate, "domain", typelen) == 0)
+	{
+		char *entry = strdup(arg);
+		if(entry == NULL)
+		{
+			log_err("Memory allocation failed in add_candidate()");
+			return false;
+		}
+		const bool okay = add_entry(cand, entry);
+		free(entry);
+		return okay;
+	}
+
+	log_err("Invalid candidate \"%s\", expected adlist:<id>, domain:<domain>, file:<path>, or regex:<regex>",
+	        candidate);
+	return false;
+}
+
+static bool __attribute__((pure)) has_hash(const struct sim_candidates *cand, const uint64_t hash)
+{
+	return bsearch(&hash, cand->hashes, cand->num_hashes, sizeof(*cand->hashes), cmp_hash) != NULL;
+}
+
+// Check the domain and, for ABP-style patterns, all of its parent domains the
+// same way in_gravity() does
+static bool __attribute__((pure)) is_listed(const struct sim_candidates *cand, const char *domain)
+{
+	if(cand->num_hashes == 0)
+		return false;
+
+	if(has_hash(cand, gravity_hash(domain)))
+		return true;
+
+	const size_t len = strlen(domain);
+	uint64_t h = FNV64_OFFSET;
+	for(size_t i = len; i-- > 0;)
+	{
+		if(domain[i] == '.' && i + 1 < len && has_hash(cand, gravity_abp_finalize(h, false)))
+			return true;
+		h = gravity_abp_step(h, domain[i]);
+	}
+
+	return len > 0 && has_hash(cand, gravity_abp_finalize(h, false));
+}
+
+// Evaluate a share of the domains. Every thread compiles its own combined
+// automaton as its lazily built DFA cannot be shared, regex which cannot be
+// represented by it (and inverted regex) are matched individually
+static void *simulate_worker(void *arg)
+{
+	struct sim_thread *thread = arg;
+	const struct sim_candidates *cand = thread->candidates;
+
+	struct regex_set *set = NULL;
+	uint64_t *recheck = NULL;
+	if(cand->num_regex > 0 && (set = regex_set_new(cand->num_regex)) != NULL)
+	{
+		recheck = calloc(regex_set_words(set), sizeof(uint64_t));
+		for(unsigned int index = 0; index < cand->num_regex && recheck != NULL; index++)
+		{
+			char *pattern = cand->regex[index].ext.inverted ? NULL : get_regex_pattern(cand->regex[index].string);
+			if(pattern == NULL || !regex_set_add(set, index, pattern))
+				recheck[index / 64] |= 1ULL << (index % 64);
+			if(pattern != NULL)
+				free(pattern);
+		}
+		if(recheck == NULL || !regex_set_finalize(set))
+		{
+			regex_set_free(set);
+			set = NULL;
+		}
+	}
+
+	for(size_t i = thread->id; i < thread->num_domains; i += thread->threads)
+	{
+		struct sim_domain *domain = &thread->domains[i];
+		if(is_listed(cand, domain->domain))
+			domain->types = SIM_ALL_TYPES;
+
+		const uint64_t *matches = set != NULL ? regex_set_match(set, domain->domain) : NULL;
+		for(unsigned int index = 0; index < cand->num_regex && domain->types != SIM_ALL_TYPES; index++)
+		{
+			regexData *regex = &cand->regex[index];
+			bool match;
+			if(matches != NULL && !((recheck[index / 64] >> (index % 64)) & 1u))
+				match = (matches[index / 64] >> (index % 64)) & 1u;
+			else
+				match = regex_matches(regex, domain->domain) != regex->ext.inverted;
+
+			if(match)
+				domain->types |= regex->ext.query_type != 0 ? regex->ext.query_type : SIM_ALL_TYPES;
+		}
+
+		if(domain->types != 0)
+			thread->matched++;
+	}
+
+	regex_set_free(set);
+	if(recheck != NULL)
+		free(recheck);
+
+	return NULL;
+}
+
+static int cmp_domain_id(const void *a, const void *b)
+{
+	const sqlite3_int64 id = *(const sqlite3_int64*)a;
+	const struct sim_domain *domain = b;
+	return id < domain->id ? -1 : id > domain->id;
+}
+
+static int cmp_client_id(const void *a, const void *b)
+{
+	const struct sim_client *ca = a, *cb = b;
+	return ca->id < cb->id ? -1 : ca->id > cb->id;
+}
+
+static int cmp_domain_queries(const void *a, const void *b)
+{
+	const struct sim_domain *da = a, *db = b;
+	if(da->queries != db->queries)
+		return da->queries < db->queries ? 1 : -1;
+	return strcmp(da->domain, db->domain);
+}
+
+static int cmp_client_queries(const void *a, const void *b)
+{
+	const struct sim_client *ca = a, *cb = b;
+	if(ca->queries != cb->queries)
+		return ca->queries < cb->queries ? 1 : -1;
+	return ca->id < cb->id ? -1 : ca->id > cb->id;
+}
+
+// Read all domains queried since the given time, sorted by their ID
+static struct sim_domain *read_domains(sqlite3 *db, const time_t since, size_t *num)
+{
+	sqlite3_stmt *stmt = NULL;
+	struct sim_domain *domains = NULL;
+	size_t size = 0;
+	*num = 0;
+
+	if(sqlite3_prepare_v2(db, "SELECT id, domain FROM domain_by_id "
+	                          "WHERE id IN (SELECT DISTINCT domain FROM query_storage WHERE timestamp >= ?1) "
+	                          "ORDER BY id", -1, &stmt, NULL) != SQLITE_OK ||
+	   sqlite3_bind_int64(stmt, 1, since) != SQLITE_OK)
+	{
+		log_err("Unable to read domains: %s", sqlite3_errmsg(db));
+		goto end_of_read_domains;
+	}
+
+	int rc;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 1);
+		if(domain == NULL)
+			continue;
+
+		if(*num == size)
+		{
+			size = size > 0 ? 2*size : 1024;
+			struct sim_domain *new = realloc(domains, size * sizeof(*new));
+			if(new == NULL)
+			{
+				log_err("Memory allocation failed in read_domains()");
+				rc = SQLITE_NOMEM;
+				break;
+			}
+			domains = new;
+		}
+
+		struct sim_domain *entry = &domains[*num];
+		memset(entry, 0, sizeof(*entry));
+		entry->id = sqlite3_column_int64(stmt, 0);
+		if((entry->domain = strdup(domain)) == NULL)
+		{
+			log_err("Memory allocation failed in read_domains()");
+			rc = SQLITE_NOMEM;
+			break;
+		}
+		(*num)++;
+	}
+	if(rc != SQLITE_DONE && rc != SQLITE_NOMEM)
+		log_err("Unable to read domains: %s", sqlite3_errmsg(db));
+
+end_of_read_domains:
+	sqlite3_finalize(stmt);
+	return domains;
+}
+
+// Stream the distinct (domain, client, type) triples of the window and count
+// the queries which would have been blocked per domain and client
+static struct sim_client *count_queries(sqlite3 *db, const time_t since, struct sim_domain *domains,
+                                        const size_t num_domains, size_t *num_clients,
+                                        unsigned long *total, bool *okay)
+{
+	sqlite3_stmt *stmt = NULL;
+	struct sim_client *clients = NULL;
+	size_t size = 0;
+	*num_clients = 0;
+	*total = 0;
+	*okay = false;
+
+	char *querystr = NULL;
+	if(asprintf(&querystr, "SELECT domain, client, type, COUNT(*), SUM(status IN %s) "
+	                       "FROM query_storage WHERE timestamp >= ?1 "
+	                       "GROUP BY domain, client, type ORDER BY domain, client",
+	            get_blocked_statuslist()) < 0)
+	{
+		log_err("Memory allocation failed in count_queries()");
+		return NULL;
+	}
+
+	if(sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL) != SQLITE_OK ||
+	   sqlite3_bind_int64(stmt, 1, since) != SQLITE_OK)
+	{
+		log_err("Unable to read queries: %s", sqlite3_errmsg(db));
+		goto end_of_count_queries;
+	}
+
+	int rc;
+	struct sim_domain *last_domain = NULL;
+	sqlite3_int64 last_client = -1;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const sqlite3_int64 domain_id = sqlite3_column_int64(stmt, 0);
+		const sqlite3_int64 client_id = sqlite3_column_int64(stmt, 1);
+		const int type = sqlite3_column_int(stmt, 2);
+		const unsigned long count = sqlite3_column_int64(stmt, 3);
+		const unsigned long blocked = sqlite3_column_int64(stmt, 4);
+		*total += count;
+
+		struct sim_domain *domain = bsearch(&domain_id, domains, num_domains, sizeof(*domains), cmp_domain_id);
+		if(domain == NULL || domain->types == 0)
+			continue;
+		if(domain->types != SIM_ALL_TYPES && (type < 0 || type >= 32 || !((domain->types >> type) & 1u)))
+			continue;
+
+		domain->queries += count;
+		domain->newly += count - blocked;
+
+		// Rows are sorted by domain and client, so a new client of this
+		// domain starts a new entry
+		if(domain != last_domain || client_id != last_client)
+		{
+			if(*num_clients == size)
+			{
+				size = size > 0 ? 2*size : 256;
+				struct sim_client *new = realloc(clients, size * sizeof(*new));
+				if(new == NULL)
+				{
+					log_err("Memory allocation failed in count_queries()");
+					goto end_of_count_queries;
+				}
+				clients = new;
+			}
+			clients[(*num_clients)++] = (struct sim_client){ .id = client_id, .domains = 1 };
+			domain->clients++;
+			last_domain = domain;
+			last_client = client_id;
+		}
+		clients[*num_clients - 1].queries += count;
+		clients[*num_clients - 1].newly += count - blocked;
+	}
+	if(rc != SQLITE_DONE)
+	{
+		log_err("Unable to read queries: %s", sqlite3_errmsg(db));
+		goto end_of_count_queries;
+	}
+
+	// Merge the entries of each client
+	if(*num_clients > 0)
+	{
+		qsort(clients, *num_clients, sizeof(*clients), cmp_client_id);
+		size_t merged = 0;
+		for(size_t i = 1; i < *num_clients; i++)
+		{
+			if(clients[i].id == clients[merged].id)
+			{
+				clients[merged].queries += clients[i].queries;
+				clients[merged].newly += clients[i].newly;
+				clients[merged].domains += clients[i].domains;
+			}
+			else
+				clients[++merged] = clients[i];
+		}
+		*num_clients = merged + 1;
+	}
+
+	*okay = true;
+
+end_of_count_queries:
+	sqlite3_finalize(stmt);
+	free(querystr);
+	return clients;
+}
+
+static void print_client(sqlite3_stmt *stmt, const unsigned int rank, const struct sim_client *client)
+{
+	const char *ip = NULL, *name = NULL;
+	if(stmt != NULL && sqlite3_bind_int64(stmt, 1, client->id) == SQLITE_OK &&
+	   sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		ip = (const char*)sqlite3_column_text(stmt, 0);
+		name = (const char*)sqlite3_column_text(stmt, 1);
+	}
+
+	log_info("    %2u. %s%s%s%s%s%s: %lu queries (%lu newly blocked), %u domain%s",
+	         rank, cli_bold(), ip != NULL ? ip : "unknown", cli_normal(),
+	         name != NULL && name[0] != '\0' ? " (" : "", name != NULL ? name : "",
+	         name != NULL && name[0] != '\0' ? ")" : "",
+	         client->queries, client->newly, client->domains, client->domains != 1 ? "s" : "");
+
+	if(stmt != NULL)
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+}
+
+int run_simulation(const struct simulate_opts *opts)
+{
+	int ret = EXIT_FAILURE;
+	sqlite3 *db = NULL;
+	struct sim_candidates cand = { 0 };
+	struct sim_domain *domains = NULL;
+	struct sim_client *clients = NULL;
+	struct sim_thread *thread = NULL;
+	size_t num_domains = 0, num_clients = 0;
+	const char *dbfile = config.files.database.v.s;
+
+	// Compile the candidate lists
+	log_info("%s Loading candidate lists...", cli_info());
+	for(unsigned int i = 0; i < opts->num_candidates; i++)
+		if(!add_candidate(&cand, opts->candidates[i]))
+			goto end_of_simulation;
+	if(cand.num_hashes > 0)
+		qsort(cand.hashes, cand.num_hashes, sizeof(*cand.hashes), cmp_hash);
+	log_info("    %zu domains and patterns, %u regex\n", cand.num_hashes, cand.num_regex);
+	if(cand.num_hashes == 0 && cand.num_regex == 0)
+	{
+		log_info("    Nothing to simulate");
+		goto end_of_simulation;
+	}
+
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+	{
+		log_err("Unable to open long-term database %s: %s", dbfile, sqlite3_errmsg(db));
+		goto end_of_simulation;
+	}
+
+	// Read the domains queried within the window
+	const time_t since = time(NULL) - (time_t)opts->days * 86400;
+	log_info("%s Reading domains queried within the last %u day%s...",
+	         cli_info(), opts->days, opts->days != 1 ? "s" : "");
+	domains = read_domains(db, since, &num_domains);
+	log_info("    Read %zu domains\n", num_domains);
+	if(num_domains == 0)
+	{
+		ret = EXIT_SUCCESS;
+		goto end_of_simulation;
+	}
+
+	// Evaluate every domain once, using all CPUs
+	unsigned int threads = opts->threads;
+	if(threads == 0)
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int)cpus : 1u;
+	}
+	if(threads > num_domains)
+		threads = num_domains;
+	if((thread = calloc(threads, sizeof(*thread))) == NULL)
+	{
+		log_err("Memory allocation failed in run_simulation()");
+		goto end_of_simulation;
+	}
+
+	log_info("%s Evaluating %zu domains using %u thread%s...",
+	         cli_info(), num_domains, threads, threads > 1 ? "s" : "");
+	const double t0 = double_time();
+	for(unsigned int i = 0; i < threads; i++)
+	{
+		thread[i].id = i;
+		thread[i].threads = threads;
+		thread[i].candidates = &cand;
+		thread[i].domains = domains;
+		thread[i].num_domains = num_domains;
+		const int rc = pthread_create(&thread[i].thread, NULL, simulate_worker, &thread[i]);
+		if(rc != 0)
+		{
+			// Process this share of the domains ourselves
+			log_warn("Cannot create simulation thread: %s", strerror(rc));
+			simulate_worker(&thread[i]);
+			continue;
+		}
+		thread[i].started = true;
+	}
+	unsigned long matched = 0;
+	for(unsigned int i = 0; i < threads; i++)
+	{
+		if(thread[i].started)
+			pthread_join(thread[i].thread, NULL);
+		matched += thread[i].matched;
+	}
+	const double elapsed = double_time() - t0;
+	log_info("    Time: %.3f msec (%.0f domains/s)", 1e3*elapsed, num_domains / elapsed);
+	log_info("    Matching domains: %lu\n", matched);
+
+	// Attribute the queries to domains and clients
+	log_info("%s Counting affected queries...", cli_info());
+	unsigned long total = 0;
+	bool okay = false;
+	clients = count_queries(db, since, domains, num_domains, &num_clients, &total, &okay);
+	if(!okay)
+		goto end_of_simulation;
+
+	unsigned long queries = 0, newly = 0;
+	for(size_t i = 0; i < num_domains; i++)
+	{
+		queries += domains[i].queries;
+		newly += domains[i].newly;
+	}
+	log_info("    Queries: %lu of %lu (%.1f%%) would have been blocked, %lu of them were permitted",
+	         queries, total, total > 0 ? 100.0*queries/total : 0.0, newly);
+	log_info("    Affected domains: %lu, affected clients: %zu\n", matched, num_clients);
+
+	if(queries > 0)
+	{
+		qsort(domains, num_domains, sizeof(*domains), cmp_domain_queries);
+		log_info("%s Top domains:", cli_info());
+		for(unsigned int i = 0; i < opts->top && i < num_domains && domains[i].queries > 0; i++)
+			log_info("    %2u. %s%s%s: %lu queries (%lu newly blocked), %u client%s",
+			         i + 1, cli_bold(), domains[i].domain, cli_normal(), domains[i].queries,
+			         domains[i].newly, domains[i].clients, domains[i].clients != 1 ? "s" : "");
+
+		qsort(clients, num_clients, sizeof(*clients), cmp_client_queries);
+		sqlite3_stmt *stmt = NULL;
+		if(sqlite3_prepare_v2(db, "SELECT ip, name FROM client_by_id WHERE id = ?1", -1, &stmt, NULL) != SQLITE_OK)
+			log_warn("Unable to look up clients: %s", sqlite3_errmsg(db));
+		log_info("\n%s Top clients:", cli_info());
+		for(unsigned int i = 0; i < opts->top && i < num_clients; i++)
+			print_client(stmt, i + 1, &clients[i]);
+		sqlite3_finalize(stmt);
+	}
+
+	log_info("\n    Allowlist entries are not taken into account");
+	ret = EXIT_SUCCESS;
+
+end_of_simulation:
+	sqlite3_close(db);
+	if(thread != NULL)
+		free(thread);
+	if(clients != NULL)
+		free(clients);
+	for(size_t i = 0; i < num_domains; i++)
+		free(domains[i].domain);
+	if(domains != NULL)
+		free(domains);
+	for(unsigned int i = 0; i < cand.num_regex; i++)
+		free_regex_entry(&cand.regex[i]);
+	if(cand.regex != NULL)
+		free(cand.regex);
+	if(cand.hashes != NULL)
+		free(cand.hashes);
+
+	return ret;
+}
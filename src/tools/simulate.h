@@ -0,0 +1,37 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Blocking simulation prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+// Defaults of pihole-FTL simulate
+#define SIMULATE_DAYS 7u
+#define SIMULATE_TOP 10u
+
+struct simulate_opts {
+	// Candidate lists, each of them is one of
+	//   adlist:<id>     domains of this list in the gravity database
+	//   domain:<domain> a single exact domain
+	//   file:<path>     domains or ABP-style patterns (one per line,
+	//                   HOSTS format is accepted)
+	//   regex:<regex>   a regular expression (including FTL options)
+	char **candidates;
+	unsigned int num_candidates;
+	// Evaluate the queries of this many days
+	unsigned int days;
+	// Worker threads, one per CPU if zero
+	unsigned int threads;
+	// Number of domains and clients to list
+	unsigned int top;
+};
+
+int run_simulation(const struct simulate_opts *opts);
+
+#endif // SIMULATE_H
@@ -0,0 +1,332 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Incrementally maintained top lists
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file top-lists.c
+* @brief Keeps candidates for the top domains and clients up to date.
+*
+* Each top list holds the IDs of (up to) TOP_LIST_SIZE domains or clients with
+* the highest counts. Objects notify the lists whenever their counters change.
+* An object which is not a member yet replaces the smallest member once its
+* count exceeds it. Members are never evicted because their own count drops,
+* instead, the list remembers an upper bound of the counts of all non-members.
+* Members with a count of at least this bound are known to be exact, a list is
+* rebuilt from scratch only when too few exact members remain.
+*
+* The lists live in shared memory and are only modified while holding the
+* exclusive SHM lock, they can be read while holding the shared lock.
+*/
+
+#include "FTL.h"
+#include "top-lists.h"
+// getDomain(), getClient()
+#include "shmem.h"
+// log_debug()
+#include "log.h"
+// INT_MAX
+#include <limits.h>
+
+// Get the count of an object in the given list and a pointer to its flags.
+// Returns false if the object does not take part in this list
+static bool get_count(const enum top_list_type type, const unsigned int id,
+                      int *count, unsigned char **flags)
+{
+	if(type == TOP_DOMAINS_PERMITTED || type == TOP_DOMAINS_BLOCKED)
+	{
+		domainsData *domain = getDomain(id, true);
+		if(domain == NULL)
+			return false;
+
+		*count = type == TOP_DOMAINS_BLOCKED ? domain->blockedcount : domain->count - domain->blockedcount;
+		*flags = &domain->toplists;
+		return true;
+	}
+
+	clientsData *client = getClient(id, true);
+	// Clients managed by alias-clients are never shown in the top lists
+	if(client == NULL || (!client->flags.aliasclient && client->aliasclient_id > -1))
+		return false;
+
+	*count = type == TOP_CLIENTS_BLOCKED ? client->blockedcount : client->count;
+	*flags = &client->toplists;
+	return true;
+}
+
+static void top_list_changed(const enum top_list_type type, const unsigned int id,
+                             unsigned char *flags, const int count)
+{
+	struct top_list *list = &top_lists->lists[type];
+	if(!list->valid)
+		return;
+
+	const unsigned char bit = 1u << type;
+	if(*flags & bit)
+	{
+		// Members stay in the list, only keep the lower bound of the
+		// smallest member up to date
+		if(count < list->min)
+			list->min = count;
+		return;
+	}
+
+	if(count < 1)
+		return;
+
+	// Add new member if there is still space left
+	if(list->num < TOP_LIST_SIZE)
+	{
+		list->id[list->num++] = id;
+		*flags |= bit;
+		if(count < list->min)
+			list->min = count;
+		return;
+	}
+
+	if(count > list->min)
+	{
+		// The lower bound may be outdated as members grow without
+		// updating it, find the actual smallest member
+		unsigned int min_idx = 0;
+		int min = INT_MAX;
+		unsigned char *min_flags = NULL;
+		for(unsigned int i = 0; i < list->num; i++)
+		{
+			int c = 0;
+			unsigned char *f = NULL;
+			if(!get_count(type, list->id[i], &c, &f))
+				c = INT_MIN;
+			if(c < min)
+			{
+				min = c;
+				min_idx = i;
+				min_flags = f;
+			}
+		}
+		list->min = min;
+
+		if(count > min)
+		{
+			// Replace the smallest member, its count becomes a
+			// possible upper bound for all non-members
+			if(min_flags != NULL)
+				*min_flags &= ~bit;
+			if(min > list->outside_max)
+				list->outside_max = min;
+			list->id[min_idx] = id;
+			*flags |= bit;
+			return;
+		}
+	}
+
+	if(count > list->outside_max)
+		list->outside_max = count;
+}
+
+static void top_list_remove(const enum top_list_type type, const unsigned int id, unsigned char *flags)
+{
+	const unsigned char bit = 1u << type;
+	if(!(*flags & bit))
+		return;
+
+	*flags &= ~bit;
+	struct top_list *list = &top_lists->lists[type];
+	for(unsigned int i = 0; i < list->num; i++)
+	{
+		if(list->id[i] != id)
+			continue;
+
+		// Move last member into the freed position
+		list->id[i] = list->id[--list->num];
+		return;
+	}
+}
+
+void top_lists_domain_changed(const unsigned int domainID, domainsData *domain)
+{
+	top_list_changed(TOP_DOMAINS_PERMITTED, domainID, &domain->toplists, domain->count - domain->blockedcount);
+	top_list_changed(TOP_DOMAINS_BLOCKED, domainID, &domain->toplists, domain->blockedcount);
+}
+
+void top_lists_client_changed(clientsData *client)
+{
+	if(!client->flags.aliasclient && client->aliasclient_id > -1)
+		return;
+
+	top_list_changed(TOP_CLIENTS_TOTAL, client->id, &client->toplists, client->count);
+	top_list_changed(TOP_CLIENTS_BLOCKED, client->id, &client->toplists, client->blockedcount);
+}
+
+void top_lists_remove_domain(const unsigned int domainID, domainsData *domain)
+{
+	top_list_remove(TOP_DOMAINS_PERMITTED, domainID, &domain->toplists);
+	top_list_remove(TOP_DOMAINS_BLOCKED, domainID, &domain->toplists);
+}
+
+void top_lists_remove_client(clientsData *client)
+{
+	top_list_remove(TOP_CLIENTS_TOTAL, client->id, &client->toplists);
+	top_list_remove(TOP_CLIENTS_BLOCKED, client->id, &client->toplists);
+}
+
+void invalidate_top_client_lists(void)
+{
+	top_lists->lists[TOP_CLIENTS_TOTAL].valid = false;
+	top_lists->lists[TOP_CLIENTS_BLOCKED].valid = false;
+}
+
+// Restore the min-heap property of the candidate heap used during rebuilds
+static void sift_down(struct top_list_entry *heap, const unsigned int num, unsigned int i)
+{
+	while(true)
+	{
+		unsigned int smallest = i;
+		const unsigned int l = 2*i + 1, r = 2*i + 2;
+		if(l < num && heap[l].count < heap[smallest].count)
+			smallest = l;
+		if(r < num && heap[r].count < heap[smallest].count)
+			smallest = r;
+		if(smallest == i)
+			return;
+
+		const struct top_list_entry tmp = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+static void sift_up(struct top_list_entry *heap, unsigned int i)
+{
+	while(i > 0 && heap[(i - 1)/2].count > heap[i].count)
+	{
+		const struct top_list_entry tmp = heap[i];
+		heap[i] = heap[(i - 1)/2];
+		heap[(i - 1)/2] = tmp;
+		i = (i - 1)/2;
+	}
+}
+
+/**
+ * Rebuild a top list from scratch. The objects with the highest counts are
+ * selected using a min-heap of TOP_LIST_SIZE elements, so no memory needs to be
+ * allocated and all objects are only visited once. The caller must hold the
+ * exclusive SHM lock.
+ *
+ * @param type The list to rebuild
+ */
+void rebuild_top_list(const enum top_list_type type)
+{
+	struct top_list *list = &top_lists->lists[type];
+	const bool domains = type == TOP_DOMAINS_PERMITTED || type == TOP_DOMAINS_BLOCKED;
+	const unsigned int num = domains ? counters->domains : counters->clients;
+	const unsigned char bit = 1u << type;
+
+	struct top_list_entry heap[TOP_LIST_SIZE];
+	unsigned int heapsize = 0;
+	int outside_max = 0;
+	for(unsigned int id = 0; id < num; id++)
+	{
+		int count = 0;
+		unsigned char *flags = NULL;
+		if(!get_count(type, id, &count, &flags))
+			continue;
+
+		// Reset membership, the new members are flagged below
+		*flags &= ~bit;
+		if(count < 1)
+			continue;
+
+		if(heapsize < TOP_LIST_SIZE)
+		{
+			heap[heapsize] = (struct top_list_entry){ .id = id, .count = count };
+			sift_up(heap, heapsize++);
+		}
+		else if(count > heap[0].count)
+		{
+			// Replace the smallest candidate
+			if(heap[0].count > outside_max)
+				outside_max = heap[0].count;
+			heap[0] = (struct top_list_entry){ .id = id, .count = count };
+			sift_down(heap, heapsize, 0);
+		}
+		else if(count > outside_max)
+			outside_max = count;
+	}
+
+	list->num = heapsize;
+	list->min = heapsize > 0 ? heap[0].count : INT_MAX;
+	list->outside_max = outside_max;
+	for(unsigned int i = 0; i < heapsize; i++)
+	{
+		int count = 0;
+		unsigned char *flags = NULL;
+		list->id[i] = heap[i].id;
+		if(get_count(type, heap[i].id, &count, &flags))
+			*flags |= bit;
+	}
+	list->valid = true;
+
+	log_debug(DEBUG_API, "Rebuilt top list %d: %u members, outside max: %d",
+	          type, list->num, list->outside_max);
+}
+
+// qsort subroutine, sort DESC
+static int __attribute__((pure)) cmpdesc_entry(const void *a, const void *b)
+{
+	const struct top_list_entry *elem1 = (const struct top_list_entry*)a;
+	const struct top_list_entry *elem2 = (const struct top_list_entry*)b;
+
+	if (elem1->count > elem2->count)
+		return -1;
+	else if (elem1->count < elem2->count)
+		return 1;
+	else
+		return 0;
+}
+
+/**
+ * Get the exact part of a top list sorted by decreasing count. The caller must
+ * hold (at least) the shared SHM lock.
+ *
+ * @param type The list to get
+ * @param entries Array of at least TOP_LIST_SIZE elements
+ * @param complete Set to true if the returned entries are all objects with a
+ * positive count, i.e., there is nothing beyond the returned entries
+ * @return The number of entries returned, this is zero if the list needs to be
+ * rebuilt
+ */
+unsigned int get_top_list(const enum top_list_type type, struct top_list_entry *entries, bool *complete)
+{
+	const struct top_list *list = &top_lists->lists[type];
+	*complete = false;
+	if(!list->valid)
+		return 0;
+
+	// Only members with a count of at least the largest possible count of
+	// any non-member are known to be in the right order
+	const int threshold = list->outside_max > 1 ? list->outside_max : 1;
+	unsigned int num = 0;
+	for(unsigned int i = 0; i < list->num; i++)
+	{
+		int count = 0;
+		unsigned char *flags = NULL;
+		if(!get_count(type, list->id[i], &count, &flags) || count < threshold)
+			continue;
+
+		entries[num].id = list->id[i];
+		entries[num].count = count;
+		num++;
+	}
+
+	qsort(entries, num, sizeof(*entries), cmpdesc_entry);
+	*complete = list->outside_max < 1;
+
+	return num;
+}
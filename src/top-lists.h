@@ -0,0 +1,72 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Incrementally maintained top lists header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef TOP_LISTS_H
+#define TOP_LISTS_H
+
+#include <stdbool.h>
+// domainsData, clientsData
+#include "datastructure.h"
+
+// How many candidates are kept per top list
+#define TOP_LIST_SIZE 256u
+
+enum top_list_type {
+	TOP_DOMAINS_PERMITTED,
+	TOP_DOMAINS_BLOCKED,
+	TOP_CLIENTS_TOTAL,
+	TOP_CLIENTS_BLOCKED,
+	TOP_LIST_TYPES
+} __attribute__ ((packed));
+
+/**
+ * struct top_list - Candidates for the top domains or clients
+ * @valid: Whether the list has been built since it was last invalidated
+ * @num: Number of members
+ * @min: Lower bound of the smallest count of all members
+ * @outside_max: Upper bound of the count of all objects which are not members
+ * @id: IDs of the members (unordered)
+ *
+ * The counts of the members are not stored in the list, they are read from the
+ * objects themselves. All members with a count of at least outside_max are
+ * guaranteed to be the objects with the highest counts overall.
+ */
+struct top_list {
+	bool valid;
+	unsigned int num;
+	int min;
+	int outside_max;
+	unsigned int id[TOP_LIST_SIZE];
+};
+
+typedef struct {
+	struct top_list lists[TOP_LIST_TYPES];
+} topListsData;
+
+extern topListsData *top_lists;
+
+struct top_list_entry {
+	unsigned int id;
+	int count;
+};
+
+// Called whenever the counters of a domain or client changed
+void top_lists_domain_changed(const unsigned int domainID, domainsData *domain);
+void top_lists_client_changed(clientsData *client);
+// Called before a domain or client is recycled
+void top_lists_remove_domain(const unsigned int domainID, domainsData *domain);
+void top_lists_remove_client(clientsData *client);
+// Called after counters of many clients have been changed at once
+void invalidate_top_client_lists(void);
+
+void rebuild_top_list(const enum top_list_type type);
+unsigned int get_top_list(const enum top_list_type type, struct top_list_entry *entries, bool *complete);
+
+#endif //TOP_LISTS_H
@@ -0,0 +1,277 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Batched UDP receive and send
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file udp_batch.c
+* @brief Receives DNS queries and sends their replies in batches.
+*
+* dnsmasq reads one query per wakeup of its event loop and sends every reply
+* with its own system call. When a listening socket becomes readable, up to
+* UDP_BATCH_SIZE queries are read at once using recvmmsg() and handed to
+* dnsmasq one after another. Replies sent while the batch is processed are
+* copied into a second arena and sent together using sendmmsg() afterwards.
+*
+* Both arenas are owned by the process handling the queries (the main process
+* or a UDP worker), the number of system calls and datagrams is accounted in
+* shared memory.
+*/
+
+#define FTLDNS
+#include "dnsmasq/dnsmasq.h"
+#undef __USE_XOPEN
+#include "FTL.h"
+#include "udp_batch.h"
+// counters
+#include "shmem.h"
+// FTL_connection_error()
+#include "dnsmasq_interface.h"
+
+// Space for the control messages (packet info) of a datagram
+#define UDP_BATCH_CONTROL 128u
+
+struct udp_batch {
+	int fd;
+	unsigned int count;
+	unsigned int next;
+	size_t size;
+	char *data;
+	struct mmsghdr msgs[UDP_BATCH_SIZE];
+	struct iovec iov[UDP_BATCH_SIZE];
+	union mysockaddr name[UDP_BATCH_SIZE];
+	union {
+		struct cmsghdr align; // this ensures alignment
+		char buf[UDP_BATCH_CONTROL];
+	} control[UDP_BATCH_SIZE];
+};
+
+static struct udp_batch rx = { .fd = -1 }, tx = { .fd = -1 };
+static unsigned int rx_rounds = 0;
+static bool rx_full = false;
+static bool batching = false;
+
+static void count_udp(uint64_t *counter, const uint64_t n)
+{
+	if(counters != NULL)
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// Make room for UDP_BATCH_SIZE datagrams of the given size, the arena must
+// not hold any datagrams when it is grown
+static bool batch_arena(struct udp_batch *batch, const size_t size)
+{
+	if(size <= batch->size)
+		return true;
+
+	char *data = realloc(batch->data, UDP_BATCH_SIZE * size);
+	if(data == NULL)
+		return false;
+
+	batch->data = data;
+	batch->size = size;
+	return true;
+}
+
+// Read a single datagram without batching
+static ssize_t single_recvmsg(const int fd, struct msghdr *msg)
+{
+	const ssize_t n = recvmsg(fd, msg, 0);
+	count_udp(&counters->udp.recv_calls, 1);
+	if(n >= 0)
+		count_udp(&counters->udp.received, 1);
+	return n;
+}
+
+/**
+ * Drop-in replacement for recvmsg() on the listening sockets. Datagrams are
+ * read in batches, each call returns the next datagram of the current batch
+ *
+ * @param fd The socket to read from
+ * @param msg Buffers for a single datagram, its source and control messages
+ * @return Length of the datagram or -1 (errno is set)
+ */
+ssize_t FTL_batch_recvmsg(const int fd, struct msghdr *msg)
+{
+	// Datagrams of another socket are still waiting to be processed or
+	// the caller expects more than we can store
+	if((rx.next < rx.count && rx.fd != fd) || msg->msg_iovlen != 1 ||
+	   msg->msg_namelen > sizeof(union mysockaddr))
+		return single_recvmsg(fd, msg);
+
+	if(rx.next >= rx.count)
+	{
+		if(!batch_arena(&rx, msg->msg_iov[0].iov_len))
+			return single_recvmsg(fd, msg);
+
+		for(unsigned int i = 0; i < UDP_BATCH_SIZE; i++)
+		{
+			struct msghdr *hdr = &rx.msgs[i].msg_hdr;
+			rx.iov[i].iov_base = rx.data + i * rx.size;
+			rx.iov[i].iov_len = rx.size;
+			hdr->msg_iov = &rx.iov[i];
+			hdr->msg_iovlen = 1;
+			hdr->msg_name = &rx.name[i];
+			hdr->msg_namelen = sizeof(rx.name[i]);
+			hdr->msg_control = rx.control[i].buf;
+			hdr->msg_controllen = sizeof(rx.control[i].buf);
+			hdr->msg_flags = 0;
+		}
+
+		rx.count = rx.next = 0;
+		rx_full = false;
+		const int n = recvmmsg(fd, rx.msgs, UDP_BATCH_SIZE, MSG_DONTWAIT);
+		count_udp(&counters->udp.recv_calls, 1);
+		if(n <= 0)
+			return -1;
+
+		count_udp(&counters->udp.received, n);
+		rx.fd = fd;
+		rx.count = n;
+		rx_full = rx.count == UDP_BATCH_SIZE;
+		rx_rounds++;
+	}
+
+	// Hand out the next datagram of the batch as if it had been read
+	// by recvmsg()
+	const struct mmsghdr *m = &rx.msgs[rx.next++];
+	const struct msghdr *hdr = &m->msg_hdr;
+	size_t len = m->msg_len;
+	msg->msg_flags = hdr->msg_flags;
+	if(len > msg->msg_iov[0].iov_len)
+	{
+		len = msg->msg_iov[0].iov_len;
+		msg->msg_flags |= MSG_TRUNC;
+	}
+	memcpy(msg->msg_iov[0].iov_base, hdr->msg_iov[0].iov_base, len);
+
+	msg->msg_namelen = min(msg->msg_namelen, hdr->msg_namelen);
+	memcpy(msg->msg_name, hdr->msg_name, msg->msg_namelen);
+
+	if(hdr->msg_controllen > msg->msg_controllen)
+		msg->msg_flags |= MSG_CTRUNC;
+	else
+		msg->msg_controllen = hdr->msg_controllen;
+	memcpy(msg->msg_control, hdr->msg_control, msg->msg_controllen);
+
+	return len;
+}
+
+// Are there more datagrams to process for this socket? Full batches are
+// followed by another one until the socket is drained or UDP_BATCH_ROUNDS
+// batches have been read
+bool __attribute__((pure)) FTL_batch_pending(const int fd)
+{
+	if(rx.fd != fd)
+		return false;
+
+	return rx.next < rx.count || (rx_full && rx_rounds < UDP_BATCH_ROUNDS);
+}
+
+// Start collecting replies, they are sent by FTL_batch_flush()
+void FTL_batch_begin(void)
+{
+	batching = true;
+	rx_rounds = 0;
+}
+
+// Send all collected replies
+static void flush_replies(void)
+{
+	unsigned int done = 0;
+	while(done < tx.count)
+	{
+		const int n = sendmmsg(tx.fd, &tx.msgs[done], tx.count - done, 0);
+		count_udp(&counters->udp.send_calls, 1);
+		if(n > 0)
+		{
+			count_udp(&counters->udp.sent, n);
+			done += n;
+			continue;
+		}
+
+		// The first remaining reply could not be sent, retry as dnsmasq
+		// does or skip it
+		if(retry_send(n))
+			continue;
+
+		// If interface is still in DAD, EINVAL results - ignore that
+		if(errno != EINVAL)
+			FTL_connection_error("failed to send UDP reply", &tx.name[done], -1);
+		done++;
+	}
+
+	tx.count = 0;
+}
+
+/**
+ * Drop-in replacement for sendmsg() of UDP replies. While a batch is being
+ * processed, the reply is copied and sent later by FTL_batch_flush()
+ *
+ * @param fd The socket to send the reply on
+ * @param msg The reply, its destination and control messages
+ * @return true if the reply has been queued, false if the caller needs to send
+ * it itself
+ */
+bool FTL_batch_send(const int fd, const struct msghdr *msg)
+{
+	if(!batching || msg->msg_iovlen != 1 ||
+	   msg->msg_namelen > sizeof(union mysockaddr) ||
+	   msg->msg_controllen > UDP_BATCH_CONTROL)
+	{
+		// Sent directly by the caller
+		count_udp(&counters->udp.send_calls, 1);
+		count_udp(&counters->udp.sent, 1);
+		return false;
+	}
+
+	// Send what we have if this reply does not fit into the batch
+	const size_t len = msg->msg_iov[0].iov_len;
+	if(tx.count > 0 && (tx.fd != fd || tx.count == UDP_BATCH_SIZE || len > tx.size))
+		flush_replies();
+
+	if(!batch_arena(&tx, len))
+	{
+		count_udp(&counters->udp.send_calls, 1);
+		count_udp(&counters->udp.sent, 1);
+		return false;
+	}
+
+	const unsigned int i = tx.count++;
+	struct msghdr *hdr = &tx.msgs[i].msg_hdr;
+	tx.fd = fd;
+
+	tx.iov[i].iov_base = tx.data + i * tx.size;
+	tx.iov[i].iov_len = len;
+	memcpy(tx.iov[i].iov_base, msg->msg_iov[0].iov_base, len);
+	hdr->msg_iov = &tx.iov[i];
+	hdr->msg_iovlen = 1;
+
+	memcpy(&tx.name[i], msg->msg_name, msg->msg_namelen);
+	hdr->msg_name = &tx.name[i];
+	hdr->msg_namelen = msg->msg_namelen;
+
+	if(msg->msg_controllen > 0)
+	{
+		memcpy(tx.control[i].buf, msg->msg_control, msg->msg_controllen);
+		hdr->msg_control = tx.control[i].buf;
+	}
+	else
+		hdr->msg_control = NULL;
+	hdr->msg_controllen = msg->msg_controllen;
+	hdr->msg_flags = 0;
+
+	return true;
+}
+
+// The batch has been processed, send the collected replies
+void FTL_batch_flush(void)
+{
+	flush_replies();
+	batching = false;
+}
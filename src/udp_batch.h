@@ -0,0 +1,29 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Batched UDP receive and send prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <stdbool.h>
+// struct msghdr
+#include <sys/socket.h>
+
+// Maximum number of datagrams received or sent with a single system call
+#define UDP_BATCH_SIZE 32u
+// Maximum number of full batches read from a socket before other sockets
+// (e.g., replies from upstream servers) are served again
+#define UDP_BATCH_ROUNDS 4u
+
+ssize_t FTL_batch_recvmsg(const int fd, struct msghdr *msg);
+bool FTL_batch_pending(const int fd) __attribute__((pure));
+void FTL_batch_begin(void);
+bool FTL_batch_send(const int fd, const struct msghdr *msg);
+void FTL_batch_flush(void);
+
+#endif // UDP_BATCH_H
@@ -0,0 +1,303 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Upstream health tracking
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file upstream-health.c
+* @brief Circuit breaking for upstream servers which stopped responding.
+*
+* When dns.circuitBreaker is enabled, every upstream has a circuit which is
+* closed as long as it answers queries. Queries which had to be retried and
+* errors connecting to or sending to an upstream count as failures. After
+* UPSTREAM_CIRCUIT_FAILURES consecutive failures (and a high enough smoothed
+* failure rate), the circuit is opened and queries are no longer sent to the
+* upstream as long as other upstreams accept them.
+*
+* Open circuits are probed by the GC thread: once the backoff of a circuit
+* has passed, a query for the NS records of the root zone is sent to the
+* upstream and the circuit becomes half-open. Any answer other than SERVFAIL
+* closes the circuit, otherwise it is opened again with a doubled backoff.
+* Probes are sent from a separate socket so they are independent of dnsmasq.
+*
+* The circuits live in shared memory (upstreamsData) so UDP and TCP workers
+* skip open upstreams, too. All functions but upstream_health_probe() require
+* the SHM lock.
+*/
+
+#include "FTL.h"
+#include "upstream-health.h"
+// config
+#include "config/config.h"
+// log_info()
+#include "log.h"
+// getUpstream()
+#include "datastructure.h"
+// lock_shm()
+#include "shmem.h"
+
+// Probes in flight, only used by the GC thread
+static struct upstream_probe {
+	bool active;
+	int fd;
+	int upstreamID;
+	uint16_t id;
+	double deadline;
+} probes[UPSTREAM_PROBES_MAX] = {{ 0 }};
+
+const char *upstream_circuit_name(const enum circuit_state state)
+{
+	switch(state)
+	{
+		case CIRCUIT_CLOSED:
+			return "closed";
+		case CIRCUIT_OPEN:
+			return "open";
+		case CIRCUIT_HALF_OPEN:
+			return "half-open";
+		default:
+			return "unknown";
+	}
+}
+
+/**
+ * Check if queries may be sent to an upstream
+ *
+ * @param upstreamID The ID of the upstream
+ * @return false if the circuit of the upstream is not closed
+ */
+bool upstream_accepts_queries(const int upstreamID)
+{
+	if(!config.dns.circuitBreaker.v.b)
+		return true;
+
+	const upstreamsData *upstream = getUpstream(upstreamID, true);
+	return upstream == NULL || upstream->circuit.state == CIRCUIT_CLOSED;
+}
+
+/**
+ * Account an answer of or a failure of an upstream
+ *
+ * @param upstreamID The ID of the upstream
+ * @param failed true if the upstream did not answer
+ */
+void upstream_health_result(const int upstreamID, const bool failed)
+{
+	upstreamsData *upstream = getUpstream(upstreamID, true);
+	if(upstream == NULL)
+		return;
+
+	struct upstream_circuit *circuit = &upstream->circuit;
+	if(!failed)
+	{
+		// Late answers of upstreams considered down close the circuit,
+		// a probe possibly still in flight is ignored
+		if(circuit->state != CIRCUIT_CLOSED)
+			log_info("Upstream %s#%u answers queries again",
+			         getstr(upstream->ippos), upstream->port);
+		circuit->state = CIRCUIT_CLOSED;
+		circuit->failures = 0;
+		return;
+	}
+
+	circuit->failures++;
+	if(!config.dns.circuitBreaker.v.b ||
+	   circuit->state != CIRCUIT_CLOSED ||
+	   circuit->failures < UPSTREAM_CIRCUIT_FAILURES ||
+	   upstream->ewma_failed < UPSTREAM_CIRCUIT_RATE)
+		return;
+
+	circuit->state = CIRCUIT_OPEN;
+	circuit->trips++;
+	circuit->backoff = UPSTREAM_CIRCUIT_BACKOFF;
+	circuit->next = double_time() + circuit->backoff;
+
+	log_info("Upstream %s#%u does not answer queries, not sending queries to it until it answers a probe",
+	         getstr(upstream->ippos), upstream->port);
+}
+
+// Send a probe to an upstream, returns the connected socket or -1 on error
+static int send_probe(const char *ip, const in_port_t port, const uint16_t id)
+{
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} addr;
+	socklen_t addrlen = 0;
+	memset(&addr, 0, sizeof(addr));
+
+	if(inet_pton(AF_INET, ip, &addr.in.sin_addr) == 1)
+	{
+		addr.in.sin_family = AF_INET;
+		addr.in.sin_port = htons(port);
+		addrlen = sizeof(addr.in);
+	}
+	else if(inet_pton(AF_INET6, ip, &addr.in6.sin6_addr) == 1)
+	{
+		addr.in6.sin6_family = AF_INET6;
+		addr.in6.sin6_port = htons(port);
+		addrlen = sizeof(addr.in6);
+	}
+	else
+		return -1;
+
+	const int fd = socket(addr.sa.sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+
+	// Recursion desired query for the NS records of the root zone, any
+	// resolver can answer it
+	const unsigned char query[] = {
+		id >> 8, id & 0xFF, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x02, 0x00, 0x01
+	};
+
+	// Connecting the socket lets us receive ICMP errors (e.g., port
+	// unreachable) and only answers of the upstream
+	if(connect(fd, &addr.sa, addrlen) != 0 ||
+	   send(fd, query, sizeof(query), 0) != (ssize_t)sizeof(query))
+	{
+		log_debug(DEBUG_QUERIES, "Cannot probe upstream %s#%u: %s", ip, port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Open or close the circuit of a probed upstream
+static void probe_done(const int upstreamID, const bool answered)
+{
+	upstreamsData *upstream = getUpstream(upstreamID, true);
+	if(upstream == NULL || upstream->circuit.state != CIRCUIT_HALF_OPEN)
+		return;
+
+	struct upstream_circuit *circuit = &upstream->circuit;
+	if(answered)
+	{
+		log_info("Upstream %s#%u answered a probe, sending queries to it again",
+		         getstr(upstream->ippos), upstream->port);
+		circuit->state = CIRCUIT_CLOSED;
+		circuit->failures = 0;
+		return;
+	}
+
+	circuit->backoff *= 2;
+	if(circuit->backoff > UPSTREAM_CIRCUIT_BACKOFF_MAX)
+		circuit->backoff = UPSTREAM_CIRCUIT_BACKOFF_MAX;
+	circuit->state = CIRCUIT_OPEN;
+	circuit->next = double_time() + circuit->backoff;
+
+	log_debug(DEBUG_QUERIES, "Upstream %s#%u did not answer a probe, next probe in %u seconds",
+	          getstr(upstream->ippos), upstream->port, circuit->backoff);
+}
+
+// Check if a probe has been answered, returns true once the probe is done
+static bool check_probe(struct upstream_probe *probe, const double now, bool *answered)
+{
+	unsigned char reply[512];
+	const ssize_t len = recv(probe->fd, reply, sizeof(reply), MSG_DONTWAIT);
+	*answered = false;
+
+	// Answers to other queries (which we did not send) are ignored
+	if(len >= 12 && (reply[0] << 8 | reply[1]) == probe->id && (reply[2] & 0x80))
+	{
+		// Any RCODE but SERVFAIL shows that the upstream works
+		*answered = (reply[3] & 0x0F) != 2;
+		return true;
+	}
+
+	// Errors like port unreachable end the probe right away
+	if(len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		return true;
+
+	return now >= probe->deadline;
+}
+
+/**
+ * Probe upstreams whose circuit is open and collect the answers of earlier
+ * probes. Called by the GC thread once per second
+ */
+void upstream_health_probe(void)
+{
+	const double now = double_time();
+
+	// Collect answers
+	for(unsigned int i = 0; i < UPSTREAM_PROBES_MAX; i++)
+	{
+		struct upstream_probe *probe = &probes[i];
+		bool answered = false;
+		if(!probe->active || !check_probe(probe, now, &answered))
+			continue;
+
+		close(probe->fd);
+		probe->active = false;
+
+		lock_shm();
+		probe_done(probe->upstreamID, answered);
+		unlock_shm();
+	}
+
+	if(!config.dns.circuitBreaker.v.b)
+		return;
+
+	// Find upstreams to be probed. The probes are sent without holding the
+	// lock, their circuits are half-open in the meantime
+	struct {
+		int upstreamID;
+		in_port_t port;
+		char ip[INET6_ADDRSTRLEN];
+	} due[UPSTREAM_PROBES_MAX];
+	unsigned int num = 0u, free_slots = 0u;
+	for(unsigned int i = 0; i < UPSTREAM_PROBES_MAX; i++)
+		if(!probes[i].active)
+			free_slots++;
+
+	lock_shm();
+	for(unsigned int upstreamID = 0; upstreamID < counters->upstreams && num < free_slots; upstreamID++)
+	{
+		upstreamsData *upstream = getUpstream(upstreamID, true);
+		if(upstream == NULL ||
+		   upstream->circuit.state != CIRCUIT_OPEN ||
+		   upstream->circuit.next > now)
+			continue;
+
+		upstream->circuit.state = CIRCUIT_HALF_OPEN;
+		due[num].upstreamID = (int)upstreamID;
+		due[num].port = upstream->port;
+		strncpy(due[num].ip, getstr(upstream->ippos), sizeof(due[num].ip) - 1);
+		due[num].ip[sizeof(due[num].ip) - 1] = '\0';
+		num++;
+	}
+	unlock_shm();
+
+	for(unsigned int i = 0, slot = 0; i < num; i++)
+	{
+		const uint16_t id = (uint16_t)random();
+		const int fd = send_probe(due[i].ip, due[i].port, id);
+		if(fd < 0)
+		{
+			lock_shm();
+			probe_done(due[i].upstreamID, false);
+			unlock_shm();
+			continue;
+		}
+
+		while(probes[slot].active)
+			slot++;
+
+		probes[slot].active = true;
+		probes[slot].fd = fd;
+		probes[slot].upstreamID = due[i].upstreamID;
+		probes[slot].id = id;
+		probes[slot].deadline = now + UPSTREAM_PROBE_TIMEOUT;
+
+		log_debug(DEBUG_QUERIES, "Probing upstream %s#%u", due[i].ip, due[i].port);
+	}
+}
@@ -0,0 +1,51 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Upstream health tracking header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#ifndef UPSTREAM_HEALTH_H
+#define UPSTREAM_HEALTH_H
+
+#include <stdbool.h>
+
+// An upstream's circuit is opened after this many consecutive failures when
+// the smoothed rate of failed queries (upstreamsData.ewma_failed) is at least
+// UPSTREAM_CIRCUIT_RATE
+#define UPSTREAM_CIRCUIT_FAILURES 5u
+#define UPSTREAM_CIRCUIT_RATE 0.5
+// Time until an open circuit is probed for the first time (seconds), doubled
+// after every failed probe up to UPSTREAM_CIRCUIT_BACKOFF_MAX
+#define UPSTREAM_CIRCUIT_BACKOFF 5u
+#define UPSTREAM_CIRCUIT_BACKOFF_MAX 300u
+// Time to wait for the answer to a probe (seconds) and number of upstreams
+// which can be probed at the same time
+#define UPSTREAM_PROBE_TIMEOUT 2.0
+#define UPSTREAM_PROBES_MAX 16u
+
+// Closed circuits forward queries. Open circuits do not, they are probed once
+// their backoff has passed. Half-open circuits wait for the answer to a probe
+enum circuit_state {
+	CIRCUIT_CLOSED,
+	CIRCUIT_OPEN,
+	CIRCUIT_HALF_OPEN
+} __attribute__ ((packed));
+
+struct upstream_circuit {
+	enum circuit_state state;
+	unsigned int failures; // consecutive failures
+	unsigned int trips; // times the circuit has been opened
+	unsigned int backoff; // seconds
+	double next; // time of the next probe
+};
+
+bool upstream_accepts_queries(const int upstreamID);
+void upstream_health_result(const int upstreamID, const bool failed);
+void upstream_health_probe(void);
+const char *upstream_circuit_name(const enum circuit_state state) __attribute__((const));
+
+#endif // UPSTREAM_HEALTH_H
@@ -0,0 +1,214 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  CBOR encoder
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file cbor.c
+* @brief Encodes cJSON trees as CBOR (RFC 8949).
+*
+* API clients sending "Accept: application/cbor" get the same data model as
+* the JSON responses in a compact binary form. Numbers without fractional part
+* are sent as integers, all other numbers as single-precision floats if this
+* is lossless and as double-precision floats otherwise.
+*/
+
+#include "FTL.h"
+#include "webserver/cbor.h"
+// fabs(), islessgreater()
+#include <math.h>
+// UINT8_MAX, UINT16_MAX, UINT32_MAX
+#include <stdint.h>
+
+// Major types (RFC 8949, section 3.1)
+#define CBOR_UINT 0u
+#define CBOR_NEGINT 1u
+#define CBOR_TEXT 3u
+#define CBOR_ARRAY 4u
+#define CBOR_MAP 5u
+
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+
+// Largest integer all smaller integers of which can be represented exactly by a
+// double (2^53)
+#define CBOR_MAX_SAFE_INTEGER 9007199254740992.0
+
+#define CBOR_INITIAL_SIZE 1024u
+
+bool cbor_init(struct cbor_buffer *cbor)
+{
+	cbor->len = 0;
+	cbor->size = CBOR_INITIAL_SIZE;
+	cbor->failed = false;
+	cbor->buf = malloc(cbor->size);
+	return cbor->buf != NULL;
+}
+
+void cbor_free(struct cbor_buffer *cbor)
+{
+	free(cbor->buf);
+	cbor->buf = NULL;
+	cbor->len = 0;
+	cbor->size = 0;
+}
+
+static void cbor_write(struct cbor_buffer *cbor, const void *data, const size_t len)
+{
+	if(cbor->failed)
+		return;
+
+	if(cbor->len + len > cbor->size)
+	{
+		size_t size = cbor->size > 0 ? cbor->size : CBOR_INITIAL_SIZE;
+		while(size < cbor->len + len)
+			size *= 2;
+		unsigned char *buf = realloc(cbor->buf, size);
+		if(buf == NULL)
+		{
+			cbor->failed = true;
+			return;
+		}
+		cbor->buf = buf;
+		cbor->size = size;
+	}
+
+	memcpy(cbor->buf + cbor->len, data, len);
+	cbor->len += len;
+}
+
+void cbor_add_byte(struct cbor_buffer *cbor, const unsigned char byte)
+{
+	cbor_write(cbor, &byte, 1);
+}
+
+// Write the initial byte of a data item followed by its argument in network
+// byte order using as few bytes as possible
+static void cbor_add_head(struct cbor_buffer *cbor, const unsigned char major, const uint64_t value)
+{
+	unsigned char head[9];
+	size_t len = 0;
+	if(value < 24u)
+		head[len++] = (unsigned char)(major << 5 | value);
+	else
+	{
+		unsigned int bytes = 8;
+		unsigned char info = 27;
+		if(value <= UINT8_MAX)
+		{
+			bytes = 1;
+			info = 24;
+		}
+		else if(value <= UINT16_MAX)
+		{
+			bytes = 2;
+			info = 25;
+		}
+		else if(value <= UINT32_MAX)
+		{
+			bytes = 4;
+			info = 26;
+		}
+
+		head[len++] = (unsigned char)(major << 5 | info);
+		for(unsigned int i = bytes; i > 0; i--)
+			head[len++] = (unsigned char)(value >> (8*(i - 1)));
+	}
+
+	cbor_write(cbor, head, len);
+}
+
+void cbor_add_text(struct cbor_buffer *cbor, const char *str)
+{
+	const size_t len = strlen(str);
+	cbor_add_head(cbor, CBOR_TEXT, len);
+	cbor_write(cbor, str, len);
+}
+
+static void cbor_add_number(struct cbor_buffer *cbor, const double value)
+{
+	// Integers are sent as such, they are both shorter and faster to
+	// decode than floats
+	if(fabs(value) < CBOR_MAX_SAFE_INTEGER && !islessgreater((double)(int64_t)value, value))
+	{
+		const int64_t i = (int64_t)value;
+		if(i >= 0)
+			cbor_add_head(cbor, CBOR_UINT, (uint64_t)i);
+		else
+			cbor_add_head(cbor, CBOR_NEGINT, (uint64_t)(-1 - i));
+		return;
+	}
+
+	unsigned char buf[9];
+	const float f = (float)value;
+	if(!islessgreater((double)f, value))
+	{
+		// Single precision is sufficient
+		uint32_t bits = 0;
+		memcpy(&bits, &f, sizeof(bits));
+		buf[0] = CBOR_FLOAT32;
+		for(unsigned int i = 0; i < 4; i++)
+			buf[1 + i] = (unsigned char)(bits >> (8*(3 - i)));
+		cbor_write(cbor, buf, 5);
+		return;
+	}
+
+	// This includes NaN and infinity which have no JSON representation
+	uint64_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	buf[0] = CBOR_FLOAT64;
+	for(unsigned int i = 0; i < 8; i++)
+		buf[1 + i] = (unsigned char)(bits >> (8*(7 - i)));
+	cbor_write(cbor, buf, 9);
+}
+
+// Encode a cJSON item including all of its children
+void cbor_add_item(struct cbor_buffer *cbor, const cJSON *item)
+{
+	const cJSON *child = NULL;
+	uint64_t num = 0;
+	switch(item->type & 0xFF)
+	{
+		case cJSON_False:
+			cbor_add_byte(cbor, CBOR_FALSE);
+			break;
+		case cJSON_True:
+			cbor_add_byte(cbor, CBOR_TRUE);
+			break;
+		case cJSON_Number:
+			cbor_add_number(cbor, item->valuedouble);
+			break;
+		case cJSON_String:
+			cbor_add_text(cbor, item->valuestring != NULL ? item->valuestring : "");
+			break;
+		case cJSON_Array:
+			cJSON_ArrayForEach(child, item)
+				num++;
+			cbor_add_head(cbor, CBOR_ARRAY, num);
+			cJSON_ArrayForEach(child, item)
+				cbor_add_item(cbor, child);
+			break;
+		case cJSON_Object:
+			cJSON_ArrayForEach(child, item)
+				num++;
+			cbor_add_head(cbor, CBOR_MAP, num);
+			cJSON_ArrayForEach(child, item)
+			{
+				cbor_add_text(cbor, child->string != NULL ? child->string : "");
+				cbor_add_item(cbor, child);
+			}
+			break;
+		case cJSON_NULL: // fall through
+		default:
+			cbor_add_byte(cbor, CBOR_NULL);
+			break;
+	}
+}
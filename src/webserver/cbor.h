@@ -0,0 +1,37 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  CBOR encoder prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stdbool.h>
+// size_t
+#include <stddef.h>
+#include "webserver/cJSON/cJSON.h"
+
+// Initial bytes of maps and arrays of indefinite length and the byte
+// terminating them (RFC 8949, section 3.2.2)
+#define CBOR_MAP_INDEFINITE 0xbf
+#define CBOR_ARRAY_INDEFINITE 0x9f
+#define CBOR_BREAK 0xff
+
+struct cbor_buffer {
+	unsigned char *buf;
+	size_t len;
+	size_t size;
+	bool failed;
+};
+
+bool cbor_init(struct cbor_buffer *cbor);
+void cbor_free(struct cbor_buffer *cbor);
+void cbor_add_byte(struct cbor_buffer *cbor, const unsigned char byte);
+void cbor_add_text(struct cbor_buffer *cbor, const char *str);
+void cbor_add_item(struct cbor_buffer *cbor, const cJSON *item);
+
+#endif // CBOR_H
@@ -1969,6 +1969,7 @@ enum {
 	LISTENING_PORTS,
 	NUM_THREADS,
 	PRESPAWN_THREADS,
+	IDLE_THREAD_TIMEOUT, /* Pi-hole modification */
 	RUN_AS_USER,
 	CONFIG_TCP_NODELAY, /* Prepended CONFIG_ to avoid conflict with the
 	                     * socket option typedef TCP_NODELAY. */
@@ -2119,6 +2120,7 @@ static const struct mg_option config_options[] = {
     {"listening_ports", MG_CONFIG_TYPE_STRING_LIST, "8080"},
     {"num_threads", MG_CONFIG_TYPE_NUMBER, "50"},
     {"prespawn_threads", MG_CONFIG_TYPE_NUMBER, "0"},
+    {"idle_thread_timeout_ms", MG_CONFIG_TYPE_NUMBER, "0"}, /* Pi-hole modification */
     {"run_as_user", MG_CONFIG_TYPE_STRING, NULL},
     {"tcp_nodelay", MG_CONFIG_TYPE_NUMBER, "0"},
     {"max_request_size", MG_CONFIG_TYPE_NUMBER, "16384"},
@@ -2440,6 +2442,16 @@ struct mg_context {
 
 	unsigned int spawned_worker_threads; /* How many worker-threads currently
 	                                        exist (modified by master thread) */
+
+	/*************** Pi-hole modification ****************/
+	/* Worker threads idle for longer than cfg_idle_thread_timeout_ms retire
+	 * as long as more than cfg_min_worker_threads are running. Their slots
+	 * (worker_threadids[i] == 0) are reused, spawned_worker_threads is the
+	 * highest slot ever used */
+	unsigned int cfg_min_worker_threads;
+	int cfg_idle_thread_timeout_ms;
+	unsigned int running_worker_threads; /* synchronized by thread_mutex */
+	/*****************************************************/
 	unsigned int
 	    idle_worker_thread_count; /* How many worker-threads are currently
 	                                 sitting around with nothing to do */
@@ -4165,6 +4177,21 @@ send_static_cache_header(struct mg_connection *conn)
 		return;
 	}
 
+	/*************** Pi-hole modification ****************/
+	/* Files requested with a version parameter (?v=<mtime>, see
+	 * pihole.fileversion()) get a new URL whenever they change, so
+	 * browsers may keep them without revalidating */
+	const char *query = conn->request_info.query_string;
+	if (query != NULL
+	    && (strncmp(query, "v=", 2) == 0 || strstr(query, "&v=") != NULL)) {
+		mg_response_header_add(conn,
+		                       "Cache-Control",
+		                       "public, max-age=31536000, immutable",
+		                       -1);
+		return;
+	}
+	/*****************************************************/
+
 	/* Read the server config to check how long a file may be cached.
 	 * The configuration is in seconds. */
 	max_age = atoi(conn->dom_ctx->config[STATIC_FILE_MAX_AGE]);
@@ -4726,6 +4753,17 @@ my_send_http_error_headers(struct mg_connection *conn,
 
 	return 0;
 }
+
+
+/************************************** Pi-hole method **************************************/
+CIVETWEB_API long long
+my_get_bytes_sent(const struct mg_connection *conn)
+{
+	if (conn == NULL) {
+		return 0;
+	}
+	return (long long)conn->num_bytes_sent;
+}
 /********************************************************************************************/
 
 CIVETWEB_API int
@@ -20183,6 +20221,36 @@ consume_socket(struct mg_context *ctx,
 	/* If the queue is empty, wait. We're idle at this point. */
 	while ((ctx->sq_head == ctx->sq_tail)
 	       && (STOP_FLAG_IS_ZERO(&ctx->stop_flag))) {
+		/*************** Pi-hole modification ****************/
+		/* Retire if we have been idle for too long and there are more
+		 * than the minimum number of worker threads */
+		if (ctx->cfg_idle_thread_timeout_ms > 0) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += ctx->cfg_idle_thread_timeout_ms / 1000;
+			deadline.tv_nsec +=
+			    (long)(ctx->cfg_idle_thread_timeout_ms % 1000) * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			if ((pthread_cond_timedwait(&ctx->sq_full,
+			                            &ctx->thread_mutex,
+			                            &deadline)
+			     == ETIMEDOUT)
+			    && (ctx->sq_head == ctx->sq_tail)
+			    && STOP_FLAG_IS_ZERO(&ctx->stop_flag)
+			    && (ctx->running_worker_threads
+			        > ctx->cfg_min_worker_threads)) {
+				ctx->idle_worker_thread_count--;
+				ctx->running_worker_threads--;
+				(void)pthread_mutex_unlock(&ctx->thread_mutex);
+				DEBUG_TRACE("%s", "retiring idle worker thread");
+				return -1;
+			}
+			continue;
+		}
+		/*****************************************************/
 		pthread_cond_wait(&ctx->sq_full, &ctx->thread_mutex);
 	}
 
@@ -20265,6 +20333,7 @@ worker_thread_run(struct mg_connection *conn)
 	int thread_index;
 	struct mg_workerTLS tls;
 	int first_call_to_consume_socket = 1;
+	int consumed; /* Pi-hole modification */
 
 	mg_set_thread_name("worker");
 
@@ -20331,8 +20400,11 @@ worker_thread_run(struct mg_connection *conn)
 	/* Call consume_socket() even when ctx->stop_flag > 0, to let it
 	 * signal sq_empty condvar to wake up the master waiting in
 	 * produce_socket() */
-	while (consume_socket(
-	    ctx, &conn->client, thread_index, first_call_to_consume_socket)) {
+	while ((consumed = consume_socket(ctx,
+	                                  &conn->client,
+	                                  thread_index,
+	                                  first_call_to_consume_socket))
+	       > 0) {
 		first_call_to_consume_socket = 0;
 
 		/* New connections must start with new protocol negotiation */
@@ -20500,6 +20572,19 @@ worker_thread_run(struct mg_connection *conn)
 	conn->conn_state = 9; /* done */
 #endif
 
+	/*************** Pi-hole modification ****************/
+	/* A retired thread frees its slot for a new thread unless the server
+	 * is stopping, in which case the master thread joins it */
+	if (consumed < 0) {
+		(void)pthread_mutex_lock(&ctx->thread_mutex);
+		if (STOP_FLAG_IS_ZERO(&ctx->stop_flag)) {
+			pthread_detach(pthread_self());
+			ctx->worker_threadids[thread_index] = 0;
+		}
+		(void)pthread_mutex_unlock(&ctx->thread_mutex);
+	}
+	/*****************************************************/
+
 	DEBUG_TRACE("%s", "exiting");
 }
 
@@ -21142,13 +21227,24 @@ mg_socketpair(int *sockA, int *sockB)
 static int
 mg_start_worker_thread(struct mg_context *ctx, int only_if_no_idle_threads)
 {
-	const unsigned int i = ctx->spawned_worker_threads;
+	unsigned int i = ctx->spawned_worker_threads;
+
+	(void)pthread_mutex_lock(&ctx->thread_mutex);
+	/*************** Pi-hole modification ****************/
+	/* Reuse the slot of a retired thread */
+	for (unsigned int j = 0; j < ctx->spawned_worker_threads; j++) {
+		if (ctx->worker_threadids[j] == 0) {
+			i = j;
+			break;
+		}
+	}
+	/*****************************************************/
 	if (i >= ctx->cfg_max_worker_threads) {
+		(void)pthread_mutex_unlock(&ctx->thread_mutex);
 		return -1; /* Oops, we hit our worker-thread limit!  No more worker
 		              threads, ever! */
 	}
 
-	(void)pthread_mutex_lock(&ctx->thread_mutex);
 #if defined(ALTERNATIVE_QUEUE)
 	if ((only_if_no_idle_threads) && (ctx->idle_worker_thread_count > 0)) {
 #else
@@ -21163,6 +21259,7 @@ mg_start_worker_thread(struct mg_context *ctx, int only_if_no_idle_threads)
 	ctx->idle_worker_thread_count++; /* we do this here to avoid a race
 	                                    condition while the thread is starting
 	                                    up */
+	ctx->running_worker_threads++; /* Pi-hole modification */
 	(void)pthread_mutex_unlock(&ctx->thread_mutex);
 
 	ctx->worker_connections[i].phys_ctx = ctx;
@@ -21170,12 +21267,15 @@ mg_start_worker_thread(struct mg_context *ctx, int only_if_no_idle_threads)
 	                                  &ctx->worker_connections[i],
 	                                  &ctx->worker_threadids[i]);
 	if (ret == 0) {
-		ctx->spawned_worker_threads++; /* note that we've filled another slot in
-		                                  the table */
-		DEBUG_TRACE("Started worker_thread #%i", ctx->spawned_worker_threads);
+		if (i == ctx->spawned_worker_threads) {
+			ctx->spawned_worker_threads++; /* note that we've filled another
+			                                  slot in the table */
+		}
+		DEBUG_TRACE("Started worker_thread #%i", i + 1);
 	} else {
 		(void)pthread_mutex_lock(&ctx->thread_mutex);
 		ctx->idle_worker_thread_count--; /* whoops, roll-back on error */
+		ctx->running_worker_threads--;   /* Pi-hole modification */
 		(void)pthread_mutex_unlock(&ctx->thread_mutex);
 	}
 	return ret;
@@ -21447,6 +21547,11 @@ mg_start2(struct mg_init_data *init, struct mg_error_data *error)
 		    workerthreadcount; /* can't prespawn more than all of them! */
 	}
 
+	/* Pi-hole modification: Keep the prespawned threads when retiring idle
+	 * threads */
+	ctx->cfg_min_worker_threads = (unsigned int)prespawnthreadcount;
+	ctx->cfg_idle_thread_timeout_ms = atoi(ctx->dd.config[IDLE_THREAD_TIMEOUT]);
+
 	if ((workerthreadcount > MAX_WORKER_THREADS) || (workerthreadcount <= 0)) {
 		if (workerthreadcount <= 0) {
 			mg_cry_ctx_internal(ctx, "%s", "Invalid number of worker threads");
@@ -942,12 +942,22 @@ int my_send_http_error_headers(struct mg_connection *conn,
                                int status, const char* mime_type,
                                long long content_length);
 
+long long my_get_bytes_sent(const struct mg_connection *conn);
+
 void FTL_rewrite_pattern(char *filename, unsigned long filename_buf_len);
 
+struct lua_State;
+int FTL_lsp_cache_load(struct lua_State *L, const char *path, long long len);
+void FTL_lsp_cache_store(struct lua_State *L, const char *path, long long len);
+
 
 #define MG_CONFIG_MBEDTLS_DEBUG 3
 void FTL_mbed_debug(void *user_param, int level, const char *file,
                     int line, const char *message);
+void FTL_tls_session_config(unsigned int *cache_size, unsigned int *lifetime,
+                            int *tickets);
+void FTL_tls_handshake(int success);
+void FTL_tls_resumed(void);
 
 // Buffer used for additional "Set-Cookie" headers
 #define PIHOLE_HEADERS_MAXLEN 1024
@@ -670,7 +670,18 @@ run_lsp_kepler(struct mg_connection *conn,
 	data.state = 0;
 	data.consumed = 0;
 	data.tag = 0;
-	lua_ok = mg_lua_load(L, lsp_kepler_reader, &data, path, NULL);
+
+	/*************** Pi-hole modification ****************/
+	/* Use the cached bytecode of this page if it did not change, otherwise
+	 * preprocess and compile it and cache the result */
+	lua_ok = FTL_lsp_cache_load(L, path, (long long)len);
+	if (lua_ok < 0) {
+		lua_ok = mg_lua_load(L, lsp_kepler_reader, &data, path, NULL);
+		if (lua_ok == 0) {
+			FTL_lsp_cache_store(L, path, (long long)len);
+		}
+	}
+	/*****************************************************/
 
 	if (lua_ok) {
 		/* Syntax error or OOM.
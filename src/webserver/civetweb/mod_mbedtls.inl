@@ -21,6 +21,16 @@
 #include "mbedtls/x509_crt.h"
 #include <string.h>
 
+/*************** Pi-hole modification ****************/
+#if defined(MBEDTLS_SSL_CACHE_C)
+#include "mbedtls/ssl_cache.h"
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_TICKET_C)
+#include "mbedtls/ssl_ticket.h"
+#define MG_TLS_TICKETS
+#endif
+/*****************************************************/
+
 typedef mbedtls_ssl_context SSL;
 
 typedef struct {
@@ -29,6 +39,14 @@ typedef struct {
 	mbedtls_ctr_drbg_context ctr;    /* Counter random generator state */
 	mbedtls_entropy_context entropy; /* Entropy context */
 	mbedtls_pk_context pkey;         /* Private key */
+	/*************** Pi-hole modification ****************/
+#if defined(MBEDTLS_SSL_CACHE_C)
+	mbedtls_ssl_cache_context cache; /* Server-side session cache */
+#endif
+#if defined(MG_TLS_TICKETS)
+	mbedtls_ssl_ticket_context ticket; /* Session ticket keys */
+#endif
+	/*****************************************************/
 } SSL_CTX;
 
 
@@ -51,6 +69,158 @@ static void mbed_debug(void *context,
 static int mbed_ssl_handshake(mbedtls_ssl_context *ssl);
 
 
+/*************** Pi-hole modification ****************/
+/* Session resumption. The session cache and the ticket keys are shared by
+ * all worker threads. mbedTLS protects them only when built with
+ * MBEDTLS_THREADING_C, so we serialize access ourselves. Successful lookups
+ * are reported to FTL as resumed handshakes. */
+static pthread_mutex_t mbed_session_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+static int
+mbed_cache_get(void *data,
+               unsigned char const *session_id,
+               size_t session_id_len,
+               mbedtls_ssl_session *session)
+{
+	int rc;
+	pthread_mutex_lock(&mbed_session_lock);
+	rc = mbedtls_ssl_cache_get(data, session_id, session_id_len, session);
+	pthread_mutex_unlock(&mbed_session_lock);
+	if (rc == 0) {
+		FTL_tls_resumed();
+	}
+	return rc;
+}
+
+
+static int
+mbed_cache_set(void *data,
+               unsigned char const *session_id,
+               size_t session_id_len,
+               const mbedtls_ssl_session *session)
+{
+	int rc;
+	pthread_mutex_lock(&mbed_session_lock);
+	rc = mbedtls_ssl_cache_set(data, session_id, session_id_len, session);
+	pthread_mutex_unlock(&mbed_session_lock);
+	return rc;
+}
+#else
+static int
+mbed_cache_get(void *data, mbedtls_ssl_session *session)
+{
+	int rc;
+	pthread_mutex_lock(&mbed_session_lock);
+	rc = mbedtls_ssl_cache_get(data, session);
+	pthread_mutex_unlock(&mbed_session_lock);
+	if (rc == 0) {
+		FTL_tls_resumed();
+	}
+	return rc;
+}
+
+
+static int
+mbed_cache_set(void *data, const mbedtls_ssl_session *session)
+{
+	int rc;
+	pthread_mutex_lock(&mbed_session_lock);
+	rc = mbedtls_ssl_cache_set(data, session);
+	pthread_mutex_unlock(&mbed_session_lock);
+	return rc;
+}
+#endif
+#endif /* MBEDTLS_SSL_CACHE_C */
+
+
+#if defined(MG_TLS_TICKETS)
+static int
+mbed_ticket_write(void *p_ticket,
+                  const mbedtls_ssl_session *session,
+                  unsigned char *start,
+                  const unsigned char *end,
+                  size_t *tlen,
+                  uint32_t *lifetime)
+{
+	int rc;
+	pthread_mutex_lock(&mbed_session_lock);
+	rc = mbedtls_ssl_ticket_write(p_ticket, session, start, end, tlen, lifetime);
+	pthread_mutex_unlock(&mbed_session_lock);
+	return rc;
+}
+
+
+static int
+mbed_ticket_parse(void *p_ticket,
+                  mbedtls_ssl_session *session,
+                  unsigned char *buf,
+                  size_t len)
+{
+	int rc;
+	pthread_mutex_lock(&mbed_session_lock);
+	rc = mbedtls_ssl_ticket_parse(p_ticket, session, buf, len);
+	pthread_mutex_unlock(&mbed_session_lock);
+	if (rc == 0) {
+		FTL_tls_resumed();
+	}
+	return rc;
+}
+#endif /* MG_TLS_TICKETS */
+
+
+static int
+mbed_session_init(SSL_CTX *ctx)
+{
+	unsigned int cache_size = 0, lifetime = 0;
+	int tickets = 0;
+	FTL_tls_session_config(&cache_size, &lifetime, &tickets);
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+	if (cache_size > 0) {
+		mbedtls_ssl_cache_set_max_entries(&ctx->cache, (int)cache_size);
+#if defined(MBEDTLS_HAVE_TIME)
+		mbedtls_ssl_cache_set_timeout(&ctx->cache, (int)lifetime);
+#endif
+		mbedtls_ssl_conf_session_cache(&ctx->conf,
+		                               &ctx->cache,
+		                               mbed_cache_get,
+		                               mbed_cache_set);
+	}
+#else
+	(void)cache_size;
+#endif
+
+#if defined(MG_TLS_TICKETS)
+	if (tickets) {
+		/* Ticket keys are rotated every lifetime seconds */
+		int rc = mbedtls_ssl_ticket_setup(&ctx->ticket,
+		                                  mbedtls_ctr_drbg_random,
+		                                  &ctx->ctr,
+		                                  MBEDTLS_CIPHER_AES_256_GCM,
+		                                  lifetime);
+		if (rc != 0) {
+			DEBUG_TRACE("TLS session ticket setup failed (%i)", rc);
+			return -1;
+		}
+		mbedtls_ssl_conf_session_tickets_cb(&ctx->conf,
+		                                    mbed_ticket_write,
+		                                    mbed_ticket_parse,
+		                                    &ctx->ticket);
+	}
+	mbedtls_ssl_conf_session_tickets(&ctx->conf,
+	                                 tickets ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED
+	                                         : MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+#else
+	(void)tickets;
+#endif
+
+	return 0;
+}
+/*****************************************************/
+
+
 int
 mbed_sslctx_init(SSL_CTX *ctx, const char *crt)
 {
@@ -91,6 +261,14 @@ mbed_sslctx_init(SSL_CTX *ctx, const char *crt)
 	mbedtls_pk_init(&ctx->pkey);
 	mbedtls_ctr_drbg_init(&ctx->ctr);
 	mbedtls_x509_crt_init(&ctx->cert);
+	/*************** Pi-hole modification ****************/
+#if defined(MBEDTLS_SSL_CACHE_C)
+	mbedtls_ssl_cache_init(&ctx->cache);
+#endif
+#if defined(MG_TLS_TICKETS)
+	mbedtls_ssl_ticket_init(&ctx->ticket);
+#endif
+	/*****************************************************/
 
 #ifdef MBEDTLS_PSA_CRYPTO_C
 	/* Initialize PSA crypto (mandatory with TLS 1.3)
@@ -158,6 +336,12 @@ mbed_sslctx_init(SSL_CTX *ctx, const char *crt)
 		DEBUG_TRACE("TLS cannot set certificate and private key (%i)", rc);
 		return -1;
 	}
+
+	/*************** Pi-hole modification ****************/
+	if (mbed_session_init(ctx) != 0) {
+		return -1;
+	}
+	/*****************************************************/
 	return 0;
 }
 
@@ -170,6 +354,14 @@ mbed_sslctx_uninit(SSL_CTX *ctx)
 	mbedtls_x509_crt_free(&ctx->cert);
 	mbedtls_entropy_free(&ctx->entropy);
 	mbedtls_ssl_config_free(&ctx->conf);
+	/*************** Pi-hole modification ****************/
+#if defined(MBEDTLS_SSL_CACHE_C)
+	mbedtls_ssl_cache_free(&ctx->cache);
+#endif
+#if defined(MG_TLS_TICKETS)
+	mbedtls_ssl_ticket_free(&ctx->ticket);
+#endif
+	/*****************************************************/
 }
 
 
@@ -197,6 +389,9 @@ mbed_ssl_accept(mbedtls_ssl_context **ssl,
 	mbedtls_ssl_setup(*ssl, &ssl_ctx->conf);
 	mbedtls_ssl_set_bio(*ssl, sock, mbedtls_net_send, mbedtls_net_recv, NULL);
 	rc = mbed_ssl_handshake(*ssl);
+	/*************** Pi-hole modification ****************/
+	FTL_tls_handshake(rc == 0);
+	/*****************************************************/
 	if (rc != 0) {
 		DEBUG_TRACE("TLS handshake failed (%i)", rc);
 		mbedtls_ssl_free(*ssl);
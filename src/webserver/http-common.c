@@ -13,6 +13,8 @@
 #include "config/config.h"
 #include "log.h"
 #include "webserver/json_macros.h"
+// api_cache_store()
+#include "api/api.h"
 // UINT_MAX
 #include <limits.h>
 // HUGE_VAL
@@ -46,16 +48,312 @@ char *json_formatter(const cJSON *object)
 	}
 }
 
+// Check if the client prefers CBOR over JSON. Batched requests are always
+// encoded as JSON as they are parsed again by api_batch()
+bool api_wants_cbor(struct ftl_conn *api)
+{
+	if(api->batch != NULL)
+		return false;
+
+	const char *accept = mg_get_header(api->conn, "Accept");
+	return accept != NULL && strstr(accept, CBOR_MIME_TYPE) != NULL;
+}
+
+/**
+ * Send a cJSON tree encoded as CBOR.
+ *
+ * @param api The API connection
+ * @param code HTTP status code
+ * @param object The object to send, not freed by this function
+ * @return HTTP status code sent
+ */
+int send_cbor(struct ftl_conn *api, const int code, const cJSON *object)
+{
+	struct cbor_buffer cbor;
+	if(!cbor_init(&cbor))
+	{
+		send_http_internal_error(api);
+		return 500;
+	}
+
+	cbor_add_item(&cbor, object);
+	if(cbor.failed)
+	{
+		cbor_free(&cbor);
+		send_http_internal_error(api);
+		return 500;
+	}
+
+	if(code == 200)
+		mg_send_http_ok(api->conn, CBOR_MIME_TYPE, cbor.len);
+	else
+		my_send_http_error_headers(api->conn, code, CBOR_MIME_TYPE, cbor.len);
+	mg_write(api->conn, cbor.buf, cbor.len);
+	cbor_free(&cbor);
+
+	return code;
+}
+
+static int store_batch_response(struct ftl_conn *api, const int code, const char *msg)
+{
+	free(api->batch->body);
+	api->batch->code = code;
+	api->batch->body = msg != NULL ? strdup(msg) : NULL;
+	return msg != NULL ? (int)strlen(msg) : 0;
+}
+
 int send_http(struct ftl_conn *api, const char *mime_type,
               const char *msg)
 {
+	// Keep response of batched requests, they are combined into a single
+	// response by api_batch()
+	if(api->batch != NULL)
+		return store_batch_response(api, 200, msg);
+
+	// Remember response for later requests (if requested)
+	if(api->cache.key != NULL)
+		api_cache_store(api, mime_type, msg);
+
 	mg_send_http_ok(api->conn, mime_type, strlen(msg));
 	return mg_write(api->conn, msg, strlen(msg));
 }
 
+// Send a file from disk without reading it into memory. civetweb hands the
+// file to the kernel using sendfile() unless the connection is encrypted (then
+// it is copied in small blocks) and answers range requests so interrupted
+// downloads can be resumed. The client is asked to store the file as filename
+int send_http_file(struct ftl_conn *api, const char *path, const char *mime_type,
+                   const char *filename)
+{
+	struct stat st;
+	if(stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return send_json_error(api, 404,
+		                       "not_found",
+		                       "File not found",
+		                       NULL);
+
+	char headers[PIHOLE_HEADERS_MAXLEN] = "";
+	if(filename != NULL)
+		snprintf(headers, sizeof(headers),
+		         "Content-Disposition: attachment; filename=\"%s\"",
+		         filename);
+
+	mg_send_mime_file2(api->conn, path, mime_type, headers);
+
+	return mg_get_header(api->conn, "Range") != NULL ? 206 : 200;
+}
+
+// Send buffered stream data as one chunk
+static void json_stream_flush(struct json_stream *stream)
+{
+	if(stream->len == 0 || stream->failed)
+		return;
+
+	// Stop writing once the client went away, the response is rendered
+	// useless anyway
+	if(mg_send_chunk(stream->api->conn, stream->buf, stream->len) < 0)
+		stream->failed = true;
+	stream->len = 0;
+}
+
+static void json_stream_write(struct json_stream *stream, const char *str, size_t len)
+{
+	if(stream->failed)
+		return;
+
+	// Grow the buffer instead of sending data while the stream is held
+	if(stream->hold && stream->len + len > stream->size)
+	{
+		size_t size = stream->size;
+		while(size < stream->len + len)
+			size *= 2;
+		char *buf = realloc(stream->buf, size);
+		if(buf == NULL)
+		{
+			stream->failed = true;
+			return;
+		}
+		stream->buf = buf;
+		stream->size = size;
+	}
+
+	while(len > 0 && !stream->failed)
+	{
+		const size_t n = min(len, stream->size - stream->len);
+		memcpy(stream->buf + stream->len, str, n);
+		stream->len += n;
+		str += n;
+		len -= n;
+
+		if(stream->len == stream->size && !stream->hold)
+			json_stream_flush(stream);
+	}
+}
+
+/**
+ * Start a streamed JSON response. The response is an object whose first member
+ * is an array filled using json_stream_add_item(). The remaining members are
+ * added by json_stream_end(). Only the current item is kept in memory, the
+ * response is sent using chunked transfer encoding while it is being built.
+ *
+ * @param stream The stream to initialize
+ * @param api The API connection
+ * @param array Name of the array member
+ * @return false if the buffer could not be allocated, nothing has been sent in
+ * this case
+ */
+bool json_stream_start(struct json_stream *stream, struct ftl_conn *api, const char *array)
+{
+	stream->api = api;
+	stream->len = 0;
+	stream->items = 0;
+	stream->failed = false;
+	stream->hold = false;
+	stream->size = JSON_STREAM_BUFSIZE;
+	stream->buf = malloc(JSON_STREAM_BUFSIZE);
+	if(stream->buf == NULL)
+		return false;
+
+	// Items are encoded into a scratch buffer reused for all of them
+	memset(&stream->cbor, 0, sizeof(stream->cbor));
+	if(api_wants_cbor(api) && !cbor_init(&stream->cbor))
+	{
+		free(stream->buf);
+		stream->buf = NULL;
+		return false;
+	}
+
+	if(stream->cbor.buf != NULL)
+	{
+		// A map and an array of indefinite length, both are terminated
+		// in json_stream_end()
+		mg_send_http_ok(api->conn, CBOR_MIME_TYPE, -1);
+		cbor_add_byte(&stream->cbor, CBOR_MAP_INDEFINITE);
+		cbor_add_text(&stream->cbor, array);
+		cbor_add_byte(&stream->cbor, CBOR_ARRAY_INDEFINITE);
+		json_stream_write(stream, (const char*)stream->cbor.buf, stream->cbor.len);
+		return true;
+	}
+
+	// A negative content length makes CivetWeb announce chunked encoding
+	mg_send_http_ok(api->conn, "application/json; charset=utf-8", -1);
+
+	json_stream_write(stream, "{\"", 2);
+	json_stream_write(stream, array, strlen(array));
+	json_stream_write(stream, "\":[", 3);
+
+	return true;
+}
+
+// Serialize an item into the array of the stream and free it
+void json_stream_add_item(struct json_stream *stream, cJSON *item)
+{
+	if(stream->cbor.buf != NULL)
+	{
+		stream->cbor.len = 0;
+		if(!stream->failed)
+			cbor_add_item(&stream->cbor, item);
+		cJSON_Delete(item);
+		if(stream->cbor.failed)
+			stream->failed = true;
+		else
+			json_stream_write(stream, (const char*)stream->cbor.buf, stream->cbor.len);
+		stream->items++;
+		return;
+	}
+
+	char *str = stream->failed ? NULL : json_formatter(item);
+	cJSON_Delete(item);
+	if(str == NULL)
+		return;
+
+	if(stream->items++ > 0)
+		json_stream_write(stream, ",", 1);
+	json_stream_write(stream, str, strlen(str));
+	cJSON_free(str);
+}
+
+// Hold back data while the caller must not block on the network, e.g. while
+// holding the SHM lock. The buffer grows as needed and is sent once released
+void json_stream_hold(struct json_stream *stream, const bool hold)
+{
+	stream->hold = hold;
+	if(!hold)
+		json_stream_flush(stream);
+}
+
+/**
+ * Finish a streamed JSON response. The members of the given object are appended
+ * after the array (together with "took").
+ *
+ * @param stream The stream to finish
+ * @param json Object holding the remaining members, freed by this function
+ * @return HTTP status code
+ */
+int json_stream_end(struct json_stream *stream, cJSON *json)
+{
+	struct ftl_conn *api = stream->api;
+	cJSON_AddNumberToObject(json, "took", double_time() - api->now);
+
+	if(stream->cbor.buf != NULL)
+	{
+		// Terminate the array, add the remaining members and terminate
+		// the map
+		stream->cbor.len = 0;
+		cbor_add_byte(&stream->cbor, CBOR_BREAK);
+		const cJSON *member = NULL;
+		cJSON_ArrayForEach(member, json)
+		{
+			cbor_add_text(&stream->cbor, member->string);
+			cbor_add_item(&stream->cbor, member);
+		}
+		cbor_add_byte(&stream->cbor, CBOR_BREAK);
+		cJSON_Delete(json);
+		if(stream->cbor.failed)
+			stream->failed = true;
+		else
+			json_stream_write(stream, (const char*)stream->cbor.buf, stream->cbor.len);
+		cbor_free(&stream->cbor);
+	}
+	else
+	{
+		char *str = json_formatter(json);
+		cJSON_Delete(json);
+
+		json_stream_write(stream, "]", 1);
+		if(str != NULL)
+		{
+			// Splice the members into the streamed object by skipping the
+			// opening brace
+			const char *members = strchr(str, '{');
+			if(members != NULL)
+			{
+				json_stream_write(stream, ",", 1);
+				json_stream_write(stream, members + 1, strlen(members + 1));
+			}
+			cJSON_free(str);
+		}
+		else
+			json_stream_write(stream, "}", 1);
+	}
+
+	json_stream_flush(stream);
+	free(stream->buf);
+	stream->buf = NULL;
+
+	// Send the terminating zero-length chunk
+	if(!stream->failed)
+		mg_send_chunk(api->conn, "", 0);
+
+	return 200;
+}
+
 int send_http_code(struct ftl_conn *api, const char *mime_type,
                    int code, const char *msg)
 {
+	if(api->batch != NULL)
+		return store_batch_response(api, code, msg);
+
 	// Payload will be sent with text/plain encoding due to
 	// the first line being "Error <code>" by definition
 	//return mg_send_http_error(conn, code, "%s", msg);
@@ -136,6 +434,9 @@ int send_json_success(struct ftl_conn *api)
 
 int send_http_internal_error(struct ftl_conn *api)
 {
+	if(api->batch != NULL)
+		return store_batch_response(api, 500, NULL);
+
 	return mg_send_http_error(api->conn, 500, "Internal server error");
 }
 
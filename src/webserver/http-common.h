@@ -17,6 +17,8 @@
 #include "enums.h"
 // tablerow
 #include "database/gravity-db.h"
+// struct cbor_buffer
+#include "webserver/cbor.h"
 
 // strlen()
 #include <string.h>
@@ -57,12 +59,49 @@ struct ftl_conn {
 	struct session *session;
 
 	struct api_options opts;
+	struct {
+		// Cache key of the response being built, NULL if the response
+		// is not to be cached
+		char *key;
+		unsigned int generation;
+	} cache;
+	// Response of a request answered as part of /api/batch, it is stored
+	// here instead of being sent if this is not NULL
+	struct batch_response *batch;
+};
+
+struct batch_response {
+	int code;
+	char *body;
+};
+
+// Streaming JSON writer for responses too large to be built in memory at once
+#define JSON_STREAM_BUFSIZE 16*1024
+struct json_stream {
+	struct ftl_conn *api;
+	char *buf;
+	size_t len;
+	size_t size;
+	unsigned int items;
+	bool failed;
+	bool hold;
+	// Items are encoded as CBOR instead of JSON if buf is not NULL
+	struct cbor_buffer cbor;
 };
 
+#define CBOR_MIME_TYPE "application/cbor"
 
 char *json_formatter(const cJSON *object);
+bool json_stream_start(struct json_stream *stream, struct ftl_conn *api, const char *array);
+void json_stream_add_item(struct json_stream *stream, cJSON *item);
+void json_stream_hold(struct json_stream *stream, const bool hold);
+int json_stream_end(struct json_stream *stream, cJSON *json);
 
+bool api_wants_cbor(struct ftl_conn *api);
+int send_cbor(struct ftl_conn *api, const int code, const cJSON *object);
 int send_http(struct ftl_conn *api, const char *mime_type, const char *msg);
+int send_http_file(struct ftl_conn *api, const char *path, const char *mime_type,
+                   const char *filename);
 int send_http_code(struct ftl_conn *api, const char *mime_type, int code, const char *msg);
 int send_http_internal_error(struct ftl_conn *api);
 int send_json_unauthorized(struct ftl_conn *api);
@@ -0,0 +1,200 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-request arena for cJSON allocations
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+/**
+* @file json-arena.c
+* @brief Bump allocator for the cJSON trees built while answering API requests.
+*
+* Responses consist of thousands of small cJSON nodes and strings which are all
+* freed once the response has been sent. While a request is handled, its thread
+* allocates them from 64 KiB chunks by just advancing an offset. Freeing only
+* decrements the number of live blocks of the chunk, the chunk is recycled as a
+* whole once all of its blocks have been freed and the request is done.
+*
+* All chunks are carved from a single reserved address range so any pointer
+* can be attributed with two comparisons. This makes it safe to free arena
+* blocks from anywhere (cJSON_free(), free() and realloc() all check for them)
+* and blocks outliving their request merely keep their chunk alive. Large
+* blocks and allocations outside of requests are served from the heap.
+*/
+
+#include "FTL.h"
+#include "webserver/json-arena.h"
+#include "webserver/cJSON/cJSON.h"
+#include "log.h"
+// mmap(), madvise()
+#include <sys/mman.h>
+// UINT32_MAX
+#include <stdint.h>
+
+// Size of one chunk and number of chunks in the reserved range (16 MiB of
+// address space, memory is only used for chunks actually touched)
+#define ARENA_CHUNK (64u*1024u)
+#define ARENA_CHUNKS 256u
+// Larger blocks are allocated on the heap
+#define ARENA_MAX_BLOCK 4096u
+// Number of free chunks kept populated for reuse, the memory of all further
+// free chunks is returned to the kernel
+#define ARENA_WARM_CHUNKS 8u
+// Blocks are preceded by their size and 8-byte aligned
+#define ARENA_ALIGN 8u
+
+#define NO_CHUNK UINT32_MAX
+
+static unsigned char *region = NULL;
+// Number of live blocks per chunk plus one while a thread allocates from it
+static uint32_t live[ARENA_CHUNKS] = { 0 };
+// Stack of free chunks
+static uint32_t free_chunks[ARENA_CHUNKS];
+static unsigned int num_free = 0u;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Chunk the current thread allocates from (if any)
+static __thread uint32_t chunk = NO_CHUNK;
+static __thread size_t offset = 0u;
+static __thread bool active = false;
+
+// Forked processes inherit the lock in unlocked state
+static void lock_arena(void)
+{
+	pthread_mutex_lock(&arena_lock);
+}
+
+static void unlock_arena(void)
+{
+	pthread_mutex_unlock(&arena_lock);
+}
+
+static void chunk_put(const uint32_t id)
+{
+	pthread_mutex_lock(&arena_lock);
+	if(num_free >= ARENA_WARM_CHUNKS)
+		madvise(region + (size_t)id * ARENA_CHUNK, ARENA_CHUNK, MADV_DONTNEED);
+	free_chunks[num_free++] = id;
+	pthread_mutex_unlock(&arena_lock);
+}
+
+static void chunk_unref(const uint32_t id)
+{
+	if(__atomic_sub_fetch(&live[id], 1, __ATOMIC_ACQ_REL) == 0)
+		chunk_put(id);
+}
+
+static uint32_t chunk_get(void)
+{
+	uint32_t id = NO_CHUNK;
+	pthread_mutex_lock(&arena_lock);
+	if(num_free > 0)
+		id = free_chunks[--num_free];
+	pthread_mutex_unlock(&arena_lock);
+
+	// The reference of the allocating thread
+	if(id != NO_CHUNK)
+		__atomic_store_n(&live[id], 1, __ATOMIC_RELEASE);
+	return id;
+}
+
+static void * CJSON_CDECL arena_malloc(size_t size)
+{
+	const size_t need = ARENA_ALIGN + ((size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+	if(!active || size > ARENA_MAX_BLOCK)
+		return malloc(size);
+
+	// Continue in a new chunk if the current one is full. It is recycled
+	// once its remaining blocks have been freed
+	if(chunk == NO_CHUNK || offset + need > ARENA_CHUNK)
+	{
+		if(chunk != NO_CHUNK)
+			chunk_unref(chunk);
+		chunk = chunk_get();
+		offset = 0u;
+		// All chunks are in use, fall back to the heap
+		if(chunk == NO_CHUNK)
+			return malloc(size);
+	}
+
+	unsigned char *block = region + (size_t)chunk * ARENA_CHUNK + offset;
+	offset += need;
+	__atomic_add_fetch(&live[chunk], 1, __ATOMIC_RELAXED);
+
+	memcpy(block, &size, sizeof(size));
+	return block + ARENA_ALIGN;
+}
+
+#undef free
+static void CJSON_CDECL arena_free(void *ptr)
+{
+	if(ptr == NULL)
+		return;
+	if(json_arena_owns(ptr))
+		json_arena_free(ptr);
+	else
+		free(ptr);
+}
+
+/**
+ * @brief Reserve the address range of the arena and make cJSON allocate via
+ * the arena. This has to happen before any cJSON object is allocated and
+ * before any other thread is started
+ */
+void init_json_arena(void)
+{
+	void *ptr = mmap(NULL, (size_t)ARENA_CHUNKS * ARENA_CHUNK, PROT_READ | PROT_WRITE,
+	                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(ptr == MAP_FAILED)
+	{
+		log_warn("Cannot reserve memory for JSON arena, using the heap: %s", strerror(errno));
+		return;
+	}
+
+	region = ptr;
+	for(unsigned int i = 0; i < ARENA_CHUNKS; i++)
+		free_chunks[num_free++] = ARENA_CHUNKS - 1u - i;
+	pthread_atfork(lock_arena, unlock_arena, unlock_arena);
+
+	cJSON_Hooks hooks = { arena_malloc, arena_free };
+	cJSON_InitHooks(&hooks);
+}
+
+// Allocate cJSON objects of the current thread from the arena
+void json_arena_begin(void)
+{
+	active = region != NULL;
+}
+
+// Stop allocating from the arena. The chunk of this thread is recycled as soon
+// as all of its blocks have been freed
+void json_arena_end(void)
+{
+	active = false;
+	if(chunk != NO_CHUNK)
+		chunk_unref(chunk);
+	chunk = NO_CHUNK;
+	offset = 0u;
+}
+
+bool json_arena_owns(const void *ptr)
+{
+	const unsigned char *p = ptr;
+	return region != NULL && p >= region && p < region + (size_t)ARENA_CHUNKS * ARENA_CHUNK;
+}
+
+void json_arena_free(void *ptr)
+{
+	chunk_unref((uint32_t)(((unsigned char*)ptr - region) / ARENA_CHUNK));
+}
+
+// Size of an arena block as requested when it was allocated
+size_t json_arena_size(const void *ptr)
+{
+	size_t size = 0u;
+	memcpy(&size, (const unsigned char*)ptr - ARENA_ALIGN, sizeof(size));
+	return size;
+}
@@ -0,0 +1,24 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Per-request arena for cJSON allocations prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <stdbool.h>
+// size_t
+#include <stddef.h>
+
+void init_json_arena(void);
+void json_arena_begin(void);
+void json_arena_end(void);
+bool json_arena_owns(const void *ptr) __attribute__((pure));
+void json_arena_free(void *ptr);
+size_t json_arena_size(const void *ptr) __attribute__((pure));
+
+#endif // JSON_ARENA_H
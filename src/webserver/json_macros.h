@@ -190,6 +190,12 @@
 
 #define JSON_SEND_OBJECT(object)({ \
 	cJSON_AddNumberToObject(object, "took", double_time() - api->now);\
+	if(api_wants_cbor(api)) \
+	{ \
+		const int cbor_code = send_cbor(api, 200, object); \
+		cJSON_Delete(object); \
+		return cbor_code; \
+	} \
 	char *json_string = json_formatter(object); \
 	if(json_string == NULL) \
 	{ \
@@ -206,6 +212,13 @@
 
 #define JSON_SEND_OBJECT_UNLOCK(object)({ \
 	cJSON_AddNumberToObject(object, "took", double_time() - api->now);\
+	if(api_wants_cbor(api)) \
+	{ \
+		const int cbor_code = send_cbor(api, 200, object); \
+		cJSON_Delete(object); \
+		unlock_shm(); \
+		return cbor_code; \
+	} \
 	char *json_string = json_formatter(object); \
 	if(json_string == NULL) \
 	{ \
@@ -231,6 +244,12 @@
 		return code; \
 	} \
 	cJSON_AddNumberToObject(object, "took", double_time() - api->now); \
+	if(api_wants_cbor(api)) \
+	{ \
+		const int cbor_code = send_cbor(api, code, object); \
+		cJSON_Delete(object); \
+		return cbor_code; \
+	} \
 	char *json_string = json_formatter(object); \
 	if(json_string == NULL) \
 	{ \
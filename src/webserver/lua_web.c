@@ -22,6 +22,30 @@
 #include "files.h"
 // ftl_http_redirect()
 #include "webserver.h"
+// lua_dump()
+#include "lua/lua.h"
+
+// Compiled Lua server page. The bytecode is valid as long as the page's
+// modification time and size do not change
+struct lsp_cache_entry {
+	char *path;
+	struct timespec mtime;
+	off_t size;
+	char *bytecode;
+	size_t len;
+	unsigned long used;
+};
+
+static struct lsp_cache_entry lsp_cache[LSP_CACHE_SIZE] = {{ 0 }};
+static struct lsp_cache_stats lsp_stats = { 0 };
+static unsigned long lsp_clock = 0;
+static pthread_mutex_t lsp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct lsp_dump {
+	char *buf;
+	size_t len;
+	size_t size;
+};
 
 static char *login_uri = NULL, *admin_api_uri = NULL, *prefix_webhome = NULL;
 void allocate_lua(char *login_uri_in, char *admin_api_uri_in, char *prefix_webhome_in)
@@ -36,6 +60,136 @@ void init_lua(const struct mg_connection *conn, void *L, unsigned context_flags)
 	return;
 }
 
+// Get the modification time of a Lua server page which has been mapped with
+// <len> bytes. Pages which changed in the meantime are not cached
+static bool lsp_stat(const char *path, const long long len, struct stat *st)
+{
+	return stat(path, st) == 0 && st->st_size == len;
+}
+
+/**
+ * Load the cached bytecode of a Lua server page onto the stack of <L>.
+ * Returns -1 if the page is not cached or has been modified since it was
+ * compiled, otherwise the result of lua_load().
+ */
+int FTL_lsp_cache_load(struct lua_State *L, const char *path, long long len)
+{
+	struct stat st;
+	if(!lsp_stat(path, len, &st))
+		return -1;
+
+	int rc = -1;
+	pthread_mutex_lock(&lsp_lock);
+	for(unsigned int i = 0; i < LSP_CACHE_SIZE; i++)
+	{
+		struct lsp_cache_entry *entry = &lsp_cache[i];
+		if(entry->path == NULL || strcmp(entry->path, path) != 0)
+			continue;
+
+		if(entry->size == st.st_size &&
+		   entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+		   entry->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		{
+			rc = luaL_loadbufferx(L, entry->bytecode, entry->len, path, "b");
+			entry->used = ++lsp_clock;
+		}
+		break;
+	}
+	if(rc == LUA_OK)
+		lsp_stats.hits++;
+	else
+		lsp_stats.misses++;
+	pthread_mutex_unlock(&lsp_lock);
+
+	// A cached chunk which fails to load is recompiled (and replaced)
+	if(rc > LUA_OK)
+	{
+		lua_pop(L, 1);
+		rc = -1;
+	}
+
+	return rc;
+}
+
+static int lsp_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	(void)L;
+	struct lsp_dump *dump = ud;
+	if(dump->len + sz > dump->size)
+	{
+		const size_t size = 2*(dump->len + sz);
+		char *buf = realloc(dump->buf, size);
+		if(buf == NULL)
+			return 1;
+		dump->buf = buf;
+		dump->size = size;
+	}
+	memcpy(dump->buf + dump->len, p, sz);
+	dump->len += sz;
+	return 0;
+}
+
+/**
+ * Store the bytecode of the compiled Lua server page on top of the stack of
+ * <L> in the cache, replacing the least recently used page when it is full.
+ * Debug information is kept so errors still report the page's line numbers.
+ */
+void FTL_lsp_cache_store(struct lua_State *L, const char *path, long long len)
+{
+	struct stat st;
+	if(!lsp_stat(path, len, &st))
+		return;
+
+	struct lsp_dump dump = { 0 };
+	char *name = strdup(path);
+	if(name == NULL || lua_dump(L, lsp_writer, &dump, 0) != 0)
+	{
+		free(name);
+		free(dump.buf);
+		return;
+	}
+
+	pthread_mutex_lock(&lsp_lock);
+	// Replace an older version of this page, use a free slot or evict the
+	// least recently used page (in this order)
+	struct lsp_cache_entry *slot = NULL;
+	for(unsigned int i = 0; i < LSP_CACHE_SIZE; i++)
+	{
+		struct lsp_cache_entry *entry = &lsp_cache[i];
+		if(entry->path != NULL && strcmp(entry->path, path) == 0)
+		{
+			slot = entry;
+			break;
+		}
+		if(slot == NULL || (slot->path != NULL &&
+		   (entry->path == NULL || entry->used < slot->used)))
+			slot = entry;
+	}
+	if(slot->path != NULL && strcmp(slot->path, path) != 0)
+		lsp_stats.evictions++;
+
+	lsp_stats.bytes -= slot->len;
+	free(slot->path);
+	free(slot->bytecode);
+	slot->path = name;
+	slot->mtime = st.st_mtim;
+	slot->size = st.st_size;
+	slot->bytecode = dump.buf;
+	slot->len = dump.len;
+	slot->used = ++lsp_clock;
+	lsp_stats.bytes += slot->len;
+	pthread_mutex_unlock(&lsp_lock);
+
+	log_debug(DEBUG_WEBSERVER, "Cached %zu bytes of bytecode for %s", dump.len, path);
+}
+
+void get_lsp_cache_stats(struct lsp_cache_stats *stats)
+{
+	pthread_mutex_lock(&lsp_lock);
+	*stats = lsp_stats;
+	pthread_mutex_unlock(&lsp_lock);
+}
+
 int request_handler(struct mg_connection *conn, void *cbdata)
 {
 	// Fall back to CivetWeb's default handler if login URI is not available
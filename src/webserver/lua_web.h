@@ -13,8 +13,19 @@
 // definition of struct mg_connection
 #include "http-common.h"
 
+// Maximum number of compiled Lua server pages kept in memory
+#define LSP_CACHE_SIZE 64
+
+struct lsp_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	size_t bytes;
+};
+
 void allocate_lua(char *login_uri_in, char *admin_api_uri_in, char *prefix_webhome);
 void init_lua(const struct mg_connection *conn, void *L, unsigned context_flags);
 int request_handler(struct mg_connection *conn, void *cbdata);
+void get_lsp_cache_stats(struct lsp_cache_stats *stats);
 
 #endif // LUA_WEB_H
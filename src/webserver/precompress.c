@@ -0,0 +1,152 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Precompression of static files
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "webserver/precompress.h"
+// config
+#include "config/config.h"
+// log_info()
+#include "log.h"
+// deflate_file()
+#include "zip/gzip.h"
+// nftw()
+#include <ftw.h>
+// AT_FDCWD
+#include <fcntl.h>
+
+// Compressible static files of the web interface
+static const char *extensions[] = {
+	".js", ".css", ".html", ".htm", ".svg", ".json", ".map", ".txt", ".xml", ".ico", ".ttf", ".eot"
+};
+
+static unsigned int compressed = 0, uptodate = 0, failed = 0;
+static bool enabled = true;
+
+static bool compressible(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+	if(ext == NULL || strchr(ext, '/') != NULL)
+		return false;
+
+	for(unsigned int i = 0; i < ArraySize(extensions); i++)
+		if(strcmp(ext, extensions[i]) == 0)
+			return true;
+
+	return false;
+}
+
+// Create or update <path>.gz. The copy gets the modification time of the
+// original so we can tell if it is still up to date. It is written to a
+// temporary file first as the web server may already serve it
+static int precompress_file(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)ftw;
+	if(type != FTW_F || !S_ISREG(st->st_mode) || st->st_size < PRECOMPRESS_MIN_SIZE || !compressible(path))
+		return FTW_CONTINUE;
+
+	char *gz = NULL, *tmp = NULL;
+	if(asprintf(&gz, "%s.gz", path) < 0 || asprintf(&tmp, "%s.gz.tmp", path) < 0)
+	{
+		free(gz);
+		return FTW_STOP;
+	}
+
+	struct stat gzst;
+	const bool ours = stat(gz, &gzst) == 0 &&
+	                  gzst.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+	                  gzst.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+
+	// CivetWeb serves any existing <file>.gz, so remove the copies we
+	// created when precompression is disabled as they would not be updated
+	if(!enabled)
+	{
+		if(ours && unlink(gz) == 0)
+			compressed++;
+		goto end_of_precompress_file;
+	}
+
+	if(ours)
+	{
+		uptodate++;
+		goto end_of_precompress_file;
+	}
+
+	// Remove outdated copies in any case, they must not be served
+	unlink(gz);
+
+	struct stat tmpst;
+	const struct timespec times[2] = { st->st_atim, st->st_mtim };
+	if(!deflate_file(path, tmp, false) || stat(tmp, &tmpst) != 0 ||
+	   chmod(tmp, st->st_mode & 0777) != 0 ||
+	   utimensat(AT_FDCWD, tmp, times, 0) != 0)
+	{
+		unlink(tmp);
+		failed++;
+		goto end_of_precompress_file;
+	}
+
+	// Keep the copy only if it is worth it
+	if(tmpst.st_size > (1.0 - PRECOMPRESS_MIN_SAVING)*st->st_size)
+	{
+		unlink(tmp);
+		goto end_of_precompress_file;
+	}
+
+	if(rename(tmp, gz) != 0)
+	{
+		unlink(tmp);
+		failed++;
+		goto end_of_precompress_file;
+	}
+
+	compressed++;
+
+end_of_precompress_file:
+	free(gz);
+	free(tmp);
+	return FTW_CONTINUE;
+}
+
+/**
+ * Create gzip-compressed copies of the static files of the web interface.
+ * CivetWeb serves <file>.gz instead of <file> with "Content-Encoding: gzip"
+ * to clients accepting it, so files are compressed once instead of on every
+ * request. Only copies which are missing or outdated are (re)created. When
+ * disabled, copies created earlier are removed again.
+ */
+void precompress_static_files(const bool enable)
+{
+	// Compress only the web interface unless the web server serves the
+	// entire webroot
+	char *dir = NULL;
+	if(asprintf(&dir, "%s%s", config.webserver.paths.webroot.v.s,
+	            config.webserver.serve_all.v.b ? "" : config.webserver.paths.webhome.v.s) < 0)
+		return;
+
+	if(access(dir, W_OK) != 0)
+	{
+		if(enable)
+			log_info("Not precompressing static files in %s: %s", dir, strerror(errno));
+		free(dir);
+		return;
+	}
+
+	const double start = double_time();
+	compressed = uptodate = failed = 0;
+	enabled = enable;
+	nftw(dir, precompress_file, 16, FTW_PHYS | FTW_ACTIONRETVAL);
+
+	if(enable)
+		log_info("Precompressed %u static files in %s (%u up to date, %u failed) in %.1f ms",
+		         compressed, dir, uptodate, failed, 1e3*(double_time() - start));
+	else if(compressed > 0)
+		log_info("Removed %u precompressed static files in %s", compressed, dir);
+	free(dir);
+}
@@ -0,0 +1,21 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Precompression of static files header
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef PRECOMPRESS_H
+#define PRECOMPRESS_H
+
+// Smaller files are not compressed (and CivetWeb would not serve the
+// compressed copy, see MG_FILE_COMPRESSION_SIZE_LIMIT)
+#define PRECOMPRESS_MIN_SIZE 1024
+// Compressed copies which do not save at least this fraction are removed
+#define PRECOMPRESS_MIN_SAVING 0.1
+
+void precompress_static_files(const bool enable);
+
+#endif // PRECOMPRESS_H
@@ -30,6 +30,10 @@
 #include "database/message-table.h"
 // create_cli_password()
 #include "config/password.h"
+// precompress_static_files()
+#include "webserver/precompress.h"
+// set_thread_placement()
+#include "daemon.h"
 
 // Server context handle
 static struct mg_context *ctx = NULL;
@@ -261,6 +265,16 @@ static int log_http_access(const struct mg_connection *conn, const char *message
 	return 1;
 }
 
+// Called by every thread CivetWeb starts (master, workers and timers)
+static void *init_thread(const struct mg_context *context, int thread_type)
+{
+	(void)context;
+	(void)thread_type;
+	set_thread_placement(ROLE_WEBSERVER);
+
+	return NULL;
+}
+
 void FTL_mbed_debug(void *user_param, int level, const char *file, int line, const char *message)
 {
 	// Only log when in TLS debugging mode
@@ -285,6 +299,35 @@ void FTL_mbed_debug(void *user_param, int level, const char *file, int line, con
 	log_web("mbedTLS(%s:%d, %d): %.*s", file, line, level, (int)len, message);
 }
 
+// Settings of the TLS session cache and session tickets, requested by
+// CivetWeb when setting up the TLS context
+void FTL_tls_session_config(unsigned int *cache_size, unsigned int *lifetime, int *tickets)
+{
+	*cache_size = config.webserver.tls.cache.v.ui;
+	// TLS 1.3 does not allow tickets to live longer than seven days
+	*lifetime = min(config.webserver.tls.lifetime.v.ui, 604800u);
+	*tickets = config.webserver.tls.tickets.v.b;
+}
+
+static struct tls_stats tls_stats = { 0 };
+
+void FTL_tls_handshake(int success)
+{
+	__atomic_fetch_add(success ? &tls_stats.handshakes : &tls_stats.failed, 1, __ATOMIC_RELAXED);
+}
+
+void FTL_tls_resumed(void)
+{
+	__atomic_fetch_add(&tls_stats.resumed, 1, __ATOMIC_RELAXED);
+}
+
+void get_tls_stats(struct tls_stats *stats)
+{
+	stats->handshakes = __atomic_load_n(&tls_stats.handshakes, __ATOMIC_RELAXED);
+	stats->failed = __atomic_load_n(&tls_stats.failed, __ATOMIC_RELAXED);
+	stats->resumed = __atomic_load_n(&tls_stats.resumed, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Redirects an HTTP request to a specified URL with a given status code.
  *
@@ -522,6 +565,19 @@ unsigned short get_api_string(char **buf, const bool domain)
 	return (unsigned short)len;
 }
 
+/**
+ * Get the maximum number of web server worker threads
+ * @return webserver.threads or CivetWeb's default if it is unset
+ */
+unsigned int __attribute__((pure)) get_webserver_threads(void)
+{
+	// For compatibility with older versions, set the number of threads to
+	// the default value (50) if it was 0. Before Pi-hole FTL v6.0.4, the
+	// number of threads was computed in dependence of the number of CPUs
+	// available. This is no longer the case.
+	return config.webserver.threads.v.ui > 0 ? config.webserver.threads.v.ui : 50;
+}
+
 void http_init(void)
 {
 	// Don't start web server if port is not set
@@ -531,19 +587,14 @@ void http_init(void)
 		return;
 	}
 
-	// Get maximum number of threads for webserver
-	char num_threads[16] = { 0 };
-	unsigned int threads = config.webserver.threads.v.ui;
-	if(threads == 0)
-	{
-		// For compatibility with older versions, set the number of
-		// threads to the default value (50) if it was 0. Before Pi-hole
-		// FTL v6.0.4, the number of threads was computed in dependence
-		// of the number of CPUs available. This is no longer the case.
-		threads = 50;
-	}
-
-	snprintf(num_threads, sizeof(num_threads), "%u", threads);
+	// Get maximum and minimum number of threads for webserver. Threads
+	// beyond the minimum are created when needed and retired when they
+	// have been idle for webserver.pool.idle seconds
+	char num_threads[16] = { 0 }, min_threads[16] = { 0 }, idle_timeout[16] = { 0 };
+	const unsigned int max_threads = get_webserver_threads();
+	snprintf(num_threads, sizeof(num_threads), "%u", max_threads);
+	snprintf(min_threads, sizeof(min_threads), "%u", min(config.webserver.pool.min.v.ui, max_threads));
+	snprintf(idle_timeout, sizeof(idle_timeout), "%u", min(config.webserver.pool.idle.v.ui, 86400u)*1000u);
 
 	// Ensure null termination for safety
 	num_threads[sizeof(num_threads) - 1] = '\0';
@@ -606,6 +657,8 @@ void http_init(void)
 		"decode_url", "yes",
 		"enable_directory_listing", "no",
 		"num_threads", num_threads,
+		"prespawn_threads", min_threads,
+		"idle_thread_timeout_ms", idle_timeout,
 		"authentication_domain", config.webserver.domain.v.s,
 		"additional_header", webheaders,
 		"index_files", "index.html,index.htm,index.lp",
@@ -682,12 +735,16 @@ void http_init(void)
 		options[++next_option] = config.webserver.acl.v.s;
 	}
 
+	// Create or update (or remove) compressed copies of the static files
+	precompress_static_files(config.webserver.precompress.v.b);
+
 	// Configure logging handlers
 	struct mg_callbacks callbacks;
 	memset(&callbacks, 0, sizeof(callbacks));
 	callbacks.log_message = log_http_message;
 	callbacks.log_access  = log_http_access;
 	callbacks.init_lua    = init_lua;
+	callbacks.init_thread = init_thread;
 
 	// Prepare error handler
 	struct mg_error_data error = { 0 };
@@ -21,6 +21,12 @@
 // Macro to limiting a numeric value to a certain minimum and maximum
 #define LIMIT_MIN_MAX(a, b, c) ((a) < (b) ? (b) : (a) > (c) ? (c) : (a))
 
+struct tls_stats {
+	unsigned long handshakes;
+	unsigned long failed;
+	unsigned long resumed;
+};
+
 void http_init(void);
 void http_terminate(void);
 
@@ -29,5 +35,7 @@ in_port_t get_https_port(void) __attribute__((pure));
 unsigned short get_api_string(char **buf, const bool domain);
 char *get_prefix_webhome(void) __attribute__((pure));
 char *get_api_uri(void) __attribute__((pure));
+unsigned int get_webserver_threads(void) __attribute__((pure));
+void get_tls_stats(struct tls_stats *stats);
 
 #endif // WEBSERVER_H
@@ -469,6 +469,29 @@ static bool check_wildcard_domain(const char *domain, char *san, const size_t sa
 	return strncasecmp(wild_domain, san + 1, san_len - 1) == 0;
 }
 
+// Load the certificate and the private key from a PEM file containing both
+// (as used by the web server) for a TLS server
+bool load_certificate(const char *certfile, mbedtls_x509_crt *crt, mbedtls_pk_context *key)
+{
+	init_entropy();
+
+	int rc = mbedtls_pk_parse_keyfile(key, certfile, NULL, mbedtls_ctr_drbg_random, &ctr_drbg);
+	if(rc != 0)
+	{
+		log_err("Cannot parse private key in %s: Error code %d", certfile, rc);
+		return false;
+	}
+
+	rc = mbedtls_x509_crt_parse_file(crt, certfile);
+	if(rc != 0)
+	{
+		log_err("Cannot parse certificate in %s: Error code %d", certfile, rc);
+		return false;
+	}
+
+	return true;
+}
+
 // This function reads a X.509 certificate from a file and prints a
 // human-readable representation of the certificate to stdout. If a domain is
 // specified, we only check if this domain is present in the certificate.
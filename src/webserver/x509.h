@@ -13,6 +13,8 @@
 #ifdef HAVE_MBEDTLS
 # include <mbedtls/entropy.h>
 # include <mbedtls/ctr_drbg.h>
+# include <mbedtls/pk.h>
+# include <mbedtls/x509_crt.h>
 #endif
 
 #include "enums.h"
@@ -26,5 +28,8 @@ enum cert_check read_certificate(const char* certfile, const char *domain, const
 bool init_entropy(void);
 void destroy_entropy(void);
 ssize_t drbg_random(unsigned char *output, size_t len);
+#ifdef HAVE_MBEDTLS
+bool load_certificate(const char *certfile, mbedtls_x509_crt *crt, mbedtls_pk_context *key);
+#endif
 
 #endif // X509_H
@@ -11,6 +11,10 @@
 #include "FTL.h"
 #include "gzip.h"
 #include "log.h"
+// config.misc.compressThreads
+#include "config/config.h"
+// pthread_create()
+#include <pthread.h>
 
 #include <errno.h>
 #include <stdio.h>
@@ -24,87 +28,68 @@
 
 static int mz_uncompress2_raw(unsigned char *pDest, mz_ulong *pDest_len, const unsigned char *pSource, mz_ulong *pSource_len);
 
-static bool deflate_buffer(const unsigned char *buffer_uncompressed, const mz_ulong size_uncompressed,
-                           unsigned char **buffer_compressed, mz_ulong *size_compressed)
+// Size of the blocks compressed independently of each other
+#define GZIP_BLOCK_SIZE (1024u*1024u)
+// Upper limit of the number of compression threads
+#define GZIP_MAX_THREADS 64u
+
+// Block of a file compressed by one of the compression threads
+struct gzip_block {
+	unsigned char *in;
+	size_t in_len;
+	unsigned char *out;
+	size_t out_len;
+	size_t out_size;
+	tdefl_compressor *comp;
+	bool last;
+	bool success;
+};
+
+static mz_bool put_block_output(const void *buf, int len, void *user)
 {
-	// Allocate memory for compressed file
-	// (compressBound() returns the maximum size of the compressed data)
-	// We add some extra bytes to the buffer to make sure we have enough
-	// space for the GZIP header and footer
-	*size_compressed = compressBound(size_uncompressed) + 14;
-	*buffer_compressed = malloc(*size_compressed);
-	if(*buffer_compressed == NULL)
+	struct gzip_block *block = user;
+	if(block->out_len + len > block->out_size)
 	{
-		log_warn("Failed to allocate %lu bytes of memory", (unsigned long)*size_compressed);
-		return false;
-	}
-
-	// Compress file (ZLIB stream format - not GZIP! - see https://tools.ietf.org/html/rfc1950)
-	int ret = compress2(*buffer_compressed, size_compressed, buffer_uncompressed, size_uncompressed, Z_BEST_COMPRESSION);
-	if(ret != Z_OK)
-	{
-		log_warn("Failed to compress: %s", zError(ret));
-		return false;
+		const size_t size = max(2*block->out_size, block->out_len + len);
+		unsigned char *out = realloc(block->out, size);
+		if(out == NULL)
+			return MZ_FALSE;
+		block->out = out;
+		block->out_size = size;
 	}
+	memcpy(block->out + block->out_len, buf, len);
+	block->out_len += len;
+	return MZ_TRUE;
+}
 
+// Compress one block into raw deflate data (no ZLIB header and footer). All
+// but the last block end with a sync flush which aligns the output to a byte
+// boundary without terminating the deflate stream. The compressed blocks can
+// hence simply be concatenated to form a single stream (like pigz does)
+static void *compress_block(void *arg)
+{
+	struct gzip_block *block = arg;
+	const int flags = tdefl_create_comp_flags_from_zip_params(MZ_BEST_COMPRESSION, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
 
-	// Isolate compressed data, strip ZLIB header (first two bytes) and
-	// footer (last four bytes)
-	// +=======================+
-	// |...compressed blocks...| (more-->)
-	// +=======================+
-	memmove(*buffer_compressed, *buffer_compressed + 2, *size_compressed);
-	*size_compressed -= (2 + 4);
+	block->out_len = 0u;
+	block->success = tdefl_init(block->comp, put_block_output, block, flags) == TDEFL_STATUS_OKAY &&
+	                 tdefl_compress_buffer(block->comp, block->in, block->in_len,
+	                                       block->last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH) ==
+	                 (block->last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY);
 
-	// Generate GZIP header (without timestamp and extra flags)
-	// (see https://tools.ietf.org/html/rfc1952#section-2.3)
-	//
-	//   0   1   2   3   4   5   6   7   8   9
-	// +---+---+---+---+---+---+---+---+---+---+
-	// |ID1|ID2|CM |FLG|     MTIME     |XFL|OS | (more-->)
-	// +---+---+---+---+---+---+---+---+---+---+
-	//
-	// 1F8B: magic number
-	// 08: compression method (deflate)
-	// 01: flags (FTEXT is set)
-	// 00000000: timestamp (set later). For simplicity, we set it to the
-	// current time
-	// 02: extra flags (maximum compression)
-	// 03: operating system (Unix)
-	unsigned char gzip_header[] = { 0x1F, 0x8B, 0x08, 0x01, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03 };
-	// Write header
-	memmove(*buffer_compressed + sizeof(gzip_header), *buffer_compressed, *size_compressed);
-	memcpy(*buffer_compressed, gzip_header, sizeof(gzip_header));
-	*size_compressed += sizeof(gzip_header);
-
-	// Set timestamp
-	uint32_t now = htole32(time(NULL));
-	memcpy(*buffer_compressed + 4, &now, sizeof(now));
+	return NULL;
+}
 
-	// Add GZIP footer (CRC32 and uncompressed size)
-	// (see https://tools.ietf.org/html/rfc1952#section-2.3)
-	//
-	//   0   1   2   3   4   5   6   7
-	// +---+---+---+---+---+---+---+---+
-	// |     CRC32     |     ISIZE     |
-	// +---+---+---+---+---+---+---+---+
-	//
-	// CRC32: This contains a Cyclic Redundancy Check value of the
-	//        uncompressed data computed according to CRC-32 algorithm used in
-	//        the ISO 3309 standard and in section 8.1.1.6.2 of ITU-T
-	//        recommendation V.42.  (See http://www.iso.ch for ordering ISO
-	//        documents. See gopher://info.itu.ch for an online version of
-	//        ITU-T V.42.)
-	// isize: This contains the size of the original (uncompressed) input
-	//        data modulo 2^32 (little endian).
-	const uint32_t crc = (uint32_t)mz_crc32(MZ_CRC32_INIT, buffer_uncompressed, size_uncompressed);
-	memcpy(*buffer_compressed + *size_compressed, &crc, sizeof(crc));
-	*size_compressed += sizeof(crc);
-	const uint32_t isize = htole32(size_uncompressed);
-	memcpy(*buffer_compressed + *size_compressed, &isize, sizeof(isize));
-	*size_compressed += sizeof(isize);
+// Number of threads used for compression, defaults to the number of CPUs
+static unsigned int compress_threads(void)
+{
+	long threads = config.misc.compressThreads.v.ui;
+	if(threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads < 1)
+		threads = 1;
 
-	return true;
+	return min((unsigned int)threads, GZIP_MAX_THREADS);
 }
 
 bool inflate_buffer(unsigned char *buffer_compressed, mz_ulong size_compressed,
@@ -394,9 +379,21 @@ bool inflate_file(const char *infilename, const char *outfilename, bool verbose)
 	return true;
 }
 
+/**
+ * Compress a file to GZIP format. The file is read in blocks which are
+ * compressed in parallel by up to misc.compressThreads threads. The result is
+ * a single, ordinary GZIP member any gunzip can decompress. Only a few blocks
+ * per thread are held in memory regardless of the size of the file.
+ */
 bool deflate_file(const char *infilename, const char *outfilename, bool verbose)
 {
-	// Read entire file into memory
+	bool success = false;
+	const unsigned int threads = compress_threads();
+	struct gzip_block *blocks = NULL;
+	pthread_t *tids = NULL;
+	uint64_t size_uncompressed = 0u, size_compressed = 0u;
+	mz_ulong crc = MZ_CRC32_INIT;
+
 	FILE *infile = fopen(infilename, "rb");
 	if(infile == NULL)
 	{
@@ -417,78 +414,164 @@ bool deflate_file(const char *infilename, const char *outfilename, bool verbose)
 	if(fchmod(fileno(outfile), S_IRUSR | S_IWUSR) != 0)
 		log_warn("Unable to set permissions on file \"%s\": %s", outfilename, strerror(errno));
 
-	// Get file size
-	fseek(infile, 0, SEEK_END);
-	const long size_uncompressed = ftell(infile);
-	fseek(infile, 0, SEEK_SET);
-
-	// Read file into memory
-	unsigned char *buffer_uncompressed = malloc(size_uncompressed);
-	if(buffer_uncompressed == NULL)
+	// Allocate one block and compressor per thread
+	blocks = calloc(threads, sizeof(*blocks));
+	tids = calloc(threads, sizeof(*tids));
+	if(blocks == NULL || tids == NULL)
 	{
-		log_warn("Failed to allocate %lu bytes of memory", (unsigned long)size_uncompressed);
-		fclose(infile);
-		fclose(outfile);
-		return false;
+		log_warn("Failed to allocate memory for %u compression threads", threads);
+		goto end_of_deflate_file;
 	}
-	if(fread(buffer_uncompressed, 1, size_uncompressed, infile) != (size_t)size_uncompressed)
+	for(unsigned int i = 0; i < threads; i++)
 	{
-		log_warn("Failed to read %lu bytes from %s", (unsigned long)size_uncompressed, infilename);
-		fclose(infile);
-		fclose(outfile);
-		free(buffer_uncompressed);
-		return false;
+		blocks[i].in = malloc(GZIP_BLOCK_SIZE);
+		blocks[i].comp = malloc(sizeof(tdefl_compressor));
+		if(blocks[i].in == NULL || blocks[i].comp == NULL)
+		{
+			log_warn("Failed to allocate memory for %u compression threads", threads);
+			goto end_of_deflate_file;
+		}
 	}
-	fclose(infile);
 
-	unsigned char *buffer_compressed = NULL;
-	mz_ulong size_compressed = 0;
-	bool success = deflate_buffer(buffer_uncompressed, size_uncompressed,
-	                              &buffer_compressed, &size_compressed);
-
-	// Free memory
-	free(buffer_uncompressed);
+	// Generate GZIP header (without timestamp and extra flags)
+	// (see https://tools.ietf.org/html/rfc1952#section-2.3)
+	//
+	//   0   1   2   3   4   5   6   7   8   9
+	// +---+---+---+---+---+---+---+---+---+---+
+	// |ID1|ID2|CM |FLG|     MTIME     |XFL|OS | (more-->)
+	// +---+---+---+---+---+---+---+---+---+---+
+	//
+	// 1F8B: magic number
+	// 08: compression method (deflate)
+	// 01: flags (FTEXT is set)
+	// 00000000: timestamp (set below). For simplicity, we set it to the
+	// current time
+	// 02: extra flags (maximum compression)
+	// 03: operating system (Unix)
+	unsigned char gzip_header[] = { 0x1F, 0x8B, 0x08, 0x01, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03 };
+	const uint32_t now = htole32(time(NULL));
+	memcpy(gzip_header + 4, &now, sizeof(now));
+	if(fwrite(gzip_header, sizeof(gzip_header), 1, outfile) != 1)
+	{
+		log_warn("Failed to write to %s: %s", outfilename, strerror(errno));
+		goto end_of_deflate_file;
+	}
+	size_compressed += sizeof(gzip_header);
 
-	// Check if compression was successful
-	if(!success)
+	bool eof = false;
+	while(!eof)
 	{
-		log_warn("Failed to compress %s", infilename);
-		if(buffer_compressed)
-			free(buffer_compressed);
-		fclose(outfile);
-		return false;
+		// Read up to one block per thread
+		unsigned int n = 0;
+		for(; n < threads && !eof; n++)
+		{
+			blocks[n].in_len = fread(blocks[n].in, 1, GZIP_BLOCK_SIZE, infile);
+			if(ferror(infile))
+			{
+				log_warn("Failed to read from %s: %s", infilename, strerror(errno));
+				goto end_of_deflate_file;
+			}
+
+			// Peek at the next byte to find out whether this is
+			// the last block as it has to terminate the stream
+			const int c = fgetc(infile);
+			if(c == EOF)
+				eof = true;
+			else
+				ungetc(c, infile);
+			blocks[n].last = eof;
+		}
+
+		// Compress the blocks in parallel. The first block is
+		// compressed by this thread. Blocks for which no thread could
+		// be started are compressed here, too
+		bool started[GZIP_MAX_THREADS] = { false };
+		for(unsigned int i = 1; i < n; i++)
+			started[i] = pthread_create(&tids[i], NULL, compress_block, &blocks[i]) == 0;
+		for(unsigned int i = 0; i < n; i++)
+			if(!started[i])
+				compress_block(&blocks[i]);
+		for(unsigned int i = 1; i < n; i++)
+			if(started[i])
+				pthread_join(tids[i], NULL);
+
+		// Write the compressed blocks in order
+		for(unsigned int i = 0; i < n; i++)
+		{
+			if(!blocks[i].success)
+			{
+				log_warn("Failed to compress %s", infilename);
+				goto end_of_deflate_file;
+			}
+			if(fwrite(blocks[i].out, 1, blocks[i].out_len, outfile) != blocks[i].out_len)
+			{
+				log_warn("Failed to write %zu bytes to %s: %s",
+				         blocks[i].out_len, outfilename, strerror(errno));
+				goto end_of_deflate_file;
+			}
+			crc = mz_crc32(crc, blocks[i].in, blocks[i].in_len);
+			size_uncompressed += blocks[i].in_len;
+			size_compressed += blocks[i].out_len;
+		}
 	}
 
-	// Write compressed data to file
-	if(fwrite(buffer_compressed, sizeof(char), size_compressed, outfile) != size_compressed)
+	// Add GZIP footer (CRC32 and uncompressed size)
+	// (see https://tools.ietf.org/html/rfc1952#section-2.3)
+	//
+	//   0   1   2   3   4   5   6   7
+	// +---+---+---+---+---+---+---+---+
+	// |     CRC32     |     ISIZE     |
+	// +---+---+---+---+---+---+---+---+
+	//
+	// CRC32: This contains a Cyclic Redundancy Check value of the
+	//        uncompressed data computed according to CRC-32 algorithm used in
+	//        the ISO 3309 standard and in section 8.1.1.6.2 of ITU-T
+	//        recommendation V.42.
+	// isize: This contains the size of the original (uncompressed) input
+	//        data modulo 2^32 (little endian).
+	const uint32_t gzip_footer[2] = { htole32((uint32_t)crc), htole32((uint32_t)size_uncompressed) };
+	if(fwrite(gzip_footer, sizeof(gzip_footer), 1, outfile) != 1)
 	{
-		log_warn("Failed to write %lu bytes to %s", (unsigned long)size_compressed, outfilename);
-		fclose(outfile);
-		free(buffer_compressed);
-		return false;
+		log_warn("Failed to write to %s: %s", outfilename, strerror(errno));
+		goto end_of_deflate_file;
 	}
-	fclose(outfile);
+	size_compressed += sizeof(gzip_footer);
 
-	free(buffer_compressed);
+	success = true;
 
-	if(verbose)
+end_of_deflate_file:
+	fclose(infile);
+	if(fclose(outfile) != 0 && success)
+	{
+		log_warn("Failed to write to %s: %s", outfilename, strerror(errno));
+		success = false;
+	}
+	if(blocks != NULL)
+	{
+		for(unsigned int i = 0; i < threads; i++)
+		{
+			free(blocks[i].in);
+			free(blocks[i].out);
+			free(blocks[i].comp);
+		}
+	}
+	free(blocks);
+	free(tids);
+
+	if(success && verbose)
 	{
 		// Print compression ratio
-		// Compressed size = size of compressed data
-		//                 + 10 bytes for GZIP header
-		//                 + 8 bytes for GZIP footer
-		const size_t csize = size_compressed - (2 + 4) + 10 + 8;
 		double raw_size, comp_size;
 		char raw_prefix[2], comp_prefix[2];
 		format_memory_size(raw_prefix, size_uncompressed, &raw_size);
-		format_memory_size(comp_prefix, csize, &comp_size);
+		format_memory_size(comp_prefix, size_compressed, &comp_size);
 		log_info("Compressed %s (%.1f%sB) to %s (%.1f%sB), %.1f%% size reduction",
 		         infilename, raw_size, raw_prefix,
 		         outfilename, comp_size, comp_prefix,
-		         100.0 - 100.0*csize / size_uncompressed);
+		         size_uncompressed > 0 ? 100.0 - 100.0*size_compressed / size_uncompressed : 0.0);
 	}
 
-	return true;
+	return success;
 }
 
 // mz_uncompress2_raw() is a copy of mz_uncompress2() from miniz.c with the
@@ -68,127 +68,210 @@ static const char *extract_files[] = {
 	"etc/pihole/gravity.db"
 };
 
-// Create database in memory, copy selected tables to it, serialize and return a memory pointer to it
+// Create an empty temporary file named <prefix>-XXXXXX and store its name in
+// path. Temporary files are created next to the files they are derived from
+// rather than in /tmp, which is often a RAM-backed tmpfs
+bool create_teleporter_tmpfile(const char *prefix, char path[PATH_MAX])
+{
+	if(snprintf(path, PATH_MAX, "%s-XXXXXX", prefix) >= PATH_MAX)
+	{
+		log_warn("Path of temporary file for %s is too long", prefix);
+		return false;
+	}
+
+	const int fd = mkstemp(path);
+	if(fd < 0)
+	{
+		log_warn("Failed to create temporary file %s: %s", path, strerror(errno));
+		path[0] = '\0';
+		return false;
+	}
+	close(fd);
+
+	return true;
+}
+
+// Create a temporary database next to the source database and copy the
+// selected tables to it. The copy is created on disk so it does not have to
+// fit into memory
 static bool create_teleporter_database(const char *filename, const char **tables, const unsigned int num_tables,
-                                       void **buffer, size_t *size)
+                                       char path[PATH_MAX])
 {
-	// Open in-memory sqlite3 database
+	char prefix[PATH_MAX];
+	snprintf(prefix, sizeof(prefix), "%s.teleporter", filename);
+	if(!create_teleporter_tmpfile(prefix, path))
+		return false;
+
+	// Open the (empty) temporary database
 	sqlite3 *db;
-	if(sqlite3_open_v2(":memory:", &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+	if(sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
 	{
-		log_warn("Failed to open in-memory database: %s", sqlite3_errmsg(db));
-		return false;
+		log_warn("Failed to open temporary database %s: %s", path, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		goto create_teleporter_database_error;
 	}
-	// Attach the FTL database to the in-memory database
+	// Attach the source database to the temporary database
 	char *err = NULL;
-	char attach_stmt[128] = "";
+	char attach_stmt[PATH_MAX + 32] = "";
 
 	snprintf(attach_stmt, sizeof(attach_stmt), "ATTACH DATABASE '%s' AS \"disk\";", filename);
 
 	// Set busy timeout to 1 second to access the database in a
 	// multi-threaded environment
 	if(sqlite3_busy_timeout(db, 1000) != SQLITE_OK)
-		log_warn("Failed to set busy timeout during creation of in-memory Teleporter database: %s", sqlite3_errmsg(db));
+		log_warn("Failed to set busy timeout during creation of temporary Teleporter database: %s", sqlite3_errmsg(db));
+
+	// The copy is thrown away after it has been archived, there is no need
+	// for crash safety
+	if(sqlite3_exec(db, "PRAGMA journal_mode = OFF; PRAGMA synchronous = OFF;", NULL, NULL, &err) != SQLITE_OK)
+	{
+		log_warn("Failed to configure temporary Teleporter database: %s", err);
+		sqlite3_free(err);
+		err = NULL;
+	}
 
 	if(sqlite3_exec(db, attach_stmt, NULL, NULL, &err) != SQLITE_OK)
 	{
-		log_warn("Failed to attach database \"%s\" to in-memory database: %s", filename, err);
+		log_warn("Failed to attach database \"%s\" to temporary database: %s", filename, err);
 		sqlite3_free(err);
 		sqlite3_close(db);
-		return false;
+		goto create_teleporter_database_error;
 	}
 
-	// Loop over the tables and copy them to the in-memory database
+	// Loop over the tables and copy them to the temporary database
 	for(unsigned int i = 0; i < num_tables; i++)
 	{
 		char create_stmt[128] = "";
 
-		// Create in-memory table copy
+		// Create table copy
 		snprintf(create_stmt, sizeof(create_stmt), "CREATE TABLE \"%s\" AS SELECT * FROM disk.\"%s\";", tables[i], tables[i]);
 		if(sqlite3_exec(db, create_stmt, NULL, NULL, &err) != SQLITE_OK)
 		{
-			log_warn("Failed to create %s in in-memory database: %s", tables[i], err);
+			log_warn("Failed to create %s in temporary database: %s", tables[i], err);
 			sqlite3_free(err);
 			sqlite3_close(db);
-			return false;
+			goto create_teleporter_database_error;
 		}
 	}
 
-	// Detach the FTL database from the in-memory database
+	// Detach the source database from the temporary database
 	if(sqlite3_exec(db, "DETACH DATABASE 'disk';", NULL, NULL, &err) != SQLITE_OK)
 	{
-		log_warn("Failed to detach FTL database from in-memory database: %s", err);
+		log_warn("Failed to detach source database from temporary database: %s", err);
 		sqlite3_free(err);
 		sqlite3_close(db);
-		return false;
+		goto create_teleporter_database_error;
 	}
 
-	// Serialize the in-memory database to a buffer
-	// The sqlite3_serialize(D,S,P,F) interface returns a pointer to memory that
-	// is a serialization of the S database on database connection D. If P is
-	// not a NULL pointer, then the size of the database in bytes is written
-	// into *P.
-	// For an ordinary on-disk database file, the serialization is just a copy
-	// of the disk file. For an in-memory database or a "TEMP" database, the
-	// serialization is the same sequence of bytes which would be written to
-	// disk if that database where backed up to disk.
-	// The usual case is that sqlite3_serialize() copies the serialization of
-	// the database into memory obtained from sqlite3_malloc64() and returns a
-	// pointer to that memory. The caller is responsible for freeing the
-	// returned value to avoid a memory leak.
-	sqlite3_int64 isize = 0;
-	*buffer = sqlite3_serialize(db, "main", &isize, 0);
-	*size = isize;
-	if(*buffer == NULL)
-	{
-		log_warn("Failed to serialize in-memory database to buffer: %s", sqlite3_errmsg(db));
-		sqlite3_close(db);
-		return false;
+	// Close the temporary database
+	if(sqlite3_close(db) != SQLITE_OK)
+	{
+		log_warn("Failed to close temporary database %s: %s", path, sqlite3_errmsg(db));
+		goto create_teleporter_database_error;
 	}
 
-	// Close the in-memory database
-	sqlite3_close(db);
-
 	return true;
+
+create_teleporter_database_error:
+	unlink(path);
+	path[0] = '\0';
+	return false;
 }
 
-const char *generate_teleporter_zip(mz_zip_archive *zip, char filename[128], void **ptr, size_t *size)
+// Destination of a Teleporter archive while it is being created
+struct zip_stream {
+	teleporter_write_cb writer;
+	void *opaque;
+	mz_uint64 ofs;
+};
+
+// Files are added to the archive without MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE so
+// miniz writes sizes and checksums into a data descriptor following each file
+// instead of seeking back to the local header. The archive is hence written
+// strictly sequentially and can be passed on chunk by chunk
+static size_t zip_stream_write(void *opaque, mz_uint64 ofs, const void *buf, size_t n)
 {
-	// Initialize ZIP archive
-	memset(zip, 0, sizeof(*zip));
+	struct zip_stream *stream = opaque;
+	if(ofs != stream->ofs)
+	{
+		log_warn("Teleporter archive is not written sequentially (offset %llu, expected %llu)",
+		         (unsigned long long)ofs, (unsigned long long)stream->ofs);
+		return 0;
+	}
+
+	if(!stream->writer(stream->opaque, buf, n))
+		return 0;
+
+	stream->ofs += n;
+	return n;
+}
 
-	// Start with 64KB allocation size (pihole.TOML is slightly larger than 32KB
-	// at the time of writing thjs)
-	if(!mz_zip_writer_init_heap(zip, 0, 64*1024))
+static bool add_file_to_zip(mz_zip_archive *zip, const char *archive_name, const char *file_path, const char *file_comment)
+{
+	if(archive_name[0] == '/')
+		archive_name++;
+	return mz_zip_writer_add_file(zip, archive_name, file_path, file_comment,
+	                              (uint16_t)strlen(file_comment), MZ_BEST_COMPRESSION);
+}
+
+/**
+ * Create a Teleporter archive and pass it to writer() chunk by chunk while it
+ * is being compressed. filename is set before writer() is called for the first
+ * time. Databases are copied to temporary files and compressed from there so
+ * neither the archive nor any of the files it contains is ever held in memory
+ * as a whole.
+ */
+const char *generate_teleporter_zip(char filename[128], teleporter_write_cb writer, void *opaque)
+{
+	const char *error = NULL;
+	char gravity_copy[PATH_MAX] = "", ftl_copy[PATH_MAX] = "";
+	mz_zip_archive zip = { 0 };
+	struct zip_stream stream = { writer, opaque, 0u };
+
+	// Generate filename for ZIP archive (it has both the hostname and the
+	// current datetime)
+	char timestr[TIMESTR_SIZE];
+	get_timestr(timestr, time(NULL), false, true);
+	snprintf(filename, 128, "pi-hole_%s_teleporter_%s.zip", hostname(), timestr);
+
+	// Create (reduced versions of) the databases before the first byte is
+	// written so failures can still be reported to the caller
+	if(!create_teleporter_database(config.files.gravity.v.s, gravity_tables, ArraySize(gravity_tables), gravity_copy))
+		return "Failed to create gravity database for ZIP archive!";
+	if(!create_teleporter_database(config.files.database.v.s, ftl_tables, ArraySize(ftl_tables), ftl_copy))
 	{
-		return "Failed creating heap ZIP archive";
+		error = "Failed to create FTL database for ZIP archive!";
+		goto end_of_generate_teleporter_zip;
+	}
+
+	// Initialize ZIP archive
+	zip.m_pWrite = zip_stream_write;
+	zip.m_pIO_opaque = &stream;
+	if(!mz_zip_writer_init_v2(&zip, 0, 0))
+	{
+		error = "Failed creating ZIP archive";
+		goto end_of_generate_teleporter_zip;
 	}
 
 	// Add pihole.toml to the ZIP archive
-	const char *file_comment = "Pi-hole's configuration";
-	const char *file_path = GLOBALTOMLPATH;
-	if(!mz_zip_writer_add_file(zip, file_path+1, file_path, file_comment, (uint16_t)strlen(file_comment), MZ_BEST_COMPRESSION))
+	if(!add_file_to_zip(&zip, GLOBALTOMLPATH, GLOBALTOMLPATH, "Pi-hole's configuration"))
 	{
-		mz_zip_writer_end(zip);
-		return "Failed to add "GLOBALTOMLPATH" to heap ZIP archive!";
+		error = "Failed to add "GLOBALTOMLPATH" to ZIP archive!";
+		goto end_of_generate_teleporter_zip_writer;
 	}
 
 	// Add /etc/hosts to the ZIP archive
-	file_comment = "System's HOSTS file";
-	file_path = "/etc/hosts";
-	if(!mz_zip_writer_add_file(zip, file_path+1, file_path, file_comment, (uint16_t)strlen(file_comment), MZ_BEST_COMPRESSION))
+	if(!add_file_to_zip(&zip, "/etc/hosts", "/etc/hosts", "System's HOSTS file"))
 	{
-		mz_zip_writer_end(zip);
-		return "Failed to add /etc/hosts to heap ZIP archive!";
+		error = "Failed to add /etc/hosts to ZIP archive!";
+		goto end_of_generate_teleporter_zip_writer;
 	}
 
 	// Add /etc/pihole/dhcp.lease to the ZIP archive if it exists
-	file_comment = "DHCP leases file";
-	file_path = "/etc/pihole/dhcp.leases";
-	if(file_exists(file_path) && !mz_zip_writer_add_file(zip, file_path+1, file_path, file_comment, (uint16_t)strlen(file_comment), MZ_BEST_COMPRESSION))
+	if(file_exists(DHCPLEASESFILE) && !add_file_to_zip(&zip, DHCPLEASESFILE, DHCPLEASESFILE, "DHCP leases file"))
 	{
-		mz_zip_writer_end(zip);
-		return "Failed to add /etc/pihole/dhcp.leases to heap ZIP archive!";
+		error = "Failed to add /etc/pihole/dhcp.leases to ZIP archive!";
+		goto end_of_generate_teleporter_zip_writer;
 	}
 
 	const char *directory = "/etc/dnsmasq.d";
@@ -211,84 +294,43 @@ const char *generate_teleporter_zip(mz_zip_archive *zip, char filename[128], voi
 				snprintf(fullpath, 128, "%s/%s", directory, ent->d_name);
 
 				// Add file to ZIP archive
-				file_comment = "dnsmasq configuration file";
-				file_path = fullpath;
-
-				if(!mz_zip_writer_add_file(zip, file_path+1, file_path, file_comment, (uint16_t)strlen(file_comment), MZ_BEST_COMPRESSION))
+				if(!add_file_to_zip(&zip, fullpath, fullpath, "dnsmasq configuration file"))
 					continue;
 			}
 			closedir(dir);
 		}
 	}
 
-	// Add (a reduced version of) the gravity database to the ZIP archive
-	void *dbbuf = NULL;
-	size_t dbsize = 0u;
-	if(create_teleporter_database(config.files.gravity.v.s, gravity_tables, ArraySize(gravity_tables), &dbbuf, &dbsize))
+	// Add the copies of the databases to the ZIP archive. They are stored
+	// under the names of the original databases
+	if(!add_file_to_zip(&zip, config.files.gravity.v.s, gravity_copy, "Pi-hole's gravity database"))
 	{
-		// Add gravity database to ZIP archive
-		file_comment = "Pi-hole's gravity database";
-		file_path = config.files.gravity.v.s;
-		if(file_path[0] == '/')
-			file_path++;
-		if(!mz_zip_writer_add_mem_ex(zip, file_path, dbbuf, dbsize, file_comment, (uint16_t)strlen(file_comment), MZ_BEST_COMPRESSION, 0, 0))
-		{
-			sqlite3_free(dbbuf);
-			mz_zip_writer_end(zip);
-			return "Failed to add gravity database to heap ZIP archive!";
-		}
-		sqlite3_free(dbbuf);
+		error = "Failed to add gravity database to ZIP archive!";
+		goto end_of_generate_teleporter_zip_writer;
 	}
-	else
+	if(!add_file_to_zip(&zip, config.files.database.v.s, ftl_copy, "Pi-hole's FTL database"))
 	{
-		mz_zip_writer_end(zip);
-		return "Failed to create gravity database for heap ZIP archive!";
+		error = "Failed to add FTL database to ZIP archive!";
+		goto end_of_generate_teleporter_zip_writer;
 	}
 
-	if(create_teleporter_database(config.files.database.v.s, ftl_tables, ArraySize(ftl_tables), &dbbuf, &dbsize))
-	{
-		// Add FTL database to ZIP archive
-		file_comment = "Pi-hole's FTL database";
-		file_path = config.files.database.v.s;
-		if(file_path[0] == '/')
-			file_path++;
-		if(!mz_zip_writer_add_mem_ex(zip, file_path, dbbuf, dbsize, file_comment, (uint16_t)strlen(file_comment), MZ_BEST_COMPRESSION, 0, 0))
-		{
-			sqlite3_free(dbbuf);
-			mz_zip_writer_end(zip);
-			return "Failed to add FTL database to heap ZIP archive!";
-		}
-		sqlite3_free(dbbuf);
-	}
-	else
-	{
-		mz_zip_writer_end(zip);
-		return "Failed to create FTL database for heap ZIP archive!";
-	}
+	// Write the central directory
+	if(!mz_zip_writer_finalize_archive(&zip))
+		error = "Failed to finalize ZIP archive!";
 
-	// Get the heap data so we can send it to the requesting client
-	if(!mz_zip_writer_finalize_heap_archive(zip, ptr, size))
-	{
-		mz_zip_writer_end(zip);
-		return "Failed to finalize heap ZIP archive!";
-	}
+end_of_generate_teleporter_zip_writer:
+	if(error != NULL)
+		log_warn("%s (%s)", error, mz_zip_get_error_string(mz_zip_get_last_error(&zip)));
+	mz_zip_writer_end(&zip);
 
-	// Verify that the ZIP archive is valid
-	mz_zip_error pErr;
-	if(!mz_zip_validate_mem_archive(*ptr, *size, MZ_ZIP_FLAG_VALIDATE_LOCATE_FILE_FLAG, &pErr))
-	{
-		log_warn("Failed to validate generated Teleporter ZIP archive: %s",
-		         mz_zip_get_error_string(pErr));
-	}
+end_of_generate_teleporter_zip:
+	// Remove temporary database copies
+	if(gravity_copy[0] != '\0')
+		unlink(gravity_copy);
+	if(ftl_copy[0] != '\0')
+		unlink(ftl_copy);
 
-	// Generate filename for ZIP archive (it has both the hostname and the
-	// current datetime)
-	char timestr[TIMESTR_SIZE];
-	get_timestr(timestr, time(NULL), false, true);
-	snprintf(filename, 128, "pi-hole_%s_teleporter_%s.zip", hostname(), timestr);
-
-	// Everything worked well
-	return NULL;
+	return error;
 }
 
 static const char *test_and_import_pihole_toml(void *ptr, size_t size, char * const hint)
@@ -341,7 +383,7 @@ static const char *test_and_import_pihole_toml(void *ptr, size_t size, char * co
 	return NULL;
 }
 
-static const char *import_dhcp_leases(void *ptr, size_t size, char * const hint)
+static const char *import_dhcp_leases(mz_zip_archive *zip, const mz_uint index, char * const hint)
 {
 	// We do not check if the file is empty here, as an empty dhcp.leases file is valid
 
@@ -352,25 +394,17 @@ static const char *import_dhcp_leases(void *ptr, size_t size, char * const hint)
 	// Rotate current dhcp.leases file
 	rotate_files(DHCPLEASESFILE, NULL);
 
-	// Write new dhcp.leases file to disk
-	FILE *fp = fopen(DHCPLEASESFILE, "w");
-	if(fp == NULL)
-	{
-		strncpy(hint, strerror(errno), ERRBUF_SIZE);
-		return "Failed to open dhcp.leases file for writing";
-	}
-	if(fwrite(ptr, 1, size, fp) != size)
+	// Extract new dhcp.leases file directly to disk
+	if(!mz_zip_reader_extract_to_file(zip, index, DHCPLEASESFILE, 0))
 	{
-		strncpy(hint, strerror(errno), ERRBUF_SIZE);
-		fclose(fp);
+		strncpy(hint, mz_zip_get_error_string(mz_zip_get_last_error(zip)), ERRBUF_SIZE);
 		return "Failed to write to dhcp.leases file";
 	}
-	fclose(fp);
 
 	return NULL;
 }
 
-static const char *test_and_import_database(void *ptr, size_t size, const char *destination,
+static const char *test_and_import_database(const char *path, const size_t size, const char *destination,
                                             const char **tables, const size_t num_tables,
                                             char * const hint)
 {
@@ -389,23 +423,25 @@ static const char *test_and_import_database(void *ptr, size_t size, const char *
 	// terminator character at the end. The nul terminator character is not
 	// included in the 16 bytes of the header.
 	// See https://www.sqlite.org/fileformat.html, section 1.3.1
-	if(memcmp(ptr, "SQLite format 3", 15) != 0)
+	char header[16] = "";
+	FILE *fp = fopen(path, "rb");
+	if(fp == NULL || fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+	   memcmp(header, "SQLite format 3", 15) != 0)
 	{
+		if(fp != NULL)
+			fclose(fp);
 		return "File etc/pihole/gravity.db in ZIP archive is not a SQLite3 database file (no header)";
 	}
+	fclose(fp);
 
 	// Check if the file is a valid SQlite3 database
-	// We do this by trying to deserialize the file into a SQLite3 database
-	// object. If this fails, the file is not a valid SQlite3 database.
+	// We do this by trying to open the extracted file as SQLite3 database.
+	// If this fails, the file is not a valid SQlite3 database.
 	sqlite3 *database = NULL;
-	if(sqlite3_open_v2(":memory:", &database, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
-	{
-		strncpy(hint, sqlite3_errmsg(database), ERRBUF_SIZE);
-		return "Failed to open temporary SQLite3 database";
-	}
-	if(sqlite3_deserialize(database, "main", ptr, size, size, SQLITE_DESERIALIZE_READONLY) != SQLITE_OK)
+	if(sqlite3_open_v2(path, &database, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
 	{
 		strncpy(hint, sqlite3_errmsg(database), ERRBUF_SIZE);
+		sqlite3_close(database);
 		return "File etc/pihole/gravity.db in ZIP archive is not a valid SQLite3 database file";
 	}
 
@@ -450,7 +486,7 @@ static const char *test_and_import_database(void *ptr, size_t size, const char *
 		strncpy(hint, err, ERRBUF_SIZE);
 		sqlite3_free(err);
 		sqlite3_close(database);
-		return "Failed to attach database file to in-memory SQLite3 database";
+		return "Failed to attach database file to temporary SQLite3 database";
 	}
 
 	// Disable foreign key checks for import
@@ -517,7 +553,7 @@ static const char *test_and_import_database(void *ptr, size_t size, const char *
 		strncpy(hint, err, ERRBUF_SIZE);
 		sqlite3_free(err);
 		sqlite3_close(database);
-		return "Failed to detach database file from in-memory SQLite3 database";
+		return "Failed to detach database file from temporary SQLite3 database";
 	}
 
 	// Close the database
@@ -529,16 +565,21 @@ static const char *test_and_import_database(void *ptr, size_t size, const char *
 	return NULL;
 }
 
-const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * const hint, cJSON *import, cJSON *imported_files)
+/**
+ * Import a Teleporter archive. Only the central directory of the archive is
+ * read into memory, files are decompressed directly to disk (except for the
+ * small pihole.toml which has to be parsed anyway).
+ */
+const char *read_teleporter_zip(const char *filename, char * const hint, cJSON *import, cJSON *imported_files)
 {
 	// Initialize ZIP archive
 	mz_zip_archive zip = { 0 };
 	memset(&zip, 0, sizeof(zip));
 
-	log_debug(DEBUG_CONFIG, "Reading ZIP archive from memory buffer (size %zu)", buflen);
+	log_debug(DEBUG_CONFIG, "Reading ZIP archive from %s", filename);
 
-	// Open ZIP archive from memory buffer
-	if(!mz_zip_reader_init_mem(&zip, buffer, buflen, 0))
+	// Open ZIP archive
+	if(!mz_zip_reader_init_file(&zip, filename, 0))
 	{
 		strncpy(hint, mz_zip_get_error_string(mz_zip_get_last_error(&zip)), ERRBUF_SIZE);
 		return "Failed to parse received ZIP archive";
@@ -569,22 +610,6 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 		if(!extract)
 			continue;
 
-		// Read file into its dedicated memory buffer
-		void *ptr = malloc(file_stat.m_uncomp_size);
-		if(ptr == NULL)
-		{
-			log_warn("Failed to allocate memory for file %u (%s) in ZIP archive: %s",
-			         i, file_stat.m_filename, mz_zip_get_error_string(mz_zip_get_last_error(&zip)));
-			continue;
-		}
-		if(!mz_zip_reader_extract_to_mem(&zip, i, ptr, file_stat.m_uncomp_size, 0))
-		{
-			log_warn("Failed to read file %u (%s) in ZIP archive: %s",
-			         i, file_stat.m_filename, mz_zip_get_error_string(mz_zip_get_last_error(&zip)));
-			free(ptr);
-			continue;
-		}
-
 		log_debug(DEBUG_CONFIG, "Processing file %u (%s) in ZIP archive (%zu/%zu bytes, comment: \"%s\", timestamp: %lu)",
 		          i, file_stat.m_filename, (size_t)file_stat.m_comp_size, (size_t)file_stat.m_uncomp_size,
 		          file_stat.m_comment, (unsigned long)file_stat.m_time);
@@ -599,16 +624,26 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 			if(import != NULL && !JSON_KEY_TRUE(import, "config"))
 			{
 				log_info("Ignoring file %s in Teleporter archive (not in import list)", file_stat.m_filename);
-				free(ptr);
+				continue;
+			}
+
+			// Read file into its dedicated memory buffer
+			size_t size = 0u;
+			void *ptr = mz_zip_reader_extract_to_heap(&zip, i, &size, 0);
+			if(ptr == NULL)
+			{
+				log_warn("Failed to read file %u (%s) in ZIP archive: %s",
+				         i, file_stat.m_filename, mz_zip_get_error_string(mz_zip_get_last_error(&zip)));
 				continue;
 			}
 
 			// Import Pi-hole configuration
 			memset(hint, 0, ERRBUF_SIZE);
-			const char *err = test_and_import_pihole_toml(ptr, file_stat.m_uncomp_size, hint);
+			const char *err = test_and_import_pihole_toml(ptr, size, hint);
+			mz_free(ptr);
 			if(err != NULL)
 			{
-				free(ptr);
+				mz_zip_reader_end(&zip);
 				return err;
 			}
 			log_debug(DEBUG_CONFIG, "Imported Pi-hole configuration: %s", file_stat.m_filename);
@@ -620,16 +655,15 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 			if(import != NULL && !JSON_KEY_TRUE(import, "dhcp_leases"))
 			{
 				log_info("Ignoring file %s in Teleporter archive (not in import list)", file_stat.m_filename);
-				free(ptr);
 				continue;
 			}
 
 			// Import DHCP leases
 			memset(hint, 0, ERRBUF_SIZE);
-			const char *err = import_dhcp_leases(ptr, file_stat.m_uncomp_size, hint);
+			const char *err = import_dhcp_leases(&zip, i, hint);
 			if(err != NULL)
 			{
-				free(ptr);
+				mz_zip_reader_end(&zip);
 				return err;
 			}
 			log_debug(DEBUG_CONFIG, "Imported DHCP leases: %s", file_stat.m_filename);
@@ -641,7 +675,6 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 			if(import != NULL && !cJSON_HasObjectItem(import, "gravity"))
 			{
 				log_info("Ignoring file %s in Teleporter archive (not in import list)", file_stat.m_filename);
-				free(ptr);
 				continue;
 			}
 
@@ -660,7 +693,6 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 				if(import_gravity == NULL || !cJSON_IsObject(import_gravity))
 				{
 					log_warn("Ignoring file %s in Teleporter archive (import.gravity is not a JSON object)", file_stat.m_filename);
-					free(ptr);
 					continue;
 				}
 
@@ -674,13 +706,32 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 				}
 			}
 
+			// Extract the database to a temporary file next to the
+			// gravity database
+			char prefix[PATH_MAX], tmpfile[PATH_MAX];
+			snprintf(prefix, sizeof(prefix), "%s.teleporter", config.files.gravity.v.s);
+			if(!create_teleporter_tmpfile(prefix, tmpfile))
+			{
+				mz_zip_reader_end(&zip);
+				strncpy(hint, strerror(errno), ERRBUF_SIZE);
+				return "Failed to create temporary file for gravity database";
+			}
+			if(!mz_zip_reader_extract_to_file(&zip, i, tmpfile, 0))
+			{
+				strncpy(hint, mz_zip_get_error_string(mz_zip_get_last_error(&zip)), ERRBUF_SIZE);
+				unlink(tmpfile);
+				mz_zip_reader_end(&zip);
+				return "Failed to extract gravity database from ZIP archive";
+			}
+
 			// Import gravity database
 			memset(hint, 0, ERRBUF_SIZE);
-			const char *err = test_and_import_database(ptr, file_stat.m_uncomp_size, config.files.gravity.v.s,
+			const char *err = test_and_import_database(tmpfile, file_stat.m_uncomp_size, config.files.gravity.v.s,
 			                                           import_tables, num_tables, hint);
+			unlink(tmpfile);
 			if(err != NULL)
 			{
-				free(ptr);
+				mz_zip_reader_end(&zip);
 				return err;
 			}
 			log_debug(DEBUG_CONFIG, "Imported database: %s", file_stat.m_filename);
@@ -693,7 +744,6 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 				if(tablename == NULL)
 				{
 					log_err("Failed to allocate memory for table name");
-					free(ptr);
 					continue;
 				}
 
@@ -706,26 +756,19 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 				free(tablename);
 			}
 
-			// Free allocated memory and skip to next file without
-			// adding it to the JSON array again below
-			free(ptr);
+			// Skip to next file without adding it to the JSON array
+			// again below
 			continue;
 		}
 		else
 		{
 			log_warn("Ignoring file %s in Teleporter archive", file_stat.m_filename);
-
-			// Free allocated memory and skip to next file
-			free(ptr);
 			continue;
 		}
 
 		// Add filename of processed files to JSON array
 		if(imported_files != NULL && !cJSON_AddItemToArray(imported_files, cJSON_CreateString(file_stat.m_filename)))
 			log_warn("Failed to add file %s to JSON array", file_stat.m_filename);
-
-		// Free allocated memory
-		free(ptr);
 	}
 
 	// Close ZIP archive
@@ -735,44 +778,56 @@ const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char * con
 	return NULL;
 }
 
-bool free_teleporter_zip(mz_zip_archive *zip)
+// Teleporter archive written to disk
+struct zip_file {
+	const char *filename;
+	FILE *fp;
+};
+
+static bool write_zip_file(void *opaque, const void *buf, const size_t len)
 {
-	return mz_zip_writer_end(zip);
+	struct zip_file *file = opaque;
+
+	// Open the file when the first chunk arrives, its name is not known
+	// before the archive is generated
+	if(file->fp == NULL && (file->fp = fopen(file->filename, "w")) == NULL)
+	{
+		log_err("Failed to open %s for writing: %s", file->filename, strerror(errno));
+		return false;
+	}
+
+	if(fwrite(buf, 1, len, file->fp) != len)
+	{
+		log_err("Failed to write %zu bytes to %s: %s", len, file->filename, strerror(errno));
+		return false;
+	}
+
+	return true;
 }
 
 bool write_teleporter_zip_to_disk(void)
 {
-	// Generate in-memory ZIP file
-	mz_zip_archive zip = { 0 };
-	void *ptr = NULL;
-	size_t size = 0u;
+	// Generate ZIP file and write it to disk while it is being created
 	char filename[128] = "";
-	const char *error = generate_teleporter_zip(&zip, filename, &ptr, &size);
+	struct zip_file file = { filename, NULL };
+	const char *error = generate_teleporter_zip(filename, write_zip_file, &file);
+	if(file.fp != NULL && fclose(file.fp) != 0 && error == NULL)
+		error = strerror(errno);
 	if(error != NULL)
 	{
 		log_err("Failed to create Teleporter ZIP file: %s", error);
+		if(file.fp != NULL)
+			unlink(filename);
 		return false;
 	}
 
-	// Write file to disk
-	FILE *fp = fopen(filename, "w");
-	if(fp == NULL)
-	{
-		log_err("Failed to open %s for writing: %s", filename, strerror(errno));
-		free_teleporter_zip(&zip);
-		return false;
-	}
-	if(fwrite(ptr, 1, size, fp) != size)
+	// Verify that the ZIP archive is valid
+	mz_zip_error pErr;
+	if(!mz_zip_validate_file_archive(filename, MZ_ZIP_FLAG_VALIDATE_LOCATE_FILE_FLAG, &pErr))
 	{
-		log_err("Failed to write %zu bytes to %s: %s", size, filename, strerror(errno));
-		free_teleporter_zip(&zip);
-		fclose(fp);
-		return false;
+		log_warn("Failed to validate generated Teleporter ZIP archive: %s",
+		         mz_zip_get_error_string(pErr));
 	}
-	fclose(fp);
-
-	// Free allocated ZIP memory
-	free_teleporter_zip(&zip);
 
 	/* Output filename on successful creation */
 	log_info("%s", filename);
@@ -780,60 +835,23 @@ bool write_teleporter_zip_to_disk(void)
 	return true;
 }
 
-#define MAX_TELEPORTER_ZIP_SIZE (size_t)(128*1024*1024) // 128 MiB
-
 bool read_teleporter_zip_from_disk(const char *filename)
 {
-	// Open ZIP archive
-	FILE *fp = fopen(filename, "r");
-	if(fp == NULL)
-	{
-		log_err("Failed to open %s for reading: %s",
-		        filename, strerror(errno));
-		return false;
-	}
-
-	// Get ZIP archive size
-	fseek(fp, 0, SEEK_END);
-	const size_t size = (size_t)ftell(fp);
-	fseek(fp, 0, SEEK_SET);
-	if(size > MAX_TELEPORTER_ZIP_SIZE)
-	{
-		log_err("ZIP archive %s is too large (%zu bytes, max. %zu bytes)",
-		        filename, size, MAX_TELEPORTER_ZIP_SIZE);
-		fclose(fp);
-		return false;
-	}
-
-	// Read ZIP archive to memory
-	void *ptr = calloc(size, sizeof(char));
-	if(fread(ptr, 1, size, fp) != size)
-	{
-		log_err("Failed to read %zu bytes from %s: %s",
-		        size, filename, strerror(errno));
-		fclose(fp);
-		free(ptr);
-		return false;
-	}
-	fclose(fp);
-
 	// Process ZIP archive
 	char hint[ERRBUF_SIZE] = "";
 	cJSON *imported_files = cJSON_CreateArray();
 	if(imported_files == NULL)
 	{
 		log_err("Failed to create JSON array for imported files");
-		free(ptr);
 		return false;
 	}
-	const char *error = read_teleporter_zip(ptr, size, hint, NULL, imported_files);
+	const char *error = read_teleporter_zip(filename, hint, NULL, imported_files);
 
 	if(error != NULL)
 	{
 		log_err("Failed to read Teleporter ZIP file: %s", error);
 		log_err("Hint: %s", hint);
 		cJSON_Delete(imported_files);
-		free(ptr);
 		return false;
 	}
 
@@ -841,5 +859,6 @@ bool read_teleporter_zip_from_disk(const char *filename)
 	for(cJSON *file = imported_files->child; file != NULL; file = file->next)
 		log_info("Imported %s", file->valuestring);
 
+	cJSON_Delete(imported_files);
 	return true;
 }
@@ -12,10 +12,20 @@
 
 #include "zip/miniz/miniz.h"
 #include "webserver/cJSON/cJSON.h"
+// PATH_MAX
+#include <limits.h>
 
-const char *generate_teleporter_zip(mz_zip_archive *zip, char filename[128], void **ptr, size_t *size);
-bool free_teleporter_zip(mz_zip_archive *zip);
-const char *read_teleporter_zip(uint8_t *buffer, const size_t buflen, char *hint, cJSON *import, cJSON *json_files);
+// Uploaded archives are stored in temporary files named <prefix>-XXXXXX
+#define TELEPORTER_UPLOAD "/etc/pihole/teleporter-upload"
+// Archives downloaded as files are stored in temporary files named <prefix>-XXXXXX
+#define TELEPORTER_DOWNLOAD "/etc/pihole/teleporter-download"
+
+// Receives a Teleporter archive chunk by chunk while it is being created
+typedef bool (*teleporter_write_cb)(void *opaque, const void *buf, const size_t len);
+
+bool create_teleporter_tmpfile(const char *prefix, char path[PATH_MAX]);
+const char *generate_teleporter_zip(char filename[128], teleporter_write_cb writer, void *opaque);
+const char *read_teleporter_zip(const char *filename, char *hint, cJSON *import, cJSON *json_files);
 
 bool write_teleporter_zip_to_disk(void);
 bool read_teleporter_zip_from_disk(const char *filename);
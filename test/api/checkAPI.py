@@ -61,6 +61,12 @@ def main():
 		# gravity, stutting down the system, etc.
 		if path.startswith("/api/action"):
 			continue
+		# The live query log never finishes its response
+		if path == "/api/queries/stream":
+			continue
+		# Metrics are not JSON but in the Prometheus text format
+		if path == "/api/metrics":
+			continue
 		with ResponseVerifyer(ftl, openapi) as verifyer:
 			errors = verifyer.verify_endpoint(path)
 			if verifyer.teleporter_archive is not None:
@@ -0,0 +1,223 @@
+#!/bin/python3
+# Pi-hole: A black hole for Internet advertisements
+# (c) 2026 Pi-hole, LLC (https://pi-hole.net)
+# Network-wide ad blocking via your own hardware.
+#
+# FTL Engine - auxiliary files
+# Performance stage of the test suite
+#
+# This file is copyright under the latest version of the EUPL.
+# Please see LICENSE file for your rights under this license.
+
+# Measures the running FTL instance set up by test/run.sh (DNS throughput and
+# latency by query status, API response times, memory usage and startup time)
+# together with the micro-benchmarks of pihole-FTL-bench and compares the
+# results against the baselines stored for the architecture in
+# test/perf/baselines.json. Metrics which got worse by more than their
+# tolerance fail the run. Architectures without baselines are only reported,
+# run with --update to store the current results as their baselines.
+
+import argparse
+import json
+import os
+import platform
+import re
+import subprocess
+import sys
+import time
+import urllib.request
+
+BASELINES = "test/perf/baselines.json"
+
+# API endpoints timed, each of them is requested API_REQUESTS times
+API_ENDPOINTS = [
+	"/api/stats/summary",
+	"/api/stats/top_domains",
+	"/api/history",
+	"/api/history/clients",
+	"/api/queries?length=100",
+]
+API_REQUESTS = 50
+
+# Latencies of statuses with fewer replies are too noisy to be compared
+MIN_STATUS_COUNT = 100
+
+# Where pihole-FTL-bench may have been built
+BENCH_BINARIES = ["./pihole-FTL-bench", "cmake/pihole-FTL-bench", "cmake_ci/pihole-FTL-bench"]
+
+ANSI = re.compile(r"\x1b\[[0-9;]*m")
+
+def metric_kind(name: str):
+	# Returns the tolerance class of a metric and whether larger is better
+	if name.endswith(".qps"):
+		return "qps", True
+	if name.endswith(".lost"):
+		return "dns.lost", False
+	if name.startswith("dns."):
+		return "latency", False
+	if name.startswith("api."):
+		return "api", False
+	if name.startswith("micro."):
+		return "micro", False
+	return name, False
+
+def run_dns_bench(ftl: str, rate: int, duration: int, tcp: bool):
+	results = {}
+	proto = "tcp" if tcp else "udp"
+	cmd = [ftl, "bench", "dns", "-d", "2000", "-r", str(rate), "-t", str(duration), "-c", "256"]
+	if tcp:
+		cmd.append("--tcp")
+	out = subprocess.run(cmd, capture_output=True, text=True)
+	lines = ANSI.sub("", out.stdout).splitlines()
+	if out.returncode != 0:
+		print("\n".join(lines))
+		raise Exception("DNS load generator failed (" + proto + ")")
+
+	for line in lines:
+		m = re.search(r"Sent (\d+) queries, received (\d+) replies in ([0-9.]+) s \(([0-9.]+) replies/s\)", line)
+		if m is not None:
+			results["dns." + proto + ".qps"] = float(m.group(4))
+			results["dns." + proto + ".lost"] = int(m.group(1)) - int(m.group(2))
+			continue
+		# Status, count, p50, p90, p99, p99.9, max
+		cols = line.split()
+		if len(cols) == 7 and cols[1].isdigit() and int(cols[1]) >= MIN_STATUS_COUNT:
+			results["dns." + proto + "." + cols[0] + ".p50"] = float(cols[2])
+			results["dns." + proto + "." + cols[0] + ".p99"] = float(cols[4])
+	return results
+
+def api_login(api: str, password: str):
+	req = urllib.request.Request(api + "/api/auth")
+	with urllib.request.urlopen(req) as r:
+		session = json.load(r)["session"]
+	if session["valid"]:
+		return None
+	req = urllib.request.Request(api + "/api/auth", data=json.dumps({"password": password}).encode(),
+	                             headers={"Content-Type": "application/json"})
+	with urllib.request.urlopen(req) as r:
+		session = json.load(r)["session"]
+	if not session["valid"]:
+		raise Exception("Cannot log in to the API")
+	return session["sid"]
+
+def run_api(api: str, password: str):
+	results = {}
+	sid = api_login(api, password)
+	headers = {"X-FTL-SID": sid} if sid is not None else {}
+	for endpoint in API_ENDPOINTS:
+		times = []
+		for i in range(API_REQUESTS):
+			req = urllib.request.Request(api + endpoint, headers=headers)
+			start = time.perf_counter()
+			with urllib.request.urlopen(req) as r:
+				r.read()
+			times.append(1e3*(time.perf_counter() - start))
+		times.sort()
+		name = "api." + endpoint.split("?")[0][len("/api/"):]
+		results[name + ".p50"] = times[len(times)//2]
+		results[name + ".p95"] = times[int(0.95*(len(times) - 1))]
+	if sid is not None:
+		urllib.request.urlopen(urllib.request.Request(api + "/api/auth", headers=headers, method="DELETE"))
+	return results
+
+def ftl_rss():
+	with open("/run/pihole-FTL.pid") as f:
+		pid = f.read().strip()
+	results = {}
+	with open("/proc/" + pid + "/status") as f:
+		for line in f:
+			if line.startswith("VmRSS:"):
+				results["rss_kib"] = int(line.split()[1])
+			elif line.startswith("VmHWM:"):
+				results["rss_peak_kib"] = int(line.split()[1])
+	return results
+
+def run_micro(runs: int):
+	binary = next((b for b in BENCH_BINARIES if os.access(b, os.X_OK)), None)
+	if binary is None:
+		print("pihole-FTL-bench not found, skipping micro-benchmarks")
+		return {}
+	out = subprocess.run([binary, "-r", str(runs)], capture_output=True, text=True)
+	if out.returncode != 0:
+		print(out.stderr)
+		raise Exception("Micro-benchmarks failed")
+	# Benchmarks without their data (e.g. the gravity database) are skipped
+	return {"micro." + b["name"]: b["median_ns"] for b in json.loads(out.stdout)["benchmarks"] if "median_ns" in b}
+
+def compare(results: dict, baseline: dict, tolerance: dict):
+	# Returns the number of regressions, prints one line per metric
+	regressions = 0
+	print("%-40s %12s %12s %8s  %s" % ("Metric", "Baseline", "Current", "Change", "Result"))
+	for name in sorted(set(results) | set(baseline)):
+		kind, higher_is_better = metric_kind(name)
+		tol = tolerance.get(kind, tolerance["default"])
+		cur, base = results.get(name), baseline.get(name)
+		if cur is None or base is None:
+			print("%-40s %12s %12s %8s  %s" % (name, "-" if base is None else "%.3f" % base,
+			                                    "-" if cur is None else "%.3f" % cur, "",
+			                                    "NEW" if base is None else "MISSING"))
+			continue
+		change = (cur - base)/base if base != 0 else (0.0 if cur == 0 else float("inf"))
+		worse = base - cur if higher_is_better else cur - base
+		# Small absolute differences are noise, even if they are large in
+		# relative terms
+		bad = worse > tol["rel"]*abs(base) and worse > tol["abs"]
+		regressions += bad
+		print("%-40s %12.3f %12.3f %+7.1f%%  %s" % (name, base, cur, 100*change, "REGRESSION" if bad else "OK"))
+	return regressions
+
+def main():
+	parser = argparse.ArgumentParser(description="Performance stage of the FTL test suite")
+	parser.add_argument("--ftl", default="./pihole-FTL", help="pihole-FTL binary running the DNS load generator")
+	parser.add_argument("--api", default="http://127.0.0.1", help="Base URL of the API")
+	parser.add_argument("--password", default="ABC", help="API password (if needed)")
+	parser.add_argument("--rate", type=int, default=2000, help="DNS queries per second")
+	parser.add_argument("--duration", type=int, default=5, help="Seconds of DNS load per protocol")
+	parser.add_argument("--runs", type=int, default=5, help="Repetitions of each micro-benchmark")
+	parser.add_argument("--startup", type=float, help="Startup time of FTL (milliseconds)")
+	parser.add_argument("--arch", default=os.environ.get("CI_ARCH") or platform.machine(), help="Baselines to compare against")
+	parser.add_argument("--output", help="Write the results as JSON to this file")
+	parser.add_argument("--update", action="store_true", help="Store the results as baselines of the architecture")
+	args = parser.parse_args()
+
+	results = {}
+	if args.startup is not None:
+		results["startup_ms"] = args.startup
+	results.update(run_dns_bench(args.ftl, args.rate, args.duration, False))
+	results.update(run_dns_bench(args.ftl, args.rate, args.duration, True))
+	results.update(run_api(args.api, args.password))
+	# Memory is measured after the load so it includes the queries
+	results.update(ftl_rss())
+	results.update(run_micro(args.runs))
+
+	if args.output is not None:
+		with open(args.output, "w") as f:
+			json.dump(results, f, indent=2, sort_keys=True)
+
+	with open(BASELINES) as f:
+		baselines = json.load(f)
+
+	if args.update:
+		baselines["baselines"][args.arch] = {k: round(v, 3) for k, v in sorted(results.items())}
+		with open(BASELINES, "w") as f:
+			json.dump(baselines, f, indent=2)
+			f.write("\n")
+		print("Stored " + str(len(results)) + " baselines for " + args.arch)
+		return 0
+
+	print("Performance results (" + args.arch + "):")
+	baseline = baselines["baselines"].get(args.arch)
+	if baseline is None:
+		compare(results, {}, baselines["tolerance"])
+		print("\nNo baselines for " + args.arch + ", not comparing")
+		return 0
+
+	regressions = compare(results, baseline, baselines["tolerance"])
+	if regressions > 0:
+		print("\n" + str(regressions) + " performance regression(s) beyond the tolerances in " + BASELINES)
+		return 1
+	print("\nNo performance regressions")
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -84,11 +84,20 @@ export FTLCONF_files_pcap='*123#./test/pcap'
 echo "handle SIGHUP nostop SIGPIPE nostop SIGTERM nostop SIG32 nostop SIG33 nostop SIG34 nostop SIG35 nostop SIG41 nostop" > /root/.gdbinit
 
 # Start FTL
+start="${EPOCHREALTIME/[.,]/}"
 if ! su pihole -s /bin/sh -c /home/pihole/pihole-FTL; then
   echo "pihole-FTL failed to start"
   exit 1
 fi
 
+# Measure the startup time until the first DNS reply (for the performance
+# stage below)
+for _ in {1..300}; do
+  dig CHAOS TXT version.FTL @127.0.0.1 +short +time=1 +tries=1 > /dev/null && break
+  sleep 0.1
+done
+FTL_STARTUP_MS="$(( (${EPOCHREALTIME/[.,]/} - start) / 1000 ))"
+
 # Prepare BATS
 if [ -z "$BATS" ]; then
   mkdir -p test/libs
@@ -118,6 +127,15 @@ apk add --no-cache py3-dnspython
 $BATS -p "test/test_suite.bats"
 RET=$?
 
+# Run performance stage, regressions beyond the tolerances stored in
+# test/perf/baselines.json fail the run
+if [[ ${PERF} != "false" ]]; then
+  echo "Running performance stage"
+  if ! python3 test/perf.py --startup "${FTL_STARTUP_MS}" --output perf.json && [[ $RET == 0 ]]; then
+    RET=1
+  fi
+fi
+
 curl_to_tricorder() {
   curl --silent --upload-file "${1}" https://tricorder.pi-hole.net
 }
@@ -691,7 +691,7 @@
   [[ "${lines[@]}" == *"CREATE TABLE IF NOT EXISTS \"network\" (id INTEGER PRIMARY KEY NOT NULL, hwaddr TEXT UNIQUE NOT NULL, interface TEXT NOT NULL, firstSeen INTEGER NOT NULL, lastQuery INTEGER NOT NULL, numQueries INTEGER NOT NULL, macVendor TEXT, aliasclient_id INTEGER);"* ]]
   [[ "${lines[@]}" == *"CREATE TABLE IF NOT EXISTS \"network_addresses\" (network_id INTEGER NOT NULL, ip TEXT UNIQUE NOT NULL, lastSeen INTEGER NOT NULL DEFAULT (cast(strftime('%s', 'now') as int)), name TEXT, nameUpdated INTEGER, FOREIGN KEY(network_id) REFERENCES network(id));"* ]]
   [[ "${lines[@]}" == *"CREATE TABLE aliasclient (id INTEGER PRIMARY KEY NOT NULL, name TEXT NOT NULL, comment TEXT);"* ]]
-  [[ "${lines[@]}" == *"INSERT INTO ftl VALUES(0,21,'Database version');"* ]]
+  [[ "${lines[@]}" == *"INSERT INTO ftl VALUES(0,24,'Database version');"* ]]
   # vvv This has been added in version 10 vvv
   [[ "${lines[@]}" == *"CREATE VIEW queries AS SELECT id, timestamp, type, status, CASE typeof(domain) WHEN 'integer' THEN (SELECT domain FROM domain_by_id d WHERE d.id = q.domain) ELSE domain END domain,CASE typeof(client) WHEN 'integer' THEN (SELECT ip FROM client_by_id c WHERE c.id = q.client) ELSE client END client,CASE typeof(forward) WHEN 'integer' THEN (SELECT forward FROM forward_by_id f WHERE f.id = q.forward) ELSE forward END forward,CASE typeof(additional_info) WHEN 'integer' THEN (SELECT content FROM addinfo_by_id a WHERE a.id = q.additional_info) ELSE additional_info END additional_info, reply_type, reply_time, dnssec, list_id, ede FROM query_storage q;"* ]]
   [[ "${lines[@]}" == *"CREATE TABLE domain_by_id (id INTEGER PRIMARY KEY, domain TEXT NOT NULL);"* ]]
@@ -706,6 +706,13 @@
   [[ "${lines[@]}" == *"CREATE TABLE session (id INTEGER PRIMARY KEY, login_at TIMESTAMP NOT NULL, valid_until TIMESTAMP NOT NULL, remote_addr TEXT NOT NULL, user_agent TEXT, sid TEXT NOT NULL, csrf TEXT NOT NULL, tls_login BOOL, tls_mixed BOOL, app BOOL, cli BOOL, x_forwarded_for TEXT);"* ]]
   # vvv This has been added in version 20 vvv
   [[ "${lines[@]}" == *"CREATE INDEX network_addresses_network_id_index ON network_addresses (network_id);"* ]]
+  # vvv This has been added in version 22 vvv
+  [[ "${lines[@]}" == *"CREATE INDEX idx_query_storage_client_timestamp ON query_storage (client, timestamp);"* ]]
+  [[ "${lines[@]}" == *"CREATE INDEX idx_query_storage_domain_timestamp ON query_storage (domain, timestamp);"* ]]
+  # vvv This has been added in version 23 vvv
+  [[ "${lines[@]}" == *"CREATE TABLE query_rollup ( period INTEGER NOT NULL, timestamp INTEGER NOT NULL, status INTEGER NOT NULL, type INTEGER NOT NULL, client INTEGER NOT NULL, domain INTEGER NOT NULL, forward INTEGER NOT NULL, count INTEGER NOT NULL, PRIMARY KEY (period, timestamp, status, type, client, domain, forward) ) WITHOUT ROWID;"* ]]
+  # vvv This has been added in version 24 vvv
+  [[ "${lines[@]}" == *"CREATE TABLE list_hits ( list_id INTEGER PRIMARY KEY, hits INTEGER NOT NULL, last_hit INTEGER NOT NULL );"* ]]
 }
 
 @test "Ownership, permissions and type of pihole-FTL.db correct" {
@@ -1156,6 +1163,16 @@
   [[ "${lines[@]}" == *"status: NOERROR"* ]]
 }
 
+@test "Regex Test 54: Benchmark mode matches all domains against all database regex" {
+  run bash -c 'printf "regex1.ftl\n# comment\nregex2.ftl.\nnot-matching.ftl\n" | ./pihole-FTL regex-bench - 2'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ "${lines[@]}" == *"Read 3 domains"* ]]
+  [[ "${lines[@]}" == *"using 2 threads"* ]]
+  [[ "${lines[@]}" == *"Domains matching deny regex: 2, allow regex: 1"* ]]
+  [[ "${lines[@]}" == *"regex[0-9].ftl (deny, DB ID 6)"* ]]
+}
+
 @test "API addresses reported correctly by CHAOS TXT domain.api.ftl" {
   run bash -c 'dig CHAOS TXT domain.api.ftl +short @127.0.0.1'
   printf "dig (full): %s\n" "${lines[@]}"
@@ -1378,6 +1395,24 @@
   [[ "${lines[@]}" == *"EDNS0: CLIENT SUBNET: Skipped ::1/128 (IPv6 loopback address)"* ]]
 }
 
+@test "EDNS(0) parser benchmark and fuzzing mode survives captured and mutated records" {
+  run bash -c 'printf "# ECS + MAC (text)\n00 00 29 10 00 00 00 00 00 00 21 00 08 00 08 00 01 20 00 c0 a8 01 05 fe 31 00 11 61 61 3a 62 62 3a 63 63 3a 64 64 3a 65 65 3a 66 66\n0000290200000000000a000a00080123456789abcdef\n" | ./pihole-FTL edns0-bench - 1000'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ "${lines[@]}" == *"Read 2 records"* ]]
+  [[ "${lines[@]}" == *"Parsed 2000 records (2000 valid)"* ]]
+  [[ "${lines[@]}" == *"Fuzzed 2000 mutated records"* ]]
+}
+
+@test "Domain validation benchmark mode: scalar and vector validators agree" {
+  run bash -c 'printf "# comment\nexample.com\nsub-domain.with-a-long-name.example.org\nlocalhost\na..b.example.com\n-leading-hyphen-in-long-tld.example.com-\nthis-label-is-exactly-sixty-four-characters-long-which-is-too-lo.com\ninvalid!character.in.a.long.domain.example.com\n" | ./pihole-FTL domain-bench -'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ "${lines[@]}" == *"Read 7 domains"* ]]
+  [[ "${lines[@]}" == *"Scalar validator: 2 valid domains"* ]]
+  [[ "${lines[@]}" != *"Validators disagree"* ]]
+}
+
 @test "Embedded SQLite3 shell available and functional" {
   run bash -c './pihole-FTL sqlite3 -help'
   printf "%s\n" "${lines[@]}"
@@ -1721,6 +1756,198 @@
   [[ ${lines[0]} == "145" ]]
 }
 
+@test "API history: Returns 10-second slots for the last hour when requested" {
+  run bash -c 'curl -s "127.0.0.1/api/history?interval=10" | jq ".history | length"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "360" ]]
+}
+
+@test "API history/clients: Returns one-minute slots for the last six hours when requested" {
+  run bash -c 'curl -s "127.0.0.1/api/history/clients?interval=60" | jq ".history | length"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "360" ]]
+}
+
+@test "API info/cache: Flushing the logs removes the cache hits and misses of the queries once" {
+  run bash -c 'curl -s -X POST 127.0.0.1/api/action/flush/logs | jq -r .status'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "success" ]]
+  # The second query is answered from the cache
+  run bash -c "dig A a.ftl @127.0.0.1 +short && dig A a.ftl @127.0.0.1 +short"
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "192.168.1.1" ]]
+  run bash -c 'curl -s "127.0.0.1/api/info/cache?hits=true&count=100" | jq ".cache.domains[] | select(.domain == \"a.ftl\") | .hits + .misses"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "2" ]]
+  run bash -c 'curl -s "127.0.0.1/api/info/cache?count=100" | jq "[.cache.domains[] | select(.hits < 0 or .misses < 0)] | length"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "0" ]]
+}
+
+@test "API history: Flushing the logs does not leave negative counts in the 10-second slots" {
+  # Queries of the current second are not flushed
+  sleep 1
+  run bash -c 'curl -s -X POST 127.0.0.1/api/action/flush/logs | jq -r .status'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "success" ]]
+  run bash -c 'curl -s "127.0.0.1/api/history?interval=10" | jq "[.history[] | select(.total < 0 or .blocked < 0 or .cached < 0 or .forwarded < 0)] | length"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "0" ]]
+}
+
+@test "API info/locks: Lock call sites are profiled and can be reset" {
+  run bash -c 'curl -s 127.0.0.1/api/info/locks | jq ".sites | length > 0"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "true" ]]
+  run bash -c 'curl -s -o /dev/null -w "%{http_code}" -X DELETE 127.0.0.1/api/info/locks'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "204" ]]
+}
+
+@test "API info/memory: Heap memory is attributed to the allocating code" {
+  run bash -c 'curl -s 127.0.0.1/api/info/memory | jq "[.heap.modules[] | select(.file == \"src/config/config.c\")] | length"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "1" ]]
+}
+
+@test "API response cache: Repeated GET requests get the same cached response" {
+  # Background threads may change the data in between, retry a few times
+  for attempt in 1 2 3 4 5; do
+    run bash -c 'for i in 1 2; do curl -s -D - 127.0.0.1/api/stats/summary | tr -d "\r" | grep -i -e "^etag:" -e "^{" | md5sum; done'
+    if [[ ${lines[0]} == "${lines[1]}" ]]; then break; fi
+  done
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "${lines[1]}" ]]
+  run bash -c 'curl -s -D - -o /dev/null 127.0.0.1/api/stats/summary | grep -i "^etag:"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "ETag: \""* ]]
+}
+
+@test "API response cache: Conditional GET requests compare entity tags exactly" {
+  url="127.0.0.1/api/stats/summary"
+  # All requests are sent back to back in the same connection. Background
+  # threads may change the data in between, retry until the ETag is the same
+  # after the requests
+  for attempt in 1 2 3 4 5; do
+    etag="$(curl -s -D - -o /dev/null ${url} | grep -i "^etag:" | cut -d" " -f2 | tr -d "\r")"
+    run bash -c "curl -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: ${etag}' ${url} \
+                  --next -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: \"x\", W/${etag}' ${url} \
+                  --next -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: \"x\"' -H 'If-None-Match: ${etag}' ${url} \
+                  --next -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: *' ${url} \
+                  --next -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: \"x\"' ${url} \
+                  --next -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: x${etag}' ${url} \
+                  --next -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: \"x${etag:1}' ${url} \
+                  --next -s -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: \"x\", *' ${url} \
+                  --next -s -D - -o /dev/null ${url} | tr -d '\r' | grep -i -e '^etag:' -e '^[0-9][0-9]*$'"
+    if [[ ${lines[8]} == "ETag: ${etag}" ]]; then break; fi
+  done
+  printf "ETag: %s\n" "${etag}"
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[8]} == "ETag: ${etag}" ]]
+  # Exact (weak) matches and "*" are not modified
+  [[ ${lines[0]} == "304" ]]
+  [[ ${lines[1]} == "304" ]]
+  [[ ${lines[2]} == "304" ]]
+  [[ ${lines[3]} == "304" ]]
+  # Other tags, values merely containing our tag, and "*" in a list are not
+  # matching
+  [[ ${lines[4]} == "200" ]]
+  [[ ${lines[5]} == "200" ]]
+  [[ ${lines[6]} == "200" ]]
+  [[ ${lines[7]} == "200" ]]
+}
+
+@test "API response cache: New queries invalidate cached responses" {
+  etag="$(curl -s -D - -o /dev/null 127.0.0.1/api/stats/summary | grep -i "^etag:" | cut -d" " -f2 | tr -d "\r")"
+  printf "ETag: %s\n" "${etag}"
+  run bash -c "dig A etag-invalidation.ftl @127.0.0.1 +short"
+  run bash -c "curl -s -D - -o /dev/null -w '%{http_code}\n' -H 'If-None-Match: ${etag}' 127.0.0.1/api/stats/summary | tr -d '\r' | grep -i -e '^etag:' -e '^[0-9][0-9]*$'"
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} != "ETag: ${etag}" ]]
+  [[ ${lines[1]} == "200" ]]
+}
+
+@test "Lookup tables: Colliding elements are found after removals, garbage collection and growth" {
+  # The micro-benchmarks are built for the performance stage
+  bench="$(ls cmake_ci/pihole-FTL-bench cmake/pihole-FTL-bench 2> /dev/null | head -n 1)"
+  if [[ -z "${bench}" ]]; then
+    skip "pihole-FTL-bench not built"
+  fi
+  run bash -c "${bench} -n 256 -r 1 -b none -l 200000 | jq -c '.lookup | [.mismatches, .checks > 0, .capacity_end > .capacity_start]'"
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "[0,true,true]" ]]
+}
+
+@test "Query ring: Queries stay ordered and counted after the ring wrapped around" {
+  # Move the start of the ring close to the end of the buffer: fill the
+  # empty ring almost up to its capacity and flush all but one query of a
+  # new second. An empty ring starts over at the beginning, so the round is
+  # repeated should the second end before the flush
+  batch=200
+  for round in {1..3}; do
+    # Queries of the current second are not flushed
+    sleep 1
+    run bash -c 'curl -s -X POST 127.0.0.1/api/action/flush/logs | jq -r .status'
+    printf "%s\n" "${lines[@]}"
+    [[ ${lines[0]} == "success" ]]
+    capacity="$(curl -s 127.0.0.1/api/info/ftl | jq .ftl.queries.capacity)"
+    for i in $(seq 1 $(( capacity - batch / 2 - 1 ))); do echo "fill${round}-${i}.ftl A"; done > ring.txt
+    dig -f ring.txt @127.0.0.1 +short +tries=1 +time=1 > /dev/null
+    sleep 1
+    dig A "keep${round}.ftl" @127.0.0.1 +short +tries=1 +time=1 > /dev/null
+    curl -s -X POST 127.0.0.1/api/action/flush/logs > /dev/null
+    read -r capacity oldest total <<< "$(curl -s 127.0.0.1/api/info/ftl | jq -r '.ftl.queries | "\(.capacity) \(.oldest) \(.total)"')"
+    if (( total > 0 && capacity - oldest < batch )); then
+      break
+    fi
+  done
+  printf "capacity: %s, oldest: %s, total: %s\n" "${capacity}" "${oldest}" "${total}"
+  [[ ${total} -gt 0 ]]
+  [[ $(( capacity - oldest )) -lt ${batch} ]]
+  for i in $(seq 0 $(( batch - 1 ))); do echo "ring${i}.ftl A"; done > ring.txt
+  dig -f ring.txt @127.0.0.1 +short +tries=1 +time=1 > /dev/null
+  rm -f ring.txt
+  # Wait for the queries to be stored in the in-memory database
+  sleep 2
+  # The queries continue at the beginning of the buffer
+  run bash -c 'curl -s 127.0.0.1/api/info/ftl | jq ".ftl.queries | .oldest + .total > .capacity"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "true" ]]
+  # Newest queries first, in the order they have been sent
+  run bash -c 'curl -s "127.0.0.1/api/queries?domain=ring*.ftl&length=1000" | jq -r ".queries[].domain"'
+  expected="$(for i in $(seq $(( batch - 1 )) -1 0); do echo "ring${i}.ftl"; done)"
+  printf "%s\n" "${lines[0]}" "${lines[-1]}"
+  [[ ${#lines[@]} == "${batch}" ]]
+  [[ "${output}" == "${expected}" ]]
+  run bash -c 'curl -s "127.0.0.1/api/queries?length=10000" | jq "[.queries[] | [.id, .time]] | . as \$q | [range(1; length) | select(\$q[.][0] >= \$q[. - 1][0] or \$q[.][1] > \$q[. - 1][1])] | length"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "0" ]]
+  # The counts of all views agree
+  run bash -c 'curl -s "127.0.0.1/api/queries?length=1" | jq .recordsTotal; curl -s 127.0.0.1/api/stats/summary | jq .queries.total; curl -s 127.0.0.1/api/info/ftl | jq .ftl.queries.total'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "${lines[1]}" ]]
+  [[ ${lines[0]} == "${lines[2]}" ]]
+  [[ ${lines[0]} -ge ${batch} ]]
+}
+
+@test "Query ring: Replies are matched to their queries in recycled slots of the wrapped ring" {
+  # The previous test left the ring wrapped around. The slots behind its end
+  # have been used before and were freed by the garbage collection
+  run bash -c 'curl -s 127.0.0.1/api/info/ftl | jq ".ftl.queries | .oldest + .total > .capacity"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "true" ]]
+  batch=200
+  for i in $(seq 0 $(( batch - 1 ))); do echo "recycled${i}.ftl A"; done > recycled.txt
+  dig -f recycled.txt @127.0.0.1 +short +tries=1 +time=1 > /dev/null
+  rm -f recycled.txt
+  # Wait for the queries to be stored in the in-memory database
+  sleep 2
+  # Forwarding and reply have both been attributed to each query
+  run bash -c 'curl -s "127.0.0.1/api/queries?domain=recycled*.ftl&length=1000" | jq "[.queries[] | select(.status == \"FORWARDED\" and .reply.type != \"UNKNOWN\")] | length"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "${batch}" ]]
+}
+
 @test "Check /api/lists?type=block returning only blocking lists" {
   run bash -c 'curl -s 127.0.0.1/api/lists?type=block | jq ".lists[].type"'
   printf "%s\n" "${lines[@]}"
@@ -1851,6 +2078,11 @@
   [[ ${lines[0]} == 'New dnsmasq configuration is not valid ('*'resolve at line '*' of /etc/pihole/dnsmasq.conf.temp: "rev-server=1.1.1.1,def"), config remains unchanged' ]]
   [[ $status == 3 ]]
 
+  run bash -c './pihole-FTL --config dns.upstreams "[\"1.1.1.1#abc\"]"'
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == 'New upstream servers are not valid ('*' of /etc/pihole/dnsmasq.servers.temp: "server=1.1.1.1#abc"), config remains unchanged' ]]
+  [[ $status == 3 ]]
+
   run bash -c './pihole-FTL --config webserver.api.excludeClients "[\".*\",\"$$$\",\"[[[\"]"'
   printf "%s\n" "${lines[@]}"
   [[ ${lines[0]} == 'Invalid value: webserver.api.excludeClients[2]: not a valid regex ("[[["): Missing '\'']'\' ]]
@@ -1890,7 +2122,7 @@
   # Set app password hash
   run bash -c 'curl -s -X PATCH http://127.0.0.1/api/config/webserver/api/app_pwhash -d  "{\"config\":{\"webserver\":{\"api\":{\"app_pwhash\":${0}}}}}"' "${pwhash}"
   printf "%s\n" "${lines[@]}"
-  [[ ${lines[0]} == "{\"config\":{\"webserver\":{\"api\":{\"app_pwhash\":${pwhash}}}},\"took\":"*"}" ]]
+  [[ ${lines[0]} == "{\"config\":{\"webserver\":{\"api\":{\"app_pwhash\":${pwhash}}}},\"applied\":{\"changed\":[\"webserver.api.app_pwhash\"],\"restart\":false,\"reload_servers\":false},\"took\":"*"}" ]]
 
   # Login using app password is successful
   run bash -c 'curl -s -X POST 127.0.0.1/api/auth -d "{\"password\":${0}}" | jq .session.valid' "${password}"
@@ -1924,7 +2156,7 @@
   # Password: ABC
   run bash -c 'curl -s -X PATCH http://127.0.0.1/api/config/webserver/api/password -d "{\"config\":{\"webserver\":{\"api\":{\"password\":\"ABC\"}}}}"'
   printf "%s\n" "${lines[@]}"
-  [[ ${lines[0]} == "{\"config\":{\"webserver\":{\"api\":{\"password\":\"********\"}}},\"took\":"*"}" ]]
+  [[ ${lines[0]} == "{\"config\":{\"webserver\":{\"api\":{\"password\":\"********\"}}},\"applied\":{\"changed\":[\"webserver.api.password\"],\"restart\":false,\"reload_servers\":false},\"took\":"*"}" ]]
 }
 
 @test "API authorization (with password): Incorrect password is rejected if password auth is enabled" {
@@ -2050,7 +2282,7 @@
   printf "Compression output:\n"
   printf "%s\n" "${lines[@]}"
   [[ $status == 0 ]]
-  [[ ${lines[0]} == "Compressed test/pihole-FTL.db.sql (2.0KB) to test/pihole-FTL.db.sql.gz (689.0B), 66.0% size reduction" ]]
+  [[ ${lines[0]} == "Compressed test/pihole-FTL.db.sql (2.0KB) to test/pihole-FTL.db.sql.gz (677.0B), 66.6% size reduction" ]]
   printf "Uncompress (FTL) output:\n"
   run bash -c './pihole-FTL gzip test/pihole-FTL.db.sql.gz test/pihole-FTL.db.sql.1'
   printf "%s\n" "${lines[@]}"
@@ -2108,6 +2340,15 @@
   [[ ${lines[0]} == "localhost" ]]
 }
 
+@test "DNS load generator reports latency by query status" {
+  run bash -c 'echo "gravity.ftl A" | ./pihole-FTL bench dns -f - -r 20 -t 1'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ "${lines[@]}" == *"Got 1 queries"* ]]
+  [[ "${lines[@]}" == *"received 20 replies"* ]]
+  [[ "${lines[@]}" == *"GRAVITY "* ]]
+}
+
 @test "API validation" {
   run python3 test/api/checkAPI.py
   printf "%s\n" "${lines[@]}"